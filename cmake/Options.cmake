@@ -22,9 +22,13 @@ option(TP_USE_CUDA "Enable support for CUDA tensors" OFF)
 # Transports
 option(TP_ENABLE_IBV "Enable InfiniBand transport" ${LINUX})
 option(TP_ENABLE_SHM "Enable shm transport" ${LINUX})
+option(TP_ENABLE_URING "Enable io_uring transport" ${LINUX})
+option(TP_ENABLE_UDS "Enable UNIX domain socket transport" ${LINUX})
 
 # Channels
 option(TP_ENABLE_CMA "Enable cma channel" ${LINUX})
+cmake_dependent_option(TP_ENABLE_SHM_ARENA "Enable shm_arena channel" ON
+                       "TP_ENABLE_SHM" OFF)
 cmake_dependent_option(TP_ENABLE_CUDA_IPC "Enable CUDA IPC channel" ON
                        "TP_USE_CUDA" OFF)
 
@@ -32,6 +36,8 @@ cmake_dependent_option(TP_ENABLE_CUDA_IPC "Enable CUDA IPC channel" ON
 option(TP_BUILD_BENCHMARK "Build benchmarks" OFF)
 option(TP_BUILD_PYTHON "Build python bindings" OFF)
 option(TP_BUILD_TESTING "Build tests" OFF)
+option(TP_ENABLE_TRACING "Record trace events of pipes, channels and loops" OFF)
+option(TP_ENABLE_USDT "Add USDT probes to pipes, channels and loops" OFF)
 
 # Whether to build a static or shared library
 if(BUILD_SHARED_LIBS)
@@ -0,0 +1,479 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstring>
+
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/benchmark/channel_registry.h>
+#include <tensorpipe/benchmark/measurements.h>
+#include <tensorpipe/benchmark/options.h>
+#include <tensorpipe/benchmark/transport_registry.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/config.h>
+#include <tensorpipe/core/context.h>
+#include <tensorpipe/core/listener.h>
+#include <tensorpipe/core/pipe.h>
+#include <tensorpipe/core/tuning.h>
+#if TENSORPIPE_HAS_SHM_TRANSPORT
+#include <tensorpipe/transport/shm/context.h>
+#endif // TENSORPIPE_HAS_SHM_TRANSPORT
+#include <tensorpipe/transport/sim/context.h>
+
+// Find the knobs that work best between two hosts, for the messages given by
+// the options, by trying their values one knob at a time (keeping the best one
+// of each before moving on to the next) and timing round trips with each. The
+// client drives the search, and tells the server the config of each trial over
+// a control pipe, on a context with the default knobs. Both ends then create a
+// context with that config, the client connects a pipe to the server's, and
+// the server echoes the messages of the client until that pipe is closed.
+//
+// The --channel flag takes a comma-separated list, so that the channels can be
+// ranked too. The recommended config is printed, and written to the file given
+// by --tuning-config, for loadTuningConfig.
+
+using namespace tensorpipe;
+using namespace tensorpipe::benchmark;
+
+// The metadata on the control pipe that starts a trial, followed by its config.
+// The server replies with the URL to connect to for it.
+constexpr char kTrialPrefix[] = "trial\n";
+// The metadata on the control pipe that ends the search.
+constexpr char kDone[] = "done";
+
+// The round trips at the start of each trial that aren't timed, which include
+// the establishment of the pipe and of its channels.
+constexpr int kNumWarmupRoundTrips = 16;
+
+struct Data {
+  std::string metadata;
+  size_t payloadSize{0};
+  std::vector<std::unique_ptr<uint8_t[]>> payloads;
+  size_t tensorSize{0};
+  std::vector<std::unique_ptr<uint8_t[]>> tensors;
+};
+
+static Data createData(const Options& options) {
+  Data data;
+  data.metadata = std::string(options.metadataSize, 0x42);
+  data.payloadSize = options.payloadSize;
+  if (data.payloadSize > 0) {
+    for (size_t idx = 0; idx < options.numPayloads; idx++) {
+      data.payloads.push_back(std::make_unique<uint8_t[]>(data.payloadSize));
+      std::memset(data.payloads.back().get(), 0x42, data.payloadSize);
+    }
+  }
+  data.tensorSize = options.tensorSize;
+  if (data.tensorSize > 0) {
+    for (size_t idx = 0; idx < options.numTensors; idx++) {
+      data.tensors.push_back(std::make_unique<uint8_t[]>(data.tensorSize));
+      std::memset(data.tensors.back().get(), 0x42, data.tensorSize);
+    }
+  }
+  return data;
+}
+
+static Message makeMessage(const Data& data) {
+  Message message;
+  message.metadata = data.metadata;
+  for (const auto& payloadData : data.payloads) {
+    Message::Payload payload;
+    payload.data = payloadData.get();
+    payload.length = data.payloadSize;
+    message.payloads.push_back(std::move(payload));
+  }
+  for (const auto& tensorData : data.tensors) {
+    Message::Tensor tensor;
+    tensor.buffer = CpuBuffer{tensorData.get(), data.tensorSize};
+    message.tensors.push_back(std::move(tensor));
+  }
+  return message;
+}
+
+static void fillInDescriptor(Message& message, const Data& data) {
+  TP_THROW_ASSERT_IF(
+      message.payloads.size() != data.payloads.size() ||
+      message.tensors.size() != data.tensors.size())
+      << "The two ends were given messages of different shapes";
+  for (size_t idx = 0; idx < data.payloads.size(); idx++) {
+    message.payloads[idx].data = data.payloads[idx].get();
+  }
+  for (size_t idx = 0; idx < data.tensors.size(); idx++) {
+    message.tensors[idx].buffer =
+        CpuBuffer{data.tensors[idx].get(), data.tensorSize};
+  }
+}
+
+static Error writeMessage(Pipe& pipe, Message message) {
+  std::promise<Error> errorProm;
+  pipe.write(
+      std::move(message),
+      [&errorProm](const Error& error, Message /* unused */) {
+        errorProm.set_value(error);
+      });
+  return errorProm.get_future().get();
+}
+
+// Read the next message into the buffers of the data.
+static Error readMessage(Pipe& pipe, const Data& data, Message& message) {
+  std::promise<Error> errorProm;
+  pipe.readDescriptor([&](const Error& error, Message descriptor) {
+    if (error) {
+      errorProm.set_value(error);
+      return;
+    }
+    fillInDescriptor(descriptor, data);
+    pipe.read(std::move(descriptor), [&](const Error& error, Message received) {
+      message = std::move(received);
+      errorProm.set_value(error);
+    });
+  });
+  return errorProm.get_future().get();
+}
+
+static void writeMetadata(Pipe& pipe, std::string metadata) {
+  Message message;
+  message.metadata = std::move(metadata);
+  Error error = writeMessage(pipe, std::move(message));
+  TP_THROW_ASSERT_IF(error) << error.what();
+}
+
+static std::string readMetadata(Pipe& pipe) {
+  std::promise<Error> errorProm;
+  std::string metadata;
+  pipe.read(
+      [](Message& /* unused */) {},
+      [&](const Error& error, Message message) {
+        metadata = std::move(message.metadata);
+        errorProm.set_value(error);
+      });
+  Error error = errorProm.get_future().get();
+  TP_THROW_ASSERT_IF(error) << error.what();
+  return metadata;
+}
+
+static std::shared_ptr<Pipe> acceptPipe(Listener& listener) {
+  std::promise<std::shared_ptr<Pipe>> pipeProm;
+  listener.accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+    pipeProm.set_value(std::move(pipe));
+  });
+  return pipeProm.get_future().get();
+}
+
+static std::shared_ptr<transport::Context> createTransportContext(
+    const Options& options,
+    const TuningConfig& config) {
+  std::shared_ptr<transport::Context> transportContext;
+#if TENSORPIPE_HAS_SHM_TRANSPORT
+  if (options.transport == "shm" && config.shmBufferSize > 0) {
+    transportContext = std::make_shared<transport::shm::Context>(
+        transport::shm::ShmOptions().bufferSize(config.shmBufferSize));
+  }
+#endif // TENSORPIPE_HAS_SHM_TRANSPORT
+  if (transportContext == nullptr) {
+    transportContext = TensorpipeTransportRegistry().create(options.transport);
+  }
+  validateTransportContext(transportContext);
+  if (options.simulateLink) {
+    transportContext = std::make_shared<transport::sim::Context>(
+        std::move(transportContext), options.simLink);
+  }
+  return transportContext;
+}
+
+// The channels are registered in the order they were given in, the first one
+// with the highest priority, unless the config ranks them.
+static std::shared_ptr<Context> createContext(
+    const Options& options,
+    const std::vector<std::string>& channels,
+    const TuningConfig& config) {
+  std::shared_ptr<Context> context =
+      std::make_shared<Context>(config.contextOptions(
+          ContextOptions().payloadChecksums(options.payloadChecksums)));
+  context->registerTransport(
+      0, options.transport, createTransportContext(options, config));
+  for (size_t idx = 0; idx < channels.size(); idx++) {
+    auto channelContext = TensorpipeChannelRegistry().create(channels[idx]);
+    validateChannelContext(channelContext);
+    context->registerChannel(
+        config.channelPriority(channels[idx], channels.size() - idx),
+        channels[idx],
+        channelContext);
+  }
+  return context;
+}
+
+// The URL for the server to listen on for a trial: the address of the control
+// pipe, with any port left for the transport to pick, or else with a suffix.
+static std::string trialUrl(const std::string& address, size_t trialIdx) {
+  const size_t schemeEnd = address.find("://");
+  const size_t hostStart = schemeEnd == std::string::npos ? 0 : schemeEnd + 3;
+  const size_t portStart = address.rfind(':');
+  if (portStart != std::string::npos && portStart >= hostStart &&
+      address.find(']', portStart) == std::string::npos) {
+    return address.substr(0, portStart);
+  }
+  return address + ".trial" + std::to_string(trialIdx);
+}
+
+static void runServer(const Options& options) {
+  const std::vector<std::string> channels = splitList(options.channel);
+  Data data = createData(options);
+
+  std::shared_ptr<Context> context =
+      createContext(options, {channels.front()}, TuningConfig());
+  std::shared_ptr<Listener> listener = context->listen({options.address});
+  std::shared_ptr<Pipe> controlPipe = acceptPipe(*listener);
+
+  for (size_t trialIdx = 0;; trialIdx++) {
+    const std::string request = readMetadata(*controlPipe);
+    if (request == kDone) {
+      break;
+    }
+    const size_t prefixLength = std::strlen(kTrialPrefix);
+    TP_THROW_ASSERT_IF(request.compare(0, prefixLength, kTrialPrefix) != 0)
+        << "Unexpected request: " << request;
+    TuningConfig config;
+    Error error = parseTuningConfig(request.substr(prefixLength), config);
+    TP_THROW_ASSERT_IF(error) << error.what();
+
+    std::shared_ptr<Context> trialContext =
+        createContext(options, channels, config);
+    std::shared_ptr<Listener> trialListener =
+        trialContext->listen({trialUrl(options.address, trialIdx)});
+    writeMetadata(*controlPipe, trialListener->url(options.transport));
+
+    // The client closes the pipe once it's done, which fails the next read,
+    // or the write of the last echo if it hadn't completed yet.
+    std::shared_ptr<Pipe> pipe = acceptPipe(*trialListener);
+    while (true) {
+      Message message;
+      if (readMessage(*pipe, data, message) ||
+          writeMessage(*pipe, std::move(message))) {
+        break;
+      }
+    }
+    pipe->close();
+    trialListener.reset();
+    trialContext->join();
+  }
+
+  controlPipe->close();
+  listener.reset();
+  context->join();
+}
+
+// Have the server set up a trial with the config, and time the round trips on
+// a pipe to it.
+static Measurements runTrial(
+    const Options& options,
+    const std::vector<std::string>& channels,
+    Pipe& controlPipe,
+    const TuningConfig& config,
+    const Data& sendData,
+    const Data& recvData) {
+  writeMetadata(controlPipe, kTrialPrefix + formatTuningConfig(config));
+  const std::string url = readMetadata(controlPipe);
+
+  std::shared_ptr<Context> context = createContext(options, channels, config);
+  std::shared_ptr<Pipe> pipe = context->connect(url, config.pipeOptions());
+  Measurements measurements;
+  for (int idx = 0; idx < kNumWarmupRoundTrips + options.numRoundTrips;
+       idx++) {
+    if (idx >= kNumWarmupRoundTrips) {
+      measurements.markStart();
+    }
+    Error error = writeMessage(*pipe, makeMessage(sendData));
+    TP_THROW_ASSERT_IF(error) << error.what();
+    Message message;
+    error = readMessage(*pipe, recvData, message);
+    TP_THROW_ASSERT_IF(error) << error.what();
+    if (idx >= kNumWarmupRoundTrips) {
+      measurements.markStop();
+    }
+  }
+  pipe->close();
+  context->join();
+  return measurements;
+}
+
+// A knob takes each of its values in turn, which are set on the best config so
+// far. The first value is the default one.
+struct Knob {
+  std::string name;
+  std::vector<std::string> labels;
+  std::function<void(TuningConfig&, size_t)> setValue;
+};
+
+static Knob sizeKnob(
+    std::string name,
+    size_t TuningConfig::*field,
+    std::vector<size_t> values) {
+  Knob knob;
+  knob.name = std::move(name);
+  for (size_t value : values) {
+    knob.labels.push_back(std::to_string(value));
+  }
+  knob.setValue = [field, values](TuningConfig& config, size_t valueIdx) {
+    config.*field = values[valueIdx];
+  };
+  return knob;
+}
+
+// Only the knobs that may make a difference for the messages are tried.
+static std::vector<Knob> getKnobs(
+    const Options& options,
+    const std::vector<std::string>& channels) {
+  const bool hasPayloads = options.numPayloads > 0 && options.payloadSize > 0;
+  const bool hasTensors = options.numTensors > 0 && options.tensorSize > 0;
+  std::vector<Knob> knobs;
+  if (hasTensors && channels.size() > 1) {
+    // Each value has one of the channels take precedence over all the others,
+    // which keep their order.
+    Knob knob;
+    knob.name = "channel_priority";
+    knob.labels = channels;
+    knob.setValue = [channels](TuningConfig& config, size_t valueIdx) {
+      for (size_t idx = 0; idx < channels.size(); idx++) {
+        config.channelPriorities[channels[idx]] =
+            idx == valueIdx ? channels.size() : channels.size() - idx - 1;
+      }
+    };
+    knobs.push_back(std::move(knob));
+  }
+  if (hasTensors) {
+    knobs.push_back(sizeKnob(
+        "inline_tensor_threshold",
+        &TuningConfig::inlineTensorThreshold,
+        {0, 4096, 65536}));
+  }
+  if (hasPayloads && !hasTensors) {
+    knobs.push_back(sizeKnob(
+        "inline_payload_threshold",
+        &TuningConfig::inlinePayloadThreshold,
+        {0, 1024, 16384}));
+  }
+  knobs.push_back(sizeKnob(
+      "read_ahead_window", &TuningConfig::readAheadWindow, {0, 4, 16}));
+  {
+    Knob knob;
+    knob.name = "multiplex_channel_connections";
+    knob.labels = {"0", "1"};
+    knob.setValue = [](TuningConfig& config, size_t valueIdx) {
+      config.multiplexChannelConnections = valueIdx == 1;
+    };
+    knobs.push_back(std::move(knob));
+  }
+#if TENSORPIPE_HAS_SHM_TRANSPORT
+  if (options.transport == "shm") {
+    knobs.push_back(sizeKnob(
+        "shm_buffer_size",
+        &TuningConfig::shmBufferSize,
+        {0, 256 * 1024, 16 * 1024 * 1024}));
+  }
+#endif // TENSORPIPE_HAS_SHM_TRANSPORT
+  return knobs;
+}
+
+static void printMeasurements(
+    const std::string& label,
+    const Measurements& measurements) {
+  const auto toUs = [](std::chrono::nanoseconds duration) {
+    return duration.count() / 1000.0;
+  };
+  std::cout << label << ": avg "
+            << toUs(measurements.sum()) / measurements.size() << "us, p50 "
+            << toUs(measurements.percentile(0.50)) << "us, p99 "
+            << toUs(measurements.percentile(0.99)) << "us\n";
+}
+
+static void runClient(const Options& options) {
+  const std::vector<std::string> channels = splitList(options.channel);
+  Data sendData = createData(options);
+  Data recvData = createData(options);
+
+  std::shared_ptr<Context> context =
+      createContext(options, {channels.front()}, TuningConfig());
+  std::shared_ptr<Pipe> controlPipe = context->connect(options.address);
+
+  // The score of a config is the mean round trip time, and a value only
+  // replaces the best one so far if it's strictly better, hence ties keep the
+  // defaults.
+  TuningConfig bestConfig;
+  Measurements bestMeasurements = runTrial(
+      options, channels, *controlPipe, bestConfig, sendData, recvData);
+  printMeasurements("defaults", bestMeasurements);
+  for (const Knob& knob : getKnobs(options, channels)) {
+    const TuningConfig startConfig = bestConfig;
+    for (size_t valueIdx = 0; valueIdx < knob.labels.size(); valueIdx++) {
+      TuningConfig config = startConfig;
+      knob.setValue(config, valueIdx);
+      if (formatTuningConfig(config) == formatTuningConfig(bestConfig)) {
+        continue;
+      }
+      Measurements measurements = runTrial(
+          options, channels, *controlPipe, config, sendData, recvData);
+      printMeasurements(
+          knob.name + " = " + knob.labels[valueIdx], measurements);
+      if (measurements.sum().count() / measurements.size() <
+          bestMeasurements.sum().count() / bestMeasurements.size()) {
+        bestConfig = std::move(config);
+        bestMeasurements = std::move(measurements);
+      }
+    }
+  }
+  writeMetadata(*controlPipe, kDone);
+
+  const std::string text = formatTuningConfig(bestConfig);
+  printMeasurements("recommended", bestMeasurements);
+  std::cout << text;
+  if (!options.tuningConfigPath.empty()) {
+    std::ofstream file(options.tuningConfigPath);
+    file << text;
+    TP_THROW_ASSERT_IF(!file) << "Couldn't write " << options.tuningConfigPath;
+  }
+
+  controlPipe->close();
+  context->join();
+}
+
+int main(int argc, char** argv) {
+  struct Options x = parseOptions(argc, argv);
+  std::cout << "mode = " << x.mode << "\n";
+  std::cout << "transport = " << x.transport << "\n";
+  std::cout << "channel = " << x.channel << "\n";
+  std::cout << "address = " << x.address << "\n";
+  std::cout << "num_round_trips = " << x.numRoundTrips << "\n";
+  std::cout << "num_payloads = " << x.numPayloads << "\n";
+  std::cout << "payload_size = " << x.payloadSize << "\n";
+  std::cout << "num_tensors = " << x.numTensors << "\n";
+  std::cout << "tensor_size = " << x.tensorSize << "\n";
+  std::cout << "metadata_size = " << x.metadataSize << "\n";
+  std::cout << "tuning_config = " << x.tuningConfigPath << "\n";
+
+  TP_THROW_ASSERT_IF(x.tensorType != "cpu")
+      << "Only CPU tensors can be tuned for";
+  TP_THROW_ASSERT_IF(x.channel.empty()) << "--channel must be set";
+  if (x.mode == "listen") {
+    runServer(x);
+  } else if (x.mode == "connect") {
+    runClient(x);
+  } else {
+    // Should never be here
+    TP_THROW_ASSERT() << "unknown mode: " << x.mode;
+  }
+
+  return 0;
+}
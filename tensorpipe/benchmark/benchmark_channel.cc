@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdlib>
+#include <cstring>
+
+#include <chrono>
+#include <future>
+
+#include <tensorpipe/benchmark/channel_registry.h>
+#include <tensorpipe/benchmark/cpu_usage.h>
+#include <tensorpipe/benchmark/measurements.h>
+#include <tensorpipe/benchmark/options.h>
+#include <tensorpipe/benchmark/results.h>
+#include <tensorpipe/benchmark/transport_registry.h>
+#include <tensorpipe/channel/channel.h>
+#include <tensorpipe/common/cpu_buffer.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/trace.h>
+#include <tensorpipe/transport/connection.h>
+#include <tensorpipe/transport/listener.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::benchmark;
+
+// The channel is driven directly, without a pipe: its descriptors travel on a
+// control connection of the transport, and the channel itself gets a
+// connection of its own for each channel context that is benchmarked.
+
+struct Data {
+  std::unique_ptr<uint8_t[]> expected;
+  std::unique_ptr<uint8_t[]> temporary;
+  size_t size;
+};
+
+static void printMeasurements(
+    const Options& options,
+    const std::string& channelName,
+    const Measurements& measurements,
+    size_t dataLen,
+    std::chrono::nanoseconds elapsed) {
+  const double seconds = std::chrono::duration<double>(elapsed).count();
+  // Each round trip moves the data once in each direction.
+  const double gbps = 2 * measurements.size() * dataLen * 8 / seconds / 1e9;
+  fprintf(
+      stderr,
+      "%-15s %-15s %-15s %-12s %-9s %-9s %-9s %-9s %-9s %-12s\n",
+      "channel",
+      "chunk-size",
+      "# ping-pong",
+      "avg (usec)",
+      "p50",
+      "p90",
+      "p99",
+      "p99.9",
+      "max",
+      "Gb/s");
+  fprintf(
+      stderr,
+      "%-15s %-15lu %-15lu %-12.3f %-9.3f %-9.3f %-9.3f %-9.3f %-9.3f "
+      "%-12.3f\n",
+      channelName.c_str(),
+      dataLen,
+      measurements.size(),
+      measurements.sum().count() / (float)measurements.size() / 1000.0,
+      measurements.percentile(0.50).count() / 1000.0,
+      measurements.percentile(0.90).count() / 1000.0,
+      measurements.percentile(0.99).count() / 1000.0,
+      measurements.percentile(0.999).count() / 1000.0,
+      measurements.max().count() / 1000.0,
+      gbps);
+  exportMeasurements(
+      measurements,
+      options.transport + "/" + channelName + "/" + std::to_string(dataLen),
+      options.csvPath,
+      options.jsonPath);
+}
+
+static std::unique_ptr<uint8_t[]> createData(const size_t size) {
+  auto data = std::make_unique<uint8_t[]>(size);
+  // Generate fixed data for validation between peers
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (i >> 8) ^ (i & 0xff);
+  }
+  return data;
+}
+
+static std::shared_ptr<channel::CpuContext> createChannelContext(
+    const std::string& channelName) {
+  std::shared_ptr<channel::CpuContext> context =
+      TensorpipeChannelRegistry().create(channelName);
+  validateChannelContext(context);
+  return context;
+}
+
+// Hand the descriptor of a send to the peer, which needs it for the recv.
+static void writeDescriptor(
+    const std::shared_ptr<transport::Connection>& controlConn,
+    channel::TDescriptor descriptor) {
+  auto descriptorHolder =
+      std::make_shared<channel::TDescriptor>(std::move(descriptor));
+  controlConn->write(
+      descriptorHolder->data(),
+      descriptorHolder->size(),
+      [descriptorHolder](const Error& error) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+      });
+}
+
+// Receive the ping, described by a descriptor that comes on the control
+// connection, then send it back as a pong.
+static void serverPongPingNonBlock(
+    std::shared_ptr<channel::CpuChannel> channel,
+    std::shared_ptr<transport::Connection> controlConn,
+    int& numRoundTrips,
+    std::promise<void>& doneProm,
+    Data& data) {
+  controlConn->read([channel, controlConn, &numRoundTrips, &doneProm, &data](
+                        const Error& error, const void* ptr, size_t len) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+    channel->recv(
+        channel::TDescriptor(static_cast<const char*>(ptr), len),
+        CpuBuffer{data.temporary.get(), data.size},
+        [channel, controlConn, &numRoundTrips, &doneProm, &data](
+            const Error& error) {
+          TP_THROW_ASSERT_IF(error) << error.what();
+          TP_DCHECK_EQ(
+              memcmp(data.temporary.get(), data.expected.get(), data.size), 0);
+          channel->send(
+              CpuBuffer{data.temporary.get(), data.size},
+              [controlConn](
+                  const Error& error, channel::TDescriptor descriptor) {
+                TP_THROW_ASSERT_IF(error) << error.what();
+                writeDescriptor(controlConn, std::move(descriptor));
+              },
+              [channel, controlConn, &numRoundTrips, &doneProm, &data](
+                  const Error& error) {
+                TP_THROW_ASSERT_IF(error) << error.what();
+                if (--numRoundTrips > 0) {
+                  serverPongPingNonBlock(
+                      channel, controlConn, numRoundTrips, doneProm, data);
+                } else {
+                  doneProm.set_value();
+                }
+              });
+        });
+  });
+}
+
+static std::shared_ptr<transport::Connection> accept(
+    const std::shared_ptr<transport::Listener>& listener) {
+  std::promise<std::shared_ptr<transport::Connection>> connProm;
+  listener->accept(
+      [&](const Error& error, std::shared_ptr<transport::Connection> conn) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        connProm.set_value(std::move(conn));
+      });
+  return connProm.get_future().get();
+}
+
+static std::string readString(
+    const std::shared_ptr<transport::Connection>& conn) {
+  std::promise<std::string> stringProm;
+  conn->read([&](const Error& error, const void* ptr, size_t len) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+    stringProm.set_value(std::string(static_cast<const char*>(ptr), len));
+  });
+  return stringProm.get_future().get();
+}
+
+static void writeString(
+    const std::shared_ptr<transport::Connection>& conn,
+    const std::string& str) {
+  std::promise<void> doneProm;
+  conn->write(str.data(), str.size(), [&](const Error& error) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+    doneProm.set_value();
+  });
+  doneProm.get_future().get();
+}
+
+// Start with receiving ping
+static void runServer(const Options& options) {
+  Data data = {
+      createData(options.tensorSize),
+      std::make_unique<uint8_t[]>(options.tensorSize),
+      options.tensorSize};
+
+  std::shared_ptr<transport::Context> context;
+  context = TensorpipeTransportRegistry().create(options.transport);
+  validateTransportContext(context);
+
+  std::shared_ptr<transport::Listener> listener =
+      context->listen(options.address);
+  std::shared_ptr<transport::Connection> controlConn = accept(listener);
+  // Let the client know that the control connection was accepted, so that
+  // the next one it opens is the one of the first channel.
+  writeString(controlConn, "hello");
+
+  for (const std::string& channelName : splitList(options.channel)) {
+    std::shared_ptr<channel::CpuContext> channelContext =
+        createChannelContext(channelName);
+    TP_THROW_ASSERT_IF(
+        readString(controlConn) != channelContext->domainDescriptor())
+        << "the domain descriptors of the " << channelName
+        << " channels of the two peers don't match";
+    std::shared_ptr<channel::CpuChannel> channel =
+        channelContext->createChannel(
+            accept(listener), channel::Endpoint::kListen);
+
+    int numRoundTrips = options.numRoundTrips;
+    std::promise<void> doneProm;
+    serverPongPingNonBlock(
+        std::move(channel), controlConn, numRoundTrips, doneProm, data);
+    doneProm.get_future().get();
+    // Tell the client that the channel can be torn down.
+    writeString(controlConn, "done");
+
+    channelContext->join();
+  }
+
+  context->join();
+}
+
+// Send the ping, whose descriptor goes on the control connection, then
+// receive the pong.
+static void clientPingPongNonBlock(
+    std::shared_ptr<channel::CpuChannel> channel,
+    std::shared_ptr<transport::Connection> controlConn,
+    int& numRoundTrips,
+    std::promise<void>& doneProm,
+    Data& data,
+    Measurements& measurements) {
+  measurements.markStart();
+  channel->send(
+      CpuBuffer{data.expected.get(), data.size},
+      [controlConn](const Error& error, channel::TDescriptor descriptor) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        writeDescriptor(controlConn, std::move(descriptor));
+      },
+      [](const Error& error) { TP_THROW_ASSERT_IF(error) << error.what(); });
+  controlConn->read([channel,
+                     controlConn,
+                     &numRoundTrips,
+                     &doneProm,
+                     &data,
+                     &measurements](
+                        const Error& error, const void* ptr, size_t len) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+    channel->recv(
+        channel::TDescriptor(static_cast<const char*>(ptr), len),
+        CpuBuffer{data.temporary.get(), data.size},
+        [channel, controlConn, &numRoundTrips, &doneProm, &data, &measurements](
+            const Error& error) {
+          measurements.markStop();
+          TP_THROW_ASSERT_IF(error) << error.what();
+          TP_DCHECK_EQ(
+              memcmp(data.temporary.get(), data.expected.get(), data.size), 0);
+          if (--numRoundTrips > 0) {
+            clientPingPongNonBlock(
+                channel,
+                controlConn,
+                numRoundTrips,
+                doneProm,
+                data,
+                measurements);
+          } else {
+            doneProm.set_value();
+          }
+        });
+  });
+}
+
+// Start with sending ping
+static void runClient(const Options& options) {
+  Data data = {
+      createData(options.tensorSize),
+      std::make_unique<uint8_t[]>(options.tensorSize),
+      options.tensorSize};
+
+  std::shared_ptr<transport::Context> context;
+  context = TensorpipeTransportRegistry().create(options.transport);
+  validateTransportContext(context);
+
+  std::shared_ptr<transport::Connection> controlConn =
+      context->connect(options.address);
+  readString(controlConn);
+
+  for (const std::string& channelName : splitList(options.channel)) {
+    std::shared_ptr<channel::CpuContext> channelContext =
+        createChannelContext(channelName);
+    writeString(controlConn, channelContext->domainDescriptor());
+    std::shared_ptr<channel::CpuChannel> channel =
+        channelContext->createChannel(
+            context->connect(options.address), channel::Endpoint::kConnect);
+
+    Measurements measurements;
+    int numRoundTrips = options.numRoundTrips;
+    std::promise<void> doneProm;
+    const CpuTimes startCpuTimes = getCpuTimes();
+    const auto startTime = Measurements::clock::now();
+    clientPingPongNonBlock(
+        std::move(channel),
+        controlConn,
+        numRoundTrips,
+        doneProm,
+        data,
+        measurements);
+    doneProm.get_future().get();
+    const auto doneTime = Measurements::clock::now();
+    const CpuTimes stopCpuTimes = getCpuTimes();
+    printMeasurements(
+        options, channelName, measurements, data.size, doneTime - startTime);
+    printCpuUsage(
+        startCpuTimes,
+        stopCpuTimes,
+        2 * options.numRoundTrips * data.size,
+        2 * options.numRoundTrips);
+    Options runOptions = options;
+    runOptions.channel = channelName;
+    exportResults(
+        options.resultsPath,
+        "channel",
+        options.transport + "/" + channelName + "/" + std::to_string(data.size),
+        runOptions,
+        measurements,
+        doneTime - startTime,
+        data.size,
+        computeCpuUsage(startCpuTimes, stopCpuTimes));
+    readString(controlConn);
+
+    channelContext->join();
+  }
+
+  context->join();
+}
+
+int main(int argc, char** argv) {
+  struct Options x = parseOptions(argc, argv);
+  std::cout << "mode = " << x.mode << "\n";
+  std::cout << "transport = " << x.transport << "\n";
+  std::cout << "channel = " << x.channel << "\n";
+  std::cout << "address = " << x.address << "\n";
+  std::cout << "num_round_trips = " << x.numRoundTrips << "\n";
+  std::cout << "tensor_size = " << x.tensorSize << "\n";
+
+  if (x.channel.empty() || x.tensorSize == 0) {
+    fprintf(
+        stderr,
+        "Missing argument: --channel and --tensor-size must be set\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (x.mode == "listen") {
+    runServer(x);
+  } else if (x.mode == "connect") {
+    runClient(x);
+  } else {
+    // Should never be here
+    TP_THROW_ASSERT() << "unknown mode: " << x.mode;
+  }
+
+  if (!x.tracePath.empty()) {
+    trace::writeChromeTrace(x.tracePath);
+  }
+
+  return 0;
+}
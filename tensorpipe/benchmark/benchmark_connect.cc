@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdlib>
+#include <cstring>
+
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <vector>
+
+#include <tensorpipe/benchmark/channel_registry.h>
+#include <tensorpipe/benchmark/measurements.h>
+#include <tensorpipe/benchmark/options.h>
+#include <tensorpipe/benchmark/transport_registry.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/trace.h>
+#include <tensorpipe/core/context.h>
+#include <tensorpipe/core/listener.h>
+#include <tensorpipe/core/pipe.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::benchmark;
+
+// The client opens --num-pipes pipes at once, --num-round-trips times, and
+// measures how long it takes for each of them to get its first message, which
+// the server writes as soon as it accepts the pipe. That message carries a
+// tensor of --tensor-size bytes, if set, so that the channel that is selected
+// also has to be ready. All the (comma-separated) channels of --channel are
+// registered, the first one having the highest priority, as they're all
+// advertised, and get a connection each, whether they're used or not.
+
+struct Data {
+  std::unique_ptr<uint8_t[]> expected;
+  size_t size;
+};
+
+static std::shared_ptr<Context> createContext(const Options& options) {
+  std::shared_ptr<Context> context =
+      std::make_shared<Context>(ContextOptions().collectStats(true));
+  auto transportContext =
+      TensorpipeTransportRegistry().create(options.transport);
+  validateTransportContext(transportContext);
+  context->registerTransport(0, options.transport, transportContext);
+
+  const std::vector<std::string> channels = splitList(options.channel);
+  for (size_t channelIdx = 0; channelIdx < channels.size(); channelIdx++) {
+    auto channelContext =
+        TensorpipeChannelRegistry().create(channels[channelIdx]);
+    validateChannelContext(channelContext);
+    context->registerChannel(
+        channels.size() - channelIdx, channels[channelIdx], channelContext);
+  }
+
+  return context;
+}
+
+static std::unique_ptr<uint8_t[]> createData(const size_t size) {
+  auto data = std::make_unique<uint8_t[]>(size);
+  // Generate fixed data for validation between peers
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (i >> 8) ^ (i & 0xff);
+  }
+  return data;
+}
+
+static void printPhase(const std::string& name, const DurationHistogram& h) {
+  // The percentiles are the upper edges of power-of-two buckets.
+  fprintf(
+      stderr,
+      "%-30s %-12lu %-12.3f %-12.3f %-12.3f %-12.3f\n",
+      name.c_str(),
+      h.count(),
+      h.mean().count() / 1000.0,
+      h.percentile(0.50).count() / 1000.0,
+      h.percentile(0.99).count() / 1000.0,
+      h.max().count() / 1000.0);
+}
+
+static void printPhasesHeader() {
+  fprintf(
+      stderr,
+      "%-30s %-12s %-12s %-12s %-12s %-12s\n",
+      "phase",
+      "# pipes",
+      "avg (usec)",
+      "p50 (<=)",
+      "p99 (<=)",
+      "max");
+}
+
+static void runServer(const Options& options) {
+  Data data = {createData(options.tensorSize), options.tensorSize};
+  std::shared_ptr<Context> context = createContext(options);
+  const int numPipesToAccept = options.numPipes * options.numRoundTrips;
+
+  std::mutex mutex;
+  std::vector<std::shared_ptr<Pipe>> pipes;
+  std::atomic<int> numMessagesLeft{numPipesToAccept};
+  std::promise<void> doneProm;
+  std::shared_ptr<Listener> listener = context->listen({options.address});
+  std::function<void(const Error&, std::shared_ptr<Pipe>)> acceptFn;
+  acceptFn = [&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+    Message message;
+    if (data.size > 0) {
+      Message::Tensor tensor;
+      tensor.buffer = CpuBuffer{data.expected.get(), data.size};
+      message.tensors.push_back(std::move(tensor));
+    }
+    pipe->write(
+        std::move(message),
+        [&](const Error& /* unused */, Message&& /* unused */) {
+          // The client may close the pipe as soon as it has read the message,
+          // before the channel got an acknowledgement of it, hence an error
+          // doesn't mean that the message didn't get through.
+          if (--numMessagesLeft == 0) {
+            doneProm.set_value();
+          }
+        });
+    std::unique_lock<std::mutex> lock(mutex);
+    pipes.push_back(std::move(pipe));
+    if (pipes.size() < static_cast<size_t>(numPipesToAccept)) {
+      listener->accept(acceptFn);
+    }
+  };
+  listener->accept(acceptFn);
+
+  doneProm.get_future().get();
+  const PipeStats stats = context->getStats();
+  printPhasesHeader();
+  printPhase("brochure read", stats.acceptBrochureRead);
+  printPhase("established", stats.acceptEstablished);
+
+  listener.reset();
+  context->join();
+}
+
+static void runClient(const Options& options) {
+  Data data = {createData(options.tensorSize), options.tensorSize};
+  std::shared_ptr<Context> context = createContext(options);
+
+  // One buffer for each of the pipes that are open at once.
+  std::vector<std::unique_ptr<uint8_t[]>> temporary;
+  for (int pipeIdx = 0; pipeIdx < options.numPipes; pipeIdx++) {
+    temporary.push_back(std::make_unique<uint8_t[]>(data.size));
+  }
+
+  std::mutex mutex;
+  Measurements measurements;
+  for (int roundIdx = 0; roundIdx < options.numRoundTrips; roundIdx++) {
+    std::vector<std::shared_ptr<Pipe>> pipes;
+    std::vector<std::promise<void>> doneProms(options.numPipes);
+    for (int pipeIdx = 0; pipeIdx < options.numPipes; pipeIdx++) {
+      const Measurements::clock::time_point start =
+          Measurements::clock::now();
+      std::shared_ptr<Pipe> pipe = context->connect(options.address);
+      pipe->readDescriptor([&, pipe, pipeIdx, start](
+                               const Error& error, Message&& message) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        for (Message::Tensor& tensor : message.tensors) {
+          TP_DCHECK_EQ(tensor.buffer.cpu.length, data.size);
+          tensor.buffer.cpu.ptr = temporary[pipeIdx].get();
+        }
+        pipe->read(
+            std::move(message),
+            [&, pipeIdx, start](const Error& error, Message&& /* unused */) {
+              TP_THROW_ASSERT_IF(error) << error.what();
+              std::unique_lock<std::mutex> lock(mutex);
+              measurements.markStop(start);
+              TP_DCHECK_EQ(
+                  memcmp(
+                      temporary[pipeIdx].get(), data.expected.get(), data.size),
+                  0);
+              doneProms[pipeIdx].set_value();
+            });
+      });
+      pipes.push_back(std::move(pipe));
+    }
+    for (auto& doneProm : doneProms) {
+      doneProm.get_future().get();
+    }
+    for (auto& pipe : pipes) {
+      pipe->close();
+    }
+  }
+
+  fprintf(
+      stderr,
+      "%-15s %-15s %-12s %-9s %-9s %-9s %-9s %-9s\n",
+      "# pipes",
+      "# rounds",
+      "avg (usec)",
+      "p50",
+      "p90",
+      "p99",
+      "p99.9",
+      "max");
+  fprintf(
+      stderr,
+      "%-15d %-15d %-12.3f %-9.3f %-9.3f %-9.3f %-9.3f %-9.3f\n",
+      options.numPipes,
+      options.numRoundTrips,
+      measurements.sum().count() / (float)measurements.size() / 1000.0,
+      measurements.percentile(0.50).count() / 1000.0,
+      measurements.percentile(0.90).count() / 1000.0,
+      measurements.percentile(0.99).count() / 1000.0,
+      measurements.percentile(0.999).count() / 1000.0,
+      measurements.max().count() / 1000.0);
+  exportMeasurements(
+      measurements,
+      options.transport + "/" + options.channel + "/" +
+          std::to_string(options.numPipes),
+      options.csvPath,
+      options.jsonPath);
+
+  const PipeStats stats = context->getStats();
+  printPhasesHeader();
+  printPhase("brochure answer read", stats.connectBrochureAnswerRead);
+  printPhase("established", stats.connectEstablished);
+
+  context->join();
+}
+
+int main(int argc, char** argv) {
+  struct Options x = parseOptions(argc, argv);
+  std::cout << "mode = " << x.mode << "\n";
+  std::cout << "transport = " << x.transport << "\n";
+  std::cout << "channel = " << x.channel << "\n";
+  std::cout << "address = " << x.address << "\n";
+  std::cout << "num_round_trips = " << x.numRoundTrips << "\n";
+  std::cout << "num_pipes = " << x.numPipes << "\n";
+  std::cout << "tensor_size = " << x.tensorSize << "\n";
+
+  if (x.channel.empty()) {
+    fprintf(stderr, "Missing argument: --channel must be set\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (x.mode == "listen") {
+    runServer(x);
+  } else if (x.mode == "connect") {
+    runClient(x);
+  } else {
+    // Should never be here
+    TP_THROW_ASSERT() << "unknown mode: " << x.mode;
+  }
+
+  if (!x.tracePath.empty()) {
+    trace::writeChromeTrace(x.tracePath);
+  }
+
+  return 0;
+}
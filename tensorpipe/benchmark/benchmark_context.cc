@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/benchmark/channel_registry.h>
+#include <tensorpipe/benchmark/options.h>
+#include <tensorpipe/benchmark/transport_registry.h>
+#include <tensorpipe/config.h>
+#include <tensorpipe/core/context.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::benchmark;
+
+// Creates --num-contexts contexts, one after the other, registering with each
+// of them all the (comma-separated) transports of --transport, channels of
+// --channel and CUDA channels of --cuda-channel, and then joins it. It reports
+// how long each step took for the first context, which pays for probing the
+// system and the devices, and on average for the following ones, which get the
+// results of those probes that are cached for the whole process.
+
+namespace {
+
+struct ContextBenchmarkOptions {
+  std::string transports{"uv"};
+  std::string channels{"basic"};
+  std::string cudaChannels;
+  size_t numContexts{10};
+};
+
+void usage(int status, const char* argv0) {
+  if (status != EXIT_SUCCESS) {
+    fprintf(stderr, "`%s --help' for more information.\n", argv0);
+    exit(status);
+  }
+
+  fprintf(stderr, "Usage: %s [OPTIONS]\n", argv0);
+#define X(x) fputs(x "\n", stderr);
+  X("");
+  X("--transport=TRANSPORTS        Transports to register [uv,shm,ibv]");
+  X("--channel=CHANNELS            Channels to register [basic,xth,cma,...]");
+  X("--cuda-channel=CHANNELS       CUDA channels to register [cuda_xth,...]");
+  X("--num-contexts=NUM            Number of contexts to create");
+#undef X
+
+  exit(status);
+}
+
+ContextBenchmarkOptions parseContextBenchmarkOptions(int argc, char** argv) {
+  ContextBenchmarkOptions options;
+  int opt;
+  int flag = -1;
+
+  enum Flags : int {
+    TRANSPORT,
+    CHANNEL,
+    CUDA_CHANNEL,
+    NUM_CONTEXTS,
+    HELP,
+  };
+
+  static struct option longOptions[] = {
+      {"transport", required_argument, &flag, TRANSPORT},
+      {"channel", required_argument, &flag, CHANNEL},
+      {"cuda-channel", required_argument, &flag, CUDA_CHANNEL},
+      {"num-contexts", required_argument, &flag, NUM_CONTEXTS},
+      {"help", no_argument, &flag, HELP},
+      {nullptr, 0, nullptr, 0}};
+
+  while (1) {
+    opt = getopt_long(argc, argv, "", longOptions, nullptr);
+    if (opt == -1) {
+      break;
+    }
+    if (opt != 0) {
+      usage(EXIT_FAILURE, argv[0]);
+      break;
+    }
+    switch (flag) {
+      case TRANSPORT:
+        options.transports = std::string(optarg, strlen(optarg));
+        break;
+      case CHANNEL:
+        options.channels = std::string(optarg, strlen(optarg));
+        break;
+      case CUDA_CHANNEL:
+        options.cudaChannels = std::string(optarg, strlen(optarg));
+        break;
+      case NUM_CONTEXTS:
+        options.numContexts = std::strtoull(optarg, nullptr, 10);
+        break;
+      case HELP:
+        usage(EXIT_SUCCESS, argv[0]);
+        break;
+      default:
+        usage(EXIT_FAILURE, argv[0]);
+        break;
+    }
+  }
+
+  if (options.numContexts == 0) {
+    fprintf(stderr, "The number of contexts must be positive\n");
+    usage(EXIT_FAILURE, argv[0]);
+  }
+#if !TENSORPIPE_SUPPORTS_CUDA
+  if (!options.cudaChannels.empty()) {
+    fprintf(stderr, "Invalid argument: TensorPipe was built without CUDA\n");
+    usage(EXIT_FAILURE, argv[0]);
+  }
+#endif // !TENSORPIPE_SUPPORTS_CUDA
+
+  return options;
+}
+
+// How long each step took, in the order in which they're run, for one context.
+struct Steps {
+  std::vector<std::string> names;
+  std::vector<std::chrono::steady_clock::duration> durations;
+
+  void add(std::string name, std::chrono::steady_clock::time_point start) {
+    names.push_back(std::move(name));
+    durations.push_back(std::chrono::steady_clock::now() - start);
+  }
+};
+
+Steps createAndJoinContext(const ContextBenchmarkOptions& options) {
+  Steps steps;
+
+  auto start = std::chrono::steady_clock::now();
+  auto context = std::make_shared<Context>();
+  steps.add("context", start);
+
+  const std::vector<std::string> transports = splitList(options.transports);
+  for (size_t idx = 0; idx < transports.size(); idx++) {
+    start = std::chrono::steady_clock::now();
+    auto transportContext =
+        TensorpipeTransportRegistry().create(transports[idx]);
+    validateTransportContext(transportContext);
+    context->registerTransport(
+        transports.size() - idx, transports[idx], transportContext);
+    steps.add("transport " + transports[idx], start);
+  }
+
+  const std::vector<std::string> channels = splitList(options.channels);
+  for (size_t idx = 0; idx < channels.size(); idx++) {
+    start = std::chrono::steady_clock::now();
+    auto channelContext = TensorpipeChannelRegistry().create(channels[idx]);
+    validateChannelContext(channelContext);
+    context->registerChannel(
+        channels.size() - idx, channels[idx], channelContext);
+    steps.add("channel " + channels[idx], start);
+  }
+
+#if TENSORPIPE_SUPPORTS_CUDA
+  const std::vector<std::string> cudaChannels =
+      splitList(options.cudaChannels);
+  for (size_t idx = 0; idx < cudaChannels.size(); idx++) {
+    start = std::chrono::steady_clock::now();
+    auto channelContext =
+        TensorpipeCudaChannelRegistry().create(cudaChannels[idx]);
+    validateCudaChannelContext(channelContext);
+    context->registerChannel(
+        cudaChannels.size() - idx, cudaChannels[idx], channelContext);
+    steps.add("cuda channel " + cudaChannels[idx], start);
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+  start = std::chrono::steady_clock::now();
+  context->join();
+  steps.add("join", start);
+
+  return steps;
+}
+
+double toMicroseconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  ContextBenchmarkOptions options = parseContextBenchmarkOptions(argc, argv);
+
+  std::vector<Steps> allSteps;
+  for (size_t contextIdx = 0; contextIdx < options.numContexts; contextIdx++) {
+    allSteps.push_back(createAndJoinContext(options));
+  }
+
+  fprintf(stderr, "%-30s %-15s %-15s\n", "step", "first (usec)", "others");
+  const Steps& firstSteps = allSteps.front();
+  std::chrono::steady_clock::duration firstTotal{0};
+  std::chrono::steady_clock::duration othersTotal{0};
+  for (size_t stepIdx = 0; stepIdx < firstSteps.names.size(); stepIdx++) {
+    std::chrono::steady_clock::duration others{0};
+    for (size_t contextIdx = 1; contextIdx < allSteps.size(); contextIdx++) {
+      others += allSteps[contextIdx].durations[stepIdx];
+    }
+    firstTotal += firstSteps.durations[stepIdx];
+    othersTotal += others;
+    fprintf(
+        stderr,
+        "%-30s %-15.3f %-15.3f\n",
+        firstSteps.names[stepIdx].c_str(),
+        toMicroseconds(firstSteps.durations[stepIdx]),
+        allSteps.size() > 1 ? toMicroseconds(others) / (allSteps.size() - 1)
+                            : 0.0);
+  }
+  fprintf(
+      stderr,
+      "%-30s %-15.3f %-15.3f\n",
+      "total",
+      toMicroseconds(firstTotal),
+      allSteps.size() > 1 ? toMicroseconds(othersTotal) / (allSteps.size() - 1)
+                          : 0.0);
+
+  return 0;
+}
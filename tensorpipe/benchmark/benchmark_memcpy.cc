@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/common/memcpy.h>
+
+using namespace tensorpipe;
+
+// Copies --size bytes --num-iters times, between buffers that are used in turn
+// from a pool of --num-buffers ones (so that, if the pool is larger than the
+// last level cache, the copies come from and go to memory), with the regular
+// memcpy and with the non-temporal stores of copyMemoryNonTemporal. After each
+// copy it reads through a working set of --working-set-size bytes, which the
+// copies evict from the caches unless they use non-temporal stores, and reports
+// how long that took too.
+
+namespace {
+
+struct Options {
+  size_t size{4 * 1024 * 1024};
+  size_t numIters{100};
+  size_t numBuffers{16};
+  size_t workingSetSize{1024 * 1024};
+};
+
+void usage(int status, const char* argv0) {
+  if (status != EXIT_SUCCESS) {
+    fprintf(stderr, "`%s --help' for more information.\n", argv0);
+    exit(status);
+  }
+
+  fprintf(stderr, "Usage: %s [OPTIONS]\n", argv0);
+#define X(x) fputs(x "\n", stderr);
+  X("");
+  X("--size=SIZE                   Size of each copy, in bytes");
+  X("--num-iters=NUM               Number of copies");
+  X("--num-buffers=NUM             Number of source and destination buffers");
+  X("--working-set-size=SIZE       Size of the data read after each copy");
+#undef X
+
+  exit(status);
+}
+
+Options parseOptions(int argc, char** argv) {
+  Options options;
+  int opt;
+  int flag = -1;
+
+  enum Flags : int {
+    SIZE,
+    NUM_ITERS,
+    NUM_BUFFERS,
+    WORKING_SET_SIZE,
+    HELP,
+  };
+
+  static struct option longOptions[] = {
+      {"size", required_argument, &flag, SIZE},
+      {"num-iters", required_argument, &flag, NUM_ITERS},
+      {"num-buffers", required_argument, &flag, NUM_BUFFERS},
+      {"working-set-size", required_argument, &flag, WORKING_SET_SIZE},
+      {"help", no_argument, &flag, HELP},
+      {nullptr, 0, nullptr, 0}};
+
+  while (1) {
+    opt = getopt_long(argc, argv, "", longOptions, nullptr);
+    if (opt == -1) {
+      break;
+    }
+    if (opt != 0) {
+      usage(EXIT_FAILURE, argv[0]);
+      break;
+    }
+    switch (flag) {
+      case SIZE:
+        options.size = std::strtoull(optarg, nullptr, 10);
+        break;
+      case NUM_ITERS:
+        options.numIters = std::strtoull(optarg, nullptr, 10);
+        break;
+      case NUM_BUFFERS:
+        options.numBuffers = std::strtoull(optarg, nullptr, 10);
+        break;
+      case WORKING_SET_SIZE:
+        options.workingSetSize = std::strtoull(optarg, nullptr, 10);
+        break;
+      case HELP:
+        usage(EXIT_SUCCESS, argv[0]);
+        break;
+      default:
+        usage(EXIT_FAILURE, argv[0]);
+        break;
+    }
+  }
+
+  if (options.size == 0 || options.numIters == 0 || options.numBuffers == 0) {
+    fprintf(stderr, "Size, iterations and buffers must be positive\n");
+    usage(EXIT_FAILURE, argv[0]);
+  }
+
+  return options;
+}
+
+using TCopyFn = void (*)(void*, const void*, size_t);
+
+// Where the sum of the working set goes, so that its reads are not elided.
+volatile uint64_t sink;
+
+void copyWithMemcpy(void* dst, const void* src, size_t length) {
+  std::memcpy(dst, src, length);
+}
+
+void runBenchmark(
+    const std::string& name,
+    TCopyFn copyFn,
+    const Options& options) {
+  std::vector<std::vector<uint8_t>> srcs(
+      options.numBuffers, std::vector<uint8_t>(options.size, 42));
+  std::vector<std::vector<uint8_t>> dsts(
+      options.numBuffers, std::vector<uint8_t>(options.size, 0));
+  std::vector<uint64_t> workingSet(options.workingSetSize / sizeof(uint64_t));
+  uint64_t sum = 0;
+
+  std::chrono::steady_clock::duration copyTime{0};
+  std::chrono::steady_clock::duration readTime{0};
+  for (size_t iterIdx = 0; iterIdx < options.numIters; iterIdx++) {
+    const size_t bufferIdx = iterIdx % options.numBuffers;
+    auto start = std::chrono::steady_clock::now();
+    copyFn(dsts[bufferIdx].data(), srcs[bufferIdx].data(), options.size);
+    auto middle = std::chrono::steady_clock::now();
+    for (uint64_t value : workingSet) {
+      sum += value;
+    }
+    auto end = std::chrono::steady_clock::now();
+    copyTime += middle - start;
+    readTime += end - middle;
+  }
+  sink = sum;
+
+  double copySeconds = std::chrono::duration<double>(copyTime).count();
+  double readSeconds = std::chrono::duration<double>(readTime).count();
+  fprintf(
+      stderr,
+      "%-10s copy %10.3f GB/s, working set read %10.3f us/iter\n",
+      name.c_str(),
+      options.numIters * options.size / copySeconds / 1e9,
+      readSeconds / options.numIters * 1e6);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options options = parseOptions(argc, argv);
+
+  fprintf(
+      stderr,
+      "%zu copies of %zu bytes among %zu buffers, working set of %zu bytes, "
+      "non-temporal stores with %s\n",
+      options.numIters,
+      options.size,
+      options.numBuffers,
+      options.workingSetSize,
+      getNonTemporalCopyImplementation());
+
+  runBenchmark("memcpy", copyWithMemcpy, options);
+  runBenchmark("streaming", copyMemoryNonTemporal, options);
+
+  return 0;
+}
@@ -0,0 +1,477 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <tensorpipe/benchmark/measurements.h>
+#include <tensorpipe/common/busy_polling_loop.h>
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/epoll_loop.h>
+#include <tensorpipe/common/nop.h>
+#include <tensorpipe/core/nop_types.h>
+#include <tensorpipe/util/ringbuffer/consumer.h>
+#include <tensorpipe/util/ringbuffer/producer.h>
+#include <tensorpipe/util/ringbuffer/ringbuffer.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::benchmark;
+
+// Measures the building blocks of the library in isolation, to validate the
+// changes to them without the noise of a whole pipe or transport benchmark:
+// - the nop serialization of message descriptors, by number of tensors, and of
+//   brochures, by number of channels;
+// - the ringbuffer, with the producer and the consumer on the same thread and
+//   on two threads pinned to --producer-cpu and --consumer-cpu;
+// - the throughput of deferToLoop with 1 to 16 producer threads;
+// - the overhead of wrapping a callback with runIfAlive;
+// - the latency of the EpollLoop between an eventfd becoming readable and the
+//   call to its handler.
+// Each case runs --num-ops operations (or round trips, for the latency) and
+// those whose name doesn't contain --filter, if given, are skipped.
+
+namespace {
+
+struct MicroBenchmarkOptions {
+  size_t numOps{1000000};
+  std::string filter;
+  int producerCpu{0};
+  int consumerCpu{1};
+};
+
+void usage(int status, const char* argv0) {
+  if (status != EXIT_SUCCESS) {
+    fprintf(stderr, "`%s --help' for more information.\n", argv0);
+    exit(status);
+  }
+
+  fprintf(stderr, "Usage: %s [OPTIONS]\n", argv0);
+#define X(x) fputs(x "\n", stderr);
+  X("");
+  X("--num-ops=NUM                 Number of operations of each case");
+  X("--filter=STRING               Only run the cases whose name contains it");
+  X("--producer-cpu=CPU            CPU to pin the ringbuffer producer to");
+  X("--consumer-cpu=CPU            CPU to pin the ringbuffer consumer to");
+#undef X
+
+  exit(status);
+}
+
+MicroBenchmarkOptions parseMicroBenchmarkOptions(int argc, char** argv) {
+  MicroBenchmarkOptions options;
+  int opt;
+  int flag = -1;
+
+  enum Flags : int {
+    NUM_OPS,
+    FILTER,
+    PRODUCER_CPU,
+    CONSUMER_CPU,
+    HELP,
+  };
+
+  static struct option longOptions[] = {
+      {"num-ops", required_argument, &flag, NUM_OPS},
+      {"filter", required_argument, &flag, FILTER},
+      {"producer-cpu", required_argument, &flag, PRODUCER_CPU},
+      {"consumer-cpu", required_argument, &flag, CONSUMER_CPU},
+      {"help", no_argument, &flag, HELP},
+      {nullptr, 0, nullptr, 0}};
+
+  while (1) {
+    opt = getopt_long(argc, argv, "", longOptions, nullptr);
+    if (opt == -1) {
+      break;
+    }
+    if (opt != 0) {
+      usage(EXIT_FAILURE, argv[0]);
+      break;
+    }
+    switch (flag) {
+      case NUM_OPS:
+        options.numOps = std::strtoull(optarg, nullptr, 10);
+        break;
+      case FILTER:
+        options.filter = std::string(optarg, strlen(optarg));
+        break;
+      case PRODUCER_CPU:
+        options.producerCpu = std::strtol(optarg, nullptr, 10);
+        break;
+      case CONSUMER_CPU:
+        options.consumerCpu = std::strtol(optarg, nullptr, 10);
+        break;
+      case HELP:
+        usage(EXIT_SUCCESS, argv[0]);
+        break;
+      default:
+        usage(EXIT_FAILURE, argv[0]);
+        break;
+    }
+  }
+
+  if (options.numOps == 0) {
+    fprintf(stderr, "The number of operations must be positive\n");
+    usage(EXIT_FAILURE, argv[0]);
+  }
+
+  return options;
+}
+
+void pinToCpu(int cpu) {
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  CPU_SET(cpu, &cpuSet);
+  int rv = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+  if (rv != 0) {
+    fprintf(stderr, "Couldn't pin to CPU %d: %s\n", cpu, strerror(rv));
+  }
+}
+
+// Keeps the compiler from optimizing away the work whose result is unused.
+template <typename T>
+void doNotOptimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Run the case if it's selected, and report its throughput, that is, the
+// number of operations divided by the time the function took to run them all.
+void runThroughputCase(
+    const MicroBenchmarkOptions& options,
+    const std::string& name,
+    const std::function<void(size_t)>& fn) {
+  if (name.find(options.filter) == std::string::npos) {
+    return;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  fn(options.numOps);
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  fprintf(
+      stderr,
+      "%-40s %12.3f Mops/s %12.3f ns/op\n",
+      name.c_str(),
+      options.numOps / seconds / 1e6,
+      seconds * 1e9 / options.numOps);
+}
+
+MessageDescriptor makeMessageDescriptor(size_t numTensors) {
+  MessageDescriptor descriptor;
+  descriptor.metadata = "metadata";
+  descriptor.payloadDescriptors.resize(1);
+  descriptor.payloadDescriptors[0].sizeInBytes = 1024;
+  descriptor.payloadDescriptors[0].compression = PayloadCompression::kNone;
+  descriptor.payloadDescriptors[0].segmented = false;
+  for (size_t tensorIdx = 0; tensorIdx < numTensors; tensorIdx++) {
+    MessageDescriptor::TensorDescriptor tensorDescriptor;
+    tensorDescriptor.sizeInBytes = 1024 * 1024;
+    tensorDescriptor.deviceType = DeviceType::kCpu;
+    tensorDescriptor.channelName = "basic";
+    tensorDescriptor.channelDescriptor = "descriptor";
+    tensorDescriptor.checksum = 0;
+    tensorDescriptor.handoffId = 0;
+    tensorDescriptor.dedup = TensorDedup::kNone;
+    tensorDescriptor.dedupHash = 0;
+    descriptor.tensorDescriptors.push_back(std::move(tensorDescriptor));
+  }
+  descriptor.hasChecksums = false;
+  descriptor.handsOffTensors = false;
+  descriptor.coalescesCudaTensors = false;
+  return descriptor;
+}
+
+Brochure makeBrochure(size_t numChannels) {
+  Brochure brochure;
+  brochure.transportAdvertisement["uv"].domainDescriptor = "uv";
+  brochure.transportAdvertisement["shm"].domainDescriptor = "shm:boot-id";
+  for (size_t channelIdx = 0; channelIdx < numChannels; channelIdx++) {
+    brochure.cpuChannelAdvertisement["channel" + std::to_string(channelIdx)]
+        .domainDescriptor = "domain-descriptor";
+  }
+  brochure.multiplexChannelConnections = false;
+  brochure.messageDescriptorVersion = 0;
+  brochure.processIdentifier = 0;
+  brochure.hostIdentifier = "boot-id";
+  brochure.tensorDedupThreshold = 0;
+  brochure.tensorDedupCacheCapacity = 0;
+  return brochure;
+}
+
+// Write the object and read it back, once per operation.
+template <typename T>
+void serializeAndDeserialize(const T& object, size_t numOps) {
+  NopHolder<T> holder;
+  holder.getObject() = object;
+  std::vector<uint8_t> buffer(holder.getSize());
+  for (size_t opIdx = 0; opIdx < numOps; opIdx++) {
+    NopWriter writer(buffer.data(), buffer.size());
+    nop::Status<void> status = holder.write(writer);
+    TP_DCHECK(!status.has_error());
+    NopHolder<T> otherHolder;
+    NopReader reader(buffer.data(), buffer.size());
+    status = otherHolder.read(reader);
+    TP_DCHECK(!status.has_error());
+    doNotOptimize(otherHolder.getObject());
+  }
+}
+
+constexpr size_t kRingBufferSize = 1 << 16;
+constexpr size_t kRingBufferMessageSize = 8;
+
+void ringBufferSameThread(size_t numOps) {
+  util::ringbuffer::RingBufferHeader header(kRingBufferSize);
+  auto data = std::make_unique<uint8_t[]>(header.kDataPoolByteSize);
+  util::ringbuffer::RingBuffer rb(&header, data.get());
+  uint8_t message[kRingBufferMessageSize] = {};
+  util::ringbuffer::SingleProducer producer(rb);
+  util::ringbuffer::SingleConsumer consumer(rb);
+  for (size_t opIdx = 0; opIdx < numOps; opIdx++) {
+    ssize_t ret = producer.write(message, sizeof(message));
+    TP_DCHECK_EQ(ret, sizeof(message));
+    ret = consumer.read(message, sizeof(message));
+    TP_DCHECK_EQ(ret, sizeof(message));
+  }
+}
+
+void ringBufferAcrossThreads(const MicroBenchmarkOptions& options, size_t n) {
+  util::ringbuffer::RingBufferHeader header(kRingBufferSize);
+  auto data = std::make_unique<uint8_t[]>(header.kDataPoolByteSize);
+  util::ringbuffer::RingBuffer rb(&header, data.get());
+
+  std::thread consumerThread([&]() {
+    pinToCpu(options.consumerCpu);
+    uint8_t message[kRingBufferMessageSize];
+    util::ringbuffer::SingleConsumer consumer(rb);
+    for (size_t opIdx = 0; opIdx < n;) {
+      if (consumer.read(message, sizeof(message)) > 0) {
+        opIdx++;
+      }
+    }
+  });
+
+  pinToCpu(options.producerCpu);
+  {
+    uint8_t message[kRingBufferMessageSize] = {};
+    util::ringbuffer::SingleProducer producer(rb);
+    for (size_t opIdx = 0; opIdx < n;) {
+      if (producer.write(message, sizeof(message)) > 0) {
+        opIdx++;
+      }
+    }
+  }
+  consumerThread.join();
+}
+
+// A loop with nothing to poll, which merely runs the deferred functions, and
+// which goes to sleep as soon as it's idle, as the loops of the transports do
+// when there is no traffic.
+class IdleLoop final : public BusyPollingLoop {
+ public:
+  IdleLoop()
+      : BusyPollingLoop(std::chrono::microseconds(0), std::chrono::seconds(1)) {
+    startThread("TP_bench_loop");
+  }
+
+  ~IdleLoop() {
+    stopBusyPolling();
+    joinThread();
+  }
+
+ protected:
+  bool pollOnce() override {
+    return false;
+  }
+
+  bool readyToClose() override {
+    return true;
+  }
+};
+
+void deferToLoopFromProducers(size_t numProducers, size_t numOps) {
+  IdleLoop loop;
+  std::atomic<size_t> numRun{0};
+  std::vector<std::thread> producers;
+  for (size_t producerIdx = 0; producerIdx < numProducers; producerIdx++) {
+    producers.emplace_back([&, producerIdx]() {
+      const size_t begin = numOps * producerIdx / numProducers;
+      const size_t end = numOps * (producerIdx + 1) / numProducers;
+      for (size_t opIdx = begin; opIdx < end; opIdx++) {
+        loop.deferToLoop(
+            [&]() { numRun.fetch_add(1, std::memory_order_relaxed); });
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  while (numRun.load(std::memory_order_relaxed) < numOps) {
+    std::this_thread::yield();
+  }
+}
+
+class Subject : public std::enable_shared_from_this<Subject> {
+ public:
+  uint64_t value{0};
+};
+
+void callPlainCallbacks(size_t numOps) {
+  auto subject = std::make_shared<Subject>();
+  std::function<void(uint64_t)> fn = [subject](uint64_t value) {
+    subject->value += value;
+  };
+  for (size_t opIdx = 0; opIdx < numOps; opIdx++) {
+    fn(opIdx);
+  }
+  doNotOptimize(subject->value);
+}
+
+void callRunIfAliveCallbacks(size_t numOps) {
+  auto subject = std::make_shared<Subject>();
+  std::function<void(uint64_t)> fn =
+      runIfAlive(*subject, [](Subject& subject, uint64_t value) {
+        subject.value += value;
+      });
+  for (size_t opIdx = 0; opIdx < numOps; opIdx++) {
+    fn(opIdx);
+  }
+  doNotOptimize(subject->value);
+}
+
+void wrapAndCallRunIfAliveCallbacks(size_t numOps) {
+  auto subject = std::make_shared<Subject>();
+  for (size_t opIdx = 0; opIdx < numOps; opIdx++) {
+    std::function<void(uint64_t)> fn =
+        runIfAlive(*subject, [](Subject& subject, uint64_t value) {
+          subject.value += value;
+        });
+    fn(opIdx);
+  }
+  doNotOptimize(subject->value);
+}
+
+// Records when the eventfd was seen readable, for the writer to measure how
+// long it took and to wait for it before the next round trip.
+class EventFdHandler final : public EpollLoop::EventHandler {
+ public:
+  explicit EventFdHandler(int fd) : fd_(fd) {}
+
+  void handleEventsFromLoop(int /* unused */) override {
+    uint64_t value;
+    ssize_t ret = ::read(fd_, &value, sizeof(value));
+    TP_DCHECK_EQ(ret, sizeof(value));
+    numHandled.fetch_add(1, std::memory_order_release);
+  }
+
+  std::atomic<size_t> numHandled{0};
+
+ private:
+  const int fd_;
+};
+
+void runEpollLoopWakeupCase(
+    const MicroBenchmarkOptions& options,
+    const std::string& name,
+    bool integrated) {
+  if (name.find(options.filter) == std::string::npos) {
+    return;
+  }
+  IdleLoop loop;
+  std::unique_ptr<EpollLoop> epollLoop = integrated
+      ? std::make_unique<EpollLoop>(static_cast<BusyPollingLoop&>(loop))
+      : std::make_unique<EpollLoop>(static_cast<DeferredExecutor&>(loop));
+  Fd fd(::eventfd(0, EFD_NONBLOCK));
+  TP_THROW_SYSTEM_IF(fd.fd() < 0, errno);
+  auto handler = std::make_shared<EventFdHandler>(fd.fd());
+  loop.runInLoop([&]() {
+    epollLoop->registerDescriptor(fd.fd(), EPOLLIN, handler);
+  });
+
+  // The loop falls asleep between two round trips, as the next one only starts
+  // once the handler is done, hence each of them measures a wakeup.
+  Measurements measurements;
+  for (size_t opIdx = 0; opIdx < options.numOps; opIdx++) {
+    const uint64_t value = 1;
+    measurements.markStart();
+    ssize_t ret = ::write(fd.fd(), &value, sizeof(value));
+    TP_DCHECK_EQ(ret, sizeof(value));
+    while (handler->numHandled.load(std::memory_order_acquire) <= opIdx) {
+    }
+    measurements.markStop();
+  }
+
+  loop.runInLoop([&]() { epollLoop->unregisterDescriptor(fd.fd()); });
+  epollLoop->join();
+
+  fprintf(
+      stderr,
+      "%-40s p50 %9.3f us  p99 %9.3f us  max %9.3f us\n",
+      name.c_str(),
+      measurements.percentile(0.50).count() / 1e3,
+      measurements.percentile(0.99).count() / 1e3,
+      measurements.max().count() / 1e3);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  MicroBenchmarkOptions options = parseMicroBenchmarkOptions(argc, argv);
+
+  for (size_t numTensors : {0, 1, 4, 16, 64, 256}) {
+    const MessageDescriptor descriptor = makeMessageDescriptor(numTensors);
+    runThroughputCase(
+        options,
+        "nop/message_descriptor/" + std::to_string(numTensors),
+        [&](size_t numOps) { serializeAndDeserialize(descriptor, numOps); });
+  }
+  for (size_t numChannels : {1, 4, 16}) {
+    const Brochure brochure = makeBrochure(numChannels);
+    runThroughputCase(
+        options, "nop/brochure/" + std::to_string(numChannels), [&](size_t n) {
+          serializeAndDeserialize(brochure, n);
+        });
+  }
+
+  runThroughputCase(options, "ringbuffer/same_thread", ringBufferSameThread);
+  runThroughputCase(options, "ringbuffer/across_cpus", [&](size_t numOps) {
+    ringBufferAcrossThreads(options, numOps);
+  });
+
+  for (size_t numProducers : {1, 2, 4, 8, 16}) {
+    runThroughputCase(
+        options,
+        "defer_to_loop/" + std::to_string(numProducers),
+        [&](size_t numOps) { deferToLoopFromProducers(numProducers, numOps); });
+  }
+
+  runThroughputCase(options, "callback/plain", callPlainCallbacks);
+  runThroughputCase(options, "callback/run_if_alive", callRunIfAliveCallbacks);
+  runThroughputCase(
+      options, "callback/wrap_run_if_alive", wrapAndCallRunIfAliveCallbacks);
+
+  runEpollLoopWakeupCase(options, "epoll_loop/wakeup", /*integrated=*/false);
+  runEpollLoopWakeupCase(
+      options, "epoll_loop/wakeup_integrated", /*integrated=*/true);
+
+  return 0;
+}
@@ -6,62 +6,223 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <cstdlib>
 #include <cstring>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <future>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
 
 #include <tensorpipe/benchmark/channel_registry.h>
+#include <tensorpipe/benchmark/cpu_usage.h>
 #include <tensorpipe/benchmark/measurements.h>
 #include <tensorpipe/benchmark/options.h>
+#include <tensorpipe/benchmark/results.h>
 #include <tensorpipe/benchmark/transport_registry.h>
 #include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/trace.h>
+#if TENSORPIPE_SUPPORTS_CUDA
+#include <tensorpipe/common/cuda.h>
+#endif // TENSORPIPE_SUPPORTS_CUDA
 #include <tensorpipe/core/context.h>
 #include <tensorpipe/core/listener.h>
 #include <tensorpipe/core/pipe.h>
+#include <tensorpipe/transport/sim/context.h>
 
 using namespace tensorpipe;
 using namespace tensorpipe::benchmark;
 
-Measurements measurements;
+using TClock = Measurements::clock;
 
+// Count the heap allocations performed by the whole process (by replacing the
+// global allocation functions) in order to report how many of them, on
+// average, each round trip incurs.
+static std::atomic<uint64_t> numAllocations{0};
+
+void* operator new(size_t size) {
+  numAllocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+#if TENSORPIPE_SUPPORTS_CUDA
+struct CudaDeleter {
+  void operator()(uint8_t* ptr) {
+    TP_CUDA_CHECK(cudaFree(ptr));
+  }
+};
+
+using CudaPtr = std::unique_ptr<uint8_t, CudaDeleter>;
+
+struct CudaStreamDeleter {
+  void operator()(cudaStream_t stream) {
+    TP_CUDA_CHECK(cudaStreamDestroy(stream));
+  }
+};
+
+using CudaStream =
+    std::unique_ptr<std::remove_pointer_t<cudaStream_t>, CudaStreamDeleter>;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+// The data that the messages are made of, and that is checked upon receiving
+// them, which is shared by all the pipes.
 struct Data {
   size_t numPayloads;
   size_t payloadSize;
   std::vector<std::unique_ptr<uint8_t[]>> expectedPayload;
   std::vector<std::string> expectedPayloadMetadata;
-  std::vector<std::unique_ptr<uint8_t[]>> temporaryPayload;
 
   size_t numTensors;
   size_t tensorSize;
   std::vector<std::unique_ptr<uint8_t[]>> expectedTensor;
   std::vector<std::string> expectedTensorMetadata;
-  std::vector<std::unique_ptr<uint8_t[]>> temporaryTensor;
+
+  // With CUDA tensors, the expected ones above are copied to the device, and
+  // all the tensors of this process go through the same stream.
+  bool cudaTensors{false};
+#if TENSORPIPE_SUPPORTS_CUDA
+  int cudaDevice{0};
+  CudaStream cudaStream;
+  std::vector<CudaPtr> expectedCudaTensor;
+#endif // TENSORPIPE_SUPPORTS_CUDA
 
   std::string expectedMetadata;
 };
 
-static void printMeasurements(Measurements& measurements, size_t dataLen) {
-  measurements.sort();
+// The memory that a message is received into. Each pipe has one of these for
+// each of the round trips it may have in flight.
+struct Slot {
+  std::vector<std::unique_ptr<uint8_t[]>> temporaryPayload;
+  std::vector<std::unique_ptr<uint8_t[]>> temporaryTensor;
+#if TENSORPIPE_SUPPORTS_CUDA
+  std::vector<CudaPtr> temporaryCudaTensor;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+};
+
+struct PipeState {
+  std::shared_ptr<Pipe> pipe;
+  std::vector<Slot> slots;
+  int numWritesLeft;
+  int numReadsLeft;
+  int64_t nextSlotIdx{0};
+  // The moments at which the round trips in flight started, oldest first.
+  std::deque<TClock::time_point> startTimes;
+  Measurements measurements;
+  TClock::time_point doneTime;
+  std::promise<void> doneProm;
+};
+
+// The label under which the results of a run are exported.
+static std::string runLabel(const Options& options, size_t dataLen) {
+  const std::string& channel =
+      options.tensorType == "cuda" ? options.cudaChannel : options.channel;
+  return options.transport + "/" + channel + "/" + std::to_string(dataLen);
+}
+
+static void printMeasurements(
+    const Options& options,
+    const Measurements& measurements,
+    size_t dataLen,
+    uint64_t numAllocs) {
   fprintf(
       stderr,
-      "%-15s %-15s %-12s %-7s %-7s %-7s %-7s\n",
+      "%-15s %-15s %-12s %-9s %-9s %-9s %-9s %-9s %-7s\n",
       "chunk-size",
       "# ping-pong",
       "avg (usec)",
       "p50",
-      "p75",
       "p90",
-      "p95");
+      "p99",
+      "p99.9",
+      "max",
+      "allocs");
   fprintf(
       stderr,
-      "%-15lu %-15lu %-12.3f %-7.3f %-7.3f %-7.3f %-7.3f\n",
+      "%-15lu %-15lu %-12.3f %-9.3f %-9.3f %-9.3f %-9.3f %-9.3f %-7.1f\n",
       dataLen,
       measurements.size(),
       measurements.sum().count() / (float)measurements.size() / 1000.0,
       measurements.percentile(0.50).count() / 1000.0,
-      measurements.percentile(0.75).count() / 1000.0,
       measurements.percentile(0.90).count() / 1000.0,
-      measurements.percentile(0.95).count() / 1000.0);
+      measurements.percentile(0.99).count() / 1000.0,
+      measurements.percentile(0.999).count() / 1000.0,
+      measurements.max().count() / 1000.0,
+      numAllocs / (float)measurements.size());
+  exportMeasurements(
+      measurements,
+      runLabel(options, dataLen),
+      options.csvPath,
+      options.jsonPath);
+}
+
+// Report the throughput of all the pipes together, counting the data that went
+// each way, and return it in Gb/s.
+static double printThroughput(
+    const Options& options,
+    size_t numRoundTrips,
+    size_t bytesPerMessage,
+    std::chrono::nanoseconds elapsed) {
+  const double seconds = std::chrono::duration<double>(elapsed).count();
+  const double gbps = 2 * numRoundTrips * bytesPerMessage * 8 / seconds / 1e9;
+  fprintf(
+      stderr,
+      "%-15s %-15s %-15s %-12s %-12s\n",
+      "# pipes",
+      "window",
+      "# threads",
+      "Gb/s",
+      "msg/s");
+  fprintf(
+      stderr,
+      "%-15d %-15d %-15d %-12.3f %-12.1f\n",
+      options.numPipes,
+      options.window,
+      options.numClientThreads,
+      gbps,
+      numRoundTrips / seconds);
+  return gbps;
+}
+
+// Print the bandwidth, in Gb/s, that each channel achieved for each size.
+static void printBandwidthMatrix(
+    const std::vector<std::string>& channels,
+    const std::vector<size_t>& sizes,
+    const std::vector<std::vector<double>>& gbps) {
+  auto formatSize = [](size_t size) {
+    const char* units[] = {"B", "KiB", "MiB", "GiB"};
+    int unitIdx = 0;
+    while (size >= 1024 && size % 1024 == 0 && unitIdx < 3) {
+      size /= 1024;
+      unitIdx++;
+    }
+    return std::to_string(size) + units[unitIdx];
+  };
+
+  fprintf(stderr, "%-15s", "Gb/s");
+  for (size_t size : sizes) {
+    fprintf(stderr, " %-9s", formatSize(size).c_str());
+  }
+  fprintf(stderr, "\n");
+  for (size_t channelIdx = 0; channelIdx < channels.size(); channelIdx++) {
+    fprintf(stderr, "%-15s", channels[channelIdx].c_str());
+    for (double value : gbps[channelIdx]) {
+      fprintf(stderr, " %-9.3f", value);
+    }
+    fprintf(stderr, "\n");
+  }
 }
 
 static std::unique_ptr<uint8_t[]> createData(const int size) {
@@ -73,111 +234,27 @@ static std::unique_ptr<uint8_t[]> createData(const int size) {
   return data;
 }
 
-static void serverPongPingNonBlock(
-    std::shared_ptr<Pipe> pipe,
-    int& numRoundTrips,
-    std::promise<void>& doneProm,
-    Data& data,
-    Measurements& measurements) {
-  pipe->readDescriptor([pipe, &numRoundTrips, &doneProm, &data, &measurements](
-                           const Error& error, Message&& message) {
-    TP_THROW_ASSERT_IF(error) << error.what();
-    TP_DCHECK_EQ(message.metadata, data.expectedMetadata);
-    if (data.payloadSize > 0) {
-      TP_DCHECK_EQ(message.payloads.size(), data.numPayloads);
-      for (size_t payloadIdx = 0; payloadIdx < data.numPayloads; payloadIdx++) {
-        TP_DCHECK_EQ(
-            message.payloads[payloadIdx].metadata,
-            data.expectedPayloadMetadata[payloadIdx]);
-        TP_DCHECK_EQ(message.payloads[payloadIdx].length, data.payloadSize);
-        message.payloads[payloadIdx].data =
-            data.temporaryPayload[payloadIdx].get();
-      }
-    } else {
-      TP_DCHECK_EQ(message.payloads.size(), 0);
-    }
-    if (data.tensorSize > 0) {
-      TP_DCHECK_EQ(message.tensors.size(), data.numTensors);
-      for (size_t tensorIdx = 0; tensorIdx < data.numTensors; tensorIdx++) {
-        TP_DCHECK_EQ(
-            message.tensors[tensorIdx].metadata,
-            data.expectedTensorMetadata[tensorIdx]);
-        TP_DCHECK_EQ(
-            message.tensors[tensorIdx].buffer.cpu.length, data.tensorSize);
-        message.tensors[tensorIdx].buffer.cpu.ptr =
-            data.temporaryTensor[tensorIdx].get();
-      }
-    } else {
-      TP_DCHECK_EQ(message.tensors.size(), 0);
-    }
-    pipe->read(
-        std::move(message),
-        [pipe, &numRoundTrips, &doneProm, &data, &measurements](
-            const Error& error, Message&& message) {
-          TP_THROW_ASSERT_IF(error) << error.what();
-          if (data.payloadSize > 0) {
-            TP_DCHECK_EQ(message.payloads.size(), data.numPayloads);
-            for (size_t payloadIdx = 0; payloadIdx < data.numPayloads;
-                 payloadIdx++) {
-              TP_DCHECK_EQ(
-                  message.payloads[payloadIdx].length, data.payloadSize);
-              TP_DCHECK_EQ(
-                  memcmp(
-                      message.payloads[payloadIdx].data,
-                      data.expectedPayload[payloadIdx].get(),
-                      message.payloads[payloadIdx].length),
-                  0);
-            }
-          } else {
-            TP_DCHECK_EQ(message.tensors.size(), 0);
-          }
-          if (data.tensorSize > 0) {
-            TP_DCHECK_EQ(message.tensors.size(), data.numTensors);
-            for (size_t tensorIdx = 0; tensorIdx < data.numTensors;
-                 tensorIdx++) {
-              TP_DCHECK_EQ(
-                  message.tensors[tensorIdx].buffer.cpu.length,
-                  data.tensorSize);
-              TP_DCHECK_EQ(
-                  memcmp(
-                      message.tensors[tensorIdx].buffer.cpu.ptr,
-                      data.expectedTensor[tensorIdx].get(),
-                      message.tensors[tensorIdx].buffer.cpu.length),
-                  0);
-            }
-          } else {
-            TP_DCHECK_EQ(message.tensors.size(), 0);
-          }
-          pipe->write(
-              std::move(message),
-              [pipe, &numRoundTrips, &doneProm, &data, &measurements](
-                  const Error& error, Message&& message) {
-                TP_THROW_ASSERT_IF(error) << error.what();
-                if (--numRoundTrips > 0) {
-                  serverPongPingNonBlock(
-                      pipe, numRoundTrips, doneProm, data, measurements);
-                } else {
-                  doneProm.set_value();
-                }
-              });
-        });
-  });
+#if TENSORPIPE_SUPPORTS_CUDA
+// Allocate memory on the device, and fill it with the given data if any.
+static CudaPtr createCudaData(int device, const uint8_t* data, size_t size) {
+  CudaDeviceGuard guard(device);
+  void* ptr;
+  TP_CUDA_CHECK(cudaMalloc(&ptr, size));
+  CudaPtr cudaPtr(reinterpret_cast<uint8_t*>(ptr));
+  if (data != nullptr) {
+    TP_CUDA_CHECK(cudaMemcpy(ptr, data, size, cudaMemcpyHostToDevice));
+  }
+  return cudaPtr;
 }
+#endif // TENSORPIPE_SUPPORTS_CUDA
 
-// Start with receiving ping
-static void runServer(const Options& options) {
-  std::string addr = options.address;
-  int numRoundTrips = options.numRoundTrips;
-
-  Data data;
+static void createData(const Options& options, int cudaDevice, Data& data) {
   data.numPayloads = options.numPayloads;
   data.payloadSize = options.payloadSize;
   for (size_t payloadIdx = 0; payloadIdx < options.numPayloads; payloadIdx++) {
     data.expectedPayload.push_back(createData(options.payloadSize));
     data.expectedPayloadMetadata.push_back(
         std::string(options.metadataSize, 0x42));
-    data.temporaryPayload.push_back(
-        std::make_unique<uint8_t[]>(options.payloadSize));
   }
   data.numTensors = options.numTensors;
   data.tensorSize = options.tensorSize;
@@ -185,48 +262,59 @@ static void runServer(const Options& options) {
     data.expectedTensor.push_back(createData(options.tensorSize));
     data.expectedTensorMetadata.push_back(
         std::string(options.metadataSize, 0x42));
-    data.temporaryTensor.push_back(
-        std::make_unique<uint8_t[]>(options.tensorSize));
   }
+#if TENSORPIPE_SUPPORTS_CUDA
+  if (options.tensorType == "cuda") {
+    data.cudaTensors = true;
+    data.cudaDevice = cudaDevice;
+    CudaDeviceGuard guard(cudaDevice);
+    cudaStream_t stream;
+    TP_CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+    data.cudaStream = CudaStream(stream);
+    for (size_t tensorIdx = 0; tensorIdx < options.numTensors; tensorIdx++) {
+      data.expectedCudaTensor.push_back(createCudaData(
+          cudaDevice, data.expectedTensor[tensorIdx].get(), data.tensorSize));
+    }
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
   data.expectedMetadata = std::string(options.metadataSize, 0x42);
+}
 
-  Measurements measurements;
-  measurements.reserve(options.numRoundTrips);
-
-  std::shared_ptr<Context> context = std::make_shared<Context>();
-  auto transportContext =
-      TensorpipeTransportRegistry().create(options.transport);
-  validateTransportContext(transportContext);
-  context->registerTransport(0, options.transport, transportContext);
-
-  auto channelContext = TensorpipeChannelRegistry().create(options.channel);
-  validateChannelContext(channelContext);
-  context->registerChannel(0, options.channel, channelContext);
-
-  std::promise<std::shared_ptr<Pipe>> pipeProm;
-  std::shared_ptr<Listener> listener = context->listen({addr});
-  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
-    TP_THROW_ASSERT_IF(error) << error.what();
-    pipeProm.set_value(std::move(pipe));
-  });
-  std::shared_ptr<Pipe> pipe = pipeProm.get_future().get();
-
-  std::promise<void> doneProm;
-  serverPongPingNonBlock(
-      std::move(pipe), numRoundTrips, doneProm, data, measurements);
+static size_t bytesPerMessage(const Data& data) {
+  return data.numPayloads * data.payloadSize +
+      data.numTensors * data.tensorSize;
+}
 
-  doneProm.get_future().get();
-  listener.reset();
-  context->join();
+static std::unique_ptr<PipeState> createPipeState(
+    const Options& options,
+    const Data& data,
+    std::shared_ptr<Pipe> pipe) {
+  auto state = std::make_unique<PipeState>();
+  state->pipe = std::move(pipe);
+  state->slots.resize(options.window);
+  for (Slot& slot : state->slots) {
+    for (size_t idx = 0; idx < options.numPayloads; idx++) {
+      slot.temporaryPayload.push_back(
+          std::make_unique<uint8_t[]>(options.payloadSize));
+    }
+    for (size_t idx = 0; idx < options.numTensors; idx++) {
+#if TENSORPIPE_SUPPORTS_CUDA
+      if (data.cudaTensors) {
+        slot.temporaryCudaTensor.push_back(
+            createCudaData(data.cudaDevice, nullptr, options.tensorSize));
+        continue;
+      }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+      slot.temporaryTensor.push_back(
+          std::make_unique<uint8_t[]>(options.tensorSize));
+    }
+  }
+  state->numWritesLeft = options.numRoundTrips;
+  state->numReadsLeft = options.numRoundTrips;
+  return state;
 }
 
-static void clientPingPongNonBlock(
-    std::shared_ptr<Pipe> pipe,
-    int& numRoundTrips,
-    std::promise<void>& doneProm,
-    Data& data,
-    Measurements& measurements) {
-  measurements.markStart();
+static Message makeMessage(const Data& data) {
   Message message;
   message.metadata = data.expectedMetadata;
   if (data.payloadSize > 0) {
@@ -236,169 +324,505 @@ static void clientPingPongNonBlock(
       payload.length = data.payloadSize;
       message.payloads.push_back(std::move(payload));
     }
-  } else {
-    TP_DCHECK_EQ(message.tensors.size(), 0);
   }
   if (data.tensorSize > 0) {
     for (size_t tensorIdx = 0; tensorIdx < data.numTensors; tensorIdx++) {
       Message::Tensor tensor;
+#if TENSORPIPE_SUPPORTS_CUDA
+      if (data.cudaTensors) {
+        tensor.buffer = CudaBuffer{
+            data.expectedCudaTensor[tensorIdx].get(),
+            data.tensorSize,
+            data.cudaStream.get()};
+        message.tensors.push_back(std::move(tensor));
+        continue;
+      }
+#endif // TENSORPIPE_SUPPORTS_CUDA
       tensor.buffer =
           CpuBuffer{data.expectedTensor[tensorIdx].get(), data.tensorSize};
       message.tensors.push_back(std::move(tensor));
     }
+  }
+  return message;
+}
+
+static size_t lengthOfTensor(const Message::Tensor& tensor) {
+#if TENSORPIPE_SUPPORTS_CUDA
+  if (tensor.buffer.type == DeviceType::kCuda) {
+    return tensor.buffer.cuda.length;
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+  return tensor.buffer.cpu.length;
+}
+
+static bool tensorIsOfExpectedType(
+    const Message::Tensor& tensor,
+    const Data& data) {
+  return data.cudaTensors ? tensor.buffer.type != DeviceType::kCpu
+                          : tensor.buffer.type == DeviceType::kCpu;
+}
+
+// Point a tensor to the memory of a slot.
+static void fillInTensor(
+    Message::Tensor& tensor,
+    const Data& data,
+    Slot& slot,
+    size_t tensorIdx) {
+#if TENSORPIPE_SUPPORTS_CUDA
+  if (data.cudaTensors) {
+    tensor.buffer = CudaBuffer{
+        slot.temporaryCudaTensor[tensorIdx].get(),
+        data.tensorSize,
+        data.cudaStream.get()};
+    return;
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+  tensor.buffer.cpu.ptr = slot.temporaryTensor[tensorIdx].get();
+}
+
+static bool tensorHasExpectedData(
+    const Message::Tensor& tensor,
+    const Data& data,
+    size_t tensorIdx) {
+#if TENSORPIPE_SUPPORTS_CUDA
+  if (data.cudaTensors) {
+    // The tensor is ready once the operations on its stream are done.
+    std::vector<uint8_t> hostData(data.tensorSize);
+    TP_CUDA_CHECK(cudaStreamSynchronize(tensor.buffer.cuda.stream));
+    TP_CUDA_CHECK(cudaMemcpy(
+        hostData.data(),
+        tensor.buffer.cuda.ptr,
+        data.tensorSize,
+        cudaMemcpyDeviceToHost));
+    return memcmp(
+               hostData.data(),
+               data.expectedTensor[tensorIdx].get(),
+               data.tensorSize) == 0;
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+  return memcmp(
+             tensor.buffer.cpu.ptr,
+             data.expectedTensor[tensorIdx].get(),
+             data.tensorSize) == 0;
+}
+
+// Check the descriptor of a message and point it to the memory of a slot.
+static void fillInDescriptor(Message& message, const Data& data, Slot& slot) {
+  TP_DCHECK_EQ(message.metadata, data.expectedMetadata);
+  if (data.payloadSize > 0) {
+    TP_DCHECK_EQ(message.payloads.size(), data.numPayloads);
+    for (size_t payloadIdx = 0; payloadIdx < data.numPayloads; payloadIdx++) {
+      TP_DCHECK_EQ(
+          message.payloads[payloadIdx].metadata,
+          data.expectedPayloadMetadata[payloadIdx]);
+      TP_DCHECK_EQ(message.payloads[payloadIdx].length, data.payloadSize);
+      message.payloads[payloadIdx].data =
+          slot.temporaryPayload[payloadIdx].get();
+    }
+  } else {
+    TP_DCHECK_EQ(message.payloads.size(), 0);
+  }
+  if (data.tensorSize > 0) {
+    TP_DCHECK_EQ(message.tensors.size(), data.numTensors);
+    for (size_t tensorIdx = 0; tensorIdx < data.numTensors; tensorIdx++) {
+      TP_DCHECK_EQ(
+          message.tensors[tensorIdx].metadata,
+          data.expectedTensorMetadata[tensorIdx]);
+      TP_DCHECK(tensorIsOfExpectedType(message.tensors[tensorIdx], data));
+      TP_DCHECK_EQ(lengthOfTensor(message.tensors[tensorIdx]), data.tensorSize);
+      fillInTensor(message.tensors[tensorIdx], data, slot, tensorIdx);
+    }
   } else {
     TP_DCHECK_EQ(message.tensors.size(), 0);
   }
-  pipe->write(
-      std::move(message),
-      [pipe, &numRoundTrips, &doneProm, &data, &measurements](
-          const Error& error, Message&& message) {
-        TP_THROW_ASSERT_IF(error) << error.what();
-        pipe->readDescriptor(
-            [pipe, &numRoundTrips, &doneProm, &data, &measurements](
-                const Error& error, Message&& message) {
-              TP_THROW_ASSERT_IF(error) << error.what();
-              TP_DCHECK_EQ(message.metadata, data.expectedMetadata);
-              if (data.payloadSize > 0) {
-                TP_DCHECK_EQ(message.payloads.size(), data.numPayloads);
-                for (size_t payloadIdx = 0; payloadIdx < data.numPayloads;
-                     payloadIdx++) {
-                  TP_DCHECK_EQ(
-                      message.payloads[payloadIdx].metadata,
-                      data.expectedPayloadMetadata[payloadIdx]);
-                  TP_DCHECK_EQ(
-                      message.payloads[payloadIdx].length, data.payloadSize);
-                  message.payloads[payloadIdx].data =
-                      data.temporaryPayload[payloadIdx].get();
-                }
-              } else {
-                TP_DCHECK_EQ(message.payloads.size(), 0);
-              }
-              if (data.tensorSize > 0) {
-                TP_DCHECK_EQ(message.tensors.size(), data.numTensors);
-                for (size_t tensorIdx = 0; tensorIdx < data.numTensors;
-                     tensorIdx++) {
-                  TP_DCHECK_EQ(
-                      message.tensors[tensorIdx].metadata,
-                      data.expectedTensorMetadata[tensorIdx]);
-                  TP_DCHECK_EQ(
-                      message.tensors[tensorIdx].buffer.cpu.length,
-                      data.tensorSize);
-                  message.tensors[tensorIdx].buffer.cpu.ptr =
-                      data.temporaryTensor[tensorIdx].get();
-                }
-              } else {
-                TP_DCHECK_EQ(message.tensors.size(), 0);
-              }
-              pipe->read(
-                  std::move(message),
-                  [pipe, &numRoundTrips, &doneProm, &data, &measurements](
-                      const Error& error, Message&& message) {
-                    measurements.markStop();
-                    TP_THROW_ASSERT_IF(error) << error.what();
-                    if (data.payloadSize > 0) {
-                      TP_DCHECK_EQ(message.payloads.size(), data.numPayloads);
-                      for (size_t payloadIdx = 0; payloadIdx < data.numPayloads;
-                           payloadIdx++) {
-                        TP_DCHECK_EQ(
-                            memcmp(
-                                message.payloads[payloadIdx].data,
-                                data.expectedPayload[payloadIdx].get(),
-                                message.payloads[payloadIdx].length),
-                            0);
-                      }
-                    } else {
-                      TP_DCHECK_EQ(message.payloads.size(), 0);
-                    }
-                    if (data.tensorSize > 0) {
-                      TP_DCHECK_EQ(message.tensors.size(), data.numTensors);
-                      for (size_t tensorIdx = 0; tensorIdx < data.numTensors;
-                           tensorIdx++) {
-                        TP_DCHECK_EQ(
-                            memcmp(
-                                message.tensors[tensorIdx].buffer.cpu.ptr,
-                                data.expectedTensor[tensorIdx].get(),
-                                message.tensors[tensorIdx].buffer.cpu.length),
-                            0);
-                      }
-                    } else {
-                      TP_DCHECK_EQ(message.tensors.size(), 0);
-                    }
-                    if (--numRoundTrips > 0) {
-                      clientPingPongNonBlock(
-                          pipe, numRoundTrips, doneProm, data, measurements);
-                    } else {
-                      printMeasurements(measurements, data.payloadSize);
-                      doneProm.set_value();
-                    }
-                  });
-            });
-      });
 }
 
-// Start with sending ping
-static void runClient(const Options& options) {
-  std::string addr = options.address;
-  int numRoundTrips = options.numRoundTrips;
-
-  Data data;
-  data.numPayloads = options.numPayloads;
-  data.payloadSize = options.payloadSize;
-  for (size_t payloadIdx = 0; payloadIdx < options.numPayloads; payloadIdx++) {
-    data.expectedPayload.push_back(createData(options.payloadSize));
-    data.expectedPayloadMetadata.push_back(
-        std::string(options.metadataSize, 0x42));
-    data.temporaryPayload.push_back(
-        std::make_unique<uint8_t[]>(options.payloadSize));
+static void checkMessage(const Message& message, const Data& data) {
+  if (data.payloadSize > 0) {
+    TP_DCHECK_EQ(message.payloads.size(), data.numPayloads);
+    for (size_t payloadIdx = 0; payloadIdx < data.numPayloads; payloadIdx++) {
+      TP_DCHECK_EQ(message.payloads[payloadIdx].length, data.payloadSize);
+      TP_DCHECK_EQ(
+          memcmp(
+              message.payloads[payloadIdx].data,
+              data.expectedPayload[payloadIdx].get(),
+              message.payloads[payloadIdx].length),
+          0);
+    }
+  } else {
+    TP_DCHECK_EQ(message.payloads.size(), 0);
   }
-  data.numTensors = options.numTensors;
-  data.tensorSize = options.tensorSize;
-  for (size_t tensorIdx = 0; tensorIdx < options.numTensors; tensorIdx++) {
-    data.expectedTensor.push_back(createData(options.tensorSize));
-    data.expectedTensorMetadata.push_back(
-        std::string(options.metadataSize, 0x42));
-    data.temporaryTensor.push_back(
-        std::make_unique<uint8_t[]>(options.tensorSize));
+  if (data.tensorSize > 0) {
+    TP_DCHECK_EQ(message.tensors.size(), data.numTensors);
+    for (size_t tensorIdx = 0; tensorIdx < data.numTensors; tensorIdx++) {
+      TP_DCHECK_EQ(lengthOfTensor(message.tensors[tensorIdx]), data.tensorSize);
+      TP_DCHECK(
+          tensorHasExpectedData(message.tensors[tensorIdx], data, tensorIdx));
+    }
+  } else {
+    TP_DCHECK_EQ(message.tensors.size(), 0);
   }
-  data.expectedMetadata = std::string(options.metadataSize, 0x42);
+}
 
-  Measurements measurements;
-  measurements.reserve(options.numRoundTrips);
+// Read a message into the next slot and hand it to the callback.
+template <typename TFn>
+static void readMessage(PipeState& state, const Data& data, TFn fn) {
+  Slot& slot = state.slots[state.nextSlotIdx];
+  state.nextSlotIdx = (state.nextSlotIdx + 1) % state.slots.size();
+  state.pipe->readDescriptor([&state, &data, &slot, fn{std::move(fn)}](
+                                 const Error& error, Message&& message) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+    fillInDescriptor(message, data, slot);
+    state.pipe->read(
+        std::move(message),
+        [&data, fn{std::move(fn)}](const Error& error, Message&& message) {
+          TP_THROW_ASSERT_IF(error) << error.what();
+          checkMessage(message, data);
+          fn(std::move(message));
+        });
+  });
+}
 
-  std::shared_ptr<Context> context = std::make_shared<Context>();
-  auto transportContext =
+// Echo each message back, as soon as it's read, and keep reading the next one.
+// The slot a message was read into is only reused once the client has got the
+// echo of that message back, and thus once it has been sent.
+static void serverPongPingNonBlock(PipeState& state, const Data& data) {
+  readMessage(state, data, [&state, &data](Message&& message) {
+    state.pipe->write(
+        std::move(message),
+        [&state](const Error& error, Message&& /* unused */) {
+          TP_THROW_ASSERT_IF(error) << error.what();
+          if (--state.numWritesLeft == 0) {
+            state.doneProm.set_value();
+          }
+        });
+    if (--state.numReadsLeft > 0) {
+      serverPongPingNonBlock(state, data);
+    }
+  });
+}
+
+static std::shared_ptr<Context> createContext(const Options& options) {
+  std::shared_ptr<Context> context = std::make_shared<Context>(
+      ContextOptions().payloadChecksums(options.payloadChecksums));
+  std::shared_ptr<transport::Context> transportContext =
       TensorpipeTransportRegistry().create(options.transport);
   validateTransportContext(transportContext);
+  if (options.simulateLink) {
+    transportContext = std::make_shared<transport::sim::Context>(
+        std::move(transportContext), options.simLink);
+  }
   context->registerTransport(0, options.transport, transportContext);
 
   auto channelContext = TensorpipeChannelRegistry().create(options.channel);
   validateChannelContext(channelContext);
   context->registerChannel(0, options.channel, channelContext);
 
-  std::shared_ptr<Pipe> pipe = context->connect(addr);
+#if TENSORPIPE_SUPPORTS_CUDA
+  if (options.tensorType == "cuda") {
+    auto cudaChannelContext =
+        TensorpipeCudaChannelRegistry().create(options.cudaChannel);
+    validateCudaChannelContext(cudaChannelContext);
+    context->registerChannel(0, options.cudaChannel, cudaChannelContext);
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
 
-  std::promise<void> doneProm;
-  clientPingPongNonBlock(
-      std::move(pipe), numRoundTrips, doneProm, data, measurements);
+  return context;
+}
 
-  doneProm.get_future().get();
+// Start with receiving ping
+static void runServer(const Options& options) {
+  std::string addr = options.address;
+
+  Data data;
+  createData(options, options.serverCudaDevice, data);
+
+  std::shared_ptr<Context> context = createContext(options);
+  const CpuTimes startCpuTimes = getCpuTimes();
+
+  std::vector<std::unique_ptr<PipeState>> states;
+  std::mutex mutex;
+  std::promise<void> allAcceptedProm;
+  std::shared_ptr<Listener> listener = context->listen({addr});
+  std::function<void(const Error&, std::shared_ptr<Pipe>)> acceptFn;
+  acceptFn = [&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+    // Let the client know that we're there (see connectToServer).
+    pipe->write(Message(), [](const Error& error, Message&& /* unused */) {
+      TP_THROW_ASSERT_IF(error) << error.what();
+    });
+    std::unique_lock<std::mutex> lock(mutex);
+    states.push_back(createPipeState(options, data, std::move(pipe)));
+    serverPongPingNonBlock(*states.back(), data);
+    if (states.size() < static_cast<size_t>(options.numPipes)) {
+      listener->accept(acceptFn);
+    } else {
+      allAcceptedProm.set_value();
+    }
+  };
+  listener->accept(acceptFn);
+
+  allAcceptedProm.get_future().get();
+  for (auto& state : states) {
+    state->doneProm.get_future().get();
+  }
+  printCpuUsage(
+      startCpuTimes,
+      getCpuTimes(),
+      2 * options.numPipes * options.numRoundTrips * bytesPerMessage(data),
+      2 * options.numPipes * options.numRoundTrips);
+  listener.reset();
   context->join();
 }
 
+// Keep a window of round trips in flight: each time a pong comes back another
+// ping goes out, until they've all been sent.
+static void clientPing(PipeState& state, const Data& data) {
+  state.startTimes.push_back(TClock::now());
+  --state.numWritesLeft;
+  state.pipe->write(
+      makeMessage(data), [](const Error& error, Message&& /* unused */) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+      });
+}
+
+static void clientPong(PipeState& state, const Data& data) {
+  readMessage(state, data, [&state, &data](Message&& /* unused */) {
+    state.measurements.markStop(state.startTimes.front());
+    state.startTimes.pop_front();
+    if (state.numWritesLeft > 0) {
+      clientPing(state, data);
+    }
+    if (--state.numReadsLeft > 0) {
+      clientPong(state, data);
+    } else {
+      state.doneTime = TClock::now();
+      state.doneProm.set_value();
+    }
+  });
+}
+
+static void clientPingPongNonBlock(PipeState& state, const Data& data) {
+  for (size_t i = 0; i < state.slots.size() && state.numWritesLeft > 0; i++) {
+    clientPing(state, data);
+  }
+  clientPong(state, data);
+}
+
+// The server may not be listening yet, for example while it's still tearing
+// down the previous run of a sweep, hence try again until it greets us.
+static std::shared_ptr<Pipe> connectToServer(
+    Context& context,
+    const std::string& address) {
+  constexpr int kMaxAttempts = 100;
+  constexpr auto kDelayBetweenAttempts = std::chrono::milliseconds(100);
+  for (int attempt = 0;; attempt++) {
+    std::shared_ptr<Pipe> pipe = context.connect(address);
+    std::promise<bool> greetedProm;
+    pipe->readDescriptor(
+        [pipe, &greetedProm](const Error& error, Message&& message) {
+          if (error) {
+            greetedProm.set_value(false);
+            return;
+          }
+          pipe->read(
+              std::move(message),
+              [&greetedProm](const Error& error, Message&& /* unused */) {
+                greetedProm.set_value(!error);
+              });
+        });
+    if (greetedProm.get_future().get()) {
+      return pipe;
+    }
+    pipe->close();
+    TP_THROW_ASSERT_IF(attempt + 1 == kMaxAttempts)
+        << "Couldn't connect to " << address;
+    std::this_thread::sleep_for(kDelayBetweenAttempts);
+  }
+}
+
+// Run the pipes of one client thread, on a context of its own. The round trips
+// start once all the threads are ready, so that they all run concurrently, and
+// the context is only joined once told to, so that the CPU time of its threads
+// can be measured until then.
+static void runClientThread(
+    const Options& options,
+    const Data& data,
+    std::vector<std::unique_ptr<PipeState>>& states,
+    std::promise<void>& readyProm,
+    std::shared_future<void> startFuture,
+    std::promise<void>& doneProm,
+    std::shared_future<void> stopFuture) {
+  std::shared_ptr<Context> context = createContext(options);
+
+  for (auto& state : states) {
+    state->pipe = connectToServer(*context, options.address);
+  }
+
+  readyProm.set_value();
+  startFuture.wait();
+
+  for (auto& state : states) {
+    clientPingPongNonBlock(*state, data);
+  }
+  for (auto& state : states) {
+    state->doneProm.get_future().get();
+  }
+  doneProm.set_value();
+  stopFuture.wait();
+  context->join();
+}
+
+// Start with sending ping, and return the throughput in Gb/s.
+static double runClient(const Options& options) {
+  Data data;
+  createData(options, options.clientCudaDevice, data);
+
+  // Spread the pipes among the threads.
+  std::vector<std::vector<std::unique_ptr<PipeState>>> statesOfThreads(
+      options.numClientThreads);
+  for (int pipeIdx = 0; pipeIdx < options.numPipes; pipeIdx++) {
+    statesOfThreads[pipeIdx % options.numClientThreads].push_back(
+        createPipeState(options, data, nullptr));
+  }
+
+  std::vector<std::promise<void>> readyProms(options.numClientThreads);
+  std::promise<void> startProm;
+  std::shared_future<void> startFuture = startProm.get_future().share();
+  std::vector<std::promise<void>> doneProms(options.numClientThreads);
+  std::promise<void> stopProm;
+  std::shared_future<void> stopFuture = stopProm.get_future().share();
+  std::vector<std::thread> threads;
+  for (int threadIdx = 0; threadIdx < options.numClientThreads; threadIdx++) {
+    threads.emplace_back(
+        runClientThread,
+        std::cref(options),
+        std::cref(data),
+        std::ref(statesOfThreads[threadIdx]),
+        std::ref(readyProms[threadIdx]),
+        startFuture,
+        std::ref(doneProms[threadIdx]),
+        stopFuture);
+  }
+  for (auto& readyProm : readyProms) {
+    readyProm.get_future().get();
+  }
+
+  const uint64_t numAllocationsAtStart =
+      numAllocations.load(std::memory_order_relaxed);
+  const CpuTimes startCpuTimes = getCpuTimes();
+  const TClock::time_point startTime = TClock::now();
+  startProm.set_value();
+  for (auto& doneProm : doneProms) {
+    doneProm.get_future().get();
+  }
+  const CpuTimes stopCpuTimes = getCpuTimes();
+  stopProm.set_value();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  Measurements measurements;
+  TClock::time_point doneTime = startTime;
+  for (const auto& states : statesOfThreads) {
+    for (const auto& state : states) {
+      measurements.merge(state->measurements);
+      doneTime = std::max(doneTime, state->doneTime);
+    }
+  }
+  printMeasurements(
+      options,
+      measurements,
+      data.payloadSize,
+      numAllocations.load(std::memory_order_relaxed) - numAllocationsAtStart);
+  printCpuUsage(
+      startCpuTimes,
+      stopCpuTimes,
+      2 * measurements.size() * bytesPerMessage(data),
+      2 * measurements.size());
+  exportResults(
+      options.resultsPath,
+      "pipe",
+      runLabel(options, data.payloadSize),
+      options,
+      measurements,
+      doneTime - startTime,
+      bytesPerMessage(data),
+      computeCpuUsage(startCpuTimes, stopCpuTimes));
+  return printThroughput(
+      options,
+      measurements.size(),
+      bytesPerMessage(data),
+      doneTime - startTime);
+}
+
+// Run once for each channel and each size, on new contexts and pipes each time,
+// in the same order on both sides.
+static void runSweep(const Options& options) {
+  const bool cudaTensors = options.tensorType == "cuda";
+  const std::vector<std::string> channels =
+      splitList(cudaTensors ? options.cudaChannel : options.channel);
+  std::vector<size_t> sizes;
+  for (size_t size = 1024; size <= 1024 * 1024 * 1024; size *= 4) {
+    sizes.push_back(size);
+  }
+
+  std::vector<std::vector<double>> gbps(channels.size());
+  for (size_t channelIdx = 0; channelIdx < channels.size(); channelIdx++) {
+    for (size_t size : sizes) {
+      Options runOptions = options;
+      if (cudaTensors) {
+        runOptions.cudaChannel = channels[channelIdx];
+      } else {
+        runOptions.channel = channels[channelIdx];
+      }
+      runOptions.tensorSize = size;
+      std::cout << "channel = " << channels[channelIdx]
+                << ", tensor_size = " << size << "\n";
+      if (options.mode == "listen") {
+        runServer(runOptions);
+      } else {
+        gbps[channelIdx].push_back(runClient(runOptions));
+      }
+    }
+  }
+
+  if (options.mode == "connect") {
+    printBandwidthMatrix(channels, sizes, gbps);
+  }
+}
+
 int main(int argc, char** argv) {
   struct Options x = parseOptions(argc, argv);
   std::cout << "mode = " << x.mode << "\n";
   std::cout << "transport = " << x.transport << "\n";
   std::cout << "channel = " << x.channel << "\n";
+  std::cout << "cuda_channel = " << x.cudaChannel << "\n";
   std::cout << "address = " << x.address << "\n";
   std::cout << "num_round_trips = " << x.numRoundTrips << "\n";
+  std::cout << "window = " << x.window << "\n";
+  std::cout << "num_pipes = " << x.numPipes << "\n";
+  std::cout << "num_client_threads = " << x.numClientThreads << "\n";
   std::cout << "num_payloads = " << x.numPayloads << "\n";
   std::cout << "payload_size = " << x.payloadSize << "\n";
   std::cout << "num_tensors = " << x.numTensors << "\n";
   std::cout << "tensor_size = " << x.tensorSize << "\n";
   std::cout << "metadata_size = " << x.metadataSize << "\n";
+  std::cout << "tensor_type = " << x.tensorType << "\n";
+  std::cout << "client_cuda_device = " << x.clientCudaDevice << "\n";
+  std::cout << "server_cuda_device = " << x.serverCudaDevice << "\n";
+  std::cout << "sweep = " << x.sweep << "\n";
+  std::cout << "payload_checksums = " << x.payloadChecksums << "\n";
+  if (x.simulateLink) {
+    std::cout << "sim_bytes_per_second = " << x.simLink.bytesPerSecond << "\n";
+    std::cout << "sim_latency_ns = " << x.simLink.latency.count() << "\n";
+    std::cout << "sim_jitter_ns = " << x.simLink.jitter.count() << "\n";
+    std::cout << "sim_seed = " << x.simLink.seed << "\n";
+  }
 
-  if (x.mode == "listen") {
+  if (x.sweep) {
+    runSweep(x);
+  } else if (x.mode == "listen") {
     runServer(x);
   } else if (x.mode == "connect") {
     runClient(x);
@@ -407,5 +831,9 @@ int main(int argc, char** argv) {
     TP_THROW_ASSERT() << "unknown mode: " << x.mode;
   }
 
+  if (!x.tracePath.empty()) {
+    trace::writeChromeTrace(x.tracePath);
+  }
+
   return 0;
 }
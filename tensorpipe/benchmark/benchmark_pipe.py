@@ -0,0 +1,458 @@
+#!/usr/bin/env python3
+# Copyright (c) Facebook, Inc. and its affiliates.
+# All rights reserved.
+#
+# This source code is licensed under the BSD-style license found in the
+# LICENSE file in the root directory of this source tree.
+
+# The counterpart of benchmark_pipe that goes through the Python bindings, with
+# the same options (those that the bindings support) and the same protocol, so
+# that either side can be run against the C++ one. Running this client against
+# the C++ server and comparing with the C++ client (by giving it a file that
+# the latter wrote with --results) tells how much each round trip, and thus
+# each message, costs on top in the bindings: holding and releasing the GIL
+# and converting the messages to and from Python objects.
+
+import argparse
+import collections
+import json
+import math
+import resource
+import sys
+import threading
+import time
+
+import pytensorpipe as tp
+
+
+TRANSPORTS = {"uv": "UvTransport", "shm": "ShmTransport", "uds": "UdsTransport"}
+CHANNELS = {"basic": "BasicChannel", "cma": "CmaChannel"}
+
+# How long to wait for the server to greet a new pipe.
+GREETING_TIMEOUT_S = 10
+
+
+def parse_options():
+    parser = argparse.ArgumentParser(
+        description="Benchmark the pipes through the Python bindings."
+    )
+    parser.add_argument("--mode", required=True, choices=["listen", "connect"])
+    parser.add_argument(
+        "--transport", required=True, help="transport backend [uv|shm|uds]"
+    )
+    parser.add_argument("--channel", required=True, help="channel backend [basic|cma]")
+    parser.add_argument(
+        "--address", required=True, help="address to listen or connect to"
+    )
+    parser.add_argument(
+        "--num-round-trips",
+        type=int,
+        required=True,
+        help="number of write/read pairs to perform (per pipe)",
+    )
+    parser.add_argument(
+        "--window", type=int, default=1, help="number of write/read pairs in flight"
+    )
+    parser.add_argument(
+        "--num-pipes", type=int, default=1, help="number of pipes to run the pairs on"
+    )
+    parser.add_argument("--num-payloads", type=int, default=0)
+    parser.add_argument("--payload-size", type=int, default=0)
+    parser.add_argument("--num-tensors", type=int, default=0)
+    parser.add_argument("--tensor-size", type=int, default=0)
+    parser.add_argument("--metadata-size", type=int, default=0)
+    parser.add_argument(
+        "--results",
+        help="append the options and results of the run to a file, as a JSON "
+        "line (see compare_results.py)",
+    )
+    parser.add_argument(
+        "--baseline",
+        help="results that benchmark_pipe wrote with --results, to report the "
+        "overhead of the bindings over the run with the same options",
+    )
+    options = parser.parse_args()
+
+    if options.transport not in TRANSPORTS or not hasattr(
+        tp, TRANSPORTS[options.transport]
+    ):
+        parser.error(f"transport {options.transport} isn't available in the bindings")
+    if options.channel not in CHANNELS or not hasattr(tp, CHANNELS[options.channel]):
+        parser.error(f"channel {options.channel} isn't available in the bindings")
+    if options.num_round_trips <= 0:
+        parser.error("--num-round-trips must be positive")
+    if options.window <= 0 or options.num_pipes <= 0:
+        parser.error("--window and --num-pipes must be positive")
+    return options
+
+
+def create_data(size):
+    # The same data as benchmark_pipe, which checks it.
+    return bytes(((i >> 8) ^ (i & 0xFF)) & 0xFF for i in range(size))
+
+
+class Data:
+    def __init__(self, options):
+        self.metadata = b"\x42" * options.metadata_size
+        # As in benchmark_pipe, empty payloads and tensors aren't sent.
+        self.num_payloads = options.num_payloads if options.payload_size > 0 else 0
+        self.num_tensors = options.num_tensors if options.tensor_size > 0 else 0
+        self.payload = create_data(options.payload_size)
+        self.tensor = create_data(options.tensor_size)
+        self.bytes_per_message = (
+            self.num_payloads * options.payload_size
+            + self.num_tensors * options.tensor_size
+        )
+
+    def make_message(self, payloads=None, tensors=None):
+        if payloads is None:
+            payloads = [self.payload] * self.num_payloads
+        if tensors is None:
+            tensors = [self.tensor] * self.num_tensors
+        return tp.OutgoingMessage(
+            self.metadata,
+            [tp.OutgoingPayload(p, self.metadata) for p in payloads],
+            [tp.OutgoingTensor(memoryview(t), self.metadata) for t in tensors],
+        )
+
+
+# The memory that a message is received into. Each pipe has one of these for
+# each of the round trips it may have in flight.
+class Slot:
+    def __init__(self, options, data):
+        self.payloads = [
+            bytearray(options.payload_size) for _ in range(data.num_payloads)
+        ]
+        self.tensors = [
+            bytearray(options.tensor_size) for _ in range(data.num_tensors)
+        ]
+
+
+class PipeState:
+    def __init__(self, options, data, pipe):
+        self.options = options
+        self.data = data
+        self.pipe = pipe
+        self.slots = [Slot(options, data) for _ in range(options.window)]
+        self.next_slot_idx = 0
+        self.num_writes_left = options.num_round_trips
+        self.num_reads_left = options.num_round_trips
+        # The moments at which the round trips in flight started, oldest first.
+        self.start_times = collections.deque()
+        self.samples = []
+        self.done_time = None
+        self.done = threading.Event()
+        # The callbacks of the pipe run one at a time, but the first pings are
+        # sent from the main thread, concurrently with those, hence the pings
+        # are sent under this lock so that their start times stay in order.
+        self.lock = threading.Lock()
+
+    # Read a message into the next slot and hand the slot to the callback.
+    def read_message(self, fn):
+        slot = self.slots[self.next_slot_idx]
+        self.next_slot_idx = (self.next_slot_idx + 1) % len(self.slots)
+
+        def on_read_descriptor(message):
+            for payload, buffer in zip(message.payloads, slot.payloads):
+                payload.buffer = buffer
+            for tensor, buffer in zip(message.tensors, slot.tensors):
+                tensor.buffer = memoryview(buffer)
+            self.pipe.read(message, lambda: fn(slot))
+
+        self.pipe.read_descriptor(on_read_descriptor)
+
+
+# Echo each message back, as soon as it's read, and keep reading the next one.
+def server_pong_ping(state):
+    def on_read(slot):
+        state.pipe.write(
+            state.data.make_message(slot.payloads, slot.tensors), on_write
+        )
+        state.num_reads_left -= 1
+        if state.num_reads_left > 0:
+            server_pong_ping(state)
+
+    def on_write():
+        state.num_writes_left -= 1
+        if state.num_writes_left == 0:
+            state.done.set()
+
+    state.read_message(on_read)
+
+
+# Keep a window of round trips in flight: each time a pong comes back another
+# ping is sent, until all have been.
+def client_ping(state):
+    with state.lock:
+        if state.num_writes_left == 0:
+            return
+        state.num_writes_left -= 1
+        state.start_times.append(time.perf_counter_ns())
+        state.pipe.write(state.data.make_message(), lambda: None)
+
+
+def client_pong(state):
+    def on_read(slot):
+        stop_time = time.perf_counter_ns()
+        with state.lock:
+            state.samples.append(stop_time - state.start_times.popleft())
+        client_ping(state)
+        state.num_reads_left -= 1
+        if state.num_reads_left > 0:
+            client_pong(state)
+        else:
+            state.done_time = time.perf_counter_ns()
+            state.done.set()
+
+    state.read_message(on_read)
+
+
+def create_context(options):
+    context = tp.Context()
+    context.register_transport(
+        0, options.transport, getattr(tp, TRANSPORTS[options.transport])()
+    )
+    context.register_channel(
+        0, options.channel, getattr(tp, CHANNELS[options.channel])()
+    )
+    return context
+
+
+def process_cpu_time_s():
+    usage = resource.getrusage(resource.RUSAGE_SELF)
+    return usage.ru_utime + usage.ru_stime
+
+
+def run_server(options):
+    data = Data(options)
+    context = create_context(options)
+    listener = context.listen([options.address])
+    states = []
+    all_accepted = threading.Event()
+
+    def on_connection(pipe):
+        # Let the client know that we're there, as benchmark_pipe does.
+        pipe.write(tp.OutgoingMessage(b"", [], []), lambda: None)
+        states.append(PipeState(options, data, pipe))
+        server_pong_ping(states[-1])
+        if len(states) < options.num_pipes:
+            listener.listen(on_connection)
+        else:
+            all_accepted.set()
+
+    listener.listen(on_connection)
+    all_accepted.wait()
+    for state in states:
+        state.done.wait()
+    context.join()
+
+
+def connect_to_server(context, address):
+    pipe = context.connect(address)
+    greeted = threading.Event()
+    pipe.read_descriptor(lambda message: pipe.read(message, greeted.set))
+    if not greeted.wait(GREETING_TIMEOUT_S):
+        sys.exit(f"Couldn't connect to {address}")
+    return pipe
+
+
+# The histogram of the samples, in the buckets of the Measurements of the C++
+# benchmarks: one for each value below 128 ns and 64 for each power of two
+# above, so that the results can be merged and compared with those.
+def make_buckets(samples):
+    buckets = collections.Counter()
+    for value in samples:
+        shift = max(value.bit_length() - 7, 0)
+        lowest = (value >> shift) << shift
+        buckets[(lowest, lowest + (1 << shift) - 1)] += 1
+    return sorted(buckets.items())
+
+
+def percentile(sorted_samples, fraction):
+    rank = min(max(math.ceil(fraction * len(sorted_samples)), 1), len(sorted_samples))
+    return sorted_samples[rank - 1]
+
+
+def config_of(options):
+    return {
+        "mode": options.mode,
+        "transport": options.transport,
+        "channel": options.channel,
+        "cuda_channel": "",
+        "num_round_trips": options.num_round_trips,
+        "window": options.window,
+        "num_pipes": options.num_pipes,
+        "num_client_threads": 1,
+        "num_payloads": options.num_payloads,
+        "payload_size": options.payload_size,
+        "num_tensors": options.num_tensors,
+        "tensor_size": options.tensor_size,
+        "metadata_size": options.metadata_size,
+        "tensor_type": "cpu",
+        "payload_checksums": False,
+    }
+
+
+def find_baseline(path, label, config):
+    # The runs of benchmark_pipe with the same label and options, besides the
+    # number of round trips, which only changes the precision.
+    def key(config):
+        return {k: v for k, v in config.items() if k != "num_round_trips"}
+
+    runs = []
+    with open(path, "r") as f:
+        for line in f:
+            if not line.strip():
+                continue
+            run = json.loads(line)
+            if (
+                run["benchmark"] == "pipe"
+                and run["label"] == label
+                and key(run["config"]) == key(config)
+            ):
+                runs.append(run)
+    return runs
+
+
+def report_overhead(runs, samples):
+    # Merge the histograms of all the matching runs and take the percentiles
+    # as benchmark_pipe does, i.e., the highest value of their bucket, to which
+    # ours are rounded up too for a fair comparison.
+    cpp_buckets = collections.Counter()
+    cpp_sum = 0
+    for run in runs:
+        cpp_sum += run["latency"]["sum_ns"]
+        for lowest, highest, count in run["latency"]["buckets"]:
+            cpp_buckets[(lowest, highest)] += count
+    cpp_count = sum(cpp_buckets.values())
+    cpp_samples_upper = []
+    for (_, highest), count in sorted(cpp_buckets.items()):
+        cpp_samples_upper.extend([highest] * count)
+    py_samples_upper = []
+    for (_, highest), count in make_buckets(samples):
+        py_samples_upper.extend([highest] * count)
+
+    rows = [("avg", cpp_sum / cpp_count, sum(samples) / len(samples))]
+    for name, fraction in (("p50", 0.5), ("p90", 0.9), ("p99", 0.99)):
+        rows.append(
+            (
+                name,
+                percentile(cpp_samples_upper, fraction),
+                percentile(py_samples_upper, fraction),
+            )
+        )
+    # Each round trip is a write and a read on this side, hence two messages
+    # that went through the bindings.
+    print(
+        f"{'':<6} {'C++ (usec)':>12} {'Python':>12} {'overhead/trip':>14} "
+        f"{'overhead/msg':>14}",
+        file=sys.stderr,
+    )
+    for name, cpp, py in rows:
+        print(
+            f"{name:<6} {cpp / 1e3:>12.3f} {py / 1e3:>12.3f} "
+            f"{(py - cpp) / 1e3:>14.3f} {(py - cpp) / 2e3:>14.3f}",
+            file=sys.stderr,
+        )
+
+
+def run_client(options):
+    data = Data(options)
+    context = create_context(options)
+    states = [
+        PipeState(options, data, connect_to_server(context, options.address))
+        for _ in range(options.num_pipes)
+    ]
+
+    start_cpu_s = process_cpu_time_s()
+    start_time = time.perf_counter_ns()
+    for state in states:
+        client_pong(state)
+        for _ in range(options.window):
+            client_ping(state)
+    for state in states:
+        state.done.wait()
+    stop_cpu_s = process_cpu_time_s()
+    elapsed_s = (max(state.done_time for state in states) - start_time) / 1e9
+
+    samples = sorted(sample for state in states for sample in state.samples)
+    num_messages = 2 * len(samples)
+    num_bytes = num_messages * data.bytes_per_message
+    cpu_s = stop_cpu_s - start_cpu_s
+    print(
+        f"{'chunk-size':<15} {'# ping-pong':<15} {'avg (usec)':<12} {'p50':<9} "
+        f"{'p90':<9} {'p99':<9} {'p99.9':<9} {'max':<9}",
+        file=sys.stderr,
+    )
+    print(
+        f"{options.payload_size:<15} {len(samples):<15} "
+        f"{sum(samples) / len(samples) / 1e3:<12.3f} "
+        + " ".join(
+            f"{percentile(samples, f) / 1e3:<9.3f}" for f in (0.5, 0.9, 0.99, 0.999)
+        )
+        + f" {samples[-1] / 1e3:<9.3f}",
+        file=sys.stderr,
+    )
+    print(
+        f"{'Gb/s':<12} {'msg/s':<12} {'CPU (s)':<12} {'CPU s/1k msg':<12}",
+        file=sys.stderr,
+    )
+    print(
+        f"{num_bytes * 8 / elapsed_s / 1e9:<12.3f} "
+        f"{len(samples) / elapsed_s:<12.1f} {cpu_s:<12.3f} "
+        f"{cpu_s / (num_messages / 1e3):<12.6f}",
+        file=sys.stderr,
+    )
+
+    label = f"{options.transport}/{options.channel}/{options.payload_size}"
+    config = config_of(options)
+    if options.results:
+        buckets = make_buckets(samples)
+        result = {
+            "benchmark": "python_pipe",
+            "label": label,
+            "config": config,
+            "latency": {
+                "count": len(samples),
+                "sum_ns": sum(samples),
+                "min_ns": samples[0],
+                "p50_ns": percentile(samples, 0.5),
+                "p90_ns": percentile(samples, 0.9),
+                "p99_ns": percentile(samples, 0.99),
+                "p999_ns": percentile(samples, 0.999),
+                "max_ns": samples[-1],
+                "buckets": [[lo, hi, count] for (lo, hi), count in buckets],
+            },
+            "throughput": {
+                "elapsed_s": elapsed_s,
+                "num_bytes": num_bytes,
+                "num_messages": num_messages,
+                "gbps": num_bytes * 8 / elapsed_s / 1e9,
+                "round_trips_per_s": len(samples) / elapsed_s,
+            },
+            "cpu": {
+                "s": cpu_s,
+                "s_per_gb": cpu_s / (num_bytes / 1e9) if num_bytes > 0 else 0,
+                "s_per_1k_msg": cpu_s / (num_messages / 1e3),
+                "threads": {},
+            },
+        }
+        with open(options.results, "a") as f:
+            f.write(json.dumps(result) + "\n")
+    if options.baseline:
+        runs = find_baseline(options.baseline, label, config)
+        if runs:
+            report_overhead(runs, samples)
+        else:
+            print(f"No run of benchmark_pipe for {label} in {options.baseline}")
+
+    # The context must be joined explicitly, see test/python/tensorpipe.py.
+    context.join()
+
+
+if __name__ == "__main__":
+    options = parse_options()
+    if options.mode == "listen":
+        run_server(options)
+    else:
+        run_client(options)
@@ -0,0 +1,869 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <tensorpipe/benchmark/channel_registry.h>
+#include <tensorpipe/benchmark/measurements.h>
+#include <tensorpipe/benchmark/options.h>
+#include <tensorpipe/benchmark/transport_registry.h>
+#include <tensorpipe/common/defs.h>
+#if TENSORPIPE_SUPPORTS_CUDA
+#include <tensorpipe/common/cuda.h>
+#endif // TENSORPIPE_SUPPORTS_CUDA
+#include <tensorpipe/core/context.h>
+#include <tensorpipe/core/listener.h>
+#include <tensorpipe/core/pipe.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::benchmark;
+
+// Replays a workload of messages of mixed shapes on a pipe, open-loop: the
+// client writes each message at the moment the workload schedules it, whether
+// or not the previous ones have been acknowledged, and the server acknowledges
+// each one with an empty message once it has read it. The latency of a message
+// runs from the moment it was scheduled (rather than written, so that a client
+// that falls behind doesn't hide the queueing) until its acknowledgment is
+// read, and it's reported for all messages and for each size class.
+//
+// The workload is either read from a trace (--trace-file), which has a line
+// for each message (those starting with # are skipped):
+//
+//   <time (usec)> <metadata size> <payload sizes> <tensor sizes>
+//
+// where the sizes are comma-separated, or "-" for none, and where the tensor
+// sizes prefixed with "cuda:" are for CUDA tensors, or it's drawn at random
+// (--num-messages) from weighted sizes (--payload-sizes and --tensor-sizes, as
+// SIZE:WEIGHT,...). The arrivals of random messages follow a Poisson process at
+// --rate messages per second, which, if set, also replaces the timestamps of
+// the trace. The contents of the messages aren't checked.
+
+namespace {
+
+using TClock = Measurements::clock;
+
+#if TENSORPIPE_SUPPORTS_CUDA
+struct CudaDeleter {
+  void operator()(uint8_t* ptr) {
+    TP_CUDA_CHECK(cudaFree(ptr));
+  }
+};
+
+using CudaPtr = std::unique_ptr<uint8_t, CudaDeleter>;
+
+struct CudaStreamDeleter {
+  void operator()(cudaStream_t stream) {
+    TP_CUDA_CHECK(cudaStreamDestroy(stream));
+  }
+};
+
+using CudaStream =
+    std::unique_ptr<std::remove_pointer_t<cudaStream_t>, CudaStreamDeleter>;
+
+CudaPtr createCudaData(int device, size_t size) {
+  CudaDeviceGuard guard(device);
+  void* ptr;
+  TP_CUDA_CHECK(cudaMalloc(&ptr, std::max<size_t>(size, 1)));
+  return CudaPtr(reinterpret_cast<uint8_t*>(ptr));
+}
+
+CudaStream createCudaStream(int device) {
+  CudaDeviceGuard guard(device);
+  cudaStream_t stream;
+  TP_CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+  return CudaStream(stream);
+}
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+struct ReplayOptions {
+  std::string mode; // listen or connect
+  std::string transport{"uv"};
+  std::string channel{"basic"};
+  std::string cudaChannel;
+  std::string address;
+  std::string traceFile;
+  size_t numMessages{0};
+  double rate{0};
+  size_t numPayloads{0};
+  std::string payloadSizes;
+  size_t numTensors{0};
+  std::string tensorSizes;
+  std::string tensorType{"cpu"};
+  size_t metadataSize{0};
+  int cudaDevice{0};
+  uint64_t seed{0};
+  std::string csvPath;
+  std::string jsonPath;
+};
+
+void usage(int status, const char* argv0) {
+  if (status != EXIT_SUCCESS) {
+    fprintf(stderr, "`%s --help' for more information.\n", argv0);
+    exit(status);
+  }
+
+  fprintf(stderr, "Usage: %s [OPTIONS]\n", argv0);
+#define X(x) fputs(x "\n", stderr);
+  X("");
+  X("--mode=MODE                     Running mode [listen|connect]");
+  X("--transport=TRANSPORT           Transport backend [shm|uv|ibv]");
+  X("--channel=CHANNEL               Channel backend [basic|xth|cma|...]");
+  X("--cuda-channel=CHANNEL [optional]");
+  X("                                CUDA channel backend [cuda_basic|...]");
+  X("--address=ADDRESS               Address to listen or connect to");
+  X("--cuda-device=IDX [optional]    Device of the CUDA tensors");
+  X("");
+  X("On the client only:");
+  X("--trace-file=PATH               Replay the messages of a trace");
+  X("--num-messages=NUM              Or send this many random messages");
+  X("--rate=NUM [optional]           Messages per second, on average");
+  X("--num-payloads=NUM [optional]   Number of payloads of random messages");
+  X("--payload-sizes=SIZE:WEIGHT,... [optional]");
+  X("                                Sizes of their payloads, and how likely");
+  X("--num-tensors=NUM [optional]    Number of tensors of random messages");
+  X("--tensor-sizes=SIZE:WEIGHT,... [optional]");
+  X("                                Sizes of their tensors, and how likely");
+  X("--tensor-type=TYPE [optional]   Type of their tensors [cpu|cuda]");
+  X("--metadata-size=SIZE [optional] Size of their metadata");
+  X("--seed=NUM [optional]           Seed of the random generator");
+  X("--csv=PATH [optional]           Append the latency histogram to a CSV");
+  X("                                file");
+  X("--json=PATH [optional]          Append the latency histogram and its");
+  X("                                percentiles to a file, as a JSON line");
+#undef X
+
+  exit(status);
+}
+
+void validateOptions(const ReplayOptions& options, const char* argv0) {
+  int status = EXIT_SUCCESS;
+  if (options.mode.empty()) {
+    fprintf(stderr, "Missing argument: --mode must be set\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.address.empty()) {
+    fprintf(stderr, "Missing argument: --address must be set\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.mode == "connect" &&
+      options.traceFile.empty() == (options.numMessages == 0)) {
+    fprintf(
+        stderr,
+        "Invalid argument: exactly one of --trace-file and --num-messages must"
+        " be set\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.traceFile.empty() && options.numMessages > 0 &&
+      options.rate <= 0) {
+    fprintf(stderr, "Missing argument: --num-messages needs --rate\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.numPayloads > 0 && options.payloadSizes.empty()) {
+    fprintf(stderr, "Missing argument: --num-payloads needs --payload-sizes\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.numTensors > 0 && options.tensorSizes.empty()) {
+    fprintf(stderr, "Missing argument: --num-tensors needs --tensor-sizes\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.tensorType != "cpu" && options.tensorType != "cuda") {
+    fprintf(stderr, "Invalid argument: --tensor-type must be [cpu|cuda]\n");
+    status = EXIT_FAILURE;
+  }
+#if !TENSORPIPE_SUPPORTS_CUDA
+  if (options.tensorType == "cuda" || !options.cudaChannel.empty()) {
+    fprintf(stderr, "Invalid argument: TensorPipe was built without CUDA\n");
+    status = EXIT_FAILURE;
+  }
+#endif // !TENSORPIPE_SUPPORTS_CUDA
+  if (status != EXIT_SUCCESS) {
+    usage(status, argv0);
+  }
+}
+
+ReplayOptions parseReplayOptions(int argc, char** argv) {
+  ReplayOptions options;
+  int opt;
+  int flag = -1;
+
+  enum Flags : int {
+    MODE,
+    TRANSPORT,
+    CHANNEL,
+    CUDA_CHANNEL,
+    ADDRESS,
+    CUDA_DEVICE,
+    TRACE_FILE,
+    NUM_MESSAGES,
+    RATE,
+    NUM_PAYLOADS,
+    PAYLOAD_SIZES,
+    NUM_TENSORS,
+    TENSOR_SIZES,
+    TENSOR_TYPE,
+    METADATA_SIZE,
+    SEED,
+    CSV,
+    JSON,
+    HELP,
+  };
+
+  static struct option longOptions[] = {
+      {"mode", required_argument, &flag, MODE},
+      {"transport", required_argument, &flag, TRANSPORT},
+      {"channel", required_argument, &flag, CHANNEL},
+      {"cuda-channel", required_argument, &flag, CUDA_CHANNEL},
+      {"address", required_argument, &flag, ADDRESS},
+      {"cuda-device", required_argument, &flag, CUDA_DEVICE},
+      {"trace-file", required_argument, &flag, TRACE_FILE},
+      {"num-messages", required_argument, &flag, NUM_MESSAGES},
+      {"rate", required_argument, &flag, RATE},
+      {"num-payloads", required_argument, &flag, NUM_PAYLOADS},
+      {"payload-sizes", required_argument, &flag, PAYLOAD_SIZES},
+      {"num-tensors", required_argument, &flag, NUM_TENSORS},
+      {"tensor-sizes", required_argument, &flag, TENSOR_SIZES},
+      {"tensor-type", required_argument, &flag, TENSOR_TYPE},
+      {"metadata-size", required_argument, &flag, METADATA_SIZE},
+      {"seed", required_argument, &flag, SEED},
+      {"csv", required_argument, &flag, CSV},
+      {"json", required_argument, &flag, JSON},
+      {"help", no_argument, &flag, HELP},
+      {nullptr, 0, nullptr, 0}};
+
+  while (1) {
+    opt = getopt_long(argc, argv, "", longOptions, nullptr);
+    if (opt == -1) {
+      break;
+    }
+    if (opt != 0) {
+      usage(EXIT_FAILURE, argv[0]);
+      break;
+    }
+    switch (flag) {
+      case MODE:
+        options.mode = std::string(optarg, strlen(optarg));
+        if (options.mode != "listen" && options.mode != "connect") {
+          fprintf(stderr, "Error:\n");
+          fprintf(stderr, "  --mode must be [listen|connect]\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case TRANSPORT:
+        options.transport = std::string(optarg, strlen(optarg));
+        break;
+      case CHANNEL:
+        options.channel = std::string(optarg, strlen(optarg));
+        break;
+      case CUDA_CHANNEL:
+        options.cudaChannel = std::string(optarg, strlen(optarg));
+        break;
+      case ADDRESS:
+        options.address = std::string(optarg, strlen(optarg));
+        break;
+      case CUDA_DEVICE:
+        options.cudaDevice = atoi(optarg);
+        break;
+      case TRACE_FILE:
+        options.traceFile = std::string(optarg, strlen(optarg));
+        break;
+      case NUM_MESSAGES:
+        options.numMessages = std::strtoull(optarg, nullptr, 10);
+        break;
+      case RATE:
+        options.rate = std::strtod(optarg, nullptr);
+        break;
+      case NUM_PAYLOADS:
+        options.numPayloads = std::strtoull(optarg, nullptr, 10);
+        break;
+      case PAYLOAD_SIZES:
+        options.payloadSizes = std::string(optarg, strlen(optarg));
+        break;
+      case NUM_TENSORS:
+        options.numTensors = std::strtoull(optarg, nullptr, 10);
+        break;
+      case TENSOR_SIZES:
+        options.tensorSizes = std::string(optarg, strlen(optarg));
+        break;
+      case TENSOR_TYPE:
+        options.tensorType = std::string(optarg, strlen(optarg));
+        break;
+      case METADATA_SIZE:
+        options.metadataSize = std::strtoull(optarg, nullptr, 10);
+        break;
+      case SEED:
+        options.seed = std::strtoull(optarg, nullptr, 10);
+        break;
+      case CSV:
+        options.csvPath = std::string(optarg, strlen(optarg));
+        break;
+      case JSON:
+        options.jsonPath = std::string(optarg, strlen(optarg));
+        break;
+      case HELP:
+        usage(EXIT_SUCCESS, argv[0]);
+        break;
+      default:
+        usage(EXIT_FAILURE, argv[0]);
+        break;
+    }
+  }
+
+  validateOptions(options, argv[0]);
+
+  return options;
+}
+
+[[noreturn]] void fail(const std::string& what) {
+  fprintf(stderr, "%s\n", what.c_str());
+  exit(EXIT_FAILURE);
+}
+
+size_t parseSize(const std::string& str) {
+  char* end;
+  const unsigned long long value = std::strtoull(str.c_str(), &end, 10);
+  if (str.empty() || *end != '\0') {
+    fail("Invalid size: " + str);
+  }
+  return value;
+}
+
+struct TensorShape {
+  bool cuda;
+  size_t size;
+};
+
+struct MessageShape {
+  // When the message is due, since the start of the run.
+  std::chrono::nanoseconds time;
+  size_t metadataSize;
+  std::vector<size_t> payloadSizes;
+  std::vector<TensorShape> tensors;
+};
+
+size_t bytesOfMessage(const MessageShape& shape) {
+  size_t bytes = shape.metadataSize;
+  for (size_t size : shape.payloadSizes) {
+    bytes += size;
+  }
+  for (const TensorShape& tensor : shape.tensors) {
+    bytes += tensor.size;
+  }
+  return bytes;
+}
+
+std::vector<MessageShape> readTrace(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    fail("Couldn't open trace file " + path);
+  }
+  std::vector<MessageShape> shapes;
+  std::string line;
+  for (size_t lineIdx = 1; std::getline(file, line); lineIdx++) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    double timeUsec;
+    MessageShape shape;
+    std::string payloads;
+    std::string tensors;
+    if (!(fields >> timeUsec >> shape.metadataSize >> payloads >> tensors)) {
+      fail("Malformed line " + std::to_string(lineIdx) + " of " + path);
+    }
+    shape.time = std::chrono::nanoseconds(
+        static_cast<int64_t>(std::max(timeUsec, 0.0) * 1000));
+    if (payloads != "-") {
+      for (const std::string& size : splitList(payloads)) {
+        shape.payloadSizes.push_back(parseSize(size));
+      }
+    }
+    if (tensors != "-") {
+      for (const std::string& tensor : splitList(tensors)) {
+        const bool cuda = tensor.compare(0, 5, "cuda:") == 0;
+        shape.tensors.push_back(
+            TensorShape{cuda, parseSize(cuda ? tensor.substr(5) : tensor)});
+      }
+    }
+    shapes.push_back(std::move(shape));
+  }
+  if (shapes.empty()) {
+    fail("No messages in trace file " + path);
+  }
+  // The messages are sent in the order of their timestamps.
+  std::stable_sort(
+      shapes.begin(),
+      shapes.end(),
+      [](const MessageShape& a, const MessageShape& b) {
+        return a.time < b.time;
+      });
+  return shapes;
+}
+
+// A distribution over sizes, given as SIZE:WEIGHT,... (a missing weight is 1).
+class SizeDistribution {
+ public:
+  explicit SizeDistribution(const std::string& spec) {
+    std::vector<double> weights;
+    if (!spec.empty()) {
+      for (const std::string& item : splitList(spec)) {
+        const size_t colon = item.find(':');
+        sizes_.push_back(parseSize(item.substr(0, colon)));
+        weights.push_back(
+            colon == std::string::npos
+                ? 1.0
+                : std::strtod(item.c_str() + colon + 1, nullptr));
+      }
+    }
+    distribution_ =
+        std::discrete_distribution<size_t>(weights.begin(), weights.end());
+  }
+
+  template <typename TGenerator>
+  size_t operator()(TGenerator& generator) {
+    return sizes_[distribution_(generator)];
+  }
+
+ private:
+  std::vector<size_t> sizes_;
+  std::discrete_distribution<size_t> distribution_;
+};
+
+std::vector<MessageShape> generateWorkload(const ReplayOptions& options) {
+  std::mt19937_64 generator(options.seed);
+  SizeDistribution payloadSizes(options.payloadSizes);
+  SizeDistribution tensorSizes(options.tensorSizes);
+  std::vector<MessageShape> shapes(options.numMessages);
+  for (MessageShape& shape : shapes) {
+    shape.metadataSize = options.metadataSize;
+    for (size_t idx = 0; idx < options.numPayloads; idx++) {
+      shape.payloadSizes.push_back(payloadSizes(generator));
+    }
+    for (size_t idx = 0; idx < options.numTensors; idx++) {
+      shape.tensors.push_back(
+          TensorShape{options.tensorType == "cuda", tensorSizes(generator)});
+    }
+  }
+  return shapes;
+}
+
+// Schedule the messages as the arrivals of a Poisson process of the given rate.
+void scheduleAtRate(
+    std::vector<MessageShape>& shapes,
+    double rate,
+    uint64_t seed) {
+  std::mt19937_64 generator(seed);
+  std::exponential_distribution<double> interarrival(rate);
+  double seconds = 0;
+  for (MessageShape& shape : shapes) {
+    shape.time = std::chrono::nanoseconds(static_cast<int64_t>(seconds * 1e9));
+    seconds += interarrival(generator);
+  }
+}
+
+std::shared_ptr<Context> createContext(const ReplayOptions& options) {
+  std::shared_ptr<Context> context = std::make_shared<Context>();
+  auto transportContext =
+      TensorpipeTransportRegistry().create(options.transport);
+  validateTransportContext(transportContext);
+  context->registerTransport(0, options.transport, transportContext);
+
+  auto channelContext = TensorpipeChannelRegistry().create(options.channel);
+  validateChannelContext(channelContext);
+  context->registerChannel(0, options.channel, channelContext);
+
+#if TENSORPIPE_SUPPORTS_CUDA
+  if (!options.cudaChannel.empty()) {
+    auto cudaChannelContext =
+        TensorpipeCudaChannelRegistry().create(options.cudaChannel);
+    validateCudaChannelContext(cudaChannelContext);
+    context->registerChannel(0, options.cudaChannel, cudaChannelContext);
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+  return context;
+}
+
+// The memory that the messages are sent from or received into, which is shared
+// by all of them as their contents don't matter, and which grows as needed.
+// Those it has outgrown are kept, as messages may still be using them.
+class Scratch {
+ public:
+  explicit Scratch(int cudaDevice) : cudaDevice_(cudaDevice) {}
+
+  uint8_t* cpu(size_t size) {
+    if (cpu_.empty() || size > cpuSize_) {
+      cpuSize_ = std::max(size, 2 * cpuSize_);
+      cpu_.push_back(
+          std::make_unique<uint8_t[]>(std::max<size_t>(cpuSize_, 1)));
+    }
+    return cpu_.back().get();
+  }
+
+#if TENSORPIPE_SUPPORTS_CUDA
+  CudaBuffer cuda(size_t size) {
+    if (!cudaStream_) {
+      cudaStream_ = createCudaStream(cudaDevice_);
+    }
+    if (cuda_.empty() || size > cudaSize_) {
+      cudaSize_ = std::max(size, 2 * cudaSize_);
+      cuda_.push_back(createCudaData(cudaDevice_, cudaSize_));
+    }
+    return CudaBuffer{cuda_.back().get(), size, cudaStream_.get()};
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+ private:
+  const int cudaDevice_;
+  size_t cpuSize_{0};
+  std::vector<std::unique_ptr<uint8_t[]>> cpu_;
+#if TENSORPIPE_SUPPORTS_CUDA
+  size_t cudaSize_{0};
+  std::vector<CudaPtr> cuda_;
+  CudaStream cudaStream_;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+};
+
+Message makeMessage(const MessageShape& shape, Scratch& scratch) {
+  Message message;
+  message.metadata = std::string(shape.metadataSize, 0x42);
+  for (size_t size : shape.payloadSizes) {
+    Message::Payload payload;
+    payload.data = scratch.cpu(size);
+    payload.length = size;
+    message.payloads.push_back(std::move(payload));
+  }
+  for (const TensorShape& tensorShape : shape.tensors) {
+    Message::Tensor tensor;
+#if TENSORPIPE_SUPPORTS_CUDA
+    if (tensorShape.cuda) {
+      tensor.buffer = scratch.cuda(tensorShape.size);
+      message.tensors.push_back(std::move(tensor));
+      continue;
+    }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+    tensor.buffer = CpuBuffer{scratch.cpu(tensorShape.size), tensorShape.size};
+    message.tensors.push_back(std::move(tensor));
+  }
+  return message;
+}
+
+// Point the payloads and tensors of a descriptor to the scratch memory.
+void allocateMessage(Message& message, Scratch& scratch) {
+  for (Message::Payload& payload : message.payloads) {
+    payload.data = scratch.cpu(payload.length);
+  }
+  for (Message::Tensor& tensor : message.tensors) {
+#if TENSORPIPE_SUPPORTS_CUDA
+    if (tensor.buffer.type == DeviceType::kCuda) {
+      tensor.buffer = scratch.cuda(tensor.buffer.cuda.length);
+      continue;
+    }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+    tensor.buffer.cpu.ptr = scratch.cpu(tensor.buffer.cpu.length);
+  }
+}
+
+// Acknowledge each message once it's read, and keep reading until the client
+// goes away. The callbacks of a pipe are serialized, hence they can share the
+// scratch memory without locking.
+struct ServerState {
+  std::shared_ptr<Pipe> pipe;
+  Scratch scratch;
+  uint64_t numMessages{0};
+  uint64_t numBytes{0};
+  std::promise<void> doneProm;
+  bool done{false};
+
+  explicit ServerState(int cudaDevice) : scratch(cudaDevice) {}
+
+  void finish() {
+    if (!done) {
+      done = true;
+      doneProm.set_value();
+    }
+  }
+};
+
+void serverReadNext(ServerState& state) {
+  state.pipe->readDescriptor([&state](const Error& error, Message&& message) {
+    if (error) {
+      state.finish();
+      return;
+    }
+    allocateMessage(message, state.scratch);
+    state.pipe->read(
+        std::move(message), [&state](const Error& error, Message&& message) {
+          if (error) {
+            state.finish();
+            return;
+          }
+          state.numMessages++;
+          state.numBytes += message.metadata.size();
+          for (const Message::Payload& payload : message.payloads) {
+            state.numBytes += payload.length;
+          }
+          for (const Message::Tensor& tensor : message.tensors) {
+#if TENSORPIPE_SUPPORTS_CUDA
+            if (tensor.buffer.type == DeviceType::kCuda) {
+              state.numBytes += tensor.buffer.cuda.length;
+              continue;
+            }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+            state.numBytes += tensor.buffer.cpu.length;
+          }
+          state.pipe->write(
+              Message(), [](const Error& /* unused */, Message&& /* unused */) {
+              });
+        });
+    serverReadNext(state);
+  });
+}
+
+void runServer(const ReplayOptions& options) {
+  std::shared_ptr<Context> context = createContext(options);
+  std::shared_ptr<Listener> listener = context->listen({options.address});
+
+  ServerState state(options.cudaDevice);
+  std::promise<std::shared_ptr<Pipe>> pipeProm;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+    pipeProm.set_value(std::move(pipe));
+  });
+  state.pipe = pipeProm.get_future().get();
+  // Let the client know that we're there, and that the run can start.
+  state.pipe->write(Message(), [](const Error& error, Message&& /* unused */) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+  });
+  serverReadNext(state);
+
+  state.doneProm.get_future().get();
+  fprintf(
+      stderr,
+      "Received %lu messages, %lu bytes\n",
+      static_cast<unsigned long>(state.numMessages),
+      static_cast<unsigned long>(state.numBytes));
+  state.pipe->close();
+  listener.reset();
+  context->join();
+}
+
+// The messages whose acknowledgments haven't been read yet, in order, with the
+// moment they were due at and their size class, i.e., the smallest power of two
+// that is at least their total size.
+struct ClientState {
+  std::shared_ptr<Pipe> pipe;
+  std::mutex mutex;
+  std::deque<std::pair<TClock::time_point, size_t>> inFlight;
+  Measurements measurements;
+  std::map<size_t, Measurements> measurementsBySizeClass;
+  size_t numAcksLeft;
+  std::promise<void> doneProm;
+};
+
+size_t sizeClassOf(size_t bytes) {
+  size_t sizeClass = 1;
+  while (sizeClass < bytes) {
+    sizeClass *= 2;
+  }
+  return sizeClass;
+}
+
+void clientReadNext(ClientState& state) {
+  state.pipe->readDescriptor([&state](const Error& error, Message&& message) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+    state.pipe->read(
+        std::move(message),
+        [&state](const Error& error, Message&& /* unused */) {
+          TP_THROW_ASSERT_IF(error) << error.what();
+          bool done;
+          {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            TP_DCHECK(!state.inFlight.empty());
+            const auto& entry = state.inFlight.front();
+            const auto latency = TClock::now() - entry.first;
+            state.measurements.add(latency);
+            state.measurementsBySizeClass[entry.second].add(latency);
+            state.inFlight.pop_front();
+            done = --state.numAcksLeft == 0;
+          }
+          if (done) {
+            state.doneProm.set_value();
+          } else {
+            clientReadNext(state);
+          }
+        });
+  });
+}
+
+void printMeasurements(
+    const std::string& label,
+    const Measurements& measurements) {
+  fprintf(
+      stderr,
+      "%-15s %-12lu %-12.3f %-9.3f %-9.3f %-9.3f %-9.3f %-9.3f\n",
+      label.c_str(),
+      static_cast<unsigned long>(measurements.size()),
+      measurements.sum().count() / (float)measurements.size() / 1000.0,
+      measurements.percentile(0.50).count() / 1000.0,
+      measurements.percentile(0.90).count() / 1000.0,
+      measurements.percentile(0.99).count() / 1000.0,
+      measurements.percentile(0.999).count() / 1000.0,
+      measurements.max().count() / 1000.0);
+}
+
+void runClient(const ReplayOptions& options) {
+  std::vector<MessageShape> shapes = options.traceFile.empty()
+      ? generateWorkload(options)
+      : readTrace(options.traceFile);
+  if (options.rate > 0) {
+    scheduleAtRate(shapes, options.rate, options.seed);
+  }
+  for (const MessageShape& shape : shapes) {
+    for (const TensorShape& tensor : shape.tensors) {
+#if TENSORPIPE_SUPPORTS_CUDA
+      if (tensor.cuda && options.cudaChannel.empty()) {
+        fail("Missing argument: CUDA tensors need --cuda-channel");
+      }
+#else // TENSORPIPE_SUPPORTS_CUDA
+      if (tensor.cuda) {
+        fail("Invalid trace: TensorPipe was built without CUDA");
+      }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+    }
+  }
+
+  std::shared_ptr<Context> context = createContext(options);
+  Scratch scratch(options.cudaDevice);
+  ClientState state;
+  state.numAcksLeft = shapes.size();
+
+  // The server may not be listening yet, hence try again until it greets us.
+  constexpr int kMaxAttempts = 100;
+  constexpr auto kDelayBetweenAttempts = std::chrono::milliseconds(100);
+  for (int attempt = 0;; attempt++) {
+    state.pipe = context->connect(options.address);
+    std::promise<bool> greetedProm;
+    state.pipe->readDescriptor(
+        [&state, &greetedProm](const Error& error, Message&& message) {
+          if (error) {
+            greetedProm.set_value(false);
+            return;
+          }
+          state.pipe->read(
+              std::move(message),
+              [&greetedProm](const Error& error, Message&& /* unused */) {
+                greetedProm.set_value(!error);
+              });
+        });
+    if (greetedProm.get_future().get()) {
+      break;
+    }
+    state.pipe->close();
+    TP_THROW_ASSERT_IF(attempt + 1 == kMaxAttempts)
+        << "Couldn't connect to " << options.address;
+    std::this_thread::sleep_for(kDelayBetweenAttempts);
+  }
+  clientReadNext(state);
+
+  // Lay out the scratch memory up front, so that its allocations don't delay
+  // the first messages.
+  for (const MessageShape& shape : shapes) {
+    makeMessage(shape, scratch);
+  }
+
+  // The messages are written from this thread, each at its time. Those that
+  // are late, because the previous writes took too long or because the thread
+  // overslept, are written right away, and their latency includes the delay.
+  std::chrono::nanoseconds maxLag{0};
+  uint64_t numBytes = 0;
+  const TClock::time_point startTime = TClock::now();
+  for (const MessageShape& shape : shapes) {
+    const TClock::time_point dueTime = startTime + shape.time;
+    std::this_thread::sleep_until(dueTime);
+    maxLag = std::max<std::chrono::nanoseconds>(
+        maxLag, TClock::now() - dueTime);
+    {
+      std::unique_lock<std::mutex> lock(state.mutex);
+      state.inFlight.emplace_back(dueTime, sizeClassOf(bytesOfMessage(shape)));
+    }
+    numBytes += bytesOfMessage(shape);
+    state.pipe->write(
+        makeMessage(shape, scratch),
+        [](const Error& error, Message&& /* unused */) {
+          TP_THROW_ASSERT_IF(error) << error.what();
+        });
+  }
+  state.doneProm.get_future().get();
+  const std::chrono::nanoseconds elapsed = TClock::now() - startTime;
+
+  fprintf(
+      stderr,
+      "%-15s %-12s %-12s %-9s %-9s %-9s %-9s %-9s\n",
+      "size-class",
+      "# messages",
+      "avg (usec)",
+      "p50",
+      "p90",
+      "p99",
+      "p99.9",
+      "max");
+  for (const auto& iter : state.measurementsBySizeClass) {
+    printMeasurements("<= " + std::to_string(iter.first), iter.second);
+  }
+  printMeasurements("all", state.measurements);
+  const double seconds = std::chrono::duration<double>(elapsed).count();
+  fprintf(
+      stderr,
+      "%.1f msg/s, %.3f Gb/s, writes lagged by up to %.3f usec\n",
+      shapes.size() / seconds,
+      numBytes * 8 / seconds / 1e9,
+      maxLag.count() / 1000.0);
+
+  const std::string& channel =
+      options.cudaChannel.empty() ? options.channel : options.cudaChannel;
+  exportMeasurements(
+      state.measurements,
+      options.transport + "/" + channel + "/replay",
+      options.csvPath,
+      options.jsonPath);
+
+  state.pipe->close();
+  context->join();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  ReplayOptions options = parseReplayOptions(argc, argv);
+  if (options.mode == "listen") {
+    runServer(options);
+  } else {
+    runClient(options);
+  }
+  return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <tensorpipe/util/ringbuffer/consumer.h>
+#include <tensorpipe/util/ringbuffer/producer.h>
+#include <tensorpipe/util/ringbuffer/ringbuffer.h>
+
+using namespace tensorpipe::util::ringbuffer;
+
+// A producer thread writes --num-ops messages of --message-size bytes each into
+// a ringbuffer of --buffer-size bytes, while a consumer thread reads them back,
+// both spinning when the ringbuffer is full or empty. The two threads are
+// pinned to --producer-cpu and --consumer-cpu, which should be different cores
+// in order to measure the cost of moving the cache lines of the header between
+// them. This is done both with the multi-user producer and consumer and with
+// the single-user ones. Run it on builds before and after a change to the
+// layout of the header to compare them.
+
+namespace {
+
+struct Options {
+  size_t numOps{10000000};
+  size_t messageSize{8};
+  size_t bufferSize{1 << 16};
+  int producerCpu{0};
+  int consumerCpu{1};
+};
+
+void usage(int status, const char* argv0) {
+  if (status != EXIT_SUCCESS) {
+    fprintf(stderr, "`%s --help' for more information.\n", argv0);
+    exit(status);
+  }
+
+  fprintf(stderr, "Usage: %s [OPTIONS]\n", argv0);
+#define X(x) fputs(x "\n", stderr);
+  X("");
+  X("--num-ops=NUM                 Number of messages to write and read");
+  X("--message-size=SIZE           Size of each message, in bytes");
+  X("--buffer-size=SIZE            Size of the ringbuffer, in bytes");
+  X("--producer-cpu=CPU            CPU to pin the producer thread to");
+  X("--consumer-cpu=CPU            CPU to pin the consumer thread to");
+#undef X
+
+  exit(status);
+}
+
+Options parseOptions(int argc, char** argv) {
+  Options options;
+  int opt;
+  int flag = -1;
+
+  enum Flags : int {
+    NUM_OPS,
+    MESSAGE_SIZE,
+    BUFFER_SIZE,
+    PRODUCER_CPU,
+    CONSUMER_CPU,
+    HELP,
+  };
+
+  static struct option longOptions[] = {
+      {"num-ops", required_argument, &flag, NUM_OPS},
+      {"message-size", required_argument, &flag, MESSAGE_SIZE},
+      {"buffer-size", required_argument, &flag, BUFFER_SIZE},
+      {"producer-cpu", required_argument, &flag, PRODUCER_CPU},
+      {"consumer-cpu", required_argument, &flag, CONSUMER_CPU},
+      {"help", no_argument, &flag, HELP},
+      {nullptr, 0, nullptr, 0}};
+
+  while (1) {
+    opt = getopt_long(argc, argv, "", longOptions, nullptr);
+    if (opt == -1) {
+      break;
+    }
+    if (opt != 0) {
+      usage(EXIT_FAILURE, argv[0]);
+      break;
+    }
+    switch (flag) {
+      case NUM_OPS:
+        options.numOps = std::strtoull(optarg, nullptr, 10);
+        break;
+      case MESSAGE_SIZE:
+        options.messageSize = std::strtoull(optarg, nullptr, 10);
+        break;
+      case BUFFER_SIZE:
+        options.bufferSize = std::strtoull(optarg, nullptr, 10);
+        break;
+      case PRODUCER_CPU:
+        options.producerCpu = std::strtol(optarg, nullptr, 10);
+        break;
+      case CONSUMER_CPU:
+        options.consumerCpu = std::strtol(optarg, nullptr, 10);
+        break;
+      case HELP:
+        usage(EXIT_SUCCESS, argv[0]);
+        break;
+      default:
+        usage(EXIT_FAILURE, argv[0]);
+        break;
+    }
+  }
+
+  if (options.messageSize == 0 || options.messageSize > options.bufferSize) {
+    fprintf(stderr, "Message size must be positive and fit the ringbuffer\n");
+    usage(EXIT_FAILURE, argv[0]);
+  }
+
+  return options;
+}
+
+void pinToCpu(int cpu) {
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  CPU_SET(cpu, &cpuSet);
+  int rv = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+  if (rv != 0) {
+    fprintf(stderr, "Couldn't pin to CPU %d: %s\n", cpu, strerror(rv));
+  }
+}
+
+template <typename TProducer, typename TConsumer>
+void runBenchmark(const std::string& name, const Options& options) {
+  RingBufferHeader header(options.bufferSize);
+  auto data = std::make_unique<uint8_t[]>(header.kDataPoolByteSize);
+  RingBuffer rb(&header, data.get());
+
+  std::vector<uint8_t> message(options.messageSize);
+
+  auto start = std::chrono::steady_clock::now();
+
+  std::thread consumerThread([&]() {
+    pinToCpu(options.consumerCpu);
+    std::vector<uint8_t> buffer(options.messageSize);
+    TConsumer consumer(rb);
+    for (size_t opIdx = 0; opIdx < options.numOps;) {
+      ssize_t ret = consumer.read(buffer.data(), buffer.size());
+      if (ret > 0) {
+        opIdx++;
+      }
+    }
+  });
+
+  pinToCpu(options.producerCpu);
+  {
+    TProducer producer(rb);
+    for (size_t opIdx = 0; opIdx < options.numOps;) {
+      ssize_t ret = producer.write(message.data(), message.size());
+      if (ret > 0) {
+        opIdx++;
+      }
+    }
+  }
+  consumerThread.join();
+
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  fprintf(
+      stderr,
+      "%-20s %12.3f Mops/s %12.3f GB/s\n",
+      name.c_str(),
+      options.numOps / seconds / 1e6,
+      options.numOps * options.messageSize / seconds / 1e9);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options options = parseOptions(argc, argv);
+
+  fprintf(
+      stderr,
+      "Header of %zu bytes, %zu messages of %zu bytes, CPUs %d and %d\n",
+      sizeof(RingBufferHeader),
+      options.numOps,
+      options.messageSize,
+      options.producerCpu,
+      options.consumerCpu);
+
+  runBenchmark<Producer, Consumer>("multi-user", options);
+  runBenchmark<SingleProducer, SingleConsumer>("single-user", options);
+
+  return 0;
+}
@@ -10,10 +10,13 @@
 
 #include <future>
 
+#include <tensorpipe/benchmark/cpu_usage.h>
 #include <tensorpipe/benchmark/measurements.h>
 #include <tensorpipe/benchmark/options.h>
+#include <tensorpipe/benchmark/results.h>
 #include <tensorpipe/benchmark/transport_registry.h>
 #include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/trace.h>
 #include <tensorpipe/transport/connection.h>
 #include <tensorpipe/transport/listener.h>
 
@@ -27,28 +30,37 @@ struct Data {
   size_t size;
 };
 
-static void printMeasurements(Measurements& measurements, size_t dataLen) {
-  measurements.sort();
+static void printMeasurements(
+    const Options& options,
+    const Measurements& measurements,
+    size_t dataLen) {
   fprintf(
       stderr,
-      "%-15s %-15s %-12s %-7s %-7s %-7s %-7s\n",
+      "%-15s %-15s %-12s %-9s %-9s %-9s %-9s %-9s\n",
       "chunk-size",
       "# ping-pong",
       "avg (usec)",
       "p50",
-      "p75",
       "p90",
-      "p95");
+      "p99",
+      "p99.9",
+      "max");
   fprintf(
       stderr,
-      "%-15lu %-15lu %-12.3f %-7.3f %-7.3f %-7.3f %-7.3f\n",
+      "%-15lu %-15lu %-12.3f %-9.3f %-9.3f %-9.3f %-9.3f %-9.3f\n",
       dataLen,
       measurements.size(),
       measurements.sum().count() / (float)measurements.size() / 1000.0,
       measurements.percentile(0.50).count() / 1000.0,
-      measurements.percentile(0.75).count() / 1000.0,
       measurements.percentile(0.90).count() / 1000.0,
-      measurements.percentile(0.95).count() / 1000.0);
+      measurements.percentile(0.99).count() / 1000.0,
+      measurements.percentile(0.999).count() / 1000.0,
+      measurements.max().count() / 1000.0);
+  exportMeasurements(
+      measurements,
+      options.transport + "/" + std::to_string(dataLen),
+      options.csvPath,
+      options.jsonPath);
 }
 
 static std::unique_ptr<uint8_t[]> createData(const int size) {
@@ -99,7 +111,6 @@ static void runServer(const Options& options) {
       std::make_unique<uint8_t[]>(options.payloadSize),
       options.payloadSize};
   Measurements measurements;
-  measurements.reserve(options.numRoundTrips);
 
   std::shared_ptr<transport::Context> context;
   context = TensorpipeTransportRegistry().create(options.transport);
@@ -113,11 +124,17 @@ static void runServer(const Options& options) {
   });
   std::shared_ptr<Connection> conn = connProm.get_future().get();
 
+  const CpuTimes startCpuTimes = getCpuTimes();
   std::promise<void> doneProm;
   serverPongPingNonBlock(
       std::move(conn), numRoundTrips, doneProm, data, measurements);
 
   doneProm.get_future().get();
+  printCpuUsage(
+      startCpuTimes,
+      getCpuTimes(),
+      2 * options.numRoundTrips * data.size,
+      2 * options.numRoundTrips);
   context->join();
 }
 
@@ -147,7 +164,6 @@ static void clientPingPongNonBlock(
                 clientPingPongNonBlock(
                     conn, numRoundTrips, doneProm, data, measurements);
               } else {
-                printMeasurements(measurements, data.size);
                 doneProm.set_value();
               }
             });
@@ -163,18 +179,36 @@ static void runClient(const Options& options) {
       std::make_unique<uint8_t[]>(options.payloadSize),
       options.payloadSize};
   Measurements measurements;
-  measurements.reserve(options.numRoundTrips);
 
   std::shared_ptr<transport::Context> context;
   context = TensorpipeTransportRegistry().create(options.transport);
   validateTransportContext(context);
   std::shared_ptr<Connection> conn = context->connect(addr);
 
+  const CpuTimes startCpuTimes = getCpuTimes();
+  const auto startTime = Measurements::clock::now();
   std::promise<void> doneProm;
   clientPingPongNonBlock(
       std::move(conn), numRoundTrips, doneProm, data, measurements);
 
   doneProm.get_future().get();
+  const auto doneTime = Measurements::clock::now();
+  const CpuTimes stopCpuTimes = getCpuTimes();
+  printMeasurements(options, measurements, data.size);
+  printCpuUsage(
+      startCpuTimes,
+      stopCpuTimes,
+      2 * options.numRoundTrips * data.size,
+      2 * options.numRoundTrips);
+  exportResults(
+      options.resultsPath,
+      "transport",
+      options.transport + "/" + std::to_string(data.size),
+      options,
+      measurements,
+      doneTime - startTime,
+      data.size,
+      computeCpuUsage(startCpuTimes, stopCpuTimes));
   context->join();
 }
 
@@ -195,5 +229,9 @@ int main(int argc, char** argv) {
     TP_THROW_ASSERT() << "unknown mode: " << x.mode;
   }
 
+  if (!x.tracePath.empty()) {
+    trace::writeChromeTrace(x.tracePath);
+  }
+
   return 0;
 }
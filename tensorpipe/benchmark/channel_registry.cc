@@ -32,6 +32,26 @@ std::shared_ptr<tensorpipe::channel::CpuContext> makeCmaChannel() {
 TP_REGISTER_CREATOR(TensorpipeChannelRegistry, cma, makeCmaChannel);
 #endif // TENSORPIPE_HAS_CMA_CHANNEL
 
+// SHM ARENA
+
+#if TENSORPIPE_HAS_SHM_ARENA_CHANNEL
+std::shared_ptr<tensorpipe::channel::CpuContext> makeShmArenaChannel() {
+  return std::make_shared<tensorpipe::channel::shm_arena::Context>();
+}
+
+TP_REGISTER_CREATOR(TensorpipeChannelRegistry, shm_arena, makeShmArenaChannel);
+#endif // TENSORPIPE_HAS_SHM_ARENA_CHANNEL
+
+// IBV
+
+#if TENSORPIPE_HAS_IBV_CHANNEL
+std::shared_ptr<tensorpipe::channel::CpuContext> makeIbvChannel() {
+  return std::make_shared<tensorpipe::channel::ibv::Context>();
+}
+
+TP_REGISTER_CREATOR(TensorpipeChannelRegistry, ibv, makeIbvChannel);
+#endif // TENSORPIPE_HAS_IBV_CHANNEL
+
 // MPT
 
 std::shared_ptr<tensorpipe::channel::CpuContext> makeMptChannel() {
@@ -47,3 +67,98 @@ std::shared_ptr<tensorpipe::channel::CpuContext> makeXthChannel() {
 }
 
 TP_REGISTER_CREATOR(TensorpipeChannelRegistry, xth, makeXthChannel);
+
+#if TENSORPIPE_SUPPORTS_CUDA
+
+TP_DEFINE_SHARED_REGISTRY(
+    TensorpipeCudaChannelRegistry,
+    tensorpipe::channel::CudaContext);
+
+// CUDA BASIC
+
+std::shared_ptr<tensorpipe::channel::CudaContext> makeCudaBasicChannel() {
+  return std::make_shared<tensorpipe::channel::cuda_basic::Context>(
+      std::make_shared<tensorpipe::channel::basic::Context>());
+}
+
+TP_REGISTER_CREATOR(
+    TensorpipeCudaChannelRegistry,
+    cuda_basic,
+    makeCudaBasicChannel);
+
+// CUDA GDR
+
+#if TENSORPIPE_HAS_CUDA_GDR_CHANNEL
+std::shared_ptr<tensorpipe::channel::CudaContext> makeCudaGdrChannel() {
+  return std::make_shared<tensorpipe::channel::cuda_gdr::Context>();
+}
+
+TP_REGISTER_CREATOR(
+    TensorpipeCudaChannelRegistry,
+    cuda_gdr,
+    makeCudaGdrChannel);
+#endif // TENSORPIPE_HAS_CUDA_GDR_CHANNEL
+
+// CUDA IPC
+
+#if TENSORPIPE_HAS_CUDA_IPC_CHANNEL
+std::shared_ptr<tensorpipe::channel::CudaContext> makeCudaIpcChannel() {
+  return std::make_shared<tensorpipe::channel::cuda_ipc::Context>();
+}
+
+TP_REGISTER_CREATOR(
+    TensorpipeCudaChannelRegistry,
+    cuda_ipc,
+    makeCudaIpcChannel);
+
+// The same, with the copies of large tensors split across several streams so
+// that they use more copy engines, to compare against the one above.
+std::shared_ptr<tensorpipe::channel::CudaContext> makeCudaIpcSplitChannel() {
+  return std::make_shared<tensorpipe::channel::cuda_ipc::Context>(
+      /*useDedicatedCopyStreams=*/true, /*numSplitStreams=*/4);
+}
+
+TP_REGISTER_CREATOR(
+    TensorpipeCudaChannelRegistry,
+    cuda_ipc_split,
+    makeCudaIpcSplitChannel);
+
+// The same, with the receivers having the tensors pushed to them whenever their
+// copy stream is still busy.
+std::shared_ptr<tensorpipe::channel::CudaContext> makeCudaIpcAutoChannel() {
+  return std::make_shared<tensorpipe::channel::cuda_ipc::Context>(
+      /*useDedicatedCopyStreams=*/true,
+      /*numSplitStreams=*/1,
+      tensorpipe::channel::cuda_ipc::CopyDirection::kAuto);
+}
+
+TP_REGISTER_CREATOR(
+    TensorpipeCudaChannelRegistry,
+    cuda_ipc_auto,
+    makeCudaIpcAutoChannel);
+#endif // TENSORPIPE_HAS_CUDA_IPC_CHANNEL
+
+// CUDA XTH
+
+std::shared_ptr<tensorpipe::channel::CudaContext> makeCudaXthChannel() {
+  return std::make_shared<tensorpipe::channel::cuda_xth::Context>();
+}
+
+TP_REGISTER_CREATOR(
+    TensorpipeCudaChannelRegistry,
+    cuda_xth,
+    makeCudaXthChannel);
+
+std::shared_ptr<tensorpipe::channel::CudaContext> makeCudaXthSplitChannel() {
+  return std::make_shared<tensorpipe::channel::cuda_xth::Context>(
+      /*useDedicatedCopyStreams=*/true,
+      /*relayThroughPeers=*/false,
+      /*numSplitStreams=*/4);
+}
+
+TP_REGISTER_CREATOR(
+    TensorpipeCudaChannelRegistry,
+    cuda_xth_split,
+    makeCudaXthSplitChannel);
+
+#endif // TENSORPIPE_SUPPORTS_CUDA
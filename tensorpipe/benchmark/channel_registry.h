@@ -8,9 +8,20 @@
 
 #pragma once
 
+#include <tensorpipe/config.h>
+
 #include <tensorpipe/channel/cpu_context.h>
+#if TENSORPIPE_SUPPORTS_CUDA
+#include <tensorpipe/channel/cuda_context.h>
+#endif // TENSORPIPE_SUPPORTS_CUDA
 #include <tensorpipe/util/registry/registry.h>
 
 TP_DECLARE_SHARED_REGISTRY(
     TensorpipeChannelRegistry,
     tensorpipe::channel::CpuContext);
+
+#if TENSORPIPE_SUPPORTS_CUDA
+TP_DECLARE_SHARED_REGISTRY(
+    TensorpipeCudaChannelRegistry,
+    tensorpipe::channel::CudaContext);
+#endif // TENSORPIPE_SUPPORTS_CUDA
@@ -0,0 +1,283 @@
+#!/usr/bin/env python3
+# Copyright (c) Facebook, Inc. and its affiliates.
+# All rights reserved.
+#
+# This source code is licensed under the BSD-style license found in the
+# LICENSE file in the root directory of this source tree.
+
+# Compare the results that two versions wrote with --results (one JSON line per
+# run), pairing the runs with the same benchmark, label and options, and exit
+# with status 1 if the candidate is significantly worse than the baseline on
+# any of them. A run may be repeated (e.g., by running the benchmark several
+# times with the same file), in which case the latency histograms of the
+# repetitions are merged and their throughputs and CPU costs are treated as
+# samples.
+#
+# A difference is flagged when it's both statistically significant (at the
+# given level) and larger than the given relative threshold, as with millions
+# of round trips even a negligible shift in latency would be significant:
+# - latency: one-sided Mann-Whitney U test on the histograms (which considers
+#   the whole distribution rather than a percentile), and the relative change
+#   of the median or of the 99th percentile;
+# - throughput and CPU cost per message: one-sided Welch's t-test when both
+#   sides have at least two repetitions, or else the threshold alone.
+
+import argparse
+import collections
+import json
+import math
+import sys
+
+
+def load_runs(path):
+    runs = collections.OrderedDict()
+    with open(path, "r") as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            run = json.loads(line)
+            key = (
+                run["benchmark"],
+                run["label"],
+                json.dumps(run["config"], sort_keys=True),
+            )
+            runs.setdefault(key, []).append(run)
+    return runs
+
+
+def merge_buckets(runs):
+    buckets = collections.defaultdict(int)
+    for run in runs:
+        for lowest, highest, count in run["latency"]["buckets"]:
+            buckets[(lowest, highest)] += count
+    return sorted(buckets.items())
+
+
+def percentile(buckets, max_ns, fraction):
+    # The highest value of the bucket the percentile falls into, capped by the
+    # largest sample, as the benchmarks compute it.
+    total = sum(count for _, count in buckets)
+    if total == 0:
+        return 0
+    rank = min(max(math.ceil(fraction * total), 1), total)
+    seen = 0
+    for (_, highest), count in buckets:
+        seen += count
+        if seen >= rank:
+            return min(highest, max_ns)
+    return max_ns
+
+
+def mann_whitney_greater(baseline, candidate):
+    # The p-value of the candidate's samples being stochastically greater than
+    # the baseline's, with the normal approximation (fine for the sample sizes
+    # at hand) corrected for ties, which all samples of a bucket are.
+    counts = collections.defaultdict(lambda: [0, 0])
+    for (lowest, _), count in baseline:
+        counts[lowest][0] += count
+    for (lowest, _), count in candidate:
+        counts[lowest][1] += count
+    n_a = sum(a for a, _ in counts.values())
+    n_b = sum(b for _, b in counts.values())
+    n = n_a + n_b
+    if n_a == 0 or n_b == 0:
+        return 1.0
+    rank_sum_b = 0.0
+    ties = 0.0
+    seen = 0
+    for lowest in sorted(counts):
+        a, b = counts[lowest]
+        t = a + b
+        rank_sum_b += b * (seen + (t + 1) / 2)
+        ties += t ** 3 - t
+        seen += t
+    u_b = rank_sum_b - n_b * (n_b + 1) / 2
+    mean = n_a * n_b / 2
+    variance = n_a * n_b / 12 * ((n + 1) - ties / (n * (n - 1)))
+    if variance <= 0:
+        return 1.0
+    z = (u_b - mean) / math.sqrt(variance)
+    return 0.5 * math.erfc(z / math.sqrt(2))
+
+
+def regularized_incomplete_beta(a, b, x):
+    # By Lentz's continued fraction, as in Numerical Recipes.
+    if x <= 0:
+        return 0.0
+    if x >= 1:
+        return 1.0
+    if x > (a + 1) / (a + b + 2):
+        return 1.0 - regularized_incomplete_beta(b, a, 1 - x)
+    log_front = (
+        math.lgamma(a + b)
+        - math.lgamma(a)
+        - math.lgamma(b)
+        + a * math.log(x)
+        + b * math.log(1 - x)
+    )
+    tiny = 1e-300
+    c = 1.0
+    d = 1.0 - (a + b) * x / (a + 1)
+    d = 1.0 / (d if abs(d) > tiny else tiny)
+    result = d
+    for m in range(1, 300):
+        for numerator in (
+            m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m)),
+            -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1)),
+        ):
+            d = 1.0 + numerator * d
+            d = 1.0 / (d if abs(d) > tiny else tiny)
+            c = 1.0 + numerator / c
+            c = c if abs(c) > tiny else tiny
+            result *= c * d
+        if abs(c * d - 1.0) < 1e-12:
+            break
+    return math.exp(log_front) * result / a
+
+
+def welch_greater(baseline, candidate):
+    # The p-value of the candidate's mean being greater than the baseline's.
+    n_a, n_b = len(baseline), len(candidate)
+    mean_a, mean_b = sum(baseline) / n_a, sum(candidate) / n_b
+    var_a = sum((x - mean_a) ** 2 for x in baseline) / (n_a - 1)
+    var_b = sum((x - mean_b) ** 2 for x in candidate) / (n_b - 1)
+    se2_a, se2_b = var_a / n_a, var_b / n_b
+    if se2_a + se2_b == 0:
+        return 0.0 if mean_b > mean_a else 1.0
+    t = (mean_b - mean_a) / math.sqrt(se2_a + se2_b)
+    dof = (se2_a + se2_b) ** 2 / (
+        (se2_a ** 2 / (n_a - 1) if n_a > 1 else 0)
+        + (se2_b ** 2 / (n_b - 1) if n_b > 1 else 0)
+    )
+    tail = 0.5 * regularized_incomplete_beta(dof / 2, 0.5, dof / (dof + t * t))
+    return tail if t > 0 else 1.0 - tail
+
+
+def relative_change(baseline, candidate):
+    if baseline == 0:
+        return 0.0 if candidate == 0 else math.inf
+    return (candidate - baseline) / baseline
+
+
+class Comparison:
+    def __init__(self, args):
+        self.args = args
+        self.num_regressions = 0
+
+    def report(self, name, metric, baseline, candidate, worse, p_value):
+        change = relative_change(baseline, candidate)
+        # The change in the direction in which the metric gets worse.
+        worsening = change if worse == "higher" else -change
+        significant = p_value is None or p_value < self.args.alpha
+        if worsening > self.args.threshold and significant:
+            verdict = "REGRESSION"
+            self.num_regressions += 1
+        elif -worsening > self.args.threshold and significant:
+            verdict = "improvement"
+        else:
+            verdict = ""
+        print(
+            f"{name:<40} {metric:<18} {baseline:>14.6g} {candidate:>14.6g} "
+            f"{change * 100:>+8.1f}% "
+            f"{'n/a' if p_value is None else f'{p_value:.3g}':>9} {verdict}"
+        )
+
+    def compare_latency(self, name, baseline_runs, candidate_runs):
+        baseline = merge_buckets(baseline_runs)
+        candidate = merge_buckets(candidate_runs)
+        baseline_max = max(run["latency"]["max_ns"] for run in baseline_runs)
+        candidate_max = max(run["latency"]["max_ns"] for run in candidate_runs)
+        # Either direction of the test, so that improvements show up too.
+        p_worse = mann_whitney_greater(baseline, candidate)
+        p_better = mann_whitney_greater(candidate, baseline)
+        for metric, fraction in (
+            ("latency p50 (ns)", 0.5),
+            ("latency p99 (ns)", 0.99),
+        ):
+            b = percentile(baseline, baseline_max, fraction)
+            c = percentile(candidate, candidate_max, fraction)
+            self.report(
+                name, metric, b, c, "higher", p_worse if c >= b else p_better
+            )
+
+    def compare_samples(self, name, metric, baseline, candidate, worse):
+        mean_b = sum(baseline) / len(baseline)
+        mean_c = sum(candidate) / len(candidate)
+        p_value = None
+        if len(baseline) >= 2 and len(candidate) >= 2:
+            if worse == "higher":
+                increasing = mean_c >= mean_b
+            else:
+                increasing = mean_c > mean_b
+            p_value = (
+                welch_greater(baseline, candidate)
+                if increasing
+                else welch_greater(candidate, baseline)
+            )
+        self.report(name, metric, mean_b, mean_c, worse, p_value)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Compare two files of benchmark results (as written with "
+        "--results) and flag the significant regressions."
+    )
+    parser.add_argument("baseline", help="results of the reference version")
+    parser.add_argument("candidate", help="results of the version under test")
+    parser.add_argument(
+        "--alpha",
+        type=float,
+        default=0.01,
+        help="significance level of the tests (default: %(default)s)",
+    )
+    parser.add_argument(
+        "--threshold",
+        type=float,
+        default=0.05,
+        help="smallest relative change that counts (default: %(default)s)",
+    )
+    args = parser.parse_args()
+
+    baseline_runs = load_runs(args.baseline)
+    candidate_runs = load_runs(args.candidate)
+
+    print(
+        f"{'run':<40} {'metric':<18} {'baseline':>14} {'candidate':>14} "
+        f"{'change':>9} {'p-value':>9}"
+    )
+    comparison = Comparison(args)
+    for key, candidate in candidate_runs.items():
+        benchmark, label, _ = key
+        name = f"{benchmark}:{label}"
+        baseline = baseline_runs.get(key)
+        if baseline is None:
+            print(f"{name:<40} (not in the baseline)")
+            continue
+        comparison.compare_latency(name, baseline, candidate)
+        comparison.compare_samples(
+            name,
+            "throughput (Gb/s)",
+            [run["throughput"]["gbps"] for run in baseline],
+            [run["throughput"]["gbps"] for run in candidate],
+            "lower",
+        )
+        comparison.compare_samples(
+            name,
+            "CPU s/1k msg",
+            [run["cpu"]["s_per_1k_msg"] for run in baseline],
+            [run["cpu"]["s_per_1k_msg"] for run in candidate],
+            "higher",
+        )
+    for key in baseline_runs:
+        if key not in candidate_runs:
+            name = f"{key[0]}:{key[1]}"
+            print(f"{name:<40} (not in the candidate)")
+
+    if comparison.num_regressions > 0:
+        print(f"{comparison.num_regressions} regression(s)", file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
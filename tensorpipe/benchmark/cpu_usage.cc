@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/benchmark/cpu_usage.h>
+
+#include <dirent.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+namespace tensorpipe {
+namespace benchmark {
+
+namespace {
+
+std::chrono::nanoseconds toNanoseconds(const struct timeval& tv) {
+  return std::chrono::seconds(tv.tv_sec) +
+      std::chrono::microseconds(tv.tv_usec);
+}
+
+#ifdef __linux__
+
+// The clock of a thread of this process given its id, rather than the handle
+// that pthread_getcpuclockid requires, built as glibc builds the latter (i.e.,
+// a per-thread clock of the "scheduler time" kind, in the kernel's encoding).
+clockid_t cpuClockOfThread(pid_t tid) {
+  constexpr clockid_t kCpuClockPerThread = 4;
+  constexpr clockid_t kCpuClockSched = 2;
+  return (~static_cast<clockid_t>(tid) << 3) | kCpuClockPerThread |
+      kCpuClockSched;
+}
+
+#endif // __linux__
+
+} // namespace
+
+CpuTimes getCpuTimes() {
+  CpuTimes times;
+
+  struct rusage usage;
+  if (::getrusage(RUSAGE_SELF, &usage) == 0) {
+    times.process = toNanoseconds(usage.ru_utime) +
+        toNanoseconds(usage.ru_stime);
+  }
+
+#ifdef __linux__
+  DIR* dir = ::opendir("/proc/self/task");
+  if (dir == nullptr) {
+    return times;
+  }
+  while (struct dirent* entry = ::readdir(dir)) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    const pid_t tid = std::atoi(entry->d_name);
+    struct timespec ts;
+    // The thread may have ended in the meantime.
+    if (::clock_gettime(cpuClockOfThread(tid), &ts) != 0) {
+      continue;
+    }
+    CpuTimes::Thread& thread = times.threads[tid];
+    thread.time =
+        std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+    std::ifstream comm(
+        std::string("/proc/self/task/") + entry->d_name + "/comm");
+    std::getline(comm, thread.name);
+  }
+  ::closedir(dir);
+#endif // __linux__
+
+  return times;
+}
+
+CpuUsage computeCpuUsage(const CpuTimes& start, const CpuTimes& stop) {
+  CpuUsage usage;
+  usage.process = stop.process - start.process;
+  usage.numThreads = stop.threads.size();
+  for (const auto& iter : stop.threads) {
+    const CpuTimes::Thread& thread = iter.second;
+    CpuUsage::Threads& threads = usage.threadsByName[thread.name];
+    threads.numThreads++;
+    threads.time += thread.time;
+    // The threads that started in between spent all their time there.
+    auto startIter = start.threads.find(iter.first);
+    if (startIter != start.threads.end()) {
+      threads.time -= startIter->second.time;
+    }
+  }
+  return usage;
+}
+
+void printCpuUsage(
+    const CpuTimes& start,
+    const CpuTimes& stop,
+    size_t numBytes,
+    size_t numMessages) {
+  const CpuUsage usage = computeCpuUsage(start, stop);
+
+  auto printRow = [&](const std::string& name,
+                      int numThreads,
+                      std::chrono::nanoseconds time) {
+    const double seconds = std::chrono::duration<double>(time).count();
+    fprintf(
+        stderr,
+        "%-25s %-12d %-12.3f %-12.3f %-12.6f\n",
+        name.c_str(),
+        numThreads,
+        seconds,
+        numBytes > 0 ? seconds / (numBytes / 1e9) : 0.0,
+        numMessages > 0 ? seconds / (numMessages / 1e3) : 0.0);
+  };
+
+  fprintf(
+      stderr,
+      "%-25s %-12s %-12s %-12s %-12s\n",
+      "thread",
+      "# threads",
+      "CPU (s)",
+      "CPU s/GB",
+      "CPU s/1k msg");
+  for (const auto& iter : usage.threadsByName) {
+    printRow(iter.first, iter.second.numThreads, iter.second.time);
+  }
+  printRow("(process)", usage.numThreads, usage.process);
+}
+
+} // namespace benchmark
+} // namespace tensorpipe
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+
+namespace tensorpipe {
+namespace benchmark {
+
+// The CPU time (user and system) that the process, and each of its live
+// threads, had consumed at some point. The threads are those of the contexts
+// (loops, reactors, copy threads, ...) as well as those of the benchmark, and
+// are identified by their names, which TensorPipe sets to TP_<something>.
+struct CpuTimes {
+  struct Thread {
+    std::string name;
+    std::chrono::nanoseconds time{0};
+  };
+
+  std::chrono::nanoseconds process{0};
+  std::map<pid_t, Thread> threads;
+};
+
+CpuTimes getCpuTimes();
+
+// The CPU time that was spent between two points, in total and for each thread
+// name (summing the threads that share one, e.g., those of several contexts).
+// The threads that ended in between only count towards the total.
+struct CpuUsage {
+  struct Threads {
+    int numThreads{0};
+    std::chrono::nanoseconds time{0};
+  };
+
+  std::chrono::nanoseconds process{0};
+  int numThreads{0};
+  std::map<std::string, Threads> threadsByName;
+};
+
+CpuUsage computeCpuUsage(const CpuTimes& start, const CpuTimes& stop);
+
+// Print the CPU time that was spent between the two points, in total and for
+// each thread name (summing the threads that share one, e.g., those of several
+// contexts), in seconds per GB and per thousand messages moved in that time.
+// The threads that ended in between only count towards the total.
+void printCpuUsage(
+    const CpuTimes& start,
+    const CpuTimes& stop,
+    size_t numBytes,
+    size_t numMessages);
+
+} // namespace benchmark
+} // namespace tensorpipe
@@ -9,53 +9,227 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <chrono>
-#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <ostream>
+#include <string>
 
 namespace tensorpipe {
 namespace benchmark {
 
+// Write the string as a JSON string literal, quoted and escaped.
+inline void writeJsonString(std::ostream& os, const std::string& str) {
+  os << '"';
+  for (const char c : str) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      static const char kHexDigits[] = "0123456789abcdef";
+      os << "\\u00" << kHexDigits[c >> 4] << kHexDigits[c & 0xf];
+    } else {
+      os << c;
+    }
+  }
+  os << '"';
+}
+
+// The samples are kept in a histogram in the style of HDR histograms, rather
+// than one by one, hence the memory doesn't grow with the length of the run.
+// The durations below 2^kSubBucketBits nanoseconds have a bucket each, and the
+// range of each power of two above that is split in 2^(kSubBucketBits-1)
+// buckets, which bounds the relative error of the percentiles by 1/64.
 class Measurements {
+ public:
   using clock = std::chrono::high_resolution_clock;
   using nanoseconds = std::chrono::nanoseconds;
 
- public:
+  static constexpr int kSubBucketBits = 7;
+  static constexpr size_t kNumBuckets =
+      (size_t{1} << kSubBucketBits) +
+      (64 - kSubBucketBits) * (size_t{1} << (kSubBucketBits - 1));
+
   void markStart() {
     start_ = clock::now();
   }
 
   void markStop() {
-    samples_.push_back(clock::now() - start_);
+    add(clock::now() - start_);
   }
 
-  void sort() {
-    std::sort(samples_.begin(), samples_.end());
+  // For when several measurements overlap, and each keeps its own start.
+  void markStop(clock::time_point start) {
+    add(clock::now() - start);
   }
 
-  void reserve(size_t capacity) {
-    samples_.reserve(capacity);
+  void add(nanoseconds sample) {
+    const uint64_t value = std::max<int64_t>(sample.count(), 0);
+    ++buckets_[bucketOf(value)];
+    ++count_;
+    sum_ += nanoseconds(value);
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+
+  // Add all the samples of the other object to this one, e.g., to aggregate
+  // the ones that each thread gathered on its own.
+  void merge(const Measurements& other) {
+    for (size_t bucket = 0; bucket < kNumBuckets; ++bucket) {
+      buckets_[bucket] += other.buckets_[bucket];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
   }
 
   size_t size() const {
-    return samples_.size();
+    return count_;
   }
 
   nanoseconds sum() const {
-    nanoseconds sum{0};
-    for (const auto& sample : samples_) {
-      sum += sample;
+    return sum_;
+  }
+
+  nanoseconds min() const {
+    return nanoseconds(count_ > 0 ? min_ : 0);
+  }
+
+  nanoseconds max() const {
+    return nanoseconds(max_);
+  }
+
+  // Return the given percentile (expressed between 0 and 1) of the samples,
+  // that is, the highest value of the bucket it falls into, capped by the
+  // largest sample. Return zero if there are no samples.
+  nanoseconds percentile(double fraction) const {
+    if (count_ == 0) {
+      return nanoseconds(0);
     }
-    return sum;
+    const uint64_t rank = std::min<uint64_t>(
+        std::max<uint64_t>(std::ceil(fraction * count_), 1), count_);
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < kNumBuckets; ++bucket) {
+      seen += buckets_[bucket];
+      if (seen >= rank) {
+        return nanoseconds(std::min(highestOf(bucket), max_));
+      }
+    }
+    return nanoseconds(max_);
   }
 
-  nanoseconds percentile(float f) const {
-    return samples_[static_cast<size_t>(f * samples_.size())];
+  // Write one row for each non-empty bucket, with the given label, so that the
+  // histograms of several runs can be appended to a same file.
+  static void writeCsvHeader(std::ostream& os) {
+    os << "label,lowest_ns,highest_ns,count\n";
+  }
+
+  void writeCsv(std::ostream& os, const std::string& label) const {
+    for (size_t bucket = 0; bucket < kNumBuckets; ++bucket) {
+      if (buckets_[bucket] > 0) {
+        os << label << "," << lowestOf(bucket) << "," << highestOf(bucket)
+           << "," << buckets_[bucket] << "\n";
+      }
+    }
+  }
+
+  // Write the summary and the non-empty buckets as a JSON object on a single
+  // line, so that the ones of several runs can be appended to a same file.
+  void writeJson(std::ostream& os, const std::string& label) const {
+    os << "{\"label\":";
+    writeJsonString(os, label);
+    os << ",";
+    writeJsonFields(os);
+    os << "}\n";
+  }
+
+  // The members of the object that writeJson writes, besides the label, for
+  // embedding the histogram in other objects.
+  void writeJsonFields(std::ostream& os) const {
+    os << "\"count\":" << count_ << ",\"sum_ns\":" << sum_.count()
+       << ",\"min_ns\":" << min().count()
+       << ",\"p50_ns\":" << percentile(0.50).count()
+       << ",\"p90_ns\":" << percentile(0.90).count()
+       << ",\"p99_ns\":" << percentile(0.99).count()
+       << ",\"p999_ns\":" << percentile(0.999).count()
+       << ",\"max_ns\":" << max_ << ",\"buckets\":[";
+    bool first = true;
+    for (size_t bucket = 0; bucket < kNumBuckets; ++bucket) {
+      if (buckets_[bucket] > 0) {
+        os << (first ? "" : ",") << "[" << lowestOf(bucket) << ","
+           << highestOf(bucket) << "," << buckets_[bucket] << "]";
+        first = false;
+      }
+    }
+    os << "]";
   }
 
  private:
   clock::time_point start_;
-  std::vector<nanoseconds> samples_;
+  std::array<uint64_t, kNumBuckets> buckets_{};
+  uint64_t count_{0};
+  nanoseconds sum_{0};
+  uint64_t min_{std::numeric_limits<uint64_t>::max()};
+  uint64_t max_{0};
+
+  static size_t bucketOf(uint64_t value) {
+    if (value < (uint64_t{1} << kSubBucketBits)) {
+      return value;
+    }
+    const int exponent = 63 - __builtin_clzll(value);
+    const uint64_t mantissa = value >> (exponent - kSubBucketBits + 1);
+    return (size_t{1} << kSubBucketBits) +
+        (exponent - kSubBucketBits) * (size_t{1} << (kSubBucketBits - 1)) +
+        (mantissa - (uint64_t{1} << (kSubBucketBits - 1)));
+  }
+
+  static int shiftOf(size_t bucket) {
+    if (bucket < (size_t{1} << kSubBucketBits)) {
+      return 0;
+    }
+    return (bucket - (size_t{1} << kSubBucketBits)) /
+        (size_t{1} << (kSubBucketBits - 1)) +
+        1;
+  }
+
+  static uint64_t lowestOf(size_t bucket) {
+    if (bucket < (size_t{1} << kSubBucketBits)) {
+      return bucket;
+    }
+    const uint64_t mantissa = (uint64_t{1} << (kSubBucketBits - 1)) +
+        (bucket - (size_t{1} << kSubBucketBits)) %
+            (size_t{1} << (kSubBucketBits - 1));
+    return mantissa << shiftOf(bucket);
+  }
+
+  static uint64_t highestOf(size_t bucket) {
+    return lowestOf(bucket) + (uint64_t{1} << shiftOf(bucket)) - 1;
+  }
 };
 
+// Append the samples to the CSV and/or JSON files at the given paths, unless
+// they are empty, starting the CSV file with a header if it's new.
+inline void exportMeasurements(
+    const Measurements& measurements,
+    const std::string& label,
+    const std::string& csvPath,
+    const std::string& jsonPath) {
+  if (!csvPath.empty()) {
+    std::ofstream csv(csvPath, std::ios::app);
+    csv.seekp(0, std::ios::end);
+    if (csv.tellp() == 0) {
+      Measurements::writeCsvHeader(csv);
+    }
+    measurements.writeCsv(csv, label);
+  }
+  if (!jsonPath.empty()) {
+    std::ofstream json(jsonPath, std::ios::app);
+    measurements.writeJson(json, label);
+  }
+}
+
 } // namespace benchmark
 } // namespace tensorpipe
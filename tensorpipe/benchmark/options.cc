@@ -45,6 +45,35 @@ void validateChannelContext(std::shared_ptr<channel::CpuContext> context) {
   }
 }
 
+#if TENSORPIPE_SUPPORTS_CUDA
+void validateCudaChannelContext(std::shared_ptr<channel::CudaContext> context) {
+  if (!context) {
+    auto keys = TensorpipeCudaChannelRegistry().keys();
+    std::cout << "The CUDA channel you passed in is not supported. The "
+              << "following CUDA channels are valid: ";
+    for (const auto& key : keys) {
+      std::cout << key << ", ";
+    }
+    std::cout << "\n";
+    exit(EXIT_FAILURE);
+  }
+}
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+std::vector<std::string> splitList(const std::string& list) {
+  std::vector<std::string> items;
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    items.push_back(list.substr(start, end - start));
+    start = end + 1;
+  }
+  return items;
+}
+
 static void usage(int status, const char* argv0) {
   if (status != EXIT_SUCCESS) {
     fprintf(stderr, "`%s --help' for more information.\n", argv0);
@@ -57,13 +86,47 @@ static void usage(int status, const char* argv0) {
   X("--mode=MODE                     Running mode [listen|connect]");
   X("--transport=TRANSPORT           Transport backend [shm|uv]");
   X("--channel=CHANNEL               Channel backend [basic]");
+  X("--cuda-channel=CHANNEL [optional]");
+  X("                                CUDA channel backend [cuda_basic|");
+  X("                                cuda_ipc|cuda_xth|cuda_gdr|");
+  X("                                cuda_ipc_split|cuda_xth_split]");
   X("--address=ADDRESS               Address to listen or connect to");
   X("--num-round-trips=NUM           Number of write/read pairs to perform");
+  X("--window=NUM [optional]         Number of write/read pairs in flight");
+  X("--num-pipes=NUM [optional]      Number of pipes to run the pairs on");
+  X("--num-client-threads=NUM [optional]");
+  X("                                Number of client threads (and contexts)");
   X("--num-payloads=NUM [optional]   Number of payloads of each write/read pair");
   X("--payload-size=SIZE [optional]  Size of payload of each write/read pair");
   X("--num-tensors=NUM [optional]    Number of tensors of each write/read pair");
   X("--tensor-size=SIZE [optional]   Size of tensor of each write/read pair");
   X("--metadata-size=SIZE [optional] Size of metadata of each write/read pair");
+  X("--tensor-type=TYPE [optional]   Type of the tensors [cpu|cuda]");
+  X("--client-cuda-device=IDX [optional]");
+  X("                                Device of the CUDA tensors of the client");
+  X("--server-cuda-device=IDX [optional]");
+  X("                                Device of the CUDA tensors of the server");
+  X("--sweep [optional]              Run for each of the (comma-separated)");
+  X("                                channels and each tensor size from 1 KiB");
+  X("                                to 1 GiB, and print a bandwidth matrix");
+  X("--payload-checksums [optional]  Checksum the payloads and CPU tensors");
+  X("--sim-bandwidth=GBPS [optional] Have the transport go over a simulated");
+  X("                                link with this bandwidth (in Gb/s)");
+  X("--sim-latency=US [optional]     ... and this latency (in microseconds)");
+  X("--sim-jitter=US [optional]      ... and up to this jitter on top");
+  X("--sim-seed=NUM [optional]       Seed of the jitter");
+  X("--csv=PATH [optional]           Append the latency histogram to a CSV");
+  X("                                file");
+  X("--json=PATH [optional]          Append the latency histogram and its");
+  X("                                percentiles to a file, as a JSON line");
+  X("--results=PATH [optional]       Append the options, latencies,");
+  X("                                throughput and CPU usage of each run");
+  X("                                to a file, as a JSON line (see");
+  X("                                compare_results.py)");
+  X("--trace=PATH [optional]         Write the trace events to a file, in the");
+  X("                                format of Chrome's trace viewer");
+  X("--tuning-config=PATH [optional] Write the recommended config to a file");
+  X("                                (for benchmark_autotune)");
 
   exit(status);
 }
@@ -86,6 +149,37 @@ static void validateOptions(Options options, const char* argv0) {
     fprintf(stderr, "Missing argument: --num-round-trips must be set\n");
     status = EXIT_FAILURE;
   }
+  if (options.window <= 0) {
+    fprintf(stderr, "Invalid argument: --window must be positive\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.numPipes <= 0) {
+    fprintf(stderr, "Invalid argument: --num-pipes must be positive\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.numClientThreads <= 0 ||
+      options.numClientThreads > options.numPipes) {
+    fprintf(
+        stderr,
+        "Invalid argument: --num-client-threads must be positive and at most"
+        " --num-pipes\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.tensorType == "cuda") {
+#if TENSORPIPE_SUPPORTS_CUDA
+    if (options.cudaChannel.empty()) {
+      fprintf(stderr, "Missing argument: --cuda-channel must be set\n");
+      status = EXIT_FAILURE;
+    }
+#else // TENSORPIPE_SUPPORTS_CUDA
+    fprintf(stderr, "Invalid argument: TensorPipe was built without CUDA\n");
+    status = EXIT_FAILURE;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+  }
+  if (options.sweep && options.numTensors == 0) {
+    fprintf(stderr, "Missing argument: --sweep needs --num-tensors\n");
+    status = EXIT_FAILURE;
+  }
   if (status != EXIT_SUCCESS) {
     usage(status, argv0);
   }
@@ -100,13 +194,31 @@ struct Options parseOptions(int argc, char** argv) {
     MODE,
     TRANSPORT,
     CHANNEL,
+    CUDA_CHANNEL,
     ADDRESS,
     NUM_ROUND_TRIPS,
+    WINDOW,
+    NUM_PIPES,
+    NUM_CLIENT_THREADS,
     NUM_PAYLOADS,
     PAYLOAD_SIZE,
     NUM_TENSORS,
     TENSOR_SIZE,
     METADATA_SIZE,
+    TENSOR_TYPE,
+    CLIENT_CUDA_DEVICE,
+    SERVER_CUDA_DEVICE,
+    SWEEP,
+    PAYLOAD_CHECKSUMS,
+    SIM_BANDWIDTH,
+    SIM_LATENCY,
+    SIM_JITTER,
+    SIM_SEED,
+    CSV,
+    JSON,
+    RESULTS,
+    TRACE,
+    TUNING_CONFIG,
     HELP,
   };
 
@@ -114,13 +226,31 @@ struct Options parseOptions(int argc, char** argv) {
       {"mode", required_argument, &flag, MODE},
       {"transport", required_argument, &flag, TRANSPORT},
       {"channel", required_argument, &flag, CHANNEL},
+      {"cuda-channel", required_argument, &flag, CUDA_CHANNEL},
       {"address", required_argument, &flag, ADDRESS},
       {"num-round-trips", required_argument, &flag, NUM_ROUND_TRIPS},
+      {"window", required_argument, &flag, WINDOW},
+      {"num-pipes", required_argument, &flag, NUM_PIPES},
+      {"num-client-threads", required_argument, &flag, NUM_CLIENT_THREADS},
       {"num-payloads", required_argument, &flag, NUM_PAYLOADS},
       {"payload-size", required_argument, &flag, PAYLOAD_SIZE},
       {"num-tensors", required_argument, &flag, NUM_TENSORS},
       {"tensor-size", required_argument, &flag, TENSOR_SIZE},
       {"metadata-size", required_argument, &flag, METADATA_SIZE},
+      {"tensor-type", required_argument, &flag, TENSOR_TYPE},
+      {"client-cuda-device", required_argument, &flag, CLIENT_CUDA_DEVICE},
+      {"server-cuda-device", required_argument, &flag, SERVER_CUDA_DEVICE},
+      {"sweep", no_argument, &flag, SWEEP},
+      {"payload-checksums", no_argument, &flag, PAYLOAD_CHECKSUMS},
+      {"sim-bandwidth", required_argument, &flag, SIM_BANDWIDTH},
+      {"sim-latency", required_argument, &flag, SIM_LATENCY},
+      {"sim-jitter", required_argument, &flag, SIM_JITTER},
+      {"sim-seed", required_argument, &flag, SIM_SEED},
+      {"csv", required_argument, &flag, CSV},
+      {"json", required_argument, &flag, JSON},
+      {"results", required_argument, &flag, RESULTS},
+      {"trace", required_argument, &flag, TRACE},
+      {"tuning-config", required_argument, &flag, TUNING_CONFIG},
       {"help", no_argument, &flag, HELP},
       {nullptr, 0, nullptr, 0}};
 
@@ -148,12 +278,24 @@ struct Options parseOptions(int argc, char** argv) {
       case CHANNEL:
         options.channel = std::string(optarg, strlen(optarg));
         break;
+      case CUDA_CHANNEL:
+        options.cudaChannel = std::string(optarg, strlen(optarg));
+        break;
       case ADDRESS:
         options.address = std::string(optarg, strlen(optarg));
         break;
       case NUM_ROUND_TRIPS:
         options.numRoundTrips = atoi(optarg);
         break;
+      case WINDOW:
+        options.window = atoi(optarg);
+        break;
+      case NUM_PIPES:
+        options.numPipes = atoi(optarg);
+        break;
+      case NUM_CLIENT_THREADS:
+        options.numClientThreads = atoi(optarg);
+        break;
       case NUM_PAYLOADS:
         options.numPayloads = atoi(optarg);
         break;
@@ -169,6 +311,60 @@ struct Options parseOptions(int argc, char** argv) {
       case METADATA_SIZE:
         options.metadataSize = atoi(optarg);
         break;
+      case TENSOR_TYPE:
+        options.tensorType = std::string(optarg, strlen(optarg));
+        if (options.tensorType != "cpu" && options.tensorType != "cuda") {
+          fprintf(stderr, "Error:\n");
+          fprintf(stderr, "  --tensor-type must be [cpu|cuda]\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case CLIENT_CUDA_DEVICE:
+        options.clientCudaDevice = atoi(optarg);
+        break;
+      case SERVER_CUDA_DEVICE:
+        options.serverCudaDevice = atoi(optarg);
+        break;
+      case SWEEP:
+        options.sweep = true;
+        break;
+      case PAYLOAD_CHECKSUMS:
+        options.payloadChecksums = true;
+        break;
+      case SIM_BANDWIDTH:
+        options.simulateLink = true;
+        options.simLink.bytesPerSecond =
+            static_cast<uint64_t>(atof(optarg) * 1000 * 1000 * 1000 / 8);
+        break;
+      case SIM_LATENCY:
+        options.simulateLink = true;
+        options.simLink.latency = std::chrono::nanoseconds(
+            static_cast<int64_t>(atof(optarg) * 1000));
+        break;
+      case SIM_JITTER:
+        options.simulateLink = true;
+        options.simLink.jitter = std::chrono::nanoseconds(
+            static_cast<int64_t>(atof(optarg) * 1000));
+        break;
+      case SIM_SEED:
+        options.simulateLink = true;
+        options.simLink.seed = strtoull(optarg, nullptr, /*base=*/10);
+        break;
+      case CSV:
+        options.csvPath = std::string(optarg, strlen(optarg));
+        break;
+      case JSON:
+        options.jsonPath = std::string(optarg, strlen(optarg));
+        break;
+      case RESULTS:
+        options.resultsPath = std::string(optarg, strlen(optarg));
+        break;
+      case TRACE:
+        options.tracePath = std::string(optarg, strlen(optarg));
+        break;
+      case TUNING_CONFIG:
+        options.tuningConfigPath = std::string(optarg, strlen(optarg));
+        break;
       case HELP:
         usage(EXIT_SUCCESS, argv[0]);
         break;
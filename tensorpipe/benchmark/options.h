@@ -9,9 +9,16 @@
 #pragma once
 
 #include <string>
+#include <vector>
+
+#include <tensorpipe/config.h>
 
 #include <tensorpipe/channel/cpu_context.h>
+#if TENSORPIPE_SUPPORTS_CUDA
+#include <tensorpipe/channel/cuda_context.h>
+#endif // TENSORPIPE_SUPPORTS_CUDA
 #include <tensorpipe/transport/context.h>
+#include <tensorpipe/transport/sim/context.h>
 
 namespace tensorpipe {
 namespace benchmark {
@@ -20,19 +27,51 @@ struct Options {
   std::string mode; // server or client
   std::string transport; // shm or uv
   std::string channel; // basic
+  std::string cudaChannel; // cuda_basic, cuda_ipc, cuda_xth or cuda_gdr
   std::string address; // address for listen or connect
-  int numRoundTrips{0}; // number of write/read pairs
+  int numRoundTrips{0}; // number of write/read pairs (per pipe)
+  int window{1}; // number of write/read pairs in flight on each pipe
+  int numPipes{1};
+  int numClientThreads{1}; // each with a context of its own
   size_t numPayloads{0};
   size_t payloadSize{0};
   size_t numTensors{0};
   size_t tensorSize{0};
   size_t metadataSize{0};
+  std::string tensorType{"cpu"}; // cpu or cuda
+  int clientCudaDevice{0};
+  int serverCudaDevice{0};
+  // Run once for each of the (comma-separated) channels, or CUDA channels for
+  // CUDA tensors, and for each tensor size from 1 KiB to 1 GiB.
+  bool sweep{false};
+  // Have the pipes checksum the payloads and CPU tensors.
+  bool payloadChecksums{false};
+  // Have the transport go over a simulated link (see transport/sim), set by
+  // any of the --sim-* flags, which both ends must pass alike.
+  bool simulateLink{false};
+  transport::sim::LinkOptions simLink;
+  // Files to append the histograms of the latencies to, if set.
+  std::string csvPath;
+  std::string jsonPath;
+  // File to append the options and all the results of each run to, as a JSON
+  // line, for compare_results.py.
+  std::string resultsPath;
+  // File to write the trace events to (if built with TP_ENABLE_TRACING).
+  std::string tracePath;
+  // File to write the config that benchmark_autotune recommends to.
+  std::string tuningConfigPath;
 };
 
 struct Options parseOptions(int argc, char** argv);
 
 void validateTransportContext(std::shared_ptr<transport::Context> context);
 void validateChannelContext(std::shared_ptr<channel::CpuContext> context);
+#if TENSORPIPE_SUPPORTS_CUDA
+void validateCudaChannelContext(std::shared_ptr<channel::CudaContext> context);
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+// Split a comma-separated list.
+std::vector<std::string> splitList(const std::string& list);
 
 } // namespace benchmark
 } // namespace tensorpipe
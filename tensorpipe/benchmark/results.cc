@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/benchmark/results.h>
+
+#include <fstream>
+#include <limits>
+#include <ostream>
+
+namespace tensorpipe {
+namespace benchmark {
+
+namespace {
+
+void writeOptions(std::ostream& os, const Options& options) {
+  os << "{\"mode\":";
+  writeJsonString(os, options.mode);
+  os << ",\"transport\":";
+  writeJsonString(os, options.transport);
+  os << ",\"channel\":";
+  writeJsonString(os, options.channel);
+  os << ",\"cuda_channel\":";
+  writeJsonString(os, options.cudaChannel);
+  os << ",\"num_round_trips\":" << options.numRoundTrips
+     << ",\"window\":" << options.window
+     << ",\"num_pipes\":" << options.numPipes
+     << ",\"num_client_threads\":" << options.numClientThreads
+     << ",\"num_payloads\":" << options.numPayloads
+     << ",\"payload_size\":" << options.payloadSize
+     << ",\"num_tensors\":" << options.numTensors
+     << ",\"tensor_size\":" << options.tensorSize
+     << ",\"metadata_size\":" << options.metadataSize << ",\"tensor_type\":";
+  writeJsonString(os, options.tensorType);
+  os << ",\"payload_checksums\":"
+     << (options.payloadChecksums ? "true" : "false");
+  // Only set for the runs over a simulated link, so that the others still
+  // compare with the results from before.
+  if (options.simulateLink) {
+    os << ",\"sim_bytes_per_second\":" << options.simLink.bytesPerSecond
+       << ",\"sim_latency_ns\":" << options.simLink.latency.count()
+       << ",\"sim_jitter_ns\":" << options.simLink.jitter.count()
+       << ",\"sim_seed\":" << options.simLink.seed;
+  }
+  os << "}";
+}
+
+} // namespace
+
+void exportResults(
+    const std::string& path,
+    const std::string& benchmark,
+    const std::string& label,
+    const Options& options,
+    const Measurements& measurements,
+    std::chrono::nanoseconds elapsed,
+    size_t bytesPerMessage,
+    const CpuUsage& cpuUsage) {
+  if (path.empty()) {
+    return;
+  }
+
+  // Each round trip moves a message each way.
+  const double seconds = std::chrono::duration<double>(elapsed).count();
+  const size_t numMessages = 2 * measurements.size();
+  const size_t numBytes = numMessages * bytesPerMessage;
+  auto perSecond = [&](double value) {
+    return seconds > 0 ? value / seconds : 0.0;
+  };
+  // The CPU time in seconds per GB and per thousand messages.
+  auto writeCpuTime = [&](std::ostream& os, std::chrono::nanoseconds time) {
+    const double cpuSeconds = std::chrono::duration<double>(time).count();
+    os << "\"s\":" << cpuSeconds
+       << ",\"s_per_gb\":" << (numBytes > 0 ? cpuSeconds / (numBytes / 1e9) : 0)
+       << ",\"s_per_1k_msg\":"
+       << (numMessages > 0 ? cpuSeconds / (numMessages / 1e3) : 0);
+  };
+
+  std::ofstream os(path, std::ios::app);
+  os.precision(std::numeric_limits<double>::max_digits10);
+  os << "{\"benchmark\":";
+  writeJsonString(os, benchmark);
+  os << ",\"label\":";
+  writeJsonString(os, label);
+  os << ",\"config\":";
+  writeOptions(os, options);
+  os << ",\"latency\":{";
+  measurements.writeJsonFields(os);
+  os << "},\"throughput\":{\"elapsed_s\":" << seconds
+     << ",\"num_bytes\":" << numBytes << ",\"num_messages\":" << numMessages
+     << ",\"gbps\":" << perSecond(numBytes * 8 / 1e9)
+     << ",\"round_trips_per_s\":" << perSecond(measurements.size())
+     << "},\"cpu\":{\"num_threads\":" << cpuUsage.numThreads << ",";
+  writeCpuTime(os, cpuUsage.process);
+  os << ",\"threads\":{";
+  bool first = true;
+  for (const auto& iter : cpuUsage.threadsByName) {
+    os << (first ? "" : ",");
+    writeJsonString(os, iter.first);
+    os << ":{\"num_threads\":" << iter.second.numThreads << ",";
+    writeCpuTime(os, iter.second.time);
+    os << "}";
+    first = false;
+  }
+  os << "}}}\n";
+}
+
+} // namespace benchmark
+} // namespace tensorpipe
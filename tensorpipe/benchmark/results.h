@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+#include <tensorpipe/benchmark/cpu_usage.h>
+#include <tensorpipe/benchmark/measurements.h>
+#include <tensorpipe/benchmark/options.h>
+
+namespace tensorpipe {
+namespace benchmark {
+
+// Append all there is to know about a run of a ping-pong benchmark to a file,
+// as a JSON object on a single line: the options it was run with, the latency
+// histogram of its round trips, its throughput and its CPU usage (in total and
+// per thread name, and per GB and per thousand messages moved). The runs are
+// identified by the name of the benchmark and the label, as in the CSV and JSON
+// histograms. See compare_results.py for comparing those of two versions.
+void exportResults(
+    const std::string& path,
+    const std::string& benchmark,
+    const std::string& label,
+    const Options& options,
+    const Measurements& measurements,
+    std::chrono::nanoseconds elapsed,
+    size_t bytesPerMessage,
+    const CpuUsage& cpuUsage);
+
+} // namespace benchmark
+} // namespace tensorpipe
@@ -34,6 +34,26 @@ std::shared_ptr<tensorpipe::transport::Context> makeShmContext() {
 TP_REGISTER_CREATOR(TensorpipeTransportRegistry, shm, makeShmContext);
 #endif // TENSORPIPE_HAS_SHM_TRANSPORT
 
+// URING
+
+#if TENSORPIPE_HAS_URING_TRANSPORT
+std::shared_ptr<tensorpipe::transport::Context> makeUringContext() {
+  return std::make_shared<tensorpipe::transport::uring::Context>();
+}
+
+TP_REGISTER_CREATOR(TensorpipeTransportRegistry, uring, makeUringContext);
+#endif // TENSORPIPE_HAS_URING_TRANSPORT
+
+// UDS
+
+#if TENSORPIPE_HAS_UDS_TRANSPORT
+std::shared_ptr<tensorpipe::transport::Context> makeUdsContext() {
+  return std::make_shared<tensorpipe::transport::uds::Context>();
+}
+
+TP_REGISTER_CREATOR(TensorpipeTransportRegistry, uds, makeUdsContext);
+#endif // TENSORPIPE_HAS_UDS_TRANSPORT
+
 // UV
 
 std::shared_ptr<tensorpipe::transport::Context> makeUvContext() {
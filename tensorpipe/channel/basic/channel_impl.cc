@@ -25,15 +25,21 @@ ChannelImpl::ChannelImpl(
     ConstructorToken token,
     std::shared_ptr<ContextImpl> context,
     std::string id,
-    std::shared_ptr<transport::Connection> connection)
+    std::shared_ptr<transport::Connection> connection,
+    bool flowControl)
     : ChannelImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl>(
           token,
           std::move(context),
           std::move(id)),
-      connection_(std::move(connection)) {}
+      connection_(std::move(connection)),
+      flowControl_(flowControl) {}
 
 void ChannelImpl::initImplFromLoop() {
   context_->enroll(*this);
+
+  if (flowControl_) {
+    readHeaderFromLoop();
+  }
 }
 
 void ChannelImpl::sendImplFromLoop(
@@ -41,6 +47,100 @@ void ChannelImpl::sendImplFromLoop(
     CpuBuffer buffer,
     TDescriptorCallback descriptorCallback,
     TSendCallback callback) {
+  if (flowControl_) {
+    TP_VLOG(6) << "Channel " << id_ << " is waiting for a credit (#"
+               << sequenceNumber << ")";
+    sendOperations_.push_back(
+        SendOperation{sequenceNumber, buffer, std::move(callback)});
+    descriptorCallback(Error::kSuccess, std::string());
+    writePayloadsFromLoop();
+    return;
+  }
+
+  writePayloadFromLoop(sequenceNumber, buffer, std::move(callback));
+
+  descriptorCallback(Error::kSuccess, std::string());
+}
+
+void ChannelImpl::recvImplFromLoop(
+    uint64_t sequenceNumber,
+    TDescriptor descriptor,
+    CpuBuffer buffer,
+    TRecvCallback callback) {
+  TP_DCHECK_EQ(descriptor, std::string());
+
+  if (flowControl_) {
+    // The payload will be read into the buffer once its header arrives.
+    recvOperations_.push_back(
+        RecvOperation{sequenceNumber, buffer, std::move(callback)});
+    TP_VLOG(6) << "Channel " << id_ << " is granting a credit (#"
+               << sequenceNumber << ")";
+    writeHeaderFromLoop(kCredit, sequenceNumber);
+    return;
+  }
+
+  readPayloadFromLoop(sequenceNumber, buffer, std::move(callback));
+}
+
+void ChannelImpl::readHeaderFromLoop() {
+  auto header = std::make_shared<Header>();
+  connection_->read(
+      header.get(),
+      sizeof(Header),
+      lazyCallbackWrapper_([header](
+                               ChannelImpl& impl,
+                               const void* /* unused */,
+                               size_t /* unused */) {
+        impl.onHeaderFromLoop(*header);
+      }));
+}
+
+void ChannelImpl::onHeaderFromLoop(const Header& header) {
+  if (header.type == kCredit) {
+    TP_VLOG(6) << "Channel " << id_ << " got a credit (#"
+               << header.sequenceNumber << ")";
+    ++numCredits_;
+    writePayloadsFromLoop();
+  } else {
+    TP_THROW_ASSERT_IF(header.type != kPayload)
+        << "Unexpected header type " << header.type;
+    TP_DCHECK(!recvOperations_.empty());
+    RecvOperation op = std::move(recvOperations_.front());
+    recvOperations_.pop_front();
+    TP_DCHECK_EQ(op.sequenceNumber, header.sequenceNumber);
+    readPayloadFromLoop(op.sequenceNumber, op.buffer, std::move(op.callback));
+  }
+
+  // The connection reads in order, hence this comes after the payload.
+  readHeaderFromLoop();
+}
+
+void ChannelImpl::writeHeaderFromLoop(
+    HeaderType type,
+    uint64_t sequenceNumber) {
+  auto header = std::make_shared<Header>(Header{type, sequenceNumber});
+  connection_->write(
+      header.get(),
+      sizeof(Header),
+      lazyCallbackWrapper_([header](ChannelImpl& /* unused */) {}));
+}
+
+void ChannelImpl::writePayloadsFromLoop() {
+  // The credits are granted in the order of the receives, which is the one of
+  // the sends, hence any credit is for the first send that's waiting.
+  while (numCredits_ > 0 && !sendOperations_.empty()) {
+    SendOperation op = std::move(sendOperations_.front());
+    sendOperations_.pop_front();
+    --numCredits_;
+    writeHeaderFromLoop(kPayload, op.sequenceNumber);
+    writePayloadFromLoop(op.sequenceNumber, op.buffer, std::move(op.callback));
+  }
+}
+
+void ChannelImpl::writePayloadFromLoop(
+    uint64_t sequenceNumber,
+    CpuBuffer buffer,
+    TSendCallback callback) {
   TP_VLOG(6) << "Channel " << id_ << " is writing payload (#" << sequenceNumber
              << ")";
   connection_->write(
@@ -52,17 +152,12 @@ void ChannelImpl::sendImplFromLoop(
                        << sequenceNumber << ")";
             callback(impl.error_);
           }));
-
-  descriptorCallback(Error::kSuccess, std::string());
 }
 
-void ChannelImpl::recvImplFromLoop(
+void ChannelImpl::readPayloadFromLoop(
     uint64_t sequenceNumber,
-    TDescriptor descriptor,
     CpuBuffer buffer,
     TRecvCallback callback) {
-  TP_DCHECK_EQ(descriptor, std::string());
-
   TP_VLOG(6) << "Channel " << id_ << " is reading payload (#" << sequenceNumber
              << ")";
   connection_->read(
@@ -83,6 +178,19 @@ void ChannelImpl::handleErrorImpl() {
   // will cause their callbacks to be invoked, and only then we'll invoke ours.
   connection_->close();
 
+  // The operations that are still waiting for their credit or payload haven't
+  // been handed to the connection, hence we must invoke their callbacks.
+  while (!sendOperations_.empty()) {
+    SendOperation op = std::move(sendOperations_.front());
+    sendOperations_.pop_front();
+    op.callback(error_);
+  }
+  while (!recvOperations_.empty()) {
+    RecvOperation op = std::move(recvOperations_.front());
+    recvOperations_.pop_front();
+    op.callback(error_);
+  }
+
   context_->unenroll(*this);
 }
 
@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include <cstdint>
+#include <deque>
 #include <memory>
 #include <string>
 
@@ -28,7 +30,8 @@ class ChannelImpl final
       ConstructorToken token,
       std::shared_ptr<ContextImpl> context,
       std::string id,
-      std::shared_ptr<transport::Connection> connection);
+      std::shared_ptr<transport::Connection> connection,
+      bool flowControl);
 
  protected:
   // Implement the entry points called by ChannelImplBoilerplate.
@@ -47,6 +50,53 @@ class ChannelImpl final
 
  private:
   const std::shared_ptr<transport::Connection> connection_;
+  const bool flowControl_;
+
+  // With flow control, both directions of the connection carry a sequence of
+  // headers, each of which is either a credit, granted by the receiver for the
+  // next tensor once it has posted the buffer for it, or announces that the
+  // payload of the next tensor follows. As a channel both sends and receives
+  // through the same connection, the headers are how it tells one from the
+  // other when reading.
+  enum HeaderType : uint64_t {
+    kCredit = 1,
+    kPayload,
+  };
+  struct Header {
+    HeaderType type;
+    uint64_t sequenceNumber;
+  };
+
+  struct SendOperation {
+    uint64_t sequenceNumber;
+    CpuBuffer buffer;
+    TSendCallback callback;
+  };
+  struct RecvOperation {
+    uint64_t sequenceNumber;
+    CpuBuffer buffer;
+    TRecvCallback callback;
+  };
+
+  // The sends that are waiting for a credit.
+  std::deque<SendOperation> sendOperations_;
+  // The credits that were granted and haven't been used by a send yet.
+  uint64_t numCredits_{0};
+  // The receives that granted a credit and whose payload hasn't arrived yet.
+  std::deque<RecvOperation> recvOperations_;
+
+  void readHeaderFromLoop();
+  void onHeaderFromLoop(const Header& header);
+  void writeHeaderFromLoop(HeaderType type, uint64_t sequenceNumber);
+  void writePayloadFromLoop(
+      uint64_t sequenceNumber,
+      CpuBuffer buffer,
+      TSendCallback callback);
+  void readPayloadFromLoop(
+      uint64_t sequenceNumber,
+      CpuBuffer buffer,
+      TRecvCallback callback);
+  void writePayloadsFromLoop();
 };
 
 } // namespace basic
@@ -19,7 +19,8 @@ namespace tensorpipe {
 namespace channel {
 namespace basic {
 
-Context::Context() : impl_(std::make_shared<ContextImpl>()) {}
+Context::Context(bool flowControl)
+    : impl_(std::make_shared<ContextImpl>(flowControl)) {}
 
 // Explicitly define all methods of the context, which just forward to the impl.
 // We cannot use an intermediate ContextBoilerplate class without forcing a
@@ -23,7 +23,12 @@ class ContextImpl;
 
 class Context : public CpuContext {
  public:
-  Context();
+  // With flow control, a sender only writes a tensor into the connection once
+  // the receiver has posted the buffer for it, and granted a credit for it in
+  // return. This keeps the transport from having to buffer the tensors of a
+  // slow receiver, at the cost of an additional one-way latency for the sends
+  // that come before their receives. Both ends must agree on it.
+  explicit Context(bool flowControl = false);
 
   Context(const Context&) = delete;
   Context(Context&&) = delete;
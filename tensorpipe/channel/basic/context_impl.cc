@@ -17,13 +17,16 @@ namespace tensorpipe {
 namespace channel {
 namespace basic {
 
-ContextImpl::ContextImpl()
-    : ContextImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl>("any") {}
+ContextImpl::ContextImpl(bool flowControl)
+    : ContextImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl>(
+          // The two ends must agree on whether to use flow control.
+          flowControl ? "any_flow_control" : "any"),
+      flowControl_(flowControl) {}
 
 std::shared_ptr<CpuChannel> ContextImpl::createChannel(
     std::shared_ptr<transport::Connection> connection,
     Endpoint /* unused */) {
-  return createChannelInternal(std::move(connection));
+  return createChannelInternal(std::move(connection), flowControl_);
 }
 
 void ContextImpl::closeImpl() {}
@@ -34,7 +37,7 @@ bool ContextImpl::inLoop() {
   return loop_.inLoop();
 };
 
-void ContextImpl::deferToLoop(std::function<void()> fn) {
+void ContextImpl::deferToLoop(TTask fn) {
   loop_.deferToLoop(std::move(fn));
 };
 
@@ -24,7 +24,7 @@ class ChannelImpl;
 class ContextImpl final
     : public ContextImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl> {
  public:
-  ContextImpl();
+  explicit ContextImpl(bool flowControl);
 
   std::shared_ptr<CpuChannel> createChannel(
       std::shared_ptr<transport::Connection> connection,
@@ -32,7 +32,7 @@ class ContextImpl final
 
   // Implement the DeferredExecutor interface.
   bool inLoop() override;
-  void deferToLoop(std::function<void()> fn) override;
+  void deferToLoop(TTask fn) override;
 
  protected:
   // Implement the entry points called by ContextImplBoilerplate.
@@ -41,6 +41,7 @@ class ContextImpl final
 
  private:
   OnDemandDeferredExecutor loop_;
+  const bool flowControl_;
 };
 
 } // namespace basic
@@ -14,10 +14,13 @@
 
 #include <tensorpipe/channel/channel.h>
 #include <tensorpipe/channel/error.h>
+#include <tensorpipe/channel/operation_window.h>
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
 #include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/trace.h>
+#include <tensorpipe/common/usdt.h>
 
 namespace tensorpipe {
 namespace channel {
@@ -68,6 +71,10 @@ class ChannelImplBoilerplate : public std::enable_shared_from_this<TChan> {
   virtual ~ChannelImplBoilerplate() = default;
 
  protected:
+  // The operations are numbered in the order in which they were issued, which
+  // is also how they're matched with the ones of the peer. Implementations
+  // that work on several of them at once can use an OperationWindow to keep
+  // their completions in that order.
   virtual void initImplFromLoop() = 0;
   virtual void sendImplFromLoop(
       uint64_t sequenceNumber,
@@ -185,27 +192,37 @@ void ChannelImplBoilerplate<TBuffer, TCtx, TChan>::sendFromLoop(
     TSendCallback callback) {
   TP_DCHECK(context_->inLoop());
 
+  TP_TRACE_SCOPE("tp::Channel::send");
   const uint64_t sequenceNumber = nextTensorBeingSent_++;
   TP_VLOG(4) << "Channel " << id_ << " received a send request (#"
              << sequenceNumber << ")";
+  const uint64_t traceFlowId = TP_TRACE_NEW_FLOW_ID();
+  TP_TRACE_FLOW_START("tp::Channel::send", traceFlowId);
+  TP_USDT(channel__send__start, id_.c_str(), sequenceNumber, buffer.length);
 
   descriptorCallback = [this,
                         sequenceNumber,
+                        traceFlowId,
                         descriptorCallback{std::move(descriptorCallback)}](
                            const Error& error, TDescriptor descriptor) {
     // There is no requirement for the channel to invoke callbacks in order.
     TP_VLOG(4) << "Channel " << id_ << " is calling a descriptor callback (#"
                << sequenceNumber << ")";
+    TP_TRACE_SCOPE("tp::Channel::descriptorCallback");
+    TP_TRACE_FLOW_STEP("tp::Channel::send", traceFlowId);
     descriptorCallback(error, std::move(descriptor));
     TP_VLOG(4) << "Channel " << id_ << " done calling a descriptor callback (#"
                << sequenceNumber << ")";
   };
 
-  callback = [this, sequenceNumber, callback{std::move(callback)}](
+  callback = [this, sequenceNumber, traceFlowId, callback{std::move(callback)}](
                  const Error& error) {
     // There is no requirement for the channel to invoke callbacks in order.
     TP_VLOG(4) << "Channel " << id_ << " is calling a send callback (#"
                << sequenceNumber << ")";
+    TP_TRACE_SCOPE("tp::Channel::sendCallback");
+    TP_TRACE_FLOW_END("tp::Channel::send", traceFlowId);
+    TP_USDT(channel__send__done, id_.c_str(), sequenceNumber, error ? 1 : 0);
     callback(error);
     TP_VLOG(4) << "Channel " << id_ << " done calling a send callback (#"
                << sequenceNumber << ")";
@@ -244,15 +261,22 @@ void ChannelImplBoilerplate<TBuffer, TCtx, TChan>::recvFromLoop(
     TRecvCallback callback) {
   TP_DCHECK(context_->inLoop());
 
+  TP_TRACE_SCOPE("tp::Channel::recv");
   const uint64_t sequenceNumber = nextTensorBeingReceived_++;
   TP_VLOG(4) << "Channel " << id_ << " received a recv request (#"
              << sequenceNumber << ")";
+  const uint64_t traceFlowId = TP_TRACE_NEW_FLOW_ID();
+  TP_TRACE_FLOW_START("tp::Channel::recv", traceFlowId);
+  TP_USDT(channel__recv__start, id_.c_str(), sequenceNumber, buffer.length);
 
-  callback = [this, sequenceNumber, callback{std::move(callback)}](
+  callback = [this, sequenceNumber, traceFlowId, callback{std::move(callback)}](
                  const Error& error) {
     // There is no requirement for the channel to invoke callbacks in order.
     TP_VLOG(4) << "Channel " << id_ << " is calling a recv callback (#"
                << sequenceNumber << ")";
+    TP_TRACE_SCOPE("tp::Channel::recvCallback");
+    TP_TRACE_FLOW_END("tp::Channel::recv", traceFlowId);
+    TP_USDT(channel__recv__done, id_.c_str(), sequenceNumber, error ? 1 : 0);
     callback(error);
     TP_VLOG(4) << "Channel " << id_ << " done calling a recv callback (#"
                << sequenceNumber << ")";
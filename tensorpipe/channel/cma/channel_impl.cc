@@ -30,9 +30,17 @@ namespace {
 struct Descriptor {
   uint32_t pid;
   uint64_t ptr;
-  NOP_STRUCTURE(Descriptor, pid, ptr);
+  // The layout of the buffer, see CpuBuffer::rowLength.
+  uint64_t rowLength;
+  uint64_t rowStride;
+  NOP_STRUCTURE(Descriptor, pid, ptr, rowLength, rowStride);
 };
 
+// The number of recvs whose copies may be in flight at once on one channel,
+// e.g., those of the tensors of a message, ahead of the oldest one that hasn't
+// completed yet.
+constexpr size_t kMaxRecvsInFlight = 16;
+
 } // namespace
 
 ChannelImpl::ChannelImpl(
@@ -44,7 +52,8 @@ ChannelImpl::ChannelImpl(
           token,
           std::move(context),
           std::move(id)),
-      connection_(std::move(connection)) {}
+      connection_(std::move(connection)),
+      recvWindow_(kMaxRecvsInFlight) {}
 
 void ChannelImpl::initImplFromLoop() {
   context_->enroll(*this);
@@ -73,6 +82,8 @@ void ChannelImpl::sendImplFromLoop(
   Descriptor& nopDescriptor = nopHolder.getObject();
   nopDescriptor.pid = getpid();
   nopDescriptor.ptr = reinterpret_cast<uint64_t>(buffer.ptr);
+  nopDescriptor.rowLength = buffer.rowLength;
+  nopDescriptor.rowStride = buffer.rowStride;
 
   descriptorCallback(Error::kSuccess, saveDescriptor(nopHolder));
 }
@@ -86,33 +97,75 @@ void ChannelImpl::recvImplFromLoop(
   loadDescriptor(nopHolder, descriptor);
   Descriptor& nopDescriptor = nopHolder.getObject();
   pid_t remotePid = nopDescriptor.pid;
-  void* remotePtr = reinterpret_cast<void*>(nopDescriptor.ptr);
+  CpuBuffer remoteBuffer;
+  remoteBuffer.ptr = reinterpret_cast<void*>(nopDescriptor.ptr);
+  remoteBuffer.length = buffer.length;
+  remoteBuffer.rowLength = nopDescriptor.rowLength;
+  remoteBuffer.rowStride = nopDescriptor.rowStride;
+
+  recvWindow_.enqueue(
+      sequenceNumber,
+      [this,
+       sequenceNumber,
+       remotePid,
+       remoteBuffer,
+       buffer,
+       callback{std::move(callback)}]() mutable {
+        copyPayload(
+            sequenceNumber,
+            remotePid,
+            remoteBuffer,
+            buffer,
+            std::move(callback));
+      });
+}
+
+void ChannelImpl::copyPayload(
+    uint64_t sequenceNumber,
+    pid_t remotePid,
+    CpuBuffer remoteBuffer,
+    CpuBuffer buffer,
+    TRecvCallback callback) {
+  if (error_) {
+    recvWindow_.complete(
+        sequenceNumber, [this, callback{std::move(callback)}]() {
+          callback(error_);
+        });
+    return;
+  }
 
   TP_VLOG(6) << "Channel " << id_ << " is copying payload (#" << sequenceNumber
              << ")";
   context_->requestCopy(
       remotePid,
-      remotePtr,
-      buffer.ptr,
-      buffer.length,
+      remoteBuffer,
+      buffer,
       eagerCallbackWrapper_([sequenceNumber,
-                             callback{std::move(callback)}](ChannelImpl& impl) {
+                             callback{std::move(callback)}](
+                                ChannelImpl& impl) mutable {
         TP_VLOG(6) << "Channel " << impl.id_ << " done copying payload (#"
                    << sequenceNumber << ")";
-
-        // Let peer know we've completed the copy.
-        TP_VLOG(6) << "Channel " << impl.id_ << " is writing notification (#"
-                   << sequenceNumber << ")";
-        impl.connection_->write(
-            nullptr,
-            0,
-            impl.lazyCallbackWrapper_([sequenceNumber](ChannelImpl& impl) {
+        // The window only runs this once the earlier recvs are done, and as
+        // it belongs to the channel it can't outlive it.
+        impl.recvWindow_.complete(
+            sequenceNumber,
+            [&impl, sequenceNumber, callback{std::move(callback)}]() {
+              // Let peer know we've completed the copy.
               TP_VLOG(6) << "Channel " << impl.id_
-                         << " done writing notification (#" << sequenceNumber
+                         << " is writing notification (#" << sequenceNumber
                          << ")";
-            }));
-
-        callback(impl.error_);
+              impl.connection_->write(
+                  nullptr,
+                  0,
+                  impl.lazyCallbackWrapper_(
+                      [sequenceNumber](ChannelImpl& impl) {
+                        TP_VLOG(6) << "Channel " << impl.id_
+                                   << " done writing notification (#"
+                                   << sequenceNumber << ")";
+                      }));
+
+              callback(impl.error_);
+            });
       }));
 }
 
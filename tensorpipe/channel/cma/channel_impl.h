@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include <sys/types.h>
+
 #include <memory>
 #include <string>
 
@@ -47,6 +49,18 @@ class ChannelImpl final
 
  private:
   const std::shared_ptr<transport::Connection> connection_;
+
+  // The copies of the recvs are performed in parallel by the context's
+  // threads, and thus may complete in any order, but their notifications must
+  // be written in the order of the sends, which are only told apart by that.
+  OperationWindow recvWindow_;
+
+  void copyPayload(
+      uint64_t sequenceNumber,
+      pid_t remotePid,
+      CpuBuffer remoteBuffer,
+      CpuBuffer buffer,
+      TRecvCallback callback);
 };
 
 } // namespace cma
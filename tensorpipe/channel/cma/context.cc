@@ -19,7 +19,8 @@ namespace tensorpipe {
 namespace channel {
 namespace cma {
 
-Context::Context() : impl_(ContextImpl::create()) {}
+Context::Context(size_t numThreads, ThreadOptions threadOptions)
+    : impl_(ContextImpl::create(numThreads, std::move(threadOptions))) {}
 
 // Explicitly define all methods of the context, which just forward to the impl.
 // We cannot use an intermediate ContextBoilerplate class without forcing a
@@ -39,6 +40,10 @@ bool Context::isViable() const {
   return impl_->isViable();
 }
 
+bool Context::supportsStridedBuffers() const {
+  return true;
+}
+
 void Context::setId(std::string id) {
   impl_->setId(std::move(id));
 }
@@ -13,6 +13,7 @@
 
 #include <tensorpipe/channel/context.h>
 #include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/common/thread_options.h>
 #include <tensorpipe/transport/context.h>
 
 namespace tensorpipe {
@@ -21,9 +22,17 @@ namespace cma {
 
 class ContextImpl;
 
+// The default number of threads used to perform large copies, see below.
+constexpr size_t kDefaultNumThreads = 4;
+
 class Context : public CpuContext {
  public:
-  Context();
+  // Copies are performed by background threads: small ones by a dedicated
+  // thread, and large ones by numThreads threads, each copying a part of them.
+  // All these threads are set up according to threadOptions.
+  explicit Context(
+      size_t numThreads = kDefaultNumThreads,
+      ThreadOptions threadOptions = ThreadOptions());
 
   Context(const Context&) = delete;
   Context(Context&&) = delete;
@@ -38,6 +47,8 @@ class Context : public CpuContext {
 
   bool isViable() const override;
 
+  bool supportsStridedBuffers() const override;
+
   void setId(std::string id) override;
 
   void close() override;
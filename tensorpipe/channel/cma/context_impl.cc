@@ -8,19 +8,23 @@
 
 #include <tensorpipe/channel/cma/context_impl.h>
 
+#include <limits.h>
 #include <linux/prctl.h>
 #include <sys/prctl.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <deque>
 #include <functional>
-#include <limits>
 #include <sstream>
 #include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include <tensorpipe/channel/cma/channel_impl.h>
+#include <tensorpipe/common/buffer_layout.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/system.h>
 
@@ -34,6 +38,18 @@ namespace {
 // disambiguate descriptors when debugging.
 const std::string kDomainDescriptorPrefix{"cma:"};
 
+// Copies up to this size are performed by the dedicated "fast lane" thread.
+constexpr size_t kSmallCopyThreshold = 256 * 1024;
+
+// Small copies that are queued up together are batched into a single syscall
+// as long as they read from the same process, up to this many of them (the
+// most that the kernel accepts) and up to kSmallCopyThreshold bytes in total.
+constexpr size_t kMaxBatchSize = IOV_MAX;
+
+// Large copies are split into chunks which, except for the last one, are at
+// least this large and start at page boundaries.
+constexpr size_t kMinChunkSize = 1024 * 1024;
+
 // Old versions of Docker use a default seccomp-bpf rule that blocks some
 // ptrace-related syscalls. To find this out, we attempt such a call against
 // ourselves, which is always allowed (it shortcuts all checks, including LSMs),
@@ -217,19 +233,40 @@ std::tuple<bool, std::string> determineViabilityAndGenerateDomainDescriptor() {
 
 } // namespace
 
-std::shared_ptr<ContextImpl> ContextImpl::create() {
+std::shared_ptr<ContextImpl> ContextImpl::create(
+    size_t numThreads,
+    ThreadOptions threadOptions) {
   bool isVIable;
   std::string domainDescriptor;
   std::tie(isVIable, domainDescriptor) =
       determineViabilityAndGenerateDomainDescriptor();
-  return std::make_shared<ContextImpl>(isVIable, std::move(domainDescriptor));
+  return std::make_shared<ContextImpl>(
+      isVIable,
+      std::move(domainDescriptor),
+      numThreads,
+      std::move(threadOptions));
 }
 
-ContextImpl::ContextImpl(bool isVIable, std::string domainDescriptor)
+ContextImpl::ContextImpl(
+    bool isVIable,
+    std::string domainDescriptor,
+    size_t numThreads,
+    ThreadOptions threadOptions)
     : ContextImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl>(
           std::move(domainDescriptor)),
       isViable_(isVIable) {
-  thread_ = std::thread(&ContextImpl::handleCopyRequests, this);
+  TP_THROW_ASSERT_IF(numThreads == 0)
+      << "The number of threads must be positive";
+  smallCopiesThread_ = std::thread([this, threadOptions]() {
+    setUpThread(threadOptions, "TP_CMA_small");
+    handleSmallCopyRequests();
+  });
+  for (size_t threadIdx = 0; threadIdx < numThreads; threadIdx++) {
+    largeCopiesThreads_.emplace_back([this, threadOptions]() {
+      setUpThread(threadOptions, "TP_CMA_large");
+      handleLargeCopyRequests();
+    });
+  }
 }
 
 std::shared_ptr<CpuChannel> ContextImpl::createChannel(
@@ -243,28 +280,33 @@ bool ContextImpl::isViable() const {
 }
 
 void ContextImpl::closeImpl() {
-  requests_.push(nullopt);
+  smallCopies_.push(nullopt);
+  for (size_t threadIdx = 0; threadIdx < largeCopiesThreads_.size();
+       threadIdx++) {
+    largeCopies_.push(nullopt);
+  }
 }
 
 void ContextImpl::joinImpl() {
-  thread_.join();
-  // TP_DCHECK(requests_.empty());
+  smallCopiesThread_.join();
+  for (auto& thread : largeCopiesThreads_) {
+    thread.join();
+  }
 }
 
 bool ContextImpl::inLoop() {
   return loop_.inLoop();
 };
 
-void ContextImpl::deferToLoop(std::function<void()> fn) {
+void ContextImpl::deferToLoop(TTask fn) {
   loop_.deferToLoop(std::move(fn));
 };
 
 void ContextImpl::requestCopy(
     pid_t remotePid,
-    void* remotePtr,
-    void* localPtr,
-    size_t length,
-    std::function<void(const Error&)> fn) {
+    CpuBuffer remoteBuffer,
+    CpuBuffer localBuffer,
+    copy_request_callback_fn fn) {
   uint64_t requestId = nextRequestId_++;
   TP_VLOG(4) << "Channel context " << id_ << " received a copy request (#"
              << requestId << ")";
@@ -278,35 +320,173 @@ void ContextImpl::requestCopy(
                << ")";
   };
 
-  requests_.push(
-      CopyRequest{remotePid, remotePtr, localPtr, length, std::move(fn)});
+  TP_DCHECK_EQ(remoteBuffer.length, localBuffer.length);
+  const size_t length = localBuffer.length;
+  auto request = std::make_shared<CopyRequest>();
+  request->remotePid = remotePid;
+  request->remoteBuffer = remoteBuffer;
+  request->localBuffer = localBuffer;
+  request->callback = std::move(fn);
+
+  if (length <= kSmallCopyThreshold) {
+    request->numPendingChunks = 1;
+    smallCopies_.push(CopyChunk{std::move(request), 0, length});
+    return;
+  }
+
+  // Split the copy evenly among the threads (with a minimum size per chunk),
+  // rounding the boundaries to page boundaries of the remote buffer, so that
+  // different threads don't fault on the same pages.
+  const size_t pageSize = ::getpagesize();
+  const size_t numChunks = std::max<size_t>(
+      1, std::min(largeCopiesThreads_.size(), length / kMinChunkSize));
+  const uintptr_t remoteStart =
+      reinterpret_cast<uintptr_t>(remoteBuffer.ptr);
+  std::vector<size_t> boundaries;
+  boundaries.push_back(0);
+  for (size_t chunkIdx = 1; chunkIdx < numChunks; chunkIdx++) {
+    uintptr_t boundary = remoteStart + chunkIdx * (length / numChunks);
+    boundary = (boundary + pageSize - 1) / pageSize * pageSize;
+    boundaries.push_back(boundary - remoteStart);
+  }
+  boundaries.push_back(length);
+
+  request->numPendingChunks = numChunks;
+  for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+    largeCopies_.push(CopyChunk{
+        request,
+        boundaries[chunkIdx],
+        boundaries[chunkIdx + 1] - boundaries[chunkIdx]});
+  }
 }
 
-void ContextImpl::handleCopyRequests() {
-  setThreadName("TP_CMA_loop");
+void ContextImpl::handleSmallCopyRequests() {
+  std::deque<optional<CopyChunk>> chunks;
+  std::vector<CopyChunk> batch;
+  std::vector<struct iovec> localIovs;
+  std::vector<struct iovec> remoteIovs;
   while (true) {
-    auto maybeRequest = requests_.pop();
-    if (!maybeRequest.has_value()) {
+    if (chunks.empty()) {
+      smallCopies_.popAll(chunks);
+    }
+    if (!chunks.front().has_value()) {
       break;
     }
-    CopyRequest request = std::move(maybeRequest).value();
-
-    // Perform copy.
-    struct iovec local {
-      .iov_base = request.localPtr, .iov_len = request.length
-    };
-    struct iovec remote {
-      .iov_base = request.remotePtr, .iov_len = request.length
-    };
-    auto nread =
-        ::process_vm_readv(request.remotePid, &local, 1, &remote, 1, 0);
-    if (nread == -1) {
-      request.callback(TP_CREATE_ERROR(SystemError, "cma", errno));
-    } else if (nread != request.length) {
-      request.callback(TP_CREATE_ERROR(ShortReadError, request.length, nread));
+    if (!isContiguous(chunks.front()->request->localBuffer) ||
+        !isContiguous(chunks.front()->request->remoteBuffer)) {
+      CopyChunk chunk = std::move(chunks.front()).value();
+      chunks.pop_front();
+      completeCopy(chunk, performCopy(chunk));
+      continue;
+    }
+
+    // Take the chunks at the front of the queue as long as they fit the batch.
+    const pid_t remotePid = chunks.front()->request->remotePid;
+    size_t batchLength = 0;
+    while (!chunks.empty() && chunks.front().has_value() &&
+           chunks.front()->request->remotePid == remotePid &&
+           isContiguous(chunks.front()->request->localBuffer) &&
+           isContiguous(chunks.front()->request->remoteBuffer) &&
+           batch.size() < kMaxBatchSize &&
+           (batch.empty() ||
+            batchLength + chunks.front()->length <= kSmallCopyThreshold)) {
+      CopyChunk chunk = std::move(chunks.front()).value();
+      chunks.pop_front();
+      CopyRequest& request = *chunk.request;
+      localIovs.push_back(iovec{
+          reinterpret_cast<uint8_t*>(request.localBuffer.ptr) + chunk.offset,
+          chunk.length});
+      remoteIovs.push_back(iovec{
+          reinterpret_cast<uint8_t*>(request.remoteBuffer.ptr) + chunk.offset,
+          chunk.length});
+      batchLength += chunk.length;
+      batch.push_back(std::move(chunk));
+    }
+
+    auto nread = ::process_vm_readv(
+        remotePid,
+        localIovs.data(),
+        localIovs.size(),
+        remoteIovs.data(),
+        remoteIovs.size(),
+        0);
+    if (nread >= 0 && static_cast<size_t>(nread) == batchLength) {
+      for (const CopyChunk& chunk : batch) {
+        completeCopy(chunk, Error::kSuccess);
+      }
     } else {
-      request.callback(Error::kSuccess);
+      // Redo the chunks one by one, to find out which ones failed and why.
+      for (const CopyChunk& chunk : batch) {
+        completeCopy(chunk, performCopy(chunk));
+      }
+    }
+
+    batch.clear();
+    localIovs.clear();
+    remoteIovs.clear();
+  }
+}
+
+void ContextImpl::handleLargeCopyRequests() {
+  while (true) {
+    auto maybeChunk = largeCopies_.pop();
+    if (!maybeChunk.has_value()) {
+      break;
+    }
+    CopyChunk chunk = std::move(maybeChunk).value();
+    completeCopy(chunk, performCopy(chunk));
+  }
+}
+
+Error ContextImpl::performCopy(const CopyChunk& chunk) {
+  CopyRequest& request = *chunk.request;
+  // A piece per row, if either buffer isn't contiguous.
+  std::vector<struct iovec> localIovs;
+  std::vector<struct iovec> remoteIovs;
+  forEachPieceOfBuffers(
+      request.localBuffer,
+      request.remoteBuffer,
+      chunk.offset,
+      chunk.length,
+      [&](uint8_t* localPtr, uint8_t* remotePtr, size_t length) {
+        localIovs.push_back(iovec{localPtr, length});
+        remoteIovs.push_back(iovec{remotePtr, length});
+      });
+  for (size_t iovIdx = 0; iovIdx < localIovs.size(); iovIdx += kMaxBatchSize) {
+    const size_t numIovs = std::min(kMaxBatchSize, localIovs.size() - iovIdx);
+    size_t length = 0;
+    for (size_t idx = iovIdx; idx < iovIdx + numIovs; idx++) {
+      length += localIovs[idx].iov_len;
     }
+    auto nread = ::process_vm_readv(
+        request.remotePid,
+        &localIovs[iovIdx],
+        numIovs,
+        &remoteIovs[iovIdx],
+        numIovs,
+        0);
+    if (nread == -1) {
+      return TP_CREATE_ERROR(SystemError, "cma", errno);
+    }
+    if (static_cast<size_t>(nread) != length) {
+      return TP_CREATE_ERROR(ShortReadError, length, nread);
+    }
+  }
+  return Error::kSuccess;
+}
+
+void ContextImpl::completeCopy(const CopyChunk& chunk, Error error) {
+  CopyRequest& request = *chunk.request;
+  if (error) {
+    std::unique_lock<std::mutex> lock(request.errorMutex);
+    if (!request.error) {
+      request.error = std::move(error);
+    }
+  }
+
+  if (--request.numPendingChunks == 0) {
+    // All other threads are done with the request, hence no need to lock.
+    request.callback(request.error);
   }
 }
 
@@ -10,15 +10,20 @@
 
 #include <atomic>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include <tensorpipe/channel/context_impl_boilerplate.h>
 #include <tensorpipe/channel/cpu_context.h>
 #include <tensorpipe/common/cpu_buffer.h>
 #include <tensorpipe/common/deferred_executor.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/common/mpmc_queue.h>
 #include <tensorpipe/common/optional.h>
-#include <tensorpipe/common/queue.h>
+#include <tensorpipe/common/thread_options.h>
 
 namespace tensorpipe {
 namespace channel {
@@ -29,9 +34,15 @@ class ChannelImpl;
 class ContextImpl final
     : public ContextImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl> {
  public:
-  static std::shared_ptr<ContextImpl> create();
+  static std::shared_ptr<ContextImpl> create(
+      size_t numThreads,
+      ThreadOptions threadOptions);
 
-  ContextImpl(bool isViable, std::string domainDescriptor);
+  ContextImpl(
+      bool isViable,
+      std::string domainDescriptor,
+      size_t numThreads,
+      ThreadOptions threadOptions);
 
   std::shared_ptr<CpuChannel> createChannel(
       std::shared_ptr<transport::Connection> connection,
@@ -41,15 +52,16 @@ class ContextImpl final
 
   // Implement the DeferredExecutor interface.
   bool inLoop() override;
-  void deferToLoop(std::function<void()> fn) override;
+  void deferToLoop(TTask fn) override;
 
-  using copy_request_callback_fn = std::function<void(const Error&)>;
+  using copy_request_callback_fn = MoveOnlyFunction<void(const Error&)>;
 
+  // The buffers may not be contiguous (see CpuBuffer::rowLength), but must be
+  // of the same length.
   void requestCopy(
       pid_t remotePid,
-      void* remotePtr,
-      void* localPtr,
-      size_t length,
+      CpuBuffer remoteBuffer,
+      CpuBuffer localBuffer,
       copy_request_callback_fn fn);
 
  protected:
@@ -64,19 +76,46 @@ class ContextImpl final
 
   struct CopyRequest {
     pid_t remotePid;
-    void* remotePtr;
-    void* localPtr;
-    size_t length;
+    CpuBuffer remoteBuffer;
+    CpuBuffer localBuffer;
     copy_request_callback_fn callback;
+
+    // Large requests are split into chunks, which are performed in parallel by
+    // different threads. The one that completes the last chunk fires the
+    // callback, with the first error that was encountered, if any.
+    std::atomic<size_t> numPendingChunks{0};
+    std::mutex errorMutex;
+    Error error;
+  };
+
+  struct CopyChunk {
+    std::shared_ptr<CopyRequest> request;
+    size_t offset;
+    size_t length;
   };
 
-  std::thread thread_;
-  Queue<optional<CopyRequest>> requests_{std::numeric_limits<int>::max()};
+  // Small copies are served by their own dedicated thread so that they never
+  // end up waiting behind large ones, whose chunks are spread among a pool of
+  // threads in order to use more than one core's memory bandwidth. The small
+  // copies that are queued up together (e.g., the tensors of a same message)
+  // are performed in batches, each with a single syscall, unless they aren't
+  // contiguous, as they then take an iovec per row already. Enqueuing copies
+  // blocks the loop while kMaxQueuedCopies are already waiting, which holds
+  // new ones back until the threads catch up.
+  static constexpr size_t kMaxQueuedCopies = 1024;
+  std::thread smallCopiesThread_;
+  MpmcQueue<optional<CopyChunk>> smallCopies_{kMaxQueuedCopies};
+  std::vector<std::thread> largeCopiesThreads_;
+  MpmcQueue<optional<CopyChunk>> largeCopies_{kMaxQueuedCopies};
 
   // This is atomic because it may be accessed from outside the loop.
   std::atomic<uint64_t> nextRequestId_{0};
 
-  void handleCopyRequests();
+  void handleSmallCopyRequests();
+  void handleLargeCopyRequests();
+
+  static Error performCopy(const CopyChunk& chunk);
+  static void completeCopy(const CopyChunk& chunk, Error error);
 };
 
 } // namespace cma
@@ -8,9 +8,14 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
 #include <string>
 
+#include <tensorpipe/channel/stats.h>
+#include <tensorpipe/common/loop_stats.h>
+#include <tensorpipe/common/memory_footprint.h>
+#include <tensorpipe/common/pinned_memory_allocator.h>
 #include <tensorpipe/transport/context.h>
 
 namespace tensorpipe {
@@ -41,6 +46,30 @@ class Context {
     return true;
   }
 
+  // Return whether the channels can send and receive buffers that aren't
+  // contiguous (see CpuBuffer::rowLength), each end with a layout of its own.
+  //
+  // Those that can't are only given contiguous buffers: the core context
+  // gathers the others into temporary memory before sending them, and
+  // receives into temporary memory that it then scatters into them.
+  //
+  virtual bool supportsStridedBuffers() const {
+    return false;
+  }
+
+  // Return whether the channels can send and receive buffers in CUDA managed
+  // memory (see cudaMallocManaged), as those that copy it with the CUDA runtime
+  // can, but not those that share it through IPC handles or register it with
+  // a NIC.
+  //
+  // Those that can't are only given device memory: the core context copies the
+  // others to (or from) temporary device memory, just as for strided buffers.
+  // Either way, it migrates managed memory to its device before the transfer.
+  //
+  virtual bool supportsManagedMemory() const {
+    return false;
+  }
+
   // Return string to describe the domain for this channel.
   //
   // Two processes with a channel context of the same type whose
@@ -66,6 +95,49 @@ class Context {
   // only used for logging and debugging purposes.
   virtual void setId(std::string id) = 0;
 
+  // Start gathering the statistics of the event loops of the context, which
+  // the high-level context does when it collects statistics itself.
+  virtual void enableLoopStats() {}
+
+  // Return a snapshot of the statistics of each of the event loops of this
+  // context, by name. Contexts without loops of their own (e.g., those that
+  // defer to the ones of the transports they're given) have none.
+  virtual std::map<std::string, LoopStats> getLoopStats() {
+    return {};
+  }
+
+  // Start timing the operations of the channels of this context, which the
+  // high-level context does when it collects statistics itself. This is only
+  // supported by the CUDA channels, and it costs them a few events per copy.
+  virtual void enableChannelStats() {}
+
+  // Return a snapshot of the timings of the operations of the channels of this
+  // context, which are empty unless enabled. Those still running on the GPU
+  // when this is called will only be accounted for in later snapshots.
+  virtual ChannelStats getChannelStats() {
+    return ChannelStats();
+  }
+
+  // Return a snapshot of the memory held by this context and its channels, by
+  // kind, not counting the one of the transports they're given.
+  virtual MemoryFootprint getMemoryFootprint() {
+    return MemoryFootprint();
+  }
+
+  // Give back the memory that isn't in use right now (e.g., cached staging
+  // buffers), as the high-level context does when it goes over its soft limit.
+  // This is done asynchronously, in background.
+  virtual void reclaimMemory() {}
+
+  // Have the context stage through the given pinned memory, rather than through
+  // memory of its own, as the high-level context does when it's given one (see
+  // ContextOptions::pinnedMemoryAllocator). This is only called before any
+  // channel is created, and only the channels that stage through pinned memory
+  // (e.g., cuda_basic) make use of it. The memory that the allocator holds
+  // isn't part of the footprint of the context.
+  virtual void setPinnedMemoryAllocator(
+      std::shared_ptr<PinnedMemoryAllocator> /* unused */) {}
+
   // Put the channel context in a terminal state, in turn closing all of its
   // channels, and release its resources. This may be done asynchronously, in
   // background.
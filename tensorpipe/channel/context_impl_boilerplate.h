@@ -17,6 +17,7 @@
 
 #include <tensorpipe/channel/channel_boilerplate.h>
 #include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/memory_footprint.h>
 #include <tensorpipe/transport/context.h>
 
 namespace tensorpipe {
@@ -51,6 +52,14 @@ class ContextImplBoilerplate : public virtual DeferredExecutor,
 
   void setId(std::string id);
 
+  // The memory held by the context and its channels, which the subclasses
+  // account for in these counters, from any thread.
+  MemoryFootprintCounters& getMemoryFootprintCounters();
+  MemoryFootprint getMemoryFootprint() const;
+
+  // Give back the memory that isn't in use, asynchronously.
+  void reclaimMemory();
+
   void close();
 
   void join();
@@ -61,6 +70,12 @@ class ContextImplBoilerplate : public virtual DeferredExecutor,
   virtual void closeImpl() = 0;
   virtual void joinImpl() = 0;
   virtual void setIdImpl() {}
+  virtual void reclaimMemoryImpl() {}
+  // The memory that isn't accounted for in the counters, e.g., the one held by
+  // internal contexts or by pools that may outlive this context.
+  virtual MemoryFootprint getMemoryFootprintImpl() const {
+    return MemoryFootprint();
+  }
 
   template <typename... Args>
   std::shared_ptr<Channel<TBuffer>> createChannelInternal(Args&&... args);
@@ -76,6 +91,8 @@ class ContextImplBoilerplate : public virtual DeferredExecutor,
 
   const std::string domainDescriptor_;
 
+  MemoryFootprintCounters memoryFootprintCounters_;
+
   // Sequence numbers for the channels created by this context, used to create
   // their identifiers based off this context's identifier. They will only be
   // used for logging and debugging.
@@ -142,6 +159,31 @@ void ContextImplBoilerplate<TBuffer, TCtx, TChan>::setId(std::string id) {
   setIdImpl();
 }
 
+template <typename TBuffer, typename TCtx, typename TChan>
+MemoryFootprintCounters& ContextImplBoilerplate<TBuffer, TCtx, TChan>::
+    getMemoryFootprintCounters() {
+  return memoryFootprintCounters_;
+}
+
+template <typename TBuffer, typename TCtx, typename TChan>
+MemoryFootprint ContextImplBoilerplate<TBuffer, TCtx, TChan>::
+    getMemoryFootprint() const {
+  MemoryFootprint footprint = memoryFootprintCounters_.snapshot();
+  footprint.merge(getMemoryFootprintImpl());
+  return footprint;
+}
+
+template <typename TBuffer, typename TCtx, typename TChan>
+void ContextImplBoilerplate<TBuffer, TCtx, TChan>::reclaimMemory() {
+  deferToLoop([this, impl{this->shared_from_this()}]() {
+    if (closed_) {
+      return;
+    }
+    TP_VLOG(4) << "Channel context " << id_ << " is reclaiming memory";
+    reclaimMemoryImpl();
+  });
+}
+
 template <typename TBuffer, typename TCtx, typename TChan>
 void ContextImplBoilerplate<TBuffer, TCtx, TChan>::close() {
   // Defer this to the loop so that it won't race with other code accessing it
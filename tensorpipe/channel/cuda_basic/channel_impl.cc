@@ -8,22 +8,64 @@
 
 #include <tensorpipe/channel/cuda_basic/channel_impl.h>
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <cuda_runtime.h>
+#include <nop/serializer.h>
+#include <nop/structure.h>
 
 #include <tensorpipe/channel/channel.h>
 #include <tensorpipe/channel/cuda_basic/context_impl.h>
+#include <tensorpipe/channel/cuda_copy_timer.h>
+#include <tensorpipe/channel/helpers.h>
 #include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/cuda_copy_streams.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/nop.h>
 
 namespace tensorpipe {
 namespace channel {
 namespace cuda_basic {
 
+namespace {
+
+struct Descriptor {
+  uint64_t chunkSize;
+  std::vector<std::string> chunkDescriptors;
+  // The name of the transform that encoded the data, or empty if none did.
+  std::string transformName;
+  NOP_STRUCTURE(Descriptor, chunkSize, chunkDescriptors, transformName);
+};
+
+size_t chunkLength(size_t length, size_t chunkSize, size_t chunkIdx) {
+  return std::min(chunkSize, length - chunkIdx * chunkSize);
+}
+
+// The staging buffers of the copies done through GDRCopy needn't be pinned.
+CudaPinnedBuffer makeUnpinnedBuffer(size_t length) {
+  return CudaPinnedBuffer(
+      new uint8_t[length], std::default_delete<uint8_t[]>());
+}
+
+// The address at which the kernels of the transforms access a staging buffer.
+void* devicePointerOfPinnedBuffer(const CudaPinnedBuffer& buffer) {
+  void* ptr;
+  TP_CUDA_CHECK(cudaHostGetDevicePointer(&ptr, buffer.get(), 0));
+  return ptr;
+}
+
+// The number of recvs that may be staging their chunks at once on a channel,
+// e.g., those of the tensors of a message, ahead of the oldest one that hasn't
+// completed yet.
+constexpr size_t kMaxRecvsInFlight = 16;
+
+} // namespace
+
 ChannelImpl::ChannelImpl(
     ConstructorToken token,
     std::shared_ptr<ContextImpl> context,
@@ -35,7 +77,8 @@ ChannelImpl::ChannelImpl(
           std::move(context),
           std::move(id)),
       cpuChannel_(std::move(cpuChannel)),
-      cudaLoop_(cudaLoop) {}
+      cudaLoop_(cudaLoop),
+      recvWindow_(kMaxRecvsInFlight) {}
 
 void ChannelImpl::initImplFromLoop() {
   context_->enroll(*this);
@@ -46,60 +89,189 @@ void ChannelImpl::sendImplFromLoop(
     CudaBuffer buffer,
     TDescriptorCallback descriptorCallback,
     TSendCallback callback) {
-  TP_VLOG(5) << "Channel " << id_ << " is copying buffer #" << sequenceNumber
-             << " from CUDA device to CPU";
-  auto tmpBuffer = makeCudaPinnedBuffer(buffer.length);
-  TP_CUDA_CHECK(cudaMemcpyAsync(
-      tmpBuffer.get(),
-      buffer.ptr,
-      buffer.length,
-      cudaMemcpyDeviceToHost,
-      buffer.stream));
+  const size_t maxChunkSize = context_->getChunkSize();
 
   sendOperations_.emplace_back();
   auto& op = sendOperations_.back();
   op.sequenceNumber = sequenceNumber;
-  op.tmpBuffer = std::move(tmpBuffer);
-  op.length = buffer.length;
+  op.buffer = buffer;
+  op.deviceIdx = cudaDeviceForPointer(context_->getCudaLib(), buffer.ptr);
+  op.copyStream = context_->getCopyStream(op.deviceIdx, buffer.stream);
+  op.transform = context_->getTransformFor(buffer);
+  op.stagedLength = op.transform != nullptr
+      ? op.transform->encodedLength(buffer.length)
+      : buffer.length;
+  if (maxChunkSize == 0 || op.stagedLength <= maxChunkSize) {
+    op.chunkSize = op.stagedLength;
+    op.numChunks = 1;
+  } else {
+    op.chunkSize = maxChunkSize;
+    op.numChunks = (op.stagedLength + maxChunkSize - 1) / maxChunkSize;
+  }
+  op.chunkDescriptors.resize(op.numChunks);
   op.descriptorCallback = std::move(descriptorCallback);
-  op.ready = false;
-
-  cudaLoop_.addCallback(
-      cudaDeviceForPointer(context_->getCudaLib(), buffer.ptr),
-      buffer.stream,
-      eagerCallbackWrapper_([&op](ChannelImpl& impl) {
-        TP_VLOG(5) << "Channel " << impl.id_ << " is done copying buffer #"
-                   << op.sequenceNumber << " from CUDA device to CPU";
-        op.ready = true;
-        impl.onTempBufferReadyForSend();
-      }));
-
-  callback(Error::kSuccess);
+  op.callback = std::move(callback);
+
+  if (op.transform == nullptr &&
+      context_->canUseGdrcopy(buffer, op.deviceIdx)) {
+    TP_VLOG(5) << "Channel " << id_ << " is copying buffer #" << sequenceNumber
+               << " from CUDA device to CPU through GDRCopy";
+    op.tmpBuffer = makeUnpinnedBuffer(buffer.length);
+    context_->gdrcopyFromDevice(op.tmpBuffer.get(), buffer, 0, buffer.length);
+    op.numChunksCopied = op.numChunks;
+    op.callback(Error::kSuccess);
+    onTempBufferReadyForSend();
+    return;
+  }
+
+  TP_VLOG(5) << "Channel " << id_
+             << " is allocating temporary buffer for buffer #"
+             << sequenceNumber;
+  context_->getPinnedMemoryAllocator().allocate(
+      op.deviceIdx,
+      op.stagedLength,
+      eagerCallbackWrapper_(
+          [&op](ChannelImpl& impl, CudaPinnedBuffer tmpBuffer) {
+            impl.onTempBufferAllocatedForSend(op, std::move(tmpBuffer));
+          }));
+}
+
+void ChannelImpl::onTempBufferAllocatedForSend(
+    SendOperation& op,
+    CudaPinnedBuffer tmpBuffer) {
+  if (error_) {
+    op.callback(error_);
+    op.numChunksCopied = op.numChunks;
+    onTempBufferReadyForSend();
+    return;
+  }
+
+  op.tmpBuffer = std::move(tmpBuffer);
+  CudaCopyTimer& copyTimer = context_->getCopyTimer();
+  const size_t sampleIdx = copyTimer.begin(op.deviceIdx);
+  cudaStreamWaitForStream(
+      eventPool_, op.copyStream, op.deviceIdx, op.buffer.stream, op.deviceIdx);
+  copyTimer.markReady(sampleIdx, op.copyStream);
+  if (op.transform != nullptr) {
+    TP_VLOG(5) << "Channel " << id_ << " is encoding buffer #"
+               << op.sequenceNumber << " with transform "
+               << op.transform->name() << " from CUDA device to CPU";
+    {
+      CudaDeviceGuard guard(op.deviceIdx);
+      op.transform->encode(
+          op.buffer.ptr,
+          op.buffer.length,
+          devicePointerOfPinnedBuffer(op.tmpBuffer),
+          op.copyStream);
+    }
+    cudaLoop_.addCallback(
+        op.deviceIdx,
+        op.copyStream,
+        eagerCallbackWrapper_([&op](ChannelImpl& impl) {
+          TP_VLOG(5) << "Channel " << impl.id_ << " is done encoding buffer #"
+                     << op.sequenceNumber << " from CUDA device to CPU";
+          op.numChunksCopied = op.numChunks;
+          impl.onTempBufferReadyForSend();
+        }));
+  } else {
+    for (size_t chunkIdx = 0; chunkIdx < op.numChunks; chunkIdx++) {
+      const size_t offset = chunkIdx * op.chunkSize;
+      TP_VLOG(5) << "Channel " << id_ << " is copying chunk #" << chunkIdx
+                 << " of buffer #" << op.sequenceNumber
+                 << " from CUDA device to CPU";
+      TP_CUDA_CHECK(cudaMemcpyAsync(
+          op.tmpBuffer.get() + offset,
+          reinterpret_cast<uint8_t*>(op.buffer.ptr) + offset,
+          chunkLength(op.buffer.length, op.chunkSize, chunkIdx),
+          cudaMemcpyDeviceToHost,
+          op.copyStream));
+
+      // The copies are all enqueued on the same stream, hence they will
+      // complete (and these callbacks will fire) in order.
+      cudaLoop_.addCallback(
+          op.deviceIdx,
+          op.copyStream,
+          eagerCallbackWrapper_([&op, chunkIdx](ChannelImpl& impl) {
+            TP_VLOG(5) << "Channel " << impl.id_ << " is done copying chunk #"
+                       << chunkIdx << " of buffer #" << op.sequenceNumber
+                       << " from CUDA device to CPU";
+            op.numChunksCopied++;
+            impl.onTempBufferReadyForSend();
+          }));
+    }
+  }
+
+  copyTimer.markCopied(sampleIdx, op.copyStream);
+  copyTimer.end(sampleIdx);
+
+  // Anything the user does next on their stream will be ordered after the
+  // copies.
+  cudaStreamWaitForStream(
+      eventPool_, op.buffer.stream, op.deviceIdx, op.copyStream, op.deviceIdx);
+  op.callback(Error::kSuccess);
 }
 
 void ChannelImpl::onTempBufferReadyForSend() {
+  // Chunks must be handed to the CPU channel in order, across all operations,
+  // as that's how they'll be matched with the receives on the remote side.
+  for (auto& op : sendOperations_) {
+    while (op.numChunksSent < op.numChunksCopied) {
+      const size_t chunkIdx = op.numChunksSent++;
+      if (error_) {
+        op.numChunkDescriptors++;
+        continue;
+      }
+
+      const size_t offset = chunkIdx * op.chunkSize;
+      CpuBuffer cpuBuffer{
+          op.tmpBuffer.get() + offset,
+          chunkLength(op.stagedLength, op.chunkSize, chunkIdx)};
+      // Keep tmpBuffer alive until cpuChannel_ is done sending it over.
+      // TODO: This could be a lazy callback wrapper.
+      auto callback = eagerCallbackWrapper_(
+          [sequenceNumber{op.sequenceNumber},
+           chunkIdx,
+           tmpBuffer{op.tmpBuffer}](ChannelImpl& impl) {
+            TP_VLOG(5) << "Channel " << impl.id_ << " is done sending chunk #"
+                       << chunkIdx << " of buffer #" << sequenceNumber
+                       << " through CPU channel";
+          });
+      TP_VLOG(6) << "Channel " << id_ << " is sending chunk #" << chunkIdx
+                 << " of buffer #" << op.sequenceNumber
+                 << " through CPU channel";
+      cpuChannel_->send(
+          cpuBuffer,
+          eagerCallbackWrapper_([&op, chunkIdx](
+                                    ChannelImpl& impl,
+                                    std::string descriptor) {
+            op.chunkDescriptors[chunkIdx] = std::move(descriptor);
+            op.numChunkDescriptors++;
+            impl.onTempBufferReadyForSend();
+          }),
+          std::move(callback));
+    }
+    if (op.numChunksSent < op.numChunks) {
+      break;
+    }
+  }
+
   while (!sendOperations_.empty()) {
     auto& op = sendOperations_.front();
-    if (!op.ready) {
+    if (op.numChunkDescriptors < op.numChunks) {
       break;
     }
 
     if (error_) {
       op.descriptorCallback(error_, std::string());
     } else {
-      CpuBuffer cpuBuffer{op.tmpBuffer.get(), op.length};
-      // Keep tmpBuffer alive until cpuChannel_ is done sending it over.
-      // TODO: This could be a lazy callback wrapper.
-      auto callback = eagerCallbackWrapper_(
-          [sequenceNumber{op.sequenceNumber},
-           tmpBuffer{std::move(op.tmpBuffer)}](ChannelImpl& impl) {
-            TP_VLOG(5) << "Channel " << impl.id_ << " is done sending buffer #"
-                       << sequenceNumber << " through CPU channel";
-          });
-      TP_VLOG(6) << "Channel " << id_ << " is sending buffer #"
-                 << op.sequenceNumber << " through CPU channel";
-      cpuChannel_->send(
-          cpuBuffer, std::move(op.descriptorCallback), std::move(callback));
+      NopHolder<Descriptor> nopHolder;
+      Descriptor& nopDescriptor = nopHolder.getObject();
+      nopDescriptor.chunkSize = op.chunkSize;
+      nopDescriptor.chunkDescriptors = std::move(op.chunkDescriptors);
+      if (op.transform != nullptr) {
+        nopDescriptor.transformName = op.transform->name();
+      }
+      op.descriptorCallback(Error::kSuccess, saveDescriptor(nopHolder));
     }
 
     sendOperations_.pop_front();
@@ -111,56 +283,201 @@ void ChannelImpl::recvImplFromLoop(
     TDescriptor descriptor,
     CudaBuffer buffer,
     TRecvCallback callback) {
-  auto tmpBuffer = makeCudaPinnedBuffer(buffer.length);
-  CpuBuffer cpuBuffer{tmpBuffer.get(), buffer.length};
-
-  TP_VLOG(6) << "Channel " << id_ << " is receiving buffer #" << sequenceNumber
-             << " through CPU channel";
-  cpuChannel_->recv(
-      std::move(descriptor),
-      cpuBuffer,
-      eagerCallbackWrapper_([sequenceNumber,
-                             buffer,
-                             tmpBuffer{std::move(tmpBuffer)},
-                             callback{std::move(callback)}](
-                                ChannelImpl& impl) mutable {
-        TP_VLOG(5) << "Channel " << impl.id_ << " is done receiving buffer #"
-                   << sequenceNumber << " through CPU channel";
-        impl.onCpuChannelRecv(
-            sequenceNumber, buffer, std::move(tmpBuffer), std::move(callback));
-      }));
+  NopHolder<Descriptor> nopHolder;
+  loadDescriptor(nopHolder, descriptor);
+  Descriptor& nopDescriptor = nopHolder.getObject();
+
+  recvOperations_.emplace_back();
+  auto& op = recvOperations_.back();
+  op.sequenceNumber = sequenceNumber;
+  op.buffer = buffer;
+  op.deviceIdx = cudaDeviceForPointer(context_->getCudaLib(), buffer.ptr);
+  op.copyStream = context_->getCopyStream(op.deviceIdx, buffer.stream);
+  if (!nopDescriptor.transformName.empty()) {
+    op.transform = context_->getTransformByName(nopDescriptor.transformName);
+  }
+  op.stagedLength = op.transform != nullptr
+      ? op.transform->encodedLength(buffer.length)
+      : buffer.length;
+  op.chunkSize = nopDescriptor.chunkSize;
+  op.chunkDescriptors = std::move(nopDescriptor.chunkDescriptors);
+  op.callback = std::move(callback);
+
+  // The copies into the buffer must come after what the user has enqueued so
+  // far on their stream, which is already the case if that has all run, as is
+  // required to copy them through GDRCopy.
+  op.useGdrcopy = op.transform == nullptr &&
+      context_->canUseGdrcopy(buffer, op.deviceIdx);
+  // Only the wait is timed, as the copies are then paced by the arrival of
+  // the chunks from the CPU channel.
+  if (!op.useGdrcopy) {
+    CudaCopyTimer& copyTimer = context_->getCopyTimer();
+    const size_t sampleIdx = copyTimer.begin(op.deviceIdx);
+    cudaStreamWaitForStream(
+        eventPool_, op.copyStream, op.deviceIdx, buffer.stream, op.deviceIdx);
+    copyTimer.markReady(sampleIdx, op.copyStream);
+    copyTimer.end(sampleIdx);
+  }
+
+  // The operations stay put in the deque until they're retired, and they're
+  // retired only once they've started.
+  recvWindow_.enqueue(
+      sequenceNumber, [this, &op]() { allocateTempBufferForRecv(op); });
 }
 
-void ChannelImpl::onCpuChannelRecv(
-    uint64_t sequenceNumber,
-    CudaBuffer buffer,
-    CudaPinnedBuffer tmpBuffer,
-    TRecvCallback callback) {
+void ChannelImpl::allocateTempBufferForRecv(RecvOperation& op) {
   if (error_) {
-    callback(error_);
+    op.allocated = true;
+    onTempBufferReadyForRecv();
+    return;
+  }
+
+  if (op.useGdrcopy) {
+    onTempBufferAllocatedForRecv(op, makeUnpinnedBuffer(op.buffer.length));
     return;
   }
 
-  TP_VLOG(5) << "Channel " << id_ << " is copying buffer #" << sequenceNumber
-             << " from CPU to CUDA device";
-  TP_CUDA_CHECK(cudaMemcpyAsync(
-      buffer.ptr,
-      tmpBuffer.get(),
-      buffer.length,
-      cudaMemcpyHostToDevice,
-      buffer.stream));
-
-  // Keep tmpBuffer alive until cudaMemcpyAsync is done.
-  cudaLoop_.addCallback(
-      cudaDeviceForPointer(context_->getCudaLib(), buffer.ptr),
-      buffer.stream,
-      eagerCallbackWrapper_([sequenceNumber, tmpBuffer{std::move(tmpBuffer)}](
-                                ChannelImpl& impl) mutable {
-        TP_VLOG(5) << "Channel " << impl.id_ << " is done copying buffer #"
-                   << sequenceNumber << " from CPU to CUDA device";
-      }));
-
-  callback(Error::kSuccess);
+  TP_VLOG(5) << "Channel " << id_
+             << " is allocating temporary buffer for buffer #"
+             << op.sequenceNumber;
+  context_->getPinnedMemoryAllocator().allocate(
+      op.deviceIdx,
+      op.stagedLength,
+      eagerCallbackWrapper_(
+          [&op](ChannelImpl& impl, CudaPinnedBuffer tmpBuffer) {
+            impl.onTempBufferAllocatedForRecv(op, std::move(tmpBuffer));
+          }));
+}
+
+void ChannelImpl::onTempBufferAllocatedForRecv(
+    RecvOperation& op,
+    CudaPinnedBuffer tmpBuffer) {
+  op.tmpBuffer = std::move(tmpBuffer);
+  op.allocated = true;
+  onTempBufferReadyForRecv();
+}
+
+void ChannelImpl::onTempBufferReadyForRecv() {
+  // The buffers must be handed to the CPU channel in the same order in which
+  // the receives were issued, as that's how they'll be matched with the sends.
+  for (auto& op : recvOperations_) {
+    if (!op.allocated) {
+      break;
+    }
+    const size_t numChunks = op.chunkDescriptors.size();
+    while (op.numChunksRecvd < numChunks) {
+      const size_t chunkIdx = op.numChunksRecvd++;
+      if (error_) {
+        op.numChunksDone++;
+        continue;
+      }
+
+      CpuBuffer cpuBuffer{
+          op.tmpBuffer.get() + chunkIdx * op.chunkSize,
+          chunkLength(op.stagedLength, op.chunkSize, chunkIdx)};
+      TP_VLOG(6) << "Channel " << id_ << " is receiving chunk #" << chunkIdx
+                 << " of buffer #" << op.sequenceNumber
+                 << " through CPU channel";
+      cpuChannel_->recv(
+          std::move(op.chunkDescriptors[chunkIdx]),
+          cpuBuffer,
+          eagerCallbackWrapper_([&op, chunkIdx](ChannelImpl& impl) {
+            TP_VLOG(5) << "Channel " << impl.id_ << " is done receiving chunk #"
+                       << chunkIdx << " of buffer #" << op.sequenceNumber
+                       << " through CPU channel";
+            impl.onCpuChannelRecv(op, chunkIdx);
+          }));
+    }
+  }
+
+  // The operations may be done in any order, as the CPU channel may complete
+  // its recvs in any order, but the window only retires them in order, i.e.,
+  // always the one at the front.
+  std::vector<uint64_t> sequenceNumbers;
+  for (auto& op : recvOperations_) {
+    if (!op.completed && op.allocated &&
+        op.numChunksDone == op.chunkDescriptors.size()) {
+      op.completed = true;
+      sequenceNumbers.push_back(op.sequenceNumber);
+    }
+  }
+  for (uint64_t sequenceNumber : sequenceNumbers) {
+    recvWindow_.complete(sequenceNumber, [this]() { retireRecvOperation(); });
+  }
+}
+
+void ChannelImpl::retireRecvOperation() {
+  TP_DCHECK(!recvOperations_.empty());
+  auto& op = recvOperations_.front();
+  if (error_) {
+    op.callback(error_);
+  } else if (op.useGdrcopy) {
+    // The chunks were copied synchronously, as they arrived.
+    op.callback(Error::kSuccess);
+  } else {
+    // Keep tmpBuffer alive until all the copies are done. As they are all
+    // enqueued on the same stream it suffices to wait for the last one.
+    cudaLoop_.addCallback(
+        op.deviceIdx,
+        op.copyStream,
+        eagerCallbackWrapper_([sequenceNumber{op.sequenceNumber},
+                               tmpBuffer{std::move(op.tmpBuffer)}](
+                                  ChannelImpl& impl) mutable {
+          TP_VLOG(5) << "Channel " << impl.id_ << " is done copying buffer #"
+                     << sequenceNumber << " from CPU to CUDA device";
+        }));
+
+    cudaStreamWaitForStream(
+        eventPool_,
+        op.buffer.stream,
+        op.deviceIdx,
+        op.copyStream,
+        op.deviceIdx);
+    op.callback(Error::kSuccess);
+  }
+
+  recvOperations_.pop_front();
+}
+
+void ChannelImpl::onCpuChannelRecv(RecvOperation& op, size_t chunkIdx) {
+  op.numChunksDone++;
+  if (!error_ && op.transform != nullptr) {
+    // The data can only be decoded once all of it has arrived.
+    if (op.numChunksDone == op.chunkDescriptors.size()) {
+      TP_VLOG(5) << "Channel " << id_ << " is decoding buffer #"
+                 << op.sequenceNumber << " with transform "
+                 << op.transform->name() << " from CPU to CUDA device";
+      CudaDeviceGuard guard(op.deviceIdx);
+      op.transform->decode(
+          devicePointerOfPinnedBuffer(op.tmpBuffer),
+          op.buffer.ptr,
+          op.buffer.length,
+          op.copyStream);
+    }
+  } else if (!error_ && op.useGdrcopy) {
+    const size_t offset = chunkIdx * op.chunkSize;
+    TP_VLOG(5) << "Channel " << id_ << " is copying chunk #" << chunkIdx
+               << " of buffer #" << op.sequenceNumber
+               << " from CPU to CUDA device through GDRCopy";
+    context_->gdrcopyToDevice(
+        op.buffer,
+        offset,
+        op.tmpBuffer.get() + offset,
+        chunkLength(op.buffer.length, op.chunkSize, chunkIdx));
+  } else if (!error_) {
+    const size_t offset = chunkIdx * op.chunkSize;
+    TP_VLOG(5) << "Channel " << id_ << " is copying chunk #" << chunkIdx
+               << " of buffer #" << op.sequenceNumber
+               << " from CPU to CUDA device";
+    TP_CUDA_CHECK(cudaMemcpyAsync(
+        reinterpret_cast<uint8_t*>(op.buffer.ptr) + offset,
+        op.tmpBuffer.get() + offset,
+        chunkLength(op.buffer.length, op.chunkSize, chunkIdx),
+        cudaMemcpyHostToDevice,
+        op.copyStream));
+  }
+
+  onTempBufferReadyForRecv();
 }
 
 void ChannelImpl::setIdImpl() {
@@ -11,11 +11,14 @@
 #include <deque>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <tensorpipe/channel/channel_impl_boilerplate.h>
 #include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/channel/cuda_basic/context.h>
 #include <tensorpipe/common/cuda.h>
 #include <tensorpipe/common/cuda_buffer.h>
+#include <tensorpipe/common/cuda_event_pool.h>
 #include <tensorpipe/common/cuda_loop.h>
 
 namespace tensorpipe {
@@ -24,12 +27,60 @@ namespace cuda_basic {
 
 class ContextImpl;
 
+// In order to overlap the copies between device and host with the transfer
+// through the CPU channel, a buffer is split into chunks, which are copied and
+// sent independently. The staging buffer is allocated for the whole tensor.
+//
+// The chunks are handed to the CPU channel as they sit in the pinned staging
+// buffers, on both ends, hence those CPU channels that access the memory of
+// their peer (e.g., cma's process_vm_readv, or xth's memcpy) move them from
+// one staging buffer straight into the other, with no host copy of their own.
+//
+// A buffer to which a transform applies is encoded into the staging buffer at
+// once, and then sent in chunks, which are decoded into the buffer once they
+// have all arrived. The chunks are cut from the encoded data.
 struct SendOperation {
   uint64_t sequenceNumber{0};
+  CudaBuffer buffer;
+  int deviceIdx{0};
+  // The stream on which the copies are enqueued, which may be the user's one.
+  cudaStream_t copyStream{nullptr};
+  std::shared_ptr<Transform> transform;
+  // The length of the data in the staging buffer, i.e., of the encoded one.
+  size_t stagedLength{0};
+  size_t chunkSize{0};
+  size_t numChunks{0};
   CudaPinnedBuffer tmpBuffer;
-  size_t length{0};
   TDescriptorCallback descriptorCallback;
-  bool ready{false};
+  TSendCallback callback;
+  // The number of chunks that have been copied to the host, that have been
+  // passed to the CPU channel, and for which the CPU channel gave a descriptor.
+  size_t numChunksCopied{0};
+  size_t numChunksSent{0};
+  size_t numChunkDescriptors{0};
+  std::vector<std::string> chunkDescriptors;
+};
+
+struct RecvOperation {
+  uint64_t sequenceNumber{0};
+  CudaBuffer buffer;
+  int deviceIdx{0};
+  cudaStream_t copyStream{nullptr};
+  // Whether the chunks are copied to the device by the CPU, through GDRCopy.
+  bool useGdrcopy{false};
+  std::shared_ptr<Transform> transform;
+  size_t stagedLength{0};
+  size_t chunkSize{0};
+  std::vector<std::string> chunkDescriptors;
+  CudaPinnedBuffer tmpBuffer;
+  TRecvCallback callback;
+  bool allocated{false};
+  // The number of chunks that have been passed to the CPU channel, and that the
+  // CPU channel has finished receiving.
+  size_t numChunksRecvd{0};
+  size_t numChunksDone{0};
+  // Whether the operation has been handed to the window to be retired.
+  bool completed{false};
 };
 
 class ChannelImpl final
@@ -61,15 +112,31 @@ class ChannelImpl final
  private:
   const std::shared_ptr<CpuChannel> cpuChannel_;
   CudaLoop& cudaLoop_;
+  // The events that order the copy streams against the user's ones.
+  CudaEventPool eventPool_;
   std::deque<SendOperation> sendOperations_;
+  std::deque<RecvOperation> recvOperations_;
+  // Bounds the recvs whose staging buffers are allocated at once, and retires
+  // them, in order, from the front of recvOperations_.
+  OperationWindow recvWindow_;
+
+  void onTempBufferAllocatedForSend(
+      SendOperation& op,
+      CudaPinnedBuffer tmpBuffer);
 
   void onTempBufferReadyForSend();
 
-  void onCpuChannelRecv(
-      uint64_t sequenceNumber,
-      CudaBuffer buffer,
-      CudaPinnedBuffer tmpBuffer,
-      TRecvCallback callback);
+  void allocateTempBufferForRecv(RecvOperation& op);
+
+  void onTempBufferAllocatedForRecv(
+      RecvOperation& op,
+      CudaPinnedBuffer tmpBuffer);
+
+  void onTempBufferReadyForRecv();
+
+  void onCpuChannelRecv(RecvOperation& op, size_t chunkIdx);
+
+  void retireRecvOperation();
 };
 
 } // namespace cuda_basic
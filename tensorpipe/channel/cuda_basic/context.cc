@@ -19,8 +19,14 @@ namespace tensorpipe {
 namespace channel {
 namespace cuda_basic {
 
-Context::Context(std::shared_ptr<CpuContext> cpuContext)
-    : impl_(std::make_shared<ContextImpl>(std::move(cpuContext))) {}
+Context::Context(
+    std::shared_ptr<CpuContext> cpuContext,
+    CudaBasicOptions cudaBasicOptions,
+    ThreadOptions threadOptions)
+    : impl_(std::make_shared<ContextImpl>(
+          std::move(cpuContext),
+          std::move(cudaBasicOptions),
+          std::move(threadOptions))) {}
 
 // Explicitly define all methods of the context, which just forward to the impl.
 // We cannot use an intermediate ContextBoilerplate class without forcing a
@@ -40,10 +46,35 @@ bool Context::isViable() const {
   return impl_->isViable();
 }
 
+bool Context::supportsManagedMemory() const {
+  return true;
+}
+
 void Context::setId(std::string id) {
   impl_->setId(std::move(id));
 }
 
+MemoryFootprint Context::getMemoryFootprint() {
+  return impl_->getMemoryFootprint();
+}
+
+void Context::reclaimMemory() {
+  impl_->reclaimMemory();
+}
+
+void Context::setPinnedMemoryAllocator(
+    std::shared_ptr<PinnedMemoryAllocator> allocator) {
+  impl_->setPinnedMemoryAllocator(std::move(allocator));
+}
+
+void Context::enableChannelStats() {
+  impl_->enableChannelStats();
+}
+
+ChannelStats Context::getChannelStats() {
+  return impl_->getChannelStats();
+}
+
 void Context::close() {
   impl_->close();
 }
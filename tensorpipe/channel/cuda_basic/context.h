@@ -10,9 +10,14 @@
 
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <tensorpipe/channel/cpu_context.h>
 #include <tensorpipe/channel/cuda_context.h>
+#include <tensorpipe/common/cuda_buffer.h>
+#include <tensorpipe/common/cuda_loop.h>
+#include <tensorpipe/common/thread_options.h>
 #include <tensorpipe/transport/context.h>
 
 namespace tensorpipe {
@@ -21,9 +26,166 @@ namespace cuda_basic {
 
 class ContextImpl;
 
+// The default cap on the pinned host memory used for staging, see below.
+constexpr size_t kDefaultMaxPinnedBytes = 256 * 1024 * 1024;
+
+// The default size of the chunks into which large buffers are split, see below.
+constexpr size_t kDefaultChunkSize = 2 * 1024 * 1024;
+
+// The default size up to which buffers are copied through GDRCopy, see below.
+constexpr size_t kDefaultGdrcopyThreshold = 64 * 1024;
+
+// An on-device transform that the channel applies to the data of a buffer on
+// the sender before staging it (e.g., a cast from fp32 to fp16 or bf16, or a
+// blockwise 8-bit quantization), and that it reverses on the receiver, so that
+// less data crosses the host and the network. It's up to the user to provide
+// the kernels, and to deal with the loss of precision (e.g., error feedback).
+// The kernels are enqueued on the stream on which the channel does its copies,
+// and they read or write the staging buffer, which is pinned host memory, in
+// place of the copy between it and the device.
+class Transform {
+ public:
+  // The name under which the receiver finds its own instance of the transform,
+  // which the sender puts in the descriptor of the buffers it applies to.
+  virtual const std::string& name() const = 0;
+
+  // Whether the transform is to be applied to the given buffer. Those that
+  // aren't go through untouched, and so do those that are copied through
+  // GDRCopy.
+  virtual bool appliesTo(const CudaBuffer& buffer) const = 0;
+
+  // The number of bytes into which a buffer of the given length is encoded,
+  // which must be the same on both ends.
+  virtual size_t encodedLength(size_t length) const = 0;
+
+  // Enqueue on the stream the encoding of the length bytes at src (on the
+  // device) into the encodedLength(length) bytes at dst (the device pointer of
+  // the staging buffer).
+  virtual void encode(
+      const void* src,
+      size_t length,
+      void* dst,
+      cudaStream_t stream) = 0;
+
+  // Enqueue on the stream the decoding of the encodedLength(length) bytes at
+  // src (the device pointer of the staging buffer) into the length bytes at dst
+  // (on the device).
+  virtual void decode(
+      const void* src,
+      void* dst,
+      size_t length,
+      cudaStream_t stream) = 0;
+
+  virtual ~Transform() = default;
+};
+
+// How the context stages, splits, copies and transforms the buffers. The
+// defaults stage them through up to kDefaultMaxPinnedBytes of pinned memory,
+// in chunks of kDefaultChunkSize, copy them on streams of the context's own,
+// and copy those up to kDefaultGdrcopyThreshold through GDRCopy.
+class CudaBasicOptions {
+ public:
+  // The channel stages the data through pinned host memory, which is recycled
+  // across transfers. The total amount of pinned memory held by the context
+  // won't exceed this: transfers that would go over it are delayed until
+  // enough memory is released by previous ones. When the high-level context
+  // shares an allocator instead (see setPinnedMemoryAllocator), the memory
+  // comes from it, and this doesn't apply.
+  CudaBasicOptions&& maxPinnedBytes(size_t maxBytes) && {
+    maxPinnedBytes_ = maxBytes;
+    return std::move(*this);
+  }
+
+  // Buffers larger than this are split into chunks of that size, which are
+  // copied and transferred independently so that the copy of a chunk can
+  // overlap with the transfer of the previous one. Pass zero to disable it.
+  // The chunks are handed to the CPU channel as soon as they're staged, hence
+  // when GPUDirect isn't available a multi-rail CPU channel (e.g., mpt over
+  // several ibv transport contexts) spreads them across all the NICs while the
+  // following ones are still being copied.
+  CudaBasicOptions&& chunkSize(size_t size) && {
+    chunkSize_ = size;
+    return std::move(*this);
+  }
+
+  // The copies are enqueued on high-priority streams owned by the context, one
+  // per device, which are ordered against the user's streams by means of
+  // events. Pass false to enqueue them directly on the user's streams instead.
+  CudaBasicOptions&& useDedicatedCopyStreams(bool enabled) && {
+    useDedicatedCopyStreams_ = enabled;
+    return std::move(*this);
+  }
+
+  // How the completion of the copies is detected.
+  CudaBasicOptions&& cudaLoopMode(CudaLoopMode mode) && {
+    cudaLoopMode_ = mode;
+    return std::move(*this);
+  }
+
+  // Buffers up to this many bytes are instead copied by the CPU, through a
+  // mapping of the device memory, when GDRCopy (libgdrapi and its driver) is
+  // available and the stream of the buffer has nothing left to run, which
+  // spares small transfers the latency of the copy and of its completion.
+  // Pass zero to disable it.
+  CudaBasicOptions&& gdrcopyThreshold(size_t threshold) && {
+    gdrcopyThreshold_ = threshold;
+    return std::move(*this);
+  }
+
+  // A buffer that one of the transforms applies to (the first one, if several
+  // do) is encoded by it before staging, and decoded after, in one go rather
+  // than chunk by chunk. The peer must have been given the same transforms, or
+  // rather ones with the same names, or else the two won't use this channel.
+  CudaBasicOptions&& transforms(
+      std::vector<std::shared_ptr<Transform>> transforms) && {
+    transforms_ = std::move(transforms);
+    return std::move(*this);
+  }
+
+  size_t getMaxPinnedBytes() const {
+    return maxPinnedBytes_;
+  }
+
+  // Zero means disabled.
+  size_t getChunkSize() const {
+    return chunkSize_;
+  }
+
+  bool getUseDedicatedCopyStreams() const {
+    return useDedicatedCopyStreams_;
+  }
+
+  CudaLoopMode getCudaLoopMode() const {
+    return cudaLoopMode_;
+  }
+
+  // Zero means disabled.
+  size_t getGdrcopyThreshold() const {
+    return gdrcopyThreshold_;
+  }
+
+  const std::vector<std::shared_ptr<Transform>>& getTransforms() const {
+    return transforms_;
+  }
+
+ private:
+  size_t maxPinnedBytes_{kDefaultMaxPinnedBytes};
+  size_t chunkSize_{kDefaultChunkSize};
+  bool useDedicatedCopyStreams_{true};
+  CudaLoopMode cudaLoopMode_{CudaLoopMode::kStreamCallbacks};
+  size_t gdrcopyThreshold_{kDefaultGdrcopyThreshold};
+  std::vector<std::shared_ptr<Transform>> transforms_;
+};
+
 class Context : public CudaContext {
  public:
-  explicit Context(std::shared_ptr<CpuContext> cpuContext);
+  // The buffers are staged, and copied, through the CPU channel of cpuContext
+  // according to cudaBasicOptions, and the thread that waits for the copies is
+  // set up according to threadOptions.
+  explicit Context(
+      std::shared_ptr<CpuContext> cpuContext,
+      CudaBasicOptions cudaBasicOptions = CudaBasicOptions(),
+      ThreadOptions threadOptions = ThreadOptions());
 
   Context(const Context&) = delete;
   Context(Context&&) = delete;
@@ -38,8 +200,21 @@ class Context : public CudaContext {
 
   bool isViable() const override;
 
+  bool supportsManagedMemory() const override;
+
   void setId(std::string id) override;
 
+  MemoryFootprint getMemoryFootprint() override;
+
+  void reclaimMemory() override;
+
+  void setPinnedMemoryAllocator(
+      std::shared_ptr<PinnedMemoryAllocator> allocator) override;
+
+  void enableChannelStats() override;
+
+  ChannelStats getChannelStats() override;
+
   void close() override;
 
   void join() override;
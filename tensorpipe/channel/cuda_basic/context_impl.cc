@@ -8,20 +8,55 @@
 
 #include <tensorpipe/channel/cuda_basic/context_impl.h>
 
+#include <algorithm>
 #include <functional>
 #include <memory>
+#include <sstream>
+#include <string>
+#include <tuple>
 #include <utility>
 
+#include <cuda_runtime.h>
+
 #include <tensorpipe/channel/cuda_basic/channel_impl.h>
+#include <tensorpipe/common/cuda.h>
 
 namespace tensorpipe {
 namespace channel {
 namespace cuda_basic {
 
-ContextImpl::ContextImpl(std::shared_ptr<CpuContext> cpuContext)
+namespace {
+
+// The transforms are part of the domain descriptor, as only two contexts that
+// have the same ones can decode each other's buffers.
+std::string buildDomainDescriptor(
+    const CpuContext& cpuContext,
+    const std::vector<std::shared_ptr<Transform>>& transforms) {
+  std::ostringstream oss;
+  oss << cpuContext.domainDescriptor();
+  for (const auto& transform : transforms) {
+    oss << "_" << transform->name();
+  }
+  return oss.str();
+}
+
+} // namespace
+
+ContextImpl::ContextImpl(
+    std::shared_ptr<CpuContext> cpuContext,
+    CudaBasicOptions cudaBasicOptions,
+    ThreadOptions threadOptions)
     : ContextImplBoilerplate<CudaBuffer, ContextImpl, ChannelImpl>(
-          cpuContext->domainDescriptor()),
-      cpuContext_(std::move(cpuContext)) {
+          buildDomainDescriptor(*cpuContext, cudaBasicOptions.getTransforms())),
+      cpuContext_(std::move(cpuContext)),
+      cudaLoop_(std::move(threadOptions), cudaBasicOptions.getCudaLoopMode()),
+      pinnedBufferPool_(std::make_shared<CudaPinnedBufferPool>(
+          cudaBasicOptions.getMaxPinnedBytes())),
+      pinnedMemoryAllocator_(pinnedBufferPool_),
+      chunkSize_(cudaBasicOptions.getChunkSize()),
+      transforms_(cudaBasicOptions.getTransforms()),
+      copyStreams_(cudaBasicOptions.getUseDedicatedCopyStreams()),
+      gdrcopyThreshold_(cudaBasicOptions.getGdrcopyThreshold()) {
   Error error;
   std::tie(error, cudaLib_) = CudaLib::create();
   if (error) {
@@ -31,6 +66,22 @@ ContextImpl::ContextImpl(std::shared_ptr<CpuContext> cpuContext)
     return;
   }
   foundCudaLib_ = true;
+
+  if (gdrcopyThreshold_ == 0) {
+    return;
+  }
+  std::tie(error, gdrcopyLib_) = GdrcopyLib::create();
+  if (error) {
+    TP_VLOG(5) << "Channel context " << id_
+               << " won't use GDRCopy because libgdrapi could not be loaded: "
+               << error.what();
+    return;
+  }
+  gdr_ = gdrcopyLib_.open();
+  if (gdr_ == nullptr) {
+    TP_VLOG(5) << "Channel context " << id_
+               << " won't use GDRCopy because its driver could not be opened";
+  }
 }
 
 std::shared_ptr<CudaChannel> ContextImpl::createChannel(
@@ -48,11 +99,186 @@ const CudaLib& ContextImpl::getCudaLib() {
   return cudaLib_;
 }
 
+void ContextImpl::enableChannelStats() {
+  copyTimer_.enable();
+}
+
+ChannelStats ContextImpl::getChannelStats() {
+  return copyTimer_.getStats();
+}
+
+CudaCopyTimer& ContextImpl::getCopyTimer() {
+  return copyTimer_;
+}
+
+PinnedMemoryAllocator& ContextImpl::getPinnedMemoryAllocator() {
+  return *pinnedMemoryAllocator_;
+}
+
+void ContextImpl::setPinnedMemoryAllocator(
+    std::shared_ptr<PinnedMemoryAllocator> allocator) {
+  TP_THROW_ASSERT_IF(allocator == nullptr);
+  TP_VLOG(4) << "Channel context " << id_
+             << " is staging through a shared pinned memory allocator";
+  pinnedMemoryAllocator_ = std::move(allocator);
+}
+
+size_t ContextImpl::getChunkSize() const {
+  return chunkSize_;
+}
+
+std::shared_ptr<Transform> ContextImpl::getTransformFor(
+    const CudaBuffer& buffer) const {
+  for (const auto& transform : transforms_) {
+    if (transform->appliesTo(buffer)) {
+      return transform;
+    }
+  }
+  return nullptr;
+}
+
+std::shared_ptr<Transform> ContextImpl::getTransformByName(
+    const std::string& name) const {
+  auto iter = std::find_if(
+      transforms_.begin(),
+      transforms_.end(),
+      [&](const std::shared_ptr<Transform>& transform) {
+        return transform->name() == name;
+      });
+  TP_THROW_ASSERT_IF(iter == transforms_.end()) << "Unknown transform " << name;
+  return *iter;
+}
+
+cudaStream_t ContextImpl::getCopyStream(
+    int deviceIdx,
+    cudaStream_t userStream) {
+  TP_DCHECK(inLoop());
+  return copyStreams_.get(deviceIdx, userStream);
+}
+
+bool ContextImpl::canUseGdrcopy(const CudaBuffer& buffer, int deviceIdx) {
+  TP_DCHECK(inLoop());
+  if (gdr_ == nullptr || buffer.length > gdrcopyThreshold_) {
+    return false;
+  }
+
+  const cudaError_t res = cudaStreamQuery(buffer.stream);
+  if (res == cudaErrorNotReady) {
+    return false;
+  }
+  TP_CUDA_CHECK(res);
+
+  CudaDeviceGuard guard(deviceIdx);
+  return findGdrcopyMapping(buffer) != nullptr;
+}
+
+const ContextImpl::GdrcopyMapping* ContextImpl::findGdrcopyMapping(
+    const CudaBuffer& buffer) {
+  CUdeviceptr basePtr;
+  size_t allocSize;
+  TP_CUDA_DRIVER_CHECK(
+      cudaLib_,
+      cudaLib_.memGetAddressRange(
+          &basePtr, &allocSize, reinterpret_cast<CUdeviceptr>(buffer.ptr)));
+
+  unsigned long long bufferId;
+  TP_CUDA_DRIVER_CHECK(
+      cudaLib_,
+      cudaLib_.pointerGetAttribute(
+          &bufferId, CU_POINTER_ATTRIBUTE_BUFFER_ID, basePtr));
+
+  auto iter = gdrcopyMappings_.find(bufferId);
+  if (iter == gdrcopyMappings_.end()) {
+    optional<GdrcopyMapping> mapping;
+    const uintptr_t pageMask = GdrcopyLib::kGpuPageSize - 1;
+    const uintptr_t start =
+        (static_cast<uintptr_t>(basePtr) + pageMask) & ~pageMask;
+    const uintptr_t end =
+        (static_cast<uintptr_t>(basePtr) + allocSize) & ~pageMask;
+    GdrcopyLib::mh_t handle;
+    void* ptr;
+    if (start < end &&
+        gdrcopyLib_.pin_buffer(gdr_, start, end - start, 0, 0, &handle) == 0) {
+      if (gdrcopyLib_.map(gdr_, handle, &ptr, end - start) == 0) {
+        mapping = GdrcopyMapping{start, end - start, handle, ptr};
+      } else {
+        gdrcopyLib_.unpin_buffer(gdr_, handle);
+      }
+    }
+    if (!mapping.has_value()) {
+      TP_VLOG(5) << "Channel context " << id_
+                 << " couldn't map allocation of " << allocSize
+                 << " bytes for GDRCopy";
+    }
+    std::tie(iter, std::ignore) =
+        gdrcopyMappings_.emplace(bufferId, std::move(mapping));
+  }
+  if (!iter->second.has_value()) {
+    return nullptr;
+  }
+
+  const GdrcopyMapping& mapping = iter->second.value();
+  const uintptr_t ptr = reinterpret_cast<uintptr_t>(buffer.ptr);
+  if (ptr < mapping.start ||
+      ptr + buffer.length > mapping.start + mapping.length) {
+    return nullptr;
+  }
+  return &mapping;
+}
+
+void ContextImpl::gdrcopyFromDevice(
+    void* dst,
+    const CudaBuffer& src,
+    size_t offset,
+    size_t length) {
+  TP_DCHECK(inLoop());
+  const GdrcopyMapping* mapping = findGdrcopyMapping(src);
+  TP_DCHECK(mapping != nullptr);
+  const uint8_t* mappedSrc = reinterpret_cast<uint8_t*>(mapping->ptr) +
+      (reinterpret_cast<uintptr_t>(src.ptr) - mapping->start) + offset;
+  TP_THROW_ASSERT_IF(
+      gdrcopyLib_.copy_from_mapping(mapping->handle, dst, mappedSrc, length) !=
+      0)
+      << "Copy from GDRCopy mapping failed";
+}
+
+void ContextImpl::gdrcopyToDevice(
+    const CudaBuffer& dst,
+    size_t offset,
+    const void* src,
+    size_t length) {
+  TP_DCHECK(inLoop());
+  const GdrcopyMapping* mapping = findGdrcopyMapping(dst);
+  TP_DCHECK(mapping != nullptr);
+  uint8_t* mappedDst = reinterpret_cast<uint8_t*>(mapping->ptr) +
+      (reinterpret_cast<uintptr_t>(dst.ptr) - mapping->start) + offset;
+  // This ends with a store fence, hence the data will be visible to the work
+  // that the user enqueues next.
+  TP_THROW_ASSERT_IF(
+      gdrcopyLib_.copy_to_mapping(mapping->handle, mappedDst, src, length) != 0)
+      << "Copy to GDRCopy mapping failed";
+}
+
 void ContextImpl::closeImpl() {
   cpuContext_->close();
   cudaLoop_.close();
+  pinnedBufferPool_->close();
+
+  if (gdr_ != nullptr) {
+    for (auto& iter : gdrcopyMappings_) {
+      optional<GdrcopyMapping>& mapping = iter.second;
+      if (mapping.has_value()) {
+        gdrcopyLib_.unmap(gdr_, mapping->handle, mapping->ptr, mapping->length);
+        gdrcopyLib_.unpin_buffer(gdr_, mapping->handle);
+      }
+    }
+    gdrcopyMappings_.clear();
+    gdrcopyLib_.close(gdr_);
+    gdr_ = nullptr;
+  }
 }
 
+
 void ContextImpl::joinImpl() {
   cpuContext_->join();
   cudaLoop_.join();
@@ -62,7 +288,7 @@ bool ContextImpl::inLoop() {
   return loop_.inLoop();
 };
 
-void ContextImpl::deferToLoop(std::function<void()> fn) {
+void ContextImpl::deferToLoop(TTask fn) {
   loop_.deferToLoop(std::move(fn));
 };
 
@@ -70,6 +296,17 @@ void ContextImpl::setIdImpl() {
   cpuContext_->setId(id_ + ".cpu");
 }
 
+void ContextImpl::reclaimMemoryImpl() {
+  pinnedBufferPool_->releaseFreeBuffers();
+  cpuContext_->reclaimMemory();
+}
+
+MemoryFootprint ContextImpl::getMemoryFootprintImpl() const {
+  MemoryFootprint footprint = cpuContext_->getMemoryFootprint();
+  footprint.pinnedBytes += pinnedBufferPool_->getTotalBytes();
+  return footprint;
+}
+
 } // namespace cuda_basic
 } // namespace channel
 } // namespace tensorpipe
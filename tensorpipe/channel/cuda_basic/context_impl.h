@@ -8,13 +8,24 @@
 
 #pragma once
 
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <tensorpipe/channel/context_impl_boilerplate.h>
 #include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/channel/cuda_basic/context.h>
 #include <tensorpipe/channel/cuda_context.h>
+#include <tensorpipe/channel/cuda_copy_timer.h>
 #include <tensorpipe/common/cuda_buffer.h>
+#include <tensorpipe/common/cuda_copy_streams.h>
 #include <tensorpipe/common/cuda_lib.h>
 #include <tensorpipe/common/cuda_loop.h>
+#include <tensorpipe/common/cuda_pinned_buffer_pool.h>
 #include <tensorpipe/common/deferred_executor.h>
+#include <tensorpipe/common/gdrcopy_lib.h>
+#include <tensorpipe/common/optional.h>
 
 namespace tensorpipe {
 namespace channel {
@@ -25,7 +36,10 @@ class ChannelImpl;
 class ContextImpl final
     : public ContextImplBoilerplate<CudaBuffer, ContextImpl, ChannelImpl> {
  public:
-  explicit ContextImpl(std::shared_ptr<CpuContext> cpuContext);
+  ContextImpl(
+      std::shared_ptr<CpuContext> cpuContext,
+      CudaBasicOptions cudaBasicOptions,
+      ThreadOptions threadOptions);
 
   std::shared_ptr<CudaChannel> createChannel(
       std::shared_ptr<transport::Connection> connection,
@@ -35,15 +49,58 @@ class ContextImpl final
 
   const CudaLib& getCudaLib();
 
+  PinnedMemoryAllocator& getPinnedMemoryAllocator();
+
+  void setPinnedMemoryAllocator(
+      std::shared_ptr<PinnedMemoryAllocator> allocator);
+
+  size_t getChunkSize() const;
+
+  // The transform to apply to the buffer on the sender, if any.
+  std::shared_ptr<Transform> getTransformFor(const CudaBuffer& buffer) const;
+
+  // The transform with the given name, that the receiver must reverse.
+  std::shared_ptr<Transform> getTransformByName(const std::string& name) const;
+
+  // The stream on which to copy from or to a buffer of the given device, whose
+  // user has provided the given stream.
+  cudaStream_t getCopyStream(int deviceIdx, cudaStream_t userStream);
+
+  // Whether the buffer, which is on the given device, can be copied from or to
+  // by the CPU right away, through a GDRCopy mapping, rather than by a copy on
+  // a stream. This requires its stream to be idle, so that the copy is ordered
+  // after the work the user has already enqueued on it.
+  bool canUseGdrcopy(const CudaBuffer& buffer, int deviceIdx);
+
+  // Copy the given range of a buffer that passed canUseGdrcopy.
+  void gdrcopyFromDevice(
+      void* dst,
+      const CudaBuffer& src,
+      size_t offset,
+      size_t length);
+  void gdrcopyToDevice(
+      const CudaBuffer& dst,
+      size_t offset,
+      const void* src,
+      size_t length);
+
+  void enableChannelStats();
+
+  ChannelStats getChannelStats();
+
+  CudaCopyTimer& getCopyTimer();
+
   // Implement the DeferredExecutor interface.
   bool inLoop() override;
-  void deferToLoop(std::function<void()> fn) override;
+  void deferToLoop(TTask fn) override;
 
  protected:
   // Implement the entry points called by ContextImplBoilerplate.
   void closeImpl() override;
   void joinImpl() override;
   void setIdImpl() override;
+  void reclaimMemoryImpl() override;
+  MemoryFootprint getMemoryFootprintImpl() const override;
 
  private:
   OnDemandDeferredExecutor loop_;
@@ -51,9 +108,42 @@ class ContextImpl final
   bool foundCudaLib_{false};
   CudaLib cudaLib_;
 
+  CudaCopyTimer copyTimer_;
+
   const std::shared_ptr<CpuContext> cpuContext_;
   // TODO: Lazy initialization of cuda loop.
   CudaLoop cudaLoop_;
+
+  // Owned through a shared_ptr as the buffers it hands out keep it alive.
+  const std::shared_ptr<CudaPinnedBufferPool> pinnedBufferPool_;
+  // The above, unless one was shared by the high-level context, whose memory
+  // is neither accounted nor released by this context.
+  std::shared_ptr<PinnedMemoryAllocator> pinnedMemoryAllocator_;
+
+  const size_t chunkSize_;
+
+  const std::vector<std::shared_ptr<Transform>> transforms_;
+
+  CudaCopyStreams copyStreams_;
+
+  const size_t gdrcopyThreshold_;
+  GdrcopyLib gdrcopyLib_;
+  GdrcopyLib::gdr_t gdr_{nullptr};
+
+  // The device allocations are pinned and mapped whole, or rather the largest
+  // part of them aligned to GPU pages, the first time one of their buffers is
+  // copied, and they stay so until the context is closed. They are indexed by
+  // the CUDA driver's buffer ID, which is never reused, and those that can't be
+  // mapped are remembered as such.
+  struct GdrcopyMapping {
+    uintptr_t start;
+    size_t length;
+    GdrcopyLib::mh_t handle;
+    void* ptr;
+  };
+  std::map<unsigned long long, optional<GdrcopyMapping>> gdrcopyMappings_;
+
+  const GdrcopyMapping* findGdrcopyMapping(const CudaBuffer& buffer);
 };
 
 } // namespace cuda_basic
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include <tensorpipe/channel/stats.h>
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace channel {
+
+// Times the operations of the CUDA channels on the timeline of the GPU, by
+// recording events that capture when: the operation was issued (on a stream of
+// the timer's own, which has nothing else to do, hence which gets there right
+// away); the work that it must come after was done (i.e., when a copy that was
+// made to wait for it could start); and its copies were done. The samples are
+// accounted for in the histograms once their events have completed, which is
+// checked whenever a sample begins and when taking a snapshot.
+//
+// It does nothing until enabled. It's thread-safe, as the snapshots are taken
+// by the user, whereas the samples are taken from a context's loop.
+class CudaCopyTimer {
+ public:
+  // What begin returns when disabled, which the other methods then ignore.
+  static constexpr size_t kNoSample = SIZE_MAX;
+
+  // Beyond these many samples whose events haven't completed yet, the new ones
+  // are dropped, rather than hold more events.
+  static constexpr size_t kMaxPendingSamples = 1024;
+
+  CudaCopyTimer() = default;
+
+  CudaCopyTimer(const CudaCopyTimer&) = delete;
+  CudaCopyTimer(CudaCopyTimer&&) = delete;
+  CudaCopyTimer& operator=(const CudaCopyTimer&) = delete;
+  CudaCopyTimer& operator=(CudaCopyTimer&&) = delete;
+
+  void enable() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    enabled_ = true;
+  }
+
+  // Start a sample for an operation on the given device, issued now.
+  size_t begin(int device) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!enabled_) {
+      return kNoSample;
+    }
+    harvest();
+    if (pendingSamples_.size() >= kMaxPendingSamples) {
+      return kNoSample;
+    }
+    const size_t sampleIdx = acquireSample(device);
+    Sample& sample = *samples_[sampleIdx];
+    sample.issuedEv.record(getClockStream(device));
+    return sampleIdx;
+  }
+
+  // Mark the moment at which the work enqueued so far on the stream is done.
+  void markReady(size_t sampleIdx, cudaStream_t stream) {
+    if (sampleIdx == kNoSample) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    Sample& sample = *samples_[sampleIdx];
+    sample.readyEv.record(stream);
+    sample.hasReady = true;
+  }
+
+  // Mark the moment at which the copies enqueued so far on the stream, which
+  // come after the ready mark, are done.
+  void markCopied(size_t sampleIdx, cudaStream_t stream) {
+    if (sampleIdx == kNoSample) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    Sample& sample = *samples_[sampleIdx];
+    TP_DCHECK(sample.hasReady);
+    sample.copiedEv.record(stream);
+    sample.hasCopied = true;
+  }
+
+  // Tell that no more marks will be made for the sample, which will then be
+  // accounted for once its events complete.
+  void end(size_t sampleIdx) {
+    if (sampleIdx == kNoSample) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    samples_[sampleIdx]->ended = true;
+  }
+
+  ChannelStats getStats() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    harvest();
+    return stats_;
+  }
+
+  ~CudaCopyTimer() {
+    // The samples must be destroyed before the streams their events may still
+    // be recorded on, although the work on the latter will complete anyway.
+    samples_.clear();
+    for (const auto& iter : clockStreams_) {
+      CudaDeviceGuard guard(iter.first);
+      TP_CUDA_CHECK(cudaStreamDestroy(iter.second));
+    }
+  }
+
+ private:
+  struct Sample {
+    explicit Sample(int device)
+        : device(device),
+          issuedEv(device, /*interprocess=*/false, /*recordTiming=*/true),
+          readyEv(device, /*interprocess=*/false, /*recordTiming=*/true),
+          copiedEv(device, /*interprocess=*/false, /*recordTiming=*/true) {}
+
+    const int device;
+    CudaEvent issuedEv;
+    CudaEvent readyEv;
+    CudaEvent copiedEv;
+    bool hasReady{false};
+    bool hasCopied{false};
+    bool ended{false};
+  };
+
+  std::mutex mutex_;
+  bool enabled_{false};
+  ChannelStats stats_;
+
+  // The samples keep their index, and their events, once they're done, to be
+  // reused for new ones on the same device.
+  std::vector<std::unique_ptr<Sample>> samples_;
+  std::unordered_map<int, std::vector<size_t>> freeSamples_;
+  std::list<size_t> pendingSamples_;
+
+  std::unordered_map<int, cudaStream_t> clockStreams_;
+
+  size_t acquireSample(int device) {
+    std::vector<size_t>& freeSamples = freeSamples_[device];
+    size_t sampleIdx;
+    if (freeSamples.empty()) {
+      sampleIdx = samples_.size();
+      samples_.push_back(std::make_unique<Sample>(device));
+    } else {
+      sampleIdx = freeSamples.back();
+      freeSamples.pop_back();
+    }
+    Sample& sample = *samples_[sampleIdx];
+    sample.hasReady = false;
+    sample.hasCopied = false;
+    sample.ended = false;
+    pendingSamples_.push_back(sampleIdx);
+    return sampleIdx;
+  }
+
+  cudaStream_t getClockStream(int device) {
+    auto iter = clockStreams_.find(device);
+    if (iter == clockStreams_.end()) {
+      CudaDeviceGuard guard(device);
+      cudaStream_t stream;
+      TP_CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+      iter = clockStreams_.emplace(device, stream).first;
+    }
+    return iter->second;
+  }
+
+  // Account for the samples that are over and whose events have completed.
+  void harvest() {
+    for (auto iter = pendingSamples_.begin(); iter != pendingSamples_.end();) {
+      Sample& sample = *samples_[*iter];
+      const CudaEvent& lastEv = sample.hasCopied
+          ? sample.copiedEv
+          : (sample.hasReady ? sample.readyEv : sample.issuedEv);
+      if (!sample.ended || !lastEv.query()) {
+        ++iter;
+        continue;
+      }
+      if (sample.hasReady) {
+        stats_.copyQueueWaitTime.add(
+            sample.readyEv.elapsedSince(sample.issuedEv));
+      }
+      if (sample.hasCopied) {
+        stats_.copyRunTime.add(sample.copiedEv.elapsedSince(sample.readyEv));
+      }
+      freeSamples_[sample.device].push_back(*iter);
+      iter = pendingSamples_.erase(iter);
+    }
+  }
+};
+
+} // namespace channel
+} // namespace tensorpipe
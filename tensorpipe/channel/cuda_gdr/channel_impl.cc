@@ -15,8 +15,10 @@
 #include <utility>
 #include <vector>
 
+#include <tensorpipe/channel/cuda_copy_timer.h>
 #include <tensorpipe/channel/cuda_gdr/context_impl.h>
 #include <tensorpipe/channel/helpers.h>
+#include <tensorpipe/common/cuda.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
 #include <tensorpipe/transport/connection.h>
@@ -43,9 +45,7 @@ void ChannelImpl::initImplFromLoop() {
 
   context_->enroll(*this);
 
-  localGpuToNic_ = context_->getGpuToNicMapping();
-  numLocalNics_ =
-      *std::max_element(localGpuToNic_.begin(), localGpuToNic_.end()) + 1;
+  numLocalNics_ = context_->getNumIbvNics();
 
   auto nopHolderOut = std::make_shared<NopHolder<HandshakeNumNics>>();
   HandshakeNumNics& nopHandshakeNumNics = nopHolderOut->getObject();
@@ -89,21 +89,7 @@ void ChannelImpl::onReadHandshakeNumNics(
     IbvNic& localNic = context_->getIbvNic(localNicIdx);
     for (size_t remoteNicIdx = 0; remoteNicIdx < numRemoteNics_;
          remoteNicIdx++) {
-      IbvLib::qp_init_attr initAttr;
-      std::memset(&initAttr, 0, sizeof(initAttr));
-      initAttr.qp_type = IbvLib::QPT_RC;
-      initAttr.send_cq = localNic.getIbvCq().get();
-      initAttr.recv_cq = localNic.getIbvCq().get();
-      initAttr.cap.max_send_wr = kNumSends;
-      initAttr.cap.max_send_sge = 1;
-      initAttr.cap.max_recv_wr = kNumRecvs;
-      initAttr.cap.max_recv_sge = 1;
-      initAttr.sq_sig_all = 1;
-      IbvQueuePair qp = createIbvQueuePair(
-          context_->getIbvLib(), localNic.getIbvPd(), initAttr);
-
-      transitionIbvQueuePairToInit(
-          context_->getIbvLib(), qp, localNic.getIbvAddress());
+      IbvQueuePair qp = localNic.createQueuePair();
 
       IbvSetupInformation setupInfo =
           makeIbvSetupInformation(localNic.getIbvAddress(), qp);
@@ -114,9 +100,41 @@ void ChannelImpl::onReadHandshakeNumNics(
     }
   }
 
+  IbvNic& eagerNic = context_->getIbvNic(0);
+  eagerQueuePair_ = eagerNic.createQueuePair();
+  NopIbvSetupInformation eagerSetupInfo;
+  eagerSetupInfo.fromIbvSetupInformation(
+      makeIbvSetupInformation(eagerNic.getIbvAddress(), eagerQueuePair_));
+
+  // The recvs can be posted before the queue pair is ready to receive, and
+  // they must be by the time the peer can send to it, i.e., before it gets our
+  // setup information.
+  const size_t eagerBuffersLength = 2 * kNumEagerBuffers * kEagerThreshold;
+  eagerBuffers_ = makeCudaPinnedBuffer(eagerBuffersLength);
+  eagerBuffersMr_ = createIbvMemoryRegion(
+      context_->getIbvLib(),
+      eagerNic.getIbvPd(),
+      eagerBuffers_.get(),
+      eagerBuffersLength,
+      IbvLib::ACCESS_LOCAL_WRITE);
+  eagerBuffersCharge_ = MemoryCharge(
+      context_->getMemoryFootprintCounters(),
+      MemoryKind::kPinned,
+      eagerBuffersLength);
+  eagerSges_.resize(2 * kNumEagerBuffers);
+  eagerWrs_.resize(2 * kNumEagerBuffers);
+  for (size_t bufferIdx = 0; bufferIdx < 2 * kNumEagerBuffers; bufferIdx++) {
+    if (bufferIdx < kNumEagerBuffers) {
+      postEagerRecv(bufferIdx);
+    } else {
+      freeEagerBuffers_.push_back(bufferIdx);
+    }
+  }
+
   auto nopHolderOut = std::make_shared<NopHolder<HandshakeSetupInfo>>();
   HandshakeSetupInfo& nopHandshakeSetupInfo = nopHolderOut->getObject();
   nopHandshakeSetupInfo.setupInfo = std::move(allSetupInfo);
+  nopHandshakeSetupInfo.eagerSetupInfo = std::move(eagerSetupInfo);
   TP_VLOG(6) << "Channel " << id_ << " is writing nop object (handshake two)";
   connection_->write(
       *nopHolderOut, lazyCallbackWrapper_([nopHolderOut](ChannelImpl& impl) {
@@ -163,6 +181,14 @@ void ChannelImpl::onReadHandshakeSetupInfo(
     }
   }
 
+  IbvNic& eagerNic = context_->getIbvNic(0);
+  transitionIbvQueuePairToReadyToReceive(
+      context_->getIbvLib(),
+      eagerQueuePair_,
+      eagerNic.getIbvAddress(),
+      nopHandshakeSetupInfo.eagerSetupInfo.toIbvSetupInformation());
+  transitionIbvQueuePairToReadyToSend(context_->getIbvLib(), eagerQueuePair_);
+
   state_ = ESTABLISHED;
   for (auto& sendOp : sendOps_) {
     processSendOperationFromLoop(sendOp);
@@ -178,12 +204,20 @@ void ChannelImpl::sendImplFromLoop(
     TDescriptorCallback descriptorCallback,
     TSendCallback callback) {
   size_t localGpuIdx = cudaDeviceForPointer(context_->getCudaLib(), buffer.ptr);
-  size_t localNicIdx = context_->getGpuToNicMapping()[localGpuIdx];
+  // Spread the transfers of a GPU across all the NICs it's matched to.
+  const std::vector<size_t>& localNicIdxs =
+      context_->getGpuToNicMapping()[localGpuIdx];
+  size_t localNicIdx = localNicIdxs[sequenceNumber % localNicIdxs.size()];
 
   sendOps_.emplace_back(
       sequenceNumber, buffer, std::move(callback), localGpuIdx, localNicIdx);
   SendOperation& op = sendOps_.back();
+  // The data is read by the NIC, hence only the wait on the stream is timed.
+  CudaCopyTimer& copyTimer = context_->getCopyTimer();
+  const size_t sampleIdx = copyTimer.begin(localGpuIdx);
   op.event.record(op.buffer.stream);
+  copyTimer.markReady(sampleIdx, op.buffer.stream);
+  copyTimer.end(sampleIdx);
   if (state_ == ESTABLISHED) {
     processSendOperationFromLoop(op);
   }
@@ -199,32 +233,45 @@ void ChannelImpl::processSendOperationFromLoop(SendOperation& op) {
   TP_DCHECK_EQ(state_, ESTABLISHED);
   TP_DCHECK(!error_);
 
-  auto nopHolderIn = std::make_shared<NopHolder<ReadyToReceive>>();
-  TP_VLOG(6) << "Channel " << id_ << " is reading ready-to-receive (#"
-             << op.sequenceNumber << ")";
-  connection_->read(
-      *nopHolderIn,
-      eagerCallbackWrapper_([&op, nopHolderIn](ChannelImpl& impl) {
-        TP_VLOG(6) << "Channel " << impl.id_
-                   << " done reading ready-to-receive (# " << op.sequenceNumber
-                   << ")";
-        impl.onReadReadyToReceive(op, nopHolderIn->getObject());
-      }));
-}
-
-void ChannelImpl::onReadReadyToReceive(
-    SendOperation& op,
-    const ReadyToReceive& readyToReceive) {
-  TP_DCHECK(context_->inLoop());
-  TP_DCHECK_EQ(state_, ESTABLISHED);
-
-  if (error_) {
-    op.callback(error_);
-    eraseOp(op);
-    return;
+  if (op.eager) {
+    // The receiver doesn't grant credit for this tensor, but it gives back the
+    // one for a bounce buffer when it claims the tensor out of it, at which
+    // point it sends a ready-to-receive message just as for a chunk. Thus this
+    // is where that message falls in the sequence of those, even though it is
+    // unrelated to this operation, which may have completed by then.
+    auto nopHolderIn = std::make_shared<NopHolder<ReadyToReceive>>();
+    TP_VLOG(6) << "Channel " << id_ << " is reading eager credit (#"
+               << op.sequenceNumber << ")";
+    connection_->read(
+        *nopHolderIn,
+        lazyCallbackWrapper_([sequenceNumber{op.sequenceNumber},
+                              nopHolderIn](ChannelImpl& impl) {
+          TP_VLOG(6) << "Channel " << impl.id_
+                     << " done reading eager credit (#" << sequenceNumber
+                     << ")";
+          impl.onReadEagerCredit();
+        }));
+    // The eager sends must be posted in order, regardless of when the events
+    // of their operations complete.
+    sendOpsWaitingForEagerCredit_.push_back(&op);
   }
 
-  op.remoteNicIdx = readyToReceive.destinationNicIdx;
+  // The receiver will grant us credit for each chunk separately, as it posts
+  // the recv for it. We can start sending as soon as we get the first one.
+  for (size_t chunkIdx = 0; !op.eager && chunkIdx < op.numChunks;
+       chunkIdx++) {
+    auto nopHolderIn = std::make_shared<NopHolder<ReadyToReceive>>();
+    TP_VLOG(6) << "Channel " << id_ << " is reading ready-to-receive (#"
+               << op.sequenceNumber << ", chunk #" << chunkIdx << ")";
+    connection_->read(
+        *nopHolderIn,
+        eagerCallbackWrapper_([&op, chunkIdx, nopHolderIn](ChannelImpl& impl) {
+          TP_VLOG(6) << "Channel " << impl.id_
+                     << " done reading ready-to-receive (# "
+                     << op.sequenceNumber << ", chunk #" << chunkIdx << ")";
+          impl.onReadReadyToReceive(op, nopHolderIn->getObject());
+        }));
+  }
 
   TP_VLOG(6) << "Channel " << id_ << " is waiting for CUDA event to send (#"
              << op.sequenceNumber << ")";
@@ -242,13 +289,47 @@ void ChannelImpl::onReadReadyToReceive(
       }));
 }
 
+void ChannelImpl::onReadReadyToReceive(
+    SendOperation& op,
+    const ReadyToReceive& readyToReceive) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK_EQ(state_, ESTABLISHED);
+
+  op.numChunksGranted++;
+
+  if (error_) {
+    maybeCompleteOp(op);
+    return;
+  }
+
+  op.remoteNicIdx = readyToReceive.destinationNicIdx;
+  postGrantedChunks(op);
+}
+
 void ChannelImpl::onSendEventReady(SendOperation& op) {
   TP_DCHECK(context_->inLoop());
   TP_DCHECK_EQ(state_, ESTABLISHED);
 
+  op.doneWaitingForCudaEvent = true;
+
   if (error_) {
-    op.callback(error_);
-    eraseOp(op);
+    maybeCompleteOp(op);
+    return;
+  }
+
+  if (op.eager) {
+    postEagerSends();
+  } else {
+    postGrantedChunks(op);
+  }
+}
+
+void ChannelImpl::postGrantedChunks(SendOperation& op) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(!error_);
+
+  if (!op.doneWaitingForCudaEvent ||
+      op.numChunksPosted == op.numChunksGranted) {
     return;
   }
 
@@ -259,26 +340,85 @@ void ChannelImpl::onSendEventReady(SendOperation& op) {
   // result will be cached and subsequent calls will be much faster.
   IbvMemoryRegion& mr = localNic.registerMemory(op.buffer);
 
-  IbvLib::sge list;
-  list.addr = reinterpret_cast<uint64_t>(op.buffer.ptr);
-  list.length = op.buffer.length;
-  list.lkey = mr->lkey;
+  while (op.numChunksPosted < op.numChunksGranted) {
+    size_t chunkIdx = op.numChunksPosted;
+    size_t offset = chunkIdx * kChunkSize;
+    size_t length = std::min(kChunkSize, op.buffer.length - offset);
+
+    IbvLib::sge& list = op.sges[chunkIdx];
+    list.addr = reinterpret_cast<uint64_t>(op.buffer.ptr) + offset;
+    list.length = length;
+    list.lkey = mr->lkey;
+
+    IbvLib::send_wr& wr = op.wrs[chunkIdx];
+    std::memset(&wr, 0, sizeof(wr));
+    wr.sg_list = &list;
+    wr.num_sge = 1;
+    wr.opcode = IbvLib::WR_SEND;
+
+    TP_VLOG(6) << "Channel " << id_ << " is sending tensor (#"
+               << op.sequenceNumber << ", chunk #" << chunkIdx << ") on QP "
+               << qp->qp_num;
+    localNic.postSend(
+        qp, wr, eagerCallbackWrapper_([&op, chunkIdx](ChannelImpl& impl) {
+          TP_VLOG(6) << "Channel " << impl.id_ << " done sending tensor (# "
+                     << op.sequenceNumber << ", chunk #" << chunkIdx << ")";
+          impl.onIbvSendDone(op);
+        }));
+    op.numChunksPosted++;
+    numSendsInFlight_++;
+  }
+}
 
-  IbvLib::send_wr wr;
-  std::memset(&wr, 0, sizeof(wr));
-  wr.sg_list = &list;
-  wr.num_sge = 1;
-  wr.opcode = IbvLib::WR_SEND;
-
-  TP_VLOG(6) << "Channel " << id_ << " is sending tensor (#"
-             << op.sequenceNumber << ") on QP " << qp->qp_num;
-  localNic.postSend(qp, wr, eagerCallbackWrapper_([&op](ChannelImpl& impl) {
-                      TP_VLOG(6) << "Channel " << impl.id_
-                                 << " done sending tensor (# "
-                                 << op.sequenceNumber << ")";
-                      impl.onIbvSendDone(op);
-                    }));
-  numSendsInFlight_++;
+void ChannelImpl::onReadEagerCredit() {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK_EQ(state_, ESTABLISHED);
+  TP_DCHECK(!error_);
+
+  numEagerCredits_++;
+  postEagerSends();
+}
+
+void ChannelImpl::postEagerSends() {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(!error_);
+
+  IbvNic& localNic = context_->getIbvNic(0);
+
+  while (!sendOpsWaitingForEagerCredit_.empty() && numEagerCredits_ > 0 &&
+         sendOpsWaitingForEagerCredit_.front()->doneWaitingForCudaEvent) {
+    SendOperation& op = *sendOpsWaitingForEagerCredit_.front();
+    sendOpsWaitingForEagerCredit_.pop_front();
+    numEagerCredits_--;
+    op.numChunksGranted = 1;
+
+    // This could be VEEERY slow the first time we encounter the buffer, but
+    // the result will be cached and subsequent calls will be much faster.
+    IbvMemoryRegion& mr = localNic.registerMemory(op.buffer);
+
+    IbvLib::sge& list = op.sges[0];
+    list.addr = reinterpret_cast<uint64_t>(op.buffer.ptr);
+    list.length = op.buffer.length;
+    list.lkey = mr->lkey;
+
+    IbvLib::send_wr& wr = op.wrs[0];
+    std::memset(&wr, 0, sizeof(wr));
+    wr.sg_list = &list;
+    wr.num_sge = 1;
+    wr.opcode = IbvLib::WR_SEND;
+
+    TP_VLOG(6) << "Channel " << id_ << " is sending tensor (#"
+               << op.sequenceNumber << ") eagerly on QP "
+               << eagerQueuePair_->qp_num;
+    localNic.postSend(
+        eagerQueuePair_, wr, eagerCallbackWrapper_([&op](ChannelImpl& impl) {
+          TP_VLOG(6) << "Channel " << impl.id_ << " done sending tensor (# "
+                     << op.sequenceNumber << ") eagerly";
+          impl.onIbvSendDone(op);
+        }));
+    op.numChunksPosted++;
+    numSendsInFlight_++;
+  }
 }
 
 void ChannelImpl::onIbvSendDone(SendOperation& op) {
@@ -286,13 +426,30 @@ void ChannelImpl::onIbvSendDone(SendOperation& op) {
   TP_DCHECK_EQ(state_, ESTABLISHED);
 
   numSendsInFlight_--;
+  op.numChunksDone++;
 
-  op.callback(error_);
-  eraseOp(op);
+  maybeCompleteOp(op);
 
   tryCleanup();
 }
 
+void ChannelImpl::maybeCompleteOp(SendOperation& op) {
+  // Wait for all the callbacks that are pending on the operation to return
+  // (there will be no more once all chunks have been granted and posted). An
+  // eager one has none besides its send, and upon error it won't be posted.
+  if (!op.doneWaitingForCudaEvent || op.numChunksDone < op.numChunksPosted) {
+    return;
+  }
+  if (op.eager ? !error_ && op.numChunksDone < op.numChunks
+               : op.numChunksGranted < op.numChunks) {
+    return;
+  }
+  TP_DCHECK(error_ || op.numChunksDone == op.numChunks);
+
+  op.callback(error_);
+  eraseOp(op);
+}
+
 void ChannelImpl::eraseOp(const SendOperation& op) {
   auto iter = std::find_if(
       sendOps_.begin(), sendOps_.end(), [&](const SendOperation& otherOp) {
@@ -308,7 +465,10 @@ void ChannelImpl::recvImplFromLoop(
     CudaBuffer buffer,
     TRecvCallback callback) {
   size_t localGpuIdx = cudaDeviceForPointer(context_->getCudaLib(), buffer.ptr);
-  size_t localNicIdx = context_->getGpuToNicMapping()[localGpuIdx];
+  // Spread the transfers of a GPU across all the NICs it's matched to.
+  const std::vector<size_t>& localNicIdxs =
+      context_->getGpuToNicMapping()[localGpuIdx];
+  size_t localNicIdx = localNicIdxs[sequenceNumber % localNicIdxs.size()];
 
   NopHolder<Descriptor> nopHolder;
   loadDescriptor(nopHolder, descriptor);
@@ -324,6 +484,14 @@ void ChannelImpl::recvImplFromLoop(
       remoteNicIdx);
   RecvOperation& op = recvOps_.back();
   op.event.record(op.buffer.stream);
+  // The data is written by the NIC, hence only the wait on the stream is
+  // timed, except for the eager operations, which time their copy instead.
+  if (!op.eager) {
+    CudaCopyTimer& copyTimer = context_->getCopyTimer();
+    const size_t sampleIdx = copyTimer.begin(localGpuIdx);
+    copyTimer.markReady(sampleIdx, op.buffer.stream);
+    copyTimer.end(sampleIdx);
+  }
   if (state_ == ESTABLISHED) {
     processRecvOperationFromLoop(op);
   }
@@ -334,6 +502,14 @@ void ChannelImpl::processRecvOperationFromLoop(RecvOperation& op) {
   TP_DCHECK_EQ(state_, ESTABLISHED);
   TP_DCHECK(!error_);
 
+  if (op.eager) {
+    // The copy out of the bounce buffer is issued on the stream of the buffer,
+    // hence it is already ordered after the work that was enqueued on it.
+    op.doneWaitingForCudaEvent = true;
+    grantCredit();
+    return;
+  }
+
   TP_VLOG(6) << "Channel " << id_ << " is waiting for CUDA event to recv (#"
              << op.sequenceNumber << ")";
   // FIXME There is no guarantee that two CUDA events will complete in the order
@@ -354,12 +530,48 @@ void ChannelImpl::onRecvEventReady(RecvOperation& op) {
   TP_DCHECK(context_->inLoop());
   TP_DCHECK_EQ(state_, ESTABLISHED);
 
+  op.doneWaitingForCudaEvent = true;
+
   if (error_) {
-    op.callback(error_);
-    eraseOp(op);
+    maybeCompleteOp(op);
     return;
   }
 
+  grantCredit();
+}
+
+void ChannelImpl::grantCredit() {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(!error_);
+
+  // Chunks are matched to recvs in the order in which they're posted, and the
+  // sender attributes the credit to its operations in order too. Thus we must
+  // grant it strictly in order, and stop at the first operation that isn't
+  // ready for it yet.
+  for (RecvOperation& op : recvOps_) {
+    if (!op.doneWaitingForCudaEvent) {
+      return;
+    }
+    if (op.eager) {
+      if (op.numChunksGranted == 0) {
+        if (arrivedEagerBuffers_.empty() || freeEagerBuffers_.empty()) {
+          return;
+        }
+        claimEagerBuffer(op);
+      }
+      continue;
+    }
+    while (op.numChunksGranted < op.numChunks) {
+      if (numRecvsInFlight_ >=
+          context_->getIbvNic(op.localNicIdx).getNumRecvs()) {
+        return;
+      }
+      postChunk(op);
+    }
+  }
+}
+
+void ChannelImpl::postChunk(RecvOperation& op) {
   IbvNic& localNic = context_->getIbvNic(op.localNicIdx);
   IbvQueuePair& qp = queuePairs_[op.localNicIdx][op.remoteNicIdx];
 
@@ -367,39 +579,46 @@ void ChannelImpl::onRecvEventReady(RecvOperation& op) {
   // result will be cached and subsequent calls will be much faster.
   IbvMemoryRegion& mr = localNic.registerMemory(op.buffer);
 
-  IbvLib::sge list;
-  list.addr = reinterpret_cast<uint64_t>(op.buffer.ptr);
-  list.length = op.buffer.length;
+  size_t chunkIdx = op.numChunksGranted;
+  size_t offset = chunkIdx * kChunkSize;
+  size_t length = std::min(kChunkSize, op.buffer.length - offset);
+
+  IbvLib::sge& list = op.sges[chunkIdx];
+  list.addr = reinterpret_cast<uint64_t>(op.buffer.ptr) + offset;
+  list.length = length;
   list.lkey = mr->lkey;
 
-  IbvLib::recv_wr wr;
+  IbvLib::recv_wr& wr = op.wrs[chunkIdx];
   std::memset(&wr, 0, sizeof(wr));
   wr.sg_list = &list;
   wr.num_sge = 1;
 
   TP_VLOG(6) << "Channel " << id_ << " is receiving tensor (#"
-             << op.sequenceNumber << ") on QP " << qp->qp_num;
-  localNic.postRecv(qp, wr, eagerCallbackWrapper_([&op](ChannelImpl& impl) {
-                      TP_VLOG(6) << "Channel " << impl.id_
-                                 << " done receiving tensor (# "
-                                 << op.sequenceNumber << ")";
-                      impl.onIbvRecvDone(op);
-                    }));
+             << op.sequenceNumber << ", chunk #" << chunkIdx << ") on QP "
+             << qp->qp_num;
+  localNic.postRecv(
+      qp, wr, eagerCallbackWrapper_([&op, chunkIdx](ChannelImpl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_ << " done receiving tensor (# "
+                   << op.sequenceNumber << ", chunk #" << chunkIdx << ")";
+        impl.onIbvRecvDone(op);
+      }));
+  op.numChunksGranted++;
   numRecvsInFlight_++;
 
   auto nopHolderOut = std::make_shared<NopHolder<ReadyToReceive>>();
   ReadyToReceive& nopReadyToReceive = nopHolderOut->getObject();
   nopReadyToReceive.destinationNicIdx = op.localNicIdx;
   TP_VLOG(6) << "Channel " << id_ << " is writing ready-to-receive (#"
-             << op.sequenceNumber << ")";
+             << op.sequenceNumber << ", chunk #" << chunkIdx << ")";
   connection_->write(
       *nopHolderOut,
-      lazyCallbackWrapper_(
-          [sequenceNumber{op.sequenceNumber}, nopHolderOut](ChannelImpl& impl) {
-            TP_VLOG(6) << "Channel " << impl.id_
-                       << " done writing ready-to-receive (#" << sequenceNumber
-                       << ")";
-          }));
+      lazyCallbackWrapper_([sequenceNumber{op.sequenceNumber},
+                            chunkIdx,
+                            nopHolderOut](ChannelImpl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_
+                   << " done writing ready-to-receive (#" << sequenceNumber
+                   << ", chunk #" << chunkIdx << ")";
+      }));
 }
 
 void ChannelImpl::onIbvRecvDone(RecvOperation& op) {
@@ -407,13 +626,139 @@ void ChannelImpl::onIbvRecvDone(RecvOperation& op) {
   TP_DCHECK_EQ(state_, ESTABLISHED);
 
   numRecvsInFlight_--;
+  op.numChunksDone++;
 
-  op.callback(error_);
-  eraseOp(op);
+  maybeCompleteOp(op);
+
+  if (!error_) {
+    grantCredit();
+  }
+
+  tryCleanup();
+}
+
+void ChannelImpl::postEagerRecv(size_t bufferIdx) {
+  IbvNic& localNic = context_->getIbvNic(0);
+
+  IbvLib::sge& list = eagerSges_[bufferIdx];
+  list.addr = reinterpret_cast<uint64_t>(
+      eagerBuffers_.get() + bufferIdx * kEagerThreshold);
+  list.length = kEagerThreshold;
+  list.lkey = eagerBuffersMr_->lkey;
+
+  IbvLib::recv_wr& wr = eagerWrs_[bufferIdx];
+  std::memset(&wr, 0, sizeof(wr));
+  wr.sg_list = &list;
+  wr.num_sge = 1;
+
+  TP_VLOG(6) << "Channel " << id_ << " is receiving into bounce buffer #"
+             << bufferIdx << " on QP " << eagerQueuePair_->qp_num;
+  localNic.postRecv(
+      eagerQueuePair_,
+      wr,
+      eagerCallbackWrapper_([bufferIdx](ChannelImpl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_
+                   << " done receiving into bounce buffer #" << bufferIdx;
+        impl.onIbvEagerRecvDone(bufferIdx);
+      }));
+  numRecvsInFlight_++;
+}
+
+void ChannelImpl::onIbvEagerRecvDone(size_t bufferIdx) {
+  TP_DCHECK(context_->inLoop());
+
+  numRecvsInFlight_--;
+
+  if (!error_) {
+    arrivedEagerBuffers_.push_back(bufferIdx);
+    grantCredit();
+  }
 
   tryCleanup();
 }
 
+void ChannelImpl::claimEagerBuffer(RecvOperation& op) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(!error_);
+
+  op.eagerBufferIdx = arrivedEagerBuffers_.front();
+  arrivedEagerBuffers_.pop_front();
+  op.numChunksGranted = 1;
+
+  // Take the place of the bounce buffer right away and give its credit back,
+  // rather than once its data has been copied out.
+  postEagerRecv(freeEagerBuffers_.front());
+  freeEagerBuffers_.pop_front();
+
+  auto nopHolderOut = std::make_shared<NopHolder<ReadyToReceive>>();
+  ReadyToReceive& nopReadyToReceive = nopHolderOut->getObject();
+  nopReadyToReceive.destinationNicIdx = 0;
+  TP_VLOG(6) << "Channel " << id_ << " is writing eager credit (#"
+             << op.sequenceNumber << ")";
+  connection_->write(
+      *nopHolderOut,
+      lazyCallbackWrapper_([sequenceNumber{op.sequenceNumber},
+                            nopHolderOut](ChannelImpl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_ << " done writing eager credit (#"
+                   << sequenceNumber << ")";
+      }));
+
+  CudaCopyTimer& copyTimer = context_->getCopyTimer();
+  const size_t sampleIdx = copyTimer.begin(op.deviceIdx);
+  copyTimer.markReady(sampleIdx, op.buffer.stream);
+  {
+    CudaDeviceGuard guard(op.deviceIdx);
+    TP_CUDA_CHECK(cudaMemcpyAsync(
+        op.buffer.ptr,
+        eagerBuffers_.get() + op.eagerBufferIdx * kEagerThreshold,
+        op.buffer.length,
+        cudaMemcpyHostToDevice,
+        op.buffer.stream));
+  }
+  copyTimer.markCopied(sampleIdx, op.buffer.stream);
+  copyTimer.end(sampleIdx);
+  op.event.record(op.buffer.stream);
+
+  TP_VLOG(6) << "Channel " << id_
+             << " is waiting for CUDA event to copy out of bounce buffer (#"
+             << op.sequenceNumber << ")";
+  context_->waitForCudaEvent(
+      op.event, eagerCallbackWrapper_([&op](ChannelImpl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_
+                   << " done waiting for CUDA event to copy out of bounce "
+                   << "buffer (#" << op.sequenceNumber << ")";
+        impl.onEagerCopyDone(op);
+      }));
+}
+
+void ChannelImpl::onEagerCopyDone(RecvOperation& op) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK_EQ(state_, ESTABLISHED);
+
+  freeEagerBuffers_.push_back(op.eagerBufferIdx);
+  op.numChunksDone = 1;
+
+  maybeCompleteOp(op);
+
+  if (!error_) {
+    grantCredit();
+  }
+}
+
+void ChannelImpl::maybeCompleteOp(RecvOperation& op) {
+  // Upon error, the operation is done once the chunks that were already posted
+  // have been flushed, as no more will be.
+  if (!op.doneWaitingForCudaEvent || op.numChunksDone < op.numChunksGranted) {
+    return;
+  }
+  if (!error_ && op.numChunksDone < op.numChunks) {
+    return;
+  }
+
+  op.callback(error_);
+  eraseOp(op);
+}
+
 void ChannelImpl::eraseOp(const RecvOperation& op) {
   auto iter = std::find_if(
       recvOps_.begin(), recvOps_.end(), [&](const RecvOperation& otherOp) {
@@ -436,9 +781,21 @@ void ChannelImpl::handleErrorImpl() {
     }
     recvOps_.clear();
   } else {
-    // All operations are currently waiting for some lower-level operation to
+    // Most operations are currently waiting for some lower-level operation to
     // return. We will take care of calling the callback and easing each of them
-    // once their current operation terminates.
+    // once their current operation terminates. The only exceptions are the recv
+    // operations that were waiting for their turn to be granted credit, and the
+    // eager send operations that were waiting for credit.
+    while (!sendOpsWaitingForEagerCredit_.empty()) {
+      SendOperation& sendOp = *sendOpsWaitingForEagerCredit_.front();
+      sendOpsWaitingForEagerCredit_.pop_front();
+      maybeCompleteOp(sendOp);
+    }
+    for (auto iter = recvOps_.begin(); iter != recvOps_.end();) {
+      RecvOperation& recvOp = *iter;
+      ++iter;
+      maybeCompleteOp(recvOp);
+    }
   }
 
   for (size_t localNicIdx = 0; localNicIdx < numLocalNics_; localNicIdx++) {
@@ -448,6 +805,9 @@ void ChannelImpl::handleErrorImpl() {
           context_->getIbvLib(), queuePairs_[localNicIdx][remoteNicIdx]);
     }
   }
+  if (eagerQueuePair_ != nullptr) {
+    transitionIbvQueuePairToError(context_->getIbvLib(), eagerQueuePair_);
+  }
 
   tryCleanup();
 
@@ -474,6 +834,10 @@ void ChannelImpl::cleanup() {
   TP_VLOG(8) << "Connection " << id_ << " is cleaning up";
 
   queuePairs_.clear();
+  eagerQueuePair_.reset();
+  // The bounce buffers themselves are kept until the channel is destroyed, as
+  // copies out of them may still be running on the streams of the users.
+  eagerBuffersMr_.reset();
 
   context_->unenroll(*this);
 }
@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <deque>
 #include <list>
 #include <memory>
 #include <string>
@@ -18,9 +20,11 @@
 #include <nop/structure.h>
 
 #include <tensorpipe/channel/channel_impl_boilerplate.h>
+#include <tensorpipe/channel/cuda_gdr/constants.h>
 #include <tensorpipe/common/cuda.h>
 #include <tensorpipe/common/cuda_buffer.h>
 #include <tensorpipe/common/ibv.h>
+#include <tensorpipe/common/memory_footprint.h>
 #include <tensorpipe/transport/context.h>
 
 namespace tensorpipe {
@@ -83,6 +87,13 @@ struct NopIbvSetupInformation {
   }
 };
 
+// Tensors are transferred in chunks of (at most) this size, each one being a
+// separate ibverbs request, so that the first ones can be on the wire while the
+// receiver is still granting credit for the following ones.
+inline size_t numChunksForLength(size_t length) {
+  return std::max<size_t>((length + kChunkSize - 1) / kChunkSize, 1);
+}
+
 struct SendOperation {
   // Provide a constructor so we can create the CudaEvent in-place.
   SendOperation(
@@ -95,7 +106,11 @@ struct SendOperation {
         buffer(buffer),
         callback(std::move(callback)),
         event(localGpuIdx),
-        localNicIdx(localNicIdx) {}
+        localNicIdx(localNicIdx),
+        numChunks(numChunksForLength(buffer.length)),
+        eager(buffer.length <= kEagerThreshold),
+        sges(numChunks),
+        wrs(numChunks) {}
 
   size_t sequenceNumber;
   CudaBuffer buffer;
@@ -103,6 +118,22 @@ struct SendOperation {
   CudaEvent event;
   size_t localNicIdx;
   size_t remoteNicIdx;
+
+  size_t numChunks;
+  // Whether the tensor, of a single chunk, is sent without a grant.
+  bool eager;
+  // The requests must outlive the call to postSend, as the NIC may queue them
+  // up if it has no free slots.
+  std::vector<IbvLib::sge> sges;
+  std::vector<IbvLib::send_wr> wrs;
+
+  bool doneWaitingForCudaEvent{false};
+  // How many ready-to-receive messages (one per chunk) have been read, i.e.,
+  // for how many chunks the receiver has granted us credit. For eager ones,
+  // whether a bounce buffer of the receiver was taken for it.
+  size_t numChunksGranted{0};
+  size_t numChunksPosted{0};
+  size_t numChunksDone{0};
 };
 
 struct RecvOperation {
@@ -118,15 +149,37 @@ struct RecvOperation {
         buffer(buffer),
         callback(std::move(callback)),
         event(deviceIdx),
+        deviceIdx(deviceIdx),
         localNicIdx(localNicIdx),
-        remoteNicIdx(remoteNicIdx) {}
+        remoteNicIdx(remoteNicIdx),
+        numChunks(numChunksForLength(buffer.length)),
+        eager(buffer.length <= kEagerThreshold),
+        sges(numChunks),
+        wrs(numChunks) {}
 
   size_t sequenceNumber;
   CudaBuffer buffer;
   TSendCallback callback;
   CudaEvent event;
+  size_t deviceIdx;
   size_t localNicIdx;
   size_t remoteNicIdx;
+
+  size_t numChunks;
+  // Whether the tensor, of a single chunk, arrives in a bounce buffer.
+  bool eager;
+  // The requests must outlive the call to postRecv, as the NIC may queue them
+  // up if it has no free slots.
+  std::vector<IbvLib::sge> sges;
+  std::vector<IbvLib::recv_wr> wrs;
+
+  bool doneWaitingForCudaEvent{false};
+  // How many chunks we have posted a recv for, and thus granted credit for.
+  // For eager ones, whether the data was claimed from its bounce buffer, whose
+  // copy to the destination is then done once numChunksDone is set.
+  size_t numChunksGranted{0};
+  size_t numChunksDone{0};
+  size_t eagerBufferIdx{0};
 };
 
 // First "round" of handshake.
@@ -138,7 +191,9 @@ struct HandshakeNumNics {
 // Second "round" of handshake.
 struct HandshakeSetupInfo {
   std::vector<std::vector<NopIbvSetupInformation>> setupInfo;
-  NOP_STRUCTURE(HandshakeSetupInfo, setupInfo);
+  // For the queue pair of the eager transfers, between the first NICs.
+  NopIbvSetupInformation eagerSetupInfo;
+  NOP_STRUCTURE(HandshakeSetupInfo, setupInfo, eagerSetupInfo);
 };
 
 // From sender to receiver (through pipe).
@@ -147,7 +202,9 @@ struct Descriptor {
   NOP_STRUCTURE(Descriptor, originNicIdx);
 };
 
-// From receiver to sender (through channel's connection).
+// From receiver to sender (through channel's connection), once per chunk. For
+// eager tensors, it's sent once a bounce buffer has been posted in place of the
+// one they were received in, to give that credit back.
 struct ReadyToReceive {
   size_t destinationNicIdx;
   NOP_STRUCTURE(ReadyToReceive, destinationNicIdx);
@@ -192,12 +249,29 @@ class ChannelImpl final
   void onReadHandshakeSetupInfo(
       const HandshakeSetupInfo& nopHandshakeSetupInfo);
 
-  std::vector<size_t> localGpuToNic_;
   size_t numLocalNics_{0};
   size_t numRemoteNics_{0};
 
   std::vector<std::vector<IbvQueuePair>> queuePairs_;
 
+  // The eager transfers all go through a queue pair between the first NIC of
+  // each side, into bounce buffers of pinned host memory, which is as close to
+  // any of the NICs and any of the GPUs as it gets.
+  IbvQueuePair eagerQueuePair_;
+  CudaPinnedBuffer eagerBuffers_;
+  IbvMemoryRegion eagerBuffersMr_;
+  MemoryCharge eagerBuffersCharge_;
+  std::vector<IbvLib::sge> eagerSges_;
+  std::vector<IbvLib::recv_wr> eagerWrs_;
+  // The bounce buffers that are neither posted nor holding data, and the ones
+  // that received data which no recv operation has claimed yet, in order.
+  std::deque<size_t> freeEagerBuffers_;
+  std::deque<size_t> arrivedEagerBuffers_;
+  // How many bounce buffers of the peer are posted and not taken yet, and the
+  // send operations that are waiting for one.
+  size_t numEagerCredits_{kNumEagerBuffers};
+  std::deque<SendOperation*> sendOpsWaitingForEagerCredit_;
+
   std::list<SendOperation> sendOps_;
   std::list<RecvOperation> recvOps_;
 
@@ -209,12 +283,23 @@ class ChannelImpl final
       SendOperation& op,
       const ReadyToReceive& readyToReceive);
   void onSendEventReady(SendOperation& op);
+  void postGrantedChunks(SendOperation& op);
+  void onReadEagerCredit();
+  void postEagerSends();
   void onIbvSendDone(SendOperation& op);
+  void maybeCompleteOp(SendOperation& op);
   void eraseOp(const SendOperation& op);
 
   void processRecvOperationFromLoop(RecvOperation& op);
   void onRecvEventReady(RecvOperation& op);
+  void grantCredit();
+  void postChunk(RecvOperation& op);
   void onIbvRecvDone(RecvOperation& op);
+  void postEagerRecv(size_t bufferIdx);
+  void onIbvEagerRecvDone(size_t bufferIdx);
+  void claimEagerBuffer(RecvOperation& op);
+  void onEagerCopyDone(RecvOperation& op);
+  void maybeCompleteOp(RecvOperation& op);
   void eraseOp(const RecvOperation& op);
 
   void tryCleanup();
@@ -8,7 +8,7 @@
 
 #pragma once
 
-#include <cstdint>
+#include <cstddef>
 
 namespace tensorpipe {
 namespace channel {
@@ -16,28 +16,20 @@ namespace cuda_gdr {
 
 namespace {
 
-// We should probably allow these to be user-configured. But, for now, we'll set
-// them to the lowest value they can have, the rationale being that this way
-// they will always be valid.
-constexpr uint8_t kPortNum = 1;
-constexpr uint8_t kGlobalIdentifierIndex = 0;
+// The size of the slices in which tensors are split, each of which is sent as
+// its own request as soon as the receiver has granted credit for it.
+constexpr size_t kChunkSize = 1024 * 1024;
 
-// FIXME Instead of hardcoding the next three values, we could use
-// ibv_query_device to obtain max_cqe, max_qp_wr and max_srq_wr and deduce from
-// them the maximum allowed values for these parameters.
+// Tensors up to this size are sent eagerly, i.e., without waiting for the
+// receiver to grant credit for them, into bounce buffers that the receiver has
+// posted recvs for up front (on a queue pair of their own), out of which it
+// then copies them to their destination on its stream.
+constexpr size_t kEagerThreshold = 16 * 1024;
 
-constexpr uint32_t kNumRecvs = 1024;
-constexpr uint32_t kNumSends = 1024;
-
-// How many elements the completion queue should be able to hold. These elements
-// will be either the completed receive requests of the SRQ, or the completed
-// send requests from a connection's queue pair. We can bound the former value
-// but not the latter, so we try to add some margin.
-constexpr int kCompletionQueueSize = kNumRecvs + kNumSends;
-
-// How many work completions to poll from the completion queue at each reactor
-// iteration.
-constexpr int kNumPolledWorkCompletions = 32;
+// How many bounce buffers the receiver keeps posted for eager transfers (and
+// thus how many of those the sender may have in flight). It has as many more
+// to swap in while the data of the others is copied out.
+constexpr size_t kNumEagerBuffers = 16;
 
 } // namespace
 
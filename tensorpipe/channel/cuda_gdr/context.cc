@@ -8,6 +8,7 @@
 
 #include <tensorpipe/channel/cuda_gdr/context.h>
 
+#include <map>
 #include <memory>
 #include <string>
 #include <utility>
@@ -20,8 +21,12 @@ namespace tensorpipe {
 namespace channel {
 namespace cuda_gdr {
 
-Context::Context(optional<std::vector<std::string>> gpuIdxToNicName)
-    : impl_(std::make_shared<ContextImpl>(std::move(gpuIdxToNicName))) {}
+Context::Context(
+    optional<std::vector<std::string>> gpuIdxToNicName,
+    ThreadOptions threadOptions)
+    : impl_(std::make_shared<ContextImpl>(
+          std::move(gpuIdxToNicName),
+          std::move(threadOptions))) {}
 
 // Explicitly define all methods of the context, which just forward to the impl.
 // We cannot use an intermediate ContextBoilerplate class without forcing a
@@ -45,6 +50,38 @@ void Context::setId(std::string id) {
   impl_->setId(std::move(id));
 }
 
+void Context::registerArena(void* ptr, size_t length) {
+  impl_->registerArena(ptr, length);
+}
+
+void Context::unregisterArena(void* ptr) {
+  impl_->unregisterArena(ptr);
+}
+
+void Context::enableLoopStats() {
+  impl_->enableStats();
+}
+
+std::map<std::string, LoopStats> Context::getLoopStats() {
+  return {{"reactor", impl_->getStats()}};
+}
+
+MemoryFootprint Context::getMemoryFootprint() {
+  return impl_->getMemoryFootprint();
+}
+
+void Context::reclaimMemory() {
+  impl_->reclaimMemory();
+}
+
+void Context::enableChannelStats() {
+  impl_->enableChannelStats();
+}
+
+ChannelStats Context::getChannelStats() {
+  return impl_->getChannelStats();
+}
+
 void Context::close() {
   impl_->close();
 }
@@ -8,12 +8,14 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include <tensorpipe/channel/cuda_context.h>
 #include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/thread_options.h>
 #include <tensorpipe/transport/context.h>
 
 namespace tensorpipe {
@@ -24,8 +26,15 @@ class ContextImpl;
 
 class Context : public CudaContext {
  public:
+  // By default each GPU is matched to the InfiniBand NICs that are closest to
+  // it in the PCI topology, and its transfers are spread across them. This can
+  // be overridden by passing, for each GPU, the name of a NIC, or the names of
+  // several NICs separated by commas.
+  //
+  // The thread that polls the NICs is set up according to threadOptions.
   explicit Context(
-      optional<std::vector<std::string>> gpuIdxToNicName = nullopt);
+      optional<std::vector<std::string>> gpuIdxToNicName = nullopt,
+      ThreadOptions threadOptions = ThreadOptions());
 
   Context(const Context&) = delete;
   Context(Context&&) = delete;
@@ -42,6 +51,28 @@ class Context : public CudaContext {
 
   void setId(std::string id) override;
 
+  MemoryFootprint getMemoryFootprint() override;
+
+  void reclaimMemory() override;
+
+  // Register a range of device memory (e.g., a segment of a caching allocator)
+  // with the NICs of its GPU ahead of time, so that the transfers of tensors
+  // inside it never register memory on their critical path. This blocks until
+  // the registration is done. The memory must not be freed before the arena is
+  // unregistered, which can only be done once no transfers of tensors inside
+  // it are in progress.
+  void registerArena(void* ptr, size_t length);
+
+  void unregisterArena(void* ptr);
+
+  void enableLoopStats() override;
+
+  std::map<std::string, LoopStats> getLoopStats() override;
+
+  void enableChannelStats() override;
+
+  ChannelStats getChannelStats() override;
+
   void close() override;
 
   void join() override;
@@ -8,13 +8,15 @@
 
 #include <tensorpipe/channel/cuda_gdr/context_impl.h>
 
+#include <algorithm>
 #include <array>
 #include <climits>
 #include <cstdlib>
+#include <fstream>
 #include <functional>
+#include <iterator>
 #include <string>
 #include <tuple>
-#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -24,7 +26,6 @@
 #include <cuda_runtime.h>
 
 #include <tensorpipe/channel/cuda_gdr/channel_impl.h>
-#include <tensorpipe/channel/cuda_gdr/error.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error_macros.h>
 
@@ -34,27 +35,6 @@ namespace cuda_gdr {
 
 namespace {
 
-// NOTE: This is an incomplete implementation of C++17's `std::apply`.
-// It's intended to only work for methods of IbvNic.
-template <class TMethod, class TArgsTuple, std::size_t... I>
-auto applyFuncImpl(
-    IbvNic& subject,
-    TMethod&& method,
-    TArgsTuple&& args,
-    std::index_sequence<I...> /* unused */) {
-  return ((subject).*(method))(std::get<I>(std::forward<TArgsTuple>(args))...);
-}
-
-template <class TMethod, class TArgsTuple>
-auto applyFunc(IbvNic& subject, TMethod&& method, TArgsTuple&& args) {
-  return applyFuncImpl(
-      subject,
-      std::forward<TMethod>(method),
-      std::forward<TArgsTuple>(args),
-      std::make_index_sequence<
-          std::tuple_size<std::remove_reference_t<TArgsTuple>>::value>{});
-}
-
 // The PCI topology is a tree, with the root being the host bridge, the leaves
 // being the devices, and the other nodes being switches. We want to match each
 // GPU to the InfiniBand NIC with which it shares the longest "prefix" in this
@@ -113,57 +93,123 @@ std::string getPciPathForGpu(int gpuIdx) {
   return res;
 }
 
-size_t commonPrefixLength(const std::string& a, const std::string& b) {
-  // The length of the longest common prefix is the index of the first char on
-  // which the two strings differ.
-  size_t maxLength = std::min(a.size(), b.size());
-  for (size_t idx = 0; idx < maxLength; idx++) {
+std::vector<std::string> splitPciPath(const std::string& pciPath) {
+  std::vector<std::string> components;
+  size_t begin = 0;
+  while (begin < pciPath.size()) {
+    size_t end = pciPath.find('/', begin);
+    if (end == std::string::npos) {
+      end = pciPath.size();
+    }
+    if (end > begin) {
+      components.push_back(pciPath.substr(begin, end - begin));
+    }
+    begin = end + 1;
+  }
+  return components;
+}
+
+// The number of leading components that the two paths have in common, i.e.,
+// how deep in the PCI tree the two devices have their lowest common ancestor.
+// This is done on whole components, as "0000:3a" and "0000:3b" are unrelated.
+size_t commonPciPathDepth(
+    const std::vector<std::string>& a,
+    const std::vector<std::string>& b) {
+  size_t maxDepth = std::min(a.size(), b.size());
+  for (size_t idx = 0; idx < maxDepth; idx++) {
     if (a[idx] != b[idx]) {
       return idx;
     }
   }
-  return maxLength;
+  return maxDepth;
 }
 
-std::vector<std::string> matchGpusToIbvNics(
+// Return the NUMA node to which the device is attached, or -1 if unknown (which
+// is also what the kernel reports on machines with a single node).
+int getNumaNodeForPciPath(const std::string& pciPath) {
+  std::ifstream f(pciPath + "/numa_node");
+  int numaNode = -1;
+  if (!(f >> numaNode)) {
+    return -1;
+  }
+  return numaNode;
+}
+
+// Each GPU is matched to the NICs with which it shares the deepest ancestor in
+// the PCI tree. When that is just the root (i.e., they're behind different host
+// bridges), the NICs on the same NUMA node as the GPU are preferred, as the
+// others can only be reached through the inter-socket link. If several NICs
+// are equally close to a GPU (e.g., they share its PCI switch), the GPU is
+// matched to all of them, and its transfers will be spread across them.
+std::vector<std::vector<std::string>> matchGpusToIbvNics(
     IbvLib& ibvLib,
     IbvDeviceList& deviceList) {
   struct NicInfo {
     std::string name;
-    std::string pciPath;
+    std::vector<std::string> pciPath;
+    int numaNode;
   };
   std::vector<NicInfo> nicInfos;
   for (size_t deviceIdx = 0; deviceIdx < deviceList.size(); deviceIdx++) {
     IbvLib::device& device = deviceList[deviceIdx];
     std::string deviceName(TP_CHECK_IBV_PTR(ibvLib.get_device_name(&device)));
     std::string pciPath = getPciPathForIbvNic(deviceName);
+    int numaNode = getNumaNodeForPciPath(pciPath);
     TP_VLOG(5) << "Resolved InfiniBand NIC " << deviceName << " to PCI path "
-               << pciPath;
-    nicInfos.push_back(NicInfo{std::move(deviceName), std::move(pciPath)});
+               << pciPath << " on NUMA node " << numaNode;
+    nicInfos.push_back(
+        NicInfo{std::move(deviceName), splitPciPath(pciPath), numaNode});
   }
 
   int numGpus;
   TP_CUDA_CHECK(cudaGetDeviceCount(&numGpus));
 
-  std::vector<std::string> gpuIdxToIbvNicName;
+  std::vector<std::vector<std::string>> gpuIdxToIbvNicNames;
   for (int gpuIdx = 0; gpuIdx < numGpus; gpuIdx++) {
     std::string gpuPciPath = getPciPathForGpu(gpuIdx);
-    TP_VLOG(5) << "Resolved GPU #" << gpuIdx << " to PCI path " << gpuPciPath;
-    ssize_t bestMatchLength = -1;
-    const std::string* bestMatchName = nullptr;
+    int gpuNumaNode = getNumaNodeForPciPath(gpuPciPath);
+    TP_VLOG(5) << "Resolved GPU #" << gpuIdx << " to PCI path " << gpuPciPath
+               << " on NUMA node " << gpuNumaNode;
+    std::vector<std::string> gpuPciPathComponents = splitPciPath(gpuPciPath);
+
+    // Scores are compared lexicographically: depth first, then NUMA affinity.
+    using TScore = std::tuple<size_t, bool>;
+    optional<TScore> bestScore;
+    std::vector<std::string> bestMatchNames;
     for (const auto& nicInfo : nicInfos) {
-      ssize_t matchLength = commonPrefixLength(gpuPciPath, nicInfo.pciPath);
-      if (matchLength > bestMatchLength) {
-        bestMatchLength = matchLength;
-        bestMatchName = &nicInfo.name;
+      TScore score(
+          commonPciPathDepth(gpuPciPathComponents, nicInfo.pciPath),
+          gpuNumaNode >= 0 && gpuNumaNode == nicInfo.numaNode);
+      if (!bestScore.has_value() || score > bestScore.value()) {
+        bestScore = score;
+        bestMatchNames.clear();
+      }
+      if (score == bestScore.value()) {
+        bestMatchNames.push_back(nicInfo.name);
       }
     }
-    TP_DCHECK_GE(bestMatchLength, 0);
-    TP_DCHECK(bestMatchName != nullptr);
-    gpuIdxToIbvNicName.push_back(*bestMatchName);
+    TP_DCHECK(!bestMatchNames.empty());
+    gpuIdxToIbvNicNames.push_back(std::move(bestMatchNames));
   }
 
-  return gpuIdxToIbvNicName;
+  return gpuIdxToIbvNicNames;
+}
+
+// Each item of the user-provided mapping is the name of a NIC, or the names of
+// several NICs separated by commas.
+std::vector<std::string> splitNicNames(const std::string& nicNames) {
+  std::vector<std::string> res;
+  size_t begin = 0;
+  while (true) {
+    size_t end = nicNames.find(',', begin);
+    res.push_back(nicNames.substr(
+        begin, end == std::string::npos ? std::string::npos : end - begin));
+    if (end == std::string::npos) {
+      break;
+    }
+    begin = end + 1;
+  }
+  return res;
 }
 
 } // namespace
@@ -173,129 +219,22 @@ IbvNic::IbvNic(
     std::string name,
     IbvLib::device& device,
     IbvLib& ibvLib,
-    CudaLib& cudaLib)
-    : id_(std::move(id)),
-      name_(std::move(name)),
+    CudaLib& cudaLib,
+    MemoryFootprintCounters& memoryFootprintCounters)
+    : IbvNicBase(std::move(id), std::move(name), device, ibvLib),
       cudaLib_(cudaLib),
-      ibvLib_(ibvLib) {
-  ctx_ = createIbvContext(ibvLib_, device);
-  pd_ = createIbvProtectionDomain(ibvLib_, ctx_);
-  cq_ = createIbvCompletionQueue(
-      ibvLib_,
-      ctx_,
-      kCompletionQueueSize,
-      /*cq_context=*/nullptr,
-      /*channel=*/nullptr,
-      /*comp_vector=*/0);
-  addr_ = makeIbvAddress(ibvLib_, ctx_, kPortNum, kGlobalIdentifierIndex);
-}
-
-bool IbvNic::pollOnce() {
-  std::array<IbvLib::wc, kNumPolledWorkCompletions> wcs;
-  auto rv = ibvLib_.poll_cq(cq_.get(), wcs.size(), wcs.data());
+      memoryFootprintCounters_(memoryFootprintCounters) {}
 
-  if (rv == 0) {
-    return false;
-  }
-  TP_THROW_SYSTEM_IF(rv < 0, errno);
-
-  int numSends = 0;
-  int numRecvs = 0;
-  for (int wcIdx = 0; wcIdx < rv; wcIdx++) {
-    IbvLib::wc& wc = wcs[wcIdx];
-
-    TP_VLOG(6) << "Channel context " << id_ << " got work completion on device "
-               << name_ << " for request " << wc.wr_id << " for QP "
-               << wc.qp_num << " with status "
-               << ibvLib_.wc_status_str(wc.status) << " and opcode "
-               << ibvWorkCompletionOpcodeToStr(wc.opcode)
-               << " (byte length: " << wc.byte_len << ")";
-
-    auto iter = requestsInFlight_.find(wc.wr_id);
-    TP_THROW_ASSERT_IF(iter == requestsInFlight_.end())
-        << "Got work completion with unknown ID " << wc.wr_id;
-
-    std::function<void(const Error&)> cb = std::move(iter->second);
-    requestsInFlight_.erase(iter);
-
-    if (wc.status != IbvLib::WC_SUCCESS) {
-      cb(TP_CREATE_ERROR(IbvError, ibvLib_.wc_status_str(wc.status)));
-    } else {
-      cb(Error::kSuccess);
-    }
-
-    switch (wc.opcode) {
-      case IbvLib::WC_RECV:
-        numRecvs++;
-        break;
-      case IbvLib::WC_SEND:
-        numSends++;
-        break;
-      default:
-        TP_THROW_ASSERT() << "Unknown opcode: " << wc.opcode;
+IbvMemoryRegion& IbvNic::registerMemory(CudaBuffer buffer) {
+  const uintptr_t ptr = reinterpret_cast<uintptr_t>(buffer.ptr);
+  auto arenaIter = arenas_.upper_bound(ptr);
+  if (arenaIter != arenas_.begin()) {
+    --arenaIter;
+    if (ptr + buffer.length <= arenaIter->first + arenaIter->second.length) {
+      return arenaIter->second.mr;
     }
   }
 
-  numAvailableSendSlots_ += numSends;
-  while (!sendsWaitingForSlots_.empty() && numAvailableSendSlots_ > 0) {
-    applyFunc(
-        *this, &IbvNic::postSend, std::move(sendsWaitingForSlots_.front()));
-    sendsWaitingForSlots_.pop_front();
-  }
-
-  numAvailableRecvSlots_ += numRecvs;
-  while (!recvsWaitingForSlots_.empty() && numAvailableRecvSlots_ > 0) {
-    applyFunc(
-        *this, &IbvNic::postRecv, std::move(recvsWaitingForSlots_.front()));
-    recvsWaitingForSlots_.pop_front();
-  }
-
-  return true;
-}
-
-void IbvNic::postSend(
-    IbvQueuePair& qp,
-    IbvLib::send_wr& wr,
-    std::function<void(const Error&)> cb) {
-  TP_DCHECK_EQ(wr.wr_id, 0);
-  if (numAvailableSendSlots_ > 0) {
-    wr.wr_id = nextRequestId_++;
-    IbvLib::send_wr* badWr = nullptr;
-    TP_VLOG(6) << "Channel context " << id_ << " posting send on device "
-               << name_ << " for QP " << qp->qp_num;
-    TP_CHECK_IBV_INT(ibvLib_.post_send(qp.get(), &wr, &badWr));
-    TP_THROW_ASSERT_IF(badWr != nullptr);
-    numAvailableSendSlots_--;
-    requestsInFlight_.emplace(wr.wr_id, std::move(cb));
-  } else {
-    TP_VLOG(6) << "Channel context " << id_ << " queueing up send on device "
-               << name_ << " for QP " << qp->qp_num;
-    sendsWaitingForSlots_.emplace_back(qp, wr, std::move(cb));
-  }
-}
-
-void IbvNic::postRecv(
-    IbvQueuePair& qp,
-    IbvLib::recv_wr& wr,
-    std::function<void(const Error&)> cb) {
-  TP_DCHECK_EQ(wr.wr_id, 0);
-  if (numAvailableRecvSlots_ > 0) {
-    wr.wr_id = nextRequestId_++;
-    IbvLib::recv_wr* badWr = nullptr;
-    TP_VLOG(6) << "Channel context " << id_ << " posting recv on device "
-               << name_ << " for QP " << qp->qp_num;
-    TP_CHECK_IBV_INT(ibvLib_.post_recv(qp.get(), &wr, &badWr));
-    TP_THROW_ASSERT_IF(badWr != nullptr);
-    numAvailableRecvSlots_--;
-    requestsInFlight_.emplace(wr.wr_id, std::move(cb));
-  } else {
-    TP_VLOG(6) << "Channel context " << id_ << " queueing up recv on device "
-               << name_ << " for QP " << qp->qp_num;
-    recvsWaitingForSlots_.emplace_back(qp, wr, std::move(cb));
-  }
-}
-
-IbvMemoryRegion& IbvNic::registerMemory(CudaBuffer buffer) {
   // FIXME Instead of re-querying the device, have the caller provide it.
   CudaDeviceGuard guard(cudaDeviceForPointer(cudaLib_, buffer.ptr));
 
@@ -314,29 +253,55 @@ IbvMemoryRegion& IbvNic::registerMemory(CudaBuffer buffer) {
 
   auto iter = memoryRegions_.find(bufferId);
   if (iter != memoryRegions_.end()) {
-    return iter->second;
+    return iter->second.mr;
   }
   std::tie(iter, std::ignore) = memoryRegions_.emplace(
       bufferId,
-      createIbvMemoryRegion(
-          ibvLib_,
-          pd_,
-          reinterpret_cast<void*>(basePtr),
-          allocSize,
-          IbvLib::ACCESS_LOCAL_WRITE));
-  return iter->second;
+      MemoryRegion{
+          createIbvMemoryRegion(
+              ibvLib_,
+              pd_,
+              reinterpret_cast<void*>(basePtr),
+              allocSize,
+              IbvLib::ACCESS_LOCAL_WRITE),
+          MemoryCharge(
+              memoryFootprintCounters_, MemoryKind::kRegistered, allocSize)});
+  return iter->second.mr;
 }
 
-bool IbvNic::readyToClose() const {
-  return requestsInFlight_.empty();
+void IbvNic::registerArena(void* ptr, size_t length) {
+  const uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+  auto iter = arenas_.lower_bound(start);
+  TP_THROW_ASSERT_IF(iter != arenas_.end() && iter->first < start + length)
+      << "Arena overlaps with an already registered one";
+  if (iter != arenas_.begin()) {
+    auto prevIter = std::prev(iter);
+    TP_THROW_ASSERT_IF(prevIter->first + prevIter->second.length > start)
+        << "Arena overlaps with an already registered one";
+  }
+
+  TP_VLOG(5) << "Channel context " << id_ << " is registering arena of "
+             << length << " bytes on device " << name_;
+  arenas_.emplace_hint(
+      iter,
+      start,
+      Arena{
+          length,
+          createIbvMemoryRegion(
+              ibvLib_, pd_, ptr, length, IbvLib::ACCESS_LOCAL_WRITE),
+          MemoryCharge(
+              memoryFootprintCounters_, MemoryKind::kRegistered, length)});
 }
 
-void IbvNic::setId(std::string id) {
-  id_ = std::move(id);
+void IbvNic::unregisterArena(void* ptr) {
+  arenas_.erase(reinterpret_cast<uintptr_t>(ptr));
 }
 
-ContextImpl::ContextImpl(optional<std::vector<std::string>> gpuIdxToNicName)
-    : ContextImplBoilerplate<CudaBuffer, ContextImpl, ChannelImpl>("*") {
+ContextImpl::ContextImpl(
+    optional<std::vector<std::string>> gpuIdxToNicName,
+    ThreadOptions threadOptions)
+    : BusyPollingLoop(kBusyPollForever, kBusyPollForever),
+      ContextImplBoilerplate<CudaBuffer, ContextImpl, ChannelImpl>("*") {
   Error error;
 
   std::tie(error, cudaLib_) = CudaLib::create();
@@ -384,7 +349,7 @@ ContextImpl::ContextImpl(optional<std::vector<std::string>> gpuIdxToNicName)
     return;
   }
 
-  std::vector<std::string> actualGpuIdxToNicName;
+  std::vector<std::vector<std::string>> actualGpuIdxToNicNames;
   if (gpuIdxToNicName.has_value()) {
     int numGpus;
     TP_CUDA_CHECK(cudaGetDeviceCount(&numGpus));
@@ -393,19 +358,25 @@ ContextImpl::ContextImpl(optional<std::vector<std::string>> gpuIdxToNicName)
         << "number of items: found " << gpuIdxToNicName->size() << ", expected "
         << numGpus;
 
-    actualGpuIdxToNicName = std::move(gpuIdxToNicName.value());
+    for (const std::string& nicNames : gpuIdxToNicName.value()) {
+      actualGpuIdxToNicNames.push_back(splitNicNames(nicNames));
+    }
   } else {
-    actualGpuIdxToNicName = matchGpusToIbvNics(ibvLib_, deviceList);
-  }
-
-  for (int gpuIdx = 0; gpuIdx < actualGpuIdxToNicName.size(); gpuIdx++) {
-    TP_VLOG(5) << "Channel context " << id_ << " mapped GPU #" << gpuIdx
-               << " to InfiniBand NIC " << actualGpuIdxToNicName[gpuIdx];
+    // The PCI tree doesn't change during the life of the process, whereas it
+    // takes a few lookups in sysfs per NIC and per GPU to resolve, hence
+    // they're only matched once.
+    static const std::vector<std::vector<std::string>> gpuIdxToNicNames =
+        matchGpusToIbvNics(ibvLib_, deviceList);
+    actualGpuIdxToNicNames = gpuIdxToNicNames;
   }
 
   std::unordered_set<std::string> nicNames;
-  for (const auto& nicName : actualGpuIdxToNicName) {
-    nicNames.insert(nicName);
+  for (int gpuIdx = 0; gpuIdx < actualGpuIdxToNicNames.size(); gpuIdx++) {
+    for (const auto& nicName : actualGpuIdxToNicNames[gpuIdx]) {
+      TP_VLOG(5) << "Channel context " << id_ << " mapped GPU #" << gpuIdx
+                 << " to InfiniBand NIC " << nicName;
+      nicNames.insert(nicName);
+    }
   }
 
   std::unordered_map<std::string, size_t> nicNameToNicIdx;
@@ -419,7 +390,13 @@ ContextImpl::ContextImpl(optional<std::vector<std::string>> gpuIdxToNicName)
     if (iter != nicNames.end()) {
       TP_VLOG(5) << "Channel context " << id_ << " is using InfiniBand NIC "
                  << deviceName << " as device #" << nicIdx;
-      ibvNics_.emplace_back(id_, *iter, device, ibvLib_, cudaLib_);
+      ibvNics_.emplace_back(
+          id_,
+          *iter,
+          device,
+          ibvLib_,
+          cudaLib_,
+          getMemoryFootprintCounters());
       nicNameToNicIdx[*iter] = nicIdx;
       nicIdx++;
       nicNames.erase(iter);
@@ -428,25 +405,64 @@ ContextImpl::ContextImpl(optional<std::vector<std::string>> gpuIdxToNicName)
   TP_THROW_ASSERT_IF(!nicNames.empty())
       << "Couldn't find all the devices I was supposed to use";
 
-  for (size_t gpuIdx = 0; gpuIdx < actualGpuIdxToNicName.size(); gpuIdx++) {
-    gpuToNic_.push_back(nicNameToNicIdx[actualGpuIdxToNicName[gpuIdx]]);
+  for (size_t gpuIdx = 0; gpuIdx < actualGpuIdxToNicNames.size(); gpuIdx++) {
+    std::vector<size_t> nicIdxs;
+    for (const auto& nicName : actualGpuIdxToNicNames[gpuIdx]) {
+      nicIdxs.push_back(nicNameToNicIdx[nicName]);
+    }
+    gpuToNics_.push_back(std::move(nicIdxs));
   }
 
-  startThread("TP_CUDA_GDR_loop");
+  startThread("TP_CUDA_GDR_loop", std::move(threadOptions));
 }
 
 const CudaLib& ContextImpl::getCudaLib() {
   return cudaLib_;
 }
 
-const std::vector<size_t>& ContextImpl::getGpuToNicMapping() {
-  return gpuToNic_;
+void ContextImpl::enableChannelStats() {
+  copyTimer_.enable();
+}
+
+ChannelStats ContextImpl::getChannelStats() {
+  return copyTimer_.getStats();
+}
+
+CudaCopyTimer& ContextImpl::getCopyTimer() {
+  return copyTimer_;
+}
+
+const std::vector<std::vector<size_t>>& ContextImpl::getGpuToNicMapping() {
+  return gpuToNics_;
+}
+
+size_t ContextImpl::getNumIbvNics() const {
+  return ibvNics_.size();
 }
 
 IbvLib& ContextImpl::getIbvLib() {
   return ibvLib_;
 }
 
+void ContextImpl::registerArena(void* ptr, size_t length) {
+  TP_THROW_ASSERT_IF(!viable_) << "Cannot register arena on unviable context";
+  runInLoop([&]() {
+    const int deviceIdx = cudaDeviceForPointer(cudaLib_, ptr);
+    CudaDeviceGuard guard(deviceIdx);
+    for (size_t nicIdx : gpuToNics_[deviceIdx]) {
+      ibvNics_[nicIdx].registerArena(ptr, length);
+    }
+  });
+}
+
+void ContextImpl::unregisterArena(void* ptr) {
+  runInLoop([&]() {
+    for (auto& ibvNic : ibvNics_) {
+      ibvNic.unregisterArena(ptr);
+    }
+  });
+}
+
 IbvNic& ContextImpl::getIbvNic(size_t nicIdx) {
   TP_DCHECK_LT(nicIdx, ibvNics_.size());
   return ibvNics_[nicIdx];
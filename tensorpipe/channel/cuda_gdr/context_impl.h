@@ -8,7 +8,6 @@
 
 #pragma once
 
-#include <deque>
 #include <functional>
 #include <list>
 #include <map>
@@ -20,13 +19,16 @@
 
 #include <tensorpipe/channel/context_impl_boilerplate.h>
 #include <tensorpipe/channel/cuda_context.h>
+#include <tensorpipe/channel/cuda_copy_timer.h>
 #include <tensorpipe/channel/cuda_gdr/constants.h>
+#include <tensorpipe/channel/ibv_nic.h>
 #include <tensorpipe/common/busy_polling_loop.h>
 #include <tensorpipe/common/cuda.h>
 #include <tensorpipe/common/cuda_buffer.h>
 #include <tensorpipe/common/cuda_lib.h>
 #include <tensorpipe/common/error.h>
 #include <tensorpipe/common/ibv.h>
+#include <tensorpipe/common/memory_footprint.h>
 #include <tensorpipe/common/optional.h>
 #include <tensorpipe/transport/context.h>
 
@@ -36,88 +38,48 @@ namespace cuda_gdr {
 
 class ChannelImpl;
 
-class IbvNic {
+class IbvNic : public IbvNicBase {
  public:
   IbvNic(
       std::string id,
       std::string name,
       IbvLib::device& device,
       IbvLib& ibvLib,
-      CudaLib& cudaLib);
-
-  IbvProtectionDomain& getIbvPd() {
-    return pd_;
-  }
-
-  IbvCompletionQueue& getIbvCq() {
-    return cq_;
-  }
-
-  const IbvAddress& getIbvAddress() {
-    return addr_;
-  }
-
-  void postSend(
-      IbvQueuePair& qp,
-      IbvLib::send_wr& wr,
-      std::function<void(const Error&)> cb);
-
-  void postRecv(
-      IbvQueuePair& qp,
-      IbvLib::recv_wr& wr,
-      std::function<void(const Error&)> cb);
-
-  bool pollOnce();
+      CudaLib& cudaLib,
+      MemoryFootprintCounters& memoryFootprintCounters);
 
   IbvMemoryRegion& registerMemory(CudaBuffer buffer);
 
-  bool readyToClose() const;
+  void registerArena(void* ptr, size_t length);
 
-  void setId(std::string id);
+  void unregisterArena(void* ptr);
 
  private:
-  // The ID of the context, for use in verbose logging.
-  std::string id_{"N/A"};
-  // The name of the InfiniBand device.
-  std::string name_;
-
   CudaLib& cudaLib_;
 
-  IbvLib& ibvLib_;
-  IbvContext ctx_;
-  IbvProtectionDomain pd_;
-  IbvCompletionQueue cq_;
-  IbvAddress addr_;
-
-  size_t numAvailableRecvSlots_ = kNumRecvs;
-  std::deque<std::tuple<
-      IbvQueuePair&,
-      IbvLib::recv_wr&,
-      std::function<void(const Error&)>>>
-      recvsWaitingForSlots_;
-
-  size_t numAvailableSendSlots_ = kNumSends;
-  std::deque<std::tuple<
-      IbvQueuePair&,
-      IbvLib::send_wr&,
-      std::function<void(const Error&)>>>
-      sendsWaitingForSlots_;
-
-  // We need one common map for both send and recv requests because in principle
-  // we cannot access the opcode of a failed operation, meaning we couldn't
-  // match it to its callback. However, we could group them by QP number or, in
-  // fact, we could have the QP store these requests and we just wake it up when
-  // a completion occurs.
-  std::unordered_map<uint64_t, std::function<void(const Error&)>>
-      requestsInFlight_;
-  uint64_t nextRequestId_ = 0;
+  // Where the memory registered with the NIC is accounted for.
+  MemoryFootprintCounters& memoryFootprintCounters_;
 
   // The ibverbs memory regions are indexed by the CUDA driver's buffer ID for
   // the GPU allocation, which is unique (within the process) and never reused.
   // This will prevent us from re-using the memory region if a buffer gets
   // deallocated and reallocated (although we will not clean up the old memory
   // region until we close the context).
-  std::map<unsigned long long, IbvMemoryRegion> memoryRegions_;
+  struct MemoryRegion {
+    IbvMemoryRegion mr;
+    MemoryCharge charge;
+  };
+  std::map<unsigned long long, MemoryRegion> memoryRegions_;
+
+  // The memory regions of the arenas registered up front, indexed by their
+  // start address so that the one containing a buffer can be found with a
+  // range lookup. Buffers inside them don't end up in the map above.
+  struct Arena {
+    size_t length;
+    IbvMemoryRegion mr;
+    MemoryCharge charge;
+  };
+  std::map<uintptr_t, Arena> arenas_;
 };
 
 class ContextImpl final
@@ -125,7 +87,8 @@ class ContextImpl final
       public ContextImplBoilerplate<CudaBuffer, ContextImpl, ChannelImpl> {
  public:
   explicit ContextImpl(
-      optional<std::vector<std::string>> gpuIdxToNicName = nullopt);
+      optional<std::vector<std::string>> gpuIdxToNicName = nullopt,
+      ThreadOptions threadOptions = ThreadOptions());
 
   std::shared_ptr<CudaChannel> createChannel(
       std::shared_ptr<transport::Connection> connection,
@@ -135,16 +98,29 @@ class ContextImpl final
 
   const CudaLib& getCudaLib();
 
-  const std::vector<size_t>& getGpuToNicMapping();
+  // For each GPU, the NICs that its transfers are spread across.
+  const std::vector<std::vector<size_t>>& getGpuToNicMapping();
+
+  size_t getNumIbvNics() const;
 
   IbvLib& getIbvLib();
 
   IbvNic& getIbvNic(size_t nicIdx);
 
+  void registerArena(void* ptr, size_t length);
+
+  void unregisterArena(void* ptr);
+
   void waitForCudaEvent(
       const CudaEvent& event,
       std::function<void(const Error&)> cb);
 
+  void enableChannelStats();
+
+  ChannelStats getChannelStats();
+
+  CudaCopyTimer& getCopyTimer();
+
  protected:
   // Implement BusyPollingLoop hooks.
   bool pollOnce() override;
@@ -158,10 +134,12 @@ class ContextImpl final
  private:
   bool viable_{true};
   CudaLib cudaLib_;
+
+  CudaCopyTimer copyTimer_;
   IbvLib ibvLib_;
   std::vector<IbvNic> ibvNics_;
 
-  std::vector<size_t> gpuToNic_;
+  std::vector<std::vector<size_t>> gpuToNics_;
 
   std::list<std::tuple<const CudaEvent&, std::function<void(const Error&)>>>
       pendingCudaEvents_;
@@ -8,19 +8,24 @@
 
 #include <tensorpipe/channel/cuda_ipc/channel_impl.h>
 
+#include <cstring>
+#include <iterator>
 #include <memory>
 #include <string>
+#include <tuple>
 #include <utility>
+#include <vector>
 
-#include <cuda.h>
 #include <cuda_runtime.h>
 #include <nop/serializer.h>
 #include <nop/structure.h>
 #include <nop/types/variant.h>
 
+#include <tensorpipe/channel/cuda_copy_timer.h>
 #include <tensorpipe/channel/cuda_ipc/context_impl.h>
 #include <tensorpipe/channel/helpers.h>
 #include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/cuda_copy_streams.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
 #include <tensorpipe/transport/connection.h>
@@ -30,96 +35,289 @@ namespace channel {
 namespace cuda_ipc {
 
 struct Descriptor {
-  std::string handle;
+  // Either the legacy IPC handle, or the exported pointer and its pool.
+  std::string memHandle;
+  std::string ptrExportData;
+  uint64_t poolId;
+  int poolFd;
+  std::string processIdentifier;
+  uint64_t bufferId;
   size_t offset;
+  int startEvDeviceIdx;
+  uint64_t startEvIdx;
+  // Only set the first time the event is used.
   std::string startEvHandle;
-  NOP_STRUCTURE(Descriptor, handle, offset, startEvHandle);
+  NOP_STRUCTURE(
+      Descriptor,
+      memHandle,
+      ptrExportData,
+      poolId,
+      poolFd,
+      processIdentifier,
+      bufferId,
+      offset,
+      startEvDeviceIdx,
+      startEvIdx,
+      startEvHandle);
 };
 
+struct ReplyEntry {
+  // Whether the receiver wants the sender to push the data to it, rather than
+  // having pulled it.
+  bool push;
+  // The end of the copy for a pull, or for a push the point on the receiver's
+  // stream after which its buffer can be written into.
+  int evDeviceIdx;
+  uint64_t evIdx;
+  // Only set the first time the event is used.
+  std::string evHandle;
+  // Only for a push: the receiver's buffer, as in a Descriptor.
+  std::string memHandle;
+  std::string ptrExportData;
+  uint64_t poolId;
+  int poolFd;
+  std::string processIdentifier;
+  uint64_t bufferId;
+  size_t offset;
+  NOP_STRUCTURE(
+      ReplyEntry,
+      push,
+      evDeviceIdx,
+      evIdx,
+      evHandle,
+      memHandle,
+      ptrExportData,
+      poolId,
+      poolFd,
+      processIdentifier,
+      bufferId,
+      offset);
+};
+
+// The replies for consecutive recv operations, in order.
 struct Reply {
+  std::vector<ReplyEntry> entries;
+  NOP_STRUCTURE(Reply, entries);
+};
+
+// The end of the copy of a push.
+struct PushedEntry {
+  int stopEvDeviceIdx;
+  uint64_t stopEvIdx;
+  // Only set the first time the event is used.
   std::string stopEvHandle;
-  NOP_STRUCTURE(Reply, stopEvHandle);
+  NOP_STRUCTURE(PushedEntry, stopEvDeviceIdx, stopEvIdx, stopEvHandle);
 };
 
 struct Ack {
-  NOP_STRUCTURE(Ack);
+  uint64_t numOps;
+  // For those of the operations that were pushed, in order.
+  std::vector<PushedEntry> pushed;
+  NOP_STRUCTURE(Ack, numOps, pushed);
 };
 
-using Packet = nop::Variant<Reply, Ack>;
+// Once the receiver has waited on the stop events of the pushes.
+struct PushAck {
+  uint64_t numOps;
+  NOP_STRUCTURE(PushAck, numOps);
+};
+
+using Packet = nop::Variant<Reply, Ack, PushAck>;
+
+CudaEvent& PeerEvents::get(
+    int peerDeviceIdx,
+    uint64_t eventIdx,
+    const std::string& handle,
+    int deviceIdx) {
+  const auto handleKey = std::make_tuple(peerDeviceIdx, eventIdx);
+  if (!handle.empty()) {
+    TP_DCHECK_EQ(handle.size(), sizeof(cudaIpcEventHandle_t));
+    cudaIpcEventHandle_t ipcHandle;
+    std::memcpy(&ipcHandle, handle.data(), sizeof(cudaIpcEventHandle_t));
+    bool wasInserted;
+    std::tie(std::ignore, wasInserted) = handles_.emplace(handleKey, ipcHandle);
+    TP_DCHECK(wasInserted);
+  }
+
+  std::unique_ptr<CudaEvent>& event =
+      events_[std::make_tuple(peerDeviceIdx, eventIdx, deviceIdx)];
+  if (event == nullptr) {
+    auto iter = handles_.find(handleKey);
+    TP_THROW_ASSERT_IF(iter == handles_.end())
+        << "Unknown event #" << eventIdx << " of peer device " << peerDeviceIdx;
+    event = std::make_unique<CudaEvent>(deviceIdx, iter->second);
+  }
+  return *event;
+}
 
 SendOperation::SendOperation(
     uint64_t sequenceNumber,
     TSendCallback callback,
     int deviceIdx,
     const void* ptr,
-    cudaStream_t stream)
+    cudaStream_t stream,
+    size_t length,
+    CudaEventPool& eventPool)
     : sequenceNumber(sequenceNumber),
       callback(std::move(callback)),
       deviceIdx_(deviceIdx),
       ptr_(ptr),
       stream_(stream),
-      startEv_(deviceIdx_, /* interprocess = */ true) {
-  startEv_.record(stream_);
+      length_(length),
+      eventPool_(eventPool) {
+  std::tie(startEvIdx_, startEvIsNew_) = eventPool_.acquire(deviceIdx_);
+  eventPool_.get(deviceIdx_, startEvIdx_).record(stream_);
 }
 
-Descriptor SendOperation::descriptor(const CudaLib& cudaLib) {
-  CudaDeviceGuard guard(deviceIdx_);
-  cudaIpcMemHandle_t handle;
-  TP_CUDA_CHECK(cudaIpcGetMemHandle(&handle, const_cast<void*>(ptr_)));
-  CUdeviceptr basePtr;
-  TP_CUDA_DRIVER_CHECK(
-      cudaLib,
-      cudaLib.memGetAddressRange(
-          &basePtr, nullptr, reinterpret_cast<CUdeviceptr>(ptr_)));
-  size_t offset = reinterpret_cast<const uint8_t*>(ptr_) -
-      reinterpret_cast<uint8_t*>(basePtr);
+Descriptor SendOperation::descriptor(ContextImpl& context) {
+  IpcHandle handle;
+  uint64_t bufferId;
+  size_t offset;
+  std::tie(handle, bufferId, offset) = context.getIpcHandle(deviceIdx_, ptr_);
   return Descriptor{
-      std::string(reinterpret_cast<const char*>(&handle), sizeof(handle)),
+      std::move(handle.memHandle),
+      std::move(handle.ptrExportData),
+      handle.poolId,
+      handle.poolFd,
+      context.getProcessIdentifier(),
+      bufferId,
       offset,
-      startEv_.serializedHandle()};
+      deviceIdx_,
+      startEvIdx_,
+      startEvIsNew_
+          ? eventPool_.get(deviceIdx_, startEvIdx_).serializedHandle()
+          : std::string()};
 }
 
-void SendOperation::process(const cudaIpcEventHandle_t& stopEvHandle) {
-  CudaEvent stopEv(deviceIdx_, stopEvHandle);
+void SendOperation::process(PeerEvents& peerEvents, const ReplyEntry& reply) {
+  CudaEvent& stopEv = peerEvents.get(
+      reply.evDeviceIdx, reply.evIdx, reply.evHandle, deviceIdx_);
   stopEv.wait(stream_, deviceIdx_);
 }
 
+PushedEntry SendOperation::push(
+    PeerEvents& peerEvents,
+    const ReplyEntry& reply,
+    void* remotePtr,
+    ContextImpl& context) {
+  cudaStream_t copyStream = context.getCopyStream(deviceIdx_, stream_);
+  CudaCopyTimer& copyTimer = context.getCopyTimer();
+  const size_t sampleIdx = copyTimer.begin(deviceIdx_);
+  CudaEvent& readyEv = peerEvents.get(
+      reply.evDeviceIdx, reply.evIdx, reply.evHandle, deviceIdx_);
+  readyEv.wait(copyStream, deviceIdx_);
+  eventPool_.get(deviceIdx_, startEvIdx_).wait(copyStream, deviceIdx_);
+  copyTimer.markReady(sampleIdx, copyStream);
+
+  context.copy(eventPool_, remotePtr, ptr_, length_, copyStream, deviceIdx_);
+  copyTimer.markCopied(sampleIdx, copyStream);
+  copyTimer.end(sampleIdx);
+
+  std::tie(stopEvIdx_, stopEvIsNew_) = eventPool_.acquire(deviceIdx_);
+  hasStopEv_ = true;
+  CudaEvent& stopEv = eventPool_.get(deviceIdx_, stopEvIdx_);
+  stopEv.record(copyStream);
+  if (copyStream != stream_) {
+    stopEv.wait(stream_, deviceIdx_);
+  }
+  return PushedEntry{
+      deviceIdx_,
+      stopEvIdx_,
+      stopEvIsNew_ ? stopEv.serializedHandle() : std::string()};
+}
+
+SendOperation::~SendOperation() {
+  eventPool_.release(deviceIdx_, startEvIdx_);
+  if (hasStopEv_) {
+    eventPool_.release(deviceIdx_, stopEvIdx_);
+  }
+}
+
 RecvOperation::RecvOperation(
     uint64_t sequenceNumber,
     int deviceIdx,
     void* ptr,
     cudaStream_t stream,
-    size_t length)
+    cudaStream_t copyStream,
+    size_t length,
+    bool push,
+    CudaEventPool& eventPool)
     : sequenceNumber(sequenceNumber),
       deviceIdx_(deviceIdx),
       ptr_(ptr),
       stream_(stream),
+      copyStream_(copyStream),
       length_(length),
-      stopEv_(deviceIdx_, /* interprocess = */ true) {}
+      push_(push),
+      eventPool_(eventPool) {
+  std::tie(evIdx_, evIsNew_) = eventPool_.acquire(deviceIdx_);
+  if (push_) {
+    eventPool_.get(deviceIdx_, evIdx_).record(stream_);
+  }
+}
 
-Reply RecvOperation::reply() {
-  return Reply{stopEv_.serializedHandle()};
+ReplyEntry RecvOperation::reply(ContextImpl& context) {
+  ReplyEntry entry{};
+  entry.push = push_;
+  entry.evDeviceIdx = deviceIdx_;
+  entry.evIdx = evIdx_;
+  if (evIsNew_) {
+    entry.evHandle = eventPool_.get(deviceIdx_, evIdx_).serializedHandle();
+  }
+  if (push_) {
+    IpcHandle handle;
+    std::tie(handle, entry.bufferId, entry.offset) =
+        context.getIpcHandle(deviceIdx_, ptr_);
+    entry.memHandle = std::move(handle.memHandle);
+    entry.ptrExportData = std::move(handle.ptrExportData);
+    entry.poolId = handle.poolId;
+    entry.poolFd = handle.poolFd;
+    entry.processIdentifier = context.getProcessIdentifier();
+  }
+  return entry;
 }
 
 void RecvOperation::process(
-    const cudaIpcEventHandle_t& startEvHandle,
-    const cudaIpcMemHandle_t& remoteHandle,
-    size_t offset) {
-  CudaEvent startEv(deviceIdx_, startEvHandle);
-  startEv.wait(stream_, deviceIdx_);
+    PeerEvents& peerEvents,
+    const Descriptor& descriptor,
+    const void* remotePtr,
+    ContextImpl& context) {
+  CudaCopyTimer& copyTimer = context.getCopyTimer();
+  const size_t sampleIdx = copyTimer.begin(deviceIdx_);
+  CudaEvent& startEv = peerEvents.get(
+      descriptor.startEvDeviceIdx,
+      descriptor.startEvIdx,
+      descriptor.startEvHandle,
+      deviceIdx_);
+  startEv.wait(copyStream_, deviceIdx_);
+  cudaStreamWaitForStream(
+      eventPool_, copyStream_, deviceIdx_, stream_, deviceIdx_);
+  copyTimer.markReady(sampleIdx, copyStream_);
+
+  context.copy(eventPool_, ptr_, remotePtr, length_, copyStream_, deviceIdx_);
+  copyTimer.markCopied(sampleIdx, copyStream_);
+  copyTimer.end(sampleIdx);
+
+  CudaEvent& stopEv = eventPool_.get(deviceIdx_, evIdx_);
+  stopEv.record(copyStream_);
+  if (copyStream_ != stream_) {
+    stopEv.wait(stream_, deviceIdx_);
+  }
+}
 
-  void* remotePtr;
-  TP_CUDA_CHECK(cudaIpcOpenMemHandle(
-      &remotePtr, remoteHandle, cudaIpcMemLazyEnablePeerAccess));
-  TP_CUDA_CHECK(cudaMemcpyAsync(
-      ptr_,
-      static_cast<uint8_t*>(remotePtr) + offset,
-      length_,
-      cudaMemcpyDeviceToDevice,
-      stream_));
-  TP_CUDA_CHECK(cudaIpcCloseMemHandle(remotePtr));
-
-  stopEv_.record(stream_);
+void RecvOperation::finishPush(
+    PeerEvents& peerEvents,
+    const PushedEntry& pushed) {
+  CudaEvent& stopEv = peerEvents.get(
+      pushed.stopEvDeviceIdx,
+      pushed.stopEvIdx,
+      pushed.stopEvHandle,
+      deviceIdx_);
+  stopEv.wait(stream_, deviceIdx_);
+}
+
+RecvOperation::~RecvOperation() {
+  eventPool_.release(deviceIdx_, evIdx_);
 }
 
 ChannelImpl::ChannelImpl(
@@ -150,11 +348,13 @@ void ChannelImpl::sendImplFromLoop(
       std::move(callback),
       deviceIdx,
       buffer.ptr,
-      buffer.stream);
+      buffer.stream,
+      buffer.length,
+      eventPool_);
   auto& op = sendOperations_.back();
 
   NopHolder<Descriptor> nopHolder;
-  nopHolder.getObject() = op.descriptor(context_->getCudaLib());
+  nopHolder.getObject() = op.descriptor(*context_);
   descriptorCallback(Error::kSuccess, saveDescriptor(nopHolder));
 }
 
@@ -168,42 +368,118 @@ void ChannelImpl::recvImplFromLoop(
   // TODO: figure out which CUDA op crashed and replace this with a
   // more precise fix.
   CudaDeviceGuard guard(deviceIdx);
+  cudaStream_t copyStream = context_->getCopyStream(deviceIdx, buffer.stream);
+  const bool push = context_->shouldPush(copyStream);
+  // The callbacks are called in order, hence one that comes after a push that
+  // is still in flight is held back until that one is done.
+  bool afterPush = false;
+  for (const auto& otherOp : recvOperations_) {
+    afterPush = afterPush || otherOp.isPush();
+  }
   recvOperations_.emplace_back(
-      sequenceNumber, deviceIdx, buffer.ptr, buffer.stream, buffer.length);
+      sequenceNumber,
+      deviceIdx,
+      buffer.ptr,
+      buffer.stream,
+      copyStream,
+      buffer.length,
+      push,
+      eventPool_);
   auto& op = recvOperations_.back();
 
+  if (push) {
+    TP_VLOG(6) << "Channel " << id_ << " is asking for payload to be pushed (#"
+               << sequenceNumber << ")";
+    op.callback = std::move(callback);
+    if (numPendingReplies_++ == 0) {
+      context_->deferToLoop(
+          [impl{shared_from_this()}]() { impl->writeReplies(); });
+    }
+    return;
+  }
+
   NopHolder<Descriptor> nopHolder;
   loadDescriptor(nopHolder, descriptor);
   Descriptor& nopDescriptor = nopHolder.getObject();
-  const cudaIpcEventHandle_t* startEvHandle =
-      reinterpret_cast<const cudaIpcEventHandle_t*>(
-          nopDescriptor.startEvHandle.c_str());
-  const cudaIpcMemHandle_t* remoteHandle =
-      reinterpret_cast<const cudaIpcMemHandle_t*>(nopDescriptor.handle.c_str());
+  IpcHandle remoteHandle;
+  remoteHandle.memHandle = std::move(nopDescriptor.memHandle);
+  remoteHandle.ptrExportData = std::move(nopDescriptor.ptrExportData);
+  remoteHandle.poolId = nopDescriptor.poolId;
+  remoteHandle.poolFd = nopDescriptor.poolFd;
 
   // Perform copy.
   TP_VLOG(6) << "Channel " << id_ << " is copying payload (#" << sequenceNumber
              << ")";
 
-  op.process(*startEvHandle, *remoteHandle, nopDescriptor.offset);
+  Error error;
+  void* remotePtr;
+  std::tie(error, remotePtr) = context_->openIpcHandle(
+      nopDescriptor.processIdentifier,
+      nopDescriptor.bufferId,
+      remoteHandle,
+      deviceIdx);
+  if (error) {
+    // This drops the operation.
+    setError(std::move(error));
+    callback(error_);
+    return;
+  }
+  op.process(
+      peerEvents_,
+      nopDescriptor,
+      static_cast<const uint8_t*>(remotePtr) + nopDescriptor.offset,
+      *context_);
 
   TP_VLOG(6) << "Channel " << id_ << " done copying payload (#"
              << op.sequenceNumber << ")";
 
-  callback(error_);
+  if (afterPush) {
+    op.callback = std::move(callback);
+  } else {
+    callback(error_);
+  }
+
+  // Let peer know we've completed the copy, together with any other copy that
+  // is enqueued before the loop gets to it.
+  if (numPendingReplies_++ == 0) {
+    context_->deferToLoop(
+        [impl{shared_from_this()}]() { impl->writeReplies(); });
+  }
+}
+
+void ChannelImpl::writeReplies() {
+  TP_DCHECK(context_->inLoop());
+  if (error_) {
+    // The operations have been dropped already.
+    numPendingReplies_ = 0;
+    return;
+  }
+
+  TP_DCHECK_GE(recvOperations_.size(), numPendingReplies_);
+  auto opIter = std::prev(recvOperations_.end(), numPendingReplies_);
+  const uint64_t firstSequenceNumber = opIter->sequenceNumber;
+  const uint64_t lastSequenceNumber = recvOperations_.back().sequenceNumber;
 
-  // Let peer know we've completed the copy.
   TP_VLOG(6) << "Channel " << id_ << " is writing reply notification (#"
-             << op.sequenceNumber << ")";
+             << firstSequenceNumber << " to #" << lastSequenceNumber << ")";
   auto nopPacketHolder = std::make_shared<NopHolder<Packet>>();
-  nopPacketHolder->getObject() = op.reply();
+  Packet& nopPacket = nopPacketHolder->getObject();
+  nopPacket.Become(nopPacket.index_of<Reply>());
+  Reply& nopReply = *nopPacket.get<Reply>();
+  nopReply.entries.reserve(numPendingReplies_);
+  for (; opIter != recvOperations_.end(); ++opIter) {
+    nopReply.entries.push_back(opIter->reply(*context_));
+  }
+  numPendingReplies_ = 0;
 
   connection_->write(
       *nopPacketHolder,
-      lazyCallbackWrapper_([nopPacketHolder, sequenceNumber{op.sequenceNumber}](
-                               ChannelImpl& impl) {
+      lazyCallbackWrapper_([nopPacketHolder,
+                            firstSequenceNumber,
+                            lastSequenceNumber](ChannelImpl& impl) {
         TP_VLOG(6) << "Channel " << impl.id_
-                   << " done writing reply notification (#" << sequenceNumber
+                   << " done writing reply notification (#"
+                   << firstSequenceNumber << " to #" << lastSequenceNumber
                    << ")";
       }));
 }
@@ -217,7 +493,9 @@ void ChannelImpl::readPackets() {
         if (nopPacket.is<Reply>()) {
           impl.onReply(*nopPacket.get<Reply>());
         } else if (nopPacket.is<Ack>()) {
-          impl.onAck();
+          impl.onAck(*nopPacket.get<Ack>());
+        } else if (nopPacket.is<PushAck>()) {
+          impl.onPushAck(nopPacket.get<PushAck>()->numOps);
         } else {
           TP_THROW_ASSERT() << "Unexpected packet type: " << nopPacket.index();
         }
@@ -227,44 +505,139 @@ void ChannelImpl::readPackets() {
 }
 
 void ChannelImpl::onReply(const Reply& nopReply) {
-  auto& op = sendOperations_.front();
+  TP_DCHECK_GE(sendOperations_.size(), nopReply.entries.size());
+  TP_DCHECK(!nopReply.entries.empty());
+  const uint64_t firstSequenceNumber = sendOperations_.front().sequenceNumber;
+  const uint64_t lastSequenceNumber =
+      firstSequenceNumber + nopReply.entries.size() - 1;
 
   TP_VLOG(6) << "Channel " << id_ << " received reply notification (#"
-             << op.sequenceNumber << ")";
-
-  const cudaIpcEventHandle_t* stopEvHandle =
-      reinterpret_cast<const cudaIpcEventHandle_t*>(
-          nopReply.stopEvHandle.c_str());
-
-  op.process(*stopEvHandle);
+             << firstSequenceNumber << " to #" << lastSequenceNumber << ")";
 
-  TP_VLOG(6) << "Channel " << id_ << " is writing ACK notification (#"
-             << op.sequenceNumber << ")";
   auto nopPacketHolder = std::make_shared<NopHolder<Packet>>();
   Packet& nopPacket = nopPacketHolder->getObject();
   nopPacket.Become(nopPacket.index_of<Ack>());
+  Ack& nopAck = *nopPacket.get<Ack>();
+  nopAck.numOps = nopReply.entries.size();
+
+  for (const ReplyEntry& nopReplyEntry : nopReply.entries) {
+    auto& op = sendOperations_.front();
+    if (!nopReplyEntry.push) {
+      op.process(peerEvents_, nopReplyEntry);
+      op.callback(error_);
+      sendOperations_.pop_front();
+      continue;
+    }
+
+    TP_VLOG(6) << "Channel " << id_ << " is pushing payload (#"
+               << op.sequenceNumber << ")";
+    CudaDeviceGuard guard(op.deviceIdx());
+    IpcHandle remoteHandle;
+    remoteHandle.memHandle = nopReplyEntry.memHandle;
+    remoteHandle.ptrExportData = nopReplyEntry.ptrExportData;
+    remoteHandle.poolId = nopReplyEntry.poolId;
+    remoteHandle.poolFd = nopReplyEntry.poolFd;
+    Error error;
+    void* remotePtr;
+    std::tie(error, remotePtr) = context_->openIpcHandle(
+        nopReplyEntry.processIdentifier,
+        nopReplyEntry.bufferId,
+        remoteHandle,
+        op.deviceIdx());
+    if (error) {
+      // The remaining operations are failed by the error handler.
+      setError(std::move(error));
+      return;
+    }
+    nopAck.pushed.push_back(op.push(
+        peerEvents_,
+        nopReplyEntry,
+        static_cast<uint8_t*>(remotePtr) + nopReplyEntry.offset,
+        *context_));
+    TP_VLOG(6) << "Channel " << id_ << " done pushing payload (#"
+               << op.sequenceNumber << ")";
+    op.callback(error_);
+    // Its events must outlive the peer's wait on them.
+    pushedOperations_.splice(
+        pushedOperations_.end(), sendOperations_, sendOperations_.begin());
+  }
 
-  op.callback(error_);
+  TP_VLOG(6) << "Channel " << id_ << " is writing ACK notification (#"
+             << firstSequenceNumber << " to #" << lastSequenceNumber << ")";
 
   connection_->write(
       *nopPacketHolder,
-      lazyCallbackWrapper_([nopPacketHolder, sequenceNumber{op.sequenceNumber}](
-                               ChannelImpl& impl) {
+      lazyCallbackWrapper_([nopPacketHolder,
+                            firstSequenceNumber,
+                            lastSequenceNumber](ChannelImpl& impl) {
         TP_VLOG(6) << "Channel " << impl.id_
-                   << " done writing ACK notification (#" << sequenceNumber
+                   << " done writing ACK notification (#"
+                   << firstSequenceNumber << " to #" << lastSequenceNumber
                    << ")";
       }));
-
-  sendOperations_.pop_front();
 }
 
-void ChannelImpl::onAck() {
-  auto& op = recvOperations_.front();
+void ChannelImpl::onAck(const Ack& nopAck) {
+  const uint64_t numOps = nopAck.numOps;
+  TP_DCHECK_GE(recvOperations_.size(), numOps);
 
   TP_VLOG(6) << "Channel " << id_ << " received ACK notification (#"
-             << op.sequenceNumber << ")";
+             << recvOperations_.front().sequenceNumber << " to #"
+             << recvOperations_.front().sequenceNumber + numOps - 1 << ")";
+
+  auto pushedIter = nopAck.pushed.begin();
+  for (uint64_t opIdx = 0; opIdx < numOps; opIdx++) {
+    auto& op = recvOperations_.front();
+    if (op.isPush()) {
+      TP_DCHECK(pushedIter != nopAck.pushed.end());
+      CudaDeviceGuard guard(op.deviceIdx());
+      op.finishPush(peerEvents_, *pushedIter);
+      ++pushedIter;
+      TP_VLOG(6) << "Channel " << id_ << " got payload pushed (#"
+                 << op.sequenceNumber << ")";
+    }
+    if (op.callback) {
+      TRecvCallback callback = std::move(op.callback);
+      recvOperations_.pop_front();
+      callback(error_);
+    } else {
+      recvOperations_.pop_front();
+    }
+  }
+  TP_DCHECK(pushedIter == nopAck.pushed.end());
+
+  // The pulls that were held back by the pushes that just finished.
+  for (auto& op : recvOperations_) {
+    if (op.isPush()) {
+      break;
+    }
+    if (op.callback) {
+      TRecvCallback callback = std::move(op.callback);
+      op.callback = nullptr;
+      callback(error_);
+    }
+  }
+
+  if (nopAck.pushed.empty()) {
+    return;
+  }
+  auto nopPacketHolder = std::make_shared<NopHolder<Packet>>();
+  Packet& nopPacket = nopPacketHolder->getObject();
+  nopPacket.Become(nopPacket.index_of<PushAck>());
+  nopPacket.get<PushAck>()->numOps = nopAck.pushed.size();
+  connection_->write(
+      *nopPacketHolder,
+      lazyCallbackWrapper_([nopPacketHolder](ChannelImpl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_
+                   << " done writing push ACK notification";
+      }));
+}
 
-  recvOperations_.pop_front();
+void ChannelImpl::onPushAck(uint64_t numOps) {
+  TP_DCHECK_GE(pushedOperations_.size(), numOps);
+  for (uint64_t opIdx = 0; opIdx < numOps; opIdx++) {
+    pushedOperations_.pop_front();
+  }
 }
 
 void ChannelImpl::handleErrorImpl() {
@@ -274,9 +647,17 @@ void ChannelImpl::handleErrorImpl() {
     op.callback(error_);
   }
   sendOperations_.clear();
-
-  // Callbacks for recv operations are always called inline.
+  pushedOperations_.clear();
+
+  // Callbacks for recv operations are called inline, except for those held
+  // back by a push.
+  for (auto& op : recvOperations_) {
+    if (op.callback) {
+      op.callback(error_);
+    }
+  }
   recvOperations_.clear();
+  numPendingReplies_ = 0;
 
   context_->unenroll(*this);
 }
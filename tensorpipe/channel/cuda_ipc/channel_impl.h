@@ -9,14 +9,17 @@
 #pragma once
 
 #include <list>
+#include <map>
 #include <memory>
 #include <string>
+#include <tuple>
 
 #include <cuda_runtime.h>
 
 #include <tensorpipe/channel/channel_impl_boilerplate.h>
 #include <tensorpipe/common/cuda.h>
 #include <tensorpipe/common/cuda_buffer.h>
+#include <tensorpipe/common/cuda_event_pool.h>
 #include <tensorpipe/common/cuda_lib.h>
 #include <tensorpipe/transport/context.h>
 
@@ -27,7 +30,28 @@ namespace cuda_ipc {
 class ContextImpl;
 
 struct Descriptor;
+struct ReplyEntry;
 struct Reply;
+struct PushedEntry;
+struct Ack;
+
+// The interprocess events of the peer, as opened in this process. The peer
+// only sends the handle of each of its events the first time it uses it, and
+// afterwards refers to it by its device and index. Each event is opened once
+// for each of the local devices that wait on it.
+class PeerEvents {
+ public:
+  // The handle is empty if it was already received before.
+  CudaEvent& get(
+      int peerDeviceIdx,
+      uint64_t eventIdx,
+      const std::string& handle,
+      int deviceIdx);
+
+ private:
+  std::map<std::tuple<int, uint64_t>, cudaIpcEventHandle_t> handles_;
+  std::map<std::tuple<int, uint64_t, int>, std::unique_ptr<CudaEvent>> events_;
+};
 
 class SendOperation {
  public:
@@ -39,43 +63,102 @@ class SendOperation {
       TSendCallback callback,
       int deviceIdx,
       const void* ptr,
-      cudaStream_t stream);
+      cudaStream_t stream,
+      size_t length,
+      CudaEventPool& eventPool);
+
+  SendOperation(const SendOperation&) = delete;
+  SendOperation& operator=(const SendOperation&) = delete;
+
+  Descriptor descriptor(ContextImpl& context);
+
+  int deviceIdx() const {
+    return deviceIdx_;
+  }
+
+  // Once the peer has pulled the data.
+  void process(PeerEvents& peerEvents, const ReplyEntry& reply);
 
-  Descriptor descriptor(const CudaLib& cudaLib);
+  // Copy the data into the peer's buffer, mapped at the given address, once
+  // the peer's event says it's ready. The operation must then be kept until
+  // the peer has waited on the end of the copy.
+  PushedEntry push(
+      PeerEvents& peerEvents,
+      const ReplyEntry& reply,
+      void* remotePtr,
+      ContextImpl& context);
 
-  void process(const cudaIpcEventHandle_t& stopEvHandle);
+  ~SendOperation();
 
  private:
   const int deviceIdx_;
   const void* ptr_;
   cudaStream_t stream_;
-  CudaEvent startEv_;
+  const size_t length_;
+  CudaEventPool& eventPool_;
+  size_t startEvIdx_;
+  bool startEvIsNew_;
+  // Only for pushes.
+  bool hasStopEv_{false};
+  size_t stopEvIdx_{0};
+  bool stopEvIsNew_{false};
 };
 
 struct RecvOperation {
  public:
   uint64_t sequenceNumber;
+  // Set while the callback is held back: until the data of a push is in, or,
+  // for the others, until the pushes before them are done, so that the
+  // callbacks are called in order.
+  TRecvCallback callback;
 
   RecvOperation(
       uint64_t sequenceNumber,
       int deviceIdx,
       void* ptr,
       cudaStream_t stream,
-      size_t length);
+      cudaStream_t copyStream,
+      size_t length,
+      bool push,
+      CudaEventPool& eventPool);
 
-  Reply reply();
+  RecvOperation(const RecvOperation&) = delete;
+  RecvOperation& operator=(const RecvOperation&) = delete;
 
+  int deviceIdx() const {
+    return deviceIdx_;
+  }
+
+  bool isPush() const {
+    return push_;
+  }
+
+  ReplyEntry reply(ContextImpl& context);
+
+  // Pull the data.
   void process(
-      const cudaIpcEventHandle_t& startEvHandle,
-      const cudaIpcMemHandle_t& remoteHandle,
-      size_t offset);
+      PeerEvents& peerEvents,
+      const Descriptor& descriptor,
+      const void* remotePtr,
+      ContextImpl& context);
+
+  // Once the peer has pushed the data.
+  void finishPush(PeerEvents& peerEvents, const PushedEntry& pushed);
+
+  ~RecvOperation();
 
  private:
   const int deviceIdx_;
   void* ptr_;
   cudaStream_t stream_;
+  cudaStream_t copyStream_;
   size_t length_;
-  CudaEvent stopEv_;
+  const bool push_;
+  CudaEventPool& eventPool_;
+  // The event that the peer waits on: the end of the copy for a pull, and for
+  // a push the point after which the buffer can be written into.
+  size_t evIdx_;
+  bool evIsNew_;
 };
 
 class ChannelImpl final
@@ -105,15 +188,34 @@ class ChannelImpl final
  private:
   const std::shared_ptr<transport::Connection> connection_;
 
+  // The events recorded by the operations of this channel, which the peer
+  // waits on, and the ones of the peer which this channel waits on. They're
+  // declared before the operations, which give their events back when they're
+  // destroyed.
+  CudaEventPool eventPool_{/*interprocess=*/true};
+  PeerEvents peerEvents_;
+
   // List of alive send operations.
   std::list<SendOperation> sendOperations_;
 
+  // The send operations that were pushed, whose stop events the peer hasn't
+  // waited on yet.
+  std::list<SendOperation> pushedOperations_;
+
   // List of alive recv operations.
   std::list<RecvOperation> recvOperations_;
 
+  // The number of recv operations, at the back of the list, whose copy has been
+  // enqueued but whose reply hasn't been written yet. All the tensors of a
+  // message are received back-to-back, hence their replies are coalesced into
+  // a single packet, written once the loop has processed them all.
+  size_t numPendingReplies_{0};
+
   void readPackets();
+  void writeReplies();
   void onReply(const Reply& nopReply);
-  void onAck();
+  void onAck(const Ack& nopAck);
+  void onPushAck(uint64_t numOps);
 };
 
 } // namespace cuda_ipc
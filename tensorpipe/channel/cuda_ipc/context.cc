@@ -19,7 +19,14 @@ namespace tensorpipe {
 namespace channel {
 namespace cuda_ipc {
 
-Context::Context() : impl_(std::make_shared<ContextImpl>()) {}
+Context::Context(
+    bool useDedicatedCopyStreams,
+    size_t numSplitStreams,
+    CopyDirection copyDirection)
+    : impl_(std::make_shared<ContextImpl>(
+          useDedicatedCopyStreams,
+          numSplitStreams,
+          copyDirection)) {}
 
 // Explicitly define all methods of the context, which just forward to the impl.
 // We cannot use an intermediate ContextBoilerplate class without forcing a
@@ -43,6 +50,22 @@ void Context::setId(std::string id) {
   impl_->setId(std::move(id));
 }
 
+MemoryFootprint Context::getMemoryFootprint() {
+  return impl_->getMemoryFootprint();
+}
+
+void Context::reclaimMemory() {
+  impl_->reclaimMemory();
+}
+
+void Context::enableChannelStats() {
+  impl_->enableChannelStats();
+}
+
+ChannelStats Context::getChannelStats() {
+  return impl_->getChannelStats();
+}
+
 void Context::close() {
   impl_->close();
 }
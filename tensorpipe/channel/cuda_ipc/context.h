@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <memory>
 #include <string>
 
@@ -20,9 +21,38 @@ namespace cuda_ipc {
 
 class ContextImpl;
 
+// Which end of the channel copies each tensor, from the memory of the other.
+enum class CopyDirection {
+  // The receiver maps the sender's buffer and copies from it.
+  kPull,
+  // The receiver exports its buffer for the sender to map and copy into.
+  kPush,
+  // Each tensor is pushed if the stream that the receiver would copy it on is
+  // still busy with earlier work, and pulled otherwise.
+  kAuto,
+};
+
 class Context : public CudaContext {
  public:
-  Context();
+  // Copies are enqueued on high-priority streams owned by the context, one per
+  // device, which are ordered against the user's streams by means of events.
+  // Pass false to enqueue them directly on the user's streams instead.
+  //
+  // With numSplitStreams above one, the copies of large tensors are split in
+  // up to that many slices, on as many more streams of the device, so that
+  // they use several of its copy engines at once.
+  //
+  // The receiving end picks the direction of each copy: pulling leaves the
+  // sender out of it, whereas pushing has the copy run on the sender's device
+  // (and on its copy streams, as above), which completes sooner when the
+  // receiver's device is busy, and lets the sender reuse its buffer as soon
+  // as the copy is done instead of once the receiver got to it. A push costs
+  // one more message between the two ends before the receiving one completes.
+  // The handles of the buffers are cached on either side in both directions.
+  explicit Context(
+      bool useDedicatedCopyStreams = true,
+      size_t numSplitStreams = 1,
+      CopyDirection copyDirection = CopyDirection::kPull);
 
   Context(const Context&) = delete;
   Context(Context&&) = delete;
@@ -39,6 +69,14 @@ class Context : public CudaContext {
 
   void setId(std::string id) override;
 
+  MemoryFootprint getMemoryFootprint() override;
+
+  void reclaimMemory() override;
+
+  void enableChannelStats() override;
+
+  ChannelStats getChannelStats() override;
+
   void close() override;
 
   void join() override;
@@ -8,12 +8,20 @@
 
 #include <tensorpipe/channel/cuda_ipc/context_impl.h>
 
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
 #include <memory>
 #include <sstream>
 #include <string>
 #include <utility>
 
+#include <cuda.h>
+
 #include <tensorpipe/channel/cuda_ipc/channel_impl.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/optional.h>
@@ -33,35 +41,83 @@ std::string generateDomainDescriptor() {
   return oss.str();
 }
 
-} // namespace
-
-ContextImpl::ContextImpl()
-    : ContextImplBoilerplate<CudaBuffer, ContextImpl, ChannelImpl>(
-          generateDomainDescriptor()) {
-  Error error;
-  std::tie(error, cudaLib_) = CudaLib::create();
-  if (error) {
-    TP_VLOG(5) << "Channel context " << id_
-               << " is not viable because libcuda could not be loaded: "
-               << error.what();
-    return;
+// PIDs are only unique within a PID namespace.
+std::string generateProcessIdentifier() {
+  std::ostringstream oss;
+  optional<std::string> pidNsId = getLinuxNamespaceId(LinuxNamespace::kPid);
+  if (pidNsId.has_value()) {
+    oss << pidNsId.value() << "_";
   }
-  foundCudaLib_ = true;
+  oss << ::getpid();
+  return oss.str();
 }
 
-std::shared_ptr<CudaChannel> ContextImpl::createChannel(
-    std::shared_ptr<transport::Connection> connection,
-    Endpoint /* unused */) {
-  return createChannelInternal(std::move(connection));
+#if TP_CUDA_IPC_MEM_POOLS
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_getfd
+#define SYS_pidfd_getfd 438
+#endif
+
+// Return the PID of the process with the given identifier, as seen from this
+// process, i.e., only if they're in the same PID namespace.
+optional<pid_t> getPidOfProcess(const std::string& processIdentifier) {
+  std::string prefix;
+  optional<std::string> pidNsId = getLinuxNamespaceId(LinuxNamespace::kPid);
+  if (pidNsId.has_value()) {
+    prefix = pidNsId.value() + "_";
+  }
+  if (processIdentifier.compare(0, prefix.size(), prefix) != 0) {
+    return nullopt;
+  }
+  const char* begin = processIdentifier.c_str() + prefix.size();
+  char* end;
+  long pid = std::strtol(begin, &end, 10);
+  if (end == begin || *end != '\0') {
+    return nullopt;
+  }
+  return static_cast<pid_t>(pid);
 }
 
-bool ContextImpl::isViable() const {
-  if (!foundCudaLib_) {
-    return false;
+// Duplicate a file descriptor of another process into this one, which requires
+// the same permissions as ptrace-ing that process, and Linux 5.6 or later.
+std::tuple<Error, Fd> duplicateFdOfProcess(
+    const std::string& processIdentifier,
+    int fd) {
+  optional<pid_t> pid = getPidOfProcess(processIdentifier);
+  if (!pid.has_value()) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(
+            SystemError, "the peer is in another PID namespace", ESRCH),
+        Fd());
+  }
+  Fd pidFd(static_cast<int>(::syscall(SYS_pidfd_open, pid.value(), 0)));
+  if (!pidFd.hasValue()) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "pidfd_open", errno), Fd());
+  }
+  Fd dupFd(static_cast<int>(::syscall(SYS_pidfd_getfd, pidFd.fd(), fd, 0)));
+  if (!dupFd.hasValue()) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "pidfd_getfd", errno), Fd());
   }
+  return std::make_tuple(Error::kSuccess, std::move(dupFd));
+}
+
+#endif // TP_CUDA_IPC_MEM_POOLS
 
-  // This part is largely inspired from
-  // https://github.com/NVIDIA/cuda-samples/blob/master/Samples/simpleIPC/simpleIPC.cu.
+// The maximum number of entries in the caches of IPC handles. The mappings of
+// remote allocations pin device memory, which thus isn't really freed until
+// they are evicted.
+constexpr size_t kMaxNumCachedLocalHandles = 1024;
+constexpr size_t kMaxNumOpenRemoteMappings = 128;
+
+// Return why the devices can't be used for IPC, or an empty string if they can.
+// This part is largely inspired from the simpleIPC sample of NVIDIA's
+// cuda-samples (Samples/simpleIPC/simpleIPC.cu).
+std::string findWhyDevicesDontSupportIpc() {
   int deviceCount;
   TP_CUDA_CHECK(cudaGetDeviceCount(&deviceCount));
   for (int i = 0; i < deviceCount; ++i) {
@@ -70,19 +126,15 @@ bool ContextImpl::isViable() const {
 
     // Unified addressing is required for IPC.
     if (!props.unifiedAddressing) {
-      TP_VLOG(4) << "Channel context " << id_
-                 << " is not viable because CUDA device " << i
-                 << " does not have unified addressing";
-      return false;
+      return "CUDA device " + std::to_string(i) +
+          " does not have unified addressing";
     }
 
     // The other two compute modes are "exclusive" and "prohibited", both of
     // which prevent access from an other process.
     if (props.computeMode != cudaComputeModeDefault) {
-      TP_VLOG(4) << "Channel context " << id_
-                 << " is not viable because CUDA device " << i
-                 << " is not in default compute mode";
-      return false;
+      return "CUDA device " + std::to_string(i) +
+          " is not in default compute mode";
     }
 
     for (int j = 0; j < deviceCount; ++j) {
@@ -95,13 +147,57 @@ bool ContextImpl::isViable() const {
       int canAccessPeer;
       TP_CUDA_CHECK(cudaDeviceCanAccessPeer(&canAccessPeer, i, j));
       if (!canAccessPeer) {
-        TP_VLOG(4) << "Channel context " << id_
-                   << " is not viable because CUDA device " << i
-                   << " cannot access peer device " << j;
-        return false;
+        return "CUDA device " + std::to_string(i) +
+            " cannot access peer device " + std::to_string(j);
       }
     }
   }
+  return "";
+}
+
+} // namespace
+
+ContextImpl::ContextImpl(
+    bool useDedicatedCopyStreams,
+    size_t numSplitStreams,
+    CopyDirection copyDirection)
+    : ContextImplBoilerplate<CudaBuffer, ContextImpl, ChannelImpl>(
+          generateDomainDescriptor()),
+      copyStreams_(useDedicatedCopyStreams, numSplitStreams),
+      copyDirection_(copyDirection),
+      processIdentifier_(generateProcessIdentifier()),
+      localHandles_(kMaxNumCachedLocalHandles),
+      remoteMappings_(kMaxNumOpenRemoteMappings) {
+  Error error;
+  std::tie(error, cudaLib_) = CudaLib::create();
+  if (error) {
+    TP_VLOG(5) << "Channel context " << id_
+               << " is not viable because libcuda could not be loaded: "
+               << error.what();
+    return;
+  }
+  foundCudaLib_ = true;
+}
+
+std::shared_ptr<CudaChannel> ContextImpl::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint /* unused */) {
+  return createChannelInternal(std::move(connection));
+}
+
+bool ContextImpl::isViable() const {
+  if (!foundCudaLib_) {
+    return false;
+  }
+
+  // Looked up once per process, as querying the properties of each device, and
+  // of each pair of them, is slow.
+  static const std::string reason = findWhyDevicesDontSupportIpc();
+  if (!reason.empty()) {
+    TP_VLOG(4) << "Channel context " << id_ << " is not viable because "
+               << reason;
+    return false;
+  }
 
   return true;
 }
@@ -110,7 +206,258 @@ const CudaLib& ContextImpl::getCudaLib() {
   return cudaLib_;
 }
 
-void ContextImpl::closeImpl() {}
+void ContextImpl::enableChannelStats() {
+  copyTimer_.enable();
+}
+
+ChannelStats ContextImpl::getChannelStats() {
+  return copyTimer_.getStats();
+}
+
+CudaCopyTimer& ContextImpl::getCopyTimer() {
+  return copyTimer_;
+}
+
+cudaStream_t ContextImpl::getCopyStream(
+    int deviceIdx,
+    cudaStream_t userStream) {
+  TP_DCHECK(inLoop());
+  return copyStreams_.get(deviceIdx, userStream);
+}
+
+void ContextImpl::copy(
+    CudaEventPool& eventPool,
+    void* dst,
+    const void* src,
+    size_t length,
+    cudaStream_t stream,
+    int deviceIdx) {
+  TP_DCHECK(inLoop());
+  copyStreams_.copy(eventPool, dst, src, length, stream, deviceIdx);
+}
+
+bool ContextImpl::shouldPush(cudaStream_t copyStream) {
+  switch (copyDirection_) {
+    case CopyDirection::kPull:
+      return false;
+    case CopyDirection::kPush:
+      return true;
+    case CopyDirection::kAuto: {
+      // A pulled copy would have to wait for the work that is already on its
+      // stream, whereas a pushed one goes on the sender's device.
+      cudaError_t status = cudaStreamQuery(copyStream);
+      if (status == cudaErrorNotReady) {
+        return true;
+      }
+      TP_CUDA_CHECK(status);
+      return false;
+    }
+  }
+  TP_THROW_ASSERT() << "Unknown copy direction";
+  return false;
+}
+
+const std::string& ContextImpl::getProcessIdentifier() {
+  return processIdentifier_;
+}
+
+std::tuple<IpcHandle, uint64_t, size_t> ContextImpl::getIpcHandle(
+    int deviceIdx,
+    const void* ptr) {
+  TP_DCHECK(inLoop());
+  CudaDeviceGuard guard(deviceIdx);
+
+  CUdeviceptr basePtr;
+  TP_CUDA_DRIVER_CHECK(
+      cudaLib_,
+      cudaLib_.memGetAddressRange(
+          &basePtr, nullptr, reinterpret_cast<CUdeviceptr>(ptr)));
+  size_t offset = reinterpret_cast<const uint8_t*>(ptr) -
+      reinterpret_cast<uint8_t*>(basePtr);
+
+  unsigned long long bufferId;
+  TP_CUDA_DRIVER_CHECK(
+      cudaLib_,
+      cudaLib_.pointerGetAttribute(
+          &bufferId, CU_POINTER_ATTRIBUTE_BUFFER_ID, basePtr));
+
+  IpcHandle* handle = localHandles_.find(bufferId);
+  if (handle == nullptr) {
+    TP_VLOG(5) << "Channel context " << id_
+               << " is getting IPC handle for allocation " << bufferId;
+    handle = &localHandles_.insert(bufferId, exportAllocation(basePtr));
+  }
+
+  return std::make_tuple(*handle, bufferId, offset);
+}
+
+IpcHandle ContextImpl::exportAllocation(CUdeviceptr basePtr) {
+  IpcHandle handle;
+#if TP_CUDA_IPC_MEM_POOLS
+  CUmemoryPool pool = nullptr;
+  TP_CUDA_DRIVER_CHECK(
+      cudaLib_,
+      cudaLib_.pointerGetAttribute(
+          &pool, CU_POINTER_ATTRIBUTE_MEMPOOL_HANDLE, basePtr));
+  if (pool != nullptr) {
+    const ExportedPool& exportedPool = exportPool(pool);
+    cudaMemPoolPtrExportData exportData;
+    TP_CUDA_CHECK(cudaMemPoolExportPointer(
+        &exportData, reinterpret_cast<void*>(basePtr)));
+    handle.ptrExportData = std::string(
+        reinterpret_cast<const char*>(&exportData), sizeof(exportData));
+    handle.poolId = exportedPool.id;
+    handle.poolFd = exportedPool.fd.fd();
+    return handle;
+  }
+#endif // TP_CUDA_IPC_MEM_POOLS
+  cudaIpcMemHandle_t ipcHandle;
+  TP_CUDA_CHECK(
+      cudaIpcGetMemHandle(&ipcHandle, reinterpret_cast<void*>(basePtr)));
+  handle.memHandle =
+      std::string(reinterpret_cast<const char*>(&ipcHandle), sizeof(ipcHandle));
+  return handle;
+}
+
+#if TP_CUDA_IPC_MEM_POOLS
+
+const ContextImpl::ExportedPool& ContextImpl::exportPool(cudaMemPool_t pool) {
+  auto iter = exportedPools_.find(pool);
+  if (iter == exportedPools_.end()) {
+    // This fails if the pool wasn't created with the POSIX file descriptor
+    // handle type, as is the case of the default pool of a device.
+    int fd;
+    TP_CUDA_CHECK(cudaMemPoolExportToShareableHandle(
+        &fd, pool, cudaMemHandleTypePosixFileDescriptor, 0));
+    TP_VLOG(5) << "Channel context " << id_ << " exported memory pool #"
+               << nextPoolId_ << " to file descriptor " << fd;
+    std::tie(iter, std::ignore) =
+        exportedPools_.emplace(pool, ExportedPool{nextPoolId_++, Fd(fd)});
+  }
+  return iter->second;
+}
+
+std::tuple<Error, cudaMemPool_t> ContextImpl::importPool(
+    const std::string& processIdentifier,
+    const IpcHandle& handle,
+    int deviceIdx) {
+  auto key = std::make_tuple(processIdentifier, handle.poolId);
+  auto iter = importedPools_.find(key);
+  if (iter == importedPools_.end()) {
+    TP_VLOG(5) << "Channel context " << id_ << " is importing memory pool #"
+               << handle.poolId << " of process " << processIdentifier;
+    Error error;
+    Fd fd;
+    std::tie(error, fd) =
+        duplicateFdOfProcess(processIdentifier, handle.poolFd);
+    if (error) {
+      return std::make_tuple(std::move(error), nullptr);
+    }
+    cudaMemPool_t pool;
+    TP_CUDA_CHECK(cudaMemPoolImportFromShareableHandle(
+        &pool,
+        reinterpret_cast<void*>(static_cast<intptr_t>(fd.fd())),
+        cudaMemHandleTypePosixFileDescriptor,
+        0));
+    std::tie(iter, std::ignore) =
+        importedPools_.emplace(std::move(key), ImportedPool{pool, {}});
+  }
+
+  // An imported pool isn't necessarily accessible from any device yet.
+  ImportedPool& importedPool = iter->second;
+  if (importedPool.accessibleDevices.count(deviceIdx) == 0) {
+    cudaMemLocation location;
+    std::memset(&location, 0, sizeof(location));
+    location.type = cudaMemLocationTypeDevice;
+    location.id = deviceIdx;
+    cudaMemAccessFlags flags;
+    TP_CUDA_CHECK(cudaMemPoolGetAccess(&flags, importedPool.pool, &location));
+    if (flags != cudaMemAccessFlagsProtReadWrite) {
+      cudaMemAccessDesc accessDesc;
+      std::memset(&accessDesc, 0, sizeof(accessDesc));
+      accessDesc.location = location;
+      accessDesc.flags = cudaMemAccessFlagsProtReadWrite;
+      TP_CUDA_CHECK(cudaMemPoolSetAccess(importedPool.pool, &accessDesc, 1));
+    }
+    importedPool.accessibleDevices.insert(deviceIdx);
+  }
+
+  return std::make_tuple(Error::kSuccess, importedPool.pool);
+}
+
+#endif // TP_CUDA_IPC_MEM_POOLS
+
+std::tuple<Error, void*> ContextImpl::openIpcHandle(
+    const std::string& processIdentifier,
+    uint64_t bufferId,
+    const IpcHandle& handle,
+    int deviceIdx) {
+  TP_DCHECK(inLoop());
+  auto key = std::make_tuple(processIdentifier, bufferId, deviceIdx);
+  CudaIpcMapping* mapping = remoteMappings_.find(key);
+  if (mapping == nullptr) {
+    TP_VLOG(5) << "Channel context " << id_
+               << " is opening IPC handle for allocation " << bufferId
+               << " of process " << processIdentifier;
+    CudaDeviceGuard guard(deviceIdx);
+    void* remotePtr;
+    const bool fromMemPool = !handle.ptrExportData.empty();
+    if (fromMemPool) {
+#if TP_CUDA_IPC_MEM_POOLS
+      Error error;
+      cudaMemPool_t pool;
+      std::tie(error, pool) = importPool(processIdentifier, handle, deviceIdx);
+      if (error) {
+        return std::make_tuple(std::move(error), nullptr);
+      }
+      cudaMemPoolPtrExportData exportData;
+      TP_DCHECK_EQ(handle.ptrExportData.size(), sizeof(exportData));
+      std::memcpy(&exportData, handle.ptrExportData.data(), sizeof(exportData));
+      TP_CUDA_CHECK(cudaMemPoolImportPointer(&remotePtr, pool, &exportData));
+#else // TP_CUDA_IPC_MEM_POOLS
+      TP_THROW_ASSERT() << "The peer shared an allocation of a memory pool, "
+                        << "which requires CUDA 11.3 or later";
+#endif // TP_CUDA_IPC_MEM_POOLS
+    } else {
+      cudaIpcMemHandle_t ipcHandle;
+      TP_DCHECK_EQ(handle.memHandle.size(), sizeof(ipcHandle));
+      std::memcpy(&ipcHandle, handle.memHandle.data(), sizeof(ipcHandle));
+      TP_CUDA_CHECK(cudaIpcOpenMemHandle(
+          &remotePtr, ipcHandle, cudaIpcMemLazyEnablePeerAccess));
+    }
+    size_t allocSize;
+    TP_CUDA_DRIVER_CHECK(
+        cudaLib_,
+        cudaLib_.memGetAddressRange(
+            nullptr, &allocSize, reinterpret_cast<CUdeviceptr>(remotePtr)));
+    mapping = &remoteMappings_.insert(
+        std::move(key),
+        CudaIpcMapping(
+            remotePtr,
+            CudaIpcMemHandleCloser{
+                deviceIdx,
+                MemoryCharge(
+                    getMemoryFootprintCounters(),
+                    MemoryKind::kDeviceMapped,
+                    allocSize),
+                fromMemPool}));
+  }
+
+  return std::make_tuple(Error::kSuccess, mapping->get());
+}
+
+void ContextImpl::closeImpl() {
+  remoteMappings_.clear();
+  localHandles_.clear();
+#if TP_CUDA_IPC_MEM_POOLS
+  // The imported allocations must be freed first.
+  for (auto& iter : importedPools_) {
+    TP_CUDA_CHECK(cudaMemPoolDestroy(iter.second.pool));
+  }
+  importedPools_.clear();
+  exportedPools_.clear();
+#endif // TP_CUDA_IPC_MEM_POOLS
+}
 
 void ContextImpl::joinImpl() {}
 
@@ -118,7 +465,7 @@ bool ContextImpl::inLoop() {
   return loop_.inLoop();
 };
 
-void ContextImpl::deferToLoop(std::function<void()> fn) {
+void ContextImpl::deferToLoop(TTask fn) {
   loop_.deferToLoop(std::move(fn));
 };
 
@@ -8,11 +8,37 @@
 
 #pragma once
 
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+
 #include <tensorpipe/channel/context_impl_boilerplate.h>
 #include <tensorpipe/channel/cuda_context.h>
+#include <tensorpipe/channel/cuda_ipc/context.h>
+#include <tensorpipe/channel/cuda_copy_timer.h>
+#include <tensorpipe/common/cuda.h>
 #include <tensorpipe/common/cuda_buffer.h>
+#include <tensorpipe/common/cuda_copy_streams.h>
 #include <tensorpipe/common/cuda_lib.h>
 #include <tensorpipe/common/deferred_executor.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/fd.h>
+#include <tensorpipe/common/lru_cache.h>
+#include <tensorpipe/common/memory_footprint.h>
+
+// Allocations made from memory pools (e.g., by cudaMallocAsync) can be shared
+// since CUDA 11.2, and their pool looked up since CUDA 11.3.
+#if (CUDART_VERSION >= 11030)
+#define TP_CUDA_IPC_MEM_POOLS 1
+#else
+#define TP_CUDA_IPC_MEM_POOLS 0
+#endif
 
 namespace tensorpipe {
 namespace channel {
@@ -20,10 +46,44 @@ namespace cuda_ipc {
 
 class ChannelImpl;
 
+// How the peer can map an allocation of this process. Those made by cudaMalloc
+// have a legacy IPC handle, which cudaIpcGetMemHandle doesn't support for those
+// made from a memory pool. The latter are exported as pointers into their pool
+// instead, which the peer must import first, once, by duplicating the file
+// descriptor that this process exported the pool to (see pidfd_getfd(2)).
+struct IpcHandle {
+  std::string memHandle;
+  std::string ptrExportData;
+  uint64_t poolId{0};
+  int poolFd{-1};
+};
+
+struct CudaIpcMemHandleCloser {
+  void operator()(void* ptr) {
+    CudaDeviceGuard guard(deviceIdx);
+    if (fromMemPool) {
+      TP_CUDA_CHECK(cudaFree(ptr));
+    } else {
+      TP_CUDA_CHECK(cudaIpcCloseMemHandle(ptr));
+    }
+  }
+
+  int deviceIdx;
+  // Accounts for the mapped allocation for as long as it stays open.
+  MemoryCharge charge;
+  // Whether the allocation was imported from a memory pool of the peer.
+  bool fromMemPool{false};
+};
+
+using CudaIpcMapping = std::unique_ptr<void, CudaIpcMemHandleCloser>;
+
 class ContextImpl final
     : public ContextImplBoilerplate<CudaBuffer, ContextImpl, ChannelImpl> {
  public:
-  ContextImpl();
+  ContextImpl(
+      bool useDedicatedCopyStreams,
+      size_t numSplitStreams,
+      CopyDirection copyDirection);
 
   std::shared_ptr<CudaChannel> createChannel(
       std::shared_ptr<transport::Connection> connection,
@@ -33,9 +93,53 @@ class ContextImpl final
 
   const CudaLib& getCudaLib();
 
+  // The stream on which to copy from or to a buffer of the given device, whose
+  // user has provided the given stream.
+  cudaStream_t getCopyStream(int deviceIdx, cudaStream_t userStream);
+
+  // Enqueue a copy between two buffers in device memory on the given stream,
+  // of the given device, or split across several streams if it's large (see
+  // CudaCopyStreams::copy).
+  void copy(
+      CudaEventPool& eventPool,
+      void* dst,
+      const void* src,
+      size_t length,
+      cudaStream_t stream,
+      int deviceIdx);
+
+  // Whether the receiver of a tensor should have the sender push it, rather
+  // than pull it itself on the given stream (see CopyDirection).
+  bool shouldPush(cudaStream_t copyStream);
+
+  // An identifier for this process, which remote peers use to tell apart the
+  // allocations of different processes in their caches.
+  const std::string& getProcessIdentifier();
+
+  // Return the IPC handle of the allocation that contains the given pointer,
+  // the unique ID of that allocation and the offset of the pointer within it.
+  std::tuple<IpcHandle, uint64_t, size_t> getIpcHandle(
+      int deviceIdx,
+      const void* ptr);
+
+  // Return the local address at which a remote allocation is mapped, mapping
+  // it if this hasn't been done already. This fails if the memory pool of the
+  // allocation can't be imported from the peer's process.
+  std::tuple<Error, void*> openIpcHandle(
+      const std::string& processIdentifier,
+      uint64_t bufferId,
+      const IpcHandle& handle,
+      int deviceIdx);
+
+  void enableChannelStats();
+
+  ChannelStats getChannelStats();
+
+  CudaCopyTimer& getCopyTimer();
+
   // Implement the DeferredExecutor interface.
   bool inLoop() override;
-  void deferToLoop(std::function<void()> fn) override;
+  void deferToLoop(TTask fn) override;
 
  protected:
   // Implement the entry points called by ContextImplBoilerplate.
@@ -47,6 +151,54 @@ class ContextImpl final
 
   bool foundCudaLib_{false};
   CudaLib cudaLib_;
+
+  CudaCopyTimer copyTimer_;
+
+  CudaCopyStreams copyStreams_;
+
+  const CopyDirection copyDirection_;
+
+  const std::string processIdentifier_;
+
+  // Obtaining an IPC handle and, even more so, opening one, are expensive
+  // operations, whereas the caching allocators typically used by the frameworks
+  // keep reusing the same few allocations. Hence we cache the handles of local
+  // allocations, and keep the remote ones mapped. Both are indexed by the CUDA
+  // driver's buffer ID, which is unique (within a process) and never reused.
+  // The mappings of remote allocations keep those alive even after they are
+  // freed by their owner, thus they are evicted once too many are open.
+  LruCache<uint64_t, IpcHandle> localHandles_;
+  LruCache<std::tuple<std::string, uint64_t, int>, CudaIpcMapping>
+      remoteMappings_;
+
+#if TP_CUDA_IPC_MEM_POOLS
+  // The memory pools of this process that allocations were exported from, each
+  // with the file descriptor it was exported to, which stays open for the peers
+  // to duplicate, and with an ID that tells it apart for them.
+  struct ExportedPool {
+    uint64_t id;
+    Fd fd;
+  };
+  std::unordered_map<cudaMemPool_t, ExportedPool> exportedPools_;
+  uint64_t nextPoolId_{0};
+
+  // The memory pools of remote processes that have been imported, by process
+  // identifier and pool ID, with the devices that were given access to them.
+  // They're only destroyed once the allocations imported from them are freed.
+  struct ImportedPool {
+    cudaMemPool_t pool;
+    std::set<int> accessibleDevices;
+  };
+  std::map<std::tuple<std::string, uint64_t>, ImportedPool> importedPools_;
+
+  const ExportedPool& exportPool(cudaMemPool_t pool);
+  std::tuple<Error, cudaMemPool_t> importPool(
+      const std::string& processIdentifier,
+      const IpcHandle& handle,
+      int deviceIdx);
+#endif // TP_CUDA_IPC_MEM_POOLS
+
+  IpcHandle exportAllocation(CUdeviceptr basePtr);
 };
 
 } // namespace cuda_ipc
@@ -10,15 +10,18 @@
 
 #include <memory>
 #include <string>
+#include <tuple>
 #include <utility>
 
 #include <cuda_runtime.h>
 #include <nop/serializer.h>
 #include <nop/structure.h>
 
+#include <tensorpipe/channel/cuda_copy_timer.h>
 #include <tensorpipe/channel/cuda_xth/context_impl.h>
 #include <tensorpipe/channel/helpers.h>
 #include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/cuda_copy_streams.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
 #include <tensorpipe/transport/connection.h>
@@ -31,31 +34,104 @@ namespace {
 
 class SendOperation {
  public:
-  explicit SendOperation(int deviceIdx, CudaBuffer buffer)
-      : buffer_(buffer), deviceIdx_(deviceIdx), startEv_(deviceIdx) {
+  SendOperation(
+      int deviceIdx,
+      CudaBuffer buffer,
+      CudaEvent& startEv,
+      size_t startEvIdx)
+      : buffer_(buffer),
+        deviceIdx_(deviceIdx),
+        startEv_(startEv),
+        startEvIdx_(startEvIdx) {
     startEv_.record(buffer_.stream);
   }
 
-  void process(int dstDeviceIdx, CudaBuffer dstBuffer) {
-    startEv_.wait(dstBuffer.stream, dstDeviceIdx);
+  // This is called by the receiving channel, which may run on another loop,
+  // hence the events it needs come from the receiver's pool, and the relay (if
+  // any) is done by the receiver's context.
+  void process(
+      int dstDeviceIdx,
+      CudaBuffer dstBuffer,
+      cudaStream_t copyStream,
+      CudaEventPool& eventPool,
+      ContextImpl& context) {
+    CudaCopyTimer& copyTimer = context.getCopyTimer();
+    const size_t sampleIdx = copyTimer.begin(dstDeviceIdx);
+    // With a single stream on both ends, its order alone has the copy start
+    // after what the sender enqueued before it, and end before what either
+    // side enqueues next, hence no event needs to be waited on or recorded.
+    // (The start event was still recorded, as the sender couldn't tell.)
+    const bool sameStream = isOnStream(dstDeviceIdx, copyStream) &&
+        dstBuffer.stream == copyStream;
+    cudaStreamWaitForStream(
+        eventPool, copyStream, dstDeviceIdx, dstBuffer.stream, dstDeviceIdx);
 
     TP_DCHECK_EQ(buffer_.length, dstBuffer.length);
-    TP_CUDA_CHECK(cudaMemcpyAsync(
-        dstBuffer.ptr,
-        buffer_.ptr,
-        dstBuffer.length,
-        cudaMemcpyDeviceToDevice,
-        dstBuffer.stream));
-
-    CudaEvent stopEv(dstDeviceIdx);
-    stopEv.record(dstBuffer.stream);
+    const int relayDeviceIdx = context.getRelayDevice(dstDeviceIdx, deviceIdx_);
+    if (relayDeviceIdx >= 0) {
+      // The relayed copies aren't timed, as they're pipelined in chunks across
+      // two devices, hence they don't start or end at a single point.
+      context.relayCopy(
+          dstBuffer.ptr,
+          dstDeviceIdx,
+          copyStream,
+          buffer_.ptr,
+          deviceIdx_,
+          startEv_,
+          dstBuffer.length,
+          relayDeviceIdx);
+    } else {
+      // The copy is enqueued on (a stream of) the receiving device, which thus
+      // needs to access the sender's memory.
+      context.enablePeerAccess(dstDeviceIdx, deviceIdx_);
+      if (!sameStream) {
+        startEv_.wait(copyStream, dstDeviceIdx);
+      }
+      copyTimer.markReady(sampleIdx, copyStream);
+      context.copy(
+          eventPool,
+          dstBuffer.ptr,
+          buffer_.ptr,
+          dstBuffer.length,
+          copyStream,
+          dstDeviceIdx);
+      copyTimer.markCopied(sampleIdx, copyStream);
+    }
+    copyTimer.end(sampleIdx);
+
+    if (sameStream) {
+      return;
+    }
+    size_t stopEvIdx;
+    std::tie(stopEvIdx, std::ignore) = eventPool.acquire(dstDeviceIdx);
+    CudaEvent& stopEv = eventPool.get(dstDeviceIdx, stopEvIdx);
+    stopEv.record(copyStream);
     stopEv.wait(buffer_.stream, deviceIdx_);
+    if (copyStream != dstBuffer.stream) {
+      stopEv.wait(dstBuffer.stream, dstDeviceIdx);
+    }
+    // Both streams have already been made to wait on the stop event.
+    eventPool.release(dstDeviceIdx, stopEvIdx);
+  }
+
+  int deviceIdx() const {
+    return deviceIdx_;
+  }
+
+  // Whether the buffer is on the given stream, of the given device.
+  bool isOnStream(int deviceIdx, cudaStream_t stream) const {
+    return deviceIdx_ == deviceIdx && buffer_.stream == stream;
+  }
+
+  size_t startEvIdx() const {
+    return startEvIdx_;
   }
 
  private:
   const CudaBuffer buffer_;
   const int deviceIdx_;
-  CudaEvent startEv_;
+  CudaEvent& startEv_;
+  const size_t startEvIdx_;
 };
 
 struct Descriptor {
@@ -87,8 +163,12 @@ void ChannelImpl::sendImplFromLoop(
     TSendCallback callback) {
   int deviceIdx = cudaDeviceForPointer(context_->getCudaLib(), buffer.ptr);
 
+  size_t startEvIdx;
+  std::tie(startEvIdx, std::ignore) = eventPool_.acquire(deviceIdx);
+
   // The op must be kept alive until the notification has been received.
-  auto op = std::make_shared<SendOperation>(deviceIdx, buffer);
+  auto op = std::make_shared<SendOperation>(
+      deviceIdx, buffer, eventPool_.get(deviceIdx, startEvIdx), startEvIdx);
   NopHolder<Descriptor> nopHolder;
   Descriptor& nopDescriptor = nopHolder.getObject();
   nopDescriptor.opPtr = reinterpret_cast<uintptr_t>(op.get());
@@ -106,6 +186,8 @@ void ChannelImpl::sendImplFromLoop(
             TP_VLOG(6) << "Channel " << impl.id_
                        << " done reading notification (#" << sequenceNumber
                        << ")";
+            // The peer has enqueued its wait on the start event by now.
+            impl.eventPool_.release(op->deviceIdx(), op->startEvIdx());
             callback(impl.error_);
           }));
 
@@ -124,9 +206,15 @@ void ChannelImpl::recvImplFromLoop(
   Descriptor& nopDescriptor = nopHolder.getObject();
   SendOperation* op = reinterpret_cast<SendOperation*>(nopDescriptor.opPtr);
 
+  // If both buffers are on the same stream, the copy goes on it rather than on
+  // a dedicated stream, as it couldn't overlap with the user's work anyway,
+  // and it then needs no events (see SendOperation::process).
+  cudaStream_t copyStream = op->isOnStream(deviceIdx, buffer.stream)
+      ? buffer.stream
+      : context_->getCopyStream(deviceIdx, buffer.stream);
   TP_VLOG(6) << "Channel " << id_ << " is copying payload (#" << sequenceNumber
              << ")";
-  op->process(deviceIdx, buffer);
+  op->process(deviceIdx, buffer, copyStream, eventPool_, *context_);
   TP_VLOG(6) << "Channel " << id_ << " done copying payload (#"
              << sequenceNumber << ")";
 
@@ -13,6 +13,7 @@
 
 #include <tensorpipe/channel/channel_impl_boilerplate.h>
 #include <tensorpipe/common/cuda_buffer.h>
+#include <tensorpipe/common/cuda_event_pool.h>
 #include <tensorpipe/transport/context.h>
 
 namespace tensorpipe {
@@ -47,6 +48,12 @@ class ChannelImpl final
 
  private:
   const std::shared_ptr<transport::Connection> connection_;
+
+  // The events that this channel records, both for its outgoing buffers (which
+  // the peer waits on before copying) and for incoming copies (which the peer's
+  // stream waits on before reusing its buffer, and which order the copy stream
+  // against the user's one).
+  CudaEventPool eventPool_;
 };
 
 } // namespace cuda_xth
@@ -19,7 +19,14 @@ namespace tensorpipe {
 namespace channel {
 namespace cuda_xth {
 
-Context::Context() : impl_(std::make_shared<ContextImpl>()) {}
+Context::Context(
+    bool useDedicatedCopyStreams,
+    bool relayThroughPeers,
+    size_t numSplitStreams)
+    : impl_(std::make_shared<ContextImpl>(
+          useDedicatedCopyStreams,
+          relayThroughPeers,
+          numSplitStreams)) {}
 
 // Explicitly define all methods of the context, which just forward to the impl.
 // We cannot use an intermediate ContextBoilerplate class without forcing a
@@ -39,10 +46,22 @@ bool Context::isViable() const {
   return impl_->isViable();
 }
 
+bool Context::supportsManagedMemory() const {
+  return true;
+}
+
 void Context::setId(std::string id) {
   impl_->setId(std::move(id));
 }
 
+void Context::enableChannelStats() {
+  impl_->enableChannelStats();
+}
+
+ChannelStats Context::getChannelStats() {
+  return impl_->getChannelStats();
+}
+
 void Context::close() {
   impl_->close();
 }
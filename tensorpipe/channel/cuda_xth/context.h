@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <memory>
 #include <string>
 
@@ -22,7 +23,23 @@ class ContextImpl;
 
 class Context : public CudaContext {
  public:
-  Context();
+  // Copies are enqueued on high-priority streams owned by the context, one per
+  // device, which are ordered against the user's streams by means of events.
+  // Pass false to enqueue them directly on the user's streams instead.
+  //
+  // If relayThroughPeers is set, copies between devices that can't access each
+  // other's memory directly (which the driver would stage through the host) are
+  // relayed through an intermediate device that has peer-to-peer links (e.g.,
+  // NVLink) to both, in pipelined chunks, according to the topology found when
+  // the context is created.
+  //
+  // With numSplitStreams above one, the direct copies of large tensors are
+  // split in up to that many slices, on as many more streams of the receiving
+  // device, so that they use several of its copy engines at once.
+  explicit Context(
+      bool useDedicatedCopyStreams = true,
+      bool relayThroughPeers = false,
+      size_t numSplitStreams = 1);
 
   Context(const Context&) = delete;
   Context(Context&&) = delete;
@@ -37,8 +54,14 @@ class Context : public CudaContext {
 
   bool isViable() const override;
 
+  bool supportsManagedMemory() const override;
+
   void setId(std::string id) override;
 
+  void enableChannelStats() override;
+
+  ChannelStats getChannelStats() override;
+
   void close() override;
 
   void join() override;
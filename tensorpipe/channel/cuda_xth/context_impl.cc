@@ -10,6 +10,7 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <functional>
 #include <sstream>
 #include <string>
@@ -27,24 +28,141 @@ namespace cuda_xth {
 
 namespace {
 
-std::string generateDomainDescriptor() {
+// The size of the chunks into which relayed copies are split.
+constexpr size_t kRelayChunkSize = 4 * 1024 * 1024;
+
+PeerTopology discoverPeerTopology() {
+  int deviceCount;
+  if (cudaGetDeviceCount(&deviceCount) != cudaSuccess) {
+    // Clear the error, as the context will be reported as not viable anyway.
+    cudaGetLastError();
+    return PeerTopology();
+  }
+  PeerTopology topology(deviceCount, std::vector<int>(deviceCount, -1));
+  for (int deviceIdx = 0; deviceIdx < deviceCount; deviceIdx++) {
+    for (int peerDeviceIdx = 0; peerDeviceIdx < deviceCount; peerDeviceIdx++) {
+      if (deviceIdx == peerDeviceIdx) {
+        continue;
+      }
+      int canAccessPeer;
+      TP_CUDA_CHECK(
+          cudaDeviceCanAccessPeer(&canAccessPeer, deviceIdx, peerDeviceIdx));
+      if (!canAccessPeer) {
+        continue;
+      }
+      TP_CUDA_CHECK(cudaDeviceGetP2PAttribute(
+          &topology[deviceIdx][peerDeviceIdx],
+          cudaDevP2PAttrPerformanceRank,
+          deviceIdx,
+          peerDeviceIdx));
+    }
+  }
+  return topology;
+}
+
+// The devices, and their links, don't change during the life of the process,
+// whereas discovering them takes a few calls per pair of devices (and the first
+// of them initializes the CUDA runtime), hence it's only done once.
+const PeerTopology& getPeerTopology() {
+  static const PeerTopology topology = discoverPeerTopology();
+  return topology;
+}
+
+// Unified addressing is required for cross-device `cudaMemcpyAsync()`. We could
+// lift this requirement by adding a fallback to `cudaMemcpyPeerAsync()`. Return
+// the first device without it, if any, or -1.
+int findDeviceWithoutUnifiedAddressing() {
+  int deviceCount;
+  TP_CUDA_CHECK(cudaGetDeviceCount(&deviceCount));
+  for (int i = 0; i < deviceCount; ++i) {
+    cudaDeviceProp props;
+    TP_CUDA_CHECK(cudaGetDeviceProperties(&props, i));
+    if (!props.unifiedAddressing) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Describe which pairs of devices can access each other's memory directly, and
+// their relative performance rank (as reported by the driver, where lower is
+// faster, e.g., for NVLink), as copies between the others are staged through
+// host memory and are much slower.
+std::string generatePeerAccessDescriptor(const PeerTopology& topology) {
+  std::ostringstream oss;
+  const int numDevices = topology.size();
+  for (int deviceIdx = 0; deviceIdx < numDevices; deviceIdx++) {
+    for (int peerDeviceIdx = 0; peerDeviceIdx < numDevices; peerDeviceIdx++) {
+      const int performanceRank = topology[deviceIdx][peerDeviceIdx];
+      if (performanceRank >= 0) {
+        oss << "_" << deviceIdx << ">" << peerDeviceIdx << ":"
+            << performanceRank;
+      }
+    }
+  }
+  return oss.str();
+}
+
+std::string generateDomainDescriptor(const PeerTopology& topology) {
   std::ostringstream oss;
   auto bootID = getBootID();
   TP_THROW_ASSERT_IF(!bootID) << "Unable to read boot_id";
 
   pid_t pid = getpid();
 
-  // Combine boot ID and PID.
-  oss << bootID.value() << "-" << pid;
+  // Combine boot ID and PID, and the peer-to-peer capabilities of the devices.
+  oss << bootID.value() << "-" << pid << "-p2p"
+      << generatePeerAccessDescriptor(topology);
 
   return oss.str();
 }
 
 } // namespace
 
-ContextImpl::ContextImpl()
+RelayBuffers::RelayBuffers(
+    int relayDeviceIdx,
+    int dstDeviceIdx,
+    size_t chunkSize)
+    : relayDeviceIdx(relayDeviceIdx) {
+  CudaDeviceGuard guard(relayDeviceIdx);
+  for (size_t bufferIdx = 0; bufferIdx < kNumBuffers; bufferIdx++) {
+    TP_CUDA_CHECK(cudaMalloc(&ptrs[bufferIdx], chunkSize));
+    filledEvs[bufferIdx] = std::make_unique<CudaEvent>(relayDeviceIdx);
+    drainedEvs[bufferIdx] = std::make_unique<CudaEvent>(dstDeviceIdx);
+  }
+}
+
+RelayBuffers::~RelayBuffers() {
+  // The buffers can only be freed once the copies that use them are done.
+  for (size_t bufferIdx = 0; bufferIdx < kNumBuffers; bufferIdx++) {
+    drainedEvs[bufferIdx]->synchronize();
+  }
+  CudaDeviceGuard guard(relayDeviceIdx);
+  for (size_t bufferIdx = 0; bufferIdx < kNumBuffers; bufferIdx++) {
+    TP_CUDA_CHECK(cudaFree(ptrs[bufferIdx]));
+  }
+}
+
+ContextImpl::ContextImpl(
+    bool useDedicatedCopyStreams,
+    bool relayThroughPeers,
+    size_t numSplitStreams)
+    : ContextImpl(
+          getPeerTopology(),
+          useDedicatedCopyStreams,
+          relayThroughPeers,
+          numSplitStreams) {}
+
+ContextImpl::ContextImpl(
+    PeerTopology topology,
+    bool useDedicatedCopyStreams,
+    bool relayThroughPeers,
+    size_t numSplitStreams)
     : ContextImplBoilerplate<CudaBuffer, ContextImpl, ChannelImpl>(
-          generateDomainDescriptor()) {
+          generateDomainDescriptor(topology)),
+      copyStreams_(useDedicatedCopyStreams, numSplitStreams),
+      topology_(std::move(topology)),
+      relayThroughPeers_(relayThroughPeers) {
   Error error;
   std::tie(error, cudaLib_) = CudaLib::create();
   if (error) {
@@ -67,21 +185,16 @@ bool ContextImpl::isViable() const {
     return false;
   }
 
-  int deviceCount;
-  TP_CUDA_CHECK(cudaGetDeviceCount(&deviceCount));
-  for (int i = 0; i < deviceCount; ++i) {
-    cudaDeviceProp props;
-    TP_CUDA_CHECK(cudaGetDeviceProperties(&props, i));
-
-    // Unified addressing is required for cross-device `cudaMemcpyAsync()`. We
-    // could lift this requirement by adding a fallback to
-    // `cudaMemcpyPeerAsync()`.
-    if (!props.unifiedAddressing) {
-      TP_VLOG(4) << "Channel context " << id_
-                 << " is not viable because CUDA device " << i
-                 << " does not have unified addressing";
-      return false;
-    }
+  // Looked up once per process, as querying the properties of each device is
+  // slow.
+  static const int deviceWithoutUnifiedAddressing =
+      findDeviceWithoutUnifiedAddressing();
+  if (deviceWithoutUnifiedAddressing >= 0) {
+    TP_VLOG(4) << "Channel context " << id_
+               << " is not viable because CUDA device "
+               << deviceWithoutUnifiedAddressing
+               << " does not have unified addressing";
+    return false;
   }
 
   return true;
@@ -91,6 +204,144 @@ const CudaLib& ContextImpl::getCudaLib() {
   return cudaLib_;
 }
 
+void ContextImpl::enableChannelStats() {
+  copyTimer_.enable();
+}
+
+ChannelStats ContextImpl::getChannelStats() {
+  return copyTimer_.getStats();
+}
+
+CudaCopyTimer& ContextImpl::getCopyTimer() {
+  return copyTimer_;
+}
+
+cudaStream_t ContextImpl::getCopyStream(
+    int deviceIdx,
+    cudaStream_t userStream) {
+  TP_DCHECK(inLoop());
+  return copyStreams_.get(deviceIdx, userStream);
+}
+
+void ContextImpl::copy(
+    CudaEventPool& eventPool,
+    void* dst,
+    const void* src,
+    size_t length,
+    cudaStream_t stream,
+    int deviceIdx) {
+  TP_DCHECK(inLoop());
+  copyStreams_.copy(eventPool, dst, src, length, stream, deviceIdx);
+}
+
+void ContextImpl::enablePeerAccess(int deviceIdx, int peerDeviceIdx) {
+  TP_DCHECK(inLoop());
+  if (deviceIdx == peerDeviceIdx ||
+      !peerAccessChecked_.emplace(deviceIdx, peerDeviceIdx).second) {
+    return;
+  }
+
+  int canAccessPeer;
+  TP_CUDA_CHECK(
+      cudaDeviceCanAccessPeer(&canAccessPeer, deviceIdx, peerDeviceIdx));
+  if (!canAccessPeer) {
+    TP_VLOG(5) << "Channel context " << id_ << " found that CUDA device "
+               << deviceIdx << " cannot access the memory of CUDA device "
+               << peerDeviceIdx << ", copies will be staged through the host";
+    return;
+  }
+
+  CudaDeviceGuard guard(deviceIdx);
+  const cudaError_t error = cudaDeviceEnablePeerAccess(peerDeviceIdx, 0);
+  if (error == cudaErrorPeerAccessAlreadyEnabled) {
+    // Someone else in this process (e.g., another context or the user) already
+    // did it. Clear the error so that it isn't picked up by later calls.
+    cudaGetLastError();
+    return;
+  }
+  TP_CUDA_CHECK(error);
+  TP_VLOG(5) << "Channel context " << id_ << " enabled access by CUDA device "
+             << deviceIdx << " to the memory of CUDA device " << peerDeviceIdx;
+}
+
+int ContextImpl::getRelayDevice(int dstDeviceIdx, int srcDeviceIdx) {
+  TP_DCHECK(inLoop());
+  const int numDevices = topology_.size();
+  TP_DCHECK_LT(dstDeviceIdx, numDevices);
+  TP_DCHECK_LT(srcDeviceIdx, numDevices);
+  if (!relayThroughPeers_ || dstDeviceIdx == srcDeviceIdx ||
+      topology_[dstDeviceIdx][srcDeviceIdx] >= 0) {
+    return -1;
+  }
+
+  int bestRelayDeviceIdx = -1;
+  int bestPerformanceRank = 0;
+  for (int relayDeviceIdx = 0; relayDeviceIdx < numDevices; relayDeviceIdx++) {
+    const int inRank = topology_[relayDeviceIdx][srcDeviceIdx];
+    const int outRank = topology_[dstDeviceIdx][relayDeviceIdx];
+    if (inRank < 0 || outRank < 0) {
+      continue;
+    }
+    // A relayed chunk goes through both links, but they're pipelined, hence
+    // the slowest of the two determines the throughput.
+    const int performanceRank = std::max(inRank, outRank);
+    if (bestRelayDeviceIdx < 0 || performanceRank < bestPerformanceRank) {
+      bestRelayDeviceIdx = relayDeviceIdx;
+      bestPerformanceRank = performanceRank;
+    }
+  }
+  return bestRelayDeviceIdx;
+}
+
+void ContextImpl::relayCopy(
+    void* dstPtr,
+    int dstDeviceIdx,
+    cudaStream_t dstStream,
+    const void* srcPtr,
+    int srcDeviceIdx,
+    CudaEvent& srcReadyEv,
+    size_t length,
+    int relayDeviceIdx) {
+  TP_DCHECK(inLoop());
+  enablePeerAccess(relayDeviceIdx, srcDeviceIdx);
+  enablePeerAccess(dstDeviceIdx, relayDeviceIdx);
+
+  std::unique_ptr<RelayBuffers>& buffers =
+      relayBuffers_[std::make_pair(relayDeviceIdx, dstDeviceIdx)];
+  if (buffers == nullptr) {
+    buffers = std::make_unique<RelayBuffers>(
+        relayDeviceIdx, dstDeviceIdx, kRelayChunkSize);
+  }
+  cudaStream_t relayStream = relayStreams_.get(relayDeviceIdx, nullptr);
+
+  srcReadyEv.wait(relayStream, relayDeviceIdx);
+  for (size_t offset = 0; offset < length; offset += kRelayChunkSize) {
+    const size_t chunkLength = std::min(kRelayChunkSize, length - offset);
+    const size_t bufferIdx = buffers->nextBufferIdx;
+    buffers->nextBufferIdx = (bufferIdx + 1) % RelayBuffers::kNumBuffers;
+
+    // Wait for the previous chunk that used this buffer, possibly of another
+    // copy, to have been copied out of it.
+    buffers->drainedEvs[bufferIdx]->wait(relayStream, relayDeviceIdx);
+    TP_CUDA_CHECK(cudaMemcpyAsync(
+        buffers->ptrs[bufferIdx],
+        static_cast<const uint8_t*>(srcPtr) + offset,
+        chunkLength,
+        cudaMemcpyDeviceToDevice,
+        relayStream));
+    buffers->filledEvs[bufferIdx]->record(relayStream);
+
+    buffers->filledEvs[bufferIdx]->wait(dstStream, dstDeviceIdx);
+    TP_CUDA_CHECK(cudaMemcpyAsync(
+        static_cast<uint8_t*>(dstPtr) + offset,
+        buffers->ptrs[bufferIdx],
+        chunkLength,
+        cudaMemcpyDeviceToDevice,
+        dstStream));
+    buffers->drainedEvs[bufferIdx]->record(dstStream);
+  }
+}
+
 void ContextImpl::closeImpl() {}
 
 void ContextImpl::joinImpl() {}
@@ -99,7 +350,7 @@ bool ContextImpl::inLoop() {
   return loop_.inLoop();
 };
 
-void ContextImpl::deferToLoop(std::function<void()> fn) {
+void ContextImpl::deferToLoop(TTask fn) {
   loop_.deferToLoop(std::move(fn));
 };
 
@@ -8,9 +8,19 @@
 
 #pragma once
 
+#include <array>
+#include <map>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+
 #include <tensorpipe/channel/context_impl_boilerplate.h>
 #include <tensorpipe/channel/cuda_context.h>
+#include <tensorpipe/channel/cuda_copy_timer.h>
+#include <tensorpipe/common/cuda.h>
 #include <tensorpipe/common/cuda_buffer.h>
+#include <tensorpipe/common/cuda_copy_streams.h>
 #include <tensorpipe/common/cuda_lib.h>
 #include <tensorpipe/common/deferred_executor.h>
 
@@ -20,10 +30,42 @@ namespace cuda_xth {
 
 class ChannelImpl;
 
+// The peer-to-peer links between the devices, as found when the context is
+// created: the entry (i, j) is the performance rank (the lower the faster) of
+// the access by device i to the memory of device j, or -1 if it can't access it
+// directly.
+using PeerTopology = std::vector<std::vector<int>>;
+
+// The staging buffers on an intermediate device through which copies towards a
+// given device are relayed. They're used alternately by consecutive chunks, so
+// that a chunk can be copied into the intermediate device while the previous
+// one is being copied out of it.
+struct RelayBuffers {
+  static constexpr size_t kNumBuffers = 2;
+
+  RelayBuffers(int relayDeviceIdx, int dstDeviceIdx, size_t chunkSize);
+
+  RelayBuffers(const RelayBuffers&) = delete;
+  RelayBuffers& operator=(const RelayBuffers&) = delete;
+
+  ~RelayBuffers();
+
+  const int relayDeviceIdx;
+  std::array<void*, kNumBuffers> ptrs;
+  // Recorded on the relay device once a chunk has been copied in, and on the
+  // destination device once it has been copied out.
+  std::array<std::unique_ptr<CudaEvent>, kNumBuffers> filledEvs;
+  std::array<std::unique_ptr<CudaEvent>, kNumBuffers> drainedEvs;
+  size_t nextBufferIdx{0};
+};
+
 class ContextImpl final
     : public ContextImplBoilerplate<CudaBuffer, ContextImpl, ChannelImpl> {
  public:
-  ContextImpl();
+  ContextImpl(
+      bool useDedicatedCopyStreams,
+      bool relayThroughPeers,
+      size_t numSplitStreams);
 
   std::shared_ptr<CudaChannel> createChannel(
       std::shared_ptr<transport::Connection> connection,
@@ -33,9 +75,55 @@ class ContextImpl final
 
   const CudaLib& getCudaLib();
 
+  // The stream on which to copy from or to a buffer of the given device, whose
+  // user has provided the given stream.
+  cudaStream_t getCopyStream(int deviceIdx, cudaStream_t userStream);
+
+  // Enqueue a copy between two buffers in device memory on the given stream,
+  // of the given device, or split across several streams if it's large (see
+  // CudaCopyStreams::copy).
+  void copy(
+      CudaEventPool& eventPool,
+      void* dst,
+      const void* src,
+      size_t length,
+      cudaStream_t stream,
+      int deviceIdx);
+
+  // Allow kernels and copies on the first device to access the memory of the
+  // second one, if the hardware supports it, so that copies between the two
+  // don't get staged through host memory by the driver.
+  void enablePeerAccess(int deviceIdx, int peerDeviceIdx);
+
+  // If relaying is enabled and the first device can't access the memory of the
+  // second one directly, return a device which is linked to both (preferring
+  // the fastest links), through which copies should be relayed. Otherwise, or
+  // if there is none, return -1.
+  int getRelayDevice(int dstDeviceIdx, int srcDeviceIdx);
+
+  // Enqueue a copy through the given intermediate device, in chunks which are
+  // pipelined across a stream of that device and the destination stream. It
+  // starts once srcReadyEv is done, and anything enqueued on dstStream later on
+  // is ordered after it.
+  void relayCopy(
+      void* dstPtr,
+      int dstDeviceIdx,
+      cudaStream_t dstStream,
+      const void* srcPtr,
+      int srcDeviceIdx,
+      CudaEvent& srcReadyEv,
+      size_t length,
+      int relayDeviceIdx);
+
+  void enableChannelStats();
+
+  ChannelStats getChannelStats();
+
+  CudaCopyTimer& getCopyTimer();
+
   // Implement the DeferredExecutor interface.
   bool inLoop() override;
-  void deferToLoop(std::function<void()> fn) override;
+  void deferToLoop(TTask fn) override;
 
  protected:
   // Implement the entry points called by ContextImplBoilerplate.
@@ -43,10 +131,31 @@ class ContextImpl final
   void joinImpl() override;
 
  private:
+  ContextImpl(
+      PeerTopology topology,
+      bool useDedicatedCopyStreams,
+      bool relayThroughPeers,
+      size_t numSplitStreams);
+
   OnDemandDeferredExecutor loop_;
 
   bool foundCudaLib_{false};
   CudaLib cudaLib_;
+
+  CudaCopyTimer copyTimer_;
+
+  CudaCopyStreams copyStreams_;
+
+  // The pairs of devices for which enablePeerAccess was already called.
+  std::set<std::pair<int, int>> peerAccessChecked_;
+
+  const PeerTopology topology_;
+  const bool relayThroughPeers_;
+
+  // The streams of the intermediate devices, which are always dedicated ones,
+  // and their staging buffers, indexed by intermediate and destination device.
+  CudaCopyStreams relayStreams_{/*enabled=*/true};
+  std::map<std::pair<int, int>, std::unique_ptr<RelayBuffers>> relayBuffers_;
 };
 
 } // namespace cuda_xth
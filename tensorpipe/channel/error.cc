@@ -22,5 +22,13 @@ std::string ChannelClosedError::what() const {
   return "channel closed";
 }
 
+std::string PeerLaneFailureError::what() const {
+  return "lane failed on the remote end";
+}
+
+std::string IbvError::what() const {
+  return error_;
+}
+
 } // namespace channel
 } // namespace tensorpipe
@@ -9,6 +9,7 @@
 #pragma once
 
 #include <string>
+#include <utility>
 
 #include <tensorpipe/common/error.h>
 
@@ -29,5 +30,23 @@ class ChannelClosedError final : public BaseError {
   std::string what() const override;
 };
 
+class PeerLaneFailureError final : public BaseError {
+ public:
+  PeerLaneFailureError() {}
+
+  std::string what() const override;
+};
+
+// A work request posted to an InfiniBand NIC failed, with the given status.
+class IbvError final : public BaseError {
+ public:
+  explicit IbvError(std::string error) : error_(std::move(error)) {}
+
+  std::string what() const override;
+
+ private:
+  std::string error_;
+};
+
 } // namespace channel
 } // namespace tensorpipe
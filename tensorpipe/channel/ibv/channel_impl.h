@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <nop/serializer.h>
+#include <nop/structure.h>
+
+#include <tensorpipe/channel/channel_impl_boilerplate.h>
+#include <tensorpipe/common/cpu_buffer.h>
+#include <tensorpipe/common/ibv.h>
+#include <tensorpipe/transport/context.h>
+#include <tensorpipe/transport/ibv/memory_region_cache.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace ibv {
+
+class ContextImpl;
+
+// Replicate the IbvLib::gid struct so we can serialize it with libnop.
+struct NopIbvGid {
+  uint64_t subnetPrefix;
+  uint64_t interfaceId;
+  NOP_STRUCTURE(NopIbvGid, subnetPrefix, interfaceId);
+
+  void fromIbvGid(const IbvLib::gid& globalIdentifier) {
+    subnetPrefix = globalIdentifier.global.subnet_prefix;
+    interfaceId = globalIdentifier.global.interface_id;
+  }
+
+  IbvLib::gid toIbvGid() const {
+    IbvLib::gid globalIdentifier;
+    globalIdentifier.global.subnet_prefix = subnetPrefix;
+    globalIdentifier.global.interface_id = interfaceId;
+    return globalIdentifier;
+  }
+};
+
+// Replicate the IbvSetupInformation struct so we can serialize it with libnop.
+struct NopIbvSetupInformation {
+  // This pointless constructor is needed to work around a bug in GCC 5.5 (and
+  // possibly other versions). It appears to be needed in the nop types that
+  // are used inside std::vectors.
+  NopIbvSetupInformation() {}
+
+  uint32_t localIdentifier;
+  NopIbvGid globalIdentifier;
+  uint32_t queuePairNumber;
+  IbvLib::mtu maximumTransmissionUnit;
+  NOP_STRUCTURE(
+      NopIbvSetupInformation,
+      localIdentifier,
+      globalIdentifier,
+      queuePairNumber,
+      maximumTransmissionUnit);
+
+  void fromIbvSetupInformation(const IbvSetupInformation& setupInfo) {
+    localIdentifier = setupInfo.localIdentifier;
+    globalIdentifier.fromIbvGid(setupInfo.globalIdentifier);
+    queuePairNumber = setupInfo.queuePairNumber;
+    maximumTransmissionUnit = setupInfo.maximumTransmissionUnit;
+  }
+
+  IbvSetupInformation toIbvSetupInformation() const {
+    IbvSetupInformation setupInfo;
+    setupInfo.localIdentifier = localIdentifier;
+    setupInfo.globalIdentifier = globalIdentifier.toIbvGid();
+    setupInfo.queuePairNumber = queuePairNumber;
+    setupInfo.maximumTransmissionUnit = maximumTransmissionUnit;
+    return setupInfo;
+  }
+};
+
+struct SendOperation {
+  SendOperation(
+      size_t sequenceNumber,
+      CpuBuffer buffer,
+      TSendCallback callback,
+      size_t localNicIdx)
+      : sequenceNumber(sequenceNumber),
+        buffer(buffer),
+        callback(std::move(callback)),
+        localNicIdx(localNicIdx) {}
+
+  size_t sequenceNumber;
+  CpuBuffer buffer;
+  TSendCallback callback;
+  size_t localNicIdx;
+  size_t remoteNicIdx;
+  transport::ibv::MemoryRegionCache::TRegion mr;
+  // The work request is kept here, rather than on the stack, as the NIC may
+  // hold on to it until a slot frees up.
+  IbvLib::sge list;
+  IbvLib::send_wr wr;
+};
+
+struct RecvOperation {
+  RecvOperation(
+      size_t sequenceNumber,
+      CpuBuffer buffer,
+      TRecvCallback callback,
+      size_t localNicIdx,
+      size_t remoteNicIdx)
+      : sequenceNumber(sequenceNumber),
+        buffer(buffer),
+        callback(std::move(callback)),
+        localNicIdx(localNicIdx),
+        remoteNicIdx(remoteNicIdx) {}
+
+  size_t sequenceNumber;
+  CpuBuffer buffer;
+  TRecvCallback callback;
+  size_t localNicIdx;
+  size_t remoteNicIdx;
+  transport::ibv::MemoryRegionCache::TRegion mr;
+  // See above. This recv carries no data: it's only consumed by the immediate
+  // of the sender's RDMA write, to signal that the data has landed.
+  IbvLib::recv_wr wr;
+};
+
+// First "round" of handshake.
+struct HandshakeNumNics {
+  size_t numNics;
+  NOP_STRUCTURE(HandshakeNumNics, numNics);
+};
+
+// Second "round" of handshake.
+struct HandshakeSetupInfo {
+  std::vector<std::vector<NopIbvSetupInformation>> setupInfo;
+  NOP_STRUCTURE(HandshakeSetupInfo, setupInfo);
+};
+
+// From sender to receiver (through pipe).
+struct Descriptor {
+  size_t originNicIdx;
+  NOP_STRUCTURE(Descriptor, originNicIdx);
+};
+
+// From receiver to sender (through channel's connection).
+struct ReadyToReceive {
+  size_t destinationNicIdx;
+  uint64_t ptr;
+  uint32_t rkey;
+  NOP_STRUCTURE(ReadyToReceive, destinationNicIdx, ptr, rkey);
+};
+
+class ChannelImpl final
+    : public ChannelImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl> {
+ public:
+  ChannelImpl(
+      ConstructorToken token,
+      std::shared_ptr<ContextImpl> context,
+      std::string id,
+      std::shared_ptr<transport::Connection> connection);
+
+ protected:
+  // Implement the entry points called by ChannelImplBoilerplate.
+  void initImplFromLoop() override;
+  void sendImplFromLoop(
+      uint64_t sequenceNumber,
+      CpuBuffer buffer,
+      TDescriptorCallback descriptorCallback,
+      TSendCallback callback) override;
+  void recvImplFromLoop(
+      uint64_t sequenceNumber,
+      TDescriptor descriptor,
+      CpuBuffer buffer,
+      TRecvCallback callback) override;
+  void handleErrorImpl() override;
+
+ private:
+  const std::shared_ptr<transport::Connection> connection_;
+
+  enum State {
+    INITIALIZING = 1,
+    WAITING_FOR_HANDSHAKE_NUM_NICS,
+    WAITING_FOR_HANDSHAKE_SETUP_INFO,
+    ESTABLISHED,
+  };
+  State state_{INITIALIZING};
+
+  void onReadHandshakeNumNics(const HandshakeNumNics& nopHandshakeNumNics);
+  void onReadHandshakeSetupInfo(
+      const HandshakeSetupInfo& nopHandshakeSetupInfo);
+
+  size_t numLocalNics_{0};
+  size_t numRemoteNics_{0};
+
+  std::vector<std::vector<IbvQueuePair>> queuePairs_;
+
+  std::list<SendOperation> sendOps_;
+  std::list<RecvOperation> recvOps_;
+
+  uint32_t numSendsInFlight_{0};
+  uint32_t numRecvsInFlight_{0};
+
+  void processSendOperationFromLoop(SendOperation& op);
+  void onReadReadyToReceive(
+      SendOperation& op,
+      const ReadyToReceive& readyToReceive);
+  void onIbvSendDone(SendOperation& op);
+  void eraseOp(const SendOperation& op);
+
+  void processRecvOperationFromLoop(RecvOperation& op);
+  void onIbvRecvDone(RecvOperation& op);
+  void eraseOp(const RecvOperation& op);
+
+  void tryCleanup();
+  void cleanup();
+};
+
+} // namespace ibv
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/ibv/context.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <tensorpipe/channel/ibv/channel_impl.h>
+#include <tensorpipe/channel/ibv/context_impl.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace ibv {
+
+Context::Context(
+    optional<std::vector<std::string>> nicNames,
+    size_t registrationCacheCapacity,
+    ThreadOptions threadOptions)
+    : impl_(std::make_shared<ContextImpl>(
+          std::move(nicNames),
+          registrationCacheCapacity,
+          std::move(threadOptions))) {}
+
+// Explicitly define all methods of the context, which just forward to the impl.
+// We cannot use an intermediate ContextBoilerplate class without forcing a
+// recursive include of private headers into the public ones.
+
+std::shared_ptr<CpuChannel> Context::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint endpoint) {
+  return impl_->createChannel(std::move(connection), endpoint);
+}
+
+const std::string& Context::domainDescriptor() const {
+  return impl_->domainDescriptor();
+}
+
+bool Context::isViable() const {
+  return impl_->isViable();
+}
+
+void Context::invalidateMemoryRegistrations(void* ptr, size_t length) {
+  impl_->invalidateMemoryRegistrations(ptr, length);
+}
+
+void Context::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Context::enableLoopStats() {
+  impl_->enableStats();
+}
+
+std::map<std::string, LoopStats> Context::getLoopStats() {
+  return {{"reactor", impl_->getStats()}};
+}
+
+void Context::close() {
+  impl_->close();
+}
+
+void Context::join() {
+  impl_->join();
+}
+
+Context::~Context() {
+  join();
+}
+
+} // namespace ibv
+} // namespace channel
+} // namespace tensorpipe
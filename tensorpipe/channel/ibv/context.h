@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/thread_options.h>
+#include <tensorpipe/transport/context.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace ibv {
+
+class ContextImpl;
+
+class Context : public CpuContext {
+ public:
+  // Tensors are transferred with RDMA writes from the sender's memory straight
+  // into the receiver's one, using the given InfiniBand NICs, or all of them if
+  // none are given. Successive tensors are spread across the NICs.
+  //
+  // The memory of the tensors needs to be registered with the NICs. Where they
+  // support on-demand paging, the memory of the tensors being sent needs no
+  // registration at all, and the one of the tensors being received is
+  // registered without being pinned, which is much cheaper. If
+  // registrationCacheCapacity isn't zero, up to that many registrations are
+  // kept around (per NIC) to be reused by later transfers involving the same
+  // memory. In that case the user must call invalidateMemoryRegistrations
+  // before deallocating any such memory.
+  //
+  // The thread that polls the NICs is set up according to threadOptions.
+  explicit Context(
+      optional<std::vector<std::string>> nicNames = nullopt,
+      size_t registrationCacheCapacity = 0,
+      ThreadOptions threadOptions = ThreadOptions());
+
+  Context(const Context&) = delete;
+  Context(Context&&) = delete;
+  Context& operator=(const Context&) = delete;
+  Context& operator=(Context&&) = delete;
+
+  std::shared_ptr<CpuChannel> createChannel(
+      std::shared_ptr<transport::Connection> connection,
+      Endpoint endpoint) override;
+
+  const std::string& domainDescriptor() const override;
+
+  bool isViable() const override;
+
+  // Drop the cached registrations that overlap the given memory. Once this
+  // returns, the memory can be safely deallocated, as soon as all the
+  // operations that use it have completed.
+  void invalidateMemoryRegistrations(void* ptr, size_t length);
+
+  void setId(std::string id) override;
+
+  void enableLoopStats() override;
+
+  std::map<std::string, LoopStats> getLoopStats() override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it. However, its lifetime is tied to the one
+  // of this public object since when the latter is destroyed the implementation
+  // is closed and joined.
+  const std::shared_ptr<ContextImpl> impl_;
+};
+
+} // namespace ibv
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/ibv/context_impl.h>
+
+#include <string>
+#include <tuple>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <tensorpipe/channel/ibv/channel_impl.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace ibv {
+
+IbvNic::IbvNic(
+    std::string id,
+    std::string name,
+    IbvLib::device& device,
+    IbvLib& ibvLib,
+    size_t registrationCacheCapacity)
+    : IbvNicBase(std::move(id), std::move(name), device, ibvLib),
+      memoryRegionCache_(ibvLib_, pd_, registrationCacheCapacity) {}
+
+transport::ibv::MemoryRegionCache::TRegion IbvNic::registerMemory(
+    CpuBuffer buffer,
+    int accessFlags) {
+  return memoryRegionCache_.getRegion(buffer.ptr, buffer.length, accessFlags);
+}
+
+void IbvNic::invalidateMemory(void* ptr, size_t length) {
+  memoryRegionCache_.invalidate(ptr, length);
+}
+
+ContextImpl::ContextImpl(
+    optional<std::vector<std::string>> nicNames,
+    size_t registrationCacheCapacity,
+    ThreadOptions threadOptions)
+    : BusyPollingLoop(kBusyPollForever, kBusyPollForever),
+      ContextImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl>("*") {
+  Error error;
+
+  std::tie(error, ibvLib_) = IbvLib::create();
+  if (error) {
+    TP_VLOG(5) << "Channel context " << id_
+               << " is not viable because libibverbs could not be loaded: "
+               << error.what();
+    viable_ = false;
+    return;
+  }
+
+  IbvDeviceList deviceList;
+  std::tie(error, deviceList) = IbvDeviceList::create(getIbvLib());
+  if (error && error.isOfType<SystemError>() &&
+      error.castToType<SystemError>()->errorCode() == ENOSYS) {
+    TP_VLOG(5) << "Channel context " << id_
+               << " couldn't get list of InfiniBand devices because the kernel "
+               << "module isn't loaded";
+    viable_ = false;
+    return;
+  }
+  TP_THROW_ASSERT_IF(error)
+      << "Couldn't get list of InfiniBand devices: " << error.what();
+  if (deviceList.size() == 0) {
+    TP_VLOG(5) << "Channel context " << id_
+               << " is not viable because it couldn't find any InfiniBand NICs";
+    viable_ = false;
+    return;
+  }
+
+  std::unordered_set<std::string> wantedNicNames;
+  if (nicNames.has_value()) {
+    TP_THROW_ASSERT_IF(nicNames->empty())
+        << "The list of InfiniBand NICs to use cannot be empty";
+    wantedNicNames.insert(nicNames->begin(), nicNames->end());
+  }
+
+  // The device index is among all available devices, the NIC index is among the
+  // ones we will use.
+  for (size_t deviceIdx = 0; deviceIdx < deviceList.size(); deviceIdx++) {
+    IbvLib::device& device = deviceList[deviceIdx];
+    std::string deviceName(TP_CHECK_IBV_PTR(ibvLib_.get_device_name(&device)));
+    if (nicNames.has_value()) {
+      auto iter = wantedNicNames.find(deviceName);
+      if (iter == wantedNicNames.end()) {
+        continue;
+      }
+      wantedNicNames.erase(iter);
+    }
+    TP_VLOG(5) << "Channel context " << id_ << " is using InfiniBand NIC "
+               << deviceName << " as device #" << ibvNics_.size();
+    ibvNics_.emplace_back(
+        id_, std::move(deviceName), device, ibvLib_, registrationCacheCapacity);
+  }
+  TP_THROW_ASSERT_IF(!wantedNicNames.empty())
+      << "Couldn't find all the devices I was supposed to use";
+
+  startThread("TP_IBV_CHAN_loop", std::move(threadOptions));
+}
+
+IbvLib& ContextImpl::getIbvLib() {
+  return ibvLib_;
+}
+
+size_t ContextImpl::getNumIbvNics() const {
+  return ibvNics_.size();
+}
+
+IbvNic& ContextImpl::getIbvNic(size_t nicIdx) {
+  TP_DCHECK_LT(nicIdx, ibvNics_.size());
+  return ibvNics_[nicIdx];
+}
+
+void ContextImpl::invalidateMemoryRegistrations(void* ptr, size_t length) {
+  if (!viable_) {
+    return;
+  }
+  runInLoop([this, ptr, length]() {
+    for (IbvNic& ibvNic : ibvNics_) {
+      ibvNic.invalidateMemory(ptr, length);
+    }
+  });
+}
+
+bool ContextImpl::pollOnce() {
+  for (IbvNic& ibvNic : ibvNics_) {
+    if (ibvNic.pollOnce()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ContextImpl::readyToClose() {
+  for (const IbvNic& ibvNic : ibvNics_) {
+    if (!ibvNic.readyToClose()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ContextImpl::closeImpl() {
+  stopBusyPolling();
+}
+
+void ContextImpl::joinImpl() {
+  joinThread();
+
+  ibvNics_.clear();
+}
+
+void ContextImpl::setIdImpl() {
+  for (IbvNic& ibvNic : ibvNics_) {
+    ibvNic.setId(id_);
+  }
+}
+
+std::shared_ptr<CpuChannel> ContextImpl::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint /* unused */) {
+  return createChannelInternal(std::move(connection));
+}
+
+bool ContextImpl::isViable() const {
+  return viable_;
+}
+
+} // namespace ibv
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/channel/context_impl_boilerplate.h>
+#include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/channel/ibv_nic.h>
+#include <tensorpipe/common/busy_polling_loop.h>
+#include <tensorpipe/common/cpu_buffer.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/ibv.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/transport/context.h>
+#include <tensorpipe/transport/ibv/memory_region_cache.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace ibv {
+
+class ChannelImpl;
+
+class IbvNic : public IbvNicBase {
+ public:
+  IbvNic(
+      std::string id,
+      std::string name,
+      IbvLib::device& device,
+      IbvLib& ibvLib,
+      size_t registrationCacheCapacity);
+
+  // The registration cache holds on to the protection domain, hence the NIC
+  // must stay where it was constructed.
+  IbvNic(const IbvNic&) = delete;
+  IbvNic(IbvNic&&) = delete;
+  IbvNic& operator=(const IbvNic&) = delete;
+  IbvNic& operator=(IbvNic&&) = delete;
+
+  transport::ibv::MemoryRegionCache::TRegion registerMemory(
+      CpuBuffer buffer,
+      int accessFlags);
+
+  void invalidateMemory(void* ptr, size_t length);
+
+ private:
+  // Host memory has no identifier that is never reused (unlike CUDA's buffer
+  // IDs), hence registrations are only kept around if the user opted into it
+  // and promised to invalidate them.
+  transport::ibv::MemoryRegionCache memoryRegionCache_;
+};
+
+class ContextImpl final
+    : public BusyPollingLoop,
+      public ContextImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl> {
+ public:
+  ContextImpl(
+      optional<std::vector<std::string>> nicNames,
+      size_t registrationCacheCapacity,
+      ThreadOptions threadOptions);
+
+  std::shared_ptr<CpuChannel> createChannel(
+      std::shared_ptr<transport::Connection> connection,
+      Endpoint endpoint);
+
+  bool isViable() const;
+
+  IbvLib& getIbvLib();
+
+  size_t getNumIbvNics() const;
+
+  IbvNic& getIbvNic(size_t nicIdx);
+
+  void invalidateMemoryRegistrations(void* ptr, size_t length);
+
+ protected:
+  // Implement BusyPollingLoop hooks.
+  bool pollOnce() override;
+  bool readyToClose() override;
+
+  // Implement the entry points called by ContextImplBoilerplate.
+  void closeImpl() override;
+  void joinImpl() override;
+  void setIdImpl() override;
+
+ private:
+  bool viable_{true};
+  IbvLib ibvLib_;
+  // A deque, rather than a vector, as the NICs cannot be moved.
+  std::deque<IbvNic> ibvNics_;
+};
+
+} // namespace ibv
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/ibv_nic.h>
+
+#include <array>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <tensorpipe/channel/error.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+
+namespace tensorpipe {
+namespace channel {
+
+namespace {
+
+// We should probably allow these to be user-configured. But, for now, we'll set
+// them to the lowest value they can have, the rationale being that this way
+// they will always be valid.
+constexpr uint8_t kPortNum = 1;
+constexpr uint8_t kGlobalIdentifierIndex = 0;
+
+// How many receive and send requests can be outstanding at once on each NIC,
+// which is also the capacity of the queues of each queue pair. They're lowered
+// to the limits of the device (max_qp_wr and max_cqe) if they exceed them, and
+// the completion queue is sized to hold the completions of all of them.
+constexpr uint32_t kNumRecvs = 1024;
+constexpr uint32_t kNumSends = 1024;
+
+// How many work completions to poll from the completion queue at each reactor
+// iteration.
+constexpr int kNumPolledWorkCompletions = 32;
+
+// NOTE: This is an incomplete implementation of C++17's `std::apply`.
+// It's intended to only work for methods of IbvNicBase.
+template <class TMethod, class TArgsTuple, std::size_t... I>
+auto applyFuncImpl(
+    IbvNicBase& subject,
+    TMethod&& method,
+    TArgsTuple&& args,
+    std::index_sequence<I...> /* unused */) {
+  return ((subject).*(method))(std::get<I>(std::forward<TArgsTuple>(args))...);
+}
+
+template <class TMethod, class TArgsTuple>
+auto applyFunc(IbvNicBase& subject, TMethod&& method, TArgsTuple&& args) {
+  return applyFuncImpl(
+      subject,
+      std::forward<TMethod>(method),
+      std::forward<TArgsTuple>(args),
+      std::make_index_sequence<
+          std::tuple_size<std::remove_reference_t<TArgsTuple>>::value>{});
+}
+
+} // namespace
+
+IbvNicBase::IbvNicBase(
+    std::string id,
+    std::string name,
+    IbvLib::device& device,
+    IbvLib& ibvLib)
+    : id_(std::move(id)), name_(std::move(name)), ibvLib_(ibvLib) {
+  ctx_ = createIbvContext(ibvLib_, device);
+  pd_ = createIbvProtectionDomain(ibvLib_, ctx_);
+  capacities_ = fitIbvQueueCapacities(
+      ibvLib_, ctx_, kNumRecvs, kNumSends, /*useSharedReceiveQueue=*/false);
+  numAvailableRecvSlots_ = capacities_.numRecvs;
+  numAvailableSendSlots_ = capacities_.numSends;
+  cq_ = createIbvCompletionQueue(
+      ibvLib_,
+      ctx_,
+      capacities_.completionQueueSize,
+      /*cq_context=*/nullptr,
+      /*channel=*/nullptr,
+      /*comp_vector=*/0);
+  addr_ = makeIbvAddress(ibvLib_, ctx_, kPortNum, kGlobalIdentifierIndex);
+}
+
+IbvQueuePair IbvNicBase::createQueuePair() {
+  IbvLib::qp_init_attr initAttr;
+  std::memset(&initAttr, 0, sizeof(initAttr));
+  initAttr.qp_type = IbvLib::QPT_RC;
+  initAttr.send_cq = cq_.get();
+  initAttr.recv_cq = cq_.get();
+  initAttr.cap.max_send_wr = capacities_.numSends;
+  initAttr.cap.max_send_sge = 1;
+  initAttr.cap.max_recv_wr = capacities_.numRecvs;
+  initAttr.cap.max_recv_sge = 1;
+  initAttr.sq_sig_all = 1;
+  IbvQueuePair qp = createIbvQueuePair(ibvLib_, pd_, initAttr);
+
+  transitionIbvQueuePairToInit(ibvLib_, qp, addr_);
+
+  return qp;
+}
+
+bool IbvNicBase::pollOnce() {
+  std::array<IbvLib::wc, kNumPolledWorkCompletions> wcs;
+  auto rv = ibvLib_.poll_cq(cq_.get(), wcs.size(), wcs.data());
+
+  if (rv == 0) {
+    return false;
+  }
+  TP_THROW_SYSTEM_IF(rv < 0, errno);
+
+  int numSends = 0;
+  int numRecvs = 0;
+  for (int wcIdx = 0; wcIdx < rv; wcIdx++) {
+    IbvLib::wc& wc = wcs[wcIdx];
+
+    TP_VLOG(6) << "Channel context " << id_ << " got work completion on device "
+               << name_ << " for request " << wc.wr_id << " for QP "
+               << wc.qp_num << " with status "
+               << ibvLib_.wc_status_str(wc.status) << " and opcode "
+               << ibvWorkCompletionOpcodeToStr(wc.opcode)
+               << " (byte length: " << wc.byte_len << ")";
+
+    auto iter = requestsInFlight_.find(wc.wr_id);
+    TP_THROW_ASSERT_IF(iter == requestsInFlight_.end())
+        << "Got work completion with unknown ID " << wc.wr_id;
+
+    std::function<void(const Error&)> cb = std::move(iter->second.callback);
+    const bool isRecv = iter->second.isRecv;
+    requestsInFlight_.erase(iter);
+
+    if (wc.status != IbvLib::WC_SUCCESS) {
+      cb(TP_CREATE_ERROR(IbvError, ibvLib_.wc_status_str(wc.status)));
+    } else {
+      cb(Error::kSuccess);
+    }
+
+    if (isRecv) {
+      numRecvs++;
+    } else {
+      numSends++;
+    }
+  }
+
+  numAvailableSendSlots_ += numSends;
+  while (!sendsWaitingForSlots_.empty() && numAvailableSendSlots_ > 0) {
+    applyFunc(
+        *this, &IbvNicBase::postSend, std::move(sendsWaitingForSlots_.front()));
+    sendsWaitingForSlots_.pop_front();
+  }
+
+  numAvailableRecvSlots_ += numRecvs;
+  while (!recvsWaitingForSlots_.empty() && numAvailableRecvSlots_ > 0) {
+    applyFunc(
+        *this, &IbvNicBase::postRecv, std::move(recvsWaitingForSlots_.front()));
+    recvsWaitingForSlots_.pop_front();
+  }
+
+  return true;
+}
+
+void IbvNicBase::postSend(
+    IbvQueuePair& qp,
+    IbvLib::send_wr& wr,
+    std::function<void(const Error&)> cb) {
+  TP_DCHECK_EQ(wr.wr_id, 0);
+  if (numAvailableSendSlots_ > 0) {
+    wr.wr_id = nextRequestId_++;
+    IbvLib::send_wr* badWr = nullptr;
+    TP_VLOG(6) << "Channel context " << id_ << " posting send on device "
+               << name_ << " for QP " << qp->qp_num;
+    TP_CHECK_IBV_INT(ibvLib_.post_send(qp.get(), &wr, &badWr));
+    TP_THROW_ASSERT_IF(badWr != nullptr);
+    numAvailableSendSlots_--;
+    requestsInFlight_.emplace(
+        wr.wr_id, RequestInFlight{/*isRecv=*/false, std::move(cb)});
+  } else {
+    TP_VLOG(6) << "Channel context " << id_ << " queueing up send on device "
+               << name_ << " for QP " << qp->qp_num;
+    sendsWaitingForSlots_.emplace_back(qp, wr, std::move(cb));
+  }
+}
+
+void IbvNicBase::postRecv(
+    IbvQueuePair& qp,
+    IbvLib::recv_wr& wr,
+    std::function<void(const Error&)> cb) {
+  TP_DCHECK_EQ(wr.wr_id, 0);
+  if (numAvailableRecvSlots_ > 0) {
+    wr.wr_id = nextRequestId_++;
+    IbvLib::recv_wr* badWr = nullptr;
+    TP_VLOG(6) << "Channel context " << id_ << " posting recv on device "
+               << name_ << " for QP " << qp->qp_num;
+    TP_CHECK_IBV_INT(ibvLib_.post_recv(qp.get(), &wr, &badWr));
+    TP_THROW_ASSERT_IF(badWr != nullptr);
+    numAvailableRecvSlots_--;
+    requestsInFlight_.emplace(
+        wr.wr_id, RequestInFlight{/*isRecv=*/true, std::move(cb)});
+  } else {
+    TP_VLOG(6) << "Channel context " << id_ << " queueing up recv on device "
+               << name_ << " for QP " << qp->qp_num;
+    recvsWaitingForSlots_.emplace_back(qp, wr, std::move(cb));
+  }
+}
+
+bool IbvNicBase::readyToClose() const {
+  return requestsInFlight_.empty();
+}
+
+void IbvNicBase::setId(std::string id) {
+  id_ = std::move(id);
+}
+
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/ibv.h>
+
+namespace tensorpipe {
+namespace channel {
+
+// What the channels that use InfiniBand NICs directly (ibv and cuda_gdr) have
+// in common for each NIC: its device context, protection domain, completion
+// queue and address, the creation of the queue pairs (one per peer NIC), and
+// the posting of requests to them. The requests are queued up while the NIC is
+// at its capacity, and their callbacks are called by pollOnce as they complete.
+// Each channel adds the registration of its kind of memory on top.
+class IbvNicBase {
+ public:
+  IbvNicBase(
+      std::string id,
+      std::string name,
+      IbvLib::device& device,
+      IbvLib& ibvLib);
+
+  IbvProtectionDomain& getIbvPd() {
+    return pd_;
+  }
+
+  IbvCompletionQueue& getIbvCq() {
+    return cq_;
+  }
+
+  const IbvAddress& getIbvAddress() {
+    return addr_;
+  }
+
+  // The capacities of the queues, of the queue pairs and of the NIC as a whole.
+  uint32_t getNumRecvs() const {
+    return capacities_.numRecvs;
+  }
+
+  uint32_t getNumSends() const {
+    return capacities_.numSends;
+  }
+
+  // A reliable connected queue pair, sized after the capacities above and using
+  // the completion queue of the NIC, brought to the INIT state. The caller then
+  // exchanges its setup information with the peer.
+  IbvQueuePair createQueuePair();
+
+  void postSend(
+      IbvQueuePair& qp,
+      IbvLib::send_wr& wr,
+      std::function<void(const Error&)> cb);
+
+  void postRecv(
+      IbvQueuePair& qp,
+      IbvLib::recv_wr& wr,
+      std::function<void(const Error&)> cb);
+
+  bool pollOnce();
+
+  bool readyToClose() const;
+
+  void setId(std::string id);
+
+ protected:
+  // The ID of the context, for use in verbose logging.
+  std::string id_{"N/A"};
+  // The name of the InfiniBand device.
+  std::string name_;
+
+  IbvLib& ibvLib_;
+  IbvContext ctx_;
+  IbvProtectionDomain pd_;
+  IbvCompletionQueue cq_;
+  IbvAddress addr_;
+  IbvQueueCapacities capacities_;
+
+ private:
+  size_t numAvailableRecvSlots_ = 0;
+  std::deque<std::tuple<
+      IbvQueuePair&,
+      IbvLib::recv_wr&,
+      std::function<void(const Error&)>>>
+      recvsWaitingForSlots_;
+
+  size_t numAvailableSendSlots_ = 0;
+  std::deque<std::tuple<
+      IbvQueuePair&,
+      IbvLib::send_wr&,
+      std::function<void(const Error&)>>>
+      sendsWaitingForSlots_;
+
+  // We need one common map for both send and recv requests because in principle
+  // we cannot access the opcode of a failed operation, meaning we couldn't
+  // match it to its callback. For the same reason we remember which kind of
+  // request it was, in order to give its slot back.
+  struct RequestInFlight {
+    bool isRecv;
+    std::function<void(const Error&)> callback;
+  };
+  std::unordered_map<uint64_t, RequestInFlight> requestsInFlight_;
+  uint64_t nextRequestId_ = 0;
+};
+
+} // namespace channel
+} // namespace tensorpipe
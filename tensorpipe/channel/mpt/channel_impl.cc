@@ -8,13 +8,20 @@
 
 #include <tensorpipe/channel/mpt/channel_impl.h>
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
+#include <numeric>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <tensorpipe/channel/error.h>
+#include <tensorpipe/channel/helpers.h>
 #include <tensorpipe/channel/mpt/context_impl.h>
+#include <tensorpipe/channel/mpt/nop_types.h>
 #include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/nop.h>
 #include <tensorpipe/transport/connection.h>
 
 namespace tensorpipe {
@@ -27,7 +34,10 @@ ChannelImpl::ChannelImpl(
     std::string id,
     std::shared_ptr<transport::Connection> connection,
     Endpoint endpoint,
-    uint64_t numLanes)
+    uint64_t numLanes,
+    size_t minChunkSize,
+    bool flowControl,
+    bool laneFailover)
     : ChannelImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl>(
           token,
           std::move(context),
@@ -35,7 +45,27 @@ ChannelImpl::ChannelImpl(
       connection_(std::move(connection)),
       endpoint_(endpoint),
       numLanes_(numLanes),
-      lanes_(numLanes_) {}
+      minChunkSize_(minChunkSize),
+      flowControl_(flowControl),
+      laneFailover_(laneFailover),
+      lanes_(numLanes_),
+      laneStats_(numLanes_),
+      laneIsDown_(numLanes_, false) {}
+
+template <typename TBoundFn>
+auto ChannelImpl::laneCallbackWrapper(uint64_t laneIdx, TBoundFn&& fn) {
+  return [impl{shared_from_this()}, laneIdx, fn{std::move(fn)}](
+             const Error& error, auto&&... /* unused */) mutable {
+    ContextImpl& context = *impl->context_;
+    context.deferToLoop(
+        [impl{std::move(impl)}, laneIdx, fn{std::move(fn)}, error]() mutable {
+          if (error) {
+            impl->onErrorOfLane(laneIdx, error);
+          }
+          fn(*impl, !error);
+        });
+  };
+}
 
 void ChannelImpl::initImplFromLoop() {
   context_->enroll(*this);
@@ -63,6 +93,12 @@ void ChannelImpl::initImplFromLoop() {
       nopServerHello.laneAdvertisements.emplace_back();
       LaneAdvertisement& nopLaneAdvertisement =
           nopServerHello.laneAdvertisements.back();
+      if (context_->isLaneDown(laneIdx)) {
+        TP_DCHECK(laneFailover_);
+        laneIsDown_[laneIdx] = true;
+        numLanesDown_++;
+        continue;
+      }
       nopLaneAdvertisement.address = addresses[laneIdx];
       TP_VLOG(6) << "Channel " << id_ << " requesting connection (for lane "
                  << laneIdx << ")";
@@ -81,6 +117,8 @@ void ChannelImpl::initImplFromLoop() {
       nopLaneAdvertisement.registrationId = token;
       numLanesBeingAccepted_++;
     }
+    // The context fails once all of its lanes did.
+    TP_DCHECK_GT(numLanesBeingAccepted_, 0);
     TP_VLOG(6) << "Channel " << id_ << " writing nop object (server hello)";
     connection_->write(
         *nopHolderOut, lazyCallbackWrapper_([nopHolderOut](ChannelImpl& impl) {
@@ -102,13 +140,21 @@ void ChannelImpl::sendImplFromLoop(
   op.sequenceNumber = sequenceNumber;
   op.ptr = buffer.ptr;
   op.length = buffer.length;
+  op.laneLengths = chooseLaneLengths(buffer.length);
+  op.waitingForCredit = flowControl_;
+  op.waitingForAck = laneFailover_ && buffer.length > 0;
   op.callback = std::move(callback);
 
-  if (state_ == ESTABLISHED) {
+  NopHolder<Descriptor> nopHolder;
+  Descriptor& nopDescriptor = nopHolder.getObject();
+  nopDescriptor.laneLengths = op.laneLengths;
+
+  if (state_ == ESTABLISHED && !op.waitingForCredit) {
     sendOperation(op);
+    completeSendOperations();
   }
 
-  descriptorCallback(Error::kSuccess, std::string());
+  descriptorCallback(Error::kSuccess, saveDescriptor(nopHolder));
 }
 
 void ChannelImpl::recvImplFromLoop(
@@ -116,17 +162,29 @@ void ChannelImpl::recvImplFromLoop(
     TDescriptor descriptor,
     CpuBuffer buffer,
     TRecvCallback callback) {
-  TP_DCHECK_EQ(descriptor, std::string());
+  NopHolder<Descriptor> nopHolder;
+  loadDescriptor(nopHolder, descriptor);
+  Descriptor& nopDescriptor = nopHolder.getObject();
+  TP_DCHECK_EQ(nopDescriptor.laneLengths.size(), numLanes_);
+  TP_DCHECK_EQ(
+      std::accumulate(
+          nopDescriptor.laneLengths.begin(),
+          nopDescriptor.laneLengths.end(),
+          uint64_t(0)),
+      buffer.length);
 
   recvOperations_.emplace_back();
   RecvOperation& op = recvOperations_.back();
   op.sequenceNumber = sequenceNumber;
   op.ptr = buffer.ptr;
   op.length = buffer.length;
+  op.laneLengths = std::move(nopDescriptor.laneLengths);
+  op.chunkStates.resize(numLanes_, ChunkState::kDone);
   op.callback = std::move(callback);
 
   if (state_ == ESTABLISHED) {
     recvOperation(op);
+    completeRecvOperations();
   }
 }
 
@@ -141,6 +199,12 @@ void ChannelImpl::onClientReadHelloOnConnection(const Packet& nopPacketIn) {
   for (uint64_t laneIdx = 0; laneIdx < numLanes_; ++laneIdx) {
     const LaneAdvertisement& nopLaneAdvertisement =
         nopServerHello.laneAdvertisements[laneIdx];
+    if (nopLaneAdvertisement.address.empty()) {
+      TP_DCHECK(laneFailover_);
+      laneIsDown_[laneIdx] = true;
+      numLanesDown_++;
+      continue;
+    }
     std::shared_ptr<transport::Connection> lane =
         context_->connect(laneIdx, nopLaneAdvertisement.address);
     auto nopHolderOut = std::make_shared<NopHolder<Packet>>();
@@ -190,36 +254,126 @@ void ChannelImpl::startSendingAndReceivingUponEstablishingChannel() {
   TP_DCHECK_EQ(state_, ESTABLISHED);
 
   for (SendOperation& op : sendOperations_) {
-    sendOperation(op);
+    if (!op.waitingForCredit) {
+      sendOperation(op);
+    }
   }
   for (RecvOperation& op : recvOperations_) {
     recvOperation(op);
   }
+  if (flowControl_ || laneFailover_) {
+    readControlMessage();
+  }
+  completeSendOperations();
+  completeRecvOperations();
+}
+
+std::vector<uint64_t> ChannelImpl::chooseLaneLengths(size_t length) {
+  std::vector<uint64_t> laneLengths(numLanes_, 0);
+
+  // Small tensors wouldn't gain anything from being split, and would only pay
+  // the overhead of more transfers, hence they take turns among the lanes.
+  const uint64_t numChunks =
+      std::min<uint64_t>(numLanes_ - numLanesDown_, length / minChunkSize_);
+  if (numChunks <= 1) {
+    while (laneIsDown_[nextLaneIdx_]) {
+      nextLaneIdx_ = (nextLaneIdx_ + 1) % numLanes_;
+    }
+    laneLengths[nextLaneIdx_] = length;
+    nextLaneIdx_ = (nextLaneIdx_ + 1) % numLanes_;
+    return laneLengths;
+  }
+
+  // The lanes that weren't measured yet are assumed to be as fast as the
+  // average of the others. If there's room for fewer chunks than lanes, the
+  // fastest lanes are used.
+  double sumOfThroughputs = 0;
+  uint64_t numMeasuredLanes = 0;
+  for (uint64_t laneIdx = 0; laneIdx < numLanes_; laneIdx++) {
+    const LaneStats& stats = laneStats_[laneIdx];
+    if (!laneIsDown_[laneIdx] && stats.throughput > 0) {
+      sumOfThroughputs += stats.throughput;
+      numMeasuredLanes++;
+    }
+  }
+  const double defaultThroughput =
+      numMeasuredLanes > 0 ? sumOfThroughputs / numMeasuredLanes : 1;
+  std::vector<double> weights(numLanes_);
+  std::vector<uint64_t> laneIdxs;
+  for (uint64_t laneIdx = 0; laneIdx < numLanes_; laneIdx++) {
+    const double throughput = laneStats_[laneIdx].throughput;
+    weights[laneIdx] = throughput > 0 ? throughput : defaultThroughput;
+    if (!laneIsDown_[laneIdx]) {
+      laneIdxs.push_back(laneIdx);
+    }
+  }
+  std::stable_sort(
+      laneIdxs.begin(), laneIdxs.end(), [&](uint64_t lhs, uint64_t rhs) {
+        return weights[lhs] > weights[rhs];
+      });
+  laneIdxs.resize(numChunks);
+  std::sort(laneIdxs.begin(), laneIdxs.end());
+
+  // Insert "cutpoints" in the buffer at the cumulated weights of the lanes,
+  // rounding them down if they don't end up being at an integer position.
+  double sumOfWeights = 0;
+  for (uint64_t laneIdx : laneIdxs) {
+    sumOfWeights += weights[laneIdx];
+  }
+  double cumulatedWeight = 0;
+  uint64_t offsetStart = 0;
+  for (size_t chunkIdx = 0; chunkIdx < laneIdxs.size(); chunkIdx++) {
+    cumulatedWeight += weights[laneIdxs[chunkIdx]];
+    const uint64_t offsetEnd = chunkIdx + 1 == laneIdxs.size()
+        ? length
+        : static_cast<uint64_t>(length * (cumulatedWeight / sumOfWeights));
+    laneLengths[laneIdxs[chunkIdx]] = offsetEnd - offsetStart;
+    offsetStart = offsetEnd;
+  }
+  return laneLengths;
 }
 
 void ChannelImpl::sendOperation(SendOperation& op) {
   TP_DCHECK(context_->inLoop());
   TP_DCHECK_EQ(state_, ESTABLISHED);
 
+  uint64_t offset = 0;
   for (uint64_t laneIdx = 0; laneIdx < lanes_.size(); laneIdx++) {
-    // Insert "cutpoints" at equally-spaced intervals in the buffer, rounding
-    // them down if they don't end up being at an integer position.
-    uint64_t offsetStart = op.length * laneIdx / lanes_.size();
-    uint64_t offsetEnd = op.length * (laneIdx + 1) / lanes_.size();
+    const uint64_t length = op.laneLengths[laneIdx];
+    if (length == 0) {
+      continue;
+    }
     // As void "has no size" we cannot do pointer arithmetic on it. We need to
     // temporarily convert the pointer to a type that has a size of 1 byte.
-    const void* ptr = reinterpret_cast<const uint8_t*>(op.ptr) + offsetStart;
-    uint64_t length = offsetEnd - offsetStart;
+    const void* ptr = reinterpret_cast<const uint8_t*>(op.ptr) + offset;
+    offset += length;
+
+    // The receiver will ask for the chunk again, as it knows the lane is down.
+    if (laneIsDown_[laneIdx]) {
+      continue;
+    }
+
+    // The lane only starts working on this chunk once it's done with the
+    // previous ones.
+    LaneStats& stats = laneStats_[laneIdx];
+    if (stats.numChunksBeingWritten == 0) {
+      stats.busySince = std::chrono::steady_clock::now();
+    }
+    ++stats.numChunksBeingWritten;
 
     // Write payload.
     TP_VLOG(6) << "Channel " << id_ << " writing payload #" << op.sequenceNumber
                << " on lane " << laneIdx;
     lanes_[laneIdx]->write(
-        ptr, length, eagerCallbackWrapper_([&op, laneIdx](ChannelImpl& impl) {
-          TP_VLOG(6) << "Channel " << impl.id_ << " done writing payload #"
-                     << op.sequenceNumber << " on lane " << laneIdx;
-          impl.onWriteOfPayload(op);
-        }));
+        ptr,
+        length,
+        laneCallbackWrapper(
+            laneIdx,
+            [&op, laneIdx, length](ChannelImpl& impl, bool succeeded) {
+              TP_VLOG(6) << "Channel " << impl.id_ << " done writing payload #"
+                         << op.sequenceNumber << " on lane " << laneIdx;
+              impl.onWriteOfPayload(op, laneIdx, length, succeeded);
+            }));
     ++op.numChunksBeingWritten;
   }
 }
@@ -228,63 +382,339 @@ void ChannelImpl::recvOperation(RecvOperation& op) {
   TP_DCHECK(context_->inLoop());
   TP_DCHECK_EQ(state_, ESTABLISHED);
 
+  uint64_t offset = 0;
   for (uint64_t laneIdx = 0; laneIdx < lanes_.size(); laneIdx++) {
-    // Insert "cutpoints" at equally-spaced intervals in the buffer, rounding
-    // them down if they don't end up being at an integer position.
-    uint64_t offsetStart = op.length * laneIdx / lanes_.size();
-    uint64_t offsetEnd = op.length * (laneIdx + 1) / lanes_.size();
+    const uint64_t length = op.laneLengths[laneIdx];
+    if (length == 0) {
+      continue;
+    }
     // As void "has no size" we cannot do pointer arithmetic on it. We need to
     // temporarily convert the pointer to a type that has a size of 1 byte.
-    void* ptr = reinterpret_cast<uint8_t*>(op.ptr) + offsetStart;
-    uint64_t length = offsetEnd - offsetStart;
+    void* ptr = reinterpret_cast<uint8_t*>(op.ptr) + offset;
+    offset += length;
+    ++op.numChunksLeft;
+
+    if (laneIsDown_[laneIdx]) {
+      op.chunkStates[laneIdx] = ChunkState::kResending;
+      writeControlMessage(ResendRequest{op.sequenceNumber, laneIdx});
+      continue;
+    }
 
     // Read payload.
     TP_VLOG(6) << "Channel " << id_ << " reading payload #" << op.sequenceNumber
                << " on lane " << laneIdx;
+    op.chunkStates[laneIdx] = ChunkState::kReadingFromLane;
     lanes_[laneIdx]->read(
         ptr,
         length,
-        eagerCallbackWrapper_([&op, laneIdx](
-                                  ChannelImpl& impl,
-                                  const void* /* unused */,
-                                  size_t /* unused */) {
-          TP_VLOG(6) << "Channel " << impl.id_ << " done reading payload #"
-                     << op.sequenceNumber << " on lane " << laneIdx;
-          impl.onReadOfPayload(op);
-        }));
+        laneCallbackWrapper(
+            laneIdx, [&op, laneIdx](ChannelImpl& impl, bool succeeded) {
+              TP_VLOG(6) << "Channel " << impl.id_ << " done reading payload #"
+                         << op.sequenceNumber << " on lane " << laneIdx;
+              impl.onReadOfPayload(op, laneIdx, succeeded);
+            }));
     ++op.numChunksBeingRead;
   }
+
+  // The reads are posted, hence the sender may now write the chunks, which the
+  // lanes will read straight into the buffer.
+  if (flowControl_) {
+    writeControlMessage(Credit{op.sequenceNumber});
+  }
+}
+
+void ChannelImpl::readControlMessage() {
+  auto nopHolderIn = std::make_shared<NopHolder<ControlMessage>>();
+  TP_VLOG(6) << "Channel " << id_ << " reading nop object (control message)";
+  connection_->read(
+      *nopHolderIn, lazyCallbackWrapper_([nopHolderIn](ChannelImpl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_
+                   << " done reading nop object (control message)";
+        impl.onReadOfControlMessage(nopHolderIn->getObject());
+      }));
 }
 
-void ChannelImpl::onWriteOfPayload(SendOperation& op) {
+void ChannelImpl::writeControlMessage(ControlMessage message) {
+  auto nopHolderOut = std::make_shared<NopHolder<ControlMessage>>();
+  nopHolderOut->getObject() = std::move(message);
+  TP_VLOG(6) << "Channel " << id_ << " writing nop object (control message)";
+  connection_->write(
+      *nopHolderOut, lazyCallbackWrapper_([nopHolderOut](ChannelImpl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_
+                   << " done writing nop object (control message)";
+      }));
+}
+
+void ChannelImpl::onReadOfControlMessage(const ControlMessage& message) {
   TP_DCHECK(context_->inLoop());
+  TP_DCHECK_EQ(state_, ESTABLISHED);
 
-  --op.numChunksBeingWritten;
-  if (op.numChunksBeingWritten > 0) {
-    return;
+  if (message.index() == message.index_of<Credit>()) {
+    onReadOfCredit(message.get<Credit>()->sequenceNumber);
+  } else if (message.index() == message.index_of<Ack>()) {
+    onReadOfAck(message.get<Ack>()->sequenceNumber);
+  } else if (message.index() == message.index_of<LaneFailure>()) {
+    const uint64_t laneIdx = message.get<LaneFailure>()->laneIdx;
+    if (!laneIsDown_[laneIdx]) {
+      takeLaneDown(
+          laneIdx, TP_CREATE_ERROR(PeerLaneFailureError), /*tellPeer=*/false);
+    }
+  } else if (message.index() == message.index_of<ResendRequest>()) {
+    const ResendRequest& nopResendRequest = *message.get<ResendRequest>();
+    onReadOfResendRequest(
+        nopResendRequest.sequenceNumber, nopResendRequest.laneIdx);
+  } else if (message.index() == message.index_of<Resend>()) {
+    // This posts the read of the chunk that follows, before the one of the
+    // next control message.
+    const Resend& nopResend = *message.get<Resend>();
+    onReadOfResend(nopResend.sequenceNumber, nopResend.laneIdx);
+  } else {
+    TP_THROW_ASSERT() << "unknown control message";
+  }
+
+  // The handlers above may have put the channel in error.
+  if (!error_) {
+    readControlMessage();
   }
+}
 
-  op.callback(error_);
+void ChannelImpl::onReadOfCredit(uint64_t sequenceNumber) {
+  // The receives, and thus the credits, come in the same order as the sends,
+  // hence the credit is for the first send that's still waiting for one.
+  auto iter = std::find_if(
+      sendOperations_.begin(),
+      sendOperations_.end(),
+      [](const SendOperation& op) { return op.waitingForCredit; });
+  TP_THROW_ASSERT_IF(iter == sendOperations_.end())
+      << "Got a credit for a send that doesn't exist";
+  TP_DCHECK_EQ(iter->sequenceNumber, sequenceNumber);
+  iter->waitingForCredit = false;
+  sendOperation(*iter);
+  completeSendOperations();
+}
 
-  TP_DCHECK(!sendOperations_.empty());
-  TP_DCHECK(&op == &sendOperations_.front());
-  sendOperations_.pop_front();
+void ChannelImpl::onReadOfAck(uint64_t sequenceNumber) {
+  auto iter = std::find_if(
+      sendOperations_.begin(),
+      sendOperations_.end(),
+      [&](const SendOperation& op) {
+        return op.sequenceNumber == sequenceNumber;
+      });
+  TP_THROW_ASSERT_IF(iter == sendOperations_.end() || !iter->waitingForAck)
+      << "Got an ack for a send that doesn't exist";
+  iter->waitingForAck = false;
+  completeSendOperations();
 }
 
-void ChannelImpl::onReadOfPayload(RecvOperation& op) {
+void ChannelImpl::onReadOfResendRequest(
+    uint64_t sequenceNumber,
+    uint64_t laneIdx) {
+  TP_THROW_ASSERT_IF(!laneFailover_ || laneIdx >= numLanes_)
+      << "Got a resend request for a lane that doesn't exist";
+  // The receiver only asks for chunks of lanes that it knows are down.
+  if (!laneIsDown_[laneIdx]) {
+    takeLaneDown(
+        laneIdx, TP_CREATE_ERROR(PeerLaneFailureError), /*tellPeer=*/false);
+    if (error_) {
+      return;
+    }
+  }
+
+  // The send can't be complete, as the receiver didn't acknowledge it.
+  auto iter = std::find_if(
+      sendOperations_.begin(),
+      sendOperations_.end(),
+      [&](const SendOperation& op) {
+        return op.sequenceNumber == sequenceNumber;
+      });
+  TP_THROW_ASSERT_IF(iter == sendOperations_.end() || !iter->waitingForAck)
+      << "Got a resend request for a send that doesn't exist";
+  SendOperation& op = *iter;
+  const uint64_t offset = std::accumulate(
+      op.laneLengths.begin(), op.laneLengths.begin() + laneIdx, uint64_t(0));
+  const uint64_t length = op.laneLengths[laneIdx];
+  TP_DCHECK_GT(length, 0);
+
+  writeControlMessage(Resend{sequenceNumber, laneIdx});
+  TP_VLOG(6) << "Channel " << id_ << " writing payload #" << sequenceNumber
+             << " of lane " << laneIdx << " on connection";
+  connection_->write(
+      reinterpret_cast<const uint8_t*>(op.ptr) + offset,
+      length,
+      eagerCallbackWrapper_([&op, laneIdx](ChannelImpl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_ << " done writing payload #"
+                   << op.sequenceNumber << " of lane " << laneIdx
+                   << " on connection";
+        --op.numChunksBeingWritten;
+        impl.completeSendOperations();
+      }));
+  ++op.numChunksBeingWritten;
+}
+
+void ChannelImpl::onReadOfResend(uint64_t sequenceNumber, uint64_t laneIdx) {
+  auto iter = std::find_if(
+      recvOperations_.begin(),
+      recvOperations_.end(),
+      [&](const RecvOperation& op) {
+        return op.sequenceNumber == sequenceNumber;
+      });
+  TP_THROW_ASSERT_IF(
+      iter == recvOperations_.end() || laneIdx >= numLanes_ ||
+      iter->chunkStates[laneIdx] != ChunkState::kResending)
+      << "Got a chunk that wasn't asked for";
+  RecvOperation& op = *iter;
+  const uint64_t offset = std::accumulate(
+      op.laneLengths.begin(), op.laneLengths.begin() + laneIdx, uint64_t(0));
+
+  TP_VLOG(6) << "Channel " << id_ << " reading payload #" << sequenceNumber
+             << " of lane " << laneIdx << " on connection";
+  connection_->read(
+      reinterpret_cast<uint8_t*>(op.ptr) + offset,
+      op.laneLengths[laneIdx],
+      eagerCallbackWrapper_([&op, laneIdx](
+                                ChannelImpl& impl,
+                                const void* /* unused */,
+                                size_t /* unused */) {
+        TP_VLOG(6) << "Channel " << impl.id_ << " done reading payload #"
+                   << op.sequenceNumber << " of lane " << laneIdx
+                   << " on connection";
+        impl.onReadOfResentPayload(op, laneIdx);
+      }));
+  ++op.numChunksBeingRead;
+}
+
+void ChannelImpl::onWriteOfPayload(
+    SendOperation& op,
+    uint64_t laneIdx,
+    uint64_t length,
+    bool succeeded) {
+  TP_DCHECK(context_->inLoop());
+
+  // Only large enough chunks tell something about the throughput rather than
+  // about the latency. A moving average smooths out the fluctuations.
+  constexpr double kThroughputSmoothing = 0.25;
+  LaneStats& stats = laneStats_[laneIdx];
+  const auto now = std::chrono::steady_clock::now();
+  const double seconds =
+      std::chrono::duration<double>(now - stats.busySince).count();
+  if (!error_ && succeeded && length >= minChunkSize_ && seconds > 0) {
+    const double throughput = length / seconds;
+    stats.throughput = stats.throughput > 0
+        ? kThroughputSmoothing * throughput +
+            (1 - kThroughputSmoothing) * stats.throughput
+        : throughput;
+  }
+  stats.busySince = now;
+  --stats.numChunksBeingWritten;
+
+  --op.numChunksBeingWritten;
+  completeSendOperations();
+}
+
+void ChannelImpl::onReadOfPayload(
+    RecvOperation& op,
+    uint64_t laneIdx,
+    bool succeeded) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK_EQ(state_, ESTABLISHED);
+
+  // If the lane went down in the meantime the chunk was asked for again, and
+  // whatever this read got will be overwritten with the same bytes.
+  --op.numChunksBeingRead;
+  if (!error_ && succeeded &&
+      op.chunkStates[laneIdx] == ChunkState::kReadingFromLane) {
+    markChunkAsDone(op, laneIdx);
+  }
+  completeRecvOperations();
+}
+
+void ChannelImpl::onReadOfResentPayload(RecvOperation& op, uint64_t laneIdx) {
   TP_DCHECK(context_->inLoop());
   TP_DCHECK_EQ(state_, ESTABLISHED);
 
   --op.numChunksBeingRead;
-  if (op.numChunksBeingRead > 0) {
+  if (!error_) {
+    markChunkAsDone(op, laneIdx);
+  }
+  completeRecvOperations();
+}
+
+void ChannelImpl::markChunkAsDone(RecvOperation& op, uint64_t laneIdx) {
+  op.chunkStates[laneIdx] = ChunkState::kDone;
+  --op.numChunksLeft;
+  if (laneFailover_ && op.numChunksLeft == 0) {
+    writeControlMessage(Ack{op.sequenceNumber});
+  }
+}
+
+void ChannelImpl::onErrorOfLane(uint64_t laneIdx, const Error& error) {
+  TP_DCHECK(context_->inLoop());
+
+  if (!laneFailover_) {
+    setError(error);
+    return;
+  }
+  // Once the channel is in error, or the lane is down, the lane's operations
+  // fail as it's being closed.
+  if (!error_ && !laneIsDown_[laneIdx]) {
+    takeLaneDown(laneIdx, error, /*tellPeer=*/true);
+  }
+}
+
+void ChannelImpl::takeLaneDown(
+    uint64_t laneIdx,
+    const Error& error,
+    bool tellPeer) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(laneFailover_);
+  TP_DCHECK(!laneIsDown_[laneIdx]);
+
+  TP_VLOG(5) << "Channel " << id_ << " lost lane " << laneIdx << ": "
+             << error.what();
+  laneIsDown_[laneIdx] = true;
+  numLanesDown_++;
+  if (numLanesDown_ == numLanes_) {
+    setError(error);
     return;
   }
 
-  op.callback(error_);
+  if (tellPeer) {
+    writeControlMessage(LaneFailure{laneIdx});
+  }
+  // The reads still pending on the lane will fail once it's closed, and in any
+  // case the bytes they got can't be trusted to be all there.
+  for (RecvOperation& op : recvOperations_) {
+    if (op.chunkStates[laneIdx] == ChunkState::kReadingFromLane) {
+      op.chunkStates[laneIdx] = ChunkState::kResending;
+      writeControlMessage(ResendRequest{op.sequenceNumber, laneIdx});
+    }
+  }
+  if (lanes_[laneIdx]) {
+    lanes_[laneIdx]->close();
+  }
+}
+
+void ChannelImpl::completeSendOperations() {
+  // Once in error, the sends still waiting for a credit or an ack won't ever
+  // get it.
+  while (!sendOperations_.empty() &&
+         sendOperations_.front().numChunksBeingWritten == 0 &&
+         ((!sendOperations_.front().waitingForCredit &&
+           !sendOperations_.front().waitingForAck) ||
+          error_)) {
+    sendOperations_.front().callback(error_);
+    sendOperations_.pop_front();
+  }
+}
 
-  TP_DCHECK(!recvOperations_.empty());
-  TP_DCHECK(&op == &recvOperations_.front());
-  recvOperations_.pop_front();
+void ChannelImpl::completeRecvOperations() {
+  // Once in error, the chunks that were asked for again won't ever come.
+  while (!recvOperations_.empty() &&
+         recvOperations_.front().numChunksBeingRead == 0 &&
+         (recvOperations_.front().numChunksLeft == 0 || error_)) {
+    recvOperations_.front().callback(error_);
+    recvOperations_.pop_front();
+  }
 }
 
 void ChannelImpl::handleErrorImpl() {
@@ -314,6 +744,14 @@ void ChannelImpl::handleErrorImpl() {
     context_->unregisterConnectionRequest(iter.second);
   }
 
+  // The sends at the front that are waiting for a credit or an ack, and the
+  // recvs that are waiting for a chunk to be sent again, have no callback that
+  // would complete them.
+  if (state_ == ESTABLISHED) {
+    completeSendOperations();
+    completeRecvOperations();
+  }
+
   context_->unenroll(*this);
 }
 
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <deque>
 #include <memory>
 #include <string>
@@ -28,19 +29,47 @@ struct SendOperation {
   uint64_t sequenceNumber;
   const void* ptr;
   size_t length;
+  std::vector<uint64_t> laneLengths;
   int64_t numChunksBeingWritten{0};
+  // With flow control, whether the receiver has yet to grant a credit for it.
+  bool waitingForCredit{false};
+  // With lane failover, whether the receiver has yet to acknowledge it.
+  bool waitingForAck{false};
   TSendCallback callback;
 };
 
+// Where the receiver is with the chunk of a tensor on a lane.
+enum class ChunkState {
+  kReadingFromLane,
+  // With lane failover, the lane failed, and the sender was asked to send the
+  // chunk again on the connection.
+  kResending,
+  kDone,
+};
+
 // State capturing a single recv operation.
 struct RecvOperation {
   uint64_t sequenceNumber;
   void* ptr;
   size_t length;
+  std::vector<uint64_t> laneLengths;
+  std::vector<ChunkState> chunkStates;
+  // The reads that the transports still hold the buffer for.
   int64_t numChunksBeingRead{0};
+  // The chunks that didn't make it into the buffer yet.
+  int64_t numChunksLeft{0};
   TRecvCallback callback;
 };
 
+// What the sender observed of the speed of a lane.
+struct LaneStats {
+  // In bytes per second, or zero if it wasn't measured yet.
+  double throughput{0};
+  // Since when the lane has been busy writing its current chunk.
+  std::chrono::steady_clock::time_point busySince;
+  int64_t numChunksBeingWritten{0};
+};
+
 class ContextImpl;
 
 class ChannelImpl final
@@ -52,7 +81,10 @@ class ChannelImpl final
       std::string id,
       std::shared_ptr<transport::Connection> connection,
       Endpoint endpoint,
-      uint64_t numLanes);
+      uint64_t numLanes,
+      size_t minChunkSize,
+      bool flowControl,
+      bool laneFailover);
 
  protected:
   // Implement the entry points called by ChannelImplBoilerplate.
@@ -89,6 +121,9 @@ class ChannelImpl final
   // operations that were performed in the meantime and queued.
   void startSendingAndReceivingUponEstablishingChannel();
 
+  // Decide how many bytes of a tensor of the given length each lane carries.
+  std::vector<uint64_t> chooseLaneLengths(size_t length);
+
   // Performs the chunking and the writing of one send operation.
   void sendOperation(SendOperation& op);
 
@@ -96,17 +131,61 @@ class ChannelImpl final
   void recvOperation(RecvOperation& op);
 
   // Called when the write of one chunk of a send operation has been completed.
-  void onWriteOfPayload(SendOperation& op);
+  void onWriteOfPayload(
+      SendOperation& op,
+      uint64_t laneIdx,
+      uint64_t length,
+      bool succeeded);
 
   // Called when the read of one chunk of a recv operation has been completed.
-  void onReadOfPayload(RecvOperation& op);
+  void onReadOfPayload(RecvOperation& op, uint64_t laneIdx, bool succeeded);
+  void onReadOfResentPayload(RecvOperation& op, uint64_t laneIdx);
+  void markChunkAsDone(RecvOperation& op, uint64_t laneIdx);
+
+  // With flow control or lane failover, once the lanes are established, the
+  // connection carries the control messages (see nop_types.h), such as the
+  // credits that each receiver grants for the next tensor, after posting the
+  // reads of its chunks.
+  void readControlMessage();
+  void writeControlMessage(ControlMessage message);
+  void onReadOfControlMessage(const ControlMessage& message);
+  void onReadOfCredit(uint64_t sequenceNumber);
+  void onReadOfAck(uint64_t sequenceNumber);
+  void onReadOfResendRequest(uint64_t sequenceNumber, uint64_t laneIdx);
+  void onReadOfResend(uint64_t sequenceNumber, uint64_t laneIdx);
+
+  // Like eagerCallbackWrapper_, for the operations on the lanes, except that
+  // with lane failover an error only takes down the lane, rather than the whole
+  // channel.
+  template <typename TBoundFn>
+  auto laneCallbackWrapper(uint64_t laneIdx, TBoundFn&& fn);
+
+  void onErrorOfLane(uint64_t laneIdx, const Error& error);
+
+  // With lane failover, stop using the lane, and ask the sender to send again
+  // the chunks that were expected from it. The peer is told about it, unless
+  // it's the one that reported it.
+  void takeLaneDown(uint64_t laneIdx, const Error& error, bool tellPeer);
+
+  // Fire the callbacks of the operations at the front of the queues that are
+  // done, in order, as the chunks of later operations may complete earlier.
+  void completeSendOperations();
+  void completeRecvOperations();
 
   const std::shared_ptr<transport::Connection> connection_;
   const Endpoint endpoint_;
   State state_{UNINITIALIZED};
   const uint64_t numLanes_;
+  const size_t minChunkSize_;
+  const bool flowControl_;
+  const bool laneFailover_;
   uint64_t numLanesBeingAccepted_{0};
   std::vector<std::shared_ptr<transport::Connection>> lanes_;
+  std::vector<LaneStats> laneStats_;
+  std::vector<bool> laneIsDown_;
+  uint64_t numLanesDown_{0};
+  // The lane that the next tensor that isn't split goes on.
+  uint64_t nextLaneIdx_{0};
   std::unordered_map<uint64_t, uint64_t> laneRegistrationIds_;
 
   std::deque<SendOperation> sendOperations_;
@@ -8,6 +8,8 @@
 
 #include <tensorpipe/channel/mpt/context.h>
 
+#include <functional>
+#include <map>
 #include <memory>
 #include <string>
 #include <utility>
@@ -20,12 +22,47 @@ namespace tensorpipe {
 namespace channel {
 namespace mpt {
 
+namespace {
+
+std::shared_ptr<ContextImpl> makeContextImpl(
+    const std::function<std::shared_ptr<transport::Context>()>& contextFactory,
+    size_t numLanes,
+    const std::string& address,
+    MptOptions mptOptions) {
+  std::vector<std::shared_ptr<transport::Context>> contexts;
+  std::vector<std::shared_ptr<transport::Listener>> listeners;
+  for (size_t laneIdx = 0; laneIdx < numLanes; laneIdx++) {
+    std::shared_ptr<transport::Context> context = contextFactory();
+    listeners.push_back(context->listen(address));
+    contexts.push_back(std::move(context));
+  }
+  return std::make_shared<ContextImpl>(
+      std::move(contexts), std::move(listeners), std::move(mptOptions));
+}
+
+} // namespace
+
 Context::Context(
     std::vector<std::shared_ptr<transport::Context>> contexts,
-    std::vector<std::shared_ptr<transport::Listener>> listeners)
+    std::vector<std::shared_ptr<transport::Listener>> listeners,
+    MptOptions mptOptions)
     : impl_(std::make_shared<ContextImpl>(
           std::move(contexts),
-          std::move(listeners))) {
+          std::move(listeners),
+          std::move(mptOptions))) {
+  impl_->init();
+}
+
+Context::Context(
+    std::function<std::shared_ptr<transport::Context>()> contextFactory,
+    size_t numLanes,
+    const std::string& address,
+    MptOptions mptOptions)
+    : impl_(makeContextImpl(
+          contextFactory,
+          numLanes,
+          address,
+          std::move(mptOptions))) {
   impl_->init();
 }
 
@@ -47,6 +84,14 @@ void Context::setId(std::string id) {
   impl_->setId(std::move(id));
 }
 
+void Context::enableLoopStats() {
+  impl_->enableLoopStats();
+}
+
+std::map<std::string, LoopStats> Context::getLoopStats() {
+  return impl_->getLoopStats();
+}
+
 void Context::close() {
   impl_->close();
 }
@@ -8,8 +8,12 @@
 
 #pragma once
 
+#include <cstddef>
+#include <functional>
+#include <map>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <tensorpipe/channel/cpu_context.h>
@@ -21,11 +25,92 @@ namespace mpt {
 
 class ContextImpl;
 
+// Tensors smaller than twice this go on a single lane, and larger ones are
+// split in chunks of at least this size.
+constexpr size_t kDefaultMinChunkSize = 256 * 1024;
+
+// How the channel shares the tensors out among its lanes, and whether it waits
+// for the receiver and survives the failure of some of them. The defaults
+// split the tensors in chunks of at least kDefaultMinChunkSize, without flow
+// control nor lane failover.
+class MptOptions {
+ public:
+  // Small tensors are sent whole on one lane, taking turns among the lanes,
+  // whereas large ones are split among several lanes, in chunks of at least
+  // this many bytes. The lanes get shares of the tensors that are proportional
+  // to the throughput they were observed to achieve, so that a slower lane
+  // doesn't hold back the whole transfer.
+  MptOptions&& minChunkSize(size_t minChunkSize) && {
+    minChunkSize_ = minChunkSize;
+    return std::move(*this);
+  }
+
+  // With flow control, a sender only writes a tensor into the lanes once the
+  // receiver has posted the buffer for it, which costs an additional one-way
+  // latency but keeps the transports from buffering the tensors of a slow
+  // receiver. Both ends must agree on it.
+  MptOptions&& flowControl(bool enabled) && {
+    flowControl_ = enabled;
+    return std::move(*this);
+  }
+
+  // With lane failover, the failure of a lane only takes that lane down: the
+  // chunks that it lost are sent again on the connection of the channel, and
+  // the following tensors are split among the lanes that are left. The channel
+  // only fails when all its lanes did, or when its connection does. This costs
+  // a round trip per tensor, as a sender must hold on to its tensor until the
+  // receiver acknowledged all of its chunks. Both ends must agree on it.
+  MptOptions&& laneFailover(bool enabled) && {
+    laneFailover_ = enabled;
+    return std::move(*this);
+  }
+
+  size_t getMinChunkSize() const {
+    return minChunkSize_;
+  }
+
+  bool getFlowControl() const {
+    return flowControl_;
+  }
+
+  bool getLaneFailover() const {
+    return laneFailover_;
+  }
+
+ private:
+  size_t minChunkSize_{kDefaultMinChunkSize};
+  bool flowControl_{false};
+  bool laneFailover_{false};
+};
+
 class Context : public CpuContext {
  public:
+  // Each pair of a transport context and a listener on it provides one lane,
+  // and the tensors are shared out among the lanes according to mptOptions.
+  //
+  // To stripe the tensors over several NICs, give each lane a transport
+  // context that goes through a different one, e.g., a uv context whose
+  // listener is bound to the address of each interface (with the interfaces on
+  // different subnets, so that the routes to the peer's addresses go through
+  // them), or an ibv context on each device.
   Context(
       std::vector<std::shared_ptr<transport::Context>> contexts,
-      std::vector<std::shared_ptr<transport::Listener>> listeners);
+      std::vector<std::shared_ptr<transport::Listener>> listeners,
+      MptOptions mptOptions = MptOptions());
+
+  // Make numLanes lanes, each with the transport context returned by a call to
+  // the factory, listening on the given address. For the lanes to be handled
+  // in parallel by several threads they need to go through different event
+  // loops: either have the factory make a new transport context for each lane,
+  // or return the same one each time, if it runs one loop per lane (e.g., a uv
+  // context with numLoops set to numLanes, which spreads its connections over
+  // its loops). A transport context that is used by several lanes is only
+  // reported once among the loop stats.
+  Context(
+      std::function<std::shared_ptr<transport::Context>()> contextFactory,
+      size_t numLanes,
+      const std::string& address,
+      MptOptions mptOptions = MptOptions());
 
   Context(const Context&) = delete;
   Context(Context&&) = delete;
@@ -40,6 +125,10 @@ class Context : public CpuContext {
 
   void setId(std::string id) override;
 
+  void enableLoopStats() override;
+
+  std::map<std::string, LoopStats> getLoopStats() override;
+
   void close() override;
 
   void join() override;
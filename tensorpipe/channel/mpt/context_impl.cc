@@ -8,8 +8,10 @@
 
 #include <tensorpipe/channel/mpt/context_impl.h>
 
+#include <map>
 #include <memory>
 #include <sstream>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -28,7 +30,9 @@ namespace mpt {
 namespace {
 
 std::string generateDomainDescriptor(
-    const std::vector<std::shared_ptr<transport::Context>>& contexts) {
+    const std::vector<std::shared_ptr<transport::Context>>& contexts,
+    bool flowControl,
+    bool laneFailover) {
   // FIXME Escape the contexts' domain descriptors in case they contain a colon?
   // Or put them all in a nop object, that'll do the escaping for us.
   // But is it okay to compare nop objects by equality bitwise?
@@ -37,6 +41,13 @@ std::string generateDomainDescriptor(
   for (const auto& context : contexts) {
     ss << ":" << context->domainDescriptor();
   }
+  // The two ends must agree on whether to use flow control.
+  if (flowControl) {
+    ss << ":flow_control";
+  }
+  if (laneFailover) {
+    ss << ":lane_failover";
+  }
   return ss.str();
 }
 
@@ -44,13 +55,22 @@ std::string generateDomainDescriptor(
 
 ContextImpl::ContextImpl(
     std::vector<std::shared_ptr<transport::Context>> contexts,
-    std::vector<std::shared_ptr<transport::Listener>> listeners)
+    std::vector<std::shared_ptr<transport::Listener>> listeners,
+    MptOptions mptOptions)
     : ContextImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl>(
-          generateDomainDescriptor(contexts)),
+          generateDomainDescriptor(
+              contexts,
+              mptOptions.getFlowControl(),
+              mptOptions.getLaneFailover())),
       contexts_(std::move(contexts)),
-      listeners_(std::move(listeners)) {
+      listeners_(std::move(listeners)),
+      minChunkSize_(mptOptions.getMinChunkSize()),
+      flowControl_(mptOptions.getFlowControl()),
+      laneFailover_(mptOptions.getLaneFailover()) {
   TP_THROW_ASSERT_IF(contexts_.size() != listeners_.size());
+  TP_THROW_ASSERT_IF(minChunkSize_ == 0) << "The minimum chunk size is zero";
   numLanes_ = contexts_.size();
+  laneErrors_.resize(numLanes_);
 
   addresses_.reserve(numLanes_);
   for (const auto& listener : listeners_) {
@@ -73,7 +93,13 @@ void ContextImpl::initFromLoop() {
 std::shared_ptr<CpuChannel> ContextImpl::createChannel(
     std::shared_ptr<transport::Connection> connection,
     Endpoint endpoint) {
-  return createChannelInternal(std::move(connection), endpoint, numLanes_);
+  return createChannelInternal(
+      std::move(connection),
+      endpoint,
+      numLanes_,
+      minChunkSize_,
+      flowControl_,
+      laneFailover_);
 }
 
 const std::vector<std::string>& ContextImpl::addresses() const {
@@ -82,6 +108,11 @@ const std::vector<std::string>& ContextImpl::addresses() const {
   return addresses_;
 }
 
+bool ContextImpl::isLaneDown(uint64_t laneIdx) {
+  TP_DCHECK(loop_.inLoop());
+  return static_cast<bool>(laneErrors_[laneIdx]);
+}
+
 uint64_t ContextImpl::registerConnectionRequest(
     uint64_t laneIdx,
     connection_request_callback_fn fn) {
@@ -109,16 +140,18 @@ void ContextImpl::registerConnectionRequestFromLoop(
              << " received a connection request registration (#"
              << registrationId << ") on lane " << laneIdx;
 
-  if (error_) {
+  if (error_ || laneErrors_[laneIdx]) {
     TP_VLOG(4) << "Channel context " << id_
                << " calling a connection request registration callback (#"
                << registrationId << ")";
-    fn(error_, std::shared_ptr<transport::Connection>());
+    fn(error_ ? error_ : laneErrors_[laneIdx],
+       std::shared_ptr<transport::Connection>());
     TP_VLOG(4) << "Channel context " << id_
                << " done calling a connection request registration callback (#"
                << registrationId << ")";
   } else {
-    connectionRequestRegistrations_.emplace(registrationId, std::move(fn));
+    connectionRequestRegistrations_.emplace(
+        registrationId, ConnectionRequest{laneIdx, std::move(fn)});
   }
 }
 
@@ -151,17 +184,56 @@ void ContextImpl::acceptLane(uint64_t laneIdx) {
 
   TP_VLOG(6) << "Channel context " << id_ << " accepting connection on lane "
              << laneIdx;
-  listeners_[laneIdx]->accept(lazyCallbackWrapper_(
+  listeners_[laneIdx]->accept(runIfAlive(
+      *this,
       [laneIdx](
           ContextImpl& impl,
+          const Error& error,
           std::shared_ptr<transport::Connection> connection) {
-        TP_VLOG(6) << "Channel context " << impl.id_
-                   << " done accepting connection on lane " << laneIdx;
-        impl.onAcceptOfLane(std::move(connection));
-        impl.acceptLane(laneIdx);
+        impl.loop_.deferToLoop(
+            [&impl, laneIdx, error, connection]() mutable {
+              TP_VLOG(6) << "Channel context " << impl.id_
+                         << " done accepting connection on lane " << laneIdx;
+              if (impl.error_) {
+                return;
+              }
+              if (error) {
+                impl.onErrorOfLane(laneIdx, error);
+                return;
+              }
+              impl.onAcceptOfLane(std::move(connection));
+              impl.acceptLane(laneIdx);
+            });
       }));
 }
 
+void ContextImpl::onErrorOfLane(uint64_t laneIdx, const Error& error) {
+  TP_DCHECK(loop_.inLoop());
+
+  if (!laneFailover_ || numLanesDown_ + 1 == numLanes_) {
+    setError(error);
+    return;
+  }
+
+  TP_VLOG(4) << "Channel context " << id_ << " lost lane " << laneIdx << ": "
+             << error.what();
+  laneErrors_[laneIdx] = error;
+  numLanesDown_++;
+
+  // The channels that are still waiting for a connection on this lane won't
+  // ever get it.
+  for (auto iter = connectionRequestRegistrations_.begin();
+       iter != connectionRequestRegistrations_.end();) {
+    if (iter->second.laneIdx == laneIdx) {
+      connection_request_callback_fn fn = std::move(iter->second.fn);
+      iter = connectionRequestRegistrations_.erase(iter);
+      fn(error, std::shared_ptr<transport::Connection>());
+    } else {
+      ++iter;
+    }
+  }
+}
+
 void ContextImpl::onAcceptOfLane(
     std::shared_ptr<transport::Connection> connection) {
   TP_DCHECK(loop_.inLoop());
@@ -199,7 +271,7 @@ void ContextImpl::onReadClientHelloOnLane(
   // The connection request may have already been deregistered, for example
   // because the channel may have been closed.
   if (iter != connectionRequestRegistrations_.end()) {
-    auto fn = std::move(iter->second);
+    auto fn = std::move(iter->second.fn);
     connectionRequestRegistrations_.erase(iter);
     fn(Error::kSuccess, std::move(connection));
   }
@@ -222,7 +294,7 @@ void ContextImpl::handleError() {
              << error_.what();
 
   for (auto& iter : connectionRequestRegistrations_) {
-    connection_request_callback_fn fn = std::move(iter.second);
+    connection_request_callback_fn fn = std::move(iter.second.fn);
     fn(error_, std::shared_ptr<transport::Connection>());
   }
   connectionRequestRegistrations_.clear();
@@ -236,6 +308,29 @@ void ContextImpl::handleError() {
   }
 }
 
+void ContextImpl::enableLoopStats() {
+  for (const auto& context : contexts_) {
+    context->enableLoopStats();
+  }
+}
+
+std::map<std::string, LoopStats> ContextImpl::getLoopStats() {
+  std::map<std::string, LoopStats> stats;
+  // The lanes may share a transport context that runs several loops.
+  std::unordered_set<transport::Context*> seenContexts;
+  for (uint64_t laneIdx = 0; laneIdx < numLanes_; ++laneIdx) {
+    if (!seenContexts.insert(contexts_[laneIdx].get()).second) {
+      continue;
+    }
+    for (auto& iter : contexts_[laneIdx]->getLoopStats()) {
+      stats.emplace(
+          "ctx_" + std::to_string(laneIdx) + "/" + iter.first,
+          std::move(iter.second));
+    }
+  }
+  return stats;
+}
+
 void ContextImpl::setIdImpl() {
   for (uint64_t laneIdx = 0; laneIdx < numLanes_; ++laneIdx) {
     contexts_[laneIdx]->setId(id_ + ".ctx_" + std::to_string(laneIdx));
@@ -263,7 +358,7 @@ bool ContextImpl::inLoop() {
   return loop_.inLoop();
 };
 
-void ContextImpl::deferToLoop(std::function<void()> fn) {
+void ContextImpl::deferToLoop(TTask fn) {
   loop_.deferToLoop(std::move(fn));
 };
 
@@ -10,6 +10,7 @@
 
 #include <atomic>
 #include <functional>
+#include <map>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -18,6 +19,7 @@
 
 #include <tensorpipe/channel/context_impl_boilerplate.h>
 #include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/channel/mpt/context.h>
 #include <tensorpipe/channel/mpt/nop_types.h>
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/common/cpu_buffer.h>
@@ -35,7 +37,8 @@ class ContextImpl final
  public:
   ContextImpl(
       std::vector<std::shared_ptr<transport::Context>> contexts,
-      std::vector<std::shared_ptr<transport::Listener>> listeners);
+      std::vector<std::shared_ptr<transport::Listener>> listeners,
+      MptOptions mptOptions);
 
   void init();
 
@@ -45,13 +48,22 @@ class ContextImpl final
 
   // Implement the DeferredExecutor interface.
   bool inLoop() override;
-  void deferToLoop(std::function<void()> fn) override;
+  void deferToLoop(TTask fn) override;
 
   using connection_request_callback_fn =
       std::function<void(const Error&, std::shared_ptr<transport::Connection>)>;
 
   const std::vector<std::string>& addresses() const;
 
+  // With lane failover, whether the listener of the lane failed, in which case
+  // the lane is left out of the channels that are established from then on.
+  bool isLaneDown(uint64_t laneIdx);
+
+  // The loops are those of the transport contexts of the lanes.
+  void enableLoopStats();
+
+  std::map<std::string, LoopStats> getLoopStats();
+
   uint64_t registerConnectionRequest(
       uint64_t laneIdx,
       connection_request_callback_fn fn);
@@ -83,6 +95,7 @@ class ContextImpl final
 
   void acceptLane(uint64_t laneIdx);
   void onAcceptOfLane(std::shared_ptr<transport::Connection> connection);
+  void onErrorOfLane(uint64_t laneIdx, const Error& error);
   void onReadClientHelloOnLane(
       std::shared_ptr<transport::Connection> connection,
       const Packet& nopPacketIn);
@@ -95,7 +108,13 @@ class ContextImpl final
   const std::vector<std::shared_ptr<transport::Listener>> listeners_;
 
   uint64_t numLanes_{0};
+  const size_t minChunkSize_;
+  const bool flowControl_;
+  const bool laneFailover_;
   std::vector<std::string> addresses_;
+  // With lane failover, the error of each lane whose listener failed.
+  std::vector<Error> laneErrors_;
+  uint64_t numLanesDown_{0};
 
   // This is atomic because it may be accessed from outside the loop.
   std::atomic<uint64_t> nextConnectionRequestRegistrationId_{0};
@@ -104,7 +123,11 @@ class ContextImpl final
   std::unordered_set<std::shared_ptr<transport::Connection>>
       connectionsWaitingForHello_;
 
-  std::unordered_map<uint64_t, connection_request_callback_fn>
+  struct ConnectionRequest {
+    uint64_t laneIdx;
+    connection_request_callback_fn fn;
+  };
+  std::unordered_map<uint64_t, ConnectionRequest>
       connectionRequestRegistrations_;
 
   LazyCallbackWrapper<ContextImpl> lazyCallbackWrapper_{*this, this->loop_};
@@ -25,6 +25,7 @@ struct LaneAdvertisement {
   // used inside std::vectors.
   LaneAdvertisement() {}
 
+  // Empty if the lane is down on the server, with lane failover.
   std::string address;
   uint64_t registrationId;
   NOP_STRUCTURE(LaneAdvertisement, address, registrationId);
@@ -42,6 +43,52 @@ struct ClientHello {
 
 using Packet = nop::Variant<ServerHello, ClientHello>;
 
+// How many bytes of the tensor each lane carries (possibly none), in a single
+// contiguous chunk, with the chunks in the order of the lanes.
+struct Descriptor {
+  std::vector<uint64_t> laneLengths;
+  NOP_STRUCTURE(Descriptor, laneLengths);
+};
+
+// With flow control or lane failover, once the lanes are established, these go
+// on the connection, in both directions, as each endpoint is both a sender and
+// a receiver.
+
+// From a receiver, once it posted the buffer for a tensor.
+struct Credit {
+  uint64_t sequenceNumber;
+  NOP_STRUCTURE(Credit, sequenceNumber);
+};
+
+// From a receiver, once it got all the chunks of a tensor.
+struct Ack {
+  uint64_t sequenceNumber;
+  NOP_STRUCTURE(Ack, sequenceNumber);
+};
+
+// From either endpoint, when it sees a lane fail.
+struct LaneFailure {
+  uint64_t laneIdx;
+  NOP_STRUCTURE(LaneFailure, laneIdx);
+};
+
+// From a receiver, for a chunk that it didn't get because its lane failed.
+struct ResendRequest {
+  uint64_t sequenceNumber;
+  uint64_t laneIdx;
+  NOP_STRUCTURE(ResendRequest, sequenceNumber, laneIdx);
+};
+
+// From a sender, followed by the chunk that was asked for.
+struct Resend {
+  uint64_t sequenceNumber;
+  uint64_t laneIdx;
+  NOP_STRUCTURE(Resend, sequenceNumber, laneIdx);
+};
+
+using ControlMessage =
+    nop::Variant<Credit, Ack, LaneFailure, ResendRequest, Resend>;
+
 } // namespace mpt
 } // namespace channel
 } // namespace tensorpipe
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/function.h>
+
+namespace tensorpipe {
+namespace channel {
+
+// Lets a channel work on several of its operations of a same kind (sends or
+// recvs, as numbered by ChannelImplBoilerplate) at once, e.g., so that the
+// tensors of a message are transferred in parallel, while still handing their
+// completions back in the order of their sequence numbers, which is how the
+// peer matches them (for instance by counting notifications). At most a given
+// number of operations are started ahead of the oldest one that hasn't been
+// retired yet, which bounds the resources (threads, staging buffers, ...) that
+// a channel may take up, and the others are started as those retire.
+//
+// This isn't thread-safe: it's meant to be used from a channel's loop. The
+// functions it's given may in turn enqueue or complete operations.
+class OperationWindow {
+ public:
+  using TFn = MoveOnlyFunction<void()>;
+
+  explicit OperationWindow(size_t maxInFlight) : maxInFlight_(maxInFlight) {
+    TP_DCHECK_GT(maxInFlight_, 0);
+  }
+
+  OperationWindow(const OperationWindow&) = delete;
+  OperationWindow(OperationWindow&&) = delete;
+  OperationWindow& operator=(const OperationWindow&) = delete;
+  OperationWindow& operator=(OperationWindow&&) = delete;
+
+  // Run the start function of the operation, whose sequence number must follow
+  // the one of the previous operation, as soon as there's room for it.
+  void enqueue(uint64_t sequenceNumber, TFn startFn) {
+    TP_DCHECK(
+        entries_.empty() ||
+        entries_.back().sequenceNumber + 1 == sequenceNumber);
+    entries_.push_back(Entry{
+        sequenceNumber,
+        std::move(startFn),
+        /*done=*/false,
+        /*completeFn=*/TFn()});
+    advance();
+  }
+
+  // Mark the operation, which must have started, as done, and run the given
+  // function once all the earlier ones have been retired too.
+  void complete(uint64_t sequenceNumber, TFn completeFn) {
+    TP_DCHECK(!entries_.empty());
+    TP_DCHECK_GE(sequenceNumber, entries_.front().sequenceNumber);
+    const size_t offset = sequenceNumber - entries_.front().sequenceNumber;
+    TP_DCHECK_LT(offset, numStarted_);
+    Entry& entry = entries_[offset];
+    TP_DCHECK(!entry.done);
+    entry.done = true;
+    entry.completeFn = std::move(completeFn);
+    advance();
+  }
+
+  // The number of operations that have started and haven't been retired yet.
+  size_t numInFlight() const {
+    return numStarted_;
+  }
+
+  size_t numPending() const {
+    return entries_.size() - numStarted_;
+  }
+
+ private:
+  struct Entry {
+    uint64_t sequenceNumber;
+    TFn startFn;
+    bool done{false};
+    TFn completeFn;
+  };
+
+  const size_t maxInFlight_;
+  // The operations that haven't been retired yet, by sequence number, of which
+  // the first numStarted_ have been started.
+  std::deque<Entry> entries_;
+  size_t numStarted_{0};
+  // Set while the functions are being run, so that those they reenter through
+  // enqueue or complete are picked up by the outer call, in order.
+  bool advancing_{false};
+
+  void advance() {
+    if (advancing_) {
+      return;
+    }
+    advancing_ = true;
+    while (true) {
+      if (!entries_.empty() && entries_.front().done) {
+        TFn fn = std::move(entries_.front().completeFn);
+        entries_.pop_front();
+        numStarted_--;
+        if (fn) {
+          fn();
+        }
+        continue;
+      }
+      if (numStarted_ < entries_.size() && numStarted_ < maxInFlight_) {
+        TFn fn = std::move(entries_[numStarted_].startFn);
+        numStarted_++;
+        fn();
+        continue;
+      }
+      break;
+    }
+    advancing_ = false;
+  }
+};
+
+} // namespace channel
+} // namespace tensorpipe
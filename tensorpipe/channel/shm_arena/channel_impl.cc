@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/shm_arena/channel_impl.h>
+
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <nop/serializer.h>
+#include <nop/structure.h>
+
+#include <tensorpipe/channel/helpers.h>
+#include <tensorpipe/channel/shm_arena/context_impl.h>
+#include <tensorpipe/channel/shm_arena/error.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/transport/connection.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace shm_arena {
+
+namespace {
+
+struct Descriptor {
+  uint32_t pid;
+  uint64_t token;
+  uint64_t segmentIdx;
+  int32_t fd;
+  uint64_t offset;
+  NOP_STRUCTURE(Descriptor, pid, token, segmentIdx, fd, offset);
+};
+
+TDescriptor makeDescriptor(const ContextImpl::Location& location) {
+  NopHolder<Descriptor> nopHolder;
+  Descriptor& nopDescriptor = nopHolder.getObject();
+  nopDescriptor.pid = ::getpid();
+  nopDescriptor.token = location.token;
+  nopDescriptor.segmentIdx = location.segmentIdx;
+  nopDescriptor.fd = location.fd;
+  nopDescriptor.offset = location.offset;
+  return saveDescriptor(nopHolder);
+}
+
+} // namespace
+
+ChannelImpl::ChannelImpl(
+    ConstructorToken token,
+    std::shared_ptr<ContextImpl> context,
+    std::string id,
+    std::shared_ptr<transport::Connection> connection)
+    : ChannelImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl>(
+          token,
+          std::move(context),
+          std::move(id)),
+      connection_(std::move(connection)) {}
+
+void ChannelImpl::initImplFromLoop() {
+  context_->enroll(*this);
+}
+
+void ChannelImpl::sendImplFromLoop(
+    uint64_t sequenceNumber,
+    CpuBuffer buffer,
+    TDescriptorCallback descriptorCallback,
+    TSendCallback callback) {
+  // Buffers that aren't in the arena are copied into it first, and kept there
+  // until the peer is done with them.
+  std::shared_ptr<uint8_t> stagingBuffer;
+  optional<ContextImpl::Location> location =
+      context_->locate(buffer.ptr, buffer.length);
+  if (!location.has_value()) {
+    stagingBuffer = context_->allocateStagingBuffer(buffer.length);
+    if (stagingBuffer == nullptr) {
+      setError(TP_CREATE_ERROR(
+          ShmArenaError, "couldn't allocate a buffer in shared memory"));
+      descriptorCallback(error_, std::string());
+      callback(error_);
+      return;
+    }
+    location = context_->locate(stagingBuffer.get(), buffer.length);
+    TP_DCHECK(location.has_value());
+  }
+
+  TP_VLOG(6) << "Channel " << id_ << " is reading notification (#"
+             << sequenceNumber << ")";
+  connection_->read(
+      nullptr,
+      0,
+      eagerCallbackWrapper_(
+          [sequenceNumber, stagingBuffer, callback{std::move(callback)}](
+              ChannelImpl& impl,
+              const void* /* unused */,
+              size_t /* unused */) {
+            TP_VLOG(6) << "Channel " << impl.id_
+                       << " done reading notification (#" << sequenceNumber
+                       << ")";
+            callback(impl.error_);
+          }));
+
+  if (stagingBuffer == nullptr) {
+    descriptorCallback(Error::kSuccess, makeDescriptor(location.value()));
+    return;
+  }
+
+  TP_VLOG(6) << "Channel " << id_ << " is staging tensor (#" << sequenceNumber
+             << ")";
+  context_->requestCopy(
+      stagingBuffer.get(),
+      buffer.ptr,
+      buffer.length,
+      eagerCallbackWrapper_([sequenceNumber,
+                             stagingBuffer,
+                             descriptor{makeDescriptor(location.value())},
+                             descriptorCallback{std::move(descriptorCallback)}](
+                                ChannelImpl& impl) mutable {
+        TP_VLOG(6) << "Channel " << impl.id_ << " done staging tensor (#"
+                   << sequenceNumber << ")";
+        descriptorCallback(impl.error_, std::move(descriptor));
+      }));
+}
+
+void ChannelImpl::recvImplFromLoop(
+    uint64_t sequenceNumber,
+    TDescriptor descriptor,
+    CpuBuffer buffer,
+    TRecvCallback callback) {
+  NopHolder<Descriptor> nopHolder;
+  loadDescriptor(nopHolder, descriptor);
+  const Descriptor& nopDescriptor = nopHolder.getObject();
+
+  recvOperations_.push_back(RecvOperation{sequenceNumber});
+  recvOperations_.back().callback = std::move(callback);
+
+  Error error;
+  const util::shm::Segment* segment;
+  std::tie(error, segment) = context_->mapRemoteSegment(
+      nopDescriptor.pid,
+      nopDescriptor.token,
+      nopDescriptor.segmentIdx,
+      nopDescriptor.fd);
+  if (!error &&
+      (nopDescriptor.offset > segment->getSize() ||
+       buffer.length > segment->getSize() - nopDescriptor.offset)) {
+    error = TP_CREATE_ERROR(
+        ShmArenaError, "tensor lies outside of its shared memory segment");
+  }
+  if (error) {
+    setError(std::move(error));
+    onCopyOfTensor(sequenceNumber);
+    return;
+  }
+
+  TP_VLOG(6) << "Channel " << id_ << " is copying payload (#" << sequenceNumber
+             << ")";
+  context_->requestCopy(
+      buffer.ptr,
+      reinterpret_cast<const uint8_t*>(segment->getPtr()) +
+          nopDescriptor.offset,
+      buffer.length,
+      eagerCallbackWrapper_([sequenceNumber](ChannelImpl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_ << " done copying payload (#"
+                   << sequenceNumber << ")";
+        impl.onCopyOfTensor(sequenceNumber);
+      }));
+}
+
+void ChannelImpl::onCopyOfTensor(uint64_t sequenceNumber) {
+  TP_DCHECK(!recvOperations_.empty());
+  const uint64_t firstSequenceNumber = recvOperations_.front().sequenceNumber;
+  TP_DCHECK_GE(sequenceNumber, firstSequenceNumber);
+  recvOperations_[sequenceNumber - firstSequenceNumber].doneCopying = true;
+
+  while (!recvOperations_.empty() && recvOperations_.front().doneCopying) {
+    RecvOperation& op = recvOperations_.front();
+    if (!error_) {
+      // Let peer know we've completed the copy.
+      TP_VLOG(6) << "Channel " << id_ << " is writing notification (#"
+                 << op.sequenceNumber << ")";
+      connection_->write(
+          nullptr,
+          0,
+          lazyCallbackWrapper_(
+              [sequenceNumber{op.sequenceNumber}](ChannelImpl& impl) {
+                TP_VLOG(6) << "Channel " << impl.id_
+                           << " done writing notification (#" << sequenceNumber
+                           << ")";
+              }));
+    }
+    TRecvCallback callback = std::move(op.callback);
+    recvOperations_.pop_front();
+    callback(error_);
+  }
+}
+
+void ChannelImpl::handleErrorImpl() {
+  connection_->close();
+
+  context_->unenroll(*this);
+}
+
+} // namespace shm_arena
+} // namespace channel
+} // namespace tensorpipe
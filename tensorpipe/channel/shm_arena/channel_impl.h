@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/channel/channel_impl_boilerplate.h>
+#include <tensorpipe/common/cpu_buffer.h>
+#include <tensorpipe/transport/context.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace shm_arena {
+
+class ContextImpl;
+
+class ChannelImpl final
+    : public ChannelImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl> {
+ public:
+  ChannelImpl(
+      ConstructorToken token,
+      std::shared_ptr<ContextImpl> context,
+      std::string id,
+      std::shared_ptr<transport::Connection> connection);
+
+ protected:
+  // Implement the entry points called by ChannelImplBoilerplate.
+  void initImplFromLoop() override;
+  void sendImplFromLoop(
+      uint64_t sequenceNumber,
+      CpuBuffer buffer,
+      TDescriptorCallback descriptorCallback,
+      TSendCallback callback) override;
+  void recvImplFromLoop(
+      uint64_t sequenceNumber,
+      TDescriptor descriptor,
+      CpuBuffer buffer,
+      TRecvCallback callback) override;
+  void handleErrorImpl() override;
+
+ private:
+  const std::shared_ptr<transport::Connection> connection_;
+
+  // The copies may complete out of order, but the peer matches the
+  // notifications to its send operations in order, hence these are completed
+  // in order, once all the previous ones are.
+  struct RecvOperation {
+    uint64_t sequenceNumber;
+    bool doneCopying{false};
+    TRecvCallback callback;
+  };
+  std::deque<RecvOperation> recvOperations_;
+
+  void onCopyOfTensor(uint64_t sequenceNumber);
+};
+
+} // namespace shm_arena
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/shm_arena/context.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <tensorpipe/channel/shm_arena/channel_impl.h>
+#include <tensorpipe/channel/shm_arena/context_impl.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace shm_arena {
+
+Context::Context(
+    size_t arenaSize,
+    size_t numThreads,
+    ThreadOptions threadOptions)
+    : impl_(ContextImpl::create(
+          arenaSize,
+          numThreads,
+          std::move(threadOptions))) {}
+
+void* Context::allocate(size_t length) {
+  return impl_->allocate(length);
+}
+
+void Context::deallocate(void* ptr) {
+  impl_->deallocate(ptr);
+}
+
+// Explicitly define all methods of the context, which just forward to the impl.
+// We cannot use an intermediate ContextBoilerplate class without forcing a
+// recursive include of private headers into the public ones.
+
+std::shared_ptr<CpuChannel> Context::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint endpoint) {
+  return impl_->createChannel(std::move(connection), endpoint);
+}
+
+const std::string& Context::domainDescriptor() const {
+  return impl_->domainDescriptor();
+}
+
+bool Context::isViable() const {
+  return impl_->isViable();
+}
+
+void Context::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Context::close() {
+  impl_->close();
+}
+
+void Context::join() {
+  impl_->join();
+}
+
+Context::~Context() {
+  join();
+}
+
+} // namespace shm_arena
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <tensorpipe/channel/context.h>
+#include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/common/thread_options.h>
+#include <tensorpipe/transport/context.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace shm_arena {
+
+class ContextImpl;
+
+// The default size of each of the shared memory segments of the arena.
+constexpr size_t kDefaultArenaSize = 64 * 1024 * 1024;
+
+// The default number of threads used to perform copies, see below.
+constexpr size_t kDefaultNumThreads = 4;
+
+// A channel between processes of the same machine, for tensors that are
+// allocated from its shared memory arena (see allocate). Such a tensor is sent
+// as just the segment it belongs to, its offset and its length: the receiver
+// maps the segment the first time it sees it (by opening the file descriptor of
+// the sender through /proc) and then copies straight from there, without any
+// work on the sender's side. Other tensors are first copied into the arena by
+// the sender, and then sent the same way.
+class Context : public CpuContext {
+ public:
+  // The arena is made of segments of arenaSize bytes, which are allocated as
+  // needed (larger ones being created for buffers that don't fit in those).
+  // Copies are performed by numThreads background threads, which are set up
+  // according to threadOptions.
+  explicit Context(
+      size_t arenaSize = kDefaultArenaSize,
+      size_t numThreads = kDefaultNumThreads,
+      ThreadOptions threadOptions = ThreadOptions());
+
+  Context(const Context&) = delete;
+  Context(Context&&) = delete;
+  Context& operator=(const Context&) = delete;
+  Context& operator=(Context&&) = delete;
+
+  // Allocate a buffer of the given length from the arena, or return null if
+  // the shared memory couldn't be allocated. The buffer must be freed with
+  // deallocate, and it must not be used after the context is destroyed. These
+  // are safe to call from any thread.
+  void* allocate(size_t length);
+  void deallocate(void* ptr);
+
+  std::shared_ptr<CpuChannel> createChannel(
+      std::shared_ptr<transport::Connection> connection,
+      Endpoint endpoint) override;
+
+  const std::string& domainDescriptor() const override;
+
+  bool isViable() const override;
+
+  void setId(std::string id) override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it. However, its lifetime is tied to the one
+  // of this public object since when the latter is destroyed the implementation
+  // is closed and joined.
+  const std::shared_ptr<ContextImpl> impl_;
+};
+
+} // namespace shm_arena
+} // namespace channel
+} // namespace tensorpipe
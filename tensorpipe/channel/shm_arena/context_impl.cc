@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/shm_arena/context_impl.h>
+
+#include <fcntl.h>
+#include <linux/prctl.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include <tensorpipe/channel/shm_arena/channel_impl.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/fd.h>
+#include <tensorpipe/common/memcpy.h>
+#include <tensorpipe/common/system.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace shm_arena {
+
+namespace {
+
+// Prepend descriptor with channel name so it's easy to disambiguate
+// descriptors when debugging.
+const std::string kDomainDescriptorPrefix{"shm_arena:"};
+
+// Copies up to this size are performed right away, by the thread that asks for
+// them, rather than handed over to the background threads.
+constexpr size_t kInlineCopyThreshold = 64 * 1024;
+
+std::tuple<bool, std::string> determineViabilityAndGenerateDomainDescriptor() {
+  int rv;
+  std::ostringstream oss;
+  oss << kDomainDescriptorPrefix;
+
+  // This channel only works across processes on the same machine, and we
+  // detect that by computing the boot ID.
+  optional<std::string> bootID = getBootID();
+  TP_THROW_ASSERT_IF(!bootID.has_value()) << "Unable to read boot_id";
+  oss << bootID.value();
+
+  // The peer is found in /proc by its PID, hence both endpoints must be in the
+  // same PID namespace (by symmetry, as in the CMA channel).
+  optional<std::string> pidNsID = getLinuxNamespaceId(LinuxNamespace::kPid);
+  TP_THROW_ASSERT_IF(!pidNsID.has_value()) << "Unable to read pid namespace ID";
+  oss << '_' << pidNsID.value();
+
+  // Opening the file descriptors of another process through /proc is subject
+  // to the PTRACE_MODE_READ_FSCREDS check (see ptrace(2)), which, like for the
+  // CMA channel, requires the two endpoints to have the same user and group IDs
+  // (all of them equal), in the same user namespace, and the same permitted
+  // capabilities, and the target to be dumpable. Unlike the CMA channel, YAMA
+  // doesn't get in the way, as it only restricts attaching.
+  optional<std::string> userNsID = getLinuxNamespaceId(LinuxNamespace::kUser);
+  TP_THROW_ASSERT_IF(!userNsID.has_value())
+      << "Unable to read user namespace ID";
+  oss << '_' << userNsID.value();
+
+  uid_t realUserId, effectiveUserId, savedSetUserId;
+  gid_t realGroupId, effectiveGroupId, savedSetGroupId;
+  rv = ::getresuid(&realUserId, &effectiveUserId, &savedSetUserId);
+  TP_THROW_SYSTEM_IF(rv < 0, errno);
+  rv = ::getresgid(&realGroupId, &effectiveGroupId, &savedSetGroupId);
+  TP_THROW_SYSTEM_IF(rv < 0, errno);
+  if (realUserId != effectiveUserId || realUserId != savedSetUserId ||
+      realGroupId != effectiveGroupId || realGroupId != savedSetGroupId) {
+    TP_VLOG(5) << "User IDs or group IDs aren't all equal";
+    return std::make_tuple(false, std::string());
+  }
+  oss << '_' << realUserId << '_' << realGroupId;
+
+  optional<std::string> caps = getPermittedCapabilitiesID();
+  TP_THROW_ASSERT_IF(!caps.has_value())
+      << "Unable to obtain permitted capabilities";
+  oss << '_' << caps.value();
+
+  // SUID_DUMP_USER has a value of 1.
+  rv = ::prctl(PR_GET_DUMPABLE, 0, 0, 0, 0);
+  TP_THROW_SYSTEM_IF(rv < 0, errno);
+  if (rv != 1) {
+    TP_VLOG(5) << "Process isn't dumpable";
+    return std::make_tuple(false, std::string());
+  }
+
+  // The arena is backed by files in /dev/shm, which may not be available.
+  Error error;
+  std::unique_ptr<util::shm::Arena> arena;
+  std::tie(error, arena) = util::shm::Arena::create(::getpagesize());
+  if (error) {
+    TP_VLOG(5) << "Couldn't allocate shared memory: " << error.what();
+    return std::make_tuple(false, std::string());
+  }
+
+  std::string domainDescriptor = oss.str();
+  TP_VLOG(5) << "The domain descriptor for SHM_ARENA is " << domainDescriptor;
+  return std::make_tuple(true, std::move(domainDescriptor));
+}
+
+uint64_t generateUniqueId() {
+  std::random_device rd;
+  return (static_cast<uint64_t>(rd()) << 32) | rd();
+}
+
+} // namespace
+
+std::shared_ptr<ContextImpl> ContextImpl::create(
+    size_t arenaSize,
+    size_t numThreads,
+    ThreadOptions threadOptions) {
+  bool isViable;
+  std::string domainDescriptor;
+  std::tie(isViable, domainDescriptor) =
+      determineViabilityAndGenerateDomainDescriptor();
+  return std::make_shared<ContextImpl>(
+      isViable,
+      std::move(domainDescriptor),
+      arenaSize,
+      numThreads,
+      std::move(threadOptions));
+}
+
+ContextImpl::ContextImpl(
+    bool isViable,
+    std::string domainDescriptor,
+    size_t arenaSize,
+    size_t numThreads,
+    ThreadOptions threadOptions)
+    : ContextImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl>(
+          std::move(domainDescriptor)),
+      isViable_(isViable),
+      arenaSize_(arenaSize),
+      token_(generateUniqueId()),
+      copyPool_(numThreads, "TP_SHM_ARENA", std::move(threadOptions)) {
+  TP_THROW_ASSERT_IF(numThreads == 0)
+      << "The number of threads must be positive";
+  TP_THROW_ASSERT_IF(arenaSize == 0) << "The arena size must be positive";
+}
+
+std::shared_ptr<CpuChannel> ContextImpl::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint /* unused */) {
+  return createChannelInternal(std::move(connection));
+}
+
+bool ContextImpl::isViable() const {
+  return isViable_;
+}
+
+void ContextImpl::closeImpl() {}
+
+void ContextImpl::joinImpl() {
+  copyPool_.join();
+}
+
+bool ContextImpl::inLoop() {
+  return loop_.inLoop();
+};
+
+void ContextImpl::deferToLoop(TTask fn) {
+  loop_.deferToLoop(std::move(fn));
+};
+
+void* ContextImpl::allocate(size_t length) {
+  std::unique_lock<std::mutex> lock(arenaMutex_);
+  for (const auto& segment : segments_) {
+    void* ptr = segment->allocate(length);
+    if (ptr != nullptr) {
+      return ptr;
+    }
+  }
+
+  // Buffers that are larger than the segments get one of their own.
+  const size_t pageSize = ::getpagesize();
+  const size_t segmentSize = std::max(
+      arenaSize_,
+      (length + util::shm::Arena::kAlignment + pageSize - 1) / pageSize *
+          pageSize);
+  Error error;
+  std::unique_ptr<util::shm::Arena> segment;
+  std::tie(error, segment) = util::shm::Arena::create(segmentSize);
+  if (error) {
+    TP_VLOG(4) << "Channel context " << id_
+               << " couldn't allocate a shared memory segment of "
+               << segmentSize << " bytes: " << error.what();
+    return nullptr;
+  }
+  TP_VLOG(4) << "Channel context " << id_
+             << " allocated a shared memory segment of " << segmentSize
+             << " bytes (#" << segments_.size() << ")";
+  void* ptr = segment->allocate(length);
+  TP_DCHECK(ptr != nullptr);
+  segments_.push_back(std::move(segment));
+  return ptr;
+}
+
+void ContextImpl::deallocate(void* ptr) {
+  std::unique_lock<std::mutex> lock(arenaMutex_);
+  for (const auto& segment : segments_) {
+    if (segment->contains(ptr, 0)) {
+      segment->deallocate(ptr);
+      return;
+    }
+  }
+  TP_THROW_ASSERT() << "Freeing a buffer that wasn't allocated from the arena";
+}
+
+optional<ContextImpl::Location> ContextImpl::locate(
+    const void* ptr,
+    size_t length) {
+  std::unique_lock<std::mutex> lock(arenaMutex_);
+  for (size_t segmentIdx = 0; segmentIdx < segments_.size(); segmentIdx++) {
+    const util::shm::Arena& segment = *segments_[segmentIdx];
+    if (segment.contains(ptr, length)) {
+      return Location{
+          token_, segmentIdx, segment.getFd(), segment.offsetOf(ptr)};
+    }
+  }
+  return nullopt;
+}
+
+std::shared_ptr<uint8_t> ContextImpl::allocateStagingBuffer(size_t length) {
+  uint8_t* ptr = reinterpret_cast<uint8_t*>(allocate(length));
+  if (ptr == nullptr) {
+    return nullptr;
+  }
+  return std::shared_ptr<uint8_t>(
+      ptr, [this](uint8_t* ptr) { deallocate(ptr); });
+}
+
+std::tuple<Error, const util::shm::Segment*> ContextImpl::mapRemoteSegment(
+    pid_t remotePid,
+    uint64_t remoteToken,
+    uint64_t remoteSegmentIdx,
+    int remoteFd) {
+  TP_DCHECK(inLoop());
+
+  auto key = std::make_pair(remoteToken, remoteSegmentIdx);
+  auto iter = remoteSegments_.find(key);
+  if (iter != remoteSegments_.end()) {
+    return std::make_tuple(Error::kSuccess, &iter->second);
+  }
+
+  std::ostringstream path;
+  path << "/proc/" << remotePid << "/fd/" << remoteFd;
+  int fd = ::open(path.str().c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "open", errno), nullptr);
+  }
+
+  Error error;
+  util::shm::Segment segment;
+  std::tie(error, segment) = util::shm::Segment::access(
+      Fd(fd), /*permWrite=*/false, /*pageType=*/nullopt);
+  if (error) {
+    return std::make_tuple(std::move(error), nullptr);
+  }
+  TP_VLOG(4) << "Channel context " << id_ << " mapped shared memory segment #"
+             << remoteSegmentIdx << " of process " << remotePid << " ("
+             << segment.getSize() << " bytes)";
+  iter = remoteSegments_.emplace(key, std::move(segment)).first;
+  return std::make_tuple(Error::kSuccess, &iter->second);
+}
+
+void ContextImpl::requestCopy(
+    void* dst,
+    const void* src,
+    size_t length,
+    copy_request_callback_fn fn) {
+  uint64_t requestId = nextRequestId_++;
+  TP_VLOG(4) << "Channel context " << id_ << " received a copy request (#"
+             << requestId << ")";
+
+  fn = [this, requestId, fn{std::move(fn)}](const Error& error) {
+    TP_VLOG(4) << "Channel context " << id_
+               << " is calling a copy request callback (#" << requestId << ")";
+    fn(error);
+    TP_VLOG(4) << "Channel context " << id_
+               << " done calling a copy request callback (#" << requestId
+               << ")";
+  };
+
+  if (length <= kInlineCopyThreshold) {
+    // Don't even call memcpy on a length of 0 to avoid issues with the pointer
+    // possibly being null.
+    if (length > 0) {
+      copyMemory(dst, src, length);
+    }
+    fn(Error::kSuccess);
+    return;
+  }
+
+  copyPool_.submit([dst, src, length, fn{std::move(fn)}]() mutable {
+    copyMemory(dst, src, length);
+    fn(Error::kSuccess);
+  });
+}
+
+} // namespace shm_arena
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <tensorpipe/channel/context_impl_boilerplate.h>
+#include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/common/cpu_buffer.h>
+#include <tensorpipe/common/deferred_executor.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/thread_options.h>
+#include <tensorpipe/common/worker_pool.h>
+#include <tensorpipe/util/shm/arena.h>
+#include <tensorpipe/util/shm/segment.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace shm_arena {
+
+class ChannelImpl;
+
+class ContextImpl final
+    : public ContextImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl> {
+ public:
+  static std::shared_ptr<ContextImpl> create(
+      size_t arenaSize,
+      size_t numThreads,
+      ThreadOptions threadOptions);
+
+  ContextImpl(
+      bool isViable,
+      std::string domainDescriptor,
+      size_t arenaSize,
+      size_t numThreads,
+      ThreadOptions threadOptions);
+
+  std::shared_ptr<CpuChannel> createChannel(
+      std::shared_ptr<transport::Connection> connection,
+      Endpoint endpoint);
+
+  bool isViable() const;
+
+  // Implement the DeferredExecutor interface.
+  bool inLoop() override;
+  void deferToLoop(TTask fn) override;
+
+  // These may be called from any thread.
+  void* allocate(size_t length);
+  void deallocate(void* ptr);
+
+  // Where a buffer lies in the arena: the segment, identified by this context's
+  // token and its index, the file descriptor of the segment and the offset.
+  struct Location {
+    uint64_t token;
+    uint64_t segmentIdx;
+    int fd;
+    size_t offset;
+  };
+
+  // Find the segment of the arena that contains the given buffer, if any.
+  optional<Location> locate(const void* ptr, size_t length);
+
+  // Allocate a buffer from the arena, which is freed once the last reference to
+  // it is dropped, or return null if it couldn't be allocated.
+  std::shared_ptr<uint8_t> allocateStagingBuffer(size_t length);
+
+  // Return the mapping of the segment of the arena of the given remote context,
+  // which belongs to a remote process, mapping it if this is the first time.
+  std::tuple<Error, const util::shm::Segment*> mapRemoteSegment(
+      pid_t remotePid,
+      uint64_t remoteToken,
+      uint64_t remoteSegmentIdx,
+      int remoteFd);
+
+  using copy_request_callback_fn = MoveOnlyFunction<void(const Error&)>;
+
+  // Copy the data in background unless it's small, and then call the callback
+  // (from the thread that performed the copy).
+  void requestCopy(
+      void* dst,
+      const void* src,
+      size_t length,
+      copy_request_callback_fn fn);
+
+ protected:
+  // Implement the entry points called by ContextImplBoilerplate.
+  void closeImpl() override;
+  void joinImpl() override;
+
+ private:
+  OnDemandDeferredExecutor loop_;
+
+  const bool isViable_;
+  const size_t arenaSize_;
+
+  // Identifies this context's arena among all those the peers have ever seen,
+  // so that they don't confuse it with the one of a former process that had the
+  // same PID.
+  const uint64_t token_;
+
+  // The segments are never freed, as the peers may still have them mapped, and
+  // their indices are how they are identified in the descriptors.
+  std::mutex arenaMutex_;
+  std::vector<std::unique_ptr<util::shm::Arena>> segments_;
+
+  // The segments of the remote contexts that were mapped, by token and index.
+  // Only accessed from the loop.
+  std::map<std::pair<uint64_t, uint64_t>, util::shm::Segment> remoteSegments_;
+
+  WorkerPool copyPool_;
+
+  // This is atomic because it may be accessed from outside the loop.
+  std::atomic<uint64_t> nextRequestId_{0};
+};
+
+} // namespace shm_arena
+} // namespace channel
+} // namespace tensorpipe
@@ -14,11 +14,11 @@
 
 namespace tensorpipe {
 namespace channel {
-namespace cuda_gdr {
+namespace shm_arena {
 
-class IbvError final : public BaseError {
+class ShmArenaError final : public BaseError {
  public:
-  explicit IbvError(std::string error) : error_(error) {}
+  explicit ShmArenaError(std::string error) : error_(error) {}
 
   std::string what() const override {
     return error_;
@@ -28,6 +28,6 @@ class IbvError final : public BaseError {
   std::string error_;
 };
 
-} // namespace cuda_gdr
+} // namespace shm_arena
 } // namespace channel
 } // namespace tensorpipe
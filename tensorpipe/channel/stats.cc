@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/stats.h>
+
+namespace tensorpipe {
+namespace channel {
+
+void ChannelStats::merge(const ChannelStats& other) {
+  copyQueueWaitTime.merge(other.copyQueueWaitTime);
+  copyRunTime.merge(other.copyRunTime);
+}
+
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <tensorpipe/common/duration_histogram.h>
+
+namespace tensorpipe {
+namespace channel {
+
+// The statistics of all the channels of a context, gathered only when enabled
+// (see Context::enableChannelStats). Only the CUDA channels fill them in.
+//
+// These are measured on the timeline of the GPU, by means of CUDA events, as
+// the host can't tell how long a copy waited, once enqueued, for the kernels
+// the user had put on the stream of the buffer, from how long it took to run.
+struct ChannelStats {
+  // From the moment an operation was issued to the moment the work it must come
+  // after (i.e., that the user had enqueued on their stream) was done.
+  DurationHistogram copyQueueWaitTime;
+
+  // How long the copies of an operation took to run on the GPU, once they
+  // could start.
+  DurationHistogram copyRunTime;
+
+  // Add all the statistics of the other object to this one.
+  void merge(const ChannelStats& other);
+};
+
+} // namespace channel
+} // namespace tensorpipe
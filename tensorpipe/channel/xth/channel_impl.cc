@@ -29,7 +29,10 @@ namespace {
 
 struct Descriptor {
   uint64_t ptr;
-  NOP_STRUCTURE(Descriptor, ptr);
+  // The layout of the buffer, see CpuBuffer::rowLength.
+  uint64_t rowLength;
+  uint64_t rowStride;
+  NOP_STRUCTURE(Descriptor, ptr, rowLength, rowStride);
 };
 
 } // namespace
@@ -71,6 +74,8 @@ void ChannelImpl::sendImplFromLoop(
   NopHolder<Descriptor> nopHolder;
   Descriptor& nopDescriptor = nopHolder.getObject();
   nopDescriptor.ptr = reinterpret_cast<std::uintptr_t>(buffer.ptr);
+  nopDescriptor.rowLength = buffer.rowLength;
+  nopDescriptor.rowStride = buffer.rowStride;
 
   descriptorCallback(Error::kSuccess, saveDescriptor(nopHolder));
 }
@@ -83,13 +88,16 @@ void ChannelImpl::recvImplFromLoop(
   NopHolder<Descriptor> nopHolder;
   loadDescriptor(nopHolder, descriptor);
   Descriptor& nopDescriptor = nopHolder.getObject();
-  void* remotePtr = reinterpret_cast<void*>(nopDescriptor.ptr);
+  CpuBuffer remoteBuffer;
+  remoteBuffer.ptr = reinterpret_cast<void*>(nopDescriptor.ptr);
+  remoteBuffer.length = buffer.length;
+  remoteBuffer.rowLength = nopDescriptor.rowLength;
+  remoteBuffer.rowStride = nopDescriptor.rowStride;
   TP_VLOG(6) << "Channel " << id_ << " is copying payload (#" << sequenceNumber
              << ")";
   context_->requestCopy(
-      remotePtr,
-      buffer.ptr,
-      buffer.length,
+      remoteBuffer,
+      buffer,
       eagerCallbackWrapper_([sequenceNumber,
                              callback{std::move(callback)}](ChannelImpl& impl) {
         TP_VLOG(6) << "Channel " << impl.id_ << " done copying payload (#"
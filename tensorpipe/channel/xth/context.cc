@@ -19,7 +19,14 @@ namespace tensorpipe {
 namespace channel {
 namespace xth {
 
-Context::Context() : impl_(std::make_shared<ContextImpl>()) {}
+Context::Context(
+    size_t numThreads,
+    size_t inlineCopyThreshold,
+    ThreadOptions threadOptions)
+    : impl_(std::make_shared<ContextImpl>(
+          numThreads,
+          inlineCopyThreshold,
+          std::move(threadOptions))) {}
 
 // Explicitly define all methods of the context, which just forward to the impl.
 // We cannot use an intermediate ContextBoilerplate class without forcing a
@@ -35,6 +42,10 @@ const std::string& Context::domainDescriptor() const {
   return impl_->domainDescriptor();
 }
 
+bool Context::supportsStridedBuffers() const {
+  return true;
+}
+
 void Context::setId(std::string id) {
   impl_->setId(std::move(id));
 }
@@ -12,6 +12,7 @@
 #include <string>
 
 #include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/common/thread_options.h>
 #include <tensorpipe/transport/context.h>
 
 namespace tensorpipe {
@@ -20,9 +21,22 @@ namespace xth {
 
 class ContextImpl;
 
+// The default number of threads used to perform large copies, see below.
+constexpr size_t kDefaultNumThreads = 4;
+
+// The default size up to which copies are performed inline, see below.
+constexpr size_t kDefaultInlineCopyThreshold = 64 * 1024;
+
 class Context : public CpuContext {
  public:
-  Context();
+  // Copies up to inlineCopyThreshold bytes are performed directly by the thread
+  // that receives the tensor, whereas larger ones are split into chunks which
+  // are spread among numThreads background threads, which are set up according
+  // to threadOptions.
+  explicit Context(
+      size_t numThreads = kDefaultNumThreads,
+      size_t inlineCopyThreshold = kDefaultInlineCopyThreshold,
+      ThreadOptions threadOptions = ThreadOptions());
 
   Context(const Context&) = delete;
   Context(Context&&) = delete;
@@ -35,6 +49,8 @@ class Context : public CpuContext {
 
   const std::string& domainDescriptor() const override;
 
+  bool supportsStridedBuffers() const override;
+
   void setId(std::string id) override;
 
   void close() override;
@@ -10,15 +10,16 @@
 
 #include <unistd.h>
 
-#include <cstring>
+#include <algorithm>
 #include <functional>
-#include <limits>
 #include <sstream>
 #include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include <tensorpipe/channel/xth/channel_impl.h>
+#include <tensorpipe/common/buffer_layout.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/system.h>
 
@@ -28,6 +29,14 @@ namespace xth {
 
 namespace {
 
+// Copies are split into chunks which, except for the last one, are at least
+// this large and end at page boundaries of the target buffer.
+constexpr size_t kMinChunkSize = 1024 * 1024;
+
+// Enqueuing chunks blocks the loop while this many are already waiting, which
+// holds new copies back until the threads catch up.
+constexpr size_t kMaxQueuedChunks = 1024;
+
 std::string generateDomainDescriptor() {
   std::ostringstream oss;
   auto bootID = getBootID();
@@ -43,11 +52,19 @@ std::string generateDomainDescriptor() {
 
 } // namespace
 
-ContextImpl::ContextImpl()
+ContextImpl::ContextImpl(
+    size_t numThreads,
+    size_t inlineCopyThreshold,
+    ThreadOptions threadOptions)
     : ContextImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl>(
           generateDomainDescriptor()),
-      requests_(std::numeric_limits<int>::max()) {
-  thread_ = std::thread(&ContextImpl::handleCopyRequests, this);
+      inlineCopyThreshold_(inlineCopyThreshold),
+      chunks_(kMaxQueuedChunks) {
+  TP_THROW_ASSERT_IF(numThreads == 0) << "At least one thread is needed";
+  for (size_t threadIdx = 0; threadIdx < numThreads; threadIdx++) {
+    threads_.emplace_back(
+        &ContextImpl::handleCopyRequests, this, threadOptions);
+  }
 }
 
 std::shared_ptr<CpuChannel> ContextImpl::createChannel(
@@ -57,27 +74,30 @@ std::shared_ptr<CpuChannel> ContextImpl::createChannel(
 }
 
 void ContextImpl::closeImpl() {
-  requests_.push(nullopt);
+  for (size_t threadIdx = 0; threadIdx < threads_.size(); threadIdx++) {
+    chunks_.push(nullopt);
+  }
 }
 
 void ContextImpl::joinImpl() {
-  thread_.join();
-  // TP_DCHECK(requests_.empty());
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+  // TP_DCHECK(chunks_.empty());
 }
 
 bool ContextImpl::inLoop() {
   return loop_.inLoop();
 };
 
-void ContextImpl::deferToLoop(std::function<void()> fn) {
+void ContextImpl::deferToLoop(TTask fn) {
   loop_.deferToLoop(std::move(fn));
 };
 
 void ContextImpl::requestCopy(
-    void* remotePtr,
-    void* localPtr,
-    size_t length,
-    std::function<void(const Error&)> fn) {
+    CpuBuffer remoteBuffer,
+    CpuBuffer localBuffer,
+    copy_request_callback_fn fn) {
   uint64_t requestId = nextRequestId_++;
   TP_VLOG(4) << "Channel context " << id_ << " received a copy request (#"
              << requestId << ")";
@@ -91,26 +111,70 @@ void ContextImpl::requestCopy(
                << ")";
   };
 
-  requests_.push(CopyRequest{remotePtr, localPtr, length, std::move(fn)});
+  TP_DCHECK_EQ(remoteBuffer.length, localBuffer.length);
+  const size_t length = localBuffer.length;
+
+  // Small copies are cheaper to perform right away, on the thread that asked
+  // for them, than to hand over to another thread and wait for it to wake up.
+  if (length <= inlineCopyThreshold_) {
+    // Don't even call memcpy on a length of 0 to avoid issues with the pointer
+    // possibly being null.
+    if (length > 0) {
+      copyBuffer(localBuffer, remoteBuffer);
+    }
+    fn(Error::kSuccess);
+    return;
+  }
+
+  auto request = std::make_shared<CopyRequest>();
+  request->remoteBuffer = remoteBuffer;
+  request->localBuffer = localBuffer;
+  request->callback = std::move(fn);
+
+  // Split the copy evenly among the threads (with a minimum size per chunk),
+  // rounding the boundaries to page boundaries of the target buffer. This way
+  // each page of the target is written by a single thread, which avoids false
+  // sharing and, for fresh memory, has the page be allocated by the first-touch
+  // policy on the NUMA node of the thread that writes it.
+  const size_t pageSize = getpagesize();
+  const size_t numChunks = std::max<size_t>(
+      1, std::min(threads_.size(), length / kMinChunkSize));
+  const uintptr_t localStart = reinterpret_cast<uintptr_t>(localBuffer.ptr);
+  std::vector<size_t> boundaries;
+  boundaries.push_back(0);
+  for (size_t chunkIdx = 1; chunkIdx < numChunks; chunkIdx++) {
+    uintptr_t boundary = localStart + chunkIdx * (length / numChunks);
+    boundary = (boundary + pageSize - 1) / pageSize * pageSize;
+    boundaries.push_back(boundary - localStart);
+  }
+  boundaries.push_back(length);
+
+  request->numPendingChunks = numChunks;
+  for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+    chunks_.push(CopyChunk{
+        request,
+        boundaries[chunkIdx],
+        boundaries[chunkIdx + 1] - boundaries[chunkIdx]});
+  }
 }
 
-void ContextImpl::handleCopyRequests() {
-  setThreadName("TP_XTH_loop");
+void ContextImpl::handleCopyRequests(const ThreadOptions& threadOptions) {
+  setUpThread(threadOptions, "TP_XTH_loop");
   while (true) {
-    auto maybeRequest = requests_.pop();
-    if (!maybeRequest.has_value()) {
+    auto maybeChunk = chunks_.pop();
+    if (!maybeChunk.has_value()) {
       break;
     }
-    CopyRequest request = std::move(maybeRequest).value();
+    CopyChunk chunk = std::move(maybeChunk).value();
+    CopyRequest& request = *chunk.request;
 
-    // Don't even call memcpy on a length of 0 to avoid issues with the pointer
-    // possibly being null.
-    if (request.length > 0) {
-      // Perform copy.
-      std::memcpy(request.localPtr, request.remotePtr, request.length);
-    }
+    // Perform copy.
+    copyBuffer(
+        request.localBuffer, request.remoteBuffer, chunk.offset, chunk.length);
 
-    request.callback(Error::kSuccess);
+    if (--request.numPendingChunks == 0) {
+      request.callback(Error::kSuccess);
+    }
   }
 }
 
@@ -10,15 +10,19 @@
 
 #include <atomic>
 #include <functional>
+#include <memory>
 #include <thread>
+#include <vector>
 
 #include <tensorpipe/channel/context_impl_boilerplate.h>
 #include <tensorpipe/channel/cpu_context.h>
 #include <tensorpipe/common/cpu_buffer.h>
 #include <tensorpipe/common/deferred_executor.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/common/mpmc_queue.h>
 #include <tensorpipe/common/optional.h>
-#include <tensorpipe/common/queue.h>
+#include <tensorpipe/common/thread_options.h>
 
 namespace tensorpipe {
 namespace channel {
@@ -29,7 +33,10 @@ class ChannelImpl;
 class ContextImpl final
     : public ContextImplBoilerplate<CpuBuffer, ContextImpl, ChannelImpl> {
  public:
-  ContextImpl();
+  ContextImpl(
+      size_t numThreads,
+      size_t inlineCopyThreshold,
+      ThreadOptions threadOptions);
 
   std::shared_ptr<CpuChannel> createChannel(
       std::shared_ptr<transport::Connection> connection,
@@ -37,14 +44,15 @@ class ContextImpl final
 
   // Implement the DeferredExecutor interface.
   bool inLoop() override;
-  void deferToLoop(std::function<void()> fn) override;
+  void deferToLoop(TTask fn) override;
 
-  using copy_request_callback_fn = std::function<void(const Error&)>;
+  using copy_request_callback_fn = MoveOnlyFunction<void(const Error&)>;
 
+  // The buffers may not be contiguous (see CpuBuffer::rowLength), but must be
+  // of the same length.
   void requestCopy(
-      void* remotePtr,
-      void* localPtr,
-      size_t length,
+      CpuBuffer remoteBuffer,
+      CpuBuffer localBuffer,
       copy_request_callback_fn fn);
 
  protected:
@@ -55,20 +63,32 @@ class ContextImpl final
  private:
   OnDemandDeferredExecutor loop_;
 
+  const size_t inlineCopyThreshold_;
+
   struct CopyRequest {
-    void* remotePtr;
-    void* localPtr;
-    size_t length;
+    CpuBuffer remoteBuffer;
+    CpuBuffer localBuffer;
     copy_request_callback_fn callback;
+
+    // Requests are split into chunks, which are performed in parallel by
+    // different threads. The one that completes the last chunk fires the
+    // callback.
+    std::atomic<size_t> numPendingChunks{0};
+  };
+
+  struct CopyChunk {
+    std::shared_ptr<CopyRequest> request;
+    size_t offset;
+    size_t length;
   };
 
-  std::thread thread_;
-  Queue<optional<CopyRequest>> requests_;
+  std::vector<std::thread> threads_;
+  MpmcQueue<optional<CopyChunk>> chunks_;
 
   // This is atomic because it may be accessed from outside the loop.
   std::atomic<uint64_t> nextRequestId_{0};
 
-  void handleCopyRequests();
+  void handleCopyRequests(const ThreadOptions& threadOptions);
 };
 
 } // namespace xth
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include <tensorpipe/common/cpu_buffer.h>
+#include <tensorpipe/common/crc32c.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/memcpy.h>
+#include <tensorpipe/common/xxhash64.h>
+
+// Helpers for the buffers that may not be contiguous (see CpuBuffer::rowLength)
+// which work for any type of buffer (CPU or CUDA) as they only do arithmetic on
+// the pointers, whereas the actual copies are up to the caller.
+
+namespace tensorpipe {
+
+// Whether the bytes of the buffer are all one after the other.
+template <typename TBuffer>
+bool isContiguous(const TBuffer& buffer) {
+  return buffer.rowLength == 0 || buffer.rowLength == buffer.rowStride ||
+      buffer.length <= buffer.rowLength;
+}
+
+// Whether the rows fit the length of the buffer and don't overlap.
+template <typename TBuffer>
+bool hasValidLayout(const TBuffer& buffer) {
+  return buffer.rowLength == 0 ||
+      (buffer.length % buffer.rowLength == 0 &&
+       buffer.rowStride >= buffer.rowLength);
+}
+
+// The number of bytes from the first one of the buffer to the last one, gaps
+// between the rows included.
+template <typename TBuffer>
+size_t spanOfBuffer(const TBuffer& buffer) {
+  if (isContiguous(buffer) || buffer.length == 0) {
+    return buffer.length;
+  }
+  return (buffer.length / buffer.rowLength - 1) * buffer.rowStride +
+      buffer.rowLength;
+}
+
+// Goes through the bytes of a buffer one contiguous piece at a time, in order.
+class BufferCursor {
+ public:
+  template <typename TBuffer>
+  explicit BufferCursor(const TBuffer& buffer, size_t offset = 0)
+      : ptr_(reinterpret_cast<uint8_t*>(buffer.ptr)),
+        rowLength_(isContiguous(buffer) ? buffer.length : buffer.rowLength),
+        rowStride_(isContiguous(buffer) ? buffer.length : buffer.rowStride) {
+    TP_DCHECK(hasValidLayout(buffer));
+    TP_DCHECK_LE(offset, buffer.length);
+    if (rowLength_ > 0) {
+      rowIdx_ = offset / rowLength_;
+      offsetInRow_ = offset % rowLength_;
+    }
+  }
+
+  // The first byte of the piece, which goes until the end of its row.
+  uint8_t* ptr() const {
+    return ptr_ + rowIdx_ * rowStride_ + offsetInRow_;
+  }
+
+  size_t lengthLeftInRow() const {
+    return rowLength_ - offsetInRow_;
+  }
+
+  void advance(size_t length) {
+    TP_DCHECK_LE(length, lengthLeftInRow());
+    offsetInRow_ += length;
+    if (offsetInRow_ == rowLength_) {
+      rowIdx_++;
+      offsetInRow_ = 0;
+    }
+  }
+
+ private:
+  uint8_t* const ptr_;
+  const size_t rowLength_;
+  const size_t rowStride_;
+  size_t rowIdx_{0};
+  size_t offsetInRow_{0};
+};
+
+// Call fn(ptr, length) on each of the contiguous pieces of the given range of
+// bytes of the buffer, in order.
+template <typename TBuffer, typename TFn>
+void forEachPieceOfBuffer(
+    const TBuffer& buffer,
+    size_t offset,
+    size_t length,
+    TFn&& fn) {
+  TP_DCHECK_LE(offset + length, buffer.length);
+  BufferCursor cursor(buffer, offset);
+  while (length > 0) {
+    const size_t pieceLength = std::min(length, cursor.lengthLeftInRow());
+    fn(cursor.ptr(), pieceLength);
+    cursor.advance(pieceLength);
+    length -= pieceLength;
+  }
+}
+
+// Call fn(dstPtr, srcPtr, length) on each of the pieces of the given range of
+// bytes that are contiguous in both buffers (which have the same length), in
+// order, e.g., to copy that range from one to the other.
+template <typename TDstBuffer, typename TSrcBuffer, typename TFn>
+void forEachPieceOfBuffers(
+    const TDstBuffer& dst,
+    const TSrcBuffer& src,
+    size_t offset,
+    size_t length,
+    TFn&& fn) {
+  TP_DCHECK_EQ(dst.length, src.length);
+  TP_DCHECK_LE(offset + length, dst.length);
+  BufferCursor dstCursor(dst, offset);
+  BufferCursor srcCursor(src, offset);
+  while (length > 0) {
+    const size_t pieceLength = std::min(
+        length,
+        std::min(dstCursor.lengthLeftInRow(), srcCursor.lengthLeftInRow()));
+    fn(dstCursor.ptr(), srcCursor.ptr(), pieceLength);
+    dstCursor.advance(pieceLength);
+    srcCursor.advance(pieceLength);
+    length -= pieceLength;
+  }
+}
+
+// Copy the given range of bytes from one CPU buffer to another, whatever their
+// layouts.
+inline void copyBuffer(
+    const CpuBuffer& dst,
+    const CpuBuffer& src,
+    size_t offset,
+    size_t length) {
+  forEachPieceOfBuffers(
+      dst, src, offset, length, [](uint8_t* dstPtr, uint8_t* srcPtr, size_t n) {
+        copyMemory(dstPtr, srcPtr, n);
+      });
+}
+
+inline void copyBuffer(const CpuBuffer& dst, const CpuBuffer& src) {
+  copyBuffer(dst, src, 0, dst.length);
+}
+
+// The checksum of the bytes of the buffer, in order, whatever its layout.
+inline uint32_t crc32cOfBuffer(const CpuBuffer& buffer) {
+  uint32_t crc = 0;
+  forEachPieceOfBuffer(buffer, 0, buffer.length, [&](uint8_t* ptr, size_t n) {
+    crc = crc32c(ptr, n, crc);
+  });
+  return crc;
+}
+
+// The hash of the bytes of the buffer, in order, chained over its pieces, so
+// that the same contents only have the same hash when laid out the same way.
+inline uint64_t xxhash64OfBuffer(const CpuBuffer& buffer) {
+  uint64_t hash = 0;
+  forEachPieceOfBuffer(buffer, 0, buffer.length, [&](uint8_t* ptr, size_t n) {
+    hash = xxhash64(ptr, n, hash);
+  });
+  return hash;
+}
+
+} // namespace tensorpipe
@@ -9,47 +9,169 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <string>
 #include <thread>
 #include <utility>
 
 #include <tensorpipe/common/deferred_executor.h>
+#include <tensorpipe/common/event_count.h>
 #include <tensorpipe/common/system.h>
+#include <tensorpipe/common/trace.h>
+#include <tensorpipe/common/usdt.h>
 
 namespace tensorpipe {
 
+// Pass this as spin duration to make a loop poll continuously, without ever
+// going to sleep. This yields the lowest latency, at the cost of a full core.
+constexpr std::chrono::microseconds kBusyPollForever =
+    std::chrono::microseconds::max();
+
+// A loop that repeatedly polls for events. After it hasn't found any event for
+// a while (the spin duration) it goes to sleep on an EventCount, until either
+// it is notified by a producer or the sleep duration expires. The latter is the
+// upper bound on the extra latency incurred by events whose producers don't or
+// can't notify the loop (e.g., hardware completions) and which it only detects
+// when polling again.
 class BusyPollingLoop : public EventLoopDeferredExecutor {
+ public:
+  // An extra source of events that the loop polls on its own thread, along
+  // with its own ones, so that they don't need to be handed over from another
+  // thread. The loop doesn't terminate while a poller is attached.
+  class Poller {
+   public:
+    // Handle the events that are ready, if any, without blocking, and return
+    // whether there were some.
+    virtual bool pollOnceFromLoop() = 0;
+
+    virtual ~Poller() = default;
+  };
+
+  // Only one poller can be attached at a time. Must be called from the loop.
+  void attachPoller(Poller& poller) {
+    TP_DCHECK(inLoop());
+    TP_DCHECK(poller_ == nullptr);
+    poller_ = &poller;
+  }
+
+  // Must be called from the loop, possibly by the poller itself as it runs.
+  void detachPoller() {
+    TP_DCHECK(inLoop());
+    poller_ = nullptr;
+  }
+
+  // Wake up the loop if it's asleep, for example when the attached poller has
+  // new events ready. This is cheap if the loop is awake. Thread-safe.
+  void notify() {
+    eventCount_->notify();
+  }
+
  protected:
+  // If an EventCount isn't provided, an internal one is used, which is only
+  // notified upon deferring functions to the loop and upon closing it.
+  BusyPollingLoop(
+      std::chrono::microseconds spinDuration,
+      std::chrono::microseconds sleepDuration,
+      EventCount* eventCount = nullptr)
+      : spinDuration_(spinDuration),
+        sleepDuration_(sleepDuration),
+        eventCount_(eventCount != nullptr ? eventCount : &ownEventCount_) {}
+
+  // Subclasses that obtain their EventCount later on (e.g., because it lives
+  // in memory they allocate in their constructor) can set it here, before the
+  // thread is started.
+  void setEventCount(EventCount& eventCount) {
+    eventCount_ = &eventCount;
+  }
+
   virtual bool pollOnce() = 0;
 
   virtual bool readyToClose() = 0;
 
+  // Called when the loop is about to go to sleep, before it polls one last
+  // time, for subclasses to ask to be notified of their next events (e.g., by
+  // arming a file descriptor that's monitored by an attached poller).
+  virtual void prepareToSleep() {}
+
   void stopBusyPolling() {
     closed_ = true;
-    // No need to wake up the thread, since it is busy-waiting.
+    // Wake up the thread in case it is asleep.
+    eventCount_->notify();
   }
 
   void eventLoop() override {
-    while (!closed_ || !readyToClose()) {
-      if (pollOnce()) {
-        // continue
+    auto lastEventTime = std::chrono::steady_clock::now();
+    while (!closed_ || !readyToClose() || poller_ != nullptr) {
+      if (pollOnceAndRecord()) {
+        lastEventTime = std::chrono::steady_clock::now();
       } else if (deferredFunctionCount_ > 0) {
         deferredFunctionCount_ -= runDeferredFunctionsFromEventLoop();
-      } else {
+        lastEventTime = std::chrono::steady_clock::now();
+      } else if (
+          spinDuration_ == kBusyPollForever || closed_ ||
+          std::chrono::steady_clock::now() - lastEventTime < spinDuration_) {
         std::this_thread::yield();
+      } else {
+        // Check one last time after announcing that we're about to sleep, as
+        // events that came in before that wouldn't have woken us up.
+        const uint32_t key = eventCount_->prepareWait();
+        prepareToSleep();
+        if (pollOnceAndRecord()) {
+          lastEventTime = std::chrono::steady_clock::now();
+        } else if (deferredFunctionCount_ == 0 && !closed_) {
+          eventCount_->wait(key, sleepDuration_);
+        }
+        eventCount_->finishWait();
       }
     }
   }
 
   void wakeupEventLoopToDeferFunction() override {
     ++deferredFunctionCount_;
-    // No need to wake up the thread, since it is busy-waiting.
+    eventCount_->notify();
   }
 
  private:
+  // Only the polls that found something to do are traced and timed, as the
+  // others would swamp the trace and the statistics.
+  bool pollOnceAndRecord() {
+    const uint64_t traceStartTime = TP_TRACE_NOW();
+    if (likely(!isCollectingStats())) {
+      if (!pollAllOnce()) {
+        return false;
+      }
+      TP_TRACE_COMPLETE("tp::BusyPollingLoop::pollOnce", traceStartTime);
+      return true;
+    }
+    const auto startTime = std::chrono::steady_clock::now();
+    if (!pollAllOnce()) {
+      return false;
+    }
+    recordPollRunTime(std::chrono::steady_clock::now() - startTime);
+    TP_TRACE_COMPLETE("tp::BusyPollingLoop::pollOnce", traceStartTime);
+    return true;
+  }
+
+  bool pollAllOnce() {
+    bool foundEvents = pollOnce();
+    if (poller_ != nullptr && poller_->pollOnceFromLoop()) {
+      foundEvents = true;
+    }
+    TP_USDT(loop__poll, foundEvents ? 1 : 0);
+    return foundEvents;
+  }
+
+  const std::chrono::microseconds spinDuration_;
+  const std::chrono::microseconds sleepDuration_;
+  EventCount ownEventCount_;
+  EventCount* eventCount_;
+
   std::atomic<bool> closed_{false};
 
   std::atomic<int64_t> deferredFunctionCount_{0};
+
+  // Only accessed from the loop.
+  Poller* poller_{nullptr};
 };
 
 } // namespace tensorpipe
@@ -20,6 +20,7 @@
 #include <tensorpipe/common/deferred_executor.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
 #include <tensorpipe/common/optional.h>
 
 namespace tensorpipe {
@@ -73,7 +74,7 @@ auto cbApply(F&& f, T&& t) {
 // unarmed are stashed and will be delayed until a callback is provided again.
 template <typename... Args>
 class RearmableCallback {
-  using TFn = std::function<void(Args...)>;
+  using TFn = MoveOnlyFunction<void(Args...)>;
   using TStoredArgs = std::tuple<typename std::remove_reference<Args>::type...>;
 
  public:
@@ -97,6 +98,13 @@ class RearmableCallback {
     }
   }
 
+  // Tell how many triggers are stored, waiting for a callback to be armed. As
+  // arming a callback while there is one will invoke it immediately, this can
+  // be used to consume all of them in a row.
+  size_t numPendingTriggers() const {
+    return args_.size();
+  }
+
   // This method is intended for "flushing" the callback, for example when an
   // error condition is reached which means that no more callbacks will be
   // processed but the current ones still must be honored.
@@ -15,6 +15,13 @@ namespace tensorpipe {
 struct CpuBuffer {
   void* ptr{nullptr};
   size_t length{0};
+  // If set, the buffer isn't contiguous but made of rows of rowLength bytes,
+  // the first one starting at ptr and each of the others rowStride bytes after
+  // the previous one (e.g., a slice of a larger matrix), which together hold
+  // the length bytes of the buffer, hence length must be a multiple of it. The
+  // other end of a pipe or channel can use any layout of the same length.
+  size_t rowLength{0};
+  size_t rowStride{0};
 };
 
 } // namespace tensorpipe
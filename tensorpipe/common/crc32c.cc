@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/crc32c.h>
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define TP_HAS_X86_CRC32C 1
+#else
+#define TP_HAS_X86_CRC32C 0
+#endif
+
+#if defined(__aarch64__) && defined(__GNUC__) && defined(__linux__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#define TP_HAS_ARMV8_CRC32C 1
+#else
+#define TP_HAS_ARMV8_CRC32C 0
+#endif
+
+namespace tensorpipe {
+
+namespace {
+
+// The polynomial, bit-reflected, as the instructions work on reflected CRCs.
+constexpr uint32_t kPolynomial = 0x82f63b78;
+
+// The functions below update a CRC without its initial and final inversions,
+// which crc32c applies once around them.
+using TUpdateFn = uint32_t (*)(uint32_t crc, const uint8_t* ptr, size_t length);
+
+struct Implementation {
+  TUpdateFn fn;
+  const char* name;
+};
+
+// The byte-wise table of the fallback implementation.
+const std::array<uint32_t, 256>& getByteTable() {
+  static const std::array<uint32_t, 256> table = []() {
+    std::array<uint32_t, 256> table;
+    for (uint32_t byte = 0; byte < 256; byte++) {
+      uint32_t crc = byte;
+      for (int bitIdx = 0; bitIdx < 8; bitIdx++) {
+        crc = (crc >> 1) ^ (crc & 1 ? kPolynomial : 0);
+      }
+      table[byte] = crc;
+    }
+    return table;
+  }();
+  return table;
+}
+
+uint32_t updateWithTable(uint32_t crc, const uint8_t* ptr, size_t length) {
+  const std::array<uint32_t, 256>& table = getByteTable();
+  for (size_t idx = 0; idx < length; idx++) {
+    crc = table[(crc ^ ptr[idx]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if TP_HAS_X86_CRC32C || TP_HAS_ARMV8_CRC32C
+
+// The length of each of the three blocks that are processed at the same time.
+constexpr size_t kBlockLength = 4096;
+
+using TTable = std::array<std::array<uint32_t, 256>, 4>;
+
+// Advancing a CRC over a run of zero bytes is a linear function of its bits,
+// hence it can be tabulated byte by byte, which is how the CRCs of the blocks
+// are combined: the one of the concatenation of A and B is the one of A (of the
+// length of A) advanced over as many zeros as B's length, xored with the one of
+// B (started from zero).
+TTable makeShiftTable(TUpdateFn updateFn) {
+  std::array<uint8_t, kBlockLength> zeros{};
+  std::array<uint32_t, 32> shiftedBits;
+  for (int bitIdx = 0; bitIdx < 32; bitIdx++) {
+    shiftedBits[bitIdx] =
+        updateFn(uint32_t(1) << bitIdx, zeros.data(), zeros.size());
+  }
+  TTable table;
+  for (int byteIdx = 0; byteIdx < 4; byteIdx++) {
+    for (uint32_t byte = 0; byte < 256; byte++) {
+      uint32_t crc = 0;
+      for (int bitIdx = 0; bitIdx < 8; bitIdx++) {
+        if (byte & (1 << bitIdx)) {
+          crc ^= shiftedBits[byteIdx * 8 + bitIdx];
+        }
+      }
+      table[byteIdx][byte] = crc;
+    }
+  }
+  return table;
+}
+
+inline uint32_t shift(const TTable& table, uint32_t crc) {
+  return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+      table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+}
+
+inline uint64_t load64(const uint8_t* ptr) {
+  uint64_t value;
+  std::memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+#endif // TP_HAS_X86_CRC32C || TP_HAS_ARMV8_CRC32C
+
+#if TP_HAS_X86_CRC32C
+
+__attribute__((target("sse4.2"))) uint32_t updateSingleWithSse42(
+    uint32_t crc,
+    const uint8_t* ptr,
+    size_t length) {
+  uint64_t crc64 = crc;
+  for (; length >= 8; ptr += 8, length -= 8) {
+    crc64 = _mm_crc32_u64(crc64, load64(ptr));
+  }
+  crc = crc64;
+  for (; length > 0; ptr++, length--) {
+    crc = _mm_crc32_u8(crc, *ptr);
+  }
+  return crc;
+}
+
+const TTable& getSse42ShiftTable() {
+  static const TTable table = makeShiftTable(updateSingleWithSse42);
+  return table;
+}
+
+__attribute__((target("sse4.2"))) uint32_t updateWithSse42(
+    uint32_t crc,
+    const uint8_t* ptr,
+    size_t length) {
+  if (length >= 3 * kBlockLength) {
+    const TTable& table = getSse42ShiftTable();
+    do {
+      uint64_t crc0 = crc;
+      uint64_t crc1 = 0;
+      uint64_t crc2 = 0;
+      for (size_t offset = 0; offset < kBlockLength; offset += 8) {
+        crc0 = _mm_crc32_u64(crc0, load64(ptr + offset));
+        crc1 = _mm_crc32_u64(crc1, load64(ptr + kBlockLength + offset));
+        crc2 = _mm_crc32_u64(crc2, load64(ptr + 2 * kBlockLength + offset));
+      }
+      crc = shift(table, shift(table, crc0) ^ crc1) ^ crc2;
+      ptr += 3 * kBlockLength;
+      length -= 3 * kBlockLength;
+    } while (length >= 3 * kBlockLength);
+  }
+  return updateSingleWithSse42(crc, ptr, length);
+}
+
+#endif // TP_HAS_X86_CRC32C
+
+#if TP_HAS_ARMV8_CRC32C
+
+__attribute__((target("+crc"))) uint32_t updateSingleWithArmv8(
+    uint32_t crc,
+    const uint8_t* ptr,
+    size_t length) {
+  for (; length >= 8; ptr += 8, length -= 8) {
+    crc = __crc32cd(crc, load64(ptr));
+  }
+  for (; length > 0; ptr++, length--) {
+    crc = __crc32cb(crc, *ptr);
+  }
+  return crc;
+}
+
+const TTable& getArmv8ShiftTable() {
+  static const TTable table = makeShiftTable(updateSingleWithArmv8);
+  return table;
+}
+
+__attribute__((target("+crc"))) uint32_t updateWithArmv8(
+    uint32_t crc,
+    const uint8_t* ptr,
+    size_t length) {
+  if (length >= 3 * kBlockLength) {
+    const TTable& table = getArmv8ShiftTable();
+    do {
+      uint32_t crc0 = crc;
+      uint32_t crc1 = 0;
+      uint32_t crc2 = 0;
+      for (size_t offset = 0; offset < kBlockLength; offset += 8) {
+        crc0 = __crc32cd(crc0, load64(ptr + offset));
+        crc1 = __crc32cd(crc1, load64(ptr + kBlockLength + offset));
+        crc2 = __crc32cd(crc2, load64(ptr + 2 * kBlockLength + offset));
+      }
+      crc = shift(table, shift(table, crc0) ^ crc1) ^ crc2;
+      ptr += 3 * kBlockLength;
+      length -= 3 * kBlockLength;
+    } while (length >= 3 * kBlockLength);
+  }
+  return updateSingleWithArmv8(crc, ptr, length);
+}
+
+#endif // TP_HAS_ARMV8_CRC32C
+
+Implementation selectImplementation() {
+#if TP_HAS_X86_CRC32C
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    return {updateWithSse42, "sse4.2"};
+  }
+#endif // TP_HAS_X86_CRC32C
+#if TP_HAS_ARMV8_CRC32C
+  if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+    return {updateWithArmv8, "armv8"};
+  }
+#endif // TP_HAS_ARMV8_CRC32C
+  return {updateWithTable, "table"};
+}
+
+const Implementation& getImplementation() {
+  static const Implementation implementation = selectImplementation();
+  return implementation;
+}
+
+} // namespace
+
+uint32_t crc32c(const void* ptr, size_t length, uint32_t crc) {
+  return ~getImplementation().fn(
+      ~crc, reinterpret_cast<const uint8_t*>(ptr), length);
+}
+
+const char* getCrc32cImplementation() {
+  return getImplementation().name;
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The CRC32C (Castagnoli) checksum, as used by iSCSI, ext4, etc., which CPUs
+// compute in hardware: with SSE 4.2 on x86-64 and with the CRC extension on
+// ARMv8. Three independent streams of blocks are interleaved to hide the
+// latency of the instruction, and their checksums are then combined. The
+// implementation is picked at runtime, the first time it's needed, falling back
+// to a (much slower) table-driven one if the CPU has no such instructions.
+
+namespace tensorpipe {
+
+// Return the checksum of the given bytes. To compute the checksum of several
+// buffers, one after the other, pass the one of the previous buffers as crc.
+uint32_t crc32c(const void* ptr, size_t length, uint32_t crc = 0);
+
+// The name of the implementation used on this CPU, i.e., "sse4.2", "armv8" or
+// "table".
+const char* getCrc32cImplementation();
+
+} // namespace tensorpipe
@@ -8,6 +8,9 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 
 #include <cuda_runtime.h>
@@ -15,6 +18,7 @@
 #include <tensorpipe/common/cuda_lib.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/system.h>
 
 #define TP_CUDA_CHECK(a)                                                \
   do {                                                                  \
@@ -67,9 +71,15 @@ class CudaEvent {
   CudaEvent& operator=(const CudaEvent&) = delete;
   CudaEvent& operator=(CudaEvent&&) = delete;
 
-  explicit CudaEvent(int device, bool interprocess = false) {
+  // Only the events that aren't shared with other processes can record the
+  // time at which they completed (see elapsedSince), which isn't free.
+  explicit CudaEvent(
+      int device,
+      bool interprocess = false,
+      bool recordTiming = false) {
+    TP_DCHECK(!(interprocess && recordTiming));
     CudaDeviceGuard guard(device);
-    int flags = cudaEventDisableTiming;
+    int flags = recordTiming ? cudaEventDefault : cudaEventDisableTiming;
     if (interprocess) {
       flags |= cudaEventInterprocess;
     }
@@ -91,6 +101,10 @@ class CudaEvent {
     TP_CUDA_CHECK(cudaStreamWaitEvent(stream, ev_, 0));
   }
 
+  void synchronize() {
+    TP_CUDA_CHECK(cudaEventSynchronize(ev_));
+  }
+
   bool query() const {
     cudaError_t res = cudaEventQuery(ev_);
     if (res == cudaErrorNotReady) {
@@ -100,6 +114,15 @@ class CudaEvent {
     return true;
   }
 
+  // The time between the completion of the other event and the one of this
+  // event, on the GPU, both of which are done and record their timing.
+  std::chrono::nanoseconds elapsedSince(const CudaEvent& start) const {
+    float milliseconds;
+    TP_CUDA_CHECK(cudaEventElapsedTime(&milliseconds, start.ev_, ev_));
+    return std::chrono::nanoseconds(
+        static_cast<int64_t>(static_cast<double>(milliseconds) * 1000000));
+  }
+
   std::string serializedHandle() {
     cudaIpcEventHandle_t handle;
     TP_CUDA_CHECK(cudaIpcGetEventHandle(&handle, ev_));
@@ -133,7 +156,10 @@ inline int cudaDeviceForPointer(const CudaLib& cudaLib, const void* ptr) {
   cudaPointerAttributes attrs;
   TP_CUDA_CHECK(cudaPointerGetAttributes(&attrs, ptr));
 #if (CUDART_VERSION >= 10000)
-  TP_DCHECK_EQ(cudaMemoryTypeDevice, attrs.type);
+  // Managed memory belongs to the device it was allocated for.
+  TP_DCHECK(
+      attrs.type == cudaMemoryTypeDevice ||
+      attrs.type == cudaMemoryTypeManaged);
 #else
   TP_DCHECK_EQ(cudaMemoryTypeDevice, attrs.memoryType);
 #endif
@@ -142,6 +168,51 @@ inline int cudaDeviceForPointer(const CudaLib& cudaLib, const void* ptr) {
   return attrs.device;
 }
 
+// Whether the pointer is to managed memory (i.e., allocated with
+// cudaMallocManaged), which the driver migrates between the host and the
+// devices on demand, and which thus can't be shared with other processes
+// through CUDA IPC handles nor registered with InfiniBand for GPUDirect.
+inline bool cudaIsManagedPointer(const CudaLib& cudaLib, const void* ptr) {
+  unsigned int isManaged = 0;
+  TP_CUDA_DRIVER_CHECK(
+      cudaLib,
+      cudaLib.pointerGetAttribute(
+          &isManaged,
+          CU_POINTER_ATTRIBUTE_IS_MANAGED,
+          reinterpret_cast<CUdeviceptr>(ptr)));
+  return isManaged != 0;
+}
+
+// Enqueue on the stream the migration of the given range of managed memory to
+// the device, so that the work enqueued after it accesses it at full bandwidth
+// rather than faulting its pages in one at a time. This is only a hint, which
+// is skipped on the devices that can't access managed memory concurrently with
+// the host, as the driver migrates all of it to those at each launch anyway.
+inline void cudaPrefetchManagedMemory(
+    const void* ptr,
+    size_t length,
+    int device,
+    cudaStream_t stream) {
+  int concurrentManagedAccess = 0;
+  TP_CUDA_CHECK(cudaDeviceGetAttribute(
+      &concurrentManagedAccess, cudaDevAttrConcurrentManagedAccess, device));
+  if (concurrentManagedAccess == 0 || length == 0) {
+    return;
+  }
+  TP_CUDA_CHECK(cudaMemPrefetchAsync(ptr, length, device, stream));
+}
+
+// Return the NUMA node to which the GPU is attached, or -1 if unknown.
+inline int getNumaNodeOfCudaDevice(int device) {
+  // The ID may have a domain of up to 32 bits (see getPciPathForGpu in the
+  // cuda_gdr channel), hence the room.
+  char busId[17];
+  if (cudaDeviceGetPCIBusId(busId, sizeof(busId), device) != cudaSuccess) {
+    return -1;
+  }
+  return getNumaNodeOfPciDevice(busId);
+}
+
 using CudaPinnedBuffer = std::shared_ptr<uint8_t>;
 
 inline CudaPinnedBuffer makeCudaPinnedBuffer(size_t length) {
@@ -18,6 +18,9 @@ struct CudaBuffer {
   void* ptr{nullptr};
   size_t length{0};
   cudaStream_t stream{cudaStreamDefault};
+  // If set, the buffer isn't contiguous. See CpuBuffer.
+  size_t rowLength{0};
+  size_t rowStride{0};
 };
 
 } // namespace tensorpipe
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <cuda_runtime.h>
+
+#include <tensorpipe/common/buffer_layout.h>
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/cuda_buffer.h>
+#include <tensorpipe/common/cuda_lib.h>
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+// Enqueue on the stream the copy of a buffer into another one of the same
+// length, whatever their layouts (see CpuBuffer::rowLength), with the direction
+// of the copy inferred from the pointers (hence either buffer may be on CPU).
+// If the rows of the two buffers line up, or either of them is contiguous, it's
+// a single cudaMemcpy2DAsync, and a cudaMemcpyAsync per piece otherwise.
+template <typename TDstBuffer, typename TSrcBuffer>
+void cudaCopyBuffer(
+    const TDstBuffer& dst,
+    const TSrcBuffer& src,
+    cudaStream_t stream) {
+  TP_DCHECK_EQ(dst.length, src.length);
+  if (dst.length == 0) {
+    return;
+  }
+  const bool dstIsContiguous = isContiguous(dst);
+  const bool srcIsContiguous = isContiguous(src);
+  if (dstIsContiguous && srcIsContiguous) {
+    TP_CUDA_CHECK(cudaMemcpyAsync(
+        dst.ptr, src.ptr, dst.length, cudaMemcpyDefault, stream));
+    return;
+  }
+  if (dstIsContiguous || srcIsContiguous || dst.rowLength == src.rowLength) {
+    const size_t width = dstIsContiguous ? src.rowLength : dst.rowLength;
+    TP_CUDA_CHECK(cudaMemcpy2DAsync(
+        dst.ptr,
+        dstIsContiguous ? width : dst.rowStride,
+        src.ptr,
+        srcIsContiguous ? width : src.rowStride,
+        width,
+        dst.length / width,
+        cudaMemcpyDefault,
+        stream));
+    return;
+  }
+  forEachPieceOfBuffers(
+      dst,
+      src,
+      0,
+      dst.length,
+      [&](uint8_t* dstPtr, uint8_t* srcPtr, size_t length) {
+        TP_CUDA_CHECK(cudaMemcpyAsync(
+            dstPtr, srcPtr, length, cudaMemcpyDefault, stream));
+      });
+}
+
+// If the buffer is in managed memory, enqueue on its stream the migration of
+// all the pages it spans to its device (see cudaPrefetchManagedMemory), and
+// return whether it is.
+inline bool cudaPrefetchBufferIfManaged(
+    const CudaLib& cudaLib,
+    const CudaBuffer& buffer) {
+  if (buffer.length == 0 || !cudaIsManagedPointer(cudaLib, buffer.ptr)) {
+    return false;
+  }
+  cudaPrefetchManagedMemory(
+      buffer.ptr,
+      spanOfBuffer(buffer),
+      cudaDeviceForPointer(cudaLib, buffer.ptr),
+      buffer.stream);
+  return true;
+}
+
+} // namespace tensorpipe
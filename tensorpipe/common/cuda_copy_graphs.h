@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/defs.h>
+
+// CUDA graphs with memcpy nodes can be built without stream capture since 11.1,
+// and instantiated with the same signature across versions since 11.4.
+#if (CUDART_VERSION >= 11040)
+#define TP_CUDA_COPY_GRAPHS 1
+#else
+#define TP_CUDA_COPY_GRAPHS 0
+#endif
+
+namespace tensorpipe {
+
+// Enqueues sets of device copies, and replays those that recur (same device,
+// same pointers and same lengths, in the same order) as a single launch of a
+// CUDA graph of their copies, rather than a cudaMemcpyAsync per copy. Training
+// loops gather and scatter the very same tensors (see
+// PipeOptions::cudaTensorCoalescingThreshold) at each iteration, hence after
+// the first one the CPU overhead of those messages no longer grows with their
+// number of tensors. A set is only turned into a graph the second time it's
+// seen, as instantiating a graph costs more than enqueuing its copies, and only
+// the most recently used graphs are kept.
+//
+// This isn't thread-safe: it's meant to be used from a pipe's loop.
+class CudaCopyGraphs {
+ public:
+  struct Copy {
+    void* dst;
+    const void* src;
+    size_t length;
+
+    bool operator==(const Copy& other) const {
+      return dst == other.dst && src == other.src && length == other.length;
+    }
+  };
+
+  CudaCopyGraphs() = default;
+
+  CudaCopyGraphs(const CudaCopyGraphs&) = delete;
+  CudaCopyGraphs(CudaCopyGraphs&&) = delete;
+  CudaCopyGraphs& operator=(const CudaCopyGraphs&) = delete;
+  CudaCopyGraphs& operator=(CudaCopyGraphs&&) = delete;
+
+  // Enqueue the copies, which don't overlap, on the stream, which belongs to
+  // the given device.
+  void enqueue(
+      int device,
+      const std::vector<Copy>& copies,
+      cudaStream_t stream) {
+    CudaDeviceGuard guard(device);
+#if TP_CUDA_COPY_GRAPHS
+    auto iter = std::find_if(
+        entries_.begin(), entries_.end(), [&](const Entry& entry) {
+          return entry.device == device && entry.copies == copies;
+        });
+    if (iter != entries_.end()) {
+      iter->lastUse = ++useCounter_;
+      if (iter->exec == nullptr) {
+        iter->exec = instantiate(copies);
+      }
+      TP_CUDA_CHECK(cudaGraphLaunch(iter->exec, stream));
+      return;
+    }
+    if (entries_.size() == kMaxEntries) {
+      auto lruIter = std::min_element(
+          entries_.begin(), entries_.end(), [](const Entry& a, const Entry& b) {
+            return a.lastUse < b.lastUse;
+          });
+      destroy(*lruIter);
+      entries_.erase(lruIter);
+    }
+    entries_.push_back(Entry{device, copies, nullptr, ++useCounter_});
+#endif // TP_CUDA_COPY_GRAPHS
+    for (const Copy& copy : copies) {
+      TP_CUDA_CHECK(cudaMemcpyAsync(
+          copy.dst, copy.src, copy.length, cudaMemcpyDefault, stream));
+    }
+  }
+
+  ~CudaCopyGraphs() {
+#if TP_CUDA_COPY_GRAPHS
+    for (Entry& entry : entries_) {
+      destroy(entry);
+    }
+#endif // TP_CUDA_COPY_GRAPHS
+  }
+
+ private:
+#if TP_CUDA_COPY_GRAPHS
+  static constexpr size_t kMaxEntries = 16;
+
+  struct Entry {
+    int device;
+    std::vector<Copy> copies;
+    // Only set once the copies have been seen twice.
+    cudaGraphExec_t exec;
+    uint64_t lastUse;
+  };
+
+  std::vector<Entry> entries_;
+  uint64_t useCounter_{0};
+
+  // The nodes have no dependencies among them, hence the copies may run
+  // concurrently, as the ones they replace would on the copy engines.
+  static cudaGraphExec_t instantiate(const std::vector<Copy>& copies) {
+    cudaGraph_t graph;
+    TP_CUDA_CHECK(cudaGraphCreate(&graph, 0));
+    for (const Copy& copy : copies) {
+      cudaGraphNode_t node;
+      TP_CUDA_CHECK(cudaGraphAddMemcpyNode1D(
+          &node,
+          graph,
+          nullptr,
+          0,
+          copy.dst,
+          copy.src,
+          copy.length,
+          cudaMemcpyDefault));
+    }
+    cudaGraphExec_t exec;
+    TP_CUDA_CHECK(cudaGraphInstantiateWithFlags(&exec, graph, 0));
+    TP_CUDA_CHECK(cudaGraphDestroy(graph));
+    return exec;
+  }
+
+  // Destroying a graph that's still running is fine, as its resources are only
+  // released once it completes.
+  static void destroy(Entry& entry) {
+    if (entry.exec != nullptr) {
+      CudaDeviceGuard guard(entry.device);
+      TP_CUDA_CHECK(cudaGraphExecDestroy(entry.exec));
+    }
+  }
+#endif // TP_CUDA_COPY_GRAPHS
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/cuda_event_pool.h>
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+// The streams on which channels enqueue their copies, one per device. They are
+// created with the highest priority and don't synchronize with the legacy
+// default stream, so that the copies don't get serialized with the compute
+// kernels of the user's streams and can run on the copy engines concurrently
+// with them. When disabled, the copies are enqueued on the user's stream, as
+// if there were no dedicated streams.
+//
+// A GPU has several copy engines, but the copies enqueued on one stream run one
+// after the other, hence on one engine at a time. With numSplitStreams above
+// one, the large device-to-device copies (see copy) are split into as many
+// slices, each enqueued on one of that many more streams of the device, which
+// the driver spreads over the engines.
+//
+// The streams are created lazily and never destroyed while this object is
+// alive. This isn't thread-safe: it's meant to be used from a context's loop.
+class CudaCopyStreams {
+ public:
+  // A copy is split in at most as many slices as there are of this size in it.
+  static constexpr size_t kMinSliceLength = 1024 * 1024;
+
+  explicit CudaCopyStreams(bool enabled, size_t numSplitStreams = 1)
+      : enabled_(enabled), numSplitStreams_(numSplitStreams) {
+    TP_THROW_ASSERT_IF(numSplitStreams_ == 0)
+        << "The number of split streams must be positive";
+  }
+
+  CudaCopyStreams(const CudaCopyStreams&) = delete;
+  CudaCopyStreams(CudaCopyStreams&&) = delete;
+  CudaCopyStreams& operator=(const CudaCopyStreams&) = delete;
+  CudaCopyStreams& operator=(CudaCopyStreams&&) = delete;
+
+  // Return the stream on which to copy from or to a buffer of the given device,
+  // whose user has provided the given stream.
+  cudaStream_t get(int device, cudaStream_t userStream) {
+    if (!enabled_) {
+      return userStream;
+    }
+    auto iter = streams_.find(device);
+    if (iter == streams_.end()) {
+      std::tie(iter, std::ignore) =
+          streams_.emplace(device, createStream(device));
+    }
+    return iter->second;
+  }
+
+  // Enqueue, as if on the given stream (of the given device, from which the
+  // copy is done), a copy between two buffers in device memory. If it's large
+  // enough it's split instead across the split streams, which wait for the
+  // work already on the stream before starting, and which the stream waits for
+  // in turn, by means of events from the pool.
+  void copy(
+      CudaEventPool& eventPool,
+      void* dst,
+      const void* src,
+      size_t length,
+      cudaStream_t stream,
+      int device) {
+    const size_t numSlices =
+        std::min(numSplitStreams_, length / kMinSliceLength);
+    if (numSlices <= 1) {
+      TP_CUDA_CHECK(cudaMemcpyAsync(
+          dst, src, length, cudaMemcpyDeviceToDevice, stream));
+      return;
+    }
+    std::vector<cudaStream_t>& splitStreams = splitStreams_[device];
+    while (splitStreams.size() < numSlices) {
+      splitStreams.push_back(createStream(device));
+    }
+
+    size_t startEvIdx;
+    std::tie(startEvIdx, std::ignore) = eventPool.acquire(device);
+    CudaEvent& startEv = eventPool.get(device, startEvIdx);
+    startEv.record(stream);
+    // The slices are about equal, and each a multiple of kSliceAlignment, but
+    // the last one.
+    const size_t sliceLength =
+        (length / numSlices + kSliceAlignment - 1) & ~(kSliceAlignment - 1);
+    CudaDeviceGuard guard(device);
+    size_t offset = 0;
+    for (size_t sliceIdx = 0; sliceIdx < numSlices && offset < length;
+         sliceIdx++) {
+      const size_t thisLength = std::min(sliceLength, length - offset);
+      startEv.wait(splitStreams[sliceIdx], device);
+      TP_CUDA_CHECK(cudaMemcpyAsync(
+          reinterpret_cast<uint8_t*>(dst) + offset,
+          reinterpret_cast<const uint8_t*>(src) + offset,
+          thisLength,
+          cudaMemcpyDeviceToDevice,
+          splitStreams[sliceIdx]));
+      offset += thisLength;
+
+      size_t stopEvIdx;
+      std::tie(stopEvIdx, std::ignore) = eventPool.acquire(device);
+      CudaEvent& stopEv = eventPool.get(device, stopEvIdx);
+      stopEv.record(splitStreams[sliceIdx]);
+      stopEv.wait(stream, device);
+      eventPool.release(device, stopEvIdx);
+    }
+    // All the waits on the events have been enqueued.
+    eventPool.release(device, startEvIdx);
+  }
+
+  ~CudaCopyStreams() {
+    // Any work still enqueued on the streams will complete before their
+    // resources are released.
+    for (const auto& iter : streams_) {
+      CudaDeviceGuard guard(iter.first);
+      TP_CUDA_CHECK(cudaStreamDestroy(iter.second));
+    }
+    for (const auto& iter : splitStreams_) {
+      CudaDeviceGuard guard(iter.first);
+      for (cudaStream_t stream : iter.second) {
+        TP_CUDA_CHECK(cudaStreamDestroy(stream));
+      }
+    }
+  }
+
+ private:
+  // Not to slow down the copy engines with unaligned accesses.
+  static constexpr size_t kSliceAlignment = 4096;
+
+  const bool enabled_;
+  const size_t numSplitStreams_;
+  std::unordered_map<int, cudaStream_t> streams_;
+  std::unordered_map<int, std::vector<cudaStream_t>> splitStreams_;
+
+  static cudaStream_t createStream(int device) {
+    CudaDeviceGuard guard(device);
+    int leastPriority;
+    int greatestPriority;
+    TP_CUDA_CHECK(
+        cudaDeviceGetStreamPriorityRange(&leastPriority, &greatestPriority));
+    cudaStream_t stream;
+    TP_CUDA_CHECK(cudaStreamCreateWithPriority(
+        &stream, cudaStreamNonBlocking, greatestPriority));
+    return stream;
+  }
+};
+
+// Make the work that will be enqueued on the waiting stream (of the waiting
+// device) from now on start only after the work currently enqueued on the
+// signaling stream (of the signaling device), by means of a pooled event.
+inline void cudaStreamWaitForStream(
+    CudaEventPool& eventPool,
+    cudaStream_t waitingStream,
+    int waitingDevice,
+    cudaStream_t signalingStream,
+    int signalingDevice) {
+  if (waitingStream == signalingStream) {
+    return;
+  }
+  size_t eventIdx;
+  std::tie(eventIdx, std::ignore) = eventPool.acquire(signalingDevice);
+  CudaEvent& event = eventPool.get(signalingDevice, eventIdx);
+  event.record(signalingStream);
+  event.wait(waitingStream, waitingDevice);
+  // The wait has been enqueued, hence the event can be reused right away.
+  eventPool.release(signalingDevice, eventIdx);
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+// A pool of CUDA events for each device, which operations borrow and give back
+// once nobody needs them anymore. Creating events is surprisingly expensive and
+// takes a global lock in the CUDA driver and, for interprocess ones, so does
+// opening them in the peer, hence the events are never destroyed while the pool
+// is alive and each of them keeps the same index within its device, so that a
+// peer can open it once and then refer to it just by its index.
+//
+// An event can be given back as soon as all the waits on the operation it was
+// last recorded for have been enqueued, as those wait on the record that was
+// the most recent one at the time they were issued.
+//
+// The pool isn't thread-safe: it's meant to be used from a loop.
+class CudaEventPool {
+ public:
+  explicit CudaEventPool(bool interprocess = false)
+      : interprocess_(interprocess) {}
+
+  // Borrow an event of the given device, and tell whether it was just created
+  // (in which case, e.g., its handle must be sent to the peer).
+  std::tuple<size_t, bool> acquire(int device) {
+    DevicePool& devicePool = devicePools_[device];
+    if (!devicePool.freeIndices.empty()) {
+      const size_t eventIdx = devicePool.freeIndices.back();
+      devicePool.freeIndices.pop_back();
+      return std::make_tuple(eventIdx, false);
+    }
+    devicePool.events.push_back(
+        std::make_unique<CudaEvent>(device, interprocess_));
+    return std::make_tuple(devicePool.events.size() - 1, true);
+  }
+
+  CudaEvent& get(int device, size_t eventIdx) {
+    auto iter = devicePools_.find(device);
+    TP_DCHECK(iter != devicePools_.end());
+    TP_DCHECK_LT(eventIdx, iter->second.events.size());
+    return *iter->second.events[eventIdx];
+  }
+
+  void release(int device, size_t eventIdx) {
+    auto iter = devicePools_.find(device);
+    TP_DCHECK(iter != devicePools_.end());
+    TP_DCHECK_LT(eventIdx, iter->second.events.size());
+    iter->second.freeIndices.push_back(eventIdx);
+  }
+
+ private:
+  struct DevicePool {
+    std::vector<std::unique_ptr<CudaEvent>> events;
+    std::vector<size_t> freeIndices;
+  };
+
+  const bool interprocess_;
+  std::unordered_map<int, DevicePool> devicePools_;
+};
+
+} // namespace tensorpipe
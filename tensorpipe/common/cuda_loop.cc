@@ -8,8 +8,17 @@
 
 #include <tensorpipe/common/cuda_loop.h>
 
+#include <deque>
+#include <list>
+#include <tuple>
+#include <utility>
+#include <vector>
+
 #include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/cuda_event_pool.h>
 #include <tensorpipe/common/system.h>
+#include <tensorpipe/common/trace.h>
+#include <tensorpipe/common/usdt.h>
 
 namespace tensorpipe {
 
@@ -29,11 +38,148 @@ class CudaLoopClosedError final : public BaseError {
   }
 };
 
+// The completions are hardware events which nobody notifies the poller about,
+// hence this bounds the latency of those that happen while it's asleep.
+constexpr std::chrono::microseconds kSleepDuration{100};
+
+// The completed operations that can wait for the loop to pick them up in the
+// lock-free queue, beyond which they go to the overflow list.
+constexpr size_t kMaxQueuedOperations = 1024;
+
 } // namespace
 
-CudaLoop::CudaLoop() {
-  thread_ = std::thread([this]() {
-    setThreadName("TP_CUDA_callback_loop");
+// Records an event after each callback's work and polls them all from its own
+// thread, which avoids the internal thread of the CUDA runtime and the hand-off
+// between it and the loop.
+class CudaEventPoller final : public BusyPollingLoop {
+ public:
+  CudaEventPoller(
+      std::chrono::microseconds spinDuration,
+      ThreadOptions threadOptions)
+      : BusyPollingLoop(spinDuration, kSleepDuration) {
+    startThread("TP_CUDA_event_poller", std::move(threadOptions));
+  }
+
+  void addCallback(
+      int device,
+      cudaStream_t stream,
+      std::function<void(const Error&)> callback) {
+    size_t eventIdx;
+    CudaEvent* event;
+    {
+      std::unique_lock<std::mutex> lock = mutex_.acquire();
+      if (closed_) {
+        lock.unlock();
+        callback(TP_CREATE_ERROR(CudaLoopClosedError));
+        return;
+      }
+      ++numPendingCallbacks_;
+      std::tie(eventIdx, std::ignore) = eventPool_.acquire(device);
+      event = &eventPool_.get(device, eventIdx);
+    }
+
+    // The pool needs the lock, but the event is ours until we give it back.
+    event->record(stream);
+
+    deferToLoop([this,
+                 device,
+                 eventIdx,
+                 event,
+                 callback{std::move(callback)}]() mutable {
+      pendingCallbacks_.push_back(
+          PendingCallback{device, eventIdx, event, std::move(callback)});
+    });
+  }
+
+  void close() {
+    std::unique_lock<std::mutex> lock = mutex_.acquire();
+    if (!closed_) {
+      closed_ = true;
+      stopBusyPolling();
+    }
+  }
+
+  void join() {
+    close();
+
+    if (!joined_.exchange(true)) {
+      joinThread();
+    }
+  }
+
+  ~CudaEventPoller() override {
+    join();
+  }
+
+ protected:
+  bool pollOnce() override {
+    std::vector<std::function<void(const Error&)>> completed;
+    for (auto iter = pendingCallbacks_.begin();
+         iter != pendingCallbacks_.end();) {
+      if (!iter->event->query()) {
+        ++iter;
+        continue;
+      }
+      completed.push_back(std::move(iter->callback));
+      {
+        std::unique_lock<std::mutex> lock = mutex_.acquire();
+        eventPool_.release(iter->device, iter->eventIdx);
+      }
+      iter = pendingCallbacks_.erase(iter);
+    }
+
+    if (completed.empty()) {
+      return false;
+    }
+    for (auto& callback : completed) {
+      TP_TRACE_SCOPE("tp::CudaLoop::callback");
+      TP_USDT(cuda__callback, 0);
+      callback(Error::kSuccess);
+    }
+    {
+      std::unique_lock<std::mutex> lock = mutex_.acquire();
+      numPendingCallbacks_ -= completed.size();
+    }
+    return true;
+  }
+
+  bool readyToClose() override {
+    std::unique_lock<std::mutex> lock = mutex_.acquire();
+    return numPendingCallbacks_ == 0;
+  }
+
+ private:
+  struct PendingCallback {
+    int device;
+    size_t eventIdx;
+    CudaEvent* event;
+    std::function<void(const Error&)> callback;
+  };
+
+  ProfiledMutex mutex_{"cuda_loop/event_poller"};
+  bool closed_{false};
+  std::atomic<bool> joined_{false};
+  // Counts the callbacks from when they're added (rather than from when they
+  // reach the loop) so that the loop doesn't terminate before running them.
+  uint64_t numPendingCallbacks_{0};
+  CudaEventPool eventPool_;
+
+  // Only accessed from the loop, in the order in which callbacks were added.
+  std::list<PendingCallback> pendingCallbacks_;
+};
+
+CudaLoop::CudaLoop(
+    ThreadOptions threadOptions,
+    CudaLoopMode mode,
+    std::chrono::microseconds spinDuration)
+    : operations_(kMaxQueuedOperations), mutex_("cuda_loop") {
+  if (mode == CudaLoopMode::kEventPolling) {
+    poller_ = std::make_unique<CudaEventPoller>(
+        spinDuration, std::move(threadOptions));
+    return;
+  }
+  thread_ = std::thread([this, threadOptions{std::move(threadOptions)}]() {
+    setUpThread(threadOptions, "TP_CUDA_callback_loop");
     processCallbacks();
   });
 }
@@ -46,49 +192,81 @@ void CudaLoop::join() {
   close();
 
   if (!joined_.exchange(true)) {
-    thread_.join();
+    if (poller_ != nullptr) {
+      poller_->join();
+    } else {
+      thread_.join();
+    }
   }
 }
 
 void CudaLoop::close() {
-  std::unique_lock<std::mutex> lock(mutex_);
+  if (poller_ != nullptr) {
+    poller_->close();
+    return;
+  }
+  std::unique_lock<std::mutex> lock = mutex_.acquire();
   if (closed_) {
     return;
   }
   closed_ = true;
-  cv_.notify_all();
+  operations_.push(nullopt);
 }
 
 void CudaLoop::processCallbacks() {
-  for (;;) {
-    std::deque<Operation> operations;
-    {
-      std::unique_lock<std::mutex> lock(mutex_);
-
-      if (operations_.empty()) {
-        if (closed_ && pendingOperations_ == 0) {
-          break;
-        } else {
-          cv_.wait(lock);
-        }
-      }
+  bool closed = false;
+  while (!closed || pendingOperations_ > 0) {
+    std::deque<optional<Operation>> operations;
+    operations_.popAll(operations);
 
-      std::swap(operations, operations_);
-      pendingOperations_ -= operations.size();
+    for (auto& op : operations) {
+      if (!op.has_value()) {
+        closed = true;
+        continue;
+      }
+      runOperation(op.value());
     }
 
-    for (auto& op : operations) {
-      op.callback(op.error);
+    // An operation only overflows when the queue is full, or when others
+    // already did, hence the queue isn't empty, or these are taken next.
+    for (Operation& op : takeOverflowOperations()) {
+      runOperation(op);
     }
   }
 }
 
+void CudaLoop::runOperation(Operation& op) {
+  --pendingOperations_;
+  TP_TRACE_SCOPE("tp::CudaLoop::callback");
+  TP_USDT(cuda__callback, op.error ? 1 : 0);
+  op.callback(op.error);
+}
+
+std::deque<CudaLoop::Operation> CudaLoop::takeOverflowOperations() {
+  std::deque<Operation> operations;
+  if (!overflowing_.load(std::memory_order_acquire)) {
+    return operations;
+  }
+  std::unique_lock<std::mutex> lock = overflowMutex_.acquire();
+  // The operations that completed before the overflowing ones must be run
+  // first. Meanwhile no new operation enters the queue, hence it drains.
+  if (operations_.empty()) {
+    std::swap(operations, overflowOperations_);
+    overflowing_.store(false, std::memory_order_release);
+  }
+  return operations;
+}
+
 void CudaLoop::addCallback(
     int device,
     cudaStream_t stream,
     std::function<void(const Error&)> callback) {
+  if (poller_ != nullptr) {
+    poller_->addCallback(device, stream, std::move(callback));
+    return;
+  }
   {
-    std::unique_lock<std::mutex> lock(mutex_);
+    std::unique_lock<std::mutex> lock = mutex_.acquire();
     if (closed_) {
       callback(TP_CREATE_ERROR(CudaLoopClosedError));
       return;
@@ -110,17 +288,23 @@ void CUDART_CB CudaLoop::runCudaCallback(
   std::unique_ptr<CudaCallback> cudaCallback(
       reinterpret_cast<CudaCallback*>(callbackPtr));
   CudaLoop& loop = cudaCallback->loop;
-  {
-    std::unique_lock<std::mutex> lock(loop.mutex_);
-    auto error = Error::kSuccess;
-    if (cudaError != cudaSuccess) {
-      error = TP_CREATE_ERROR(CudaError, cudaError);
-    }
-    loop.operations_.push_back(
-        {std::move(cudaCallback->callback), std::move(error)});
-    loop.cv_.notify_all();
+  auto error = Error::kSuccess;
+  if (cudaError != cudaSuccess) {
+    error = TP_CREATE_ERROR(CudaError, cudaError);
   }
+  optional<Operation> op(
+      Operation{std::move(cudaCallback->callback), std::move(error)});
   cudaCallback.reset();
+  if (!loop.overflowing_.load(std::memory_order_acquire) &&
+      loop.operations_.pushIfNotFull(op)) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock = loop.overflowMutex_.acquire();
+  if (loop.overflowOperations_.empty() && loop.operations_.pushIfNotFull(op)) {
+    return;
+  }
+  loop.overflowOperations_.push_back(std::move(op).value());
+  loop.overflowing_.store(true, std::memory_order_release);
 }
 
 } // namespace tensorpipe
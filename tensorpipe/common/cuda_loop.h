@@ -9,19 +9,40 @@
 #pragma once
 
 #include <atomic>
-#include <condition_variable>
+#include <chrono>
 #include <deque>
 #include <functional>
-#include <list>
+#include <memory>
 #include <mutex>
 #include <thread>
 
 #include <cuda_runtime.h>
 
+#include <tensorpipe/common/busy_polling_loop.h>
 #include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/lock_stats.h>
+#include <tensorpipe/common/mpmc_queue.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/thread_options.h>
 
 namespace tensorpipe {
 
+enum class CudaLoopMode {
+  // Enqueue a host callback on the stream, which the CUDA runtime runs on an
+  // internal thread (blocking the stream meanwhile) and which hands it over to
+  // the loop's thread.
+  kStreamCallbacks,
+  // Record an event on the stream, which the loop's thread polls, running the
+  // callbacks of all the events that completed since the last poll at once.
+  kEventPolling,
+};
+
+// The default time for which the loop keeps polling after its last completion,
+// when polling events.
+constexpr std::chrono::microseconds kDefaultCudaLoopSpinDuration{100};
+
+class CudaEventPoller;
+
 class CudaLoop {
   struct Operation {
     std::function<void(const Error&)> callback;
@@ -29,7 +50,13 @@ class CudaLoop {
   };
 
  public:
-  CudaLoop();
+  // When polling events, the loop busy-polls for spinDuration after the last
+  // completion it found and then polls at a low frequency until more callbacks
+  // are added. Pass kBusyPollForever to have it never slow down.
+  explicit CudaLoop(
+      ThreadOptions threadOptions = ThreadOptions(),
+      CudaLoopMode mode = CudaLoopMode::kStreamCallbacks,
+      std::chrono::microseconds spinDuration = kDefaultCudaLoopSpinDuration);
 
   ~CudaLoop();
 
@@ -42,17 +69,39 @@ class CudaLoop {
       std::function<void(const Error&)> callback);
 
  private:
+  // Only set when polling events, in which case this class's own thread and
+  // queue are unused.
+  std::unique_ptr<CudaEventPoller> poller_;
+
   std::thread thread_;
-  std::deque<Operation> operations_;
-  std::mutex mutex_;
-  std::condition_variable cv_;
-  uint64_t pendingOperations_{0};
+  // The completed operations, pushed by the internal thread of the CUDA runtime
+  // without taking the mutex, followed by an empty one once the loop is closed.
+  MpmcQueue<optional<Operation>> operations_;
+  // The operations that completed while the queue above was full, and all the
+  // later ones until the loop has emptied the queue and taken these, so that
+  // it runs them all in the order in which they completed. The internal thread
+  // of the CUDA runtime serves all the streams, hence it mustn't ever wait for
+  // a busy loop (e.g., one whose callbacks synchronize with the device).
+  ProfiledMutex overflowMutex_{"cuda_loop/overflow"};
+  std::deque<Operation> overflowOperations_;
+  std::atomic<bool> overflowing_{false};
+  // Only guards closed_, so that no operation is added after it's set.
+  ProfiledMutex mutex_;
+  // The operations that were added and haven't been popped yet, which the loop
+  // waits for once closed.
+  std::atomic<uint64_t> pendingOperations_{0};
 
   bool closed_{false};
   std::atomic<bool> joined_{false};
 
   void processCallbacks();
 
+  void runOperation(Operation& op);
+
+  // Move the overflowing operations out, if the queue got emptied since they
+  // started overflowing.
+  std::deque<Operation> takeOverflowOperations();
+
   // Proxy static method for cudaStreamAddCallback(), which does not accept
   // lambdas.
   static void CUDART_CB runCudaCallback(
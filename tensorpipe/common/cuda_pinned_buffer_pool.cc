@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/cuda_pinned_buffer_pool.h>
+
+#include <algorithm>
+#include <tuple>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/system.h>
+
+namespace tensorpipe {
+
+namespace {
+
+// Below this size the cost of a copy is dominated by its fixed overhead, hence
+// there is no point in having finer-grained size classes.
+constexpr size_t kMinSizeClass = 4096;
+
+size_t sizeClassForLength(size_t length) {
+  return std::max(kMinSizeClass, static_cast<size_t>(nextPow2(
+                                     static_cast<uint64_t>(length))));
+}
+
+class CudaPinnedBufferPoolClosedError final : public BaseError {
+  std::string what() const override {
+    return "CUDA pinned buffer pool already closed";
+  }
+};
+
+} // namespace
+
+CudaPinnedBufferPool::CudaPinnedBufferPool(size_t maxBytes)
+    : maxBytes_(maxBytes) {}
+
+void CudaPinnedBufferPool::allocate(
+    int device,
+    size_t length,
+    TAllocCallback callback) {
+  const size_t sizeClass = sizeClassForLength(length);
+  uint8_t* ptr = nullptr;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (closed_) {
+      lock.unlock();
+      callback(TP_CREATE_ERROR(CudaPinnedBufferPoolClosedError), nullptr);
+      return;
+    }
+    // Don't overtake requests that are already waiting.
+    if (pendingRequests_.empty()) {
+      ptr = tryAcquire(device, sizeClass);
+    }
+    if (ptr == nullptr) {
+      TP_VLOG(9) << "Pinned buffer pool is at capacity (" << totalBytes_
+                 << " bytes out of " << maxBytes_ << "), queueing request for "
+                 << sizeClass << " bytes on device " << device;
+      pendingRequests_.push_back(
+          Request{device, sizeClass, std::move(callback)});
+      return;
+    }
+  }
+  callback(Error::kSuccess, wrap(device, sizeClass, ptr));
+}
+
+size_t CudaPinnedBufferPool::getTotalBytes() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return totalBytes_;
+}
+
+void CudaPinnedBufferPool::releaseFreeBuffers() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  TP_VLOG(9) << "Pinned buffer pool is releasing "
+             << totalBytes_ - inUseBytes_ << " cached bytes";
+  evictFreeBuffers(totalBytes_);
+}
+
+uint8_t* CudaPinnedBufferPool::tryAcquire(int device, size_t sizeClass) {
+  auto& freeList = freeLists_[device][sizeClass];
+  if (!freeList.empty()) {
+    uint8_t* ptr = freeList.back();
+    freeList.pop_back();
+    inUseBytes_ += sizeClass;
+    return ptr;
+  }
+
+  if (totalBytes_ + sizeClass > maxBytes_) {
+    evictFreeBuffers(totalBytes_ + sizeClass - maxBytes_);
+  }
+  if (totalBytes_ + sizeClass > maxBytes_ && inUseBytes_ > 0) {
+    return nullptr;
+  }
+
+  TP_VLOG(9) << "Pinned buffer pool is allocating " << sizeClass
+             << " bytes on device " << device;
+  uint8_t* ptr = allocateBuffer(device, sizeClass);
+  totalBytes_ += sizeClass;
+  inUseBytes_ += sizeClass;
+  return ptr;
+}
+
+uint8_t* CudaPinnedBufferPool::allocateBuffer(int device, size_t sizeClass) {
+  CudaDeviceGuard guard(device);
+  Error error;
+  MmappedPtr hugePagePtr;
+  std::tie(error, hugePagePtr) =
+      MmappedPtr::createOnHugePages(sizeClass, PROT_READ | PROT_WRITE);
+  if (!error) {
+    cudaError_t result = cudaHostRegister(
+        hugePagePtr.ptr(), sizeClass, cudaHostRegisterDefault);
+    if (result == cudaSuccess) {
+      uint8_t* ptr = hugePagePtr.ptr();
+      hugePageBuffers_.emplace(ptr, std::move(hugePagePtr));
+      return ptr;
+    }
+    // Clear the error, which isn't sticky, so that it isn't reported later.
+    cudaGetLastError();
+    TP_VLOG(9) << "Pinned buffer pool couldn't pin huge pages, falling back to "
+               << "regular ones (" << cudaGetErrorName(result) << ")";
+  }
+  void* ptr;
+  TP_CUDA_CHECK(cudaMallocHost(&ptr, sizeClass));
+  return reinterpret_cast<uint8_t*>(ptr);
+}
+
+void CudaPinnedBufferPool::freeBuffer(uint8_t* ptr) {
+  auto iter = hugePageBuffers_.find(ptr);
+  if (iter != hugePageBuffers_.end()) {
+    TP_CUDA_CHECK(cudaHostUnregister(ptr));
+    hugePageBuffers_.erase(iter);
+    return;
+  }
+  TP_CUDA_CHECK(cudaFreeHost(ptr));
+}
+
+void CudaPinnedBufferPool::evictFreeBuffers(size_t numBytes) {
+  size_t numFreedBytes = 0;
+  for (auto& deviceIter : freeLists_) {
+    for (auto& sizeClassIter : deviceIter.second) {
+      const size_t sizeClass = sizeClassIter.first;
+      auto& freeList = sizeClassIter.second;
+      while (!freeList.empty() && numFreedBytes < numBytes) {
+        freeBuffer(freeList.back());
+        freeList.pop_back();
+        totalBytes_ -= sizeClass;
+        numFreedBytes += sizeClass;
+      }
+      if (numFreedBytes >= numBytes) {
+        return;
+      }
+    }
+  }
+}
+
+CudaPinnedBuffer CudaPinnedBufferPool::wrap(
+    int device,
+    size_t sizeClass,
+    uint8_t* ptr) {
+  return CudaPinnedBuffer(
+      ptr, [pool{shared_from_this()}, device, sizeClass](uint8_t* ptr) {
+        pool->release(device, sizeClass, ptr);
+      });
+}
+
+void CudaPinnedBufferPool::release(
+    int device,
+    size_t sizeClass,
+    uint8_t* ptr) {
+  std::vector<std::tuple<CudaPinnedBuffer, TAllocCallback>> servedRequests;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    inUseBytes_ -= sizeClass;
+    if (closed_) {
+      freeBuffer(ptr);
+      totalBytes_ -= sizeClass;
+      return;
+    }
+    freeLists_[device][sizeClass].push_back(ptr);
+
+    while (!pendingRequests_.empty()) {
+      Request& request = pendingRequests_.front();
+      uint8_t* newPtr = tryAcquire(request.device, request.sizeClass);
+      if (newPtr == nullptr) {
+        break;
+      }
+      servedRequests.emplace_back(
+          wrap(request.device, request.sizeClass, newPtr),
+          std::move(request.callback));
+      pendingRequests_.pop_front();
+    }
+  }
+
+  // Fire the callbacks outside of the critical section, as they could end up
+  // releasing buffers themselves.
+  for (auto& servedRequest : servedRequests) {
+    std::get<1>(servedRequest)(
+        Error::kSuccess, std::move(std::get<0>(servedRequest)));
+  }
+}
+
+void CudaPinnedBufferPool::close() {
+  std::deque<Request> pendingRequests;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (closed_) {
+      return;
+    }
+    closed_ = true;
+    std::swap(pendingRequests, pendingRequests_);
+    evictFreeBuffers(totalBytes_);
+  }
+
+  for (auto& request : pendingRequests) {
+    request.callback(TP_CREATE_ERROR(CudaPinnedBufferPoolClosedError), nullptr);
+  }
+}
+
+CudaPinnedBufferPool::~CudaPinnedBufferPool() {
+  close();
+}
+
+} // namespace tensorpipe
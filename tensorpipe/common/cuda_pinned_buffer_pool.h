@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/memory.h>
+#include <tensorpipe/common/pinned_memory_allocator.h>
+
+namespace tensorpipe {
+
+// A pool of pinned (page-locked) host memory, used as staging area for copies
+// between CUDA devices and CPU. Allocating and freeing pinned memory is very
+// expensive (it often costs more than the copy itself for small buffers, and it
+// takes a global lock in the CUDA driver), hence buffers are never returned to
+// CUDA while the pool is open: when a CudaPinnedBuffer obtained from the pool
+// is destroyed its memory goes back to a free list, from which it is handed out
+// again to the next request of the same size class and device.
+//
+// Sizes are rounded up to the next power of two (with a minimum), which bounds
+// the fragmentation to a factor of two and limits the number of free lists.
+// The buffers that are made of whole huge pages (from 2 MB on) are backed by
+// them, and then pinned, if any are available, which spares TLB misses to the
+// copy engines and to the CPU. Others come from CUDA's allocator.
+//
+// The total amount of pinned memory held by the pool (both in use and cached)
+// is capped. When a request would exceed the cap, cached buffers of other size
+// classes are released first and, if that isn't enough, the request is queued
+// until enough memory is returned to the pool (requests are served in FIFO
+// order). As an exception, a request is always allowed to proceed when no
+// memory is in use at all, so that a single buffer larger than the cap doesn't
+// stall forever.
+//
+// The pool is thread-safe. Allocation callbacks may be invoked inline from the
+// call to allocate, or later on from whatever thread releases a buffer, hence
+// callers are expected to wrap them so that they defer to their own loop.
+class CudaPinnedBufferPool
+    : public PinnedMemoryAllocator,
+      public std::enable_shared_from_this<CudaPinnedBufferPool> {
+ public:
+  explicit CudaPinnedBufferPool(size_t maxBytes);
+
+  void allocate(int device, size_t length, TAllocCallback callback) override;
+
+  // The pinned memory held by the pool, both in use and cached.
+  size_t getTotalBytes() override;
+
+  // Give back all the cached buffers to CUDA, e.g., when the memory is needed
+  // elsewhere. They'll be allocated again as the need arises.
+  void releaseFreeBuffers() override;
+
+  // Fail all queued requests and free all cached buffers. Buffers that are
+  // still in use will be freed when they are released.
+  void close();
+
+  ~CudaPinnedBufferPool();
+
+ private:
+  struct Request {
+    int device;
+    size_t sizeClass;
+    TAllocCallback callback;
+  };
+
+  std::mutex mutex_;
+  const size_t maxBytes_;
+  // The amount of pinned memory that was obtained from CUDA and not given back
+  // to it yet, including the one sitting in the free lists.
+  size_t totalBytes_{0};
+  // The part of the above which is currently handed out to users.
+  size_t inUseBytes_{0};
+  bool closed_{false};
+
+  // For each device, for each size class, the buffers that are available.
+  std::unordered_map<int, std::map<size_t, std::vector<uint8_t*>>> freeLists_;
+  std::deque<Request> pendingRequests_;
+  // The buffers that were carved out of huge pages, which must be unpinned and
+  // unmapped rather than given back to CUDA's allocator.
+  std::unordered_map<uint8_t*, MmappedPtr> hugePageBuffers_;
+
+  // Try to obtain a buffer for the given request, either from the free lists
+  // or by allocating new memory. Return null if this would exceed the cap.
+  // Must be called while holding the mutex.
+  uint8_t* tryAcquire(int device, size_t sizeClass);
+
+  // Obtain pinned memory for a new buffer, and give it back. Must be called
+  // while holding the mutex.
+  uint8_t* allocateBuffer(int device, size_t sizeClass);
+  void freeBuffer(uint8_t* ptr);
+
+  // Give back cached buffers to CUDA until at least the given number of bytes
+  // has been freed (or the free lists are empty). Must be called while holding
+  // the mutex.
+  void evictFreeBuffers(size_t numBytes);
+
+  // Wrap a pointer into a CudaPinnedBuffer that returns the memory to the pool
+  // upon destruction.
+  CudaPinnedBuffer wrap(int device, size_t sizeClass, uint8_t* ptr);
+
+  void release(int device, size_t sizeClass, uint8_t* ptr);
+};
+
+} // namespace tensorpipe
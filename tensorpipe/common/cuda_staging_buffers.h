@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+// Device memory that a pipe gathers small CUDA tensors into before sending
+// them, and scatters them from once received (see
+// PipeOptions::cudaTensorCoalescingThreshold). Allocating and freeing it with
+// cudaMalloc and cudaFree is expensive, and synchronizes the device, hence the
+// buffers are kept and handed out again to later messages, of any stream of
+// the same device, whose work is made to wait for the one that was enqueued by
+// the previous user of the buffer. A few buffers are enough, as they're only
+// used by the messages in flight.
+//
+// This isn't thread-safe: it's meant to be used from a pipe's loop.
+class CudaStagingBuffers {
+ public:
+  struct Buffer {
+    int device{-1};
+    void* ptr{nullptr};
+    size_t length{0};
+    // Recorded on the stream of the previous user once it's done with it.
+    std::unique_ptr<CudaEvent> releaseEvent;
+  };
+
+  CudaStagingBuffers() = default;
+
+  CudaStagingBuffers(const CudaStagingBuffers&) = delete;
+  CudaStagingBuffers(CudaStagingBuffers&&) = delete;
+  CudaStagingBuffers& operator=(const CudaStagingBuffers&) = delete;
+  CudaStagingBuffers& operator=(CudaStagingBuffers&&) = delete;
+
+  // Return a buffer of at least the given length, on the given device, that
+  // the work enqueued on the given stream from now on can use.
+  Buffer acquire(int device, size_t length, cudaStream_t stream) {
+    auto iter = std::find_if(
+        freeBuffers_.begin(), freeBuffers_.end(), [&](const Buffer& buffer) {
+          return buffer.device == device && buffer.length >= length;
+        });
+    if (iter != freeBuffers_.end()) {
+      Buffer buffer = std::move(*iter);
+      freeBuffers_.erase(iter);
+      buffer.releaseEvent->wait(stream, device);
+      return buffer;
+    }
+    CudaDeviceGuard guard(device);
+    Buffer buffer;
+    buffer.device = device;
+    buffer.length = length;
+    TP_CUDA_CHECK(cudaMalloc(&buffer.ptr, length));
+    buffer.releaseEvent = std::make_unique<CudaEvent>(device);
+    return buffer;
+  }
+
+  // Take the buffer back once all the work that uses it has been enqueued on
+  // the given stream.
+  void release(Buffer buffer, cudaStream_t stream) {
+    {
+      CudaDeviceGuard guard(buffer.device);
+      buffer.releaseEvent->record(stream);
+    }
+    freeBuffers_.push_back(std::move(buffer));
+    if (freeBuffers_.size() > kMaxFreeBuffers) {
+      // Freeing a buffer synchronizes its device, hence it's safe even if the
+      // work that uses it isn't done.
+      auto iter = std::min_element(
+          freeBuffers_.begin(),
+          freeBuffers_.end(),
+          [](const Buffer& a, const Buffer& b) { return a.length < b.length; });
+      freeBuffer(*iter);
+      freeBuffers_.erase(iter);
+    }
+  }
+
+  ~CudaStagingBuffers() {
+    for (Buffer& buffer : freeBuffers_) {
+      freeBuffer(buffer);
+    }
+  }
+
+ private:
+  static constexpr size_t kMaxFreeBuffers = 4;
+
+  std::vector<Buffer> freeBuffers_;
+
+  static void freeBuffer(Buffer& buffer) {
+    CudaDeviceGuard guard(buffer.device);
+    TP_CUDA_CHECK(cudaFree(buffer.ptr));
+  }
+};
+
+} // namespace tensorpipe
@@ -9,10 +9,10 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <deque>
 #include <exception>
 #include <functional>
-#include <future>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -21,7 +21,13 @@
 #include <vector>
 
 #include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/latch.h>
+#include <tensorpipe/common/lock_stats.h>
+#include <tensorpipe/common/loop_stats.h>
 #include <tensorpipe/common/system.h>
+#include <tensorpipe/common/task_queue.h>
+#include <tensorpipe/common/thread_options.h>
+#include <tensorpipe/common/trace.h>
 
 namespace tensorpipe {
 
@@ -37,7 +43,7 @@ namespace tensorpipe {
 // provide.
 class DeferredExecutor {
  public:
-  using TTask = std::function<void()>;
+  using TTask = Task;
 
   virtual void deferToLoop(TTask fn) = 0;
 
@@ -56,21 +62,23 @@ class DeferredExecutor {
     if (inLoop()) {
       fn();
     } else {
-      // Must use a copyable wrapper around std::promise because
-      // we use it from a std::function which must be copyable.
-      auto promise = std::make_shared<std::promise<void>>();
-      auto future = promise->get_future();
-      // Marked as mutable because the fn might hold some state (e.g., the
-      // closure of a lambda) which it might want to modify.
-      deferToLoop([promise, fn{std::forward<F>(fn)}]() mutable {
+      // Everything stays on the stack of this thread, which waits for the task
+      // to be done, hence the task only captures references, which fit inline
+      // in a Task, and only the error path goes through the exception_ptr.
+      Latch latch;
+      std::exception_ptr exception;
+      deferToLoop([&fn, &latch, &exception]() {
         try {
           fn();
-          promise->set_value();
         } catch (...) {
-          promise->set_exception(std::current_exception());
+          exception = std::current_exception();
         }
+        latch.open();
       });
-      future.get();
+      latch.wait();
+      if (unlikely(exception != nullptr)) {
+        std::rethrow_exception(exception);
+      }
     }
   }
 
@@ -100,31 +108,44 @@ class OnDemandDeferredExecutor : public DeferredExecutor {
 
   void deferToLoop(TTask fn) override {
     {
-      std::unique_lock<std::mutex> lock(mutex_);
-      pendingTasks_.push_back(std::move(fn));
+      std::unique_lock<std::mutex> lock = mutex_.acquire();
       if (currentLoop_ != std::thread::id()) {
+        pendingTasks_.push_back(std::move(fn));
         return;
       }
       currentLoop_ = std::this_thread::get_id();
     }
 
+    // Nobody was running the loop, hence no task was pending in it, and this
+    // one can run right away rather than go through the queue. This is the
+    // common case for the callbacks of the transports, which thus reach the
+    // pipe, and then the user, on the transport's thread with no further ado.
+    fn();
+
+    // Take all the tasks that piled up at once, rather than one at a time, so
+    // that the other threads (e.g., many of them writing to a same pipe) only
+    // contend with this one once per batch. Those that the batch defers come
+    // after it, as they would have anyway.
+    std::deque<TTask> tasks;
     while (true) {
-      TTask task;
       {
-        std::unique_lock<std::mutex> lock(mutex_);
+        std::unique_lock<std::mutex> lock = mutex_.acquire();
         if (pendingTasks_.empty()) {
           currentLoop_ = std::thread::id();
           return;
         }
-        task = std::move(pendingTasks_.front());
-        pendingTasks_.pop_front();
+        std::swap(tasks, pendingTasks_);
       }
-      task();
+      for (TTask& task : tasks) {
+        task();
+      }
+      tasks.clear();
     }
   }
 
  private:
-  std::mutex mutex_;
+  // Shared by the threads that defer to a same pipe, for example.
+  ProfiledMutex mutex_{"on_demand_loop"};
   std::atomic<std::thread::id> currentLoop_{std::thread::id()};
   std::deque<TTask> pendingTasks_;
 };
@@ -132,29 +153,50 @@ class OnDemandDeferredExecutor : public DeferredExecutor {
 class EventLoopDeferredExecutor : public virtual DeferredExecutor {
  public:
   void deferToLoop(TTask fn) override {
-    {
-      std::unique_lock<std::mutex> lock(mutex_);
-      if (likely(isThreadConsumingDeferredFunctions_)) {
-        fns_.push_back(std::move(fn));
-        wakeupEventLoopToDeferFunction();
-        return;
+    // Announce ourselves before checking the flag, so that the loop, when it
+    // winds down, can wait for us to be done pushing to the queue.
+    numProducersInFlight_.fetch_add(1, std::memory_order_seq_cst);
+    if (likely(isThreadConsumingDeferredFunctions_.load(
+            std::memory_order_seq_cst))) {
+      if (unlikely(collectingStats_.load(std::memory_order_relaxed))) {
+        pushAndCount(std::move(fn));
+      } else {
+        fns_.push(std::move(fn));
       }
+      wakeupEventLoopToDeferFunction();
+      numProducersInFlight_.fetch_sub(1, std::memory_order_seq_cst);
+      return;
     }
-    // Must call it without holding the lock, as it could cause a reentrant
-    // call.
+    numProducersInFlight_.fetch_sub(1, std::memory_order_seq_cst);
     onDemandLoop_.deferToLoop(std::move(fn));
   }
 
   inline bool inLoop() override {
-    {
-      std::unique_lock<std::mutex> lock(mutex_);
-      if (likely(isThreadConsumingDeferredFunctions_)) {
-        return std::this_thread::get_id() == thread_.get_id();
-      }
+    if (likely(isThreadConsumingDeferredFunctions_.load(
+            std::memory_order_seq_cst))) {
+      return std::this_thread::get_id() == thread_.get_id();
     }
     return onDemandLoop_.inLoop();
   }
 
+  // Start gathering the statistics of the loop, which costs a few timestamps
+  // for each deferred function. There is no going back.
+  void enableStats() {
+    collectingStats_.store(true, std::memory_order_relaxed);
+  }
+
+  // Return a snapshot of the statistics of the loop. Thread-safe.
+  LoopStats getStats() {
+    LoopStats stats;
+    {
+      std::unique_lock<std::mutex> lock(statsMutex_);
+      stats = stats_;
+    }
+    stats.numPendingTasks = numPendingTasks_.load();
+    stats.maxPendingTasks = maxPendingTasks_.load();
+    return stats;
+  }
+
  protected:
   // This is the actual long-running event loop, which is implemented by
   // subclasses and called inside the thread owned by this parent class.
@@ -170,7 +212,7 @@ class EventLoopDeferredExecutor : public virtual DeferredExecutor {
   // it, and must be implemented by subclasses, which are required to have their
   // event loop call runDeferredFunctionsFromEventLoop as soon as possible. This
   // function is guaranteed to be called once per function deferral (in case
-  // subclasses want to keep count).
+  // subclasses want to keep count), after the function has been enqueued.
   virtual void wakeupEventLoopToDeferFunction() = 0;
 
   // Called by subclasses to have the parent class start the thread. We cannot
@@ -178,9 +220,14 @@ class EventLoopDeferredExecutor : public virtual DeferredExecutor {
   // lead to a race condition between the event loop (run by the thread) and the
   // subclass's constructor (which is executed after the parent class's one).
   // Hence this method should be invoked at the end of the subclass constructor.
-  void startThread(std::string threadName) {
+  void startThread(
+      std::string threadName,
+      ThreadOptions threadOptions = ThreadOptions()) {
     thread_ = std::thread(
-        &EventLoopDeferredExecutor::loop, this, std::move(threadName));
+        &EventLoopDeferredExecutor::loop,
+        this,
+        std::move(threadName),
+        std::move(threadOptions));
   }
 
   // This is basically the reverse operation of the above, and is needed for the
@@ -195,47 +242,73 @@ class EventLoopDeferredExecutor : public virtual DeferredExecutor {
   // functions were deferred, this method only needs to be called once. However,
   // care must be taken to avoid races between this call and new wakeups. This
   // method also returns the number of functions it executed, in case the
-  // subclass is keeping count.
+  // subclass is keeping count. It may miss a function whose deferral is still
+  // in progress, but the wakeup for that function will come afterwards.
   size_t runDeferredFunctionsFromEventLoop() {
-    decltype(fns_) fns;
-
-    {
-      std::unique_lock<std::mutex> lock(mutex_);
-      std::swap(fns, fns_);
+    TP_TRACE_SCOPE("tp::EventLoop::runDeferredFunctions");
+    if (likely(!collectingStats_.load(std::memory_order_relaxed))) {
+      return fns_.runTasks();
     }
+    return fns_.runTasks([this](Task& task, TTimePoint pushTime) {
+      const TTimePoint startTime = std::chrono::steady_clock::now();
+      task();
+      const TTimePoint endTime = std::chrono::steady_clock::now();
+      // The functions deferred before the stats were enabled weren't counted.
+      const bool wasCounted = pushTime != TTimePoint();
+      if (wasCounted) {
+        numPendingTasks_.fetch_sub(1, std::memory_order_relaxed);
+      }
+      std::unique_lock<std::mutex> lock(statsMutex_);
+      if (wasCounted) {
+        stats_.taskQueueLatency.add(startTime - pushTime);
+      }
+      stats_.taskRunTime.add(endTime - startTime);
+    });
+  }
 
-    for (auto& fn : fns) {
-      fn();
-    }
+  bool isCollectingStats() {
+    return collectingStats_.load(std::memory_order_relaxed);
+  }
 
-    return fns.size();
+  // For subclasses to record the time they spent in their own handlers.
+  void recordPollRunTime(std::chrono::steady_clock::duration duration) {
+    std::unique_lock<std::mutex> lock(statsMutex_);
+    stats_.pollRunTime.add(duration);
   }
 
  private:
-  void loop(std::string threadName) {
-    setThreadName(std::move(threadName));
+  using TTimePoint = MpscTaskQueue::TTimePoint;
+
+  void pushAndCount(TTask fn) {
+    const uint64_t numPendingTasks =
+        numPendingTasks_.fetch_add(1, std::memory_order_relaxed) + 1;
+    uint64_t maxPendingTasks = maxPendingTasks_.load(std::memory_order_relaxed);
+    while (numPendingTasks > maxPendingTasks &&
+           !maxPendingTasks_.compare_exchange_weak(
+               maxPendingTasks, numPendingTasks, std::memory_order_relaxed)) {
+    }
+    fns_.push(std::move(fn), std::chrono::steady_clock::now());
+  }
+
+  void loop(std::string threadName, ThreadOptions threadOptions) {
+    setUpThread(threadOptions, std::move(threadName));
 
     eventLoop();
 
     // The loop is winding down and "handing over" control to the on demand
     // loop. But it can only do so safely once there are no pending deferred
-    // functions, as otherwise those may risk never being executed.
-    while (true) {
-      decltype(fns_) fns;
-
-      {
-        std::unique_lock<std::mutex> lock(mutex_);
-        if (fns_.empty()) {
-          isThreadConsumingDeferredFunctions_ = false;
-          break;
-        }
-        std::swap(fns, fns_);
-      }
-
-      for (auto& fn : fns) {
-        fn();
-      }
+    // functions, as otherwise those may risk never being executed. Once no
+    // producer can be pushing to the queue anymore, we drain it from within
+    // the on demand loop, so that the functions deferred by the ones we run
+    // are executed after them, and on this same thread.
+    isThreadConsumingDeferredFunctions_.store(false, std::memory_order_seq_cst);
+    while (numProducersInFlight_.load(std::memory_order_seq_cst) > 0) {
+      std::this_thread::yield();
     }
+    onDemandLoop_.deferToLoop([this]() {
+      while (runDeferredFunctionsFromEventLoop() > 0) {
+      }
+    });
 
     cleanUpLoop();
   }
@@ -253,14 +326,25 @@ class EventLoopDeferredExecutor : public virtual DeferredExecutor {
   // those tasks inline. In order to keep ensuring the single-threadedness
   // assumption of our model (which is what we rely on to be safe from race
   // conditions) we use an on-demand loop.
-  bool isThreadConsumingDeferredFunctions_{true};
+  std::atomic<bool> isThreadConsumingDeferredFunctions_{true};
   OnDemandDeferredExecutor onDemandLoop_;
 
-  // Mutex to guard the deferring and the running of functions.
-  std::mutex mutex_;
-
-  // List of deferred functions to run when the loop is ready.
-  std::vector<std::function<void()>> fns_;
+  // How many threads are between the check of the above flag and the end of
+  // their push to the queue (and wakeup of the loop).
+  std::atomic<int64_t> numProducersInFlight_{0};
+
+  // Queue of deferred functions to run when the loop is ready. It's lock-free,
+  // as many user threads may be deferring functions to one loop at once.
+  MpscTaskQueue fns_;
+
+  // The statistics, only gathered once enabled. The queue depth is tracked by
+  // the producers and the consumer, hence it's atomic, whereas the rest is only
+  // written by the thread of the loop but must be readable from any thread.
+  std::atomic<bool> collectingStats_{false};
+  std::atomic<uint64_t> numPendingTasks_{0};
+  std::atomic<uint64_t> maxPendingTasks_{0};
+  std::mutex statsMutex_;
+  LoopStats stats_;
 };
 
 } // namespace tensorpipe
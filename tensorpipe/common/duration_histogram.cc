@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/duration_histogram.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace tensorpipe {
+
+namespace {
+
+size_t bucketForDuration(DurationHistogram::TDuration duration) {
+  uint64_t micros =
+      std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+  size_t bucket = 0;
+  while (micros > 0 && bucket < DurationHistogram::kNumBuckets - 1) {
+    micros >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+} // namespace
+
+constexpr size_t DurationHistogram::kNumBuckets;
+
+void DurationHistogram::add(TDuration duration) {
+  if (duration < TDuration::zero()) {
+    duration = TDuration::zero();
+  }
+  ++buckets_[bucketForDuration(duration)];
+  ++count_;
+  sum_ += duration;
+  max_ = std::max(max_, duration);
+}
+
+void DurationHistogram::merge(const DurationHistogram& other) {
+  for (size_t bucket = 0; bucket < kNumBuckets; ++bucket) {
+    buckets_[bucket] += other.buckets_[bucket];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  max_ = std::max(max_, other.max_);
+}
+
+DurationHistogram::TDuration DurationHistogram::mean() const {
+  if (count_ == 0) {
+    return TDuration::zero();
+  }
+  return sum_ / count_;
+}
+
+DurationHistogram::TDuration DurationHistogram::percentile(
+    double fraction) const {
+  if (count_ == 0) {
+    return TDuration::zero();
+  }
+  const uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(fraction * count_)));
+  uint64_t seen = 0;
+  for (size_t bucket = 0; bucket < kNumBuckets - 1; ++bucket) {
+    seen += buckets_[bucket];
+    if (seen >= rank) {
+      return std::min<TDuration>(
+          max_, std::chrono::microseconds(uint64_t(1) << bucket));
+    }
+  }
+  return max_;
+}
+
+} // namespace tensorpipe
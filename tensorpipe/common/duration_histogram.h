@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace tensorpipe {
+
+// A histogram of durations with exponentially-sized buckets: bucket zero holds
+// the samples below one microsecond and bucket i holds the ones between 2^(i-1)
+// (included) and 2^i (excluded) microseconds. The last bucket also holds all
+// the samples that exceed its range. This is a plain value type, which is cheap
+// to copy and isn't thread-safe.
+class DurationHistogram {
+ public:
+  using TDuration = std::chrono::nanoseconds;
+
+  static constexpr size_t kNumBuckets = 32;
+
+  void add(TDuration duration);
+
+  // Add all the samples of the other histogram to this one.
+  void merge(const DurationHistogram& other);
+
+  uint64_t count() const {
+    return count_;
+  }
+
+  TDuration sum() const {
+    return sum_;
+  }
+
+  TDuration max() const {
+    return max_;
+  }
+
+  TDuration mean() const;
+
+  // Return an upper bound on the given percentile (expressed between 0 and 1)
+  // of the samples, i.e., the upper edge of the bucket it falls into, capped by
+  // the largest sample that was seen. Return zero if there are no samples.
+  TDuration percentile(double fraction) const;
+
+  const std::array<uint64_t, kNumBuckets>& buckets() const {
+    return buckets_;
+  }
+
+ private:
+  std::array<uint64_t, kNumBuckets> buckets_{};
+  uint64_t count_{0};
+  TDuration sum_{0};
+  TDuration max_{0};
+};
+
+} // namespace tensorpipe
@@ -10,34 +10,92 @@
 
 #include <sys/eventfd.h>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+
 #include <tensorpipe/common/system.h>
+#include <tensorpipe/common/trace.h>
+#include <tensorpipe/common/usdt.h>
 
 namespace tensorpipe {
 
-EpollLoop::EpollLoop(DeferredExecutor& deferredExecutor)
-    : deferredExecutor_(deferredExecutor) {
+EpollLoop::EpollLoop(
+    DeferredExecutor& deferredExecutor,
+    ThreadOptions threadOptions,
+    size_t capacity)
+    : deferredExecutor_(deferredExecutor),
+      threadOptions_(std::move(threadOptions)),
+      capacity_(capacity) {
+  init();
+
+  // Register the eventfd with epoll.
   {
-    auto rv = ::epoll_create(1);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;
+    auto rv = ::epoll_ctl(epollFd_.fd(), EPOLL_CTL_ADD, eventFd_.fd(), &ev);
     TP_THROW_SYSTEM_IF(rv == -1, errno);
-    epollFd_ = Fd(rv);
   }
+
+  // Start epoll(2) thread.
+  thread_ = std::thread(&EpollLoop::loop, this);
+}
+
+EpollLoop::EpollLoop(
+    BusyPollingLoop& busyPollingLoop,
+    ThreadOptions threadOptions,
+    size_t capacity)
+    : deferredExecutor_(busyPollingLoop),
+      busyPollingLoop_(&busyPollingLoop),
+      threadOptions_(std::move(threadOptions)),
+      capacity_(capacity),
+      epollEvents_(capacity) {
+  init();
   {
-    auto rv = ::eventfd(0, EFD_NONBLOCK);
+    auto rv = ::epoll_create(1);
     TP_THROW_SYSTEM_IF(rv == -1, errno);
-    eventFd_ = Fd(rv);
+    watcherFd_ = Fd(rv);
   }
 
-  // Register the eventfd with epoll.
+  // Register the eventfd and the main epoll fd with the watcher one. The latter
+  // is edge-triggered, as the busy-polling loop may take a while to handle the
+  // events and they shouldn't wake up the thread again until then.
   {
     struct epoll_event ev;
     ev.events = EPOLLIN;
     ev.data.u64 = 0;
-    auto rv = ::epoll_ctl(epollFd_.fd(), EPOLL_CTL_ADD, eventFd_.fd(), &ev);
+    auto rv = ::epoll_ctl(watcherFd_.fd(), EPOLL_CTL_ADD, eventFd_.fd(), &ev);
+    TP_THROW_SYSTEM_IF(rv == -1, errno);
+  }
+  {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = 1;
+    auto rv = ::epoll_ctl(watcherFd_.fd(), EPOLL_CTL_ADD, epollFd_.fd(), &ev);
     TP_THROW_SYSTEM_IF(rv == -1, errno);
   }
 
-  // Start epoll(2) thread.
-  thread_ = std::thread(&EpollLoop::loop, this);
+  // Don't wait for this, as the thread of a reactor that turned out not to be
+  // viable may never be started. Anything else deferred to it will come after.
+  busyPollingLoop_->deferToLoop(
+      [this]() { busyPollingLoop_->attachPoller(*this); });
+
+  thread_ = std::thread(&EpollLoop::watch, this);
+}
+
+void EpollLoop::init() {
+  TP_THROW_ASSERT_IF(capacity_ == 0) << "The epoll capacity must be positive";
+  {
+    auto rv = ::epoll_create(1);
+    TP_THROW_SYSTEM_IF(rv == -1, errno);
+    epollFd_ = Fd(rv);
+  }
+  {
+    auto rv = ::eventfd(0, EFD_NONBLOCK);
+    TP_THROW_SYSTEM_IF(rv == -1, errno);
+    eventFd_ = Fd(rv);
+  }
 }
 
 void EpollLoop::close() {
@@ -57,39 +115,60 @@ void EpollLoop::join() {
 EpollLoop::~EpollLoop() {
   join();
 
-  // Unregister the eventfd with epoll.
-  {
+  // Unregister the eventfd (and, in the integrated mode, the main epoll fd)
+  // with epoll.
+  if (busyPollingLoop_ != nullptr) {
+    auto rv =
+        ::epoll_ctl(watcherFd_.fd(), EPOLL_CTL_DEL, eventFd_.fd(), nullptr);
+    TP_THROW_SYSTEM_IF(rv == -1, errno);
+    rv = ::epoll_ctl(watcherFd_.fd(), EPOLL_CTL_DEL, epollFd_.fd(), nullptr);
+    TP_THROW_SYSTEM_IF(rv == -1, errno);
+  } else {
     auto rv = ::epoll_ctl(epollFd_.fd(), EPOLL_CTL_DEL, eventFd_.fd(), nullptr);
     TP_THROW_SYSTEM_IF(rv == -1, errno);
   }
 }
 
+uint64_t EpollLoop::makeRecord(int fd, uint32_t generation) {
+  return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+}
+
+void EpollLoop::retireHandler(HandlerSlot& slot) {
+  if (handlingEvents_) {
+    retiredHandlers_.push_back(std::move(slot.handler));
+  }
+  slot.handler.reset();
+}
+
 void EpollLoop::registerDescriptor(
     int fd,
     int events,
     std::shared_ptr<EventHandler> h) {
   TP_DCHECK(deferredExecutor_.inLoop());
+  TP_DCHECK_GE(fd, 0);
 
-  std::lock_guard<std::mutex> lock(handlersMutex_);
-
-  uint64_t record = nextRecord_++;
+  if (static_cast<size_t>(fd) >= handlerSlots_.size()) {
+    handlerSlots_.resize(fd + 1);
+  }
+  HandlerSlot& slot = handlerSlots_[fd];
+  if (++slot.generation == 0) {
+    ++slot.generation;
+  }
 
   struct epoll_event ev;
   ev.events = events;
-  ev.data.u64 = record;
+  ev.data.u64 = makeRecord(fd, slot.generation);
 
-  auto fdIter = fdToRecord_.find(fd);
-  if (fdIter == fdToRecord_.end()) {
-    fdToRecord_.emplace(fd, record);
-    recordToHandler_.emplace(record, h);
+  if (!slot.registered) {
+    slot.registered = true;
+    slot.handler = std::move(h);
+    ++numRegisteredHandlers_;
 
     auto rv = ::epoll_ctl(epollFd_.fd(), EPOLL_CTL_ADD, fd, &ev);
     TP_THROW_SYSTEM_IF(rv == -1, errno);
   } else {
-    uint64_t oldRecord = fdIter->second;
-    fdIter->second = record;
-    recordToHandler_.erase(oldRecord);
-    recordToHandler_.emplace(record, h);
+    retireHandler(slot);
+    slot.handler = std::move(h);
 
     auto rv = ::epoll_ctl(epollFd_.fd(), EPOLL_CTL_MOD, fd, &ev);
     TP_THROW_SYSTEM_IF(rv == -1, errno);
@@ -99,20 +178,19 @@ void EpollLoop::registerDescriptor(
 void EpollLoop::unregisterDescriptor(int fd) {
   TP_DCHECK(deferredExecutor_.inLoop());
 
-  std::lock_guard<std::mutex> lock(handlersMutex_);
-
-  auto fdIter = fdToRecord_.find(fd);
-  TP_DCHECK(fdIter != fdToRecord_.end());
-  uint64_t oldRecord = fdIter->second;
-  fdToRecord_.erase(fdIter);
-  recordToHandler_.erase(oldRecord);
+  TP_DCHECK(fd >= 0 && static_cast<size_t>(fd) < handlerSlots_.size());
+  HandlerSlot& slot = handlerSlots_[fd];
+  TP_DCHECK(slot.registered);
+  slot.registered = false;
+  retireHandler(slot);
+  const size_t numRegisteredHandlers = --numRegisteredHandlers_;
 
   auto rv = ::epoll_ctl(epollFd_.fd(), EPOLL_CTL_DEL, fd, nullptr);
   TP_THROW_SYSTEM_IF(rv == -1, errno);
 
   // Maybe we're done and the event loop is waiting for the last handlers to
   // be unregistered before terminating, so just in case we wake it up.
-  if (fdToRecord_.empty()) {
+  if (numRegisteredHandlers == 0) {
     wakeup();
   }
 }
@@ -122,20 +200,27 @@ void EpollLoop::wakeup() {
   eventFd_.writeOrThrow<uint64_t>(1);
 }
 
+void EpollLoop::enableStats() {
+  collectingStats_.store(true, std::memory_order_relaxed);
+}
+
+LoopStats EpollLoop::getStats() {
+  std::lock_guard<std::mutex> lock(statsMutex_);
+  return stats_;
+}
+
 bool EpollLoop::hasRegisteredHandlers() {
-  std::lock_guard<std::mutex> lock(handlersMutex_);
-  TP_DCHECK_EQ(fdToRecord_.size(), recordToHandler_.size());
-  return !fdToRecord_.empty();
+  return numRegisteredHandlers_.load() > 0;
 }
 
 void EpollLoop::loop() {
-  setThreadName("TP_IBV_loop");
+  setUpThread(threadOptions_, "TP_IBV_loop");
 
   // Stop when another thread has asked the loop the close and when all
   // handlers have been unregistered except for the wakeup eventfd one.
   while (!closed_ || hasRegisteredHandlers()) {
     // Use fixed epoll_event capacity for every call.
-    std::vector<struct epoll_event> epollEvents(kCapacity);
+    std::vector<struct epoll_event> epollEvents(capacity_);
 
     // Block waiting for something to happen...
     auto nfds =
@@ -162,36 +247,125 @@ void EpollLoop::loop() {
     // Resize based on actual number of events.
     epollEvents.resize(nfds);
 
+    recordEpollWait(nfds);
+
     // Defer handling to reactor and wait for it to process these events.
     deferredExecutor_.runInLoop(
-        [this, epollEvents{std::move(epollEvents)}]() mutable {
-          handleEpollEventsFromLoop(std::move(epollEvents));
+        [this, epollEvents{std::move(epollEvents)}]() {
+          handleEpollEventsFromLoop(epollEvents);
         });
   }
 }
 
+void EpollLoop::watch() {
+  setUpThread(threadOptions_, "TP_epoll_watch");
+
+  // Stop once the busy-polling loop stopped polling, which it does when this
+  // loop is closed and all handlers have been unregistered.
+  while (!detached_) {
+    std::array<struct epoll_event, 2> watcherEvents;
+    auto nfds = ::epoll_wait(
+        watcherFd_.fd(), watcherEvents.data(), watcherEvents.size(), -1);
+    if (nfds == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      TP_THROW_SYSTEM(errno);
+    }
+
+    // See loop() for why this is done before waking up the reactor.
+    {
+      uint64_t val;
+      auto rv = eventFd_.read(reinterpret_cast<void*>(&val), sizeof(val));
+      TP_DCHECK(
+          (rv == -1 && errno == EAGAIN) || (rv == sizeof(val) && val > 0));
+    }
+
+    busyPollingLoop_->notify();
+  }
+}
+
+bool EpollLoop::pollOnceFromLoop() {
+  TP_DCHECK(deferredExecutor_.inLoop());
+
+  if (closed_ && !hasRegisteredHandlers()) {
+    busyPollingLoop_->detachPoller();
+    detached_ = true;
+    wakeup();
+    return false;
+  }
+
+  epollEvents_.resize(capacity_);
+  auto nfds = ::epoll_wait(
+      epollFd_.fd(), epollEvents_.data(), epollEvents_.size(), /*timeout=*/0);
+  if (nfds == -1) {
+    if (errno == EINTR) {
+      return false;
+    }
+    TP_THROW_SYSTEM(errno);
+  }
+  if (nfds == 0) {
+    return false;
+  }
+  epollEvents_.resize(nfds);
+
+  recordEpollWait(nfds);
+
+  handleEpollEventsFromLoop(epollEvents_);
+  return true;
+}
+
+void EpollLoop::recordEpollWait(int nfds) {
+  if (collectingStats_.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    stats_.numEpollWaits++;
+    stats_.numEpollEvents += nfds;
+    stats_.maxEpollEventsPerWait =
+        std::max<uint64_t>(stats_.maxEpollEventsPerWait, nfds);
+  }
+}
+
 void EpollLoop::handleEpollEventsFromLoop(
-    std::vector<struct epoll_event> epollEvents) {
+    const std::vector<struct epoll_event>& epollEvents) {
   TP_DCHECK(deferredExecutor_.inLoop());
+  TP_TRACE_SCOPE("tp::EpollLoop::handleEvents");
+  TP_USDT(loop__epoll__events, epollEvents.size());
+
+  // The handlers that unregister themselves, or others, as they run are kept
+  // alive until the end of the batch rather than through a copy of their
+  // shared_ptr for each event.
+  handlingEvents_ = true;
 
   // Process events returned by epoll_wait(2).
   for (const auto& event : epollEvents) {
     const uint64_t record = event.data.u64;
-
-    // Make a copy so that if the handler unregisters itself as it runs it will
-    // still be kept alive by our copy of the shared_ptr.
-    std::shared_ptr<EventHandler> handler;
-    {
-      std::unique_lock<std::mutex> handlersLock(handlersMutex_);
-      const auto recordIter = recordToHandler_.find(record);
-      if (recordIter == recordToHandler_.end()) {
-        continue;
-      }
-      handler = recordIter->second;
+    const uint32_t fd = static_cast<uint32_t>(record);
+    const uint32_t generation = static_cast<uint32_t>(record >> 32);
+    if (static_cast<size_t>(fd) >= handlerSlots_.size()) {
+      continue;
     }
+    const HandlerSlot& slot = handlerSlots_[fd];
+    if (!slot.registered || slot.generation != generation) {
+      continue;
+    }
+    EventHandler* handler = slot.handler.get();
 
+    if (likely(!collectingStats_.load(std::memory_order_relaxed))) {
+      handler->handleEventsFromLoop(event.events);
+      continue;
+    }
+    const auto startTime = std::chrono::steady_clock::now();
     handler->handleEventsFromLoop(event.events);
+    const auto endTime = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    stats_.epollHandlerRunTime.add(endTime - startTime);
   }
+
+  handlingEvents_ = false;
+  // Their destructors may in turn unregister other handlers.
+  std::vector<std::shared_ptr<EventHandler>> retiredHandlers;
+  std::swap(retiredHandlers, retiredHandlers_);
+  retiredHandlers.clear();
 }
 
 std::string EpollLoop::formatEpollEvents(uint32_t events) {
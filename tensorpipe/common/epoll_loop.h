@@ -13,18 +13,23 @@
 #include <mutex>
 #include <string>
 #include <thread>
-#include <unordered_map>
 #include <vector>
 
 #include <sys/epoll.h>
 
+#include <tensorpipe/common/busy_polling_loop.h>
 #include <tensorpipe/common/deferred_executor.h>
 #include <tensorpipe/common/fd.h>
+#include <tensorpipe/common/loop_stats.h>
+#include <tensorpipe/common/thread_options.h>
 
 namespace tensorpipe {
 
-class EpollLoop final {
+class EpollLoop final : private BusyPollingLoop::Poller {
  public:
+  // How many events a single call to epoll_wait(2) returns at most.
+  static constexpr size_t kDefaultCapacity = 64;
+
   // Abstract base class called by the epoll(2) event loop.
   //
   // Dispatch to multiple types is needed because we must deal with a
@@ -37,26 +42,38 @@ class EpollLoop final {
     virtual void handleEventsFromLoop(int events) = 0;
   };
 
-  explicit EpollLoop(DeferredExecutor& deferredExecutor);
+  // The handlers are run by the given deferred executor, to which a thread of
+  // this loop hands over each batch of events (see below).
+  explicit EpollLoop(
+      DeferredExecutor& deferredExecutor,
+      ThreadOptions threadOptions = ThreadOptions(),
+      size_t capacity = kDefaultCapacity);
+
+  // The handlers are run by the given busy-polling loop, which also polls for
+  // the events itself, and the thread of this loop merely wakes it up when
+  // events come in while it's asleep. This saves the round trip between the
+  // two threads for each batch of events.
+  explicit EpollLoop(
+      BusyPollingLoop& busyPollingLoop,
+      ThreadOptions threadOptions = ThreadOptions(),
+      size_t capacity = kDefaultCapacity);
 
   // Register file descriptor with event loop.
   //
   // Trigger the handler if any of the epoll events in the `events`
-  // mask occurs. If an event is triggered, the loop first acquires a
-  // copy of the shared_ptr to the handler before calling into its
-  // handler function. This ensures that the handler is alive for the
-  // duration of this function.
+  // mask occurs. A handler that's unregistered (or replaced) while the
+  // loop is handling a batch of events is only released at the end of
+  // that batch. This ensures that the handler is alive for the duration
+  // of its handler function, even if it unregisters itself.
   //
   void registerDescriptor(int fd, int events, std::shared_ptr<EventHandler> h);
 
   // Unregister file descriptor from event loop.
   //
-  // This resets the shared_ptr to the event handler that was registered
-  // in `registerDescriptor`. Upon returning, the handler can no
-  // longer be called, even if there were pending events for the file
-  // descriptor. Only if the loop had acquired a shared_ptr to the
-  // handler prior to this function being called, can the handler
-  // function still be called.
+  // This drops the shared_ptr to the event handler that was registered
+  // in `registerDescriptor` (see above for when). Upon returning, the
+  // handler can no longer be called, even if there were pending events
+  // for the file descriptor.
   //
   void unregisterDescriptor(int fd);
 
@@ -65,22 +82,43 @@ class EpollLoop final {
   // Tell loop to terminate when no more handlers remain.
   void join();
 
+  // Start counting the calls to epoll_wait(2) and the events they return, and
+  // timing the handlers. There is no going back.
+  void enableStats();
+
+  // Return a snapshot of the statistics. Thread-safe.
+  LoopStats getStats();
+
   ~EpollLoop();
 
   static std::string formatEpollEvents(uint32_t events);
 
  private:
-  static constexpr auto kCapacity = 64;
-
   // The reactor is used to process events for this loop.
   DeferredExecutor& deferredExecutor_;
 
+  // Only set in the integrated mode, in which it's also the reactor.
+  BusyPollingLoop* const busyPollingLoop_{nullptr};
+
+  const ThreadOptions threadOptions_;
+  const size_t capacity_;
+
+  // Set up the epoll fd and the eventfd, shared by both constructors.
+  void init();
+
   // Wake up the event loop.
   void wakeup();
 
   // Main loop function.
   void loop();
 
+  // Main function of the thread in the integrated mode, which waits for the
+  // epoll fd to have events ready and wakes up the busy-polling loop.
+  void watch();
+
+  // Implement BusyPollingLoop::Poller, for the integrated mode.
+  bool pollOnceFromLoop() override;
+
   // Check whether some handlers are currently registered.
   bool hasRegisteredHandlers();
 
@@ -90,9 +128,22 @@ class EpollLoop final {
   std::atomic<bool> joined_{false};
   std::thread thread_;
 
+  // In the integrated mode, the thread waits on this epoll fd, which monitors
+  // the eventfd and, in edge-triggered mode, the main epoll fd, which becomes
+  // readable when some of its fds have events ready.
+  Fd watcherFd_;
+  // Set once the busy-polling loop is done polling, to stop the thread.
+  std::atomic<bool> detached_{false};
+  // Reused across the polls of the integrated mode, to avoid allocating.
+  std::vector<struct epoll_event> epollEvents_;
+
   // Interaction with epoll(7).
   //
-  // A dedicated thread runs epoll_wait(2) in a loop and, every time it returns,
+  // In the integrated mode the busy-polling loop, which is also the reactor,
+  // calls epoll_wait(2) without blocking each time it polls, and handles the
+  // events right away, hence everything already happens on the reactor thread.
+  // Otherwise, a dedicated thread runs epoll_wait(2) in a loop and, every time
+  // it returns,
   // it defers a function to the reactor which is responsible for processing the
   // epoll events and executing the handlers, and then notify the epoll thread
   // that it is done, for it to start another iteration. This back-and-forth
@@ -121,20 +172,46 @@ class EpollLoop final {
   // event, the piece of extra data that was provided by the *last* call on
   // epoll_ctl for that fd. This allows us to detect whether epoll_wait had
   // taken into account an update to the set of fds or not. We do so by giving
-  // each update a unique identifier, called "record". Each update to a fd will
-  // associate a new record to it. The handlers are associated to records (and
-  // not to fds), and for each fd we know which handler is the one currently
-  // installed. This way when processing an event we can detect whether the
-  // record for that event is still valid or whether it is stale, in which case
-  // we disregard the event, and wait for it to fire again at the next epoll
-  // iteration, with the up-to-date handler.
-  std::unordered_map<int, uint64_t> fdToRecord_;
-  std::unordered_map<uint64_t, std::shared_ptr<EventHandler>> recordToHandler_;
-  uint64_t nextRecord_{1}; // Reserve record 0 for the eventfd
-  std::mutex handlersMutex_;
+  // each update a unique identifier, called "record", made of the fd and of
+  // the number of updates that the fd has gone through. Each update to a fd
+  // will associate a new record to it. The handlers are stored in a flat array
+  // indexed by fd, together with the current record of their fd. This way when
+  // processing an event we can detect whether the record for that event is
+  // still valid or whether it is stale, in which case we disregard the event,
+  // and wait for it to fire again at the next epoll iteration, with the
+  // up-to-date handler. This array is only accessed from the reactor, hence
+  // finding the handlers of a batch of events takes neither locks nor atomic
+  // operations.
+  struct HandlerSlot {
+    // It's kept when the fd is unregistered, so that the events of the old
+    // registration are told apart from those of the next one, and it skips
+    // zero, which reserves record 0 for the eventfd.
+    uint32_t generation{0};
+    bool registered{false};
+    std::shared_ptr<EventHandler> handler;
+  };
+  std::vector<HandlerSlot> handlerSlots_;
+  // The handlers that were unregistered or replaced while handling a batch of
+  // events, which are released once it's over. Also reactor-only.
+  std::vector<std::shared_ptr<EventHandler>> retiredHandlers_;
+  bool handlingEvents_{false};
+  // Also read by the thread of the loop, to know when to stop.
+  std::atomic<size_t> numRegisteredHandlers_{0};
+
+  static uint64_t makeRecord(int fd, uint32_t generation);
+
+  // Drop the handler of the slot, or keep it until the end of the batch.
+  void retireHandler(HandlerSlot& slot);
+
+  std::atomic<bool> collectingStats_{false};
+  std::mutex statsMutex_;
+  LoopStats stats_;
+
+  void recordEpollWait(int nfds);
 
   // Deferred to the reactor to handle the events received by epoll_wait(2).
-  void handleEpollEventsFromLoop(std::vector<struct epoll_event> epollEvents);
+  void handleEpollEventsFromLoop(
+      const std::vector<struct epoll_event>& epollEvents);
 };
 
 } // namespace tensorpipe
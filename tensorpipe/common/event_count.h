@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+// A primitive that allows a consumer to block until a producer signals that
+// some new work is available, without losing wakeups that happen between the
+// moment the consumer last checked for work and the moment it goes to sleep.
+//
+// The consumer must first call prepareWait, then check (once more) whether any
+// work is available and, only if none is, call wait with the key it obtained.
+// It must then call finishWait in any case. Producers call notify after having
+// published their work, which is cheap when no consumer is waiting.
+//
+// This class only contains atomics and is based on futexes that are not marked
+// as process-private, hence it can be placed in shared memory and be used to
+// wake up a consumer located in another process.
+class EventCount {
+ public:
+  uint32_t prepareWait() {
+    numWaiters_.fetch_add(1, std::memory_order_seq_cst);
+    return epoch_.load(std::memory_order_seq_cst);
+  }
+
+  // Block until notify is called or the timeout expires, unless notify has
+  // already been called since the key was obtained.
+  void wait(uint32_t key, std::chrono::microseconds timeout) {
+    const auto seconds =
+        std::chrono::duration_cast<std::chrono::seconds>(timeout);
+    struct timespec ts;
+    ts.tv_sec = seconds.count();
+    ts.tv_nsec =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(timeout - seconds)
+            .count();
+    auto rv = ::syscall(
+        SYS_futex,
+        reinterpret_cast<uint32_t*>(&epoch_),
+        FUTEX_WAIT,
+        key,
+        &ts,
+        nullptr,
+        0);
+    TP_THROW_SYSTEM_IF(
+        rv < 0 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT,
+        errno);
+  }
+
+  void finishWait() {
+    numWaiters_.fetch_sub(1, std::memory_order_seq_cst);
+  }
+
+  void notify() {
+    epoch_.fetch_add(1, std::memory_order_seq_cst);
+    if (numWaiters_.load(std::memory_order_seq_cst) > 0) {
+      auto rv = ::syscall(
+          SYS_futex,
+          reinterpret_cast<uint32_t*>(&epoch_),
+          FUTEX_WAKE,
+          INT32_MAX,
+          nullptr,
+          nullptr,
+          0);
+      TP_THROW_SYSTEM_IF(rv < 0, errno);
+    }
+  }
+
+ private:
+  std::atomic<uint32_t> epoch_{0};
+  std::atomic<uint32_t> numWaiters_{0};
+
+  static_assert(
+      sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+      "Futexes require atomics to have the same layout as plain integers");
+};
+
+} // namespace tensorpipe
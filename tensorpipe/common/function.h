@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace tensorpipe {
+
+template <typename TSignature>
+class MoveOnlyFunction;
+
+// A type-erased callable, like std::function, except that it only needs the
+// callable it wraps to be movable and that it stores it inline, without any
+// allocation, if it's at most kInlineSize bytes (and can be moved without
+// throwing). This is what we use for callbacks and deferred tasks: being
+// move-only allows them to capture a Message (or another such callback) by
+// move, and the inline storage is large enough for a Message plus a pointer.
+template <typename R, typename... Args>
+class MoveOnlyFunction<R(Args...)> {
+ public:
+  static constexpr size_t kInlineSize = 96;
+
+  MoveOnlyFunction() = default;
+
+  /* implicit */ MoveOnlyFunction(std::nullptr_t) {}
+
+  template <
+      typename F,
+      typename = std::enable_if_t<
+          !std::is_same<std::decay_t<F>, MoveOnlyFunction>::value &&
+          !std::is_same<std::decay_t<F>, std::nullptr_t>::value>>
+  /* implicit */ MoveOnlyFunction(F&& fn) {
+    using TFn = std::decay_t<F>;
+    init<TFn>(
+        std::forward<F>(fn),
+        std::integral_constant<bool, fitsInline<TFn>()>());
+  }
+
+  MoveOnlyFunction(const MoveOnlyFunction&) = delete;
+  MoveOnlyFunction& operator=(const MoveOnlyFunction&) = delete;
+
+  MoveOnlyFunction(MoveOnlyFunction&& other) noexcept {
+    moveFrom(other);
+  }
+
+  MoveOnlyFunction& operator=(MoveOnlyFunction&& other) noexcept {
+    if (this != &other) {
+      reset();
+      moveFrom(other);
+    }
+    return *this;
+  }
+
+  MoveOnlyFunction& operator=(std::nullptr_t) noexcept {
+    reset();
+    return *this;
+  }
+
+  ~MoveOnlyFunction() {
+    reset();
+  }
+
+  explicit operator bool() const {
+    return ops_ != nullptr;
+  }
+
+  // Like std::function, this is const but invokes the callable as non-const.
+  // Unlike it, calling an empty object is undefined behavior.
+  R operator()(Args... args) const {
+    return ops_->invoke(&storage_, std::forward<Args>(args)...);
+  }
+
+ private:
+  struct Ops {
+    R (*invoke)(void* storage, Args&&... args);
+    // Move-construct the callable into the destination and destroy the source.
+    void (*relocate)(void* dst, void* src);
+    void (*destroy)(void* storage);
+  };
+
+  template <typename F>
+  static constexpr bool fitsInline() {
+    return sizeof(F) <= kInlineSize &&
+        alignof(F) <= alignof(std::max_align_t) &&
+        std::is_nothrow_move_constructible<F>::value;
+  }
+
+  template <typename F>
+  struct InlineOps {
+    static R invoke(void* storage, Args&&... args) {
+      return (*static_cast<F*>(storage))(std::forward<Args>(args)...);
+    }
+
+    static void relocate(void* dst, void* src) {
+      new (dst) F(std::move(*static_cast<F*>(src)));
+      static_cast<F*>(src)->~F();
+    }
+
+    static void destroy(void* storage) {
+      static_cast<F*>(storage)->~F();
+    }
+
+    static constexpr Ops kOps{&invoke, &relocate, &destroy};
+  };
+
+  template <typename F>
+  struct HeapOps {
+    static R invoke(void* storage, Args&&... args) {
+      return (**static_cast<F**>(storage))(std::forward<Args>(args)...);
+    }
+
+    static void relocate(void* dst, void* src) {
+      *static_cast<F**>(dst) = *static_cast<F**>(src);
+    }
+
+    static void destroy(void* storage) {
+      delete *static_cast<F**>(storage);
+    }
+
+    static constexpr Ops kOps{&invoke, &relocate, &destroy};
+  };
+
+  template <typename F, typename G>
+  void init(G&& fn, std::true_type /* fitsInline */) {
+    new (&storage_) F(std::forward<G>(fn));
+    ops_ = &InlineOps<F>::kOps;
+  }
+
+  template <typename F, typename G>
+  void init(G&& fn, std::false_type /* fitsInline */) {
+    *reinterpret_cast<F**>(&storage_) = new F(std::forward<G>(fn));
+    ops_ = &HeapOps<F>::kOps;
+  }
+
+  void moveFrom(MoveOnlyFunction& other) {
+    if (other.ops_ != nullptr) {
+      other.ops_->relocate(&storage_, &other.storage_);
+      ops_ = other.ops_;
+      other.ops_ = nullptr;
+    }
+  }
+
+  void reset() {
+    if (ops_ != nullptr) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  mutable std::aligned_storage_t<kInlineSize, alignof(std::max_align_t)>
+      storage_;
+  const Ops* ops_{nullptr};
+};
+
+template <typename R, typename... Args>
+template <typename F>
+constexpr typename MoveOnlyFunction<R(Args...)>::Ops
+    MoveOnlyFunction<R(Args...)>::InlineOps<F>::kOps;
+
+template <typename R, typename... Args>
+template <typename F>
+constexpr typename MoveOnlyFunction<R(Args...)>::Ops
+    MoveOnlyFunction<R(Args...)>::HeapOps<F>::kOps;
+
+template <typename R, typename... Args>
+bool operator==(const MoveOnlyFunction<R(Args...)>& fn, std::nullptr_t) {
+  return !fn;
+}
+
+template <typename R, typename... Args>
+bool operator!=(const MoveOnlyFunction<R(Args...)>& fn, std::nullptr_t) {
+  return static_cast<bool>(fn);
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/dl.h>
+
+namespace tensorpipe {
+
+// Replicate the types of gdrapi.h, so that we don't need it to build.
+
+struct GdrcopyTypes {
+  using gdr_t = struct gdr*;
+  struct mh_t {
+    unsigned long h;
+  };
+
+  // The granularity of the mappings, i.e., the size of GPU pages.
+  static constexpr size_t kGpuPageSize = 64 * 1024;
+};
+
+// Master list of all symbols we care about from libgdrapi.
+
+#define TP_FORALL_GDRCOPY_SYMBOLS(_)                                         \
+  _(open, GdrcopyTypes::gdr_t, ())                                           \
+  _(close, int, (GdrcopyTypes::gdr_t))                                       \
+  _(pin_buffer,                                                              \
+    int,                                                                     \
+    (GdrcopyTypes::gdr_t,                                                    \
+     unsigned long,                                                          \
+     size_t,                                                                 \
+     uint64_t,                                                               \
+     uint32_t,                                                               \
+     GdrcopyTypes::mh_t*))                                                   \
+  _(unpin_buffer, int, (GdrcopyTypes::gdr_t, GdrcopyTypes::mh_t))            \
+  _(map, int, (GdrcopyTypes::gdr_t, GdrcopyTypes::mh_t, void**, size_t))     \
+  _(unmap, int, (GdrcopyTypes::gdr_t, GdrcopyTypes::mh_t, void*, size_t))    \
+  _(copy_to_mapping, int, (GdrcopyTypes::mh_t, void*, const void*, size_t))  \
+  _(copy_from_mapping, int, (GdrcopyTypes::mh_t, void*, const void*, size_t))
+
+// Wrapper for libgdrapi, the user-space library of GDRCopy, which maps device
+// memory into the address space of the process (through the BAR1 aperture of
+// the GPU) so that the CPU can read and write it directly. It is loaded at
+// runtime rather than linked, as it's only available on some machines (and it
+// also needs the gdrdrv kernel module, which open reports as missing).
+
+class GdrcopyLib : public GdrcopyTypes {
+ private:
+  explicit GdrcopyLib(DynamicLibraryHandle dlhandle)
+      : dlhandle_(std::move(dlhandle)) {}
+
+  DynamicLibraryHandle dlhandle_;
+
+#define TP_DECLARE_FIELD(function_name, return_type, args_types) \
+  return_type(*function_name##_ptr_) args_types = nullptr;
+  TP_FORALL_GDRCOPY_SYMBOLS(TP_DECLARE_FIELD)
+#undef TP_DECLARE_FIELD
+
+ public:
+  GdrcopyLib() = default;
+
+  static std::tuple<Error, GdrcopyLib> create() {
+    Error error;
+    DynamicLibraryHandle dlhandle;
+    // To keep things "neat" and contained, we open in "local" mode (as opposed
+    // to global) so that the gdrapi symbols can only be resolved through this
+    // handle and are not exposed (a.k.a., "leaked") to other shared objects.
+    std::tie(error, dlhandle) =
+        createDynamicLibraryHandle("libgdrapi.so.2", RTLD_LOCAL | RTLD_LAZY);
+    if (error) {
+      return std::make_tuple(std::move(error), GdrcopyLib());
+    }
+    GdrcopyLib lib(std::move(dlhandle));
+#define TP_LOAD_SYMBOL(function_name, return_type, args_types)               \
+  {                                                                          \
+    void* ptr;                                                               \
+    std::tie(error, ptr) = loadSymbol(lib.dlhandle_, "gdr_" #function_name); \
+    if (error) {                                                             \
+      return std::make_tuple(std::move(error), GdrcopyLib());                \
+    }                                                                        \
+    TP_THROW_ASSERT_IF(ptr == nullptr);                                      \
+    lib.function_name##_ptr_ =                                               \
+        reinterpret_cast<decltype(function_name##_ptr_)>(ptr);               \
+  }
+    TP_FORALL_GDRCOPY_SYMBOLS(TP_LOAD_SYMBOL)
+#undef TP_LOAD_SYMBOL
+    return std::make_tuple(Error::kSuccess, std::move(lib));
+  }
+
+#define TP_FORWARD_CALL(function_name, return_type, args_types)  \
+  template <typename... Args>                                    \
+  auto function_name(Args&&... args) const {                     \
+    return (*function_name##_ptr_)(std::forward<Args>(args)...); \
+  }
+  TP_FORALL_GDRCOPY_SYMBOLS(TP_FORWARD_CALL)
+#undef TP_FORWARD_CALL
+};
+
+#undef TP_FORALL_GDRCOPY_SYMBOLS
+
+} // namespace tensorpipe
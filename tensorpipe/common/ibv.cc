@@ -8,6 +8,7 @@
 
 #include <tensorpipe/common/ibv.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 
@@ -36,6 +37,39 @@ std::string ibvWorkCompletionOpcodeToStr(IbvLib::wc_opcode opcode) {
   }
 }
 
+struct IbvQueueCapacities fitIbvQueueCapacities(
+    IbvLib& ibvLib,
+    const IbvContext& context,
+    uint32_t numRecvs,
+    uint32_t numSends,
+    bool useSharedReceiveQueue) {
+  IbvLib::device_attr deviceAttr;
+  std::memset(&deviceAttr, 0, sizeof(deviceAttr));
+  TP_CHECK_IBV_INT(ibvLib.query_device(context.get(), &deviceAttr));
+
+  const uint32_t maxRecvs = useSharedReceiveQueue ? deviceAttr.max_srq_wr
+                                                  : deviceAttr.max_qp_wr;
+  const uint32_t maxSends = deviceAttr.max_qp_wr;
+  const uint64_t maxCompletions = deviceAttr.max_cqe;
+  TP_THROW_ASSERT_IF(maxRecvs < 1 || maxSends < 1 || maxCompletions < 2)
+      << "The InfiniBand device reports queues that can't hold any request";
+
+  numRecvs = std::max<uint32_t>(std::min(numRecvs, maxRecvs), 1);
+  numSends = std::max<uint32_t>(std::min(numSends, maxSends), 1);
+  const uint64_t numCompletions = static_cast<uint64_t>(numRecvs) + numSends;
+  if (numCompletions > maxCompletions) {
+    numRecvs =
+        std::max<uint64_t>(numRecvs * maxCompletions / numCompletions, 1);
+    numSends = std::min<uint64_t>(numSends, maxCompletions - numRecvs);
+  }
+
+  struct IbvQueueCapacities capacities;
+  capacities.numRecvs = numRecvs;
+  capacities.numSends = numSends;
+  capacities.completionQueueSize = numRecvs + numSends;
+  return capacities;
+}
+
 struct IbvAddress makeIbvAddress(
     IbvLib& ibvLib,
     const IbvContext& context,
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 
 #include <tensorpipe/common/defs.h>
@@ -120,6 +121,25 @@ inline IbvProtectionDomain createIbvProtectionDomain(
       IbvProtectionDomainDeleter{&ibvLib});
 }
 
+struct IbvCompletionChannelDeleter {
+  void operator()(IbvLib::comp_channel* ptr) {
+    TP_CHECK_IBV_INT(ibvLib->destroy_comp_channel(ptr));
+  }
+
+  IbvLib* ibvLib;
+};
+
+using IbvCompletionChannel =
+    std::unique_ptr<IbvLib::comp_channel, IbvCompletionChannelDeleter>;
+
+inline IbvCompletionChannel createIbvCompletionChannel(
+    IbvLib& ibvLib,
+    IbvContext& context) {
+  return IbvCompletionChannel(
+      TP_CHECK_IBV_PTR(ibvLib.create_comp_channel(context.get())),
+      IbvCompletionChannelDeleter{&ibvLib});
+}
+
 struct IbvCompletionQueueDeleter {
   void operator()(IbvLib::cq* ptr) {
     TP_CHECK_IBV_INT(ibvLib->destroy_cq(ptr));
@@ -185,6 +205,25 @@ inline IbvMemoryRegion createIbvMemoryRegion(
       IbvMemoryRegionDeleter{&ibvLib});
 }
 
+// Register the whole address space of the process with on-demand paging (an
+// "implicit" ODP registration): the device resolves the pages as it accesses
+// them, faulting them in if need be, hence any memory can be used with this
+// region without being registered, or pinned, beforehand. Return a null region
+// if the device or the kernel doesn't support it, which registering is the only
+// way to find out without the extended (inline-only) query_device_ex verb.
+inline IbvMemoryRegion createIbvImplicitOnDemandMemoryRegion(
+    IbvLib& ibvLib,
+    IbvProtectionDomain& pd,
+    int accessFlags) {
+  return IbvMemoryRegion(
+      ibvLib.reg_mr(
+          pd.get(),
+          /*addr=*/nullptr,
+          SIZE_MAX,
+          accessFlags | IbvLib::ACCESS_ON_DEMAND),
+      IbvMemoryRegionDeleter{&ibvLib});
+}
+
 struct IbvQueuePairDeleter {
   void operator()(IbvLib::qp* ptr) {
     TP_CHECK_IBV_INT(ibvLib->destroy_qp(ptr));
@@ -223,6 +262,24 @@ struct IbvSetupInformation {
   IbvLib::mtu maximumTransmissionUnit;
 };
 
+// How many work requests can be outstanding at once: the receive ones, held by
+// each queue pair or by the shared receive queue, and the send ones, held by
+// each queue pair. The completion queue must be able to hold all of them.
+struct IbvQueueCapacities {
+  uint32_t numRecvs;
+  uint32_t numSends;
+  int completionQueueSize;
+};
+
+// Lower the given capacities to the limits of the device, if they exceed them,
+// scaling both down in proportion if the completion queue is the bottleneck.
+struct IbvQueueCapacities fitIbvQueueCapacities(
+    IbvLib& ibvLib,
+    const IbvContext& context,
+    uint32_t numRecvs,
+    uint32_t numSends,
+    bool useSharedReceiveQueue);
+
 struct IbvAddress makeIbvAddress(
     IbvLib& ibvLib,
     const IbvContext& context,
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+// A one-shot rendezvous between a thread that waits for something to be done
+// and the one that does it, which, unlike a std::promise and its future, needs
+// no allocation and can thus live on the stack of the waiting thread. The one
+// that does it only makes a syscall if the other one is actually asleep.
+//
+// The waiting thread may return, and destroy the latch, as soon as it sees it
+// open, possibly before the other thread is done waking it up. That's fine, as
+// waking up a futex doesn't touch its memory, only its address.
+class Latch {
+ public:
+  Latch() = default;
+
+  Latch(const Latch&) = delete;
+  Latch(Latch&&) = delete;
+  Latch& operator=(const Latch&) = delete;
+  Latch& operator=(Latch&&) = delete;
+
+  void open() {
+    const uint32_t state = state_.exchange(kOpen, std::memory_order_acq_rel);
+    if (state == kClosedWithWaiter) {
+      auto rv = ::syscall(
+          SYS_futex,
+          reinterpret_cast<uint32_t*>(&state_),
+          FUTEX_WAKE_PRIVATE,
+          1,
+          nullptr,
+          nullptr,
+          0);
+      TP_THROW_SYSTEM_IF(rv < 0, errno);
+    }
+  }
+
+  // Block until open is called, unless it already has been. Only one thread
+  // may wait.
+  void wait() {
+    uint32_t state = kClosed;
+    if (state_.compare_exchange_strong(
+            state, kClosedWithWaiter, std::memory_order_acquire)) {
+      state = kClosedWithWaiter;
+    }
+    while (state != kOpen) {
+      auto rv = ::syscall(
+          SYS_futex,
+          reinterpret_cast<uint32_t*>(&state_),
+          FUTEX_WAIT_PRIVATE,
+          kClosedWithWaiter,
+          nullptr,
+          nullptr,
+          0);
+      TP_THROW_SYSTEM_IF(rv < 0 && errno != EAGAIN && errno != EINTR, errno);
+      state = state_.load(std::memory_order_acquire);
+    }
+  }
+
+ private:
+  static constexpr uint32_t kClosed = 0;
+  static constexpr uint32_t kClosedWithWaiter = 1;
+  static constexpr uint32_t kOpen = 2;
+
+  std::atomic<uint32_t> state_{kClosed};
+
+  static_assert(
+      sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+      "Futexes require atomics to have the same layout as plain integers");
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/lock_stats.h>
+
+#include <algorithm>
+#include <memory>
+
+namespace tensorpipe {
+
+namespace {
+
+// The counters are never freed, so that the mutexes can refer to them for as
+// long as they live, including those of static objects.
+class LockRegistry {
+ public:
+  static LockRegistry& instance() {
+    static LockRegistry* registry = new LockRegistry();
+    return *registry;
+  }
+
+  ProfiledMutex::Counters& get(const std::string& name) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::unique_ptr<ProfiledMutex::Counters>& counters = counters_[name];
+    if (counters == nullptr) {
+      counters = std::make_unique<ProfiledMutex::Counters>();
+    }
+    return *counters;
+  }
+
+  std::map<std::string, LockStats> snapshot() {
+    std::map<std::string, LockStats> stats;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (const auto& iter : counters_) {
+      const ProfiledMutex::Counters& counters = *iter.second;
+      LockStats& lockStats = stats[iter.first];
+      lockStats.numAcquisitions = counters.numAcquisitions.load();
+      lockStats.numContendedAcquisitions =
+          counters.numContendedAcquisitions.load();
+      lockStats.totalWaitTime =
+          std::chrono::nanoseconds(counters.totalWaitNanos.load());
+      lockStats.maxWaitTime =
+          std::chrono::nanoseconds(counters.maxWaitNanos.load());
+    }
+    return stats;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::map<std::string, std::unique_ptr<ProfiledMutex::Counters>> counters_;
+};
+
+} // namespace
+
+void LockStats::merge(const LockStats& other) {
+  numAcquisitions += other.numAcquisitions;
+  numContendedAcquisitions += other.numContendedAcquisitions;
+  totalWaitTime += other.totalWaitTime;
+  maxWaitTime = std::max(maxWaitTime, other.maxWaitTime);
+}
+
+std::atomic<bool> ProfiledMutex::collectingStats_{false};
+
+void enableLockStats() {
+  ProfiledMutex::collectingStats_.store(true, std::memory_order_relaxed);
+}
+
+std::map<std::string, LockStats> getLockStats() {
+  return LockRegistry::instance().snapshot();
+}
+
+ProfiledMutex::ProfiledMutex(const std::string& name)
+    : counters_(LockRegistry::instance().get(name)) {}
+
+std::unique_lock<std::mutex> ProfiledMutex::acquireAndCount() {
+  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+  counters_.numAcquisitions.fetch_add(1, std::memory_order_relaxed);
+  if (lock.owns_lock()) {
+    return lock;
+  }
+  const auto startTime = std::chrono::steady_clock::now();
+  lock.lock();
+  const uint64_t waitNanos =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - startTime)
+          .count();
+  counters_.numContendedAcquisitions.fetch_add(1, std::memory_order_relaxed);
+  counters_.totalWaitNanos.fetch_add(waitNanos, std::memory_order_relaxed);
+  uint64_t maxWaitNanos =
+      counters_.maxWaitNanos.load(std::memory_order_relaxed);
+  while (waitNanos > maxWaitNanos &&
+         !counters_.maxWaitNanos.compare_exchange_weak(
+             maxWaitNanos, waitNanos, std::memory_order_relaxed)) {
+  }
+  return lock;
+}
+
+} // namespace tensorpipe
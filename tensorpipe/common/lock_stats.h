@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+// How much the internal mutexes of a same name were fought over, summed over
+// all the instances of that name in the process (e.g., the queues of all the
+// on-demand loops of the pipes). They're only gathered once enabled, as a
+// Context does when it collects statistics, and then they tell which of the
+// mutexes serializes the threads under load.
+struct LockStats {
+  uint64_t numAcquisitions{0};
+  // Those that found the mutex held by another thread, and had to wait.
+  uint64_t numContendedAcquisitions{0};
+  std::chrono::nanoseconds totalWaitTime{0};
+  std::chrono::nanoseconds maxWaitTime{0};
+
+  // Add all the statistics of the other object to this one.
+  void merge(const LockStats& other);
+};
+
+// Start gathering the statistics of all the profiled mutexes of the process,
+// which costs a try-lock and, when it fails, two timestamps for each of their
+// acquisitions. There is no going back.
+void enableLockStats();
+
+// Return a snapshot of the statistics of the profiled mutexes of the process,
+// by name. Thread-safe.
+std::map<std::string, LockStats> getLockStats();
+
+// A mutex whose acquisitions are counted, under its name, once the lock stats
+// are enabled. It's acquired through a std::unique_lock on the underlying
+// mutex, which can thus be waited on with a std::condition_variable, although
+// the reacquisitions that follow the waits aren't counted.
+class ProfiledMutex {
+ public:
+  struct Counters {
+    std::atomic<uint64_t> numAcquisitions{0};
+    std::atomic<uint64_t> numContendedAcquisitions{0};
+    std::atomic<uint64_t> totalWaitNanos{0};
+    std::atomic<uint64_t> maxWaitNanos{0};
+  };
+
+  // The instances of a same name share their counters.
+  explicit ProfiledMutex(const std::string& name);
+
+  ProfiledMutex(const ProfiledMutex&) = delete;
+  ProfiledMutex& operator=(const ProfiledMutex&) = delete;
+
+  std::unique_lock<std::mutex> acquire() {
+    if (likely(!collectingStats_.load(std::memory_order_relaxed))) {
+      return std::unique_lock<std::mutex>(mutex_);
+    }
+    return acquireAndCount();
+  }
+
+ private:
+  std::mutex mutex_;
+  Counters& counters_;
+
+  std::unique_lock<std::mutex> acquireAndCount();
+
+  static std::atomic<bool> collectingStats_;
+
+  friend void enableLockStats();
+};
+
+} // namespace tensorpipe
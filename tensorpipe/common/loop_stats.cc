@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/loop_stats.h>
+
+#include <algorithm>
+
+namespace tensorpipe {
+
+void LoopStats::merge(const LoopStats& other) {
+  numPendingTasks += other.numPendingTasks;
+  maxPendingTasks = std::max(maxPendingTasks, other.maxPendingTasks);
+  taskQueueLatency.merge(other.taskQueueLatency);
+  taskRunTime.merge(other.taskRunTime);
+  pollRunTime.merge(other.pollRunTime);
+  numEpollWaits += other.numEpollWaits;
+  numEpollEvents += other.numEpollEvents;
+  maxEpollEventsPerWait =
+      std::max(maxEpollEventsPerWait, other.maxEpollEventsPerWait);
+  epollHandlerRunTime.merge(other.epollHandlerRunTime);
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include <tensorpipe/common/duration_histogram.h>
+
+namespace tensorpipe {
+
+// The statistics of one of the event loops of a transport or channel context,
+// gathered only once enabled on it (as a Context does, for those registered
+// with it, when it collects statistics). A loop runs on a single thread, hence
+// a queue of deferred functions that keeps growing, or functions that wait long
+// before running, mean that it's saturated and that its work should be spread
+// over more loops. Each loop fills in the fields that apply to it.
+struct LoopStats {
+  // The deferred functions that were waiting to run when the snapshot was
+  // taken, and the most that were ever waiting at once.
+  uint64_t numPendingTasks{0};
+  uint64_t maxPendingTasks{0};
+
+  // For deferred functions, from their deferral to the moment they started to
+  // run, and from then to the moment they returned.
+  DurationHistogram taskQueueLatency;
+  DurationHistogram taskRunTime;
+
+  // The time spent in the iterations of busy-polling loops that found work
+  // (those that didn't are too many and too short to be worth timing).
+  DurationHistogram pollRunTime;
+
+  // For loops built on epoll: the number of calls to epoll_wait, of events they
+  // returned, and the most that one of them returned, followed by the time the
+  // handlers spent on each event. When a busy-polling loop polls epoll itself,
+  // only the calls that returned some events are counted.
+  uint64_t numEpollWaits{0};
+  uint64_t numEpollEvents{0};
+  uint64_t maxEpollEventsPerWait{0};
+  DurationHistogram epollHandlerRunTime;
+
+  // Add all the statistics of the other object to this one.
+  void merge(const LoopStats& other);
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+// A map with a bounded number of entries which, when full, makes room for new
+// entries by evicting the least recently used one. Values are destroyed upon
+// eviction, hence RAII types can be used to release any associated resource.
+// This class isn't thread-safe.
+template <typename TKey, typename TValue>
+class LruCache {
+ public:
+  explicit LruCache(size_t capacity) : capacity_(capacity) {
+    TP_DCHECK_GT(capacity_, 0);
+  }
+
+  // Return a pointer to the value stored for the key, or null if there is none.
+  // The entry is marked as the most recently used one. The pointer remains
+  // valid until the entry is evicted.
+  TValue* find(const TKey& key) {
+    auto iter = index_.find(key);
+    if (iter == index_.end()) {
+      return nullptr;
+    }
+    entries_.splice(entries_.begin(), entries_, iter->second);
+    return &iter->second->second;
+  }
+
+  // Store a value for a key that must not be present yet, evicting the least
+  // recently used entry if the cache is full.
+  TValue& insert(TKey key, TValue value) {
+    TP_DCHECK(index_.find(key) == index_.end());
+    if (entries_.size() >= capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+    entries_.emplace_front(std::move(key), std::move(value));
+    index_.emplace(entries_.front().first, entries_.begin());
+    return entries_.front().second;
+  }
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+  void clear() {
+    index_.clear();
+    entries_.clear();
+  }
+
+ private:
+  using TEntries = std::list<std::pair<TKey, TValue>>;
+
+  const size_t capacity_;
+  // Ordered from the most to the least recently used.
+  TEntries entries_;
+  std::map<TKey, typename TEntries::iterator> index_;
+};
+
+} // namespace tensorpipe
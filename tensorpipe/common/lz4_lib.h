@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <tuple>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/dl.h>
+
+namespace tensorpipe {
+
+// Master list of all symbols we care about from liblz4.
+
+#define TP_FORALL_LZ4_SYMBOLS(_)                           \
+  _(compress_default, int, (const char*, char*, int, int)) \
+  _(decompress_safe, int, (const char*, char*, int, int))
+
+// Wrapper for liblz4, which is loaded at runtime rather than linked, so that
+// it's only needed by the users that enable lz4 compression.
+
+class Lz4Lib {
+ private:
+  explicit Lz4Lib(DynamicLibraryHandle dlhandle)
+      : dlhandle_(std::move(dlhandle)) {}
+
+  DynamicLibraryHandle dlhandle_;
+
+#define TP_DECLARE_FIELD(function_name, return_type, args_types) \
+  return_type(*function_name##_ptr_) args_types = nullptr;
+  TP_FORALL_LZ4_SYMBOLS(TP_DECLARE_FIELD)
+#undef TP_DECLARE_FIELD
+
+ public:
+  Lz4Lib() = default;
+
+  static std::tuple<Error, Lz4Lib> create() {
+    Error error;
+    DynamicLibraryHandle dlhandle;
+    // To keep things "neat" and contained, we open in "local" mode (as opposed
+    // to global) so that the lz4 symbols can only be resolved through this
+    // handle and are not exposed (a.k.a., "leaked") to other shared objects.
+    std::tie(error, dlhandle) =
+        createDynamicLibraryHandle("liblz4.so.1", RTLD_LOCAL | RTLD_LAZY);
+    if (error) {
+      return std::make_tuple(std::move(error), Lz4Lib());
+    }
+    Lz4Lib lib(std::move(dlhandle));
+#define TP_LOAD_SYMBOL(function_name, return_type, args_types)               \
+  {                                                                          \
+    void* ptr;                                                               \
+    std::tie(error, ptr) = loadSymbol(lib.dlhandle_, "LZ4_" #function_name); \
+    if (error) {                                                             \
+      return std::make_tuple(std::move(error), Lz4Lib());                    \
+    }                                                                        \
+    TP_THROW_ASSERT_IF(ptr == nullptr);                                      \
+    lib.function_name##_ptr_ =                                               \
+        reinterpret_cast<decltype(function_name##_ptr_)>(ptr);               \
+  }
+    TP_FORALL_LZ4_SYMBOLS(TP_LOAD_SYMBOL)
+#undef TP_LOAD_SYMBOL
+    return std::make_tuple(Error::kSuccess, std::move(lib));
+  }
+
+#define TP_FORWARD_CALL(function_name, return_type, args_types)  \
+  template <typename... Args>                                    \
+  auto function_name(Args&&... args) const {                     \
+    return (*function_name##_ptr_)(std::forward<Args>(args)...); \
+  }
+  TP_FORALL_LZ4_SYMBOLS(TP_FORWARD_CALL)
+#undef TP_FORWARD_CALL
+};
+
+#undef TP_FORALL_LZ4_SYMBOLS
+
+} // namespace tensorpipe
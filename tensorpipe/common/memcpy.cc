@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/memcpy.h>
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define TP_HAS_X86_NON_TEMPORAL_COPY 1
+#else
+#define TP_HAS_X86_NON_TEMPORAL_COPY 0
+#endif
+
+namespace tensorpipe {
+
+namespace {
+
+using TCopyFn = void (*)(void*, const void*, size_t);
+
+struct Implementation {
+  TCopyFn fn;
+  const char* name;
+};
+
+void copyWithMemcpy(void* dst, const void* src, size_t length) {
+  std::memcpy(dst, src, length);
+}
+
+#if TP_HAS_X86_NON_TEMPORAL_COPY
+
+// How many bytes ahead of the loads to prefetch the source. This must cover the
+// latency of a load from memory, at the speed at which the loop consumes data.
+constexpr size_t kPrefetchDistance = 1024;
+
+constexpr size_t kCacheLineSize = 64;
+
+// Copy the unaligned head of the destination with memcpy, so that the streaming
+// stores that follow are aligned, and return how many bytes were copied.
+size_t copyUntilAligned(
+    uint8_t* dst,
+    const uint8_t* src,
+    size_t length,
+    size_t alignment) {
+  size_t headLength = -reinterpret_cast<uintptr_t>(dst) & (alignment - 1);
+  if (headLength > length) {
+    headLength = length;
+  }
+  std::memcpy(dst, src, headLength);
+  return headLength;
+}
+
+__attribute__((target("avx2"))) void copyWithAvx2(
+    void* dst,
+    const void* src,
+    size_t length) {
+  uint8_t* dstPtr = reinterpret_cast<uint8_t*>(dst);
+  const uint8_t* srcPtr = reinterpret_cast<const uint8_t*>(src);
+
+  size_t headLength = copyUntilAligned(dstPtr, srcPtr, length, 32);
+  dstPtr += headLength;
+  srcPtr += headLength;
+  length -= headLength;
+
+  // Two cache lines per iteration. Prefetching beyond the end of the source is
+  // harmless, as prefetches never fault.
+  while (length >= 2 * kCacheLineSize) {
+    _mm_prefetch(
+        reinterpret_cast<const char*>(srcPtr + kPrefetchDistance),
+        _MM_HINT_NTA);
+    _mm_prefetch(
+        reinterpret_cast<const char*>(
+            srcPtr + kPrefetchDistance + kCacheLineSize),
+        _MM_HINT_NTA);
+    const __m256i* srcVec = reinterpret_cast<const __m256i*>(srcPtr);
+    __m256i* dstVec = reinterpret_cast<__m256i*>(dstPtr);
+    __m256i v0 = _mm256_loadu_si256(srcVec + 0);
+    __m256i v1 = _mm256_loadu_si256(srcVec + 1);
+    __m256i v2 = _mm256_loadu_si256(srcVec + 2);
+    __m256i v3 = _mm256_loadu_si256(srcVec + 3);
+    _mm256_stream_si256(dstVec + 0, v0);
+    _mm256_stream_si256(dstVec + 1, v1);
+    _mm256_stream_si256(dstVec + 2, v2);
+    _mm256_stream_si256(dstVec + 3, v3);
+    dstPtr += 2 * kCacheLineSize;
+    srcPtr += 2 * kCacheLineSize;
+    length -= 2 * kCacheLineSize;
+  }
+
+  // Streaming stores are weakly ordered: make them visible before any later
+  // store (e.g., to the head of a ringbuffer, or to a flag of another thread).
+  _mm_sfence();
+  std::memcpy(dstPtr, srcPtr, length);
+}
+
+__attribute__((target("avx512f"))) void copyWithAvx512(
+    void* dst,
+    const void* src,
+    size_t length) {
+  uint8_t* dstPtr = reinterpret_cast<uint8_t*>(dst);
+  const uint8_t* srcPtr = reinterpret_cast<const uint8_t*>(src);
+
+  size_t headLength = copyUntilAligned(dstPtr, srcPtr, length, 64);
+  dstPtr += headLength;
+  srcPtr += headLength;
+  length -= headLength;
+
+  // Four cache lines per iteration, one per register.
+  while (length >= 4 * kCacheLineSize) {
+    for (size_t lineIdx = 0; lineIdx < 4; lineIdx++) {
+      _mm_prefetch(
+          reinterpret_cast<const char*>(
+              srcPtr + kPrefetchDistance + lineIdx * kCacheLineSize),
+          _MM_HINT_NTA);
+    }
+    __m512i v0 = _mm512_loadu_si512(srcPtr + 0 * kCacheLineSize);
+    __m512i v1 = _mm512_loadu_si512(srcPtr + 1 * kCacheLineSize);
+    __m512i v2 = _mm512_loadu_si512(srcPtr + 2 * kCacheLineSize);
+    __m512i v3 = _mm512_loadu_si512(srcPtr + 3 * kCacheLineSize);
+    _mm512_stream_si512(
+        reinterpret_cast<__m512i*>(dstPtr + 0 * kCacheLineSize), v0);
+    _mm512_stream_si512(
+        reinterpret_cast<__m512i*>(dstPtr + 1 * kCacheLineSize), v1);
+    _mm512_stream_si512(
+        reinterpret_cast<__m512i*>(dstPtr + 2 * kCacheLineSize), v2);
+    _mm512_stream_si512(
+        reinterpret_cast<__m512i*>(dstPtr + 3 * kCacheLineSize), v3);
+    dstPtr += 4 * kCacheLineSize;
+    srcPtr += 4 * kCacheLineSize;
+    length -= 4 * kCacheLineSize;
+  }
+
+  _mm_sfence();
+  std::memcpy(dstPtr, srcPtr, length);
+}
+
+#endif // TP_HAS_X86_NON_TEMPORAL_COPY
+
+Implementation selectImplementation() {
+#if TP_HAS_X86_NON_TEMPORAL_COPY
+  // These also check that the OS saves the state of the wider registers.
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return {copyWithAvx512, "avx512"};
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return {copyWithAvx2, "avx2"};
+  }
+#endif // TP_HAS_X86_NON_TEMPORAL_COPY
+  return {copyWithMemcpy, "memcpy"};
+}
+
+const Implementation& getImplementation() {
+  static const Implementation implementation = selectImplementation();
+  return implementation;
+}
+
+} // namespace
+
+void copyMemory(void* dst, const void* src, size_t length) {
+  if (length < kNonTemporalCopyThreshold) {
+    std::memcpy(dst, src, length);
+    return;
+  }
+  getImplementation().fn(dst, src, length);
+}
+
+void copyMemoryNonTemporal(void* dst, const void* src, size_t length) {
+  getImplementation().fn(dst, src, length);
+}
+
+const char* getNonTemporalCopyImplementation() {
+  return getImplementation().name;
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+// Bulk copies of CPU memory, such as those into ringbuffers or between the
+// buffers of two pipes of a same process, are mostly read once, by another
+// core, a while later. The regular memcpy writes them through the caches, hence
+// evicting from the last level cache data that's still useful, for no benefit.
+// Above a threshold these copies are instead done with non-temporal (streaming)
+// stores, which write whole cache lines straight to memory, while prefetching
+// the source ahead of the loads. The instruction set is picked at runtime,
+// among those supported by the CPU, the first time it's needed. On CPUs that
+// support none of them (or other architectures) this is the regular memcpy.
+
+namespace tensorpipe {
+
+// Copies of fewer bytes than this go through the regular memcpy.
+constexpr size_t kNonTemporalCopyThreshold = 256 * 1024;
+
+// Copy the given number of bytes from the source to the (non-overlapping)
+// destination, like std::memcpy, using non-temporal stores if there are enough
+// of them. The stores are fenced before returning, hence the data can then be
+// handed over to other threads as usual.
+void copyMemory(void* dst, const void* src, size_t length);
+
+// Same as above, but use non-temporal stores whatever the length, if the CPU
+// supports them. Mainly meant for tests and benchmarks.
+void copyMemoryNonTemporal(void* dst, const void* src, size_t length);
+
+// The name of the implementation that copyMemoryNonTemporal uses on this CPU,
+// i.e., "avx512", "avx2" or "memcpy".
+const char* getNonTemporalCopyImplementation();
+
+} // namespace tensorpipe
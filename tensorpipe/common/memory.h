@@ -8,9 +8,13 @@
 
 #pragma once
 
+#include <linux/mman.h>
 #include <sys/mman.h>
 
+#include <cstdint>
 #include <memory>
+#include <tuple>
+#include <utility>
 
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
@@ -30,9 +34,10 @@ class MmappedPtr {
       size_t length,
       int prot,
       int flags,
-      int fd) {
+      int fd,
+      off_t offset = 0) {
     void* ptr;
-    ptr = ::mmap(nullptr, length, prot, flags, fd, 0);
+    ptr = ::mmap(nullptr, length, prot, flags, fd, offset);
     if (ptr == MAP_FAILED) {
       return std::make_tuple(
           TP_CREATE_ERROR(SystemError, "mmap", errno), MmappedPtr());
@@ -41,6 +46,83 @@ class MmappedPtr {
         Error::kSuccess, MmappedPtr(reinterpret_cast<uint8_t*>(ptr), length));
   }
 
+  // Map the first length bytes of the file twice, back-to-back, at an address
+  // that is a multiple of the given alignment (which the length must also be a
+  // multiple of, e.g., the page size). The result spans both copies, hence it
+  // is twice as long, and its second half aliases its first one.
+  static std::tuple<Error, MmappedPtr> createTwice(
+      size_t length,
+      size_t alignment,
+      int prot,
+      int flags,
+      int fd) {
+    TP_DCHECK_EQ(length % alignment, 0);
+    // Reserve enough address space for both copies, plus some slack to align
+    // them, without committing any memory, and then map them over it.
+    const size_t reservedLength = 2 * length + alignment;
+    void* reservedPtr = ::mmap(
+        nullptr,
+        reservedLength,
+        PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+        -1,
+        0);
+    if (reservedPtr == MAP_FAILED) {
+      return std::make_tuple(
+          TP_CREATE_ERROR(SystemError, "mmap", errno), MmappedPtr());
+    }
+    uint8_t* reserved = reinterpret_cast<uint8_t*>(reservedPtr);
+    const uintptr_t reservedAddr = reinterpret_cast<uintptr_t>(reserved);
+    uint8_t* base =
+        reserved + (alignment - reservedAddr % alignment) % alignment;
+    for (uint8_t* copy : {base, base + length}) {
+      void* ptr = ::mmap(copy, length, prot, flags | MAP_FIXED, fd, 0);
+      if (ptr == MAP_FAILED) {
+        Error error = TP_CREATE_ERROR(SystemError, "mmap", errno);
+        ::munmap(reserved, reservedLength);
+        return std::make_tuple(std::move(error), MmappedPtr());
+      }
+    }
+    // Give back the slack on either side.
+    if (base > reserved) {
+      ::munmap(reserved, base - reserved);
+    }
+    uint8_t* end = base + 2 * length;
+    if (end < reserved + reservedLength) {
+      ::munmap(end, reserved + reservedLength - end);
+    }
+    return std::make_tuple(Error::kSuccess, MmappedPtr(base, 2 * length));
+  }
+
+  // Map private anonymous memory backed by the largest huge pages (1 GB or
+  // 2 MB) that the length is a whole number of, which spares TLB misses to the
+  // CPU and to the devices that access it. This fails if the length isn't a
+  // multiple of 2 MB or if no such pages are available (e.g., none have been
+  // reserved), for the caller to fall back to regular pages.
+  static std::tuple<Error, MmappedPtr> createOnHugePages(
+      size_t length,
+      int prot) {
+    constexpr size_t kHugePageSize2MB = 2 * 1024 * 1024;
+    constexpr size_t kHugePageSize1GB = 1024 * 1024 * 1024;
+    Error error = TP_CREATE_ERROR(SystemError, "mmap", EINVAL);
+    MmappedPtr ptr;
+    for (auto sizeAndFlag : {std::make_pair(kHugePageSize1GB, MAP_HUGE_1GB),
+                             std::make_pair(kHugePageSize2MB, MAP_HUGE_2MB)}) {
+      if (length % sizeAndFlag.first != 0) {
+        continue;
+      }
+      std::tie(error, ptr) = create(
+          length,
+          prot,
+          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | sizeAndFlag.second,
+          -1);
+      if (!error) {
+        break;
+      }
+    }
+    return std::make_tuple(std::move(error), std::move(ptr));
+  }
+
   uint8_t* ptr() {
     return ptr_.get();
   }
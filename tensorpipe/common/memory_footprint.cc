@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/memory_footprint.h>
+
+#include <utility>
+
+namespace tensorpipe {
+
+uint64_t MemoryFootprint::totalBytes() const {
+  return hostBytes + pinnedBytes + registeredBytes + deviceMappedBytes +
+      sharedBytes;
+}
+
+void MemoryFootprint::merge(const MemoryFootprint& other) {
+  hostBytes += other.hostBytes;
+  pinnedBytes += other.pinnedBytes;
+  registeredBytes += other.registeredBytes;
+  deviceMappedBytes += other.deviceMappedBytes;
+  sharedBytes += other.sharedBytes;
+}
+
+void MemoryFootprintCounters::add(MemoryKind kind, size_t numBytes) {
+  numBytes_[static_cast<size_t>(kind)].fetch_add(
+      numBytes, std::memory_order_relaxed);
+}
+
+void MemoryFootprintCounters::remove(MemoryKind kind, size_t numBytes) {
+  numBytes_[static_cast<size_t>(kind)].fetch_sub(
+      numBytes, std::memory_order_relaxed);
+}
+
+MemoryFootprint MemoryFootprintCounters::snapshot() const {
+  auto load = [&](MemoryKind kind) {
+    return numBytes_[static_cast<size_t>(kind)].load(
+        std::memory_order_relaxed);
+  };
+  MemoryFootprint footprint;
+  footprint.hostBytes = load(MemoryKind::kHost);
+  footprint.pinnedBytes = load(MemoryKind::kPinned);
+  footprint.registeredBytes = load(MemoryKind::kRegistered);
+  footprint.deviceMappedBytes = load(MemoryKind::kDeviceMapped);
+  footprint.sharedBytes = load(MemoryKind::kShared);
+  return footprint;
+}
+
+MemoryCharge::MemoryCharge(
+    MemoryFootprintCounters& counters,
+    MemoryKind kind,
+    size_t numBytes)
+    : counters_(&counters), kind_(kind), numBytes_(numBytes) {
+  counters_->add(kind_, numBytes_);
+}
+
+MemoryCharge::MemoryCharge(MemoryCharge&& other) noexcept
+    : counters_(std::exchange(other.counters_, nullptr)),
+      kind_(other.kind_),
+      numBytes_(std::exchange(other.numBytes_, 0)) {}
+
+MemoryCharge& MemoryCharge::operator=(MemoryCharge&& other) noexcept {
+  if (this != &other) {
+    reset();
+    counters_ = std::exchange(other.counters_, nullptr);
+    kind_ = other.kind_;
+    numBytes_ = std::exchange(other.numBytes_, 0);
+  }
+  return *this;
+}
+
+void MemoryCharge::reset() {
+  if (counters_ != nullptr) {
+    counters_->remove(kind_, numBytes_);
+    counters_ = nullptr;
+    numBytes_ = 0;
+  }
+}
+
+MemoryCharge::~MemoryCharge() {
+  reset();
+}
+
+} // namespace tensorpipe
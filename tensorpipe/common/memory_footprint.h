@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace tensorpipe {
+
+// The kinds of memory that a context may hold on to, which are accounted
+// separately as they come from different budgets. Each byte is only counted
+// once, under the most specific kind (e.g., host memory registered with a NIC
+// is only counted as registered).
+enum class MemoryKind {
+  // Regular memory, e.g., the private buffers of connections, or the messages
+  // that the pipes keep referencing until they're written.
+  kHost,
+  // Page-locked host memory obtained from CUDA, e.g., for staging copies.
+  kPinned,
+  // Memory registered with an InfiniBand NIC, either on the host or on a GPU.
+  kRegistered,
+  // Device allocations of other processes mapped into this one by CUDA IPC.
+  kDeviceMapped,
+  // Shared memory, e.g., the ringbuffers of the shm transport.
+  kShared,
+};
+
+// A snapshot of how many bytes of each kind a transport or channel context (and
+// all of its connections or channels) holds. Only the memory that the context
+// allocated, mapped or registered itself is counted, not the one of the peers.
+struct MemoryFootprint {
+  uint64_t hostBytes{0};
+  uint64_t pinnedBytes{0};
+  uint64_t registeredBytes{0};
+  uint64_t deviceMappedBytes{0};
+  uint64_t sharedBytes{0};
+
+  uint64_t totalBytes() const;
+
+  // Add all the bytes of the other object to this one.
+  void merge(const MemoryFootprint& other);
+};
+
+// The counters behind the above snapshot, which can be updated and read from
+// any thread.
+class MemoryFootprintCounters {
+ public:
+  MemoryFootprintCounters() = default;
+
+  MemoryFootprintCounters(const MemoryFootprintCounters&) = delete;
+  MemoryFootprintCounters& operator=(const MemoryFootprintCounters&) = delete;
+
+  void add(MemoryKind kind, size_t numBytes);
+  void remove(MemoryKind kind, size_t numBytes);
+
+  MemoryFootprint snapshot() const;
+
+ private:
+  std::array<std::atomic<uint64_t>, 5> numBytes_{};
+};
+
+// Accounts for some memory for as long as it's alive, or until it's reset (as
+// when the memory is released before its owner goes away). Movable, so that
+// it can sit next to the object that owns the memory.
+class MemoryCharge {
+ public:
+  MemoryCharge() = default;
+
+  MemoryCharge(
+      MemoryFootprintCounters& counters,
+      MemoryKind kind,
+      size_t numBytes);
+
+  MemoryCharge(const MemoryCharge&) = delete;
+  MemoryCharge& operator=(const MemoryCharge&) = delete;
+
+  MemoryCharge(MemoryCharge&& other) noexcept;
+  MemoryCharge& operator=(MemoryCharge&& other) noexcept;
+
+  void reset();
+
+  ~MemoryCharge();
+
+ private:
+  MemoryFootprintCounters* counters_{nullptr};
+  MemoryKind kind_{MemoryKind::kHost};
+  size_t numBytes_{0};
+};
+
+} // namespace tensorpipe
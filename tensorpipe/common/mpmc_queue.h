@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/event_count.h>
+#include <tensorpipe/common/optional.h>
+
+namespace tensorpipe {
+
+// A bounded multi-producer multi-consumer queue, with the same interface as
+// Queue, based on Dmitry Vyukov's ring of slots that each carry a sequence
+// number. Producers and consumers claim a slot with a compare-and-swap on the
+// position at the back or at the front, hence they don't take any lock, and
+// they only go to sleep (on a futex, through an EventCount) when the queue is
+// full or empty, respectively. The capacity is rounded up to a power of two.
+//
+// Waking up a consumer that isn't asleep costs an atomic increment, which is
+// much less than the lock and the signal of a condition variable of Queue,
+// hence this is meant for the hot paths that hand work over to other threads.
+template <typename T>
+class MpmcQueue {
+ public:
+  explicit MpmcQueue(size_t capacity)
+      : mask_(roundUpToPowerOfTwo(capacity) - 1),
+        slots_(std::make_unique<Slot[]>(mask_ + 1)) {
+    for (size_t slotIdx = 0; slotIdx <= mask_; slotIdx++) {
+      slots_[slotIdx].sequence.store(slotIdx, std::memory_order_relaxed);
+    }
+  }
+
+  MpmcQueue(const MpmcQueue&) = delete;
+  MpmcQueue(MpmcQueue&&) = delete;
+  MpmcQueue& operator=(const MpmcQueue&) = delete;
+  MpmcQueue& operator=(MpmcQueue&&) = delete;
+
+  size_t capacity() const {
+    return mask_ + 1;
+  }
+
+  // Block while the queue is full.
+  void push(T t) {
+    while (!tryPush(t)) {
+      const uint32_t key = notFull_.prepareWait();
+      if (tryPush(t)) {
+        notFull_.finishWait();
+        break;
+      }
+      notFull_.wait(key, kWaitTimeout);
+      notFull_.finishWait();
+    }
+    notEmpty_.notify();
+  }
+
+  // Move the item into the queue if it isn't full, and leave it as it is (and
+  // return false) otherwise, for the producers that must never block.
+  bool pushIfNotFull(T& t) {
+    if (!tryPush(t)) {
+      return false;
+    }
+    notEmpty_.notify();
+    return true;
+  }
+
+  // Whether all the items that were pushed, including those still being
+  // pushed, have been popped. This is just a snapshot unless the producers
+  // have stopped.
+  bool empty() const {
+    return frontPos_.load(std::memory_order_acquire) ==
+        backPos_.load(std::memory_order_acquire);
+  }
+
+  // Block while the queue is empty.
+  T pop() {
+    optional<T> t;
+    while (!tryPop(t)) {
+      const uint32_t key = notEmpty_.prepareWait();
+      if (tryPop(t)) {
+        notEmpty_.finishWait();
+        break;
+      }
+      notEmpty_.wait(key, kWaitTimeout);
+      notEmpty_.finishWait();
+    }
+    notFull_.notify();
+    return std::move(t).value();
+  }
+
+  // Wait until the queue isn't empty and then move all its items, in order, to
+  // the back of the given deque. As the producers don't stop meanwhile, this
+  // stops at the first slot that it finds empty.
+  void popAll(std::deque<T>& items) {
+    items.push_back(pop());
+    optional<T> t;
+    while (tryPop(t)) {
+      items.push_back(std::move(t).value());
+      t.reset();
+    }
+    notFull_.notify();
+  }
+
+  ~MpmcQueue() {
+    optional<T> t;
+    while (tryPop(t)) {
+      t.reset();
+    }
+  }
+
+ private:
+  // The waits are only bounded in case of a bug, as the event counts don't
+  // lose wakeups.
+  static constexpr std::chrono::seconds kWaitTimeout{1};
+
+  struct Slot {
+    // The position of the next push into the slot while it's empty, and one
+    // past the position of its item while it's full.
+    std::atomic<size_t> sequence;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  static size_t roundUpToPowerOfTwo(size_t value) {
+    TP_THROW_ASSERT_IF(value == 0) << "The capacity must be positive";
+    size_t result = 1;
+    while (result < value) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  // Move the item into the queue if it isn't full, and leave it as it is
+  // otherwise.
+  bool tryPush(T& t) {
+    size_t pos = backPos_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      const intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (backPos_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // The slot still holds the item of the previous lap.
+        return false;
+      } else {
+        pos = backPos_.load(std::memory_order_relaxed);
+      }
+    }
+    new (&slot->storage) T(std::move(t));
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Move the item at the front into the given (empty) optional, if any.
+  bool tryPop(optional<T>& t) {
+    size_t pos = frontPos_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      const intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (frontPos_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // The slot is empty, or a producer hasn't finished filling it.
+        return false;
+      } else {
+        pos = frontPos_.load(std::memory_order_relaxed);
+      }
+    }
+    T* item = reinterpret_cast<T*>(&slot->storage);
+    t.emplace(std::move(*item));
+    item->~T();
+    slot->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  const size_t mask_;
+  const std::unique_ptr<Slot[]> slots_;
+
+  // Keep the positions, which producers and consumers respectively contend
+  // on, on separate cache lines to avoid false sharing.
+  alignas(64) std::atomic<size_t> backPos_{0};
+  alignas(64) std::atomic<size_t> frontPos_{0};
+
+  EventCount notEmpty_;
+  EventCount notFull_;
+};
+
+template <typename T>
+constexpr std::chrono::seconds MpmcQueue<T>::kWaitTimeout;
+
+} // namespace tensorpipe
@@ -8,6 +8,9 @@
 
 #pragma once
 
+#include <cstddef>
+#include <type_traits>
+
 #include <nop/serializer.h>
 #include <nop/status.h>
 #include <nop/utility/buffer_reader.h>
@@ -212,6 +215,19 @@ class AbstractNopHolder {
   virtual ~AbstractNopHolder() = default;
 };
 
+// Whether the nop type has a fixed layout, i.e., none of its fields have a
+// variable length (strings, vectors, variants, ...), which is the case of most
+// of the control messages of the channels, and of the descriptors of the
+// channels that just refer to the memory of the sender. Those are copied as
+// they are, as a single block of sizeof(T) bytes, rather than encoded field by
+// field (each one with its own prefix and its own width, depending on its
+// value), which spares the work of libnop for each tensor. This is only a
+// different encoding, which both ends agree upon as long as they run the same
+// version of TensorPipe on platforms with the same ABI (as all the 64-bit
+// little-endian ones that we support are).
+template <typename T>
+struct IsFixedLayoutNopType : std::is_trivially_copyable<T> {};
+
 template <typename T>
 class NopHolder : public AbstractNopHolder {
  public:
@@ -224,19 +240,53 @@ class NopHolder : public AbstractNopHolder {
   }
 
   size_t getSize() const override {
-    return nop::Encoding<T>::Size(object_);
+    return getSizeImpl(IsFixedLayoutNopType<T>());
   }
 
   nop::Status<void> write(NopWriter& writer) const override {
-    return nop::Encoding<T>::Write(object_, &writer);
+    return writeImpl(writer, IsFixedLayoutNopType<T>());
   }
 
   nop::Status<void> read(NopReader& reader) override {
-    return nop::Encoding<T>::Read(&object_, &reader);
+    return readImpl(reader, IsFixedLayoutNopType<T>());
   }
 
  private:
   T object_;
+
+  size_t getSizeImpl(std::true_type /* unused */) const {
+    return sizeof(T);
+  }
+
+  size_t getSizeImpl(std::false_type /* unused */) const {
+    return nop::Encoding<T>::Size(object_);
+  }
+
+  nop::Status<void> writeImpl(NopWriter& writer, std::true_type /* unused */)
+      const {
+    nop::Status<void> status = writer.Prepare(sizeof(T));
+    if (status.has_error()) {
+      return status;
+    }
+    return writer.Write(&object_, &object_ + 1);
+  }
+
+  nop::Status<void> writeImpl(NopWriter& writer, std::false_type /* unused */)
+      const {
+    return nop::Encoding<T>::Write(object_, &writer);
+  }
+
+  nop::Status<void> readImpl(NopReader& reader, std::true_type /* unused */) {
+    nop::Status<void> status = reader.Ensure(sizeof(T));
+    if (status.has_error()) {
+      return status;
+    }
+    return reader.Read(&object_, &object_ + 1);
+  }
+
+  nop::Status<void> readImpl(NopReader& reader, std::false_type /* unused */) {
+    return nop::Encoding<T>::Read(&object_, &reader);
+  }
 };
 
 } // namespace tensorpipe
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include <tensorpipe/common/error.h>
+
+namespace tensorpipe {
+
+// A source of pinned (page-locked) host memory, which the CUDA channels stage
+// their copies through. By default each channel context has its own pool (see
+// CudaPinnedBufferPool), but one allocator can be shared by all the channels of
+// a context and by the application itself (e.g., an adapter around PyTorch's
+// CachingHostAllocator), see ContextOptions::pinnedMemoryAllocator, so that the
+// memory cached by one is reused by the others and is only capped once.
+//
+// Implementations must be thread-safe. The memory must be usable by CUDA for
+// any device (as the one of cudaMallocHost and cudaHostAlloc is).
+class PinnedMemoryAllocator {
+ public:
+  // The buffer gives the memory back to the allocator once it is destroyed.
+  using TAllocCallback =
+      std::function<void(const Error&, std::shared_ptr<uint8_t>)>;
+
+  // Obtain a buffer of at least length bytes, to be copied from or to the given
+  // device. The callback may be called inline, or later on from any thread
+  // (e.g., once enough memory is given back by other users), and its error is
+  // set if the allocator is closed or can't ever provide the memory.
+  virtual void allocate(int device, size_t length, TAllocCallback callback) = 0;
+
+  // The pinned memory held by the allocator, both in use and cached, as counted
+  // in the memory footprint of the context.
+  virtual size_t getTotalBytes() {
+    return 0;
+  }
+
+  // Give back the memory that isn't in use right now, as the context does when
+  // it goes over its soft limit (see ContextOptions::memorySoftLimit).
+  virtual void releaseFreeBuffers() {}
+
+  virtual ~PinnedMemoryAllocator() = default;
+};
+
+} // namespace tensorpipe
@@ -11,16 +11,21 @@
 #include <condition_variable>
 #include <deque>
 #include <mutex>
+#include <string>
+
+#include <tensorpipe/common/lock_stats.h>
 
 namespace tensorpipe {
 
 template <typename T>
 class Queue {
  public:
-  explicit Queue(int capacity = 1) : capacity_(capacity) {}
+  // The name is the one under which its mutex is profiled (see LockStats).
+  explicit Queue(int capacity = 1, const std::string& name = "queue")
+      : mutex_(name), capacity_(capacity) {}
 
   void push(T t) {
-    std::unique_lock<std::mutex> lock(mutex_);
+    std::unique_lock<std::mutex> lock = mutex_.acquire();
     while (items_.size() >= capacity_) {
       cv_.wait(lock);
     }
@@ -29,7 +34,7 @@ class Queue {
   }
 
   T pop() {
-    std::unique_lock<std::mutex> lock(mutex_);
+    std::unique_lock<std::mutex> lock = mutex_.acquire();
     while (items_.size() == 0) {
       cv_.wait(lock);
     }
@@ -39,8 +44,23 @@ class Queue {
     return t;
   }
 
+  // Wait until the queue isn't empty and then move all its items, in order, to
+  // the back of the given deque. This allows a consumer to handle a burst of
+  // items at once, rather than one by one.
+  void popAll(std::deque<T>& items) {
+    std::unique_lock<std::mutex> lock = mutex_.acquire();
+    while (items_.size() == 0) {
+      cv_.wait(lock);
+    }
+    while (items_.size() > 0) {
+      items.push_back(std::move(items_.front()));
+      items_.pop_front();
+    }
+    cv_.notify_all();
+  }
+
  private:
-  std::mutex mutex_;
+  ProfiledMutex mutex_;
   std::condition_variable cv_;
   const int capacity_;
   std::deque<T> items_;
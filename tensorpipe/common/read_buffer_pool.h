@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+// Recycles the buffers that read operations allocate when they aren't given a
+// destination, which a connection mostly does for small control messages (of
+// the channels, for example), so that reading those doesn't allocate memory in
+// the steady state. The buffers are grouped in size classes, which are powers
+// of two, and only a few of the free ones of each class are kept. Those larger
+// than the largest class are allocated (and freed) on demand as before.
+//
+// This isn't thread-safe: it's meant to be owned by a connection and used from
+// its loop. It must outlive the buffers it hands out.
+class ReadBufferPool {
+ public:
+  static constexpr size_t kMinPooledLength = 64;
+  static constexpr size_t kNumSizeClasses = 11;
+  static constexpr size_t kMaxPooledLength = kMinPooledLength
+      << (kNumSizeClasses - 1);
+  static constexpr size_t kMaxFreeBuffersPerSizeClass = 4;
+
+  // Owns a buffer, and gives it back to its pool (if any) when destroyed.
+  class Buffer {
+   public:
+    Buffer() = default;
+
+    Buffer(Buffer&& other) noexcept
+        : pool_(other.pool_),
+          sizeClass_(other.sizeClass_),
+          data_(std::move(other.data_)) {}
+
+    Buffer& operator=(Buffer&& other) noexcept {
+      if (this != &other) {
+        reset();
+        pool_ = other.pool_;
+        sizeClass_ = other.sizeClass_;
+        data_ = std::move(other.data_);
+      }
+      return *this;
+    }
+
+    ~Buffer() {
+      reset();
+    }
+
+    uint8_t* get() const {
+      return data_.get();
+    }
+
+    void reset() {
+      if (pool_ != nullptr && data_ != nullptr) {
+        pool_->release(sizeClass_, std::move(data_));
+      }
+      data_.reset();
+    }
+
+   private:
+    Buffer(
+        ReadBufferPool* pool,
+        size_t sizeClass,
+        std::unique_ptr<uint8_t[]> data)
+        : pool_(pool), sizeClass_(sizeClass), data_(std::move(data)) {}
+
+    ReadBufferPool* pool_{nullptr};
+    size_t sizeClass_{0};
+    std::unique_ptr<uint8_t[]> data_;
+
+    friend class ReadBufferPool;
+  };
+
+  ReadBufferPool() = default;
+
+  ReadBufferPool(const ReadBufferPool&) = delete;
+  ReadBufferPool(ReadBufferPool&&) = delete;
+  ReadBufferPool& operator=(const ReadBufferPool&) = delete;
+  ReadBufferPool& operator=(ReadBufferPool&&) = delete;
+
+  // Return a buffer of at least the given length, from the pool if there is
+  // one, or else allocated on purpose.
+  static Buffer allocate(ReadBufferPool* pool, size_t length) {
+    if (pool == nullptr || length > kMaxPooledLength) {
+      return Buffer(nullptr, 0, std::make_unique<uint8_t[]>(length));
+    }
+    return pool->allocate(length);
+  }
+
+  Buffer allocate(size_t length) {
+    TP_DCHECK_LE(length, kMaxPooledLength);
+    size_t sizeClass = 0;
+    while ((kMinPooledLength << sizeClass) < length) {
+      sizeClass++;
+    }
+    std::vector<std::unique_ptr<uint8_t[]>>& freeBuffers =
+        freeBuffers_[sizeClass];
+    if (!freeBuffers.empty()) {
+      std::unique_ptr<uint8_t[]> data = std::move(freeBuffers.back());
+      freeBuffers.pop_back();
+      return Buffer(this, sizeClass, std::move(data));
+    }
+    numAllocations_++;
+    return Buffer(
+        this,
+        sizeClass,
+        std::make_unique<uint8_t[]>(kMinPooledLength << sizeClass));
+  }
+
+  // The number of buffers that the pool had to allocate so far.
+  uint64_t numAllocations() const {
+    return numAllocations_;
+  }
+
+ private:
+  std::array<std::vector<std::unique_ptr<uint8_t[]>>, kNumSizeClasses>
+      freeBuffers_;
+  uint64_t numAllocations_{0};
+
+  void release(size_t sizeClass, std::unique_ptr<uint8_t[]> data) {
+    std::vector<std::unique_ptr<uint8_t[]>>& freeBuffers =
+        freeBuffers_[sizeClass];
+    if (freeBuffers.size() < kMaxFreeBuffersPerSizeClass) {
+      freeBuffers.push_back(std::move(data));
+    }
+  }
+};
+
+} // namespace tensorpipe
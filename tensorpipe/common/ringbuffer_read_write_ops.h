@@ -9,14 +9,20 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <memory>
 #include <tuple>
 #include <utility>
+#include <vector>
 
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/common/memcpy.h>
 #include <tensorpipe/common/nop.h>
+#include <tensorpipe/common/read_buffer_pool.h>
 #include <tensorpipe/util/ringbuffer/consumer.h>
 #include <tensorpipe/util/ringbuffer/producer.h>
 
@@ -30,15 +36,39 @@ namespace tensorpipe {
 // duration of the callback. If the memory contents must be
 // preserved for longer, it must be copied elsewhere.
 //
+// When no destination buffer is supplied and the whole payload is already
+// available in a contiguous region of the ringbuffer, the callback is given a
+// pointer directly into the ringbuffer (before the data is released to the
+// producer), which avoids an allocation and a copy. Otherwise the payload is
+// copied into a buffer that is allocated on purpose, or that is taken from the
+// connection's pool, if it set one.
+//
+// Nop objects are always deserialized in place from the ringbuffer, once all
+// their bytes are there. If the ringbuffer's data is double mapped (see
+// RingBuffer::isDataDoubleMapped) they, and the payloads that are available in
+// full, are always contiguous, hence are never split in two nor copied.
+//
+// Transports that can move large payloads outside of the ringbuffer may set a
+// rendezvous threshold: once it has read the length of a payload that is at
+// least that large the operation stops, and waits for the transport to deliver
+// the data directly to its destination and to mark it as such. The peer's write
+// operation must have been given the same threshold.
+//
+// Transports may also deliver small messages in full outside of the ringbuffer,
+// in which case they hand them to the operation at the front of the queue, if
+// it didn't start reading yet, in place of the ringbuffer (see handleEagerRead
+// and RingbufferWriteOperation::handleEagerWrite).
+//
 class RingbufferReadOperation {
   enum Mode {
     READ_LENGTH,
     READ_PAYLOAD,
+    AWAIT_RENDEZVOUS,
   };
 
  public:
   using read_callback_fn =
-      std::function<void(const Error& error, const void* ptr, size_t len)>;
+      MoveOnlyFunction<void(const Error& error, const void* ptr, size_t len)>;
   // Read into a user-provided buffer of known length.
   inline RingbufferReadOperation(void* ptr, size_t len, read_callback_fn fn);
   // Read into an auto-allocated buffer, whose length is read from the wire.
@@ -48,29 +78,78 @@ class RingbufferReadOperation {
       AbstractNopHolder* nopObject,
       read_callback_fn fn);
 
-  // Processes a pending read.
-  inline size_t handleRead(util::ringbuffer::Consumer& inbox);
+  // Processes a pending read, with either kind of consumer.
+  template <typename TConsumer>
+  inline size_t handleRead(TConsumer& inbox);
+
+  // Processes a pending read in one go, from a payload that the transport got
+  // in full by other means, which only needs to stay valid during the call.
+  inline void handleEagerRead(const void* ptr, size_t len);
 
   bool completed() const {
     return (mode_ == READ_PAYLOAD && bytesRead_ == len_);
   }
 
+  // Whether nothing was read yet, not even the length.
+  bool awaitingLength() const {
+    return mode_ == READ_LENGTH;
+  }
+
+  void setRendezvousThreshold(size_t threshold) {
+    rendezvousThreshold_ = threshold;
+  }
+
+  // The pool to take the buffers from when no destination was given. It must
+  // outlive the operation.
+  void setBufferPool(ReadBufferPool* pool) {
+    bufferPool_ = pool;
+  }
+
+  bool awaitingRendezvous() const {
+    return mode_ == AWAIT_RENDEZVOUS;
+  }
+
+  // The memory that the payload must be delivered to, when awaiting rendezvous.
+  void* rendezvousPtr() const {
+    TP_DCHECK(awaitingRendezvous());
+    return ptr_;
+  }
+
+  size_t rendezvousLength() const {
+    TP_DCHECK(awaitingRendezvous());
+    return len_;
+  }
+
+  // Called by the transport once the payload has been delivered to the memory
+  // returned by rendezvousPtr. Completes the operation.
+  inline void completeRendezvous();
+
   inline void handleError(const Error& error);
 
  private:
   Mode mode_{READ_LENGTH};
   void* ptr_{nullptr};
   AbstractNopHolder* nopObject_{nullptr};
-  std::unique_ptr<uint8_t[]> buf_;
+  ReadBufferPool::Buffer buf_;
+  ReadBufferPool* bufferPool_{nullptr};
   size_t len_{0};
   size_t bytesRead_{0};
   read_callback_fn fn_;
+  // Whether the callback was already called, with a pointer into the
+  // ringbuffer, while the transaction was still open.
+  bool calledWithBorrowedPtr_{false};
   // Use a separare flag, rather than checking if ptr_ == nullptr, to catch the
   // case of a user explicitly passing in a nullptr with length zero, in which
   // case we must check that the length matches the header we see on the wire.
   const bool ptrProvided_;
-
-  inline ssize_t readNopObject(util::ringbuffer::Consumer& inbox);
+  // Payloads at least this large are delivered by the transport directly.
+  size_t rendezvousThreshold_{SIZE_MAX};
+
+  template <typename TConsumer>
+  inline ssize_t readNopObject(TConsumer& inbox);
+  template <typename TConsumer>
+  inline ssize_t borrowOrAllocatePayload(TConsumer& inbox);
+  inline void allocateBuffer();
 };
 
 // Writes happen only if the user supplied a memory pointer, the
@@ -80,14 +159,29 @@ class RingbufferReadOperation {
 // The memory pointed to by the pointer may only be reused or freed
 // after the callback has been called.
 //
+// A single operation may also write a nop object followed by several
+// buffers. Each of them is framed as if it had been written by its own
+// operation (hence the peer reads them one by one), but they are all
+// written within the same ringbuffer transaction, as far as space
+// allows, so that the peer only needs to be notified once.
+//
+// Nop objects are serialized in place into the ringbuffer, which is contiguous
+// if its data is double mapped. Large buffers are copied with non-temporal
+// stores (see copyMemory), as the peer only reads them once.
+//
+// If a rendezvous threshold is set, only the length of the buffers that are at
+// least that large is written to the ringbuffer. The operation then stops until
+// the transport has delivered the data by other means and marked it as such.
+//
 class RingbufferWriteOperation {
   enum Mode {
     WRITE_LENGTH,
     WRITE_PAYLOAD,
+    AWAIT_RENDEZVOUS,
   };
 
  public:
-  using write_callback_fn = std::function<void(const Error& error)>;
+  using write_callback_fn = MoveOnlyFunction<void(const Error& error)>;
   // Write from a user-provided buffer of known length.
   inline RingbufferWriteOperation(
       const void* ptr,
@@ -97,24 +191,74 @@ class RingbufferWriteOperation {
   inline RingbufferWriteOperation(
       const AbstractNopHolder* nopObject,
       write_callback_fn fn);
+  // Write from a user-provided libnop object followed by a sequence of
+  // user-provided buffers of known length.
+  inline RingbufferWriteOperation(
+      const AbstractNopHolder* nopObject,
+      const std::vector<std::tuple<const void*, size_t>>& buffers,
+      write_callback_fn fn);
 
-  inline size_t handleWrite(util::ringbuffer::Producer& outbox);
+  // Processes a pending write, with either kind of producer.
+  template <typename TProducer>
+  inline size_t handleWrite(TProducer& outbox);
+
+  // Writes a pending operation in one go, without its framing, into the given
+  // memory, for the transport to deliver it by other means, if it's made of a
+  // single non-empty segment that fits and that it didn't start writing yet.
+  // Returns the number of bytes that it wrote, i.e., zero if it didn't.
+  inline size_t handleEagerWrite(void* ptr, size_t maxLen);
 
   bool completed() const {
-    return (mode_ == WRITE_PAYLOAD && bytesWritten_ == len_);
+    return segmentIdx_ == segments_.size();
+  }
+
+  void setRendezvousThreshold(size_t threshold) {
+    rendezvousThreshold_ = threshold;
+  }
+
+  bool awaitingRendezvous() const {
+    return mode_ == AWAIT_RENDEZVOUS;
+  }
+
+  // The buffer that must be delivered to the peer, when awaiting rendezvous.
+  const void* rendezvousPtr() const {
+    TP_DCHECK(awaitingRendezvous());
+    return segments_[segmentIdx_].ptr;
   }
 
+  size_t rendezvousLength() const {
+    TP_DCHECK(awaitingRendezvous());
+    return segments_[segmentIdx_].len;
+  }
+
+  // Called by the transport once the buffer returned by rendezvousPtr has been
+  // delivered to the peer. The operation can then proceed with the next ones
+  // (and its callback is called by the next handleWrite if it was the last).
+  inline void completeRendezvous();
+
   inline void handleError(const Error& error);
 
  private:
+  // Either a buffer or a nop object, preceded by its length.
+  struct Segment {
+    const void* ptr{nullptr};
+    const AbstractNopHolder* nopObject{nullptr};
+    size_t len{0};
+  };
+
+  std::vector<Segment> segments_;
+  // The segment being written, and the progress within it.
+  size_t segmentIdx_{0};
   Mode mode_{WRITE_LENGTH};
-  const void* ptr_{nullptr};
-  const AbstractNopHolder* nopObject_{nullptr};
-  size_t len_{0};
   size_t bytesWritten_{0};
   write_callback_fn fn_;
+  // Buffers at least this large are delivered by the transport directly.
+  size_t rendezvousThreshold_{SIZE_MAX};
 
-  inline ssize_t writeNopObject(util::ringbuffer::Producer& outbox);
+  template <typename TProducer>
+  inline ssize_t writeNopObject(TProducer& outbox, const Segment& segment);
+  template <typename TProducer>
+  inline ssize_t writeBuffer(TProducer& outbox, const Segment& segment);
 };
 
 RingbufferReadOperation::RingbufferReadOperation(
@@ -131,10 +275,16 @@ RingbufferReadOperation::RingbufferReadOperation(
     read_callback_fn fn)
     : nopObject_(nopObject), fn_(std::move(fn)), ptrProvided_(false) {}
 
-size_t RingbufferReadOperation::handleRead(util::ringbuffer::Consumer& inbox) {
+template <typename TConsumer>
+size_t RingbufferReadOperation::handleRead(TConsumer& inbox) {
   ssize_t ret;
   size_t bytesReadNow = 0;
 
+  // The payload isn't coming through the ringbuffer.
+  if (mode_ == AWAIT_RENDEZVOUS) {
+    return 0;
+  }
+
   // Start read transaction. This end of the connection is the only consumer for
   // this ringbuffer, and all reads are done from the reactor thread, so there
   // cannot be another transaction already going on. Fail hard in case.
@@ -143,7 +293,8 @@ size_t RingbufferReadOperation::handleRead(util::ringbuffer::Consumer& inbox) {
 
   if (mode_ == READ_LENGTH) {
     uint32_t length;
-    ret = inbox.readInTx</*AllowPartial=*/false>(&length, sizeof(length));
+    ret = inbox.template readInTx</*AllowPartial=*/false>(
+        &length, sizeof(length));
     if (likely(ret >= 0)) {
       mode_ = READ_PAYLOAD;
       bytesReadNow += ret;
@@ -153,8 +304,12 @@ size_t RingbufferReadOperation::handleRead(util::ringbuffer::Consumer& inbox) {
         TP_DCHECK_EQ(length, len_);
       } else {
         len_ = length;
-        buf_ = std::make_unique<uint8_t[]>(len_);
-        ptr_ = buf_.get();
+      }
+      if (nopObject_ == nullptr && len_ >= rendezvousThreshold_) {
+        if (!ptrProvided_) {
+          allocateBuffer();
+        }
+        mode_ = AWAIT_RENDEZVOUS;
       }
     } else if (unlikely(ret != -ENODATA)) {
       TP_THROW_SYSTEM(-ret);
@@ -164,8 +319,10 @@ size_t RingbufferReadOperation::handleRead(util::ringbuffer::Consumer& inbox) {
   if (mode_ == READ_PAYLOAD) {
     if (nopObject_ != nullptr) {
       ret = readNopObject(inbox);
+    } else if (!ptrProvided_ && ptr_ == nullptr) {
+      ret = borrowOrAllocatePayload(inbox);
     } else {
-      ret = inbox.readInTx</*AllowPartial=*/true>(
+      ret = inbox.template readInTx</*AllowPartial=*/true>(
           reinterpret_cast<uint8_t*>(ptr_) + bytesRead_, len_ - bytesRead_);
     }
     if (likely(ret >= 0)) {
@@ -179,28 +336,100 @@ size_t RingbufferReadOperation::handleRead(util::ringbuffer::Consumer& inbox) {
   ret = inbox.commitTx();
   TP_THROW_SYSTEM_IF(ret < 0, -ret);
 
-  if (completed()) {
+  if (completed() && !calledWithBorrowedPtr_) {
     fn_(Error::kSuccess, ptr_, len_);
   }
 
   return bytesReadNow;
 }
 
-ssize_t RingbufferReadOperation::readNopObject(
-    util::ringbuffer::Consumer& inbox) {
+template <typename TConsumer>
+ssize_t RingbufferReadOperation::borrowOrAllocatePayload(TConsumer& inbox) {
+  if (len_ <= inbox.getSize()) {
+    ssize_t numBuffers;
+    std::array<typename TConsumer::Buffer, 2> buffers;
+    std::tie(numBuffers, buffers) =
+        inbox.template accessContiguousInTx</*AllowPartial=*/false>(len_);
+    if (likely(numBuffers == 1)) {
+      // The data stays valid until the transaction is committed, hence the
+      // callback must be called right away.
+      calledWithBorrowedPtr_ = true;
+      fn_(Error::kSuccess, buffers[0].ptr, len_);
+      return len_;
+    }
+    if (numBuffers == 2) {
+      // The payload wraps around the end of the ringbuffer, which can't happen
+      // if it's double mapped.
+      TP_DCHECK(!inbox.isDataDoubleMapped());
+      allocateBuffer();
+      std::memcpy(ptr_, buffers[0].ptr, buffers[0].len);
+      std::memcpy(
+          reinterpret_cast<uint8_t*>(ptr_) + buffers[0].len,
+          buffers[1].ptr,
+          buffers[1].len);
+      return len_;
+    }
+    if (numBuffers != -ENODATA && numBuffers != 0) {
+      return numBuffers;
+    }
+  }
+
+  // Not all the payload is there yet (or it can't ever fit in the ringbuffer):
+  // copy it out progressively.
+  allocateBuffer();
+  return inbox.template readInTx</*AllowPartial=*/true>(ptr_, len_);
+}
+
+void RingbufferReadOperation::handleEagerRead(const void* ptr, size_t len) {
+  TP_DCHECK(awaitingLength());
+  mode_ = READ_PAYLOAD;
+  if (nopObject_ != nullptr) {
+    len_ = len;
+    NopReader reader(reinterpret_cast<const uint8_t*>(ptr), len);
+    nop::Status<void> status = nopObject_->read(reader);
+    TP_THROW_SYSTEM_IF(status.has_error(), EINVAL);
+  } else if (ptrProvided_) {
+    TP_DCHECK_EQ(len, len_);
+    std::memcpy(ptr_, ptr, len);
+  } else {
+    // Like a payload borrowed from the ringbuffer.
+    len_ = len;
+    bytesRead_ = len_;
+    calledWithBorrowedPtr_ = true;
+    fn_(Error::kSuccess, ptr, len_);
+    return;
+  }
+  bytesRead_ = len_;
+  fn_(Error::kSuccess, ptr_, len_);
+}
+
+void RingbufferReadOperation::allocateBuffer() {
+  buf_ = ReadBufferPool::allocate(bufferPool_, len_);
+  ptr_ = buf_.get();
+}
+
+template <typename TConsumer>
+ssize_t RingbufferReadOperation::readNopObject(TConsumer& inbox) {
   TP_THROW_ASSERT_IF(len_ > inbox.getSize());
 
   ssize_t numBuffers;
-  std::array<util::ringbuffer::Consumer::Buffer, 2> buffers;
+  std::array<typename TConsumer::Buffer, 2> buffers;
   std::tie(numBuffers, buffers) =
-      inbox.accessContiguousInTx</*AllowPartial=*/false>(len_);
+      inbox.template accessContiguousInTx</*AllowPartial=*/false>(len_);
   if (unlikely(numBuffers < 0)) {
     return numBuffers;
   }
-
-  NopReader reader(
-      buffers[0].ptr, buffers[0].len, buffers[1].ptr, buffers[1].len);
-  nop::Status<void> status = nopObject_->read(reader);
+  TP_DCHECK(numBuffers <= 1 || !inbox.isDataDoubleMapped());
+
+  nop::Status<void> status;
+  if (likely(numBuffers <= 1)) {
+    NopReader reader(buffers[0].ptr, buffers[0].len);
+    status = nopObject_->read(reader);
+  } else {
+    NopReader reader(
+        buffers[0].ptr, buffers[0].len, buffers[1].ptr, buffers[1].len);
+    status = nopObject_->read(reader);
+  }
   if (status.error() == nop::ErrorStatus::ReadLimitReached) {
     return -ENODATA;
   } else if (status.has_error()) {
@@ -210,6 +439,13 @@ ssize_t RingbufferReadOperation::readNopObject(
   return len_;
 }
 
+void RingbufferReadOperation::completeRendezvous() {
+  TP_DCHECK(awaitingRendezvous());
+  mode_ = READ_PAYLOAD;
+  bytesRead_ = len_;
+  fn_(Error::kSuccess, ptr_, len_);
+}
+
 void RingbufferReadOperation::handleError(const Error& error) {
   fn_(error, nullptr, 0);
 }
@@ -218,15 +454,32 @@ RingbufferWriteOperation::RingbufferWriteOperation(
     const void* ptr,
     size_t len,
     write_callback_fn fn)
-    : ptr_(ptr), len_(len), fn_(std::move(fn)) {}
+    : fn_(std::move(fn)) {
+  segments_.push_back(Segment{ptr, nullptr, len});
+}
 
 RingbufferWriteOperation::RingbufferWriteOperation(
     const AbstractNopHolder* nopObject,
     write_callback_fn fn)
-    : nopObject_(nopObject), len_(nopObject_->getSize()), fn_(std::move(fn)) {}
+    : fn_(std::move(fn)) {
+  segments_.push_back(Segment{nullptr, nopObject, nopObject->getSize()});
+}
 
-size_t RingbufferWriteOperation::handleWrite(
-    util::ringbuffer::Producer& outbox) {
+RingbufferWriteOperation::RingbufferWriteOperation(
+    const AbstractNopHolder* nopObject,
+    const std::vector<std::tuple<const void*, size_t>>& buffers,
+    write_callback_fn fn)
+    : fn_(std::move(fn)) {
+  segments_.reserve(buffers.size() + 1);
+  segments_.push_back(Segment{nullptr, nopObject, nopObject->getSize()});
+  for (const auto& buffer : buffers) {
+    segments_.push_back(
+        Segment{std::get<0>(buffer), nullptr, std::get<1>(buffer)});
+  }
+}
+
+template <typename TProducer>
+size_t RingbufferWriteOperation::handleWrite(TProducer& outbox) {
   ssize_t ret;
   size_t bytesWrittenNow = 0;
 
@@ -236,31 +489,49 @@ size_t RingbufferWriteOperation::handleWrite(
   ret = outbox.startTx();
   TP_THROW_SYSTEM_IF(ret < 0, -ret);
 
-  if (mode_ == WRITE_LENGTH) {
-    uint32_t length = len_;
-    ret = outbox.writeInTx</*AllowPartial=*/false>(&length, sizeof(length));
-    if (likely(ret >= 0)) {
-      mode_ = WRITE_PAYLOAD;
-      bytesWrittenNow += ret;
-    } else if (unlikely(ret != -ENOSPC)) {
-      TP_THROW_SYSTEM(-ret);
+  while (segmentIdx_ < segments_.size() && mode_ != AWAIT_RENDEZVOUS) {
+    const Segment& segment = segments_[segmentIdx_];
+
+    if (mode_ == WRITE_LENGTH) {
+      uint32_t length = segment.len;
+      ret = outbox.template writeInTx</*AllowPartial=*/false>(
+          &length, sizeof(length));
+      if (likely(ret >= 0)) {
+        bytesWrittenNow += ret;
+        if (segment.nopObject == nullptr &&
+            segment.len >= rendezvousThreshold_) {
+          mode_ = AWAIT_RENDEZVOUS;
+          break;
+        }
+        mode_ = WRITE_PAYLOAD;
+      } else if (unlikely(ret != -ENOSPC)) {
+        TP_THROW_SYSTEM(-ret);
+      } else {
+        break;
+      }
     }
-  }
 
-  if (mode_ == WRITE_PAYLOAD) {
-    if (nopObject_ != nullptr) {
-      ret = writeNopObject(outbox);
-    } else {
-      ret = outbox.writeInTx</*AllowPartial=*/true>(
-          reinterpret_cast<const uint8_t*>(ptr_) + bytesWritten_,
-          len_ - bytesWritten_);
-    }
-    if (likely(ret >= 0)) {
-      bytesWritten_ += ret;
-      bytesWrittenNow += ret;
-    } else if (unlikely(ret != -ENOSPC)) {
-      TP_THROW_SYSTEM(-ret);
+    if (mode_ == WRITE_PAYLOAD) {
+      if (segment.nopObject != nullptr) {
+        ret = writeNopObject(outbox, segment);
+      } else {
+        ret = writeBuffer(outbox, segment);
+      }
+      if (likely(ret >= 0)) {
+        bytesWritten_ += ret;
+        bytesWrittenNow += ret;
+      } else if (unlikely(ret != -ENOSPC)) {
+        TP_THROW_SYSTEM(-ret);
+      }
+      if (bytesWritten_ < segment.len) {
+        // The ringbuffer is full.
+        break;
+      }
     }
+
+    segmentIdx_++;
+    mode_ = WRITE_LENGTH;
+    bytesWritten_ = 0;
   }
 
   ret = outbox.commitTx();
@@ -273,28 +544,89 @@ size_t RingbufferWriteOperation::handleWrite(
   return bytesWrittenNow;
 }
 
+size_t RingbufferWriteOperation::handleEagerWrite(void* ptr, size_t maxLen) {
+  if (segments_.size() != 1 || segmentIdx_ != 0 || mode_ != WRITE_LENGTH) {
+    return 0;
+  }
+  const Segment& segment = segments_[0];
+  if (segment.len == 0 || segment.len > maxLen ||
+      (segment.nopObject == nullptr && segment.len >= rendezvousThreshold_)) {
+    return 0;
+  }
+  if (segment.nopObject != nullptr) {
+    NopWriter writer(reinterpret_cast<uint8_t*>(ptr), segment.len);
+    nop::Status<void> status = segment.nopObject->write(writer);
+    TP_THROW_SYSTEM_IF(status.has_error(), EINVAL);
+  } else {
+    std::memcpy(ptr, segment.ptr, segment.len);
+  }
+  segmentIdx_++;
+  fn_(Error::kSuccess);
+  return segment.len;
+}
+
+void RingbufferWriteOperation::completeRendezvous() {
+  TP_DCHECK(awaitingRendezvous());
+  segmentIdx_++;
+  mode_ = WRITE_LENGTH;
+  bytesWritten_ = 0;
+}
+
+template <typename TProducer>
 ssize_t RingbufferWriteOperation::writeNopObject(
-    util::ringbuffer::Producer& outbox) {
-  TP_THROW_ASSERT_IF(len_ > outbox.getSize());
+    TProducer& outbox,
+    const Segment& segment) {
+  TP_THROW_ASSERT_IF(segment.len > outbox.getSize());
 
   ssize_t numBuffers;
-  std::array<util::ringbuffer::Producer::Buffer, 2> buffers;
+  std::array<typename TProducer::Buffer, 2> buffers;
   std::tie(numBuffers, buffers) =
-      outbox.accessContiguousInTx</*AllowPartial=*/false>(len_);
+      outbox.template accessContiguousInTx</*AllowPartial=*/false>(segment.len);
   if (unlikely(numBuffers < 0)) {
     return numBuffers;
   }
-
-  NopWriter writer(
-      buffers[0].ptr, buffers[0].len, buffers[1].ptr, buffers[1].len);
-  nop::Status<void> status = nopObject_->write(writer);
+  TP_DCHECK(numBuffers <= 1 || !outbox.isDataDoubleMapped());
+
+  nop::Status<void> status;
+  if (likely(numBuffers <= 1)) {
+    NopWriter writer(buffers[0].ptr, buffers[0].len);
+    status = segment.nopObject->write(writer);
+  } else {
+    NopWriter writer(
+        buffers[0].ptr, buffers[0].len, buffers[1].ptr, buffers[1].len);
+    status = segment.nopObject->write(writer);
+  }
   if (status.error() == nop::ErrorStatus::WriteLimitReached) {
     return -ENOSPC;
   } else if (status.has_error()) {
     return -EINVAL;
   }
 
-  return len_;
+  return segment.len;
+}
+
+template <typename TProducer>
+ssize_t RingbufferWriteOperation::writeBuffer(
+    TProducer& outbox,
+    const Segment& segment) {
+  ssize_t numBuffers;
+  std::array<typename TProducer::Buffer, 2> buffers;
+  std::tie(numBuffers, buffers) =
+      outbox.template accessContiguousInTx</*AllowPartial=*/true>(
+          segment.len - bytesWritten_);
+  if (unlikely(numBuffers <= 0)) {
+    return numBuffers;
+  }
+
+  const uint8_t* ptr =
+      reinterpret_cast<const uint8_t*>(segment.ptr) + bytesWritten_;
+  size_t len = 0;
+  for (ssize_t bufferIdx = 0; bufferIdx < numBuffers; bufferIdx++) {
+    copyMemory(buffers[bufferIdx].ptr, ptr + len, buffers[bufferIdx].len);
+    len += buffers[bufferIdx].len;
+  }
+
+  return len;
 }
 
 void RingbufferWriteOperation::handleError(const Error& error) {
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/serial_executor.h>
+
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+SerialExecutor::SerialExecutor(TExecutor executor)
+    : executor_(std::move(executor)) {
+  TP_THROW_ASSERT_IF(!executor_) << "An executor is needed";
+}
+
+void SerialExecutor::submit(TTask task) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+    if (running_) {
+      return;
+    }
+    running_ = true;
+  }
+  executor_([self{shared_from_this()}]() { self->runTasks(); });
+}
+
+void SerialExecutor::runTasks() {
+  while (true) {
+    TTask task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (tasks_.empty()) {
+        running_ = false;
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+} // namespace tensorpipe
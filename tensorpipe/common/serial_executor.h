@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include <tensorpipe/common/function.h>
+
+namespace tensorpipe {
+
+// Runs the tasks it's given one at a time and in the order they were given, on
+// top of an executor that may run its tasks concurrently and in any order (such
+// as a WorkerPool). This is what keeps the callbacks of a pipe in order when
+// they're moved off its event loop. At most one task of a serial executor is
+// in the underlying executor at any time, and it then runs all the tasks that
+// were queued up behind it. It must be owned by a shared_ptr, as that task
+// keeps it alive.
+class SerialExecutor : public std::enable_shared_from_this<SerialExecutor> {
+ public:
+  using TTask = MoveOnlyFunction<void()>;
+  using TExecutor = std::function<void(TTask)>;
+
+  explicit SerialExecutor(TExecutor executor);
+
+  SerialExecutor(const SerialExecutor&) = delete;
+  SerialExecutor(SerialExecutor&&) = delete;
+  SerialExecutor& operator=(const SerialExecutor&) = delete;
+  SerialExecutor& operator=(SerialExecutor&&) = delete;
+
+  // Thread-safe.
+  void submit(TTask task);
+
+ private:
+  const TExecutor executor_;
+
+  std::mutex mutex_;
+  std::deque<TTask> tasks_;
+  bool running_{false};
+
+  void runTasks();
+};
+
+} // namespace tensorpipe
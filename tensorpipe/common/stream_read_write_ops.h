@@ -8,7 +8,9 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cstddef>
 #include <functional>
 #include <memory>
 #include <tuple>
@@ -16,10 +18,40 @@
 
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
 #include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/read_buffer_pool.h>
 
 namespace tensorpipe {
 
+// The maximum number of streams that a connection can be made of.
+constexpr size_t kMaxNumStreams = 16;
+
+// How the payloads are spread over several streams (e.g., TCP connections) that
+// are used together as a single one, to get more throughput than any of them
+// provides on its own. The header with the length of a payload always goes on
+// the first stream. Payloads of at least minStripedLength bytes are then split
+// in numStreams contiguous chunks of (about) the same size, one per stream, in
+// order, whereas smaller ones go entirely on the first stream. Since the split
+// only depends on the length, and all the streams carry their chunks in the
+// order of the payloads, the chunks don't need any framing of their own.
+struct StreamStriping {
+  size_t numStreams{1};
+  size_t minStripedLength{0};
+
+  // Return the offset and the length of the chunk of a payload of the given
+  // length that the given stream carries (which may be empty).
+  std::tuple<size_t, size_t> getChunk(size_t length, size_t streamIdx) const {
+    if (numStreams == 1 || length < minStripedLength) {
+      return std::make_tuple(size_t(0), streamIdx == 0 ? length : 0);
+    }
+    const size_t chunkLength = (length + numStreams - 1) / numStreams;
+    const size_t begin = std::min(streamIdx * chunkLength, length);
+    const size_t end = std::min(begin + chunkLength, length);
+    return std::make_tuple(begin, end - begin);
+  }
+};
+
 // The read operation captures all state associated with reading a
 // fixed length chunk of data from the underlying connection. All
 // reads are required to include a word-sized header containing the
@@ -27,26 +59,57 @@ namespace tensorpipe {
 // read side of the connection to either 1) not know how many bytes
 // to expected, and dynamically allocate, or 2) know how many bytes
 // to expect, and preallocate the destination memory.
+//
+// If the connection is made of several streams, the streams other than the
+// first one only have something to read for this operation once the length is
+// known. Each stream must be done with an operation before moving to the next.
 class StreamReadOperation {
-  enum Mode {
-    READ_LENGTH,
-    READ_PAYLOAD,
-    COMPLETE,
-  };
-
  public:
   using read_callback_fn =
-      std::function<void(const Error& error, const void* ptr, size_t len)>;
+      MoveOnlyFunction<void(const Error& error, const void* ptr, size_t len)>;
+
+  inline explicit StreamReadOperation(
+      read_callback_fn fn,
+      StreamStriping striping = StreamStriping());
+
+  inline StreamReadOperation(
+      void* ptr,
+      size_t length,
+      read_callback_fn fn,
+      StreamStriping striping = StreamStriping());
+
+  // The pool to take the temporary buffer from, if no length was specified. It
+  // must outlive the operation.
+  inline void setBufferPool(ReadBufferPool* pool);
+
+  // Returns whether the stream can read data for this operation right now.
+  inline bool canReadFromLoop(size_t streamIdx) const;
+
+  // Returns whether the stream has no more data to read for this operation.
+  inline bool doneFromLoop(size_t streamIdx) const;
 
-  explicit inline StreamReadOperation(read_callback_fn fn);
+  // Returns how many bytes the stream still has to read for this operation, as
+  // far as it's known (i.e., only those of the length until it is).
+  inline size_t bytesLeftFromLoop(size_t streamIdx) const;
 
-  inline StreamReadOperation(void* ptr, size_t length, read_callback_fn fn);
+  // Returns the length of the payload, once the header has been read.
+  inline optional<size_t> lengthFromLoop() const;
 
   // Called when a buffer is needed to read data from stream.
-  inline void allocFromLoop(char** base, size_t* len);
+  inline void allocFromLoop(size_t streamIdx, char** base, size_t* len);
 
   // Called when data has been read from stream.
-  inline void readFromLoop(size_t nread);
+  inline void readFromLoop(size_t streamIdx, size_t nread);
+
+  // Returns whether the rest of the data of this operation is available, in a
+  // buffer of the given length, for it to be handed to the callback as is,
+  // without being copied, because the operation has no destination of its own
+  // and the stream carries all of its data.
+  inline bool canReadInPlaceFromLoop(size_t streamIdx, size_t len) const;
+
+  // Called instead of allocFromLoop and readFromLoop when the data can be read
+  // in place. The data must remain valid until the callback returns.
+  inline void readInPlaceFromLoop(size_t streamIdx, const char* ptr);
 
   // Returns if this read operation is complete.
   inline bool completeFromLoop() const;
@@ -55,7 +118,8 @@ class StreamReadOperation {
   inline void callbackFromLoop(const Error& error);
 
  private:
-  Mode mode_{READ_LENGTH};
+  const StreamStriping striping_;
+
   char* ptr_{nullptr};
 
   // Number of bytes as specified by the user (if applicable).
@@ -64,76 +128,161 @@ class StreamReadOperation {
   // Number of bytes to expect as read from the connection.
   size_t readLength_{0};
 
-  // Number of bytes read from the connection.
-  // This is reset to 0 when we advance from READ_LENGTH to READ_PAYLOAD.
-  size_t bytesRead_{0};
+  // Number of bytes of the length that were read from the first stream.
+  size_t lengthBytesRead_{0};
+
+  // Number of bytes of its chunk of the payload read from each stream.
+  std::array<size_t, kMaxNumStreams> bytesRead_{};
 
   // Holds temporary allocation if no length was specified.
-  std::unique_ptr<char[]> buffer_{nullptr};
+  ReadBufferPool::Buffer buffer_;
+  ReadBufferPool* bufferPool_{nullptr};
 
   // User callback.
   read_callback_fn fn_;
+
+  inline bool lengthKnown() const;
+
+  // Allocate the temporary buffer, if it's needed and it wasn't done yet.
+  inline void allocBufferIfNeeded();
 };
 
-StreamReadOperation::StreamReadOperation(read_callback_fn fn)
-    : fn_(std::move(fn)) {}
+StreamReadOperation::StreamReadOperation(
+    read_callback_fn fn,
+    StreamStriping striping)
+    : striping_(striping), fn_(std::move(fn)) {}
 
 StreamReadOperation::StreamReadOperation(
     void* ptr,
     size_t length,
-    read_callback_fn fn)
-    : ptr_(static_cast<char*>(ptr)), givenLength_(length), fn_(std::move(fn)) {}
-
-void StreamReadOperation::allocFromLoop(char** base, size_t* len) {
-  if (mode_ == READ_LENGTH) {
-    TP_DCHECK_LT(bytesRead_, sizeof(readLength_));
-    *base = reinterpret_cast<char*>(&readLength_) + bytesRead_;
-    *len = sizeof(readLength_) - bytesRead_;
-  } else if (mode_ == READ_PAYLOAD) {
-    TP_DCHECK_LT(bytesRead_, readLength_);
-    TP_DCHECK(ptr_ != nullptr);
-    *base = ptr_ + bytesRead_;
-    *len = readLength_ - bytesRead_;
+    read_callback_fn fn,
+    StreamStriping striping)
+    : striping_(striping),
+      ptr_(static_cast<char*>(ptr)),
+      givenLength_(length),
+      fn_(std::move(fn)) {}
+
+void StreamReadOperation::setBufferPool(ReadBufferPool* pool) {
+  bufferPool_ = pool;
+}
+
+bool StreamReadOperation::lengthKnown() const {
+  return lengthBytesRead_ == sizeof(readLength_);
+}
+
+void StreamReadOperation::allocBufferIfNeeded() {
+  if (lengthKnown() && !givenLength_.has_value() && ptr_ == nullptr) {
+    buffer_ = ReadBufferPool::allocate(bufferPool_, readLength_);
+    ptr_ = reinterpret_cast<char*>(buffer_.get());
+  }
+}
+
+bool StreamReadOperation::canReadFromLoop(size_t streamIdx) const {
+  return (streamIdx == 0 || lengthKnown()) && !doneFromLoop(streamIdx);
+}
+
+bool StreamReadOperation::doneFromLoop(size_t streamIdx) const {
+  if (!lengthKnown()) {
+    return false;
+  }
+  size_t chunkLength;
+  std::tie(std::ignore, chunkLength) =
+      striping_.getChunk(readLength_, streamIdx);
+  return bytesRead_[streamIdx] == chunkLength;
+}
+
+size_t StreamReadOperation::bytesLeftFromLoop(size_t streamIdx) const {
+  if (!lengthKnown()) {
+    return streamIdx == 0 ? sizeof(readLength_) - lengthBytesRead_ : 0;
+  }
+  return std::get<1>(striping_.getChunk(readLength_, streamIdx)) -
+      bytesRead_[streamIdx];
+}
+
+optional<size_t> StreamReadOperation::lengthFromLoop() const {
+  if (!lengthKnown()) {
+    return nullopt;
+  }
+  return readLength_;
+}
+
+void StreamReadOperation::allocFromLoop(
+    size_t streamIdx,
+    char** base,
+    size_t* len) {
+  TP_DCHECK(canReadFromLoop(streamIdx));
+  if (!lengthKnown()) {
+    *base = reinterpret_cast<char*>(&readLength_) + lengthBytesRead_;
+    *len = sizeof(readLength_) - lengthBytesRead_;
   } else {
-    TP_THROW_ASSERT() << "invalid mode " << mode_;
+    // The buffer is only allocated once there's data to put in it, as the data
+    // may instead be read in place.
+    allocBufferIfNeeded();
+    TP_DCHECK(ptr_ != nullptr);
+    size_t chunkOffset;
+    size_t chunkLength;
+    std::tie(chunkOffset, chunkLength) =
+        striping_.getChunk(readLength_, streamIdx);
+    TP_DCHECK_LT(bytesRead_[streamIdx], chunkLength);
+    *base = ptr_ + chunkOffset + bytesRead_[streamIdx];
+    *len = chunkLength - bytesRead_[streamIdx];
   }
 }
 
-void StreamReadOperation::readFromLoop(size_t nread) {
-  bytesRead_ += nread;
-  if (mode_ == READ_LENGTH) {
-    TP_DCHECK_LE(bytesRead_, sizeof(readLength_));
-    if (bytesRead_ == sizeof(readLength_)) {
+void StreamReadOperation::readFromLoop(size_t streamIdx, size_t nread) {
+  if (!lengthKnown()) {
+    TP_DCHECK_EQ(streamIdx, 0);
+    lengthBytesRead_ += nread;
+    TP_DCHECK_LE(lengthBytesRead_, sizeof(readLength_));
+    if (lengthKnown()) {
       if (givenLength_.has_value()) {
         TP_DCHECK(ptr_ != nullptr || givenLength_.value() == 0);
         TP_DCHECK_EQ(readLength_, givenLength_.value());
       } else {
         TP_DCHECK(ptr_ == nullptr);
-        buffer_ = std::make_unique<char[]>(readLength_);
-        ptr_ = buffer_.get();
       }
-      if (readLength_ == 0) {
-        mode_ = COMPLETE;
-      } else {
-        mode_ = READ_PAYLOAD;
-      }
-      bytesRead_ = 0;
-    }
-  } else if (mode_ == READ_PAYLOAD) {
-    TP_DCHECK_LE(bytesRead_, readLength_);
-    if (bytesRead_ == readLength_) {
-      mode_ = COMPLETE;
     }
   } else {
-    TP_THROW_ASSERT() << "invalid mode " << mode_;
+    bytesRead_[streamIdx] += nread;
+    TP_DCHECK(
+        bytesRead_[streamIdx] <=
+        std::get<1>(striping_.getChunk(readLength_, streamIdx)));
+  }
+}
+
+bool StreamReadOperation::canReadInPlaceFromLoop(
+    size_t streamIdx,
+    size_t len) const {
+  if (!canReadFromLoop(streamIdx) || !lengthKnown() ||
+      givenLength_.has_value() || ptr_ != nullptr) {
+    return false;
   }
+  size_t chunkLength;
+  std::tie(std::ignore, chunkLength) =
+      striping_.getChunk(readLength_, streamIdx);
+  return chunkLength == readLength_ && readLength_ <= len;
+}
+
+void StreamReadOperation::readInPlaceFromLoop(
+    size_t streamIdx,
+    const char* ptr) {
+  TP_DCHECK(canReadInPlaceFromLoop(streamIdx, readLength_));
+  ptr_ = const_cast<char*>(ptr);
+  bytesRead_[streamIdx] = readLength_;
 }
 
 bool StreamReadOperation::completeFromLoop() const {
-  return mode_ == COMPLETE;
+  for (size_t streamIdx = 0; streamIdx < striping_.numStreams; streamIdx++) {
+    if (!doneFromLoop(streamIdx)) {
+      return false;
+    }
+  }
+  return true;
 }
 
 void StreamReadOperation::callbackFromLoop(const Error& error) {
+  // Empty payloads don't need a buffer, but still get a valid pointer.
+  allocBufferIfNeeded();
   fn_(error, ptr_, readLength_);
 }
 
@@ -143,32 +292,53 @@ void StreamReadOperation::callbackFromLoop(const Error& error) {
 // write. This header is a member field on this class and therefore
 // the instance must be kept alive and the reference to the instance
 // must remain valid until the write callback has been called.
+//
+// If the connection is made of several streams, the operation is only done once
+// the writes of all the streams that carry some of its data are complete.
 class StreamWriteOperation {
  public:
-  using write_callback_fn = std::function<void(const Error& error)>;
+  using write_callback_fn = MoveOnlyFunction<void(const Error& error)>;
 
   inline StreamWriteOperation(
       const void* ptr,
       size_t length,
-      write_callback_fn fn);
+      write_callback_fn fn,
+      StreamStriping striping = StreamStriping());
 
   struct Buf {
     char* base;
     size_t len;
   };
 
-  inline std::tuple<Buf*, size_t> getBufs();
+  // Returns whether the given stream carries some data of this operation.
+  inline bool usesStream(size_t streamIdx) const;
+
+  // Returns the buffers to write to the given stream (possibly none). They are
+  // only valid until the next call.
+  inline std::tuple<Buf*, size_t> getBufs(size_t streamIdx = 0);
+
+  // Called when a write carrying some of the data of this operation has been
+  // issued, and when it completes.
+  inline void writeIssuedFromLoop();
+  inline void writeCompletedFromLoop();
+
+  // Returns if all the writes of this operation are complete.
+  inline bool completeFromLoop() const;
 
   // Invoke user callback.
   inline void callbackFromLoop(const Error& error);
 
  private:
+  const StreamStriping striping_;
   const char* ptr_;
   const size_t length_;
 
   // Buffers (structs with pointers and lengths) to write to stream.
   std::array<Buf, 2> bufs_;
 
+  // Number of writes issued for this operation that aren't complete yet.
+  size_t numPendingWrites_{0};
+
   // User callback.
   write_callback_fn fn_;
 };
@@ -176,19 +346,51 @@ class StreamWriteOperation {
 StreamWriteOperation::StreamWriteOperation(
     const void* ptr,
     size_t length,
-    write_callback_fn fn)
-    : ptr_(static_cast<const char*>(ptr)), length_(length), fn_(std::move(fn)) {
-  bufs_[0].base = const_cast<char*>(reinterpret_cast<const char*>(&length_));
-  bufs_[0].len = sizeof(length_);
-  bufs_[1].base = const_cast<char*>(ptr_);
-  bufs_[1].len = length_;
+    write_callback_fn fn,
+    StreamStriping striping)
+    : striping_(striping),
+      ptr_(static_cast<const char*>(ptr)),
+      length_(length),
+      fn_(std::move(fn)) {}
+
+bool StreamWriteOperation::usesStream(size_t streamIdx) const {
+  return streamIdx == 0 ||
+      std::get<1>(striping_.getChunk(length_, streamIdx)) > 0;
 }
 
-std::tuple<StreamWriteOperation::Buf*, size_t> StreamWriteOperation::getBufs() {
-  size_t numBuffers = length_ == 0 ? 1 : 2;
+std::tuple<StreamWriteOperation::Buf*, size_t> StreamWriteOperation::getBufs(
+    size_t streamIdx) {
+  size_t chunkOffset;
+  size_t chunkLength;
+  std::tie(chunkOffset, chunkLength) = striping_.getChunk(length_, streamIdx);
+  size_t numBuffers = 0;
+  if (streamIdx == 0) {
+    bufs_[numBuffers].base =
+        const_cast<char*>(reinterpret_cast<const char*>(&length_));
+    bufs_[numBuffers].len = sizeof(length_);
+    numBuffers++;
+  }
+  if (chunkLength > 0) {
+    bufs_[numBuffers].base = const_cast<char*>(ptr_) + chunkOffset;
+    bufs_[numBuffers].len = chunkLength;
+    numBuffers++;
+  }
   return std::make_tuple(bufs_.data(), numBuffers);
 }
 
+void StreamWriteOperation::writeIssuedFromLoop() {
+  numPendingWrites_++;
+}
+
+void StreamWriteOperation::writeCompletedFromLoop() {
+  TP_DCHECK_GT(numPendingWrites_, 0);
+  numPendingWrites_--;
+}
+
+bool StreamWriteOperation::completeFromLoop() const {
+  return numPendingWrites_ == 0;
+}
+
 void StreamWriteOperation::callbackFromLoop(const Error& error) {
   fn_(error);
 }
@@ -10,8 +10,11 @@
 
 #ifdef __linux__
 #include <linux/capability.h>
+#include <linux/mempolicy.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 #endif
@@ -20,6 +23,7 @@
 #include <IOKit/IOKitLib.h>
 #endif
 
+#include <algorithm>
 #include <array>
 #include <cstring>
 #include <fstream>
@@ -29,6 +33,8 @@
 #include <system_error>
 #include <thread>
 
+#include <tensorpipe/common/error_macros.h>
+
 #ifdef __linux__
 
 // This is a libc wrapper for the Linux syscall.
@@ -147,13 +153,15 @@ optional<std::string> getBootID() {
 
 #ifdef __linux__
 
+namespace {
+
 // According to namespaces(7):
 // > Each process has a /proc/[pid]/ns/ subdirectory containing one entry for
 // > each namespace [...]. If two processes are in the same namespace, then the
 // > device IDs and inode numbers of their /proc/[pid]/ns/xxx symbolic links
 // > will be the same; an application can check this using the stat.st_dev and
 // > stat.st_ino fields returned by stat(2).
-optional<std::string> getLinuxNamespaceId(LinuxNamespace ns) {
+optional<std::string> getLinuxNamespaceIdInternal(LinuxNamespace ns) {
   struct stat statInfo;
   int rv = ::stat(getPathForLinuxNamespace(ns).c_str(), &statInfo);
   TP_THROW_SYSTEM_IF(rv < 0, errno);
@@ -171,7 +179,7 @@ optional<std::string> getLinuxNamespaceId(LinuxNamespace ns) {
 // According to https://www.kernel.org/doc/Documentation/security/LSM.txt:
 // > A list of the active security modules can be found by reading
 // > /sys/kernel/security/lsm. This is a comma separated list [...].
-optional<std::vector<std::string>> getLinuxSecurityModules() {
+optional<std::vector<std::string>> getLinuxSecurityModulesInternal() {
   std::ifstream f{"/sys/kernel/security/lsm"};
   if (f.fail()) {
     return nullopt;
@@ -192,7 +200,7 @@ optional<std::vector<std::string>> getLinuxSecurityModules() {
 
 // See ptrace(2) (the sections towards the end) and
 // https://www.kernel.org/doc/Documentation/security/Yama.txt
-optional<YamaPtraceScope> getYamaPtraceScope() {
+optional<YamaPtraceScope> getYamaPtraceScopeInternal() {
   std::ifstream f{"/proc/sys/kernel/yama/ptrace_scope"};
   if (f.fail()) {
     return nullopt;
@@ -218,7 +226,7 @@ optional<YamaPtraceScope> getYamaPtraceScope() {
   }
 }
 
-optional<std::string> getPermittedCapabilitiesID() {
+optional<std::string> getPermittedCapabilitiesIDInternal() {
   std::remove_pointer<cap_user_header_t>::type header;
   std::array<std::remove_pointer<cap_user_data_t>::type, 2> data;
 
@@ -248,6 +256,56 @@ optional<std::string> getPermittedCapabilitiesID() {
   return oss.str();
 }
 
+} // namespace
+
+// Contexts (and their transports and channels) probe these each time they're
+// created, even though they don't change during the life of the process, hence
+// they're only looked up once (per namespace type, for the namespaces).
+optional<std::string> getLinuxNamespaceId(LinuxNamespace ns) {
+  switch (ns) {
+    case LinuxNamespace::kIpc: {
+      static optional<std::string> ipcNsId =
+          getLinuxNamespaceIdInternal(LinuxNamespace::kIpc);
+      return ipcNsId;
+    }
+    case LinuxNamespace::kNet: {
+      static optional<std::string> netNsId =
+          getLinuxNamespaceIdInternal(LinuxNamespace::kNet);
+      return netNsId;
+    }
+    case LinuxNamespace::kPid: {
+      static optional<std::string> pidNsId =
+          getLinuxNamespaceIdInternal(LinuxNamespace::kPid);
+      return pidNsId;
+    }
+    case LinuxNamespace::kUser: {
+      static optional<std::string> userNsId =
+          getLinuxNamespaceIdInternal(LinuxNamespace::kUser);
+      return userNsId;
+    }
+    default:
+      TP_THROW_ASSERT() << "Unknown namespace";
+      // Dummy return to make the compiler happy.
+      return nullopt;
+  }
+}
+
+optional<std::vector<std::string>> getLinuxSecurityModules() {
+  static optional<std::vector<std::string>> lsms =
+      getLinuxSecurityModulesInternal();
+  return lsms;
+}
+
+optional<YamaPtraceScope> getYamaPtraceScope() {
+  static optional<YamaPtraceScope> yamaScope = getYamaPtraceScopeInternal();
+  return yamaScope;
+}
+
+optional<std::string> getPermittedCapabilitiesID() {
+  static optional<std::string> caps = getPermittedCapabilitiesIDInternal();
+  return caps;
+}
+
 #endif
 
 void setThreadName(std::string name) {
@@ -256,4 +314,142 @@ void setThreadName(std::string name) {
 #endif
 }
 
+optional<std::vector<int>> getCpusOfNumaNode(int numaNode) {
+  std::ifstream f(
+      "/sys/devices/system/node/node" + std::to_string(numaNode) + "/cpulist");
+  if (!f.is_open()) {
+    return nullopt;
+  }
+  // The list is made of comma-separated ranges, like "0-3,8-11" or "5".
+  std::vector<int> cpus;
+  std::string range;
+  while (std::getline(f, range, ',')) {
+    std::istringstream iss(range);
+    int first;
+    int last;
+    if (!(iss >> first)) {
+      continue;
+    }
+    if (iss.get() == '-') {
+      if (!(iss >> last)) {
+        return nullopt;
+      }
+    } else {
+      last = first;
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+int getNumaNodeOfCurrentCpu() {
+#ifdef __linux__
+  // The glibc wrapper only appeared in version 2.29.
+  unsigned int cpu;
+  unsigned int numaNode;
+  long rv = ::syscall(SYS_getcpu, &cpu, &numaNode, nullptr);
+  if (rv < 0) {
+    return -1;
+  }
+  return static_cast<int>(numaNode);
+#else
+  return -1;
+#endif
+}
+
+int getNumaNodeOfPciDevice(std::string busId) {
+  // sysfs lists the hex digits of the IDs in lowercase.
+  std::transform(busId.begin(), busId.end(), busId.begin(), [](char c) {
+    return ('A' <= c && c <= 'F') ? static_cast<char>(c - 'A' + 'a') : c;
+  });
+  std::ifstream f("/sys/bus/pci/devices/" + busId + "/numa_node");
+  int numaNode = -1;
+  if (!(f >> numaNode)) {
+    return -1;
+  }
+  return numaNode;
+}
+
+Error bindMemoryToNumaNode(void* ptr, size_t length, int numaNode) {
+#ifdef __linux__
+  TP_DCHECK_GE(numaNode, 0);
+  // We invoke the syscall directly to avoid depending on libnuma.
+  constexpr size_t kBitsPerWord = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> nodeMask(numaNode / kBitsPerWord + 1, 0);
+  nodeMask[numaNode / kBitsPerWord] |= 1ul << (numaNode % kBitsPerWord);
+  // The kernel only looks at the first maxnode - 1 bits of the mask.
+  const unsigned long maxNode = nodeMask.size() * kBitsPerWord + 1;
+  long rv = ::syscall(
+      SYS_mbind,
+      ptr,
+      length,
+      MPOL_PREFERRED,
+      nodeMask.data(),
+      maxNode,
+      MPOL_MF_MOVE);
+  if (rv < 0) {
+    return TP_CREATE_ERROR(SystemError, "mbind", errno);
+  }
+  return Error::kSuccess;
+#else
+  return TP_CREATE_ERROR(SystemError, "mbind", ENOSYS);
+#endif
+}
+
+void setUpThread(const ThreadOptions& options, std::string name) {
+  if (!options.getNamePrefix().empty() && name.compare(0, 2, "TP") == 0) {
+    name = options.getNamePrefix() + name.substr(2);
+  }
+  setThreadName(name);
+
+#ifdef __linux__
+  std::vector<int> cpus = options.getCpus();
+  if (options.getNumaNode() >= 0) {
+    optional<std::vector<int>> nodeCpus =
+        getCpusOfNumaNode(options.getNumaNode());
+    if (!nodeCpus.has_value()) {
+      TP_LOG_WARNING() << "Couldn't find the CPUs of NUMA node "
+                       << options.getNumaNode() << " for thread " << name;
+    } else if (cpus.empty()) {
+      cpus = std::move(nodeCpus.value());
+    } else {
+      std::vector<int> cpusOnNode;
+      for (int cpu : cpus) {
+        if (std::find(nodeCpus->begin(), nodeCpus->end(), cpu) !=
+            nodeCpus->end()) {
+          cpusOnNode.push_back(cpu);
+        }
+      }
+      TP_LOG_WARNING_IF(cpusOnNode.empty())
+          << "None of the CPUs of thread " << name << " are on NUMA node "
+          << options.getNumaNode();
+      cpus = std::move(cpusOnNode);
+    }
+  }
+  if (!cpus.empty()) {
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (int cpu : cpus) {
+      if (cpu >= 0 && cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &cpuSet);
+      }
+    }
+    int rv = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+    TP_LOG_WARNING_IF(rv != 0) << "Couldn't set the affinity of thread " << name
+                               << ": " << std::strerror(rv);
+  }
+  if (options.hasSchedPolicy()) {
+    struct sched_param param;
+    param.sched_priority = options.getSchedPriority();
+    int rv = pthread_setschedparam(
+        pthread_self(), options.getSchedPolicy(), &param);
+    TP_LOG_WARNING_IF(rv != 0)
+        << "Couldn't set the scheduling policy of thread " << name << ": "
+        << std::strerror(rv);
+  }
+#endif
+}
+
 } // namespace tensorpipe
@@ -17,7 +17,9 @@
 #include <vector>
 
 #include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error.h>
 #include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/thread_options.h>
 
 namespace tensorpipe {
 
@@ -97,7 +99,9 @@ enum class LinuxNamespace {
 };
 
 // Returns a string that uniquely identifies a namespace of a certain type.
-// It is only valid within the same machine and for that fixed type.
+// It is only valid within the same machine and for that fixed type. Like the
+// other probes below, it's only looked up once per process, hence it doesn't
+// reflect later changes (e.g., through setns(2) or capset(2)).
 optional<std::string> getLinuxNamespaceId(LinuxNamespace ns);
 
 // Returns the names of the active Linux Security Modules, in the order in which
@@ -126,4 +130,25 @@ optional<std::string> getPermittedCapabilitiesID();
 // Set the name of the current thread, if possible. Use only for debugging.
 void setThreadName(std::string name);
 
+// Return the CPUs of the given NUMA node, as listed by sysfs.
+optional<std::vector<int>> getCpusOfNumaNode(int numaNode);
+
+// Return the NUMA node of the CPU that the calling thread is running on, or -1
+// if unknown. The thread may be migrated right after, unless it's bound.
+int getNumaNodeOfCurrentCpu();
+
+// Return the NUMA node to which the PCI device with the given bus ID (e.g.,
+// "0000:3b:00.0", in either case) is attached, as listed by sysfs, or -1 if
+// unknown (which is also what the kernel reports on single-node machines).
+int getNumaNodeOfPciDevice(std::string busId);
+
+// Have the pages of the given (page-aligned) memory preferably be allocated on
+// the given NUMA node, moving those that were already allocated elsewhere.
+Error bindMemoryToNumaNode(void* ptr, size_t length, int numaNode);
+
+// To be called by the threads started by the contexts as they begin, with the
+// default name of the thread (which starts with "TP"). Failing to apply any of
+// the options only causes a warning, as the thread can still do its job.
+void setUpThread(const ThreadOptions& options, std::string name);
+
 } // namespace tensorpipe
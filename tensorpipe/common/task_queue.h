@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <utility>
+
+#include <tensorpipe/common/function.h>
+
+namespace tensorpipe {
+
+// The deferred tasks are stored inline in the queue's nodes.
+using Task = MoveOnlyFunction<void()>;
+
+// An unbounded multi-producer single-consumer queue of tasks, based on Dmitry
+// Vyukov's intrusive non-blocking design. Linking a task into the queue is a
+// single atomic exchange, after which the producer links the previous head to
+// its node. Popping is lock-free but only allowed from one thread at a time,
+// and may spuriously report the queue as empty if it catches a producer
+// between those two steps. Producers that will later notify the consumer
+// (after having pushed) thus guarantee that their task will be seen.
+//
+// The nodes are recycled rather than allocated on each push: the consumer
+// puts them back on a lock-free free list once it has run their task, from
+// which producers take them. They're carved out of slabs that the queue only
+// frees when it's destroyed, and that are only added (under a mutex) when the
+// free list runs dry, which after an initial warm-up stops happening.
+class MpscTaskQueue {
+ public:
+  using TTimePoint = std::chrono::steady_clock::time_point;
+
+  MpscTaskQueue() = default;
+
+  MpscTaskQueue(const MpscTaskQueue&) = delete;
+  MpscTaskQueue(MpscTaskQueue&&) = delete;
+  MpscTaskQueue& operator=(const MpscTaskQueue&) = delete;
+  MpscTaskQueue& operator=(MpscTaskQueue&&) = delete;
+
+  ~MpscTaskQueue() {
+    // Destroy the tasks that were never run.
+    while (Node* node = popNode()) {
+      releaseNode(node);
+    }
+    for (auto& slab : slabs_) {
+      delete[] slab.load(std::memory_order_relaxed);
+    }
+  }
+
+  // Thread-safe. The time of the push, if given, is handed back to the runner
+  // of runTasks along with the task.
+  void push(Task task, TTimePoint pushTime = TTimePoint()) {
+    Node* node = acquireNode();
+    node->task = std::move(task);
+    node->pushTime = pushTime;
+    pushNode(node);
+  }
+
+  // Run the tasks that were pushed before this call, but not the ones they (or
+  // other threads) push in the meantime, so that a task that keeps re-pushing
+  // itself can't starve the rest of the consumer's loop. Return how many tasks
+  // were run. Only to be called by the consumer.
+  size_t runTasks() {
+    return runTasks([](Task& task, TTimePoint /* unused */) { task(); });
+  }
+
+  // Same as above, but have the runner (a callable taking the task and the
+  // time of its push) run each task, e.g., to time it.
+  template <typename TRunner>
+  size_t runTasks(TRunner&& runner) {
+    // This is the last node that was pushed when we started. Comparing its
+    // address is safe as it can't be reused until we release it.
+    Node* last = head_.load(std::memory_order_acquire);
+    size_t numTasks = 0;
+    while (true) {
+      // If the stub was the last node, reaching it means we're done.
+      if (last == &stub_ && tail_ == &stub_) {
+        break;
+      }
+      Node* node = popNode();
+      if (node == nullptr) {
+        break;
+      }
+      const bool isLast = node == last;
+      runner(node->task, node->pushTime);
+      releaseNode(node);
+      numTasks++;
+      if (isLast) {
+        break;
+      }
+    }
+    return numTasks;
+  }
+
+ private:
+  // The nodes are referred to by their index in the free list, so that its
+  // head fits in a word along with a tag, which is bumped on every change to
+  // protect against ABA. Once all the slabs are used up, nodes are allocated
+  // (and freed) one by one, with an index of kNoNode.
+  static constexpr uint32_t kNodesPerSlab = 256;
+  static constexpr uint32_t kMaxNumSlabs = 1024;
+  static constexpr uint32_t kNoNode = std::numeric_limits<uint32_t>::max();
+
+  struct Node {
+    std::atomic<Node*> next{nullptr};
+    Task task;
+    TTimePoint pushTime;
+    uint32_t index{kNoNode};
+    // The node that follows this one in the free list, while it's in there.
+    std::atomic<uint32_t> nextFree{kNoNode};
+  };
+
+  static uint64_t makeFreeHead(uint64_t prevFreeHead, uint32_t index) {
+    return (((prevFreeHead >> 32) + 1) << 32) | index;
+  }
+
+  Node* nodeAt(uint32_t index) {
+    return slabs_[index / kNodesPerSlab].load(std::memory_order_acquire) +
+        index % kNodesPerSlab;
+  }
+
+  Node* acquireNode() {
+    uint64_t freeHead = freeHead_.load(std::memory_order_acquire);
+    while (static_cast<uint32_t>(freeHead) != kNoNode) {
+      Node* node = nodeAt(static_cast<uint32_t>(freeHead));
+      // The node may be taken (and even given back) by another producer in
+      // the meantime, in which case this is stale, but then the tag of the head
+      // has changed and the exchange below fails.
+      const uint32_t nextFree = node->nextFree.load(std::memory_order_relaxed);
+      if (freeHead_.compare_exchange_weak(
+              freeHead,
+              makeFreeHead(freeHead, nextFree),
+              std::memory_order_acquire,
+              std::memory_order_acquire)) {
+        return node;
+      }
+    }
+    return addSlab();
+  }
+
+  void releaseNode(Node* node) {
+    node->task = nullptr;
+    if (node->index == kNoNode) {
+      delete node;
+      return;
+    }
+    uint64_t freeHead = freeHead_.load(std::memory_order_relaxed);
+    do {
+      node->nextFree.store(
+          static_cast<uint32_t>(freeHead), std::memory_order_relaxed);
+    } while (!freeHead_.compare_exchange_weak(
+        freeHead,
+        makeFreeHead(freeHead, node->index),
+        std::memory_order_release,
+        std::memory_order_relaxed));
+  }
+
+  // Return a node from a new slab, and put the others on the free list.
+  Node* addSlab() {
+    std::unique_lock<std::mutex> lock(slabsMutex_);
+    if (numSlabs_ == kMaxNumSlabs) {
+      return new Node();
+    }
+    Node* slab = new Node[kNodesPerSlab];
+    for (uint32_t nodeIdx = 0; nodeIdx < kNodesPerSlab; nodeIdx++) {
+      slab[nodeIdx].index = numSlabs_ * kNodesPerSlab + nodeIdx;
+    }
+    slabs_[numSlabs_].store(slab, std::memory_order_release);
+    numSlabs_++;
+    lock.unlock();
+
+    for (uint32_t nodeIdx = 1; nodeIdx < kNodesPerSlab; nodeIdx++) {
+      releaseNode(&slab[nodeIdx]);
+    }
+    return &slab[0];
+  }
+
+  void pushNode(Node* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  Node* popNode() {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (next == nullptr) {
+        return nullptr;
+      }
+      tail_ = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+      tail_ = next;
+      return tail;
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+      // A producer has swapped the head but hasn't linked its node yet.
+      return nullptr;
+    }
+    // The tail is the only node: put the stub behind it so it can be detached.
+    pushNode(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+      tail_ = next;
+      return tail;
+    }
+    return nullptr;
+  }
+
+  // The stub is what keeps the queue from ever being truly empty, which is
+  // what allows producers to only ever touch the head.
+  Node stub_;
+  // Producers swap the head, whereas the consumer owns the tail. Keep them on
+  // separate cache lines to avoid false sharing.
+  alignas(64) std::atomic<Node*> head_{&stub_};
+  alignas(64) Node* tail_{&stub_};
+
+  // Both producers and the consumer update the head of the free list, which
+  // holds the index of its first node in its low half and the tag in its high
+  // half.
+  alignas(64) std::atomic<uint64_t> freeHead_{kNoNode};
+  std::mutex slabsMutex_;
+  uint32_t numSlabs_{0};
+  std::array<std::atomic<Node*>, kMaxNumSlabs> slabs_{};
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace tensorpipe {
+
+// How the transport and channel contexts set up the threads they start (such
+// as their event loops, reactors and copy threads), when those start. By
+// default the threads inherit the affinity and the scheduling policy of the
+// thread that created the context, and get a name starting with "TP".
+class ThreadOptions {
+ public:
+  // Start the names of the threads with this prefix instead of "TP". Note that
+  // Linux truncates the names of threads to 15 characters.
+  ThreadOptions&& namePrefix(std::string namePrefix) && {
+    namePrefix_ = std::move(namePrefix);
+    return std::move(*this);
+  }
+
+  // Only let the threads run on these CPUs, for example to keep reactors that
+  // busy-poll off the cores that run the compute threads.
+  ThreadOptions&& cpus(std::vector<int> cpus) && {
+    cpus_ = std::move(cpus);
+    return std::move(*this);
+  }
+
+  // Only let the threads run on the CPUs of this NUMA node. If CPUs are also
+  // given, the threads are restricted to those of them that are on the node.
+  // The shm and ibv transports also place their connections' ringbuffers on
+  // that node, so that the reactor accesses them locally.
+  ThreadOptions&& numaNode(int numaNode) && {
+    numaNode_ = numaNode;
+    return std::move(*this);
+  }
+
+  // Run the threads with this scheduling policy (e.g., SCHED_FIFO) and
+  // priority, see sched(7). Real-time policies usually need privileges.
+  ThreadOptions&& schedPolicy(int policy, int priority = 0) && {
+    hasSchedPolicy_ = true;
+    schedPolicy_ = policy;
+    schedPriority_ = priority;
+    return std::move(*this);
+  }
+
+  const std::string& getNamePrefix() const {
+    return namePrefix_;
+  }
+
+  const std::vector<int>& getCpus() const {
+    return cpus_;
+  }
+
+  int getNumaNode() const {
+    return numaNode_;
+  }
+
+  bool hasSchedPolicy() const {
+    return hasSchedPolicy_;
+  }
+
+  int getSchedPolicy() const {
+    return schedPolicy_;
+  }
+
+  int getSchedPriority() const {
+    return schedPriority_;
+  }
+
+ private:
+  std::string namePrefix_;
+  std::vector<int> cpus_;
+  int numaNode_{-1};
+  bool hasSchedPolicy_{false};
+  int schedPolicy_{0};
+  int schedPriority_{0};
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/timer_wheel.h>
+
+#include <algorithm>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/system.h>
+
+namespace tensorpipe {
+
+TimerWheel::TimerWheel(
+    std::chrono::milliseconds tickDuration,
+    size_t numSlots,
+    std::string threadName,
+    ThreadOptions threadOptions)
+    : tickDuration_(tickDuration),
+      threadName_(std::move(threadName)),
+      threadOptions_(std::move(threadOptions)),
+      startTime_(std::chrono::steady_clock::now()),
+      slots_(numSlots) {
+  TP_THROW_ASSERT_IF(tickDuration.count() <= 0) << "Ticks can't be empty";
+  TP_THROW_ASSERT_IF(numSlots == 0) << "At least one slot is needed";
+}
+
+uint64_t TimerWheel::tickOf(std::chrono::steady_clock::time_point time) const {
+  return (time - startTime_) / tickDuration_;
+}
+
+TimerWheel::TTimerId TimerWheel::schedule(
+    std::chrono::milliseconds timeout,
+    TCallback callback) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  const TTimerId id = nextTimerId_++;
+  if (joined_) {
+    return id;
+  }
+  if (!thread_.joinable()) {
+    thread_ = std::thread(&TimerWheel::run, this);
+  }
+  // Rounding up to the next tick ensures that the timer never expires early,
+  // and that it comes after the tick that's currently being looked at.
+  const uint64_t expiryTick =
+      tickOf(std::chrono::steady_clock::now() + timeout) + 1;
+  TSlot& slot = slots_[expiryTick % slots_.size()];
+  slot.push_back(Timer{id, expiryTick, std::move(callback)});
+  timers_.emplace(id, std::make_pair(&slot, std::prev(slot.end())));
+  // The thread only waits for a tick if there were timers already.
+  if (timers_.size() == 1) {
+    cv_.notify_all();
+  }
+  return id;
+}
+
+void TimerWheel::cancel(TTimerId id) {
+  // The callback is destroyed once the lock is dropped, as it may hold
+  // resources whose release calls back into the wheel.
+  TSlot cancelled;
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto iter = timers_.find(id);
+  if (iter == timers_.end()) {
+    return;
+  }
+  TSlot& slot = *iter->second.first;
+  cancelled.splice(cancelled.end(), slot, iter->second.second);
+  timers_.erase(iter);
+  lock.unlock();
+}
+
+void TimerWheel::join() {
+  std::vector<TSlot> slots;
+  std::thread thread;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (joined_) {
+      return;
+    }
+    joined_ = true;
+    slots = std::move(slots_);
+    timers_.clear();
+    thread = std::move(thread_);
+    cv_.notify_all();
+  }
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+TimerWheel::~TimerWheel() {
+  join();
+}
+
+void TimerWheel::run() {
+  setUpThread(threadOptions_, threadName_);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    if (timers_.empty()) {
+      cv_.wait(lock, [&]() { return joined_ || !timers_.empty(); });
+    } else {
+      cv_.wait_until(lock, startTime_ + (currentTick_ + 1) * tickDuration_);
+    }
+    if (joined_) {
+      break;
+    }
+
+    // The thread may have slept through several ticks, but it need not look at
+    // a slot twice.
+    const uint64_t nowTick = tickOf(std::chrono::steady_clock::now());
+    const uint64_t numTicks =
+        std::min<uint64_t>(nowTick - currentTick_, slots_.size());
+    TSlot expired;
+    for (uint64_t tick = currentTick_ + 1; tick <= currentTick_ + numTicks;
+         tick++) {
+      TSlot& slot = slots_[tick % slots_.size()];
+      for (auto iter = slot.begin(); iter != slot.end();) {
+        auto nextIter = std::next(iter);
+        if (iter->expiryTick <= nowTick) {
+          timers_.erase(iter->id);
+          expired.splice(expired.end(), slot, iter);
+        }
+        iter = nextIter;
+      }
+    }
+    currentTick_ = nowTick;
+
+    if (!expired.empty()) {
+      lock.unlock();
+      for (Timer& timer : expired) {
+        timer.callback();
+      }
+      expired.clear();
+      lock.lock();
+    }
+  }
+}
+
+} // namespace tensorpipe
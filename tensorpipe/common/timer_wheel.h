@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/common/thread_options.h>
+
+namespace tensorpipe {
+
+// A hashed timer wheel, for the deadlines of many short operations, most of
+// which complete (and cancel their timer) long before it expires. Time is cut
+// in ticks, and each timer is put in the slot of the tick it expires at, modulo
+// the number of slots, so that scheduling and cancelling it are O(1) and that
+// each tick only looks at the timers of its slot. The thread that advances the
+// wheel is only started by the first timer, and only wakes up once per tick
+// while there are timers. The callbacks are run on that thread, hence they
+// should be quick, like deferring to a loop.
+class TimerWheel {
+ public:
+  using TCallback = MoveOnlyFunction<void()>;
+  using TTimerId = uint64_t;
+
+  TimerWheel(
+      std::chrono::milliseconds tickDuration,
+      size_t numSlots,
+      std::string threadName,
+      ThreadOptions threadOptions = ThreadOptions());
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel(TimerWheel&&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+  TimerWheel& operator=(TimerWheel&&) = delete;
+
+  // Thread-safe. The callback is called once the timeout has passed, possibly
+  // up to a tick later, unless the timer is cancelled before. Once the wheel
+  // has been joined, the timers are dropped instead.
+  TTimerId schedule(std::chrono::milliseconds timeout, TCallback callback);
+
+  // Thread-safe. If the timer already expired, its callback may still be about
+  // to be called, hence it must cope with being called late.
+  void cancel(TTimerId id);
+
+  // Drop the timers that are left and stop the thread.
+  void join();
+
+  ~TimerWheel();
+
+ private:
+  struct Timer {
+    TTimerId id;
+    uint64_t expiryTick;
+    TCallback callback;
+  };
+  using TSlot = std::list<Timer>;
+
+  const std::chrono::steady_clock::duration tickDuration_;
+  const std::string threadName_;
+  const ThreadOptions threadOptions_;
+  const std::chrono::steady_clock::time_point startTime_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool joined_{false};
+  std::thread thread_;
+  std::vector<TSlot> slots_;
+  // Where each timer is, in order to cancel it without looking for it.
+  std::unordered_map<TTimerId, std::pair<TSlot*, TSlot::iterator>> timers_;
+  TTimerId nextTimerId_{0};
+  // The last tick whose slot was looked at.
+  uint64_t currentTick_{0};
+
+  uint64_t tickOf(std::chrono::steady_clock::time_point time) const;
+
+  void run();
+};
+
+} // namespace tensorpipe
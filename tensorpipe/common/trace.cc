@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/trace.h>
+
+#include <fstream>
+
+#if TENSORPIPE_ENABLE_TRACING
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#endif // TENSORPIPE_ENABLE_TRACING
+
+namespace tensorpipe {
+namespace trace {
+
+#if TENSORPIPE_ENABLE_TRACING
+
+namespace {
+
+// Large enough for a few seconds of busy traffic, for each thread.
+constexpr size_t kMaxEventsPerThread = 1 << 16;
+
+struct Event {
+  Phase phase;
+  const char* name;
+  uint64_t startTime;
+  uint64_t duration;
+  uint64_t flowId;
+};
+
+// The events of a thread. Only that thread appends to it, and it publishes
+// them by increasing the count, hence they can be read from any thread.
+struct ThreadBuffer {
+  int64_t tid;
+  std::string threadName;
+  std::array<Event, kMaxEventsPerThread> events;
+  std::atomic<size_t> numEvents{0};
+  std::atomic<uint64_t> numDroppedEvents{0};
+};
+
+// The buffers outlive their threads, so that the events of the threads that
+// ended can still be written out.
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+Registry& getRegistry() {
+  static Registry* registry = new Registry();
+  return *registry;
+}
+
+ThreadBuffer& getThreadBuffer() {
+  thread_local ThreadBuffer* buffer = nullptr;
+  if (buffer == nullptr) {
+    auto newBuffer = std::make_unique<ThreadBuffer>();
+    newBuffer->tid = ::syscall(SYS_gettid);
+    // The thread's name, if it was set already (as TensorPipe does as soon as
+    // it starts one of its threads).
+    std::array<char, 16> name{};
+    if (::pthread_getname_np(::pthread_self(), name.data(), name.size()) ==
+        0) {
+      newBuffer->threadName = name.data();
+    }
+    buffer = newBuffer.get();
+    Registry& registry = getRegistry();
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    registry.buffers.push_back(std::move(newBuffer));
+  }
+  return *buffer;
+}
+
+void writeEscaped(std::ostream& os, const std::string& str) {
+  for (const char c : str) {
+    if (c == '"' || c == '\\') {
+      os << '\\';
+    }
+    os << c;
+  }
+}
+
+} // namespace
+
+uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+uint64_t newFlowId() {
+  static std::atomic<uint64_t> nextFlowId{1};
+  return nextFlowId++;
+}
+
+void record(
+    Phase phase,
+    const char* name,
+    uint64_t startTime,
+    uint64_t duration,
+    uint64_t flowId) {
+  ThreadBuffer& buffer = getThreadBuffer();
+  const size_t idx = buffer.numEvents.load(std::memory_order_relaxed);
+  if (idx == kMaxEventsPerThread) {
+    buffer.numDroppedEvents.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  buffer.events[idx] = Event{phase, name, startTime, duration, flowId};
+  buffer.numEvents.store(idx + 1, std::memory_order_release);
+}
+
+bool writeChromeTrace(const std::string& path) {
+  std::ofstream os(path);
+  if (!os) {
+    return false;
+  }
+  const pid_t pid = ::getpid();
+  os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  auto startEvent = [&](char phase, const char* name, int64_t tid) {
+    os << (first ? "\n" : ",\n") << "{\"ph\":\"" << phase << "\",\"name\":\"";
+    writeEscaped(os, name);
+    os << "\",\"cat\":\"tensorpipe\",\"pid\":" << pid << ",\"tid\":" << tid;
+    first = false;
+  };
+  // The timestamps are in microseconds.
+  os << std::fixed << std::setprecision(3);
+
+  Registry& registry = getRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  for (const auto& buffer : registry.buffers) {
+    startEvent('M', "thread_name", buffer->tid);
+    os << ",\"args\":{\"name\":\"";
+    writeEscaped(os, buffer->threadName);
+    os << "\",\"dropped_events\":"
+       << buffer->numDroppedEvents.load(std::memory_order_relaxed) << "}}";
+
+    const size_t numEvents =
+        buffer->numEvents.load(std::memory_order_acquire);
+    for (size_t idx = 0; idx < numEvents; idx++) {
+      const Event& event = buffer->events[idx];
+      startEvent(static_cast<char>(event.phase), event.name, buffer->tid);
+      os << ",\"ts\":" << event.startTime / 1000.0;
+      switch (event.phase) {
+        case Phase::kComplete:
+          os << ",\"dur\":" << event.duration / 1000.0;
+          break;
+        case Phase::kInstant:
+          os << ",\"s\":\"t\"";
+          break;
+        case Phase::kFlowStart:
+        case Phase::kFlowStep:
+        case Phase::kFlowEnd:
+          // Bind the flow event to the span that encloses it.
+          os << ",\"id\":" << event.flowId << ",\"bp\":\"e\"";
+          break;
+      }
+      os << "}";
+    }
+  }
+  os << "\n]}\n";
+  return static_cast<bool>(os);
+}
+
+#else // TENSORPIPE_ENABLE_TRACING
+
+bool writeChromeTrace(const std::string& path) {
+  std::ofstream os(path);
+  os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[]}\n";
+  return static_cast<bool>(os);
+}
+
+#endif // TENSORPIPE_ENABLE_TRACING
+
+} // namespace trace
+} // namespace tensorpipe
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <tensorpipe/config.h>
+
+// An optional tracing layer, enabled at compile time (TP_ENABLE_TRACING), which
+// records spans and instant events, with flows linking together those of a
+// same operation across threads. Each thread appends its events to a buffer of
+// its own, without taking any lock, until the buffer is full, after which the
+// thread's further events are dropped. The events can be written out at any
+// time in the JSON format of Chrome's trace viewer, which Perfetto also opens.
+//
+// The names of the events must be string literals, as only their address is
+// recorded.
+
+namespace tensorpipe {
+namespace trace {
+
+// Write the events that all threads recorded so far to the given file, and
+// return whether that worked. Without tracing, the trace has no events.
+bool writeChromeTrace(const std::string& path);
+
+#if TENSORPIPE_ENABLE_TRACING
+
+enum class Phase : char {
+  kComplete = 'X',
+  kInstant = 'i',
+  kFlowStart = 's',
+  kFlowStep = 't',
+  kFlowEnd = 'f',
+};
+
+// The time, in nanoseconds, of a monotonic clock.
+uint64_t now();
+
+// Return an identifier for a flow that's unique within the process.
+uint64_t newFlowId();
+
+void record(
+    Phase phase,
+    const char* name,
+    uint64_t startTime,
+    uint64_t duration,
+    uint64_t flowId);
+
+// Record a span that lasts from its creation to its destruction.
+class Span {
+ public:
+  explicit Span(const char* name) : name_(name), startTime_(now()) {}
+
+  Span(const Span&) = delete;
+  Span& operator=(const Span&) = delete;
+
+  ~Span() {
+    record(Phase::kComplete, name_, startTime_, now() - startTime_, 0);
+  }
+
+ private:
+  const char* const name_;
+  const uint64_t startTime_;
+};
+
+#endif // TENSORPIPE_ENABLE_TRACING
+
+} // namespace trace
+} // namespace tensorpipe
+
+#if TENSORPIPE_ENABLE_TRACING
+
+#define TP_TRACE_CONCAT_(a, b) a##b
+#define TP_TRACE_CONCAT(a, b) TP_TRACE_CONCAT_(a, b)
+
+// A span covering the rest of the enclosing scope.
+#define TP_TRACE_SCOPE(name) \
+  ::tensorpipe::trace::Span TP_TRACE_CONCAT(tpTraceSpan, __LINE__)(name)
+
+// A span that started at the given time (obtained from TP_TRACE_NOW) and ends
+// now, for when it's only known at the end whether it's worth recording.
+#define TP_TRACE_NOW() ::tensorpipe::trace::now()
+#define TP_TRACE_COMPLETE(name, startTime)             \
+  do {                                                 \
+    const uint64_t tpTraceStartTime = (startTime);     \
+    ::tensorpipe::trace::record(                       \
+        ::tensorpipe::trace::Phase::kComplete,         \
+        name,                                          \
+        tpTraceStartTime,                              \
+        ::tensorpipe::trace::now() - tpTraceStartTime, \
+        0);                                            \
+  } while (false)
+
+#define TP_TRACE_INSTANT(name)              \
+  ::tensorpipe::trace::record(              \
+      ::tensorpipe::trace::Phase::kInstant, \
+      name,                                 \
+      ::tensorpipe::trace::now(),           \
+      0,                                    \
+      0)
+
+// The steps of a flow attach to the span they're recorded in, hence they should
+// be recorded within one (e.g., the one of a TP_TRACE_SCOPE).
+#define TP_TRACE_NEW_FLOW_ID() ::tensorpipe::trace::newFlowId()
+#define TP_TRACE_FLOW(phase, name, flowId) \
+  ::tensorpipe::trace::record(             \
+      ::tensorpipe::trace::Phase::phase,   \
+      name,                                \
+      ::tensorpipe::trace::now(),          \
+      0,                                   \
+      (flowId))
+#define TP_TRACE_FLOW_START(name, flowId) \
+  TP_TRACE_FLOW(kFlowStart, name, flowId)
+#define TP_TRACE_FLOW_STEP(name, flowId) TP_TRACE_FLOW(kFlowStep, name, flowId)
+#define TP_TRACE_FLOW_END(name, flowId) TP_TRACE_FLOW(kFlowEnd, name, flowId)
+
+#else // TENSORPIPE_ENABLE_TRACING
+
+#define TP_TRACE_SCOPE(name)
+#define TP_TRACE_NOW() uint64_t(0)
+#define TP_TRACE_COMPLETE(name, startTime) (void)(startTime)
+#define TP_TRACE_INSTANT(name)
+#define TP_TRACE_NEW_FLOW_ID() uint64_t(0)
+#define TP_TRACE_FLOW_START(name, flowId) (void)(flowId)
+#define TP_TRACE_FLOW_STEP(name, flowId) (void)(flowId)
+#define TP_TRACE_FLOW_END(name, flowId) (void)(flowId)
+
+#endif // TENSORPIPE_ENABLE_TRACING
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <tensorpipe/config.h>
+
+// Optional USDT (user-level statically defined tracing) probes, enabled at
+// compile time (TP_ENABLE_USDT), to which bpftrace, perf or SystemTap can
+// attach in a running process, under the "tensorpipe" provider. Unlike the
+// trace events (see trace.h) they cost nothing but a nop instruction until
+// something attaches to them, hence they can be left in production builds.
+// Their arguments are computed anyway though, so they must be cheap to get.
+//
+// The probes, and their arguments, are:
+// - pipe__write__start(pipe, sequenceNumber, numBytes)
+// - pipe__descriptor__sent(pipe, sequenceNumber, numBuffers)
+// - pipe__write__done(pipe, sequenceNumber, failed)
+// - pipe__read__descriptor__start(pipe, sequenceNumber)
+// - pipe__descriptor__received(pipe, sequenceNumber, numPayloads, numTensors)
+// - pipe__read__start(pipe, sequenceNumber)
+// - pipe__read__done(pipe, sequenceNumber, failed)
+// - channel__send__start(channel, sequenceNumber, numBytes)
+// - channel__send__done(channel, sequenceNumber, failed)
+// - channel__recv__start(channel, sequenceNumber, numBytes)
+// - channel__recv__done(channel, sequenceNumber, failed)
+// - connection__read__start(connection, sequenceNumber, numBytes)
+// - connection__read__done(connection, sequenceNumber, numBytes, failed)
+// - connection__write__start(connection, sequenceNumber, numBytes)
+// - connection__write__done(connection, sequenceNumber, failed)
+// - loop__epoll__events(numEvents)
+// - loop__poll(didWork)
+// - cuda__callback(failed)
+// The pipes, channels and connections are given by their IDs, as strings (as
+// in the logs). The sequence numbers are those of the operations of the object
+// that the probe is about, in the order in which they were requested. The
+// number of bytes of a read is zero when it's only known once it's done, and
+// "failed" is one or zero. For example, the latency of the writes of a pipe:
+//
+//   bpftrace -p <pid> -e '
+//     usdt:*:tensorpipe:pipe__write__start { @start[str(arg0), arg1] = nsecs; }
+//     usdt:*:tensorpipe:pipe__write__done /@start[str(arg0), arg1]/ {
+//       @us = hist((nsecs - @start[str(arg0), arg1]) / 1000);
+//       delete(@start[str(arg0), arg1]);
+//     }'
+
+#if TENSORPIPE_ENABLE_USDT
+
+#include <sys/sdt.h>
+
+#define TP_USDT(name, ...) STAP_PROBEV(tensorpipe, name, __VA_ARGS__)
+
+#else // TENSORPIPE_ENABLE_USDT
+
+#define TP_USDT(name, ...)
+
+#endif // TENSORPIPE_ENABLE_USDT
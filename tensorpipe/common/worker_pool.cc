@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/worker_pool.h>
+
+#include <limits>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/system.h>
+
+namespace tensorpipe {
+
+WorkerPool::WorkerPool(
+    size_t numThreads,
+    std::string threadName,
+    ThreadOptions threadOptions)
+    : numThreads_(numThreads),
+      threadName_(std::move(threadName)),
+      threadOptions_(std::move(threadOptions)),
+      mutex_("worker_pool/" + threadName_),
+      tasks_(
+          std::numeric_limits<int>::max(),
+          "worker_pool/tasks/" + threadName_) {
+  TP_THROW_ASSERT_IF(numThreads_ == 0) << "At least one thread is needed";
+}
+
+void WorkerPool::submit(TTask task) {
+  {
+    std::unique_lock<std::mutex> lock = mutex_.acquire();
+    if (!joined_) {
+      if (threads_.empty()) {
+        for (size_t threadIdx = 0; threadIdx < numThreads_; threadIdx++) {
+          threads_.emplace_back(&WorkerPool::runTasks, this);
+        }
+      }
+      // The queue is unbounded, hence this doesn't block.
+      tasks_.push(std::move(task));
+      return;
+    }
+  }
+  task();
+}
+
+void WorkerPool::join() {
+  std::vector<std::thread> threads;
+  {
+    std::unique_lock<std::mutex> lock = mutex_.acquire();
+    if (joined_) {
+      return;
+    }
+    joined_ = true;
+    // The threads only see these once they're done with the earlier tasks.
+    for (size_t threadIdx = 0; threadIdx < threads_.size(); threadIdx++) {
+      tasks_.push(nullopt);
+    }
+    threads = std::move(threads_);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  join();
+}
+
+void WorkerPool::runTasks() {
+  setUpThread(threadOptions_, threadName_);
+  while (true) {
+    optional<TTask> task = tasks_.pop();
+    if (!task.has_value()) {
+      break;
+    }
+    (*task)();
+  }
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/common/lock_stats.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/queue.h>
+#include <tensorpipe/common/thread_options.h>
+
+namespace tensorpipe {
+
+// A fixed number of threads that run the tasks they're given, in no particular
+// order, for CPU-heavy work that would otherwise stall an event loop. The
+// threads are only started by the first task, so that a pool that is never
+// used costs nothing. Once the pool has been joined, the tasks are run inline
+// by the thread that submits them instead.
+class WorkerPool {
+ public:
+  using TTask = MoveOnlyFunction<void()>;
+
+  WorkerPool(
+      size_t numThreads,
+      std::string threadName,
+      ThreadOptions threadOptions = ThreadOptions());
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool(WorkerPool&&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+  WorkerPool& operator=(WorkerPool&&) = delete;
+
+  // Thread-safe.
+  void submit(TTask task);
+
+  // Run the tasks that were submitted so far, and then stop the threads.
+  void join();
+
+  ~WorkerPool();
+
+ private:
+  const size_t numThreads_;
+  const std::string threadName_;
+  const ThreadOptions threadOptions_;
+
+  ProfiledMutex mutex_;
+  bool joined_{false};
+  std::vector<std::thread> threads_;
+  Queue<optional<TTask>> tasks_;
+
+  void runTasks();
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/xxhash64.h>
+
+#include <cstring>
+
+namespace tensorpipe {
+
+namespace {
+
+constexpr uint64_t kPrime1 = 0x9e3779b185ebca87;
+constexpr uint64_t kPrime2 = 0xc2b2ae3d27d4eb4f;
+constexpr uint64_t kPrime3 = 0x165667b19e3779f9;
+constexpr uint64_t kPrime4 = 0x85ebca77c2b2ae63;
+constexpr uint64_t kPrime5 = 0x27d4eb2f165667c5;
+
+inline uint64_t rotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+// The hash is defined on little-endian words, which is what all the platforms
+// we support use natively.
+inline uint64_t readUint64(const uint8_t* ptr) {
+  uint64_t value;
+  std::memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+inline uint32_t readUint32(const uint8_t* ptr) {
+  uint32_t value;
+  std::memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input) {
+  acc += input * kPrime2;
+  acc = rotateLeft(acc, 31);
+  return acc * kPrime1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t value) {
+  acc ^= round(0, value);
+  return acc * kPrime1 + kPrime4;
+}
+
+} // namespace
+
+uint64_t xxhash64(const void* ptr, size_t length, uint64_t seed) {
+  const uint8_t* cursor = reinterpret_cast<const uint8_t*>(ptr);
+  const uint8_t* const end = cursor + length;
+  uint64_t hash;
+
+  if (length >= 32) {
+    uint64_t acc1 = seed + kPrime1 + kPrime2;
+    uint64_t acc2 = seed + kPrime2;
+    uint64_t acc3 = seed;
+    uint64_t acc4 = seed - kPrime1;
+    const uint8_t* const lastStripe = end - 32;
+    do {
+      acc1 = round(acc1, readUint64(cursor));
+      acc2 = round(acc2, readUint64(cursor + 8));
+      acc3 = round(acc3, readUint64(cursor + 16));
+      acc4 = round(acc4, readUint64(cursor + 24));
+      cursor += 32;
+    } while (cursor <= lastStripe);
+    hash = rotateLeft(acc1, 1) + rotateLeft(acc2, 7) + rotateLeft(acc3, 12) +
+        rotateLeft(acc4, 18);
+    hash = mergeRound(hash, acc1);
+    hash = mergeRound(hash, acc2);
+    hash = mergeRound(hash, acc3);
+    hash = mergeRound(hash, acc4);
+  } else {
+    hash = seed + kPrime5;
+  }
+
+  hash += length;
+
+  for (; cursor + 8 <= end; cursor += 8) {
+    hash ^= round(0, readUint64(cursor));
+    hash = rotateLeft(hash, 27) * kPrime1 + kPrime4;
+  }
+  if (cursor + 4 <= end) {
+    hash ^= static_cast<uint64_t>(readUint32(cursor)) * kPrime1;
+    hash = rotateLeft(hash, 23) * kPrime2 + kPrime3;
+    cursor += 4;
+  }
+  for (; cursor < end; cursor++) {
+    hash ^= static_cast<uint64_t>(*cursor) * kPrime5;
+    hash = rotateLeft(hash, 11) * kPrime1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The 64-bit xxHash (XXH64) of Yann Collet, a non-cryptographic hash which
+// runs at several bytes per cycle on a single core, as its four accumulators
+// are independent of one another. It's used to recognize contents that were
+// already seen, not to detect corruption (see crc32c.h for that).
+
+namespace tensorpipe {
+
+// Return the hash of the given bytes. To hash several buffers, one after the
+// other, pass the hash of the previous ones as the seed (which isn't the same
+// as hashing them all at once, but is just as good to tell contents apart).
+uint64_t xxhash64(const void* ptr, size_t length, uint64_t seed = 0);
+
+} // namespace tensorpipe
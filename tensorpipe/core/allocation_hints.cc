@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/allocation_hints.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/system.h>
+#include <tensorpipe/core/error.h>
+#include <tensorpipe/core/message.h>
+
+#if TENSORPIPE_SUPPORTS_CUDA
+#include <tensorpipe/common/cuda.h>
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+namespace tensorpipe {
+
+namespace {
+
+bool isPowerOfTwo(size_t value) {
+  return (value & (value - 1)) == 0;
+}
+
+std::tuple<Error, std::shared_ptr<uint8_t>> allocateOnCpu(
+    size_t length,
+    const AllocationHints& hints) {
+  size_t alignment = std::max(hints.alignment, alignof(std::max_align_t));
+  size_t allocatedLength = length;
+  // The memory policy applies to whole pages, hence the buffer must have its
+  // own, lest it moves those of other allocations (or they move it).
+  if (hints.numaNode >= 0) {
+    const size_t pageSize = ::getpagesize();
+    alignment = std::max(alignment, pageSize);
+    allocatedLength = (length + pageSize - 1) / pageSize * pageSize;
+  }
+  void* ptr;
+  int rv = ::posix_memalign(&ptr, alignment, allocatedLength);
+  if (rv != 0) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "posix_memalign", rv), nullptr);
+  }
+  uint8_t* data = reinterpret_cast<uint8_t*>(ptr);
+
+  if (hints.numaNode >= 0) {
+    Error error = bindMemoryToNumaNode(data, allocatedLength, hints.numaNode);
+    if (error) {
+      ::free(data);
+      return std::make_tuple(std::move(error), nullptr);
+    }
+  }
+
+  if (hints.pinned) {
+#if TENSORPIPE_SUPPORTS_CUDA
+    // This faults the pages in, which thus happens after they were bound.
+    cudaError_t cudaError =
+        cudaHostRegister(data, allocatedLength, cudaHostRegisterDefault);
+    if (cudaError != cudaSuccess) {
+      ::free(data);
+      return std::make_tuple(TP_CREATE_ERROR(CudaError, cudaError), nullptr);
+    }
+    return std::make_tuple(
+        Error::kSuccess, std::shared_ptr<uint8_t>(data, [](uint8_t* ptr) {
+          TP_CUDA_CHECK(cudaHostUnregister(ptr));
+          ::free(ptr);
+        }));
+#else // TENSORPIPE_SUPPORTS_CUDA
+    ::free(data);
+    return std::make_tuple(
+        TP_CREATE_ERROR(AllocationError, "pinning needs CUDA support"),
+        nullptr);
+#endif // TENSORPIPE_SUPPORTS_CUDA
+  }
+
+  return std::make_tuple(
+      Error::kSuccess,
+      std::shared_ptr<uint8_t>(data, [](uint8_t* ptr) { ::free(ptr); }));
+}
+
+#if TENSORPIPE_SUPPORTS_CUDA
+
+// The alignment that cudaMalloc guarantees.
+constexpr size_t kCudaMallocAlignment = 256;
+
+std::tuple<Error, std::shared_ptr<uint8_t>> allocateOnCuda(
+    size_t length,
+    const AllocationHints& hints) {
+  int device = hints.cudaDeviceIdx;
+  if (device < 0) {
+    TP_CUDA_CHECK(cudaGetDevice(&device));
+  }
+  // Larger alignments are obtained by allocating enough to slide the buffer.
+  const size_t slack = hints.alignment > kCudaMallocAlignment
+      ? hints.alignment - kCudaMallocAlignment
+      : 0;
+  void* ptr;
+  {
+    CudaDeviceGuard guard(device);
+    cudaError_t cudaError = cudaMalloc(&ptr, length + slack);
+    if (cudaError != cudaSuccess) {
+      return std::make_tuple(TP_CREATE_ERROR(CudaError, cudaError), nullptr);
+    }
+  }
+  uint8_t* base = reinterpret_cast<uint8_t*>(ptr);
+  const uintptr_t baseAddr = reinterpret_cast<uintptr_t>(base);
+  uint8_t* data = slack > 0
+      ? base + (hints.alignment - baseAddr % hints.alignment) % hints.alignment
+      : base;
+  return std::make_tuple(
+      Error::kSuccess,
+      std::shared_ptr<uint8_t>(data, [base, device](uint8_t* /* unused */) {
+        CudaDeviceGuard guard(device);
+        TP_CUDA_CHECK(cudaFree(base));
+      }));
+}
+
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+} // namespace
+
+std::tuple<Error, std::shared_ptr<uint8_t>> allocateWithHints(
+    size_t length,
+    DeviceType deviceType,
+    const AllocationHints& hints) {
+  // The hints may come from the other end of a pipe, hence they're checked
+  // rather than asserted.
+  if (!isPowerOfTwo(hints.alignment)) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(
+            AllocationError,
+            "alignment " + std::to_string(hints.alignment) +
+                " isn't a power of two"),
+        nullptr);
+  }
+  if (length == 0) {
+    return std::make_tuple(Error::kSuccess, nullptr);
+  }
+  switch (deviceType) {
+    case DeviceType::kCpu:
+      return allocateOnCpu(length, hints);
+#if TENSORPIPE_SUPPORTS_CUDA
+    case DeviceType::kCuda:
+      return allocateOnCuda(length, hints);
+#endif // TENSORPIPE_SUPPORTS_CUDA
+    default:
+      TP_THROW_ASSERT() << "Unknown device type.";
+  };
+  // Dummy return to make compiler happy.
+  return std::make_tuple(Error::kSuccess, nullptr);
+}
+
+Error allocateMessageWithHints(
+    Message& message,
+    std::vector<std::shared_ptr<uint8_t>>& buffers) {
+  Error error;
+  std::shared_ptr<uint8_t> buffer;
+  for (Message::Payload& payload : message.payloads) {
+    if (payload.fd >= 0) {
+      continue;
+    }
+    std::tie(error, buffer) = allocateWithHints(
+        payload.length, DeviceType::kCpu, payload.allocationHints);
+    if (error) {
+      return error;
+    }
+    payload.data = buffer.get();
+    buffers.push_back(std::move(buffer));
+  }
+
+  if (message.handOffTensors) {
+    return Error::kSuccess;
+  }
+  for (Message::Tensor& tensor : message.tensors) {
+    switch (tensor.buffer.type) {
+      case DeviceType::kCpu:
+        std::tie(error, buffer) = allocateWithHints(
+            tensor.buffer.cpu.length,
+            DeviceType::kCpu,
+            tensor.allocationHints);
+        if (error) {
+          return error;
+        }
+        tensor.buffer.cpu.ptr = buffer.get();
+        break;
+#if TENSORPIPE_SUPPORTS_CUDA
+      case DeviceType::kCuda:
+        std::tie(error, buffer) = allocateWithHints(
+            tensor.buffer.cuda.length,
+            DeviceType::kCuda,
+            tensor.allocationHints);
+        if (error) {
+          return error;
+        }
+        tensor.buffer.cuda.ptr = buffer.get();
+        break;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+      default:
+        TP_THROW_ASSERT() << "Unknown device type.";
+    };
+    buffers.push_back(std::move(buffer));
+  }
+  return Error::kSuccess;
+}
+
+} // namespace tensorpipe
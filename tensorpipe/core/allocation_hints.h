@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/core/buffer.h>
+
+namespace tensorpipe {
+
+class Message;
+
+// What the buffer of a payload or of a tensor should be like on the receiving
+// end, which the sender, as it knows what the data is for, can tell the
+// receiver through the descriptor of the message. The pipe doesn't act on them
+// but gives them to the readDescriptor callback, which can then allocate the
+// buffers (e.g., with allocateWithHints) where the data is eventually needed,
+// rather than receiving it anywhere and copying it over again.
+struct AllocationHints {
+  // The alignment of the start of the buffer, in bytes, which must be a power
+  // of two, or zero if any will do.
+  size_t alignment{0};
+  // The NUMA node whose memory a buffer on CPU should preferably be in, or -1
+  // if any will do.
+  int numaNode{-1};
+  // Whether a buffer on CPU should be page-locked (pinned) and registered with
+  // CUDA, e.g., as it will be the source of asynchronous copies to a GPU.
+  bool pinned{false};
+  // The CUDA device a buffer on CUDA should be on, or -1 for the current one.
+  int cudaDeviceIdx{-1};
+
+  bool isDefault() const {
+    return alignment == 0 && numaNode == -1 && !pinned && cudaDeviceIdx == -1;
+  }
+};
+
+// Allocate a buffer of the given length on the given type of device that
+// honors the hints, and return it along with the function that frees it. The
+// hints that don't apply to the device type are ignored. An error is returned
+// if one of the others can't be honored (e.g., the alignment isn't a power of
+// two, or pinning was asked for without CUDA support), for the caller to fall
+// back on a less specific allocation if it wants.
+std::tuple<Error, std::shared_ptr<uint8_t>> allocateWithHints(
+    size_t length,
+    DeviceType deviceType,
+    const AllocationHints& hints);
+
+// Point the payloads and tensors of a message given by the readDescriptor
+// callback to buffers allocated with their hints, and add these buffers to the
+// given vector, which must keep them alive for as long as they are needed. The
+// tensors that are handed off and the payloads that land in a file, which need
+// no memory, are left alone. On error the message may be partly allocated.
+Error allocateMessageWithHints(
+    Message& message,
+    std::vector<std::shared_ptr<uint8_t>>& buffers);
+
+} // namespace tensorpipe
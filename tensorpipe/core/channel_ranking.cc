@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/channel_ranking.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+constexpr size_t ChannelProbes::kNumProbesPerChannel;
+
+size_t getChannelRankingLengthClass(size_t length) {
+  size_t lengthClass = 0;
+  while (length >= 16 && lengthClass + 1 < kNumChannelRankingLengthClasses) {
+    length /= 16;
+    lengthClass++;
+  }
+  return lengthClass;
+}
+
+const std::string* ChannelProbes::nextChannelToProbe(
+    size_t lengthClass,
+    const std::vector<const std::string*>& candidates) const {
+  TP_DCHECK_LT(lengthClass, kNumChannelRankingLengthClasses);
+  const auto& probes = probes_[lengthClass];
+  const std::string* channelToProbe = nullptr;
+  size_t minNumProbes = kNumProbesPerChannel;
+  for (const std::string* candidate : candidates) {
+    auto iter = probes.find(*candidate);
+    const size_t numProbes = iter == probes.end()
+        ? 0
+        : iter->second.numInFlight + iter->second.durations.size();
+    if (numProbes < minNumProbes) {
+      channelToProbe = candidate;
+      minNumProbes = numProbes;
+    }
+  }
+  return channelToProbe;
+}
+
+void ChannelProbes::startProbe(size_t lengthClass, const std::string& channel) {
+  TP_DCHECK_LT(lengthClass, kNumChannelRankingLengthClasses);
+  probes_[lengthClass][channel].numInFlight++;
+}
+
+void ChannelProbes::completeProbe(
+    size_t lengthClass,
+    const std::string& channel,
+    TDuration duration) {
+  TP_DCHECK_LT(lengthClass, kNumChannelRankingLengthClasses);
+  Probes& probes = probes_[lengthClass][channel];
+  TP_DCHECK_GT(probes.numInFlight, 0);
+  probes.numInFlight--;
+  probes.durations.push_back(duration);
+}
+
+optional<std::vector<std::string>> ChannelProbes::rank(
+    size_t lengthClass,
+    const std::vector<const std::string*>& candidates) const {
+  TP_DCHECK_LT(lengthClass, kNumChannelRankingLengthClasses);
+  const auto& probes = probes_[lengthClass];
+  // The median is the most robust to the first sends over a channel, which
+  // pay for warming it up, and to the occasional hiccup.
+  std::vector<std::pair<TDuration, size_t>> medians;
+  for (size_t candidateIdx = 0; candidateIdx < candidates.size();
+       candidateIdx++) {
+    auto iter = probes.find(*candidates[candidateIdx]);
+    if (iter == probes.end() ||
+        iter->second.durations.size() < kNumProbesPerChannel) {
+      return nullopt;
+    }
+    std::vector<TDuration> durations = iter->second.durations;
+    std::nth_element(
+        durations.begin(),
+        durations.begin() + durations.size() / 2,
+        durations.end());
+    medians.emplace_back(durations[durations.size() / 2], candidateIdx);
+  }
+  std::sort(medians.begin(), medians.end());
+
+  std::vector<std::string> ranking;
+  ranking.reserve(medians.size());
+  for (const auto& median : medians) {
+    ranking.push_back(*candidates[median.second]);
+  }
+  return ranking;
+}
+
+optional<std::vector<std::string>> ChannelRankingCache::get(
+    const std::string& host,
+    size_t lengthClass) {
+  TP_DCHECK_LT(lengthClass, kNumChannelRankingLengthClasses);
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto iter = entries_.find(host);
+  if (iter == entries_.end()) {
+    return nullopt;
+  }
+  const Entry& entry = iter->second[lengthClass];
+  if (entry.ranking.empty() ||
+      entry.expiry <= std::chrono::steady_clock::now()) {
+    return nullopt;
+  }
+  return entry.ranking;
+}
+
+void ChannelRankingCache::put(
+    const std::string& host,
+    size_t lengthClass,
+    std::vector<std::string> ranking) {
+  TP_DCHECK_LT(lengthClass, kNumChannelRankingLengthClasses);
+  std::unique_lock<std::mutex> lock(mutex_);
+  Entry& entry = entries_[host][lengthClass];
+  entry.ranking = std::move(ranking);
+  entry.expiry = std::chrono::steady_clock::now() + ttl_;
+}
+
+} // namespace tensorpipe
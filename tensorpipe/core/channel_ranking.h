@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <tensorpipe/common/optional.h>
+
+namespace tensorpipe {
+
+// The channels are ranked separately for each class of tensor lengths, as the
+// fastest one for small tensors, whose time goes to latency, isn't necessarily
+// the fastest for large ones, whose time goes to bandwidth. Each class is 16
+// times as wide as the previous one, and the last one has no upper bound.
+constexpr size_t kNumChannelRankingLengthClasses = 8;
+
+size_t getChannelRankingLengthClass(size_t length);
+
+// The sends that a pipe times over each of its channels (see
+// ContextOptions::channelRankingTtl), for each class of lengths, until it has
+// timed enough of them to rank the channels by their median duration. This
+// isn't thread-safe: it's meant to be used from a pipe's loop.
+class ChannelProbes {
+ public:
+  using TDuration = std::chrono::steady_clock::duration;
+
+  static constexpr size_t kNumProbesPerChannel = 4;
+
+  // Among the candidates, in order of priority, return the first one that has
+  // the fewest probes (completed or not) if it needs more, or null otherwise.
+  const std::string* nextChannelToProbe(
+      size_t lengthClass,
+      const std::vector<const std::string*>& candidates) const;
+
+  void startProbe(size_t lengthClass, const std::string& channel);
+
+  void completeProbe(
+      size_t lengthClass,
+      const std::string& channel,
+      TDuration duration);
+
+  // Once all the candidates were probed enough, return them from the fastest
+  // to the slowest, and otherwise nothing. The order of priority breaks ties.
+  optional<std::vector<std::string>> rank(
+      size_t lengthClass,
+      const std::vector<const std::string*>& candidates) const;
+
+ private:
+  struct Probes {
+    size_t numInFlight{0};
+    std::vector<TDuration> durations;
+  };
+
+  std::array<
+      std::unordered_map<std::string, Probes>,
+      kNumChannelRankingLengthClasses>
+      probes_;
+};
+
+// The rankings of the channels, for each host that the pipes of a context
+// connect to and each class of lengths, which the pipes to that host reuse
+// rather than probing the channels again, until they expire. It is safe to use
+// from any thread.
+class ChannelRankingCache {
+ public:
+  explicit ChannelRankingCache(std::chrono::steady_clock::duration ttl)
+      : ttl_(ttl) {}
+
+  optional<std::vector<std::string>> get(
+      const std::string& host,
+      size_t lengthClass);
+
+  void put(
+      const std::string& host,
+      size_t lengthClass,
+      std::vector<std::string> ranking);
+
+ private:
+  struct Entry {
+    std::vector<std::string> ranking;
+    std::chrono::steady_clock::time_point expiry;
+  };
+
+  const std::chrono::steady_clock::duration ttl_;
+  std::mutex mutex_;
+  std::unordered_map<
+      std::string,
+      std::array<Entry, kNumChannelRankingLengthClasses>>
+      entries_;
+};
+
+} // namespace tensorpipe
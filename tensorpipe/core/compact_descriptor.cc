@@ -0,0 +1,651 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/compact_descriptor.h>
+
+#include <limits>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/core/error.h>
+
+// The compact format is a sequence of fields, each of which is either a byte,
+// a varint (seven bits at a time, least significant first, with the top bit
+// telling whether more follow), a 32-bit little-endian integer, a string (its
+// length as a varint, followed by its bytes) or a 64-bit little-endian integer.
+// The message is:
+//
+// - a byte of flags (kHasChecksums, kHasMetadata, kHandsOffTensors,
+//   kCoalescesCudaTensors, kHasInlinePayloads), then the metadata if any;
+// - the number of payloads, then for each of them a byte of flags
+//   (kHasMetadata, kIsInChunks, kHasAllocationHints, kIsSegmented), its size,
+//   its metadata and its allocation hints if any, its checksum if the message
+//   has checksums and, if it's in chunks, a byte with the compression
+//   algorithm (possibly none), the number of chunks and the compressed length
+//   of each of them (a payload that is segmented is in uncompressed chunks);
+// - the number of tensors, then for each of them a byte of flags (kHasMetadata,
+//   kHasChannelDescriptor, kIsDeduplicated, kHasAllocationHints), a byte with
+//   the device type, its size, the index of its channel plus one (or zero if it
+//   was inlined, handed off or deduplicated), its handoff identifier if the
+//   message hands off its tensors, its metadata, its channel descriptor and its
+//   allocation hints if any, its checksum if the message has checksums and, if
+//   it's deduplicated, a byte with how (see TensorDedup) and the hash of its
+//   contents;
+// - if the message has the kHasInlinePayloads flag (in which case it has no
+//   tensors and no payload is in chunks), the bytes of the payloads.
+//
+// The allocation hints are the alignment, the NUMA node plus one (or zero for
+// none), a byte telling whether the buffer is pinned and the CUDA device plus
+// one (or zero for the current one).
+
+namespace tensorpipe {
+
+namespace {
+
+constexpr uint8_t kMessageHasChecksums = 1 << 0;
+constexpr uint8_t kMessageHasMetadata = 1 << 1;
+constexpr uint8_t kMessageHandsOffTensors = 1 << 2;
+constexpr uint8_t kMessageCoalescesCudaTensors = 1 << 3;
+constexpr uint8_t kMessageHasInlinePayloads = 1 << 4;
+
+constexpr uint8_t kPayloadHasMetadata = 1 << 0;
+constexpr uint8_t kPayloadIsInChunks = 1 << 1;
+constexpr uint8_t kPayloadHasAllocationHints = 1 << 2;
+constexpr uint8_t kPayloadIsSegmented = 1 << 3;
+
+constexpr uint8_t kTensorHasMetadata = 1 << 0;
+constexpr uint8_t kTensorHasChannelDescriptor = 1 << 1;
+constexpr uint8_t kTensorIsDeduplicated = 1 << 2;
+constexpr uint8_t kTensorHasAllocationHints = 1 << 3;
+
+void writeByte(std::vector<uint8_t>& buffer, uint8_t value) {
+  buffer.push_back(value);
+}
+
+void writeVarint(std::vector<uint8_t>& buffer, uint64_t value) {
+  while (value >= 0x80) {
+    buffer.push_back(static_cast<uint8_t>(value) | 0x80);
+    value >>= 7;
+  }
+  buffer.push_back(static_cast<uint8_t>(value));
+}
+
+void writeFixed32(std::vector<uint8_t>& buffer, uint32_t value) {
+  for (int shift = 0; shift < 32; shift += 8) {
+    buffer.push_back(static_cast<uint8_t>(value >> shift));
+  }
+}
+
+void writeFixed64(std::vector<uint8_t>& buffer, uint64_t value) {
+  for (int shift = 0; shift < 64; shift += 8) {
+    buffer.push_back(static_cast<uint8_t>(value >> shift));
+  }
+}
+
+void writeString(std::vector<uint8_t>& buffer, const std::string& value) {
+  writeVarint(buffer, value.size());
+  buffer.insert(buffer.end(), value.begin(), value.end());
+}
+
+bool hasAllocationHints(
+    const MessageDescriptor::AllocationHintsDescriptor& nopAllocationHints) {
+  return nopAllocationHints.alignment != 0 ||
+      nopAllocationHints.numaNode >= 0 || nopAllocationHints.pinned ||
+      nopAllocationHints.cudaDeviceIdx >= 0;
+}
+
+// Any negative index stands for none.
+void writeIndex(std::vector<uint8_t>& buffer, int64_t value) {
+  writeVarint(buffer, value < 0 ? 0 : static_cast<uint64_t>(value) + 1);
+}
+
+void writeAllocationHints(
+    std::vector<uint8_t>& buffer,
+    const MessageDescriptor::AllocationHintsDescriptor& nopAllocationHints) {
+  writeVarint(buffer, nopAllocationHints.alignment);
+  writeIndex(buffer, nopAllocationHints.numaNode);
+  writeByte(buffer, nopAllocationHints.pinned ? 1 : 0);
+  writeIndex(buffer, nopAllocationHints.cudaDeviceIdx);
+}
+
+// Reads the fields from the buffer, failing (and then doing nothing) once they
+// go past its end or they're malformed.
+class Reader {
+ public:
+  explicit Reader(const std::vector<uint8_t>& buffer)
+      : begin_(buffer.data()),
+        ptr_(buffer.data()),
+        end_(buffer.data() + buffer.size()) {}
+
+  bool ok() const {
+    return ok_;
+  }
+
+  size_t offset() const {
+    return ptr_ - begin_;
+  }
+
+  bool skip(uint64_t length) {
+    if (!ok_ || length > static_cast<uint64_t>(end_ - ptr_)) {
+      return fail("truncated");
+    }
+    ptr_ += length;
+    return true;
+  }
+
+  bool readByte(uint8_t& value) {
+    if (!ok_ || ptr_ == end_) {
+      return fail("truncated");
+    }
+    value = *ptr_++;
+    return true;
+  }
+
+  bool readVarint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t byte;
+      if (!readByte(byte)) {
+        return false;
+      }
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        return true;
+      }
+    }
+    return fail("varint too long");
+  }
+
+  bool readFixed32(uint32_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+      uint8_t byte;
+      if (!readByte(byte)) {
+        return false;
+      }
+      value |= static_cast<uint32_t>(byte) << shift;
+    }
+    return true;
+  }
+
+  bool readFixed64(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 8) {
+      uint8_t byte;
+      if (!readByte(byte)) {
+        return false;
+      }
+      value |= static_cast<uint64_t>(byte) << shift;
+    }
+    return true;
+  }
+
+  bool readString(std::string& value) {
+    uint64_t length;
+    if (!readVarint(length)) {
+      return false;
+    }
+    if (length > static_cast<uint64_t>(end_ - ptr_)) {
+      return fail("truncated");
+    }
+    value.assign(reinterpret_cast<const char*>(ptr_), length);
+    ptr_ += length;
+    return true;
+  }
+
+  // Read a size, which must fit in the signed integers of the descriptor.
+  bool readSize(int64_t& value) {
+    uint64_t size;
+    if (!readVarint(size)) {
+      return false;
+    }
+    if (size > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+      return fail("size too large");
+    }
+    value = static_cast<int64_t>(size);
+    return true;
+  }
+
+  // Read an index written by writeIndex, which must fit in an int.
+  bool readIndex(int64_t& value) {
+    uint64_t index;
+    if (!readVarint(index)) {
+      return false;
+    }
+    if (index > static_cast<uint64_t>(std::numeric_limits<int>::max())) {
+      return fail("index too large");
+    }
+    value = static_cast<int64_t>(index) - 1;
+    return true;
+  }
+
+  // Read a count of items that each take at least one byte, which thus can't be
+  // more than there are bytes left, in order not to allocate for bogus counts.
+  bool readCount(uint64_t& value) {
+    uint64_t count;
+    if (!readVarint(count)) {
+      return false;
+    }
+    if (count > static_cast<uint64_t>(end_ - ptr_)) {
+      return fail("count too large");
+    }
+    value = count;
+    return true;
+  }
+
+  bool fail(std::string reason) {
+    if (ok_) {
+      ok_ = false;
+      reason_ = std::move(reason);
+    }
+    return false;
+  }
+
+  Error finish() {
+    if (ok_ && ptr_ != end_) {
+      fail("trailing data");
+    }
+    if (!ok_) {
+      return TP_CREATE_ERROR(MalformedDescriptorError, reason_);
+    }
+    return Error::kSuccess;
+  }
+
+ private:
+  const uint8_t* const begin_;
+  const uint8_t* ptr_;
+  const uint8_t* const end_;
+  bool ok_{true};
+  std::string reason_;
+};
+
+bool isValidDeviceType(uint8_t value) {
+  switch (static_cast<DeviceType>(value)) {
+    case DeviceType::kCpu:
+#if TENSORPIPE_SUPPORTS_CUDA
+    case DeviceType::kCuda:
+#endif // TENSORPIPE_SUPPORTS_CUDA
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool isValidPayloadCompression(uint8_t value) {
+  switch (static_cast<PayloadCompression>(value)) {
+    case PayloadCompression::kNone:
+    case PayloadCompression::kLz4:
+    case PayloadCompression::kZstd:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool isValidTensorDedup(uint8_t value) {
+  switch (static_cast<TensorDedup>(value)) {
+    case TensorDedup::kStore:
+    case TensorDedup::kHit:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool readAllocationHints(
+    Reader& reader,
+    MessageDescriptor::AllocationHintsDescriptor& nopAllocationHints) {
+  uint8_t pinned;
+  if (!reader.readVarint(nopAllocationHints.alignment) ||
+      !reader.readIndex(nopAllocationHints.numaNode) ||
+      !reader.readByte(pinned) ||
+      !reader.readIndex(nopAllocationHints.cudaDeviceIdx)) {
+    return false;
+  }
+  if (pinned > 1) {
+    return reader.fail("invalid pinned flag");
+  }
+  nopAllocationHints.pinned = pinned != 0;
+  return true;
+}
+
+bool readPayloadDescriptor(
+    Reader& reader,
+    bool hasChecksums,
+    MessageDescriptor::PayloadDescriptor& nopPayloadDescriptor) {
+  uint8_t flags;
+  if (!reader.readByte(flags)) {
+    return false;
+  }
+  if ((flags &
+       ~(kPayloadHasMetadata | kPayloadIsInChunks |
+         kPayloadHasAllocationHints | kPayloadIsSegmented)) != 0) {
+    return reader.fail("unknown payload flags");
+  }
+  if ((flags & kPayloadIsSegmented) && !(flags & kPayloadIsInChunks)) {
+    return reader.fail("segmented payload not in chunks");
+  }
+  if (!reader.readSize(nopPayloadDescriptor.sizeInBytes)) {
+    return false;
+  }
+  nopPayloadDescriptor.metadata.clear();
+  if ((flags & kPayloadHasMetadata) &&
+      !reader.readString(nopPayloadDescriptor.metadata)) {
+    return false;
+  }
+  nopPayloadDescriptor.allocationHints =
+      MessageDescriptor::AllocationHintsDescriptor();
+  if ((flags & kPayloadHasAllocationHints) &&
+      !readAllocationHints(reader, nopPayloadDescriptor.allocationHints)) {
+    return false;
+  }
+  nopPayloadDescriptor.checksum = 0;
+  if (hasChecksums && !reader.readFixed32(nopPayloadDescriptor.checksum)) {
+    return false;
+  }
+  nopPayloadDescriptor.compression = PayloadCompression::kNone;
+  nopPayloadDescriptor.compressedChunkLengths.clear();
+  nopPayloadDescriptor.segmented = (flags & kPayloadIsSegmented) != 0;
+  if ((flags & kPayloadIsInChunks) == 0) {
+    return true;
+  }
+  uint8_t compression;
+  if (!reader.readByte(compression)) {
+    return false;
+  }
+  if (!isValidPayloadCompression(compression)) {
+    return reader.fail("unknown payload compression");
+  }
+  nopPayloadDescriptor.compression =
+      static_cast<PayloadCompression>(compression);
+  if (nopPayloadDescriptor.segmented &&
+      nopPayloadDescriptor.compression != PayloadCompression::kNone) {
+    return reader.fail("segmented payload compressed");
+  }
+  uint64_t numChunks;
+  if (!reader.readCount(numChunks)) {
+    return false;
+  }
+  nopPayloadDescriptor.compressedChunkLengths.resize(numChunks);
+  for (uint64_t& length : nopPayloadDescriptor.compressedChunkLengths) {
+    if (!reader.readVarint(length)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool readTensorDescriptor(
+    Reader& reader,
+    bool hasChecksums,
+    bool handsOffTensors,
+    const std::vector<std::string>& channelNames,
+    MessageDescriptor::TensorDescriptor& nopTensorDescriptor) {
+  uint8_t flags;
+  if (!reader.readByte(flags)) {
+    return false;
+  }
+  if ((flags &
+       ~(kTensorHasMetadata | kTensorHasChannelDescriptor |
+         kTensorIsDeduplicated | kTensorHasAllocationHints)) != 0) {
+    return reader.fail("unknown tensor flags");
+  }
+  uint8_t deviceType;
+  if (!reader.readByte(deviceType)) {
+    return false;
+  }
+  if (!isValidDeviceType(deviceType)) {
+    return reader.fail("unknown device type");
+  }
+  nopTensorDescriptor.deviceType = static_cast<DeviceType>(deviceType);
+  if (!reader.readSize(nopTensorDescriptor.sizeInBytes)) {
+    return false;
+  }
+  uint64_t channelIndex;
+  if (!reader.readVarint(channelIndex)) {
+    return false;
+  }
+  if (channelIndex > channelNames.size()) {
+    return reader.fail("unknown channel index");
+  }
+  if (channelIndex == 0) {
+    nopTensorDescriptor.channelName.clear();
+  } else {
+    nopTensorDescriptor.channelName = channelNames[channelIndex - 1];
+  }
+  nopTensorDescriptor.handoffId = 0;
+  if (handsOffTensors && !reader.readVarint(nopTensorDescriptor.handoffId)) {
+    return false;
+  }
+  nopTensorDescriptor.metadata.clear();
+  if ((flags & kTensorHasMetadata) &&
+      !reader.readString(nopTensorDescriptor.metadata)) {
+    return false;
+  }
+  nopTensorDescriptor.channelDescriptor.clear();
+  if ((flags & kTensorHasChannelDescriptor) &&
+      !reader.readString(nopTensorDescriptor.channelDescriptor)) {
+    return false;
+  }
+  nopTensorDescriptor.allocationHints =
+      MessageDescriptor::AllocationHintsDescriptor();
+  if ((flags & kTensorHasAllocationHints) &&
+      !readAllocationHints(reader, nopTensorDescriptor.allocationHints)) {
+    return false;
+  }
+  nopTensorDescriptor.checksum = 0;
+  if (hasChecksums && !reader.readFixed32(nopTensorDescriptor.checksum)) {
+    return false;
+  }
+  nopTensorDescriptor.dedup = TensorDedup::kNone;
+  nopTensorDescriptor.dedupHash = 0;
+  if ((flags & kTensorIsDeduplicated) == 0) {
+    return true;
+  }
+  uint8_t dedup;
+  if (!reader.readByte(dedup)) {
+    return false;
+  }
+  if (!isValidTensorDedup(dedup)) {
+    return reader.fail("unknown tensor deduplication");
+  }
+  nopTensorDescriptor.dedup = static_cast<TensorDedup>(dedup);
+  return reader.readFixed64(nopTensorDescriptor.dedupHash);
+}
+
+} // namespace
+
+void encodeCompactMessageDescriptor(
+    const MessageDescriptor& nopMessageDescriptor,
+    const std::unordered_map<std::string, uint64_t>& channelIndices,
+    std::vector<uint8_t>& buffer,
+    const std::vector<Message::Payload>* inlinePayloads) {
+  const bool hasChecksums = nopMessageDescriptor.hasChecksums;
+  const bool handsOffTensors = nopMessageDescriptor.handsOffTensors;
+  buffer.clear();
+
+  writeByte(
+      buffer,
+      (hasChecksums ? kMessageHasChecksums : 0) |
+          (nopMessageDescriptor.metadata.empty() ? 0 : kMessageHasMetadata) |
+          (handsOffTensors ? kMessageHandsOffTensors : 0) |
+          (nopMessageDescriptor.coalescesCudaTensors
+               ? kMessageCoalescesCudaTensors
+               : 0) |
+          (inlinePayloads != nullptr ? kMessageHasInlinePayloads : 0));
+  if (!nopMessageDescriptor.metadata.empty()) {
+    writeString(buffer, nopMessageDescriptor.metadata);
+  }
+
+  writeVarint(buffer, nopMessageDescriptor.payloadDescriptors.size());
+  for (const auto& nopPayloadDescriptor :
+       nopMessageDescriptor.payloadDescriptors) {
+    const bool isInChunks =
+        nopPayloadDescriptor.compression != PayloadCompression::kNone ||
+        !nopPayloadDescriptor.compressedChunkLengths.empty();
+    const bool hasHints =
+        hasAllocationHints(nopPayloadDescriptor.allocationHints);
+    writeByte(
+        buffer,
+        (nopPayloadDescriptor.metadata.empty() ? 0 : kPayloadHasMetadata) |
+            (isInChunks ? kPayloadIsInChunks : 0) |
+            (hasHints ? kPayloadHasAllocationHints : 0) |
+            (nopPayloadDescriptor.segmented ? kPayloadIsSegmented : 0));
+    writeVarint(buffer, nopPayloadDescriptor.sizeInBytes);
+    if (!nopPayloadDescriptor.metadata.empty()) {
+      writeString(buffer, nopPayloadDescriptor.metadata);
+    }
+    if (hasHints) {
+      writeAllocationHints(buffer, nopPayloadDescriptor.allocationHints);
+    }
+    if (hasChecksums) {
+      writeFixed32(buffer, nopPayloadDescriptor.checksum);
+    }
+    if (isInChunks) {
+      writeByte(
+          buffer, static_cast<uint8_t>(nopPayloadDescriptor.compression));
+      writeVarint(buffer, nopPayloadDescriptor.compressedChunkLengths.size());
+      for (uint64_t length : nopPayloadDescriptor.compressedChunkLengths) {
+        writeVarint(buffer, length);
+      }
+    }
+  }
+
+  writeVarint(buffer, nopMessageDescriptor.tensorDescriptors.size());
+  for (const auto& nopTensorDescriptor :
+       nopMessageDescriptor.tensorDescriptors) {
+    const bool isDeduplicated = nopTensorDescriptor.dedup != TensorDedup::kNone;
+    const bool hasHints =
+        hasAllocationHints(nopTensorDescriptor.allocationHints);
+    writeByte(
+        buffer,
+        (nopTensorDescriptor.metadata.empty() ? 0 : kTensorHasMetadata) |
+            (nopTensorDescriptor.channelDescriptor.empty()
+                 ? 0
+                 : kTensorHasChannelDescriptor) |
+            (isDeduplicated ? kTensorIsDeduplicated : 0) |
+            (hasHints ? kTensorHasAllocationHints : 0));
+    writeByte(buffer, static_cast<uint8_t>(nopTensorDescriptor.deviceType));
+    writeVarint(buffer, nopTensorDescriptor.sizeInBytes);
+    if (nopTensorDescriptor.channelName.empty()) {
+      writeVarint(buffer, 0);
+    } else {
+      auto iter = channelIndices.find(nopTensorDescriptor.channelName);
+      TP_THROW_ASSERT_IF(iter == channelIndices.end())
+          << "Channel " << nopTensorDescriptor.channelName
+          << " wasn't negotiated";
+      writeVarint(buffer, iter->second + 1);
+    }
+    if (handsOffTensors) {
+      writeVarint(buffer, nopTensorDescriptor.handoffId);
+    }
+    if (!nopTensorDescriptor.metadata.empty()) {
+      writeString(buffer, nopTensorDescriptor.metadata);
+    }
+    if (!nopTensorDescriptor.channelDescriptor.empty()) {
+      writeString(buffer, nopTensorDescriptor.channelDescriptor);
+    }
+    if (hasHints) {
+      writeAllocationHints(buffer, nopTensorDescriptor.allocationHints);
+    }
+    if (hasChecksums) {
+      writeFixed32(buffer, nopTensorDescriptor.checksum);
+    }
+    if (isDeduplicated) {
+      writeByte(buffer, static_cast<uint8_t>(nopTensorDescriptor.dedup));
+      writeFixed64(buffer, nopTensorDescriptor.dedupHash);
+    }
+  }
+
+  if (inlinePayloads != nullptr) {
+    TP_DCHECK(nopMessageDescriptor.tensorDescriptors.empty());
+    TP_DCHECK_EQ(
+        inlinePayloads->size(), nopMessageDescriptor.payloadDescriptors.size());
+    for (const Message::Payload& payload : *inlinePayloads) {
+      const uint8_t* data = reinterpret_cast<const uint8_t*>(payload.data);
+      buffer.insert(buffer.end(), data, data + payload.length);
+    }
+  }
+}
+
+Error decodeCompactMessageDescriptor(
+    const std::vector<uint8_t>& buffer,
+    const std::vector<std::string>& channelNames,
+    MessageDescriptor& nopMessageDescriptor,
+    optional<size_t>* inlinePayloadsOffset) {
+  Reader reader(buffer);
+
+  // The inline payloads are only understood by the ends that asked for them.
+  const uint8_t knownFlags = kMessageHasChecksums | kMessageHasMetadata |
+      kMessageHandsOffTensors | kMessageCoalescesCudaTensors |
+      (inlinePayloadsOffset != nullptr ? kMessageHasInlinePayloads : 0);
+  uint8_t flags = 0;
+  if (reader.readByte(flags) && (flags & ~knownFlags) != 0) {
+    reader.fail("unknown message flags");
+  }
+  const bool hasChecksums = flags & kMessageHasChecksums;
+  const bool handsOffTensors = flags & kMessageHandsOffTensors;
+  nopMessageDescriptor.hasChecksums = hasChecksums;
+  nopMessageDescriptor.handsOffTensors = handsOffTensors;
+  nopMessageDescriptor.coalescesCudaTensors =
+      flags & kMessageCoalescesCudaTensors;
+  nopMessageDescriptor.metadata.clear();
+  if (flags & kMessageHasMetadata) {
+    reader.readString(nopMessageDescriptor.metadata);
+  }
+
+  uint64_t numPayloads = 0;
+  if (reader.readCount(numPayloads)) {
+    nopMessageDescriptor.payloadDescriptors.resize(numPayloads);
+  }
+  for (auto& nopPayloadDescriptor : nopMessageDescriptor.payloadDescriptors) {
+    if (!readPayloadDescriptor(reader, hasChecksums, nopPayloadDescriptor)) {
+      break;
+    }
+  }
+
+  uint64_t numTensors = 0;
+  if (reader.readCount(numTensors)) {
+    nopMessageDescriptor.tensorDescriptors.resize(numTensors);
+  }
+  for (auto& nopTensorDescriptor : nopMessageDescriptor.tensorDescriptors) {
+    if (!readTensorDescriptor(
+            reader,
+            hasChecksums,
+            handsOffTensors,
+            channelNames,
+            nopTensorDescriptor)) {
+      break;
+    }
+  }
+
+  if (inlinePayloadsOffset != nullptr) {
+    inlinePayloadsOffset->reset();
+  }
+  // The flag was rejected above if the offset isn't wanted.
+  if (reader.ok() && (flags & kMessageHasInlinePayloads)) {
+    if (numTensors > 0) {
+      reader.fail("inline payloads with tensors");
+    }
+    *inlinePayloadsOffset = reader.offset();
+    for (const auto& nopPayloadDescriptor :
+         nopMessageDescriptor.payloadDescriptors) {
+      if (nopPayloadDescriptor.compression != PayloadCompression::kNone ||
+          !nopPayloadDescriptor.compressedChunkLengths.empty()) {
+        reader.fail("inline payload in chunks");
+      }
+      if (!reader.skip(nopPayloadDescriptor.sizeInBytes)) {
+        break;
+      }
+    }
+  }
+
+  return reader.finish();
+}
+
+} // namespace tensorpipe
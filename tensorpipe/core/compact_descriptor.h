@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/core/message.h>
+#include <tensorpipe/core/nop_types.h>
+
+namespace tensorpipe {
+
+// The formats of the message descriptors, which the two ends of a pipe agree
+// upon in the brochure by picking the highest one they both support. The first
+// one is the MessageDescriptor nop object, the second one is the compact
+// encoding below, carried by a CompactMessageDescriptor nop object. The third
+// one is the same as the second one, except that the descriptor may carry the
+// payloads of the message right after it, for the messages without tensors.
+constexpr uint64_t kNopMessageDescriptorVersion = 0;
+constexpr uint64_t kCompactMessageDescriptorVersion = 1;
+constexpr uint64_t kCompactMessageDescriptorWithInlinePayloadsVersion = 2;
+
+// Encode the descriptor in a compact format, which refers to the channels by
+// their index (as given by the map, which the ends of the pipe negotiated),
+// leaves out the empty strings and the checksums of messages that don't have
+// them, and writes the integers as varints. The buffer is overwritten, but its
+// memory is reused. If given, the payloads (which must be those described, none
+// of them in chunks, and the message must have no tensors) are copied in after
+// the descriptor.
+void encodeCompactMessageDescriptor(
+    const MessageDescriptor& nopMessageDescriptor,
+    const std::unordered_map<std::string, uint64_t>& channelIndices,
+    std::vector<uint8_t>& buffer,
+    const std::vector<Message::Payload>* inlinePayloads = nullptr);
+
+// Decode a descriptor in the compact format into the given one, reusing the
+// memory of its strings and vectors, and resolving the indices of the channels
+// with the given names. Return an error if the data is malformed. If the
+// payloads were carried inline, and the caller accepts them (i.e., gave where
+// to put it), set the offset at which they start in the buffer, one after the
+// other, otherwise reset it.
+Error decodeCompactMessageDescriptor(
+    const std::vector<uint8_t>& buffer,
+    const std::vector<std::string>& channelNames,
+    MessageDescriptor& nopMessageDescriptor,
+    optional<size_t>* inlinePayloadsOffset = nullptr);
+
+} // namespace tensorpipe
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/compression.h>
+
+#include <limits>
+#include <tuple>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/core/error.h>
+
+namespace tensorpipe {
+
+const char* payloadCompressionToString(PayloadCompression compression) {
+  switch (compression) {
+    case PayloadCompression::kNone:
+      return "none";
+    case PayloadCompression::kLz4:
+      return "lz4";
+    case PayloadCompression::kZstd:
+      return "zstd";
+    default:
+      TP_THROW_ASSERT() << "Unknown compression";
+  }
+  // Return bogus to silence "return from non-void function" warning.
+  return nullptr;
+}
+
+PayloadCompressor::PayloadCompressor() {
+  Error error;
+  std::tie(error, lz4Lib_) = Lz4Lib::create();
+  if (error) {
+    TP_VLOG(7) << "Couldn't load liblz4: " << error.what();
+  } else {
+    lz4Available_ = true;
+  }
+  std::tie(error, zstdLib_) = ZstdLib::create();
+  if (error) {
+    TP_VLOG(7) << "Couldn't load libzstd: " << error.what();
+  } else {
+    zstdAvailable_ = true;
+  }
+}
+
+bool PayloadCompressor::isAvailable(PayloadCompression compression) const {
+  switch (compression) {
+    case PayloadCompression::kNone:
+      return true;
+    case PayloadCompression::kLz4:
+      return lz4Available_;
+    case PayloadCompression::kZstd:
+      return zstdAvailable_;
+    default:
+      return false;
+  }
+}
+
+size_t PayloadCompressor::compress(
+    PayloadCompression compression,
+    const void* src,
+    size_t srcLength,
+    void* dst,
+    size_t dstCapacity) const {
+  TP_DCHECK(isAvailable(compression));
+  switch (compression) {
+    case PayloadCompression::kLz4: {
+      // The lengths are ints for lz4, which the chunks are far from reaching.
+      TP_DCHECK_LE(srcLength, std::numeric_limits<int>::max());
+      TP_DCHECK_LE(dstCapacity, std::numeric_limits<int>::max());
+      int rv = lz4Lib_.compress_default(
+          reinterpret_cast<const char*>(src),
+          reinterpret_cast<char*>(dst),
+          static_cast<int>(srcLength),
+          static_cast<int>(dstCapacity));
+      return rv > 0 ? static_cast<size_t>(rv) : 0;
+    }
+    case PayloadCompression::kZstd: {
+      size_t rv = zstdLib_.compress(
+          dst, dstCapacity, src, srcLength, kZstdCompressionLevel);
+      return zstdLib_.isError(rv) ? 0 : rv;
+    }
+    default:
+      TP_THROW_ASSERT() << "Unexpected compression "
+                        << payloadCompressionToString(compression);
+  }
+  // Return bogus to silence "return from non-void function" warning.
+  return 0;
+}
+
+Error PayloadCompressor::decompress(
+    PayloadCompression compression,
+    const void* src,
+    size_t srcLength,
+    void* dst,
+    size_t dstLength) const {
+  if (compression == PayloadCompression::kNone || !isAvailable(compression)) {
+    return TP_CREATE_ERROR(
+        DecompressionError,
+        std::string("unsupported compression ") +
+            payloadCompressionToString(compression));
+  }
+  switch (compression) {
+    case PayloadCompression::kLz4: {
+      TP_DCHECK_LE(srcLength, std::numeric_limits<int>::max());
+      TP_DCHECK_LE(dstLength, std::numeric_limits<int>::max());
+      int rv = lz4Lib_.decompress_safe(
+          reinterpret_cast<const char*>(src),
+          reinterpret_cast<char*>(dst),
+          static_cast<int>(srcLength),
+          static_cast<int>(dstLength));
+      if (rv < 0) {
+        return TP_CREATE_ERROR(DecompressionError, "lz4: malformed input");
+      }
+      if (static_cast<size_t>(rv) != dstLength) {
+        return TP_CREATE_ERROR(
+            DecompressionError,
+            "lz4: got " + std::to_string(rv) + " bytes, expected " +
+                std::to_string(dstLength));
+      }
+      break;
+    }
+    case PayloadCompression::kZstd: {
+      size_t rv = zstdLib_.decompress(dst, dstLength, src, srcLength);
+      if (zstdLib_.isError(rv)) {
+        return TP_CREATE_ERROR(
+            DecompressionError,
+            std::string("zstd: ") + zstdLib_.getErrorName(rv));
+      }
+      if (rv != dstLength) {
+        return TP_CREATE_ERROR(
+            DecompressionError,
+            "zstd: got " + std::to_string(rv) + " bytes, expected " +
+                std::to_string(dstLength));
+      }
+      break;
+    }
+    default:
+      TP_THROW_ASSERT() << "Unexpected compression "
+                        << payloadCompressionToString(compression);
+  }
+  return Error::kSuccess;
+}
+
+} // namespace tensorpipe
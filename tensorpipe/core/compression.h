@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/lz4_lib.h>
+#include <tensorpipe/common/zstd_lib.h>
+#include <tensorpipe/core/context.h>
+
+namespace tensorpipe {
+
+// The compressed payloads are split into chunks of this size (except for the
+// last one, which may be shorter), each of which is compressed on its own, so
+// that the chunks of a payload can be worked on in parallel. Both ends must
+// agree on this, as the descriptor only carries the compressed lengths.
+constexpr size_t kPayloadCompressionChunkSize = 1024 * 1024;
+
+// The speed/ratio trade-off of zstd. Low levels are the fast ones.
+constexpr int kZstdCompressionLevel = 1;
+
+const char* payloadCompressionToString(PayloadCompression compression);
+
+// Compresses and decompresses the chunks of the payloads with the libraries of
+// the algorithms that could be loaded. It's safe to use from any thread.
+class PayloadCompressor {
+ public:
+  // Try to load the library of each algorithm.
+  PayloadCompressor();
+
+  // Whether the library of the given algorithm was loaded. The algorithm that
+  // doesn't compress is always available.
+  bool isAvailable(PayloadCompression compression) const;
+
+  // Compress the source into the target, of the given capacity, and return the
+  // length of the compressed data, or zero if it doesn't fit in the target.
+  size_t compress(
+      PayloadCompression compression,
+      const void* src,
+      size_t srcLength,
+      void* dst,
+      size_t dstCapacity) const;
+
+  // Decompress the source into the target, which must end up exactly filled.
+  Error decompress(
+      PayloadCompression compression,
+      const void* src,
+      size_t srcLength,
+      void* dst,
+      size_t dstLength) const;
+
+ private:
+  Lz4Lib lz4Lib_;
+  bool lz4Available_{false};
+  ZstdLib zstdLib_;
+  bool zstdAvailable_{false};
+};
+
+} // namespace tensorpipe
@@ -12,18 +12,33 @@
 #include <unistd.h>
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <map>
+#include <mutex>
 #include <thread>
+#include <tuple>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/optional.h>
 #include <tensorpipe/common/queue.h>
+#include <tensorpipe/common/system.h>
 #include <tensorpipe/core/buffer_helpers.h>
 #include <tensorpipe/core/context_impl.h>
 #include <tensorpipe/core/listener.h>
 #include <tensorpipe/core/pipe.h>
 #include <tensorpipe/transport/connection.h>
+#include <tensorpipe/transport/inproc/context.h>
+
+#if TENSORPIPE_SUPPORTS_CUDA
+#include <tensorpipe/common/cuda.h>
+#endif // TENSORPIPE_SUPPORTS_CUDA
 
 namespace tensorpipe {
 
@@ -31,6 +46,9 @@ namespace {
 
 uint64_t contextCouter{0};
 
+// How often the footprint is compared against the soft limit, if any.
+constexpr std::chrono::milliseconds kMemoryCheckInterval{1000};
+
 std::string createContextId() {
   // Should we use argv[0] instead of the PID? It may be more semantically
   // meaningful and consistent across runs, but it may not be unique...
@@ -63,6 +81,8 @@ class Context::Impl : public Context::PrivateIface,
 
   std::shared_ptr<Pipe> connect(const std::string& url, PipeOptions opts);
 
+  void warmPipes(const std::string& url, size_t numPipes, PipeOptions opts);
+
   ClosingEmitter& getClosingEmitter() override;
 
   std::shared_ptr<transport::Context> getTransport(
@@ -87,15 +107,93 @@ class Context::Impl : public Context::PrivateIface,
 
   const std::string& getName() override;
 
+  bool isCollectingStats() override;
+
+  void mergeStats(const PipeStats& stats) override;
+
+  PipeStats getStats();
+
+  std::map<std::string, LoopStats> getLoopStats();
+
+  std::map<std::string, transport::TransportStats> getTransportStats();
+
+  std::map<std::string, channel::ChannelStats> getChannelStats();
+
+  std::map<std::string, MemoryFootprint> getMemoryFootprint();
+
+  size_t getReadAheadWindow() override;
+
+  std::chrono::microseconds getWriteCoalescingBudget() override;
+
+  size_t getWriteCoalescingThreshold() override;
+
+  bool isMultiplexingChannelConnections() override;
+
+  bool isChecksummingPayloads() override;
+
+  const PayloadCompressor& getPayloadCompressor() override;
+
+  WorkerPool& getCompressionPool() override;
+
+  std::shared_ptr<SerialExecutor> createCallbackExecutor() override;
+
+  TimerWheel& getTimerWheel() override;
+
+#if TENSORPIPE_SUPPORTS_CUDA
+  const CudaLib* getCudaLib() override;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+  std::pair<size_t, size_t> getChannelTensorLengthRange(
+      const std::string& channel) override;
+
+  ChannelRankingCache* getChannelRankingCache() override;
+
+  MemoryFootprintCounters& getMemoryFootprintCounters() override;
+
+  bool isUsingLoopbackPipes() override;
+
+  void addLoopbackUrl(std::string url, std::string address) override;
+
+  void removeLoopbackUrl(const std::string& url) override;
+
   void close();
 
   void join();
 
-  ~Impl() override = default;
+  bool join(std::chrono::milliseconds timeout);
+
+  void joinAsync(join_callback_fn fn);
+
+  bool isJoinDetached();
+
+  ~Impl() override;
 
  private:
   std::atomic<bool> closed_{false};
-  std::atomic<bool> joined_{false};
+
+  // The transports and channels are joined concurrently, each from a thread of
+  // its own, as some of them take a while (e.g., to wait for their loops to
+  // drain or to release the memory registered with the devices). The last one
+  // to finish joins the rest of the context and calls the callbacks of
+  // joinAsync. The threads belong to the context, whose destructor waits for
+  // them, so that they can outlive a join that gave up on them but not the
+  // context itself.
+  struct JoinState {
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t numLeft{0};
+    bool done{false};
+    std::vector<join_callback_fn> callbacks;
+    std::vector<std::thread> threads;
+  };
+  std::once_flag joinOnceFlag_;
+  JoinState joinState_;
+  // Set once the caller stopped waiting for the join, after a timeout or by
+  // going for joinAsync, for the destructor not to wait for it either.
+  std::atomic<bool> joinDetached_{false};
+
+  void startJoin();
+  void finishJoin();
 
   // An identifier for the context, either consisting of the user-provided name
   // for this context (see below) or, by default, composed of unique information
@@ -115,6 +213,68 @@ class Context::Impl : public Context::PrivateIface,
   // identify the endpoints of a pipe.
   std::string name_;
 
+  const bool collectStats_;
+
+  const size_t readAheadWindow_;
+
+  const std::chrono::microseconds writeCoalescingBudget_;
+  const size_t writeCoalescingThreshold_;
+
+  const bool multiplexChannelConnections_;
+
+  const bool payloadChecksums_;
+
+  const PayloadCompressor payloadCompressor_;
+
+  // Its threads are only started if some pipe compresses its payloads or
+  // receives compressed ones.
+  WorkerPool compressionPool_;
+
+  // Either the executor given by the user or one that submits to the pool of
+  // the context, if any, and otherwise empty, in which case the callbacks are
+  // run inline.
+  std::unique_ptr<WorkerPool> callbackPool_;
+  ContextOptions::callback_executor_fn callbackExecutor_;
+
+  // Its thread is only started by the first operation that has a deadline. The
+  // ticks are coarse, as the deadlines are meant to catch operations that are
+  // stuck rather than to time them precisely, and they make a turn of the wheel
+  // cover a few seconds, which is past most deadlines.
+  TimerWheel timerWheel_{std::chrono::milliseconds(10), 512, "TP_timer"};
+
+#if TENSORPIPE_SUPPORTS_CUDA
+  // Loaded by the first pipe that needs it, see getCudaLib.
+  std::once_flag cudaLibOnceFlag_;
+  bool hasCudaLib_{false};
+  CudaLib cudaLib_;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+  // Never modified after construction, hence safe to access from the pipes.
+  const std::unordered_map<std::string, std::pair<size_t, size_t>>
+      channelTensorLengthRanges_;
+
+  // Only set if the pipes rank their channels.
+  const std::unique_ptr<ChannelRankingCache> channelRankingCache_;
+
+  // The messages that the pipes are yet to write.
+  MemoryFootprintCounters memoryFootprintCounters_;
+
+  // Zero if there is no soft limit, in which case the checks never start.
+  const uint64_t memorySoftLimit_;
+  std::once_flag memoryChecksOnceFlag_;
+
+  // Shared by all the channels, if any, see registerChannel.
+  const std::shared_ptr<PinnedMemoryAllocator> pinnedMemoryAllocator_;
+
+  // Start the periodic checks of the footprint, once the transports and the
+  // channels have all been registered, as they're then used from the timer.
+  void startMemoryChecks();
+  void checkMemoryFootprint();
+
+  // The statistics of all the operations of all pipes, merged as they complete.
+  std::mutex statsMutex_;
+  PipeStats stats_;
+
   std::unordered_map<std::string, std::shared_ptr<transport::Context>>
       transports_;
 
@@ -130,6 +290,30 @@ class Context::Impl : public Context::PrivateIface,
 
   ClosingEmitter closingEmitter_;
 
+  // The pipes that were opened ahead of time, by URL, and the options to open
+  // them with. Pipes are opened, and closed, outside of the mutex.
+  struct PipePool {
+    PipeOptions opts;
+    size_t numPipes;
+    // The pipes that are being opened to refill the pool, so that concurrent
+    // refills don't overfill it.
+    size_t numPipesBeingOpened{0};
+    std::deque<std::shared_ptr<Pipe>> pipes;
+  };
+  std::mutex pipePoolsMutex_;
+  std::unordered_map<std::string, std::shared_ptr<PipePool>> pipePools_;
+
+  // The URLs of this context's listeners, with the addresses of the loopback
+  // transport that the pipes that connect to them go to instead.
+  std::mutex loopbackUrlsMutex_;
+  std::unordered_map<std::string, std::string> loopbackUrls_;
+
+  std::shared_ptr<Pipe> createPipe(const std::string& url, PipeOptions opts);
+  void fillPipePool(
+      const std::string& url,
+      const std::shared_ptr<PipePool>& pool,
+      size_t numPipes);
+
   template <typename TBuffer>
   std::shared_ptr<channel::Context<TBuffer>> getChannel(
       const std::string& channel);
@@ -139,12 +323,45 @@ Context::Context(ContextOptions opts)
     : impl_(std::make_shared<Context::Impl>(std::move(opts))) {}
 
 Context::Impl::Impl(ContextOptions opts)
-    : id_(createContextId()), name_(std::move(opts.name_)) {
+    : id_(createContextId()),
+      name_(std::move(opts.name_)),
+      collectStats_(opts.collectStats_),
+      readAheadWindow_(opts.readAheadWindow_),
+      writeCoalescingBudget_(opts.writeCoalescingBudget_),
+      writeCoalescingThreshold_(opts.writeCoalescingThreshold_),
+      multiplexChannelConnections_(opts.multiplexChannelConnections_),
+      payloadChecksums_(opts.payloadChecksums_),
+      compressionPool_(opts.numCompressionThreads_, "TP_compression"),
+      callbackExecutor_(std::move(opts.callbackExecutor_)),
+      channelTensorLengthRanges_(std::move(opts.channelTensorLengthRanges_)),
+      channelRankingCache_(
+          opts.channelRankingTtl_.count() > 0
+              ? std::make_unique<ChannelRankingCache>(opts.channelRankingTtl_)
+              : nullptr),
+      memorySoftLimit_(opts.memorySoftLimit_),
+      pinnedMemoryAllocator_(std::move(opts.pinnedMemoryAllocator_)) {
+  if (!callbackExecutor_ && opts.numCallbackThreads_ > 0) {
+    callbackPool_ =
+        std::make_unique<WorkerPool>(opts.numCallbackThreads_, "TP_callback");
+    callbackExecutor_ = [pool{callbackPool_.get()}](
+                            MoveOnlyFunction<void()> task) {
+      pool->submit(std::move(task));
+    };
+  }
+  if (collectStats_) {
+    enableLockStats();
+  }
   TP_VLOG(1) << "Context " << id_ << " created";
   if (name_ != "") {
     TP_VLOG(1) << "Context " << id_ << " aliased as " << name_;
     id_ = name_;
   }
+  if (opts.loopbackPipes_) {
+    registerTransport(
+        std::numeric_limits<int64_t>::max(),
+        kLoopbackTransportName,
+        std::make_shared<transport::inproc::Context>());
+  }
 }
 
 void Context::registerTransport(
@@ -171,6 +388,9 @@ void Context::Impl::registerTransport(
   }
   TP_VLOG(1) << "Context " << id_ << " is registering transport " << transport;
   context->setId(id_ + ".tr_" + transport);
+  if (collectStats_) {
+    context->enableLoopStats();
+  }
   transports_.emplace(transport, context);
   // Reverse the priority, as the pipe will pick the *first* available transport
   // it can find in the ordered map, so higher priorities should come first.
@@ -197,6 +417,13 @@ void Context::Impl::registerChannel(
   }
   TP_VLOG(1) << "Context " << id_ << " is registering channel " << channel;
   context->setId(id_ + ".ch_" + channel);
+  if (collectStats_) {
+    context->enableLoopStats();
+    context->enableChannelStats();
+  }
+  if (pinnedMemoryAllocator_ != nullptr) {
+    context->setPinnedMemoryAllocator(pinnedMemoryAllocator_);
+  }
   channels.emplace(channel, context);
   // Reverse the priority, as the pipe will pick the *first* available channel
   // it can find in the ordered map, so higher priorities should come first.
@@ -226,6 +453,7 @@ std::shared_ptr<Listener> Context::listen(
 
 std::shared_ptr<Listener> Context::Impl::listen(
     const std::vector<std::string>& urls) {
+  startMemoryChecks();
   std::string listenerId =
       id_ + "[l" + std::to_string(listenerCounter_++) + "]";
   TP_VLOG(1) << "Context " << id_ << " is opening listener " << listenerId;
@@ -245,11 +473,126 @@ std::shared_ptr<Pipe> Context::connect(
 std::shared_ptr<Pipe> Context::Impl::connect(
     const std::string& url,
     PipeOptions opts) {
+  // These are destroyed, and thus closed, once the mutex is released.
+  std::vector<std::shared_ptr<Pipe>> failedPipes;
+  std::shared_ptr<PipePool> pool;
+  std::shared_ptr<Pipe> pipe;
+  size_t numPipesToOpen = 0;
+  {
+    std::unique_lock<std::mutex> lock(pipePoolsMutex_);
+    auto iter = pipePools_.find(url);
+    // The pipes of the pool can only stand in for those with the same options.
+    if (iter != pipePools_.end() && iter->second->opts == opts) {
+      pool = iter->second;
+      while (pipe == nullptr && !pool->pipes.empty()) {
+        if (pool->pipes.front()->hasFailed()) {
+          failedPipes.push_back(std::move(pool->pipes.front()));
+        } else {
+          pipe = std::move(pool->pipes.front());
+        }
+        pool->pipes.pop_front();
+      }
+      numPipesToOpen =
+          pool->numPipes - pool->pipes.size() - pool->numPipesBeingOpened;
+      pool->numPipesBeingOpened += numPipesToOpen;
+    }
+  }
+  if (pool != nullptr) {
+    fillPipePool(url, pool, numPipesToOpen);
+  }
+  if (pipe != nullptr) {
+    return pipe;
+  }
+  return createPipe(url, std::move(opts));
+}
+
+void Context::warmPipes(
+    const std::string& url,
+    size_t numPipes,
+    PipeOptions opts) {
+  impl_->warmPipes(url, numPipes, std::move(opts));
+}
+
+void Context::Impl::warmPipes(
+    const std::string& url,
+    size_t numPipes,
+    PipeOptions opts) {
+  // The pipes of the pool being replaced, if any, are closed when destroyed,
+  // once the mutex is released.
+  std::shared_ptr<PipePool> oldPool;
+  auto pool = std::make_shared<PipePool>();
+  pool->opts = std::move(opts);
+  pool->numPipes = numPipes;
+  pool->numPipesBeingOpened = numPipes;
+  {
+    std::unique_lock<std::mutex> lock(pipePoolsMutex_);
+    auto iter = pipePools_.find(url);
+    if (iter != pipePools_.end()) {
+      oldPool = std::move(iter->second);
+      pipePools_.erase(iter);
+    }
+    if (numPipes == 0) {
+      return;
+    }
+    pipePools_.emplace(url, pool);
+  }
+  TP_VLOG(1) << "Context " << id_ << " is opening " << numPipes
+             << " pipes ahead of time to " << url;
+  fillPipePool(url, pool, numPipes);
+}
+
+void Context::Impl::fillPipePool(
+    const std::string& url,
+    const std::shared_ptr<PipePool>& pool,
+    size_t numPipes) {
+  // The pool's options never change, hence they can be used without the mutex.
+  std::vector<std::shared_ptr<Pipe>> pipes;
+  for (size_t pipeIdx = 0; pipeIdx < numPipes; pipeIdx++) {
+    pipes.push_back(createPipe(url, pool->opts));
+  }
+  std::unique_lock<std::mutex> lock(pipePoolsMutex_);
+  pool->numPipesBeingOpened -= numPipes;
+  auto iter = pipePools_.find(url);
+  // If the pool was replaced or removed in the meantime, the pipes are closed
+  // when destroyed, after the mutex is released.
+  if (iter == pipePools_.end() || iter->second != pool) {
+    return;
+  }
+  for (auto& pipe : pipes) {
+    pool->pipes.push_back(std::move(pipe));
+  }
+}
+
+std::shared_ptr<Pipe> Context::Impl::createPipe(
+    const std::string& url,
+    PipeOptions opts) {
+  startMemoryChecks();
   std::string pipeId = id_ + ".p" + std::to_string(pipeCounter_++);
   TP_VLOG(1) << "Context " << id_ << " is opening pipe " << pipeId;
-  std::string remoteContextName = std::move(opts.remoteName_);
-  if (remoteContextName != "") {
-    std::string aliasPipeId = id_ + "_to_" + remoteContextName;
+  std::string targetUrl = url;
+  {
+    std::unique_lock<std::mutex> lock(loopbackUrlsMutex_);
+    auto iter = loopbackUrls_.find(url);
+    if (iter != loopbackUrls_.end()) {
+      targetUrl = std::string(kLoopbackTransportName) + "://" + iter->second;
+      TP_VLOG(1) << "Pipe " << pipeId << " is going to " << targetUrl
+                 << " rather than to " << url << ", on this same context";
+    }
+  }
+  // This is the last chance to find the node of the caller's thread, as the
+  // connections of the channels are opened from the loop.
+  if (opts.numaNode_ < 0) {
+#if TENSORPIPE_SUPPORTS_CUDA
+    if (opts.cudaDevice_ >= 0) {
+      opts.numaNode_ = getNumaNodeOfCudaDevice(opts.cudaDevice_);
+    }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+    if (opts.numaNode_ < 0) {
+      opts.numaNode_ = getNumaNodeOfCurrentCpu();
+    }
+  }
+  if (opts.remoteName_ != "") {
+    std::string aliasPipeId = id_ + "_to_" + opts.remoteName_;
     TP_VLOG(1) << "Pipe " << pipeId << " aliased as " << aliasPipeId;
     pipeId = std::move(aliasPipeId);
   }
@@ -257,8 +600,8 @@ std::shared_ptr<Pipe> Context::Impl::connect(
       Pipe::ConstructorToken(),
       std::static_pointer_cast<PrivateIface>(shared_from_this()),
       std::move(pipeId),
-      std::move(remoteContextName),
-      url);
+      targetUrl,
+      std::move(opts));
 }
 
 ClosingEmitter& Context::Impl::getClosingEmitter() {
@@ -317,6 +660,234 @@ const std::string& Context::Impl::getName() {
   return name_;
 }
 
+bool Context::Impl::isCollectingStats() {
+  return collectStats_;
+}
+
+void Context::Impl::mergeStats(const PipeStats& stats) {
+  std::unique_lock<std::mutex> lock(statsMutex_);
+  stats_.merge(stats);
+}
+
+PipeStats Context::getStats() {
+  return impl_->getStats();
+}
+
+PipeStats Context::Impl::getStats() {
+  std::unique_lock<std::mutex> lock(statsMutex_);
+  return stats_;
+}
+
+std::map<std::string, LoopStats> Context::getLoopStats() {
+  return impl_->getLoopStats();
+}
+
+std::map<std::string, LoopStats> Context::Impl::getLoopStats() {
+  std::map<std::string, LoopStats> stats;
+  for (const auto& iter : transports_) {
+    for (auto& loopIter : iter.second->getLoopStats()) {
+      stats.emplace(
+          "transport/" + iter.first + "/" + loopIter.first,
+          std::move(loopIter.second));
+    }
+  }
+  forEachDeviceType([&](auto buffer) {
+    for (const auto& iter : channels_.get<decltype(buffer)>()) {
+      for (auto& loopIter : iter.second->getLoopStats()) {
+        stats.emplace(
+            "channel/" + iter.first + "/" + loopIter.first,
+            std::move(loopIter.second));
+      }
+    }
+  });
+  return stats;
+}
+
+std::map<std::string, LockStats> Context::getLockStats() {
+  return tensorpipe::getLockStats();
+}
+
+std::map<std::string, transport::TransportStats> Context::getTransportStats() {
+  return impl_->getTransportStats();
+}
+
+std::map<std::string, transport::TransportStats> Context::Impl::
+    getTransportStats() {
+  std::map<std::string, transport::TransportStats> stats;
+  for (const auto& iter : transports_) {
+    stats.emplace(iter.first, iter.second->getTransportStats());
+  }
+  return stats;
+}
+
+std::map<std::string, channel::ChannelStats> Context::getChannelStats() {
+  return impl_->getChannelStats();
+}
+
+std::map<std::string, channel::ChannelStats> Context::Impl::getChannelStats() {
+  std::map<std::string, channel::ChannelStats> stats;
+  forEachDeviceType([&](auto buffer) {
+    for (const auto& iter : channels_.get<decltype(buffer)>()) {
+      stats.emplace(iter.first, iter.second->getChannelStats());
+    }
+  });
+  return stats;
+}
+
+std::map<std::string, MemoryFootprint> Context::getMemoryFootprint() {
+  return impl_->getMemoryFootprint();
+}
+
+std::map<std::string, MemoryFootprint> Context::Impl::getMemoryFootprint() {
+  std::map<std::string, MemoryFootprint> footprints;
+  for (const auto& iter : transports_) {
+    footprints.emplace(
+        "transport/" + iter.first, iter.second->getMemoryFootprint());
+  }
+  forEachDeviceType([&](auto buffer) {
+    for (const auto& iter : channels_.get<decltype(buffer)>()) {
+      footprints.emplace(
+          "channel/" + iter.first, iter.second->getMemoryFootprint());
+    }
+  });
+  footprints.emplace("core", memoryFootprintCounters_.snapshot());
+  if (pinnedMemoryAllocator_ != nullptr) {
+    MemoryFootprint footprint;
+    footprint.pinnedBytes = pinnedMemoryAllocator_->getTotalBytes();
+    footprints.emplace("pinned_memory_allocator", footprint);
+  }
+  return footprints;
+}
+
+MemoryFootprintCounters& Context::Impl::getMemoryFootprintCounters() {
+  return memoryFootprintCounters_;
+}
+
+bool Context::Impl::isUsingLoopbackPipes() {
+  // The transport isn't registered if it isn't viable.
+  return transports_.find(kLoopbackTransportName) != transports_.end();
+}
+
+void Context::Impl::addLoopbackUrl(std::string url, std::string address) {
+  std::unique_lock<std::mutex> lock(loopbackUrlsMutex_);
+  loopbackUrls_[std::move(url)] = std::move(address);
+}
+
+void Context::Impl::removeLoopbackUrl(const std::string& url) {
+  std::unique_lock<std::mutex> lock(loopbackUrlsMutex_);
+  loopbackUrls_.erase(url);
+}
+
+void Context::Impl::startMemoryChecks() {
+  if (memorySoftLimit_ == 0) {
+    return;
+  }
+  std::call_once(memoryChecksOnceFlag_, [&]() { checkMemoryFootprint(); });
+}
+
+void Context::Impl::checkMemoryFootprint() {
+  if (closed_) {
+    return;
+  }
+  uint64_t totalBytes = 0;
+  for (const auto& iter : getMemoryFootprint()) {
+    totalBytes += iter.second.totalBytes();
+  }
+  if (totalBytes > memorySoftLimit_) {
+    TP_VLOG(1) << "Context " << id_ << " holds " << totalBytes
+               << " bytes, more than its soft limit of " << memorySoftLimit_
+               << " bytes, hence it's reclaiming memory";
+    for (auto& iter : transports_) {
+      iter.second->reclaimMemory();
+    }
+    forEachDeviceType([&](auto buffer) {
+      for (auto& iter : channels_.get<decltype(buffer)>()) {
+        iter.second->reclaimMemory();
+      }
+    });
+    if (pinnedMemoryAllocator_ != nullptr) {
+      pinnedMemoryAllocator_->releaseFreeBuffers();
+    }
+  }
+  // The timer doesn't keep the context alive, and it's dropped once the timer
+  // wheel is joined.
+  std::weak_ptr<Impl> weakImpl = shared_from_this();
+  timerWheel_.schedule(kMemoryCheckInterval, [weakImpl]() {
+    std::shared_ptr<Impl> impl = weakImpl.lock();
+    if (impl != nullptr) {
+      impl->checkMemoryFootprint();
+    }
+  });
+}
+
+size_t Context::Impl::getReadAheadWindow() {
+  return readAheadWindow_;
+}
+
+std::chrono::microseconds Context::Impl::getWriteCoalescingBudget() {
+  return writeCoalescingBudget_;
+}
+
+size_t Context::Impl::getWriteCoalescingThreshold() {
+  return writeCoalescingThreshold_;
+}
+
+bool Context::Impl::isMultiplexingChannelConnections() {
+  return multiplexChannelConnections_;
+}
+
+bool Context::Impl::isChecksummingPayloads() {
+  return payloadChecksums_;
+}
+
+const PayloadCompressor& Context::Impl::getPayloadCompressor() {
+  return payloadCompressor_;
+}
+
+WorkerPool& Context::Impl::getCompressionPool() {
+  return compressionPool_;
+}
+
+std::shared_ptr<SerialExecutor> Context::Impl::createCallbackExecutor() {
+  if (!callbackExecutor_) {
+    return nullptr;
+  }
+  return std::make_shared<SerialExecutor>(callbackExecutor_);
+}
+
+TimerWheel& Context::Impl::getTimerWheel() {
+  return timerWheel_;
+}
+
+#if TENSORPIPE_SUPPORTS_CUDA
+const CudaLib* Context::Impl::getCudaLib() {
+  std::call_once(cudaLibOnceFlag_, [this]() {
+    Error error;
+    std::tie(error, cudaLib_) = CudaLib::create();
+    if (error) {
+      TP_VLOG(1) << "Context " << id_
+                 << " couldn't load the CUDA driver: " << error.what();
+      return;
+    }
+    hasCudaLib_ = true;
+  });
+  return hasCudaLib_ ? &cudaLib_ : nullptr;
+}
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+std::pair<size_t, size_t> Context::Impl::getChannelTensorLengthRange(
+    const std::string& channel) {
+  auto iter = channelTensorLengthRanges_.find(channel);
+  if (iter == channelTensorLengthRanges_.end()) {
+    return std::make_pair(0, std::numeric_limits<size_t>::max());
+  }
+  return iter->second;
+}
+
+ChannelRankingCache* Context::Impl::getChannelRankingCache() {
+  return channelRankingCache_.get();
+}
+
 void Context::close() {
   impl_->close();
 }
@@ -325,6 +896,13 @@ void Context::Impl::close() {
   if (!closed_.exchange(true)) {
     TP_VLOG(1) << "Context " << id_ << " is closing";
 
+    {
+      // Their pipes are closed when destroyed, once the mutex is released.
+      decltype(pipePools_) pipePools;
+      std::unique_lock<std::mutex> lock(pipePoolsMutex_);
+      std::swap(pipePools, pipePools_);
+    }
+
     closingEmitter_.close();
 
     for (auto& iter : transports_) {
@@ -344,27 +922,138 @@ void Context::join() {
   impl_->join();
 }
 
-void Context::Impl::join() {
+void Context::Impl::startJoin() {
   close();
 
-  if (!joined_.exchange(true)) {
+  std::call_once(joinOnceFlag_, [&]() {
     TP_VLOG(1) << "Context " << id_ << " is joining";
 
+    std::vector<std::function<void()>> joiners;
     for (auto& iter : transports_) {
-      iter.second->join();
+      joiners.push_back([context{iter.second}]() { context->join(); });
     }
     forEachDeviceType([&](auto buffer) {
       for (auto& iter : channels_.get<decltype(buffer)>()) {
-        iter.second->join();
+        joiners.push_back([context{iter.second}]() { context->join(); });
       }
     });
 
-    TP_VLOG(1) << "Context " << id_ << " done joining";
+    if (joiners.empty()) {
+      finishJoin();
+      return;
+    }
+    {
+      std::unique_lock<std::mutex> lock(joinState_.mutex);
+      joinState_.numLeft = joiners.size();
+    }
+    for (auto& joiner : joiners) {
+      joinState_.threads.emplace_back([this, joiner{std::move(joiner)}]() {
+        setUpThread(ThreadOptions(), "TP_join");
+        joiner();
+        bool isLast;
+        {
+          std::unique_lock<std::mutex> lock(joinState_.mutex);
+          isLast = --joinState_.numLeft == 0;
+        }
+        if (isLast) {
+          finishJoin();
+        }
+      });
+    }
+  });
+}
+
+void Context::Impl::finishJoin() {
+  // The pipes may still hand chunks to the pool until all of the above are
+  // done. Later, if ever, they are compressed inline.
+  compressionPool_.join();
+  // The callbacks of the pipes that failed when closing may still be in the
+  // pool, and run inline from then on.
+  if (callbackPool_ != nullptr) {
+    callbackPool_->join();
+  }
+  // The pipes are all closed, hence their deadlines no longer matter.
+  timerWheel_.join();
+
+  TP_VLOG(1) << "Context " << id_ << " done joining";
+
+  std::vector<join_callback_fn> callbacks;
+  {
+    std::unique_lock<std::mutex> lock(joinState_.mutex);
+    joinState_.done = true;
+    callbacks = std::move(joinState_.callbacks);
+  }
+  joinState_.cv.notify_all();
+  for (auto& fn : callbacks) {
+    fn();
+  }
+}
+
+void Context::Impl::join() {
+  startJoin();
+
+  std::unique_lock<std::mutex> lock(joinState_.mutex);
+  joinState_.cv.wait(lock, [&]() { return joinState_.done; });
+}
+
+bool Context::join(std::chrono::milliseconds timeout) {
+  return impl_->join(timeout);
+}
+
+bool Context::Impl::join(std::chrono::milliseconds timeout) {
+  startJoin();
+
+  std::unique_lock<std::mutex> lock(joinState_.mutex);
+  if (!joinState_.cv.wait_for(
+          lock, timeout, [&]() { return joinState_.done; })) {
+    TP_LOG_WARNING() << "Context " << id_ << " wasn't done joining after "
+                     << timeout.count() << "ms, leaving it to background";
+    joinDetached_ = true;
+    return false;
+  }
+  return true;
+}
+
+void Context::joinAsync(join_callback_fn fn) {
+  impl_->joinAsync(std::move(fn));
+}
+
+void Context::Impl::joinAsync(join_callback_fn fn) {
+  joinDetached_ = true;
+  startJoin();
+
+  std::unique_lock<std::mutex> lock(joinState_.mutex);
+  if (!joinState_.done) {
+    joinState_.callbacks.push_back(std::move(fn));
+    return;
+  }
+  lock.unlock();
+  fn();
+}
+
+bool Context::Impl::isJoinDetached() {
+  return joinDetached_;
+}
+
+Context::Impl::~Impl() {
+  for (std::thread& thread : joinState_.threads) {
+    // A callback of joinAsync may have dropped the last reference to the
+    // context, from the thread that called it. That thread is then done with
+    // the context, and just about to return.
+    if (thread.get_id() == std::this_thread::get_id()) {
+      thread.detach();
+    } else {
+      thread.join();
+    }
   }
 }
 
 Context::~Context() {
-  join();
+  if (impl_->isJoinDetached()) {
+    impl_->close();
+  } else {
+    join();
+  }
 }
 
 } // namespace tensorpipe
@@ -8,14 +8,28 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
 #include <memory>
 #include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/common/lock_stats.h>
+#include <tensorpipe/common/memory_footprint.h>
+#include <tensorpipe/common/pinned_memory_allocator.h>
 #include <tensorpipe/config.h>
+#include <tensorpipe/core/stats.h>
 #include <tensorpipe/transport/context.h>
 
 #include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/channel/stats.h>
 #if TENSORPIPE_SUPPORTS_CUDA
 #include <tensorpipe/channel/cuda_context.h>
 #endif // TENSORPIPE_SUPPORTS_CUDA
@@ -26,6 +40,11 @@ class Context;
 class Listener;
 class Pipe;
 
+// The algorithms that the pipes can compress the payloads with. The libraries
+// that implement them (liblz4 and libzstd) are loaded at runtime, hence they
+// are only needed by the processes that use them.
+enum class PayloadCompression { kNone, kLz4, kZstd };
+
 class ContextOptions {
  public:
   // The name should be a semantically meaningful description of this context.
@@ -36,8 +55,203 @@ class ContextOptions {
     return std::move(*this);
   }
 
+  // Have the pipes record the latency of each stage of their operations and
+  // the amount of data going through each transport and channel, have the
+  // event loops of the transports and channels registered with the context
+  // record how busy they are, and have the CUDA channels time their copies on
+  // the GPU. This has a small cost, hence it's disabled by default. The
+  // statistics can then be obtained from each pipe and, aggregated, from the
+  // context. This also starts profiling the internal mutexes, for the whole
+  // process (see getLockStats).
+  ContextOptions&& collectStats(bool collectStats) && {
+    collectStats_ = collectStats;
+    return std::move(*this);
+  }
+
+  // By default a pipe reads the descriptor of a message only once the user has
+  // provided the memory for the previous one, as the payloads of the latter
+  // come first on the connection. With a non-zero window, the pipes will read
+  // the payloads of up to that many messages into internal buffers in order
+  // to get to the descriptors of the next ones, so that readDescriptor calls
+  // complete without waiting for the reads of earlier messages. Those payloads
+  // are later copied into the user's memory. This removes head-of-line blocking
+  // for streams of small messages, at the cost of an extra copy.
+  ContextOptions&& readAheadWindow(size_t readAheadWindow) && {
+    readAheadWindow_ = readAheadWindow;
+    return std::move(*this);
+  }
+
+  // Have the pipes hold the messages that are written while an earlier write
+  // of theirs is still going out on their connection, and write them all at
+  // once, as a single write of the transport, rather than one by one. They go
+  // out as soon as that earlier write is done, once the ones that are held add
+  // up to the given number of bytes (of payloads and inlined tensors), or once
+  // the first of them has been held for the given budget. That last bound is
+  // checked whenever a message is written, and otherwise by a timer of the
+  // context whose ticks are a few milliseconds long. An idle pipe thus writes a
+  // message right away, and only the bursts of small messages (e.g., the
+  // replies to many concurrent requests) wait, for fewer writes and wakeups of
+  // the peer. A message that is as large as the threshold goes out right away
+  // too, together with the ones held before it. A threshold of zero, the
+  // default, disables it. It applies to the writes of all the pipes, including
+  // those created by a listener.
+  ContextOptions&& writeCoalescing(
+      std::chrono::microseconds budget,
+      size_t threshold) && {
+    writeCoalescingBudget_ = budget;
+    writeCoalescingThreshold_ = threshold;
+    return std::move(*this);
+  }
+
+  // Restrict the channel with the given name to the tensors whose length (in
+  // bytes) is at least minLength and less than maxLength. For each tensor, the
+  // pipes use the highest-priority channel that both endpoints support and
+  // whose range includes the tensor, and otherwise fall back to the highest-
+  // priority channel that both endpoints support. Channels accept any tensor by
+  // default. Only the outgoing side of a pipe is affected, as the receiver is
+  // told by the sender which channel each tensor was sent over.
+  ContextOptions&& channelTensorLengthRange(
+      std::string channel,
+      size_t minLength,
+      size_t maxLength = std::numeric_limits<size_t>::max()) && {
+    channelTensorLengthRanges_[std::move(channel)] =
+        std::make_pair(minLength, maxLength);
+    return std::move(*this);
+  }
+
+  // Rather than only going by the channels' priorities, have the pipes rank
+  // the CPU channels that both endpoints support by how long they take to send
+  // tensors, for each class of lengths (small ones being dominated by latency
+  // and large ones by bandwidth), and use the fastest. The first few tensors of
+  // each class that a pipe sends serve as probes, going through each of the
+  // candidates in turn, and the resulting ranking is shared by all the pipes of
+  // the context to the same host (as told by its boot ID) for the given time.
+  // A send is timed until its channel is done with it, which for most channels
+  // means until the receiver got it. The length ranges of the channels (see
+  // channelTensorLengthRange) still restrict the candidates. CUDA channels are
+  // left alone, as theirs are done once the transfer is merely enqueued. Only
+  // the outgoing side of a pipe is affected. Zero, the default, disables it.
+  ContextOptions&& channelRankingTtl(std::chrono::seconds ttl) && {
+    channelRankingTtl_ = ttl;
+    return std::move(*this);
+  }
+
+  // Have the pipes compute a CRC32C checksum of each payload and CPU tensor
+  // they send, carried in the message's descriptor, which the receiving end
+  // checks once the data has arrived, failing the pipe if it doesn't match.
+  // This costs one extra pass over the data on each side, which is cheap on
+  // CPUs that compute CRC32C in hardware. CUDA tensors aren't checksummed. Only
+  // the outgoing side of a pipe is affected: the receiving side checks the
+  // checksums if and only if the sender computed them.
+  ContextOptions&& payloadChecksums(bool payloadChecksums) && {
+    payloadChecksums_ = payloadChecksums;
+    return std::move(*this);
+  }
+
+  // Have the pipes carry the connections of all their channels over a single
+  // one, rather than opening one per channel, which saves sockets and other
+  // resources of the transports (and a little time to establish the pipes)
+  // when there are many pipes. The channels' data then goes through an extra
+  // copy, hence this is mainly worth it for the channels that only exchange
+  // small control messages over their connection (such as cma or cuda_ipc)
+  // rather than their whole data (such as basic). Only the connecting side of
+  // a pipe decides this, the listening side follows.
+  ContextOptions&& multiplexChannelConnections(
+      bool multiplexChannelConnections) && {
+    multiplexChannelConnections_ = multiplexChannelConnections;
+    return std::move(*this);
+  }
+
+  // The number of threads that compress and decompress the payloads of the
+  // pipes (see PipeOptions), which are only started once they're first needed.
+  ContextOptions&& numCompressionThreads(size_t numCompressionThreads) && {
+    numCompressionThreads_ = numCompressionThreads;
+    return std::move(*this);
+  }
+
+  // By default the callbacks of the pipes (of readDescriptor, read, write and
+  // waitUntilWritable) and of the listeners (of accept) are called inline from
+  // the internal event loops, hence a slow one holds up all the pipes that
+  // share its loop. With an executor, each of them is handed to it as a task
+  // instead, which it must eventually run, on any thread. The callbacks of a
+  // same pipe or listener still run one at a time and in order. The callbacks
+  // that are given temporary memory (the payload and chunk callbacks of read)
+  // and the allocator of read are still called inline. See numCallbackThreads
+  // for a built-in executor, and PipeStats::callbackRunTime to find the
+  // callbacks that block the loops.
+  using callback_executor_fn = std::function<void(MoveOnlyFunction<void()>)>;
+
+  ContextOptions&& callbackExecutor(callback_executor_fn executor) && {
+    callbackExecutor_ = std::move(executor);
+    return std::move(*this);
+  }
+
+  // Have the callbacks be run by a pool of that many threads of the context's
+  // own, which are only started once they're first needed, rather than by an
+  // executor provided by the user (see callbackExecutor). Zero, the default,
+  // keeps the callbacks inline.
+  ContextOptions&& numCallbackThreads(size_t numCallbackThreads) && {
+    numCallbackThreads_ = numCallbackThreads;
+    return std::move(*this);
+  }
+
+  // Have the context check its memory footprint (see getMemoryFootprint) about
+  // once a second and, whenever it adds up to more than this number of bytes,
+  // ask its transports and channels to give back the memory they aren't using
+  // right now (e.g., the inboxes of idle connections, or cached staging
+  // buffers). This is a soft limit: the memory that is in use stays, and
+  // nothing is held back to stay under it. The checks only start with the first
+  // listener or pipe. Zero, the default, disables it.
+  ContextOptions&& memorySoftLimit(uint64_t numBytes) && {
+    memorySoftLimit_ = numBytes;
+    return std::move(*this);
+  }
+
+  // Have the pipes that this context opens to one of its own listeners, as
+  // given by one of the listener's URLs (see Listener::url), go over an
+  // in-process transport rather than the one of the URL, which spares the
+  // sockets, shared memory and reactors of the latter. It's registered as the
+  // "loopback" transport, above all others, which the listeners also listen
+  // on, hence the pipes that other such contexts of the same process open to
+  // them switch to it too, once connected. The tensors then go through the
+  // channel that both ends prefer, which is best made a cheap one like xth,
+  // unless the messages ask to hand them off (see Message::handOffTensors).
+  ContextOptions&& loopbackPipes(bool loopbackPipes) && {
+    loopbackPipes_ = loopbackPipes;
+    return std::move(*this);
+  }
+
+  // Have the channels that stage through pinned host memory (e.g., cuda_basic)
+  // all draw from this allocator, rather than each from a pool of its own, so
+  // that the memory that one caches can be reused by the others, and the total
+  // is bounded by the allocator alone. The application can share it too, e.g.,
+  // by passing an adapter around PyTorch's CachingHostAllocator, or by using a
+  // CudaPinnedBufferPool for its own buffers. Its memory is accounted in the
+  // footprint of the context under "pinned_memory_allocator", and released as
+  // part of the soft limit (see memorySoftLimit).
+  ContextOptions&& pinnedMemoryAllocator(
+      std::shared_ptr<PinnedMemoryAllocator> allocator) && {
+    pinnedMemoryAllocator_ = std::move(allocator);
+    return std::move(*this);
+  }
+
  private:
   std::string name_;
+  bool collectStats_{false};
+  size_t readAheadWindow_{0};
+  std::chrono::microseconds writeCoalescingBudget_{0};
+  size_t writeCoalescingThreshold_{0};
+  bool multiplexChannelConnections_{false};
+  bool payloadChecksums_{false};
+  size_t numCompressionThreads_{4};
+  callback_executor_fn callbackExecutor_;
+  size_t numCallbackThreads_{0};
+  std::unordered_map<std::string, std::pair<size_t, size_t>>
+      channelTensorLengthRanges_;
+  std::chrono::seconds channelRankingTtl_{0};
+  uint64_t memorySoftLimit_{0};
+  bool loopbackPipes_{false};
+  std::shared_ptr<PinnedMemoryAllocator> pinnedMemoryAllocator_;
 
   friend Context;
   friend Listener;
@@ -46,6 +260,10 @@ class ContextOptions {
 
 class PipeOptions {
  public:
+  // Whether pipes opened with these options and with the other ones would be
+  // the same, as for the pool of Context::warmPipes.
+  bool operator==(const PipeOptions& other) const;
+
   // The name should be a semantically meaningful description of the context
   // that the pipe is connecting to. It will only be used for logging and
   // debugging purposes, to identify the endpoints of a pipe.
@@ -54,14 +272,222 @@ class PipeOptions {
     return std::move(*this);
   }
 
+  // CPU tensors smaller than this number of bytes won't be sent through a
+  // channel but will instead be written over the pipe's connection, right after
+  // the payloads of the message. This avoids the overhead of the channels (such
+  // as their own control messages) for tiny tensors, in exchange for copying
+  // them into the transport. Zero, the default, disables it. Only the outgoing
+  // side of the pipe is affected.
+  PipeOptions&& inlineTensorThreshold(size_t inlineTensorThreshold) && {
+    inlineTensorThreshold_ = inlineTensorThreshold;
+    return std::move(*this);
+  }
+
+  // Messages with no tensors, whose payloads add up to fewer than this number
+  // of bytes, will have their payloads copied into their descriptor, hence they
+  // will go over the pipe's connection as a single buffer, which the other end
+  // reads at once, without waiting for the memory to be provided to read each
+  // payload into its place. This suits the pipes that carry many small control
+  // messages. Payloads that are compressed, and messages with checksums, aren't
+  // affected. Zero, the default, disables it, as does a remote end that doesn't
+  // support it. Only the outgoing side of the pipe is affected.
+  PipeOptions&& inlinePayloadThreshold(size_t inlinePayloadThreshold) && {
+    inlinePayloadThreshold_ = inlinePayloadThreshold;
+    return std::move(*this);
+  }
+
+  // Bound the writes that the pipe works on at once, by their number and by
+  // the total size of their payloads and tensors. The writes beyond the limits
+  // are accepted, but held back (without using any channel, buffer, etc.)
+  // until enough of the earlier ones complete. A write larger than the byte
+  // limit still goes through once it's the only one. Producers can pace
+  // themselves with Pipe::waitUntilWritable rather than queueing messages
+  // without bound. Zero, the default, disables the limit. Only the outgoing
+  // side of the pipe is affected.
+  PipeOptions&& maxWritesInFlight(size_t maxWritesInFlight) && {
+    maxWritesInFlight_ = maxWritesInFlight;
+    return std::move(*this);
+  }
+
+  PipeOptions&& maxWriteBytesInFlight(size_t maxWriteBytesInFlight) && {
+    maxWriteBytesInFlight_ = maxWriteBytesInFlight;
+    return std::move(*this);
+  }
+
+  // Compress the payloads of at least minLength bytes with the given algorithm
+  // before writing them over the connection, which is worth it for links whose
+  // bandwidth is scarcer than CPU time, and for data that compresses well. The
+  // payloads are split into chunks that are compressed (and, on the other end,
+  // decompressed) in parallel by the context's compression threads, and those
+  // chunks that don't get any smaller are sent as they are. If either end can't
+  // load the library of the algorithm the payloads are sent uncompressed. The
+  // tensors are never compressed. Only the outgoing side of the pipe is
+  // affected.
+  PipeOptions&& payloadCompression(
+      PayloadCompression payloadCompression,
+      size_t minLength = 0) && {
+    payloadCompression_ = payloadCompression;
+    payloadCompressionThreshold_ = minLength;
+    return std::move(*this);
+  }
+
+  // Write the payloads of at least minLength bytes that aren't compressed in
+  // chunks too (of kPayloadCompressionChunkSize bytes), rather than in one
+  // piece, so that the other end can hand them out as each chunk arrives (see
+  // Pipe::readInChunks) instead of only once they're whole. Zero, the default,
+  // disables it. Only the outgoing side of the pipe is affected.
+  PipeOptions&& payloadChunking(size_t minLength) && {
+    payloadChunkingThreshold_ = minLength;
+    return std::move(*this);
+  }
+
+  // CUDA tensors smaller than this number of bytes won't each be sent through
+  // a channel but will instead be gathered, by device-to-device copies, into a
+  // single buffer per message, which goes through a channel on their behalf
+  // and which the other end scatters back into its tensors. This avoids paying
+  // the overhead of the channels once per tensor for messages with many small
+  // CUDA tensors (biases, normalization parameters, ...), in exchange for the
+  // extra copies on the devices. Only the tensors that are on the same device
+  // as the first of them are gathered, and only if there are at least two.
+  // Zero, the default, disables it. Only the outgoing side of the pipe is
+  // affected.
+  PipeOptions&& cudaTensorCoalescingThreshold(size_t threshold) && {
+    cudaTensorCoalescingThreshold_ = threshold;
+    return std::move(*this);
+  }
+
+  // Gather, and scatter, the coalesced CUDA tensors (see above) of a message
+  // with a single launch of a CUDA graph, instead of a copy per tensor, when
+  // they're the very same tensors as those of an earlier message, as in the
+  // iterations of a training loop. This cuts the CPU overhead of messages with
+  // many tensors, in exchange for instantiating (and keeping) the graphs of the
+  // last few sets of tensors. It needs CUDA 11.4 or later, and is ignored
+  // otherwise. Both sides of this pipe are affected, but not those created by a
+  // listener.
+  PipeOptions&& cudaGraphsForCoalescedTensors(bool enabled) && {
+    cudaGraphsForCoalescedTensors_ = enabled;
+    return std::move(*this);
+  }
+
+  // Call the callbacks of the reads and of the writes as soon as they're done,
+  // rather than in the order of the messages, so that a small message whose
+  // tensors went through a fast channel doesn't wait behind a large one whose
+  // tensors are still on their way. The messages still go out in order, and
+  // so do the readDescriptor callbacks, but users must tell the completed ones
+  // apart by their Message::sequenceNumber. Both the reads and the writes of
+  // this pipe are affected, but not those of the pipes created by a listener.
+  PipeOptions&& unorderedCompletions(bool enabled) && {
+    unorderedCompletions_ = enabled;
+    return std::move(*this);
+  }
+
+  // Have each end of the pipe keep the contents of the last CPU tensors of at
+  // least minLength bytes that it received through a channel, up to a total of
+  // cacheCapacity bytes, and have the other end send only the hash of those
+  // that are already there, which the receiver then copies from its cache.
+  // This saves the transfer of the tensors that recur from message to message
+  // (e.g., frozen weights or embeddings that are sent over and over), in
+  // exchange for hashing every such tensor on the sending side and for copying
+  // it once more on the receiving side. The hash (the 64-bit xxHash of the
+  // contents and length) is trusted to tell contents apart, unless checksums
+  // are enabled (see ContextOptions), in which case any mismatch is caught.
+  // Zero, the default, disables it. Both sides of this pipe are affected,
+  // including the one created by a listener, which adopts these values.
+  PipeOptions&& tensorDedup(size_t minLength, size_t cacheCapacity) && {
+    tensorDedupThreshold_ = minLength;
+    tensorDedupCacheCapacity_ = cacheCapacity;
+    return std::move(*this);
+  }
+
+  // Have the writes of the connections that this pipe opens (its own, and
+  // those of the channels that go through a transport) scheduled against
+  // those of the other shaped pipes of the context, so that a bulk transfer
+  // doesn't starve latency-sensitive traffic. The pipes with pending writes
+  // share the link in proportion of their weights, and this one may also be
+  // capped to the given rate, in bytes per second (zero for none). Writes
+  // aren't split, hence the sharing is as fine as the messages are. Only the
+  // side that creates the pipe is affected, and not the channels that drive
+  // their own devices (e.g., InfiniBand or CUDA). A weight of zero, the
+  // default, disables it.
+  PipeOptions&& writeShaping(
+      uint32_t weight,
+      uint64_t maxBytesPerSecond = 0) && {
+    writeShapingWeight_ = weight;
+    writeShapingMaxBytesPerSecond_ = maxBytesPerSecond;
+    return std::move(*this);
+  }
+
+  // The NUMA node that the traffic of this pipe is local to (e.g., the one of
+  // the memory its messages are in), for the transports with loops or NICs on
+  // several nodes (e.g., ibv with several NICs) to handle the connections that
+  // the pipe opens, its own and those of its channels, on the closest ones, as
+  // handing the data over across sockets costs a good share of the throughput
+  // of small messages. By default it's the node of the thread that creates the
+  // pipe. Only the side that creates the pipe is affected: the connections of
+  // the other side were placed before they could be told apart.
+  PipeOptions&& numaNode(int numaNode) && {
+    numaNode_ = numaNode;
+    return std::move(*this);
+  }
+
+  // The CUDA device that the tensors of this pipe are on, to place it on the
+  // NUMA node of that GPU, as above, unless one is given explicitly. It's
+  // ignored if TensorPipe was built without CUDA support.
+  PipeOptions&& cudaDevice(int device) && {
+    cudaDevice_ = device;
+    return std::move(*this);
+  }
+
  private:
+  // All the fields below, to compare the options.
+  auto tie() const {
+    return std::tie(
+        remoteName_,
+        inlineTensorThreshold_,
+        inlinePayloadThreshold_,
+        maxWritesInFlight_,
+        maxWriteBytesInFlight_,
+        payloadCompression_,
+        payloadCompressionThreshold_,
+        payloadChunkingThreshold_,
+        cudaTensorCoalescingThreshold_,
+        cudaGraphsForCoalescedTensors_,
+        unorderedCompletions_,
+        tensorDedupThreshold_,
+        tensorDedupCacheCapacity_,
+        writeShapingWeight_,
+        writeShapingMaxBytesPerSecond_,
+        numaNode_,
+        cudaDevice_);
+  }
+
   std::string remoteName_;
+  size_t inlineTensorThreshold_{0};
+  size_t inlinePayloadThreshold_{0};
+  size_t maxWritesInFlight_{0};
+  size_t maxWriteBytesInFlight_{0};
+  PayloadCompression payloadCompression_{PayloadCompression::kNone};
+  size_t payloadCompressionThreshold_{0};
+  size_t payloadChunkingThreshold_{0};
+  size_t cudaTensorCoalescingThreshold_{0};
+  bool cudaGraphsForCoalescedTensors_{false};
+  bool unorderedCompletions_{false};
+  size_t tensorDedupThreshold_{0};
+  size_t tensorDedupCacheCapacity_{0};
+  uint32_t writeShapingWeight_{0};
+  uint64_t writeShapingMaxBytesPerSecond_{0};
+  int numaNode_{-1};
+  int cudaDevice_{-1};
 
   friend Context;
   friend Listener;
   friend Pipe;
 };
 
+inline bool PipeOptions::operator==(const PipeOptions& other) const {
+  return tie() == other.tie();
+}
+
 class Context final {
  public:
   explicit Context(ContextOptions opts = ContextOptions());
@@ -89,14 +515,81 @@ class Context final {
       const std::string& url,
       PipeOptions opts = PipeOptions());
 
+  // Keep a pool of the given number of pipes to the given URL, opened ahead of
+  // time with the given options, so that the next calls to connect to that URL
+  // with the same options return one of them, whose handshake and channels are
+  // likely set up already, rather than a new pipe (calls with other options
+  // open a new pipe as usual). The pool is refilled as its pipes are taken, and
+  // the pipes that fail while in the pool are discarded. This spares the setup
+  // latency to the clients that reconnect to the same peers, e.g., after
+  // transient errors. The pipes are accepted by the remote end as soon as
+  // they're opened, not when they're taken from the pool. Calling this again
+  // for the same URL replaces the pool, and a size of zero removes it.
+  void warmPipes(
+      const std::string& url,
+      size_t numPipes,
+      PipeOptions opts = PipeOptions());
+
+  // Return a snapshot of the statistics aggregated over all the operations of
+  // all the pipes of this context. They are empty unless enabled in the
+  // options.
+  PipeStats getStats();
+
+  // Return a snapshot of the statistics of the event loops of the transports
+  // and channels of this context, by "transport/<name>/<loop>" for the ones of
+  // transports and "channel/<name>/<loop>" for the ones of channels. They are
+  // empty unless enabled in the options.
+  std::map<std::string, LoopStats> getLoopStats();
+
+  // Return a snapshot of the contention on the internal mutexes, by name (e.g.,
+  // "on_demand_loop" for the ones of the pipes, "cuda_loop" for the ones of the
+  // CUDA channels and "worker_pool/<thread name>" for the ones of the pools).
+  // These are shared with the other contexts of the process, whose objects may
+  // contend for the same mutexes, and are empty unless some context enabled
+  // them in its options.
+  std::map<std::string, LockStats> getLockStats();
+
+  // Return a snapshot of the traffic of the connections of each transport of
+  // this context, by name. Unlike the above, these are always gathered.
+  std::map<std::string, transport::TransportStats> getTransportStats();
+
+  // Return a snapshot of the timings of the operations of each channel of this
+  // context, by name, measured on the GPU for the CUDA channels (and empty for
+  // the others). They are empty unless enabled in the options.
+  std::map<std::string, channel::ChannelStats> getChannelStats();
+
+  // Return a snapshot of the memory held by this context, by kind, for each of
+  // its transports (as "transport/<name>") and channels ("channel/<name>"), and
+  // for the messages that its pipes are yet to write ("core"), which belong to
+  // the user but that the pipes keep referencing, plus the shared pinned memory
+  // allocator, if any ("pinned_memory_allocator", see ContextOptions). Like the
+  // above, these are always gathered.
+  std::map<std::string, MemoryFootprint> getMemoryFootprint();
+
   // Put the context in a terminal state, in turn closing all of its pipes and
   // listeners, and release its resources. This may be done asynchronously, in
   // background.
   void close();
 
   // Wait for all resources to be released and all background activity to stop.
+  // The transports and channels release theirs concurrently, hence this takes
+  // as long as the slowest of them rather than as long as all of them.
   void join();
 
+  // Like the above, but stop waiting once the timeout has passed, returning
+  // whether all the resources had been released by then. If not, the rest of
+  // them are released in background, and the destructor of the context no
+  // longer waits for that (though a later call to join still does).
+  bool join(std::chrono::milliseconds timeout);
+
+  using join_callback_fn = std::function<void()>;
+
+  // Close the context and, without waiting for it, have the callback called
+  // once all the resources have been released, from a background thread (or
+  // inline, if they already were). Like after a join that timed out, the
+  // destructor of the context then doesn't wait for that.
+  void joinAsync(join_callback_fn fn);
+
   ~Context();
 
  private:
@@ -8,19 +8,28 @@
 
 #pragma once
 
+#include <chrono>
 #include <map>
 #include <memory>
 #include <string>
 #include <tuple>
+#include <utility>
 
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/memory_footprint.h>
+#include <tensorpipe/common/serial_executor.h>
+#include <tensorpipe/common/timer_wheel.h>
+#include <tensorpipe/common/worker_pool.h>
 #include <tensorpipe/config.h>
+#include <tensorpipe/core/channel_ranking.h>
+#include <tensorpipe/core/compression.h>
 #include <tensorpipe/core/context.h>
 #include <tensorpipe/transport/context.h>
 
 #include <tensorpipe/channel/cpu_context.h>
 #if TENSORPIPE_SUPPORTS_CUDA
 #include <tensorpipe/channel/cuda_context.h>
+#include <tensorpipe/common/cuda_lib.h>
 #endif // TENSORPIPE_SUPPORTS_CUDA
 
 namespace tensorpipe {
@@ -28,6 +37,10 @@ namespace tensorpipe {
 class Listener;
 class Pipe;
 
+// The name under which the in-process transport of the pipes of a context to
+// itself is registered (see ContextOptions::loopbackPipes).
+constexpr char kLoopbackTransportName[] = "loopback";
+
 class Context::PrivateIface {
  public:
   virtual ClosingEmitter& getClosingEmitter() = 0;
@@ -64,6 +77,77 @@ class Context::PrivateIface {
   // by the pipes and listener in order to attach it to logged messages.
   virtual const std::string& getName() = 0;
 
+  // Whether the pipes should record statistics about their operations. If so,
+  // they will report the ones of each operation, once it completes, to the
+  // context, which aggregates them.
+  virtual bool isCollectingStats() = 0;
+
+  virtual void mergeStats(const PipeStats& stats) = 0;
+
+  // How many messages the pipes may stage the payloads of in order to read the
+  // descriptors of the next ones ahead of time.
+  virtual size_t getReadAheadWindow() = 0;
+
+  // For how long, and up to how many bytes, the pipes may hold the messages
+  // written while an earlier write is going out, to write them together. A
+  // threshold of zero means they don't.
+  virtual std::chrono::microseconds getWriteCoalescingBudget() = 0;
+  virtual size_t getWriteCoalescingThreshold() = 0;
+
+  // Whether the pipes that connect should ask for all the channels to share a
+  // single connection.
+  virtual bool isMultiplexingChannelConnections() = 0;
+
+  // Whether the pipes should send checksums of the payloads and CPU tensors.
+  virtual bool isChecksummingPayloads() = 0;
+
+  // What the pipes compress and decompress the chunks of the payloads with,
+  // and the threads they do so on. Both are safe to use from any thread.
+  virtual const PayloadCompressor& getPayloadCompressor() = 0;
+  virtual WorkerPool& getCompressionPool() = 0;
+
+  // Give a pipe or a listener what to run its callbacks with, or null if they
+  // are to be run inline (see ContextOptions::callbackExecutor). Each of them
+  // gets its own, to keep its callbacks in order.
+  virtual std::shared_ptr<SerialExecutor> createCallbackExecutor() = 0;
+
+  // What the pipes enforce the deadlines of their operations with. It's safe
+  // to use from any thread.
+  virtual TimerWheel& getTimerWheel() = 0;
+
+#if TENSORPIPE_SUPPORTS_CUDA
+  // The CUDA driver, for the pipes to find out which devices their tensors are
+  // on, or null if it can't be loaded. It's loaded on first use, and it's safe
+  // to use from any thread.
+  virtual const CudaLib* getCudaLib() = 0;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+  // The range of lengths of the tensors that the user allowed the channel with
+  // the given name to be used for, as a minimum and a (past-the-end) maximum.
+  // This is safe to call from any thread.
+  virtual std::pair<size_t, size_t> getChannelTensorLengthRange(
+      const std::string& channel) = 0;
+
+  // Where the pipes share the rankings of their channels, by peer host, or
+  // null if they don't rank them (see ContextOptions::channelRankingTtl). It's
+  // safe to use from any thread.
+  virtual ChannelRankingCache* getChannelRankingCache() = 0;
+
+  // Where the pipes account for the memory they keep referencing on behalf of
+  // the user, i.e., the messages queued for writing. It's safe to use from any
+  // thread.
+  virtual MemoryFootprintCounters& getMemoryFootprintCounters() = 0;
+
+  // Whether the context has a loopback transport (see
+  // ContextOptions::loopbackPipes), for its listeners to listen on it.
+  virtual bool isUsingLoopbackPipes() = 0;
+
+  // Have the pipes that connect to the given URL of a listener of this context
+  // go to the given address of the loopback transport instead, until the
+  // listener takes it back. They're safe to call from any thread.
+  virtual void addLoopbackUrl(std::string url, std::string address) = 0;
+  virtual void removeLoopbackUrl(const std::string& url) = 0;
+
   virtual ~PrivateIface() = default;
 };
 
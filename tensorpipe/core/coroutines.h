@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+// Awaitables for the asynchronous operations of pipes, listeners and contexts,
+// for users who build with C++20 coroutines (the library itself doesn't need
+// them, and this header is empty without them). For example:
+//
+//   MessageResult result = co_await coro::readDescriptor(*pipe);
+//   if (result.error) { ... }
+//   ... allocate the memory of result.message ...
+//   result = co_await coro::read(*pipe, std::move(result.message));
+//   ... handle the request ...
+//   result = co_await coro::write(*pipe, std::move(response));
+//
+// Each awaitable keeps the result of its operation in the frame of the
+// awaiting coroutine, and hands the operation a callback that only holds a
+// pointer to it, which fits inline in the callback, hence chaining operations
+// this way allocates nothing besides the coroutine frame itself.
+//
+// The coroutine is resumed inline by the callback, i.e., on the loop of the
+// pipe or listener (or on a callback thread, see numCallbackThreads), hence it
+// mustn't block until it suspends again, unless it's given an executor to be
+// resumed on instead. It must keep the pipe or listener alive while awaiting.
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <functional>
+#include <memory>
+#include <utility>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/core/context.h>
+#include <tensorpipe/core/listener.h>
+#include <tensorpipe/core/message.h>
+#include <tensorpipe/core/pipe.h>
+
+namespace tensorpipe {
+namespace coro {
+
+struct MessageResult {
+  Error error;
+  Message message;
+};
+
+struct AcceptResult {
+  Error error;
+  std::shared_ptr<Pipe> pipe;
+};
+
+// Runs the given function (which resumes the coroutine) wherever it sees fit.
+// The same type as ContextOptions::callback_executor_fn, for that matter.
+using resume_executor_fn = std::function<void(MoveOnlyFunction<void()>)>;
+
+namespace detail {
+
+// The state shared by all awaitables: where to resume, and how.
+class AwaitableBase {
+ public:
+  explicit AwaitableBase(resume_executor_fn executor)
+      : executor_(std::move(executor)) {}
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+ protected:
+  // The awaitable may be gone as soon as the coroutine is resumed, hence what
+  // this needs is moved out of it first.
+  void resume() {
+    std::coroutine_handle<> handle = handle_;
+    if (executor_) {
+      resume_executor_fn executor = std::move(executor_);
+      executor([handle]() { handle.resume(); });
+    } else {
+      handle.resume();
+    }
+  }
+
+  std::coroutine_handle<> handle_;
+
+ private:
+  resume_executor_fn executor_;
+};
+
+// The operation is started by await_suspend, and its callback may resume the
+// coroutine right away, even before await_suspend returns (e.g., inline, or
+// from another thread), which may then destroy the awaitable, hence nothing
+// may touch it once the operation starts.
+template <typename TStart>
+class MessageAwaitable : public AwaitableBase {
+ public:
+  MessageAwaitable(TStart start, resume_executor_fn executor)
+      : AwaitableBase(std::move(executor)), start_(std::move(start)) {}
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    handle_ = handle;
+    TStart start = std::move(start_);
+    start([this](const Error& error, Message message) {
+      result_ = MessageResult{error, std::move(message)};
+      resume();
+    });
+  }
+
+  MessageResult await_resume() {
+    return std::move(result_);
+  }
+
+ private:
+  TStart start_;
+  MessageResult result_;
+};
+
+template <typename TStart>
+MessageAwaitable<TStart> makeMessageAwaitable(
+    TStart start,
+    resume_executor_fn executor) {
+  return MessageAwaitable<TStart>(std::move(start), std::move(executor));
+}
+
+class AcceptAwaitable : public AwaitableBase {
+ public:
+  AcceptAwaitable(Listener& listener, resume_executor_fn executor)
+      : AwaitableBase(std::move(executor)), listener_(listener) {}
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    handle_ = handle;
+    listener_.accept([this](const Error& error, std::shared_ptr<Pipe> pipe) {
+      result_ = AcceptResult{error, std::move(pipe)};
+      resume();
+    });
+  }
+
+  AcceptResult await_resume() {
+    return std::move(result_);
+  }
+
+ private:
+  Listener& listener_;
+  AcceptResult result_;
+};
+
+class JoinAwaitable : public AwaitableBase {
+ public:
+  JoinAwaitable(Context& context, resume_executor_fn executor)
+      : AwaitableBase(std::move(executor)), context_(context) {}
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    handle_ = handle;
+    context_.joinAsync([this]() { resume(); });
+  }
+
+  void await_resume() {}
+
+ private:
+  Context& context_;
+};
+
+} // namespace detail
+
+inline auto readDescriptor(
+    Pipe& pipe,
+    resume_executor_fn executor = nullptr) {
+  return detail::makeMessageAwaitable(
+      [&pipe](Pipe::read_descriptor_callback_fn fn) {
+        pipe.readDescriptor(std::move(fn));
+      },
+      std::move(executor));
+}
+
+// The message must come from readDescriptor, with its memory allocated.
+inline auto read(
+    Pipe& pipe,
+    Message message,
+    resume_executor_fn executor = nullptr) {
+  return detail::makeMessageAwaitable(
+      [&pipe, message{std::move(message)}](
+          Pipe::read_callback_fn fn) mutable {
+        pipe.read(std::move(message), std::move(fn));
+      },
+      std::move(executor));
+}
+
+// Read the next message into memory allocated by the given allocator (see the
+// corresponding variant of Pipe::read), in a single step.
+inline auto read(
+    Pipe& pipe,
+    Pipe::allocate_fn allocateFn,
+    resume_executor_fn executor = nullptr) {
+  return detail::makeMessageAwaitable(
+      [&pipe, allocateFn{std::move(allocateFn)}](
+          Pipe::read_callback_fn fn) mutable {
+        pipe.read(std::move(allocateFn), std::move(fn));
+      },
+      std::move(executor));
+}
+
+inline auto write(
+    Pipe& pipe,
+    Message message,
+    resume_executor_fn executor = nullptr) {
+  return detail::makeMessageAwaitable(
+      [&pipe, message{std::move(message)}](
+          Pipe::write_callback_fn fn) mutable {
+        pipe.write(std::move(message), std::move(fn));
+      },
+      std::move(executor));
+}
+
+inline detail::AcceptAwaitable accept(
+    Listener& listener,
+    resume_executor_fn executor = nullptr) {
+  return detail::AcceptAwaitable(listener, std::move(executor));
+}
+
+// Close the context and resume once all its resources have been released (see
+// Context::joinAsync), which is then from a background thread by default.
+inline detail::JoinAwaitable join(
+    Context& context,
+    resume_executor_fn executor = nullptr) {
+  return detail::JoinAwaitable(context, std::move(executor));
+}
+
+} // namespace coro
+} // namespace tensorpipe
+
+#endif // defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
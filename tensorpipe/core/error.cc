@@ -8,6 +8,7 @@
 
 #include <tensorpipe/core/error.h>
 
+#include <iomanip>
 #include <sstream>
 
 namespace tensorpipe {
@@ -26,4 +27,60 @@ std::string PipeClosedError::what() const {
   return "pipe closed";
 }
 
+std::string ChecksumMismatchError::what() const {
+  std::ostringstream ss;
+  ss << "checksum mismatch on " << buffer_ << ": expected " << std::hex
+     << std::setfill('0') << std::setw(8) << expected_ << ", got "
+     << std::setw(8) << actual_;
+  return ss.str();
+}
+
+std::string DecompressionError::what() const {
+  std::ostringstream ss;
+  ss << "decompression error: " << reason_;
+  return ss.str();
+}
+
+std::string MalformedDescriptorError::what() const {
+  std::ostringstream ss;
+  ss << "malformed message descriptor: " << reason_;
+  return ss.str();
+}
+
+std::string HandoffError::what() const {
+  std::ostringstream ss;
+  ss << "couldn't hand off tensors: " << reason_;
+  return ss.str();
+}
+
+std::string DeadlineExceededError::what() const {
+  std::ostringstream ss;
+  ss << "deadline exceeded by " << operation_;
+  return ss.str();
+}
+
+std::string PostedReceiveMismatchError::what() const {
+  std::ostringstream ss;
+  ss << "message doesn't match the posted receive: " << reason_;
+  return ss.str();
+}
+
+std::string AllocationError::what() const {
+  std::ostringstream ss;
+  ss << "couldn't allocate buffer: " << reason_;
+  return ss.str();
+}
+
+std::string MeshBootstrapError::what() const {
+  std::ostringstream ss;
+  ss << "couldn't bootstrap mesh: " << reason_;
+  return ss.str();
+}
+
+std::string TuningConfigError::what() const {
+  std::ostringstream ss;
+  ss << "invalid tuning config: " << reason_;
+  return ss.str();
+}
+
 } // namespace tensorpipe
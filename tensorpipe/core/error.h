@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 #include <tensorpipe/common/error.h>
@@ -38,4 +39,103 @@ class PipeClosedError final : public BaseError {
   std::string what() const override;
 };
 
+class ChecksumMismatchError final : public BaseError {
+ public:
+  ChecksumMismatchError(std::string buffer, uint32_t expected, uint32_t actual)
+      : buffer_(std::move(buffer)), expected_(expected), actual_(actual) {}
+
+  std::string what() const override;
+
+ private:
+  const std::string buffer_;
+  const uint32_t expected_;
+  const uint32_t actual_;
+};
+
+class DecompressionError final : public BaseError {
+ public:
+  explicit DecompressionError(std::string reason)
+      : reason_(std::move(reason)) {}
+
+  std::string what() const override;
+
+ private:
+  const std::string reason_;
+};
+
+class MalformedDescriptorError final : public BaseError {
+ public:
+  explicit MalformedDescriptorError(std::string reason)
+      : reason_(std::move(reason)) {}
+
+  std::string what() const override;
+
+ private:
+  const std::string reason_;
+};
+
+class HandoffError final : public BaseError {
+ public:
+  explicit HandoffError(std::string reason) : reason_(std::move(reason)) {}
+
+  std::string what() const override;
+
+ private:
+  const std::string reason_;
+};
+
+class DeadlineExceededError final : public BaseError {
+ public:
+  explicit DeadlineExceededError(std::string operation)
+      : operation_(std::move(operation)) {}
+
+  std::string what() const override;
+
+ private:
+  const std::string operation_;
+};
+
+class PostedReceiveMismatchError final : public BaseError {
+ public:
+  explicit PostedReceiveMismatchError(std::string reason)
+      : reason_(std::move(reason)) {}
+
+  std::string what() const override;
+
+ private:
+  const std::string reason_;
+};
+
+class AllocationError final : public BaseError {
+ public:
+  explicit AllocationError(std::string reason) : reason_(std::move(reason)) {}
+
+  std::string what() const override;
+
+ private:
+  const std::string reason_;
+};
+
+class MeshBootstrapError final : public BaseError {
+ public:
+  explicit MeshBootstrapError(std::string reason)
+      : reason_(std::move(reason)) {}
+
+  std::string what() const override;
+
+ private:
+  const std::string reason_;
+};
+
+class TuningConfigError final : public BaseError {
+ public:
+  explicit TuningConfigError(std::string reason)
+      : reason_(std::move(reason)) {}
+
+  std::string what() const override;
+
+ private:
+  const std::string reason_;
+};
+
 } // namespace tensorpipe
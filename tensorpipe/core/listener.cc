@@ -9,7 +9,9 @@
 #include <tensorpipe/core/listener.h>
 
 #include <deque>
+#include <string>
 #include <unordered_set>
+#include <vector>
 
 #include <tensorpipe/common/address.h>
 #include <tensorpipe/common/callback.h>
@@ -39,6 +41,8 @@ class Listener::Impl : public Listener::PrivateIface,
 
   void accept(accept_callback_fn fn);
 
+  void acceptBatch(size_t maxNumPipes, accept_batch_callback_fn fn);
+
   const std::map<std::string, std::string>& addresses() const override;
 
   const std::string& address(const std::string& transport) const;
@@ -60,6 +64,8 @@ class Listener::Impl : public Listener::PrivateIface,
 
   void acceptFromLoop(accept_callback_fn fn);
 
+  void acceptBatchFromLoop(size_t maxNumPipes, accept_batch_callback_fn fn);
+
   void closeFromLoop();
 
   Error error_{Error::kSuccess};
@@ -81,6 +87,10 @@ class Listener::Impl : public Listener::PrivateIface,
       listeners_;
   std::map<std::string, std::string> addresses_;
 
+  // The URLs that the pipes of this context connect to through the loopback
+  // transport rather than through their own, if any.
+  std::vector<std::string> loopbackUrls_;
+
   // A sequence number for the calls to accept.
   uint64_t nextPipeBeingAccepted_{0};
 
@@ -105,6 +115,9 @@ class Listener::Impl : public Listener::PrivateIface,
 
   ClosingReceiver closingReceiver_;
 
+  // What the user's callbacks are run with, if not inline. See ContextOptions.
+  const std::shared_ptr<SerialExecutor> callbackExecutor_;
+
   //
   // Initialization
   //
@@ -133,6 +146,24 @@ class Listener::Impl : public Listener::PrivateIface,
 
   void setError(Error error);
 
+  //
+  // Callbacks of the user
+  //
+
+  // Call a callback of the user, inline or through the context's executor
+  // (see ContextOptions::callbackExecutor).
+  template <typename TFn, typename TArg>
+  void runCallback(TFn& fn, const Error& error, TArg arg) {
+    if (callbackExecutor_ == nullptr) {
+      fn(error, std::move(arg));
+      return;
+    }
+    callbackExecutor_->submit(
+        [fn{std::move(fn)}, error, arg{std::move(arg)}]() mutable {
+          fn(error, std::move(arg));
+        });
+  }
+
   void handleError();
 
   //
@@ -170,7 +201,8 @@ Listener::Impl::Impl(
     const std::vector<std::string>& urls)
     : context_(std::move(context)),
       id_(std::move(id)),
-      closingReceiver_(context_, context_->getClosingEmitter()) {
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      callbackExecutor_(context_->createCallbackExecutor()) {
   for (const auto& url : urls) {
     std::string transport;
     std::string address;
@@ -182,6 +214,20 @@ Listener::Impl::Impl(
     addresses_.emplace(transport, listener->addr());
     listeners_.emplace(transport, std::move(listener));
   }
+
+  if (context_->isUsingLoopbackPipes() &&
+      listeners_.find(kLoopbackTransportName) == listeners_.end()) {
+    std::shared_ptr<transport::Listener> listener =
+        context_->getTransport(kLoopbackTransportName)->listen("");
+    listener->setId(id_ + ".tr_" + kLoopbackTransportName);
+    const std::string loopbackAddress = listener->addr();
+    for (const auto& iter : addresses_) {
+      loopbackUrls_.push_back(url(iter.first));
+      context_->addLoopbackUrl(loopbackUrls_.back(), loopbackAddress);
+    }
+    addresses_.emplace(kLoopbackTransportName, loopbackAddress);
+    listeners_.emplace(kLoopbackTransportName, std::move(listener));
+  }
 }
 
 void Listener::Impl::init() {
@@ -235,11 +281,11 @@ void Listener::Impl::acceptFromLoop(accept_callback_fn fn) {
              << sequenceNumber << ")";
 
   fn = [this, sequenceNumber, fn{std::move(fn)}](
-           const Error& error, std::shared_ptr<Pipe> pipe) {
+           const Error& error, std::shared_ptr<Pipe> pipe) mutable {
     TP_DCHECK_EQ(sequenceNumber, nextAcceptCallbackToCall_++);
     TP_VLOG(1) << "Listener " << id_ << " is calling an accept callback (#"
                << sequenceNumber << ")";
-    fn(error, std::move(pipe));
+    runCallback(fn, error, std::move(pipe));
     TP_VLOG(1) << "Listener " << id_ << " done calling an accept callback (#"
                << sequenceNumber << ")";
   };
@@ -252,6 +298,70 @@ void Listener::Impl::acceptFromLoop(accept_callback_fn fn) {
   acceptCallback_.arm(std::move(fn));
 }
 
+void Listener::acceptBatch(size_t maxNumPipes, accept_batch_callback_fn fn) {
+  impl_->acceptBatch(maxNumPipes, std::move(fn));
+}
+
+void Listener::Impl::acceptBatch(
+    size_t maxNumPipes,
+    accept_batch_callback_fn fn) {
+  loop_.deferToLoop([this, maxNumPipes, fn{std::move(fn)}]() mutable {
+    acceptBatchFromLoop(maxNumPipes, std::move(fn));
+  });
+}
+
+void Listener::Impl::acceptBatchFromLoop(
+    size_t maxNumPipes,
+    accept_batch_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+  TP_THROW_ASSERT_IF(maxNumPipes == 0)
+      << ": the maximum number of pipes of a batch accept must be positive";
+
+  uint64_t sequenceNumber = nextPipeBeingAccepted_++;
+  TP_VLOG(1) << "Listener " << id_ << " received a batch accept request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](
+           const Error& error,
+           std::vector<std::shared_ptr<Pipe>> pipes) mutable {
+    TP_DCHECK_EQ(sequenceNumber, nextAcceptCallbackToCall_++);
+    TP_VLOG(1) << "Listener " << id_
+               << " is calling a batch accept callback (#" << sequenceNumber
+               << ") with " << pipes.size() << " pipes";
+    runCallback(fn, error, std::move(pipes));
+    TP_VLOG(1) << "Listener " << id_
+               << " done calling a batch accept callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_, std::vector<std::shared_ptr<Pipe>>());
+    return;
+  }
+
+  acceptCallback_.arm([this, maxNumPipes, fn{std::move(fn)}](
+                          const Error& error, std::shared_ptr<Pipe> pipe) {
+    if (error) {
+      fn(error, std::vector<std::shared_ptr<Pipe>>());
+      return;
+    }
+    std::vector<std::shared_ptr<Pipe>> pipes;
+    pipes.push_back(std::move(pipe));
+    // Only successfully accepted pipes are ever stored while waiting for a
+    // callback, as errors are only delivered to the armed ones. Arming a
+    // callback while there are stored pipes fires it synchronously.
+    while (pipes.size() < maxNumPipes &&
+           acceptCallback_.numPendingTriggers() > 0) {
+      acceptCallback_.arm(
+          [&pipes](const Error& error, std::shared_ptr<Pipe> pipe) {
+            TP_DCHECK(!error);
+            pipes.push_back(std::move(pipe));
+          });
+    }
+    fn(Error::kSuccess, std::move(pipes));
+  });
+}
+
 const std::map<std::string, std::string>& Listener::addresses() const {
   return impl_->addresses();
 }
@@ -378,6 +488,10 @@ void Listener::Impl::handleError() {
   for (const auto& listener : listeners_) {
     listener.second->close();
   }
+  for (const auto& url : loopbackUrls_) {
+    context_->removeLoopbackUrl(url);
+  }
+  loopbackUrls_.clear();
   connectionsWaitingForHello_.clear();
 }
 
@@ -53,6 +53,19 @@ class Listener final {
 
   void accept(accept_callback_fn fn);
 
+  using accept_batch_callback_fn = std::function<
+      void(const Error&, std::vector<std::shared_ptr<Pipe>>)>;
+
+  // Accept several pipes at once: wait for the next pipe to be established and
+  // then also hand over all the others that were established in the meantime,
+  // up to the given maximum number. This is meant for servers that see many
+  // clients connecting at the same time, so that they don't have to rearm and
+  // bounce back between threads for each of them. The callbacks of accept and
+  // acceptBatch are invoked in the order in which they were issued, and
+  // acceptBatch counts as just one of them. In case of success the vector
+  // contains at least one pipe.
+  void acceptBatch(size_t maxNumPipes, accept_batch_callback_fn fn);
+
   // Returns map with the materialized address of listeners by transport.
   //
   // If you don't bind a transport listener to a specific port or address, it
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/mesh.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/core/error.h>
+#include <tensorpipe/core/listener.h>
+#include <tensorpipe/core/message.h>
+#include <tensorpipe/core/pipe.h>
+
+namespace tensorpipe {
+
+namespace {
+
+// The metadata of the first message on each pipe, followed by the rank of the
+// process that connected.
+constexpr char kHelloPrefix[] = "tp_mesh_rank ";
+
+// The URL without its transport and its port, if any (e.g., "10.0.0.1" for
+// "uv://10.0.0.1:5000", and "[::1]" for "uv://[::1]:5000").
+std::string hostOfUrl(const std::string& url) {
+  std::string address = url;
+  const size_t schemeEnd = address.find("://");
+  if (schemeEnd != std::string::npos) {
+    address = address.substr(schemeEnd + 3);
+  }
+  const size_t portStart = address.rfind(':');
+  if (portStart != std::string::npos &&
+      address.find(']', portStart) == std::string::npos) {
+    address = address.substr(0, portStart);
+  }
+  return address;
+}
+
+class MeshBootstrap final
+    : public std::enable_shared_from_this<MeshBootstrap> {
+ public:
+  MeshBootstrap(
+      std::shared_ptr<Context> context,
+      std::shared_ptr<Listener> listener,
+      size_t rank,
+      std::vector<std::string> urls,
+      MeshOptions options,
+      mesh_callback_fn fn)
+      : context_(std::move(context)),
+        listener_(std::move(listener)),
+        rank_(rank),
+        urls_(std::move(urls)),
+        options_(std::move(options)),
+        fn_(std::move(fn)),
+        start_(std::chrono::steady_clock::now()) {}
+
+  void start();
+
+ private:
+  struct Host {
+    // The ranks still to be connected to, in order.
+    std::deque<size_t> ranksToConnect;
+    size_t numPendingConnects{0};
+  };
+
+  const std::shared_ptr<Context> context_;
+  const std::shared_ptr<Listener> listener_;
+  const size_t rank_;
+  const std::vector<std::string> urls_;
+  const MeshOptions options_;
+  const mesh_callback_fn fn_;
+  const std::chrono::steady_clock::time_point start_;
+
+  // The pipes may call back inline when they're used, hence they're only used
+  // once the mutex is released.
+  std::mutex mutex_;
+  std::unordered_map<std::string, Host> hosts_;
+  size_t numConnectsToIssue_{0};
+  size_t numConnectsToComplete_{0};
+  size_t numAcceptsToIssue_{0};
+  size_t numAcceptsToComplete_{0};
+  bool done_{false};
+  Mesh mesh_;
+
+  std::chrono::nanoseconds sinceStart() const {
+    return std::chrono::steady_clock::now() - start_;
+  }
+
+  // Take the ranks of the host that can be connected to now.
+  std::vector<size_t> takeRanksToConnect(Host& host);
+  bool isComplete() const;
+
+  void connect(size_t peerRank);
+  void onConnected(size_t peerRank, const Error& error);
+  void acceptNext();
+  void onHello(std::shared_ptr<Pipe> pipe, const Message& message);
+
+  void finish();
+  void fail(const Error& error);
+};
+
+void MeshBootstrap::start() {
+  TP_VLOG(1) << "Bootstrapping mesh of " << urls_.size()
+             << " processes as rank " << rank_;
+  std::vector<size_t> ranksToConnect;
+  bool complete;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    mesh_.pipes.resize(urls_.size());
+    for (size_t peerRank = rank_ + 1; peerRank < urls_.size(); peerRank++) {
+      hosts_[hostOfUrl(urls_[peerRank])].ranksToConnect.push_back(peerRank);
+    }
+    numConnectsToIssue_ = urls_.size() - rank_ - 1;
+    numConnectsToComplete_ = numConnectsToIssue_;
+    numAcceptsToIssue_ = rank_;
+    numAcceptsToComplete_ = rank_;
+    for (auto& iter : hosts_) {
+      std::vector<size_t> hostRanks = takeRanksToConnect(iter.second);
+      ranksToConnect.insert(
+          ranksToConnect.end(), hostRanks.begin(), hostRanks.end());
+    }
+    complete = isComplete();
+  }
+
+  if (rank_ > 0) {
+    acceptNext();
+  }
+  for (size_t peerRank : ranksToConnect) {
+    connect(peerRank);
+  }
+  if (complete) {
+    finish();
+  }
+}
+
+std::vector<size_t> MeshBootstrap::takeRanksToConnect(Host& host) {
+  std::vector<size_t> ranks;
+  while (!host.ranksToConnect.empty() &&
+         (options_.maxPendingConnectsPerHost == 0 ||
+          host.numPendingConnects < options_.maxPendingConnectsPerHost)) {
+    ranks.push_back(host.ranksToConnect.front());
+    host.ranksToConnect.pop_front();
+    host.numPendingConnects++;
+    numConnectsToIssue_--;
+    if (numConnectsToIssue_ == 0) {
+      mesh_.timings.connectsIssued = sinceStart();
+    }
+  }
+  return ranks;
+}
+
+bool MeshBootstrap::isComplete() const {
+  return !done_ && numConnectsToComplete_ == 0 && numAcceptsToComplete_ == 0;
+}
+
+void MeshBootstrap::connect(size_t peerRank) {
+  std::shared_ptr<Pipe> pipe =
+      context_->connect(urls_[peerRank], options_.pipeOptions);
+  bool done;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done = done_;
+    if (!done_) {
+      mesh_.pipes[peerRank] = pipe;
+    }
+  }
+  if (done) {
+    pipe->close();
+    return;
+  }
+
+  // The write completes once the pipe is established.
+  Message message;
+  message.metadata = kHelloPrefix + std::to_string(rank_);
+  pipe->write(
+      std::move(message),
+      [self{shared_from_this()}, peerRank](
+          const Error& error, Message /* unused */) {
+        self->onConnected(peerRank, error);
+      });
+}
+
+void MeshBootstrap::onConnected(size_t peerRank, const Error& error) {
+  if (error) {
+    fail(error);
+    return;
+  }
+  std::vector<size_t> ranksToConnect;
+  bool complete;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (done_) {
+      return;
+    }
+    Host& host = hosts_[hostOfUrl(urls_[peerRank])];
+    host.numPendingConnects--;
+    ranksToConnect = takeRanksToConnect(host);
+    numConnectsToComplete_--;
+    if (numConnectsToComplete_ == 0) {
+      mesh_.timings.connected = sinceStart();
+    }
+    complete = isComplete();
+  }
+  for (size_t nextRank : ranksToConnect) {
+    connect(nextRank);
+  }
+  if (complete) {
+    finish();
+  }
+}
+
+void MeshBootstrap::acceptNext() {
+  listener_->accept([self{shared_from_this()}](
+                        const Error& error, std::shared_ptr<Pipe> pipe) {
+    if (error) {
+      self->fail(error);
+      return;
+    }
+    bool acceptMore;
+    {
+      std::unique_lock<std::mutex> lock(self->mutex_);
+      if (self->done_) {
+        acceptMore = false;
+      } else {
+        self->numAcceptsToIssue_--;
+        acceptMore = self->numAcceptsToIssue_ > 0;
+      }
+    }
+    pipe->read(
+        [](Message& /* unused */) {},
+        [self, pipe](const Error& error, Message message) {
+          if (error) {
+            self->fail(error);
+            pipe->close();
+            return;
+          }
+          self->onHello(pipe, message);
+        });
+    if (acceptMore) {
+      self->acceptNext();
+    }
+  });
+}
+
+void MeshBootstrap::onHello(
+    std::shared_ptr<Pipe> pipe,
+    const Message& message) {
+  const size_t prefixLength = std::strlen(kHelloPrefix);
+  size_t peerRank = 0;
+  bool valid = message.metadata.compare(0, prefixLength, kHelloPrefix) == 0;
+  if (valid) {
+    const char* rankStart = message.metadata.c_str() + prefixLength;
+    char* rankEnd;
+    peerRank = std::strtoull(rankStart, &rankEnd, /*base=*/10);
+    valid = rankEnd != rankStart && *rankEnd == '\0' && peerRank < rank_;
+  }
+
+  bool complete = false;
+  bool duplicate = false;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!done_ && valid) {
+      if (mesh_.pipes[peerRank] != nullptr) {
+        duplicate = true;
+      } else {
+        mesh_.pipes[peerRank] = pipe;
+        pipe = nullptr;
+        numAcceptsToComplete_--;
+        if (numAcceptsToComplete_ == 0) {
+          mesh_.timings.accepted = sinceStart();
+        }
+        complete = isComplete();
+      }
+    }
+  }
+  if (!valid || duplicate) {
+    fail(TP_CREATE_ERROR(
+        MeshBootstrapError,
+        duplicate ? "got two pipes from rank " + std::to_string(peerRank)
+                  : "got a pipe from an unexpected process"));
+  }
+  if (pipe != nullptr) {
+    pipe->close();
+  }
+  if (complete) {
+    finish();
+  }
+}
+
+void MeshBootstrap::finish() {
+  Mesh mesh;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (done_) {
+      return;
+    }
+    done_ = true;
+    mesh_.timings.total = sinceStart();
+    mesh = std::move(mesh_);
+  }
+  TP_VLOG(1) << "Bootstrapped mesh of " << urls_.size() << " processes in "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(
+                    mesh.timings.total)
+                    .count()
+             << "ms";
+  fn_(Error::kSuccess, std::move(mesh));
+}
+
+void MeshBootstrap::fail(const Error& error) {
+  std::vector<std::shared_ptr<Pipe>> pipes;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (done_) {
+      return;
+    }
+    done_ = true;
+    pipes = std::move(mesh_.pipes);
+  }
+  TP_VLOG(1) << "Mesh bootstrap failed (" << error.what() << ")";
+  for (const std::shared_ptr<Pipe>& pipe : pipes) {
+    if (pipe != nullptr) {
+      pipe->close();
+    }
+  }
+  fn_(error, Mesh());
+}
+
+} // namespace
+
+void bootstrapMesh(
+    std::shared_ptr<Context> context,
+    std::shared_ptr<Listener> listener,
+    size_t rank,
+    std::vector<std::string> urls,
+    MeshOptions options,
+    mesh_callback_fn fn) {
+  TP_THROW_ASSERT_IF(rank >= urls.size())
+      << "Rank " << rank << " is out of a mesh of " << urls.size();
+  auto bootstrap = std::make_shared<MeshBootstrap>(
+      std::move(context),
+      std::move(listener),
+      rank,
+      std::move(urls),
+      std::move(options),
+      std::move(fn));
+  bootstrap->start();
+}
+
+} // namespace tensorpipe
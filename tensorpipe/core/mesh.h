@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/core/context.h>
+
+namespace tensorpipe {
+
+class Listener;
+class Pipe;
+
+struct MeshOptions {
+  PipeOptions pipeOptions;
+  // The most pipes being connected at once to the processes of a same host
+  // (i.e., whose URLs only differ in their port), to spare the accept queues
+  // of their listeners, or zero for no limit. The hosts proceed in parallel.
+  size_t maxPendingConnectsPerHost{64};
+};
+
+// The time each phase of the bootstrap took, from its start.
+struct MeshTimings {
+  // Until the pipes to the processes of higher rank were all created, which
+  // may have had to wait for some of them to be established, due to the limit
+  // on the pending connects per host.
+  std::chrono::nanoseconds connectsIssued{0};
+  // Until the pipes to the processes of higher rank were all established.
+  std::chrono::nanoseconds connected{0};
+  // Until the pipes from the processes of lower rank were all accepted, and
+  // told apart.
+  std::chrono::nanoseconds accepted{0};
+  std::chrono::nanoseconds total{0};
+};
+
+struct Mesh {
+  // The pipe to each process, by rank, and null for the process itself.
+  std::vector<std::shared_ptr<Pipe>> pipes;
+  MeshTimings timings;
+};
+
+using mesh_callback_fn = std::function<void(const Error&, Mesh)>;
+
+// Establish a pipe between this process and each of the others of a group, in
+// which it has the given rank and in which each process listens on the URL of
+// its rank, for all the processes to call this at about the same time. Each
+// connects to those of higher rank and accepts the pipes of those of lower
+// rank (which must be the only ones accepted from the listener meanwhile),
+// hence there is a single pipe for each pair. All the pipes are set up at
+// once, rather than one after the other: their handshakes, and the channels
+// they open, proceed in parallel, and only the number of them in the accept
+// queue of each host is held back (see MeshOptions). The first message on each
+// pipe tells its remote end the rank it's from, and is consumed by it.
+//
+// The callback is called, from an internal thread, once all the pipes are
+// established, or as soon as one of them fails, in which case the others are
+// closed.
+void bootstrapMesh(
+    std::shared_ptr<Context> context,
+    std::shared_ptr<Listener> listener,
+    size_t rank,
+    std::vector<std::string> urls,
+    MeshOptions options,
+    mesh_callback_fn fn);
+
+} // namespace tensorpipe
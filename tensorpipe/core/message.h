@@ -9,9 +9,12 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 
+#include <tensorpipe/core/allocation_hints.h>
 #include <tensorpipe/core/buffer.h>
 
 namespace tensorpipe {
@@ -44,6 +47,39 @@ class Message final {
     // Users may include arbitrary metadata in the following fields.
     // This may contain allocation hints for the receiver, for example.
     std::string metadata;
+
+    // If set (i.e., non-negative) in a message that is written, the payload is
+    // the length bytes of this file starting at fileOffset, and data must be
+    // null. The pipe maps that range of the file, rather than having the user
+    // read it into memory first, hence the file must stay open, and unchanged,
+    // until the write callback is called. The receiver sees a regular payload.
+    // Likewise, if set in a message given to Pipe::read, the payload lands in
+    // that range of the file (which must be open for writing, and which is
+    // extended if it's shorter) as it arrives, without going through a buffer
+    // of the user. In both cases data is null again in the message given back.
+    int fd{-1};
+    uint64_t fileOffset{0};
+
+    // If data is null, and there's no file, in a message that is written, the
+    // payload is gathered from these buffers, one after the other, which must
+    // not be empty, and its length is set to their total. They're written
+    // as they are, with no copy, and the receiver sees them in the message
+    // given to the readDescriptor callback, with their lengths and no data. It
+    // can then either point data to a single buffer for the whole payload or,
+    // leaving data null, point each segment to one of its own, and the payload
+    // is scattered into them as it arrives. The data of a payload, if set,
+    // always takes precedence over its segments. The payloads gathered from
+    // segments are sent as chunks, one per segment, and are never compressed.
+    struct Segment {
+      void* data{nullptr};
+      size_t length{0};
+    };
+    std::vector<Segment> segments;
+
+    // Set by the sender and given as they are to the receiver, in the message
+    // given to the readDescriptor callback, for it to allocate the payload
+    // accordingly (see AllocationHints).
+    AllocationHints allocationHints;
   };
 
   // Holds the payloads that are transferred over the primary connection.
@@ -55,10 +91,41 @@ class Message final {
     // Users may include arbitrary metadata in the following field.
     // This may contain allocation hints for the receiver, for example.
     std::string metadata;
+
+    // Only used if the tensors are handed off (see below). The sender sets it
+    // to the function that frees the buffer (or leaves it empty if it frees
+    // the buffer by other means) and the pipe moves it over to the receiver,
+    // which must call it once it's done with the buffer.
+    std::function<void()> release;
+
+    // Likewise, what the receiver should allocate the tensor like.
+    AllocationHints allocationHints;
   };
 
   // Holds the tensors that are offered to the side channels.
   std::vector<Tensor> tensors;
+
+  // If set by the sender, the tensors aren't copied but handed off: the
+  // receiver gets the very buffers of the sender, with their release
+  // functions, in constant time regardless of their size, and the sender must
+  // leave the buffers untouched until they're released. This only happens if
+  // both ends of the pipe are in the same process and all the tensors are on
+  // CPU. Otherwise the tensors are sent as usual and the flag is unset in the
+  // message given to the write callback. When the tensors are handed off, the
+  // release functions are taken out of that message, as they belong to the
+  // receiver then (or to the pipe, which calls them if the transfer fails).
+  // On the receiving end, the flag is set in the message given to the
+  // readDescriptor callback when the tensors are handed off, in which case no
+  // memory must be allocated for them, as the read fills in their buffers and
+  // release functions.
+  bool handOffTensors{false};
+
+  // Set by the pipe in the messages it gives to the callbacks: the position of
+  // the message among those that went out on the pipe, counting from zero,
+  // which is the same on both ends. It tells the messages apart when their
+  // callbacks may be called out of order (see
+  // PipeOptions::unorderedCompletions).
+  uint64_t sequenceNumber{0};
 };
 
 } // namespace tensorpipe
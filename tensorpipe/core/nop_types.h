@@ -17,6 +17,8 @@
 #include <nop/types/variant.h>
 
 #include <tensorpipe/core/buffer.h>
+#include <tensorpipe/core/context.h>
+#include <tensorpipe/core/tensor_dedup.h>
 
 namespace tensorpipe {
 
@@ -46,16 +48,38 @@ struct Brochure {
   std::unordered_map<std::string, ChannelAdvertisement> cpuChannelAdvertisement;
   std::unordered_map<std::string, ChannelAdvertisement>
       cudaChannelAdvertisement;
+  bool multiplexChannelConnections;
+  // The highest format of message descriptors that the client supports.
+  uint64_t messageDescriptorVersion;
+  // Tells the server whether the client is in the same process, in which case
+  // the tensors can be handed off (see getProcessIdentifier).
+  uint64_t processIdentifier;
+  // The boot ID of the client's host, if known, under which the server caches
+  // the ranking of its channels (see ContextOptions::channelRankingTtl).
+  std::string hostIdentifier;
+  // If the client deduplicates tensors (see PipeOptions::tensorDedup), with
+  // which values, that the server adopts (a capacity of zero disabling it).
+  uint64_t tensorDedupThreshold;
+  uint64_t tensorDedupCacheCapacity;
   NOP_STRUCTURE(
       Brochure,
       transportAdvertisement,
       cpuChannelAdvertisement,
-      cudaChannelAdvertisement);
+      cudaChannelAdvertisement,
+      multiplexChannelConnections,
+      messageDescriptorVersion,
+      processIdentifier,
+      hostIdentifier,
+      tensorDedupThreshold,
+      tensorDedupCacheCapacity);
 };
 
 struct ChannelSelection {
+  // When the channels' connections are multiplexed, they all use the one of
+  // the answer, and each channel is told apart by its stream instead.
   uint64_t registrationId;
-  NOP_STRUCTURE(ChannelSelection, registrationId);
+  uint64_t streamId;
+  NOP_STRUCTURE(ChannelSelection, registrationId, streamId);
 };
 
 struct BrochureAnswer {
@@ -64,16 +88,47 @@ struct BrochureAnswer {
   uint64_t registrationId;
   std::unordered_map<std::string, ChannelSelection> cpuChannelSelection;
   std::unordered_map<std::string, ChannelSelection> cudaChannelSelection;
+  uint64_t channelsRegistrationId;
+  // The algorithms that the server can decompress payloads with.
+  std::vector<PayloadCompression> payloadCompressions;
+  // The format of message descriptors that both ends will write and, for the
+  // compact one, the channels that were selected, whose index in here is how
+  // the descriptors refer to them.
+  uint64_t messageDescriptorVersion;
+  std::vector<std::string> channelNames;
+  uint64_t processIdentifier;
+  // Likewise, the boot ID of the server's host.
+  std::string hostIdentifier;
   NOP_STRUCTURE(
       BrochureAnswer,
       transport,
       address,
       registrationId,
       cpuChannelSelection,
-      cudaChannelSelection);
+      cudaChannelSelection,
+      channelsRegistrationId,
+      payloadCompressions,
+      messageDescriptorVersion,
+      channelNames,
+      processIdentifier,
+      hostIdentifier);
 };
 
 struct MessageDescriptor {
+  // The AllocationHints of a payload or of a tensor.
+  struct AllocationHintsDescriptor {
+    uint64_t alignment{0};
+    int64_t numaNode{-1};
+    bool pinned{false};
+    int64_t cudaDeviceIdx{-1};
+    NOP_STRUCTURE(
+        AllocationHintsDescriptor,
+        alignment,
+        numaNode,
+        pinned,
+        cudaDeviceIdx);
+  };
+
   struct PayloadDescriptor {
     // This pointless constructor is needed to work around a bug in GCC 5.5 (and
     // possibly other versions). It appears to be needed in the nop types that
@@ -82,7 +137,26 @@ struct MessageDescriptor {
 
     int64_t sizeInBytes;
     std::string metadata;
-    NOP_STRUCTURE(PayloadDescriptor, sizeInBytes, metadata);
+    // The CRC32C of the payload, if the message has checksums.
+    uint32_t checksum;
+    // If the payload is compressed, the lengths of its chunks once compressed,
+    // in the order they follow each other on the connection. A chunk that is
+    // as long as it would be uncompressed was sent as it is.
+    PayloadCompression compression;
+    std::vector<uint64_t> compressedChunkLengths;
+    // Whether the payload was gathered from segments (see Message::Payload),
+    // which are then its chunks, of any length, all sent as they are.
+    bool segmented;
+    AllocationHintsDescriptor allocationHints;
+    NOP_STRUCTURE(
+        PayloadDescriptor,
+        sizeInBytes,
+        metadata,
+        checksum,
+        compression,
+        compressedChunkLengths,
+        segmented,
+        allocationHints);
   };
 
   struct TensorDescriptor {
@@ -97,23 +171,60 @@ struct MessageDescriptor {
     DeviceType deviceType;
     std::string channelName;
     std::string channelDescriptor;
+    // The CRC32C of the tensor, if the message has checksums and it's on CPU
+    // and it isn't handed off.
+    uint32_t checksum;
+    // If the tensors are handed off, under which identifier the receiver can
+    // withdraw this one (see withdrawHandedOffTensor).
+    uint64_t handoffId;
+    // If the pipe deduplicates tensors, whether this one goes into the cache
+    // of the receiver or comes out of it (in which case it has no channel),
+    // and the hash of its contents, by which it's found there.
+    TensorDedup dedup;
+    uint64_t dedupHash;
+    AllocationHintsDescriptor allocationHints;
     NOP_STRUCTURE(
         TensorDescriptor,
         sizeInBytes,
         metadata,
         deviceType,
         channelName,
-        channelDescriptor);
+        channelDescriptor,
+        checksum,
+        handoffId,
+        dedup,
+        dedupHash,
+        allocationHints);
   };
 
   std::string metadata;
   std::vector<PayloadDescriptor> payloadDescriptors;
   std::vector<TensorDescriptor> tensorDescriptors;
+  bool hasChecksums;
+  // Whether the tensors are handed off, in which case none of them goes through
+  // a channel or over the connection.
+  bool handsOffTensors;
+  // Whether some CUDA tensors were gathered into a single buffer, which went
+  // through a channel on their behalf and is described by the last of the
+  // tensor descriptors (which matches no tensor of the message). The gathered
+  // tensors are the CUDA ones that have no channel, in order, each of them
+  // starting at the next multiple of kCoalescedCudaTensorAlignment (see
+  // pipe.cc) after the end of the previous one.
+  bool coalescesCudaTensors;
   NOP_STRUCTURE(
       MessageDescriptor,
       metadata,
       payloadDescriptors,
-      tensorDescriptors);
+      tensorDescriptors,
+      hasChecksums,
+      handsOffTensors,
+      coalescesCudaTensors);
+};
+
+// A MessageDescriptor in the compact format (see compact_descriptor.h).
+struct CompactMessageDescriptor {
+  std::vector<uint8_t> data;
+  NOP_STRUCTURE(CompactMessageDescriptor, data);
 };
 
 using Packet = nop::Variant<
@@ -121,6 +232,7 @@ using Packet = nop::Variant<
     RequestedConnection,
     Brochure,
     BrochureAnswer,
-    MessageDescriptor>;
+    MessageDescriptor,
+    CompactMessageDescriptor>;
 
 } // namespace tensorpipe
@@ -8,29 +8,104 @@
 
 #include <tensorpipe/core/pipe.h>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <deque>
 #include <mutex>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 
 #include <tensorpipe/channel/channel.h>
 #include <tensorpipe/common/address.h>
+#include <tensorpipe/common/buffer_layout.h>
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/crc32c.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/memcpy.h>
+#include <tensorpipe/common/memory.h>
+#include <tensorpipe/common/memory_footprint.h>
 #include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/system.h>
+#include <tensorpipe/common/trace.h>
+#include <tensorpipe/common/usdt.h>
 #include <tensorpipe/core/buffer_helpers.h>
+#include <tensorpipe/core/channel_ranking.h>
+#include <tensorpipe/core/compact_descriptor.h>
+#include <tensorpipe/core/compression.h>
 #include <tensorpipe/core/context_impl.h>
 #include <tensorpipe/core/error.h>
 #include <tensorpipe/core/listener.h>
 #include <tensorpipe/core/listener_impl.h>
 #include <tensorpipe/core/nop_types.h>
+#include <tensorpipe/core/tensor_dedup.h>
+#include <tensorpipe/core/tensor_handoff.h>
 #include <tensorpipe/transport/connection.h>
+#include <tensorpipe/transport/connection_multiplexer.h>
+
+#if TENSORPIPE_SUPPORTS_CUDA
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/cuda_buffer_layout.h>
+#include <tensorpipe/common/cuda_copy_graphs.h>
+#include <tensorpipe/common/cuda_copy_streams.h>
+#include <tensorpipe/common/cuda_event_pool.h>
+#include <tensorpipe/common/cuda_staging_buffers.h>
+#endif // TENSORPIPE_SUPPORTS_CUDA
 
 namespace tensorpipe {
 
 namespace {
 
+using TTimePoint = std::chrono::steady_clock::time_point;
+
+// What the operations that were given no timeout are given internally.
+constexpr std::chrono::milliseconds kNoDeadline{0};
+
+// How many unused nop objects for message descriptors a pipe keeps for reuse.
+// A few are enough to cover the messages that are in flight at any time.
+constexpr size_t kMaxFreeDescriptorHolders = 16;
+
+// In the buffer that small CUDA tensors are gathered into (see
+// PipeOptions::cudaTensorCoalescingThreshold), each of them starts at the first
+// multiple of this that comes after the end of the previous one, so that the
+// copies in and out of it are as aligned as the tensors themselves are.
+constexpr size_t kCoalescedCudaTensorAlignment = 256;
+
+size_t offsetOfNextCoalescedTensor(size_t endOfPreviousTensor) {
+  return (endOfPreviousTensor + kCoalescedCudaTensorAlignment - 1) /
+      kCoalescedCudaTensorAlignment * kCoalescedCudaTensorAlignment;
+}
+
+#if TENSORPIPE_SUPPORTS_CUDA
+// A CUDA tensor that is gathered into, or scattered from, that buffer.
+struct CoalescedCudaTensor {
+  size_t tensorIdx;
+  CudaBuffer buffer;
+  int device;
+  size_t offset;
+};
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+// The descriptors that are handed out together by Pipe::readDescriptorBatch,
+// shared by the operations that read them, the last of which may still be
+// waiting for its own.
+struct DescriptorBatch {
+  size_t maxMessages{0};
+  std::vector<Message> messages;
+  Pipe::read_descriptor_batch_callback_fn fn;
+  int64_t lastSequenceNumber{-1};
+  // The batch goes out once a whole pass through the loop brought no more
+  // descriptors, or once it's full.
+  size_t numMessagesAtLastPass{0};
+  bool handedOut{false};
+};
+
 struct ReadOperation {
   int64_t sequenceNumber{-1};
 
@@ -47,54 +122,229 @@ struct ReadOperation {
   bool doneGettingAllocation{false};
   int64_t numPayloadsBeingRead{0};
   int64_t numTensorsBeingReceived{0};
+  // When reading ahead, the payloads (and inlined tensors) are read from the
+  // connection into these buffers before the user provides the memory for
+  // them, in order to get to the descriptor of the next message.
+  bool payloadsStaged{false};
+  int64_t numStagedBuffersBeingRead{0};
+  std::vector<std::unique_ptr<uint8_t[]>> stagedBuffers;
+
+  // Only set if the descriptor is to be handed out as part of a batch.
+  std::shared_ptr<DescriptorBatch> descriptorBatch;
+  // Whether the descriptor came in while no one had asked for it yet, because
+  // a batch started reading it but went out without it.
+  bool descriptorIsHeld{false};
 
   // Callbacks.
   Pipe::read_descriptor_callback_fn readDescriptorCallback;
   Pipe::read_callback_fn readCallback;
+  // Only set if the payloads must be handed out as they arrive rather than be
+  // copied into the buffers of the message.
+  Pipe::read_payload_callback_fn readPayloadCallback;
+  // Only set if the payloads must be handed out piece by piece as they arrive.
+  Pipe::read_chunk_callback_fn readChunkCallback;
+  // Only set if the memory for the message must be allocated as soon as the
+  // descriptor is read, rather than by asking the user through a callback.
+  Pipe::allocate_fn allocateCallback;
+  // Only set if the message must be read into the buffers of one that was
+  // posted ahead of time, in which case the flag is set too.
+  Message postedMessage;
+  bool hasPostedMessage{false};
+
+  // The mappings of the files into which the payloads that refer to one are
+  // read, if any.
+  std::vector<MmappedPtr> fileMappings;
 
   // Metadata found in the descriptor read from the connection.
   struct Payload {
     ssize_t length{-1};
+    uint32_t checksum{0};
+    // The compressed payloads are read in chunks (see PayloadDescriptor), into
+    // these buffers, and decompressed from there on the compression threads,
+    // except for the chunks that were sent as they are, which are read right
+    // into their place. The payloads that are to be handed to the payload
+    // callback are decompressed into a buffer of their own. Those that are to
+    // be handed to the chunk callback are decompressed into a buffer per chunk
+    // instead, which is released once that chunk is handed out. The payloads
+    // that were only chunked are read in the same way, all their chunks being
+    // sent as they are. So are those that were gathered from segments, whose
+    // chunks are these segments, of any length, hence they can be scattered
+    // into the segments of the receiver.
+    PayloadCompression compression{PayloadCompression::kNone};
+    std::vector<size_t> compressedChunkLengths;
+    bool segmented{false};
+    std::vector<size_t> segmentOffsets;
+    std::vector<std::unique_ptr<uint8_t[]>> compressedChunks;
+    std::unique_ptr<uint8_t[]> decompressedData;
+    std::vector<std::unique_ptr<uint8_t[]>> decompressedChunks;
+    std::vector<bool> chunksAreDecompressed;
+    int64_t numChunksBeingDecompressed{0};
+    bool doneDecompressing{false};
+    // When handing the payload to the chunk callback, how much of it went out
+    // and, if the message has checksums, the checksum of that part, which is
+    // checked once the whole payload went out.
+    size_t numChunksHandedOut{0};
+    uint32_t checksumOfChunksHandedOut{0};
   };
   std::vector<Payload> payloads;
+  // Whether the sender compressed or chunked some of the payloads. As these
+  // complete out of order, if the payloads are to be handed to the payload
+  // callback they're all read into buffers of their own first (as if they were
+  // a single chunk that was sent as it is), and handed out in order from there.
+  // The same goes for the chunk callback if some payloads were compressed, but
+  // if they were only chunked their chunks arrive in order, and are handed out
+  // straight from the transport.
+  bool hasCompressedPayloads{false};
+  bool hasChunkedPayloads{false};
+  size_t numPayloadsHandedOut{0};
   struct Tensor {
-    DeviceType type;
+    DeviceType type{DeviceType::kCpu};
     ssize_t length{-1};
     std::string channelName;
     channel::TDescriptor descriptor;
+    uint32_t checksum{0};
+    uint64_t handoffId{0};
+    // If the tensor is deduplicated (see PipeOptions::tensorDedup), the entry
+    // of the cache that it's stored into once received, or that it's copied
+    // from, as it was looked up when the descriptor was read.
+    TensorDedup dedup{TensorDedup::kNone};
+    uint64_t dedupHash{0};
+    std::shared_ptr<TensorDedupCache::Entry> dedupEntry;
   };
   std::vector<Tensor> tensors;
+  // Whether the sender attached the checksums of the payloads and CPU tensors.
+  bool hasChecksums{false};
+  // Whether the sender handed off the tensors, which are then taken out of the
+  // registry as soon as the descriptor is read, and kept here (being released
+  // if the read fails) until they're given to the user.
+  bool handsOffTensors{false};
+  std::vector<HandedOffTensor> handedOffTensors;
+  // Whether the sender gathered some CUDA tensors (those without a channel)
+  // into a single buffer, described here, which is received into a staging
+  // buffer of this pipe and scattered from there into them.
+  bool coalescesCudaTensors{false};
+  Tensor coalescedTensor;
+#if TENSORPIPE_SUPPORTS_CUDA
+  std::vector<CoalescedCudaTensor> coalescedCudaTensors;
+  CudaStagingBuffers::Buffer stagingBuffer;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+  // The tensors whose buffers aren't contiguous, if they're inlined or if their
+  // channel doesn't support such buffers, are read or received into these
+  // contiguous ones first (indexed by tensor, and only allocated if needed),
+  // and unpacked from there once they're done.
+  std::vector<std::unique_ptr<uint8_t[]>> packedCpuTensors;
+#if TENSORPIPE_SUPPORTS_CUDA
+  std::vector<CudaStagingBuffers::Buffer> packedCudaTensors;
+#endif // TENSORPIPE_SUPPORTS_CUDA
 
   // Buffers allocated by the user.
   Message message;
+
+  // Only set while the callback that's due next, either the readDescriptor or
+  // the read one, has a deadline, which the timer of the context enforces.
+  optional<TimerWheel::TTimerId> deadlineTimer;
+  TTimePoint deadline;
+
+  // The moments at which the operation was requested and reached each stage,
+  // only taken when collecting statistics (and left unset otherwise).
+  TTimePoint readDescriptorCallTime;
+  TTimePoint descriptorReadTime;
+  TTimePoint readCallTime;
+  TTimePoint payloadsReadTime;
+  TTimePoint tensorsReceivedTime;
+
+  // The flow that links the trace events of the operation (if tracing).
+  uint64_t traceFlowId{0};
 };
 
+AllocationHints parseAllocationHints(
+    const MessageDescriptor::AllocationHintsDescriptor& nopAllocationHints) {
+  AllocationHints hints;
+  hints.alignment = nopAllocationHints.alignment;
+  hints.numaNode = static_cast<int>(nopAllocationHints.numaNode);
+  hints.pinned = nopAllocationHints.pinned;
+  hints.cudaDeviceIdx = static_cast<int>(nopAllocationHints.cudaDeviceIdx);
+  return hints;
+}
+
+void fillAllocationHints(
+    MessageDescriptor::AllocationHintsDescriptor& nopAllocationHints,
+    const AllocationHints& hints) {
+  nopAllocationHints.alignment = hints.alignment;
+  nopAllocationHints.numaNode = hints.numaNode;
+  nopAllocationHints.pinned = hints.pinned;
+  nopAllocationHints.cudaDeviceIdx = hints.cudaDeviceIdx;
+}
+
 // Copy the payload and tensors sizes, the tensor descriptors, etc. from the
-// message descriptor that is contained in the nop object to the ReadOperation.
-void parseDescriptorOfMessage(ReadOperation& op, const Packet& nopPacketIn) {
+// message descriptor to the ReadOperation.
+void parseDescriptorOfMessage(
+    ReadOperation& op,
+    const MessageDescriptor& nopMessageDescriptor) {
   Message& message = op.message;
 
-  TP_DCHECK_EQ(nopPacketIn.index(), nopPacketIn.index_of<MessageDescriptor>());
-  const MessageDescriptor& nopMessageDescriptor =
-      *nopPacketIn.get<MessageDescriptor>();
-
   message.metadata = nopMessageDescriptor.metadata;
+  op.hasChecksums = nopMessageDescriptor.hasChecksums;
+  op.handsOffTensors = nopMessageDescriptor.handsOffTensors;
+  message.handOffTensors = nopMessageDescriptor.handsOffTensors;
+  op.coalescesCudaTensors = nopMessageDescriptor.coalescesCudaTensors;
   for (const auto& nopPayloadDescriptor :
        nopMessageDescriptor.payloadDescriptors) {
     Message::Payload payload;
     ReadOperation::Payload payloadBeingAllocated;
     payload.length = nopPayloadDescriptor.sizeInBytes;
     payloadBeingAllocated.length = payload.length;
+    payloadBeingAllocated.checksum = nopPayloadDescriptor.checksum;
+    payloadBeingAllocated.compression = nopPayloadDescriptor.compression;
+    payloadBeingAllocated.compressedChunkLengths.assign(
+        nopPayloadDescriptor.compressedChunkLengths.begin(),
+        nopPayloadDescriptor.compressedChunkLengths.end());
+    payloadBeingAllocated.segmented = nopPayloadDescriptor.segmented;
+    if (payloadBeingAllocated.segmented) {
+      size_t offset = 0;
+      for (size_t length : payloadBeingAllocated.compressedChunkLengths) {
+        payloadBeingAllocated.segmentOffsets.push_back(offset);
+        payload.segments.push_back({nullptr, length});
+        offset += length;
+      }
+    }
+    if (payloadBeingAllocated.compression != PayloadCompression::kNone) {
+      op.hasCompressedPayloads = true;
+    }
+    if (!payloadBeingAllocated.compressedChunkLengths.empty()) {
+      op.hasChunkedPayloads = true;
+    }
     payload.metadata = nopPayloadDescriptor.metadata;
+    payload.allocationHints =
+        parseAllocationHints(nopPayloadDescriptor.allocationHints);
     message.payloads.push_back(std::move(payload));
     op.payloads.push_back(std::move(payloadBeingAllocated));
   }
 
-  for (const auto& nopTensorDescriptor :
-       nopMessageDescriptor.tensorDescriptors) {
+  size_t numTensors = nopMessageDescriptor.tensorDescriptors.size();
+  // The buffer the coalesced tensors went through isn't a tensor of the
+  // message (checkCoalescingOfMessage will catch it if it's missing).
+  if (op.coalescesCudaTensors && numTensors > 0) {
+    const MessageDescriptor::TensorDescriptor& nopTensorDescriptor =
+        nopMessageDescriptor.tensorDescriptors.back();
+    op.coalescedTensor.type = nopTensorDescriptor.deviceType;
+    op.coalescedTensor.length = nopTensorDescriptor.sizeInBytes;
+    op.coalescedTensor.channelName = nopTensorDescriptor.channelName;
+    op.coalescedTensor.descriptor = nopTensorDescriptor.channelDescriptor;
+    numTensors--;
+  }
+
+  for (size_t tensorIdx = 0; tensorIdx < numTensors; tensorIdx++) {
+    const MessageDescriptor::TensorDescriptor& nopTensorDescriptor =
+        nopMessageDescriptor.tensorDescriptors[tensorIdx];
     ReadOperation::Tensor tensorBeingAllocated;
+    tensorBeingAllocated.type = nopTensorDescriptor.deviceType;
     tensorBeingAllocated.length = nopTensorDescriptor.sizeInBytes;
     tensorBeingAllocated.channelName = nopTensorDescriptor.channelName;
+    tensorBeingAllocated.checksum = nopTensorDescriptor.checksum;
+    tensorBeingAllocated.handoffId = nopTensorDescriptor.handoffId;
+    tensorBeingAllocated.dedup = nopTensorDescriptor.dedup;
+    tensorBeingAllocated.dedupHash = nopTensorDescriptor.dedupHash;
     // FIXME If the nop object wasn't const we could move the string out...
     tensorBeingAllocated.descriptor = nopTensorDescriptor.channelDescriptor;
 
@@ -102,6 +352,8 @@ void parseDescriptorOfMessage(ReadOperation& op, const Packet& nopPacketIn) {
     Message::Tensor& tensor = message.tensors.back();
     op.tensors.push_back(std::move(tensorBeingAllocated));
     tensor.metadata = nopTensorDescriptor.metadata;
+    tensor.allocationHints =
+        parseAllocationHints(nopTensorDescriptor.allocationHints);
     switch (nopTensorDescriptor.deviceType) {
       case DeviceType::kCpu: {
         CpuBuffer buffer;
@@ -123,6 +375,434 @@ void parseDescriptorOfMessage(ReadOperation& op, const Packet& nopPacketIn) {
   }
 }
 
+// Whether the tensor was written over the connection after the payloads,
+// rather than sent through a channel, handed off, coalesced or copied from the
+// cache of deduplicated tensors.
+bool isInlined(const ReadOperation& op, const ReadOperation::Tensor& tensor) {
+  return !op.handsOffTensors && tensor.type == DeviceType::kCpu &&
+      tensor.channelName.empty() && tensor.dedup != TensorDedup::kHit;
+}
+
+// Whether the tensor was gathered, with others, into the buffer that went
+// through a channel on their behalf.
+bool isCoalesced(const ReadOperation& op, const ReadOperation::Tensor& tensor) {
+  return !op.handsOffTensors && tensor.type != DeviceType::kCpu &&
+      tensor.channelName.empty();
+}
+
+// Return an error if the CUDA tensors that have no channel don't match the
+// buffer that they were supposedly gathered into, which they're then scattered
+// from without any further checks.
+Error checkCoalescingOfMessage(const ReadOperation& op) {
+  size_t length = 0;
+  size_t numCoalescedTensors = 0;
+  for (const ReadOperation::Tensor& tensor : op.tensors) {
+    if (isCoalesced(op, tensor)) {
+      length = offsetOfNextCoalescedTensor(length) + tensor.length;
+      numCoalescedTensors++;
+    }
+  }
+  const std::string name = "message #" + std::to_string(op.sequenceNumber);
+  if (!op.coalescesCudaTensors) {
+    if (numCoalescedTensors > 0) {
+      return TP_CREATE_ERROR(
+          MalformedDescriptorError, name + " has CUDA tensors without channel");
+    }
+    return Error::kSuccess;
+  }
+  if (op.handsOffTensors || numCoalescedTensors == 0 ||
+      op.coalescedTensor.channelName.empty() ||
+      op.coalescedTensor.type == DeviceType::kCpu ||
+      op.coalescedTensor.length != static_cast<ssize_t>(length)) {
+    return TP_CREATE_ERROR(
+        MalformedDescriptorError,
+        name + " has coalesced CUDA tensors that don't match their buffer");
+  }
+  return Error::kSuccess;
+}
+
+// Return an error if the data doesn't match its expected checksum.
+Error checkChecksum(
+    std::string buffer,
+    uint32_t expectedChecksum,
+    const void* ptr,
+    size_t length) {
+  uint32_t checksum = crc32c(ptr, length);
+  if (checksum != expectedChecksum) {
+    return TP_CREATE_ERROR(
+        ChecksumMismatchError, std::move(buffer), expectedChecksum, checksum);
+  }
+  return Error::kSuccess;
+}
+
+// Wrap the callback of a read from the connection so that, before it runs, the
+// data is checked against its expected checksum and, if it doesn't match, the
+// callback is given an error instead.
+transport::Connection::read_callback_fn checkingChecksum(
+    std::string buffer,
+    uint32_t expectedChecksum,
+    transport::Connection::read_callback_fn fn) {
+  return [buffer{std::move(buffer)}, expectedChecksum, fn{std::move(fn)}](
+             const Error& error, const void* ptr, size_t length) mutable {
+    if (!error) {
+      Error checksumError =
+          checkChecksum(std::move(buffer), expectedChecksum, ptr, length);
+      if (checksumError) {
+        fn(checksumError, ptr, length);
+        return;
+      }
+    }
+    fn(error, ptr, length);
+  };
+}
+
+// Return an error if the message has checksums and the data of the CPU tensor,
+// which was received through a channel, doesn't match its own.
+Error checkChecksumOfReceivedTensor(const ReadOperation& op, size_t tensorIdx) {
+  const Message::Tensor& tensor = op.message.tensors[tensorIdx];
+  if (!op.hasChecksums || tensor.buffer.type != DeviceType::kCpu) {
+    return Error::kSuccess;
+  }
+  const uint32_t expectedChecksum = op.tensors[tensorIdx].checksum;
+  const uint32_t checksum = crc32cOfBuffer(tensor.buffer.cpu);
+  if (checksum != expectedChecksum) {
+    return TP_CREATE_ERROR(
+        ChecksumMismatchError,
+        "tensor #" + std::to_string(op.sequenceNumber) + "." +
+            std::to_string(tensorIdx),
+        expectedChecksum,
+        checksum);
+  }
+  return Error::kSuccess;
+}
+
+// Whether the payload is gathered from (or scattered into) its segments, see
+// Message::Payload.
+bool isSegmented(const Message::Payload& payload) {
+  return payload.data == nullptr && payload.fd < 0 && !payload.segments.empty();
+}
+
+// The CRC32C of the payload, across its segments if it has some.
+uint32_t crc32cOfPayload(const Message::Payload& payload) {
+  if (!isSegmented(payload)) {
+    return crc32c(payload.data, payload.length);
+  }
+  uint32_t checksum = 0;
+  for (const Message::Payload::Segment& segment : payload.segments) {
+    checksum = crc32c(segment.data, segment.length, checksum);
+  }
+  return checksum;
+}
+
+// How many chunks a compressed payload of the given length is split into, and
+// how long each of them is before compression.
+size_t numChunksOfLength(size_t length) {
+  return (length + kPayloadCompressionChunkSize - 1) /
+      kPayloadCompressionChunkSize;
+}
+
+size_t lengthOfChunk(size_t length, size_t chunkIdx) {
+  return std::min(
+      kPayloadCompressionChunkSize,
+      length - chunkIdx * kPayloadCompressionChunkSize);
+}
+
+// The payloads that the sender didn't compress nor chunk count as a single
+// chunk that was sent as it is.
+size_t numChunksOfPayload(const ReadOperation::Payload& payload) {
+  return payload.compressedChunkLengths.empty()
+      ? 1
+      : payload.compressedChunkLengths.size();
+}
+
+size_t lengthOfChunkOfPayload(
+    const ReadOperation::Payload& payload,
+    size_t chunkIdx) {
+  if (payload.segmented) {
+    return payload.compressedChunkLengths[chunkIdx];
+  }
+  return payload.compressedChunkLengths.empty()
+      ? payload.length
+      : lengthOfChunk(payload.length, chunkIdx);
+}
+
+// Where the chunk starts within the payload.
+size_t offsetOfChunkOfPayload(
+    const ReadOperation::Payload& payload,
+    size_t chunkIdx) {
+  return payload.segmented ? payload.segmentOffsets[chunkIdx]
+                           : chunkIdx * kPayloadCompressionChunkSize;
+}
+
+size_t compressedLengthOfChunkOfPayload(
+    const ReadOperation::Payload& payload,
+    size_t chunkIdx) {
+  return payload.compressedChunkLengths.empty()
+      ? payload.length
+      : payload.compressedChunkLengths[chunkIdx];
+}
+
+// Whether the payload has to be read in chunks, see ReadOperation::Payload.
+bool readsPayloadInChunks(const ReadOperation& op, size_t payloadIdx) {
+  return !op.payloads[payloadIdx].compressedChunkLengths.empty() ||
+      (op.hasChunkedPayloads && op.readPayloadCallback) ||
+      (op.hasCompressedPayloads && op.readChunkCallback);
+}
+
+// Whether the chunks are handed to the chunk callback from their own buffers,
+// in order, once they're ready, rather than straight as they arrive.
+bool handsOutChunksFromBuffers(const ReadOperation& op) {
+  return op.readChunkCallback && op.hasCompressedPayloads;
+}
+
+// Hand a chunk of the payload to the chunk callback, adding it to the checksum
+// of the part of the payload that went out. Chunks go out in order, from the
+// transport's thread or from the loop, but never from both for a message.
+void handOutChunkOfPayload(
+    ReadOperation& op,
+    size_t payloadIdx,
+    size_t chunkIdx,
+    const void* ptr,
+    size_t length) {
+  ReadOperation::Payload& payload = op.payloads[payloadIdx];
+  TP_DCHECK_EQ(payload.numChunksHandedOut, chunkIdx);
+  TP_DCHECK_EQ(length, lengthOfChunkOfPayload(payload, chunkIdx));
+  if (op.hasChecksums) {
+    payload.checksumOfChunksHandedOut =
+        crc32c(ptr, length, payload.checksumOfChunksHandedOut);
+  }
+  op.readChunkCallback(
+      payloadIdx, offsetOfChunkOfPayload(payload, chunkIdx), ptr, length);
+  payload.numChunksHandedOut++;
+}
+
+// Return an error if the payload that went out to the chunk callback, once it
+// all did, doesn't match its checksum, if the message has checksums.
+Error checkChecksumOfChunksHandedOut(
+    const ReadOperation& op,
+    size_t payloadIdx) {
+  const ReadOperation::Payload& payload = op.payloads[payloadIdx];
+  TP_DCHECK_EQ(payload.numChunksHandedOut, numChunksOfPayload(payload));
+  if (!op.hasChecksums ||
+      payload.checksumOfChunksHandedOut == payload.checksum) {
+    return Error::kSuccess;
+  }
+  return TP_CREATE_ERROR(
+      ChecksumMismatchError,
+      "payload #" + std::to_string(op.sequenceNumber) + "." +
+          std::to_string(payloadIdx),
+      payload.checksum,
+      payload.checksumOfChunksHandedOut);
+}
+
+// Return an error if the compressed payloads can't be decompressed, either
+// because this end doesn't support their algorithm or because their chunks
+// don't add up, before any of their data is read. The same goes for the chunks
+// of the payloads that were only chunked, which must all be uncompressed, and
+// for the segments of those that were gathered from some.
+Error checkCompressionOfMessage(
+    const ReadOperation& op,
+    const PayloadCompressor& compressor) {
+  for (size_t payloadIdx = 0; payloadIdx < op.payloads.size(); payloadIdx++) {
+    const ReadOperation::Payload& payload = op.payloads[payloadIdx];
+    if (payload.compressedChunkLengths.empty() &&
+        payload.compression == PayloadCompression::kNone &&
+        !payload.segmented) {
+      continue;
+    }
+    const std::string name = "payload #" + std::to_string(op.sequenceNumber) +
+        "." + std::to_string(payloadIdx);
+    if (payload.length <= 0) {
+      return TP_CREATE_ERROR(
+          DecompressionError, name + " is in chunks despite being empty");
+    }
+    if (payload.segmented) {
+      size_t length = 0;
+      for (size_t segmentLength : payload.compressedChunkLengths) {
+        if (segmentLength == 0) {
+          return TP_CREATE_ERROR(
+              DecompressionError, name + " has an empty segment");
+        }
+        length += segmentLength;
+      }
+      if (payload.compression != PayloadCompression::kNone ||
+          length != static_cast<size_t>(payload.length)) {
+        return TP_CREATE_ERROR(
+            DecompressionError, name + " has segments that don't add up");
+      }
+      continue;
+    }
+    if (payload.compression != PayloadCompression::kNone &&
+        !compressor.isAvailable(payload.compression)) {
+      return TP_CREATE_ERROR(
+          DecompressionError,
+          name + " was compressed with unsupported " +
+              payloadCompressionToString(payload.compression));
+    }
+    const size_t numChunks = numChunksOfLength(payload.length);
+    if (payload.compressedChunkLengths.size() != numChunks) {
+      return TP_CREATE_ERROR(
+          DecompressionError,
+          name + " has " +
+              std::to_string(payload.compressedChunkLengths.size()) +
+              " chunks, expected " + std::to_string(numChunks));
+    }
+    for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+      const size_t compressedLength = payload.compressedChunkLengths[chunkIdx];
+      const size_t length = lengthOfChunk(payload.length, chunkIdx);
+      if (compressedLength == 0 || compressedLength > length ||
+          (payload.compression == PayloadCompression::kNone &&
+           compressedLength != length)) {
+        return TP_CREATE_ERROR(
+            DecompressionError,
+            name + " has a chunk of invalid length " +
+                std::to_string(compressedLength));
+      }
+    }
+  }
+  return Error::kSuccess;
+}
+
+// Take the tensors that the sender handed off out of the registry, checking
+// that they match their descriptors.
+Error withdrawHandedOffTensorsOfMessage(
+    ReadOperation& op,
+    bool peerIsInSameProcess) {
+  if (!peerIsInSameProcess) {
+    return TP_CREATE_ERROR(HandoffError, "the peer is in another process");
+  }
+  for (size_t tensorIdx = 0; tensorIdx < op.tensors.size(); tensorIdx++) {
+    const ReadOperation::Tensor& tensor = op.tensors[tensorIdx];
+    const std::string name = "tensor #" + std::to_string(op.sequenceNumber) +
+        "." + std::to_string(tensorIdx);
+    optional<HandedOffTensor> handedOffTensor =
+        withdrawHandedOffTensor(tensor.handoffId);
+    if (!handedOffTensor.has_value()) {
+      return TP_CREATE_ERROR(HandoffError, name + " isn't there");
+    }
+    op.handedOffTensors.push_back(std::move(handedOffTensor.value()));
+    if (tensor.type != DeviceType::kCpu ||
+        static_cast<ssize_t>(op.handedOffTensors.back().length()) !=
+            tensor.length) {
+      return TP_CREATE_ERROR(
+          HandoffError, name + " doesn't match its descriptor");
+    }
+  }
+  return Error::kSuccess;
+}
+
+// Get the payload ready for its chunks to be read and decompressed.
+void prepareChunksOfPayload(ReadOperation& op, size_t payloadIdx) {
+  ReadOperation::Payload& payload = op.payloads[payloadIdx];
+  const size_t numChunks = numChunksOfPayload(payload);
+  payload.compressedChunks.resize(numChunks);
+  payload.numChunksBeingDecompressed = numChunks;
+  if (handsOutChunksFromBuffers(op)) {
+    payload.decompressedChunks.resize(numChunks);
+    payload.chunksAreDecompressed.resize(numChunks, false);
+  } else if (op.readPayloadCallback) {
+    payload.decompressedData = std::make_unique<uint8_t[]>(payload.length);
+  }
+}
+
+// Where the payload is decompressed to.
+uint8_t* targetOfChunksOfPayload(ReadOperation& op, size_t payloadIdx) {
+  ReadOperation::Payload& payload = op.payloads[payloadIdx];
+  if (payload.decompressedData != nullptr) {
+    return payload.decompressedData.get();
+  }
+  return reinterpret_cast<uint8_t*>(op.message.payloads[payloadIdx].data);
+}
+
+// Where the chunk of the payload is decompressed to, which is a buffer of its
+// own if it's to be handed to the chunk callback, allocated on first use, or
+// the segment of the user that matches it, if the payload is scattered.
+uint8_t* targetOfChunkOfPayload(
+    ReadOperation& op,
+    size_t payloadIdx,
+    size_t chunkIdx) {
+  ReadOperation::Payload& payload = op.payloads[payloadIdx];
+  if (!payload.decompressedChunks.empty()) {
+    std::unique_ptr<uint8_t[]>& chunk = payload.decompressedChunks[chunkIdx];
+    if (chunk == nullptr) {
+      chunk = std::make_unique<uint8_t[]>(
+          lengthOfChunkOfPayload(payload, chunkIdx));
+    }
+    return chunk.get();
+  }
+  const Message::Payload& messagePayload = op.message.payloads[payloadIdx];
+  if (payload.decompressedData == nullptr && isSegmented(messagePayload)) {
+    return reinterpret_cast<uint8_t*>(messagePayload.segments[chunkIdx].data);
+  }
+  return targetOfChunksOfPayload(op, payloadIdx) +
+      offsetOfChunkOfPayload(payload, chunkIdx);
+}
+
+// Return an error if the payload, once decompressed (or just read) into its
+// place, doesn't match its checksum.
+Error checkChecksumOfPayload(ReadOperation& op, size_t payloadIdx) {
+  const ReadOperation::Payload& payload = op.payloads[payloadIdx];
+  const std::string name = "payload #" + std::to_string(op.sequenceNumber) +
+      "." + std::to_string(payloadIdx);
+  const Message::Payload& messagePayload = op.message.payloads[payloadIdx];
+  if (payload.decompressedData != nullptr || !isSegmented(messagePayload)) {
+    return checkChecksum(
+        name,
+        payload.checksum,
+        targetOfChunksOfPayload(op, payloadIdx),
+        payload.length);
+  }
+  const uint32_t checksum = crc32cOfPayload(messagePayload);
+  if (checksum != payload.checksum) {
+    return TP_CREATE_ERROR(
+        ChecksumMismatchError, name, payload.checksum, checksum);
+  }
+  return Error::kSuccess;
+}
+
+// Decompress (or just copy, if it was sent as it is) a chunk of the payload
+// from its buffer to its place, and free its buffer. Runs on a compression
+// thread, hence it only touches the fields of that chunk.
+Error decompressChunkIntoPayload(
+    const PayloadCompressor& compressor,
+    ReadOperation& op,
+    size_t payloadIdx,
+    size_t chunkIdx) {
+  ReadOperation::Payload& payload = op.payloads[payloadIdx];
+  uint8_t* dst = targetOfChunkOfPayload(op, payloadIdx, chunkIdx);
+  const size_t length = lengthOfChunkOfPayload(payload, chunkIdx);
+  const size_t compressedLength =
+      compressedLengthOfChunkOfPayload(payload, chunkIdx);
+  std::unique_ptr<uint8_t[]> chunk =
+      std::move(payload.compressedChunks[chunkIdx]);
+  if (compressedLength == length) {
+    copyMemory(dst, chunk.get(), length);
+    return Error::kSuccess;
+  }
+  return compressor.decompress(
+      payload.compression, chunk.get(), compressedLength, dst, length);
+}
+
+// Whether the payload can be scattered into its segments, which must be the
+// same as those the sender gathered it from.
+bool segmentsMatchPayload(
+    const Message::Payload& payload,
+    const ReadOperation::Payload& payloadBeingRead) {
+  if (!payloadBeingRead.segmented ||
+      payload.segments.size() !=
+          payloadBeingRead.compressedChunkLengths.size()) {
+    return false;
+  }
+  for (size_t segmentIdx = 0; segmentIdx < payload.segments.size();
+       segmentIdx++) {
+    if (payload.segments[segmentIdx].length !=
+        payloadBeingRead.compressedChunkLengths[segmentIdx]) {
+      return false;
+    }
+  }
+  return true;
+}
+
 // Raise an error if the number or sizes of the payloads and the tensors in
 // the message do not match the ones that are expected by the ReadOperation.
 void checkAllocationCompatibility(
@@ -136,6 +816,10 @@ void checkAllocationCompatibility(
         op.payloads[payloadIdx];
     TP_DCHECK_GE(payloadBeingAllocated.length, 0);
     TP_THROW_ASSERT_IF(payload.length != payloadBeingAllocated.length);
+    TP_THROW_ASSERT_IF(
+        isSegmented(payload) &&
+        !segmentsMatchPayload(payload, payloadBeingAllocated))
+        << "The segments of a payload must match those it was sent in";
   }
   size_t numTensors = message.tensors.size();
   TP_THROW_ASSERT_IF(numTensors != op.tensors.size());
@@ -147,17 +831,92 @@ void checkAllocationCompatibility(
       case DeviceType::kCpu:
         TP_THROW_ASSERT_IF(
             tensor.buffer.cpu.length != tensorBeingAllocated.length);
+        TP_THROW_ASSERT_IF(!hasValidLayout(tensor.buffer.cpu));
         break;
 #if TENSORPIPE_SUPPORTS_CUDA
       case DeviceType::kCuda:
         TP_THROW_ASSERT_IF(
             tensor.buffer.cuda.length != tensorBeingAllocated.length);
+        TP_THROW_ASSERT_IF(!hasValidLayout(tensor.buffer.cuda));
+        break;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+      default:
+        TP_THROW_ASSERT() << "Unexpected device type.";
+    }
+  }
+}
+
+// Point the payloads and tensors of the message to the buffers of the posted
+// one, or return an error if they don't match, before any of their data is
+// read.
+Error useBuffersOfPostedMessage(ReadOperation& op) {
+  Message& message = op.message;
+  Message& postedMessage = op.postedMessage;
+  const std::string name = "message #" + std::to_string(op.sequenceNumber);
+  if (message.payloads.size() != postedMessage.payloads.size() ||
+      message.tensors.size() != postedMessage.tensors.size()) {
+    return TP_CREATE_ERROR(
+        PostedReceiveMismatchError,
+        name + " has " + std::to_string(message.payloads.size()) +
+            " payloads and " + std::to_string(message.tensors.size()) +
+            " tensors instead of " +
+            std::to_string(postedMessage.payloads.size()) + " and " +
+            std::to_string(postedMessage.tensors.size()));
+  }
+  for (size_t payloadIdx = 0; payloadIdx < message.payloads.size();
+       payloadIdx++) {
+    const Message::Payload& postedPayload = postedMessage.payloads[payloadIdx];
+    if (message.payloads[payloadIdx].length != postedPayload.length ||
+        (isSegmented(postedPayload) &&
+         !segmentsMatchPayload(postedPayload, op.payloads[payloadIdx]))) {
+      return TP_CREATE_ERROR(
+          PostedReceiveMismatchError,
+          "payload #" + std::to_string(op.sequenceNumber) + "." +
+              std::to_string(payloadIdx) +
+              " has a different length or segments");
+    }
+  }
+  for (size_t tensorIdx = 0; tensorIdx < message.tensors.size(); tensorIdx++) {
+    const ReadOperation::Tensor& tensor = op.tensors[tensorIdx];
+    const Buffer& buffer = postedMessage.tensors[tensorIdx].buffer;
+    size_t length = 0;
+    switch (buffer.type) {
+      case DeviceType::kCpu:
+        length = buffer.cpu.length;
+        break;
+#if TENSORPIPE_SUPPORTS_CUDA
+      case DeviceType::kCuda:
+        length = buffer.cuda.length;
         break;
 #endif // TENSORPIPE_SUPPORTS_CUDA
       default:
         TP_THROW_ASSERT() << "Unexpected device type.";
     }
+    if (buffer.type != tensor.type ||
+        static_cast<ssize_t>(length) != tensor.length) {
+      return TP_CREATE_ERROR(
+          PostedReceiveMismatchError,
+          "tensor #" + std::to_string(op.sequenceNumber) + "." +
+              std::to_string(tensorIdx) +
+              " has a different length or device");
+    }
+  }
+
+  for (size_t payloadIdx = 0; payloadIdx < message.payloads.size();
+       payloadIdx++) {
+    message.payloads[payloadIdx].data = postedMessage.payloads[payloadIdx].data;
+    message.payloads[payloadIdx].segments =
+        postedMessage.payloads[payloadIdx].segments;
+  }
+  // The buffers of the tensors that are handed off are filled in afterwards.
+  if (!op.handsOffTensors) {
+    for (size_t tensorIdx = 0; tensorIdx < message.tensors.size();
+         tensorIdx++) {
+      message.tensors[tensorIdx].buffer =
+          postedMessage.tensors[tensorIdx].buffer;
+    }
   }
+  return Error::kSuccess;
 }
 
 struct WriteOperation {
@@ -174,61 +933,197 @@ struct WriteOperation {
   int64_t numPayloadsBeingWritten{0};
   int64_t numTensorDescriptorsBeingCollected{0};
   int64_t numTensorsBeingSent{0};
-
-  // Callbacks.
+  int64_t numChunksBeingCompressed{0};
+  // Those of the above that are sent from the buffers of the message, rather
+  // than from buffers of the pipe.
+  int64_t numTensorsBeingSentFromMessage{0};
+
+  // The operations with a higher priority overtake the ones that haven't
+  // started yet.
+  int priority{0};
+
+  // The total size of the payloads and tensors, which counts against the limit
+  // on the bytes in flight.
+  size_t numBytes{0};
+
+  // Accounts, in the context, for the payloads and CPU tensors of the message,
+  // which the pipe keeps referencing until the operation completes.
+  MemoryCharge memoryCharge;
+
+  // Callbacks. The first one, if set, also has the CPU tensors sent from
+  // copies (see Pipe::write).
+  Pipe::buffers_released_callback_fn buffersReleasedCallback;
   Pipe::write_callback_fn writeCallback;
 
   // Buffers provided by the user.
   Message message;
 
-  // Tensor descriptors collected from the channels.
+  // The mappings of the files of the payloads that refer to one, if any.
+  std::vector<MmappedPtr> fileMappings;
+
+  // Only set if the operation has a deadline, which the timer of the context
+  // enforces. If it passes before the operation starts, the operation fails on
+  // its own, with this error.
+  optional<TimerWheel::TTimerId> deadlineTimer;
+  TTimePoint deadline;
+  Error error;
+
+  // If the message is written to several pipes at once, the checksums of its
+  // payloads and then of its tensors, which are computed once for all of them
+  // (and only if any of them needs them).
+  std::shared_ptr<const std::vector<uint32_t>> checksums;
+
+  // Tensor descriptors collected from the channels. Tensors that are inlined,
+  // i.e., written over the connection after the payloads, have no channel, and
+  // neither do those that are handed off, which have an identifier instead, nor
+  // those that the receiver has in its cache already (see TensorDedup).
   struct Tensor {
     DeviceType type;
     std::string channelName;
     channel::TDescriptor descriptor;
+    uint64_t handoffId{0};
+    TensorDedup dedup{TensorDedup::kNone};
+    uint64_t dedupHash{0};
   };
   std::vector<Tensor> tensors;
+  bool handsOffTensors{false};
+
+  // If some small CUDA tensors are gathered into a single buffer (see
+  // PipeOptions::cudaTensorCoalescingThreshold), their entries above have no
+  // channel, and that buffer has a channel and a descriptor of its own.
+  bool coalescesCudaTensors{false};
+  Tensor coalescedTensor;
+  size_t coalescedLength{0};
+#if TENSORPIPE_SUPPORTS_CUDA
+  std::vector<CoalescedCudaTensor> coalescedCudaTensors;
+  CudaStagingBuffers::Buffer stagingBuffer;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+  // The tensors whose buffers aren't contiguous, if their channel doesn't
+  // support such buffers, are packed into these contiguous ones (indexed by
+  // tensor, and only allocated if needed), which the channel sends instead.
+  std::vector<std::unique_ptr<uint8_t[]>> packedCpuTensors;
+#if TENSORPIPE_SUPPORTS_CUDA
+  std::vector<CudaStagingBuffers::Buffer> packedCudaTensors;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+  // If the pipe compresses or chunks payloads, one per payload of the message.
+  // Those that are compressed are split in chunks, and each chunk is compressed
+  // into its buffer, unless it didn't get any smaller, in which case it's sent
+  // as it is from the user's memory (and has no buffer). Those that are only
+  // chunked have all their chunks sent that way, and so do those that are
+  // gathered from segments, with a chunk per segment.
+  struct Payload {
+    PayloadCompression compression{PayloadCompression::kNone};
+    std::vector<std::unique_ptr<uint8_t[]>> compressedChunks;
+    std::vector<size_t> compressedChunkLengths;
+    bool segmented{false};
+  };
+  std::vector<Payload> payloads;
+
+  // The moments at which the operation was requested and reached each stage,
+  // only taken when collecting statistics (and left unset otherwise).
+  TTimePoint writeCallTime;
+  TTimePoint tensorDescriptorsCollectedTime;
+  TTimePoint payloadsWrittenTime;
+  TTimePoint tensorsSentTime;
+
+  // The flow that links the trace events of the operation (if tracing).
+  uint64_t traceFlowId{0};
 };
 
-// Produce a nop object containing a message descriptor using the information
-// contained in the WriteOperation: number and sizes of payloads and tensors,
-// tensor descriptors, ...
-std::shared_ptr<NopHolder<Packet>> makeDescriptorForMessage(
-    const WriteOperation& op) {
-  auto nopHolderOut = std::make_shared<NopHolder<Packet>>();
-  Packet& nopPacketOut = nopHolderOut->getObject();
-  nopPacketOut.Become(nopPacketOut.index_of<MessageDescriptor>());
-  MessageDescriptor& nopMessageDescriptor =
-      *nopPacketOut.get<MessageDescriptor>();
+// Whether the tensor is written over the connection after the payloads.
+bool isInlined(const WriteOperation& op, const WriteOperation::Tensor& tensor) {
+  return !op.handsOffTensors && tensor.type == DeviceType::kCpu &&
+      tensor.channelName.empty() && tensor.dedup != TensorDedup::kHit;
+}
 
+// Make the nop object hold the given type. If it already does, it's kept as it
+// is, so that the memory of its strings and vectors can be reused.
+template <typename T>
+T& becomeAlternativeOfPacket(Packet& nopPacket) {
+  // Becoming the alternative that is already held would be a no-op, but let's
+  // be explicit about not wanting to destroy it.
+  if (nopPacket.index() != nopPacket.index_of<T>()) {
+    nopPacket.Become(nopPacket.index_of<T>());
+  }
+  return *nopPacket.get<T>();
+}
+
+// Fill a message descriptor using the information contained in the
+// WriteOperation: number and sizes of payloads and tensors, tensor descriptors,
+// ... The descriptor may hold a previous message, in which case the memory of
+// its strings and vectors is reused rather than allocated anew. If asked to,
+// compute the checksums of the payloads and of the CPU tensors, unless they
+// were computed already.
+void fillDescriptorForMessage(
+    MessageDescriptor& nopMessageDescriptor,
+    const WriteOperation& op,
+    bool computeChecksums) {
   nopMessageDescriptor.metadata = op.message.metadata;
+  nopMessageDescriptor.hasChecksums = computeChecksums;
+  nopMessageDescriptor.handsOffTensors = op.handsOffTensors;
+  nopMessageDescriptor.coalescesCudaTensors = op.coalescesCudaTensors;
 
+  nopMessageDescriptor.payloadDescriptors.resize(op.message.payloads.size());
   for (int payloadIdx = 0; payloadIdx < op.message.payloads.size();
        ++payloadIdx) {
     const Message::Payload& payload = op.message.payloads[payloadIdx];
-    nopMessageDescriptor.payloadDescriptors.emplace_back();
     MessageDescriptor::PayloadDescriptor& nopPayloadDescriptor =
-        nopMessageDescriptor.payloadDescriptors.back();
+        nopMessageDescriptor.payloadDescriptors[payloadIdx];
     nopPayloadDescriptor.sizeInBytes = payload.length;
     nopPayloadDescriptor.metadata = payload.metadata;
+    fillAllocationHints(
+        nopPayloadDescriptor.allocationHints, payload.allocationHints);
+    nopPayloadDescriptor.checksum = 0;
+    if (computeChecksums) {
+      nopPayloadDescriptor.checksum = op.checksums != nullptr
+          ? (*op.checksums)[payloadIdx]
+          : crc32cOfPayload(payload);
+    }
+    nopPayloadDescriptor.compression = PayloadCompression::kNone;
+    nopPayloadDescriptor.compressedChunkLengths.clear();
+    nopPayloadDescriptor.segmented = false;
+    if (!op.payloads.empty()) {
+      const WriteOperation::Payload& compressedPayload =
+          op.payloads[payloadIdx];
+      nopPayloadDescriptor.compression = compressedPayload.compression;
+      nopPayloadDescriptor.compressedChunkLengths.assign(
+          compressedPayload.compressedChunkLengths.begin(),
+          compressedPayload.compressedChunkLengths.end());
+      nopPayloadDescriptor.segmented = compressedPayload.segmented;
+    }
   }
 
   TP_DCHECK_EQ(op.message.tensors.size(), op.tensors.size());
+  nopMessageDescriptor.tensorDescriptors.resize(
+      op.tensors.size() + (op.coalescesCudaTensors ? 1 : 0));
   for (int tensorIdx = 0; tensorIdx < op.tensors.size(); ++tensorIdx) {
     const Message::Tensor& tensor = op.message.tensors[tensorIdx];
     const WriteOperation::Tensor& otherTensor = op.tensors[tensorIdx];
-    nopMessageDescriptor.tensorDescriptors.emplace_back();
     MessageDescriptor::TensorDescriptor& nopTensorDescriptor =
-        nopMessageDescriptor.tensorDescriptors.back();
+        nopMessageDescriptor.tensorDescriptors[tensorIdx];
     nopTensorDescriptor.metadata = tensor.metadata;
+    fillAllocationHints(
+        nopTensorDescriptor.allocationHints, tensor.allocationHints);
     nopTensorDescriptor.channelName = otherTensor.channelName;
     // FIXME In principle we could move here.
     nopTensorDescriptor.channelDescriptor = otherTensor.descriptor;
+    nopTensorDescriptor.handoffId = otherTensor.handoffId;
+    nopTensorDescriptor.dedup = otherTensor.dedup;
+    nopTensorDescriptor.dedupHash = otherTensor.dedupHash;
 
     nopTensorDescriptor.deviceType = tensor.buffer.type;
+    nopTensorDescriptor.checksum = 0;
     switch (tensor.buffer.type) {
       case DeviceType::kCpu:
         nopTensorDescriptor.sizeInBytes = tensor.buffer.cpu.length;
+        // The receiver gets the very same memory, and it must take constant
+        // time, hence the tensors that are handed off aren't checksummed.
+        if (computeChecksums && !op.handsOffTensors) {
+          nopTensorDescriptor.checksum = op.checksums != nullptr
+              ? (*op.checksums)[op.message.payloads.size() + tensorIdx]
+              : crc32cOfBuffer(tensor.buffer.cpu);
+        }
         break;
 #if TENSORPIPE_SUPPORTS_CUDA
       case DeviceType::kCuda:
@@ -240,7 +1135,42 @@ std::shared_ptr<NopHolder<Packet>> makeDescriptorForMessage(
     };
   }
 
-  return nopHolderOut;
+  if (op.coalescesCudaTensors) {
+    MessageDescriptor::TensorDescriptor& nopTensorDescriptor =
+        nopMessageDescriptor.tensorDescriptors.back();
+    nopTensorDescriptor.metadata.clear();
+    nopTensorDescriptor.allocationHints =
+        MessageDescriptor::AllocationHintsDescriptor();
+    nopTensorDescriptor.channelName = op.coalescedTensor.channelName;
+    nopTensorDescriptor.channelDescriptor = op.coalescedTensor.descriptor;
+    nopTensorDescriptor.handoffId = 0;
+    nopTensorDescriptor.dedup = TensorDedup::kNone;
+    nopTensorDescriptor.dedupHash = 0;
+    nopTensorDescriptor.deviceType = op.coalescedTensor.type;
+    nopTensorDescriptor.checksum = 0;
+    nopTensorDescriptor.sizeInBytes = op.coalescedLength;
+  }
+}
+
+// Compress a chunk of the payload into a buffer, if that makes it shorter.
+// Runs on a compression thread, hence it only touches the fields of that chunk.
+void compressChunkOfPayload(
+    const PayloadCompressor& compressor,
+    const Message::Payload& payload,
+    WriteOperation::Payload& compressedPayload,
+    size_t chunkIdx) {
+  const uint8_t* src = reinterpret_cast<const uint8_t*>(payload.data) +
+      chunkIdx * kPayloadCompressionChunkSize;
+  const size_t length = lengthOfChunk(payload.length, chunkIdx);
+  auto buffer = std::make_unique<uint8_t[]>(length);
+  size_t compressedLength = compressor.compress(
+      compressedPayload.compression, src, length, buffer.get(), length - 1);
+  if (compressedLength > 0) {
+    compressedPayload.compressedChunks[chunkIdx] = std::move(buffer);
+    compressedPayload.compressedChunkLengths[chunkIdx] = compressedLength;
+  } else {
+    compressedPayload.compressedChunkLengths[chunkIdx] = length;
+  }
 }
 
 template <typename TBuffer>
@@ -332,6 +1262,101 @@ CudaBuffer unwrap(Buffer b) {
 }
 #endif // TENSORPIPE_SUPPORTS_CUDA
 
+size_t lengthOfBuffer(const Buffer& buffer) {
+  return switchOnDeviceType(buffer.type, [&](auto b) {
+    return unwrap<decltype(b)>(buffer).length;
+  });
+}
+
+bool bufferHasValidLayout(const Buffer& buffer) {
+  return switchOnDeviceType(buffer.type, [&](auto b) {
+    return hasValidLayout(unwrap<decltype(b)>(buffer));
+  });
+}
+
+void addLatency(
+    DurationHistogram& histogram,
+    TTimePoint startTime,
+    TTimePoint endTime) {
+  if (endTime != TTimePoint()) {
+    histogram.add(endTime - startTime);
+  }
+}
+
+// Set the length of the payloads of a message that is written that are gathered
+// from segments to their total.
+void sumSegmentsOfPayloads(Message& message) {
+  for (Message::Payload& payload : message.payloads) {
+    if (!isSegmented(payload)) {
+      continue;
+    }
+    payload.length = 0;
+    for (const Message::Payload::Segment& segment : payload.segments) {
+      TP_THROW_ASSERT_IF(segment.data == nullptr || segment.length == 0)
+          << "The segments of a payload can't be null nor empty";
+      payload.length += segment.length;
+    }
+  }
+}
+
+// Map the ranges of the files that the payloads of a message refer to, if any,
+// and point the payloads to them. Those of a message that is read are written
+// to, hence their files are extended to fit them first, if needed, as the pages
+// past the end of a file can't be touched. The mappings start at the page that
+// holds the first byte of each range, and they're accessed sequentially, hence
+// the kernel is told to read ahead.
+Error mapFilePayloads(
+    Message& message,
+    bool forWriting,
+    std::vector<MmappedPtr>& mappings) {
+  for (Message::Payload& payload : message.payloads) {
+    if (payload.fd < 0 || payload.length == 0) {
+      continue;
+    }
+    TP_THROW_ASSERT_IF(payload.data != nullptr)
+        << "A payload can't have both data and a file";
+    if (forWriting) {
+      struct stat st;
+      if (::fstat(payload.fd, &st) < 0) {
+        return TP_CREATE_ERROR(SystemError, "fstat", errno);
+      }
+      const off_t end = payload.fileOffset + payload.length;
+      if (st.st_size < end && ::ftruncate(payload.fd, end) < 0) {
+        return TP_CREATE_ERROR(SystemError, "ftruncate", errno);
+      }
+    }
+    const uint64_t pageSize = ::getpagesize();
+    const uint64_t start = payload.fileOffset - payload.fileOffset % pageSize;
+    const size_t skip = payload.fileOffset - start;
+    Error error;
+    MmappedPtr mapping;
+    std::tie(error, mapping) = MmappedPtr::create(
+        skip + payload.length,
+        forWriting ? PROT_READ | PROT_WRITE : PROT_READ,
+        MAP_SHARED,
+        payload.fd,
+        start);
+    if (error) {
+      return error;
+    }
+    ::madvise(mapping.ptr(), mapping.getLength(), MADV_SEQUENTIAL);
+    payload.data = mapping.ptr() + skip;
+    mappings.push_back(std::move(mapping));
+  }
+  return Error::kSuccess;
+}
+
+// The mappings are dropped once the write is done, hence the payloads that
+// pointed to them mustn't be handed back to the user as they are.
+void unmapFilePayloads(Message& message, std::vector<MmappedPtr>& mappings) {
+  for (Message::Payload& payload : message.payloads) {
+    if (payload.fd >= 0) {
+      payload.data = nullptr;
+    }
+  }
+  mappings.clear();
+}
+
 } // namespace
 
 class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
@@ -339,8 +1364,8 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
   Impl(
       std::shared_ptr<Context::PrivateIface> context,
       std::string id,
-      std::string remoteName,
-      const std::string& url);
+      const std::string& url,
+      PipeOptions opts);
 
   Impl(
       std::shared_ptr<Context::PrivateIface> context,
@@ -353,12 +1378,44 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
   // Called by the pipe's constructor.
   void init();
 
-  void readDescriptor(read_descriptor_callback_fn fn);
-  void read(Message message, read_callback_fn fn);
-  void write(Message message, write_callback_fn fn);
+  void readDescriptor(
+      std::chrono::milliseconds timeout,
+      read_descriptor_callback_fn fn);
+  void readDescriptorBatch(
+      size_t maxMessages,
+      read_descriptor_batch_callback_fn fn);
+  void readBatch(std::vector<Message> messages, read_callback_fn fn);
+  void read(allocate_fn allocateFn, read_callback_fn fn);
+  void postReceive(Message message, read_callback_fn fn);
+  void read(
+      Message message,
+      read_payload_callback_fn payloadFn,
+      read_chunk_callback_fn chunkFn,
+      std::chrono::milliseconds timeout,
+      read_callback_fn fn);
+  void write(
+      Message message,
+      int priority,
+      std::shared_ptr<const std::vector<uint32_t>> checksums,
+      std::chrono::milliseconds timeout,
+      buffers_released_callback_fn buffersReleasedFn,
+      write_callback_fn fn);
+  void writeBatch(
+      std::vector<Message> messages,
+      int priority,
+      write_callback_fn fn);
+  void waitUntilWritable(writable_callback_fn fn);
 
   const std::string& getRemoteName();
 
+  PipeStats getStats();
+
+  bool hasFailed();
+
+  bool isChecksummingPayloads() const {
+    return checksumPayloads_;
+  }
+
   void close();
 
  private:
@@ -366,11 +1423,39 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
 
   void initFromLoop();
 
-  void readDescriptorFromLoop(read_descriptor_callback_fn fn);
+  void readDescriptorFromLoop(
+      std::chrono::milliseconds timeout,
+      read_descriptor_callback_fn fn);
+
+  void readDescriptorBatchFromLoop(
+      size_t maxMessages,
+      read_descriptor_batch_callback_fn fn);
+  void readBatchFromLoop(std::vector<Message> messages, read_callback_fn fn);
 
-  void readFromLoop(Message message, read_callback_fn fn);
+  void readWithAllocatorFromLoop(allocate_fn allocateFn, read_callback_fn fn);
+  void postReceiveFromLoop(Message message, read_callback_fn fn);
 
-  void writeFromLoop(Message message, write_callback_fn fn);
+  void readFromLoop(
+      Message message,
+      read_payload_callback_fn payloadFn,
+      read_chunk_callback_fn chunkFn,
+      std::chrono::milliseconds timeout,
+      read_callback_fn fn);
+
+  void writeFromLoop(
+      Message message,
+      int priority,
+      std::shared_ptr<const std::vector<uint32_t>> checksums,
+      std::chrono::milliseconds timeout,
+      buffers_released_callback_fn buffersReleasedFn,
+      write_callback_fn fn);
+
+  void writeBatchFromLoop(
+      std::vector<Message> messages,
+      int priority,
+      write_callback_fn fn);
+
+  void waitUntilWritableFromLoop(writable_callback_fn fn);
 
   void closeFromLoop();
 
@@ -406,6 +1491,30 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
       unordered_map<std::string, std::shared_ptr<channel::Channel<TBuffer>>>;
   TP_DEVICE_FIELD(TChannelMap<CpuBuffer>, TChannelMap<CudaBuffer>) channels_;
 
+  // The channels of the pipe, in order of priority, with what choosing one for
+  // a tensor needs to know about them. As the set of channels of a pipe is
+  // fixed once it's established, this is filled in then, so that each tensor
+  // that is sent or received doesn't look its channel up by name, in the pipe
+  // and in the context, again.
+  template <typename TBuffer>
+  struct ChannelEntry {
+    // Owned by the context, as are the channel contexts.
+    const std::string* name;
+    channel::Channel<TBuffer>* channel;
+    channel::Context<TBuffer>* context;
+    // See ContextOptions::channelTensorLengthRange.
+    size_t minLength;
+    size_t maxLength;
+
+    bool acceptsTensorLength(size_t length) const {
+      return minLength <= length && length < maxLength;
+    }
+  };
+  template <typename TBuffer>
+  using TChannelTable = std::vector<ChannelEntry<TBuffer>>;
+  TP_DEVICE_FIELD(TChannelTable<CpuBuffer>, TChannelTable<CudaBuffer>)
+  channelTable_;
+
   // The server will set this up when it tell the client to switch to a
   // different connection or to open some channels.
   optional<uint64_t> registrationId_;
@@ -414,11 +1523,23 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
   TP_DEVICE_FIELD(TChannelRegistrationMap, TChannelRegistrationMap)
   channelRegistrationIds_;
 
+  // When the channels' connections are multiplexed, the server requests a
+  // single connection for all of them, and each channel gets the stream of
+  // that connection with the given id, until it's created.
+  optional<uint64_t> channelsRegistrationId_;
+  TP_DEVICE_FIELD(TChannelRegistrationMap, TChannelRegistrationMap)
+  channelStreamIds_;
+  std::shared_ptr<transport::ConnectionMultiplexer> channelMultiplexer_;
+
   ClosingReceiver closingReceiver_;
 
   std::deque<ReadOperation> readOperations_;
   std::deque<WriteOperation> writeOperations_;
 
+  // The last operation of a batch of descriptors that went out while it was
+  // still waiting for its own, which the next read call takes over.
+  ReadOperation* carriedOverReadOperation_{nullptr};
+
   // A sequence number for the calls to read and write.
   uint64_t nextMessageBeingRead_{0};
   uint64_t nextMessageBeingWritten_{0};
@@ -437,6 +1558,16 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
   ConnectionState connectionState_{AWAITING_DESCRIPTOR};
   int64_t messageBeingReadFromConnection_{0};
 
+  // The maximum number of messages whose payloads can be staged in order to
+  // read the descriptors of the next ones before the user allocated memory for
+  // them, and the number of messages that are currently in this situation.
+  const size_t readAheadWindow_;
+  size_t numMessagesWithStagedPayloads_{0};
+
+  // Whether to attach the checksums of the payloads and CPU tensors to the
+  // messages that are written.
+  const bool checksumPayloads_;
+
   // When reading, each message will be presented to the user in order for some
   // memory to be allocated for its payloads and tensors (this happens by
   // calling the readDescriptor callback and waiting for a read call). Under
@@ -445,10 +1576,145 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
   // callbacks. We need to remember the interval of messages for which we're
   // waiting for allocation in order to match calls to read to the right message
   // and for sanity checks. We do so by storing the lower and upper bounds.
+  // Messages that get their memory from an allocator are skipped over.
   int64_t nextMessageGettingAllocation_{0};
   int64_t nextMessageAskingForAllocation_{0};
 
   Error error_{Error::kSuccess};
+  // Mirrors whether the error is set, for the context to query from outside
+  // the loop.
+  std::atomic<bool> failed_{false};
+
+  // The nop objects of the message descriptors that have been fully written or
+  // read, kept around (up to a bound) in order to reuse them, together with the
+  // memory of their strings and vectors, for the next messages.
+  std::vector<std::shared_ptr<NopHolder<Packet>>> freeDescriptorHolders_;
+
+  // CPU tensors smaller than this are written over the connection rather than
+  // sent through a channel. See PipeOptions.
+  const size_t inlineTensorThreshold_;
+
+  // The payloads of the messages without tensors that are smaller than this
+  // (put together) are carried by their descriptor. See PipeOptions.
+  const size_t inlinePayloadThreshold_;
+
+  // Whether the other end is in this same process, as found out from the
+  // brochure, in which case the tensors can be handed off.
+  bool peerIsInSameProcess_{false};
+
+  // If the context ranks the channels (see ContextOptions::channelRankingTtl),
+  // the boot ID of the other end's host, under which the rankings are shared
+  // with the other pipes to it (empty if unknown), this pipe's probes and, for
+  // each class of lengths, the ranking it settled on.
+  std::string peerHostIdentifier_;
+  ChannelProbes channelProbes_;
+  std::array<
+      optional<std::vector<std::string>>,
+      kNumChannelRankingLengthClasses>
+      channelRankings_;
+
+  // The limits on the write operations that have started but aren't finished
+  // yet (zero meaning none), and how many of them and how large they are. The
+  // operations start in order, hence those held back by these limits are all
+  // those from nextWriteOperationToStart_ on.
+  const size_t maxWritesInFlight_;
+  const size_t maxWriteBytesInFlight_;
+  size_t numWritesInFlight_{0};
+  size_t numWriteBytesInFlight_{0};
+  int64_t nextWriteOperationToStart_{0};
+  std::deque<writable_callback_fn> writableCallbacks_;
+
+  // While a batch of messages is being enqueued, the descriptors and payloads
+  // of those that get to be written are set aside here rather than written
+  // right away, in order to then hand them all to the connection at once.
+  struct BatchedWrite {
+    std::shared_ptr<NopHolder<Packet>> holder;
+    std::vector<transport::Connection::WriteBuffer> buffers;
+    size_t numBuffers;
+    int64_t sequenceNumber;
+    WriteOperation* op;
+  };
+  bool batchingWrites_{false};
+  std::vector<BatchedWrite> batchedWrites_;
+
+  // When writes are coalesced (see ContextOptions), the descriptors and
+  // payloads that are set aside above also include, outside of a batch, those
+  // of the messages that are held while earlier writes are in flight, whose
+  // bytes, and the time at which the first of them was held, are kept here.
+  const std::chrono::microseconds writeCoalescingBudget_;
+  const size_t writeCoalescingThreshold_;
+  size_t numCoalescedWritesInFlight_{0};
+  size_t numHeldBytes_{0};
+  TTimePoint firstHeldTime_;
+  optional<TimerWheel::TTimerId> coalescingTimer_;
+
+  // The payloads of at least the given length are compressed with this, unless
+  // it's disabled, once the peer has confirmed that it can decompress them. See
+  // PipeOptions.
+  PayloadCompression payloadCompression_;
+  const size_t payloadCompressionThreshold_;
+
+  // The payloads of at least the given length that aren't compressed are still
+  // written in chunks, unless it's disabled. See PipeOptions.
+  const size_t payloadChunkingThreshold_;
+
+  // The CUDA tensors smaller than this are gathered into a single buffer per
+  // message, unless it's disabled. See PipeOptions.
+  const size_t cudaTensorCoalescingThreshold_;
+
+  // Whether the coalesced CUDA tensors that recur are gathered, and scattered,
+  // by the graphs below. See PipeOptions.
+  const bool cudaGraphsForCoalescedTensors_;
+
+  // Whether the operations may finish ahead of earlier ones. See PipeOptions.
+  const bool unorderedCompletions_;
+
+  // If the CPU tensors of at least the given length are deduplicated (which
+  // the side that accepted the pipe learns from the brochure), the contents of
+  // those that were written, as the peer keeps them in the cache of those it
+  // reads, and the contents of those that were read. See PipeOptions.
+  size_t tensorDedupThreshold_{0};
+  size_t tensorDedupCacheCapacity_{0};
+  std::unique_ptr<TensorDedupCache> writtenTensorDedupCache_;
+  std::unique_ptr<TensorDedupCache> readTensorDedupCache_;
+
+  // How the writes of the connections that this side opens are scheduled
+  // against those of the other pipes of the context. See PipeOptions.
+  const uint32_t writeShapingWeight_;
+  const uint64_t writeShapingMaxBytesPerSecond_;
+
+  // The NUMA node that the connections this side opens are placed near, or -1
+  // if none. See PipeOptions.
+  const int numaNode_;
+
+#if TENSORPIPE_SUPPORTS_CUDA
+  // The device memory that the coalesced CUDA tensors are gathered into, or
+  // scattered from, and the events that order the streams of the tensors with
+  // the one of that memory.
+  CudaStagingBuffers cudaStagingBuffers_;
+  CudaEventPool cudaEventPool_;
+  CudaCopyGraphs cudaCopyGraphs_;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+  // The format of the message descriptors that are written, as agreed upon in
+  // the brochure, and, for the compact one, the index of each channel. Those
+  // descriptors go through the one below, which is reused for all messages.
+  uint64_t messageDescriptorVersion_{kNopMessageDescriptorVersion};
+  std::vector<std::string> channelNames_;
+  std::unordered_map<std::string, uint64_t> channelIndices_;
+  MessageDescriptor compactMessageDescriptor_;
+
+  // Whether to take timestamps and count bytes for the operations, in which
+  // case they will be merged into the statistics below (and the context's).
+  const bool collectStats_;
+  std::mutex statsMutex_;
+  PipeStats stats_;
+
+  // What the user's callbacks are run with, if not inline. See ContextOptions.
+  const std::shared_ptr<SerialExecutor> callbackExecutor_;
+  // When the pipe was created, and when the brochure (or its answer) was read.
+  TTimePoint creationTime_;
+  TTimePoint brochureExchangedTime_;
 
   //
   // Helpers to prepare callbacks from transports and listener
@@ -462,8 +1728,46 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
   //
 
   void callReadDescriptorCallback(ReadOperation& op);
+  void handOutDescriptorOfMessage(ReadOperation& op);
+  void onDescriptorOfBatch(ReadOperation& op, Message message);
+  void passOverDescriptorBatch(std::shared_ptr<DescriptorBatch> batch);
+  void callReadDescriptorBatchCallback(DescriptorBatch& batch);
+  void callAllocateCallback(ReadOperation& op);
+  void skipAllocatedReadOperations();
   void callReadCallback(ReadOperation& op);
+  void callBuffersReleasedCallback(WriteOperation& op);
   void callWriteCallback(WriteOperation& op);
+  void callWritableCallbacks();
+
+  // Call a callback of the user, inline or through the context's executor
+  // (see ContextOptions::callbackExecutor), timing it if collecting stats.
+  void runCallback(
+      MoveOnlyFunction<void(const Error&, Message)>& fn,
+      const Error& error,
+      Message message);
+  void runCallback(writable_callback_fn& fn, const Error& error);
+  void runCallback(
+      read_descriptor_batch_callback_fn& fn,
+      const Error& error,
+      std::vector<Message> messages);
+  void runCallbackTask(MoveOnlyFunction<void()> task);
+
+  //
+  // Reuse of the nop objects of message descriptors
+  //
+
+  std::shared_ptr<NopHolder<Packet>> acquireDescriptorHolder();
+  void releaseDescriptorHolder(std::shared_ptr<NopHolder<Packet>> holder);
+
+  //
+  // Statistics
+  //
+
+  void takeTimestamp(TTimePoint& timePoint);
+  void recordStatsOfReadOperation(const ReadOperation& op, TTimePoint now);
+  void recordStatsOfWriteOperation(const WriteOperation& op, TTimePoint now);
+  void recordStatsOfEstablishment(TTimePoint now);
+  void mergeStats(const PipeStats& stats);
 
   //
   // Error handling
@@ -477,9 +1781,16 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
   // Everything else
   //
 
+  void onPipeEstablished();
   void startReadingUponEstablishingPipe();
   void startWritingUponEstablishingPipe();
 
+  // Start a read operation, or take over the one carried over from a batch of
+  // descriptors, and have it progress once it's set up (handing out its
+  // descriptor if it was held).
+  ReadOperation& startReadOperation();
+  void resumeReadOperation(ReadOperation& op);
+
   void advanceReadOperation(ReadOperation& op);
   void advanceWriteOperation(WriteOperation& op);
 
@@ -488,26 +1799,137 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
 
   void readDescriptorOfMessage(ReadOperation& op);
   void readPayloadsAndReceiveTensorsOfMessage(ReadOperation& op);
+  void readPayloadsOfMessageFromConnection(ReadOperation& op);
+  void stagePayloadsOfMessage(ReadOperation& op);
+  void stageInlinePayloadsOfMessage(ReadOperation& op, const uint8_t* ptr);
+  void copyStagedPayloadsOfMessage(ReadOperation& op);
+  void readChunksOfPayloadFromConnection(ReadOperation& op, size_t payloadIdx);
+  void decompressChunkOfPayload(
+      ReadOperation& op,
+      size_t payloadIdx,
+      size_t chunkIdx);
+  void handOutDecompressedPayloads(ReadOperation& op);
+  void releaseStagedPayloadsOfMessage(ReadOperation& op);
+  bool canReadAheadOf(const ReadOperation& op);
+  bool connectionIsReady();
+  bool canInlineTensor(const Message::Tensor& tensor);
+  bool canInlinePayloads(const WriteOperation& op);
+  bool canHandOffTensors(const Message& message);
+  bool needsChannels(const WriteOperation& op);
+  bool needsChannels(const ReadOperation& op);
+  bool hasRoomToStart(const WriteOperation& op);
+  bool isWritable();
+  void scheduleDeadline(
+      optional<TimerWheel::TTimerId>& timer,
+      TTimePoint& deadline,
+      std::chrono::milliseconds timeout);
+  void cancelDeadline(optional<TimerWheel::TTimerId>& timer);
+  void expireOperationsPastDeadline();
   void sendTensorsOfMessage(WriteOperation& op);
-  void writeDescriptorAndPayloadsOfMessage(WriteOperation& op);
-  void onReadWhileServerWaitingForBrochure(const Packet& nopPacketIn);
-  void onReadWhileClientWaitingForBrochureAnswer(const Packet& nopPacketIn);
-  void onAcceptWhileServerWaitingForConnection(
-      std::string receivedTransport,
+  // Return the channel to send a tensor of the given length over, and whether
+  // that send is a probe, to be timed (see ContextOptions::channelRankingTtl).
+  template <typename TBuffer>
+  std::tuple<const std::string*, channel::Channel<TBuffer>*, bool>
+  selectChannel(size_t length);
+  template <typename TBuffer>
+  std::tuple<const std::string*, channel::Channel<TBuffer>*, bool>
+  selectRankedChannel(size_t length);
+#if TENSORPIPE_SUPPORTS_CUDA
+  void selectCudaTensorsToCoalesce(WriteOperation& op);
+  void sendCoalescedCudaTensorsOfMessage(WriteOperation& op);
+  void receiveCoalescedCudaTensorsOfMessage(ReadOperation& op);
+  void scatterCoalescedCudaTensorsOfMessage(ReadOperation& op);
+#endif // TENSORPIPE_SUPPORTS_CUDA
+  // The buffers of the tensors that aren't contiguous are packed into (or
+  // unpacked from) contiguous ones for the connection (which the tensors use
+  // when they have no channel) and the channels that don't support them. These
+  // return the buffer to give to those instead of the tensor's. The same goes
+  // for the CUDA tensors in managed memory, which are also migrated to their
+  // device beforehand.
+  bool canTakeBufferAsItIs(
+      const CpuBuffer& buffer,
+      const std::string& channelName);
+  CpuBuffer packTensorForChannel(
+      WriteOperation& op,
+      size_t tensorIdx,
+      const CpuBuffer& buffer,
+      const std::string& channelName);
+  CpuBuffer prepareToUnpackTensor(
+      ReadOperation& op,
+      size_t tensorIdx,
+      const CpuBuffer& buffer,
+      const std::string& channelName);
+#if TENSORPIPE_SUPPORTS_CUDA
+  bool canTakeBufferAsItIs(
+      const CudaBuffer& buffer,
+      bool isManaged,
+      const std::string& channelName);
+  bool prefetchCudaTensorIfManaged(const CudaBuffer& buffer);
+  CudaBuffer packTensorForChannel(
+      WriteOperation& op,
+      size_t tensorIdx,
+      const CudaBuffer& buffer,
+      const std::string& channelName);
+  CudaBuffer prepareToUnpackTensor(
+      ReadOperation& op,
+      size_t tensorIdx,
+      const CudaBuffer& buffer,
+      const std::string& channelName);
+  bool acquirePackedCudaTensor(
+      std::vector<CudaStagingBuffers::Buffer>& packedCudaTensors,
+      size_t numTensors,
+      size_t tensorIdx,
+      const CudaBuffer& buffer);
+#endif // TENSORPIPE_SUPPORTS_CUDA
+  void releasePackedTensor(WriteOperation& op, size_t tensorIdx);
+  void unpackReceivedTensor(ReadOperation& op, size_t tensorIdx);
+  void enableTensorDedup(size_t threshold, size_t cacheCapacity);
+  void shapeWritesOfConnection(transport::Connection& connection);
+  Error lookUpDeduplicatedTensorsOfMessage(ReadOperation& op);
+  void storeDeduplicatedTensor(ReadOperation& op, size_t tensorIdx);
+  void copyDeduplicatedTensor(ReadOperation& op, size_t tensorIdx);
+  void copyDeduplicatedTensorFromCache(ReadOperation& op, size_t tensorIdx);
+  void wakeUpWaitersOfDedupEntry(TensorDedupCache::Entry& entry);
+  void compressPayloadsOfMessage(WriteOperation& op);
+  void writeDescriptorAndPayloadsOfMessage(WriteOperation& op);
+  void writeBatchedDescriptorsAndPayloads();
+  void holdCoalescedWrite(size_t numBytes);
+  void onReadWhileServerWaitingForBrochure(const Packet& nopPacketIn);
+  void onReadWhileClientWaitingForBrochureAnswer(const Packet& nopPacketIn);
+  void onAcceptWhileServerWaitingForConnection(
+      std::string receivedTransport,
       std::shared_ptr<transport::Connection> receivedConnection);
   template <typename TBuffer>
   void onAcceptWhileServerWaitingForChannel(
       std::string channelName,
       std::string receivedTransport,
       std::shared_ptr<transport::Connection> receivedConnection);
+  void onAcceptWhileServerWaitingForChannels(
+      std::string receivedTransport,
+      std::shared_ptr<transport::Connection> receivedConnection);
+  void createMultiplexedChannels(
+      std::shared_ptr<transport::Connection> connection,
+      channel::Endpoint endpoint);
+  void setMessageDescriptorVersion(
+      uint64_t version,
+      std::vector<std::string> channelNames);
   void onReadOfMessageDescriptor(ReadOperation& op, const Packet& nopPacketIn);
   void onDescriptorOfTensor(
       WriteOperation& op,
       int64_t tensorIdx,
       channel::TDescriptor descriptor);
+  void onDescriptorOfCoalescedTensors(
+      WriteOperation& op,
+      channel::TDescriptor descriptor);
   void onReadOfPayload(ReadOperation& op);
+  void onReadOfStagedBuffer(ReadOperation& op);
+  void onDecompressionOfChunkOfPayload(
+      ReadOperation& op,
+      size_t payloadIdx,
+      size_t chunkIdx);
   void onRecvOfTensor(ReadOperation& op);
-  void onWriteOfPayload(WriteOperation& op);
+  void onWriteOfPayloads(WriteOperation& op, size_t numBuffers);
+  void onCompressionOfChunkOfPayload(WriteOperation& op);
   void onSendOfTensor(WriteOperation& op);
 
   ReadOperation* findReadOperation(int64_t sequenceNumber);
@@ -523,6 +1945,11 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
   std::shared_ptr<channel::Context<TBuffer>> getChannelContext(
       const std::string& channelName);
 
+  template <typename TBuffer>
+  void buildChannelTable();
+  template <typename TBuffer>
+  const ChannelEntry<TBuffer>& findChannelEntry(const std::string& channelName);
+
   bool pendingRegistrations();
 
   template <typename T>
@@ -539,13 +1966,13 @@ Pipe::Pipe(
     ConstructorToken /* unused */,
     std::shared_ptr<Context::PrivateIface> context,
     std::string id,
-    std::string remoteName,
-    const std::string& url)
+    const std::string& url,
+    PipeOptions opts)
     : impl_(std::make_shared<Impl>(
           std::move(context),
           std::move(id),
-          std::move(remoteName),
-          url)) {
+          url,
+          std::move(opts))) {
   impl_->init();
 }
 
@@ -570,17 +1997,46 @@ Pipe::Pipe(
 Pipe::Impl::Impl(
     std::shared_ptr<Context::PrivateIface> context,
     std::string id,
-    std::string remoteName,
-    const std::string& url)
+    const std::string& url,
+    PipeOptions opts)
     : state_(CLIENT_ABOUT_TO_SEND_HELLO_AND_BROCHURE),
       context_(std::move(context)),
       id_(std::move(id)),
-      remoteName_(std::move(remoteName)),
-      closingReceiver_(context_, context_->getClosingEmitter()) {
+      remoteName_(std::move(opts.remoteName_)),
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      readAheadWindow_(context_->getReadAheadWindow()),
+      checksumPayloads_(context_->isChecksummingPayloads()),
+      inlineTensorThreshold_(opts.inlineTensorThreshold_),
+      inlinePayloadThreshold_(opts.inlinePayloadThreshold_),
+      maxWritesInFlight_(opts.maxWritesInFlight_),
+      maxWriteBytesInFlight_(opts.maxWriteBytesInFlight_),
+      writeCoalescingBudget_(context_->getWriteCoalescingBudget()),
+      writeCoalescingThreshold_(context_->getWriteCoalescingThreshold()),
+      payloadCompression_(opts.payloadCompression_),
+      payloadCompressionThreshold_(opts.payloadCompressionThreshold_),
+      payloadChunkingThreshold_(opts.payloadChunkingThreshold_),
+      cudaTensorCoalescingThreshold_(opts.cudaTensorCoalescingThreshold_),
+      cudaGraphsForCoalescedTensors_(opts.cudaGraphsForCoalescedTensors_),
+      unorderedCompletions_(opts.unorderedCompletions_),
+      writeShapingWeight_(opts.writeShapingWeight_),
+      writeShapingMaxBytesPerSecond_(opts.writeShapingMaxBytesPerSecond_),
+      numaNode_(opts.numaNode_),
+      collectStats_(context_->isCollectingStats()),
+      callbackExecutor_(context_->createCallbackExecutor()) {
+  takeTimestamp(creationTime_);
+  enableTensorDedup(opts.tensorDedupThreshold_, opts.tensorDedupCacheCapacity_);
+  if (!context_->getPayloadCompressor().isAvailable(payloadCompression_)) {
+    TP_VLOG(1) << "Pipe " << id_ << " won't compress payloads as "
+               << payloadCompressionToString(payloadCompression_)
+               << " couldn't be loaded";
+    payloadCompression_ = PayloadCompression::kNone;
+  }
   std::string address;
   std::tie(transport_, address) = splitSchemeOfURL(url);
-  connection_ = context_->getTransport(transport_)->connect(std::move(address));
+  connection_ = context_->getTransport(transport_)->connectOnNumaNode(
+      std::move(address), numaNode_);
   connection_->setId(id_ + ".tr_" + transport_);
+  shapeWritesOfConnection(*connection_);
 }
 
 Pipe::Impl::Impl(
@@ -597,7 +2053,27 @@ Pipe::Impl::Impl(
       remoteName_(std::move(remoteName)),
       transport_(std::move(transport)),
       connection_(std::move(connection)),
-      closingReceiver_(context_, context_->getClosingEmitter()) {
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      readAheadWindow_(context_->getReadAheadWindow()),
+      checksumPayloads_(context_->isChecksummingPayloads()),
+      inlineTensorThreshold_(0),
+      inlinePayloadThreshold_(0),
+      maxWritesInFlight_(0),
+      maxWriteBytesInFlight_(0),
+      writeCoalescingBudget_(context_->getWriteCoalescingBudget()),
+      writeCoalescingThreshold_(context_->getWriteCoalescingThreshold()),
+      payloadCompression_(PayloadCompression::kNone),
+      payloadCompressionThreshold_(0),
+      payloadChunkingThreshold_(0),
+      cudaTensorCoalescingThreshold_(0),
+      cudaGraphsForCoalescedTensors_(false),
+      unorderedCompletions_(false),
+      writeShapingWeight_(0),
+      writeShapingMaxBytesPerSecond_(0),
+      numaNode_(-1),
+      collectStats_(context_->isCollectingStats()),
+      callbackExecutor_(context_->createCallbackExecutor()) {
+  takeTimestamp(creationTime_);
   connection_->setId(id_ + ".tr_" + transport_);
 }
 
@@ -669,6 +2145,14 @@ void Pipe::Impl::initFromLoop() {
             channelContext.domainDescriptor();
       }
     });
+    nopBrochure.multiplexChannelConnections =
+        context_->isMultiplexingChannelConnections();
+    nopBrochure.messageDescriptorVersion =
+        kCompactMessageDescriptorWithInlinePayloadsVersion;
+    nopBrochure.processIdentifier = getProcessIdentifier();
+    nopBrochure.hostIdentifier = getBootID().value_or("");
+    nopBrochure.tensorDedupThreshold = tensorDedupThreshold_;
+    nopBrochure.tensorDedupCacheCapacity = tensorDedupCacheCapacity_;
     TP_VLOG(3) << "Pipe " << id_ << " is writing nop object (brochure)";
     connection_->write(
         *nopHolderOut2, lazyCallbackWrapper_([nopHolderOut2](Impl& impl) {
@@ -706,6 +2190,23 @@ const std::string& Pipe::Impl::getRemoteName() {
   return remoteName_;
 }
 
+PipeStats Pipe::getStats() {
+  return impl_->getStats();
+}
+
+PipeStats Pipe::Impl::getStats() {
+  std::unique_lock<std::mutex> lock(statsMutex_);
+  return stats_;
+}
+
+bool Pipe::hasFailed() {
+  return impl_->hasFailed();
+}
+
+bool Pipe::Impl::hasFailed() {
+  return failed_;
+}
+
 Pipe::~Pipe() {
   close();
 }
@@ -729,56 +2230,239 @@ void Pipe::Impl::closeFromLoop() {
 //
 
 void Pipe::readDescriptor(read_descriptor_callback_fn fn) {
-  impl_->readDescriptor(std::move(fn));
+  impl_->readDescriptor(kNoDeadline, std::move(fn));
 }
 
-void Pipe::Impl::readDescriptor(read_descriptor_callback_fn fn) {
-  loop_.deferToLoop([this, fn{std::move(fn)}]() mutable {
-    readDescriptorFromLoop(std::move(fn));
+void Pipe::readDescriptor(
+    std::chrono::milliseconds timeout,
+    read_descriptor_callback_fn fn) {
+  TP_THROW_ASSERT_IF(timeout <= kNoDeadline) << "The timeout must be positive";
+  impl_->readDescriptor(timeout, std::move(fn));
+}
+
+void Pipe::Impl::readDescriptor(
+    std::chrono::milliseconds timeout,
+    read_descriptor_callback_fn fn) {
+  loop_.deferToLoop([this, timeout, fn{std::move(fn)}]() mutable {
+    readDescriptorFromLoop(timeout, std::move(fn));
   });
 }
 
-void Pipe::Impl::readDescriptorFromLoop(read_descriptor_callback_fn fn) {
+void Pipe::Impl::readDescriptorFromLoop(
+    std::chrono::milliseconds timeout,
+    read_descriptor_callback_fn fn) {
   TP_DCHECK(loop_.inLoop());
+  TP_TRACE_SCOPE("tp::Pipe::readDescriptor");
 
-  readOperations_.emplace_back();
-  ReadOperation& op = readOperations_.back();
-  op.sequenceNumber = nextMessageBeingRead_++;
+  ReadOperation& op = startReadOperation();
 
   TP_VLOG(1) << "Pipe " << id_ << " received a readDescriptor request (#"
              << op.sequenceNumber << ")";
 
   fn = [this, sequenceNumber{op.sequenceNumber}, fn{std::move(fn)}](
-           const Error& error, Message message) {
+           const Error& error, Message message) mutable {
     TP_DCHECK_EQ(sequenceNumber, nextReadDescriptorCallbackToCall_++);
     TP_VLOG(1) << "Pipe " << id_ << " is calling a readDescriptor callback (#"
                << sequenceNumber << ")";
-    fn(error, std::move(message));
+    runCallback(fn, error, std::move(message));
     TP_VLOG(1) << "Pipe " << id_ << " done calling a readDescriptor callback (#"
                << sequenceNumber << ")";
   };
 
   op.readDescriptorCallback = std::move(fn);
+  if (timeout > kNoDeadline && !op.descriptorIsHeld) {
+    scheduleDeadline(op.deadlineTimer, op.deadline, timeout);
+  }
 
-  advanceReadOperation(op);
+  resumeReadOperation(op);
+}
+
+void Pipe::readDescriptorBatch(
+    size_t maxMessages,
+    read_descriptor_batch_callback_fn fn) {
+  TP_THROW_ASSERT_IF(maxMessages == 0) << "A batch can't be empty";
+  impl_->readDescriptorBatch(maxMessages, std::move(fn));
+}
+
+void Pipe::Impl::readDescriptorBatch(
+    size_t maxMessages,
+    read_descriptor_batch_callback_fn fn) {
+  loop_.deferToLoop([this, maxMessages, fn{std::move(fn)}]() mutable {
+    readDescriptorBatchFromLoop(maxMessages, std::move(fn));
+  });
+}
+
+void Pipe::Impl::readDescriptorBatchFromLoop(
+    size_t maxMessages,
+    read_descriptor_batch_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+  TP_TRACE_SCOPE("tp::Pipe::readDescriptorBatch");
+
+  auto batch = std::make_shared<DescriptorBatch>();
+  batch->maxMessages = maxMessages;
+  batch->fn = std::move(fn);
+
+  ReadOperation& op = startReadOperation();
+  TP_VLOG(1) << "Pipe " << id_ << " received a readDescriptorBatch request (#"
+             << op.sequenceNumber << ", for up to " << maxMessages
+             << " messages)";
+  op.descriptorBatch = batch;
+  batch->lastSequenceNumber = op.sequenceNumber;
+
+  resumeReadOperation(op);
+}
+
+void Pipe::read(allocate_fn allocateFn, read_callback_fn fn) {
+  TP_THROW_ASSERT_IF(!allocateFn);
+  impl_->read(std::move(allocateFn), std::move(fn));
+}
+
+void Pipe::Impl::read(allocate_fn allocateFn, read_callback_fn fn) {
+  loop_.deferToLoop(
+      [this, allocateFn{std::move(allocateFn)}, fn{std::move(fn)}]() mutable {
+        readWithAllocatorFromLoop(std::move(allocateFn), std::move(fn));
+      });
+}
+
+void Pipe::Impl::readWithAllocatorFromLoop(
+    allocate_fn allocateFn,
+    read_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+  TP_TRACE_SCOPE("tp::Pipe::readDescriptor");
+
+  ReadOperation& op = startReadOperation();
+
+  TP_VLOG(1) << "Pipe " << id_ << " received a read request with allocator (#"
+             << op.sequenceNumber << ")";
+
+  fn = [this, sequenceNumber{op.sequenceNumber}, fn{std::move(fn)}](
+           const Error& error, Message message) mutable {
+    TP_DCHECK(
+        unorderedCompletions_ || sequenceNumber == nextReadCallbackToCall_);
+    ++nextReadCallbackToCall_;
+    TP_VLOG(1) << "Pipe " << id_ << " is calling a read callback (#"
+               << sequenceNumber << ")";
+    runCallback(fn, error, std::move(message));
+    TP_VLOG(1) << "Pipe " << id_ << " done calling a read callback (#"
+               << sequenceNumber << ")";
+  };
+
+  op.allocateCallback = std::move(allocateFn);
+  op.readCallback = std::move(fn);
+
+  resumeReadOperation(op);
+}
+
+void Pipe::postReceive(Message message, read_callback_fn fn) {
+  impl_->postReceive(std::move(message), std::move(fn));
+}
+
+void Pipe::Impl::postReceive(Message message, read_callback_fn fn) {
+  loop_.deferToLoop(
+      [this, message{std::move(message)}, fn{std::move(fn)}]() mutable {
+        postReceiveFromLoop(std::move(message), std::move(fn));
+      });
+}
+
+void Pipe::Impl::postReceiveFromLoop(Message message, read_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+  TP_TRACE_SCOPE("tp::Pipe::readDescriptor");
+
+  ReadOperation& op = startReadOperation();
+
+  TP_VLOG(1) << "Pipe " << id_ << " received a posted receive (#"
+             << op.sequenceNumber << ", containing "
+             << message.payloads.size() << " payloads and "
+             << message.tensors.size() << " tensors)";
+
+  fn = [this, sequenceNumber{op.sequenceNumber}, fn{std::move(fn)}](
+           const Error& error, Message message) mutable {
+    TP_DCHECK(
+        unorderedCompletions_ || sequenceNumber == nextReadCallbackToCall_);
+    ++nextReadCallbackToCall_;
+    TP_VLOG(1) << "Pipe " << id_ << " is calling a read callback (#"
+               << sequenceNumber << ")";
+    runCallback(fn, error, std::move(message));
+    TP_VLOG(1) << "Pipe " << id_ << " done calling a read callback (#"
+               << sequenceNumber << ")";
+  };
+
+  for (const Message::Tensor& tensor : message.tensors) {
+    TP_THROW_ASSERT_IF(!bufferHasValidLayout(tensor.buffer))
+        << "The rows of a tensor don't match its length";
+  }
+  op.postedMessage = std::move(message);
+  op.hasPostedMessage = true;
+  op.readCallback = std::move(fn);
+
+  resumeReadOperation(op);
 }
 
 void Pipe::read(Message message, read_callback_fn fn) {
-  impl_->read(std::move(message), std::move(fn));
+  impl_->read(std::move(message), nullptr, nullptr, kNoDeadline, std::move(fn));
+}
+
+void Pipe::read(
+    Message message,
+    std::chrono::milliseconds timeout,
+    read_callback_fn fn) {
+  TP_THROW_ASSERT_IF(timeout <= kNoDeadline) << "The timeout must be positive";
+  impl_->read(std::move(message), nullptr, nullptr, timeout, std::move(fn));
+}
+
+void Pipe::read(
+    Message message,
+    read_payload_callback_fn payloadFn,
+    read_callback_fn fn) {
+  TP_THROW_ASSERT_IF(!payloadFn);
+  impl_->read(
+      std::move(message),
+      std::move(payloadFn),
+      nullptr,
+      kNoDeadline,
+      std::move(fn));
 }
 
-void Pipe::Impl::read(Message message, read_callback_fn fn) {
-  // Messages aren't copyable and thus if a lambda captures them it cannot be
-  // wrapped in a std::function. Therefore we wrap Messages in shared_ptrs.
-  auto sharedMessage = std::make_shared<Message>(std::move(message));
+void Pipe::readInChunks(
+    Message message,
+    read_chunk_callback_fn chunkFn,
+    read_callback_fn fn) {
+  TP_THROW_ASSERT_IF(!chunkFn);
+  impl_->read(
+      std::move(message),
+      nullptr,
+      std::move(chunkFn),
+      kNoDeadline,
+      std::move(fn));
+}
+
+void Pipe::Impl::read(
+    Message message,
+    read_payload_callback_fn payloadFn,
+    read_chunk_callback_fn chunkFn,
+    std::chrono::milliseconds timeout,
+    read_callback_fn fn) {
   loop_.deferToLoop([this,
-                     sharedMessage{std::move(sharedMessage)},
+                     message{std::move(message)},
+                     payloadFn{std::move(payloadFn)},
+                     chunkFn{std::move(chunkFn)},
+                     timeout,
                      fn{std::move(fn)}]() mutable {
-    readFromLoop(std::move(*sharedMessage), std::move(fn));
+    readFromLoop(
+        std::move(message),
+        std::move(payloadFn),
+        std::move(chunkFn),
+        timeout,
+        std::move(fn));
   });
 }
 
-void Pipe::Impl::readFromLoop(Message message, read_callback_fn fn) {
+void Pipe::Impl::readFromLoop(
+    Message message,
+    read_payload_callback_fn payloadFn,
+    read_chunk_callback_fn chunkFn,
+    std::chrono::milliseconds timeout,
+    read_callback_fn fn) {
   TP_DCHECK(loop_.inLoop());
 
   // This is such a bad logical error on the user's side that it doesn't deserve
@@ -791,16 +2475,23 @@ void Pipe::Impl::readFromLoop(Message message, read_callback_fn fn) {
   ReadOperation* opPtr = findReadOperation(nextMessageGettingAllocation_);
   TP_DCHECK(opPtr != nullptr);
   ++nextMessageGettingAllocation_;
+  skipAllocatedReadOperations();
   ReadOperation& op = *opPtr;
+  takeTimestamp(op.readCallTime);
+  TP_TRACE_SCOPE("tp::Pipe::read");
+  TP_TRACE_FLOW_STEP("tp::Pipe::read", op.traceFlowId);
+  TP_USDT(pipe__read__start, id_.c_str(), op.sequenceNumber);
 
   checkAllocationCompatibility(op, message);
 
   fn = [this, sequenceNumber{op.sequenceNumber}, fn{std::move(fn)}](
-           const Error& error, Message message) {
-    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+           const Error& error, Message message) mutable {
+    TP_DCHECK(
+        unorderedCompletions_ || sequenceNumber == nextReadCallbackToCall_);
+    ++nextReadCallbackToCall_;
     TP_VLOG(1) << "Pipe " << id_ << " is calling a read callback (#"
                << sequenceNumber << ")";
-    fn(error, std::move(message));
+    runCallback(fn, error, std::move(message));
     TP_VLOG(1) << "Pipe " << id_ << " done calling a read callback (#"
                << sequenceNumber << ")";
   };
@@ -808,19 +2499,69 @@ void Pipe::Impl::readFromLoop(Message message, read_callback_fn fn) {
   TP_DCHECK_EQ(op.state, ReadOperation::ASKING_FOR_ALLOCATION);
   op.message = std::move(message);
   op.readCallback = std::move(fn);
+  op.readPayloadCallback = std::move(payloadFn);
+  op.readChunkCallback = std::move(chunkFn);
   op.doneGettingAllocation = true;
+  if (timeout > kNoDeadline) {
+    scheduleDeadline(op.deadlineTimer, op.deadline, timeout);
+  }
+
+  Error error =
+      mapFilePayloads(op.message, /*forWriting=*/true, op.fileMappings);
 
   TP_VLOG(1) << "Pipe " << id_ << " received a read request (#"
              << op.sequenceNumber << ", containing "
              << op.message.payloads.size() << " payloads and "
              << op.message.tensors.size() << " tensors)";
 
+  // The payloads are still coming over the connection, and would have nowhere
+  // to go, hence the whole pipe fails if they can't be mapped. This advances
+  // all the operations, including this one, which may then be gone.
+  if (error && !error_) {
+    setError(std::move(error));
+    return;
+  }
+
   advanceReadOperation(op);
 }
 
+void Pipe::readBatch(std::vector<Message> messages, read_callback_fn fn) {
+  impl_->readBatch(std::move(messages), std::move(fn));
+}
+
+void Pipe::Impl::readBatch(std::vector<Message> messages, read_callback_fn fn) {
+  loop_.deferToLoop(
+      [this, messages{std::move(messages)}, fn{std::move(fn)}]() mutable {
+        readBatchFromLoop(std::move(messages), std::move(fn));
+      });
+}
+
+void Pipe::Impl::readBatchFromLoop(
+    std::vector<Message> messages,
+    read_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+  TP_TRACE_SCOPE("tp::Pipe::readBatch");
+
+  TP_VLOG(1) << "Pipe " << id_ << " received a batch of " << messages.size()
+             << " read requests";
+
+  // The callback is shared by all the messages, each of them calling it once.
+  auto sharedFn = std::make_shared<read_callback_fn>(std::move(fn));
+  for (Message& message : messages) {
+    readFromLoop(
+        std::move(message),
+        /*payloadFn=*/nullptr,
+        /*chunkFn=*/nullptr,
+        kNoDeadline,
+        [sharedFn](const Error& error, Message message) {
+          (*sharedFn)(error, std::move(message));
+        });
+  }
+}
+
 void Pipe::Impl::readPayloadsAndReceiveTensorsOfMessage(ReadOperation& op) {
   TP_DCHECK(loop_.inLoop());
-  TP_DCHECK_EQ(state_, ESTABLISHED);
+  TP_DCHECK(connectionIsReady());
 
   TP_DCHECK_EQ(op.state, ReadOperation::ASKING_FOR_ALLOCATION);
   op.state = ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS;
@@ -829,170 +2570,1414 @@ void Pipe::Impl::readPayloadsAndReceiveTensorsOfMessage(ReadOperation& op) {
              << " is reading payloads and receiving tensors of message #"
              << op.sequenceNumber;
 
-  TP_DCHECK_EQ(connectionState_, AWAITING_PAYLOADS);
-  TP_DCHECK_EQ(messageBeingReadFromConnection_, op.sequenceNumber);
-  for (size_t payloadIdx = 0; payloadIdx < op.message.payloads.size();
-       payloadIdx++) {
-    Message::Payload& payload = op.message.payloads[payloadIdx];
-    TP_VLOG(3) << "Pipe " << id_ << " is reading payload #" << op.sequenceNumber
-               << "." << payloadIdx;
-    connection_->read(
-        payload.data,
-        payload.length,
-        eagerCallbackWrapper_(
-            [&op, payloadIdx](
-                Impl& impl, const void* /* unused */, size_t /* unused */) {
-              TP_VLOG(3) << "Pipe " << impl.id_ << " done reading payload #"
-                         << op.sequenceNumber << "." << payloadIdx;
-              impl.onReadOfPayload(op);
-            }));
-    ++op.numPayloadsBeingRead;
+  if (op.payloadsStaged) {
+    copyStagedPayloadsOfMessage(op);
+  } else {
+    readPayloadsOfMessageFromConnection(op);
   }
-  connectionState_ = AWAITING_DESCRIPTOR;
-  ++messageBeingReadFromConnection_;
 
   for (size_t tensorIdx = 0; tensorIdx < op.message.tensors.size();
        tensorIdx++) {
+    if (op.tensors[tensorIdx].dedup == TensorDedup::kHit) {
+      copyDeduplicatedTensor(op, tensorIdx);
+      continue;
+    }
+    if (op.tensors[tensorIdx].channelName.empty()) {
+      continue;
+    }
     Message::Tensor& tensor = op.message.tensors[tensorIdx];
     switchOnDeviceType(
         op.message.tensors[tensorIdx].buffer.type, [&](auto buffer) {
           ReadOperation::Tensor& tensorBeingAllocated = op.tensors[tensorIdx];
-          std::shared_ptr<channel::Channel<decltype(buffer)>> channel =
-              channels_.get<decltype(buffer)>().at(
-                  tensorBeingAllocated.channelName);
+          channel::Channel<decltype(buffer)>* channel =
+              this->findChannelEntry<decltype(buffer)>(
+                      tensorBeingAllocated.channelName)
+                  .channel;
           TP_VLOG(3) << "Pipe " << id_ << " is receiving tensor #"
                      << op.sequenceNumber << "." << tensorIdx;
 
           channel->recv(
               std::move(tensorBeingAllocated.descriptor),
-              unwrap<decltype(buffer)>(tensor.buffer),
+              prepareToUnpackTensor(
+                  op,
+                  tensorIdx,
+                  unwrap<decltype(buffer)>(tensor.buffer),
+                  tensorBeingAllocated.channelName),
               eagerCallbackWrapper_([&op, tensorIdx](Impl& impl) {
                 TP_VLOG(3) << "Pipe " << impl.id_ << " done receiving tensor #"
                            << op.sequenceNumber << "." << tensorIdx;
+                impl.unpackReceivedTensor(op, tensorIdx);
+                if (!impl.error_) {
+                  impl.setError(checkChecksumOfReceivedTensor(op, tensorIdx));
+                }
+                if (op.tensors[tensorIdx].dedup == TensorDedup::kStore) {
+                  impl.storeDeduplicatedTensor(op, tensorIdx);
+                }
                 impl.onRecvOfTensor(op);
               }));
           ++op.numTensorsBeingReceived;
         });
   }
-}
-
-void Pipe::write(Message message, write_callback_fn fn) {
-  impl_->write(std::move(message), std::move(fn));
-}
 
-void Pipe::Impl::write(Message message, write_callback_fn fn) {
-  // Messages aren't copyable and thus if a lambda captures them it cannot be
-  // wrapped in a std::function. Therefore we wrap Messages in shared_ptrs.
-  auto sharedMessage = std::make_shared<Message>(std::move(message));
-  loop_.deferToLoop([this,
-                     sharedMessage{std::move(sharedMessage)},
-                     fn{std::move(fn)}]() mutable {
-    writeFromLoop(std::move(*sharedMessage), std::move(fn));
-  });
+#if TENSORPIPE_SUPPORTS_CUDA
+  if (op.coalescesCudaTensors) {
+    receiveCoalescedCudaTensorsOfMessage(op);
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
 }
 
-void Pipe::Impl::writeFromLoop(Message message, write_callback_fn fn) {
+#if TENSORPIPE_SUPPORTS_CUDA
+void Pipe::Impl::receiveCoalescedCudaTensorsOfMessage(ReadOperation& op) {
   TP_DCHECK(loop_.inLoop());
+  TP_DCHECK(op.coalescesCudaTensors);
 
-  writeOperations_.emplace_back();
-  WriteOperation& op = writeOperations_.back();
-  op.sequenceNumber = nextMessageBeingWritten_++;
-
-  TP_VLOG(1) << "Pipe " << id_ << " received a write request (#"
-             << op.sequenceNumber << ", contaning " << message.payloads.size()
-             << " payloads and " << message.tensors.size() << " tensors)";
-
-  fn = [this, sequenceNumber{op.sequenceNumber}, fn{std::move(fn)}](
-           const Error& error, Message message) {
-    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
-    TP_VLOG(1) << "Pipe " << id_ << " is calling a write callback (#"
-               << sequenceNumber << ")";
-    fn(error, std::move(message));
-    TP_VLOG(1) << "Pipe " << id_ << " done calling a write callback (#"
-               << sequenceNumber << ")";
-  };
+  const CudaLib* cudaLib = context_->getCudaLib();
+  if (cudaLib == nullptr) {
+    setError(TP_CREATE_ERROR(CudaError, cudaErrorInitializationError));
+    return;
+  }
+  size_t offset = 0;
+  for (size_t tensorIdx = 0; tensorIdx < op.tensors.size(); tensorIdx++) {
+    if (!isCoalesced(op, op.tensors[tensorIdx])) {
+      continue;
+    }
+    const CudaBuffer buffer =
+        unwrap<CudaBuffer>(op.message.tensors[tensorIdx].buffer);
+    const int device = cudaDeviceForPointer(*cudaLib, buffer.ptr);
+    offset = offsetOfNextCoalescedTensor(offset);
+    op.coalescedCudaTensors.push_back(
+        CoalescedCudaTensor{tensorIdx, buffer, device, offset});
+    offset += buffer.length;
+  }
 
-  op.message = std::move(message);
-  op.writeCallback = std::move(fn);
+  // The buffer is received into on the stream of the first of the tensors,
+  // once the work that the user enqueued on the streams of all of them is done,
+  // and it's then scattered on that stream too.
+  const int device = op.coalescedCudaTensors.front().device;
+  const cudaStream_t stream = op.coalescedCudaTensors.front().buffer.stream;
+  op.stagingBuffer = cudaStagingBuffers_.acquire(
+      device, static_cast<size_t>(op.coalescedTensor.length), stream);
+  for (const CoalescedCudaTensor& tensor : op.coalescedCudaTensors) {
+    cudaStreamWaitForStream(
+        cudaEventPool_, stream, device, tensor.buffer.stream, tensor.device);
+  }
 
-  advanceWriteOperation(op);
+  channel::Channel<CudaBuffer>* channel =
+      findChannelEntry<CudaBuffer>(op.coalescedTensor.channelName).channel;
+  TP_VLOG(3) << "Pipe " << id_ << " is receiving "
+             << op.coalescedCudaTensors.size()
+             << " coalesced tensors of message #" << op.sequenceNumber;
+
+  CudaBuffer buffer;
+  buffer.ptr = op.stagingBuffer.ptr;
+  buffer.length = static_cast<size_t>(op.coalescedTensor.length);
+  buffer.stream = stream;
+  channel->recv(
+      std::move(op.coalescedTensor.descriptor),
+      buffer,
+      eagerCallbackWrapper_([&op](Impl& impl) {
+        TP_VLOG(3) << "Pipe " << impl.id_
+                   << " done receiving coalesced tensors #"
+                   << op.sequenceNumber;
+        impl.scatterCoalescedCudaTensorsOfMessage(op);
+        impl.onRecvOfTensor(op);
+      }));
+  ++op.numTensorsBeingReceived;
 }
 
-//
-// Helpers to schedule our callbacks into user code
-//
-
-void Pipe::Impl::callReadDescriptorCallback(ReadOperation& op) {
+void Pipe::Impl::scatterCoalescedCudaTensorsOfMessage(ReadOperation& op) {
   TP_DCHECK(loop_.inLoop());
-  // Don't check state_ == ESTABLISHED: it can be called after failed handshake
-
-  TP_DCHECK(
-      op.state == ReadOperation::UNINITIALIZED ||
-      op.state == ReadOperation::READING_DESCRIPTOR);
-  op.state = ReadOperation::ASKING_FOR_ALLOCATION;
-
-  TP_DCHECK_EQ(op.sequenceNumber, nextMessageAskingForAllocation_);
-  ++nextMessageAskingForAllocation_;
 
-  op.readDescriptorCallback(error_, std::move(op.message));
-  // Reset callback to release the resources it was holding.
-  op.readDescriptorCallback = nullptr;
+  const int device = op.coalescedCudaTensors.front().device;
+  const cudaStream_t stream = op.coalescedCudaTensors.front().buffer.stream;
+  // The tensors are left alone if the buffer couldn't be received, but it must
+  // still be given back. Only the contiguous ones can go through a graph.
+  const bool useGraph = cudaGraphsForCoalescedTensors_ &&
+      std::all_of(op.coalescedCudaTensors.begin(),
+                  op.coalescedCudaTensors.end(),
+                  [](const CoalescedCudaTensor& tensor) {
+                    return isContiguous(tensor.buffer);
+                  });
+  if (!error_ && useGraph) {
+    std::vector<CudaCopyGraphs::Copy> copies;
+    for (const CoalescedCudaTensor& tensor : op.coalescedCudaTensors) {
+      copies.push_back(CudaCopyGraphs::Copy{
+          tensor.buffer.ptr,
+          reinterpret_cast<const uint8_t*>(op.stagingBuffer.ptr) +
+              tensor.offset,
+          tensor.buffer.length});
+    }
+    cudaCopyGraphs_.enqueue(device, copies, stream);
+  } else if (!error_) {
+    CudaDeviceGuard guard(device);
+    for (const CoalescedCudaTensor& tensor : op.coalescedCudaTensors) {
+      // The tensors of the receiver may not be contiguous.
+      CudaBuffer stagedTensor;
+      stagedTensor.ptr =
+          reinterpret_cast<uint8_t*>(op.stagingBuffer.ptr) + tensor.offset;
+      stagedTensor.length = tensor.buffer.length;
+      cudaCopyBuffer(tensor.buffer, stagedTensor, stream);
+    }
+  }
+  for (const CoalescedCudaTensor& tensor : op.coalescedCudaTensors) {
+    cudaStreamWaitForStream(
+        cudaEventPool_, tensor.buffer.stream, tensor.device, stream, device);
+  }
+  cudaStagingBuffers_.release(std::move(op.stagingBuffer), stream);
 }
+#endif // TENSORPIPE_SUPPORTS_CUDA
 
-void Pipe::Impl::callReadCallback(ReadOperation& op) {
+void Pipe::Impl::readPayloadsOfMessageFromConnection(ReadOperation& op) {
   TP_DCHECK(loop_.inLoop());
-  // Don't check state_ == ESTABLISHED: it can be called after failed handshake
 
-  TP_DCHECK(
-      op.state == ReadOperation::ASKING_FOR_ALLOCATION ||
-      op.state == ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS);
-  op.state = ReadOperation::FINISHED;
-
-  op.readCallback(error_, std::move(op.message));
-  // Reset callback to release the resources it was holding.
-  op.readCallback = nullptr;
+  TP_DCHECK_EQ(connectionState_, AWAITING_PAYLOADS);
+  TP_DCHECK_EQ(messageBeingReadFromConnection_, op.sequenceNumber);
+  for (size_t payloadIdx = 0; payloadIdx < op.message.payloads.size();
+       payloadIdx++) {
+    if (readsPayloadInChunks(op, payloadIdx)) {
+      readChunksOfPayloadFromConnection(op, payloadIdx);
+      continue;
+    }
+    Message::Payload& payload = op.message.payloads[payloadIdx];
+    TP_VLOG(3) << "Pipe " << id_ << " is reading payload #" << op.sequenceNumber
+               << "." << payloadIdx;
+    transport::Connection::read_callback_fn callback = eagerCallbackWrapper_(
+        [&op, payloadIdx](
+            Impl& impl, const void* /* unused */, size_t /* unused */) {
+          TP_VLOG(3) << "Pipe " << impl.id_ << " done reading payload #"
+                     << op.sequenceNumber << "." << payloadIdx;
+          impl.onReadOfPayload(op);
+        });
+    if (op.readPayloadCallback) {
+      // The memory given to the callback is only valid while it runs, hence
+      // the user's callback must be called right away, from the transport's
+      // thread, rather than once deferred to the loop.
+      callback = [payloadIdx,
+                  expectedLength{payload.length},
+                  payloadFn{op.readPayloadCallback},
+                  callback{std::move(callback)}](
+                     const Error& error,
+                     const void* ptr,
+                     size_t length) mutable {
+        if (!error) {
+          TP_DCHECK_EQ(length, expectedLength);
+          payloadFn(payloadIdx, ptr, length);
+        }
+        callback(error, ptr, length);
+      };
+    } else if (op.readChunkCallback) {
+      // Same as above, with the payload going out as a single chunk. It has
+      // its checksum checked before, hence there's none to keep track of.
+      callback = [payloadIdx,
+                  expectedLength{payload.length},
+                  chunkFn{op.readChunkCallback},
+                  callback{std::move(callback)}](
+                     const Error& error,
+                     const void* ptr,
+                     size_t length) mutable {
+        if (!error) {
+          TP_DCHECK_EQ(length, expectedLength);
+          chunkFn(payloadIdx, /*offset=*/0, ptr, length);
+        }
+        callback(error, ptr, length);
+      };
+    }
+    // The checksum is checked before the payload is handed out, if at all.
+    if (op.hasChecksums) {
+      callback = checkingChecksum(
+          "payload #" + std::to_string(op.sequenceNumber) + "." +
+              std::to_string(payloadIdx),
+          op.payloads[payloadIdx].checksum,
+          std::move(callback));
+    }
+    if (op.readPayloadCallback || op.readChunkCallback) {
+      connection_->read(std::move(callback));
+    } else {
+      connection_->read(payload.data, payload.length, std::move(callback));
+    }
+    ++op.numPayloadsBeingRead;
+  }
+  // Tensors that were inlined follow the payloads on the connection.
+  for (size_t tensorIdx = 0; tensorIdx < op.message.tensors.size();
+       tensorIdx++) {
+    if (!isInlined(op, op.tensors[tensorIdx])) {
+      continue;
+    }
+    Message::Tensor& tensor = op.message.tensors[tensorIdx];
+    TP_DCHECK(tensor.buffer.type == DeviceType::kCpu);
+    TP_VLOG(3) << "Pipe " << id_ << " is reading inlined tensor #"
+               << op.sequenceNumber << "." << tensorIdx;
+    transport::Connection::read_callback_fn callback = eagerCallbackWrapper_(
+        [&op, tensorIdx](
+            Impl& impl, const void* /* unused */, size_t /* unused */) {
+          TP_VLOG(3) << "Pipe " << impl.id_ << " done reading inlined tensor #"
+                     << op.sequenceNumber << "." << tensorIdx;
+          impl.unpackReceivedTensor(op, tensorIdx);
+          impl.onReadOfPayload(op);
+        });
+    if (op.hasChecksums) {
+      callback = checkingChecksum(
+          "tensor #" + std::to_string(op.sequenceNumber) + "." +
+              std::to_string(tensorIdx),
+          op.tensors[tensorIdx].checksum,
+          std::move(callback));
+    }
+    const CpuBuffer buffer = prepareToUnpackTensor(
+        op, tensorIdx, tensor.buffer.cpu, /*channelName=*/"");
+    connection_->read(buffer.ptr, buffer.length, std::move(callback));
+    ++op.numPayloadsBeingRead;
+  }
+  connectionState_ = AWAITING_DESCRIPTOR;
+  ++messageBeingReadFromConnection_;
 }
 
-void Pipe::Impl::callWriteCallback(WriteOperation& op) {
+void Pipe::Impl::readChunksOfPayloadFromConnection(
+    ReadOperation& op,
+    size_t payloadIdx) {
   TP_DCHECK(loop_.inLoop());
-  // Don't check state_ == ESTABLISHED: it can be called after failed handshake
-
-  TP_DCHECK(
-      op.state == WriteOperation::UNINITIALIZED ||
-      op.state == WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS ||
-      op.state == WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS);
-  op.state = WriteOperation::FINISHED;
 
-  op.writeCallback(error_, std::move(op.message));
-  // Reset callback to release the resources it was holding.
-  op.writeCallback = nullptr;
+  prepareChunksOfPayload(op, payloadIdx);
+  ReadOperation::Payload& payload = op.payloads[payloadIdx];
+  const size_t numChunks = numChunksOfPayload(payload);
+  TP_VLOG(3) << "Pipe " << id_ << " is reading payload #" << op.sequenceNumber
+             << "." << payloadIdx << " in " << numChunks << " chunks";
+  for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+    const size_t length = lengthOfChunkOfPayload(payload, chunkIdx);
+    const size_t compressedLength =
+        compressedLengthOfChunkOfPayload(payload, chunkIdx);
+    transport::Connection::read_callback_fn callback = eagerCallbackWrapper_(
+        [&op, payloadIdx, chunkIdx](
+            Impl& impl, const void* /* unused */, size_t /* unused */) {
+          impl.onDecompressionOfChunkOfPayload(op, payloadIdx, chunkIdx);
+        });
+    if (op.readChunkCallback && !handsOutChunksFromBuffers(op)) {
+      // All the chunks were sent as they are, and they arrive in order, hence
+      // they can be handed out right away, from the transport's thread, as the
+      // memory they're in is only valid while the callback runs.
+      TP_DCHECK_EQ(compressedLength, length);
+      connection_->read(
+          [&op, payloadIdx, chunkIdx, callback{std::move(callback)}](
+              const Error& error, const void* ptr, size_t length) mutable {
+            if (!error) {
+              handOutChunkOfPayload(op, payloadIdx, chunkIdx, ptr, length);
+            }
+            callback(error, ptr, length);
+          });
+    } else if (compressedLength == length) {
+      // The chunk was sent as it is, hence it can go straight to its place.
+      connection_->read(
+          targetOfChunkOfPayload(op, payloadIdx, chunkIdx),
+          length,
+          std::move(callback));
+    } else {
+      payload.compressedChunks[chunkIdx] =
+          std::make_unique<uint8_t[]>(compressedLength);
+      connection_->read(
+          payload.compressedChunks[chunkIdx].get(),
+          compressedLength,
+          eagerCallbackWrapper_(
+              [&op, payloadIdx, chunkIdx](
+                  Impl& impl, const void* /* unused */, size_t /* unused */) {
+                impl.decompressChunkOfPayload(op, payloadIdx, chunkIdx);
+              }));
+    }
+  }
+  ++op.numPayloadsBeingRead;
 }
 
-//
-// Error handling
-//
+void Pipe::Impl::decompressChunkOfPayload(
+    ReadOperation& op,
+    size_t payloadIdx,
+    size_t chunkIdx) {
+  TP_DCHECK(loop_.inLoop());
 
-void Pipe::Impl::setError(Error error) {
-  // Don't overwrite an error that's already set.
-  if (error_ || !error) {
+  if (error_) {
+    onDecompressionOfChunkOfPayload(op, payloadIdx, chunkIdx);
     return;
   }
 
-  error_ = std::move(error);
-
-  handleError();
+  // The callback keeps the pipe, and thus the operation, alive.
+  context_->getCompressionPool().submit(
+      [compressor{&context_->getPayloadCompressor()},
+       &op,
+       payloadIdx,
+       chunkIdx,
+       callback{eagerCallbackWrapper_([&op, payloadIdx, chunkIdx](Impl& impl) {
+         impl.onDecompressionOfChunkOfPayload(op, payloadIdx, chunkIdx);
+       })}]() mutable {
+        callback(decompressChunkIntoPayload(
+            *compressor, op, payloadIdx, chunkIdx));
+      });
+}
+
+void Pipe::Impl::handOutDecompressedPayloads(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+
+  if (error_) {
+    return;
+  }
+  if (handsOutChunksFromBuffers(op)) {
+    while (op.numPayloadsHandedOut < op.payloads.size()) {
+      const size_t payloadIdx = op.numPayloadsHandedOut;
+      ReadOperation::Payload& payload = op.payloads[payloadIdx];
+      const size_t numChunks = numChunksOfPayload(payload);
+      while (payload.numChunksHandedOut < numChunks) {
+        const size_t chunkIdx = payload.numChunksHandedOut;
+        if (payload.chunksAreDecompressed.empty() ||
+            !payload.chunksAreDecompressed[chunkIdx]) {
+          return;
+        }
+        handOutChunkOfPayload(
+            op,
+            payloadIdx,
+            chunkIdx,
+            payload.decompressedChunks[chunkIdx].get(),
+            lengthOfChunkOfPayload(payload, chunkIdx));
+        payload.decompressedChunks[chunkIdx].reset();
+      }
+      setError(checkChecksumOfChunksHandedOut(op, payloadIdx));
+      if (error_) {
+        return;
+      }
+      op.numPayloadsHandedOut++;
+    }
+    return;
+  }
+  if (!op.readPayloadCallback) {
+    return;
+  }
+  while (op.numPayloadsHandedOut < op.payloads.size()) {
+    const size_t payloadIdx = op.numPayloadsHandedOut;
+    ReadOperation::Payload& payload = op.payloads[payloadIdx];
+    if (!payload.doneDecompressing) {
+      break;
+    }
+    op.readPayloadCallback(
+        payloadIdx, payload.decompressedData.get(), payload.length);
+    payload.decompressedData.reset();
+    op.numPayloadsHandedOut++;
+  }
+}
+
+bool Pipe::Impl::canReadAheadOf(const ReadOperation& op) {
+  TP_DCHECK_EQ(op.state, ReadOperation::ASKING_FOR_ALLOCATION);
+  // A batch gets the descriptors that are there, whatever the window.
+  const ReadOperation* nextOpPtr = findReadOperation(op.sequenceNumber + 1);
+  if (nextOpPtr != nullptr && nextOpPtr->descriptorBatch != nullptr &&
+      !nextOpPtr->descriptorBatch->messages.empty()) {
+    return true;
+  }
+  return op.payloadsStaged ||
+      numMessagesWithStagedPayloads_ < readAheadWindow_;
+}
+
+void Pipe::Impl::stagePayloadsOfMessage(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK(connectionIsReady());
+
+  TP_DCHECK_EQ(op.state, ReadOperation::ASKING_FOR_ALLOCATION);
+  TP_DCHECK(!op.payloadsStaged);
+
+  TP_VLOG(2) << "Pipe " << id_ << " is staging payloads of message #"
+             << op.sequenceNumber;
+
+  TP_DCHECK_EQ(connectionState_, AWAITING_PAYLOADS);
+  TP_DCHECK_EQ(messageBeingReadFromConnection_, op.sequenceNumber);
+  // Same order as in readPayloadsOfMessageFromConnection: first the payloads,
+  // then the inlined tensors. The compressed and chunked payloads are staged as
+  // chunks, as they were sent, and their checksums are checked afterwards.
+  std::vector<size_t> lengths;
+  std::vector<optional<uint32_t>> checksums;
+  for (const ReadOperation::Payload& payload : op.payloads) {
+    if (payload.compressedChunkLengths.empty()) {
+      lengths.push_back(payload.length);
+      checksums.push_back(payload.checksum);
+      continue;
+    }
+    for (size_t compressedLength : payload.compressedChunkLengths) {
+      lengths.push_back(compressedLength);
+      checksums.push_back(nullopt);
+    }
+  }
+  for (const ReadOperation::Tensor& tensor : op.tensors) {
+    if (isInlined(op, tensor)) {
+      lengths.push_back(tensor.length);
+      checksums.push_back(tensor.checksum);
+    }
+  }
+  for (size_t bufferIdx = 0; bufferIdx < lengths.size(); bufferIdx++) {
+    op.stagedBuffers.push_back(std::make_unique<uint8_t[]>(lengths[bufferIdx]));
+    TP_VLOG(3) << "Pipe " << id_ << " is staging buffer #" << op.sequenceNumber
+               << "." << bufferIdx;
+    transport::Connection::read_callback_fn callback = eagerCallbackWrapper_(
+        [&op, bufferIdx](
+            Impl& impl, const void* /* unused */, size_t /* unused */) {
+          TP_VLOG(3) << "Pipe " << impl.id_ << " done staging buffer #"
+                     << op.sequenceNumber << "." << bufferIdx;
+          impl.onReadOfStagedBuffer(op);
+        });
+    if (op.hasChecksums && checksums[bufferIdx].has_value()) {
+      callback = checkingChecksum(
+          "staged buffer #" + std::to_string(op.sequenceNumber) + "." +
+              std::to_string(bufferIdx),
+          checksums[bufferIdx].value(),
+          std::move(callback));
+    }
+    connection_->read(
+        op.stagedBuffers.back().get(), lengths[bufferIdx], std::move(callback));
+    ++op.numStagedBuffersBeingRead;
+  }
+  op.payloadsStaged = true;
+  ++numMessagesWithStagedPayloads_;
+  connectionState_ = AWAITING_DESCRIPTOR;
+  ++messageBeingReadFromConnection_;
+}
+
+void Pipe::Impl::stageInlinePayloadsOfMessage(
+    ReadOperation& op,
+    const uint8_t* ptr) {
+  TP_DCHECK(loop_.inLoop());
+
+  TP_DCHECK_EQ(op.state, ReadOperation::READING_DESCRIPTOR);
+  TP_DCHECK(!op.payloadsStaged);
+  TP_DCHECK(op.message.tensors.empty());
+
+  TP_VLOG(2) << "Pipe " << id_ << " is staging inline payloads of message #"
+             << op.sequenceNumber;
+
+  // The payloads came with the descriptor, whose memory is reused for the next
+  // ones, hence they're copied out and then treated as if they had been staged,
+  // and there's nothing left of this message on the connection.
+  TP_DCHECK_EQ(connectionState_, AWAITING_PAYLOADS);
+  TP_DCHECK_EQ(messageBeingReadFromConnection_, op.sequenceNumber);
+  for (const Message::Payload& payload : op.message.payloads) {
+    op.stagedBuffers.push_back(std::make_unique<uint8_t[]>(payload.length));
+    copyMemory(op.stagedBuffers.back().get(), ptr, payload.length);
+    ptr += payload.length;
+  }
+  op.payloadsStaged = true;
+  ++numMessagesWithStagedPayloads_;
+  connectionState_ = AWAITING_DESCRIPTOR;
+  ++messageBeingReadFromConnection_;
+}
+
+void Pipe::Impl::copyStagedPayloadsOfMessage(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK(op.payloadsStaged);
+  TP_DCHECK_EQ(op.numStagedBuffersBeingRead, 0);
+
+  size_t bufferIdx = 0;
+  for (size_t payloadIdx = 0; payloadIdx < op.message.payloads.size();
+       payloadIdx++) {
+    Message::Payload& payload = op.message.payloads[payloadIdx];
+    ReadOperation::Payload& payloadBeingRead = op.payloads[payloadIdx];
+    if (!payloadBeingRead.compressedChunkLengths.empty() &&
+        op.readChunkCallback && !handsOutChunksFromBuffers(op)) {
+      // The chunks were all sent as they are and can go out right away.
+      for (size_t chunkIdx = 0; chunkIdx < numChunksOfPayload(payloadBeingRead);
+           chunkIdx++) {
+        const uint8_t* stagedBuffer = op.stagedBuffers[bufferIdx++].get();
+        if (!error_) {
+          handOutChunkOfPayload(
+              op,
+              payloadIdx,
+              chunkIdx,
+              stagedBuffer,
+              lengthOfChunkOfPayload(payloadBeingRead, chunkIdx));
+        }
+      }
+      if (!error_) {
+        setError(checkChecksumOfChunksHandedOut(op, payloadIdx));
+      }
+      continue;
+    }
+    if (!payloadBeingRead.compressedChunkLengths.empty()) {
+      // The chunks, even those that were sent as they are, are taken care of
+      // by the compression threads.
+      prepareChunksOfPayload(op, payloadIdx);
+      for (size_t chunkIdx = 0; chunkIdx < numChunksOfPayload(payloadBeingRead);
+           chunkIdx++) {
+        payloadBeingRead.compressedChunks[chunkIdx] =
+            std::move(op.stagedBuffers[bufferIdx++]);
+        decompressChunkOfPayload(op, payloadIdx, chunkIdx);
+      }
+      ++op.numPayloadsBeingRead;
+      continue;
+    }
+    if (readsPayloadInChunks(op, payloadIdx)) {
+      // Staged payloads were complete already, and so are their checksums.
+      if (handsOutChunksFromBuffers(op)) {
+        payloadBeingRead.decompressedChunks.push_back(
+            std::move(op.stagedBuffers[bufferIdx++]));
+        payloadBeingRead.chunksAreDecompressed.push_back(true);
+      } else {
+        payloadBeingRead.decompressedData =
+            std::move(op.stagedBuffers[bufferIdx++]);
+      }
+      payloadBeingRead.doneDecompressing = true;
+      continue;
+    }
+    const uint8_t* stagedBuffer = op.stagedBuffers[bufferIdx++].get();
+    if (op.readPayloadCallback) {
+      op.readPayloadCallback(payloadIdx, stagedBuffer, payload.length);
+    } else if (op.readChunkCallback) {
+      if (!error_) {
+        op.readChunkCallback(
+            payloadIdx, /*offset=*/0, stagedBuffer, payload.length);
+      }
+    } else {
+      copyMemory(payload.data, stagedBuffer, payload.length);
+    }
+  }
+  for (size_t tensorIdx = 0; tensorIdx < op.message.tensors.size();
+       tensorIdx++) {
+    if (!isInlined(op, op.tensors[tensorIdx])) {
+      continue;
+    }
+    const CpuBuffer& buffer = op.message.tensors[tensorIdx].buffer.cpu;
+    CpuBuffer stagedBuffer;
+    stagedBuffer.ptr = op.stagedBuffers[bufferIdx++].get();
+    stagedBuffer.length = buffer.length;
+    copyBuffer(buffer, stagedBuffer);
+  }
+  TP_DCHECK_EQ(bufferIdx, op.stagedBuffers.size());
+  if (op.hasChunkedPayloads) {
+    handOutDecompressedPayloads(op);
+  }
+  if (!op.stagedBuffers.empty()) {
+    takeTimestamp(op.payloadsReadTime);
+  }
+
+  releaseStagedPayloadsOfMessage(op);
+}
+
+void Pipe::Impl::releaseStagedPayloadsOfMessage(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+
+  if (op.payloadsStaged) {
+    op.stagedBuffers.clear();
+    op.payloadsStaged = false;
+    --numMessagesWithStagedPayloads_;
+  }
+}
+
+void Pipe::write(Message message, write_callback_fn fn) {
+  impl_->write(
+      std::move(message),
+      /*priority=*/0,
+      /*checksums=*/nullptr,
+      kNoDeadline,
+      /*buffersReleasedFn=*/nullptr,
+      std::move(fn));
+}
+
+void Pipe::write(
+    Message message,
+    buffers_released_callback_fn buffersReleasedFn,
+    write_callback_fn fn) {
+  TP_THROW_ASSERT_IF(!buffersReleasedFn)
+      << "The buffers released callback must be set";
+  impl_->write(
+      std::move(message),
+      /*priority=*/0,
+      /*checksums=*/nullptr,
+      kNoDeadline,
+      std::move(buffersReleasedFn),
+      std::move(fn));
+}
+
+void Pipe::write(Message message, int priority, write_callback_fn fn) {
+  impl_->write(
+      std::move(message),
+      priority,
+      /*checksums=*/nullptr,
+      kNoDeadline,
+      /*buffersReleasedFn=*/nullptr,
+      std::move(fn));
+}
+
+void Pipe::write(
+    Message message,
+    int priority,
+    std::chrono::milliseconds timeout,
+    write_callback_fn fn) {
+  TP_THROW_ASSERT_IF(timeout <= kNoDeadline) << "The timeout must be positive";
+  impl_->write(
+      std::move(message),
+      priority,
+      /*checksums=*/nullptr,
+      timeout,
+      /*buffersReleasedFn=*/nullptr,
+      std::move(fn));
+}
+
+void Pipe::Impl::write(
+    Message message,
+    int priority,
+    std::shared_ptr<const std::vector<uint32_t>> checksums,
+    std::chrono::milliseconds timeout,
+    buffers_released_callback_fn buffersReleasedFn,
+    write_callback_fn fn) {
+  loop_.deferToLoop([this,
+                     message{std::move(message)},
+                     priority,
+                     checksums{std::move(checksums)},
+                     timeout,
+                     buffersReleasedFn{std::move(buffersReleasedFn)},
+                     fn{std::move(fn)}]() mutable {
+    writeFromLoop(
+        std::move(message),
+        priority,
+        std::move(checksums),
+        timeout,
+        std::move(buffersReleasedFn),
+        std::move(fn));
+  });
+}
+
+void Pipe::Impl::writeFromLoop(
+    Message message,
+    int priority,
+    std::shared_ptr<const std::vector<uint32_t>> checksums,
+    std::chrono::milliseconds timeout,
+    buffers_released_callback_fn buffersReleasedFn,
+    write_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+  TP_TRACE_SCOPE("tp::Pipe::write");
+
+  writeOperations_.emplace_back();
+  WriteOperation* opPtr = &writeOperations_.back();
+  opPtr->sequenceNumber = nextMessageBeingWritten_++;
+  opPtr->priority = priority;
+  takeTimestamp(opPtr->writeCallTime);
+  opPtr->traceFlowId = TP_TRACE_NEW_FLOW_ID();
+  TP_TRACE_FLOW_START("tp::Pipe::write", opPtr->traceFlowId);
+
+  // A message that can't be mapped fails before it starts, like one that is
+  // past its deadline.
+  sumSegmentsOfPayloads(message);
+  opPtr->error =
+      mapFilePayloads(message, /*forWriting=*/false, opPtr->fileMappings);
+
+  size_t numHostBytes = 0;
+  for (const auto& payload : message.payloads) {
+    opPtr->numBytes += payload.length;
+    numHostBytes += payload.length;
+  }
+  for (const auto& tensor : message.tensors) {
+    TP_THROW_ASSERT_IF(!bufferHasValidLayout(tensor.buffer))
+        << "The rows of a tensor don't match its length";
+    opPtr->numBytes += lengthOfBuffer(tensor.buffer);
+    if (tensor.buffer.type == DeviceType::kCpu) {
+      numHostBytes += lengthOfBuffer(tensor.buffer);
+    }
+  }
+  opPtr->memoryCharge = MemoryCharge(
+      context_->getMemoryFootprintCounters(), MemoryKind::kHost, numHostBytes);
+  TP_USDT(
+      pipe__write__start, id_.c_str(), opPtr->sequenceNumber, opPtr->numBytes);
+  opPtr->message = std::move(message);
+  opPtr->checksums = std::move(checksums);
+  opPtr->buffersReleasedCallback = std::move(buffersReleasedFn);
+  opPtr->writeCallback = std::move(fn);
+  if (timeout > kNoDeadline) {
+    scheduleDeadline(opPtr->deadlineTimer, opPtr->deadline, timeout);
+  }
+
+  // Let the operation overtake the ones with a lower priority that haven't
+  // started yet, which are the last ones of the queue. Their positions are
+  // swapped, rather than the operation being inserted among them, as the ones
+  // that have started are referenced by their callbacks and must stay put. As
+  // for those that haven't, nothing refers to them yet, and they still can be
+  // renumbered.
+  for (size_t idx = writeOperations_.size() - 1; idx > 0; idx--) {
+    WriteOperation& prevOp = writeOperations_[idx - 1];
+    if (prevOp.state != WriteOperation::UNINITIALIZED ||
+        prevOp.priority >= priority) {
+      break;
+    }
+    std::swap(prevOp, *opPtr);
+    std::swap(prevOp.sequenceNumber, opPtr->sequenceNumber);
+    opPtr = &prevOp;
+  }
+  WriteOperation& op = *opPtr;
+
+  TP_VLOG(1) << "Pipe " << id_ << " received a write request (#"
+             << op.sequenceNumber << ", contaning "
+             << op.message.payloads.size() << " payloads and "
+             << op.message.tensors.size() << " tensors, with priority "
+             << op.priority << ")";
+
+  advanceWriteOperation(op);
+}
+
+void Pipe::writeBatch(std::vector<Message> messages, write_callback_fn fn) {
+  impl_->writeBatch(std::move(messages), /*priority=*/0, std::move(fn));
+}
+
+void Pipe::writeBatch(
+    std::vector<Message> messages,
+    int priority,
+    write_callback_fn fn) {
+  impl_->writeBatch(std::move(messages), priority, std::move(fn));
+}
+
+void Pipe::Impl::writeBatch(
+    std::vector<Message> messages,
+    int priority,
+    write_callback_fn fn) {
+  loop_.deferToLoop([this,
+                     messages{std::move(messages)},
+                     priority,
+                     fn{std::move(fn)}]() mutable {
+    writeBatchFromLoop(std::move(messages), priority, std::move(fn));
+  });
+}
+
+void Pipe::Impl::writeBatchFromLoop(
+    std::vector<Message> messages,
+    int priority,
+    write_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+  TP_TRACE_SCOPE("tp::Pipe::writeBatch");
+
+  TP_VLOG(1) << "Pipe " << id_ << " received a batch of " << messages.size()
+             << " write requests";
+
+  // The callback is shared by all the messages, each of them calling it once.
+  auto sharedFn = std::make_shared<write_callback_fn>(std::move(fn));
+  TP_DCHECK(!batchingWrites_);
+  batchingWrites_ = true;
+  for (Message& message : messages) {
+    writeFromLoop(
+        std::move(message),
+        priority,
+        /*checksums=*/nullptr,
+        kNoDeadline,
+        /*buffersReleasedFn=*/nullptr,
+        [sharedFn](const Error& error, Message message) {
+          (*sharedFn)(error, std::move(message));
+        });
+  }
+  batchingWrites_ = false;
+  writeBatchedDescriptorsAndPayloads();
+}
+
+void Pipe::writeToPipes(
+    const std::vector<std::shared_ptr<Pipe>>& pipes,
+    Message message,
+    write_callback_fn fn) {
+  TP_THROW_ASSERT_IF(pipes.empty());
+  TP_THROW_ASSERT_IF(message.handOffTensors)
+      << "Tensors can't be handed off to several pipes";
+
+  // The files of the payloads are mapped once for all the pipes, which write
+  // from the same mappings, as from regular payloads.
+  sumSegmentsOfPayloads(message);
+  std::vector<MmappedPtr> fileMappings;
+  Error error = mapFilePayloads(message, /*forWriting=*/false, fileMappings);
+  if (error) {
+    fn(error, std::move(message));
+    return;
+  }
+
+  // Compute the checksums once for all the pipes, if any of them needs them.
+  std::shared_ptr<std::vector<uint32_t>> checksums;
+  for (const std::shared_ptr<Pipe>& pipe : pipes) {
+    if (pipe->impl_->isChecksummingPayloads()) {
+      checksums = std::make_shared<std::vector<uint32_t>>();
+      break;
+    }
+  }
+  if (checksums != nullptr) {
+    for (const Message::Payload& payload : message.payloads) {
+      checksums->push_back(crc32cOfPayload(payload));
+    }
+    for (const Message::Tensor& tensor : message.tensors) {
+      checksums->push_back(
+          tensor.buffer.type == DeviceType::kCpu
+              ? crc32cOfBuffer(tensor.buffer.cpu)
+              : 0);
+    }
+  }
+
+  // The message is kept here, as each pipe writes from a copy of it that
+  // points to the same buffers, and it's given back once all of them are done.
+  struct State {
+    std::mutex mutex;
+    size_t numPipesBeingWritten;
+    Error error;
+    Message message;
+    std::vector<MmappedPtr> fileMappings;
+    write_callback_fn fn;
+  };
+  auto state = std::make_shared<State>();
+  state->numPipesBeingWritten = pipes.size();
+  state->message = std::move(message);
+  state->fileMappings = std::move(fileMappings);
+  state->fn = std::move(fn);
+
+  // The message isn't touched by the callbacks until the last one, which can't
+  // run before the last pipe gets its copy.
+  const Message& original = state->message;
+  for (const std::shared_ptr<Pipe>& pipe : pipes) {
+    Message copy;
+    copy.metadata = original.metadata;
+    for (const Message::Payload& payload : original.payloads) {
+      copy.payloads.emplace_back();
+      Message::Payload& payloadCopy = copy.payloads.back();
+      payloadCopy.data = payload.data;
+      payloadCopy.length = payload.length;
+      payloadCopy.segments = payload.segments;
+      payloadCopy.metadata = payload.metadata;
+      payloadCopy.allocationHints = payload.allocationHints;
+    }
+    for (const Message::Tensor& tensor : original.tensors) {
+      copy.tensors.push_back(Message::Tensor{
+          tensor.buffer, tensor.metadata, nullptr, tensor.allocationHints});
+    }
+    pipe->impl_->write(
+        std::move(copy),
+        /*priority=*/0,
+        checksums,
+        kNoDeadline,
+        /*buffersReleasedFn=*/nullptr,
+        [state](const Error& error, Message /* unused */) {
+          std::unique_lock<std::mutex> lock(state->mutex);
+          if (error && !state->error) {
+            state->error = error;
+          }
+          if (--state->numPipesBeingWritten > 0) {
+            return;
+          }
+          lock.unlock();
+          unmapFilePayloads(state->message, state->fileMappings);
+          state->fn(state->error, std::move(state->message));
+          state->fn = nullptr;
+        });
+  }
+}
+
+void Pipe::waitUntilWritable(writable_callback_fn fn) {
+  impl_->waitUntilWritable(std::move(fn));
+}
+
+void Pipe::Impl::waitUntilWritable(writable_callback_fn fn) {
+  loop_.deferToLoop([this, fn{std::move(fn)}]() mutable {
+    waitUntilWritableFromLoop(std::move(fn));
+  });
+}
+
+void Pipe::Impl::waitUntilWritableFromLoop(writable_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+  writableCallbacks_.push_back(std::move(fn));
+  callWritableCallbacks();
+}
+
+//
+// Helpers to schedule our callbacks into user code
+//
+
+void Pipe::Impl::callReadDescriptorCallback(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  // Don't check state_ == ESTABLISHED: it can be called after failed handshake
+
+  TP_DCHECK(
+      op.state == ReadOperation::UNINITIALIZED ||
+      op.state == ReadOperation::READING_DESCRIPTOR);
+  op.state = ReadOperation::ASKING_FOR_ALLOCATION;
+  cancelDeadline(op.deadlineTimer);
+
+  // No one asked for this descriptor yet, see carriedOverReadOperation_.
+  if (&op == carriedOverReadOperation_) {
+    op.descriptorIsHeld = true;
+    return;
+  }
+  handOutDescriptorOfMessage(op);
+}
+
+void Pipe::Impl::handOutDescriptorOfMessage(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+
+  TP_DCHECK_EQ(op.state, ReadOperation::ASKING_FOR_ALLOCATION);
+  TP_DCHECK_EQ(op.sequenceNumber, nextMessageAskingForAllocation_);
+  ++nextMessageAskingForAllocation_;
+
+  if (op.allocateCallback || op.hasPostedMessage) {
+    callAllocateCallback(op);
+    return;
+  }
+
+  op.message.sequenceNumber = op.sequenceNumber;
+  if (op.descriptorBatch != nullptr) {
+    onDescriptorOfBatch(op, std::move(op.message));
+    return;
+  }
+  op.readDescriptorCallback(error_, std::move(op.message));
+  // Reset callback to release the resources it was holding.
+  op.readDescriptorCallback = nullptr;
+}
+
+void Pipe::Impl::onDescriptorOfBatch(ReadOperation& op, Message message) {
+  TP_DCHECK(loop_.inLoop());
+
+  TP_DCHECK_EQ(op.sequenceNumber, nextReadDescriptorCallbackToCall_);
+  ++nextReadDescriptorCallbackToCall_;
+  std::shared_ptr<DescriptorBatch> batch = std::move(op.descriptorBatch);
+  TP_DCHECK(!batch->handedOut);
+  TP_DCHECK_EQ(batch->lastSequenceNumber, op.sequenceNumber);
+
+  batch->messages.push_back(std::move(message));
+  if (error_ || batch->messages.size() == batch->maxMessages) {
+    callReadDescriptorBatchCallback(*batch);
+    return;
+  }
+  if (batch->messages.size() == 1) {
+    passOverDescriptorBatch(batch);
+  }
+  // The batch can only grow as long as no other operation came after it. The
+  // loop that is advancing the operations, and that got here, gets to the new
+  // one next, and reads its descriptor right away.
+  if (op.sequenceNumber + 1 == static_cast<int64_t>(nextMessageBeingRead_)) {
+    ReadOperation& nextOp = startReadOperation();
+    nextOp.descriptorBatch = batch;
+    batch->lastSequenceNumber = nextOp.sequenceNumber;
+  }
+}
+
+void Pipe::Impl::passOverDescriptorBatch(
+    std::shared_ptr<DescriptorBatch> batch) {
+  TP_DCHECK(loop_.inLoop());
+
+  if (batch->handedOut) {
+    return;
+  }
+  // The descriptors that were there already come in while the loop goes
+  // through the tasks queued before this one, hence the batch waits for as
+  // long as each pass brings more of them.
+  if (batch->numMessagesAtLastPass < batch->messages.size()) {
+    batch->numMessagesAtLastPass = batch->messages.size();
+    loop_.deferToLoop([impl{shared_from_this()}, batch{std::move(batch)}]() {
+      impl->passOverDescriptorBatch(std::move(batch));
+    });
+    return;
+  }
+  callReadDescriptorBatchCallback(*batch);
+}
+
+void Pipe::Impl::callReadDescriptorBatchCallback(DescriptorBatch& batch) {
+  TP_DCHECK(loop_.inLoop());
+
+  TP_DCHECK(!batch.handedOut);
+  batch.handedOut = true;
+
+  // The operation that was waiting for the next descriptor goes on without the
+  // batch, and its descriptor to the next read call.
+  ReadOperation* opPtr = findReadOperation(batch.lastSequenceNumber);
+  if (opPtr != nullptr && opPtr->descriptorBatch != nullptr) {
+    TP_DCHECK(carriedOverReadOperation_ == nullptr);
+    TP_DCHECK_LT(opPtr->state, ReadOperation::ASKING_FOR_ALLOCATION);
+    opPtr->descriptorBatch = nullptr;
+    carriedOverReadOperation_ = opPtr;
+  }
+
+  TP_VLOG(1) << "Pipe " << id_ << " is calling a readDescriptorBatch callback ("
+             << batch.messages.size() << " messages)";
+  runCallback(batch.fn, error_, std::move(batch.messages));
+  TP_VLOG(1) << "Pipe " << id_
+             << " done calling a readDescriptorBatch callback";
+  // Reset callback to release the resources it was holding.
+  batch.fn = nullptr;
+}
+
+void Pipe::Impl::callAllocateCallback(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK_EQ(op.state, ReadOperation::ASKING_FOR_ALLOCATION);
+
+  // Keep the sequence of readDescriptor callbacks consistent, as if this one
+  // had been called.
+  TP_DCHECK_EQ(op.sequenceNumber, nextReadDescriptorCallbackToCall_);
+  ++nextReadDescriptorCallbackToCall_;
+
+  if (!error_ && op.hasPostedMessage) {
+    TP_VLOG(1) << "Pipe " << id_ << " is matching message #"
+               << op.sequenceNumber << " to its posted receive";
+    setError(useBuffersOfPostedMessage(op));
+    takeTimestamp(op.readCallTime);
+  } else if (!error_) {
+    TP_VLOG(1) << "Pipe " << id_ << " is calling an allocate callback (#"
+               << op.sequenceNumber << ")";
+    op.allocateCallback(op.message);
+    TP_VLOG(1) << "Pipe " << id_ << " done calling an allocate callback (#"
+               << op.sequenceNumber << ")";
+    checkAllocationCompatibility(op, op.message);
+    takeTimestamp(op.readCallTime);
+  }
+  // The posted message goes back to the user if it couldn't be matched.
+  if (op.hasPostedMessage && error_) {
+    op.message = std::move(op.postedMessage);
+  }
+  op.postedMessage = Message();
+  // Reset callback to release the resources it was holding.
+  op.allocateCallback = nullptr;
+  op.doneGettingAllocation = true;
+
+  skipAllocatedReadOperations();
+}
+
+void Pipe::Impl::skipAllocatedReadOperations() {
+  TP_DCHECK(loop_.inLoop());
+
+  while (nextMessageGettingAllocation_ < nextMessageAskingForAllocation_) {
+    ReadOperation* opPtr = findReadOperation(nextMessageGettingAllocation_);
+    TP_DCHECK(opPtr != nullptr);
+    if (!opPtr->doneGettingAllocation) {
+      break;
+    }
+    ++nextMessageGettingAllocation_;
+  }
+}
+
+std::shared_ptr<NopHolder<Packet>> Pipe::Impl::acquireDescriptorHolder() {
+  TP_DCHECK(loop_.inLoop());
+
+  if (freeDescriptorHolders_.empty()) {
+    return std::make_shared<NopHolder<Packet>>();
+  }
+  std::shared_ptr<NopHolder<Packet>> holder =
+      std::move(freeDescriptorHolders_.back());
+  freeDescriptorHolders_.pop_back();
+  return holder;
+}
+
+void Pipe::Impl::releaseDescriptorHolder(
+    std::shared_ptr<NopHolder<Packet>> holder) {
+  TP_DCHECK(loop_.inLoop());
+
+  if (freeDescriptorHolders_.size() < kMaxFreeDescriptorHolders) {
+    freeDescriptorHolders_.push_back(std::move(holder));
+  }
+}
+
+void Pipe::Impl::callReadCallback(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  // Don't check state_ == ESTABLISHED: it can be called after failed handshake
+
+  TP_DCHECK(
+      op.state == ReadOperation::ASKING_FOR_ALLOCATION ||
+      op.state == ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS);
+  op.state = ReadOperation::FINISHED;
+  cancelDeadline(op.deadlineTimer);
+
+  // In case of error the staged payloads may not have been consumed.
+  releaseStagedPayloadsOfMessage(op);
+  unmapFilePayloads(op.message, op.fileMappings);
+
+  // In case of error the tensors that were handed off are released instead.
+  op.message.handOffTensors = op.handsOffTensors;
+  if (!error_ && op.handsOffTensors) {
+    for (size_t tensorIdx = 0; tensorIdx < op.message.tensors.size();
+         tensorIdx++) {
+      Message::Tensor& tensor = op.message.tensors[tensorIdx];
+      HandedOffTensor& handedOffTensor = op.handedOffTensors[tensorIdx];
+      tensor.buffer.cpu.ptr = handedOffTensor.ptr();
+      tensor.buffer.cpu.rowLength = 0;
+      tensor.buffer.cpu.rowStride = 0;
+      tensor.release = handedOffTensor.takeRelease();
+    }
+  }
+  op.handedOffTensors.clear();
+
+  if (collectStats_ && !error_) {
+    recordStatsOfReadOperation(op, std::chrono::steady_clock::now());
+  }
+
+  TP_TRACE_SCOPE("tp::Pipe::readCallback");
+  TP_TRACE_FLOW_END("tp::Pipe::read", op.traceFlowId);
+  TP_USDT(pipe__read__done, id_.c_str(), op.sequenceNumber, error_ ? 1 : 0);
+  op.message.sequenceNumber = op.sequenceNumber;
+  op.readCallback(error_, std::move(op.message));
+  // Reset callbacks to release the resources they were holding.
+  op.readCallback = nullptr;
+  op.readPayloadCallback = nullptr;
+  op.readChunkCallback = nullptr;
+}
+
+void Pipe::Impl::callBuffersReleasedCallback(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+
+  TP_VLOG(1) << "Pipe " << id_ << " is calling a buffers released callback (#"
+             << op.sequenceNumber << ")";
+  buffers_released_callback_fn fn = std::move(op.buffersReleasedCallback);
+  op.buffersReleasedCallback = nullptr;
+  runCallbackTask(std::move(fn));
+}
+
+void Pipe::Impl::callWriteCallback(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  // Don't check state_ == ESTABLISHED: it can be called after failed handshake
+
+  TP_DCHECK(
+      op.state == WriteOperation::UNINITIALIZED ||
+      op.state == WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS ||
+      op.state == WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS);
+  if (op.state == WriteOperation::UNINITIALIZED) {
+    // It never started, because of an error or of its deadline.
+    TP_DCHECK_EQ(nextWriteOperationToStart_, op.sequenceNumber);
+    nextWriteOperationToStart_++;
+  } else {
+    numWritesInFlight_--;
+    numWriteBytesInFlight_ -= op.numBytes;
+  }
+  op.state = WriteOperation::FINISHED;
+  cancelDeadline(op.deadlineTimer);
+  op.memoryCharge.reset();
+
+  if (collectStats_ && !error_ && !op.error) {
+    recordStatsOfWriteOperation(op, std::chrono::steady_clock::now());
+  }
+
+  TP_DCHECK(
+      unorderedCompletions_ || op.sequenceNumber == nextWriteCallbackToCall_);
+  ++nextWriteCallbackToCall_;
+  TP_VLOG(1) << "Pipe " << id_ << " is calling a write callback (#"
+             << op.sequenceNumber << ")";
+  TP_TRACE_SCOPE("tp::Pipe::writeCallback");
+  TP_TRACE_FLOW_END("tp::Pipe::write", op.traceFlowId);
+  TP_USDT(
+      pipe__write__done,
+      id_.c_str(),
+      op.sequenceNumber,
+      error_ || op.error ? 1 : 0);
+  op.message.sequenceNumber = op.sequenceNumber;
+  unmapFilePayloads(op.message, op.fileMappings);
+  if (op.buffersReleasedCallback) {
+    callBuffersReleasedCallback(op);
+  }
+  runCallback(
+      op.writeCallback, error_ ? error_ : op.error, std::move(op.message));
+  TP_VLOG(1) << "Pipe " << id_ << " done calling a write callback (#"
+             << op.sequenceNumber << ")";
+  // Reset callback to release the resources it was holding.
+  op.writeCallback = nullptr;
+}
+
+void Pipe::Impl::callWritableCallbacks() {
+  TP_DCHECK(loop_.inLoop());
+  // A callback may issue a write that fills the pipe up again.
+  while (!writableCallbacks_.empty() && (error_ || isWritable())) {
+    writable_callback_fn fn = std::move(writableCallbacks_.front());
+    writableCallbacks_.pop_front();
+    runCallback(fn, error_);
+  }
+}
+
+void Pipe::Impl::runCallback(
+    MoveOnlyFunction<void(const Error&, Message)>& fn,
+    const Error& error,
+    Message message) {
+  TP_DCHECK(loop_.inLoop());
+  if (callbackExecutor_ == nullptr && !collectStats_) {
+    fn(error, std::move(message));
+    return;
+  }
+  runCallbackTask(
+      [fn{std::move(fn)}, error, message{std::move(message)}]() mutable {
+        fn(error, std::move(message));
+      });
+}
+
+void Pipe::Impl::runCallback(writable_callback_fn& fn, const Error& error) {
+  TP_DCHECK(loop_.inLoop());
+  if (callbackExecutor_ == nullptr && !collectStats_) {
+    fn(error);
+    return;
+  }
+  runCallbackTask([fn{std::move(fn)}, error]() { fn(error); });
+}
+
+void Pipe::Impl::runCallback(
+    read_descriptor_batch_callback_fn& fn,
+    const Error& error,
+    std::vector<Message> messages) {
+  TP_DCHECK(loop_.inLoop());
+  if (callbackExecutor_ == nullptr && !collectStats_) {
+    fn(error, std::move(messages));
+    return;
+  }
+  runCallbackTask(
+      [fn{std::move(fn)}, error, messages{std::move(messages)}]() mutable {
+        fn(error, std::move(messages));
+      });
+}
+
+void Pipe::Impl::runCallbackTask(MoveOnlyFunction<void()> task) {
+  TP_DCHECK(loop_.inLoop());
+  // The pipe is kept alive by the task if it runs later, to record its time.
+  if (collectStats_) {
+    task = [impl{shared_from_this()}, task{std::move(task)}]() {
+      TTimePoint startTime = std::chrono::steady_clock::now();
+      task();
+      PipeStats stats;
+      addLatency(
+          stats.callbackRunTime, startTime, std::chrono::steady_clock::now());
+      impl->mergeStats(stats);
+    };
+  }
+  if (callbackExecutor_ == nullptr) {
+    task();
+  } else {
+    callbackExecutor_->submit(std::move(task));
+  }
+}
+
+//
+// Statistics
+//
+
+void Pipe::Impl::takeTimestamp(TTimePoint& timePoint) {
+  if (collectStats_) {
+    timePoint = std::chrono::steady_clock::now();
+  }
+}
+
+void Pipe::Impl::recordStatsOfReadOperation(
+    const ReadOperation& op,
+    TTimePoint now) {
+  TP_DCHECK(loop_.inLoop());
+
+  PipeStats stats;
+  addLatency(
+      stats.readDescriptorRead,
+      op.readDescriptorCallTime,
+      op.descriptorReadTime);
+  addLatency(stats.readPayloadsRead, op.readCallTime, op.payloadsReadTime);
+  addLatency(
+      stats.readTensorsReceived, op.readCallTime, op.tensorsReceivedTime);
+  addLatency(stats.readCallbackInvoked, op.readCallTime, now);
+  stats.numMessagesRead = 1;
+
+  uint64_t payloadBytes = 0;
+  for (const auto& payload : op.message.payloads) {
+    payloadBytes += payload.length;
+  }
+  for (const auto& tensor : op.tensors) {
+    if (op.handsOffTensors) {
+      // Nothing was transferred.
+    } else if (isCoalesced(op, tensor)) {
+      stats.tensorBytesReceivedPerChannel[op.coalescedTensor.channelName] +=
+          tensor.length;
+    } else if (tensor.dedup == TensorDedup::kHit) {
+      stats.tensorBytesDeduplicatedReceived += tensor.length;
+    } else if (tensor.channelName.empty()) {
+      payloadBytes += tensor.length;
+    } else {
+      stats.tensorBytesReceivedPerChannel[tensor.channelName] += tensor.length;
+    }
+  }
+  stats.payloadBytesReadPerTransport[transport_] = payloadBytes;
+
+  mergeStats(stats);
+}
+
+void Pipe::Impl::recordStatsOfWriteOperation(
+    const WriteOperation& op,
+    TTimePoint now) {
+  TP_DCHECK(loop_.inLoop());
+
+  PipeStats stats;
+  addLatency(
+      stats.writeTensorDescriptorsCollected,
+      op.writeCallTime,
+      op.tensorDescriptorsCollectedTime);
+  addLatency(
+      stats.writePayloadsWritten, op.writeCallTime, op.payloadsWrittenTime);
+  addLatency(stats.writeTensorsSent, op.writeCallTime, op.tensorsSentTime);
+  addLatency(stats.writeCallbackInvoked, op.writeCallTime, now);
+  stats.numMessagesWritten = 1;
+
+  uint64_t payloadBytes = 0;
+  for (const auto& payload : op.message.payloads) {
+    payloadBytes += payload.length;
+  }
+  TP_DCHECK_EQ(op.message.tensors.size(), op.tensors.size());
+  for (size_t tensorIdx = 0; tensorIdx < op.tensors.size(); ++tensorIdx) {
+    const std::string& channelName = op.tensors[tensorIdx].channelName;
+    const size_t length = lengthOfBuffer(op.message.tensors[tensorIdx].buffer);
+    if (op.handsOffTensors) {
+      // Nothing was transferred.
+    } else if (isInlined(op, op.tensors[tensorIdx])) {
+      payloadBytes += length;
+    } else if (op.tensors[tensorIdx].dedup == TensorDedup::kHit) {
+      stats.tensorBytesDeduplicatedSent += length;
+    } else if (channelName.empty()) {
+      stats.tensorBytesSentPerChannel[op.coalescedTensor.channelName] += length;
+    } else {
+      stats.tensorBytesSentPerChannel[channelName] += length;
+    }
+  }
+  stats.payloadBytesWrittenPerTransport[transport_] = payloadBytes;
+
+  mergeStats(stats);
+}
+
+void Pipe::Impl::recordStatsOfEstablishment(TTimePoint now) {
+  TP_DCHECK(loop_.inLoop());
+  PipeStats stats;
+  if (listener_ != nullptr) {
+    addLatency(stats.acceptBrochureRead, creationTime_, brochureExchangedTime_);
+    addLatency(stats.acceptEstablished, creationTime_, now);
+  } else {
+    addLatency(
+        stats.connectBrochureAnswerRead, creationTime_, brochureExchangedTime_);
+    addLatency(stats.connectEstablished, creationTime_, now);
+  }
+  mergeStats(stats);
+}
+
+void Pipe::Impl::mergeStats(const PipeStats& stats) {
+  {
+    std::unique_lock<std::mutex> lock(statsMutex_);
+    stats_.merge(stats);
+  }
+  context_->mergeStats(stats);
+}
+
+//
+// Error handling
+//
+
+void Pipe::Impl::setError(Error error) {
+  // Don't overwrite an error that's already set.
+  if (error_ || !error) {
+    return;
+  }
+
+  error_ = std::move(error);
+  failed_ = true;
+
+  handleError();
 }
 
 void Pipe::Impl::handleError() {
   TP_DCHECK(loop_.inLoop());
   TP_VLOG(2) << "Pipe " << id_ << " is handling error " << error_.what();
+  TP_TRACE_INSTANT("tp::Pipe::handleError");
 
+  // The messages held for a coalesced write are handed to the connection, for
+  // it to fail them, as their operations wait for it.
+  if (!batchingWrites_) {
+    writeBatchedDescriptorsAndPayloads();
+  }
   connection_->close();
   forEachDeviceType([&](auto buffer) {
     for (auto& channelIter : channels_.get<decltype(buffer)>()) {
       channelIter.second->close();
     }
   });
+  if (channelMultiplexer_ != nullptr) {
+    channelMultiplexer_->close();
+  }
 
   if (registrationId_.has_value()) {
     listener_->unregisterConnectionRequest(registrationId_.value());
@@ -1004,6 +3989,28 @@ void Pipe::Impl::handleError() {
     }
     channelRegistrationIds_.get<decltype(buffer)>().clear();
   });
+  if (channelsRegistrationId_.has_value()) {
+    listener_->unregisterConnectionRequest(channelsRegistrationId_.value());
+    channelsRegistrationId_.reset();
+  }
+
+  // The peer may never get the tensors that were handed off to it.
+  withdrawHandedOffTensorsOf(this);
+
+  // The tensors that wait for the contents of others that will now never be
+  // received must still be done with. They're collected first as waking them
+  // up may finish (and remove) some operations.
+  std::vector<std::shared_ptr<TensorDedupCache::Entry>> dedupEntries;
+  for (const ReadOperation& op : readOperations_) {
+    for (const ReadOperation::Tensor& tensor : op.tensors) {
+      if (tensor.dedup == TensorDedup::kStore && tensor.dedupEntry != nullptr) {
+        dedupEntries.push_back(tensor.dedupEntry);
+      }
+    }
+  }
+  for (const auto& entry : dedupEntries) {
+    wakeUpWaitersOfDedupEntry(*entry);
+  }
 
   if (!readOperations_.empty()) {
     advanceReadOperation(readOperations_.front());
@@ -1011,15 +4018,29 @@ void Pipe::Impl::handleError() {
   if (!writeOperations_.empty()) {
     advanceWriteOperation(writeOperations_.front());
   }
+  callWritableCallbacks();
 }
 
 //
 // Everything else
 //
 
+void Pipe::Impl::onPipeEstablished() {
+  TP_DCHECK(loop_.inLoop());
+  state_ = ESTABLISHED;
+  forEachDeviceType(
+      [&](auto buffer) { this->buildChannelTable<decltype(buffer)>(); });
+  TP_TRACE_INSTANT("tp::Pipe::established");
+  if (collectStats_) {
+    recordStatsOfEstablishment(std::chrono::steady_clock::now());
+  }
+  startReadingUponEstablishingPipe();
+  startWritingUponEstablishingPipe();
+}
+
 void Pipe::Impl::startReadingUponEstablishingPipe() {
   TP_DCHECK(loop_.inLoop());
-  TP_DCHECK_EQ(state_, ESTABLISHED);
+  TP_DCHECK(connectionIsReady());
 
   if (!readOperations_.empty()) {
     advanceReadOperation(readOperations_.front());
@@ -1028,13 +4049,54 @@ void Pipe::Impl::startReadingUponEstablishingPipe() {
 
 void Pipe::Impl::startWritingUponEstablishingPipe() {
   TP_DCHECK(loop_.inLoop());
-  TP_DCHECK_EQ(state_, ESTABLISHED);
+  TP_DCHECK(connectionIsReady());
 
   if (!writeOperations_.empty()) {
     advanceWriteOperation(writeOperations_.front());
   }
 }
 
+ReadOperation& Pipe::Impl::startReadOperation() {
+  TP_DCHECK(loop_.inLoop());
+
+  if (carriedOverReadOperation_ != nullptr) {
+    ReadOperation& op = *carriedOverReadOperation_;
+    carriedOverReadOperation_ = nullptr;
+    TP_DCHECK(op.descriptorBatch == nullptr);
+    return op;
+  }
+  // The operation that a batch started in order to grow is taken over, as its
+  // message comes next, and the batch is then done growing.
+  if (!readOperations_.empty()) {
+    ReadOperation& op = readOperations_.back();
+    if (op.descriptorBatch != nullptr &&
+        !op.descriptorBatch->messages.empty()) {
+      TP_DCHECK_LT(op.state, ReadOperation::ASKING_FOR_ALLOCATION);
+      op.descriptorBatch = nullptr;
+      return op;
+    }
+  }
+
+  readOperations_.emplace_back();
+  ReadOperation& op = readOperations_.back();
+  op.sequenceNumber = nextMessageBeingRead_++;
+  takeTimestamp(op.readDescriptorCallTime);
+  op.traceFlowId = TP_TRACE_NEW_FLOW_ID();
+  TP_TRACE_FLOW_START("tp::Pipe::read", op.traceFlowId);
+  TP_USDT(pipe__read__descriptor__start, id_.c_str(), op.sequenceNumber);
+  return op;
+}
+
+void Pipe::Impl::resumeReadOperation(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+
+  if (op.descriptorIsHeld) {
+    op.descriptorIsHeld = false;
+    handOutDescriptorOfMessage(op);
+  }
+  advanceReadOperation(op);
+}
+
 void Pipe::Impl::advanceReadOperation(ReadOperation& initialOp) {
   // Advancing one operation may unblock later ones that could have progressed
   // but were prevented from overtaking. Thus each time an operation manages to
@@ -1061,12 +4123,17 @@ bool Pipe::Impl::advanceOneReadOperation(ReadOperation& op) {
   // Use this helper to force a very specific structure on our checks, as
   // otherwise we'll be tempted to start merging `if`s, using `else`s, etc.
   // which seem good ideas but hide nasty pitfalls.
+  // With unordered completions, an operation that's done may finish ahead of
+  // the earlier ones, which have all started reading their payloads already.
   auto attemptTransition = [this, &op, prevOpState](
                                ReadOperation::State from,
                                ReadOperation::State to,
                                bool cond,
                                void (Impl::*action)(ReadOperation&)) {
-    if (op.state == from && cond && to <= prevOpState) {
+    const bool mayOvertake = unorderedCompletions_ &&
+        from == ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS &&
+        to == ReadOperation::FINISHED;
+    if (op.state == from && cond && (to <= prevOpState || mayOvertake)) {
       (this->*action)(op);
       TP_DCHECK_EQ(op.state, to);
     }
@@ -1094,8 +4161,11 @@ bool Pipe::Impl::advanceOneReadOperation(ReadOperation& op) {
   attemptTransition(
       /*from=*/ReadOperation::UNINITIALIZED,
       /*to=*/ReadOperation::READING_DESCRIPTOR,
-      /*cond=*/!error_ && state_ == ESTABLISHED &&
-          prevOpState >= ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS,
+      /*cond=*/!error_ && connectionIsReady() &&
+          (prevOpState >=
+               ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS ||
+           (prevOpState == ReadOperation::ASKING_FOR_ALLOCATION &&
+            canReadAheadOf(*prevOpPtr))),
       /*action=*/&Impl::readDescriptorOfMessage);
 
   attemptTransition(
@@ -1107,13 +4177,16 @@ bool Pipe::Impl::advanceOneReadOperation(ReadOperation& op) {
   attemptTransition(
       /*from=*/ReadOperation::ASKING_FOR_ALLOCATION,
       /*to=*/ReadOperation::FINISHED,
-      /*cond=*/error_ && op.doneGettingAllocation,
+      /*cond=*/error_ && op.doneGettingAllocation &&
+          op.numStagedBuffersBeingRead == 0,
       /*action=*/&Impl::callReadCallback);
 
   attemptTransition(
       /*from=*/ReadOperation::ASKING_FOR_ALLOCATION,
       /*to=*/ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS,
-      /*cond=*/!error_ && op.doneGettingAllocation,
+      /*cond=*/!error_ && op.doneGettingAllocation &&
+          op.numStagedBuffersBeingRead == 0 &&
+          (state_ == ESTABLISHED || !needsChannels(op)),
       /*action=*/&Impl::readPayloadsAndReceiveTensorsOfMessage);
 
   attemptTransition(
@@ -1125,9 +4198,14 @@ bool Pipe::Impl::advanceOneReadOperation(ReadOperation& op) {
   // Compute return value now in case we next delete the operation.
   bool hasAdvanced = op.state != initialState;
 
+  // The operations that finished ahead of earlier ones stay in the queue, so
+  // that the others can still be found by their sequence numbers, until those
+  // finish too.
   if (op.state == ReadOperation::FINISHED) {
-    TP_DCHECK_EQ(readOperations_.front().sequenceNumber, op.sequenceNumber);
-    readOperations_.pop_front();
+    while (!readOperations_.empty() &&
+           readOperations_.front().state == ReadOperation::FINISHED) {
+      readOperations_.pop_front();
+    }
   }
 
   return hasAdvanced;
@@ -1137,12 +4215,26 @@ void Pipe::Impl::advanceWriteOperation(WriteOperation& initialOp) {
   // Advancing one operation may unblock later ones that could have progressed
   // but were prevented from overtaking. Thus each time an operation manages to
   // advance we'll try to also advance the one after.
-  for (int64_t sequenceNumber = initialOp.sequenceNumber;; ++sequenceNumber) {
+  int64_t sequenceNumber = initialOp.sequenceNumber;
+  for (;; ++sequenceNumber) {
     WriteOperation* opPtr = findWriteOperation(sequenceNumber);
     if (opPtr == nullptr || !advanceOneWriteOperation(*opPtr)) {
       break;
     }
   }
+
+  // The operations that finished may have made room for the first one that was
+  // held back by the limits on the writes in flight, which may come later.
+  if (sequenceNumber < nextWriteOperationToStart_) {
+    for (sequenceNumber = nextWriteOperationToStart_;; ++sequenceNumber) {
+      WriteOperation* opPtr = findWriteOperation(sequenceNumber);
+      if (opPtr == nullptr || !advanceOneWriteOperation(*opPtr)) {
+        break;
+      }
+    }
+  }
+
+  callWritableCallbacks();
 }
 
 bool Pipe::Impl::advanceOneWriteOperation(WriteOperation& op) {
@@ -1159,12 +4251,17 @@ bool Pipe::Impl::advanceOneWriteOperation(WriteOperation& op) {
   // Use this helper to force a very specific structure on our checks, as
   // otherwise we'll be tempted to start merging `if`s, using `else`s, etc.
   // which seem good ideas but hide nasty pitfalls.
+  // With unordered completions, an operation that's done may finish ahead of
+  // the earlier ones, which have all started writing their payloads already.
   auto attemptTransition = [this, &op, prevOpState](
                                WriteOperation::State from,
                                WriteOperation::State to,
                                bool cond,
                                void (Impl::*action)(WriteOperation&)) {
-    if (op.state == from && cond && to <= prevOpState) {
+    const bool mayOvertake = unorderedCompletions_ &&
+        from == WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS &&
+        to == WriteOperation::FINISHED;
+    if (op.state == from && cond && (to <= prevOpState || mayOvertake)) {
       (this->*action)(op);
       TP_DCHECK_EQ(op.state, to);
     }
@@ -1186,28 +4283,38 @@ bool Pipe::Impl::advanceOneWriteOperation(WriteOperation& op) {
   attemptTransition(
       /*from=*/WriteOperation::UNINITIALIZED,
       /*to=*/WriteOperation::FINISHED,
-      /*cond=*/error_,
+      /*cond=*/error_ || op.error,
       /*action=*/&Impl::callWriteCallback);
 
   attemptTransition(
       /*from=*/WriteOperation::UNINITIALIZED,
       /*to=*/WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS,
-      /*cond=*/!error_ && state_ == ESTABLISHED,
+      /*cond=*/!error_ && !op.error && connectionIsReady() &&
+          (state_ == ESTABLISHED || !needsChannels(op)) && hasRoomToStart(op),
       /*action=*/&Impl::sendTensorsOfMessage);
 
   attemptTransition(
       /*from=*/WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS,
       /*to=*/WriteOperation::FINISHED,
       /*cond=*/error_ && op.numTensorDescriptorsBeingCollected == 0 &&
-          op.numTensorsBeingSent == 0,
+          op.numTensorsBeingSent == 0 && op.numChunksBeingCompressed == 0,
       /*action=*/&Impl::callWriteCallback);
 
   attemptTransition(
       /*from=*/WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS,
       /*to=*/WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS,
-      /*cond=*/!error_ && op.numTensorDescriptorsBeingCollected == 0,
+      /*cond=*/!error_ && op.numTensorDescriptorsBeingCollected == 0 &&
+          op.numChunksBeingCompressed == 0,
       /*action=*/&Impl::writeDescriptorAndPayloadsOfMessage);
 
+  // This isn't a transition, as it doesn't depend on the other operations.
+  if (op.buffersReleasedCallback &&
+      op.state == WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS &&
+      !op.handsOffTensors && op.numPayloadsBeingWritten == 0 &&
+      op.numTensorsBeingSentFromMessage == 0) {
+    callBuffersReleasedCallback(op);
+  }
+
   attemptTransition(
       /*from=*/WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS,
       /*to=*/WriteOperation::FINISHED,
@@ -1217,9 +4324,12 @@ bool Pipe::Impl::advanceOneWriteOperation(WriteOperation& op) {
   // Compute return value now in case we next delete the operation.
   bool hasAdvanced = op.state != initialState;
 
+  // See advanceOneReadOperation.
   if (op.state == WriteOperation::FINISHED) {
-    TP_DCHECK_EQ(writeOperations_.front().sequenceNumber, op.sequenceNumber);
-    writeOperations_.pop_front();
+    while (!writeOperations_.empty() &&
+           writeOperations_.front().state == WriteOperation::FINISHED) {
+      writeOperations_.pop_front();
+    }
   }
 
   return hasAdvanced;
@@ -1227,7 +4337,7 @@ bool Pipe::Impl::advanceOneWriteOperation(WriteOperation& op) {
 
 void Pipe::Impl::readDescriptorOfMessage(ReadOperation& op) {
   TP_DCHECK(loop_.inLoop());
-  TP_DCHECK_EQ(state_, ESTABLISHED);
+  TP_DCHECK(connectionIsReady());
 
   TP_DCHECK_EQ(op.state, ReadOperation::UNINITIALIZED);
   op.state = ReadOperation::READING_DESCRIPTOR;
@@ -1235,9 +4345,17 @@ void Pipe::Impl::readDescriptorOfMessage(ReadOperation& op) {
   TP_VLOG(2) << "Pipe " << id_ << " is reading descriptor of message #"
              << op.sequenceNumber;
 
+  // If the user hasn't provided the memory for the previous message yet, its
+  // payloads are still in the way and need to be staged first.
+  if (connectionState_ == AWAITING_PAYLOADS) {
+    ReadOperation* prevOpPtr = findReadOperation(op.sequenceNumber - 1);
+    TP_DCHECK(prevOpPtr != nullptr);
+    stagePayloadsOfMessage(*prevOpPtr);
+  }
+
   TP_DCHECK_EQ(connectionState_, AWAITING_DESCRIPTOR);
   TP_DCHECK_EQ(messageBeingReadFromConnection_, op.sequenceNumber);
-  auto nopHolderIn = std::make_shared<NopHolder<Packet>>();
+  std::shared_ptr<NopHolder<Packet>> nopHolderIn = acquireDescriptorHolder();
   TP_VLOG(3) << "Pipe " << id_ << " is reading nop object (message descriptor #"
              << op.sequenceNumber << ")";
   connection_->read(
@@ -1246,104 +4364,848 @@ void Pipe::Impl::readDescriptorOfMessage(ReadOperation& op) {
                    << " done reading nop object (message descriptor #"
                    << op.sequenceNumber << ")";
         impl.onReadOfMessageDescriptor(op, nopHolderIn->getObject());
+        impl.releaseDescriptorHolder(nopHolderIn);
       }));
   connectionState_ = AWAITING_PAYLOADS;
 }
 
+bool Pipe::Impl::connectionIsReady() {
+  // The server may be done with the connection while it's still waiting for
+  // those of the channels, if the transport wasn't switched or if the
+  // replacement connection already came in.
+  return state_ == ESTABLISHED ||
+      (state_ == SERVER_WAITING_FOR_CONNECTIONS &&
+       !registrationId_.has_value());
+}
+
+bool Pipe::Impl::canInlineTensor(const Message::Tensor& tensor) {
+  return tensor.buffer.type == DeviceType::kCpu &&
+      tensor.buffer.cpu.length < inlineTensorThreshold_ &&
+      isContiguous(tensor.buffer.cpu);
+}
+
+bool Pipe::Impl::canInlinePayloads(const WriteOperation& op) {
+  // The descriptor isn't checksummed, hence the payloads would lose theirs.
+  if (messageDescriptorVersion_ <
+          kCompactMessageDescriptorWithInlinePayloadsVersion ||
+      inlinePayloadThreshold_ == 0 || checksumPayloads_ ||
+      !op.message.tensors.empty()) {
+    return false;
+  }
+  size_t length = 0;
+  for (size_t payloadIdx = 0; payloadIdx < op.message.payloads.size();
+       payloadIdx++) {
+    if (!op.payloads.empty() &&
+        (op.payloads[payloadIdx].compression != PayloadCompression::kNone ||
+         !op.payloads[payloadIdx].compressedChunkLengths.empty())) {
+      return false;
+    }
+    length += op.message.payloads[payloadIdx].length;
+  }
+  return length < inlinePayloadThreshold_;
+}
+
+bool Pipe::Impl::canHandOffTensors(const Message& message) {
+  if (!message.handOffTensors || !peerIsInSameProcess_) {
+    return false;
+  }
+  // The receiver gets the very same memory, as a contiguous buffer.
+  for (const Message::Tensor& tensor : message.tensors) {
+    if (tensor.buffer.type != DeviceType::kCpu ||
+        !isContiguous(tensor.buffer.cpu)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Pipe::Impl::needsChannels(const WriteOperation& op) {
+  if (canHandOffTensors(op.message)) {
+    return false;
+  }
+  for (const Message::Tensor& tensor : op.message.tensors) {
+    if (!canInlineTensor(tensor)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Pipe::Impl::needsChannels(const ReadOperation& op) {
+  if (op.coalescesCudaTensors) {
+    return true;
+  }
+  for (const ReadOperation::Tensor& tensor : op.tensors) {
+    if (!tensor.channelName.empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Pipe::Impl::hasRoomToStart(const WriteOperation& op) {
+  // An operation that's larger than the limit on the bytes on its own must
+  // still be able to go through.
+  return (maxWritesInFlight_ == 0 || numWritesInFlight_ < maxWritesInFlight_) &&
+      (maxWriteBytesInFlight_ == 0 || numWritesInFlight_ == 0 ||
+       numWriteBytesInFlight_ + op.numBytes <= maxWriteBytesInFlight_);
+}
+
+bool Pipe::Impl::isWritable() {
+  if (maxWritesInFlight_ == 0 && maxWriteBytesInFlight_ == 0) {
+    return true;
+  }
+  // The operations that are held back, or that wait for the pipe to be
+  // established, come before any new one.
+  return nextWriteOperationToStart_ ==
+      static_cast<int64_t>(nextMessageBeingWritten_) &&
+      (maxWritesInFlight_ == 0 || numWritesInFlight_ < maxWritesInFlight_) &&
+      (maxWriteBytesInFlight_ == 0 ||
+       numWriteBytesInFlight_ < maxWriteBytesInFlight_);
+}
+
+void Pipe::Impl::scheduleDeadline(
+    optional<TimerWheel::TTimerId>& timer,
+    TTimePoint& deadline,
+    std::chrono::milliseconds timeout) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK(!timer.has_value());
+  deadline = std::chrono::steady_clock::now() + timeout;
+  // The timer doesn't keep the pipe alive, and it doesn't say which operation
+  // it's for, as the writes that haven't started may still be renumbered, hence
+  // once it expires the pipe looks for the operations whose deadline passed.
+  std::weak_ptr<Impl> weakImpl = shared_from_this();
+  timer = context_->getTimerWheel().schedule(timeout, [weakImpl]() {
+    std::shared_ptr<Impl> impl = weakImpl.lock();
+    if (impl != nullptr) {
+      impl->loop_.deferToLoop(
+          [impl]() { impl->expireOperationsPastDeadline(); });
+    }
+  });
+}
+
+void Pipe::Impl::cancelDeadline(optional<TimerWheel::TTimerId>& timer) {
+  TP_DCHECK(loop_.inLoop());
+  if (timer.has_value()) {
+    context_->getTimerWheel().cancel(*timer);
+    timer.reset();
+  }
+}
+
+void Pipe::Impl::expireOperationsPastDeadline() {
+  TP_DCHECK(loop_.inLoop());
+  if (error_) {
+    return;
+  }
+  const TTimePoint now = std::chrono::steady_clock::now();
+
+  // The message a read waits for may be on its way already, and couldn't be
+  // told apart from the next ones, hence there's no failing the read alone.
+  // Those that finished ahead of earlier ones (see unorderedCompletions_) are
+  // done with their deadlines.
+  for (ReadOperation& op : readOperations_) {
+    if (op.state != ReadOperation::FINISHED && op.deadlineTimer.has_value() &&
+        op.deadline <= now) {
+      op.deadlineTimer.reset();
+      TP_VLOG(1) << "Pipe " << id_ << " is past the deadline of read #"
+                 << op.sequenceNumber;
+      setError(TP_CREATE_ERROR(
+          DeadlineExceededError, "read #" + std::to_string(op.sequenceNumber)));
+      return;
+    }
+  }
+
+  // A write that hasn't started can be dropped without the other side ever
+  // knowing about it, but one that has may have sent part of its message.
+  std::vector<int64_t> expiredWrites;
+  for (WriteOperation& op : writeOperations_) {
+    if (op.state == WriteOperation::FINISHED ||
+        !op.deadlineTimer.has_value() || op.deadline > now) {
+      continue;
+    }
+    op.deadlineTimer.reset();
+    TP_VLOG(1) << "Pipe " << id_ << " is past the deadline of write #"
+               << op.sequenceNumber;
+    Error error = TP_CREATE_ERROR(
+        DeadlineExceededError, "write #" + std::to_string(op.sequenceNumber));
+    if (op.state != WriteOperation::UNINITIALIZED) {
+      setError(std::move(error));
+      return;
+    }
+    op.error = std::move(error);
+    expiredWrites.push_back(op.sequenceNumber);
+  }
+  // Those whose turn it is fail right away, which may let the ones behind them
+  // start. The others do once the earlier writes are done, in order to keep
+  // the callbacks in order.
+  for (int64_t sequenceNumber : expiredWrites) {
+    WriteOperation* opPtr = findWriteOperation(sequenceNumber);
+    if (opPtr != nullptr) {
+      advanceWriteOperation(*opPtr);
+    }
+  }
+}
+
 void Pipe::Impl::sendTensorsOfMessage(WriteOperation& op) {
   TP_DCHECK(loop_.inLoop());
-  TP_DCHECK_EQ(state_, ESTABLISHED);
+  TP_DCHECK(connectionIsReady());
 
   TP_DCHECK_EQ(op.state, WriteOperation::UNINITIALIZED);
   op.state = WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS;
 
+  TP_DCHECK_EQ(nextWriteOperationToStart_, op.sequenceNumber);
+  nextWriteOperationToStart_++;
+  numWritesInFlight_++;
+  numWriteBytesInFlight_ += op.numBytes;
+
   TP_VLOG(2) << "Pipe " << id_ << " is sending tensors of message #"
              << op.sequenceNumber;
 
+  if (canHandOffTensors(op.message)) {
+    op.handsOffTensors = true;
+    for (int tensorIdx = 0; tensorIdx < op.message.tensors.size();
+         ++tensorIdx) {
+      Message::Tensor& tensor = op.message.tensors[tensorIdx];
+      uint64_t handoffId = depositHandedOffTensor(
+          this,
+          HandedOffTensor(
+              tensor.buffer.cpu.ptr,
+              tensor.buffer.cpu.length,
+              std::move(tensor.release)));
+      tensor.release = nullptr;
+      TP_VLOG(3) << "Pipe " << id_ << " is handing off tensor #"
+                 << op.sequenceNumber << "." << tensorIdx << " (as #"
+                 << handoffId << ")";
+      op.tensors.push_back(WriteOperation::Tensor{
+          DeviceType::kCpu, /*channelName=*/"", /*descriptor=*/"", handoffId});
+    }
+    compressPayloadsOfMessage(op);
+    return;
+  }
+  // The user can tell from the message given back that they weren't.
+  op.message.handOffTensors = false;
+
+#if TENSORPIPE_SUPPORTS_CUDA
+  selectCudaTensorsToCoalesce(op);
+  size_t nextCoalescedTensor = 0;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
   for (int tensorIdx = 0; tensorIdx < op.message.tensors.size(); ++tensorIdx) {
     const auto& tensor = op.message.tensors[tensorIdx];
 
-    auto t = switchOnDeviceType(tensor.buffer.type, [&](auto buffer) {
-      auto& orderedChannels = this->getOrderedChannels<decltype(buffer)>();
-      auto& availableChannels = channels_.get<decltype(buffer)>();
-      for (const auto& channelContextIter : orderedChannels) {
-        const std::string& channelName = std::get<0>(channelContextIter.second);
-        auto channelIter = availableChannels.find(channelName);
-        if (channelIter == availableChannels.cend()) {
-          continue;
-        }
-        auto& channel = *(channelIter->second);
+    if (canInlineTensor(tensor)) {
+      TP_VLOG(3) << "Pipe " << id_ << " is inlining tensor #"
+                 << op.sequenceNumber << "." << tensorIdx;
+      op.tensors.push_back(
+          WriteOperation::Tensor{tensor.buffer.type, /*channelName=*/""});
+      continue;
+    }
 
-        TP_VLOG(3) << "Pipe " << id_ << " is sending tensor #"
-                   << op.sequenceNumber << "." << tensorIdx;
+#if TENSORPIPE_SUPPORTS_CUDA
+    if (nextCoalescedTensor < op.coalescedCudaTensors.size() &&
+        op.coalescedCudaTensors[nextCoalescedTensor].tensorIdx == tensorIdx) {
+      TP_VLOG(3) << "Pipe " << id_ << " is coalescing tensor #"
+                 << op.sequenceNumber << "." << tensorIdx;
+      op.tensors.push_back(
+          WriteOperation::Tensor{DeviceType::kCuda, /*channelName=*/""});
+      nextCoalescedTensor++;
+      continue;
+    }
+#endif // TENSORPIPE_SUPPORTS_CUDA
 
-        channel.send(
-            unwrap<decltype(buffer)>(tensor.buffer),
-            eagerCallbackWrapper_(
-                [&op, tensorIdx](Impl& impl, channel::TDescriptor descriptor) {
-                  TP_VLOG(3)
-                      << "Pipe " << impl.id_ << " got tensor descriptor #"
-                      << op.sequenceNumber << "." << tensorIdx;
-                  impl.onDescriptorOfTensor(
-                      op, tensorIdx, std::move(descriptor));
-                }),
-            eagerCallbackWrapper_([&op, tensorIdx](Impl& impl) {
-              TP_VLOG(3) << "Pipe " << impl.id_ << " done sending tensor #"
-                         << op.sequenceNumber << "." << tensorIdx;
-              impl.onSendOfTensor(op);
-            }));
-        return WriteOperation::Tensor{tensor.buffer.type, channelName};
+    // The receiver's cache is mirrored by ours, hence we know whether it has
+    // the contents already, in which case only their hash is sent.
+    TensorDedup dedup = TensorDedup::kNone;
+    uint64_t dedupHash = 0;
+    if (writtenTensorDedupCache_ != nullptr &&
+        tensor.buffer.type == DeviceType::kCpu &&
+        tensor.buffer.cpu.length >= tensorDedupThreshold_) {
+      const size_t length = tensor.buffer.cpu.length;
+      dedupHash = xxhash64OfBuffer(tensor.buffer.cpu);
+      if (writtenTensorDedupCache_->find(length, dedupHash) != nullptr) {
+        TP_VLOG(3) << "Pipe " << id_ << " is deduplicating tensor #"
+                   << op.sequenceNumber << "." << tensorIdx;
+        WriteOperation::Tensor hitTensor{DeviceType::kCpu, /*channelName=*/""};
+        hitTensor.dedup = TensorDedup::kHit;
+        hitTensor.dedupHash = dedupHash;
+        op.tensors.push_back(std::move(hitTensor));
+        continue;
+      }
+      if (writtenTensorDedupCache_->insert(length, dedupHash) != nullptr) {
+        dedup = TensorDedup::kStore;
       }
+    }
 
-      TP_THROW_ASSERT() << "Could not find channel.";
-      return WriteOperation::Tensor{};
+    auto t = switchOnDeviceType(tensor.buffer.type, [&](auto buffer) {
+      const size_t length = unwrap<decltype(buffer)>(tensor.buffer).length;
+      const std::string* selectedChannelName;
+      channel::Channel<decltype(buffer)>* selectedChannel;
+      bool isProbe;
+      std::tie(selectedChannelName, selectedChannel, isProbe) =
+          this->selectChannel<decltype(buffer)>(length);
+      const TTimePoint sendStartTime =
+          isProbe ? std::chrono::steady_clock::now() : TTimePoint();
+
+      TP_VLOG(3) << "Pipe " << id_ << " is sending tensor #"
+                 << op.sequenceNumber << "." << tensorIdx << " over channel "
+                 << *selectedChannelName;
+
+      const auto packedBuffer = packTensorForChannel(
+          op,
+          tensorIdx,
+          unwrap<decltype(buffer)>(tensor.buffer),
+          *selectedChannelName);
+      const bool isFromMessage =
+          packedBuffer.ptr == unwrap<decltype(buffer)>(tensor.buffer).ptr;
+      if (isFromMessage) {
+        ++op.numTensorsBeingSentFromMessage;
+      }
+      selectedChannel->send(
+          packedBuffer,
+          eagerCallbackWrapper_(
+              [&op, tensorIdx](Impl& impl, channel::TDescriptor descriptor) {
+                TP_VLOG(3) << "Pipe " << impl.id_ << " got tensor descriptor #"
+                           << op.sequenceNumber << "." << tensorIdx;
+                impl.onDescriptorOfTensor(op, tensorIdx, std::move(descriptor));
+              }),
+          eagerCallbackWrapper_([&op,
+                                 tensorIdx,
+                                 channelName{selectedChannelName},
+                                 length,
+                                 isProbe,
+                                 sendStartTime,
+                                 isFromMessage](Impl& impl) {
+            TP_VLOG(3) << "Pipe " << impl.id_ << " done sending tensor #"
+                       << op.sequenceNumber << "." << tensorIdx;
+            if (isFromMessage) {
+              --op.numTensorsBeingSentFromMessage;
+            }
+            if (isProbe) {
+              impl.channelProbes_.completeProbe(
+                  getChannelRankingLengthClass(length),
+                  *channelName,
+                  std::chrono::steady_clock::now() - sendStartTime);
+            }
+            impl.releasePackedTensor(op, tensorIdx);
+            impl.onSendOfTensor(op);
+          }));
+      return WriteOperation::Tensor{tensor.buffer.type, *selectedChannelName};
     });
+    t.dedup = dedup;
+    t.dedupHash = dedupHash;
     op.tensors.push_back(t);
 
     ++op.numTensorDescriptorsBeingCollected;
     ++op.numTensorsBeingSent;
   }
+
+#if TENSORPIPE_SUPPORTS_CUDA
+  if (op.coalescesCudaTensors) {
+    sendCoalescedCudaTensorsOfMessage(op);
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+  // The payloads are compressed while the tensors are being sent.
+  compressPayloadsOfMessage(op);
+}
+
+template <typename TBuffer>
+std::tuple<const std::string*, channel::Channel<TBuffer>*, bool> Pipe::Impl::
+    selectChannel(size_t length) {
+  // The CUDA channels are done with a send as soon as it's enqueued on the
+  // stream, hence timing them would tell nothing about their speed.
+  if (std::is_same<TBuffer, CpuBuffer>::value &&
+      context_->getChannelRankingCache() != nullptr) {
+    return selectRankedChannel<TBuffer>(length);
+  }
+
+  // Pick the highest-priority channel whose range of lengths (see the
+  // ContextOptions) includes this tensor's, falling back to the highest-
+  // priority channel if none does.
+  const auto& channelTable = channelTable_.get<TBuffer>();
+  TP_THROW_ASSERT_IF(channelTable.empty()) << "Could not find channel.";
+  const ChannelEntry<TBuffer>* selectedEntry = &channelTable.front();
+  for (const ChannelEntry<TBuffer>& entry : channelTable) {
+    if (entry.acceptsTensorLength(length)) {
+      selectedEntry = &entry;
+      break;
+    }
+  }
+  return std::make_tuple(selectedEntry->name, selectedEntry->channel, false);
+}
+
+template <typename TBuffer>
+std::tuple<const std::string*, channel::Channel<TBuffer>*, bool> Pipe::Impl::
+    selectRankedChannel(size_t length) {
+  const auto& channelTable = channelTable_.get<TBuffer>();
+
+  // The candidates are the channels that accept this tensor's length, in order
+  // of priority, and if none does the highest-priority channel is used.
+  ChannelRankingCache& rankingCache = *context_->getChannelRankingCache();
+  std::vector<const std::string*> candidates;
+  for (const ChannelEntry<TBuffer>& entry : channelTable) {
+    if (entry.acceptsTensorLength(length)) {
+      candidates.push_back(entry.name);
+    }
+  }
+  TP_THROW_ASSERT_IF(channelTable.empty()) << "Could not find channel.";
+  if (candidates.empty()) {
+    return std::make_tuple(
+        channelTable.front().name, channelTable.front().channel, false);
+  }
+  auto selected = [&](const std::string* channelName, bool isProbe) {
+    return std::make_tuple(
+        channelName,
+        findChannelEntry<TBuffer>(*channelName).channel,
+        isProbe);
+  };
+  if (candidates.size() == 1) {
+    return selected(candidates.front(), false);
+  }
+
+  // Go by the ranking of this pipe or, failing that, by the one of another
+  // pipe to the same host, and otherwise probe the candidates until they can
+  // be ranked, sending the tensors over the first one in the meantime.
+  const size_t lengthClass = getChannelRankingLengthClass(length);
+  optional<std::vector<std::string>>& ranking = channelRankings_[lengthClass];
+  if (!ranking.has_value() && !peerHostIdentifier_.empty()) {
+    ranking = rankingCache.get(peerHostIdentifier_, lengthClass);
+  }
+  if (!ranking.has_value()) {
+    const std::string* channelToProbe =
+        channelProbes_.nextChannelToProbe(lengthClass, candidates);
+    if (channelToProbe != nullptr) {
+      channelProbes_.startProbe(lengthClass, *channelToProbe);
+      return selected(channelToProbe, true);
+    }
+    ranking = channelProbes_.rank(lengthClass, candidates);
+    if (!ranking.has_value()) {
+      return selected(candidates.front(), false);
+    }
+    std::string rankingStr;
+    for (const std::string& channelName : ranking.value()) {
+      rankingStr += (rankingStr.empty() ? "" : ", ") + channelName;
+    }
+    TP_VLOG(1) << "Pipe " << id_ << " ranked its channels for tensors of "
+               << length << " bytes as " << rankingStr;
+    if (!peerHostIdentifier_.empty()) {
+      rankingCache.put(peerHostIdentifier_, lengthClass, ranking.value());
+    }
+  }
+
+  // A ranking from another pipe may not include all the candidates of this
+  // one, or vice versa.
+  for (const std::string& channelName : ranking.value()) {
+    for (const std::string* candidate : candidates) {
+      if (*candidate == channelName) {
+        return selected(candidate, false);
+      }
+    }
+  }
+  return selected(candidates.front(), false);
+}
+
+#if TENSORPIPE_SUPPORTS_CUDA
+void Pipe::Impl::selectCudaTensorsToCoalesce(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  if (cudaTensorCoalescingThreshold_ == 0) {
+    return;
+  }
+  const CudaLib* cudaLib = context_->getCudaLib();
+  if (cudaLib == nullptr) {
+    return;
+  }
+
+  // Only those on the device of the first of them are coalesced, as the copies
+  // across devices would cost more than the channels they save.
+  std::vector<CoalescedCudaTensor> coalescedCudaTensors;
+  size_t length = 0;
+  for (size_t tensorIdx = 0; tensorIdx < op.message.tensors.size();
+       ++tensorIdx) {
+    const Buffer& buffer = op.message.tensors[tensorIdx].buffer;
+    if (buffer.type != DeviceType::kCuda || buffer.cuda.length == 0 ||
+        buffer.cuda.length >= cudaTensorCoalescingThreshold_ ||
+        !isContiguous(buffer.cuda)) {
+      continue;
+    }
+    const int device = cudaDeviceForPointer(*cudaLib, buffer.cuda.ptr);
+    if (!coalescedCudaTensors.empty() &&
+        coalescedCudaTensors.front().device != device) {
+      continue;
+    }
+    const size_t offset = offsetOfNextCoalescedTensor(length);
+    coalescedCudaTensors.push_back(
+        CoalescedCudaTensor{tensorIdx, buffer.cuda, device, offset});
+    length = offset + buffer.cuda.length;
+  }
+  if (coalescedCudaTensors.size() < 2) {
+    return;
+  }
+
+  op.coalescesCudaTensors = true;
+  op.coalescedLength = length;
+  op.coalescedCudaTensors = std::move(coalescedCudaTensors);
+}
+
+void Pipe::Impl::sendCoalescedCudaTensorsOfMessage(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK(op.coalescesCudaTensors);
+
+  // The tensors are gathered on the stream of the first of them, once the work
+  // that the user enqueued on the streams of all of them is done, and the work
+  // that the user will enqueue on those streams from now on (which may
+  // overwrite the tensors) waits for them to have been gathered.
+  const int device = op.coalescedCudaTensors.front().device;
+  const cudaStream_t stream = op.coalescedCudaTensors.front().buffer.stream;
+  op.stagingBuffer =
+      cudaStagingBuffers_.acquire(device, op.coalescedLength, stream);
+  for (const CoalescedCudaTensor& tensor : op.coalescedCudaTensors) {
+    cudaStreamWaitForStream(
+        cudaEventPool_, stream, device, tensor.buffer.stream, tensor.device);
+  }
+  if (cudaGraphsForCoalescedTensors_) {
+    std::vector<CudaCopyGraphs::Copy> copies;
+    for (const CoalescedCudaTensor& tensor : op.coalescedCudaTensors) {
+      copies.push_back(CudaCopyGraphs::Copy{
+          reinterpret_cast<uint8_t*>(op.stagingBuffer.ptr) + tensor.offset,
+          tensor.buffer.ptr,
+          tensor.buffer.length});
+    }
+    cudaCopyGraphs_.enqueue(device, copies, stream);
+  } else {
+    CudaDeviceGuard guard(device);
+    for (const CoalescedCudaTensor& tensor : op.coalescedCudaTensors) {
+      TP_CUDA_CHECK(cudaMemcpyAsync(
+          reinterpret_cast<uint8_t*>(op.stagingBuffer.ptr) + tensor.offset,
+          tensor.buffer.ptr,
+          tensor.buffer.length,
+          cudaMemcpyDeviceToDevice,
+          stream));
+    }
+  }
+  for (const CoalescedCudaTensor& tensor : op.coalescedCudaTensors) {
+    cudaStreamWaitForStream(
+        cudaEventPool_, tensor.buffer.stream, tensor.device, stream, device);
+  }
+
+  const std::string* channelName;
+  channel::Channel<CudaBuffer>* channel;
+  std::tie(channelName, channel, std::ignore) =
+      selectChannel<CudaBuffer>(op.coalescedLength);
+  op.coalescedTensor = WriteOperation::Tensor{DeviceType::kCuda, *channelName};
+
+  TP_VLOG(3) << "Pipe " << id_ << " is sending "
+             << op.coalescedCudaTensors.size()
+             << " coalesced tensors of message #" << op.sequenceNumber
+             << " over channel " << *channelName;
+
+  CudaBuffer buffer;
+  buffer.ptr = op.stagingBuffer.ptr;
+  buffer.length = op.coalescedLength;
+  buffer.stream = stream;
+  channel->send(
+      buffer,
+      eagerCallbackWrapper_(
+          [&op](Impl& impl, channel::TDescriptor descriptor) {
+            TP_VLOG(3) << "Pipe " << impl.id_
+                       << " got descriptor of coalesced tensors #"
+                       << op.sequenceNumber;
+            impl.onDescriptorOfCoalescedTensors(op, std::move(descriptor));
+          }),
+      eagerCallbackWrapper_([&op, stream](Impl& impl) {
+        TP_VLOG(3) << "Pipe " << impl.id_
+                   << " done sending coalesced tensors #" << op.sequenceNumber;
+        impl.cudaStagingBuffers_.release(std::move(op.stagingBuffer), stream);
+        impl.onSendOfTensor(op);
+      }));
+
+  ++op.numTensorDescriptorsBeingCollected;
+  ++op.numTensorsBeingSent;
+}
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+void Pipe::Impl::compressPayloadsOfMessage(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+
+  // The payloads gathered from segments are sent in chunks regardless.
+  if (payloadCompression_ == PayloadCompression::kNone &&
+      payloadChunkingThreshold_ == 0 &&
+      std::none_of(
+          op.message.payloads.begin(),
+          op.message.payloads.end(),
+          isSegmented)) {
+    return;
+  }
+
+  op.payloads.resize(op.message.payloads.size());
+  for (size_t payloadIdx = 0; payloadIdx < op.message.payloads.size();
+       payloadIdx++) {
+    const Message::Payload& payload = op.message.payloads[payloadIdx];
+    if (isSegmented(payload)) {
+      WriteOperation::Payload& segmentedPayload = op.payloads[payloadIdx];
+      segmentedPayload.segmented = true;
+      segmentedPayload.compressedChunks.resize(payload.segments.size());
+      for (const Message::Payload::Segment& segment : payload.segments) {
+        segmentedPayload.compressedChunkLengths.push_back(segment.length);
+      }
+      continue;
+    }
+    if (payload.length == 0) {
+      continue;
+    }
+    if (payloadCompression_ == PayloadCompression::kNone ||
+        payload.length < payloadCompressionThreshold_) {
+      if (payloadChunkingThreshold_ > 0 &&
+          payload.length >= payloadChunkingThreshold_) {
+        WriteOperation::Payload& chunkedPayload = op.payloads[payloadIdx];
+        const size_t numChunks = numChunksOfLength(payload.length);
+        chunkedPayload.compressedChunks.resize(numChunks);
+        for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+          chunkedPayload.compressedChunkLengths.push_back(
+              lengthOfChunk(payload.length, chunkIdx));
+        }
+      }
+      continue;
+    }
+    WriteOperation::Payload& compressedPayload = op.payloads[payloadIdx];
+    compressedPayload.compression = payloadCompression_;
+    const size_t numChunks = numChunksOfLength(payload.length);
+    compressedPayload.compressedChunks.resize(numChunks);
+    compressedPayload.compressedChunkLengths.resize(numChunks);
+    TP_VLOG(3) << "Pipe " << id_ << " is compressing payload #"
+               << op.sequenceNumber << "." << payloadIdx << " in " << numChunks
+               << " chunks";
+    for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+      ++op.numChunksBeingCompressed;
+      // The callback keeps the pipe, and thus the operation, alive.
+      context_->getCompressionPool().submit(
+          [compressor{&context_->getPayloadCompressor()},
+           &payload,
+           &compressedPayload,
+           chunkIdx,
+           callback{eagerCallbackWrapper_([&op](Impl& impl) {
+             impl.onCompressionOfChunkOfPayload(op);
+           })}]() mutable {
+            compressChunkOfPayload(
+                *compressor, payload, compressedPayload, chunkIdx);
+            callback(Error::kSuccess);
+          });
+    }
+  }
 }
 
 void Pipe::Impl::writeDescriptorAndPayloadsOfMessage(WriteOperation& op) {
   TP_DCHECK(loop_.inLoop());
-  TP_DCHECK_EQ(state_, ESTABLISHED);
+  TP_DCHECK(connectionIsReady());
 
   TP_DCHECK_EQ(
       op.state, WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS);
   op.state = WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS;
 
-  TP_VLOG(2) << "Pipe " << id_
-             << " is writing descriptor and payloads of message #"
-             << op.sequenceNumber;
+  TP_VLOG(2) << "Pipe " << id_
+             << " is writing descriptor and payloads of message #"
+             << op.sequenceNumber;
+
+  std::shared_ptr<NopHolder<Packet>> holder = acquireDescriptorHolder();
+  const bool inlinesPayloads = canInlinePayloads(op);
+  if (messageDescriptorVersion_ >= kCompactMessageDescriptorVersion) {
+    fillDescriptorForMessage(compactMessageDescriptor_, op, checksumPayloads_);
+    encodeCompactMessageDescriptor(
+        compactMessageDescriptor_,
+        channelIndices_,
+        becomeAlternativeOfPacket<CompactMessageDescriptor>(
+            holder->getObject())
+            .data,
+        inlinesPayloads ? &op.message.payloads : nullptr);
+  } else {
+    fillDescriptorForMessage(
+        becomeAlternativeOfPacket<MessageDescriptor>(holder->getObject()),
+        op,
+        checksumPayloads_);
+  }
+
+  // Hand the descriptor, all the payloads and the inlined tensors to the
+  // connection at once, so that transports that support it can write them with
+  // a single syscall. The payloads that the descriptor carries are done with.
+  std::vector<transport::Connection::WriteBuffer> buffers;
+  const size_t numPayloadsToWrite =
+      inlinesPayloads ? 0 : op.message.payloads.size();
+  for (size_t payloadIdx = 0; payloadIdx < numPayloadsToWrite; payloadIdx++) {
+    const Message::Payload& payload = op.message.payloads[payloadIdx];
+    if (op.payloads.empty() ||
+        op.payloads[payloadIdx].compressedChunkLengths.empty()) {
+      buffers.push_back({payload.data, payload.length});
+      continue;
+    }
+    // Each chunk goes as a buffer of its own, which the peer reads on its own.
+    const WriteOperation::Payload& compressedPayload = op.payloads[payloadIdx];
+    for (size_t chunkIdx = 0;
+         chunkIdx < compressedPayload.compressedChunks.size();
+         chunkIdx++) {
+      const uint8_t* chunk = compressedPayload.compressedChunks[chunkIdx].get();
+      if (compressedPayload.segmented) {
+        chunk = reinterpret_cast<const uint8_t*>(
+            payload.segments[chunkIdx].data);
+      } else if (chunk == nullptr) {
+        chunk = reinterpret_cast<const uint8_t*>(payload.data) +
+            chunkIdx * kPayloadCompressionChunkSize;
+      }
+      buffers.push_back(
+          {chunk, compressedPayload.compressedChunkLengths[chunkIdx]});
+    }
+  }
+  for (int tensorIdx = 0; tensorIdx < op.tensors.size(); ++tensorIdx) {
+    if (isInlined(op, op.tensors[tensorIdx])) {
+      const CpuBuffer& buffer = op.message.tensors[tensorIdx].buffer.cpu;
+      buffers.push_back({buffer.ptr, buffer.length});
+    }
+  }
+  TP_USDT(
+      pipe__descriptor__sent, id_.c_str(), op.sequenceNumber, buffers.size());
+
+  if (batchingWrites_ || writeCoalescingThreshold_ > 0) {
+    TP_VLOG(3) << "Pipe " << id_
+               << " is setting aside nop object (message descriptor #"
+               << op.sequenceNumber << ") and " << buffers.size()
+               << " payloads and inlined tensors for a batched write";
+    const size_t numBuffers = buffers.size();
+    size_t numBytes = 0;
+    for (const transport::Connection::WriteBuffer& buffer : buffers) {
+      numBytes += buffer.length;
+    }
+    batchedWrites_.push_back(
+        {std::move(holder), std::move(buffers), numBuffers, op.sequenceNumber,
+         &op});
+    op.numPayloadsBeingWritten += numBuffers;
+    if (!batchingWrites_) {
+      holdCoalescedWrite(numBytes);
+    }
+    return;
+  }
+
+  if (buffers.empty()) {
+    TP_VLOG(3) << "Pipe " << id_
+               << " is writing nop object (message descriptor #"
+               << op.sequenceNumber << ")";
+    connection_->write(
+        *holder,
+        lazyCallbackWrapper_(
+            [sequenceNumber{op.sequenceNumber}, holder](Impl& impl) {
+              TP_VLOG(3) << "Pipe " << impl.id_
+                         << " done writing nop object (message descriptor #"
+                         << sequenceNumber << ")";
+              impl.releaseDescriptorHolder(holder);
+            }));
+    return;
+  }
+
+  const size_t numBuffers = buffers.size();
+  TP_VLOG(3) << "Pipe " << id_
+             << " is writing nop object (message descriptor #"
+             << op.sequenceNumber << ") and " << numBuffers
+             << " payloads and inlined tensors";
+  connection_->write(
+      *holder,
+      std::move(buffers),
+      eagerCallbackWrapper_([&op, holder, numBuffers](Impl& impl) {
+        TP_VLOG(3) << "Pipe " << impl.id_
+                   << " done writing nop object (message descriptor #"
+                   << op.sequenceNumber
+                   << ") and payloads and inlined tensors";
+        impl.releaseDescriptorHolder(holder);
+        impl.onWriteOfPayloads(op, numBuffers);
+      }));
+  op.numPayloadsBeingWritten += numBuffers;
+}
+
+void Pipe::Impl::writeBatchedDescriptorsAndPayloads() {
+  TP_DCHECK(loop_.inLoop());
+  if (batchedWrites_.empty()) {
+    return;
+  }
+
+  std::vector<BatchedWrite> batchedWrites = std::move(batchedWrites_);
+  batchedWrites_.clear();
+  const bool coalescing = writeCoalescingThreshold_ > 0;
+  if (coalescing) {
+    numHeldBytes_ = 0;
+    cancelDeadline(coalescingTimer_);
+    numCoalescedWritesInFlight_++;
+  }
 
-  std::shared_ptr<NopHolder<Packet>> holder = makeDescriptorForMessage(op);
+  std::vector<transport::Connection::WriteSegment> segments;
+  segments.reserve(batchedWrites.size());
+  for (BatchedWrite& batchedWrite : batchedWrites) {
+    segments.push_back(
+        {batchedWrite.holder.get(), std::move(batchedWrite.buffers)});
+  }
 
-  TP_VLOG(3) << "Pipe " << id_ << " is writing nop object (message descriptor #"
-             << op.sequenceNumber << ")";
+  const int64_t firstSequenceNumber = batchedWrites.front().sequenceNumber;
+  const int64_t lastSequenceNumber = batchedWrites.back().sequenceNumber;
+  TP_VLOG(3) << "Pipe " << id_ << " is writing " << segments.size()
+             << " nop objects (message descriptors #" << firstSequenceNumber
+             << " to #" << lastSequenceNumber
+             << ") and their payloads and inlined tensors";
   connection_->write(
-      *holder,
-      lazyCallbackWrapper_(
-          [sequenceNumber{op.sequenceNumber}, holder](Impl& impl) {
-            TP_VLOG(3) << "Pipe " << impl.id_
-                       << " done writing nop object (message descriptor #"
-                       << sequenceNumber << ")";
-          }));
+      std::move(segments),
+      eagerCallbackWrapper_([batchedWrites{std::move(batchedWrites)},
+                             firstSequenceNumber,
+                             lastSequenceNumber,
+                             coalescing](Impl& impl) mutable {
+        TP_VLOG(3) << "Pipe " << impl.id_
+                   << " done writing nop objects (message descriptors #"
+                   << firstSequenceNumber << " to #" << lastSequenceNumber
+                   << ") and their payloads and inlined tensors";
+        for (BatchedWrite& batchedWrite : batchedWrites) {
+          impl.releaseDescriptorHolder(std::move(batchedWrite.holder));
+          // The operations that had nothing but their descriptor to write
+          // didn't wait for it, and may be gone already.
+          if (batchedWrite.numBuffers > 0) {
+            impl.onWriteOfPayloads(*batchedWrite.op, batchedWrite.numBuffers);
+          }
+        }
+        if (coalescing) {
+          // The messages that were held behind this write go out now.
+          impl.numCoalescedWritesInFlight_--;
+          impl.writeBatchedDescriptorsAndPayloads();
+        }
+      }));
+}
 
-  for (size_t payloadIdx = 0; payloadIdx < op.message.payloads.size();
-       payloadIdx++) {
-    Message::Payload& payload = op.message.payloads[payloadIdx];
-    TP_VLOG(3) << "Pipe " << id_ << " is writing payload #" << op.sequenceNumber
-               << "." << payloadIdx;
-    connection_->write(
-        payload.data,
-        payload.length,
-        eagerCallbackWrapper_([&op, payloadIdx](Impl& impl) {
-          TP_VLOG(3) << "Pipe " << impl.id_ << " done writing payload #"
-                     << op.sequenceNumber << "." << payloadIdx;
-          impl.onWriteOfPayload(op);
-        }));
-    ++op.numPayloadsBeingWritten;
+void Pipe::Impl::holdCoalescedWrite(size_t numBytes) {
+  TP_DCHECK(loop_.inLoop());
+  const TTimePoint now = std::chrono::steady_clock::now();
+  if (batchedWrites_.size() == 1) {
+    firstHeldTime_ = now;
+  }
+  numHeldBytes_ += numBytes;
+  if (numCoalescedWritesInFlight_ == 0 ||
+      numHeldBytes_ >= writeCoalescingThreshold_ ||
+      now - firstHeldTime_ >= writeCoalescingBudget_) {
+    writeBatchedDescriptorsAndPayloads();
+    return;
+  }
+
+  TP_VLOG(3) << "Pipe " << id_ << " is holding " << batchedWrites_.size()
+             << " messages (" << numHeldBytes_
+             << " bytes) behind the writes in flight";
+  if (!coalescingTimer_.has_value()) {
+    // Like the deadlines, the timer doesn't keep the pipe alive.
+    std::weak_ptr<Impl> weakImpl = shared_from_this();
+    coalescingTimer_ = context_->getTimerWheel().schedule(
+        std::max(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                writeCoalescingBudget_ + std::chrono::microseconds(999)),
+            std::chrono::milliseconds(1)),
+        [weakImpl]() {
+          std::shared_ptr<Impl> impl = weakImpl.lock();
+          if (impl != nullptr) {
+            impl->loop_.deferToLoop([impl]() {
+              impl->coalescingTimer_.reset();
+              impl->writeBatchedDescriptorsAndPayloads();
+            });
+          }
+        });
   }
 }
 
@@ -1353,6 +5215,7 @@ void Pipe::Impl::onReadWhileServerWaitingForBrochure(
   TP_DCHECK_EQ(state_, SERVER_WAITING_FOR_BROCHURE);
   TP_DCHECK_EQ(nopPacketIn.index(), nopPacketIn.index_of<Brochure>());
   const Brochure& nopBrochure = *nopPacketIn.get<Brochure>();
+  takeTimestamp(brochureExchangedTime_);
 
   auto nopHolderOut = std::make_shared<NopHolder<Packet>>();
   Packet& nopPacketOut = nopHolderOut->getObject();
@@ -1360,6 +5223,13 @@ void Pipe::Impl::onReadWhileServerWaitingForBrochure(
   BrochureAnswer& nopBrochureAnswer = *nopPacketOut.get<BrochureAnswer>();
   bool needToWaitForConnections = false;
 
+  for (PayloadCompression compression :
+       {PayloadCompression::kLz4, PayloadCompression::kZstd}) {
+    if (context_->getPayloadCompressor().isAvailable(compression)) {
+      nopBrochureAnswer.payloadCompressions.push_back(compression);
+    }
+  }
+
   bool foundATransport = false;
   for (const auto& transportContextIter : context_->getOrderedTransports()) {
     const std::string& transportName = std::get<0>(transportContextIter.second);
@@ -1417,6 +5287,7 @@ void Pipe::Impl::onReadWhileServerWaitingForBrochure(
   }
   TP_THROW_ASSERT_IF(!foundATransport);
 
+  uint64_t nextChannelStreamId = 0;
   forEachDeviceType([&](auto buffer) {
     for (const auto& channelContextIter :
          this->getOrderedChannels<decltype(buffer)>()) {
@@ -1439,6 +5310,21 @@ void Pipe::Impl::onReadWhileServerWaitingForBrochure(
         continue;
       }
 
+      needToWaitForConnections = true;
+      auto& nopChannelSelectionMap =
+          getChannelSelection<decltype(buffer)>(nopBrochureAnswer);
+      ChannelSelection& nopChannelSelection =
+          nopChannelSelectionMap[channelName];
+      nopBrochureAnswer.channelNames.push_back(channelName);
+
+      if (nopBrochure.multiplexChannelConnections) {
+        // The connection shared by all channels is requested below.
+        uint64_t streamId = nextChannelStreamId++;
+        channelStreamIds_.get<decltype(buffer)>()[channelName] = streamId;
+        nopChannelSelection.streamId = streamId;
+        continue;
+      }
+
       TP_VLOG(3) << "Pipe " << id_ << " is requesting connection (for channel "
                  << channelName << ")";
       uint64_t token =
@@ -1454,15 +5340,41 @@ void Pipe::Impl::onReadWhileServerWaitingForBrochure(
                     channelName, std::move(transport), std::move(connection));
               }));
       channelRegistrationIds_.get<decltype(buffer)>()[channelName] = token;
-      needToWaitForConnections = true;
-      auto& nopChannelSelectionMap =
-          getChannelSelection<decltype(buffer)>(nopBrochureAnswer);
-      ChannelSelection& nopChannelSelection =
-          nopChannelSelectionMap[channelName];
       nopChannelSelection.registrationId = token;
     }
   });
 
+  if (nextChannelStreamId > 0) {
+    TP_VLOG(3) << "Pipe " << id_ << " is requesting connection (for channels)";
+    uint64_t token = listener_->registerConnectionRequest(lazyCallbackWrapper_(
+        [](Impl& impl,
+           std::string transport,
+           std::shared_ptr<transport::Connection> connection) {
+          TP_VLOG(3) << "Pipe " << impl.id_
+                     << " done requesting connection (for channels)";
+          impl.onAcceptWhileServerWaitingForChannels(
+              std::move(transport), std::move(connection));
+        }));
+    channelsRegistrationId_.emplace(token);
+    nopBrochureAnswer.channelsRegistrationId = token;
+  }
+
+  nopBrochureAnswer.processIdentifier = getProcessIdentifier();
+  peerIsInSameProcess_ =
+      nopBrochure.processIdentifier == nopBrochureAnswer.processIdentifier;
+  nopBrochureAnswer.hostIdentifier = getBootID().value_or("");
+  peerHostIdentifier_ = nopBrochure.hostIdentifier;
+
+  enableTensorDedup(
+      nopBrochure.tensorDedupThreshold, nopBrochure.tensorDedupCacheCapacity);
+
+  nopBrochureAnswer.messageDescriptorVersion = std::min(
+      nopBrochure.messageDescriptorVersion,
+      kCompactMessageDescriptorWithInlinePayloadsVersion);
+  setMessageDescriptorVersion(
+      nopBrochureAnswer.messageDescriptorVersion,
+      nopBrochureAnswer.channelNames);
+
   TP_VLOG(3) << "Pipe " << id_ << " is writing nop object (brochure answer)";
   connection_->write(
       *nopHolderOut, lazyCallbackWrapper_([nopHolderOut](Impl& impl) {
@@ -1471,12 +5383,50 @@ void Pipe::Impl::onReadWhileServerWaitingForBrochure(
       }));
 
   if (!needToWaitForConnections) {
-    state_ = ESTABLISHED;
-    startReadingUponEstablishingPipe();
-    startWritingUponEstablishingPipe();
+    onPipeEstablished();
   } else {
     state_ = SERVER_WAITING_FOR_CONNECTIONS;
+    // The messages that don't need any channel don't have to wait for them.
+    if (connectionIsReady()) {
+      startReadingUponEstablishingPipe();
+      startWritingUponEstablishingPipe();
+    }
+  }
+}
+
+template <typename TBuffer>
+void Pipe::Impl::buildChannelTable() {
+  auto& channelTable = channelTable_.get<TBuffer>();
+  auto& availableChannels = channels_.get<TBuffer>();
+  channelTable.clear();
+  for (const auto& channelContextIter : getOrderedChannels<TBuffer>()) {
+    const std::string& channelName = std::get<0>(channelContextIter.second);
+    auto channelIter = availableChannels.find(channelName);
+    if (channelIter == availableChannels.end()) {
+      continue;
+    }
+    ChannelEntry<TBuffer> entry;
+    entry.name = &channelName;
+    entry.channel = channelIter->second.get();
+    entry.context = std::get<1>(channelContextIter.second).get();
+    std::tie(entry.minLength, entry.maxLength) =
+        context_->getChannelTensorLengthRange(channelName);
+    channelTable.push_back(entry);
+  }
+}
+
+template <typename TBuffer>
+const Pipe::Impl::ChannelEntry<TBuffer>& Pipe::Impl::findChannelEntry(
+    const std::string& channelName) {
+  // There are only a handful of channels.
+  for (const ChannelEntry<TBuffer>& entry : channelTable_.get<TBuffer>()) {
+    if (*entry.name == channelName) {
+      return entry;
+    }
   }
+  TP_THROW_ASSERT() << "Unknown channel " << channelName;
+  // Dummy return to make compiler happy.
+  return channelTable_.get<TBuffer>().front();
 }
 
 template <>
@@ -1493,13 +5443,324 @@ std::shared_ptr<channel::Context<CudaBuffer>> Pipe::Impl::getChannelContext(
 }
 #endif // TENSORPIPE_SUPPORTS_CUDA
 
+bool Pipe::Impl::canTakeBufferAsItIs(
+    const CpuBuffer& buffer,
+    const std::string& channelName) {
+  // The connection only deals with contiguous buffers.
+  return isContiguous(buffer) ||
+      (!channelName.empty() &&
+       findChannelEntry<CpuBuffer>(channelName)
+           .context->supportsStridedBuffers());
+}
+
+CpuBuffer Pipe::Impl::packTensorForChannel(
+    WriteOperation& op,
+    size_t tensorIdx,
+    const CpuBuffer& buffer,
+    const std::string& channelName) {
+  // The tensors are copied if the user wants their buffers back early.
+  if (canTakeBufferAsItIs(buffer, channelName) &&
+      !op.buffersReleasedCallback) {
+    return buffer;
+  }
+  op.packedCpuTensors.resize(op.message.tensors.size());
+  std::unique_ptr<uint8_t[]>& packedTensor = op.packedCpuTensors[tensorIdx];
+  packedTensor = std::make_unique<uint8_t[]>(buffer.length);
+  CpuBuffer packedBuffer;
+  packedBuffer.ptr = packedTensor.get();
+  packedBuffer.length = buffer.length;
+  copyBuffer(packedBuffer, buffer);
+  return packedBuffer;
+}
+
+CpuBuffer Pipe::Impl::prepareToUnpackTensor(
+    ReadOperation& op,
+    size_t tensorIdx,
+    const CpuBuffer& buffer,
+    const std::string& channelName) {
+  if (canTakeBufferAsItIs(buffer, channelName)) {
+    return buffer;
+  }
+  op.packedCpuTensors.resize(op.message.tensors.size());
+  std::unique_ptr<uint8_t[]>& packedTensor = op.packedCpuTensors[tensorIdx];
+  packedTensor = std::make_unique<uint8_t[]>(buffer.length);
+  CpuBuffer packedBuffer;
+  packedBuffer.ptr = packedTensor.get();
+  packedBuffer.length = buffer.length;
+  return packedBuffer;
+}
+
+#if TENSORPIPE_SUPPORTS_CUDA
+bool Pipe::Impl::canTakeBufferAsItIs(
+    const CudaBuffer& buffer,
+    bool isManaged,
+    const std::string& channelName) {
+  channel::Context<CudaBuffer>* channelContext =
+      findChannelEntry<CudaBuffer>(channelName).context;
+  if (isManaged && !channelContext->supportsManagedMemory()) {
+    return false;
+  }
+  return isContiguous(buffer) || channelContext->supportsStridedBuffers();
+}
+
+bool Pipe::Impl::prefetchCudaTensorIfManaged(const CudaBuffer& buffer) {
+  const CudaLib* cudaLib = context_->getCudaLib();
+  // Without libcuda nothing is known about the buffer, and this is reported by
+  // acquirePackedCudaTensor if it comes to that.
+  return cudaLib != nullptr && cudaPrefetchBufferIfManaged(*cudaLib, buffer);
+}
+
+CudaBuffer Pipe::Impl::packTensorForChannel(
+    WriteOperation& op,
+    size_t tensorIdx,
+    const CudaBuffer& buffer,
+    const std::string& channelName) {
+  const bool isManaged = prefetchCudaTensorIfManaged(buffer);
+  if (canTakeBufferAsItIs(buffer, isManaged, channelName) ||
+      !acquirePackedCudaTensor(
+          op.packedCudaTensors, op.message.tensors.size(), tensorIdx, buffer)) {
+    return buffer;
+  }
+  // It's packed on the tensor's stream, hence before the channel reads it and
+  // before the user's later work overwrites the tensor.
+  const CudaStagingBuffers::Buffer& packedTensor =
+      op.packedCudaTensors[tensorIdx];
+  CudaBuffer packedBuffer;
+  packedBuffer.ptr = packedTensor.ptr;
+  packedBuffer.length = buffer.length;
+  packedBuffer.stream = buffer.stream;
+  {
+    CudaDeviceGuard guard(packedTensor.device);
+    cudaCopyBuffer(packedBuffer, buffer, buffer.stream);
+  }
+  return packedBuffer;
+}
+
+CudaBuffer Pipe::Impl::prepareToUnpackTensor(
+    ReadOperation& op,
+    size_t tensorIdx,
+    const CudaBuffer& buffer,
+    const std::string& channelName) {
+  // The channel (or the unpacking) writes into the tensor on its stream, hence
+  // after the migration of its pages to its device.
+  const bool isManaged = prefetchCudaTensorIfManaged(buffer);
+  if (canTakeBufferAsItIs(buffer, isManaged, channelName) ||
+      !acquirePackedCudaTensor(
+          op.packedCudaTensors, op.message.tensors.size(), tensorIdx, buffer)) {
+    return buffer;
+  }
+  CudaBuffer packedBuffer;
+  packedBuffer.ptr = op.packedCudaTensors[tensorIdx].ptr;
+  packedBuffer.length = buffer.length;
+  packedBuffer.stream = buffer.stream;
+  return packedBuffer;
+}
+
+bool Pipe::Impl::acquirePackedCudaTensor(
+    std::vector<CudaStagingBuffers::Buffer>& packedCudaTensors,
+    size_t numTensors,
+    size_t tensorIdx,
+    const CudaBuffer& buffer) {
+  const CudaLib* cudaLib = context_->getCudaLib();
+  if (cudaLib == nullptr) {
+    setError(TP_CREATE_ERROR(CudaError, cudaErrorInitializationError));
+    return false;
+  }
+  packedCudaTensors.resize(numTensors);
+  packedCudaTensors[tensorIdx] = cudaStagingBuffers_.acquire(
+      cudaDeviceForPointer(*cudaLib, buffer.ptr), buffer.length, buffer.stream);
+  return true;
+}
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+void Pipe::Impl::releasePackedTensor(WriteOperation& op, size_t tensorIdx) {
+  if (tensorIdx < op.packedCpuTensors.size()) {
+    op.packedCpuTensors[tensorIdx] = nullptr;
+  }
+#if TENSORPIPE_SUPPORTS_CUDA
+  if (tensorIdx < op.packedCudaTensors.size() &&
+      op.packedCudaTensors[tensorIdx].ptr != nullptr) {
+    cudaStagingBuffers_.release(
+        std::move(op.packedCudaTensors[tensorIdx]),
+        op.message.tensors[tensorIdx].buffer.cuda.stream);
+    op.packedCudaTensors[tensorIdx] = CudaStagingBuffers::Buffer();
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+}
+
+void Pipe::Impl::unpackReceivedTensor(ReadOperation& op, size_t tensorIdx) {
+  const Buffer& buffer = op.message.tensors[tensorIdx].buffer;
+  // The tensor is left alone if the data couldn't be received.
+  if (tensorIdx < op.packedCpuTensors.size() &&
+      op.packedCpuTensors[tensorIdx] != nullptr) {
+    if (!error_) {
+      CpuBuffer packedBuffer;
+      packedBuffer.ptr = op.packedCpuTensors[tensorIdx].get();
+      packedBuffer.length = buffer.cpu.length;
+      copyBuffer(buffer.cpu, packedBuffer);
+    }
+    op.packedCpuTensors[tensorIdx] = nullptr;
+  }
+#if TENSORPIPE_SUPPORTS_CUDA
+  if (tensorIdx < op.packedCudaTensors.size() &&
+      op.packedCudaTensors[tensorIdx].ptr != nullptr) {
+    CudaStagingBuffers::Buffer& packedTensor = op.packedCudaTensors[tensorIdx];
+    if (!error_) {
+      CudaBuffer packedBuffer;
+      packedBuffer.ptr = packedTensor.ptr;
+      packedBuffer.length = buffer.cuda.length;
+      CudaDeviceGuard guard(packedTensor.device);
+      cudaCopyBuffer(buffer.cuda, packedBuffer, buffer.cuda.stream);
+    }
+    cudaStagingBuffers_.release(std::move(packedTensor), buffer.cuda.stream);
+    packedTensor = CudaStagingBuffers::Buffer();
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+}
+
+void Pipe::Impl::enableTensorDedup(size_t threshold, size_t cacheCapacity) {
+  if (cacheCapacity == 0) {
+    return;
+  }
+  tensorDedupThreshold_ = threshold;
+  tensorDedupCacheCapacity_ = cacheCapacity;
+  writtenTensorDedupCache_ =
+      std::make_unique<TensorDedupCache>(cacheCapacity, /*holdsData=*/false);
+  readTensorDedupCache_ =
+      std::make_unique<TensorDedupCache>(cacheCapacity, /*holdsData=*/true);
+}
+
+void Pipe::Impl::shapeWritesOfConnection(transport::Connection& connection) {
+  if (writeShapingWeight_ == 0) {
+    return;
+  }
+  connection.setWriteShaping(
+      writeShapingWeight_, writeShapingMaxBytesPerSecond_);
+}
+
+Error Pipe::Impl::lookUpDeduplicatedTensorsOfMessage(ReadOperation& op) {
+  // This must be done as the descriptors are read, i.e., in the same order as
+  // the writer went through its own cache.
+  for (size_t tensorIdx = 0; tensorIdx < op.tensors.size(); tensorIdx++) {
+    ReadOperation::Tensor& tensor = op.tensors[tensorIdx];
+    if (tensor.dedup == TensorDedup::kNone) {
+      continue;
+    }
+    const std::string name = "tensor #" + std::to_string(op.sequenceNumber) +
+        "." + std::to_string(tensorIdx);
+    const bool isStore = tensor.dedup == TensorDedup::kStore;
+    if (readTensorDedupCache_ == nullptr || op.handsOffTensors ||
+        tensor.type != DeviceType::kCpu ||
+        isStore == tensor.channelName.empty()) {
+      return TP_CREATE_ERROR(
+          MalformedDescriptorError, name + " can't be deduplicated");
+    }
+    const size_t length = static_cast<size_t>(tensor.length);
+    if (isStore) {
+      tensor.dedupEntry =
+          readTensorDedupCache_->insert(length, tensor.dedupHash);
+      if (tensor.dedupEntry == nullptr) {
+        return TP_CREATE_ERROR(
+            MalformedDescriptorError, name + " doesn't fit in the cache");
+      }
+    } else {
+      tensor.dedupEntry = readTensorDedupCache_->find(length, tensor.dedupHash);
+      if (tensor.dedupEntry == nullptr) {
+        return TP_CREATE_ERROR(
+            MalformedDescriptorError, name + " isn't in the cache");
+      }
+    }
+  }
+  return Error::kSuccess;
+}
+
+void Pipe::Impl::storeDeduplicatedTensor(ReadOperation& op, size_t tensorIdx) {
+  std::shared_ptr<TensorDedupCache::Entry> entry =
+      std::move(op.tensors[tensorIdx].dedupEntry);
+  // The entry is left empty if the data couldn't be received (or was corrupt),
+  // but the pipe is then failed, and won't look it up ever again.
+  if (!error_) {
+    CpuBuffer buffer;
+    buffer.ptr = entry->data.get();
+    buffer.length = entry->length;
+    copyBuffer(buffer, op.message.tensors[tensorIdx].buffer.cpu);
+    entry->isReady = true;
+  }
+  wakeUpWaitersOfDedupEntry(*entry);
+}
+
+void Pipe::Impl::copyDeduplicatedTensor(ReadOperation& op, size_t tensorIdx) {
+  const std::shared_ptr<TensorDedupCache::Entry>& entry =
+      op.tensors[tensorIdx].dedupEntry;
+  if (entry->isReady) {
+    copyDeduplicatedTensorFromCache(op, tensorIdx);
+    return;
+  }
+  // The tensor it's a copy of belongs to an earlier message, or to this one,
+  // and is still being received.
+  TP_VLOG(3) << "Pipe " << id_ << " is waiting for the contents of tensor #"
+             << op.sequenceNumber << "." << tensorIdx;
+  entry->waiters.push_back([this, &op, tensorIdx]() {
+    if (!error_) {
+      copyDeduplicatedTensorFromCache(op, tensorIdx);
+    }
+    onRecvOfTensor(op);
+  });
+  ++op.numTensorsBeingReceived;
+}
+
+void Pipe::Impl::copyDeduplicatedTensorFromCache(
+    ReadOperation& op,
+    size_t tensorIdx) {
+  TP_VLOG(3) << "Pipe " << id_ << " is copying tensor #" << op.sequenceNumber
+             << "." << tensorIdx << " from the cache";
+  std::shared_ptr<TensorDedupCache::Entry> entry =
+      std::move(op.tensors[tensorIdx].dedupEntry);
+  TP_DCHECK(entry->isReady);
+  CpuBuffer buffer;
+  buffer.ptr = entry->data.get();
+  buffer.length = entry->length;
+  copyBuffer(op.message.tensors[tensorIdx].buffer.cpu, buffer);
+  // This also catches the (unlikely) collisions of the hashes.
+  setError(checkChecksumOfReceivedTensor(op, tensorIdx));
+}
+
+void Pipe::Impl::wakeUpWaitersOfDedupEntry(TensorDedupCache::Entry& entry) {
+  std::vector<std::function<void()>> waiters = std::move(entry.waiters);
+  entry.waiters.clear();
+  for (auto& fn : waiters) {
+    fn();
+  }
+}
+
 void Pipe::Impl::onReadWhileClientWaitingForBrochureAnswer(
     const Packet& nopPacketIn) {
   TP_DCHECK(loop_.inLoop());
   TP_DCHECK_EQ(state_, CLIENT_WAITING_FOR_BROCHURE_ANSWER);
   TP_DCHECK_EQ(nopPacketIn.index(), nopPacketIn.index_of<BrochureAnswer>());
+  takeTimestamp(brochureExchangedTime_);
 
   const BrochureAnswer& nopBrochureAnswer = *nopPacketIn.get<BrochureAnswer>();
+
+  if (payloadCompression_ != PayloadCompression::kNone &&
+      std::find(
+          nopBrochureAnswer.payloadCompressions.begin(),
+          nopBrochureAnswer.payloadCompressions.end(),
+          payloadCompression_) == nopBrochureAnswer.payloadCompressions.end()) {
+    TP_VLOG(1) << "Pipe " << id_
+               << " won't compress payloads as the remote end doesn't support "
+               << payloadCompressionToString(payloadCompression_);
+    payloadCompression_ = PayloadCompression::kNone;
+  }
+
+  setMessageDescriptorVersion(
+      nopBrochureAnswer.messageDescriptorVersion,
+      nopBrochureAnswer.channelNames);
+
+  peerIsInSameProcess_ =
+      nopBrochureAnswer.processIdentifier == getProcessIdentifier();
+  peerHostIdentifier_ = nopBrochureAnswer.hostIdentifier;
+
   const std::string& transport = nopBrochureAnswer.transport;
   std::string address = nopBrochureAnswer.address;
   std::shared_ptr<transport::Context> transportContext =
@@ -1508,8 +5769,9 @@ void Pipe::Impl::onReadWhileClientWaitingForBrochureAnswer(
   if (transport != transport_) {
     TP_VLOG(3) << "Pipe " << id_ << " is opening connection (as replacement)";
     std::shared_ptr<transport::Connection> connection =
-        transportContext->connect(address);
+        transportContext->connectOnNumaNode(address, numaNode_);
     connection->setId(id_ + ".tr_" + transport);
+    shapeWritesOfConnection(*connection);
     auto nopHolderOut = std::make_shared<NopHolder<Packet>>();
     Packet& nopPacketOut = nopHolderOut->getObject();
     nopPacketOut.Become(nopPacketOut.index_of<RequestedConnection>());
@@ -1529,6 +5791,45 @@ void Pipe::Impl::onReadWhileClientWaitingForBrochureAnswer(
     connection_ = std::move(connection);
   }
 
+  if (context_->isMultiplexingChannelConnections()) {
+    bool hasChannels = false;
+    forEachDeviceType([&](auto buffer) {
+      auto& channelStreamIds = channelStreamIds_.get<decltype(buffer)>();
+      for (const auto& nopChannelSelectionIter :
+           getChannelSelection<decltype(buffer)>(nopBrochureAnswer)) {
+        const std::string& channelName = nopChannelSelectionIter.first;
+        const ChannelSelection& nopChannelSelection =
+            nopChannelSelectionIter.second;
+        channelStreamIds[channelName] = nopChannelSelection.streamId;
+        hasChannels = true;
+      }
+    });
+    if (hasChannels) {
+      TP_VLOG(3) << "Pipe " << id_ << " is opening connection (for channels)";
+      std::shared_ptr<transport::Connection> connection =
+          transportContext->connectOnNumaNode(address, numaNode_);
+      shapeWritesOfConnection(*connection);
+      auto nopHolderOut = std::make_shared<NopHolder<Packet>>();
+      Packet& nopPacketOut = nopHolderOut->getObject();
+      nopPacketOut.Become(nopPacketOut.index_of<RequestedConnection>());
+      RequestedConnection& nopRequestedConnection =
+          *nopPacketOut.get<RequestedConnection>();
+      nopRequestedConnection.registrationId =
+          nopBrochureAnswer.channelsRegistrationId;
+      TP_VLOG(3) << "Pipe " << id_
+                 << " is writing nop object (requested connection)";
+      connection->write(
+          *nopHolderOut, lazyCallbackWrapper_([nopHolderOut](Impl& impl) {
+            TP_VLOG(3) << "Pipe " << impl.id_
+                       << " done writing nop object (requested connection)";
+          }));
+      createMultiplexedChannels(
+          std::move(connection), channel::Endpoint::kConnect);
+    }
+    onPipeEstablished();
+    return;
+  }
+
   forEachDeviceType([&](auto buffer) {
     for (const auto& nopChannelSelectionIter :
          getChannelSelection<decltype(buffer)>(nopBrochureAnswer)) {
@@ -1542,8 +5843,9 @@ void Pipe::Impl::onReadWhileClientWaitingForBrochureAnswer(
       TP_VLOG(3) << "Pipe " << id_ << " is opening connection (for channel "
                  << channelName << ")";
       std::shared_ptr<transport::Connection> connection =
-          transportContext->connect(address);
+          transportContext->connectOnNumaNode(address, numaNode_);
       connection->setId(id_ + ".ch_" + channelName);
+      shapeWritesOfConnection(*connection);
 
       auto nopHolderOut = std::make_shared<NopHolder<Packet>>();
       Packet& nopPacketOut = nopHolderOut->getObject();
@@ -1569,9 +5871,7 @@ void Pipe::Impl::onReadWhileClientWaitingForBrochureAnswer(
     }
   });
 
-  state_ = ESTABLISHED;
-  startReadingUponEstablishingPipe();
-  startWritingUponEstablishingPipe();
+  onPipeEstablished();
 }
 
 void Pipe::Impl::onAcceptWhileServerWaitingForConnection(
@@ -1588,7 +5888,8 @@ void Pipe::Impl::onAcceptWhileServerWaitingForConnection(
   connection_ = std::move(receivedConnection);
 
   if (!pendingRegistrations()) {
-    state_ = ESTABLISHED;
+    onPipeEstablished();
+  } else {
     startReadingUponEstablishingPipe();
     startWritingUponEstablishingPipe();
   }
@@ -1622,9 +5923,69 @@ void Pipe::Impl::onAcceptWhileServerWaitingForChannel(
   channels.emplace(channelName, std::move(channel));
 
   if (!pendingRegistrations()) {
-    state_ = ESTABLISHED;
-    startReadingUponEstablishingPipe();
-    startWritingUponEstablishingPipe();
+    onPipeEstablished();
+  }
+}
+
+void Pipe::Impl::onAcceptWhileServerWaitingForChannels(
+    std::string receivedTransport,
+    std::shared_ptr<transport::Connection> receivedConnection) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK_EQ(state_, SERVER_WAITING_FOR_CONNECTIONS);
+  TP_DCHECK(channelsRegistrationId_.has_value());
+  listener_->unregisterConnectionRequest(channelsRegistrationId_.value());
+  channelsRegistrationId_.reset();
+  TP_DCHECK_EQ(transport_, receivedTransport);
+
+  createMultiplexedChannels(
+      std::move(receivedConnection), channel::Endpoint::kListen);
+
+  if (!pendingRegistrations()) {
+    onPipeEstablished();
+  }
+}
+
+void Pipe::Impl::createMultiplexedChannels(
+    std::shared_ptr<transport::Connection> connection,
+    channel::Endpoint endpoint) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK(channelMultiplexer_ == nullptr);
+  connection->setId(id_ + ".ch");
+  channelMultiplexer_ =
+      std::make_shared<transport::ConnectionMultiplexer>(std::move(connection));
+  channelMultiplexer_->setId(id_ + ".ch");
+  channelMultiplexer_->init();
+
+  forEachDeviceType([&](auto buffer) {
+    auto& channelStreamIds = channelStreamIds_.get<decltype(buffer)>();
+    for (const auto& channelStreamIdIter : channelStreamIds) {
+      const std::string& channelName = channelStreamIdIter.first;
+      std::shared_ptr<transport::Connection> stream =
+          channelMultiplexer_->openStream(channelStreamIdIter.second);
+      stream->setId(id_ + ".ch_" + channelName);
+
+      std::shared_ptr<channel::Channel<decltype(buffer)>> channel =
+          this->getChannelContext<decltype(buffer)>(channelName)
+              ->createChannel(std::move(stream), endpoint);
+      channel->setId(id_ + ".ch_" + channelName);
+      channels_.get<decltype(buffer)>().emplace(
+          channelName, std::move(channel));
+    }
+    channelStreamIds.clear();
+  });
+}
+
+void Pipe::Impl::setMessageDescriptorVersion(
+    uint64_t version,
+    std::vector<std::string> channelNames) {
+  TP_DCHECK(loop_.inLoop());
+
+  messageDescriptorVersion_ = version;
+  channelNames_ = std::move(channelNames);
+  channelIndices_.clear();
+  for (uint64_t channelIdx = 0; channelIdx < channelNames_.size();
+       channelIdx++) {
+    channelIndices_.emplace(channelNames_[channelIdx], channelIdx);
   }
 }
 
@@ -1632,11 +5993,55 @@ void Pipe::Impl::onReadOfMessageDescriptor(
     ReadOperation& op,
     const Packet& nopPacketIn) {
   TP_DCHECK(loop_.inLoop());
-  TP_DCHECK_EQ(state_, ESTABLISHED);
+  TP_TRACE_SCOPE("tp::Pipe::onReadOfMessageDescriptor");
+  TP_TRACE_FLOW_STEP("tp::Pipe::read", op.traceFlowId);
+  TP_DCHECK(connectionIsReady());
 
   TP_DCHECK_EQ(op.state, ReadOperation::READING_DESCRIPTOR);
-  parseDescriptorOfMessage(op, nopPacketIn);
+  // Either format is accepted, whichever was agreed upon.
+  Error error = Error::kSuccess;
+  if (nopPacketIn.index() ==
+      nopPacketIn.index_of<CompactMessageDescriptor>()) {
+    const std::vector<uint8_t>& data =
+        nopPacketIn.get<CompactMessageDescriptor>()->data;
+    optional<size_t> inlinePayloadsOffset;
+    error = decodeCompactMessageDescriptor(
+        data,
+        channelNames_,
+        compactMessageDescriptor_,
+        messageDescriptorVersion_ >=
+                kCompactMessageDescriptorWithInlinePayloadsVersion
+            ? &inlinePayloadsOffset
+            : nullptr);
+    if (!error) {
+      parseDescriptorOfMessage(op, compactMessageDescriptor_);
+      if (inlinePayloadsOffset.has_value()) {
+        stageInlinePayloadsOfMessage(
+            op, data.data() + inlinePayloadsOffset.value());
+      }
+    }
+  } else {
+    TP_DCHECK_EQ(
+        nopPacketIn.index(), nopPacketIn.index_of<MessageDescriptor>());
+    parseDescriptorOfMessage(op, *nopPacketIn.get<MessageDescriptor>());
+  }
+  if (!error && op.handsOffTensors) {
+    error = withdrawHandedOffTensorsOfMessage(op, peerIsInSameProcess_);
+  }
+  if (!error) {
+    error = lookUpDeduplicatedTensorsOfMessage(op);
+  }
   op.doneReadingDescriptor = true;
+  takeTimestamp(op.descriptorReadTime);
+  TP_USDT(
+      pipe__descriptor__received,
+      id_.c_str(),
+      op.sequenceNumber,
+      op.message.payloads.size(),
+      op.message.tensors.size());
+  setError(std::move(error));
+  setError(checkCompressionOfMessage(op, context_->getPayloadCompressor()));
+  setError(checkCoalescingOfMessage(op));
 
   advanceReadOperation(op);
 }
@@ -1652,44 +6057,136 @@ void Pipe::Impl::onDescriptorOfTensor(
   TP_DCHECK_LT(tensorIdx, op.tensors.size());
   op.tensors[tensorIdx].descriptor = std::move(descriptor);
   --op.numTensorDescriptorsBeingCollected;
+  if (op.numTensorDescriptorsBeingCollected == 0) {
+    takeTimestamp(op.tensorDescriptorsCollectedTime);
+  }
+
+  advanceWriteOperation(op);
+}
+
+void Pipe::Impl::onDescriptorOfCoalescedTensors(
+    WriteOperation& op,
+    channel::TDescriptor descriptor) {
+  TP_DCHECK(loop_.inLoop());
+
+  TP_DCHECK_EQ(
+      op.state, WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS);
+  TP_DCHECK(op.coalescesCudaTensors);
+  op.coalescedTensor.descriptor = std::move(descriptor);
+  --op.numTensorDescriptorsBeingCollected;
+  if (op.numTensorDescriptorsBeingCollected == 0) {
+    takeTimestamp(op.tensorDescriptorsCollectedTime);
+  }
 
   advanceWriteOperation(op);
 }
 
 void Pipe::Impl::onReadOfPayload(ReadOperation& op) {
   TP_DCHECK(loop_.inLoop());
+  TP_TRACE_SCOPE("tp::Pipe::onReadOfPayload");
+  TP_TRACE_FLOW_STEP("tp::Pipe::read", op.traceFlowId);
 
   TP_DCHECK_EQ(op.state, ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS);
   op.numPayloadsBeingRead--;
+  if (op.numPayloadsBeingRead == 0) {
+    takeTimestamp(op.payloadsReadTime);
+  }
+
+  advanceReadOperation(op);
+}
+
+void Pipe::Impl::onReadOfStagedBuffer(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+
+  TP_DCHECK(op.payloadsStaged);
+  op.numStagedBuffersBeingRead--;
 
   advanceReadOperation(op);
 }
 
+void Pipe::Impl::onDecompressionOfChunkOfPayload(
+    ReadOperation& op,
+    size_t payloadIdx,
+    size_t chunkIdx) {
+  TP_DCHECK(loop_.inLoop());
+
+  TP_DCHECK_EQ(op.state, ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS);
+  ReadOperation::Payload& payload = op.payloads[payloadIdx];
+  payload.numChunksBeingDecompressed--;
+  // The chunks that go out from their buffers do so as soon as they can.
+  if (!payload.chunksAreDecompressed.empty()) {
+    payload.chunksAreDecompressed[chunkIdx] = true;
+    handOutDecompressedPayloads(op);
+  }
+  if (payload.numChunksBeingDecompressed > 0) {
+    return;
+  }
+
+  TP_VLOG(3) << "Pipe " << id_ << " done reading payload #" << op.sequenceNumber
+             << "." << payloadIdx;
+  // The checksum was computed by the sender before compressing. The payloads
+  // that go out in chunks have theirs checked while doing so.
+  if (op.readChunkCallback) {
+    if (!error_ && !handsOutChunksFromBuffers(op)) {
+      setError(checkChecksumOfChunksHandedOut(op, payloadIdx));
+    }
+  } else if (!error_ && op.hasChecksums) {
+    setError(checkChecksumOfPayload(op, payloadIdx));
+  }
+  payload.doneDecompressing = true;
+  handOutDecompressedPayloads(op);
+
+  onReadOfPayload(op);
+}
+
 void Pipe::Impl::onRecvOfTensor(ReadOperation& op) {
   TP_DCHECK(loop_.inLoop());
+  TP_TRACE_SCOPE("tp::Pipe::onRecvOfTensor");
+  TP_TRACE_FLOW_STEP("tp::Pipe::read", op.traceFlowId);
 
   TP_DCHECK_EQ(op.state, ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS);
   op.numTensorsBeingReceived--;
+  if (op.numTensorsBeingReceived == 0) {
+    takeTimestamp(op.tensorsReceivedTime);
+  }
 
   advanceReadOperation(op);
 }
 
-void Pipe::Impl::onWriteOfPayload(WriteOperation& op) {
+void Pipe::Impl::onWriteOfPayloads(WriteOperation& op, size_t numBuffers) {
   TP_DCHECK(loop_.inLoop());
+  TP_TRACE_SCOPE("tp::Pipe::onWriteOfPayloads");
+  TP_TRACE_FLOW_STEP("tp::Pipe::write", op.traceFlowId);
 
   TP_DCHECK_EQ(op.state, WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS);
-  op.numPayloadsBeingWritten--;
+  op.numPayloadsBeingWritten -= numBuffers;
+  takeTimestamp(op.payloadsWrittenTime);
+
+  advanceWriteOperation(op);
+}
+
+void Pipe::Impl::onCompressionOfChunkOfPayload(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+
+  TP_DCHECK_EQ(
+      op.state, WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS);
+  op.numChunksBeingCompressed--;
 
   advanceWriteOperation(op);
 }
 
 void Pipe::Impl::onSendOfTensor(WriteOperation& op) {
   TP_DCHECK(loop_.inLoop());
+  TP_TRACE_SCOPE("tp::Pipe::onSendOfTensor");
+  TP_TRACE_FLOW_STEP("tp::Pipe::write", op.traceFlowId);
 
   TP_DCHECK_GE(
       op.state, WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS);
   TP_DCHECK_LE(op.state, WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS);
   op.numTensorsBeingSent--;
+  if (op.numTensorsBeingSent == 0) {
+    takeTimestamp(op.tensorsSentTime);
+  }
 
   advanceWriteOperation(op);
 }
@@ -1721,7 +6218,7 @@ WriteOperation* Pipe::Impl::findWriteOperation(int64_t sequenceNumber) {
 }
 
 bool Pipe::Impl::pendingRegistrations() {
-  if (registrationId_.has_value()) {
+  if (registrationId_.has_value() || channelsRegistrationId_.has_value()) {
     return true;
   }
 
@@ -8,14 +8,19 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
 #include <tensorpipe/core/context.h>
 #include <tensorpipe/core/listener.h>
 #include <tensorpipe/core/message.h>
+#include <tensorpipe/core/stats.h>
 #include <tensorpipe/transport/context.h>
 
 namespace tensorpipe {
@@ -44,12 +49,14 @@ class Pipe final {
   // Initialization
   //
 
+  // The options are those given to Context::connect, but with the NUMA node
+  // already resolved to an actual one.
   Pipe(
       ConstructorToken token,
       std::shared_ptr<Context::PrivateIface> context,
       std::string id,
-      std::string remoteName,
-      const std::string& url);
+      const std::string& url,
+      PipeOptions opts);
 
   Pipe(
       ConstructorToken token,
@@ -65,23 +72,207 @@ class Pipe final {
   //
 
   using read_descriptor_callback_fn =
-      std::function<void(const Error&, Message)>;
+      MoveOnlyFunction<void(const Error&, Message)>;
 
   void readDescriptor(read_descriptor_callback_fn fn);
 
-  using read_callback_fn = std::function<void(const Error&, Message)>;
+  using read_callback_fn = MoveOnlyFunction<void(const Error&, Message)>;
 
   void read(Message message, read_callback_fn fn);
 
-  using write_callback_fn = std::function<void(const Error&, Message)>;
+  // Variants of readDescriptor and read whose callback is called with an error
+  // if it isn't called before the timeout passes. The message that a read
+  // waits for may be on its way, and couldn't be told apart from the ones that
+  // follow it, hence the whole pipe fails then, with a DeadlineExceededError.
+  void readDescriptor(
+      std::chrono::milliseconds timeout,
+      read_descriptor_callback_fn fn);
+  void read(
+      Message message,
+      std::chrono::milliseconds timeout,
+      read_callback_fn fn);
+
+  // Batched variants of readDescriptor and read, for receivers under heavy
+  // fan-in that would rather handle messages in bulk. The callback is given
+  // the descriptor of the next message, once it arrives, along with those of
+  // the messages after it that arrived by the time the pipe is done with the
+  // ones before, up to the given number. To get to them the pipe reads ahead
+  // of the messages of the batch (see ContextOptions::readAheadWindow), beyond
+  // the window if need be. The descriptor of the message after the batch may
+  // have started being read, in which case it goes to the next readDescriptor
+  // (or readDescriptorBatch, etc.) call. In case of error the batch goes out
+  // right away, and its messages are still to be read, as with readDescriptor.
+  using read_descriptor_batch_callback_fn =
+      MoveOnlyFunction<void(const Error&, std::vector<Message>)>;
+
+  void readDescriptorBatch(
+      size_t maxMessages,
+      read_descriptor_batch_callback_fn fn);
+
+  // Read several messages at once (e.g., those that readDescriptorBatch gave),
+  // as if read was called for each of them in turn, with the callback being
+  // called once for each message, except that they're all enqueued in a single
+  // hop to the loop.
+  void readBatch(std::vector<Message> messages, read_callback_fn fn);
+
+  // A variant of readDescriptor and read combined, for users who can allocate
+  // the memory for a message as soon as its descriptor arrives. The allocator
+  // is given the message that would be passed to the readDescriptor callback,
+  // and must fill in the data pointers of its payloads and tensors. It's called
+  // inline from the pipe's internal loop, so the reads can be posted right away
+  // and the message is delivered with a single callback. Hence the allocator
+  // must not block nor call back into the pipe. It isn't called in case of
+  // error, in which case the read callback is called directly.
+  using allocate_fn = std::function<void(Message&)>;
+
+  void read(allocate_fn allocateFn, read_callback_fn fn);
+
+  // A variant of the above for workloads in which all messages have the same
+  // shape: the message, with the data pointers of its payloads and tensors
+  // already set, is posted ahead of time, and the next message that arrives
+  // is read straight into its buffers, without involving the user until the
+  // read callback. Receives can be posted several at a time, to form a ring
+  // that is refilled by posting each message again once it's been consumed.
+  // The incoming message keeps its own metadata, but it must have as many
+  // payloads and tensors as the posted one, of the same lengths and on the
+  // same devices, or else the pipe fails with a PostedReceiveMismatchError.
+  // In case of error the read callback is given the posted message back, so
+  // that its buffers can be reclaimed. The buffers of the tensors are ignored
+  // if those are handed off (see Message::handOffTensors).
+  void postReceive(Message message, read_callback_fn fn);
+
+  // A variant of read in which the payloads aren't copied into buffers supplied
+  // by the user: instead, each of them is handed to the payload callback as
+  // soon as it arrives, as a pointer that may point directly into the internal
+  // buffers of the transport (e.g., the ringbuffer of the shm transport) and
+  // that is only valid until that callback returns. This saves an allocation
+  // and a copy for small payloads that are consumed right away. The data field
+  // of the payloads of the message is thus ignored (and will still be unset in
+  // the message given to the read callback). The payload callback is called in
+  // order and from an internal thread, hence it shouldn't block.
+  using read_payload_callback_fn =
+      std::function<void(size_t payloadIdx, const void* ptr, size_t length)>;
+
+  void read(
+      Message message,
+      read_payload_callback_fn payloadFn,
+      read_callback_fn fn);
+
+  // A variant of the above for payloads that are too large to be held whole,
+  // or that are worth consuming before they're whole: each payload is handed
+  // to the chunk callback piece by piece, as the pieces arrive, with the offset
+  // of each piece in the payload. Those that the sender wrote in chunks (see
+  // PipeOptions::payloadChunking and PipeOptions::payloadCompression) come in
+  // those chunks, the others in a single piece. As with the payload callback,
+  // the pieces may point into the internal buffers of the transport and are
+  // only valid until the callback returns, and they're handed out in order
+  // (payload after payload) from an internal thread. If the message has
+  // checksums, those of the payloads that come in several pieces can only be
+  // checked once they all went out, and a mismatch is reported to the read
+  // callback.
+  using read_chunk_callback_fn = std::function<
+      void(size_t payloadIdx, size_t offset, const void* ptr, size_t length)>;
+
+  void readInChunks(
+      Message message,
+      read_chunk_callback_fn chunkFn,
+      read_callback_fn fn);
+
+  using write_callback_fn = MoveOnlyFunction<void(const Error&, Message)>;
 
   void write(Message message, write_callback_fn fn);
 
+  // A variant of write that also tells the user, through the first callback,
+  // as soon as the pipe is done with the buffers of the message, which can then
+  // be reused, rather than only once the whole write is (i.e., for some of the
+  // channels, such as cma, once the other end has received the data). That is
+  // once its payloads (and its inlined tensors) have been written into the
+  // transport (e.g., into the socket, or the ringbuffer of shm) and its CPU
+  // tensors copied into staging buffers of the pipe, from which the channels
+  // send them instead. This costs a copy of each CPU tensor. The CUDA tensors
+  // aren't copied, as the CUDA channels are done with a tensor as soon as its
+  // transfer is enqueued on its stream already. The tensors that are handed
+  // off (see Message::handOffTensors) aren't either, and with them, as with a
+  // write that fails, the first callback is only called right before the write
+  // callback. The first callbacks of several writes may come in any order, but
+  // each of them is called (or handed to the callback executor, if any) before
+  // the write callback of its message.
+  using buffers_released_callback_fn = MoveOnlyFunction<void()>;
+
+  void write(
+      Message message,
+      buffers_released_callback_fn buffersReleasedFn,
+      write_callback_fn fn);
+
+  // A variant of write for messages that should go out before others, such as
+  // small latency-sensitive ones issued behind large transfers. The message
+  // overtakes the writes with a lower priority (the default being zero) that
+  // haven't started yet, because they were held back by the limits of the
+  // PipeOptions or because the pipe isn't established yet. The writes that have
+  // started can't be preempted, hence the limits on the writes in flight bound
+  // how much such a message waits. The writes with the same priority go out in
+  // the order they were issued, and the callbacks are called in the order the
+  // writes go out.
+  void write(Message message, int priority, write_callback_fn fn);
+
+  // A variant of the above whose callback is called with an error if the write
+  // isn't done before the timeout passes. If it hasn't started by then (see
+  // above), only this write fails, with a DeadlineExceededError, though its
+  // callback still waits for those of the earlier writes. Otherwise part of the
+  // message may be out already, hence the whole pipe fails, with that error.
+  // The deadlines are enforced by a thread of the context, whose ticks are a
+  // few milliseconds long, and which costs nothing while there are none.
+  void write(
+      Message message,
+      int priority,
+      std::chrono::milliseconds timeout,
+      write_callback_fn fn);
+
+  // Write several messages at once. This behaves as if write was called for
+  // each of them in turn, with the callback being called once for each message
+  // (in order, unless PipeOptions::unorderedCompletions was set, and with that
+  // message), except that they are all enqueued in a single hop to the loop,
+  // and that the descriptors and payloads of those that can be written right
+  // away are handed to the connection together, so that transports that
+  // support it write them with as few syscalls as possible.
+  void writeBatch(std::vector<Message> messages, write_callback_fn fn);
+  void writeBatch(
+      std::vector<Message> messages,
+      int priority,
+      write_callback_fn fn);
+
+  // Write the same message to several pipes, as when broadcasting parameters
+  // to many workers. This behaves as if write was called on each pipe with a
+  // copy of the message (which points to the same buffers), except that the
+  // work that doesn't depend on the pipe, i.e., computing the checksums of the
+  // payloads and of the CPU tensors, if any pipe needs them, is done once, on
+  // the calling thread. The callback is called once, when all the pipes are
+  // done with the message, with the first error, if any, and with the message,
+  // whose buffers must thus stay untouched until then. The tensors can't be
+  // handed off (see Message::handOffTensors).
+  static void writeToPipes(
+      const std::vector<std::shared_ptr<Pipe>>& pipes,
+      Message message,
+      write_callback_fn fn);
+
+  // Have the callback called once the pipe has room for another write, within
+  // the limits of the PipeOptions, i.e., once a write issued then would start
+  // right away rather than be held back. It's called soon, though still from
+  // an internal thread, if there's room already or if there are no limits, and
+  // with an error if the pipe fails before that.
+  using writable_callback_fn = MoveOnlyFunction<void(const Error&)>;
+
+  void waitUntilWritable(writable_callback_fn fn);
+
   // Retrieve the user-defined name that was given to the constructor of the
   // context on the remote side, if any (if not, this will be the empty string).
   // This is intended to help in logging and debugging only.
   const std::string& getRemoteName();
 
+  // Return a snapshot of the statistics of the operations that completed on
+  // this pipe so far. They are empty unless enabled in the context's options.
+  PipeStats getStats();
+
   // Put the pipe in a terminal state, aborting its pending operations and
   // rejecting future ones, and release its resrouces. This may be carried out
   // asynchronously, in background.
@@ -92,6 +283,10 @@ class Pipe final {
  private:
   class Impl;
 
+  // Whether the pipe has encountered an error (including being closed), and is
+  // thus unusable. This can be called from any thread.
+  bool hasFailed();
+
   // Using a shared_ptr allows us to detach the lifetime of the implementation
   // from the public object's one and perform the destruction asynchronously.
   std::shared_ptr<Impl> impl_;
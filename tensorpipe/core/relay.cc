@@ -0,0 +1,549 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/relay.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/core/allocation_hints.h>
+#include <tensorpipe/core/listener.h>
+#include <tensorpipe/core/message.h>
+#include <tensorpipe/core/pipe.h>
+
+namespace tensorpipe {
+
+namespace {
+
+// The first message on the pipe from a local process to its relay says where
+// the pipe goes, and the others go through as they are. The messages on the
+// pipes between two relays are those of several streams (one for each pipe of
+// a local process), hence they start with a header made of the kind of the
+// message and of the ID given to the stream by the relay that opened it.
+constexpr char kHello = 'H';
+// Open the stream to the target whose URL is the rest of the metadata.
+constexpr char kOpen = 'O';
+// A message of the stream, whose own metadata is the rest.
+constexpr char kData = 'D';
+// The stream's pipe on the other end failed or was closed.
+constexpr char kClose = 'C';
+
+using TBuffers = std::vector<std::shared_ptr<uint8_t>>;
+
+std::string encodeHello(
+    const std::string& remoteRelayUrl,
+    const std::string& targetUrl) {
+  return std::string(1, kHello) + remoteRelayUrl + '\n' + targetUrl;
+}
+
+bool decodeHello(
+    const std::string& metadata,
+    std::string& remoteRelayUrl,
+    std::string& targetUrl) {
+  if (metadata.empty() || metadata[0] != kHello) {
+    return false;
+  }
+  const size_t pos = metadata.find('\n', 1);
+  if (pos == std::string::npos) {
+    return false;
+  }
+  remoteRelayUrl = metadata.substr(1, pos - 1);
+  targetUrl = metadata.substr(pos + 1);
+  return true;
+}
+
+std::string encodeFrame(char kind, uint64_t streamId, const std::string& rest) {
+  return std::string(1, kind) + std::to_string(streamId) + ' ' + rest;
+}
+
+bool decodeFrame(
+    const std::string& metadata,
+    char& kind,
+    uint64_t& streamId,
+    std::string& rest) {
+  const size_t pos = metadata.find(' ');
+  if (pos == std::string::npos || pos < 2) {
+    return false;
+  }
+  char* end;
+  streamId = std::strtoull(metadata.c_str() + 1, &end, /*base=*/10);
+  if (end != metadata.c_str() + pos) {
+    return false;
+  }
+  kind = metadata[0];
+  rest = metadata.substr(pos + 1);
+  return true;
+}
+
+// The data has to be received anyway, hence the hints that can't be honored
+// are ignored, though they're still passed on to the next hop.
+void allocateMessage(Message& message, TBuffers& buffers) {
+  Error error = allocateMessageWithHints(message, buffers);
+  if (!error) {
+    return;
+  }
+  TP_VLOG(2) << "Relay couldn't honor the allocation hints of a message ("
+             << error.what() << ")";
+  buffers.clear();
+  std::vector<AllocationHints> hints;
+  for (Message::Payload& payload : message.payloads) {
+    hints.push_back(payload.allocationHints);
+    payload.allocationHints = AllocationHints();
+  }
+  for (Message::Tensor& tensor : message.tensors) {
+    hints.push_back(tensor.allocationHints);
+    tensor.allocationHints = AllocationHints();
+  }
+  error = allocateMessageWithHints(message, buffers);
+  TP_THROW_ASSERT_IF(error)
+      << "Relay couldn't allocate a message: " << error.what();
+  size_t hintsIdx = 0;
+  for (Message::Payload& payload : message.payloads) {
+    payload.allocationHints = hints[hintsIdx++];
+  }
+  for (Message::Tensor& tensor : message.tensors) {
+    tensor.allocationHints = hints[hintsIdx++];
+  }
+}
+
+// The buffers are freed once the message is out.
+void writeMessage(Pipe& pipe, Message message, TBuffers buffers) {
+  pipe.write(
+      std::move(message),
+      [buffers{std::move(buffers)}](
+          const Error& error, Message /* unused */) mutable {
+        buffers.clear();
+        if (error) {
+          TP_VLOG(2) << "Relay couldn't forward a message (" << error.what()
+                     << ")";
+        }
+      });
+}
+
+} // namespace
+
+class Relay::Impl : public std::enable_shared_from_this<Relay::Impl> {
+ public:
+  explicit Impl(std::shared_ptr<Context> context);
+
+  void init(const std::vector<std::string>& urls);
+
+  std::string url(const std::string& transport) const;
+
+  void close();
+
+ private:
+  // A pipe to another relay, carrying the streams between the processes of the
+  // two nodes. Each stream goes to a pipe to a local process, which is the one
+  // that asked for it if this relay opened the stream, or its target if not.
+  struct Peer {
+    std::shared_ptr<Pipe> pipe;
+    // The URL of the other relay, if this relay connected to it, in which case
+    // the peer is shared by all the streams this relay opens to that one.
+    std::string url;
+    std::unordered_map<uint64_t, std::shared_ptr<Pipe>> streams;
+    uint64_t nextStreamId{0};
+  };
+
+  using TReadCallback = std::function<void(const Error&, Message, TBuffers)>;
+
+  const std::shared_ptr<Context> context_;
+  std::shared_ptr<Listener> listener_;
+
+  // The pipes don't call back into the relay while they're being connected or
+  // written to, but they may do so inline when they're closed, hence they are
+  // only closed once the mutex is released.
+  mutable std::mutex mutex_;
+  bool closed_{false};
+  // All the pipes that are open, to be closed along with the relay.
+  std::unordered_set<std::shared_ptr<Pipe>> pipes_;
+  std::unordered_map<std::string, std::shared_ptr<Peer>> outgoingPeers_;
+
+  void acceptNext();
+
+  // Return whether the relay is still open, and close the pipe otherwise.
+  bool addPipe(std::shared_ptr<Pipe> pipe);
+  // Return null if the relay is closed.
+  std::shared_ptr<Pipe> connect(const std::string& url);
+  void removePipe(const std::shared_ptr<Pipe>& pipe);
+  std::shared_ptr<Pipe> removeStream(Peer& peer, uint64_t streamId);
+
+  void readMessage(const std::shared_ptr<Pipe>& pipe, TReadCallback fn);
+
+  void onFirstMessage(std::shared_ptr<Pipe> pipe, const Message& message);
+  void openLink(std::shared_ptr<Pipe> pipe, const std::string& targetUrl);
+  void openStream(
+      std::shared_ptr<Pipe> pipe,
+      const std::string& remoteRelayUrl,
+      const std::string& targetUrl);
+  void onOpen(
+      std::shared_ptr<Peer> peer,
+      uint64_t streamId,
+      const std::string& targetUrl);
+  void onPeerError(std::shared_ptr<Peer> peer);
+
+  void forwardToPipe(std::shared_ptr<Pipe> from, std::shared_ptr<Pipe> to);
+  void forwardToPeer(
+      std::shared_ptr<Pipe> from,
+      std::shared_ptr<Peer> peer,
+      uint64_t streamId);
+  void forwardFromPeer(std::shared_ptr<Peer> peer);
+};
+
+Relay::Impl::Impl(std::shared_ptr<Context> context)
+    : context_(std::move(context)) {}
+
+void Relay::Impl::init(const std::vector<std::string>& urls) {
+  listener_ = context_->listen(urls);
+  acceptNext();
+}
+
+std::string Relay::Impl::url(const std::string& transport) const {
+  return listener_->url(transport);
+}
+
+void Relay::Impl::close() {
+  std::unordered_set<std::shared_ptr<Pipe>> pipes;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (closed_) {
+      return;
+    }
+    closed_ = true;
+    pipes = std::move(pipes_);
+    pipes_.clear();
+    outgoingPeers_.clear();
+  }
+  listener_->close();
+  for (const std::shared_ptr<Pipe>& pipe : pipes) {
+    pipe->close();
+  }
+}
+
+void Relay::Impl::acceptNext() {
+  listener_->accept([this, self{shared_from_this()}](
+                        const Error& error, std::shared_ptr<Pipe> pipe) {
+    if (error) {
+      TP_VLOG(1) << "Relay stopped accepting pipes (" << error.what() << ")";
+      return;
+    }
+    if (!addPipe(pipe)) {
+      return;
+    }
+    readMessage(
+        pipe,
+        [this, self, pipe](
+            const Error& error, Message message, TBuffers /* unused */) {
+          if (error) {
+            removePipe(pipe);
+            return;
+          }
+          onFirstMessage(std::move(pipe), message);
+        });
+    acceptNext();
+  });
+}
+
+bool Relay::Impl::addPipe(std::shared_ptr<Pipe> pipe) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!closed_) {
+      pipes_.insert(std::move(pipe));
+      return true;
+    }
+  }
+  pipe->close();
+  return false;
+}
+
+std::shared_ptr<Pipe> Relay::Impl::connect(const std::string& url) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (closed_) {
+    return nullptr;
+  }
+  std::shared_ptr<Pipe> pipe = context_->connect(url);
+  pipes_.insert(pipe);
+  return pipe;
+}
+
+void Relay::Impl::removePipe(const std::shared_ptr<Pipe>& pipe) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    pipes_.erase(pipe);
+  }
+  pipe->close();
+}
+
+std::shared_ptr<Pipe> Relay::Impl::removeStream(Peer& peer, uint64_t streamId) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto iter = peer.streams.find(streamId);
+  if (iter == peer.streams.end()) {
+    return nullptr;
+  }
+  std::shared_ptr<Pipe> pipe = std::move(iter->second);
+  peer.streams.erase(iter);
+  return pipe;
+}
+
+void Relay::Impl::readMessage(
+    const std::shared_ptr<Pipe>& pipe,
+    TReadCallback fn) {
+  auto buffers = std::make_shared<TBuffers>();
+  pipe->read(
+      [buffers](Message& message) { allocateMessage(message, *buffers); },
+      [buffers, fn{std::move(fn)}](const Error& error, Message message) {
+        fn(error, std::move(message), std::move(*buffers));
+      });
+}
+
+void Relay::Impl::onFirstMessage(
+    std::shared_ptr<Pipe> pipe,
+    const Message& message) {
+  std::string remoteRelayUrl;
+  std::string targetUrl;
+  if (decodeHello(message.metadata, remoteRelayUrl, targetUrl)) {
+    if (remoteRelayUrl.empty()) {
+      openLink(std::move(pipe), targetUrl);
+    } else {
+      openStream(std::move(pipe), remoteRelayUrl, targetUrl);
+    }
+    return;
+  }
+
+  char kind;
+  uint64_t streamId;
+  std::string rest;
+  if (decodeFrame(message.metadata, kind, streamId, rest) && kind == kOpen) {
+    auto peer = std::make_shared<Peer>();
+    peer->pipe = std::move(pipe);
+    onOpen(peer, streamId, rest);
+    forwardFromPeer(std::move(peer));
+    return;
+  }
+
+  TP_LOG_WARNING() << "Relay got a pipe that was neither from a local process "
+                   << "nor from another relay";
+  removePipe(pipe);
+}
+
+void Relay::Impl::openLink(
+    std::shared_ptr<Pipe> pipe,
+    const std::string& targetUrl) {
+  std::shared_ptr<Pipe> targetPipe = connect(targetUrl);
+  if (targetPipe == nullptr) {
+    removePipe(pipe);
+    return;
+  }
+  forwardToPipe(pipe, targetPipe);
+  forwardToPipe(std::move(targetPipe), std::move(pipe));
+}
+
+void Relay::Impl::openStream(
+    std::shared_ptr<Pipe> pipe,
+    const std::string& remoteRelayUrl,
+    const std::string& targetUrl) {
+  std::shared_ptr<Peer> peer;
+  uint64_t streamId;
+  bool isNewPeer = false;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!closed_) {
+      std::shared_ptr<Peer>& peerRef = outgoingPeers_[remoteRelayUrl];
+      if (peerRef == nullptr) {
+        peerRef = std::make_shared<Peer>();
+        peerRef->pipe = context_->connect(remoteRelayUrl);
+        peerRef->url = remoteRelayUrl;
+        pipes_.insert(peerRef->pipe);
+        isNewPeer = true;
+      }
+      peer = peerRef;
+      streamId = peer->nextStreamId++;
+      peer->streams.emplace(streamId, pipe);
+    }
+  }
+  if (peer == nullptr) {
+    removePipe(pipe);
+    return;
+  }
+
+  TP_VLOG(2) << "Relay is opening stream #" << streamId << " to "
+             << remoteRelayUrl << " for " << targetUrl;
+  Message message;
+  message.metadata = encodeFrame(kOpen, streamId, targetUrl);
+  writeMessage(*peer->pipe, std::move(message), TBuffers());
+  if (isNewPeer) {
+    forwardFromPeer(peer);
+  }
+  forwardToPeer(std::move(pipe), std::move(peer), streamId);
+}
+
+void Relay::Impl::onOpen(
+    std::shared_ptr<Peer> peer,
+    uint64_t streamId,
+    const std::string& targetUrl) {
+  std::shared_ptr<Pipe> pipe = connect(targetUrl);
+  if (pipe == nullptr) {
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    peer->streams.emplace(streamId, pipe);
+  }
+  forwardToPeer(std::move(pipe), std::move(peer), streamId);
+}
+
+void Relay::Impl::onPeerError(std::shared_ptr<Peer> peer) {
+  std::unordered_map<uint64_t, std::shared_ptr<Pipe>> streams;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    streams = std::move(peer->streams);
+    peer->streams.clear();
+    if (!peer->url.empty()) {
+      auto iter = outgoingPeers_.find(peer->url);
+      if (iter != outgoingPeers_.end() && iter->second == peer) {
+        outgoingPeers_.erase(iter);
+      }
+    }
+  }
+  removePipe(peer->pipe);
+  for (auto& iter : streams) {
+    removePipe(iter.second);
+  }
+}
+
+void Relay::Impl::forwardToPipe(
+    std::shared_ptr<Pipe> from,
+    std::shared_ptr<Pipe> to) {
+  readMessage(
+      from,
+      [this, self{shared_from_this()}, from, to](
+          const Error& error, Message message, TBuffers buffers) {
+        if (error) {
+          removePipe(from);
+          removePipe(to);
+          return;
+        }
+        writeMessage(*to, std::move(message), std::move(buffers));
+        forwardToPipe(std::move(from), std::move(to));
+      });
+}
+
+void Relay::Impl::forwardToPeer(
+    std::shared_ptr<Pipe> from,
+    std::shared_ptr<Peer> peer,
+    uint64_t streamId) {
+  readMessage(
+      from,
+      [this, self{shared_from_this()}, from, peer, streamId](
+          const Error& error, Message message, TBuffers buffers) {
+        if (error) {
+          // The stream is already gone if the other end closed it first.
+          if (removeStream(*peer, streamId) != nullptr) {
+            Message closeMessage;
+            closeMessage.metadata = encodeFrame(kClose, streamId, "");
+            writeMessage(*peer->pipe, std::move(closeMessage), TBuffers());
+          }
+          removePipe(from);
+          return;
+        }
+        message.metadata = encodeFrame(kData, streamId, message.metadata);
+        writeMessage(*peer->pipe, std::move(message), std::move(buffers));
+        forwardToPeer(std::move(from), std::move(peer), streamId);
+      });
+}
+
+void Relay::Impl::forwardFromPeer(std::shared_ptr<Peer> peer) {
+  readMessage(
+      peer->pipe,
+      [this, self{shared_from_this()}, peer](
+          const Error& error, Message message, TBuffers buffers) {
+        if (error) {
+          onPeerError(std::move(peer));
+          return;
+        }
+        char kind;
+        uint64_t streamId;
+        std::string rest;
+        if (!decodeFrame(message.metadata, kind, streamId, rest)) {
+          TP_LOG_WARNING()
+              << "Relay got a malformed message from another relay";
+          onPeerError(std::move(peer));
+          return;
+        }
+        if (kind == kOpen) {
+          onOpen(peer, streamId, rest);
+        } else if (kind == kData) {
+          std::shared_ptr<Pipe> pipe;
+          {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto iter = peer->streams.find(streamId);
+            if (iter != peer->streams.end()) {
+              pipe = iter->second;
+            }
+          }
+          // Otherwise the stream was closed on this end meanwhile.
+          if (pipe != nullptr) {
+            message.metadata = std::move(rest);
+            writeMessage(*pipe, std::move(message), std::move(buffers));
+          }
+        } else if (kind == kClose) {
+          std::shared_ptr<Pipe> pipe = removeStream(*peer, streamId);
+          if (pipe != nullptr) {
+            removePipe(pipe);
+          }
+        } else {
+          TP_LOG_WARNING() << "Relay got a message of unknown kind " << kind
+                           << " from another relay";
+          onPeerError(std::move(peer));
+          return;
+        }
+        forwardFromPeer(std::move(peer));
+      });
+}
+
+Relay::Relay(
+    std::shared_ptr<Context> context,
+    const std::vector<std::string>& urls)
+    : impl_(std::make_shared<Impl>(std::move(context))) {
+  impl_->init(urls);
+}
+
+std::string Relay::url(const std::string& transport) const {
+  return impl_->url(transport);
+}
+
+void Relay::close() {
+  impl_->close();
+}
+
+Relay::~Relay() {
+  close();
+}
+
+std::shared_ptr<Pipe> connectThroughRelay(
+    Context& context,
+    const std::string& relayUrl,
+    const std::string& remoteRelayUrl,
+    const std::string& targetUrl,
+    PipeOptions options) {
+  std::shared_ptr<Pipe> pipe = context.connect(relayUrl, std::move(options));
+  Message message;
+  message.metadata = encodeHello(remoteRelayUrl, targetUrl);
+  pipe->write(
+      std::move(message),
+      [](const Error& /* unused */, Message /* unused */) {});
+  return pipe;
+}
+
+} // namespace tensorpipe
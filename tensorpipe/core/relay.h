@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/core/context.h>
+
+namespace tensorpipe {
+
+class Pipe;
+
+// The relay.
+//
+// A relay lets the processes of a node share the resources needed to reach
+// other nodes (e.g., the InfiniBand devices, their queue pairs and registered
+// memory, and the threads that busy-poll them), which are then only set up by
+// the process that runs the relay, rather than by each of them. The other
+// processes register the transports and channels that are cheap to use within
+// a node (e.g., shm and cma, or cuda_ipc for the data on GPU), connect to the
+// relay of their node through them (see connectThroughRelay), and it forwards
+// their messages to the relay of the node of their target, which delivers them
+// to it (and the replies back the same way). The relays of two nodes share a
+// single pipe, over which the messages of all the pipes between their local
+// processes go, hence the number of cross-node connections no longer grows
+// with the number of processes per node.
+//
+// The target sees a regular pipe, coming from its own relay, and an extra hop
+// per relay is the price for the savings: the messages are received, in full,
+// into buffers allocated by the relay (which honors their AllocationHints) and
+// then written out again. Only the messages themselves go through, hence the
+// options of the pipe (and the handing off of tensors, etcetera) apply to each
+// of the hops separately.
+//
+// The relay listens on the given URLs of its context, typically one for the
+// local processes (e.g., "shm://...") and one for the other relays (e.g.,
+// "ibv://..."). It keeps going until it's closed or destroyed, which closes
+// the pipes going through it too, and it doesn't close its context.
+class Relay final {
+ public:
+  Relay(std::shared_ptr<Context> context, const std::vector<std::string>& urls);
+
+  // Return the address on which the relay listens for the given transport.
+  std::string url(const std::string& transport) const;
+
+  void close();
+
+  ~Relay();
+
+ private:
+  class Impl;
+
+  std::shared_ptr<Impl> impl_;
+};
+
+// Open a pipe (from a context of a process of the node whose relay listens on
+// relayUrl) to the process listening on targetUrl, which is on the node whose
+// relay listens on remoteRelayUrl. If that is empty, the target is reached by
+// the local relay directly. The pipe can then be used as any other, except
+// that the process is seen by the target as its relay.
+std::shared_ptr<Pipe> connectThroughRelay(
+    Context& context,
+    const std::string& relayUrl,
+    const std::string& remoteRelayUrl,
+    const std::string& targetUrl,
+    PipeOptions options = PipeOptions());
+
+} // namespace tensorpipe
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/stats.h>
+
+namespace tensorpipe {
+
+namespace {
+
+void mergeByteCounts(
+    std::map<std::string, uint64_t>& target,
+    const std::map<std::string, uint64_t>& source) {
+  for (const auto& iter : source) {
+    target[iter.first] += iter.second;
+  }
+}
+
+} // namespace
+
+void PipeStats::merge(const PipeStats& other) {
+  connectBrochureAnswerRead.merge(other.connectBrochureAnswerRead);
+  connectEstablished.merge(other.connectEstablished);
+  acceptBrochureRead.merge(other.acceptBrochureRead);
+  acceptEstablished.merge(other.acceptEstablished);
+  writeTensorDescriptorsCollected.merge(other.writeTensorDescriptorsCollected);
+  writePayloadsWritten.merge(other.writePayloadsWritten);
+  writeTensorsSent.merge(other.writeTensorsSent);
+  writeCallbackInvoked.merge(other.writeCallbackInvoked);
+  readDescriptorRead.merge(other.readDescriptorRead);
+  readPayloadsRead.merge(other.readPayloadsRead);
+  readTensorsReceived.merge(other.readTensorsReceived);
+  readCallbackInvoked.merge(other.readCallbackInvoked);
+  callbackRunTime.merge(other.callbackRunTime);
+  numMessagesWritten += other.numMessagesWritten;
+  numMessagesRead += other.numMessagesRead;
+  mergeByteCounts(
+      payloadBytesWrittenPerTransport, other.payloadBytesWrittenPerTransport);
+  mergeByteCounts(
+      payloadBytesReadPerTransport, other.payloadBytesReadPerTransport);
+  mergeByteCounts(tensorBytesSentPerChannel, other.tensorBytesSentPerChannel);
+  mergeByteCounts(
+      tensorBytesReceivedPerChannel, other.tensorBytesReceivedPerChannel);
+  tensorBytesDeduplicatedSent += other.tensorBytesDeduplicatedSent;
+  tensorBytesDeduplicatedReceived += other.tensorBytesDeduplicatedReceived;
+}
+
+} // namespace tensorpipe
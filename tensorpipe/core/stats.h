@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include <tensorpipe/common/duration_histogram.h>
+
+namespace tensorpipe {
+
+// The statistics of a pipe, or the aggregated ones of all the pipes of a
+// context, gathered only when enabled through the context options.
+//
+// Latencies are only recorded for operations that succeeded. Each one measures
+// the time from the moment the user called the operation to the moment a given
+// stage completed, hence the stages of a same operation can be compared.
+struct PipeStats {
+  // Measured from the creation of the pipe, on the side that connected, to
+  // the read of the answer to its brochure and to the pipe being established
+  // (the connections of the channels having been opened by then).
+  DurationHistogram connectBrochureAnswerRead;
+  DurationHistogram connectEstablished;
+
+  // Measured from the creation of the pipe, on the side that accepted it, to
+  // the read of the brochure and to the pipe being established (i.e., once the
+  // connections requested for the channels have been accepted).
+  DurationHistogram acceptBrochureRead;
+  DurationHistogram acceptEstablished;
+
+  // Measured from the call to write.
+  DurationHistogram writeTensorDescriptorsCollected;
+  DurationHistogram writePayloadsWritten;
+  DurationHistogram writeTensorsSent;
+  DurationHistogram writeCallbackInvoked;
+
+  // Measured from the call to readDescriptor.
+  DurationHistogram readDescriptorRead;
+
+  // Measured from the call to read.
+  DurationHistogram readPayloadsRead;
+  DurationHistogram readTensorsReceived;
+  DurationHistogram readCallbackInvoked;
+
+  // How long the callbacks of the user took to run, wherever they ran. Those
+  // that run inline (see ContextOptions::callbackExecutor) block the pipe's
+  // loop, and those of all the pipes that share it, for that long.
+  DurationHistogram callbackRunTime;
+
+  uint64_t numMessagesWritten{0};
+  uint64_t numMessagesRead{0};
+
+  // Bytes of payloads and inlined tensors, which go through the pipe's
+  // connection, by the name of the transport that was used for it.
+  std::map<std::string, uint64_t> payloadBytesWrittenPerTransport;
+  std::map<std::string, uint64_t> payloadBytesReadPerTransport;
+
+  // Bytes of tensors by the name of the channel that was used for them.
+  std::map<std::string, uint64_t> tensorBytesSentPerChannel;
+  std::map<std::string, uint64_t> tensorBytesReceivedPerChannel;
+
+  // Bytes of tensors that weren't transferred, as the receiver had them in its
+  // cache already (see PipeOptions::tensorDedup).
+  uint64_t tensorBytesDeduplicatedSent{0};
+  uint64_t tensorBytesDeduplicatedReceived{0};
+
+  // Add all the statistics of the other object to this one.
+  void merge(const PipeStats& other);
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/tensor_dedup.h>
+
+#include <iterator>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+TensorDedupCache::TensorDedupCache(size_t capacity, bool holdsData)
+    : capacity_(capacity), holdsData_(holdsData) {
+  TP_DCHECK_GT(capacity_, 0);
+}
+
+std::shared_ptr<TensorDedupCache::Entry> TensorDedupCache::find(
+    size_t length,
+    uint64_t hash) {
+  auto iter = index_.find(TKey(length, hash));
+  if (iter == index_.end()) {
+    return nullptr;
+  }
+  entries_.splice(entries_.begin(), entries_, iter->second);
+  return iter->second->second;
+}
+
+std::shared_ptr<TensorDedupCache::Entry> TensorDedupCache::insert(
+    size_t length,
+    uint64_t hash) {
+  if (length > capacity_) {
+    return nullptr;
+  }
+  const TKey key(length, hash);
+  auto iter = index_.find(key);
+  if (iter != index_.end()) {
+    erase(iter->second);
+  }
+  while (numBytes_ + length > capacity_) {
+    erase(std::prev(entries_.end()));
+  }
+  auto entry = std::make_shared<Entry>();
+  entry->length = length;
+  if (holdsData_) {
+    entry->data = std::make_unique<uint8_t[]>(length);
+  }
+  entries_.emplace_front(key, entry);
+  index_.emplace(key, entries_.begin());
+  numBytes_ += length;
+  return entry;
+}
+
+void TensorDedupCache::erase(TEntries::iterator iter) {
+  numBytes_ -= iter->second->length;
+  index_.erase(iter->first);
+  entries_.erase(iter);
+}
+
+} // namespace tensorpipe
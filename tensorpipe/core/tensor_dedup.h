@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace tensorpipe {
+
+// How a CPU tensor of a pipe that deduplicates them (see
+// PipeOptions::tensorDedup) relates to the cache of the receiver: it either
+// isn't involved, or it goes through a channel as usual and is then stored in
+// the cache, or its contents were there already and it's copied from it.
+enum class TensorDedup : uint8_t {
+  kNone = 0,
+  kStore = 1,
+  kHit = 2,
+};
+
+// The contents of the recent tensors that went through a pipe, by their length
+// and hash, bounded by their total size and evicting the least recently used
+// ones to make room. Each end of the pipe keeps one for the tensors it writes,
+// which holds no data, and one for those it reads, which does: as the writer
+// applies the same lookups and insertions to its own, in the order of the
+// tensors in the messages, which the reader follows too, they always agree on
+// which contents the reader has, without the latter ever telling. This class
+// isn't thread-safe.
+class TensorDedupCache {
+ public:
+  struct Entry {
+    // Null in the caches that hold no data.
+    std::unique_ptr<uint8_t[]> data;
+    size_t length{0};
+    // Whether the data was received already. Until then, the tensors that
+    // would copy it wait in here, and are called once it's there (or once it
+    // won't ever be, as the pipe failed).
+    bool isReady{false};
+    std::vector<std::function<void()>> waiters;
+  };
+
+  TensorDedupCache(size_t capacity, bool holdsData);
+
+  // Return the entry with the given contents, if there is one, marking it as
+  // the most recently used one.
+  std::shared_ptr<Entry> find(size_t length, uint64_t hash);
+
+  // Add an entry for the given contents, replacing the one already there if
+  // any, and evicting the least recently used ones to make room. Return null,
+  // and store nothing, if it's larger than the whole cache. The entries that
+  // are evicted are destroyed once no one else refers to them.
+  std::shared_ptr<Entry> insert(size_t length, uint64_t hash);
+
+  // The total length of the entries that are in the cache.
+  size_t numBytes() const {
+    return numBytes_;
+  }
+
+ private:
+  using TKey = std::pair<size_t, uint64_t>;
+  using TEntries = std::list<std::pair<TKey, std::shared_ptr<Entry>>>;
+
+  const size_t capacity_;
+  const bool holdsData_;
+  size_t numBytes_{0};
+  // Ordered from the most to the least recently used.
+  TEntries entries_;
+  std::map<TKey, TEntries::iterator> index_;
+
+  void erase(TEntries::iterator iter);
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/tensor_handoff.h>
+
+#include <unistd.h>
+
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace tensorpipe {
+
+namespace {
+
+struct Registry {
+  std::mutex mutex;
+  pid_t pid{-1};
+  uint64_t processIdentifier{0};
+  uint64_t nextId{0};
+  struct Entry {
+    const void* owner;
+    HandedOffTensor tensor;
+  };
+  std::unordered_map<uint64_t, Entry> entries;
+};
+
+// It's never destroyed, so that the tensors that are still in it at exit don't
+// get released while the rest of the program is being torn down.
+Registry& getRegistry() {
+  static Registry* registry = new Registry();
+  return *registry;
+}
+
+} // namespace
+
+HandedOffTensor::HandedOffTensor(
+    void* ptr,
+    size_t length,
+    std::function<void()> release)
+    : ptr_(ptr), length_(length), release_(std::move(release)) {}
+
+HandedOffTensor::HandedOffTensor(HandedOffTensor&& other) noexcept
+    : ptr_(other.ptr_),
+      length_(other.length_),
+      release_(other.takeRelease()) {}
+
+HandedOffTensor& HandedOffTensor::operator=(HandedOffTensor&& other) noexcept {
+  if (this != &other) {
+    if (release_) {
+      release_();
+    }
+    ptr_ = other.ptr_;
+    length_ = other.length_;
+    release_ = other.takeRelease();
+  }
+  return *this;
+}
+
+std::function<void()> HandedOffTensor::takeRelease() {
+  // A moved-from function isn't guaranteed to be empty.
+  std::function<void()> release = std::move(release_);
+  release_ = nullptr;
+  return release;
+}
+
+HandedOffTensor::~HandedOffTensor() {
+  if (release_) {
+    release_();
+  }
+}
+
+uint64_t getProcessIdentifier() {
+  Registry& registry = getRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  const pid_t pid = ::getpid();
+  if (registry.pid != pid) {
+    std::random_device rd;
+    registry.pid = pid;
+    registry.processIdentifier = (static_cast<uint64_t>(rd()) << 32) | rd();
+  }
+  return registry.processIdentifier;
+}
+
+uint64_t depositHandedOffTensor(const void* owner, HandedOffTensor tensor) {
+  Registry& registry = getRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  const uint64_t id = registry.nextId++;
+  registry.entries.emplace(id, Registry::Entry{owner, std::move(tensor)});
+  return id;
+}
+
+optional<HandedOffTensor> withdrawHandedOffTensor(uint64_t id) {
+  Registry& registry = getRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  auto iter = registry.entries.find(id);
+  if (iter == registry.entries.end()) {
+    return nullopt;
+  }
+  HandedOffTensor tensor = std::move(iter->second.tensor);
+  registry.entries.erase(iter);
+  return tensor;
+}
+
+void withdrawHandedOffTensorsOf(const void* owner) {
+  Registry& registry = getRegistry();
+  // The tensors are released once the lock is dropped, as their release
+  // functions may call back into the pipes.
+  std::vector<HandedOffTensor> tensors;
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  for (auto iter = registry.entries.begin(); iter != registry.entries.end();) {
+    if (iter->second.owner == owner) {
+      tensors.push_back(std::move(iter->second.tensor));
+      iter = registry.entries.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+  lock.unlock();
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include <tensorpipe/common/optional.h>
+
+namespace tensorpipe {
+
+// The buffer of a CPU tensor that a pipe hands off to another pipe of the same
+// process (see Message::handOffTensors), with the function that releases it.
+// That function is called when this object is destroyed, unless it was taken
+// out before, in order for the buffer not to leak if the transfer fails.
+class HandedOffTensor {
+ public:
+  HandedOffTensor() = default;
+
+  HandedOffTensor(void* ptr, size_t length, std::function<void()> release);
+
+  HandedOffTensor(const HandedOffTensor&) = delete;
+  HandedOffTensor& operator=(const HandedOffTensor&) = delete;
+
+  HandedOffTensor(HandedOffTensor&& other) noexcept;
+  HandedOffTensor& operator=(HandedOffTensor&& other) noexcept;
+
+  void* ptr() const {
+    return ptr_;
+  }
+
+  size_t length() const {
+    return length_;
+  }
+
+  // Hand the responsibility of releasing the buffer over to the caller.
+  std::function<void()> takeRelease();
+
+  ~HandedOffTensor();
+
+ private:
+  void* ptr_{nullptr};
+  size_t length_{0};
+  std::function<void()> release_;
+};
+
+// A random identifier of this process, which is drawn anew in forked children,
+// so that the two ends of a pipe can find out whether they are in the same one.
+uint64_t getProcessIdentifier();
+
+// Keep the tensor in a registry of the process until the receiving pipe gets
+// it, and return the identifier under which it can do so. The owner is the
+// sending pipe, which withdraws its tensors that weren't received when it
+// fails, as the receiver then may never get them.
+uint64_t depositHandedOffTensor(const void* owner, HandedOffTensor tensor);
+
+// Take the tensor with the given identifier out of the registry, if it's there.
+optional<HandedOffTensor> withdrawHandedOffTensor(uint64_t id);
+
+// Take all the tensors of the given owner out of the registry, thus releasing
+// them.
+void withdrawHandedOffTensorsOf(const void* owner);
+
+} // namespace tensorpipe
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/tuning.h>
+
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/core/error.h>
+
+namespace tensorpipe {
+
+namespace {
+
+// Read the value, which must be the last thing on the line.
+template <typename T>
+bool parseLastValue(std::istringstream& line, T& value) {
+  if (!(line >> value)) {
+    return false;
+  }
+  std::string rest;
+  return !(line >> rest);
+}
+
+} // namespace
+
+// The setters of the options return a reference to the very same object, hence
+// the result is moved into a new one before it's assigned back.
+
+ContextOptions TuningConfig::contextOptions(ContextOptions options) const {
+  if (readAheadWindow > 0) {
+    options =
+        ContextOptions(std::move(options).readAheadWindow(readAheadWindow));
+  }
+  if (multiplexChannelConnections) {
+    options =
+        ContextOptions(std::move(options).multiplexChannelConnections(true));
+  }
+  return options;
+}
+
+PipeOptions TuningConfig::pipeOptions(PipeOptions options) const {
+  if (inlineTensorThreshold > 0) {
+    options = PipeOptions(
+        std::move(options).inlineTensorThreshold(inlineTensorThreshold));
+  }
+  if (inlinePayloadThreshold > 0) {
+    options = PipeOptions(
+        std::move(options).inlinePayloadThreshold(inlinePayloadThreshold));
+  }
+  return options;
+}
+
+int64_t TuningConfig::channelPriority(
+    const std::string& channel,
+    int64_t defaultPriority) const {
+  auto iter = channelPriorities.find(channel);
+  return iter != channelPriorities.end() ? iter->second : defaultPriority;
+}
+
+std::string formatTuningConfig(const TuningConfig& config) {
+  std::ostringstream ss;
+  if (config.readAheadWindow > 0) {
+    ss << "read_ahead_window " << config.readAheadWindow << "\n";
+  }
+  if (config.multiplexChannelConnections) {
+    ss << "multiplex_channel_connections 1\n";
+  }
+  if (config.inlineTensorThreshold > 0) {
+    ss << "inline_tensor_threshold " << config.inlineTensorThreshold << "\n";
+  }
+  if (config.inlinePayloadThreshold > 0) {
+    ss << "inline_payload_threshold " << config.inlinePayloadThreshold << "\n";
+  }
+  for (const auto& iter : config.channelPriorities) {
+    ss << "channel_priority " << iter.first << " " << iter.second << "\n";
+  }
+  if (config.shmBufferSize > 0) {
+    ss << "shm_buffer_size " << config.shmBufferSize << "\n";
+  }
+  return ss.str();
+}
+
+Error parseTuningConfig(const std::string& text, TuningConfig& config) {
+  TuningConfig parsedConfig;
+  std::istringstream lines(text);
+  std::string lineText;
+  size_t lineIdx = 0;
+  while (std::getline(lines, lineText)) {
+    lineIdx++;
+    std::istringstream line(lineText);
+    std::string key;
+    if (!(line >> key) || key[0] == '#') {
+      continue;
+    }
+    bool valid;
+    if (key == "read_ahead_window") {
+      valid = parseLastValue(line, parsedConfig.readAheadWindow);
+    } else if (key == "multiplex_channel_connections") {
+      valid = parseLastValue(line, parsedConfig.multiplexChannelConnections);
+    } else if (key == "inline_tensor_threshold") {
+      valid = parseLastValue(line, parsedConfig.inlineTensorThreshold);
+    } else if (key == "inline_payload_threshold") {
+      valid = parseLastValue(line, parsedConfig.inlinePayloadThreshold);
+    } else if (key == "channel_priority") {
+      std::string channel;
+      int64_t priority;
+      valid = (line >> channel) && parseLastValue(line, priority);
+      if (valid) {
+        parsedConfig.channelPriorities[channel] = priority;
+      }
+    } else if (key == "shm_buffer_size") {
+      valid = parseLastValue(line, parsedConfig.shmBufferSize);
+    } else {
+      return TP_CREATE_ERROR(
+          TuningConfigError,
+          "unknown knob " + key + " on line " + std::to_string(lineIdx));
+    }
+    if (!valid) {
+      return TP_CREATE_ERROR(
+          TuningConfigError,
+          "bad value for " + key + " on line " + std::to_string(lineIdx));
+    }
+  }
+  config = std::move(parsedConfig);
+  return Error::kSuccess;
+}
+
+Error loadTuningConfig(const std::string& path, TuningConfig& config) {
+  std::ifstream file(path);
+  if (!file) {
+    return TP_CREATE_ERROR(SystemError, "open", errno);
+  }
+  std::ostringstream text;
+  text << file.rdbuf();
+  if (file.bad()) {
+    return TP_CREATE_ERROR(SystemError, "read", errno);
+  }
+  return parseTuningConfig(text.str(), config);
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/core/context.h>
+
+namespace tensorpipe {
+
+// The knobs that were found to work best between two hosts (e.g., by the
+// benchmark_autotune tool), for the processes that run there to load at
+// startup rather than hardcode. The zero values leave the defaults alone.
+struct TuningConfig {
+  // See ContextOptions.
+  size_t readAheadWindow{0};
+  bool multiplexChannelConnections{false};
+
+  // See PipeOptions.
+  size_t inlineTensorThreshold{0};
+  size_t inlinePayloadThreshold{0};
+
+  // The priority to register each channel with, by name.
+  std::map<std::string, int64_t> channelPriorities;
+
+  // The size of the inboxes of the shm transport (see shm::Context).
+  size_t shmBufferSize{0};
+
+  // Return the options with the knobs above set.
+  ContextOptions contextOptions(
+      ContextOptions options = ContextOptions()) const;
+  PipeOptions pipeOptions(PipeOptions options = PipeOptions()) const;
+
+  // The priority of the channel, if there's one for it, or else the default.
+  int64_t channelPriority(const std::string& channel, int64_t defaultPriority)
+      const;
+};
+
+// The config is kept as text, one knob per line (its name, as in snake case,
+// followed by its value, or by a channel and its priority for those), where
+// empty lines and those that start with a # are ignored. The knobs that are
+// left out keep their zero value.
+std::string formatTuningConfig(const TuningConfig& config);
+
+Error parseTuningConfig(const std::string& text, TuningConfig& config);
+
+// Read and parse the file, which fails if it can't be read.
+Error loadTuningConfig(const std::string& path, TuningConfig& config);
+
+} // namespace tensorpipe
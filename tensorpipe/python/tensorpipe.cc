@@ -6,8 +6,10 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <pybind11/functional.h>
@@ -24,10 +26,116 @@ namespace {
 
 using tensorpipe::optional;
 
+// Holds a value that references Python objects (e.g., a callback, or a message
+// and thus its buffers) so that it can be captured by a TensorPipe callback,
+// which runs and is destroyed on a TensorPipe thread, without the GIL. The GIL
+// is only acquired to drop the references. Moving is allowed (with the GIL).
+template <typename T>
+class WithGil {
+ public:
+  explicit WithGil(T value) : value_(std::move(value)) {}
+
+  WithGil(const WithGil& other) = delete;
+
+  WithGil(WithGil&& other) = default;
+
+  WithGil& operator=(const WithGil& other) = delete;
+
+  WithGil& operator=(WithGil&& other) = delete;
+
+  ~WithGil() {
+    if (value_) {
+      py::gil_scoped_acquire acquire;
+      value_ = T();
+    }
+  }
+
+  T& get() {
+    return value_;
+  }
+
+ private:
+  T value_;
+};
+
+// Invoke a Python callback from a TensorPipe thread.
+template <typename... Args>
+void callPythonCallback(py::object& callback, Args&&... args) {
+  py::gil_scoped_acquire acquire;
+  try {
+    callback(std::forward<Args>(args)...);
+  } catch (const py::error_already_set& err) {
+    TP_LOG_ERROR() << "Callback raised exception: " << err.what();
+  }
+}
+
+void completeFuture(
+    py::object future,
+    py::object exception,
+    py::object result) {
+  // The future may have been cancelled in the meantime.
+  if (future.attr("done")().cast<bool>()) {
+    return;
+  }
+  if (!exception.is_none()) {
+    future.attr("set_exception")(exception);
+  } else {
+    future.attr("set_result")(result);
+  }
+}
+
+// An asyncio future, created on the event loop running on the calling thread,
+// which is completed from a TensorPipe thread by scheduling that on the loop
+// (as the futures themselves aren't thread-safe).
+class AsyncioFuture {
+ public:
+  AsyncioFuture()
+      : loop_(py::module::import("asyncio").attr("get_running_loop")()),
+        future_(loop_.get().attr("create_future")()) {}
+
+  py::object getFuture() {
+    return future_.get();
+  }
+
+  // Complete the future, from a TensorPipe thread, with None or with the given
+  // value (converted to Python while holding the GIL).
+  void setResult() {
+    py::gil_scoped_acquire acquire;
+    schedule(py::none(), py::none());
+  }
+
+  template <typename T>
+  void setResult(T result) {
+    py::gil_scoped_acquire acquire;
+    schedule(py::none(), py::cast(std::move(result)));
+  }
+
+  void setError(const tensorpipe::Error& error) {
+    py::gil_scoped_acquire acquire;
+    schedule(
+        py::reinterpret_borrow<py::object>(PyExc_RuntimeError)(error.what()),
+        py::none());
+  }
+
+ private:
+  WithGil<py::object> loop_;
+  WithGil<py::object> future_;
+
+  void schedule(py::object exception, py::object result) {
+    try {
+      loop_.get().attr("call_soon_threadsafe")(
+          py::cpp_function(&completeFuture), future_.get(), exception, result);
+    } catch (const py::error_already_set& err) {
+      // E.g., the loop has been closed.
+      TP_LOG_ERROR() << "Couldn't complete future: " << err.what();
+    }
+  }
+};
+
 // RAII wrapper to reliably release every buffer we get.
 class BufferWrapper {
  public:
-  BufferWrapper(const py::buffer& buffer, int flags) {
+  BufferWrapper(const py::handle& buffer, int flags) {
     if (PyObject_GetBuffer(buffer.ptr(), &buffer_, flags) != 0) {
       throw py::error_already_set();
     }
@@ -41,7 +149,10 @@ class BufferWrapper {
 
   BufferWrapper& operator=(BufferWrapper&& other) = delete;
 
+  // The buffers are held until the operations that use them complete, hence
+  // they may be released on a TensorPipe thread.
   ~BufferWrapper() {
+    py::gil_scoped_acquire acquire;
     PyBuffer_Release(&buffer_);
   }
 
@@ -67,6 +178,130 @@ class BufferWrapper {
   Py_buffer buffer_;
 };
 
+// The subset of the DLPack ABI (see https://github.com/dmlc/dlpack) that is
+// needed to access the memory of the tensors of other libraries.
+struct DLDevice {
+  int32_t deviceType;
+  int32_t deviceId;
+};
+
+struct DLDataType {
+  uint8_t code;
+  uint8_t bits;
+  uint16_t lanes;
+};
+
+struct DLTensor {
+  void* data;
+  DLDevice device;
+  int32_t ndim;
+  DLDataType dtype;
+  int64_t* shape;
+  int64_t* strides;
+  uint64_t byteOffset;
+};
+
+struct DLManagedTensor {
+  DLTensor dlTensor;
+  void* managerCtx;
+  void (*deleter)(DLManagedTensor* self);
+};
+
+constexpr int32_t kDLCPU = 1;
+
+// RAII wrapper around the tensor exported by an object's __dlpack__ method,
+// which gives access to its memory without copying.
+class DLPackWrapper {
+ public:
+  explicit DLPackWrapper(const py::object& object) {
+    py::object capsule = object.attr("__dlpack__")();
+    void* ptr = PyCapsule_GetPointer(capsule.ptr(), "dltensor");
+    if (ptr == nullptr) {
+      throw py::error_already_set();
+    }
+    // Take ownership of the tensor, so that the capsule won't free it.
+    if (PyCapsule_SetName(capsule.ptr(), "used_dltensor") != 0) {
+      throw py::error_already_set();
+    }
+    tensor_.reset(static_cast<DLManagedTensor*>(ptr));
+
+    const DLTensor& tensor = tensor_->dlTensor;
+    TP_THROW_ASSERT_IF(tensor.device.deviceType != kDLCPU)
+        << "Only CPU tensors are supported";
+    size_t numElements = 1;
+    for (int32_t dim = tensor.ndim - 1; dim >= 0; dim--) {
+      TP_THROW_ASSERT_IF(
+          tensor.strides != nullptr && tensor.shape[dim] != 1 &&
+          tensor.strides[dim] != static_cast<int64_t>(numElements))
+          << "Only contiguous tensors are supported";
+      numElements *= tensor.shape[dim];
+    }
+    length_ =
+        numElements * ((tensor.dtype.bits * tensor.dtype.lanes + 7) / 8);
+  }
+
+  void* ptr() const {
+    return reinterpret_cast<uint8_t*>(tensor_->dlTensor.data) +
+        tensor_->dlTensor.byteOffset;
+  }
+
+  size_t length() const {
+    return length_;
+  }
+
+ private:
+  struct Deleter {
+    void operator()(DLManagedTensor* tensor) {
+      if (tensor->deleter != nullptr) {
+        py::gil_scoped_acquire acquire;
+        tensor->deleter(tensor);
+      }
+    }
+  };
+
+  std::unique_ptr<DLManagedTensor, Deleter> tensor_;
+  size_t length_{0};
+};
+
+// The memory of a tensor, obtained without copying, either through the buffer
+// protocol or, for objects that don't support it (e.g., PyTorch tensors),
+// through DLPack.
+class TensorBufferWrapper {
+ public:
+  TensorBufferWrapper(const py::object& object, int flags) {
+    if (PyObject_CheckBuffer(object.ptr())) {
+      buffer_.emplace(object, flags);
+    } else if (py::hasattr(object, "__dlpack__")) {
+      dlpack_.emplace(object);
+    } else {
+      TP_THROW_ASSERT()
+          << "Tensors must support either the buffer protocol or DLPack";
+    }
+  }
+
+  void* ptr() const {
+    return buffer_.has_value() ? buffer_->ptr() : dlpack_->ptr();
+  }
+
+  size_t length() const {
+    return buffer_.has_value() ? buffer_->length() : dlpack_->length();
+  }
+
+  py::buffer_info getBuffer() {
+    return py::buffer_info(
+        ptr(),
+        1,
+        py::format_descriptor<unsigned char>::format(),
+        1,
+        {length()},
+        {1});
+  }
+
+ private:
+  optional<BufferWrapper> buffer_;
+  optional<DLPackWrapper> dlpack_;
+};
+
 class OutgoingPayload {
  public:
   BufferWrapper buffer;
@@ -78,10 +313,10 @@ class OutgoingPayload {
 
 class OutgoingTensor {
  public:
-  BufferWrapper buffer;
+  TensorBufferWrapper buffer;
   BufferWrapper metadata;
 
-  OutgoingTensor(const py::buffer& buffer, const py::buffer& metadata)
+  OutgoingTensor(const py::object& buffer, const py::buffer& metadata)
       : buffer(buffer, PyBUF_SIMPLE), metadata(metadata, PyBUF_SIMPLE) {}
 };
 
@@ -147,13 +382,13 @@ class IncomingPayload {
 class IncomingTensor {
  public:
   size_t length;
-  optional<BufferWrapper> buffer;
+  optional<TensorBufferWrapper> buffer;
   py::bytes metadata;
 
   IncomingTensor(size_t length, py::bytes metadata)
       : length(length), metadata(metadata) {}
 
-  void set_buffer(const py::buffer& pyBuffer) {
+  void set_buffer(const py::object& pyBuffer) {
     TP_THROW_ASSERT_IF(buffer.has_value()) << "Buffer already set";
     buffer.emplace(pyBuffer, PyBUF_SIMPLE | PyBUF_WRITABLE);
     if (buffer->length() != length) {
@@ -245,7 +480,7 @@ PYBIND11_MODULE(pytensorpipe, module) {
       py::arg("metadata"));
   shared_ptr_class_<OutgoingTensor> outgoingTensor(module, "OutgoingTensor");
   outgoingTensor.def(
-      py::init<py::buffer, py::buffer>(),
+      py::init<py::object, py::buffer>(),
       py::arg("buffer"),
       py::arg("metadata"));
   shared_ptr_class_<OutgoingMessage> outgoingMessage(module, "OutgoingMessage");
@@ -302,6 +537,13 @@ PYBIND11_MODULE(pytensorpipe, module) {
         return context->connect(url);
       },
       py::arg("url"));
+  context.def(
+      "warm_pipes",
+      [](std::shared_ptr<tensorpipe::Context> context,
+         const std::string& url,
+         size_t numPipes) { context->warmPipes(url, numPipes); },
+      py::arg("url"),
+      py::arg("num_pipes"));
 
   context.def(
       "join",
@@ -313,78 +555,65 @@ PYBIND11_MODULE(pytensorpipe, module) {
   listener.def(
       "listen",
       [](std::shared_ptr<tensorpipe::Listener> listener, py::object callback) {
-        listener->accept([callback{std::move(callback)}](
+        // The accept callback must be copyable.
+        auto pyCallback =
+            std::make_shared<WithGil<py::object>>(std::move(callback));
+        py::gil_scoped_release release;
+        listener->accept([pyCallback{std::move(pyCallback)}](
                              const tensorpipe::Error& error,
-                             std::shared_ptr<tensorpipe::Pipe> pipe) mutable {
+                             std::shared_ptr<tensorpipe::Pipe> pipe) {
           if (error) {
             TP_LOG_ERROR() << error.what();
             return;
           }
           TP_THROW_ASSERT_IF(!pipe) << "No pipe";
-          py::gil_scoped_acquire acquire;
-          try {
-            callback(std::move(pipe));
-          } catch (const py::error_already_set& err) {
-            TP_LOG_ERROR() << "Callback raised exception: " << err.what();
-          }
-          // Leaving the scope will decrease the refcount of callback which
-          // may cause it to get destructed, which might segfault since we
-          // won't be holding the GIL anymore. So we reset callback now,
-          // while we're still holding the GIL.
-          callback = py::object();
+          callPythonCallback(pyCallback->get(), std::move(pipe));
         });
       });
 
   pipe.def(
       "read_descriptor",
       [](std::shared_ptr<tensorpipe::Pipe> pipe, py::object callback) {
-        pipe->readDescriptor([callback{std::move(callback)}](
+        WithGil<py::object> pyCallback(std::move(callback));
+        py::gil_scoped_release release;
+        pipe->readDescriptor([pyCallback{std::move(pyCallback)}](
                                  const tensorpipe::Error& error,
                                  tensorpipe::Message message) mutable {
           if (error) {
             TP_LOG_ERROR() << error.what();
             return;
           }
+          // The metadata are turned into Python objects, which needs the GIL.
           py::gil_scoped_acquire acquire;
-          try {
-            callback(prepareToAllocate(std::move(message)));
-          } catch (const py::error_already_set& err) {
-            TP_LOG_ERROR() << "Callback raised exception: " << err.what();
-          }
-          // Leaving the scope will decrease the refcount of callback which
-          // may cause it to get destructed, which might segfault since we
-          // won't be holding the GIL anymore. So we reset callback now,
-          // while we're still holding the GIL.
-          callback = py::object();
+          callPythonCallback(
+              pyCallback.get(), prepareToAllocate(std::move(message)));
         });
       });
 
+  // The message is kept alive until the operation completes, since the buffers
+  // that it references are used in place.
+
   pipe.def(
       "read",
       [](std::shared_ptr<tensorpipe::Pipe> pipe,
          std::shared_ptr<IncomingMessage> pyMessage,
          py::object callback) {
-        tensorpipe::Message tpMessage = prepareToRead(std::move(pyMessage));
+        tensorpipe::Message tpMessage = prepareToRead(pyMessage);
+        WithGil<std::shared_ptr<IncomingMessage>> pyMessageHolder(
+            std::move(pyMessage));
+        WithGil<py::object> pyCallback(std::move(callback));
+        py::gil_scoped_release release;
         pipe->read(
             std::move(tpMessage),
-            [callback{std::move(callback)}](
+            [pyMessageHolder{std::move(pyMessageHolder)},
+             pyCallback{std::move(pyCallback)}](
                 const tensorpipe::Error& error,
-                tensorpipe::Message tpMessage) mutable {
+                tensorpipe::Message /* unused */) mutable {
               if (error) {
                 TP_LOG_ERROR() << error.what();
                 return;
               }
-              py::gil_scoped_acquire acquire;
-              try {
-                callback();
-              } catch (const py::error_already_set& err) {
-                TP_LOG_ERROR() << "Callback raised exception: " << err.what();
-              }
-              // Leaving the scope will decrease the refcount of callback which
-              // may cause it to get destructed, which might segfault since we
-              // won't be holding the GIL anymore. So we reset callback now,
-              // while we're still holding the GIL.
-              callback = py::object();
+              callPythonCallback(pyCallback.get());
             });
       });
 
@@ -393,28 +622,95 @@ PYBIND11_MODULE(pytensorpipe, module) {
       [](std::shared_ptr<tensorpipe::Pipe> pipe,
          std::shared_ptr<OutgoingMessage> pyMessage,
          py::object callback) {
-        tensorpipe::Message tpMessage = prepareToWrite(std::move(pyMessage));
+        tensorpipe::Message tpMessage = prepareToWrite(pyMessage);
+        WithGil<std::shared_ptr<OutgoingMessage>> pyMessageHolder(
+            std::move(pyMessage));
+        WithGil<py::object> pyCallback(std::move(callback));
+        py::gil_scoped_release release;
         pipe->write(
             std::move(tpMessage),
-            [callback{std::move(callback)}](
+            [pyMessageHolder{std::move(pyMessageHolder)},
+             pyCallback{std::move(pyCallback)}](
                 const tensorpipe::Error& error,
-                tensorpipe::Message tpMessage) mutable {
+                tensorpipe::Message /* unused */) mutable {
               if (error) {
                 TP_LOG_ERROR() << error.what();
                 return;
               }
-              py::gil_scoped_acquire acquire;
-              try {
-                callback();
-              } catch (const py::error_already_set& err) {
-                TP_LOG_ERROR() << "Callback raised exception: " << err.what();
+              callPythonCallback(pyCallback.get());
+            });
+      });
+
+  // Asyncio variants, which must be called from a coroutine and return futures
+  // to await, which fail with a RuntimeError if the operation does.
+
+  pipe.def(
+      "read_descriptor_async",
+      [](std::shared_ptr<tensorpipe::Pipe> pipe) {
+        auto future = std::make_shared<AsyncioFuture>();
+        py::object pyFuture = future->getFuture();
+        py::gil_scoped_release release;
+        pipe->readDescriptor([future{std::move(future)}](
+                                 const tensorpipe::Error& error,
+                                 tensorpipe::Message message) {
+          if (error) {
+            future->setError(error);
+            return;
+          }
+          py::gil_scoped_acquire acquire;
+          future->setResult(prepareToAllocate(std::move(message)));
+        });
+        return pyFuture;
+      });
+
+  pipe.def(
+      "read_async",
+      [](std::shared_ptr<tensorpipe::Pipe> pipe,
+         std::shared_ptr<IncomingMessage> pyMessage) {
+        tensorpipe::Message tpMessage = prepareToRead(pyMessage);
+        WithGil<std::shared_ptr<IncomingMessage>> pyMessageHolder(
+            std::move(pyMessage));
+        auto future = std::make_shared<AsyncioFuture>();
+        py::object pyFuture = future->getFuture();
+        py::gil_scoped_release release;
+        pipe->read(
+            std::move(tpMessage),
+            [pyMessageHolder{std::move(pyMessageHolder)},
+             future{std::move(future)}](
+                const tensorpipe::Error& error,
+                tensorpipe::Message /* unused */) {
+              if (error) {
+                future->setError(error);
+                return;
+              }
+              future->setResult();
+            });
+        return pyFuture;
+      });
+
+  pipe.def(
+      "write_async",
+      [](std::shared_ptr<tensorpipe::Pipe> pipe,
+         std::shared_ptr<OutgoingMessage> pyMessage) {
+        tensorpipe::Message tpMessage = prepareToWrite(pyMessage);
+        WithGil<std::shared_ptr<OutgoingMessage>> pyMessageHolder(
+            std::move(pyMessage));
+        auto future = std::make_shared<AsyncioFuture>();
+        py::object pyFuture = future->getFuture();
+        py::gil_scoped_release release;
+        pipe->write(
+            std::move(tpMessage),
+            [pyMessageHolder{std::move(pyMessageHolder)},
+             future{std::move(future)}](
+                const tensorpipe::Error& error,
+                tensorpipe::Message /* unused */) {
+              if (error) {
+                future->setError(error);
+                return;
               }
-              // Leaving the scope will decrease the refcount of callback which
-              // may cause it to get destructed, which might segfault since we
-              // won't be holding the GIL anymore. So we reset callback now,
-              // while we're still holding the GIL.
-              callback = py::object();
+              future->setResult();
             });
+        return pyFuture;
       });
 
   // Transports and channels
@@ -432,6 +728,12 @@ PYBIND11_MODULE(pytensorpipe, module) {
   shmTransport.def(py::init<>());
 #endif // TENSORPIPE_HAS_SHM_TRANSPORT
 
+#if TENSORPIPE_HAS_UDS_TRANSPORT
+  transport_class_<tensorpipe::transport::uds::Context> udsTransport(
+      module, "UdsTransport");
+  udsTransport.def(py::init<>());
+#endif // TENSORPIPE_HAS_UDS_TRANSPORT
+
   context.def(
       "register_transport",
       &tensorpipe::Context::registerTransport,
@@ -12,17 +12,29 @@
 
 // High-level API
 
+#include <tensorpipe/core/allocation_hints.h>
 #include <tensorpipe/core/buffer.h>
 #include <tensorpipe/core/context.h>
 #include <tensorpipe/core/error.h>
 #include <tensorpipe/core/listener.h>
+#include <tensorpipe/core/mesh.h>
 #include <tensorpipe/core/message.h>
 #include <tensorpipe/core/pipe.h>
+#include <tensorpipe/core/relay.h>
+#include <tensorpipe/core/stats.h>
+#include <tensorpipe/core/tuning.h>
+
+#include <tensorpipe/common/trace.h>
 
 // Transports
 
 #include <tensorpipe/transport/context.h>
 #include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/stats.h>
+
+#include <tensorpipe/transport/inproc/context.h>
+
+#include <tensorpipe/transport/sim/context.h>
 
 #include <tensorpipe/transport/uv/context.h>
 #include <tensorpipe/transport/uv/error.h>
@@ -36,6 +48,15 @@
 #include <tensorpipe/transport/ibv/error.h>
 #endif // TENSORPIPE_HAS_IBV_TRANSPORT
 
+#if TENSORPIPE_HAS_URING_TRANSPORT
+#include <tensorpipe/transport/uring/context.h>
+#include <tensorpipe/transport/uring/error.h>
+#endif // TENSORPIPE_HAS_URING_TRANSPORT
+
+#if TENSORPIPE_HAS_UDS_TRANSPORT
+#include <tensorpipe/transport/uds/context.h>
+#endif // TENSORPIPE_HAS_UDS_TRANSPORT
+
 // Channels
 
 #include <tensorpipe/channel/cpu_context.h>
@@ -44,6 +65,7 @@
 #endif // TENSORPIPE_SUPPORTS_CUDA
 
 #include <tensorpipe/channel/error.h>
+#include <tensorpipe/channel/stats.h>
 
 #include <tensorpipe/channel/basic/context.h>
 #include <tensorpipe/channel/mpt/context.h>
@@ -53,6 +75,14 @@
 #include <tensorpipe/channel/cma/context.h>
 #endif // TENSORPIPE_HAS_CMA_CHANNEL
 
+#if TENSORPIPE_HAS_SHM_ARENA_CHANNEL
+#include <tensorpipe/channel/shm_arena/context.h>
+#endif // TENSORPIPE_HAS_SHM_ARENA_CHANNEL
+
+#if TENSORPIPE_HAS_IBV_CHANNEL
+#include <tensorpipe/channel/ibv/context.h>
+#endif // TENSORPIPE_HAS_IBV_CHANNEL
+
 #if TENSORPIPE_SUPPORTS_CUDA
 #include <tensorpipe/channel/cuda_basic/context.h>
 #include <tensorpipe/channel/cuda_xth/context.h>
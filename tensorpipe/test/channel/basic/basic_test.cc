@@ -12,17 +12,32 @@
 namespace {
 
 class BasicChannelTestHelper : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ public:
+  explicit BasicChannelTestHelper(bool flowControl = false)
+      : flowControl_(flowControl) {}
+
  protected:
   std::shared_ptr<tensorpipe::channel::CpuContext> makeContextInternal(
       std::string id) override {
-    auto context = std::make_shared<tensorpipe::channel::basic::Context>();
+    auto context =
+        std::make_shared<tensorpipe::channel::basic::Context>(flowControl_);
     context->setId(std::move(id));
     return context;
   }
+
+ private:
+  const bool flowControl_;
 };
 
 BasicChannelTestHelper helper;
 
+BasicChannelTestHelper flowControlHelper(/*flowControl=*/true);
+
 } // namespace
 
 INSTANTIATE_TEST_CASE_P(Basic, CpuChannelTestSuite, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    BasicFlowControl,
+    CpuChannelTestSuite,
+    ::testing::Values(&flowControlHelper));
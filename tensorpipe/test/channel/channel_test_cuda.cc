@@ -184,3 +184,132 @@ class SendOffsetAllocationTest
 };
 
 CHANNEL_TEST(CudaChannelTestSuite, SendOffsetAllocation);
+
+// Large enough to be split across several streams by the channels that do so,
+// and not a multiple of the size of the slices.
+class SendLargeTensorTest : public ClientServerChannelTestCase<CudaBuffer> {
+ public:
+  static constexpr size_t kDataSize = 8 * 1024 * 1024 + 123;
+
+  void server(std::shared_ptr<transport::Connection> conn) override {
+    std::shared_ptr<CudaContext> ctx = this->helper_->makeContext("server");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kListen);
+
+    std::vector<uint8_t> data(kDataSize);
+    for (size_t i = 0; i < kDataSize; i++) {
+      data[i] = i % 251;
+    }
+    DataWrapper<CudaBuffer> wrappedData(data);
+
+    // Perform send and wait for completion.
+    std::future<std::tuple<Error, TDescriptor>> descriptorFuture;
+    std::future<Error> sendFuture;
+    std::tie(descriptorFuture, sendFuture) =
+        sendWithFuture(channel, wrappedData.buffer());
+    Error descriptorError;
+    TDescriptor descriptor;
+    std::tie(descriptorError, descriptor) = descriptorFuture.get();
+    EXPECT_FALSE(descriptorError) << descriptorError.what();
+    this->peers_->send(PeerGroup::kClient, descriptor);
+    Error sendError = sendFuture.get();
+    EXPECT_FALSE(sendError) << sendError.what();
+
+    this->peers_->done(PeerGroup::kServer);
+    this->peers_->join(PeerGroup::kServer);
+
+    ctx->join();
+  }
+
+  void client(std::shared_ptr<transport::Connection> conn) override {
+    std::shared_ptr<CudaContext> ctx = this->helper_->makeContext("client");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kConnect);
+
+    DataWrapper<CudaBuffer> wrappedData(kDataSize);
+
+    // Perform recv and wait for completion.
+    auto descriptor = this->peers_->recv(PeerGroup::kClient);
+    std::future<Error> recvFuture =
+        recvWithFuture(channel, descriptor, wrappedData.buffer());
+    Error recvError = recvFuture.get();
+    EXPECT_FALSE(recvError) << recvError.what();
+
+    // Validate contents of vector.
+    auto unwrappedData = wrappedData.unwrap();
+    ASSERT_EQ(unwrappedData.size(), kDataSize);
+    for (size_t i = 0; i < kDataSize; i++) {
+      if (unwrappedData[i] != i % 251) {
+        ADD_FAILURE() << "Mismatch at byte " << i;
+        break;
+      }
+    }
+
+    this->peers_->done(PeerGroup::kClient);
+    this->peers_->join(PeerGroup::kClient);
+
+    ctx->join();
+  }
+};
+
+CHANNEL_TEST(CudaChannelTestSuite, SendLargeTensor);
+
+// Too large for the copies by the CPU of cuda_basic and the eager transfers of
+// cuda_gdr, hence the receiver times at least how long it waited.
+class ChannelStatsTest : public ClientServerChannelTestCase<CudaBuffer> {
+ public:
+  static constexpr size_t kDataSize = 1024 * 1024;
+
+  void server(std::shared_ptr<transport::Connection> conn) override {
+    std::shared_ptr<CudaContext> ctx = this->helper_->makeContext("server");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kListen);
+
+    std::vector<uint8_t> data(kDataSize, 0x42);
+    DataWrapper<CudaBuffer> wrappedData(data);
+
+    // Perform send and wait for completion.
+    std::future<std::tuple<Error, TDescriptor>> descriptorFuture;
+    std::future<Error> sendFuture;
+    std::tie(descriptorFuture, sendFuture) =
+        sendWithFuture(channel, wrappedData.buffer());
+    Error descriptorError;
+    TDescriptor descriptor;
+    std::tie(descriptorError, descriptor) = descriptorFuture.get();
+    EXPECT_FALSE(descriptorError) << descriptorError.what();
+    this->peers_->send(PeerGroup::kClient, descriptor);
+    Error sendError = sendFuture.get();
+    EXPECT_FALSE(sendError) << sendError.what();
+
+    this->peers_->done(PeerGroup::kServer);
+    this->peers_->join(PeerGroup::kServer);
+
+    ctx->join();
+  }
+
+  void client(std::shared_ptr<transport::Connection> conn) override {
+    std::shared_ptr<CudaContext> ctx = this->helper_->makeContext("client");
+    ctx->enableChannelStats();
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kConnect);
+
+    DataWrapper<CudaBuffer> wrappedData(kDataSize);
+
+    // Perform recv and wait for completion.
+    auto descriptor = this->peers_->recv(PeerGroup::kClient);
+    std::future<Error> recvFuture =
+        recvWithFuture(channel, descriptor, wrappedData.buffer());
+    Error recvError = recvFuture.get();
+    EXPECT_FALSE(recvError) << recvError.what();
+
+    // This waits for the stream of the buffer, hence for the events of the
+    // receive, which must then be accounted for.
+    EXPECT_THAT(wrappedData.unwrap(), ::testing::Each(0x42));
+    ChannelStats stats = ctx->getChannelStats();
+    EXPECT_EQ(stats.copyQueueWaitTime.count(), 1);
+    EXPECT_LE(stats.copyRunTime.count(), 1);
+
+    this->peers_->done(PeerGroup::kClient);
+    this->peers_->join(PeerGroup::kClient);
+
+    ctx->join();
+  }
+};
+
+CHANNEL_TEST(CudaChannelTestSuite, ChannelStats);
@@ -8,8 +8,13 @@
 
 #include <numeric>
 
+#include <cuda_runtime.h>
+
 #include <tensorpipe/channel/basic/context.h>
 #include <tensorpipe/channel/cuda_basic/context.h>
+#include <tensorpipe/channel/mpt/context.h>
+#include <tensorpipe/common/cuda_pinned_buffer_pool.h>
+#include <tensorpipe/transport/uv/context.h>
 #include <tensorpipe/test/channel/channel_test.h>
 
 namespace {
@@ -34,6 +39,187 @@ class CudaBasicChannelTestHelper
 
 CudaBasicChannelTestHelper helper;
 
+// Use a tiny chunk size so that the buffers used by the tests get split.
+class CudaBasicChunkedChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CudaBuffer> {
+ protected:
+  std::shared_ptr<tensorpipe::channel::CudaContext> makeContextInternal(
+      std::string id) override {
+    auto cpuContext = std::make_shared<tensorpipe::channel::basic::Context>();
+    auto context = std::make_shared<tensorpipe::channel::cuda_basic::Context>(
+        std::move(cpuContext),
+        tensorpipe::channel::cuda_basic::CudaBasicOptions().chunkSize(1024));
+    context->setId(std::move(id));
+    return context;
+  }
+
+ public:
+  std::shared_ptr<PeerGroup> makePeerGroup() override {
+    return std::make_shared<ProcessPeerGroup>();
+  }
+};
+
+CudaBasicChunkedChannelTestHelper chunkedHelper;
+
+// Detect the completion of the copies by polling events (which GDRCopy would
+// bypass, hence it's disabled).
+class CudaBasicEventPollingChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CudaBuffer> {
+ protected:
+  std::shared_ptr<tensorpipe::channel::CudaContext> makeContextInternal(
+      std::string id) override {
+    auto cpuContext = std::make_shared<tensorpipe::channel::basic::Context>();
+    auto context = std::make_shared<tensorpipe::channel::cuda_basic::Context>(
+        std::move(cpuContext),
+        tensorpipe::channel::cuda_basic::CudaBasicOptions()
+            .chunkSize(1024)
+            .cudaLoopMode(tensorpipe::CudaLoopMode::kEventPolling)
+            .gdrcopyThreshold(0));
+    context->setId(std::move(id));
+    return context;
+  }
+
+ public:
+  std::shared_ptr<PeerGroup> makePeerGroup() override {
+    return std::make_shared<ProcessPeerGroup>();
+  }
+};
+
+CudaBasicEventPollingChannelTestHelper eventPollingHelper;
+
+// Stage the chunks through a multi-lane CPU channel, which spreads them (and
+// splits them further) across its lanes.
+class CudaBasicMultiRailChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CudaBuffer> {
+ protected:
+  std::shared_ptr<tensorpipe::channel::CudaContext> makeContextInternal(
+      std::string id) override {
+    std::vector<std::shared_ptr<tensorpipe::transport::Context>> contexts = {
+        std::make_shared<tensorpipe::transport::uv::Context>(),
+        std::make_shared<tensorpipe::transport::uv::Context>()};
+    std::vector<std::shared_ptr<tensorpipe::transport::Listener>> listeners = {
+        contexts[0]->listen("127.0.0.1"), contexts[1]->listen("127.0.0.1")};
+    auto cpuContext = std::make_shared<tensorpipe::channel::mpt::Context>(
+        std::move(contexts),
+        std::move(listeners),
+        tensorpipe::channel::mpt::MptOptions().minChunkSize(256));
+    auto context = std::make_shared<tensorpipe::channel::cuda_basic::Context>(
+        std::move(cpuContext),
+        tensorpipe::channel::cuda_basic::CudaBasicOptions().chunkSize(1024));
+    context->setId(std::move(id));
+    return context;
+  }
+
+ public:
+  std::shared_ptr<PeerGroup> makePeerGroup() override {
+    return std::make_shared<ProcessPeerGroup>();
+  }
+};
+
+CudaBasicMultiRailChannelTestHelper multiRailHelper;
+
+// A transform that swaps the two halves of the buffer, which is enough to tell
+// whether the data went through it and back, without needing a kernel.
+class SwapHalvesTransform : public tensorpipe::channel::cuda_basic::Transform {
+ public:
+  const std::string& name() const override {
+    return name_;
+  }
+
+  bool appliesTo(const tensorpipe::CudaBuffer& buffer) const override {
+    return buffer.length % 2 == 0;
+  }
+
+  size_t encodedLength(size_t length) const override {
+    return length;
+  }
+
+  void encode(const void* src, size_t length, void* dst, cudaStream_t stream)
+      override {
+    swapHalves(src, dst, length, stream);
+  }
+
+  void decode(const void* src, void* dst, size_t length, cudaStream_t stream)
+      override {
+    swapHalves(src, dst, length, stream);
+  }
+
+ private:
+  const std::string name_{"swap_halves"};
+
+  static void swapHalves(
+      const void* src,
+      void* dst,
+      size_t length,
+      cudaStream_t stream) {
+    const size_t half = length / 2;
+    TP_CUDA_CHECK(cudaMemcpyAsync(
+        reinterpret_cast<uint8_t*>(dst) + half,
+        src,
+        half,
+        cudaMemcpyDefault,
+        stream));
+    TP_CUDA_CHECK(cudaMemcpyAsync(
+        dst,
+        reinterpret_cast<const uint8_t*>(src) + half,
+        half,
+        cudaMemcpyDefault,
+        stream));
+  }
+};
+
+class CudaBasicTransformChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CudaBuffer> {
+ protected:
+  std::shared_ptr<tensorpipe::channel::CudaContext> makeContextInternal(
+      std::string id) override {
+    auto cpuContext = std::make_shared<tensorpipe::channel::basic::Context>();
+    std::vector<std::shared_ptr<tensorpipe::channel::cuda_basic::Transform>>
+        transforms = {std::make_shared<SwapHalvesTransform>()};
+    auto context = std::make_shared<tensorpipe::channel::cuda_basic::Context>(
+        std::move(cpuContext),
+        tensorpipe::channel::cuda_basic::CudaBasicOptions()
+            .chunkSize(1024)
+            .transforms(std::move(transforms)));
+    context->setId(std::move(id));
+    return context;
+  }
+
+ public:
+  std::shared_ptr<PeerGroup> makePeerGroup() override {
+    return std::make_shared<ProcessPeerGroup>();
+  }
+};
+
+CudaBasicTransformChannelTestHelper transformHelper;
+
+// Stage through an allocator that the context is given, as the high-level
+// context does (see ContextOptions::pinnedMemoryAllocator), rather than through
+// its own pool.
+class CudaBasicSharedAllocatorChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CudaBuffer> {
+ protected:
+  std::shared_ptr<tensorpipe::channel::CudaContext> makeContextInternal(
+      std::string id) override {
+    auto cpuContext = std::make_shared<tensorpipe::channel::basic::Context>();
+    auto context = std::make_shared<tensorpipe::channel::cuda_basic::Context>(
+        std::move(cpuContext),
+        tensorpipe::channel::cuda_basic::CudaBasicOptions().chunkSize(1024));
+    context->setPinnedMemoryAllocator(
+        std::make_shared<tensorpipe::CudaPinnedBufferPool>(
+            /*maxBytes=*/16 * 1024));
+    context->setId(std::move(id));
+    return context;
+  }
+
+ public:
+  std::shared_ptr<PeerGroup> makePeerGroup() override {
+    return std::make_shared<ProcessPeerGroup>();
+  }
+};
+
+CudaBasicSharedAllocatorChannelTestHelper sharedAllocatorHelper;
+
 } // namespace
 
 INSTANTIATE_TEST_CASE_P(
@@ -45,3 +231,28 @@ INSTANTIATE_TEST_CASE_P(
     CudaBasic,
     CudaMultiGPUChannelTestSuite,
     ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    CudaBasicChunked,
+    CudaChannelTestSuite,
+    ::testing::Values(&chunkedHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    CudaBasicEventPolling,
+    CudaChannelTestSuite,
+    ::testing::Values(&eventPollingHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    CudaBasicMultiRail,
+    CudaChannelTestSuite,
+    ::testing::Values(&multiRailHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    CudaBasicTransform,
+    CudaChannelTestSuite,
+    ::testing::Values(&transformHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    CudaBasicSharedAllocator,
+    CudaChannelTestSuite,
+    ::testing::Values(&sharedAllocatorHelper));
@@ -6,9 +6,17 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <cstring>
+#include <future>
 #include <numeric>
+#include <tuple>
+#include <vector>
+
+#include <cuda_runtime.h>
+#include <gmock/gmock.h>
 
 #include <tensorpipe/channel/cuda_ipc/context.h>
+#include <tensorpipe/common/cuda.h>
 #include <tensorpipe/test/channel/channel_test.h>
 
 namespace {
@@ -31,13 +39,156 @@ class CudaIpcChannelTestHelper
 
 CudaIpcChannelTestHelper helper;
 
+// Split the large copies across several streams.
+class CudaIpcSplitStreamsChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CudaBuffer> {
+ protected:
+  std::shared_ptr<tensorpipe::channel::CudaContext> makeContextInternal(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::cuda_ipc::Context>(
+        /*useDedicatedCopyStreams=*/true, /*numSplitStreams=*/4);
+    context->setId(std::move(id));
+    return context;
+  }
+
+ public:
+  std::shared_ptr<PeerGroup> makePeerGroup() override {
+    return std::make_shared<ProcessPeerGroup>();
+  }
+};
+
+CudaIpcSplitStreamsChannelTestHelper splitStreamsHelper;
+
+// Have the senders push the data, rather than the receivers pull it.
+class CudaIpcPushChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CudaBuffer> {
+ protected:
+  std::shared_ptr<tensorpipe::channel::CudaContext> makeContextInternal(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::cuda_ipc::Context>(
+        /*useDedicatedCopyStreams=*/true,
+        /*numSplitStreams=*/1,
+        tensorpipe::channel::cuda_ipc::CopyDirection::kPush);
+    context->setId(std::move(id));
+    return context;
+  }
+
+ public:
+  std::shared_ptr<PeerGroup> makePeerGroup() override {
+    return std::make_shared<ProcessPeerGroup>();
+  }
+};
+
+CudaIpcPushChannelTestHelper pushHelper;
+
 } // namespace
 
+#if (CUDART_VERSION >= 11030)
+
+using namespace tensorpipe;
+using namespace tensorpipe::channel;
+
+// Allocations made from an exportable memory pool (as cudaMallocAsync does from
+// the pools that frameworks set up for it) can't have a legacy IPC handle.
+class SendFromMemPoolTest : public ClientServerChannelTestCase<CudaBuffer> {
+ public:
+  static constexpr size_t kDataSize = 256;
+  static constexpr int kNumTensors = 2;
+
+  void server(std::shared_ptr<transport::Connection> conn) override {
+    std::shared_ptr<CudaContext> ctx = this->helper_->makeContext("server");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kListen);
+
+    TP_CUDA_CHECK(cudaSetDevice(0));
+    cudaStream_t stream;
+    TP_CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+    cudaMemPoolProps props;
+    std::memset(&props, 0, sizeof(props));
+    props.allocType = cudaMemAllocationTypePinned;
+    props.handleTypes = cudaMemHandleTypePosixFileDescriptor;
+    props.location.type = cudaMemLocationTypeDevice;
+    props.location.id = 0;
+    cudaMemPool_t pool;
+    TP_CUDA_CHECK(cudaMemPoolCreate(&pool, &props));
+
+    // The second tensor comes from the pool that the peer already imported.
+    std::vector<void*> ptrs(kNumTensors);
+    for (int tensorIdx = 0; tensorIdx < kNumTensors; tensorIdx++) {
+      TP_CUDA_CHECK(
+          cudaMallocFromPoolAsync(&ptrs[tensorIdx], kDataSize, pool, stream));
+      TP_CUDA_CHECK(cudaMemsetAsync(
+          ptrs[tensorIdx], 0x42 + tensorIdx, kDataSize, stream));
+      TP_CUDA_CHECK(cudaStreamSynchronize(stream));
+
+      std::future<std::tuple<Error, TDescriptor>> descriptorFuture;
+      std::future<Error> sendFuture;
+      std::tie(descriptorFuture, sendFuture) = sendWithFuture(
+          channel, CudaBuffer{ptrs[tensorIdx], kDataSize, stream});
+      Error descriptorError;
+      TDescriptor descriptor;
+      std::tie(descriptorError, descriptor) = descriptorFuture.get();
+      EXPECT_FALSE(descriptorError) << descriptorError.what();
+      this->peers_->send(PeerGroup::kClient, descriptor);
+      Error sendError = sendFuture.get();
+      EXPECT_FALSE(sendError) << sendError.what();
+    }
+
+    this->peers_->done(PeerGroup::kServer);
+    this->peers_->join(PeerGroup::kServer);
+
+    // The peer has freed its imported allocations by now.
+    ctx->join();
+    for (void* ptr : ptrs) {
+      TP_CUDA_CHECK(cudaFreeAsync(ptr, stream));
+    }
+    TP_CUDA_CHECK(cudaStreamSynchronize(stream));
+    TP_CUDA_CHECK(cudaMemPoolDestroy(pool));
+    TP_CUDA_CHECK(cudaStreamDestroy(stream));
+  }
+
+  void client(std::shared_ptr<transport::Connection> conn) override {
+    std::shared_ptr<CudaContext> ctx = this->helper_->makeContext("client");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kConnect);
+
+    for (int tensorIdx = 0; tensorIdx < kNumTensors; tensorIdx++) {
+      DataWrapper<CudaBuffer> wrappedData(kDataSize);
+      auto descriptor = this->peers_->recv(PeerGroup::kClient);
+      std::future<Error> recvFuture =
+          recvWithFuture(channel, descriptor, wrappedData.buffer());
+      Error recvError = recvFuture.get();
+      EXPECT_FALSE(recvError) << recvError.what();
+      EXPECT_THAT(wrappedData.unwrap(), ::testing::Each(0x42 + tensorIdx));
+    }
+
+    ctx->join();
+
+    this->peers_->done(PeerGroup::kClient);
+    this->peers_->join(PeerGroup::kClient);
+  }
+};
+
+TEST(CudaIpc, SendFromMemPool) {
+  SendFromMemPoolTest t;
+  t.run(&helper);
+}
+
+#endif // (CUDART_VERSION >= 11030)
+
 INSTANTIATE_TEST_CASE_P(
     CudaIpc,
     CudaChannelTestSuite,
     ::testing::Values(&helper));
 
+INSTANTIATE_TEST_CASE_P(
+    CudaIpcSplitStreams,
+    CudaChannelTestSuite,
+    ::testing::Values(&splitStreamsHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    CudaIpcPush,
+    CudaChannelTestSuite,
+    ::testing::Values(&pushHelper));
+
 INSTANTIATE_TEST_CASE_P(
     CudaIpc,
     CudaMultiGPUChannelTestSuite,
@@ -6,10 +6,18 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <array>
+#include <cstdint>
 #include <numeric>
+#include <string>
+
+#include <cuda_runtime.h>
+#include <gmock/gmock.h>
 
 #include <tensorpipe/channel/cuda_xth/context.h>
+#include <tensorpipe/common/cuda.h>
 #include <tensorpipe/test/channel/channel_test.h>
+#include <tensorpipe/test/channel/kernel.cuh>
 
 namespace {
 
@@ -31,8 +39,155 @@ class CudaXthChannelTestHelper
 
 CudaXthChannelTestHelper helper;
 
+// Enqueue the copies directly on the user's streams.
+class CudaXthUserStreamsChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CudaBuffer> {
+ protected:
+  std::shared_ptr<tensorpipe::channel::CudaContext> makeContextInternal(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::cuda_xth::Context>(
+        /*useDedicatedCopyStreams=*/false);
+    context->setId(std::move(id));
+    return context;
+  }
+
+ public:
+  std::shared_ptr<PeerGroup> makePeerGroup() override {
+    return std::make_shared<ForkedThreadPeerGroup>();
+  }
+};
+
+CudaXthUserStreamsChannelTestHelper userStreamsHelper;
+
+// Relay the copies between devices that lack a direct link, if any.
+class CudaXthRelayChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CudaBuffer> {
+ protected:
+  std::shared_ptr<tensorpipe::channel::CudaContext> makeContextInternal(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::cuda_xth::Context>(
+        /*useDedicatedCopyStreams=*/true, /*relayThroughPeers=*/true);
+    context->setId(std::move(id));
+    return context;
+  }
+
+ public:
+  std::shared_ptr<PeerGroup> makePeerGroup() override {
+    return std::make_shared<ForkedThreadPeerGroup>();
+  }
+};
+
+CudaXthRelayChannelTestHelper relayHelper;
+
+// Split the large copies across several streams.
+class CudaXthSplitStreamsChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CudaBuffer> {
+ protected:
+  std::shared_ptr<tensorpipe::channel::CudaContext> makeContextInternal(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::cuda_xth::Context>(
+        /*useDedicatedCopyStreams=*/true,
+        /*relayThroughPeers=*/false,
+        /*numSplitStreams=*/4);
+    context->setId(std::move(id));
+    return context;
+  }
+
+ public:
+  std::shared_ptr<PeerGroup> makePeerGroup() override {
+    return std::make_shared<ForkedThreadPeerGroup>();
+  }
+};
+
+CudaXthSplitStreamsChannelTestHelper splitStreamsHelper;
+
 } // namespace
 
+using namespace tensorpipe;
+using namespace tensorpipe::channel;
+
+// Both ends use the same stream (as the peers are threads of this process),
+// hence the copy is ordered by that stream alone, without any event, after the
+// work that the sender enqueued before sending, and before the work that the
+// sender enqueues once the send is done.
+class SendOnSharedStreamTest : public ClientServerChannelTestCase<CudaBuffer> {
+ public:
+  static constexpr size_t kSize = 1024;
+
+  void server(std::shared_ptr<transport::Connection> conn) override {
+    std::shared_ptr<CudaContext> ctx = this->helper_->makeContext("server");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kListen);
+
+    TP_CUDA_CHECK(cudaSetDevice(0));
+    cudaStream_t stream;
+    TP_CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+    void* ptr;
+    TP_CUDA_CHECK(cudaMalloc(&ptr, kSize));
+    slowKernel(ptr, kSize, stream);
+    TP_CUDA_CHECK(cudaMemsetAsync(ptr, 0x42, kSize, stream));
+    const uintptr_t streamHandle = reinterpret_cast<uintptr_t>(stream);
+    this->peers_->send(PeerGroup::kClient, std::to_string(streamHandle));
+
+    auto descriptorAndSendFutures =
+        sendWithFuture(channel, CudaBuffer{ptr, kSize, stream});
+    Error descriptorError;
+    TDescriptor descriptor;
+    std::tie(descriptorError, descriptor) =
+        descriptorAndSendFutures.first.get();
+    EXPECT_FALSE(descriptorError) << descriptorError.what();
+    this->peers_->send(PeerGroup::kClient, descriptor);
+    Error sendError = descriptorAndSendFutures.second.get();
+    EXPECT_FALSE(sendError) << sendError.what();
+    TP_CUDA_CHECK(cudaMemsetAsync(ptr, 0x00, kSize, stream));
+
+    this->peers_->done(PeerGroup::kServer);
+    this->peers_->join(PeerGroup::kServer);
+
+    TP_CUDA_CHECK(cudaStreamSynchronize(stream));
+    TP_CUDA_CHECK(cudaFree(ptr));
+    TP_CUDA_CHECK(cudaStreamDestroy(stream));
+    ctx->join();
+  }
+
+  void client(std::shared_ptr<transport::Connection> conn) override {
+    std::shared_ptr<CudaContext> ctx = this->helper_->makeContext("client");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kConnect);
+
+    TP_CUDA_CHECK(cudaSetDevice(0));
+    cudaStream_t stream = reinterpret_cast<cudaStream_t>(
+        std::stoull(this->peers_->recv(PeerGroup::kClient)));
+    void* ptr;
+    TP_CUDA_CHECK(cudaMalloc(&ptr, kSize));
+
+    auto descriptor = this->peers_->recv(PeerGroup::kClient);
+    Error recvError =
+        recvWithFuture(channel, descriptor, CudaBuffer{ptr, kSize, stream})
+            .get();
+    EXPECT_FALSE(recvError) << recvError.what();
+
+    std::array<uint8_t, kSize> data;
+    TP_CUDA_CHECK(cudaStreamSynchronize(stream));
+    TP_CUDA_CHECK(cudaMemcpy(data.data(), ptr, kSize, cudaMemcpyDefault));
+    EXPECT_THAT(data, ::testing::Each(0x42));
+    TP_CUDA_CHECK(cudaFree(ptr));
+
+    this->peers_->done(PeerGroup::kClient);
+    this->peers_->join(PeerGroup::kClient);
+
+    ctx->join();
+  }
+};
+
+TEST(CudaXth, SendOnSharedStream) {
+  SendOnSharedStreamTest t;
+  t.run(&helper);
+}
+
+TEST(CudaXthUserStreams, SendOnSharedStream) {
+  SendOnSharedStreamTest t;
+  t.run(&userStreamsHelper);
+}
+
 INSTANTIATE_TEST_CASE_P(
     CudaXth,
     CudaChannelTestSuite,
@@ -42,3 +197,18 @@ INSTANTIATE_TEST_CASE_P(
     CudaXth,
     CudaMultiGPUChannelTestSuite,
     ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    CudaXthUserStreams,
+    CudaChannelTestSuite,
+    ::testing::Values(&userStreamsHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    CudaXthSplitStreams,
+    CudaChannelTestSuite,
+    ::testing::Values(&splitStreamsHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    CudaXthRelay,
+    CudaMultiGPUChannelTestSuite,
+    ::testing::Values(&relayHelper));
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <numeric>
+
+#include <tensorpipe/channel/ibv/context.h>
+#include <tensorpipe/test/channel/channel_test.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::channel;
+
+namespace {
+
+class IbvChannelTestHelper : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ protected:
+  std::shared_ptr<tensorpipe::channel::CpuContext> makeContextInternal(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::ibv::Context>();
+    context->setId(std::move(id));
+    return context;
+  }
+};
+
+IbvChannelTestHelper helper;
+
+// Have more tensors in flight at once than the NICs have slots for requests
+// (1024 sends and as many recvs each), so that the ones that don't fit are
+// queued up and only posted as the earlier ones complete.
+class MoreTensorsThanRequestSlotsTest
+    : public ClientServerChannelTestCase<tensorpipe::CpuBuffer> {
+  static constexpr size_t kNumTensors = 3000;
+  static constexpr size_t kLength = 1024;
+
+ public:
+  void server(std::shared_ptr<transport::Connection> conn) override {
+    auto ctx = this->helper_->makeContext("server");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kListen);
+
+    std::vector<std::vector<uint8_t>> datas;
+    std::vector<std::future<Error>> sendFutures;
+    for (size_t idx = 0; idx < kNumTensors; idx++) {
+      datas.emplace_back(kLength, static_cast<uint8_t>(idx));
+    }
+    for (auto& data : datas) {
+      std::future<std::tuple<Error, TDescriptor>> descriptorFuture;
+      std::future<Error> sendFuture;
+      std::tie(descriptorFuture, sendFuture) =
+          sendWithFuture(channel, CpuBuffer{data.data(), kLength});
+      Error descriptorError;
+      TDescriptor descriptor;
+      std::tie(descriptorError, descriptor) = descriptorFuture.get();
+      EXPECT_FALSE(descriptorError) << descriptorError.what();
+      this->peers_->send(PeerGroup::kClient, descriptor);
+      sendFutures.push_back(std::move(sendFuture));
+    }
+    for (auto& sendFuture : sendFutures) {
+      Error sendError = sendFuture.get();
+      EXPECT_FALSE(sendError) << sendError.what();
+    }
+
+    this->peers_->done(PeerGroup::kServer);
+    this->peers_->join(PeerGroup::kServer);
+
+    ctx->join();
+  }
+
+  void client(std::shared_ptr<transport::Connection> conn) override {
+    auto ctx = this->helper_->makeContext("client");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kConnect);
+
+    std::vector<std::vector<uint8_t>> datas(
+        kNumTensors, std::vector<uint8_t>(kLength));
+    std::vector<std::future<Error>> recvFutures;
+    for (auto& data : datas) {
+      auto descriptor = this->peers_->recv(PeerGroup::kClient);
+      recvFutures.push_back(recvWithFuture(
+          channel, descriptor, CpuBuffer{data.data(), kLength}));
+    }
+    for (auto& recvFuture : recvFutures) {
+      Error recvError = recvFuture.get();
+      EXPECT_FALSE(recvError) << recvError.what();
+    }
+
+    for (size_t idx = 0; idx < kNumTensors; idx++) {
+      EXPECT_TRUE(std::all_of(
+          datas[idx].begin(), datas[idx].end(), [idx](uint8_t value) {
+            return value == static_cast<uint8_t>(idx);
+          }))
+          << "Tensor #" << idx << " has the wrong contents";
+    }
+
+    this->peers_->done(PeerGroup::kClient);
+    this->peers_->join(PeerGroup::kClient);
+
+    ctx->join();
+  }
+};
+
+// Send from, and receive into, the same memory over and over, with new data
+// each time, while the registrations are cached and reused, and invalidate them
+// before the memory is freed.
+class CachedRegistrationsTest
+    : public ClientServerChannelTestCase<tensorpipe::CpuBuffer> {
+  static constexpr size_t kNumRounds = 5;
+  static constexpr size_t kLength = 1024 * 1024;
+
+  static std::shared_ptr<ibv::Context> makeContext(std::string id) {
+    auto context = std::make_shared<ibv::Context>(
+        /*nicNames=*/nullopt, /*registrationCacheCapacity=*/4);
+    context->setId(std::move(id));
+    return context;
+  }
+
+ public:
+  void server(std::shared_ptr<transport::Connection> conn) override {
+    auto ctx = makeContext("server");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kListen);
+
+    std::vector<uint8_t> data(kLength);
+    for (size_t round = 0; round < kNumRounds; round++) {
+      std::iota(data.begin(), data.end(), static_cast<uint8_t>(round));
+      std::future<std::tuple<Error, TDescriptor>> descriptorFuture;
+      std::future<Error> sendFuture;
+      std::tie(descriptorFuture, sendFuture) =
+          sendWithFuture(channel, CpuBuffer{data.data(), kLength});
+      Error descriptorError;
+      TDescriptor descriptor;
+      std::tie(descriptorError, descriptor) = descriptorFuture.get();
+      EXPECT_FALSE(descriptorError) << descriptorError.what();
+      this->peers_->send(PeerGroup::kClient, descriptor);
+      Error sendError = sendFuture.get();
+      EXPECT_FALSE(sendError) << sendError.what();
+    }
+    ctx->invalidateMemoryRegistrations(data.data(), kLength);
+
+    this->peers_->done(PeerGroup::kServer);
+    this->peers_->join(PeerGroup::kServer);
+
+    ctx->join();
+  }
+
+  void client(std::shared_ptr<transport::Connection> conn) override {
+    auto ctx = makeContext("client");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kConnect);
+
+    std::vector<uint8_t> data(kLength);
+    std::vector<uint8_t> expected(kLength);
+    for (size_t round = 0; round < kNumRounds; round++) {
+      auto descriptor = this->peers_->recv(PeerGroup::kClient);
+      std::future<Error> recvFuture = recvWithFuture(
+          channel, descriptor, CpuBuffer{data.data(), kLength});
+      Error recvError = recvFuture.get();
+      EXPECT_FALSE(recvError) << recvError.what();
+
+      std::iota(expected.begin(), expected.end(), static_cast<uint8_t>(round));
+      EXPECT_EQ(data, expected) << "Wrong contents in round #" << round;
+    }
+    ctx->invalidateMemoryRegistrations(data.data(), kLength);
+
+    this->peers_->done(PeerGroup::kClient);
+    this->peers_->join(PeerGroup::kClient);
+
+    ctx->join();
+  }
+};
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(Ibv, CpuChannelTestSuite, ::testing::Values(&helper));
+
+TEST(Ibv, MoreTensorsThanRequestSlots) {
+  MoreTensorsThanRequestSlotsTest t;
+  t.run(&helper);
+}
+
+TEST(Ibv, CachedRegistrations) {
+  CachedRegistrationsTest t;
+  t.run(&helper);
+}
@@ -6,32 +6,207 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <functional>
+#include <numeric>
+
 #include <tensorpipe/channel/mpt/context.h>
 #include <tensorpipe/test/channel/channel_test.h>
 
+using namespace tensorpipe;
+using namespace tensorpipe::channel;
+
 namespace {
 
+constexpr size_t kNumLanes = 3;
+
+std::shared_ptr<mpt::Context> makeMptContext(
+    std::vector<std::shared_ptr<transport::Context>> contexts,
+    mpt::MptOptions mptOptions,
+    std::string id) {
+  std::vector<std::shared_ptr<transport::Listener>> listeners;
+  for (const auto& context : contexts) {
+    listeners.push_back(context->listen("127.0.0.1"));
+  }
+  auto context = std::make_shared<mpt::Context>(
+      std::move(contexts), std::move(listeners), std::move(mptOptions));
+  context->setId(std::move(id));
+  return context;
+}
+
+std::vector<std::shared_ptr<transport::Context>> makeLaneContexts() {
+  std::vector<std::shared_ptr<transport::Context>> contexts;
+  for (size_t laneIdx = 0; laneIdx < kNumLanes; laneIdx++) {
+    contexts.push_back(std::make_shared<transport::uv::Context>());
+  }
+  return contexts;
+}
+
 class MptChannelTestHelper : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ public:
+  explicit MptChannelTestHelper(mpt::MptOptions mptOptions = mpt::MptOptions())
+      : mptOptions_(std::move(mptOptions)) {}
+
  protected:
   std::shared_ptr<tensorpipe::channel::CpuContext> makeContextInternal(
       std::string id) override {
-    std::vector<std::shared_ptr<tensorpipe::transport::Context>> contexts = {
-        std::make_shared<tensorpipe::transport::uv::Context>(),
-        std::make_shared<tensorpipe::transport::uv::Context>(),
-        std::make_shared<tensorpipe::transport::uv::Context>()};
-    std::vector<std::shared_ptr<tensorpipe::transport::Listener>> listeners = {
-        contexts[0]->listen("127.0.0.1"),
-        contexts[1]->listen("127.0.0.1"),
-        contexts[2]->listen("127.0.0.1")};
-    auto context = std::make_shared<tensorpipe::channel::mpt::Context>(
-        std::move(contexts), std::move(listeners));
+    return makeMptContext(makeLaneContexts(), mptOptions_, std::move(id));
+  }
+
+ private:
+  const mpt::MptOptions mptOptions_;
+};
+
+// Makes the lanes through the factory, either giving each of them a context of
+// its own or making them all share a context with a loop per lane.
+class MptFactoryChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ public:
+  explicit MptFactoryChannelTestHelper(bool shareContext)
+      : shareContext_(shareContext) {}
+
+ protected:
+  std::shared_ptr<tensorpipe::channel::CpuContext> makeContextInternal(
+      std::string id) override {
+    std::function<std::shared_ptr<transport::Context>()> contextFactory;
+    if (shareContext_) {
+      auto sharedContext = std::make_shared<transport::uv::Context>(kNumLanes);
+      contextFactory = [sharedContext]() { return sharedContext; };
+    } else {
+      contextFactory = []() {
+        return std::make_shared<transport::uv::Context>();
+      };
+    }
+    auto context = std::make_shared<mpt::Context>(
+        std::move(contextFactory),
+        kNumLanes,
+        "127.0.0.1",
+        mpt::MptOptions().minChunkSize(1024));
     context->setId(std::move(id));
     return context;
   }
+
+ private:
+  const bool shareContext_;
 };
 
 MptChannelTestHelper helper;
 
+// Small enough for the tensors of the tests to be split among the lanes.
+MptChannelTestHelper splittingHelper(mpt::MptOptions().minChunkSize(1024));
+
+MptChannelTestHelper flowControlHelper(
+    mpt::MptOptions().minChunkSize(1024).flowControl(true));
+
+MptFactoryChannelTestHelper contextPerLaneHelper(/*shareContext=*/false);
+
+MptFactoryChannelTestHelper loopPerLaneHelper(/*shareContext=*/true);
+
+MptChannelTestHelper laneFailoverHelper(
+    mpt::MptOptions().minChunkSize(1024).flowControl(true).laneFailover(true));
+
+// With lane failover, closing the transport context of a lane at one end takes
+// that lane down, and the tensors keep coming through the other lanes, with
+// the chunks that it lost being sent again.
+class LaneFailoverTest : public ClientServerChannelTestCase<CpuBuffer> {
+ public:
+  static constexpr size_t kDataSize = 256 * 1024;
+  static constexpr int kNumTensors = 4;
+
+  void server(std::shared_ptr<transport::Connection> conn) override {
+    std::vector<std::shared_ptr<transport::Context>> laneContexts =
+        makeLaneContexts();
+    std::shared_ptr<transport::Context> failingLaneContext = laneContexts[1];
+    std::shared_ptr<CpuContext> ctx = makeMptContext(
+        std::move(laneContexts),
+        mpt::MptOptions().minChunkSize(1024).laneFailover(true),
+        "server");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kListen);
+
+    for (int tensorIdx = 0; tensorIdx < kNumTensors; tensorIdx++) {
+      if (tensorIdx == 1) {
+        failingLaneContext->close();
+      }
+      std::vector<uint8_t> data(kDataSize);
+      std::iota(data.begin(), data.end(), tensorIdx);
+      DataWrapper<CpuBuffer> wrappedData(data);
+
+      std::future<std::tuple<Error, TDescriptor>> descriptorFuture;
+      std::future<Error> sendFuture;
+      std::tie(descriptorFuture, sendFuture) =
+          sendWithFuture(channel, wrappedData.buffer());
+      Error descriptorError;
+      TDescriptor descriptor;
+      std::tie(descriptorError, descriptor) = descriptorFuture.get();
+      EXPECT_FALSE(descriptorError) << descriptorError.what();
+      this->peers_->send(PeerGroup::kClient, descriptor);
+      Error sendError = sendFuture.get();
+      EXPECT_FALSE(sendError) << sendError.what();
+    }
+
+    this->peers_->done(PeerGroup::kServer);
+    this->peers_->join(PeerGroup::kServer);
+
+    ctx->join();
+  }
+
+  void client(std::shared_ptr<transport::Connection> conn) override {
+    std::shared_ptr<CpuContext> ctx = makeMptContext(
+        makeLaneContexts(),
+        mpt::MptOptions().minChunkSize(1024).laneFailover(true),
+        "client");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kConnect);
+
+    for (int tensorIdx = 0; tensorIdx < kNumTensors; tensorIdx++) {
+      DataWrapper<CpuBuffer> wrappedData(kDataSize);
+      auto descriptor = this->peers_->recv(PeerGroup::kClient);
+      std::future<Error> recvFuture =
+          recvWithFuture(channel, descriptor, wrappedData.buffer());
+      Error recvError = recvFuture.get();
+      EXPECT_FALSE(recvError) << recvError.what();
+
+      const std::vector<uint8_t>& unwrappedData = wrappedData.unwrap();
+      for (size_t idx = 0; idx < kDataSize; idx++) {
+        ASSERT_EQ(unwrappedData[idx], static_cast<uint8_t>(idx + tensorIdx));
+      }
+    }
+
+    this->peers_->done(PeerGroup::kClient);
+    this->peers_->join(PeerGroup::kClient);
+
+    ctx->join();
+  }
+};
+
 } // namespace
 
+TEST(Mpt, LaneFailover) {
+  LaneFailoverTest t;
+  t.run(&laneFailoverHelper);
+}
+
 INSTANTIATE_TEST_CASE_P(Mpt, CpuChannelTestSuite, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    MptSplitting,
+    CpuChannelTestSuite,
+    ::testing::Values(&splittingHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    MptFlowControl,
+    CpuChannelTestSuite,
+    ::testing::Values(&flowControlHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    MptContextPerLane,
+    CpuChannelTestSuite,
+    ::testing::Values(&contextPerLaneHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    MptLoopPerLane,
+    CpuChannelTestSuite,
+    ::testing::Values(&loopPerLaneHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    MptLaneFailover,
+    CpuChannelTestSuite,
+    ::testing::Values(&laneFailoverHelper));
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include <tensorpipe/channel/operation_window.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::channel;
+
+TEST(OperationWindow, StartUpToMaxInFlight) {
+  OperationWindow window(2);
+  std::vector<uint64_t> started;
+  for (uint64_t sequenceNumber = 0; sequenceNumber < 4; sequenceNumber++) {
+    window.enqueue(sequenceNumber, [&started, sequenceNumber]() {
+      started.push_back(sequenceNumber);
+    });
+  }
+  EXPECT_EQ(started, std::vector<uint64_t>({0, 1}));
+  EXPECT_EQ(window.numInFlight(), 2);
+  EXPECT_EQ(window.numPending(), 2);
+
+  // Completing a later operation doesn't make room, as it isn't retired until
+  // the earlier ones are.
+  window.complete(1, nullptr);
+  EXPECT_EQ(started, std::vector<uint64_t>({0, 1}));
+
+  window.complete(0, nullptr);
+  EXPECT_EQ(started, std::vector<uint64_t>({0, 1, 2, 3}));
+  EXPECT_EQ(window.numInFlight(), 2);
+  EXPECT_EQ(window.numPending(), 0);
+}
+
+TEST(OperationWindow, RetireInOrder) {
+  OperationWindow window(4);
+  std::vector<uint64_t> retired;
+  for (uint64_t sequenceNumber = 0; sequenceNumber < 4; sequenceNumber++) {
+    window.enqueue(sequenceNumber, nullptr);
+  }
+  for (uint64_t sequenceNumber : {2, 1, 3, 0}) {
+    window.complete(sequenceNumber, [&retired, sequenceNumber]() {
+      retired.push_back(sequenceNumber);
+    });
+    if (sequenceNumber != 0) {
+      EXPECT_TRUE(retired.empty());
+    }
+  }
+  EXPECT_EQ(retired, std::vector<uint64_t>({0, 1, 2, 3}));
+  EXPECT_EQ(window.numInFlight(), 0);
+}
+
+TEST(OperationWindow, Reenter) {
+  OperationWindow window(1);
+  std::vector<uint64_t> events;
+  // The first operation completes as soon as it starts, and enqueues another
+  // one when it's retired, which then starts right away.
+  window.enqueue(0, [&]() {
+    events.push_back(0);
+    window.complete(0, [&]() {
+      events.push_back(1);
+      window.enqueue(1, [&]() { events.push_back(2); });
+    });
+    // The completion is only run once this returns.
+    EXPECT_EQ(events.size(), 1);
+  });
+  EXPECT_EQ(events, std::vector<uint64_t>({0, 1, 2}));
+  EXPECT_EQ(window.numInFlight(), 1);
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstring>
+#include <numeric>
+
+#include <tensorpipe/channel/shm_arena/context.h>
+#include <tensorpipe/test/channel/channel_test.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::channel;
+
+namespace {
+
+class ShmArenaChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ protected:
+  std::shared_ptr<tensorpipe::channel::CpuContext> makeContextInternal(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::shm_arena::Context>();
+    context->setId(std::move(id));
+    return context;
+  }
+};
+
+ShmArenaChannelTestHelper helper;
+
+constexpr size_t kArenaSize = 1024 * 1024;
+constexpr size_t kSmallLength = 4096;
+constexpr size_t kLargeLength = 3 * kArenaSize + 17;
+
+// Send a tensor that was allocated from the arena, hence that doesn't need to
+// be staged, and that is larger than the arena's segments.
+class ArenaBufferTest
+    : public ClientServerChannelTestCase<tensorpipe::CpuBuffer> {
+  static std::shared_ptr<shm_arena::Context> makeContext(std::string id) {
+    auto context = std::make_shared<shm_arena::Context>(kArenaSize);
+    context->setId(std::move(id));
+    return context;
+  }
+
+  void server(std::shared_ptr<transport::Connection> conn) override {
+    auto ctx = makeContext("server");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kListen);
+
+    for (size_t length : {kSmallLength, kLargeLength}) {
+      uint8_t* ptr = reinterpret_cast<uint8_t*>(ctx->allocate(length));
+      ASSERT_NE(ptr, nullptr);
+      std::iota(ptr, ptr + length, 0);
+
+      std::future<std::tuple<Error, TDescriptor>> descriptorFuture;
+      std::future<Error> sendFuture;
+      std::tie(descriptorFuture, sendFuture) =
+          sendWithFuture(channel, CpuBuffer{ptr, length});
+      Error descriptorError;
+      TDescriptor descriptor;
+      std::tie(descriptorError, descriptor) = descriptorFuture.get();
+      EXPECT_FALSE(descriptorError) << descriptorError.what();
+      this->peers_->send(PeerGroup::kClient, descriptor);
+      Error sendError = sendFuture.get();
+      EXPECT_FALSE(sendError) << sendError.what();
+
+      ctx->deallocate(ptr);
+    }
+
+    this->peers_->done(PeerGroup::kServer);
+    this->peers_->join(PeerGroup::kServer);
+
+    ctx->join();
+  }
+
+  void client(std::shared_ptr<transport::Connection> conn) override {
+    auto ctx = makeContext("client");
+    auto channel = ctx->createChannel(std::move(conn), Endpoint::kConnect);
+
+    for (size_t length : {kSmallLength, kLargeLength}) {
+      std::vector<uint8_t> data(length);
+      auto descriptor = this->peers_->recv(PeerGroup::kClient);
+      std::future<Error> recvFuture = recvWithFuture(
+          channel, descriptor, CpuBuffer{data.data(), length});
+      Error recvError = recvFuture.get();
+      EXPECT_FALSE(recvError) << recvError.what();
+
+      std::vector<uint8_t> expected(length);
+      std::iota(expected.begin(), expected.end(), 0);
+      EXPECT_EQ(data, expected);
+    }
+
+    this->peers_->done(PeerGroup::kClient);
+    this->peers_->join(PeerGroup::kClient);
+
+    ctx->join();
+  }
+};
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(
+    ShmArena,
+    CpuChannelTestSuite,
+    ::testing::Values(&helper));
+
+TEST(ShmArena, ArenaBuffer) {
+  ArenaBufferTest t;
+  t.run(&helper);
+}
@@ -23,6 +23,27 @@ class XthChannelTestHelper : public ChannelTestHelper<tensorpipe::CpuBuffer> {
 
 XthChannelTestHelper helper;
 
+// Disable inline copies so that all of them go through the worker threads.
+class XthNoInlineChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ protected:
+  std::shared_ptr<tensorpipe::channel::CpuContext> makeContextInternal(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::xth::Context>(
+        tensorpipe::channel::xth::kDefaultNumThreads,
+        /*inlineCopyThreshold=*/0);
+    context->setId(std::move(id));
+    return context;
+  }
+};
+
+XthNoInlineChannelTestHelper noInlineHelper;
+
 } // namespace
 
 INSTANTIATE_TEST_CASE_P(Xth, CpuChannelTestSuite, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    XthNoInline,
+    CpuChannelTestSuite,
+    ::testing::Values(&noInlineHelper));
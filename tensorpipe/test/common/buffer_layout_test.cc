@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdint>
+#include <numeric>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <tensorpipe/common/buffer_layout.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+// A buffer of the given number of rows, each with some padding after it, which
+// is filled with a marker that no copy should touch.
+std::pair<std::vector<uint8_t>, CpuBuffer> makeStridedBuffer(
+    size_t numRows,
+    size_t rowLength,
+    size_t rowStride) {
+  std::vector<uint8_t> storage(numRows * rowStride, 0xff);
+  CpuBuffer buffer;
+  buffer.ptr = storage.data();
+  buffer.length = numRows * rowLength;
+  buffer.rowLength = rowLength;
+  buffer.rowStride = rowStride;
+  return std::make_pair(std::move(storage), buffer);
+}
+
+} // namespace
+
+TEST(BufferLayout, IsContiguous) {
+  uint8_t data[64];
+  CpuBuffer buffer{data, 64};
+  EXPECT_TRUE(isContiguous(buffer));
+  buffer.rowLength = 16;
+  buffer.rowStride = 16;
+  EXPECT_TRUE(isContiguous(buffer));
+  buffer.rowLength = 8;
+  EXPECT_FALSE(isContiguous(buffer));
+  EXPECT_TRUE(hasValidLayout(buffer));
+  // A single row is contiguous whatever the stride.
+  buffer.length = 8;
+  EXPECT_TRUE(isContiguous(buffer));
+  buffer.length = 12;
+  EXPECT_FALSE(hasValidLayout(buffer));
+}
+
+TEST(BufferLayout, Span) {
+  uint8_t data[64];
+  CpuBuffer buffer{data, 64};
+  EXPECT_EQ(spanOfBuffer(buffer), 64);
+  // The padding after the last row isn't part of the buffer.
+  buffer.length = 40;
+  buffer.rowLength = 10;
+  buffer.rowStride = 16;
+  EXPECT_EQ(spanOfBuffer(buffer), 3 * 16 + 10);
+  buffer.length = 0;
+  EXPECT_EQ(spanOfBuffer(buffer), 0);
+}
+
+TEST(BufferLayout, PiecesOfRange) {
+  std::vector<uint8_t> storage;
+  CpuBuffer buffer;
+  std::tie(storage, buffer) = makeStridedBuffer(4, 10, 16);
+  std::vector<std::pair<size_t, size_t>> pieces;
+  forEachPieceOfBuffer(buffer, 5, 22, [&](uint8_t* ptr, size_t length) {
+    pieces.emplace_back(ptr - storage.data(), length);
+  });
+  const std::vector<std::pair<size_t, size_t>> expected = {
+      {5, 5}, {16, 10}, {32, 7}};
+  EXPECT_EQ(pieces, expected);
+}
+
+TEST(BufferLayout, CopyBetweenLayouts) {
+  constexpr size_t kLength = 60;
+  std::vector<uint8_t> contiguous(kLength);
+  std::iota(contiguous.begin(), contiguous.end(), 0);
+  const CpuBuffer contiguousBuffer{contiguous.data(), kLength};
+
+  std::vector<uint8_t> srcStorage;
+  CpuBuffer src;
+  std::tie(srcStorage, src) = makeStridedBuffer(6, 10, 13);
+  copyBuffer(src, contiguousBuffer);
+  for (size_t rowIdx = 0; rowIdx < 6; rowIdx++) {
+    for (size_t idx = 0; idx < 10; idx++) {
+      EXPECT_EQ(srcStorage[rowIdx * 13 + idx], rowIdx * 10 + idx);
+    }
+    for (size_t idx = 10; idx < 13; idx++) {
+      EXPECT_EQ(srcStorage[rowIdx * 13 + idx], 0xff);
+    }
+  }
+
+  // Rows that don't line up with those of the source.
+  std::vector<uint8_t> dstStorage;
+  CpuBuffer dst;
+  std::tie(dstStorage, dst) = makeStridedBuffer(4, 15, 20);
+  copyBuffer(dst, src);
+  for (size_t rowIdx = 0; rowIdx < 4; rowIdx++) {
+    for (size_t idx = 0; idx < 15; idx++) {
+      EXPECT_EQ(dstStorage[rowIdx * 20 + idx], rowIdx * 15 + idx);
+    }
+    for (size_t idx = 15; idx < 20; idx++) {
+      EXPECT_EQ(dstStorage[rowIdx * 20 + idx], 0xff);
+    }
+  }
+
+  std::vector<uint8_t> roundTrip(kLength);
+  copyBuffer(CpuBuffer{roundTrip.data(), kLength}, dst);
+  EXPECT_EQ(roundTrip, contiguous);
+  EXPECT_EQ(crc32cOfBuffer(dst), crc32c(contiguous.data(), kLength));
+}
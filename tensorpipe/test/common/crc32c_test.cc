@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/crc32c.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+// A bit-by-bit implementation, straight out of the definition.
+uint32_t referenceCrc32c(const uint8_t* ptr, size_t length) {
+  uint32_t crc = 0xffffffff;
+  for (size_t idx = 0; idx < length; idx++) {
+    crc ^= ptr[idx];
+    for (int bitIdx = 0; bitIdx < 8; bitIdx++) {
+      crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+    }
+  }
+  return ~crc;
+}
+
+std::vector<uint8_t> makeData(size_t length) {
+  std::vector<uint8_t> data(length);
+  uint32_t state = 1;
+  for (uint8_t& byte : data) {
+    state = state * 1103515245 + 12345;
+    byte = state >> 24;
+  }
+  return data;
+}
+
+} // namespace
+
+TEST(Crc32c, KnownValues) {
+  const char* digits = "123456789";
+  EXPECT_EQ(crc32c(digits, std::strlen(digits)), 0xe3069283);
+  std::vector<uint8_t> zeros(32, 0x00);
+  EXPECT_EQ(crc32c(zeros.data(), zeros.size()), 0x8a9136aa);
+  std::vector<uint8_t> ones(32, 0xff);
+  EXPECT_EQ(crc32c(ones.data(), ones.size()), 0x62a8ab43);
+  EXPECT_EQ(crc32c(nullptr, 0), 0);
+}
+
+TEST(Crc32c, MatchesReference) {
+  // Cover the lengths around the ones of the interleaved blocks, at any
+  // alignment.
+  const std::vector<uint8_t> data = makeData(40000);
+  for (size_t length : {1, 7, 8, 9, 4095, 12287, 12288, 12289, 24576, 39990}) {
+    for (size_t offset : {0, 1, 5}) {
+      EXPECT_EQ(
+          crc32c(data.data() + offset, length),
+          referenceCrc32c(data.data() + offset, length))
+          << "length " << length << ", offset " << offset << " with "
+          << getCrc32cImplementation();
+    }
+  }
+}
+
+TEST(Crc32c, Incremental) {
+  const std::vector<uint8_t> data = makeData(30000);
+  const uint32_t expected = crc32c(data.data(), data.size());
+  for (size_t split : {0, 1, 4096, 12288, 20000, 30000}) {
+    uint32_t crc = crc32c(data.data(), split);
+    crc = crc32c(data.data() + split, data.size() - split, crc);
+    EXPECT_EQ(crc, expected) << "split at " << split;
+  }
+}
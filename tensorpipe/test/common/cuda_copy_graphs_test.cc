@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/cuda_copy_graphs.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+constexpr size_t kNumTensors = 8;
+constexpr size_t kTensorLength = 1000;
+
+// Gather the tensors into the buffer, with the copies going through the graphs
+// once they recur, and check what ends up in the buffer.
+void gatherAndCheck(
+    CudaCopyGraphs& graphs,
+    const std::vector<uint8_t*>& tensors,
+    uint8_t* buffer,
+    cudaStream_t stream) {
+  std::vector<CudaCopyGraphs::Copy> copies;
+  for (size_t tensorIdx = 0; tensorIdx < tensors.size(); tensorIdx++) {
+    copies.push_back(CudaCopyGraphs::Copy{
+        buffer + tensorIdx * kTensorLength, tensors[tensorIdx], kTensorLength});
+  }
+  TP_CUDA_CHECK(
+      cudaMemsetAsync(buffer, 0, kNumTensors * kTensorLength, stream));
+  graphs.enqueue(/*device=*/0, copies, stream);
+
+  std::vector<uint8_t> result(kNumTensors * kTensorLength);
+  TP_CUDA_CHECK(cudaStreamSynchronize(stream));
+  TP_CUDA_CHECK(cudaMemcpy(
+      result.data(), buffer, result.size(), cudaMemcpyDeviceToHost));
+  for (size_t tensorIdx = 0; tensorIdx < tensors.size(); tensorIdx++) {
+    for (size_t idx = 0; idx < kTensorLength; idx++) {
+      ASSERT_EQ(result[tensorIdx * kTensorLength + idx], tensorIdx + 1);
+    }
+  }
+}
+
+} // namespace
+
+TEST(CudaCopyGraphs, ReplayRecurringCopies) {
+  CudaDeviceGuard guard(0);
+  cudaStream_t stream;
+  TP_CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+
+  std::vector<uint8_t*> tensors;
+  for (size_t tensorIdx = 0; tensorIdx < kNumTensors; tensorIdx++) {
+    void* ptr;
+    TP_CUDA_CHECK(cudaMalloc(&ptr, kTensorLength));
+    TP_CUDA_CHECK(cudaMemset(ptr, tensorIdx + 1, kTensorLength));
+    tensors.push_back(reinterpret_cast<uint8_t*>(ptr));
+  }
+  void* buffer;
+  TP_CUDA_CHECK(cudaMalloc(&buffer, kNumTensors * kTensorLength));
+
+  {
+    CudaCopyGraphs graphs;
+    // The first time the copies are enqueued one by one, the second time the
+    // graph is instantiated, and from then on it's replayed.
+    for (int iter = 0; iter < 4; iter++) {
+      gatherAndCheck(
+          graphs, tensors, reinterpret_cast<uint8_t*>(buffer), stream);
+    }
+    // Other sets of copies get graphs of their own.
+    for (size_t numTensors = 1; numTensors < kNumTensors; numTensors++) {
+      for (int iter = 0; iter < 2; iter++) {
+        std::vector<uint8_t*> someTensors(
+            tensors.begin(), tensors.begin() + numTensors);
+        gatherAndCheck(
+            graphs, someTensors, reinterpret_cast<uint8_t*>(buffer), stream);
+      }
+    }
+    gatherAndCheck(graphs, tensors, reinterpret_cast<uint8_t*>(buffer), stream);
+  }
+
+  TP_CUDA_CHECK(cudaFree(buffer));
+  for (uint8_t* ptr : tensors) {
+    TP_CUDA_CHECK(cudaFree(ptr));
+  }
+  TP_CUDA_CHECK(cudaStreamDestroy(stream));
+}
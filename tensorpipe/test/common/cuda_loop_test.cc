@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <chrono>
+#include <future>
+#include <vector>
+
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/cuda_loop.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+// While the loop is stuck in a callback, the internal thread of the CUDA
+// runtime keeps completing the host callbacks of the stream, far more of them
+// than the loop's queue holds, rather than waiting for the loop (which would
+// also hold up the host callbacks of all the other streams). They're then run
+// in order once the loop resumes.
+TEST(CudaLoop, CompletionsDontWaitForABusyLoop) {
+  constexpr int kNumCallbacks = 4096;
+
+  CudaLoop loop;
+  cudaStream_t stream;
+  TP_CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+
+  std::promise<void> resumeProm;
+  std::shared_future<void> resumeFuture = resumeProm.get_future().share();
+  loop.addCallback(/*device=*/0, stream, [resumeFuture](const Error& error) {
+    EXPECT_FALSE(error) << error.what();
+    resumeFuture.wait();
+  });
+
+  std::vector<int> order;
+  std::promise<void> doneProm;
+  for (int idx = 0; idx < kNumCallbacks; idx++) {
+    loop.addCallback(
+        /*device=*/0, stream, [&order, &doneProm, idx](const Error& error) {
+          EXPECT_FALSE(error) << error.what();
+          order.push_back(idx);
+          if (idx == kNumCallbacks - 1) {
+            doneProm.set_value();
+          }
+        });
+  }
+
+  // The stream only gets through its host callbacks if none of them blocks.
+  std::future<void> syncFuture = std::async(std::launch::async, [stream]() {
+    TP_CUDA_CHECK(cudaStreamSynchronize(stream));
+  });
+  EXPECT_EQ(
+      syncFuture.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+
+  resumeProm.set_value();
+  doneProm.get_future().wait();
+  syncFuture.wait();
+
+  ASSERT_EQ(order.size(), static_cast<size_t>(kNumCallbacks));
+  for (int idx = 0; idx < kNumCallbacks; idx++) {
+    EXPECT_EQ(order[idx], idx);
+  }
+
+  loop.join();
+  TP_CUDA_CHECK(cudaStreamDestroy(stream));
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+
+#include <tensorpipe/common/cuda_pinned_buffer_pool.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(CudaPinnedBufferPool, ReuseBuffer) {
+  auto pool = std::make_shared<CudaPinnedBufferPool>(1024 * 1024);
+
+  uint8_t* firstPtr = nullptr;
+  pool->allocate(
+      /*device=*/0,
+      1000,
+      [&](const Error& error, CudaPinnedBuffer buffer) {
+        ASSERT_FALSE(error) << error.what();
+        firstPtr = buffer.get();
+      });
+  ASSERT_NE(firstPtr, nullptr);
+
+  // The first buffer has been released, the same memory should be handed out
+  // again for a request of the same size class.
+  uint8_t* secondPtr = nullptr;
+  pool->allocate(
+      /*device=*/0,
+      2000,
+      [&](const Error& error, CudaPinnedBuffer buffer) {
+        ASSERT_FALSE(error) << error.what();
+        secondPtr = buffer.get();
+      });
+  EXPECT_EQ(firstPtr, secondPtr);
+
+  pool->close();
+}
+
+TEST(CudaPinnedBufferPool, BackPressure) {
+  auto pool = std::make_shared<CudaPinnedBufferPool>(64 * 1024);
+
+  CudaPinnedBuffer firstBuffer;
+  pool->allocate(
+      /*device=*/0,
+      64 * 1024,
+      [&](const Error& error, CudaPinnedBuffer buffer) {
+        ASSERT_FALSE(error) << error.what();
+        firstBuffer = std::move(buffer);
+      });
+  ASSERT_NE(firstBuffer, nullptr);
+
+  // The cap has been reached, this request must wait.
+  CudaPinnedBuffer secondBuffer;
+  pool->allocate(
+      /*device=*/0,
+      4 * 1024,
+      [&](const Error& error, CudaPinnedBuffer buffer) {
+        ASSERT_FALSE(error) << error.what();
+        secondBuffer = std::move(buffer);
+      });
+  EXPECT_EQ(secondBuffer, nullptr);
+
+  firstBuffer.reset();
+  EXPECT_NE(secondBuffer, nullptr);
+
+  // Pending requests are failed upon closing.
+  bool failed = false;
+  pool->allocate(
+      /*device=*/0,
+      64 * 1024,
+      [&](const Error& error, CudaPinnedBuffer buffer) {
+        EXPECT_TRUE(error);
+        EXPECT_EQ(buffer, nullptr);
+        failed = true;
+      });
+  EXPECT_FALSE(failed);
+  pool->close();
+  EXPECT_TRUE(failed);
+}
+
+TEST(CudaPinnedBufferPool, ReleaseFreeBuffers) {
+  auto pool = std::make_shared<CudaPinnedBufferPool>(1024 * 1024);
+
+  CudaPinnedBuffer inUseBuffer;
+  pool->allocate(
+      /*device=*/0,
+      8192,
+      [&](const Error& error, CudaPinnedBuffer buffer) {
+        ASSERT_FALSE(error) << error.what();
+        inUseBuffer = std::move(buffer);
+      });
+  pool->allocate(
+      /*device=*/0,
+      4096,
+      [&](const Error& error, CudaPinnedBuffer /* unused */) {
+        ASSERT_FALSE(error) << error.what();
+      });
+  // The second buffer went back to the free lists, and is still held.
+  EXPECT_EQ(pool->getTotalBytes(), 8192 + 4096);
+
+  // Only the cached buffer is given back.
+  pool->releaseFreeBuffers();
+  EXPECT_EQ(pool->getTotalBytes(), 8192);
+
+  inUseBuffer = nullptr;
+  EXPECT_EQ(pool->getTotalBytes(), 8192);
+  pool->releaseFreeBuffers();
+  EXPECT_EQ(pool->getTotalBytes(), 0);
+
+  pool->close();
+}
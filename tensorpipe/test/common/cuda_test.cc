@@ -57,6 +57,38 @@ TEST(Cuda, DeviceForPointer) {
       });
 }
 
+// This tests whether we tell managed memory apart from device memory, and find
+// the device that the former was allocated for.
+TEST(Cuda, ManagedPointer) {
+  if (TestEnvironment::numCudaDevices() < 2) {
+    GTEST_SKIP() << "Skipping test requiring >=2 CUDA devices.";
+  }
+
+  ForkedThreadPeerGroup pg;
+  pg.spawn(
+      [&]() {
+        tensorpipe::CudaLib cudaLib = getCudaLib();
+        TP_CUDA_CHECK(cudaSetDevice(1));
+        void* devicePtr;
+        TP_CUDA_CHECK(cudaMalloc(&devicePtr, 1024));
+        void* managedPtr;
+        TP_CUDA_CHECK(cudaMallocManaged(&managedPtr, 1024));
+
+        EXPECT_FALSE(tensorpipe::cudaIsManagedPointer(cudaLib, devicePtr));
+        EXPECT_TRUE(tensorpipe::cudaIsManagedPointer(cudaLib, managedPtr));
+        EXPECT_EQ(tensorpipe::cudaDeviceForPointer(cudaLib, managedPtr), 1);
+
+        // Prefetching is only a hint, but it must be accepted.
+        tensorpipe::cudaPrefetchManagedMemory(
+            managedPtr, 1024, 1, cudaStreamDefault);
+        TP_CUDA_CHECK(cudaDeviceSynchronize());
+
+        TP_CUDA_CHECK(cudaFree(managedPtr));
+        TP_CUDA_CHECK(cudaFree(devicePtr));
+      },
+      [&]() {});
+}
+
 // This tests whether we can retrieve the index of the device on which a pointer
 // resided after we've explicitly set the current device to an invalid value.
 // This is known to cause problems in recent versions of CUDA, possibly because
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <array>
+#include <thread>
+#include <vector>
+
+#include <tensorpipe/common/deferred_executor.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(OnDemandDeferredExecutor, ManyProducers) {
+  constexpr size_t kNumThreads = 8;
+  constexpr size_t kNumTasks = 1000;
+  OnDemandDeferredExecutor loop;
+  // Only accessed from the loop.
+  std::array<std::vector<size_t>, kNumThreads> tasksRun;
+
+  std::vector<std::thread> threads;
+  for (size_t threadIdx = 0; threadIdx < kNumThreads; threadIdx++) {
+    threads.emplace_back([&, threadIdx]() {
+      for (size_t taskIdx = 0; taskIdx < kNumTasks; taskIdx++) {
+        loop.deferToLoop([&, threadIdx, taskIdx]() {
+          EXPECT_TRUE(loop.inLoop());
+          tasksRun[threadIdx].push_back(taskIdx);
+        });
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  // Every thread's tasks ran, in the order in which it deferred them.
+  loop.runInLoop([&]() {
+    for (size_t threadIdx = 0; threadIdx < kNumThreads; threadIdx++) {
+      ASSERT_EQ(tasksRun[threadIdx].size(), kNumTasks);
+      for (size_t taskIdx = 0; taskIdx < kNumTasks; taskIdx++) {
+        EXPECT_EQ(tasksRun[threadIdx][taskIdx], taskIdx);
+      }
+    }
+  });
+}
+
+TEST(OnDemandDeferredExecutor, RunsInlineWhenIdle) {
+  OnDemandDeferredExecutor loop;
+  std::vector<int> tasksRun;
+
+  loop.deferToLoop([&]() {
+    EXPECT_TRUE(loop.inLoop());
+    tasksRun.push_back(0);
+    // These go through the queue, after the one that's running.
+    loop.deferToLoop([&]() {
+      tasksRun.push_back(2);
+      loop.deferToLoop([&]() { tasksRun.push_back(3); });
+    });
+    tasksRun.push_back(1);
+  });
+  // The loop was idle, hence everything ran before deferToLoop returned.
+  EXPECT_FALSE(loop.inLoop());
+  EXPECT_EQ(tasksRun, std::vector<int>({0, 1, 2, 3}));
+}
@@ -8,8 +8,12 @@
 
 #include <sys/eventfd.h>
 
+#include <atomic>
+#include <chrono>
 #include <deque>
+#include <future>
 
+#include <tensorpipe/common/busy_polling_loop.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/epoll_loop.h>
 
@@ -141,6 +145,67 @@ std::shared_ptr<FunctionEventHandler> createMonitor(
   return handler;
 }
 
+// Unregisters itself when it's triggered, while it's only held by the loop,
+// and then still uses its own fields.
+class SelfUnregisteringHandler : public EpollLoop::EventHandler {
+ public:
+  SelfUnregisteringHandler(
+      EpollLoop& loop,
+      int fd,
+      std::promise<int>& numCallsPromise)
+      : loop_(loop), fd_(fd), numCallsPromise_(numCallsPromise) {}
+
+  void handleEventsFromLoop(int /* unused */) override {
+    loop_.unregisterDescriptor(fd_);
+    numCalls_++;
+  }
+
+  ~SelfUnregisteringHandler() override {
+    numCallsPromise_.set_value(numCalls_);
+  }
+
+ private:
+  EpollLoop& loop_;
+  const int fd_;
+  std::promise<int>& numCallsPromise_;
+  int numCalls_{0};
+};
+
+// A busy-polling loop with no events of its own, which goes to sleep right
+// away, for so long that a test would time out unless it's woken up.
+class SleepyBusyPollingLoop final : public BusyPollingLoop {
+ public:
+  SleepyBusyPollingLoop()
+      : BusyPollingLoop(std::chrono::microseconds(0), std::chrono::hours(1)) {
+    startThread("TP_test_loop");
+  }
+
+  void join() {
+    stopBusyPolling();
+    joinThread();
+  }
+
+  int getNumSleeps() {
+    return numSleeps_;
+  }
+
+ protected:
+  bool pollOnce() override {
+    return false;
+  }
+
+  bool readyToClose() override {
+    return true;
+  }
+
+  void prepareToSleep() override {
+    ++numSleeps_;
+  }
+
+ private:
+  std::atomic<int> numSleeps_{0};
+};
+
 } // namespace
 
 TEST(ShmLoop, RegisterUnregister) {
@@ -171,6 +236,35 @@ TEST(ShmLoop, RegisterUnregister) {
   loop.join();
 }
 
+TEST(ShmLoop, UnregisterFromHandler) {
+  OnDemandDeferredExecutor deferredExecutor;
+  EpollLoop loop{deferredExecutor};
+  auto efd = Fd(eventfd(0, EFD_NONBLOCK));
+  std::promise<int> numCallsPromise;
+
+  deferredExecutor.runInLoop([&]() {
+    loop.registerDescriptor(
+        efd.fd(),
+        EPOLLOUT,
+        std::make_shared<SelfUnregisteringHandler>(
+            loop, efd.fd(), numCallsPromise));
+  });
+
+  // The handler is only released once it's done, and it's called only once
+  // even though the fd stays writable.
+  EXPECT_EQ(numCallsPromise.get_future().get(), 1);
+
+  // The fd can be registered again, with another handler.
+  auto handler = std::make_shared<Handler>();
+  deferredExecutor.runInLoop([&]() {
+    loop.registerDescriptor(efd.fd(), EPOLLOUT | EPOLLONESHOT, handler);
+  });
+  ASSERT_EQ(handler->nextEvents(), EPOLLOUT);
+  deferredExecutor.runInLoop([&]() { loop.unregisterDescriptor(efd.fd()); });
+
+  loop.join();
+}
+
 TEST(ShmLoop, Monitor) {
   OnDemandDeferredExecutor deferredExecutor;
   EpollLoop loop{deferredExecutor};
@@ -250,3 +344,40 @@ TEST(ShmLoop, Defer) {
   future.wait();
   ASSERT_TRUE(future.valid());
 }
+
+TEST(ShmLoop, Integrated) {
+  SleepyBusyPollingLoop busyPollingLoop;
+  EpollLoop loop{busyPollingLoop};
+  auto efd = Fd(eventfd(0, EFD_NONBLOCK));
+  constexpr uint64_t kValue = 1337;
+
+  // Let the busy-polling loop fall asleep before the event comes in.
+  std::promise<uint64_t> valuePromise;
+  auto shared = std::make_shared<int>(1338);
+  auto monitor = createMonitor<int>(
+      busyPollingLoop,
+      loop,
+      shared,
+      efd.fd(),
+      EPOLLIN,
+      [&](int& i, FunctionEventHandler& handler) {
+        EXPECT_EQ(i, 1338);
+        // The handler runs on the busy-polling loop itself.
+        EXPECT_TRUE(busyPollingLoop.inLoop());
+        valuePromise.set_value(efd.readOrThrow<uint64_t>());
+        handler.cancel();
+      });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_GT(busyPollingLoop.getNumSleeps(), 0);
+  efd.writeOrThrow<uint64_t>(kValue);
+
+  std::future<uint64_t> valueFuture = valuePromise.get_future();
+  ASSERT_EQ(
+      valueFuture.wait_for(std::chrono::seconds(10)),
+      std::future_status::ready);
+  ASSERT_EQ(valueFuture.get(), kValue);
+
+  monitor.reset();
+  loop.join();
+  busyPollingLoop.join();
+}
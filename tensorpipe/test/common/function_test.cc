@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/core/message.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(MoveOnlyFunction, ArgumentsAndReturnValue) {
+  MoveOnlyFunction<std::string(const std::string&, std::unique_ptr<int>)> fn =
+      [suffix{std::string("!")}](
+          const std::string& prefix, std::unique_ptr<int> value) {
+        return prefix + std::to_string(*value) + suffix;
+      };
+  EXPECT_EQ(fn("foo", std::make_unique<int>(42)), "foo42!");
+}
+
+TEST(MoveOnlyFunction, CaptureMessageByMove) {
+  Message message;
+  message.metadata = "foo";
+  message.payloads.resize(2);
+
+  MoveOnlyFunction<void(size_t&)> fn =
+      [message{std::move(message)}](size_t& numPayloads) {
+        EXPECT_EQ(message.metadata, "foo");
+        numPayloads = message.payloads.size();
+      };
+  MoveOnlyFunction<void(size_t&)> other = std::move(fn);
+  EXPECT_FALSE(fn);
+  EXPECT_EQ(fn, nullptr);
+
+  size_t numPayloads = 0;
+  other(numPayloads);
+  EXPECT_EQ(numPayloads, 2);
+}
+
+TEST(MoveOnlyFunction, DestroysCallable) {
+  auto shared = std::make_shared<int>(0);
+  std::weak_ptr<int> observer = shared;
+  MoveOnlyFunction<void()> fn = [shared{std::move(shared)}]() {};
+  EXPECT_FALSE(observer.expired());
+  fn = nullptr;
+  EXPECT_TRUE(observer.expired());
+}
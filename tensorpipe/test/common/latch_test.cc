@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#include <tensorpipe/common/deferred_executor.h>
+#include <tensorpipe/common/latch.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(Latch, OpenBeforeWait) {
+  Latch latch;
+  latch.open();
+  latch.wait();
+}
+
+TEST(Latch, OpenWhileWaiting) {
+  for (int iter = 0; iter < 100; iter++) {
+    Latch latch;
+    bool done = false;
+    std::thread thread([&]() {
+      if (iter % 2 == 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+      done = true;
+      latch.open();
+    });
+    latch.wait();
+    EXPECT_TRUE(done);
+    thread.join();
+  }
+}
+
+TEST(Latch, RunInLoopRethrows) {
+  OnDemandDeferredExecutor loop;
+  // Hold the loop on another thread, so that runInLoop has to wait for it.
+  Latch started;
+  Latch release;
+  std::thread thread([&]() {
+    loop.deferToLoop([&]() {
+      started.open();
+      release.wait();
+    });
+  });
+  started.wait();
+
+  std::thread opener([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    release.open();
+  });
+  int value = 0;
+  loop.runInLoop([&]() { value = 42; });
+  EXPECT_EQ(value, 42);
+  EXPECT_THROW(
+      loop.runInLoop([]() { throw std::runtime_error("oops"); }),
+      std::runtime_error);
+
+  opener.join();
+  thread.join();
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include <tensorpipe/common/lock_stats.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(LockStats, CountsContendedAcquisitions) {
+  enableLockStats();
+  ProfiledMutex mutex("test/contended");
+  ProfiledMutex otherMutex("test/contended");
+
+  std::thread waiter;
+  {
+    std::unique_lock<std::mutex> lock = mutex.acquire();
+    waiter = std::thread([&]() {
+      // This waits for the main thread to let go of the mutex.
+      std::unique_lock<std::mutex> lock = mutex.acquire();
+    });
+    // The acquisition is counted once the waiter found the mutex held.
+    while (getLockStats()["test/contended"].numAcquisitions < 2) {
+      std::this_thread::yield();
+    }
+  }
+  waiter.join();
+  { std::unique_lock<std::mutex> lock = otherMutex.acquire(); }
+
+  // The two mutexes are counted together, as they share their name.
+  const LockStats stats = getLockStats()["test/contended"];
+  EXPECT_EQ(stats.numAcquisitions, 3);
+  EXPECT_EQ(stats.numContendedAcquisitions, 1);
+  EXPECT_GT(stats.totalWaitTime, std::chrono::nanoseconds(0));
+  EXPECT_EQ(stats.maxWaitTime, stats.totalWaitTime);
+}
+
+TEST(LockStats, Merge) {
+  LockStats first;
+  first.numAcquisitions = 10;
+  first.numContendedAcquisitions = 2;
+  first.totalWaitTime = std::chrono::microseconds(30);
+  first.maxWaitTime = std::chrono::microseconds(20);
+
+  LockStats second;
+  second.numAcquisitions = 5;
+  second.numContendedAcquisitions = 1;
+  second.totalWaitTime = std::chrono::microseconds(40);
+  second.maxWaitTime = std::chrono::microseconds(40);
+
+  first.merge(second);
+  EXPECT_EQ(first.numAcquisitions, 15);
+  EXPECT_EQ(first.numContendedAcquisitions, 3);
+  EXPECT_EQ(first.totalWaitTime, std::chrono::microseconds(70));
+  EXPECT_EQ(first.maxWaitTime, std::chrono::microseconds(40));
+}
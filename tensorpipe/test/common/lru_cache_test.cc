@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <string>
+
+#include <tensorpipe/common/lru_cache.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(LruCache, FindAndInsert) {
+  LruCache<int, std::string> cache(2);
+  EXPECT_EQ(cache.find(1), nullptr);
+
+  cache.insert(1, "one");
+  cache.insert(2, "two");
+  ASSERT_NE(cache.find(1), nullptr);
+  EXPECT_EQ(*cache.find(1), "one");
+  ASSERT_NE(cache.find(2), nullptr);
+  EXPECT_EQ(*cache.find(2), "two");
+  EXPECT_EQ(cache.size(), 2);
+}
+
+TEST(LruCache, EvictLeastRecentlyUsed) {
+  LruCache<int, std::string> cache(2);
+  cache.insert(1, "one");
+  cache.insert(2, "two");
+
+  // Accessing the first entry makes the second one the least recently used.
+  EXPECT_NE(cache.find(1), nullptr);
+  cache.insert(3, "three");
+
+  EXPECT_NE(cache.find(1), nullptr);
+  EXPECT_EQ(cache.find(2), nullptr);
+  EXPECT_NE(cache.find(3), nullptr);
+  EXPECT_EQ(cache.size(), 2);
+}
+
+TEST(LruCache, DestroyValueOnEviction) {
+  auto value = std::make_shared<int>(42);
+  LruCache<int, std::shared_ptr<int>> cache(1);
+  cache.insert(1, value);
+  EXPECT_EQ(value.use_count(), 2);
+
+  cache.insert(2, nullptr);
+  EXPECT_EQ(value.use_count(), 1);
+
+  cache.clear();
+  EXPECT_EQ(cache.size(), 0);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/memcpy.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+std::vector<uint8_t> makeSource(size_t length) {
+  std::vector<uint8_t> src(length);
+  for (size_t idx = 0; idx < length; idx++) {
+    src[idx] = static_cast<uint8_t>(idx * 7 + idx / 251);
+  }
+  return src;
+}
+
+} // namespace
+
+TEST(CopyMemory, NonTemporalAllLengthsAndAlignments) {
+  // Cover the unaligned head, the vectorized loop and the tail, with any
+  // relative alignment of the source and the destination.
+  const std::vector<uint8_t> src = makeSource(4096 + 64);
+  for (size_t length : {0, 1, 31, 63, 64, 65, 127, 128, 255, 256, 1000, 4096}) {
+    for (size_t srcOffset : {0, 1, 17, 32}) {
+      for (size_t dstOffset : {0, 3, 32, 63}) {
+        std::vector<uint8_t> dst(length + 128, 0xff);
+        copyMemoryNonTemporal(
+            dst.data() + dstOffset, src.data() + srcOffset, length);
+        for (size_t idx = 0; idx < dst.size(); idx++) {
+          if (idx >= dstOffset && idx < dstOffset + length) {
+            ASSERT_EQ(dst[idx], src[srcOffset + idx - dstOffset])
+                << "length " << length << ", offsets " << srcOffset << " and "
+                << dstOffset << ", byte " << idx;
+          } else {
+            ASSERT_EQ(dst[idx], 0xff)
+                << "length " << length << ", offsets " << srcOffset << " and "
+                << dstOffset << ", byte " << idx << " was overwritten";
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(CopyMemory, AboveThreshold) {
+  const size_t length = kNonTemporalCopyThreshold * 3 + 5;
+  const std::vector<uint8_t> src = makeSource(length + 1);
+  std::vector<uint8_t> dst(length);
+  copyMemory(dst.data(), src.data() + 1, length);
+  EXPECT_TRUE(std::equal(dst.begin(), dst.end(), src.begin() + 1));
+}
+
+TEST(CopyMemory, Implementation) {
+  const std::string name = getNonTemporalCopyImplementation();
+  EXPECT_TRUE(name == "avx512" || name == "avx2" || name == "memcpy") << name;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <utility>
+
+#include <tensorpipe/common/memory_footprint.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(MemoryFootprint, ChargesAddUpByKind) {
+  MemoryFootprintCounters counters;
+  {
+    MemoryCharge host(counters, MemoryKind::kHost, 100);
+    MemoryCharge shared(counters, MemoryKind::kShared, 1000);
+    MemoryCharge moreShared(counters, MemoryKind::kShared, 24);
+
+    MemoryFootprint footprint = counters.snapshot();
+    EXPECT_EQ(footprint.hostBytes, 100);
+    EXPECT_EQ(footprint.pinnedBytes, 0);
+    EXPECT_EQ(footprint.registeredBytes, 0);
+    EXPECT_EQ(footprint.deviceMappedBytes, 0);
+    EXPECT_EQ(footprint.sharedBytes, 1024);
+    EXPECT_EQ(footprint.totalBytes(), 1124);
+
+    footprint.merge(footprint);
+    EXPECT_EQ(footprint.hostBytes, 200);
+    EXPECT_EQ(footprint.sharedBytes, 2048);
+  }
+  EXPECT_EQ(counters.snapshot().totalBytes(), 0);
+}
+
+TEST(MemoryFootprint, MoveAndResetCharges) {
+  MemoryFootprintCounters counters;
+  MemoryCharge charge(counters, MemoryKind::kRegistered, 42);
+
+  // Moving the charge doesn't count the memory twice.
+  MemoryCharge otherCharge(std::move(charge));
+  EXPECT_EQ(counters.snapshot().registeredBytes, 42);
+  charge.reset();
+  EXPECT_EQ(counters.snapshot().registeredBytes, 42);
+
+  // Assigning over a charge releases what it accounted for.
+  otherCharge = MemoryCharge(counters, MemoryKind::kPinned, 8);
+  EXPECT_EQ(counters.snapshot().registeredBytes, 0);
+  EXPECT_EQ(counters.snapshot().pinnedBytes, 8);
+
+  otherCharge.reset();
+  EXPECT_EQ(counters.snapshot().totalBytes(), 0);
+  otherCharge.reset();
+  EXPECT_EQ(counters.snapshot().totalBytes(), 0);
+}
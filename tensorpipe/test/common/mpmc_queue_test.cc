@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <atomic>
+#include <deque>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <tensorpipe/common/mpmc_queue.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(MpmcQueue, CapacityIsRoundedUp) {
+  EXPECT_EQ(MpmcQueue<int>(1).capacity(), 1);
+  EXPECT_EQ(MpmcQueue<int>(3).capacity(), 4);
+  EXPECT_EQ(MpmcQueue<int>(64).capacity(), 64);
+}
+
+TEST(MpmcQueue, PopAll) {
+  MpmcQueue<int> queue(4);
+  queue.push(1);
+  queue.push(2);
+  queue.push(3);
+
+  std::deque<int> items{0};
+  queue.popAll(items);
+  EXPECT_EQ(items, std::deque<int>({0, 1, 2, 3}));
+
+  // The queue is empty again, and its slots can be used for another lap.
+  for (int item = 4; item < 8; item++) {
+    queue.push(item);
+  }
+  for (int item = 4; item < 8; item++) {
+    EXPECT_EQ(queue.pop(), item);
+  }
+}
+
+TEST(MpmcQueue, PushWaitsForRoom) {
+  MpmcQueue<int> queue(2);
+  queue.push(1);
+  queue.push(2);
+
+  std::promise<void> pushed;
+  std::thread producer([&]() {
+    queue.push(3);
+    pushed.set_value();
+  });
+  std::future<void> pushedFuture = pushed.get_future();
+  EXPECT_EQ(
+      pushedFuture.wait_for(std::chrono::milliseconds(10)),
+      std::future_status::timeout);
+
+  EXPECT_EQ(queue.pop(), 1);
+  pushedFuture.wait();
+  EXPECT_EQ(queue.pop(), 2);
+  EXPECT_EQ(queue.pop(), 3);
+
+  producer.join();
+}
+
+TEST(MpmcQueue, PushIfNotFull) {
+  MpmcQueue<int> queue(2);
+  EXPECT_TRUE(queue.empty());
+  int item = 1;
+  EXPECT_TRUE(queue.pushIfNotFull(item));
+  item = 2;
+  EXPECT_TRUE(queue.pushIfNotFull(item));
+  EXPECT_FALSE(queue.empty());
+
+  // The item is left to the caller when the queue is full.
+  item = 3;
+  EXPECT_FALSE(queue.pushIfNotFull(item));
+  EXPECT_EQ(item, 3);
+
+  std::deque<int> items;
+  queue.popAll(items);
+  EXPECT_EQ(items, std::deque<int>({1, 2}));
+  EXPECT_TRUE(queue.empty());
+  EXPECT_TRUE(queue.pushIfNotFull(item));
+  EXPECT_EQ(queue.pop(), 3);
+}
+
+TEST(MpmcQueue, PopWaitsForAnItem) {
+  MpmcQueue<int> queue(1);
+  std::thread producer([&]() { queue.push(42); });
+
+  std::deque<int> items;
+  queue.popAll(items);
+  EXPECT_EQ(items, std::deque<int>({42}));
+
+  producer.join();
+}
+
+TEST(MpmcQueue, ItemsAreDestroyed) {
+  auto item = std::make_shared<int>(42);
+  {
+    MpmcQueue<std::shared_ptr<int>> queue(4);
+    queue.push(item);
+    queue.push(item);
+    EXPECT_EQ(queue.pop(), item);
+    EXPECT_EQ(item.use_count(), 2);
+  }
+  EXPECT_EQ(item.use_count(), 1);
+}
+
+TEST(MpmcQueue, ManyProducersAndConsumers) {
+  constexpr int kNumProducers = 4;
+  constexpr int kNumConsumers = 4;
+  constexpr int kNumItemsPerProducer = 10000;
+  // Small enough for the producers and the consumers to wait on each other.
+  MpmcQueue<int> queue(8);
+
+  std::vector<std::thread> producers;
+  for (int producerIdx = 0; producerIdx < kNumProducers; producerIdx++) {
+    producers.emplace_back([&, producerIdx]() {
+      for (int itemIdx = 0; itemIdx < kNumItemsPerProducer; itemIdx++) {
+        queue.push(producerIdx * kNumItemsPerProducer + itemIdx);
+      }
+    });
+  }
+
+  // Each consumer checks that it sees the items of each producer in order.
+  std::atomic<int64_t> sum{0};
+  std::atomic<int> numPopped{0};
+  std::vector<std::thread> consumers;
+  for (int consumerIdx = 0; consumerIdx < kNumConsumers; consumerIdx++) {
+    consumers.emplace_back([&]() {
+      std::vector<int> lastItems(kNumProducers, -1);
+      while (true) {
+        const int item = queue.pop();
+        if (item < 0) {
+          break;
+        }
+        const int producerIdx = item / kNumItemsPerProducer;
+        EXPECT_GT(item, lastItems[producerIdx]);
+        lastItems[producerIdx] = item;
+        sum += item;
+        numPopped++;
+      }
+    });
+  }
+
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  for (int consumerIdx = 0; consumerIdx < kNumConsumers; consumerIdx++) {
+    queue.push(-1);
+  }
+  for (auto& consumer : consumers) {
+    consumer.join();
+  }
+
+  constexpr int kNumItems = kNumProducers * kNumItemsPerProducer;
+  EXPECT_EQ(numPopped.load(), kNumItems);
+  EXPECT_EQ(sum.load(), static_cast<int64_t>(kNumItems) * (kNumItems - 1) / 2);
+}
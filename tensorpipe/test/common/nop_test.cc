@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <tensorpipe/common/nop.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+struct FixedLayoutMessage {
+  uint64_t offset;
+  uint32_t length;
+  NOP_STRUCTURE(FixedLayoutMessage, offset, length);
+};
+
+struct VariableLayoutMessage {
+  uint64_t offset;
+  std::string name;
+  NOP_STRUCTURE(VariableLayoutMessage, offset, name);
+};
+
+static_assert(
+    IsFixedLayoutNopType<FixedLayoutMessage>::value,
+    "a struct of integers has a fixed layout");
+static_assert(
+    !IsFixedLayoutNopType<VariableLayoutMessage>::value,
+    "a struct with a string doesn't have a fixed layout");
+
+} // namespace
+
+TEST(NopHolder, FixedLayoutIsCopiedAsItIs) {
+  NopHolder<FixedLayoutMessage> holder;
+  holder.getObject().offset = 0x0123456789abcdef;
+  holder.getObject().length = 42;
+  ASSERT_EQ(holder.getSize(), sizeof(FixedLayoutMessage));
+
+  std::array<uint8_t, sizeof(FixedLayoutMessage)> buffer;
+  NopWriter writer(buffer.data(), buffer.size());
+  ASSERT_FALSE(holder.write(writer).has_error());
+  FixedLayoutMessage copy;
+  std::memcpy(&copy, buffer.data(), sizeof(copy));
+  EXPECT_EQ(copy.offset, 0x0123456789abcdef);
+  EXPECT_EQ(copy.length, 42);
+}
+
+TEST(NopHolder, FixedLayoutAcrossWrapAround) {
+  NopHolder<FixedLayoutMessage> source;
+  source.getObject().offset = 1234;
+  source.getObject().length = 5678;
+
+  // Split the bytes in two, as at the end of a ringbuffer.
+  std::array<uint8_t, 5> head;
+  std::array<uint8_t, sizeof(FixedLayoutMessage) - 5> tail;
+  NopWriter writer(head.data(), head.size(), tail.data(), tail.size());
+  ASSERT_FALSE(source.write(writer).has_error());
+
+  NopHolder<FixedLayoutMessage> target;
+  NopReader reader(head.data(), head.size(), tail.data(), tail.size());
+  ASSERT_FALSE(target.read(reader).has_error());
+  EXPECT_EQ(target.getObject().offset, 1234);
+  EXPECT_EQ(target.getObject().length, 5678);
+}
+
+TEST(NopHolder, FixedLayoutRejectsTruncation) {
+  NopHolder<FixedLayoutMessage> source;
+  std::array<uint8_t, sizeof(FixedLayoutMessage) - 1> buffer;
+  NopWriter writer(buffer.data(), buffer.size());
+  EXPECT_TRUE(source.write(writer).has_error());
+
+  NopHolder<FixedLayoutMessage> target;
+  NopReader reader(buffer.data(), buffer.size());
+  EXPECT_TRUE(target.read(reader).has_error());
+}
+
+TEST(NopHolder, VariableLayoutRoundTrip) {
+  NopHolder<VariableLayoutMessage> source;
+  source.getObject().offset = 1234;
+  source.getObject().name = "foo";
+
+  std::string buffer(source.getSize(), '\0');
+  NopWriter writer(reinterpret_cast<uint8_t*>(&buffer[0]), buffer.size());
+  ASSERT_FALSE(source.write(writer).has_error());
+
+  NopHolder<VariableLayoutMessage> target;
+  NopReader reader(
+      reinterpret_cast<const uint8_t*>(buffer.data()), buffer.size());
+  ASSERT_FALSE(target.read(reader).has_error());
+  EXPECT_EQ(target.getObject().offset, 1234);
+  EXPECT_EQ(target.getObject().name, "foo");
+}
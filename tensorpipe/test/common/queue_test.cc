@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <deque>
+#include <thread>
+
+#include <tensorpipe/common/queue.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(Queue, PopAll) {
+  Queue<int> queue(3);
+  queue.push(1);
+  queue.push(2);
+  queue.push(3);
+
+  std::deque<int> items{0};
+  queue.popAll(items);
+  EXPECT_EQ(items, std::deque<int>({0, 1, 2, 3}));
+
+  // The queue is empty again, so a producer isn't blocked by its capacity.
+  queue.push(4);
+  EXPECT_EQ(queue.pop(), 4);
+}
+
+TEST(Queue, PopAllWaitsForAnItem) {
+  Queue<int> queue;
+  std::thread producer([&]() { queue.push(42); });
+
+  std::deque<int> items;
+  queue.popAll(items);
+  EXPECT_EQ(items, std::deque<int>({42}));
+
+  producer.join();
+}
@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <array>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/common/read_buffer_pool.h>
+#include <tensorpipe/common/ringbuffer_read_write_ops.h>
+#include <tensorpipe/util/ringbuffer/consumer.h>
+#include <tensorpipe/util/ringbuffer/producer.h>
+#include <tensorpipe/util/ringbuffer/ringbuffer.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::util::ringbuffer;
+
+namespace {
+
+// Holds and owns the memory for the ringbuffer's header and data.
+class RingBufferStorage {
+ public:
+  explicit RingBufferStorage(size_t size) : header_(size) {}
+
+  RingBuffer getRb() {
+    return {&header_, data_.get()};
+  }
+
+  const uint8_t* getData() const {
+    return data_.get();
+  }
+
+ private:
+  RingBufferHeader header_;
+  std::unique_ptr<uint8_t[]> data_ =
+      std::make_unique<uint8_t[]>(header_.kDataPoolByteSize);
+};
+
+void writeAll(RingBuffer& rb, const std::string& data) {
+  Producer producer(rb);
+  RingbufferWriteOperation writeOp(
+      data.data(), data.size(), [](const Error& error) {
+        EXPECT_FALSE(error) << error.what();
+      });
+  writeOp.handleWrite(producer);
+  ASSERT_TRUE(writeOp.completed());
+}
+
+} // namespace
+
+TEST(RingbufferReadOperation, BorrowContiguousPayload) {
+  RingBufferStorage storage(64);
+  RingBuffer rb = storage.getRb();
+  const std::string data = "a small payload";
+  writeAll(rb, data);
+
+  Consumer consumer(rb);
+  bool called = false;
+  RingbufferReadOperation readOp(
+      [&](const Error& error, const void* ptr, size_t len) {
+        ASSERT_FALSE(error) << error.what();
+        called = true;
+        // The pointer must be into the ringbuffer and the data not released
+        // yet to the producer.
+        const uint8_t* bytePtr = reinterpret_cast<const uint8_t*>(ptr);
+        EXPECT_GE(bytePtr, storage.getData());
+        EXPECT_LT(bytePtr, storage.getData() + 64);
+        EXPECT_NE(rb.getHeader().readHead(), rb.getHeader().readTail());
+        EXPECT_EQ(std::string(reinterpret_cast<const char*>(ptr), len), data);
+      });
+  readOp.handleRead(consumer);
+  EXPECT_TRUE(readOp.completed());
+  EXPECT_TRUE(called);
+  EXPECT_EQ(rb.getHeader().readHead(), rb.getHeader().readTail());
+}
+
+TEST(RingbufferReadOperation, CopyWrappingPayload) {
+  RingBufferStorage storage(64);
+  RingBuffer rb = storage.getRb();
+
+  // Move the head and tail close to the end of the ringbuffer.
+  writeAll(rb, std::string(48, 'x'));
+  {
+    Consumer consumer(rb);
+    RingbufferReadOperation readOp(
+        [](const Error& error, const void* /* unused */, size_t len) {
+          ASSERT_FALSE(error) << error.what();
+          EXPECT_EQ(len, 48);
+        });
+    readOp.handleRead(consumer);
+    ASSERT_TRUE(readOp.completed());
+  }
+
+  const std::string data = "a payload that wraps around";
+  writeAll(rb, data);
+
+  Consumer consumer(rb);
+  bool called = false;
+  RingbufferReadOperation readOp(
+      [&](const Error& error, const void* ptr, size_t len) {
+        ASSERT_FALSE(error) << error.what();
+        called = true;
+        EXPECT_EQ(std::string(reinterpret_cast<const char*>(ptr), len), data);
+      });
+  readOp.handleRead(consumer);
+  EXPECT_TRUE(readOp.completed());
+  EXPECT_TRUE(called);
+}
+
+TEST(RingbufferReadOperation, CopyPayloadLargerThanRingbuffer) {
+  RingBufferStorage storage(64);
+  RingBuffer rb = storage.getRb();
+  const std::string data(200, 'y');
+
+  Producer producer(rb);
+  Consumer consumer(rb);
+  RingbufferWriteOperation writeOp(
+      data.data(), data.size(), [](const Error& error) {
+        EXPECT_FALSE(error) << error.what();
+      });
+  bool called = false;
+  RingbufferReadOperation readOp(
+      [&](const Error& error, const void* ptr, size_t len) {
+        ASSERT_FALSE(error) << error.what();
+        called = true;
+        EXPECT_EQ(std::string(reinterpret_cast<const char*>(ptr), len), data);
+      });
+  while (!readOp.completed()) {
+    writeOp.handleWrite(producer);
+    readOp.handleRead(consumer);
+  }
+  EXPECT_TRUE(writeOp.completed());
+  EXPECT_TRUE(called);
+}
+
+TEST(RingbufferReadOperation, ReuseBuffersFromPool) {
+  RingBufferStorage storage(64);
+  RingBuffer rb = storage.getRb();
+  ReadBufferPool pool;
+
+  Producer producer(rb);
+  Consumer consumer(rb);
+  for (int iter = 0; iter < 10; iter++) {
+    const std::string data(200, 'a' + iter);
+    RingbufferWriteOperation writeOp(
+        data.data(), data.size(), [](const Error& error) {
+          EXPECT_FALSE(error) << error.what();
+        });
+    bool called = false;
+    RingbufferReadOperation readOp(
+        [&](const Error& error, const void* ptr, size_t len) {
+          ASSERT_FALSE(error) << error.what();
+          called = true;
+          EXPECT_EQ(
+              std::string(reinterpret_cast<const char*>(ptr), len), data);
+        });
+    readOp.setBufferPool(&pool);
+    while (!readOp.completed()) {
+      writeOp.handleWrite(producer);
+      readOp.handleRead(consumer);
+    }
+    EXPECT_TRUE(called);
+  }
+  // Each operation gave its buffer back to the pool for the next one.
+  EXPECT_EQ(pool.numAllocations(), 1);
+}
+
+TEST(RingbufferWriteOperation, Rendezvous) {
+  RingBufferStorage storage(64);
+  RingBuffer rb = storage.getRb();
+  const std::string small = "small";
+  const std::string large(100, 'z');
+  const std::string last = "last";
+
+  auto nopHolderOut = std::make_shared<NopHolder<std::string>>();
+  nopHolderOut->getObject() = "nop";
+  Producer producer(rb);
+  Consumer consumer(rb);
+  bool writeCalled = false;
+  RingbufferWriteOperation writeOp(
+      nopHolderOut.get(),
+      {{small.data(), small.size()},
+       {large.data(), large.size()},
+       {last.data(), last.size()}},
+      [&](const Error& error) {
+        EXPECT_FALSE(error) << error.what();
+        writeCalled = true;
+      });
+  writeOp.setRendezvousThreshold(large.size());
+
+  // Only the length of the large buffer goes through the ringbuffer, and the
+  // operation stops there until the transport delivers it by other means.
+  writeOp.handleWrite(producer);
+  ASSERT_TRUE(writeOp.awaitingRendezvous());
+  EXPECT_EQ(writeOp.rendezvousPtr(), large.data());
+  EXPECT_EQ(writeOp.rendezvousLength(), large.size());
+  writeOp.handleWrite(producer);
+  ASSERT_TRUE(writeOp.awaitingRendezvous());
+
+  auto nopHolderIn = std::make_shared<NopHolder<std::string>>();
+  RingbufferReadOperation nopReadOp(
+      nopHolderIn.get(),
+      [](const Error& error, const void* /* unused */, size_t /* unused */) {
+        EXPECT_FALSE(error) << error.what();
+      });
+  nopReadOp.setRendezvousThreshold(large.size());
+  nopReadOp.handleRead(consumer);
+  ASSERT_TRUE(nopReadOp.completed());
+  EXPECT_EQ(nopHolderIn->getObject(), "nop");
+
+  auto smallBuf = std::make_unique<char[]>(small.size());
+  RingbufferReadOperation smallReadOp(
+      smallBuf.get(),
+      small.size(),
+      [](const Error& error, const void* /* unused */, size_t /* unused */) {
+        EXPECT_FALSE(error) << error.what();
+      });
+  smallReadOp.setRendezvousThreshold(large.size());
+  smallReadOp.handleRead(consumer);
+  ASSERT_TRUE(smallReadOp.completed());
+  EXPECT_EQ(std::string(smallBuf.get(), small.size()), small);
+
+  bool largeReadCalled = false;
+  RingbufferReadOperation largeReadOp(
+      [&](const Error& error, const void* ptr, size_t len) {
+        ASSERT_FALSE(error) << error.what();
+        largeReadCalled = true;
+        EXPECT_EQ(std::string(reinterpret_cast<const char*>(ptr), len), large);
+      });
+  largeReadOp.setRendezvousThreshold(large.size());
+  largeReadOp.handleRead(consumer);
+  ASSERT_TRUE(largeReadOp.awaitingRendezvous());
+  ASSERT_EQ(largeReadOp.rendezvousLength(), large.size());
+  EXPECT_EQ(rb.getHeader().readHead(), rb.getHeader().readTail());
+
+  // Play the part of the transport.
+  std::memcpy(
+      largeReadOp.rendezvousPtr(),
+      writeOp.rendezvousPtr(),
+      writeOp.rendezvousLength());
+  largeReadOp.completeRendezvous();
+  EXPECT_TRUE(largeReadOp.completed());
+  EXPECT_TRUE(largeReadCalled);
+  writeOp.completeRendezvous();
+  EXPECT_FALSE(writeCalled);
+
+  writeOp.handleWrite(producer);
+  EXPECT_TRUE(writeOp.completed());
+  EXPECT_TRUE(writeCalled);
+
+  RingbufferReadOperation lastReadOp(
+      [&](const Error& error, const void* ptr, size_t len) {
+        ASSERT_FALSE(error) << error.what();
+        EXPECT_EQ(std::string(reinterpret_cast<const char*>(ptr), len), last);
+      });
+  lastReadOp.setRendezvousThreshold(large.size());
+  lastReadOp.handleRead(consumer);
+  EXPECT_TRUE(lastReadOp.completed());
+}
+
+TEST(RingbufferWriteOperation, Eager) {
+  const std::string data = "eager";
+  std::array<uint8_t, 16> message;
+
+  // Too large, or started through the ringbuffer: left to the ringbuffer.
+  RingbufferWriteOperation largeWriteOp(
+      data.data(), data.size(), [](const Error& /* unused */) {});
+  EXPECT_EQ(largeWriteOp.handleEagerWrite(message.data(), data.size() - 1), 0);
+  RingBufferStorage storage(64);
+  RingBuffer rb = storage.getRb();
+  Producer producer(rb);
+  RingbufferWriteOperation startedWriteOp(
+      data.data(), data.size(), [](const Error& /* unused */) {});
+  startedWriteOp.handleWrite(producer);
+  EXPECT_EQ(startedWriteOp.handleEagerWrite(message.data(), message.size()), 0);
+
+  bool writeCalled = false;
+  RingbufferWriteOperation writeOp(
+      data.data(), data.size(), [&](const Error& error) {
+        EXPECT_FALSE(error) << error.what();
+        writeCalled = true;
+      });
+  ASSERT_EQ(writeOp.handleEagerWrite(message.data(), message.size()), 5);
+  EXPECT_TRUE(writeOp.completed());
+  EXPECT_TRUE(writeCalled);
+
+  auto buf = std::make_unique<char[]>(data.size());
+  RingbufferReadOperation readOp(
+      buf.get(),
+      data.size(),
+      [](const Error& error, const void* /* unused */, size_t /* unused */) {
+        EXPECT_FALSE(error) << error.what();
+      });
+  ASSERT_TRUE(readOp.awaitingLength());
+  readOp.handleEagerRead(message.data(), data.size());
+  EXPECT_TRUE(readOp.completed());
+  EXPECT_EQ(std::string(buf.get(), data.size()), data);
+
+  // Nop objects are serialized without their framing.
+  auto nopHolderOut = std::make_shared<NopHolder<std::string>>();
+  nopHolderOut->getObject() = "nop";
+  RingbufferWriteOperation nopWriteOp(
+      nopHolderOut.get(), [](const Error& /* unused */) {});
+  size_t len = nopWriteOp.handleEagerWrite(message.data(), message.size());
+  ASSERT_EQ(len, nopHolderOut->getSize());
+  auto nopHolderIn = std::make_shared<NopHolder<std::string>>();
+  RingbufferReadOperation nopReadOp(
+      nopHolderIn.get(),
+      [](const Error& error, const void* /* unused */, size_t /* unused */) {
+        EXPECT_FALSE(error) << error.what();
+      });
+  nopReadOp.handleEagerRead(message.data(), len);
+  EXPECT_TRUE(nopReadOp.completed());
+  EXPECT_EQ(nopHolderIn->getObject(), "nop");
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <tensorpipe/common/serial_executor.h>
+#include <tensorpipe/common/worker_pool.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(SerialExecutor, RunsTasksInOrder) {
+  constexpr int kNumTasks = 1000;
+  WorkerPool pool(4, "TP_test_pool");
+  auto executor = std::make_shared<SerialExecutor>(
+      [&pool](SerialExecutor::TTask task) { pool.submit(std::move(task)); });
+  // The tasks aren't synchronized with each other, as they never overlap.
+  std::vector<int> order;
+  std::promise<void> donePromise;
+  for (int taskIdx = 0; taskIdx < kNumTasks; taskIdx++) {
+    executor->submit([&order, &donePromise, taskIdx]() {
+      order.push_back(taskIdx);
+      if (taskIdx == kNumTasks - 1) {
+        donePromise.set_value();
+      }
+    });
+  }
+  donePromise.get_future().get();
+  pool.join();
+  ASSERT_EQ(order.size(), kNumTasks);
+  for (int taskIdx = 0; taskIdx < kNumTasks; taskIdx++) {
+    EXPECT_EQ(order[taskIdx], taskIdx);
+  }
+}
+
+TEST(SerialExecutor, RunsTasksOnTheExecutor) {
+  WorkerPool pool(1, "TP_test_pool");
+  auto executor = std::make_shared<SerialExecutor>(
+      [&pool](SerialExecutor::TTask task) { pool.submit(std::move(task)); });
+  std::promise<std::thread::id> promise;
+  executor->submit(
+      [&promise]() { promise.set_value(std::this_thread::get_id()); });
+  EXPECT_NE(promise.get_future().get(), std::this_thread::get_id());
+}
+
+TEST(SerialExecutor, TasksCanSubmitTasks) {
+  WorkerPool pool(2, "TP_test_pool");
+  auto executor = std::make_shared<SerialExecutor>(
+      [&pool](SerialExecutor::TTask task) { pool.submit(std::move(task)); });
+  std::promise<int> promise;
+  executor->submit([&]() {
+    auto value = std::make_unique<int>(42);
+    executor->submit([&promise, value{std::move(value)}]() {
+      promise.set_value(*value);
+    });
+  });
+  EXPECT_EQ(promise.get_future().get(), 42);
+}
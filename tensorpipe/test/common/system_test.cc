@@ -8,6 +8,16 @@
 
 #include <tensorpipe/common/system.h>
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <thread>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 using namespace tensorpipe;
@@ -36,3 +46,59 @@ TEST(Pow2, nextPow2) {
     EXPECT_EQ(nextPow2(p2 + 1), nextP2);
   }
 }
+
+#ifdef __linux__
+
+TEST(SetUpThread, NameAndAffinity) {
+  cpu_set_t cpuSet;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(cpuSet), &cpuSet), 0);
+  int cpu = 0;
+  while (!CPU_ISSET(cpu, &cpuSet)) {
+    cpu++;
+  }
+
+  std::thread thread([cpu]() {
+    setUpThread(ThreadOptions().namePrefix("XX").cpus({cpu}), "TP_test");
+
+    std::array<char, 16> name;
+    ASSERT_EQ(pthread_getname_np(pthread_self(), name.data(), name.size()), 0);
+    EXPECT_STREQ(name.data(), "XX_test");
+
+    cpu_set_t threadCpuSet;
+    ASSERT_EQ(
+        pthread_getaffinity_np(
+            pthread_self(), sizeof(threadCpuSet), &threadCpuSet),
+        0);
+    EXPECT_EQ(CPU_COUNT(&threadCpuSet), 1);
+    EXPECT_TRUE(CPU_ISSET(cpu, &threadCpuSet));
+  });
+  thread.join();
+}
+
+TEST(GetNumaNodeOfCurrentCpu, MatchesSysfs) {
+  // The node must list the current CPU among its own, which only holds if the
+  // thread isn't migrated in between, hence it's pinned first.
+  cpu_set_t cpuSet;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(cpuSet), &cpuSet), 0);
+  int cpu = 0;
+  while (!CPU_ISSET(cpu, &cpuSet)) {
+    cpu++;
+  }
+  std::thread thread([cpu]() {
+    setUpThread(ThreadOptions().cpus({cpu}), "TP_test");
+    int numaNode = getNumaNodeOfCurrentCpu();
+    ASSERT_GE(numaNode, 0);
+    optional<std::vector<int>> cpus = getCpusOfNumaNode(numaNode);
+    ASSERT_TRUE(cpus.has_value());
+    EXPECT_NE(std::find(cpus->begin(), cpus->end(), cpu), cpus->end());
+  });
+  thread.join();
+}
+
+TEST(GetNumaNodeOfPciDevice, UnknownDevice) {
+  // The device numbers only go up to 1f, hence there can be no such device.
+  EXPECT_EQ(getNumaNodeOfPciDevice("ffff:ff:ff.f"), -1);
+  EXPECT_EQ(getNumaNodeOfPciDevice(""), -1);
+}
+
+#endif // __linux__
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <tensorpipe/common/task_queue.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(Task, SmallAndLargeClosures) {
+  int count = 0;
+  Task small([&count]() { count += 1; });
+  small();
+  EXPECT_EQ(count, 1);
+
+  std::array<char, 2 * Task::kInlineSize> padding{};
+  padding[0] = 2;
+  Task large([&count, padding]() { count += padding[0]; });
+  large();
+  EXPECT_EQ(count, 3);
+}
+
+TEST(Task, MoveOnly) {
+  auto value = std::make_unique<int>(42);
+  std::weak_ptr<int> observer;
+  auto shared = std::make_shared<int>(0);
+  observer = shared;
+
+  Task task([value{std::move(value)}, shared{std::move(shared)}]() {
+    EXPECT_EQ(*value, 42);
+  });
+  EXPECT_FALSE(observer.expired());
+
+  Task other(std::move(task));
+  EXPECT_FALSE(task);
+  ASSERT_TRUE(other);
+  other();
+
+  other = Task();
+  EXPECT_TRUE(observer.expired());
+}
+
+TEST(MpscTaskQueue, RunsTasksInOrder) {
+  MpscTaskQueue queue;
+  std::vector<int> order;
+  for (int idx = 0; idx < 5; idx++) {
+    queue.push([&order, idx]() { order.push_back(idx); });
+  }
+  EXPECT_EQ(queue.runTasks(), 5);
+  EXPECT_EQ(order, std::vector<int>({0, 1, 2, 3, 4}));
+  EXPECT_EQ(queue.runTasks(), 0);
+}
+
+TEST(MpscTaskQueue, DoesNotRunTasksPushedWhileRunning) {
+  MpscTaskQueue queue;
+  int count = 0;
+  std::function<void()> repush = [&]() {
+    count++;
+    queue.push(repush);
+  };
+  queue.push(repush);
+  EXPECT_EQ(queue.runTasks(), 1);
+  EXPECT_EQ(queue.runTasks(), 1);
+  EXPECT_EQ(count, 2);
+}
+
+TEST(MpscTaskQueue, DestroysTasksOnceRun) {
+  auto shared = std::make_shared<int>(0);
+  std::weak_ptr<int> observer = shared;
+  MpscTaskQueue queue;
+  queue.push([shared{std::move(shared)}]() {});
+  EXPECT_FALSE(observer.expired());
+  EXPECT_EQ(queue.runTasks(), 1);
+  // The node is recycled, but it mustn't hold on to the closure meanwhile.
+  EXPECT_TRUE(observer.expired());
+}
+
+TEST(MpscTaskQueue, ManyProducers) {
+  constexpr int kNumProducers = 8;
+  constexpr int kNumTasksPerProducer = 10000;
+
+  MpscTaskQueue queue;
+  std::atomic<int> numPushed{0};
+  std::vector<int> lastSeen(kNumProducers, -1);
+  bool inOrder = true;
+
+  std::vector<std::thread> producers;
+  for (int producerIdx = 0; producerIdx < kNumProducers; producerIdx++) {
+    producers.emplace_back([&, producerIdx]() {
+      for (int taskIdx = 0; taskIdx < kNumTasksPerProducer; taskIdx++) {
+        queue.push([&, producerIdx, taskIdx]() {
+          // Tasks from the same producer must keep their relative order.
+          inOrder &= lastSeen[producerIdx] == taskIdx - 1;
+          lastSeen[producerIdx] = taskIdx;
+        });
+        ++numPushed;
+      }
+    });
+  }
+
+  size_t numRun = 0;
+  while (numRun < kNumProducers * kNumTasksPerProducer) {
+    numRun += queue.runTasks();
+  }
+
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  EXPECT_EQ(queue.runTasks(), 0);
+  EXPECT_EQ(numPushed, kNumProducers * kNumTasksPerProducer);
+  EXPECT_TRUE(inOrder);
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <vector>
+
+#include <tensorpipe/common/timer_wheel.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(TimerWheel, FiresAfterTimeout) {
+  TimerWheel wheel(std::chrono::milliseconds(1), 16, "TP_test_timer");
+  const auto start = std::chrono::steady_clock::now();
+  std::promise<std::chrono::steady_clock::time_point> promise;
+  wheel.schedule(std::chrono::milliseconds(50), [&promise]() {
+    promise.set_value(std::chrono::steady_clock::now());
+  });
+  EXPECT_GE(promise.get_future().get() - start, std::chrono::milliseconds(50));
+}
+
+TEST(TimerWheel, FiresInOrderAcrossTurns) {
+  // The timeouts are longer than a turn of the wheel, so that some timers share
+  // a slot with others that expire earlier or later.
+  TimerWheel wheel(std::chrono::milliseconds(1), 4, "TP_test_timer");
+  std::mutex mutex;
+  std::vector<int> order;
+  std::promise<void> donePromise;
+  for (int timerIdx = 0; timerIdx < 5; timerIdx++) {
+    wheel.schedule(
+        std::chrono::milliseconds(10 * (5 - timerIdx)),
+        [&mutex, &order, &donePromise, timerIdx]() {
+          std::unique_lock<std::mutex> lock(mutex);
+          order.push_back(timerIdx);
+          if (order.size() == 5) {
+            donePromise.set_value();
+          }
+        });
+  }
+  donePromise.get_future().get();
+  EXPECT_EQ(order, std::vector<int>({4, 3, 2, 1, 0}));
+}
+
+TEST(TimerWheel, CancelledTimersDontFire) {
+  TimerWheel wheel(std::chrono::milliseconds(1), 16, "TP_test_timer");
+  std::atomic<bool> cancelledFired{false};
+  TimerWheel::TTimerId id =
+      wheel.schedule(std::chrono::milliseconds(10), [&cancelledFired]() {
+        cancelledFired = true;
+      });
+  wheel.cancel(id);
+  std::promise<void> promise;
+  wheel.schedule(
+      std::chrono::milliseconds(30), [&promise]() { promise.set_value(); });
+  promise.get_future().get();
+  EXPECT_FALSE(cancelledFired);
+  // Cancelling a timer that's gone is harmless.
+  wheel.cancel(id);
+}
+
+TEST(TimerWheel, JoinDropsTimers) {
+  std::atomic<bool> fired{false};
+  {
+    TimerWheel wheel(std::chrono::milliseconds(1), 16, "TP_test_timer");
+    wheel.schedule(
+        std::chrono::milliseconds(10000), [&fired]() { fired = true; });
+    wheel.join();
+    wheel.schedule(std::chrono::milliseconds(0), [&fired]() { fired = true; });
+  }
+  EXPECT_FALSE(fired);
+}
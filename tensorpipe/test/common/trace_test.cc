@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <tensorpipe/common/trace.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+std::string writeAndReadTrace() {
+  const std::string path = "/tmp/tensorpipe_trace_test_" +
+      std::to_string(::getpid()) + ".json";
+  EXPECT_TRUE(trace::writeChromeTrace(path));
+  std::ifstream is(path);
+  std::stringstream ss;
+  ss << is.rdbuf();
+  std::remove(path.c_str());
+  return ss.str();
+}
+
+} // namespace
+
+#if TENSORPIPE_ENABLE_TRACING
+
+TEST(Trace, SpansAndFlowsAcrossThreads) {
+  uint64_t flowId;
+  {
+    TP_TRACE_SCOPE("test::outer");
+    flowId = TP_TRACE_NEW_FLOW_ID();
+    TP_TRACE_FLOW_START("test::flow", flowId);
+    TP_TRACE_INSTANT("test::instant");
+  }
+  std::thread thread([flowId]() {
+    TP_TRACE_SCOPE("test::inner");
+    TP_TRACE_FLOW_END("test::flow", flowId);
+  });
+  thread.join();
+
+  const std::string trace = writeAndReadTrace();
+  EXPECT_NE(trace.find("\"ph\":\"X\",\"name\":\"test::outer\""), trace.npos);
+  EXPECT_NE(trace.find("\"ph\":\"X\",\"name\":\"test::inner\""), trace.npos);
+  EXPECT_NE(trace.find("\"ph\":\"i\",\"name\":\"test::instant\""), trace.npos);
+  // Both ends of the flow carry its id.
+  const std::string id = ",\"id\":" + std::to_string(flowId) + ",";
+  const size_t flowStart = trace.find("\"ph\":\"s\",\"name\":\"test::flow\"");
+  const size_t flowEnd = trace.find("\"ph\":\"f\",\"name\":\"test::flow\"");
+  ASSERT_NE(flowStart, trace.npos);
+  ASSERT_NE(flowEnd, trace.npos);
+  EXPECT_NE(
+      trace.substr(flowStart, trace.find('}', flowStart) - flowStart).find(id),
+      std::string::npos);
+  EXPECT_NE(
+      trace.substr(flowEnd, trace.find('}', flowEnd) - flowEnd).find(id),
+      std::string::npos);
+}
+
+#else // TENSORPIPE_ENABLE_TRACING
+
+TEST(Trace, EmptyWhenDisabled) {
+  TP_TRACE_SCOPE("test::outer");
+  TP_TRACE_INSTANT("test::instant");
+  const std::string trace = writeAndReadTrace();
+  EXPECT_EQ(trace.find("test::"), trace.npos);
+  EXPECT_NE(trace.find("\"traceEvents\":[]"), trace.npos);
+}
+
+#endif // TENSORPIPE_ENABLE_TRACING
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <thread>
+
+#include <tensorpipe/common/worker_pool.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(WorkerPool, RunsAllTasks) {
+  constexpr int kNumTasks = 1000;
+  std::atomic<int> count{0};
+  WorkerPool pool(4, "TP_test_pool");
+  for (int taskIdx = 0; taskIdx < kNumTasks; taskIdx++) {
+    pool.submit([&count]() { count++; });
+  }
+  pool.join();
+  EXPECT_EQ(count, kNumTasks);
+}
+
+TEST(WorkerPool, RunsTasksOnOtherThreads) {
+  WorkerPool pool(2, "TP_test_pool");
+  std::promise<std::thread::id> promise;
+  pool.submit([&promise]() { promise.set_value(std::this_thread::get_id()); });
+  EXPECT_NE(promise.get_future().get(), std::this_thread::get_id());
+}
+
+TEST(WorkerPool, RunsTasksInlineOnceJoined) {
+  WorkerPool pool(2, "TP_test_pool");
+  pool.join();
+  std::thread::id threadId;
+  pool.submit([&threadId]() { threadId = std::this_thread::get_id(); });
+  EXPECT_EQ(threadId, std::this_thread::get_id());
+}
+
+TEST(WorkerPool, MoveOnlyTasks) {
+  WorkerPool pool(1, "TP_test_pool");
+  std::promise<int> promise;
+  auto value = std::make_unique<int>(42);
+  pool.submit([&promise, value{std::move(value)}]() {
+    promise.set_value(*value);
+  });
+  EXPECT_EQ(promise.get_future().get(), 42);
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/xxhash64.h>
+
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(Xxhash64, KnownValues) {
+  EXPECT_EQ(xxhash64(nullptr, 0), 0xef46db3751d8e999);
+  EXPECT_EQ(xxhash64("a", 1), 0xd24ec4f1a98c6e5b);
+  EXPECT_EQ(xxhash64("abc", 3), 0x44bc2cf5ad770999);
+  // Long enough to go through the four accumulators.
+  const char* sentence = "Nobody inspects the spammish repetition";
+  EXPECT_EQ(xxhash64(sentence, std::strlen(sentence)), 0xfbcea83c8a378bf1);
+}
+
+TEST(Xxhash64, TellsApartSimilarContents) {
+  // Flipping any single bit, or changing the length or the seed, must change
+  // the hash.
+  std::vector<uint8_t> data(100, 0x5a);
+  std::set<uint64_t> hashes;
+  hashes.insert(xxhash64(data.data(), data.size()));
+  for (size_t idx = 0; idx < data.size(); idx++) {
+    for (int bitIdx = 0; bitIdx < 8; bitIdx++) {
+      data[idx] ^= 1 << bitIdx;
+      hashes.insert(xxhash64(data.data(), data.size()));
+      data[idx] ^= 1 << bitIdx;
+    }
+  }
+  for (size_t length = 0; length < data.size(); length++) {
+    hashes.insert(xxhash64(data.data(), length));
+  }
+  hashes.insert(xxhash64(data.data(), data.size(), 1));
+  EXPECT_EQ(hashes.size(), 1 + data.size() * 8 + data.size() + 1);
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include <tensorpipe/common/system.h>
+#include <tensorpipe/core/allocation_hints.h>
+#include <tensorpipe/core/message.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+bool isAligned(const void* ptr, size_t alignment) {
+  return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+}
+
+} // namespace
+
+TEST(AllocationHints, Alignment) {
+  for (size_t alignment : {0, 1, 64, 4096, 1 << 21}) {
+    AllocationHints hints;
+    hints.alignment = alignment;
+    Error error;
+    std::shared_ptr<uint8_t> buffer;
+    std::tie(error, buffer) = allocateWithHints(1000, DeviceType::kCpu, hints);
+    ASSERT_FALSE(error) << error.what();
+    ASSERT_NE(buffer, nullptr);
+    EXPECT_TRUE(isAligned(buffer.get(), std::max<size_t>(alignment, 1)));
+    std::memset(buffer.get(), 0x42, 1000);
+  }
+}
+
+TEST(AllocationHints, InvalidAlignment) {
+  AllocationHints hints;
+  hints.alignment = 24;
+  Error error;
+  std::shared_ptr<uint8_t> buffer;
+  std::tie(error, buffer) = allocateWithHints(1000, DeviceType::kCpu, hints);
+  EXPECT_TRUE(error);
+  EXPECT_EQ(buffer, nullptr);
+}
+
+TEST(AllocationHints, NumaNode) {
+  AllocationHints hints;
+  hints.numaNode = getNumaNodeOfCurrentCpu();
+  if (hints.numaNode < 0) {
+    GTEST_SKIP() << "Unknown NUMA node";
+  }
+  Error error;
+  std::shared_ptr<uint8_t> buffer;
+  std::tie(error, buffer) = allocateWithHints(1000, DeviceType::kCpu, hints);
+  if (error) {
+    // Some sandboxes don't allow setting memory policies.
+    GTEST_SKIP() << error.what();
+  }
+  EXPECT_TRUE(isAligned(buffer.get(), ::getpagesize()));
+  std::memset(buffer.get(), 0x42, 1000);
+}
+
+#if !TENSORPIPE_SUPPORTS_CUDA
+TEST(AllocationHints, PinnedNeedsCuda) {
+  AllocationHints hints;
+  hints.pinned = true;
+  Error error;
+  std::shared_ptr<uint8_t> buffer;
+  std::tie(error, buffer) = allocateWithHints(1000, DeviceType::kCpu, hints);
+  EXPECT_TRUE(error);
+}
+#endif // !TENSORPIPE_SUPPORTS_CUDA
+
+TEST(AllocationHints, AllocateMessage) {
+  Message message;
+  message.payloads.resize(3);
+  message.payloads[0].length = 100;
+  message.payloads[0].allocationHints.alignment = 4096;
+  message.payloads[1].length = 0;
+  // This one lands in a file, hence it needs no memory.
+  message.payloads[2].length = 100;
+  message.payloads[2].fd = 42;
+  message.tensors.resize(1);
+  message.tensors[0].buffer = CpuBuffer{nullptr, 200};
+  message.tensors[0].allocationHints.alignment = 256;
+
+  std::vector<std::shared_ptr<uint8_t>> buffers;
+  Error error = allocateMessageWithHints(message, buffers);
+  ASSERT_FALSE(error) << error.what();
+  EXPECT_EQ(buffers.size(), 3);
+  EXPECT_NE(message.payloads[0].data, nullptr);
+  EXPECT_TRUE(isAligned(message.payloads[0].data, 4096));
+  EXPECT_EQ(message.payloads[1].data, nullptr);
+  EXPECT_EQ(message.payloads[2].data, nullptr);
+  EXPECT_NE(message.tensors[0].buffer.cpu.ptr, nullptr);
+  EXPECT_TRUE(isAligned(message.tensors[0].buffer.cpu.ptr, 256));
+
+  // The tensors that are handed off get the sender's buffers.
+  Message handedOff;
+  handedOff.handOffTensors = true;
+  handedOff.tensors.resize(1);
+  handedOff.tensors[0].buffer = CpuBuffer{nullptr, 200};
+  buffers.clear();
+  error = allocateMessageWithHints(handedOff, buffers);
+  ASSERT_FALSE(error) << error.what();
+  EXPECT_TRUE(buffers.empty());
+  EXPECT_EQ(handedOff.tensors[0].buffer.cpu.ptr, nullptr);
+}
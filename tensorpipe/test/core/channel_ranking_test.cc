@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/core/channel_ranking.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(ChannelRanking, LengthClasses) {
+  EXPECT_EQ(getChannelRankingLengthClass(0), 0);
+  EXPECT_EQ(getChannelRankingLengthClass(15), 0);
+  EXPECT_EQ(getChannelRankingLengthClass(16), 1);
+  EXPECT_EQ(getChannelRankingLengthClass(4095), 2);
+  EXPECT_EQ(getChannelRankingLengthClass(4096), 3);
+  EXPECT_EQ(
+      getChannelRankingLengthClass(static_cast<size_t>(-1)),
+      kNumChannelRankingLengthClasses - 1);
+}
+
+TEST(ChannelRanking, ProbeAndRank) {
+  const std::string fast = "fast";
+  const std::string slow = "slow";
+  // In order of priority.
+  const std::vector<const std::string*> candidates = {&slow, &fast};
+  const size_t lengthClass = 3;
+
+  ChannelProbes probes;
+  EXPECT_FALSE(probes.rank(lengthClass, candidates).has_value());
+  // The candidates take turns, starting from the highest-priority one, and the
+  // probes in flight count towards their turns.
+  for (size_t probeIdx = 0; probeIdx < ChannelProbes::kNumProbesPerChannel;
+       probeIdx++) {
+    const std::string* channel =
+        probes.nextChannelToProbe(lengthClass, candidates);
+    ASSERT_EQ(channel, &slow);
+    probes.startProbe(lengthClass, *channel);
+    channel = probes.nextChannelToProbe(lengthClass, candidates);
+    ASSERT_EQ(channel, &fast);
+    probes.startProbe(lengthClass, *channel);
+  }
+  EXPECT_EQ(probes.nextChannelToProbe(lengthClass, candidates), nullptr);
+  EXPECT_FALSE(probes.rank(lengthClass, candidates).has_value());
+
+  // One outlier doesn't change the outcome.
+  for (size_t probeIdx = 0; probeIdx < ChannelProbes::kNumProbesPerChannel;
+       probeIdx++) {
+    probes.completeProbe(
+        lengthClass, slow, std::chrono::microseconds(probeIdx == 0 ? 1 : 100));
+    probes.completeProbe(lengthClass, fast, std::chrono::microseconds(10));
+  }
+  optional<std::vector<std::string>> ranking =
+      probes.rank(lengthClass, candidates);
+  ASSERT_TRUE(ranking.has_value());
+  EXPECT_EQ(ranking.value(), std::vector<std::string>({fast, slow}));
+
+  // The other classes are probed separately.
+  EXPECT_EQ(probes.nextChannelToProbe(lengthClass + 1, candidates), &slow);
+}
+
+TEST(ChannelRanking, Cache) {
+  ChannelRankingCache cache(std::chrono::seconds(60));
+  EXPECT_FALSE(cache.get("host", 0).has_value());
+  cache.put("host", 0, {"cma", "basic"});
+  optional<std::vector<std::string>> ranking = cache.get("host", 0);
+  ASSERT_TRUE(ranking.has_value());
+  EXPECT_EQ(ranking.value(), std::vector<std::string>({"cma", "basic"}));
+  EXPECT_FALSE(cache.get("host", 1).has_value());
+  EXPECT_FALSE(cache.get("other_host", 0).has_value());
+
+  ChannelRankingCache expiredCache(std::chrono::seconds(0));
+  expiredCache.put("host", 0, {"cma", "basic"});
+  EXPECT_FALSE(expiredCache.get("host", 0).has_value());
+}
@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <tensorpipe/core/compact_descriptor.h>
+#include <tensorpipe/core/error.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+const std::vector<std::string> kChannelNames = {"basic", "xth"};
+const std::unordered_map<std::string, uint64_t> kChannelIndices = {
+    {"basic", 0},
+    {"xth", 1}};
+
+MessageDescriptor::PayloadDescriptor makePayloadDescriptor(
+    int64_t sizeInBytes,
+    std::string metadata) {
+  MessageDescriptor::PayloadDescriptor nopPayloadDescriptor;
+  nopPayloadDescriptor.sizeInBytes = sizeInBytes;
+  nopPayloadDescriptor.metadata = std::move(metadata);
+  nopPayloadDescriptor.checksum = 0;
+  nopPayloadDescriptor.compression = PayloadCompression::kNone;
+  nopPayloadDescriptor.segmented = false;
+  return nopPayloadDescriptor;
+}
+
+MessageDescriptor::TensorDescriptor makeTensorDescriptor(
+    int64_t sizeInBytes,
+    std::string channelName,
+    std::string channelDescriptor) {
+  MessageDescriptor::TensorDescriptor nopTensorDescriptor;
+  nopTensorDescriptor.sizeInBytes = sizeInBytes;
+  nopTensorDescriptor.deviceType = DeviceType::kCpu;
+  nopTensorDescriptor.channelName = std::move(channelName);
+  nopTensorDescriptor.channelDescriptor = std::move(channelDescriptor);
+  nopTensorDescriptor.checksum = 0;
+  nopTensorDescriptor.handoffId = 0;
+  nopTensorDescriptor.dedup = TensorDedup::kNone;
+  nopTensorDescriptor.dedupHash = 0;
+  return nopTensorDescriptor;
+}
+
+MessageDescriptor makeMessageDescriptor() {
+  MessageDescriptor nopMessageDescriptor;
+  nopMessageDescriptor.metadata = "a message";
+  nopMessageDescriptor.hasChecksums = true;
+  nopMessageDescriptor.handsOffTensors = false;
+  nopMessageDescriptor.coalescesCudaTensors = false;
+  nopMessageDescriptor.payloadDescriptors.push_back(
+      makePayloadDescriptor(13, "a payload"));
+  nopMessageDescriptor.payloadDescriptors.back().checksum = 0xdeadbeef;
+  nopMessageDescriptor.payloadDescriptors.push_back(
+      makePayloadDescriptor(3 * 1024 * 1024, ""));
+  nopMessageDescriptor.payloadDescriptors.back().compression =
+      PayloadCompression::kZstd;
+  nopMessageDescriptor.payloadDescriptors.back().compressedChunkLengths = {
+      1000, 1024 * 1024, 70000};
+  nopMessageDescriptor.payloadDescriptors.push_back(
+      makePayloadDescriptor(1024 * 1024 + 1, ""));
+  nopMessageDescriptor.payloadDescriptors.back().compressedChunkLengths = {
+      1024 * 1024, 1};
+  nopMessageDescriptor.payloadDescriptors.back().allocationHints.alignment =
+      4096;
+  nopMessageDescriptor.payloadDescriptors.back().allocationHints.numaNode = 1;
+  nopMessageDescriptor.payloadDescriptors.back().allocationHints.pinned = true;
+  nopMessageDescriptor.payloadDescriptors.push_back(
+      makePayloadDescriptor(40, ""));
+  nopMessageDescriptor.payloadDescriptors.back().compressedChunkLengths = {
+      8, 32};
+  nopMessageDescriptor.payloadDescriptors.back().segmented = true;
+  nopMessageDescriptor.tensorDescriptors.push_back(
+      makeTensorDescriptor(16, "", ""));
+  nopMessageDescriptor.tensorDescriptors.back().metadata = "a tensor";
+  nopMessageDescriptor.tensorDescriptors.push_back(
+      makeTensorDescriptor(1 << 20, "xth", "some channel descriptor"));
+  nopMessageDescriptor.tensorDescriptors.back().checksum = 42;
+  nopMessageDescriptor.tensorDescriptors.back().allocationHints.cudaDeviceIdx =
+      0;
+  nopMessageDescriptor.tensorDescriptors.push_back(
+      makeTensorDescriptor(0, "basic", ""));
+  return nopMessageDescriptor;
+}
+
+void expectAllocationHintsAreEqual(
+    const MessageDescriptor::AllocationHintsDescriptor& h1,
+    const MessageDescriptor::AllocationHintsDescriptor& h2) {
+  EXPECT_EQ(h1.alignment, h2.alignment);
+  EXPECT_EQ(h1.numaNode, h2.numaNode);
+  EXPECT_EQ(h1.pinned, h2.pinned);
+  EXPECT_EQ(h1.cudaDeviceIdx, h2.cudaDeviceIdx);
+}
+
+void expectDescriptorsAreEqual(
+    const MessageDescriptor& m1,
+    const MessageDescriptor& m2) {
+  EXPECT_EQ(m1.metadata, m2.metadata);
+  EXPECT_EQ(m1.hasChecksums, m2.hasChecksums);
+  EXPECT_EQ(m1.handsOffTensors, m2.handsOffTensors);
+  EXPECT_EQ(m1.coalescesCudaTensors, m2.coalescesCudaTensors);
+  ASSERT_EQ(m1.payloadDescriptors.size(), m2.payloadDescriptors.size());
+  for (size_t idx = 0; idx < m1.payloadDescriptors.size(); idx++) {
+    const auto& p1 = m1.payloadDescriptors[idx];
+    const auto& p2 = m2.payloadDescriptors[idx];
+    EXPECT_EQ(p1.sizeInBytes, p2.sizeInBytes);
+    EXPECT_EQ(p1.metadata, p2.metadata);
+    EXPECT_EQ(p1.checksum, p2.checksum);
+    EXPECT_EQ(p1.compression, p2.compression);
+    EXPECT_EQ(p1.compressedChunkLengths, p2.compressedChunkLengths);
+    EXPECT_EQ(p1.segmented, p2.segmented);
+    expectAllocationHintsAreEqual(p1.allocationHints, p2.allocationHints);
+  }
+  ASSERT_EQ(m1.tensorDescriptors.size(), m2.tensorDescriptors.size());
+  for (size_t idx = 0; idx < m1.tensorDescriptors.size(); idx++) {
+    const auto& t1 = m1.tensorDescriptors[idx];
+    const auto& t2 = m2.tensorDescriptors[idx];
+    EXPECT_EQ(t1.sizeInBytes, t2.sizeInBytes);
+    EXPECT_EQ(t1.metadata, t2.metadata);
+    EXPECT_EQ(t1.deviceType, t2.deviceType);
+    EXPECT_EQ(t1.channelName, t2.channelName);
+    EXPECT_EQ(t1.channelDescriptor, t2.channelDescriptor);
+    EXPECT_EQ(t1.checksum, t2.checksum);
+    EXPECT_EQ(t1.handoffId, t2.handoffId);
+    EXPECT_EQ(t1.dedup, t2.dedup);
+    EXPECT_EQ(t1.dedupHash, t2.dedupHash);
+    expectAllocationHintsAreEqual(t1.allocationHints, t2.allocationHints);
+  }
+}
+
+} // namespace
+
+TEST(CompactMessageDescriptor, RoundTrip) {
+  MessageDescriptor nopMessageDescriptor = makeMessageDescriptor();
+  std::vector<uint8_t> buffer;
+  encodeCompactMessageDescriptor(
+      nopMessageDescriptor, kChannelIndices, buffer);
+
+  MessageDescriptor decoded;
+  Error error = decodeCompactMessageDescriptor(buffer, kChannelNames, decoded);
+  ASSERT_FALSE(error) << error.what();
+  expectDescriptorsAreEqual(nopMessageDescriptor, decoded);
+}
+
+TEST(CompactMessageDescriptor, ReusesDescriptor) {
+  // Decoding a message into a descriptor that held a larger one must not leave
+  // any of the old fields behind.
+  std::vector<uint8_t> buffer;
+  encodeCompactMessageDescriptor(
+      makeMessageDescriptor(), kChannelIndices, buffer);
+  MessageDescriptor decoded;
+  ASSERT_FALSE(decodeCompactMessageDescriptor(buffer, kChannelNames, decoded));
+
+  MessageDescriptor smaller;
+  smaller.hasChecksums = false;
+  smaller.handsOffTensors = false;
+  smaller.coalescesCudaTensors = false;
+  smaller.payloadDescriptors.push_back(makePayloadDescriptor(5, ""));
+  smaller.tensorDescriptors.push_back(makeTensorDescriptor(7, "basic", ""));
+  encodeCompactMessageDescriptor(smaller, kChannelIndices, buffer);
+  Error error = decodeCompactMessageDescriptor(buffer, kChannelNames, decoded);
+  ASSERT_FALSE(error) << error.what();
+  expectDescriptorsAreEqual(smaller, decoded);
+}
+
+TEST(CompactMessageDescriptor, IsCompact) {
+  // A message with many tensors through the same channel, and no metadata, only
+  // takes a few bytes per tensor.
+  MessageDescriptor nopMessageDescriptor;
+  nopMessageDescriptor.hasChecksums = false;
+  nopMessageDescriptor.handsOffTensors = false;
+  nopMessageDescriptor.coalescesCudaTensors = false;
+  for (int idx = 0; idx < 100; idx++) {
+    nopMessageDescriptor.tensorDescriptors.push_back(
+        makeTensorDescriptor(4096, "basic", ""));
+  }
+  std::vector<uint8_t> buffer;
+  encodeCompactMessageDescriptor(
+      nopMessageDescriptor, kChannelIndices, buffer);
+  EXPECT_LE(buffer.size(), 3 + 100 * 5);
+}
+
+TEST(CompactMessageDescriptor, HandsOffTensors) {
+  MessageDescriptor nopMessageDescriptor;
+  nopMessageDescriptor.hasChecksums = false;
+  nopMessageDescriptor.handsOffTensors = true;
+  nopMessageDescriptor.coalescesCudaTensors = false;
+  nopMessageDescriptor.tensorDescriptors.push_back(
+      makeTensorDescriptor(1 << 30, "", ""));
+  nopMessageDescriptor.tensorDescriptors.back().handoffId = 1234567;
+  nopMessageDescriptor.tensorDescriptors.push_back(
+      makeTensorDescriptor(0, "", ""));
+  std::vector<uint8_t> buffer;
+  encodeCompactMessageDescriptor(
+      nopMessageDescriptor, kChannelIndices, buffer);
+
+  MessageDescriptor decoded;
+  Error error = decodeCompactMessageDescriptor(buffer, kChannelNames, decoded);
+  ASSERT_FALSE(error) << error.what();
+  expectDescriptorsAreEqual(nopMessageDescriptor, decoded);
+}
+
+TEST(CompactMessageDescriptor, CoalescesCudaTensors) {
+  MessageDescriptor nopMessageDescriptor;
+  nopMessageDescriptor.hasChecksums = false;
+  nopMessageDescriptor.handsOffTensors = false;
+  nopMessageDescriptor.coalescesCudaTensors = true;
+  nopMessageDescriptor.tensorDescriptors.push_back(
+      makeTensorDescriptor(100, "", ""));
+  nopMessageDescriptor.tensorDescriptors.push_back(
+      makeTensorDescriptor(200, "", ""));
+  nopMessageDescriptor.tensorDescriptors.push_back(
+      makeTensorDescriptor(456, "xth", "some channel descriptor"));
+  std::vector<uint8_t> buffer;
+  encodeCompactMessageDescriptor(
+      nopMessageDescriptor, kChannelIndices, buffer);
+
+  MessageDescriptor decoded;
+  Error error = decodeCompactMessageDescriptor(buffer, kChannelNames, decoded);
+  ASSERT_FALSE(error) << error.what();
+  expectDescriptorsAreEqual(nopMessageDescriptor, decoded);
+}
+
+TEST(CompactMessageDescriptor, DeduplicatesTensors) {
+  MessageDescriptor nopMessageDescriptor;
+  nopMessageDescriptor.hasChecksums = true;
+  nopMessageDescriptor.handsOffTensors = false;
+  nopMessageDescriptor.coalescesCudaTensors = false;
+  nopMessageDescriptor.tensorDescriptors.push_back(
+      makeTensorDescriptor(1 << 20, "xth", "some channel descriptor"));
+  nopMessageDescriptor.tensorDescriptors.back().dedup = TensorDedup::kStore;
+  nopMessageDescriptor.tensorDescriptors.back().dedupHash = 0x0123456789abcdef;
+  nopMessageDescriptor.tensorDescriptors.push_back(
+      makeTensorDescriptor(1 << 20, "", ""));
+  nopMessageDescriptor.tensorDescriptors.back().dedup = TensorDedup::kHit;
+  nopMessageDescriptor.tensorDescriptors.back().dedupHash = 0xfedcba9876543210;
+  std::vector<uint8_t> buffer;
+  encodeCompactMessageDescriptor(
+      nopMessageDescriptor, kChannelIndices, buffer);
+
+  MessageDescriptor decoded;
+  Error error = decodeCompactMessageDescriptor(buffer, kChannelNames, decoded);
+  ASSERT_FALSE(error) << error.what();
+  expectDescriptorsAreEqual(nopMessageDescriptor, decoded);
+
+  // The kind of deduplication is the byte before the hash of the last tensor.
+  buffer[buffer.size() - 9] = 3;
+  EXPECT_TRUE(decodeCompactMessageDescriptor(buffer, kChannelNames, decoded));
+}
+
+TEST(CompactMessageDescriptor, Truncated) {
+  std::vector<uint8_t> buffer;
+  encodeCompactMessageDescriptor(
+      makeMessageDescriptor(), kChannelIndices, buffer);
+  for (size_t length = 0; length < buffer.size(); length++) {
+    std::vector<uint8_t> truncated(buffer.begin(), buffer.begin() + length);
+    MessageDescriptor decoded;
+    EXPECT_TRUE(
+        decodeCompactMessageDescriptor(truncated, kChannelNames, decoded))
+        << "length " << length;
+  }
+}
+
+TEST(CompactMessageDescriptor, TrailingData) {
+  std::vector<uint8_t> buffer;
+  encodeCompactMessageDescriptor(
+      makeMessageDescriptor(), kChannelIndices, buffer);
+  buffer.push_back(0);
+  MessageDescriptor decoded;
+  EXPECT_TRUE(decodeCompactMessageDescriptor(buffer, kChannelNames, decoded));
+}
+
+// A bogus count of payloads or tensors must fail the decoding, rather than
+// have it allocate that many descriptors.
+TEST(CompactMessageDescriptor, OversizedCount) {
+  // A varint of 2^60, in nine bytes.
+  const std::vector<uint8_t> hugeCount = {
+      0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x10};
+  // No flags, then the count of payloads, or no payloads and then the count of
+  // tensors.
+  for (const std::vector<uint8_t>& prefix :
+       {std::vector<uint8_t>{0}, std::vector<uint8_t>{0, 0}}) {
+    std::vector<uint8_t> buffer = prefix;
+    buffer.insert(buffer.end(), hugeCount.begin(), hugeCount.end());
+    MessageDescriptor decoded;
+    Error error =
+        decodeCompactMessageDescriptor(buffer, kChannelNames, decoded);
+    ASSERT_TRUE(error);
+    EXPECT_TRUE(error.isOfType<MalformedDescriptorError>()) << error.what();
+    EXPECT_TRUE(decoded.payloadDescriptors.empty());
+    EXPECT_TRUE(decoded.tensorDescriptors.empty());
+  }
+}
+
+TEST(CompactMessageDescriptor, UnknownChannel) {
+  std::vector<uint8_t> buffer;
+  encodeCompactMessageDescriptor(
+      makeMessageDescriptor(), kChannelIndices, buffer);
+  // The peer only knows of the first channel.
+  MessageDescriptor decoded;
+  EXPECT_TRUE(decodeCompactMessageDescriptor(buffer, {"basic"}, decoded));
+}
+
+TEST(CompactMessageDescriptor, InlinePayloads) {
+  MessageDescriptor nopMessageDescriptor;
+  nopMessageDescriptor.hasChecksums = false;
+  nopMessageDescriptor.handsOffTensors = false;
+  nopMessageDescriptor.coalescesCudaTensors = false;
+  nopMessageDescriptor.payloadDescriptors.push_back(
+      makePayloadDescriptor(5, "a payload"));
+  nopMessageDescriptor.payloadDescriptors.push_back(
+      makePayloadDescriptor(0, ""));
+  nopMessageDescriptor.payloadDescriptors.push_back(
+      makePayloadDescriptor(3, ""));
+  std::string data1 = "hello";
+  std::string data3 = "foo";
+  std::vector<Message::Payload> payloads(3);
+  payloads[0].data = &data1[0];
+  payloads[0].length = data1.size();
+  payloads[2].data = &data3[0];
+  payloads[2].length = data3.size();
+  std::vector<uint8_t> buffer;
+  encodeCompactMessageDescriptor(
+      nopMessageDescriptor, kChannelIndices, buffer, &payloads);
+
+  MessageDescriptor decoded;
+  optional<size_t> inlinePayloadsOffset;
+  Error error = decodeCompactMessageDescriptor(
+      buffer, kChannelNames, decoded, &inlinePayloadsOffset);
+  ASSERT_FALSE(error) << error.what();
+  expectDescriptorsAreEqual(nopMessageDescriptor, decoded);
+  ASSERT_TRUE(inlinePayloadsOffset.has_value());
+  EXPECT_EQ(
+      std::string(
+          buffer.begin() + inlinePayloadsOffset.value(), buffer.end()),
+      "hellofoo");
+
+  // The ends that don't expect inline payloads reject them.
+  EXPECT_TRUE(decodeCompactMessageDescriptor(buffer, kChannelNames, decoded));
+
+  // Nor can the payloads be cut short, and the offset is reset for those that
+  // don't have any.
+  std::vector<uint8_t> truncated(buffer.begin(), buffer.end() - 1);
+  EXPECT_TRUE(decodeCompactMessageDescriptor(
+      truncated, kChannelNames, decoded, &inlinePayloadsOffset));
+  encodeCompactMessageDescriptor(nopMessageDescriptor, kChannelIndices, buffer);
+  ASSERT_FALSE(decodeCompactMessageDescriptor(
+      buffer, kChannelNames, decoded, &inlinePayloadsOffset));
+  EXPECT_FALSE(inlinePayloadsOffset.has_value());
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <tensorpipe/core/compression.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+class PayloadCompressionTest
+    : public ::testing::TestWithParam<PayloadCompression> {
+ protected:
+  void SetUp() override {
+    if (!compressor_.isAvailable(GetParam())) {
+      GTEST_SKIP() << "Skipping test as "
+                   << payloadCompressionToString(GetParam())
+                   << " couldn't be loaded.";
+    }
+  }
+
+  PayloadCompressor compressor_;
+};
+
+std::vector<uint8_t> compressibleData(size_t length) {
+  // Mostly zeros, as in sparse tensors, with a few bytes here and there.
+  std::vector<uint8_t> data(length, 0);
+  for (size_t idx = 0; idx < length; idx += 97) {
+    data[idx] = static_cast<uint8_t>(idx);
+  }
+  return data;
+}
+
+std::vector<uint8_t> randomData(size_t length) {
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> distribution(0, 255);
+  std::vector<uint8_t> data(length);
+  for (uint8_t& byte : data) {
+    byte = static_cast<uint8_t>(distribution(generator));
+  }
+  return data;
+}
+
+} // namespace
+
+TEST_P(PayloadCompressionTest, RoundTrip) {
+  std::vector<uint8_t> data = compressibleData(kPayloadCompressionChunkSize);
+  std::vector<uint8_t> compressed(data.size() - 1);
+  size_t compressedLength = compressor_.compress(
+      GetParam(),
+      data.data(),
+      data.size(),
+      compressed.data(),
+      compressed.size());
+  ASSERT_GT(compressedLength, 0);
+  EXPECT_LT(compressedLength, data.size() / 10);
+
+  std::vector<uint8_t> decompressed(data.size());
+  Error error = compressor_.decompress(
+      GetParam(),
+      compressed.data(),
+      compressedLength,
+      decompressed.data(),
+      decompressed.size());
+  ASSERT_FALSE(error) << error.what();
+  EXPECT_EQ(decompressed, data);
+}
+
+TEST_P(PayloadCompressionTest, IncompressibleData) {
+  std::vector<uint8_t> data = randomData(64 * 1024);
+  std::vector<uint8_t> compressed(data.size() - 1);
+  EXPECT_EQ(
+      compressor_.compress(
+          GetParam(),
+          data.data(),
+          data.size(),
+          compressed.data(),
+          compressed.size()),
+      0);
+}
+
+TEST_P(PayloadCompressionTest, WrongLength) {
+  std::vector<uint8_t> data = compressibleData(64 * 1024);
+  std::vector<uint8_t> compressed(data.size());
+  size_t compressedLength = compressor_.compress(
+      GetParam(),
+      data.data(),
+      data.size(),
+      compressed.data(),
+      compressed.size());
+  ASSERT_GT(compressedLength, 0);
+
+  // The chunk is larger than the sender said.
+  std::vector<uint8_t> decompressed(data.size() / 2);
+  EXPECT_TRUE(compressor_.decompress(
+      GetParam(),
+      compressed.data(),
+      compressedLength,
+      decompressed.data(),
+      decompressed.size()));
+
+  // The chunk is smaller than the sender said.
+  decompressed.resize(data.size() * 2);
+  EXPECT_TRUE(compressor_.decompress(
+      GetParam(),
+      compressed.data(),
+      compressedLength,
+      decompressed.data(),
+      decompressed.size()));
+}
+
+TEST_P(PayloadCompressionTest, MalformedInput) {
+  std::vector<uint8_t> garbage = randomData(1024);
+  std::vector<uint8_t> decompressed(64 * 1024);
+  EXPECT_TRUE(compressor_.decompress(
+      GetParam(),
+      garbage.data(),
+      garbage.size(),
+      decompressed.data(),
+      decompressed.size()));
+}
+
+INSTANTIATE_TEST_CASE_P(
+    PayloadCompression,
+    PayloadCompressionTest,
+    ::testing::Values(PayloadCompression::kLz4, PayloadCompression::kZstd));
+
+TEST(PayloadCompressor, NoCompressionCannotBeDecompressed) {
+  PayloadCompressor compressor;
+  EXPECT_TRUE(compressor.isAvailable(PayloadCompression::kNone));
+  uint8_t byte = 0;
+  EXPECT_TRUE(compressor.decompress(
+      PayloadCompression::kNone, &byte, sizeof(byte), &byte, sizeof(byte)));
+}
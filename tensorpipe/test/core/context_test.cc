@@ -8,11 +8,22 @@
 
 #include <tensorpipe/tensorpipe.h>
 
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <exception>
 #include <future>
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
+#include <thread>
+
+#include <tensorpipe/common/worker_pool.h>
 
 #include <gtest/gtest.h>
 
@@ -537,3 +548,2636 @@ TEST(Context, MixedTensorMessage) {
   clientPipe.reset();
   context->join();
 }
+
+TEST(Context, Stats) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  auto context =
+      std::make_shared<Context>(ContextOptions().collectStats(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  clientPipe->write(
+      makeMessage(2, 1), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value();
+      });
+  pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+    ASSERT_FALSE(error);
+    EXPECT_TRUE(messagesAreEqual(message, makeMessage(2, 1)));
+    readCompletedProm.set_value();
+  });
+
+  writeCompletedProm.get_future().get();
+  readCompletedProm.get_future().get();
+
+  PipeStats clientStats = clientPipe->getStats();
+  EXPECT_EQ(clientStats.numMessagesWritten, 1);
+  EXPECT_EQ(clientStats.numMessagesRead, 0);
+  EXPECT_EQ(clientStats.writeCallbackInvoked.count(), 1);
+  EXPECT_EQ(clientStats.writePayloadsWritten.count(), 1);
+  EXPECT_EQ(clientStats.writeTensorsSent.count(), 1);
+  EXPECT_EQ(
+      clientStats.payloadBytesWrittenPerTransport["uv"],
+      2 * kPayloadData.length());
+  EXPECT_EQ(
+      clientStats.tensorBytesSentPerChannel["basic"], kTensorData.length());
+
+  PipeStats serverStats = serverPipe->getStats();
+  EXPECT_EQ(serverStats.numMessagesWritten, 0);
+  EXPECT_EQ(serverStats.numMessagesRead, 1);
+  EXPECT_EQ(serverStats.readDescriptorRead.count(), 1);
+  EXPECT_EQ(serverStats.readPayloadsRead.count(), 1);
+  EXPECT_EQ(serverStats.readTensorsReceived.count(), 1);
+  EXPECT_EQ(serverStats.readCallbackInvoked.count(), 1);
+  EXPECT_LE(
+      serverStats.readPayloadsRead.max(),
+      serverStats.readCallbackInvoked.max());
+  EXPECT_EQ(
+      serverStats.payloadBytesReadPerTransport["uv"],
+      2 * kPayloadData.length());
+  EXPECT_EQ(
+      serverStats.tensorBytesReceivedPerChannel["basic"],
+      kTensorData.length());
+
+  PipeStats contextStats = context->getStats();
+  EXPECT_EQ(contextStats.numMessagesWritten, 1);
+  EXPECT_EQ(contextStats.numMessagesRead, 1);
+
+  // Both pipes are established before the message goes through, each after
+  // exchanging the brochures.
+  EXPECT_EQ(clientStats.connectBrochureAnswerRead.count(), 1);
+  EXPECT_EQ(clientStats.connectEstablished.count(), 1);
+  EXPECT_EQ(clientStats.acceptEstablished.count(), 0);
+  EXPECT_LE(
+      clientStats.connectBrochureAnswerRead.max(),
+      clientStats.connectEstablished.max());
+  EXPECT_EQ(serverStats.acceptBrochureRead.count(), 1);
+  EXPECT_EQ(serverStats.acceptEstablished.count(), 1);
+  EXPECT_EQ(serverStats.connectEstablished.count(), 0);
+  EXPECT_LE(
+      serverStats.acceptBrochureRead.max(),
+      serverStats.acceptEstablished.max());
+  EXPECT_EQ(contextStats.connectEstablished.count(), 1);
+  EXPECT_EQ(contextStats.acceptEstablished.count(), 1);
+
+  // The basic channel has no loop of its own, as it uses the connection.
+  std::map<std::string, LoopStats> loopStats = context->getLoopStats();
+  ASSERT_EQ(loopStats.size(), 1);
+  const LoopStats& uvLoopStats = loopStats["transport/uv/loop"];
+  EXPECT_GT(uvLoopStats.taskRunTime.count(), 0);
+  EXPECT_EQ(
+      uvLoopStats.taskQueueLatency.count(), uvLoopStats.taskRunTime.count());
+  EXPECT_GE(uvLoopStats.maxPendingTasks, 1);
+
+  // Both ends of the pipe share the transport, hence it both read and wrote.
+  std::map<std::string, transport::TransportStats> transportStats =
+      context->getTransportStats();
+  ASSERT_EQ(transportStats.size(), 1);
+  const transport::TransportStats& uvStats = transportStats["uv"];
+  EXPECT_GT(uvStats.numWrites, 0);
+  EXPECT_GT(uvStats.numReads, 0);
+  EXPECT_GT(uvStats.numBytesWritten, 0);
+  EXPECT_GT(uvStats.numBytesRead, 0);
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, CallbackExecutor) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+  std::atomic<int> numTasks{0};
+
+  // A single thread runs all the callbacks, which are thus known to be on it.
+  std::promise<std::thread::id> executorThreadPromise;
+  WorkerPool pool(1, "TP_test_callbacks");
+  pool.submit([&]() {
+    executorThreadPromise.set_value(std::this_thread::get_id());
+  });
+  const std::thread::id executorThread =
+      executorThreadPromise.get_future().get();
+
+  auto context = std::make_shared<Context>(
+      ContextOptions().collectStats(true).callbackExecutor(
+          [&](MoveOnlyFunction<void()> task) {
+            numTasks++;
+            pool.submit(std::move(task));
+          }));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    EXPECT_EQ(std::this_thread::get_id(), executorThread);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  clientPipe->write(
+      makeMessage(2, 1), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        EXPECT_EQ(std::this_thread::get_id(), executorThread);
+        writeCompletedProm.set_value();
+      });
+  pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+    ASSERT_FALSE(error);
+    EXPECT_EQ(std::this_thread::get_id(), executorThread);
+    EXPECT_TRUE(messagesAreEqual(message, makeMessage(2, 1)));
+    readCompletedProm.set_value();
+  });
+
+  writeCompletedProm.get_future().get();
+  readCompletedProm.get_future().get();
+
+  // The accept, readDescriptor, read and write callbacks.
+  EXPECT_GE(numTasks, 4);
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+  // The run time of the callbacks is only recorded once they return, and the
+  // listener has no statistics of its own.
+  pool.join();
+  EXPECT_EQ(context->getStats().callbackRunTime.count(), 3);
+}
+
+TEST(Context, CallbackThreadsKeepOrder) {
+  constexpr int kNumMessages = 100;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<void> writesCompletedProm;
+  std::promise<void> readsCompletedProm;
+  std::vector<int> writeCallbackOrder;
+  int numMessagesRead = 0;
+
+  auto context =
+      std::make_shared<Context>(ContextOptions().numCallbackThreads(4));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  // The callbacks of a pipe never overlap, hence they needn't synchronize.
+  for (int i = 0; i < kNumMessages; i++) {
+    clientPipe->write(
+        makeMessage(0, 0), [&, i](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          writeCallbackOrder.push_back(i);
+          if (i == kNumMessages - 1) {
+            writesCompletedProm.set_value();
+          }
+        });
+  }
+  for (int i = 0; i < kNumMessages; i++) {
+    serverPipe->readDescriptor([&](const Error& error, Message message) {
+      ASSERT_FALSE(error);
+      serverPipe->read(
+          std::move(message), [&](const Error& error, Message /* unused */) {
+            ASSERT_FALSE(error);
+            if (++numMessagesRead == kNumMessages) {
+              readsCompletedProm.set_value();
+            }
+          });
+    });
+  }
+
+  writesCompletedProm.get_future().get();
+  readsCompletedProm.get_future().get();
+  ASSERT_EQ(writeCallbackOrder.size(), kNumMessages);
+  for (int i = 0; i < kNumMessages; i++) {
+    EXPECT_EQ(writeCallbackOrder[i], i);
+  }
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ChannelTensorLengthRanges) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<void> writeCompletedProm;
+  std::promise<Message> readMessagePromise;
+
+  // The highest-priority channel only takes the large tensors, the small ones
+  // fall back to the other one.
+  const std::string largeTensorData(1000, 'x');
+  auto context = std::make_shared<Context>(
+      ContextOptions().collectStats(true).channelTensorLengthRange(
+          "xth", largeTensorData.length()));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+  context->registerChannel(1, "xth", std::make_shared<channel::xth::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  auto makeMixedMessage = [&]() {
+    Message message = makeMessage(1, 1);
+    message.tensors.push_back(Message::Tensor{CpuBuffer{
+        reinterpret_cast<void*>(const_cast<char*>(largeTensorData.data())),
+        largeTensorData.length()}});
+    return message;
+  };
+
+  clientPipe->write(
+      makeMixedMessage(), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value();
+      });
+  pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+    if (error) {
+      readMessagePromise.set_exception(
+          std::make_exception_ptr(std::runtime_error(error.what())));
+    } else {
+      readMessagePromise.set_value(std::move(message));
+    }
+  });
+
+  EXPECT_TRUE(messagesAreEqual(
+      readMessagePromise.get_future().get(), makeMixedMessage()));
+  writeCompletedProm.get_future().get();
+
+  PipeStats clientStats = clientPipe->getStats();
+  EXPECT_EQ(
+      clientStats.tensorBytesSentPerChannel["basic"], kTensorData.length());
+  EXPECT_EQ(
+      clientStats.tensorBytesSentPerChannel["xth"], largeTensorData.length());
+  PipeStats serverStats = serverPipe->getStats();
+  EXPECT_EQ(
+      serverStats.tensorBytesReceivedPerChannel["basic"],
+      kTensorData.length());
+  EXPECT_EQ(
+      serverStats.tensorBytesReceivedPerChannel["xth"],
+      largeTensorData.length());
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, BorrowedPayloads) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<void> writeCompletedProm;
+  std::promise<Message> readMessagePromise;
+  std::vector<std::string> receivedPayloads;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+#if TENSORPIPE_HAS_SHM_TRANSPORT
+  context->registerTransport(
+      1, "shm", std::make_shared<transport::shm::Context>());
+#endif // TENSORPIPE_HAS_SHM_TRANSPORT
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen(genUrls());
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  clientPipe->write(
+      makeMessage(2, 1), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value();
+      });
+
+  serverPipe->readDescriptor([&](const Error& error, Message message) {
+    ASSERT_FALSE(error);
+    receivedPayloads.resize(message.payloads.size());
+    for (auto& tensor : message.tensors) {
+      auto tensorData = std::make_unique<uint8_t[]>(tensor.buffer.cpu.length);
+      tensor.buffer.cpu.ptr = tensorData.get();
+      buffers.push_back(std::move(tensorData));
+    }
+    serverPipe->read(
+        std::move(message),
+        [&](size_t payloadIdx, const void* ptr, size_t length) {
+          receivedPayloads[payloadIdx] =
+              std::string(reinterpret_cast<const char*>(ptr), length);
+        },
+        [&](const Error& error, Message message) {
+          if (error) {
+            readMessagePromise.set_exception(
+                std::make_exception_ptr(std::runtime_error(error.what())));
+          } else {
+            readMessagePromise.set_value(std::move(message));
+          }
+        });
+  });
+
+  Message message = readMessagePromise.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  ASSERT_EQ(message.payloads.size(), 2);
+  EXPECT_EQ(message.payloads[0].data, nullptr);
+  EXPECT_EQ(receivedPayloads[0], kPayloadData);
+  EXPECT_EQ(receivedPayloads[1], kPayloadData);
+  ASSERT_EQ(message.tensors.size(), 1);
+  EXPECT_TRUE(buffersAreEqual(
+      message.tensors[0].buffer.cpu.ptr,
+      message.tensors[0].buffer.cpu.length,
+      kTensorData.data(),
+      kTensorData.length()));
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, FilePayloads) {
+  // The payload starts in the middle of a page of the file.
+  const std::string kPrefix = "skip these bytes";
+  char path[] = "/tmp/tensorpipe_file_payload_XXXXXX";
+  int fd = ::mkstemp(path);
+  ASSERT_GE(fd, 0);
+  ::unlink(path);
+  const std::string contents = kPrefix + kPayloadData;
+  ASSERT_EQ(
+      ::write(fd, contents.data(), contents.size()),
+      static_cast<ssize_t>(contents.size()));
+
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<Message> writtenMessagePromise;
+  std::promise<std::string> receivedPayloadPromise;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  Message message;
+  message.payloads.resize(1);
+  message.payloads[0].length = kPayloadData.size();
+  message.payloads[0].fd = fd;
+  message.payloads[0].fileOffset = kPrefix.size();
+  clientPipe->write(std::move(message), [&](const Error& error, Message msg) {
+    ASSERT_FALSE(error);
+    writtenMessagePromise.set_value(std::move(msg));
+  });
+
+  serverPipe->readDescriptor([&](const Error& error, Message message) {
+    ASSERT_FALSE(error);
+    ASSERT_EQ(message.payloads.size(), 1);
+    EXPECT_EQ(message.payloads[0].length, kPayloadData.size());
+    serverPipe->read(
+        std::move(message),
+        [&](size_t /* unused */, const void* ptr, size_t length) {
+          receivedPayloadPromise.set_value(
+              std::string(reinterpret_cast<const char*>(ptr), length));
+        },
+        [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+        });
+  });
+
+  EXPECT_EQ(receivedPayloadPromise.get_future().get(), kPayloadData);
+  // The payload is given back as it was, with no pointer to the mapping.
+  message = writtenMessagePromise.get_future().get();
+  ASSERT_EQ(message.payloads.size(), 1);
+  EXPECT_EQ(message.payloads[0].data, nullptr);
+  EXPECT_EQ(message.payloads[0].fd, fd);
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+  ::close(fd);
+}
+
+TEST(Context, ReadPayloadsIntoFile) {
+  char path[] = "/tmp/tensorpipe_file_payload_XXXXXX";
+  int fd = ::mkstemp(path);
+  ASSERT_GE(fd, 0);
+  ::unlink(path);
+
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<Message> readMessagePromise;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  clientPipe->write(
+      makeMessage(2, 0), [](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+      });
+
+  // The payloads go one after the other into the file, which starts empty.
+  serverPipe->readDescriptor([&](const Error& error, Message message) {
+    ASSERT_FALSE(error);
+    uint64_t offset = 0;
+    for (auto& payload : message.payloads) {
+      payload.fd = fd;
+      payload.fileOffset = offset;
+      offset += payload.length;
+    }
+    serverPipe->read(
+        std::move(message), [&](const Error& error, Message message) {
+          if (error) {
+            readMessagePromise.set_exception(
+                std::make_exception_ptr(std::runtime_error(error.what())));
+          } else {
+            readMessagePromise.set_value(std::move(message));
+          }
+        });
+  });
+
+  Message message = readMessagePromise.get_future().get();
+  ASSERT_EQ(message.payloads.size(), 2);
+  EXPECT_EQ(message.payloads[0].data, nullptr);
+  const std::string expected = kPayloadData + kPayloadData;
+  std::string contents(expected.size() + 1, '\0');
+  ASSERT_EQ(
+      ::pread(fd, &contents[0], contents.size(), 0),
+      static_cast<ssize_t>(expected.size()));
+  contents.resize(expected.size());
+  EXPECT_EQ(contents, expected);
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+  ::close(fd);
+}
+
+TEST(Context, InlineSmallTensors) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<void> writeCompletedProm;
+  std::promise<Message> readMessagePromise;
+
+  auto context =
+      std::make_shared<Context>(ContextOptions().collectStats(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(
+      listener->url("uv"), PipeOptions().inlineTensorThreshold(1024));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  clientPipe->write(
+      makeMessage(1, 2), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value();
+      });
+  pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+    if (error) {
+      readMessagePromise.set_exception(
+          std::make_exception_ptr(std::runtime_error(error.what())));
+    } else {
+      readMessagePromise.set_value(std::move(message));
+    }
+  });
+
+  EXPECT_TRUE(messagesAreEqual(
+      readMessagePromise.get_future().get(), makeMessage(1, 2)));
+  writeCompletedProm.get_future().get();
+
+  // The tensors didn't go through any channel.
+  PipeStats clientStats = clientPipe->getStats();
+  EXPECT_TRUE(clientStats.tensorBytesSentPerChannel.empty());
+  EXPECT_EQ(
+      clientStats.payloadBytesWrittenPerTransport["uv"],
+      kPayloadData.length() + 2 * kTensorData.length());
+  PipeStats serverStats = serverPipe->getStats();
+  EXPECT_TRUE(serverStats.tensorBytesReceivedPerChannel.empty());
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, TensorDedup) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+
+  auto context =
+      std::make_shared<Context>(ContextOptions().collectStats(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(
+      listener->url("uv"), PipeOptions().tensorDedup(1, 1024));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  // The two tensors of each message have the same contents, hence only the
+  // first one of the first message goes through the channel: the second one
+  // waits for it, and the ones of the next message are copied right away.
+  for (int messageIdx = 0; messageIdx < 2; messageIdx++) {
+    std::promise<void> writeCompletedProm;
+    std::promise<Message> readMessagePromise;
+    clientPipe->write(
+        makeMessage(1, 2), [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          writeCompletedProm.set_value();
+        });
+    pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+      if (error) {
+        readMessagePromise.set_exception(
+            std::make_exception_ptr(std::runtime_error(error.what())));
+      } else {
+        readMessagePromise.set_value(std::move(message));
+      }
+    });
+
+    EXPECT_TRUE(messagesAreEqual(
+        readMessagePromise.get_future().get(), makeMessage(1, 2)));
+    writeCompletedProm.get_future().get();
+  }
+
+  PipeStats clientStats = clientPipe->getStats();
+  EXPECT_EQ(
+      clientStats.tensorBytesSentPerChannel["basic"], kTensorData.length());
+  EXPECT_EQ(clientStats.tensorBytesDeduplicatedSent, 3 * kTensorData.length());
+  PipeStats serverStats = serverPipe->getStats();
+  EXPECT_EQ(
+      serverStats.tensorBytesReceivedPerChannel["basic"],
+      kTensorData.length());
+  EXPECT_EQ(
+      serverStats.tensorBytesDeduplicatedReceived, 3 * kTensorData.length());
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, HandOffTensors) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<Message> writtenMessagePromise;
+  std::promise<Message> readMessagePromise;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  std::string tensorData = kTensorData;
+  int numReleases = 0;
+  Message message = makeMessage(1, 1);
+  message.tensors[0].buffer.cpu.ptr = &tensorData[0];
+  message.tensors[0].release = [&numReleases]() { ++numReleases; };
+  message.handOffTensors = true;
+  clientPipe->write(
+      std::move(message), [&](const Error& error, Message message) {
+        ASSERT_FALSE(error);
+        writtenMessagePromise.set_value(std::move(message));
+      });
+  serverPipe->readDescriptor([&](const Error& error, Message message) {
+    ASSERT_FALSE(error);
+    // No memory has to be allocated for the tensors.
+    ASSERT_TRUE(message.handOffTensors);
+    for (auto& payload : message.payloads) {
+      auto payloadData = std::make_unique<uint8_t[]>(payload.length);
+      payload.data = payloadData.get();
+      buffers.push_back(std::move(payloadData));
+    }
+    serverPipe->read(
+        std::move(message), [&](const Error& error, Message message) {
+          ASSERT_FALSE(error);
+          readMessagePromise.set_value(std::move(message));
+        });
+  });
+
+  Message writtenMessage = writtenMessagePromise.get_future().get();
+  EXPECT_TRUE(writtenMessage.handOffTensors);
+  EXPECT_FALSE(writtenMessage.tensors[0].release);
+
+  // The receiver got the very buffer of the sender, and the duty to release it.
+  Message readMessage = readMessagePromise.get_future().get();
+  EXPECT_TRUE(messagesAreEqual(readMessage, makeMessage(1, 1)));
+  EXPECT_EQ(readMessage.tensors[0].buffer.cpu.ptr, &tensorData[0]);
+  EXPECT_EQ(numReleases, 0);
+  ASSERT_TRUE(readMessage.tensors[0].release);
+  readMessage.tensors[0].release();
+  EXPECT_EQ(numReleases, 1);
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, LoopbackPipes) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  auto context = std::make_shared<Context>(
+      ContextOptions().collectStats(true).loopbackPipes(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(0, "xth", std::make_shared<channel::xth::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+  EXPECT_EQ(listener->addresses().count("loopback"), 1);
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  clientPipe->write(
+      makeMessage(2, 1), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value();
+      });
+  pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+    ASSERT_FALSE(error);
+    EXPECT_TRUE(messagesAreEqual(message, makeMessage(2, 1)));
+    readCompletedProm.set_value();
+  });
+
+  writeCompletedProm.get_future().get();
+  readCompletedProm.get_future().get();
+
+  // The pipe never went through the transport of the URL it was given.
+  PipeStats clientStats = clientPipe->getStats();
+  EXPECT_EQ(
+      clientStats.payloadBytesWrittenPerTransport["loopback"],
+      2 * kPayloadData.length());
+  EXPECT_EQ(
+      clientStats.tensorBytesSentPerChannel["xth"], kTensorData.length());
+  std::map<std::string, transport::TransportStats> transportStats =
+      context->getTransportStats();
+  EXPECT_EQ(transportStats["uv"].numBytesWritten, 0);
+  EXPECT_GT(transportStats["loopback"].numBytesWritten, 0);
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, PayloadChecksums) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<void> writeCompletedProm;
+  std::promise<Message> readMessagePromise;
+
+  auto context =
+      std::make_shared<Context>(ContextOptions().payloadChecksums(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  // The checksums of the payloads and of the tensor, which goes through the
+  // channel, are checked upon receiving them, and they match.
+  clientPipe->write(
+      makeMessage(2, 1), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value();
+      });
+  pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+    if (error) {
+      readMessagePromise.set_exception(
+          std::make_exception_ptr(std::runtime_error(error.what())));
+    } else {
+      readMessagePromise.set_value(std::move(message));
+    }
+  });
+
+  EXPECT_TRUE(messagesAreEqual(
+      readMessagePromise.get_future().get(), makeMessage(2, 1)));
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, PayloadCompression) {
+  for (PayloadCompression compression :
+       {PayloadCompression::kLz4, PayloadCompression::kZstd}) {
+    std::vector<std::unique_ptr<uint8_t[]>> buffers;
+    std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+    std::promise<void> writeCompletedProm;
+    std::promise<Message> readMessagePromise;
+
+    auto context =
+        std::make_shared<Context>(ContextOptions().payloadChecksums(true));
+
+    context->registerTransport(
+        0, "uv", std::make_shared<transport::uv::Context>());
+    context->registerChannel(
+        0, "basic", std::make_shared<channel::basic::Context>());
+
+    auto listener = context->listen({"uv://127.0.0.1"});
+
+    listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+      ASSERT_FALSE(error);
+      serverPipePromise.set_value(std::move(pipe));
+    });
+
+    // If the library isn't available the pipe falls back to sending the
+    // payloads as they are, hence the message must get through either way.
+    auto clientPipe = context->connect(
+        listener->url("uv"),
+        PipeOptions().payloadCompression(compression, 1024));
+    std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+    // The first payload spans several chunks and compresses well, the second
+    // one is below the threshold and the third one doesn't compress at all,
+    // and is thus sent as it is.
+    std::string compressible(3 * 1024 * 1024 + 17, 'x');
+    for (size_t idx = 0; idx < compressible.size(); idx += 251) {
+      compressible[idx] = static_cast<char>(idx % 97);
+    }
+    std::string incompressible(64 * 1024, '\0');
+    uint32_t state = 1;
+    for (char& c : incompressible) {
+      state = state * 1664525 + 1013904223;
+      c = static_cast<char>(state >> 24);
+    }
+    Message message = makeMessage(0, 1);
+    for (const std::string* data :
+         {&compressible, &kPayloadData, &incompressible}) {
+      Message::Payload payload;
+      payload.data = const_cast<char*>(data->data());
+      payload.length = data->length();
+      message.payloads.push_back(std::move(payload));
+    }
+    Message expected = makeMessage(0, 1);
+    expected.payloads = message.payloads;
+
+    clientPipe->write(
+        std::move(message), [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          writeCompletedProm.set_value();
+        });
+    pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+      if (error) {
+        readMessagePromise.set_exception(
+            std::make_exception_ptr(std::runtime_error(error.what())));
+      } else {
+        readMessagePromise.set_value(std::move(message));
+      }
+    });
+
+    EXPECT_TRUE(
+        messagesAreEqual(readMessagePromise.get_future().get(), expected));
+    writeCompletedProm.get_future().get();
+
+    serverPipe.reset();
+    listener.reset();
+    clientPipe.reset();
+    context->join();
+  }
+}
+
+TEST(Context, SegmentedPayloads) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::array<std::promise<void>, 2> writeCompletedProms;
+  std::promise<Message> contiguousMessagePromise;
+  std::promise<void> scatteredMessagePromise;
+
+  auto context =
+      std::make_shared<Context>(ContextOptions().payloadChecksums(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  // Each payload is gathered from a header and a body, and the receiver reads
+  // the first one into a single buffer and scatters the second one into
+  // segments of its own.
+  std::string header = "a header";
+  std::string body(64 * 1024 + 3, 'y');
+  for (int i = 0; i < 2; i++) {
+    Message message;
+    Message::Payload payload;
+    payload.segments.push_back(
+        {const_cast<char*>(header.data()), header.length()});
+    payload.segments.push_back({const_cast<char*>(body.data()), body.length()});
+    message.payloads.push_back(std::move(payload));
+    clientPipe->write(
+        std::move(message), [&, i](const Error& error, Message message) {
+          ASSERT_FALSE(error) << error.what();
+          ASSERT_EQ(message.payloads.size(), 1);
+          EXPECT_EQ(
+              message.payloads[0].length, header.length() + body.length());
+          writeCompletedProms[i].set_value();
+        });
+  }
+
+  pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+    if (error) {
+      contiguousMessagePromise.set_exception(
+          std::make_exception_ptr(std::runtime_error(error.what())));
+    } else {
+      contiguousMessagePromise.set_value(std::move(message));
+    }
+  });
+  std::string scatteredHeader(header.length(), '\0');
+  std::string scatteredBody(body.length(), '\0');
+  serverPipe->readDescriptor([&](const Error& error, Message message) {
+    ASSERT_FALSE(error) << error.what();
+    ASSERT_EQ(message.payloads.size(), 1);
+    Message::Payload& payload = message.payloads[0];
+    ASSERT_EQ(payload.segments.size(), 2);
+    EXPECT_EQ(payload.segments[0].length, header.length());
+    EXPECT_EQ(payload.segments[1].length, body.length());
+    payload.segments[0].data = &scatteredHeader[0];
+    payload.segments[1].data = &scatteredBody[0];
+    serverPipe->read(
+        std::move(message), [&](const Error& error, Message /* unused */) {
+          if (error) {
+            scatteredMessagePromise.set_exception(
+                std::make_exception_ptr(std::runtime_error(error.what())));
+          } else {
+            scatteredMessagePromise.set_value();
+          }
+        });
+  });
+
+  Message contiguousMessage = contiguousMessagePromise.get_future().get();
+  ASSERT_EQ(contiguousMessage.payloads.size(), 1);
+  EXPECT_EQ(
+      std::string(
+          static_cast<char*>(contiguousMessage.payloads[0].data),
+          contiguousMessage.payloads[0].length),
+      header + body);
+  scatteredMessagePromise.get_future().get();
+  EXPECT_EQ(scatteredHeader, header);
+  EXPECT_EQ(scatteredBody, body);
+  for (std::promise<void>& writeCompletedProm : writeCompletedProms) {
+    writeCompletedProm.get_future().get();
+  }
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ReadInChunks) {
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<void> writeCompletedProm;
+  std::promise<Message> readMessagePromise;
+  std::vector<std::string> receivedPayloads;
+  std::vector<size_t> numPiecesOfPayloads;
+
+  auto context =
+      std::make_shared<Context>(ContextOptions().payloadChecksums(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(
+      listener->url("uv"), PipeOptions().payloadChunking(1024 * 1024));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  // The first payload is written in four chunks, the second one is below the
+  // threshold and is thus written as a whole.
+  std::string large(3 * 1024 * 1024 + 17, '\0');
+  for (size_t idx = 0; idx < large.size(); idx++) {
+    large[idx] = static_cast<char>(idx % 251);
+  }
+  Message message;
+  for (const std::string* data : {&large, &kPayloadData}) {
+    Message::Payload payload;
+    payload.data = const_cast<char*>(data->data());
+    payload.length = data->length();
+    message.payloads.push_back(std::move(payload));
+  }
+
+  clientPipe->write(
+      std::move(message), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value();
+      });
+
+  serverPipe->readDescriptor([&](const Error& error, Message message) {
+    ASSERT_FALSE(error);
+    receivedPayloads.resize(message.payloads.size());
+    numPiecesOfPayloads.resize(message.payloads.size(), 0);
+    serverPipe->readInChunks(
+        std::move(message),
+        [&](size_t payloadIdx, size_t offset, const void* ptr, size_t length) {
+          EXPECT_EQ(offset, receivedPayloads[payloadIdx].size());
+          receivedPayloads[payloadIdx].append(
+              reinterpret_cast<const char*>(ptr), length);
+          numPiecesOfPayloads[payloadIdx]++;
+        },
+        [&](const Error& error, Message message) {
+          if (error) {
+            readMessagePromise.set_exception(
+                std::make_exception_ptr(std::runtime_error(error.what())));
+          } else {
+            readMessagePromise.set_value(std::move(message));
+          }
+        });
+  });
+
+  Message received = readMessagePromise.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  ASSERT_EQ(received.payloads.size(), 2);
+  EXPECT_EQ(received.payloads[0].data, nullptr);
+  EXPECT_TRUE(receivedPayloads[0] == large);
+  EXPECT_EQ(receivedPayloads[1], kPayloadData);
+  EXPECT_EQ(numPiecesOfPayloads, std::vector<size_t>({4, 1}));
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ReadAhead) {
+  constexpr int kNumMessages = 3;
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::array<std::promise<Message>, kNumMessages> readDescriptorPromises;
+  std::array<std::promise<Message>, kNumMessages> readMessagePromises;
+
+  auto context =
+      std::make_shared<Context>(ContextOptions().readAheadWindow(2));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(
+      listener->url("uv"), PipeOptions().inlineTensorThreshold(1024));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  for (int i = 0; i < kNumMessages; i++) {
+    clientPipe->write(
+        makeMessage(2, 1), [](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+        });
+  }
+
+  // All the descriptors must come in before any memory is provided.
+  for (int i = 0; i < kNumMessages; i++) {
+    serverPipe->readDescriptor([&, i](const Error& error, Message message) {
+      if (error) {
+        readDescriptorPromises[i].set_exception(
+            std::make_exception_ptr(std::runtime_error(error.what())));
+      } else {
+        readDescriptorPromises[i].set_value(std::move(message));
+      }
+    });
+  }
+  std::array<Message, kNumMessages> messages;
+  for (int i = 0; i < kNumMessages; i++) {
+    messages[i] = readDescriptorPromises[i].get_future().get();
+  }
+
+  for (int i = 0; i < kNumMessages; i++) {
+    Message& message = messages[i];
+    for (auto& payload : message.payloads) {
+      auto payloadData = std::make_unique<uint8_t[]>(payload.length);
+      payload.data = payloadData.get();
+      buffers.push_back(std::move(payloadData));
+    }
+    for (auto& tensor : message.tensors) {
+      auto tensorData = std::make_unique<uint8_t[]>(tensor.buffer.cpu.length);
+      tensor.buffer.cpu.ptr = tensorData.get();
+      buffers.push_back(std::move(tensorData));
+    }
+    serverPipe->read(
+        std::move(message), [&, i](const Error& error, Message message) {
+          if (error) {
+            readMessagePromises[i].set_exception(
+                std::make_exception_ptr(std::runtime_error(error.what())));
+          } else {
+            readMessagePromises[i].set_value(std::move(message));
+          }
+        });
+  }
+  for (int i = 0; i < kNumMessages; i++) {
+    EXPECT_TRUE(messagesAreEqual(
+        readMessagePromises[i].get_future().get(), makeMessage(2, 1)));
+  }
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, InlineSmallPayloads) {
+  constexpr int kNumMessages = 3;
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::array<std::promise<Message>, kNumMessages> readDescriptorPromises;
+  std::array<std::promise<Message>, kNumMessages> readMessagePromises;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(
+      listener->url("uv"), PipeOptions().inlinePayloadThreshold(1024));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  for (int i = 0; i < kNumMessages; i++) {
+    clientPipe->write(
+        makeMessage(2, 0), [](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+        });
+  }
+
+  // The payloads came with the descriptors, hence all of these come in before
+  // any memory is provided, even without a read-ahead window.
+  for (int i = 0; i < kNumMessages; i++) {
+    serverPipe->readDescriptor([&, i](const Error& error, Message message) {
+      if (error) {
+        readDescriptorPromises[i].set_exception(
+            std::make_exception_ptr(std::runtime_error(error.what())));
+      } else {
+        readDescriptorPromises[i].set_value(std::move(message));
+      }
+    });
+  }
+  std::array<Message, kNumMessages> messages;
+  for (int i = 0; i < kNumMessages; i++) {
+    messages[i] = readDescriptorPromises[i].get_future().get();
+  }
+
+  for (int i = 0; i < kNumMessages; i++) {
+    Message& message = messages[i];
+    for (auto& payload : message.payloads) {
+      auto payloadData = std::make_unique<uint8_t[]>(payload.length);
+      payload.data = payloadData.get();
+      buffers.push_back(std::move(payloadData));
+    }
+    serverPipe->read(
+        std::move(message), [&, i](const Error& error, Message message) {
+          if (error) {
+            readMessagePromises[i].set_exception(
+                std::make_exception_ptr(std::runtime_error(error.what())));
+          } else {
+            readMessagePromises[i].set_value(std::move(message));
+          }
+        });
+  }
+  for (int i = 0; i < kNumMessages; i++) {
+    EXPECT_TRUE(messagesAreEqual(
+        readMessagePromises[i].get_future().get(), makeMessage(2, 0)));
+  }
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ReadWithAllocator) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<Message> readMessagePromise;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  serverPipe->read(
+      [&](Message& message) {
+        for (auto& payload : message.payloads) {
+          auto payloadData = std::make_unique<uint8_t[]>(payload.length);
+          payload.data = payloadData.get();
+          buffers.push_back(std::move(payloadData));
+        }
+        for (auto& tensor : message.tensors) {
+          auto tensorData =
+              std::make_unique<uint8_t[]>(tensor.buffer.cpu.length);
+          tensor.buffer.cpu.ptr = tensorData.get();
+          buffers.push_back(std::move(tensorData));
+        }
+      },
+      [&](const Error& error, Message message) {
+        if (error) {
+          readMessagePromise.set_exception(
+              std::make_exception_ptr(std::runtime_error(error.what())));
+        } else {
+          readMessagePromise.set_value(std::move(message));
+        }
+      });
+
+  clientPipe->write(
+      makeMessage(2, 2), [](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+      });
+
+  EXPECT_TRUE(messagesAreEqual(
+      readMessagePromise.get_future().get(), makeMessage(2, 2)));
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ReadWithAllocationHints) {
+  std::vector<std::shared_ptr<uint8_t>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<Message> readMessagePromise;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  serverPipe->read(
+      [&](Message& message) {
+        EXPECT_EQ(message.payloads[0].allocationHints.alignment, 4096);
+        EXPECT_TRUE(message.payloads[1].allocationHints.isDefault());
+        EXPECT_TRUE(message.tensors[0].allocationHints.isDefault());
+        EXPECT_EQ(message.tensors[1].allocationHints.alignment, 512);
+        Error error = allocateMessageWithHints(message, buffers);
+        ASSERT_FALSE(error) << error.what();
+      },
+      [&](const Error& error, Message message) {
+        if (error) {
+          readMessagePromise.set_exception(
+              std::make_exception_ptr(std::runtime_error(error.what())));
+        } else {
+          readMessagePromise.set_value(std::move(message));
+        }
+      });
+
+  Message message = makeMessage(2, 2);
+  message.payloads[0].allocationHints.alignment = 4096;
+  message.tensors[1].allocationHints.alignment = 512;
+  clientPipe->write(
+      std::move(message), [](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+      });
+
+  Message readMessage = readMessagePromise.get_future().get();
+  EXPECT_EQ(buffers.size(), 4);
+  EXPECT_EQ(
+      reinterpret_cast<uintptr_t>(readMessage.payloads[0].data) % 4096, 0);
+  EXPECT_EQ(
+      reinterpret_cast<uintptr_t>(readMessage.tensors[1].buffer.cpu.ptr) % 512,
+      0);
+  EXPECT_TRUE(messagesAreEqual(readMessage, makeMessage(2, 2)));
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, WriteReleasesBuffersEarly) {
+  std::vector<std::shared_ptr<uint8_t>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<void> buffersReleasedPromise;
+  std::promise<void> writtenMessagePromise;
+  std::promise<Message> readMessagePromise;
+  std::atomic<bool> buffersReleased{false};
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+#if TENSORPIPE_HAS_CMA_CHANNEL
+  context->registerChannel(1, "cma", std::make_shared<channel::cma::Context>());
+#endif // TENSORPIPE_HAS_CMA_CHANNEL
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  std::string payloadData = kPayloadData;
+  std::string tensorData = kTensorData;
+  Message message;
+  Message::Payload payload;
+  payload.data = &payloadData[0];
+  payload.length = payloadData.length();
+  message.payloads.push_back(std::move(payload));
+  message.tensors.push_back(
+      Message::Tensor{CpuBuffer{&tensorData[0], tensorData.length()}});
+  clientPipe->write(
+      std::move(message),
+      [&]() {
+        buffersReleased = true;
+        buffersReleasedPromise.set_value();
+      },
+      [&](const Error& error, Message /* unused */) {
+        EXPECT_FALSE(error) << error.what();
+        EXPECT_TRUE(buffersReleased);
+        writtenMessagePromise.set_value();
+      });
+
+  // The data is on its way from copies (or from the transport), hence the
+  // buffers can be overwritten before the other end even starts reading.
+  buffersReleasedPromise.get_future().get();
+  payloadData.assign(payloadData.length(), 'x');
+  tensorData.assign(tensorData.length(), 'x');
+
+  serverPipe->read(
+      [&](Message& message) {
+        Error error = allocateMessageWithHints(message, buffers);
+        ASSERT_FALSE(error) << error.what();
+      },
+      [&](const Error& error, Message message) {
+        if (error) {
+          readMessagePromise.set_exception(
+              std::make_exception_ptr(std::runtime_error(error.what())));
+        } else {
+          readMessagePromise.set_value(std::move(message));
+        }
+      });
+  EXPECT_TRUE(messagesAreEqual(
+      readMessagePromise.get_future().get(), makeMessage(1, 1)));
+  writtenMessagePromise.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, PostReceive) {
+  constexpr int kNumMessages = 4;
+  constexpr int kNumPostedReceives = 2;
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::array<std::promise<void>, kNumMessages> readMessagePromises;
+  std::shared_ptr<Pipe> serverPipe;
+  int numMessagesRead = 0;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  serverPipe = serverPipePromise.get_future().get();
+
+  // Each message that was read is checked to have landed in the buffers of
+  // its posted receive, and then posted again, as long as more are expected.
+  std::function<void(const Error&, Message)> onRead;
+  onRead = [&](const Error& error, Message message) {
+    ASSERT_FALSE(error);
+    EXPECT_TRUE(messagesAreEqual(message, makeMessage(2, 1)));
+    const int messageIdx = numMessagesRead++;
+    const int ringIdx = messageIdx % kNumPostedReceives;
+    EXPECT_EQ(message.payloads[0].data, buffers[3 * ringIdx].get());
+    EXPECT_EQ(
+        message.tensors[0].buffer.cpu.ptr, buffers[3 * ringIdx + 2].get());
+    if (messageIdx + kNumPostedReceives < kNumMessages) {
+      serverPipe->postReceive(std::move(message), onRead);
+    }
+    readMessagePromises[messageIdx].set_value();
+  };
+  for (int ringIdx = 0; ringIdx < kNumPostedReceives; ringIdx++) {
+    Message message;
+    for (int payloadIdx = 0; payloadIdx < 2; payloadIdx++) {
+      buffers.push_back(std::make_unique<uint8_t[]>(kPayloadData.length()));
+      Message::Payload payload;
+      payload.data = buffers.back().get();
+      payload.length = kPayloadData.length();
+      message.payloads.push_back(std::move(payload));
+    }
+    buffers.push_back(std::make_unique<uint8_t[]>(kTensorData.length()));
+    Message::Tensor tensor{
+        CpuBuffer{buffers.back().get(), kTensorData.length()}};
+    message.tensors.push_back(std::move(tensor));
+    serverPipe->postReceive(std::move(message), onRead);
+  }
+
+  for (int i = 0; i < kNumMessages; i++) {
+    clientPipe->write(
+        makeMessage(2, 1), [](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+        });
+  }
+
+  for (int i = 0; i < kNumMessages; i++) {
+    readMessagePromises[i].get_future().get();
+  }
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, PostReceiveMismatch) {
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<Message> readMessagePromise;
+  std::string payloadData(kPayloadData.length(), '\0');
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  Message message;
+  Message::Payload payload;
+  payload.data = const_cast<char*>(payloadData.data());
+  payload.length = payloadData.length();
+  message.payloads.push_back(std::move(payload));
+  serverPipe->postReceive(
+      std::move(message), [&](const Error& error, Message message) {
+        EXPECT_TRUE(error.isOfType<PostedReceiveMismatchError>());
+        readMessagePromise.set_value(std::move(message));
+      });
+
+  clientPipe->write(makeMessage(2, 0), [](const Error&, Message) {});
+
+  // The posted message comes back untouched.
+  Message postedMessage = readMessagePromise.get_future().get();
+  ASSERT_EQ(postedMessage.payloads.size(), 1);
+  EXPECT_EQ(postedMessage.payloads[0].data, payloadData.data());
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, WriteLimits) {
+  constexpr int kNumMessages = 4;
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::array<std::promise<Message>, kNumMessages> readMessagePromises;
+  std::promise<void> writableBeforeWritesPromise;
+  std::promise<int> writableAfterWritesPromise;
+  std::atomic<int> numWritesCompleted{0};
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  // Each message on its own exceeds the limit on the bytes in flight, hence
+  // the writes go through one at a time.
+  auto clientPipe = context->connect(
+      listener->url("uv"),
+      PipeOptions().maxWritesInFlight(2).maxWriteBytesInFlight(1));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  clientPipe->waitUntilWritable([&](const Error& error) {
+    ASSERT_FALSE(error);
+    writableBeforeWritesPromise.set_value();
+  });
+  writableBeforeWritesPromise.get_future().get();
+
+  for (int i = 0; i < kNumMessages; i++) {
+    clientPipe->write(
+        makeMessage(1, 1), [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          numWritesCompleted++;
+        });
+  }
+  clientPipe->waitUntilWritable([&](const Error& error) {
+    ASSERT_FALSE(error);
+    writableAfterWritesPromise.set_value(numWritesCompleted.load());
+  });
+
+  for (int i = 0; i < kNumMessages; i++) {
+    pipeRead(serverPipe, buffers, [&, i](const Error& error, Message message) {
+      if (error) {
+        readMessagePromises[i].set_exception(
+            std::make_exception_ptr(std::runtime_error(error.what())));
+      } else {
+        readMessagePromises[i].set_value(std::move(message));
+      }
+    });
+  }
+
+  for (int i = 0; i < kNumMessages; i++) {
+    EXPECT_TRUE(messagesAreEqual(
+        readMessagePromises[i].get_future().get(), makeMessage(1, 1)));
+  }
+  // The pipe only had room again once all the writes were done.
+  EXPECT_EQ(writableAfterWritesPromise.get_future().get(), kNumMessages);
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, WritePriorities) {
+  // A tensor that's too large to fit in the buffers of the connection, hence
+  // whose write doesn't complete until the remote side reads it, and holds the
+  // following writes back given the limit on the writes in flight.
+  constexpr size_t kLargeTensorSize = 64 * 1024 * 1024;
+  std::vector<uint8_t> largeTensorData(kLargeTensorSize, 0x42);
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::array<std::promise<Message>, 3> readMessagePromises;
+  std::mutex mutex;
+  std::vector<int> writeCallbackOrder;
+  std::promise<void> writesDonePromise;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(
+      listener->url("uv"), PipeOptions().maxWritesInFlight(1));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  auto onWrite = [&](int idx) {
+    return [&, idx](const Error& error, Message /* unused */) {
+      ASSERT_FALSE(error);
+      std::unique_lock<std::mutex> lock(mutex);
+      writeCallbackOrder.push_back(idx);
+      if (writeCallbackOrder.size() == 3) {
+        writesDonePromise.set_value();
+      }
+    };
+  };
+
+  Message largeMessage;
+  largeMessage.tensors.push_back(
+      Message::Tensor{CpuBuffer{largeTensorData.data(), kLargeTensorSize}});
+  // The pipe may not be established yet, hence the large message must have the
+  // highest priority too in order to go out first.
+  clientPipe->write(std::move(largeMessage), /*priority=*/1, onWrite(0));
+  // The messages are told apart by their number of payloads.
+  clientPipe->write(makeMessage(1, 0), onWrite(1));
+  clientPipe->write(makeMessage(2, 0), /*priority=*/1, onWrite(2));
+
+  for (int i = 0; i < 3; i++) {
+    pipeRead(serverPipe, buffers, [&, i](const Error& error, Message message) {
+      if (error) {
+        readMessagePromises[i].set_exception(
+            std::make_exception_ptr(std::runtime_error(error.what())));
+      } else {
+        readMessagePromises[i].set_value(std::move(message));
+      }
+    });
+  }
+
+  EXPECT_EQ(readMessagePromises[0].get_future().get().tensors.size(), 1);
+  EXPECT_TRUE(messagesAreEqual(
+      readMessagePromises[1].get_future().get(), makeMessage(2, 0)));
+  EXPECT_TRUE(messagesAreEqual(
+      readMessagePromises[2].get_future().get(), makeMessage(1, 0)));
+  writesDonePromise.get_future().get();
+  EXPECT_EQ(writeCallbackOrder, std::vector<int>({0, 2, 1}));
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, WriteDeadlines) {
+  // As above, a large tensor whose write holds the following ones back until
+  // the remote side reads it.
+  constexpr size_t kLargeTensorSize = 64 * 1024 * 1024;
+  std::vector<uint8_t> largeTensorData(kLargeTensorSize, 0x42);
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::array<std::promise<Message>, 2> readMessagePromises;
+  std::mutex mutex;
+  std::vector<int> writeCallbackOrder;
+  std::vector<Error> writeErrors;
+  std::promise<void> writesDonePromise;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(
+      listener->url("uv"), PipeOptions().maxWritesInFlight(1));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  auto onWrite = [&](int idx) {
+    return [&, idx](const Error& error, Message /* unused */) {
+      std::unique_lock<std::mutex> lock(mutex);
+      writeCallbackOrder.push_back(idx);
+      writeErrors.push_back(error);
+      if (writeCallbackOrder.size() == 3) {
+        writesDonePromise.set_value();
+      }
+    };
+  };
+
+  Message largeMessage;
+  largeMessage.tensors.push_back(
+      Message::Tensor{CpuBuffer{largeTensorData.data(), kLargeTensorSize}});
+  clientPipe->write(std::move(largeMessage), onWrite(0));
+  // The messages are told apart by their number of payloads.
+  clientPipe->write(
+      makeMessage(1, 0),
+      /*priority=*/0,
+      std::chrono::milliseconds(50),
+      onWrite(1));
+  clientPipe->write(makeMessage(2, 0), onWrite(2));
+
+  // Let the deadline pass while the second write is still held back.
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  for (int i = 0; i < 2; i++) {
+    pipeRead(serverPipe, buffers, [&, i](const Error& error, Message message) {
+      if (error) {
+        readMessagePromises[i].set_exception(
+            std::make_exception_ptr(std::runtime_error(error.what())));
+      } else {
+        readMessagePromises[i].set_value(std::move(message));
+      }
+    });
+  }
+
+  EXPECT_EQ(readMessagePromises[0].get_future().get().tensors.size(), 1);
+  // The write that expired never went out, but the pipe kept working.
+  EXPECT_TRUE(messagesAreEqual(
+      readMessagePromises[1].get_future().get(), makeMessage(2, 0)));
+  writesDonePromise.get_future().get();
+  EXPECT_EQ(writeCallbackOrder, std::vector<int>({0, 1, 2}));
+  EXPECT_FALSE(writeErrors[0]);
+  EXPECT_TRUE(writeErrors[1].isOfType<DeadlineExceededError>());
+  EXPECT_FALSE(writeErrors[2]);
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ReadDeadline) {
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::array<std::promise<Error>, 2> readDescriptorPromises;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  // Nothing is ever written, hence the read can only time out, and it takes
+  // the pipe down with it.
+  serverPipe->readDescriptor(
+      std::chrono::milliseconds(50),
+      [&](const Error& error, Message /* unused */) {
+        readDescriptorPromises[0].set_value(error);
+      });
+  serverPipe->readDescriptor([&](const Error& error, Message /* unused */) {
+    readDescriptorPromises[1].set_value(error);
+  });
+  for (int i = 0; i < 2; i++) {
+    EXPECT_TRUE(readDescriptorPromises[i]
+                    .get_future()
+                    .get()
+                    .isOfType<DeadlineExceededError>());
+  }
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, WriteBatch) {
+  constexpr int kNumMessages = 5;
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::array<std::promise<Message>, kNumMessages> readMessagePromises;
+  std::mutex mutex;
+  std::vector<size_t> writeCallbackOrder;
+  std::promise<void> writesDonePromise;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  // The messages are told apart by their number of payloads, and they include
+  // an empty one and ones with a tensor, which goes through a channel.
+  std::vector<Message> messages;
+  for (int i = 0; i < kNumMessages; i++) {
+    messages.push_back(makeMessage(i, i % 2));
+  }
+  clientPipe->writeBatch(
+      std::move(messages), [&](const Error& error, Message message) {
+        ASSERT_FALSE(error);
+        std::unique_lock<std::mutex> lock(mutex);
+        writeCallbackOrder.push_back(message.payloads.size());
+        if (writeCallbackOrder.size() == kNumMessages) {
+          writesDonePromise.set_value();
+        }
+      });
+
+  for (int i = 0; i < kNumMessages; i++) {
+    pipeRead(serverPipe, buffers, [&, i](const Error& error, Message message) {
+      if (error) {
+        readMessagePromises[i].set_exception(
+            std::make_exception_ptr(std::runtime_error(error.what())));
+      } else {
+        readMessagePromises[i].set_value(std::move(message));
+      }
+    });
+  }
+
+  for (int i = 0; i < kNumMessages; i++) {
+    EXPECT_TRUE(messagesAreEqual(
+        readMessagePromises[i].get_future().get(), makeMessage(i, i % 2)));
+  }
+  writesDonePromise.get_future().get();
+  EXPECT_EQ(writeCallbackOrder, std::vector<size_t>({0, 1, 2, 3, 4}));
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ReadBatch) {
+  constexpr size_t kNumMessages = 6;
+  constexpr size_t kMaxBatchSize = 4;
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<void> writesDonePromise;
+  std::atomic<size_t> numWritesDone{0};
+
+  // The batches read ahead beyond the window.
+  auto context =
+      std::make_shared<Context>(ContextOptions().readAheadWindow(1));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  for (size_t i = 0; i < kNumMessages; i++) {
+    clientPipe->write(
+        makeMessage(i, i % 2), [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          if (++numWritesDone == kNumMessages) {
+            writesDonePromise.set_value();
+          }
+        });
+  }
+  writesDonePromise.get_future().get();
+
+  // The messages are told apart by their number of payloads.
+  size_t numMessagesRead = 0;
+  while (numMessagesRead < kNumMessages) {
+    std::promise<std::vector<Message>> descriptorsPromise;
+    serverPipe->readDescriptorBatch(
+        kMaxBatchSize, [&](const Error& error, std::vector<Message> messages) {
+          if (error) {
+            descriptorsPromise.set_exception(
+                std::make_exception_ptr(std::runtime_error(error.what())));
+          } else {
+            descriptorsPromise.set_value(std::move(messages));
+          }
+        });
+    std::vector<Message> messages = descriptorsPromise.get_future().get();
+    ASSERT_GE(messages.size(), 1);
+    ASSERT_LE(messages.size(), kMaxBatchSize);
+    ASSERT_LE(numMessagesRead + messages.size(), kNumMessages);
+
+    for (Message& message : messages) {
+      for (auto& payload : message.payloads) {
+        auto payloadData = std::make_unique<uint8_t[]>(payload.length);
+        payload.data = payloadData.get();
+        buffers.push_back(std::move(payloadData));
+      }
+      for (auto& tensor : message.tensors) {
+        auto tensorData =
+            std::make_unique<uint8_t[]>(tensor.buffer.cpu.length);
+        tensor.buffer.cpu.ptr = tensorData.get();
+        buffers.push_back(std::move(tensorData));
+      }
+    }
+
+    const size_t batchSize = messages.size();
+    std::mutex mutex;
+    std::vector<Message> readMessages;
+    std::promise<void> readsDonePromise;
+    serverPipe->readBatch(
+        std::move(messages), [&](const Error& error, Message message) {
+          ASSERT_FALSE(error);
+          std::unique_lock<std::mutex> lock(mutex);
+          readMessages.push_back(std::move(message));
+          if (readMessages.size() == batchSize) {
+            readsDonePromise.set_value();
+          }
+        });
+    readsDonePromise.get_future().get();
+    for (size_t i = 0; i < batchSize; i++) {
+      const size_t messageIdx = numMessagesRead + i;
+      EXPECT_TRUE(messagesAreEqual(
+          readMessages[i], makeMessage(messageIdx, messageIdx % 2)));
+    }
+    numMessagesRead += batchSize;
+  }
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, WriteCoalescing) {
+  constexpr int kNumMessages = 20;
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::array<std::promise<Message>, kNumMessages> readMessagePromises;
+  std::mutex mutex;
+  std::vector<size_t> writeCallbackOrder;
+  std::promise<void> writesDonePromise;
+
+  // The budget is long enough that the messages that are held only go out once
+  // the earlier writes are done, and the threshold is past all of them.
+  auto context = std::make_shared<Context>(ContextOptions().writeCoalescing(
+      std::chrono::seconds(10), /*threshold=*/1024 * 1024));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  // The messages are told apart by their number of payloads, and some of them
+  // have a tensor, which goes through a channel.
+  for (int i = 0; i < kNumMessages; i++) {
+    clientPipe->write(
+        makeMessage(i % 5, i % 2), [&](const Error& error, Message message) {
+          ASSERT_FALSE(error);
+          std::unique_lock<std::mutex> lock(mutex);
+          writeCallbackOrder.push_back(message.payloads.size());
+          if (writeCallbackOrder.size() == kNumMessages) {
+            writesDonePromise.set_value();
+          }
+        });
+  }
+
+  for (int i = 0; i < kNumMessages; i++) {
+    pipeRead(serverPipe, buffers, [&, i](const Error& error, Message message) {
+      if (error) {
+        readMessagePromises[i].set_exception(
+            std::make_exception_ptr(std::runtime_error(error.what())));
+      } else {
+        readMessagePromises[i].set_value(std::move(message));
+      }
+    });
+  }
+
+  std::vector<size_t> expectedCallbackOrder;
+  for (int i = 0; i < kNumMessages; i++) {
+    EXPECT_TRUE(messagesAreEqual(
+        readMessagePromises[i].get_future().get(), makeMessage(i % 5, i % 2)));
+    expectedCallbackOrder.push_back(i % 5);
+  }
+  writesDonePromise.get_future().get();
+  EXPECT_EQ(writeCallbackOrder, expectedCallbackOrder);
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, UnorderedCompletions) {
+  constexpr int kNumMessages = 6;
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::array<std::promise<Message>, kNumMessages> readMessagePromises;
+  std::mutex mutex;
+  std::set<uint64_t> writeSequenceNumbers;
+  std::set<uint64_t> readSequenceNumbers;
+  std::promise<void> writesDonePromise;
+  std::promise<void> readsDonePromise;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(
+      listener->url("uv"), PipeOptions().unorderedCompletions(true));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  // The client's callbacks may come in any order, but each gets the number
+  // that the message has on the other end.
+  for (int i = 0; i < kNumMessages; i++) {
+    clientPipe->write(
+        makeMessage(i, i % 2), [&, i](const Error& error, Message message) {
+          ASSERT_FALSE(error);
+          EXPECT_EQ(message.payloads.size(), static_cast<size_t>(i));
+          EXPECT_EQ(message.sequenceNumber, static_cast<uint64_t>(i));
+          std::unique_lock<std::mutex> lock(mutex);
+          writeSequenceNumbers.insert(message.sequenceNumber);
+          if (writeSequenceNumbers.size() == kNumMessages) {
+            writesDonePromise.set_value();
+          }
+        });
+  }
+  for (int i = 0; i < kNumMessages; i++) {
+    pipeRead(serverPipe, buffers, [&, i](const Error& error, Message message) {
+      if (error) {
+        readMessagePromises[i].set_exception(
+            std::make_exception_ptr(std::runtime_error(error.what())));
+      } else {
+        readMessagePromises[i].set_value(std::move(message));
+      }
+    });
+  }
+  for (int i = 0; i < kNumMessages; i++) {
+    Message message = readMessagePromises[i].get_future().get();
+    EXPECT_EQ(message.sequenceNumber, static_cast<uint64_t>(i));
+    EXPECT_TRUE(messagesAreEqual(message, makeMessage(i, i % 2)));
+  }
+  writesDonePromise.get_future().get();
+
+  for (int i = 0; i < kNumMessages; i++) {
+    serverPipe->write(
+        makeMessage(i, i % 2), [](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+        });
+  }
+  for (int i = 0; i < kNumMessages; i++) {
+    pipeRead(clientPipe, buffers, [&](const Error& error, Message message) {
+      ASSERT_FALSE(error);
+      EXPECT_TRUE(messagesAreEqual(
+          message,
+          makeMessage(message.sequenceNumber, message.sequenceNumber % 2)));
+      std::unique_lock<std::mutex> lock(mutex);
+      readSequenceNumbers.insert(message.sequenceNumber);
+      if (readSequenceNumbers.size() == kNumMessages) {
+        readsDonePromise.set_value();
+      }
+    });
+  }
+  readsDonePromise.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, WriteToPipes) {
+  constexpr size_t kNumPipes = 3;
+  std::array<std::vector<std::unique_ptr<uint8_t[]>>, kNumPipes> buffers;
+  std::array<std::promise<Message>, kNumPipes> readMessagePromises;
+  std::promise<Message> writeCompletedProm;
+
+  auto context =
+      std::make_shared<Context>(ContextOptions().payloadChecksums(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::vector<std::shared_ptr<Pipe>> clientPipes;
+  std::vector<std::shared_ptr<Pipe>> serverPipes;
+  for (size_t pipeIdx = 0; pipeIdx < kNumPipes; pipeIdx++) {
+    std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+    listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+      ASSERT_FALSE(error);
+      serverPipePromise.set_value(std::move(pipe));
+    });
+    clientPipes.push_back(context->connect(listener->url("uv")));
+    serverPipes.push_back(serverPipePromise.get_future().get());
+  }
+
+  Pipe::writeToPipes(
+      clientPipes, makeMessage(2, 1), [&](const Error& error, Message message) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value(std::move(message));
+      });
+
+  for (size_t pipeIdx = 0; pipeIdx < kNumPipes; pipeIdx++) {
+    pipeRead(
+        serverPipes[pipeIdx],
+        buffers[pipeIdx],
+        [&, pipeIdx](const Error& error, Message message) {
+          if (error) {
+            readMessagePromises[pipeIdx].set_exception(
+                std::make_exception_ptr(std::runtime_error(error.what())));
+          } else {
+            readMessagePromises[pipeIdx].set_value(std::move(message));
+          }
+        });
+  }
+
+  for (size_t pipeIdx = 0; pipeIdx < kNumPipes; pipeIdx++) {
+    EXPECT_TRUE(messagesAreEqual(
+        readMessagePromises[pipeIdx].get_future().get(), makeMessage(2, 1)));
+  }
+  // The message is given back once, after all the pipes are done with it.
+  EXPECT_TRUE(messagesAreEqual(
+      writeCompletedProm.get_future().get(), makeMessage(2, 1)));
+
+  serverPipes.clear();
+  listener.reset();
+  clientPipes.clear();
+  context->join();
+}
+
+TEST(Context, ServerWritesBeforeChannelsConnect) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::array<std::promise<Message>, 3> readMessagePromises;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+#if TENSORPIPE_HAS_CMA_CHANNEL
+  context->registerChannel(1, "cma", std::make_shared<channel::cma::Context>());
+#endif // TENSORPIPE_HAS_CMA_CHANNEL
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  // The server writes as soon as it gets the pipe, hence the messages that
+  // only have payloads may go out before the channels are connected, but they
+  // must not overtake the one that has a tensor.
+  std::shared_ptr<Pipe> serverPipe;
+  std::atomic<int> writeNum(3);
+  auto onWrite = [&](const Error& error, Message /* unused */) {
+    ASSERT_FALSE(error);
+    if (--writeNum == 0) {
+      writeCompletedProm.set_value();
+    }
+  };
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    serverPipe->write(makeMessage(1, 0), onWrite);
+    serverPipe->write(makeMessage(1, 1), onWrite);
+    serverPipe->write(makeMessage(2, 0), onWrite);
+  });
+
+  std::shared_ptr<Pipe> clientPipe = context->connect(listener->url("uv"));
+  for (int i = 0; i < 3; i++) {
+    pipeRead(clientPipe, buffers, [&, i](const Error& error, Message message) {
+      if (error) {
+        readMessagePromises[i].set_exception(
+            std::make_exception_ptr(std::runtime_error(error.what())));
+      } else {
+        readMessagePromises[i].set_value(std::move(message));
+      }
+    });
+  }
+
+  EXPECT_TRUE(messagesAreEqual(
+      readMessagePromises[0].get_future().get(), makeMessage(1, 0)));
+  EXPECT_TRUE(messagesAreEqual(
+      readMessagePromises[1].get_future().get(), makeMessage(1, 1)));
+  EXPECT_TRUE(messagesAreEqual(
+      readMessagePromises[2].get_future().get(), makeMessage(2, 0)));
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, MultiplexedChannelConnections) {
+  constexpr int kNumMessages = 4;
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  auto context = std::make_shared<Context>(
+      ContextOptions().multiplexChannelConnections(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  // The connections of both channels are carried by a single one.
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+  context->registerChannel(1, "xth", std::make_shared<channel::xth::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  std::atomic<int> readNum(kNumMessages);
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    for (int i = 0; i < kNumMessages; i++) {
+      pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+        ASSERT_FALSE(error);
+        EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 2)));
+        if (--readNum == 0) {
+          readCompletedProm.set_value();
+        }
+      });
+    }
+  });
+
+  std::shared_ptr<Pipe> clientPipe = context->connect(listener->url("uv"));
+  std::atomic<int> writeNum(kNumMessages);
+  for (int i = 0; i < kNumMessages; i++) {
+    clientPipe->write(
+        makeMessage(1, 2), [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          if (--writeNum == 0) {
+            writeCompletedProm.set_value();
+          }
+        });
+  }
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, WarmPipes) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  // The pipe is opened, and accepted, before the client asks for it.
+  context->warmPipes(listener->url("uv"), 1);
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+  std::shared_ptr<Pipe> clientPipe = context->connect(listener->url("uv"));
+
+  pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+    ASSERT_FALSE(error);
+    EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+    readCompletedProm.set_value();
+  });
+  clientPipe->write(
+      makeMessage(1, 1), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value();
+      });
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, WarmPipesWithOtherOptions) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::promise<std::shared_ptr<Pipe>> warmServerPipePromise;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    warmServerPipePromise.set_value(std::move(pipe));
+  });
+  context->warmPipes(listener->url("uv"), 1);
+  std::shared_ptr<Pipe> warmServerPipe =
+      warmServerPipePromise.get_future().get();
+
+  // The pipe of the pool was opened with other options, hence a new one is,
+  // and it's the one that carries the message.
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipePromise.set_value(std::move(pipe));
+  });
+  std::shared_ptr<Pipe> clientPipe = context->connect(
+      listener->url("uv"), PipeOptions().remoteName("other"));
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+    ASSERT_FALSE(error);
+    EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+    readCompletedProm.set_value();
+  });
+  clientPipe->write(
+      makeMessage(1, 1), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value();
+      });
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  warmServerPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, AcceptBatch) {
+  constexpr size_t kNumPipes = 5;
+  constexpr size_t kMaxBatchSize = 2;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::vector<std::shared_ptr<Pipe>> clientPipes;
+  for (size_t pipeIdx = 0; pipeIdx < kNumPipes; pipeIdx++) {
+    clientPipes.push_back(context->connect(listener->url("uv")));
+  }
+
+  std::vector<std::shared_ptr<Pipe>> serverPipes;
+  while (serverPipes.size() < kNumPipes) {
+    std::promise<std::vector<std::shared_ptr<Pipe>>> batchPromise;
+    listener->acceptBatch(
+        kMaxBatchSize,
+        [&](const Error& error, std::vector<std::shared_ptr<Pipe>> pipes) {
+          ASSERT_FALSE(error);
+          batchPromise.set_value(std::move(pipes));
+        });
+    std::vector<std::shared_ptr<Pipe>> batch = batchPromise.get_future().get();
+    EXPECT_GE(batch.size(), 1);
+    EXPECT_LE(batch.size(), kMaxBatchSize);
+    for (auto& pipe : batch) {
+      EXPECT_NE(pipe, nullptr);
+      serverPipes.push_back(std::move(pipe));
+    }
+  }
+  EXPECT_EQ(serverPipes.size(), kNumPipes);
+
+  // Once closed, the listener fails the whole batch at once.
+  listener->close();
+  std::promise<void> failedPromise;
+  listener->acceptBatch(
+      kMaxBatchSize,
+      [&](const Error& error, std::vector<std::shared_ptr<Pipe>> pipes) {
+        EXPECT_TRUE(error);
+        EXPECT_TRUE(pipes.empty());
+        failedPromise.set_value();
+      });
+  failedPromise.get_future().get();
+
+  serverPipes.clear();
+  listener.reset();
+  clientPipes.clear();
+  context->join();
+}
+
+TEST(Context, JoinWithTimeoutAndAsync) {
+  for (bool async : {false, true}) {
+    std::vector<std::unique_ptr<uint8_t[]>> buffers;
+    std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+    std::promise<void> readCompletedProm;
+
+    auto context = std::make_shared<Context>();
+
+    context->registerTransport(
+        0, "uv", std::make_shared<transport::uv::Context>());
+#if TENSORPIPE_HAS_SHM_TRANSPORT
+    context->registerTransport(
+        1, "shm", std::make_shared<transport::shm::Context>());
+#endif // TENSORPIPE_HAS_SHM_TRANSPORT
+    context->registerChannel(
+        0, "basic", std::make_shared<channel::basic::Context>());
+
+    auto listener = context->listen({"uv://127.0.0.1"});
+    listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+      ASSERT_FALSE(error);
+      serverPipePromise.set_value(std::move(pipe));
+    });
+    std::shared_ptr<Pipe> clientPipe = context->connect(listener->url("uv"));
+    std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+    pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+      ASSERT_FALSE(error);
+      EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+      readCompletedProm.set_value();
+    });
+    clientPipe->write(makeMessage(1, 1), [](const Error&, Message) {});
+    readCompletedProm.get_future().get();
+
+    // The pipes are left open, for the join to close them.
+    if (async) {
+      std::promise<void> joinedProm;
+      context->joinAsync([&]() { joinedProm.set_value(); });
+      joinedProm.get_future().get();
+      // Already joined, hence called inline.
+      bool calledInline = false;
+      context->joinAsync([&]() { calledInline = true; });
+      EXPECT_TRUE(calledInline);
+    } else {
+      EXPECT_TRUE(context->join(std::chrono::seconds(10)));
+    }
+    EXPECT_TRUE(context->join(std::chrono::milliseconds(0)));
+  }
+}
+
+#if TENSORPIPE_HAS_SHM_TRANSPORT
+TEST(Context, MemoryFootprint) {
+  // The memory held once all the inboxes are in use, as seen without a limit.
+  uint64_t sharedBytesWithoutLimit = 0;
+  for (bool withSoftLimit : {false, true}) {
+    std::vector<std::unique_ptr<uint8_t[]>> buffers;
+    std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+
+    // Any memory at all is over the limit.
+    auto context = std::make_shared<Context>(
+        ContextOptions().memorySoftLimit(withSoftLimit ? 1 : 0));
+
+    context->registerTransport(
+        0, "shm", std::make_shared<transport::shm::Context>());
+    context->registerChannel(
+        0, "basic", std::make_shared<channel::basic::Context>());
+
+    auto listener = context->listen({createUniqueShmAddr()});
+    listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+      ASSERT_FALSE(error);
+      serverPipePromise.set_value(std::move(pipe));
+    });
+    std::shared_ptr<Pipe> clientPipe = context->connect(listener->url("shm"));
+    std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+    for (int iter = 0; iter < 2; iter++) {
+      std::promise<void> readCompletedProm;
+      std::promise<void> writeCompletedProm;
+      pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+        ASSERT_FALSE(error);
+        EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+        readCompletedProm.set_value();
+      });
+      clientPipe->write(makeMessage(1, 1), [&](const Error& error, Message) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value();
+      });
+      readCompletedProm.get_future().get();
+      writeCompletedProm.get_future().get();
+
+      std::map<std::string, MemoryFootprint> footprints =
+          context->getMemoryFootprint();
+      ASSERT_EQ(footprints.count("transport/shm"), 1);
+      ASSERT_EQ(footprints.count("channel/basic"), 1);
+      ASSERT_EQ(footprints.count("core"), 1);
+      // The messages were all written, hence they're no longer referenced.
+      EXPECT_EQ(footprints["core"].totalBytes(), 0);
+      if (!withSoftLimit) {
+        // At least the inboxes of both ends of the pipe's connection.
+        sharedBytesWithoutLimit = footprints["transport/shm"].sharedBytes;
+        EXPECT_GE(
+            sharedBytesWithoutLimit, 2 * transport::shm::kDefaultBufferSize);
+        continue;
+      }
+
+      // The inboxes of the idle connections are given back, and the pipe keeps
+      // working (as the second iteration checks) as they're reacquired.
+      const uint64_t target =
+          sharedBytesWithoutLimit - 2 * transport::shm::kDefaultBufferSize;
+      const auto deadline =
+          std::chrono::steady_clock::now() + std::chrono::seconds(10);
+      while (context->getMemoryFootprint()["transport/shm"].sharedBytes >
+                 target &&
+             std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      EXPECT_LE(
+          context->getMemoryFootprint()["transport/shm"].sharedBytes, target);
+    }
+
+    serverPipe.reset();
+    listener.reset();
+    clientPipe.reset();
+    context->join();
+  }
+}
+#endif // TENSORPIPE_HAS_SHM_TRANSPORT
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/coroutines.h>
+
+// The awaitables only exist for builds with C++20 coroutines, hence this test
+// has a target of its own, which is only built with them.
+#if !defined(__cpp_impl_coroutine) || !__has_include(<coroutine>)
+#error "The coroutines test must be built with C++20 coroutines"
+#endif
+
+#include <atomic>
+#include <exception>
+#include <future>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/tensorpipe.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+// A coroutine that runs eagerly and that nobody waits for.
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() {
+      return {};
+    }
+    std::suspend_never initial_suspend() noexcept {
+      return {};
+    }
+    std::suspend_never final_suspend() noexcept {
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() {
+      std::terminate();
+    }
+  };
+};
+
+const std::string kPayloadData = "I'm a payload";
+
+// Accept a pipe and send back the message that comes in on it.
+DetachedTask echo(
+    Listener& listener,
+    std::promise<std::shared_ptr<Pipe>>& pipePromise) {
+  coro::AcceptResult accepted = co_await coro::accept(listener);
+  EXPECT_FALSE(accepted.error) << accepted.error.what();
+  std::shared_ptr<Pipe> pipe = std::move(accepted.pipe);
+
+  coro::MessageResult result = co_await coro::readDescriptor(*pipe);
+  EXPECT_FALSE(result.error) << result.error.what();
+  EXPECT_EQ(result.message.payloads.size(), 1);
+  std::string data(result.message.payloads[0].length, '\0');
+  result.message.payloads[0].data = &data[0];
+  result = co_await coro::read(*pipe, std::move(result.message));
+  EXPECT_FALSE(result.error) << result.error.what();
+  EXPECT_EQ(data, kPayloadData);
+
+  result = co_await coro::write(*pipe, std::move(result.message));
+  EXPECT_FALSE(result.error) << result.error.what();
+
+  // Don't destroy the pipe from its own callback.
+  pipePromise.set_value(std::move(pipe));
+}
+
+// Send a message and read back the reply, resuming through the executor.
+DetachedTask ping(
+    Pipe& pipe,
+    coro::resume_executor_fn executor,
+    std::promise<std::string>& replyPromise) {
+  Message message;
+  std::string data = kPayloadData;
+  Message::Payload payload;
+  payload.data = &data[0];
+  payload.length = data.length();
+  message.payloads.push_back(std::move(payload));
+  coro::MessageResult result =
+      co_await coro::write(pipe, std::move(message), executor);
+  EXPECT_FALSE(result.error) << result.error.what();
+
+  std::string reply;
+  result = co_await coro::read(
+      pipe,
+      [&reply](Message& message) {
+        reply.resize(message.payloads[0].length);
+        message.payloads[0].data = &reply[0];
+      },
+      executor);
+  EXPECT_FALSE(result.error) << result.error.what();
+  replyPromise.set_value(std::move(reply));
+}
+
+} // namespace
+
+TEST(Coroutines, Echo) {
+  auto context = std::make_shared<Context>();
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  echo(*listener, serverPipePromise);
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::atomic<int> numResumes{0};
+  std::promise<std::string> replyPromise;
+  ping(
+      *clientPipe,
+      [&numResumes](MoveOnlyFunction<void()> fn) {
+        numResumes++;
+        fn();
+      },
+      replyPromise);
+
+  EXPECT_EQ(replyPromise.get_future().get(), kPayloadData);
+  EXPECT_EQ(numResumes, 2);
+  std::shared_ptr<Pipe> serverPipe = serverPipePromise.get_future().get();
+
+  serverPipe.reset();
+  clientPipe.reset();
+  listener.reset();
+  context->join();
+}
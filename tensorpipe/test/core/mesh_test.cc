@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <exception>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/tensorpipe.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+std::shared_ptr<Context> makeContext() {
+  auto context = std::make_shared<Context>();
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+  return context;
+}
+
+std::future<Mesh> startBootstrap(
+    std::shared_ptr<Context> context,
+    std::shared_ptr<Listener> listener,
+    size_t rank,
+    std::vector<std::string> urls,
+    MeshOptions options) {
+  auto meshPromise = std::make_shared<std::promise<Mesh>>();
+  std::future<Mesh> meshFuture = meshPromise->get_future();
+  bootstrapMesh(
+      std::move(context),
+      std::move(listener),
+      rank,
+      std::move(urls),
+      std::move(options),
+      [meshPromise](const Error& error, Mesh mesh) {
+        if (error) {
+          meshPromise->set_exception(
+              std::make_exception_ptr(std::runtime_error(error.what())));
+        } else {
+          meshPromise->set_value(std::move(mesh));
+        }
+      });
+  return meshFuture;
+}
+
+std::string readMetadata(Pipe& pipe) {
+  std::promise<std::string> metadataPromise;
+  pipe.read(
+      [](Message& /* unused */) {},
+      [&](const Error& error, Message message) {
+        if (error) {
+          metadataPromise.set_exception(
+              std::make_exception_ptr(std::runtime_error(error.what())));
+        } else {
+          metadataPromise.set_value(std::move(message.metadata));
+        }
+      });
+  return metadataPromise.get_future().get();
+}
+
+} // namespace
+
+TEST(Mesh, AllPairs) {
+  constexpr size_t kNumProcesses = 4;
+  std::vector<std::shared_ptr<Context>> contexts;
+  std::vector<std::shared_ptr<Listener>> listeners;
+  std::vector<std::string> urls;
+  for (size_t rank = 0; rank < kNumProcesses; rank++) {
+    contexts.push_back(makeContext());
+    listeners.push_back(contexts.back()->listen({"uv://127.0.0.1"}));
+    urls.push_back(listeners.back()->url("uv"));
+  }
+
+  // All the processes are on the same host, hence this has them connect to
+  // one another one at a time.
+  MeshOptions options;
+  options.maxPendingConnectsPerHost = 1;
+  std::vector<std::future<Mesh>> meshFutures;
+  for (size_t rank = 0; rank < kNumProcesses; rank++) {
+    meshFutures.push_back(
+        startBootstrap(contexts[rank], listeners[rank], rank, urls, options));
+  }
+  std::vector<Mesh> meshes;
+  for (std::future<Mesh>& meshFuture : meshFutures) {
+    meshes.push_back(meshFuture.get());
+  }
+
+  for (size_t rank = 0; rank < kNumProcesses; rank++) {
+    ASSERT_EQ(meshes[rank].pipes.size(), kNumProcesses);
+    EXPECT_EQ(meshes[rank].pipes[rank], nullptr);
+    EXPECT_LE(
+        meshes[rank].timings.connectsIssued, meshes[rank].timings.connected);
+    EXPECT_LE(meshes[rank].timings.connected, meshes[rank].timings.total);
+    EXPECT_LE(meshes[rank].timings.accepted, meshes[rank].timings.total);
+  }
+  for (size_t rank = 0; rank < kNumProcesses; rank++) {
+    for (size_t peerRank = 0; peerRank < kNumProcesses; peerRank++) {
+      if (peerRank == rank) {
+        continue;
+      }
+      Message message;
+      message.metadata = std::to_string(rank) + "->" + std::to_string(peerRank);
+      meshes[rank].pipes[peerRank]->write(
+          std::move(message), [](const Error& error, Message /* unused */) {
+            EXPECT_FALSE(error) << error.what();
+          });
+      EXPECT_EQ(
+          readMetadata(*meshes[peerRank].pipes[rank]),
+          std::to_string(rank) + "->" + std::to_string(peerRank));
+    }
+  }
+
+  for (size_t rank = 0; rank < kNumProcesses; rank++) {
+    contexts[rank]->close();
+  }
+  for (size_t rank = 0; rank < kNumProcesses; rank++) {
+    contexts[rank]->join();
+  }
+}
+
+TEST(Mesh, UnexpectedPipe) {
+  auto context = makeContext();
+  auto otherContext = makeContext();
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  // Rank 1 waits for a pipe from rank 0, but gets one that didn't introduce
+  // itself.
+  std::future<Mesh> meshFuture = startBootstrap(
+      context, listener, 1, {"uv://127.0.0.1:1", listener->url("uv")}, {});
+  auto pipe = otherContext->connect(listener->url("uv"));
+  Message message;
+  message.metadata = "hello";
+  pipe->write(
+      std::move(message),
+      [](const Error& /* unused */, Message /* unused */) {});
+  EXPECT_THROW(meshFuture.get(), std::runtime_error);
+
+  context->close();
+  otherContext->close();
+  context->join();
+  otherContext->join();
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/tensorpipe.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+std::string kPayloadData = "I'm a payload";
+std::string kTensorData = "And I'm a tensor";
+
+std::shared_ptr<Context> makeContext() {
+  auto context = std::make_shared<Context>();
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+  return context;
+}
+
+Message makeMessage(const std::string& metadata) {
+  Message message;
+  message.metadata = metadata;
+  Message::Payload payload;
+  payload.data = const_cast<char*>(kPayloadData.data());
+  payload.length = kPayloadData.length();
+  message.payloads.push_back(std::move(payload));
+  Message::Tensor tensor{
+      CpuBuffer{const_cast<char*>(kTensorData.data()), kTensorData.length()}};
+  message.tensors.push_back(std::move(tensor));
+  return message;
+}
+
+void writeMessage(Pipe& pipe, const std::string& metadata) {
+  std::promise<void> donePromise;
+  pipe.write(
+      makeMessage(metadata), [&](const Error& error, Message /* unused */) {
+        if (error) {
+          donePromise.set_exception(
+              std::make_exception_ptr(std::runtime_error(error.what())));
+        } else {
+          donePromise.set_value();
+        }
+      });
+  donePromise.get_future().get();
+}
+
+// Return the metadata of the next message, after checking its data.
+std::string readMessage(Pipe& pipe) {
+  std::vector<std::shared_ptr<uint8_t>> buffers;
+  std::promise<Message> messagePromise;
+  pipe.read(
+      [&](Message& message) {
+        Error error = allocateMessageWithHints(message, buffers);
+        EXPECT_FALSE(error) << error.what();
+      },
+      [&](const Error& error, Message message) {
+        if (error) {
+          messagePromise.set_exception(
+              std::make_exception_ptr(std::runtime_error(error.what())));
+        } else {
+          messagePromise.set_value(std::move(message));
+        }
+      });
+  Message message = messagePromise.get_future().get();
+  EXPECT_EQ(message.payloads.size(), 1);
+  EXPECT_EQ(message.tensors.size(), 1);
+  if (message.payloads.size() == 1) {
+    EXPECT_EQ(
+        std::string(
+            static_cast<char*>(message.payloads[0].data),
+            message.payloads[0].length),
+        kPayloadData);
+  }
+  if (message.tensors.size() == 1) {
+    EXPECT_EQ(
+        std::string(
+            static_cast<char*>(message.tensors[0].buffer.cpu.ptr),
+            message.tensors[0].buffer.cpu.length),
+        kTensorData);
+  }
+  return message.metadata;
+}
+
+std::shared_ptr<Pipe> acceptPipe(Listener& listener) {
+  std::promise<std::shared_ptr<Pipe>> pipePromise;
+  listener.accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    if (error) {
+      pipePromise.set_exception(
+          std::make_exception_ptr(std::runtime_error(error.what())));
+    } else {
+      pipePromise.set_value(std::move(pipe));
+    }
+  });
+  return pipePromise.get_future().get();
+}
+
+} // namespace
+
+TEST(Relay, Direct) {
+  auto serverContext = makeContext();
+  auto relayContext = makeContext();
+  auto clientContext = makeContext();
+
+  auto listener = serverContext->listen({"uv://127.0.0.1"});
+  Relay relay(relayContext, {"uv://127.0.0.1"});
+
+  auto clientPipe = connectThroughRelay(
+      *clientContext,
+      relay.url("uv"),
+      /*remoteRelayUrl=*/"",
+      listener->url("uv"));
+  writeMessage(*clientPipe, "ping");
+
+  auto serverPipe = acceptPipe(*listener);
+  EXPECT_EQ(readMessage(*serverPipe), "ping");
+  writeMessage(*serverPipe, "pong");
+  EXPECT_EQ(readMessage(*clientPipe), "pong");
+
+  clientPipe->close();
+  serverPipe->close();
+  relay.close();
+  serverContext->join();
+  relayContext->join();
+  clientContext->join();
+}
+
+TEST(Relay, SharedAcrossNodes) {
+  auto serverContext = makeContext();
+  auto localRelayContext = makeContext();
+  auto remoteRelayContext = makeContext();
+  auto clientContext = makeContext();
+
+  auto listener = serverContext->listen({"uv://127.0.0.1"});
+  Relay localRelay(localRelayContext, {"uv://127.0.0.1"});
+  Relay remoteRelay(remoteRelayContext, {"uv://127.0.0.1"});
+
+  // The streams of both pipes go over the same pipe between the relays, and
+  // each comes out on a pipe of its own on the server.
+  constexpr int kNumPipes = 2;
+  std::vector<std::shared_ptr<Pipe>> clientPipes;
+  std::vector<std::shared_ptr<Pipe>> serverPipes;
+  for (int pipeIdx = 0; pipeIdx < kNumPipes; pipeIdx++) {
+    clientPipes.push_back(connectThroughRelay(
+        *clientContext,
+        localRelay.url("uv"),
+        remoteRelay.url("uv"),
+        listener->url("uv")));
+    writeMessage(*clientPipes.back(), "ping " + std::to_string(pipeIdx));
+    serverPipes.push_back(acceptPipe(*listener));
+    EXPECT_EQ(
+        readMessage(*serverPipes.back()), "ping " + std::to_string(pipeIdx));
+  }
+
+  for (int pipeIdx = 0; pipeIdx < kNumPipes; pipeIdx++) {
+    for (int messageIdx = 0; messageIdx < 3; messageIdx++) {
+      writeMessage(*serverPipes[pipeIdx], "pong " + std::to_string(messageIdx));
+    }
+  }
+  for (int pipeIdx = 0; pipeIdx < kNumPipes; pipeIdx++) {
+    for (int messageIdx = 0; messageIdx < 3; messageIdx++) {
+      EXPECT_EQ(
+          readMessage(*clientPipes[pipeIdx]),
+          "pong " + std::to_string(messageIdx));
+    }
+  }
+
+  for (int pipeIdx = 0; pipeIdx < kNumPipes; pipeIdx++) {
+    clientPipes[pipeIdx]->close();
+    serverPipes[pipeIdx]->close();
+  }
+  localRelay.close();
+  remoteRelay.close();
+  serverContext->join();
+  localRelayContext->join();
+  remoteRelayContext->join();
+  clientContext->join();
+}
+
+TEST(Relay, ClosePropagates) {
+  auto serverContext = makeContext();
+  auto localRelayContext = makeContext();
+  auto remoteRelayContext = makeContext();
+  auto clientContext = makeContext();
+
+  auto listener = serverContext->listen({"uv://127.0.0.1"});
+  Relay localRelay(localRelayContext, {"uv://127.0.0.1"});
+  Relay remoteRelay(remoteRelayContext, {"uv://127.0.0.1"});
+
+  auto clientPipe = connectThroughRelay(
+      *clientContext,
+      localRelay.url("uv"),
+      remoteRelay.url("uv"),
+      listener->url("uv"));
+  writeMessage(*clientPipe, "ping");
+  auto serverPipe = acceptPipe(*listener);
+  EXPECT_EQ(readMessage(*serverPipe), "ping");
+
+  // Closing the pipe on one end fails it on the other, through both relays.
+  clientPipe->close();
+  EXPECT_THROW(readMessage(*serverPipe), std::runtime_error);
+
+  serverPipe->close();
+  localRelay.close();
+  remoteRelay.close();
+  serverContext->join();
+  localRelayContext->join();
+  remoteRelayContext->join();
+  clientContext->join();
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <chrono>
+
+#include <tensorpipe/common/loop_stats.h>
+#include <tensorpipe/core/stats.h>
+#include <tensorpipe/transport/stats.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(DurationHistogram, Empty) {
+  DurationHistogram histogram;
+  EXPECT_EQ(histogram.count(), 0);
+  EXPECT_EQ(histogram.mean(), std::chrono::nanoseconds(0));
+  EXPECT_EQ(histogram.percentile(0.5), std::chrono::nanoseconds(0));
+}
+
+TEST(DurationHistogram, Percentiles) {
+  DurationHistogram histogram;
+  for (int i = 0; i < 99; ++i) {
+    histogram.add(std::chrono::microseconds(3));
+  }
+  histogram.add(std::chrono::milliseconds(5));
+
+  EXPECT_EQ(histogram.count(), 100);
+  EXPECT_EQ(histogram.max(), std::chrono::milliseconds(5));
+  EXPECT_EQ(
+      histogram.sum(),
+      99 * std::chrono::microseconds(3) + std::chrono::milliseconds(5));
+  // The samples of 3us fall in the bucket of [2us, 4us).
+  EXPECT_EQ(histogram.percentile(0.5), std::chrono::microseconds(4));
+  EXPECT_EQ(histogram.percentile(0.99), std::chrono::microseconds(4));
+  // The largest sample caps the upper edge of its bucket.
+  EXPECT_EQ(histogram.percentile(1), std::chrono::milliseconds(5));
+}
+
+TEST(PipeStats, Merge) {
+  PipeStats first;
+  first.writeCallbackInvoked.add(std::chrono::microseconds(10));
+  first.numMessagesWritten = 1;
+  first.payloadBytesWrittenPerTransport["uv"] = 100;
+
+  PipeStats second;
+  second.writeCallbackInvoked.add(std::chrono::microseconds(20));
+  second.numMessagesWritten = 1;
+  second.payloadBytesWrittenPerTransport["uv"] = 50;
+  second.payloadBytesWrittenPerTransport["shm"] = 25;
+
+  first.merge(second);
+  EXPECT_EQ(first.writeCallbackInvoked.count(), 2);
+  EXPECT_EQ(first.writeCallbackInvoked.max(), std::chrono::microseconds(20));
+  EXPECT_EQ(first.numMessagesWritten, 2);
+  EXPECT_EQ(first.payloadBytesWrittenPerTransport["uv"], 150);
+  EXPECT_EQ(first.payloadBytesWrittenPerTransport["shm"], 25);
+}
+
+TEST(LoopStats, Merge) {
+  LoopStats first;
+  first.maxPendingTasks = 3;
+  first.taskRunTime.add(std::chrono::microseconds(10));
+  first.numEpollWaits = 1;
+  first.numEpollEvents = 2;
+  first.maxEpollEventsPerWait = 2;
+
+  LoopStats second;
+  second.maxPendingTasks = 5;
+  second.taskRunTime.add(std::chrono::microseconds(20));
+  second.numEpollWaits = 2;
+  second.numEpollEvents = 2;
+  second.maxEpollEventsPerWait = 1;
+
+  first.merge(second);
+  EXPECT_EQ(first.maxPendingTasks, 5);
+  EXPECT_EQ(first.taskRunTime.count(), 2);
+  EXPECT_EQ(first.taskRunTime.max(), std::chrono::microseconds(20));
+  EXPECT_EQ(first.numEpollWaits, 3);
+  EXPECT_EQ(first.numEpollEvents, 4);
+  EXPECT_EQ(first.maxEpollEventsPerWait, 2);
+}
+
+TEST(TransportStats, CountersForwardToParent) {
+  transport::TransportStatsCounters context;
+  transport::TransportStatsCounters first(&context);
+  transport::TransportStatsCounters second(&context);
+
+  first.recordWrite(10);
+  first.addWriteQueueBytes(10);
+  second.recordRead(20);
+  second.recordRingBufferStall();
+  second.addWriteQueueBytes(5);
+  first.addWriteQueueBytes(-10);
+  first.addQueuePairs(2);
+  second.addQueuePairs(1);
+  first.addQueuePairs(-1);
+
+  const transport::TransportStats firstStats = first.snapshot();
+  EXPECT_EQ(firstStats.numWrites, 1);
+  EXPECT_EQ(firstStats.numBytesWritten, 10);
+  EXPECT_EQ(firstStats.numReads, 0);
+  EXPECT_EQ(firstStats.writeQueueBytes, 0);
+  EXPECT_EQ(firstStats.maxWriteQueueBytes, 10);
+  EXPECT_EQ(firstStats.numQueuePairs, 1);
+
+  const transport::TransportStats contextStats = context.snapshot();
+  EXPECT_EQ(contextStats.numWrites, 1);
+  EXPECT_EQ(contextStats.numBytesWritten, 10);
+  EXPECT_EQ(contextStats.numReads, 1);
+  EXPECT_EQ(contextStats.numBytesRead, 20);
+  EXPECT_EQ(contextStats.numRingBufferStalls, 1);
+  EXPECT_EQ(contextStats.writeQueueBytes, 5);
+  EXPECT_EQ(contextStats.maxWriteQueueBytes, 15);
+  EXPECT_EQ(contextStats.numQueuePairs, 2);
+
+  transport::TransportStats merged = firstStats;
+  merged.merge(contextStats);
+  EXPECT_EQ(merged.numWrites, 2);
+  EXPECT_EQ(merged.writeQueueBytes, 5);
+  EXPECT_EQ(merged.maxWriteQueueBytes, 15);
+  EXPECT_EQ(merged.numQueuePairs, 3);
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+
+#include <tensorpipe/core/tensor_dedup.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(TensorDedupCache, FindAndInsert) {
+  TensorDedupCache cache(/*capacity=*/100, /*holdsData=*/true);
+  EXPECT_EQ(cache.find(10, 1), nullptr);
+
+  std::shared_ptr<TensorDedupCache::Entry> entry = cache.insert(10, 1);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_NE(entry->data, nullptr);
+  EXPECT_EQ(entry->length, 10);
+  EXPECT_FALSE(entry->isReady);
+  EXPECT_EQ(cache.find(10, 1), entry);
+  EXPECT_EQ(cache.numBytes(), 10);
+
+  // The same hash with a different length are different contents.
+  EXPECT_EQ(cache.find(11, 1), nullptr);
+}
+
+TEST(TensorDedupCache, WithoutData) {
+  TensorDedupCache cache(/*capacity=*/100, /*holdsData=*/false);
+  std::shared_ptr<TensorDedupCache::Entry> entry = cache.insert(10, 1);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(entry->data, nullptr);
+  EXPECT_EQ(cache.find(10, 1), entry);
+}
+
+TEST(TensorDedupCache, EvictsLeastRecentlyUsedBytes) {
+  TensorDedupCache cache(/*capacity=*/100, /*holdsData=*/false);
+  cache.insert(40, 1);
+  cache.insert(40, 2);
+  // Using the first one makes the second one the least recently used.
+  EXPECT_NE(cache.find(40, 1), nullptr);
+  std::shared_ptr<TensorDedupCache::Entry> entry = cache.insert(30, 3);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_NE(cache.find(40, 1), nullptr);
+  EXPECT_EQ(cache.find(40, 2), nullptr);
+  EXPECT_NE(cache.find(30, 3), nullptr);
+  EXPECT_EQ(cache.numBytes(), 70);
+
+  // Making room for a large one may take several evictions.
+  cache.insert(100, 4);
+  EXPECT_EQ(cache.find(40, 1), nullptr);
+  EXPECT_EQ(cache.find(30, 3), nullptr);
+  EXPECT_EQ(cache.numBytes(), 100);
+  // The entries that were evicted remain valid for those holding them.
+  EXPECT_EQ(entry->length, 30);
+}
+
+TEST(TensorDedupCache, TooLarge) {
+  TensorDedupCache cache(/*capacity=*/100, /*holdsData=*/true);
+  cache.insert(50, 1);
+  EXPECT_EQ(cache.insert(101, 2), nullptr);
+  // Nothing was evicted for it.
+  EXPECT_NE(cache.find(50, 1), nullptr);
+  EXPECT_EQ(cache.numBytes(), 50);
+}
+
+TEST(TensorDedupCache, Replace) {
+  TensorDedupCache cache(/*capacity=*/100, /*holdsData=*/true);
+  std::shared_ptr<TensorDedupCache::Entry> first = cache.insert(50, 1);
+  std::shared_ptr<TensorDedupCache::Entry> second = cache.insert(50, 1);
+  EXPECT_NE(first, second);
+  EXPECT_EQ(cache.find(50, 1), second);
+  EXPECT_EQ(cache.numBytes(), 50);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include <tensorpipe/core/tensor_handoff.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(TensorHandoff, DepositAndWithdraw) {
+  std::vector<uint8_t> data(16);
+  int numReleases = 0;
+  const uint64_t id = depositHandedOffTensor(
+      nullptr,
+      HandedOffTensor(
+          data.data(), data.size(), [&numReleases]() { ++numReleases; }));
+
+  optional<HandedOffTensor> tensor = withdrawHandedOffTensor(id);
+  ASSERT_TRUE(tensor.has_value());
+  EXPECT_EQ(tensor->ptr(), data.data());
+  EXPECT_EQ(tensor->length(), data.size());
+  EXPECT_EQ(numReleases, 0);
+
+  // It can only be withdrawn once.
+  EXPECT_FALSE(withdrawHandedOffTensor(id).has_value());
+
+  std::function<void()> release = tensor->takeRelease();
+  tensor.reset();
+  EXPECT_EQ(numReleases, 0);
+  release();
+  EXPECT_EQ(numReleases, 1);
+}
+
+TEST(TensorHandoff, ReleaseOnDestruction) {
+  int numReleases = 0;
+  {
+    HandedOffTensor tensor(nullptr, 0, [&numReleases]() { ++numReleases; });
+    HandedOffTensor otherTensor = std::move(tensor);
+  }
+  EXPECT_EQ(numReleases, 1);
+}
+
+TEST(TensorHandoff, WithdrawTensorsOfOwner) {
+  int owner;
+  int otherOwner;
+  int numReleases = 0;
+  auto release = [&numReleases]() { ++numReleases; };
+  const uint64_t id1 =
+      depositHandedOffTensor(&owner, HandedOffTensor(nullptr, 0, release));
+  const uint64_t id2 =
+      depositHandedOffTensor(&owner, HandedOffTensor(nullptr, 0, release));
+  const uint64_t id3 = depositHandedOffTensor(
+      &otherOwner, HandedOffTensor(nullptr, 0, release));
+
+  withdrawHandedOffTensorsOf(&owner);
+  EXPECT_EQ(numReleases, 2);
+  EXPECT_FALSE(withdrawHandedOffTensor(id1).has_value());
+  EXPECT_FALSE(withdrawHandedOffTensor(id2).has_value());
+  EXPECT_TRUE(withdrawHandedOffTensor(id3).has_value());
+  EXPECT_EQ(numReleases, 3);
+}
+
+TEST(TensorHandoff, ProcessIdentifier) {
+  EXPECT_EQ(getProcessIdentifier(), getProcessIdentifier());
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <string>
+
+#include <tensorpipe/core/error.h>
+#include <tensorpipe/core/tuning.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(Tuning, FormatAndParse) {
+  TuningConfig config;
+  config.readAheadWindow = 4;
+  config.multiplexChannelConnections = true;
+  config.inlineTensorThreshold = 4096;
+  config.inlinePayloadThreshold = 1024;
+  config.channelPriorities["basic"] = 0;
+  config.channelPriorities["cma"] = 10;
+  config.shmBufferSize = 16 * 1024 * 1024;
+
+  TuningConfig parsedConfig;
+  Error error = parseTuningConfig(formatTuningConfig(config), parsedConfig);
+  ASSERT_FALSE(error) << error.what();
+  EXPECT_EQ(parsedConfig.readAheadWindow, 4);
+  EXPECT_TRUE(parsedConfig.multiplexChannelConnections);
+  EXPECT_EQ(parsedConfig.inlineTensorThreshold, 4096);
+  EXPECT_EQ(parsedConfig.inlinePayloadThreshold, 1024);
+  EXPECT_EQ(parsedConfig.channelPriorities, config.channelPriorities);
+  EXPECT_EQ(parsedConfig.shmBufferSize, 16 * 1024 * 1024);
+  EXPECT_EQ(parsedConfig.channelPriority("cma", 100), 10);
+  EXPECT_EQ(parsedConfig.channelPriority("xth", 100), 100);
+}
+
+TEST(Tuning, CommentsAndDefaults) {
+  TuningConfig config;
+  Error error = parseTuningConfig(
+      "# Found by benchmark_autotune\n"
+      "\n"
+      "  read_ahead_window   16  \n",
+      config);
+  ASSERT_FALSE(error) << error.what();
+  EXPECT_EQ(config.readAheadWindow, 16);
+  EXPECT_FALSE(config.multiplexChannelConnections);
+  EXPECT_EQ(config.inlineTensorThreshold, 0);
+  EXPECT_TRUE(config.channelPriorities.empty());
+}
+
+TEST(Tuning, Errors) {
+  // The config is left alone when the text is invalid.
+  TuningConfig config;
+  config.readAheadWindow = 4;
+  Error error = parseTuningConfig("read_ahead_window 8\nfoo 1\n", config);
+  ASSERT_TRUE(error);
+  EXPECT_TRUE(error.isOfType<TuningConfigError>()) << error.what();
+  EXPECT_EQ(config.readAheadWindow, 4);
+
+  error = parseTuningConfig("read_ahead_window eight\n", config);
+  EXPECT_TRUE(error.isOfType<TuningConfigError>()) << error.what();
+  error = parseTuningConfig("channel_priority basic 1 2\n", config);
+  EXPECT_TRUE(error.isOfType<TuningConfigError>()) << error.what();
+
+  error = loadTuningConfig("/this/file/does/not/exist", config);
+  EXPECT_TRUE(error.isOfType<SystemError>()) << error.what();
+}
@@ -5,6 +5,7 @@
 # This source code is licensed under the BSD-style license found in the
 # LICENSE file in the root directory of this source tree.
 
+import asyncio
 import threading
 import unittest
 
@@ -82,6 +83,47 @@ class TestTensorpipe(unittest.TestCase):
         # See https://github.com/pybind/pybind11/issues/1446.
         context.join()
 
+    def test_async_read_write(self):
+        context = tp.Context()
+        context.register_transport(0, "tcp", tp.UvTransport())
+        context.register_channel(0, "basic", tp.BasicChannel())
+
+        listener: tp.Listener = context.listen(["tcp://127.0.0.1"])
+        server_pipe_available = threading.Event()
+        server_pipe = None
+
+        def on_connection(pipe: tp.Pipe) -> None:
+            nonlocal server_pipe
+            server_pipe = pipe
+            server_pipe_available.set()
+
+        listener.listen(on_connection)
+        client_pipe: tp.Pipe = context.connect(listener.get_url("tcp"))
+        server_pipe_available.wait()
+
+        # The tensor is given as a memoryview, which is used in place.
+        tensor_data = bytearray(b"World!")
+
+        async def exchange() -> bytearray:
+            payload = tp.OutgoingPayload(b"Hello ", b"a greeting")
+            tensor = tp.OutgoingTensor(memoryview(tensor_data), b"a place")
+            message = tp.OutgoingMessage(b"metadata", [payload], [tensor])
+            write_future = server_pipe.write_async(message)
+
+            incoming = await client_pipe.read_descriptor_async()
+            self.assertEqual(incoming.metadata, bytearray(b"metadata"))
+            received = bytearray(incoming.payloads[0].length)
+            incoming.payloads[0].buffer = received
+            received_tensor = bytearray(incoming.tensors[0].length)
+            incoming.tensors[0].buffer = memoryview(received_tensor)
+            await client_pipe.read_async(incoming)
+            await write_future
+            return received + received_tensor
+
+        self.assertEqual(asyncio.run(exchange()), bytearray(b"Hello World!"))
+
+        context.join()
+
 
 if __name__ == "__main__":
     unittest.main()
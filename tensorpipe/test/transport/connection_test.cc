@@ -9,6 +9,8 @@
 #include <tensorpipe/test/transport/transport_test.h>
 
 #include <array>
+#include <string>
+#include <vector>
 
 #include <nop/serializer.h>
 #include <nop/structure.h>
@@ -125,6 +127,161 @@ TEST_P(TransportTest, Connection_NopWrite) {
       });
 }
 
+TEST_P(TransportTest, Connection_NopAndBuffersWrite) {
+  constexpr size_t kSize = 0x42;
+  constexpr int numBuffers = 4;
+  std::string buffers[numBuffers];
+
+  for (int i = 0; i < numBuffers; i++) {
+    buffers[i] = std::string(1024 * (i + 1), static_cast<char>(i));
+  }
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        auto holder = std::make_shared<NopHolder<MyNopType>>();
+        MyNopType& object = holder->getObject();
+        conn->read(*holder, [&, conn, holder](const Error& error) {
+          ASSERT_FALSE(error) << error.what();
+          ASSERT_EQ(object.myIntField, kSize);
+        });
+        for (int i = 0; i < numBuffers; i++) {
+          doRead(
+              conn,
+              [&, conn, i](const Error& error, const void* data, size_t len) {
+                ASSERT_FALSE(error) << error.what();
+                ASSERT_EQ(
+                    std::string(static_cast<const char*>(data), len),
+                    buffers[i]);
+                if (i == numBuffers - 1) {
+                  peers_->done(PeerGroup::kServer);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        auto holder = std::make_shared<NopHolder<MyNopType>>();
+        MyNopType& object = holder->getObject();
+        object.myIntField = kSize;
+        std::vector<Connection::WriteBuffer> writeBuffers;
+        for (int i = 0; i < numBuffers; i++) {
+          writeBuffers.push_back({buffers[i].c_str(), buffers[i].length()});
+        }
+        conn->write(
+            *holder,
+            std::move(writeBuffers),
+            [&, conn, holder](const Error& error) {
+              ASSERT_FALSE(error) << error.what();
+              peers_->done(PeerGroup::kClient);
+            });
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
+TEST_P(TransportTest, Connection_BatchedWrite) {
+  constexpr int kNumSegments = 3;
+  std::array<std::vector<std::string>, kNumSegments> buffers;
+
+  // The segments have no buffers, then one, then two.
+  for (int i = 0; i < kNumSegments; i++) {
+    for (int j = 0; j < i; j++) {
+      buffers[i].push_back(std::string(1024 * (j + 1), static_cast<char>(i)));
+    }
+  }
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        for (int i = 0; i < kNumSegments; i++) {
+          auto holder = std::make_shared<NopHolder<MyNopType>>();
+          MyNopType& object = holder->getObject();
+          conn->read(*holder, [&, conn, holder, i](const Error& error) {
+            ASSERT_FALSE(error) << error.what();
+            ASSERT_EQ(object.myIntField, i);
+          });
+          for (int j = 0; j < i; j++) {
+            doRead(
+                conn,
+                [&, conn, i, j](
+                    const Error& error, const void* data, size_t len) {
+                  ASSERT_FALSE(error) << error.what();
+                  ASSERT_EQ(
+                      std::string(static_cast<const char*>(data), len),
+                      buffers[i][j]);
+                  if (i == kNumSegments - 1 && j == i - 1) {
+                    peers_->done(PeerGroup::kServer);
+                  }
+                });
+          }
+        }
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        auto holders =
+            std::make_shared<std::array<NopHolder<MyNopType>, kNumSegments>>();
+        std::vector<Connection::WriteSegment> segments;
+        for (int i = 0; i < kNumSegments; i++) {
+          (*holders)[i].getObject().myIntField = i;
+          std::vector<Connection::WriteBuffer> writeBuffers;
+          for (const std::string& buffer : buffers[i]) {
+            writeBuffers.push_back({buffer.c_str(), buffer.length()});
+          }
+          segments.push_back({&(*holders)[i], std::move(writeBuffers)});
+        }
+        conn->write(
+            std::move(segments), [&, conn, holders](const Error& error) {
+              ASSERT_FALSE(error) << error.what();
+              peers_->done(PeerGroup::kClient);
+            });
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
+TEST_P(TransportTest, Connection_TransportStats) {
+  const std::string buffers[] = {std::string(1000, 'a'), std::string(24, 'b')};
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        for (int i = 0; i < 2; i++) {
+          doRead(
+              conn,
+              [&, conn, i](
+                  const Error& error, const void* /* unused */, size_t len) {
+                ASSERT_FALSE(error) << error.what();
+                ASSERT_EQ(len, buffers[i].length());
+                if (i == 1) {
+                  peers_->done(PeerGroup::kServer);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kServer);
+        const TransportStats stats = conn->getTransportStats();
+        EXPECT_EQ(stats.numReads, 2);
+        EXPECT_EQ(stats.numBytesRead, 1024);
+        EXPECT_EQ(stats.numWrites, 0);
+        EXPECT_EQ(stats.numBytesWritten, 0);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        for (int i = 0; i < 2; i++) {
+          doWrite(
+              conn,
+              buffers[i].c_str(),
+              buffers[i].length(),
+              [&, conn, i](const Error& error) {
+                ASSERT_FALSE(error) << error.what();
+                if (i == 1) {
+                  peers_->done(PeerGroup::kClient);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kClient);
+        const TransportStats stats = conn->getTransportStats();
+        EXPECT_EQ(stats.numWrites, 2);
+        EXPECT_EQ(stats.numBytesWritten, 1024);
+        EXPECT_EQ(stats.numReads, 0);
+        EXPECT_EQ(stats.numBytesRead, 0);
+      });
+}
+
 TEST_P(TransportTest, Connection_QueueWritesBeforeReads) {
   constexpr int kMsgSize = 16 * 1024;
   constexpr int numMsg = 10;
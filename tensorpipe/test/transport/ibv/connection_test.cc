@@ -20,9 +20,13 @@ namespace {
 class IbvTransportTest : public TransportTest {};
 
 IbvTransportTestHelper helper;
+IbvTransportTestHelper multiLaneHelper(/*numLanes=*/4);
+IbvTransportTestHelper smallBufferHelper(
+    /*numLanes=*/1,
+    /*bufferSize=*/64 * 1024);
 
-// This value is defined in tensorpipe/transport/ibv/connection.h
-static constexpr auto kBufferSize = 2 * 1024 * 1024;
+// The size of the inboxes of the default helpers.
+static constexpr auto kBufferSize = ibv::kDefaultBufferSize;
 
 } // namespace
 
@@ -144,7 +148,12 @@ struct MyNopType {
 
 TEST_P(IbvTransportTest, NopWriteWrapAround) {
   constexpr int numMsg = 2;
-  constexpr size_t kSize = (3 * kBufferSize) / 4;
+  // The objects must fit in the buffers of the connection.
+  const size_t kSize =
+      (3 *
+       static_cast<IbvTransportTestHelper*>(GetParam())
+           ->connectionBufferSize()) /
+      4;
 
   testConnection(
       [&](std::shared_ptr<Connection> conn) {
@@ -176,3 +185,16 @@ TEST_P(IbvTransportTest, NopWriteWrapAround) {
 }
 
 INSTANTIATE_TEST_CASE_P(Ibv, IbvTransportTest, ::testing::Values(&helper));
+
+// Striping across multiple lanes must preserve the order of the data, also
+// when it wraps around the ringbuffer or when writes are queued up.
+INSTANTIATE_TEST_CASE_P(
+    IbvMultiLane,
+    IbvTransportTest,
+    ::testing::Values(&multiLaneHelper));
+
+// With smaller inboxes the same transfers wrap around them many more times.
+INSTANTIATE_TEST_CASE_P(
+    IbvSmallBuffer,
+    IbvTransportTest,
+    ::testing::Values(&smallBufferHelper));
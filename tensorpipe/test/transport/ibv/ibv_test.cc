@@ -11,7 +11,29 @@
 namespace {
 
 IbvTransportTestHelper helper;
+IbvTransportTestHelper multiReactorHelper(
+    /*numLanes=*/1,
+    /*bufferSize=*/tensorpipe::transport::ibv::kDefaultBufferSize,
+    /*numReactors=*/3);
+IbvTransportTestHelper idleHelper(
+    /*numLanes=*/1,
+    /*bufferSize=*/tensorpipe::transport::ibv::kDefaultBufferSize,
+    /*numReactors=*/1,
+    /*idleTimeout=*/std::chrono::milliseconds(1));
 
 } // namespace
 
 INSTANTIATE_TEST_CASE_P(Ibv, TransportTest, ::testing::Values(&helper));
+
+// The connections, opened or accepted, are spread over the reactors.
+INSTANTIATE_TEST_CASE_P(
+    IbvMultiReactor,
+    TransportTest,
+    ::testing::Values(&multiReactorHelper));
+
+// The inboxes are reclaimed whenever the tests pause, and must be registered
+// again for the transfers that follow.
+INSTANTIATE_TEST_CASE_P(
+    IbvIdleInboxes,
+    TransportTest,
+    ::testing::Values(&idleHelper));
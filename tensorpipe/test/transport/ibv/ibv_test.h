@@ -8,18 +8,48 @@
 
 #pragma once
 
+#include <chrono>
+
 #include <tensorpipe/test/transport/transport_test.h>
 #include <tensorpipe/transport/ibv/context.h>
 
 class IbvTransportTestHelper : public TransportTestHelper {
+ public:
+  explicit IbvTransportTestHelper(
+      size_t numLanes = 1,
+      size_t bufferSize = tensorpipe::transport::ibv::kDefaultBufferSize,
+      size_t numReactors = 1,
+      std::chrono::milliseconds idleTimeout = std::chrono::milliseconds(0))
+      : numLanes_(numLanes),
+        bufferSize_(bufferSize),
+        numReactors_(numReactors),
+        idleTimeout_(idleTimeout) {}
+
  protected:
   std::shared_ptr<tensorpipe::transport::Context> getContextInternal()
       override {
-    return std::make_shared<tensorpipe::transport::ibv::Context>();
+    return std::make_shared<tensorpipe::transport::ibv::Context>(
+        tensorpipe::transport::ibv::IbvOptions()
+            .numLanes(numLanes_)
+            .bufferSize(bufferSize_)
+            .numReactors(numReactors_)
+            .idleTimeout(idleTimeout_));
   }
 
  public:
   std::string defaultAddr() override {
     return "127.0.0.1";
   }
+
+  // The size of the inboxes of the connections, which bounds the size of the
+  // objects they can transfer.
+  size_t connectionBufferSize() const {
+    return bufferSize_;
+  }
+
+ private:
+  const size_t numLanes_;
+  const size_t bufferSize_;
+  const size_t numReactors_;
+  const std::chrono::milliseconds idleTimeout_;
 };
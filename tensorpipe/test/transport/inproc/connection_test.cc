@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/test/transport/inproc/inproc_test.h>
+
+#include <future>
+#include <string>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::transport;
+
+namespace {
+
+class InProcTransportTest : public TransportTest {};
+
+InProcTransportTestHelper helper;
+
+} // namespace
+
+TEST_P(InProcTransportTest, WritesDoneBeforeReads) {
+  // The writes that fit in the buffer of the reader are done before it reads
+  // them, hence the writer can wait for them before telling it to start.
+  constexpr int numMsg = 100;
+  constexpr size_t numBytes = inproc::kMaxBytesBuffered / numMsg;
+  const std::string kReady = "ready";
+  std::string msg(numBytes, 0x42);
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        EXPECT_EQ(kReady, peers_->recv(PeerGroup::kServer));
+
+        for (int i = 0; i < numMsg; ++i) {
+          doRead(
+              conn,
+              [&, conn, i](const Error& error, const void* ptr, size_t len) {
+                ASSERT_FALSE(error) << error.what();
+                ASSERT_EQ(len, numBytes);
+                ASSERT_EQ(std::string(static_cast<const char*>(ptr), len), msg);
+                if (i == numMsg - 1) {
+                  peers_->done(PeerGroup::kServer);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        for (int i = 0; i < numMsg; ++i) {
+          doWrite(
+              conn,
+              msg.c_str(),
+              msg.length(),
+              [&, conn, i](const Error& error) {
+                ASSERT_FALSE(error) << error.what();
+                if (i == numMsg - 1) {
+                  peers_->send(PeerGroup::kServer, kReady);
+                  peers_->done(PeerGroup::kClient);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
+TEST_P(InProcTransportTest, ConnectWithoutListener) {
+  auto ctx = GetParam()->getContext();
+  auto conn = ctx->connect(GetParam()->defaultAddr());
+  std::promise<Error> readProm;
+  conn->read([&](const Error& error, const void* /* unused */, size_t len) {
+    EXPECT_EQ(len, 0);
+    readProm.set_value(error);
+  });
+  Error error = readProm.get_future().get();
+  ASSERT_TRUE(error);
+  EXPECT_TRUE(error.isOfType<SystemError>()) << error.what();
+  ctx->join();
+}
+
+TEST_P(InProcTransportTest, ListenTwiceOnSameAddress) {
+  auto ctx = GetParam()->getContext();
+  auto firstListener = ctx->listen(GetParam()->defaultAddr());
+  auto secondListener = ctx->listen(GetParam()->defaultAddr());
+  std::promise<Error> acceptProm;
+  secondListener->accept(
+      [&](const Error& error, std::shared_ptr<Connection> /* unused */) {
+        acceptProm.set_value(error);
+      });
+  Error error = acceptProm.get_future().get();
+  ASSERT_TRUE(error);
+  EXPECT_TRUE(error.isOfType<SystemError>()) << error.what();
+  EXPECT_EQ(firstListener->addr(), GetParam()->defaultAddr());
+  ctx->join();
+}
+
+INSTANTIATE_TEST_CASE_P(
+    InProc,
+    InProcTransportTest,
+    ::testing::Values(&helper));
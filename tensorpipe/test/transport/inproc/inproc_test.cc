@@ -0,0 +1,17 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/test/transport/inproc/inproc_test.h>
+
+namespace {
+
+InProcTransportTestHelper helper;
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(InProc, TransportTest, ::testing::Values(&helper));
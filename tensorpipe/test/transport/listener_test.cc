@@ -118,3 +118,30 @@ TEST_P(TransportTest, Listener_IncomingConnectionsAreQueued) {
 
   context->join();
 }
+
+TEST_P(TransportTest, Listener_PendingAcceptsFailOnClose) {
+  auto context = GetParam()->getContext();
+  auto addr = GetParam()->defaultAddr();
+
+  auto acceptWithPromise = [](Listener& listener) {
+    auto promise = std::make_shared<std::promise<Error>>();
+    listener.accept(
+        [promise](const Error& error, std::shared_ptr<Connection> /*unused*/) {
+          promise->set_value(error);
+        });
+    return promise->get_future();
+  };
+
+  // Both closing the listener and destroying it fail its accepts.
+  auto closedListener = context->listen(addr);
+  std::future<Error> closedFuture = acceptWithPromise(*closedListener);
+  closedListener->close();
+  EXPECT_TRUE(closedFuture.get());
+
+  auto destroyedListener = context->listen(addr);
+  std::future<Error> destroyedFuture = acceptWithPromise(*destroyedListener);
+  destroyedListener.reset();
+  EXPECT_TRUE(destroyedFuture.get());
+
+  context->join();
+}
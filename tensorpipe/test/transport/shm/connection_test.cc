@@ -8,6 +8,15 @@
 
 #include <tensorpipe/test/transport/shm/shm_test.h>
 
+#include <unistd.h>
+
+#include <chrono>
+#include <future>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <gtest/gtest.h>
 #include <nop/serializer.h>
 #include <nop/structure.h>
@@ -20,9 +29,13 @@ namespace {
 class ShmTransportTest : public TransportTest {};
 
 SHMTransportTestHelper helper;
+SHMTransportTestHelper smallBufferHelper(64 * 1024);
+SHMTransportTestHelper sharedInboxesHelper(
+    shm::kDefaultBufferSize,
+    /*shareInboxes=*/true);
 
-// This value is defined in tensorpipe/transport/shm/connection.h
-static constexpr auto kBufferSize = 2 * 1024 * 1024;
+// The size of the inboxes of the default helper.
+static constexpr auto kBufferSize = shm::kDefaultBufferSize;
 
 } // namespace
 
@@ -144,7 +157,12 @@ struct MyNopType {
 
 TEST_P(ShmTransportTest, NopWriteWrapAround) {
   constexpr int numMsg = 2;
-  constexpr size_t kSize = (3 * kBufferSize) / 4;
+  // The objects must fit in the buffers of the connection.
+  const size_t kSize =
+      (3 *
+       static_cast<SHMTransportTestHelper*>(GetParam())
+           ->connectionBufferSize()) /
+      4;
 
   testConnection(
       [&](std::shared_ptr<Connection> conn) {
@@ -176,3 +194,152 @@ TEST_P(ShmTransportTest, NopWriteWrapAround) {
 }
 
 INSTANTIATE_TEST_CASE_P(Shm, ShmTransportTest, ::testing::Values(&helper));
+
+// With smaller inboxes the same transfers wrap around them many more times.
+INSTANTIATE_TEST_CASE_P(
+    ShmSmallBuffer,
+    ShmTransportTest,
+    ::testing::Values(&smallBufferHelper));
+
+// The connections carry their data through their own small buffers and the
+// shared inbox, which makes the larger transfers take many round trips.
+INSTANTIATE_TEST_CASE_P(
+    ShmSharedInboxes,
+    ShmTransportTest,
+    ::testing::Values(&sharedInboxesHelper));
+
+// A connection whose data isn't being read mustn't hold up the other ones that
+// share its inbox.
+TEST(ShmSharedInboxes, ConnectionsDontBlockEachOther) {
+  // This is larger than the private buffers of the connections.
+  constexpr size_t kLargeSize = 1024 * 1024;
+  const std::string largeMsg(kLargeSize, 'L');
+  const std::string smallMsg("small");
+
+  auto serverCtx = std::make_shared<shm::Context>(
+      shm::ShmOptions().shareInboxes(true));
+  auto clientCtx = std::make_shared<shm::Context>(
+      shm::ShmOptions().shareInboxes(true));
+
+  std::ostringstream addr;
+  addr << "tensorpipe_test_shared_inboxes_" << getpid();
+  auto listener = serverCtx->listen(addr.str());
+
+  // Keep the connections open until all the data has been read, as closing
+  // them could cut the transfers short.
+  std::vector<std::shared_ptr<Connection>> clientConns;
+  std::vector<std::shared_ptr<Connection>> serverConns;
+  for (int connIdx = 0; connIdx < 2; ++connIdx) {
+    std::promise<std::shared_ptr<Connection>> connProm;
+    listener->accept([&](const Error& error, std::shared_ptr<Connection> conn) {
+      ASSERT_FALSE(error) << error.what();
+      connProm.set_value(std::move(conn));
+    });
+    auto clientConn = clientCtx->connect(listener->addr());
+    const std::string& msg = connIdx == 0 ? largeMsg : smallMsg;
+    clientConn->write(
+        msg.data(), msg.size(), [](const Error& error) {
+          ASSERT_FALSE(error) << error.what();
+        });
+    clientConns.push_back(std::move(clientConn));
+    serverConns.push_back(connProm.get_future().get());
+  }
+
+  // Only read from the second connection first.
+  std::promise<std::string> smallProm;
+  serverConns[1]->read(
+      [&](const Error& error, const void* ptr, size_t length) {
+        ASSERT_FALSE(error) << error.what();
+        smallProm.set_value(
+            std::string(static_cast<const char*>(ptr), length));
+      });
+  EXPECT_EQ(smallProm.get_future().get(), smallMsg);
+
+  std::promise<std::string> largeProm;
+  serverConns[0]->read(
+      [&](const Error& error, const void* ptr, size_t length) {
+        ASSERT_FALSE(error) << error.what();
+        largeProm.set_value(
+            std::string(static_cast<const char*>(ptr), length));
+      });
+  EXPECT_EQ(largeProm.get_future().get(), largeMsg);
+
+  serverCtx->join();
+  clientCtx->join();
+}
+
+namespace {
+
+// Wait for the context to have reclaimed at least that many inboxes.
+void waitForReclaims(shm::Context& ctx, uint64_t numReclaims) {
+  for (int iter = 0; iter < 500; ++iter) {
+    if (ctx.getTransportStats().numRingBufferReclaims >= numReclaims) {
+      return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  FAIL() << "The inboxes weren't reclaimed";
+}
+
+// Write the message on one connection and read it from the other.
+void transfer(
+    Connection& writer,
+    Connection& reader,
+    const std::string& msg) {
+  writer.write(msg.data(), msg.size(), [](const Error& error) {
+    ASSERT_FALSE(error) << error.what();
+  });
+  std::promise<std::string> prom;
+  reader.read([&](const Error& error, const void* ptr, size_t length) {
+    ASSERT_FALSE(error) << error.what();
+    prom.set_value(std::string(static_cast<const char*>(ptr), length));
+  });
+  EXPECT_EQ(prom.get_future().get(), msg);
+}
+
+} // namespace
+
+// The inboxes of idle connections are given back, and then allocated again
+// when there's something to write into them, without losing any data.
+TEST(ShmIdleInboxes, ReclaimAndReacquire) {
+  constexpr std::chrono::milliseconds kIdleTimeout{20};
+  const std::string msg("hello");
+
+  auto serverCtx = std::make_shared<shm::Context>(
+      shm::ShmOptions().idleTimeout(kIdleTimeout));
+  auto clientCtx = std::make_shared<shm::Context>(
+      shm::ShmOptions().idleTimeout(kIdleTimeout));
+
+  std::ostringstream addr;
+  addr << "tensorpipe_test_idle_inboxes_" << getpid();
+  auto listener = serverCtx->listen(addr.str());
+  std::promise<std::shared_ptr<Connection>> connProm;
+  listener->accept([&](const Error& error, std::shared_ptr<Connection> conn) {
+    ASSERT_FALSE(error) << error.what();
+    connProm.set_value(std::move(conn));
+  });
+  auto clientConn = clientCtx->connect(listener->addr());
+  auto serverConn = connProm.get_future().get();
+
+  for (uint64_t round = 1; round <= 2; ++round) {
+    transfer(*clientConn, *serverConn, msg);
+    transfer(*serverConn, *clientConn, msg);
+    waitForReclaims(*serverCtx, round);
+    waitForReclaims(*clientCtx, round);
+  }
+  // A read that waits on a reclaimed inbox gets the data of the write that has
+  // the inbox reacquired.
+  std::promise<std::string> prom;
+  serverConn->read([&](const Error& error, const void* ptr, size_t length) {
+    ASSERT_FALSE(error) << error.what();
+    prom.set_value(std::string(static_cast<const char*>(ptr), length));
+  });
+  std::this_thread::sleep_for(kIdleTimeout);
+  clientConn->write(msg.data(), msg.size(), [](const Error& error) {
+    ASSERT_FALSE(error) << error.what();
+  });
+  EXPECT_EQ(prom.get_future().get(), msg);
+
+  serverCtx->join();
+  clientCtx->join();
+}
@@ -9,9 +9,13 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <thread>
+
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/queue.h>
 #include <tensorpipe/common/socket.h>
+#include <tensorpipe/transport/shm/context.h>
 #include <tensorpipe/transport/shm/reactor.h>
 
 #include <gtest/gtest.h>
@@ -54,7 +58,7 @@ TEST(ShmReactor, Basic) {
   run(
       [](int fd) {
         tensorpipe::Queue<int> queue;
-        auto reactor = std::make_shared<Reactor>();
+        auto reactor = std::make_shared<Reactor>(kDefaultSpinDuration);
         auto token1 = reactor->add([&] { queue.push(1); });
         auto token2 = reactor->add([&] { queue.push(2); });
 
@@ -95,9 +99,55 @@ TEST(ShmReactor, Basic) {
       });
 }
 
+TEST(ShmReactor, WakeUpFromSleep) {
+  run(
+      [](int fd) {
+        tensorpipe::Queue<int> queue;
+        // Have the reactor go to sleep as soon as it's idle.
+        auto reactor = std::make_shared<Reactor>(std::chrono::microseconds(0));
+        auto token = reactor->add([&] { queue.push(1); });
+
+        {
+          auto socket = Socket(fd);
+          auto fds = reactor->fds();
+          auto error = socket.sendPayloadAndFds(
+              token, token, std::get<0>(fds), std::get<1>(fds));
+          ASSERT_FALSE(error) << error.what();
+        }
+
+        // The trigger must wake up the reactor well before its sleep expires.
+        auto start = std::chrono::steady_clock::now();
+        ASSERT_EQ(queue.pop(), 1);
+        EXPECT_LT(
+            std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(500));
+
+        reactor->remove(token);
+      },
+      [](int fd) {
+        Reactor::TToken token;
+        Reactor::TToken unusedToken;
+        Fd header;
+        Fd data;
+
+        {
+          auto socket = Socket(fd);
+          auto error =
+              socket.recvPayloadAndFds(token, unusedToken, header, data);
+          ASSERT_FALSE(error) << error.what();
+        }
+
+        // Give the reactor the time to fall asleep.
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        Reactor::Trigger trigger(std::move(header), std::move(data));
+        trigger.run(token);
+      });
+}
+
 TEST(ShmReactor, TokenReuse) {
   tensorpipe::Queue<int> queue(3);
-  auto reactor = std::make_shared<Reactor>();
+  auto reactor = std::make_shared<Reactor>(kDefaultSpinDuration);
   auto t1 = reactor->add([&] { queue.push(1); });
   auto t2 = reactor->add([&] { queue.push(2); });
   auto t3 = reactor->add([&] { queue.push(3); });
@@ -11,7 +11,26 @@
 namespace {
 
 SHMTransportTestHelper helper;
+SHMTransportTestHelper sharedInboxesHelper(
+    tensorpipe::transport::shm::kDefaultBufferSize,
+    /*shareInboxes=*/true);
+SHMTransportTestHelper idleHelper(
+    tensorpipe::transport::shm::kDefaultBufferSize,
+    /*shareInboxes=*/false,
+    /*idleTimeout=*/std::chrono::milliseconds(1));
 
 } // namespace
 
 INSTANTIATE_TEST_CASE_P(Shm, TransportTest, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    ShmSharedInboxes,
+    TransportTest,
+    ::testing::Values(&sharedInboxesHelper));
+
+// The inboxes are reclaimed whenever the tests pause, and must be reacquired
+// for the transfers that follow.
+INSTANTIATE_TEST_CASE_P(
+    ShmIdleInboxes,
+    TransportTest,
+    ::testing::Values(&idleHelper));
@@ -8,16 +8,41 @@
 
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <sstream>
 
 #include <tensorpipe/test/transport/transport_test.h>
 #include <tensorpipe/transport/shm/context.h>
 
 class SHMTransportTestHelper : public TransportTestHelper {
+ public:
+  explicit SHMTransportTestHelper(
+      size_t bufferSize = tensorpipe::transport::shm::kDefaultBufferSize,
+      bool shareInboxes = false,
+      std::chrono::milliseconds idleTimeout = std::chrono::milliseconds(0))
+      : bufferSize_(bufferSize),
+        shareInboxes_(shareInboxes),
+        idleTimeout_(idleTimeout) {}
+
+  // The size of the ringbuffers that a connection reads from and writes into,
+  // which bounds the size of the objects it can transfer.
+  size_t connectionBufferSize() const {
+    return shareInboxes_
+        ? std::min(
+              bufferSize_,
+              tensorpipe::transport::shm::kSharedInboxChannelBufferSize)
+        : bufferSize_;
+  }
+
  protected:
   std::shared_ptr<tensorpipe::transport::Context> getContextInternal()
       override {
-    return std::make_shared<tensorpipe::transport::shm::Context>();
+    return std::make_shared<tensorpipe::transport::shm::Context>(
+        tensorpipe::transport::shm::ShmOptions()
+            .bufferSize(bufferSize_)
+            .shareInboxes(shareInboxes_)
+            .idleTimeout(idleTimeout_));
   }
 
  public:
@@ -29,4 +54,9 @@ class SHMTransportTestHelper : public TransportTestHelper {
     ss << "tensorpipe_test_" << testInfo->name() << "_" << getpid();
     return ss.str();
   }
+
+ private:
+  const size_t bufferSize_;
+  const bool shareInboxes_;
+  const std::chrono::milliseconds idleTimeout_;
 };
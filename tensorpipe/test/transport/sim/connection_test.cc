@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/test/transport/sim/sim_test.h>
+
+#include <chrono>
+#include <future>
+#include <string>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::transport;
+
+namespace {
+
+class SimTransportTest : public TransportTest {};
+
+// A link slow enough for its delays to dwarf those of the inner transport and
+// of the scheduling of the threads, which only make the writes and the reads
+// take longer.
+constexpr uint64_t kBytesPerSecond = 100 * 1000 * 1000;
+constexpr std::chrono::milliseconds kLatency{20};
+constexpr size_t kNumBytes = 1000 * 1000;
+constexpr std::chrono::milliseconds kTransmissionTime{10};
+
+sim::LinkOptions makeLinkOptions() {
+  sim::LinkOptions linkOptions;
+  linkOptions.bytesPerSecond = kBytesPerSecond;
+  linkOptions.latency = kLatency;
+  return linkOptions;
+}
+
+SimTransportTestHelper helper(makeLinkOptions());
+
+} // namespace
+
+TEST_P(SimTransportTest, WritesAndReadsAreDelayed) {
+  const std::string msg(kNumBytes, 0x42);
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        std::promise<std::chrono::steady_clock::time_point> readProm;
+        const auto startTime = std::chrono::steady_clock::now();
+        peers_->send(PeerGroup::kClient, "ready");
+        doRead(
+            conn,
+            [&, conn](const Error& error, const void* ptr, size_t len) {
+              ASSERT_FALSE(error) << error.what();
+              ASSERT_EQ(std::string(static_cast<const char*>(ptr), len), msg);
+              readProm.set_value(std::chrono::steady_clock::now());
+            });
+        EXPECT_GE(
+            readProm.get_future().get() - startTime,
+            kTransmissionTime + kLatency);
+        peers_->done(PeerGroup::kServer);
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        EXPECT_EQ(peers_->recv(PeerGroup::kClient), "ready");
+        std::promise<std::chrono::steady_clock::time_point> writeProm;
+        const auto startTime = std::chrono::steady_clock::now();
+        doWrite(conn, msg.c_str(), msg.length(), [&, conn](const Error& error) {
+          ASSERT_FALSE(error) << error.what();
+          writeProm.set_value(std::chrono::steady_clock::now());
+        });
+        const auto doneTime = writeProm.get_future().get();
+        EXPECT_GE(doneTime - startTime, kTransmissionTime);
+        peers_->done(PeerGroup::kClient);
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
+TEST_P(SimTransportTest, ReadsBeforeErrorAreDelivered) {
+  // The writes still in flight when the writer goes away still arrive.
+  const std::string msg = "in flight";
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        std::promise<void> readProm;
+        std::promise<Error> errorProm;
+        doRead(
+            conn, [&, conn](const Error& error, const void* ptr, size_t len) {
+              ASSERT_FALSE(error) << error.what();
+              EXPECT_EQ(std::string(static_cast<const char*>(ptr), len), msg);
+              readProm.set_value();
+            });
+        doRead(
+            conn,
+            [&, conn](
+                const Error& error,
+                const void* /* unused */,
+                size_t /* unused */) { errorProm.set_value(error); });
+        peers_->send(PeerGroup::kClient, "ready");
+        readProm.get_future().get();
+        EXPECT_TRUE(errorProm.get_future().get());
+        peers_->done(PeerGroup::kServer);
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        EXPECT_EQ(peers_->recv(PeerGroup::kClient), "ready");
+        std::promise<void> writeProm;
+        doWrite(conn, msg.c_str(), msg.length(), [&, conn](const Error& error) {
+          ASSERT_FALSE(error) << error.what();
+          writeProm.set_value();
+        });
+        writeProm.get_future().get();
+        conn->close();
+        peers_->done(PeerGroup::kClient);
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
+INSTANTIATE_TEST_CASE_P(Sim, SimTransportTest, ::testing::Values(&helper));
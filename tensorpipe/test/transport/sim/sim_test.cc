@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/test/transport/sim/sim_test.h>
+
+namespace {
+
+tensorpipe::transport::sim::LinkOptions makeLinkOptions() {
+  tensorpipe::transport::sim::LinkOptions linkOptions;
+  linkOptions.bytesPerSecond = 10ull * 1000 * 1000 * 1000;
+  linkOptions.latency = std::chrono::microseconds(20);
+  linkOptions.jitter = std::chrono::microseconds(10);
+  return linkOptions;
+}
+
+SimTransportTestHelper helper(makeLinkOptions());
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(Sim, TransportTest, ::testing::Values(&helper));
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/test/transport/uds/uds_test.h>
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::transport;
+
+namespace {
+
+class UDSTransportTest : public TransportTest {};
+
+UDSTransportTestHelper helper;
+UDSTransportTestHelper inlineHelper(
+    /*memfdThreshold=*/std::numeric_limits<size_t>::max());
+
+// The threshold of the default helper.
+static constexpr auto kMemfdThreshold = uds::kDefaultMemfdThreshold;
+
+} // namespace
+
+TEST_P(UDSTransportTest, MixedSizes) {
+  // The small payloads go through the socket and the large ones through memfds
+  // (unless they're disabled), which must keep the data in order.
+  constexpr int numMsg = 20;
+  auto msgSize = [](int i) -> size_t {
+    return i % 2 == 0 ? 100 + i : kMemfdThreshold + i;
+  };
+  std::vector<std::string> srcBufs;
+  for (int i = 0; i < numMsg; ++i) {
+    srcBufs.emplace_back(msgSize(i), static_cast<char>('A' + i));
+  }
+  std::vector<std::unique_ptr<char[]>> dstBufs;
+  for (int i = 0; i < numMsg; ++i) {
+    dstBufs.push_back(std::make_unique<char[]>(msgSize(i)));
+  }
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        for (int i = 0; i < numMsg; ++i) {
+          doRead(
+              conn,
+              dstBufs[i].get(),
+              msgSize(i),
+              [&, conn, i](const Error& error, const void* ptr, size_t len) {
+                ASSERT_FALSE(error) << error.what();
+                ASSERT_EQ(len, msgSize(i));
+                ASSERT_EQ(ptr, dstBufs[i].get());
+                for (size_t j = 0; j < len; ++j) {
+                  ASSERT_EQ(dstBufs[i][j], srcBufs[i][j]);
+                }
+                if (i == numMsg - 1) {
+                  peers_->done(PeerGroup::kServer);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        for (int i = 0; i < numMsg; ++i) {
+          doWrite(
+              conn,
+              srcBufs[i].c_str(),
+              srcBufs[i].length(),
+              [&, conn, i](const Error& error) {
+                ASSERT_FALSE(error) << error.what();
+                if (i == numMsg - 1) {
+                  peers_->done(PeerGroup::kClient);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
+TEST_P(UDSTransportTest, LargeImplicitRead) {
+  // The reads without a destination get a buffer of the right size, into which
+  // the payload is read from the memfd.
+  constexpr int numMsg = 3;
+  constexpr size_t numBytes = 2 * kMemfdThreshold;
+  std::vector<std::string> msgs;
+  for (int i = 0; i < numMsg; ++i) {
+    msgs.emplace_back(numBytes, static_cast<char>('A' + i));
+  }
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        for (int i = 0; i < numMsg; ++i) {
+          doRead(
+              conn,
+              [&, conn, i](const Error& error, const void* ptr, size_t len) {
+                ASSERT_FALSE(error) << error.what();
+                ASSERT_EQ(len, numBytes);
+                ASSERT_EQ(
+                    std::string(static_cast<const char*>(ptr), len), msgs[i]);
+                if (i == numMsg - 1) {
+                  peers_->done(PeerGroup::kServer);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        for (int i = 0; i < numMsg; ++i) {
+          doWrite(
+              conn,
+              msgs[i].c_str(),
+              msgs[i].length(),
+              [&, conn, i](const Error& error) {
+                ASSERT_FALSE(error) << error.what();
+                if (i == numMsg - 1) {
+                  peers_->done(PeerGroup::kClient);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
+TEST_P(UDSTransportTest, ReadAfterBacklog) {
+  // All the data is there before the reads are queued, hence each receive gets
+  // that of many messages at once, as much as the buffer can take, and most of
+  // them are then read in place. The socket must be able to hold all of it, as
+  // the writer only tells the reader to start once its writes are done, and it
+  // accounts for the overhead of each of its sends.
+  constexpr int numMsg = 100;
+  constexpr size_t numBytes = 300;
+  const std::string kReady = "ready";
+  std::string msg(numBytes, 0x42);
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        // Wait for peer to queue up writes before attempting to read
+        EXPECT_EQ(kReady, peers_->recv(PeerGroup::kServer));
+
+        for (int i = 0; i < numMsg; ++i) {
+          doRead(
+              conn,
+              [&, conn, i](const Error& error, const void* ptr, size_t len) {
+                ASSERT_FALSE(error) << error.what();
+                ASSERT_EQ(len, numBytes);
+                ASSERT_EQ(std::string(static_cast<const char*>(ptr), len), msg);
+                if (i == numMsg - 1) {
+                  peers_->done(PeerGroup::kServer);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        for (int i = 0; i < numMsg; ++i) {
+          doWrite(
+              conn,
+              msg.c_str(),
+              msg.length(),
+              [&, conn, i](const Error& error) {
+                ASSERT_FALSE(error) << error.what();
+                if (i == numMsg - 1) {
+                  peers_->send(PeerGroup::kServer, kReady);
+                  peers_->done(PeerGroup::kClient);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
+INSTANTIATE_TEST_CASE_P(UDS, UDSTransportTest, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    UDSInline,
+    UDSTransportTest,
+    ::testing::Values(&inlineHelper));
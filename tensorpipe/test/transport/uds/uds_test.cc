@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/test/transport/uds/uds_test.h>
+
+#include <limits>
+
+namespace {
+
+UDSTransportTestHelper helper;
+
+// So low a threshold that most payloads are handed over in memfds.
+UDSTransportTestHelper memfdHelper(/*memfdThreshold=*/16);
+
+UDSTransportTestHelper inlineHelper(
+    /*memfdThreshold=*/std::numeric_limits<size_t>::max());
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(UDS, TransportTest, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    UDSMemfd,
+    TransportTest,
+    ::testing::Values(&memfdHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    UDSInline,
+    TransportTest,
+    ::testing::Values(&inlineHelper));
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/test/transport/uring/uring_test.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::transport;
+
+namespace {
+
+class UringTransportTest : public TransportTest {};
+
+UringTransportTestHelper helper;
+UringTransportTestHelper fewBuffersHelper(
+    /*numBuffers=*/4,
+    /*bufferSize=*/1024);
+
+// The size of the buffers of the default helper.
+static constexpr auto kBufferSize = uring::kDefaultBufferSize;
+
+} // namespace
+
+TEST_P(UringTransportTest, MixedSizes) {
+  // The small payloads are received through the provided buffers and the large
+  // ones directly into their destination, which must keep the data in order.
+  constexpr int numMsg = 20;
+  auto msgSize = [](int i) -> size_t {
+    return i % 2 == 0 ? 100 + i : 3 * kBufferSize + i;
+  };
+  std::vector<std::string> srcBufs;
+  for (int i = 0; i < numMsg; ++i) {
+    srcBufs.emplace_back(msgSize(i), static_cast<char>('A' + i));
+  }
+  std::vector<std::unique_ptr<char[]>> dstBufs;
+  for (int i = 0; i < numMsg; ++i) {
+    dstBufs.push_back(std::make_unique<char[]>(msgSize(i)));
+  }
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        for (int i = 0; i < numMsg; ++i) {
+          doRead(
+              conn,
+              dstBufs[i].get(),
+              msgSize(i),
+              [&, conn, i](const Error& error, const void* ptr, size_t len) {
+                ASSERT_FALSE(error) << error.what();
+                ASSERT_EQ(len, msgSize(i));
+                ASSERT_EQ(ptr, dstBufs[i].get());
+                for (size_t j = 0; j < len; ++j) {
+                  ASSERT_EQ(dstBufs[i][j], srcBufs[i][j]);
+                }
+                if (i == numMsg - 1) {
+                  peers_->done(PeerGroup::kServer);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        for (int i = 0; i < numMsg; ++i) {
+          doWrite(
+              conn,
+              srcBufs[i].c_str(),
+              srcBufs[i].length(),
+              [&, conn, i](const Error& error) {
+                ASSERT_FALSE(error) << error.what();
+                if (i == numMsg - 1) {
+                  peers_->done(PeerGroup::kClient);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
+TEST_P(UringTransportTest, ReadAfterBacklog) {
+  // All the data is there before the reads are queued, hence each receive gets
+  // that of many messages at once, as much as the buffers can take.
+  constexpr int numMsg = 500;
+  constexpr size_t numBytes = 300;
+  const std::string kReady = "ready";
+  std::string msg(numBytes, 0x42);
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        // Wait for peer to queue up writes before attempting to read
+        EXPECT_EQ(kReady, peers_->recv(PeerGroup::kServer));
+
+        for (int i = 0; i < numMsg; ++i) {
+          doRead(
+              conn,
+              [&, conn, i](const Error& error, const void* ptr, size_t len) {
+                ASSERT_FALSE(error) << error.what();
+                ASSERT_EQ(len, numBytes);
+                ASSERT_EQ(std::string(static_cast<const char*>(ptr), len), msg);
+                if (i == numMsg - 1) {
+                  peers_->done(PeerGroup::kServer);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        for (int i = 0; i < numMsg; ++i) {
+          doWrite(
+              conn,
+              msg.c_str(),
+              msg.length(),
+              [&, conn, i](const Error& error) {
+                ASSERT_FALSE(error) << error.what();
+                if (i == numMsg - 1) {
+                  peers_->send(PeerGroup::kServer, kReady);
+                  peers_->done(PeerGroup::kClient);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
+INSTANTIATE_TEST_CASE_P(Uring, UringTransportTest, ::testing::Values(&helper));
+
+// With fewer buffers than the connections need they have to wait for some to
+// be recycled, and with smaller ones most payloads bypass them.
+INSTANTIATE_TEST_CASE_P(
+    UringFewBuffers,
+    UringTransportTest,
+    ::testing::Values(&fewBuffersHelper));
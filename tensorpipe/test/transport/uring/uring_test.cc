@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/test/transport/uring/uring_test.h>
+
+namespace {
+
+UringTransportTestHelper helper;
+
+// So few and so small buffers that the connections regularly run out of them,
+// and that most payloads are received directly into their destination.
+UringTransportTestHelper fewBuffersHelper(
+    /*numBuffers=*/4,
+    /*bufferSize=*/1024);
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(Uring, TransportTest, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    UringFewBuffers,
+    TransportTest,
+    ::testing::Values(&fewBuffersHelper));
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <tensorpipe/test/transport/transport_test.h>
+#include <tensorpipe/transport/uring/context.h>
+
+class UringTransportTestHelper : public TransportTestHelper {
+ public:
+  explicit UringTransportTestHelper(
+      size_t numBuffers = tensorpipe::transport::uring::kDefaultNumBuffers,
+      size_t bufferSize = tensorpipe::transport::uring::kDefaultBufferSize)
+      : numBuffers_(numBuffers), bufferSize_(bufferSize) {}
+
+ protected:
+  std::shared_ptr<tensorpipe::transport::Context> getContextInternal()
+      override {
+    return std::make_shared<tensorpipe::transport::uring::Context>(
+        numBuffers_, bufferSize_);
+  }
+
+ public:
+  std::string defaultAddr() override {
+    return "127.0.0.1";
+  }
+
+ private:
+  const size_t numBuffers_;
+  const size_t bufferSize_;
+};
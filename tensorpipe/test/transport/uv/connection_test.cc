@@ -8,6 +8,9 @@
 
 #include <tensorpipe/test/transport/uv/uv_test.h>
 
+#include <string>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 namespace {
@@ -15,6 +18,8 @@ namespace {
 class UVTransportConnectionTest : public TransportTest {};
 
 UVTransportTestHelper helper;
+StripedUVTransportTestHelper stripedHelper;
+ZeroCopyUVTransportTestHelper zeroCopyHelper;
 
 } // namespace
 
@@ -50,7 +55,113 @@ TEST_P(UVTransportConnectionTest, LargeWrite) {
       });
 }
 
+// Payloads of various sizes, some of which are striped across the streams and
+// some aren't, must come out in the order in which they went in.
+TEST_P(UVTransportConnectionTest, MixedSizeWrites) {
+  const std::vector<size_t> kSizes = {
+      8 * 1024 * 1024, 1, 3 * 1024 * 1024 + 1, 0, 1024 * 1024, 64};
+  std::vector<std::string> msgs;
+  for (size_t msgIdx = 0; msgIdx < kSizes.size(); msgIdx++) {
+    msgs.emplace_back(kSizes[msgIdx], static_cast<char>('a' + msgIdx));
+  }
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        for (size_t msgIdx = 0; msgIdx < msgs.size(); msgIdx++) {
+          conn->write(
+              msgs[msgIdx].data(),
+              msgs[msgIdx].size(),
+              [&, conn, msgIdx](const Error& error) {
+                ASSERT_FALSE(error) << error.what();
+                if (msgIdx == msgs.size() - 1) {
+                  peers_->done(PeerGroup::kServer);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        for (size_t msgIdx = 0; msgIdx < msgs.size(); msgIdx++) {
+          conn->read([&, conn, msgIdx](
+                         const Error& error, const void* ptr, size_t len) {
+            ASSERT_FALSE(error) << error.what();
+            ASSERT_EQ(len, msgs[msgIdx].size());
+            EXPECT_EQ(
+                std::string(static_cast<const char*>(ptr), len), msgs[msgIdx]);
+            if (msgIdx == msgs.size() - 1) {
+              peers_->done(PeerGroup::kClient);
+            }
+          });
+        }
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
+// Many small payloads that are already there when the reads are queued come in
+// a few reads, which split some of them, and their callbacks must get them
+// intact whether they're read into a given buffer or not.
+TEST_P(UVTransportConnectionTest, ManySmallWritesBeforeReads) {
+  constexpr size_t kNumMsgs = 400;
+  const std::string kReady = "ready";
+  std::vector<std::string> msgs;
+  for (size_t msgIdx = 0; msgIdx < kNumMsgs; msgIdx++) {
+    msgs.emplace_back(
+        (msgIdx * 97) % 400, static_cast<char>('a' + msgIdx % 26));
+  }
+  std::vector<std::string> dstBufs(kNumMsgs);
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        for (size_t msgIdx = 0; msgIdx < msgs.size(); msgIdx++) {
+          conn->write(
+              msgs[msgIdx].data(),
+              msgs[msgIdx].size(),
+              [&, conn, msgIdx](const Error& error) {
+                ASSERT_FALSE(error) << error.what();
+                if (msgIdx == msgs.size() - 1) {
+                  peers_->send(PeerGroup::kClient, kReady);
+                  peers_->done(PeerGroup::kServer);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        EXPECT_EQ(kReady, peers_->recv(PeerGroup::kClient));
+        for (size_t msgIdx = 0; msgIdx < msgs.size(); msgIdx++) {
+          auto fn = [&, conn, msgIdx](
+                        const Error& error, const void* ptr, size_t len) {
+            ASSERT_FALSE(error) << error.what();
+            ASSERT_EQ(len, msgs[msgIdx].size());
+            EXPECT_EQ(
+                std::string(static_cast<const char*>(ptr), len), msgs[msgIdx]);
+            if (msgIdx == msgs.size() - 1) {
+              peers_->done(PeerGroup::kClient);
+            }
+          };
+          if (msgIdx % 2 == 0) {
+            conn->read(std::move(fn));
+          } else {
+            dstBufs[msgIdx].resize(msgs[msgIdx].size());
+            conn->read(
+                &dstBufs[msgIdx][0], dstBufs[msgIdx].size(), std::move(fn));
+          }
+        }
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
 INSTANTIATE_TEST_CASE_P(
     Uv,
     UVTransportConnectionTest,
     ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    UvStriped,
+    UVTransportConnectionTest,
+    ::testing::Values(&stripedHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    UvZeroCopy,
+    UVTransportConnectionTest,
+    ::testing::Values(&zeroCopyHelper));
@@ -8,6 +8,9 @@
 
 #include <tensorpipe/test/transport/uv/uv_test.h>
 
+#include <future>
+#include <string>
+
 #include <gtest/gtest.h>
 
 namespace {
@@ -57,4 +60,59 @@ TEST_P(UVTransportContextTest, LookupInterfaceAddress) {
 }
 #endif
 
+TEST_P(UVTransportContextTest, ConnectToHostname) {
+  auto context = std::dynamic_pointer_cast<transport::uv::Context>(
+      GetParam()->getContext());
+  ASSERT_TRUE(context);
+  transport::uv::setAddrForHostname("tensorpipe-uv-test-host", "127.0.0.1");
+
+  auto listener = context->listen("127.0.0.1");
+  const std::string listenerAddr = listener->addr();
+  const std::string port = listenerAddr.substr(listenerAddr.rfind(':') + 1);
+  const std::string msg = "hello";
+  std::promise<std::string> readProm;
+  listener->accept([&](const Error& error,
+                       std::shared_ptr<transport::Connection> conn) {
+    ASSERT_FALSE(error) << error.what();
+    conn->read([&, conn](const Error& error, const void* ptr, size_t length) {
+      ASSERT_FALSE(error) << error.what();
+      readProm.set_value(
+          std::string(reinterpret_cast<const char*>(ptr), length));
+    });
+  });
+
+  auto conn = context->connect("tensorpipe-uv-test-host:" + port);
+  std::promise<Error> writeProm;
+  conn->write(msg.data(), msg.size(), [&](const Error& error) {
+    writeProm.set_value(error);
+  });
+  Error error = writeProm.get_future().get();
+  EXPECT_FALSE(error) << error.what();
+  EXPECT_EQ(readProm.get_future().get(), msg);
+
+  context->close();
+  context->join();
+}
+
+// The operations queued while the hostname is being resolved fail if it can't
+// be. (The .invalid domain is guaranteed not to exist.)
+TEST_P(UVTransportContextTest, ConnectToUnresolvableHostname) {
+  auto context = GetParam()->getContext();
+
+  auto conn = context->connect("tensorpipe-uv-test-host.invalid:1234");
+  std::promise<Error> readProm;
+  conn->read([&](const Error& error, const void* /* unused */, size_t) {
+    readProm.set_value(error);
+  });
+  const std::string msg = "hello";
+  std::promise<Error> writeProm;
+  conn->write(msg.data(), msg.size(), [&](const Error& error) {
+    writeProm.set_value(error);
+  });
+  EXPECT_TRUE(readProm.get_future().get());
+  EXPECT_TRUE(writeProm.get_future().get());
+
+  context->join();
+}
+
 INSTANTIATE_TEST_CASE_P(Uv, UVTransportContextTest, ::testing::Values(&helper));
@@ -29,6 +29,22 @@ TEST(UvLoop, Defer) {
   loop.join();
 }
 
+TEST(UvLoop, DeferWhilePolling) {
+  Loop loop(tensorpipe::ThreadOptions(), /*pollWindowUsecs=*/1000);
+
+  for (int i = 0; i < 10; i++) {
+    std::promise<std::thread::id> prom;
+    loop.deferToLoop([&] { prom.set_value(std::this_thread::get_id()); });
+    ASSERT_NE(std::this_thread::get_id(), prom.get_future().get());
+    // Let the loop give up spinning and go to sleep every other time.
+    if (i % 2 == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+  }
+
+  loop.join();
+}
+
 } // namespace uv
 } // namespace transport
 } // namespace test
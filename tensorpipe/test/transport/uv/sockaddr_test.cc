@@ -66,6 +66,35 @@ TEST(UvSockaddr, Inet) {
   }
 }
 
+TEST(UvSockaddr, SplitHostAndPort) {
+  std::string host;
+  uint16_t port;
+
+  std::tie(host, port) = uv::Sockaddr::splitHostAndPort("1.2.3.4:5");
+  EXPECT_EQ(host, "1.2.3.4");
+  EXPECT_EQ(port, 5);
+
+  std::tie(host, port) = uv::Sockaddr::splitHostAndPort("[::1]:5");
+  EXPECT_EQ(host, "::1");
+  EXPECT_EQ(port, 5);
+
+  std::tie(host, port) = uv::Sockaddr::splitHostAndPort("::1");
+  EXPECT_EQ(host, "::1");
+  EXPECT_EQ(port, 0);
+
+  std::tie(host, port) = uv::Sockaddr::splitHostAndPort("example.com:5");
+  EXPECT_EQ(host, "example.com");
+  EXPECT_EQ(port, 5);
+
+  std::tie(host, port) = uv::Sockaddr::splitHostAndPort("localhost");
+  EXPECT_EQ(host, "localhost");
+  EXPECT_EQ(port, 0);
+
+  EXPECT_FALSE(uv::Sockaddr::createNumericInetSockAddr("localhost", 5));
+  ASSERT_THROW(
+      uv::Sockaddr::createInetSockAddr("localhost:5"), std::invalid_argument);
+}
+
 TEST(UvSockaddr, Inet6BadPort) {
   ASSERT_THROW(
       uv::Sockaddr::createInetSockAddr("[::1]:-1"), std::invalid_argument);
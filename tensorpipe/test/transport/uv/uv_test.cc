@@ -12,6 +12,41 @@ namespace {
 
 UVTransportTestHelper helper;
 
+ShardedUVTransportTestHelper shardedHelper;
+
+TunedUVTransportTestHelper tunedHelper;
+
+StripedUVTransportTestHelper stripedHelper;
+
+ZeroCopyUVTransportTestHelper zeroCopyHelper;
+
+PollingUVTransportTestHelper pollingHelper;
+
 } // namespace
 
 INSTANTIATE_TEST_CASE_P(Uv, TransportTest, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    UvSharded,
+    TransportTest,
+    ::testing::Values(&shardedHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    UvTuned,
+    TransportTest,
+    ::testing::Values(&tunedHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    UvStriped,
+    TransportTest,
+    ::testing::Values(&stripedHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    UvZeroCopy,
+    TransportTest,
+    ::testing::Values(&zeroCopyHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    UvPolling,
+    TransportTest,
+    ::testing::Values(&pollingHelper));
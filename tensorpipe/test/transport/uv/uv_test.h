@@ -23,3 +23,61 @@ class UVTransportTestHelper : public TransportTestHelper {
     return "127.0.0.1";
   }
 };
+
+class ShardedUVTransportTestHelper : public UVTransportTestHelper {
+ protected:
+  std::shared_ptr<tensorpipe::transport::Context> getContextInternal()
+      override {
+    return std::make_shared<tensorpipe::transport::uv::Context>(
+        /*numLoops=*/4,
+        tensorpipe::transport::uv::TCPOptions().listenBacklog(1024));
+  }
+};
+
+class TunedUVTransportTestHelper : public UVTransportTestHelper {
+ protected:
+  std::shared_ptr<tensorpipe::transport::Context> getContextInternal()
+      override {
+    return std::make_shared<tensorpipe::transport::uv::Context>(
+        /*numLoops=*/1,
+        tensorpipe::transport::uv::TCPOptions()
+            .noDelay(false)
+            .sendBufferSize(1024 * 1024)
+            .receiveBufferSize(1024 * 1024)
+            .keepAlive(/*delaySecs=*/60)
+            .quickAck(true));
+  }
+};
+
+class StripedUVTransportTestHelper : public UVTransportTestHelper {
+ protected:
+  std::shared_ptr<tensorpipe::transport::Context> getContextInternal()
+      override {
+    return std::make_shared<tensorpipe::transport::uv::Context>(
+        /*numLoops=*/1, tensorpipe::transport::uv::TCPOptions().numStreams(4));
+  }
+};
+
+class PollingUVTransportTestHelper : public UVTransportTestHelper {
+ protected:
+  std::shared_ptr<tensorpipe::transport::Context> getContextInternal()
+      override {
+    return std::make_shared<tensorpipe::transport::uv::Context>(
+        /*numLoops=*/1,
+        tensorpipe::transport::uv::TCPOptions().pollWindow(/*usecs=*/1000));
+  }
+};
+
+// The small send buffer makes the large writes stall partway through, so that
+// they resume after libuv sees the socket being writable again.
+class ZeroCopyUVTransportTestHelper : public UVTransportTestHelper {
+ protected:
+  std::shared_ptr<tensorpipe::transport::Context> getContextInternal()
+      override {
+    return std::make_shared<tensorpipe::transport::uv::Context>(
+        /*numLoops=*/1,
+        tensorpipe::transport::uv::TCPOptions()
+            .zeroCopyThreshold(64 * 1024)
+            .sendBufferSize(128 * 1024));
+  }
+};
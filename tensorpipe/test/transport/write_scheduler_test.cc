@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <chrono>
+#include <future>
+#include <vector>
+
+#include <tensorpipe/common/deferred_executor.h>
+#include <tensorpipe/transport/write_scheduler.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::transport;
+
+namespace {
+
+// Writes this large fill the window on their own, hence they start one at a
+// time, each once the previous one is done.
+constexpr size_t kLargeWrite = WriteScheduler::kMaxBytesInFlight;
+
+} // namespace
+
+TEST(WriteScheduler, WeightedShares) {
+  OnDemandDeferredExecutor loop;
+  WriteScheduler scheduler(loop);
+  int heavy;
+  int light;
+  std::vector<const void*> started;
+
+  loop.runInLoop([&]() {
+    scheduler.setFlow(&heavy, /*weight=*/3, /*maxBytesPerSecond=*/0);
+    scheduler.setFlow(&light, /*weight=*/1, /*maxBytesPerSecond=*/0);
+    for (int writeIdx = 0; writeIdx < 8; writeIdx++) {
+      scheduler.enqueue(&heavy, kLargeWrite, [&]() {
+        started.push_back(&heavy);
+      });
+      scheduler.enqueue(&light, kLargeWrite, [&]() {
+        started.push_back(&light);
+      });
+    }
+    EXPECT_EQ(started.size(), 1);
+    while (started.size() < 16) {
+      scheduler.onWriteDone(kLargeWrite);
+    }
+    scheduler.onWriteDone(kLargeWrite);
+    EXPECT_EQ(scheduler.numBytesInFlight(), 0);
+  });
+
+  size_t numHeavy = 0;
+  for (size_t writeIdx = 0; writeIdx < 8; writeIdx++) {
+    if (started[writeIdx] == &heavy) {
+      numHeavy++;
+    }
+  }
+  EXPECT_EQ(numHeavy, 6);
+
+  scheduler.join();
+}
+
+TEST(WriteScheduler, OrderWithinFlow) {
+  OnDemandDeferredExecutor loop;
+  WriteScheduler scheduler(loop);
+  int flow;
+  std::vector<int> started;
+
+  loop.runInLoop([&]() {
+    scheduler.setFlow(&flow, /*weight=*/1, /*maxBytesPerSecond=*/0);
+    for (int writeIdx = 0; writeIdx < 3; writeIdx++) {
+      scheduler.enqueue(&flow, kLargeWrite, [&, writeIdx]() {
+        started.push_back(writeIdx);
+      });
+    }
+    for (int writeIdx = 0; writeIdx < 3; writeIdx++) {
+      scheduler.onWriteDone(kLargeWrite);
+    }
+  });
+
+  EXPECT_EQ(started, std::vector<int>({0, 1, 2}));
+
+  scheduler.join();
+}
+
+TEST(WriteScheduler, RemoveFlowStartsPendingWrites) {
+  OnDemandDeferredExecutor loop;
+  WriteScheduler scheduler(loop);
+  int flow;
+  size_t numStarted = 0;
+
+  loop.runInLoop([&]() {
+    scheduler.setFlow(&flow, /*weight=*/1, /*maxBytesPerSecond=*/0);
+    for (int writeIdx = 0; writeIdx < 3; writeIdx++) {
+      scheduler.enqueue(&flow, kLargeWrite, [&]() { numStarted++; });
+    }
+    EXPECT_EQ(numStarted, 1);
+    scheduler.removeFlow(&flow);
+    EXPECT_EQ(numStarted, 3);
+    EXPECT_EQ(scheduler.numBytesInFlight(), 3 * kLargeWrite);
+    for (int writeIdx = 0; writeIdx < 3; writeIdx++) {
+      scheduler.onWriteDone(kLargeWrite);
+    }
+  });
+
+  scheduler.join();
+}
+
+TEST(WriteScheduler, RateCapDelaysWrites) {
+  // With a cap of 1MB/s, the bucket holds 10kB, which the first two writes
+  // overdraw, hence the third one must wait for about 10ms.
+  constexpr uint64_t kMaxBytesPerSecond = 1000 * 1000;
+  constexpr size_t kWriteSize = 10 * 1000;
+  OnDemandDeferredExecutor loop;
+  WriteScheduler scheduler(loop);
+  int flow;
+  size_t numStarted = 0;
+  std::promise<void> lastStarted;
+
+  std::chrono::steady_clock::time_point begin;
+  loop.runInLoop([&]() {
+    scheduler.setFlow(&flow, /*weight=*/1, kMaxBytesPerSecond);
+    begin = std::chrono::steady_clock::now();
+    for (int writeIdx = 0; writeIdx < 3; writeIdx++) {
+      scheduler.enqueue(&flow, kWriteSize, [&]() {
+        numStarted++;
+        scheduler.onWriteDone(kWriteSize);
+        if (numStarted == 3) {
+          lastStarted.set_value();
+        }
+      });
+    }
+    EXPECT_EQ(numStarted, 2);
+  });
+
+  lastStarted.get_future().get();
+  EXPECT_GE(
+      std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(5));
+
+  scheduler.join();
+}
@@ -705,3 +705,72 @@ TEST(RingBuffer, accessContiguousInTx) {
     EXPECT_EQ(usedSize(rb), 0);
   }
 }
+
+TEST(RingBuffer, SingleProducerAndConsumer) {
+  // 16 bytes buffer. Fits two full TestData (each 6).
+  size_t size = 1u << 4;
+
+  RingBufferStorage storage(size);
+  RingBuffer rb = storage.getRb();
+  SingleProducer p{rb};
+  SingleConsumer c{rb};
+
+  TestData d0{.a = 0xBA98, .b = 0x7654, .c = 0xA312};
+  TestData d1{.a = 0xA987, .b = 0x7777, .c = 0x2812};
+  TestData r;
+
+  // Go around the ringbuffer a few times, so that both the cached head and
+  // tail get outdated and must be refreshed.
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(p.write(&d0, sizeof(d0)), sizeof(d0));
+    EXPECT_EQ(p.write(&d1, sizeof(d1)), sizeof(d1));
+    EXPECT_EQ(p.write(&d0, sizeof(d0)), -ENOSPC);
+    EXPECT_EQ(usedSize(rb), 12);
+
+    EXPECT_EQ(c.read(&r, sizeof(r)), sizeof(r));
+    EXPECT_EQ(r, d0);
+    EXPECT_EQ(c.read(&r, sizeof(r)), sizeof(r));
+    EXPECT_EQ(r, d1);
+    EXPECT_EQ(c.read(&r, sizeof(r)), -ENODATA);
+    EXPECT_EQ(usedSize(rb), 0);
+  }
+
+  // Single users can start and cancel transactions while the ringbuffer is
+  // also held by a multi-user one of the opposite kind.
+  Consumer mc{rb};
+  EXPECT_EQ(p.write(&d0, sizeof(d0)), sizeof(d0));
+  EXPECT_EQ(mc.read(&r, sizeof(r)), sizeof(r));
+  EXPECT_EQ(r, d0);
+  EXPECT_EQ(usedSize(rb), 0);
+}
+
+TEST(RingBuffer, SingleUsersOfNewView) {
+  size_t size = 1u << 4;
+
+  RingBufferStorage storage(size);
+  RingBuffer rb = storage.getRb();
+  TestData d0{.a = 0xBA98, .b = 0x7654, .c = 0xA312};
+  TestData r;
+
+  // Move the head and tail away from zero through another view.
+  {
+    Producer p{rb};
+    Consumer c{rb};
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_EQ(p.write(&d0, sizeof(d0)), sizeof(d0));
+      EXPECT_EQ(c.read(&r, sizeof(r)), sizeof(r));
+    }
+  }
+
+  // A fresh view starts with outdated cached values, which must not be
+  // mistaken for available room or data.
+  RingBuffer newRb = storage.getRb();
+  SingleProducer p{newRb};
+  SingleConsumer c{newRb};
+  EXPECT_EQ(c.read(&r, sizeof(r)), -ENODATA);
+  EXPECT_EQ(p.write(&d0, sizeof(d0)), sizeof(d0));
+  EXPECT_EQ(p.write(&d0, sizeof(d0)), sizeof(d0));
+  EXPECT_EQ(p.write(&d0, sizeof(d0)), -ENOSPC);
+  EXPECT_EQ(c.read(&r, sizeof(r)), sizeof(r));
+  EXPECT_EQ(r, d0);
+}
@@ -6,6 +6,8 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <tensorpipe/common/nop.h>
+#include <tensorpipe/common/ringbuffer_read_write_ops.h>
 #include <tensorpipe/common/socket.h>
 #include <tensorpipe/util/ringbuffer/consumer.h>
 #include <tensorpipe/util/ringbuffer/producer.h>
@@ -17,7 +19,11 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include <array>
+#include <cstring>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -183,3 +189,123 @@ TEST(ShmRingBuffer, SingleProducer_SingleConsumer) {
   // Wait for child to make gtest happy.
   ::wait(nullptr);
 };
+
+// With double-mapped data, what wraps around the end of the ringbuffer is still
+// handed out as a single contiguous buffer.
+TEST(ShmRingBuffer, DoubleMapped) {
+  const size_t size = ::sysconf(_SC_PAGESIZE);
+
+  Error error;
+  Segment headerSegment;
+  Segment dataSegment;
+  RingBuffer rb;
+  std::tie(error, headerSegment, dataSegment, rb) = shm::create(
+      size,
+      PageType::Default,
+      /*permWrite=*/true,
+      /*doubleMapped=*/true);
+  ASSERT_FALSE(error) << error.what();
+  ASSERT_TRUE(rb.isDataDoubleMapped());
+
+  Producer prod{rb};
+  Consumer cons{rb};
+
+  // Move the head and tail close to the end of the data.
+  std::vector<uint8_t> filler(size - 10);
+  ASSERT_EQ(prod.write(filler.data(), filler.size()), filler.size());
+  ASSERT_EQ(cons.read(filler.data(), filler.size()), filler.size());
+
+  std::vector<uint8_t> data(100);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = i;
+  }
+  ASSERT_EQ(prod.write(data.data(), data.size()), data.size());
+
+  ASSERT_EQ(cons.startTx(), 0);
+  ssize_t numBuffers;
+  std::array<Consumer::Buffer, 2> buffers;
+  std::tie(numBuffers, buffers) =
+      cons.accessContiguousInTx</*AllowPartial=*/false>(data.size());
+  ASSERT_EQ(numBuffers, 1);
+  ASSERT_EQ(buffers[0].len, data.size());
+  EXPECT_EQ(std::memcmp(buffers[0].ptr, data.data(), data.size()), 0);
+  ASSERT_EQ(cons.commitTx(), 0);
+
+  EXPECT_EQ(rb.getHeader().readHead(), rb.getHeader().readTail());
+}
+
+TEST(ShmRingBuffer, DoubleMappedReadWriteOperations) {
+  const size_t size = ::sysconf(_SC_PAGESIZE);
+
+  Error error;
+  Segment headerSegment;
+  Segment dataSegment;
+  RingBuffer rb;
+  std::tie(error, headerSegment, dataSegment, rb) = shm::create(
+      size,
+      PageType::Default,
+      /*permWrite=*/true,
+      /*doubleMapped=*/true);
+  ASSERT_FALSE(error) << error.what();
+  ASSERT_TRUE(rb.isDataDoubleMapped());
+
+  Producer prod{rb};
+  Consumer cons{rb};
+
+  // Move the head and tail close to the end of the data.
+  std::vector<uint8_t> filler(size - 10);
+  ASSERT_EQ(prod.write(filler.data(), filler.size()), filler.size());
+  ASSERT_EQ(cons.read(filler.data(), filler.size()), filler.size());
+
+  // The nop object straddles the end of the data.
+  NopHolder<std::string> nopHolderOut;
+  nopHolderOut.getObject() = "a nop object across the end of the data";
+  RingbufferWriteOperation nopWriteOp(&nopHolderOut, [](const Error& error) {
+    EXPECT_FALSE(error) << error.what();
+  });
+  nopWriteOp.handleWrite(prod);
+  ASSERT_TRUE(nopWriteOp.completed());
+
+  NopHolder<std::string> nopHolderIn;
+  RingbufferReadOperation nopReadOp(
+      &nopHolderIn, [](const Error& error, const void* /* unused */, size_t) {
+        EXPECT_FALSE(error) << error.what();
+      });
+  nopReadOp.handleRead(cons);
+  ASSERT_TRUE(nopReadOp.completed());
+  EXPECT_EQ(nopHolderIn.getObject(), nopHolderOut.getObject());
+
+  // Move the head and tail close to the end of the data again.
+  filler.resize(size - 10 - rb.getHeader().readTail() % size);
+  ASSERT_EQ(prod.write(filler.data(), filler.size()), filler.size());
+  ASSERT_EQ(cons.read(filler.data(), filler.size()), filler.size());
+
+  // The payload straddles the end of the data too.
+  const std::string payload = "a payload across the end of the data";
+  RingbufferWriteOperation payloadWriteOp(
+      payload.data(), payload.size(), [](const Error& error) {
+        EXPECT_FALSE(error) << error.what();
+      });
+  payloadWriteOp.handleWrite(prod);
+  ASSERT_TRUE(payloadWriteOp.completed());
+
+  bool called = false;
+  RingbufferReadOperation payloadReadOp(
+      [&](const Error& error, const void* ptr, size_t len) {
+        ASSERT_FALSE(error) << error.what();
+        called = true;
+        // The payload is borrowed from the ringbuffer, spilling over into the
+        // second mapping of the data, rather than copied out of it.
+        const uint8_t* bytePtr = reinterpret_cast<const uint8_t*>(ptr);
+        EXPECT_GE(bytePtr, rb.getData());
+        EXPECT_LT(bytePtr, rb.getData() + size);
+        EXPECT_GT(bytePtr + len, rb.getData() + size);
+        EXPECT_EQ(
+            std::string(reinterpret_cast<const char*>(ptr), len), payload);
+      });
+  payloadReadOp.handleRead(cons);
+  EXPECT_TRUE(payloadReadOp.completed());
+  EXPECT_TRUE(called);
+
+  EXPECT_EQ(rb.getHeader().readHead(), rb.getHeader().readTail());
+}
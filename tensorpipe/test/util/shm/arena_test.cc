@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/util/shm/arena.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::util::shm;
+
+namespace {
+
+std::unique_ptr<Arena> createArena(size_t byteSize) {
+  Error error;
+  std::unique_ptr<Arena> arena;
+  std::tie(error, arena) = Arena::create(byteSize);
+  EXPECT_FALSE(error) << error.what();
+  return arena;
+}
+
+} // namespace
+
+TEST(Arena, AllocatesAlignedDisjointBuffers) {
+  std::unique_ptr<Arena> arena = createArena(64 * 1024);
+  ASSERT_NE(arena, nullptr);
+
+  std::vector<uint8_t*> ptrs;
+  for (size_t length : {1, 100, 0, 4096, 63}) {
+    uint8_t* ptr = reinterpret_cast<uint8_t*>(arena->allocate(length));
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % Arena::kAlignment, 0);
+    EXPECT_TRUE(arena->contains(ptr, length));
+    std::memset(ptr, static_cast<int>(ptrs.size()), length);
+    ptrs.push_back(ptr);
+  }
+  for (size_t idx = 1; idx < ptrs.size(); idx++) {
+    EXPECT_NE(ptrs[idx], ptrs[idx - 1]);
+  }
+  for (uint8_t* ptr : ptrs) {
+    arena->deallocate(ptr);
+  }
+}
+
+TEST(Arena, ReusesFreedMemory) {
+  std::unique_ptr<Arena> arena = createArena(64 * 1024);
+  ASSERT_NE(arena, nullptr);
+
+  // The whole arena can be taken, and nothing is left after that.
+  void* ptr = arena->allocate(arena->getSize());
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_EQ(arena->offsetOf(ptr), 0);
+  EXPECT_EQ(arena->allocate(1), nullptr);
+  arena->deallocate(ptr);
+
+  // Once the two halves are freed, in any order, they're merged back.
+  void* first = arena->allocate(arena->getSize() / 2);
+  void* second = arena->allocate(arena->getSize() / 2);
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+  void* third = arena->allocate(arena->getSize() / 4);
+  ASSERT_EQ(third, nullptr);
+  EXPECT_EQ(arena->allocate(arena->getSize()), nullptr);
+  arena->deallocate(second);
+  arena->deallocate(first);
+  ptr = arena->allocate(arena->getSize());
+  ASSERT_NE(ptr, nullptr);
+  arena->deallocate(ptr);
+}
+
+TEST(Arena, DoesNotContainOtherMemory) {
+  std::unique_ptr<Arena> arena = createArena(64 * 1024);
+  ASSERT_NE(arena, nullptr);
+
+  std::vector<uint8_t> otherMemory(16);
+  EXPECT_FALSE(arena->contains(otherMemory.data(), otherMemory.size()));
+
+  uint8_t* ptr = reinterpret_cast<uint8_t*>(arena->allocate(128));
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_FALSE(arena->contains(ptr, arena->getSize() + 1));
+  arena->deallocate(ptr);
+}
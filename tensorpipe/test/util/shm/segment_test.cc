@@ -10,6 +10,7 @@
 #include <tensorpipe/util/shm/segment.h>
 
 #include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 
 #include <thread>
@@ -60,6 +61,158 @@ TEST(Segment, SameProducerConsumer_Scalar) {
   }
 };
 
+// Huge pages are only a hint, hence this must work whether or not any of them
+// are available, and a segment that uses them must be loadable as any other.
+TEST(Segment, HugePages) {
+  constexpr size_t kSize = 2 * 1024 * 1024;
+
+  Fd fd;
+  {
+    Error error;
+    Segment segment;
+    uint8_t* ptr;
+    std::tie(error, segment, ptr) =
+        Segment::create<uint8_t[]>(kSize, true, PageType::HugeTLB_2MB);
+    ASSERT_FALSE(error) << error.what();
+    EXPECT_EQ(segment.getSize(), kSize);
+    ptr[0] = 42;
+    ptr[kSize - 1] = 43;
+    fd = Fd(::dup(segment.getFd()));
+  }
+
+  {
+    Error error;
+    Segment segment;
+    uint8_t* ptr;
+    std::tie(error, segment, ptr) =
+        Segment::load<uint8_t[]>(std::move(fd), false, PageType::Default);
+    ASSERT_FALSE(error) << error.what();
+    EXPECT_EQ(segment.getSize(), kSize);
+    EXPECT_EQ(ptr[0], 42);
+    EXPECT_EQ(ptr[kSize - 1], 43);
+  }
+}
+
+// A segment that isn't a whole number of the requested huge pages (or that
+// can't get any of them) falls back to smaller ones, and it's still usable.
+TEST(Segment, HugePagesFallBack) {
+  constexpr size_t kSize = 2 * 1024 * 1024;
+
+  Error error;
+  Segment segment;
+  uint8_t* ptr;
+  std::tie(error, segment, ptr) =
+      Segment::create<uint8_t[]>(kSize, true, PageType::HugeTLB_1GB);
+  ASSERT_FALSE(error) << error.what();
+  EXPECT_EQ(segment.getSize(), kSize);
+  ptr[0] = 42;
+  ptr[kSize - 1] = 43;
+  EXPECT_EQ(ptr[0], 42);
+  EXPECT_EQ(ptr[kSize - 1], 43);
+}
+
+// A double-mapped segment is followed by a second copy of itself, both when it
+// is created and when it is loaded, and whatever is written through either of
+// them is seen through the other.
+TEST(Segment, DoubleMapped) {
+  const size_t size = 2 * ::sysconf(_SC_PAGESIZE);
+
+  Fd fd;
+  {
+    Error error;
+    Segment segment;
+    uint8_t* ptr;
+    std::tie(error, segment, ptr) = Segment::create<uint8_t[]>(
+        size, true, PageType::Default, /*doubleMapped=*/true);
+    ASSERT_FALSE(error) << error.what();
+    ASSERT_TRUE(segment.isDoubleMapped());
+    EXPECT_EQ(segment.getSize(), size);
+    EXPECT_EQ(ptr[size], 0);
+    ptr[0] = 42;
+    ptr[2 * size - 1] = 43;
+    EXPECT_EQ(ptr[size], 42);
+    EXPECT_EQ(ptr[size - 1], 43);
+    fd = Fd(::dup(segment.getFd()));
+  }
+
+  {
+    Error error;
+    Segment segment;
+    uint8_t* ptr;
+    std::tie(error, segment, ptr) = Segment::load<uint8_t[]>(
+        std::move(fd), false, PageType::Default, /*doubleMapped=*/true);
+    ASSERT_FALSE(error) << error.what();
+    ASSERT_TRUE(segment.isDoubleMapped());
+    EXPECT_EQ(segment.getSize(), size);
+    EXPECT_EQ(ptr[0], 42);
+    EXPECT_EQ(ptr[size - 1], 43);
+    EXPECT_EQ(ptr[size], 42);
+    EXPECT_EQ(ptr[2 * size - 1], 43);
+  }
+}
+
+// Once prefaulted, reading all of a segment, through both mappings, doesn't
+// take a fault per page anymore.
+TEST(Segment, Prefault) {
+  const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+  constexpr size_t kNumPages = 1024;
+  const size_t size = kNumPages * pageSize;
+
+  Error error;
+  Segment producerSegment;
+  uint8_t* producerPtr;
+  std::tie(error, producerSegment, producerPtr) = Segment::create<uint8_t[]>(
+      size, true, PageType::Default, /*doubleMapped=*/true);
+  ASSERT_FALSE(error) << error.what();
+  for (size_t pageIdx = 0; pageIdx < kNumPages; pageIdx++) {
+    producerPtr[pageIdx * pageSize] = pageIdx;
+  }
+
+  Segment consumerSegment;
+  uint8_t* consumerPtr;
+  std::tie(error, consumerSegment, consumerPtr) = Segment::load<uint8_t[]>(
+      Fd(::dup(producerSegment.getFd())),
+      false,
+      PageType::Default,
+      /*doubleMapped=*/true);
+  ASSERT_FALSE(error) << error.what();
+  ASSERT_TRUE(consumerSegment.isDoubleMapped());
+  error = consumerSegment.prefault();
+  ASSERT_FALSE(error) << error.what();
+
+  struct rusage before;
+  ASSERT_EQ(::getrusage(RUSAGE_SELF, &before), 0);
+  size_t numMismatches = 0;
+  for (size_t pageIdx = 0; pageIdx < 2 * kNumPages; pageIdx++) {
+    const volatile uint8_t* page = consumerPtr + pageIdx * pageSize;
+    if (*page != static_cast<uint8_t>(pageIdx % kNumPages)) {
+      numMismatches++;
+    }
+  }
+  struct rusage after;
+  ASSERT_EQ(::getrusage(RUSAGE_SELF, &after), 0);
+  EXPECT_EQ(numMismatches, 0);
+  // The kernel maps up to 16 pages around the one that faulted, hence without
+  // prefaulting this would take around 128 faults. Allow for a few of them
+  // from elsewhere in the process.
+  EXPECT_LT(after.ru_minflt - before.ru_minflt, 16);
+}
+
+// Sizes that aren't a multiple of the page size can't be double mapped, which
+// is then silently given up on.
+TEST(Segment, DoubleMappedFallback) {
+  constexpr size_t kSize = 100;
+
+  Error error;
+  Segment segment;
+  uint8_t* ptr;
+  std::tie(error, segment, ptr) = Segment::create<uint8_t[]>(
+      kSize, true, PageType::Default, /*doubleMapped=*/true);
+  ASSERT_FALSE(error) << error.what();
+  EXPECT_FALSE(segment.isDoubleMapped());
+  EXPECT_EQ(segment.getSize(), kSize);
+}
+
 TEST(SegmentManager, SingleProducer_SingleConsumer_Array) {
   size_t numFloats = 330000;
 
@@ -8,26 +8,31 @@
 
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <string>
+#include <vector>
 
+#include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
 #include <tensorpipe/common/nop.h>
 #include <tensorpipe/transport/context.h>
+#include <tensorpipe/transport/stats.h>
 
 namespace tensorpipe {
 namespace transport {
 
 class Connection {
  public:
-  using read_callback_fn =
-      std::function<void(const Error& error, const void* ptr, size_t length)>;
+  using read_callback_fn = MoveOnlyFunction<
+      void(const Error& error, const void* ptr, size_t length)>;
 
   virtual void read(read_callback_fn fn) = 0;
 
   virtual void read(void* ptr, size_t length, read_callback_fn fn) = 0;
 
-  using write_callback_fn = std::function<void(const Error& error)>;
+  using write_callback_fn = MoveOnlyFunction<void(const Error& error)>;
 
   virtual void write(const void* ptr, size_t length, write_callback_fn fn) = 0;
 
@@ -43,7 +48,7 @@ class Connection {
   // temporary buffer and instead instead read directly from its peer's
   // ring buffer. This saves an allocation and a memory copy.
   //
-  using read_nop_callback_fn = std::function<void(const Error& error)>;
+  using read_nop_callback_fn = MoveOnlyFunction<void(const Error& error)>;
 
   virtual void read(AbstractNopHolder& object, read_nop_callback_fn fn) = 0;
 
@@ -57,12 +62,83 @@ class Connection {
   //
   virtual void write(const AbstractNopHolder& object, write_callback_fn fn) = 0;
 
+  // Serialize and write a nop object, followed by a sequence of buffers.
+  //
+  // This is equivalent to writing the object and then each of the buffers in
+  // turn (and it is implemented as such by default), except that the callback
+  // is only invoked once, after all of them have been written. The data on the
+  // wire is the same, hence the peer reads them with separate calls.
+  //
+  // Subclasses may override this to hand all the data to the kernel at once.
+  // For example, the uv transport performs a single scatter-gather write.
+  //
+  struct WriteBuffer {
+    const void* ptr;
+    size_t length;
+  };
+
+  virtual void write(
+      const AbstractNopHolder& object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn) = 0;
+
+  // Write several nop objects, each followed by its own sequence of buffers.
+  //
+  // This is equivalent to performing the above write for each segment in turn
+  // (and it is implemented as such by default), except that the callback is
+  // only invoked once, after all of them have been written. It allows the
+  // pipe to hand a batch of messages to the transport in one go. There must be
+  // at least one segment, and the objects must stay alive until the callback
+  // is invoked.
+  //
+  struct WriteSegment {
+    const AbstractNopHolder* object;
+    std::vector<WriteBuffer> buffers;
+  };
+
+  virtual void write(
+      std::vector<WriteSegment> segments,
+      write_callback_fn fn) {
+    TP_DCHECK(!segments.empty());
+    // Write callbacks are fired in order and, once an error occurs, all pending
+    // and subsequent ones get it too. Hence we only need to forward the last
+    // one.
+    for (size_t segmentIdx = 0; segmentIdx < segments.size(); segmentIdx++) {
+      WriteSegment& segment = segments[segmentIdx];
+      if (segmentIdx + 1 < segments.size()) {
+        write(
+            *segment.object,
+            std::move(segment.buffers),
+            [](const Error& /* unused */) {});
+      } else {
+        write(*segment.object, std::move(segment.buffers), std::move(fn));
+      }
+    }
+  }
+
   // Tell the connection what its identifier is.
   //
   // This is only supposed to be called from the high-level pipe or from
   // channels. It will only used for logging and debugging purposes.
   virtual void setId(std::string id) = 0;
 
+  // Have the writes of this connection take turns with those of the other
+  // connections of the same context that do so too, in proportion to their
+  // weights, rather than go out as soon as they're issued, and optionally cap
+  // their rate (in bytes per second, zero meaning no cap). A weight of zero
+  // stops this. The connections that aren't shaped are left alone. This is a
+  // hint, which the connections that aren't backed by a transport context
+  // (e.g., multiplexed ones) ignore.
+  virtual void setWriteShaping(
+      uint32_t /* unused */,
+      uint64_t /* unused */) {}
+
+  // Return a snapshot of the traffic of this connection so far. This can be
+  // called from any thread, at any time.
+  virtual TransportStats getTransportStats() {
+    return TransportStats();
+  }
+
   virtual void close() = 0;
 
   virtual ~Connection() = default;
@@ -9,10 +9,12 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include <tensorpipe/transport/connection.h>
 #include <tensorpipe/transport/connection_impl_boilerplate.h>
@@ -46,10 +48,21 @@ class ConnectionBoilerplate : public Connection {
   // Perform a write operation.
   void write(const void* ptr, size_t length, write_callback_fn fn) override;
   void write(const AbstractNopHolder& object, write_callback_fn fn) override;
+  void write(
+      const AbstractNopHolder& object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn) override;
+  void write(std::vector<WriteSegment> segments, write_callback_fn fn) override;
 
   // Tell the connection what its identifier is.
   void setId(std::string id) override;
 
+  // Schedule the writes against those of the other shaped connections.
+  void setWriteShaping(uint32_t weight, uint64_t maxBytesPerSecond) override;
+
+  // Obtain the traffic of the connection so far.
+  TransportStats getTransportStats() override;
+
   // Shut down the connection and its resources.
   void close() override;
 
@@ -126,11 +139,38 @@ void ConnectionBoilerplate<TCtx, TList, TConn>::write(
   impl_->write(object, std::move(fn));
 }
 
+template <typename TCtx, typename TList, typename TConn>
+void ConnectionBoilerplate<TCtx, TList, TConn>::write(
+    const AbstractNopHolder& object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  impl_->write(object, std::move(buffers), std::move(fn));
+}
+
+template <typename TCtx, typename TList, typename TConn>
+void ConnectionBoilerplate<TCtx, TList, TConn>::write(
+    std::vector<WriteSegment> segments,
+    write_callback_fn fn) {
+  impl_->write(std::move(segments), std::move(fn));
+}
+
 template <typename TCtx, typename TList, typename TConn>
 void ConnectionBoilerplate<TCtx, TList, TConn>::setId(std::string id) {
   impl_->setId(std::move(id));
 }
 
+template <typename TCtx, typename TList, typename TConn>
+void ConnectionBoilerplate<TCtx, TList, TConn>::setWriteShaping(
+    uint32_t weight,
+    uint64_t maxBytesPerSecond) {
+  impl_->setWriteShaping(weight, maxBytesPerSecond);
+}
+
+template <typename TCtx, typename TList, typename TConn>
+TransportStats ConnectionBoilerplate<TCtx, TList, TConn>::getTransportStats() {
+  return impl_->getTransportStats();
+}
+
 template <typename TCtx, typename TList, typename TConn>
 void ConnectionBoilerplate<TCtx, TList, TConn>::close() {
   impl_->close();
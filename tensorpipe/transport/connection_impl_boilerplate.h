@@ -8,16 +8,21 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
 #include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/trace.h>
+#include <tensorpipe/common/usdt.h>
 #include <tensorpipe/transport/connection.h>
 #include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/stats.h>
 
 namespace tensorpipe {
 namespace transport {
@@ -64,12 +69,27 @@ class ConnectionImplBoilerplate : public std::enable_shared_from_this<TConn> {
 
   // Perform a write operation.
   using write_callback_fn = Connection::write_callback_fn;
+  using WriteBuffer = Connection::WriteBuffer;
+  using WriteSegment = Connection::WriteSegment;
   void write(const void* ptr, size_t length, write_callback_fn fn);
   void write(const AbstractNopHolder& object, write_callback_fn fn);
+  void write(
+      const AbstractNopHolder& object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn);
+  void write(std::vector<WriteSegment> segments, write_callback_fn fn);
 
   // Tell the connection what its identifier is.
   void setId(std::string id);
 
+  // Have the context schedule the writes of the connection against those of
+  // the other shaped connections (see WriteScheduler), or stop if the weight is
+  // zero.
+  void setWriteShaping(uint32_t weight, uint64_t maxBytesPerSecond);
+
+  // Obtain the traffic of the connection so far (from any thread).
+  TransportStats getTransportStats() const;
+
   // Shut down the connection and its resources.
   void close();
 
@@ -92,8 +112,19 @@ class ConnectionImplBoilerplate : public std::enable_shared_from_this<TConn> {
   virtual void writeImplFromLoop(
       const AbstractNopHolder& object,
       write_callback_fn fn);
+  virtual void writeImplFromLoop(
+      const AbstractNopHolder& object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn);
+  virtual void writeImplFromLoop(
+      std::vector<WriteSegment> segments,
+      write_callback_fn fn);
   virtual void handleErrorImpl() = 0;
 
+  // Give back the memory that the connection isn't using right now, if it can,
+  // when asked by the context (see Context::reclaimMemory).
+  virtual void reclaimMemoryImplFromLoop() {}
+
   void setError(Error error);
 
   const std::shared_ptr<TCtx> context_;
@@ -105,6 +136,10 @@ class ConnectionImplBoilerplate : public std::enable_shared_from_this<TConn> {
   // only be used for logging and debugging purposes.
   std::string id_;
 
+  // The traffic of the connection, which also accounts for it in the context.
+  // The subclasses record the events specific to their transport here.
+  TransportStatsCounters statsCounters_;
+
  private:
   // Initialize member fields that need `shared_from_this`.
   void initFromLoop();
@@ -117,12 +152,30 @@ class ConnectionImplBoilerplate : public std::enable_shared_from_this<TConn> {
   // Perform a write operation.
   void writeFromLoop(const void* ptr, size_t length, write_callback_fn fn);
   void writeFromLoop(const AbstractNopHolder& object, write_callback_fn fn);
+  void writeFromLoop(
+      const AbstractNopHolder& object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn);
+  void writeFromLoop(std::vector<WriteSegment> segments, write_callback_fn fn);
 
   void setIdFromLoop(std::string id);
 
+  void setWriteShapingFromLoop(uint32_t weight, uint64_t maxBytesPerSecond);
+
+  // Hand a write over to the context's scheduler, which calls start with the
+  // connection and the callback once its turn has come.
+  template <typename TStart>
+  void scheduleWriteFromLoop(
+      size_t numBytes,
+      write_callback_fn fn,
+      TStart start);
+
   // Shut down the connection and its resources.
   void closeFromLoop();
 
+  // Give back the memory that isn't in use, unless the connection has failed.
+  void reclaimMemoryFromLoop();
+
   // Deal with an error.
   void handleError();
 
@@ -130,6 +183,8 @@ class ConnectionImplBoilerplate : public std::enable_shared_from_this<TConn> {
   uint64_t nextBufferBeingRead_{0};
   uint64_t nextBufferBeingWritten_{0};
 
+  bool isWriteShaped_{false};
+
   // Contexts and listeners do sometimes need to call directly into initFromLoop
   // and closeFromLoop, in order to make sure that some of their operations can
   // happen "atomically" on the connection, without possibly other operations
@@ -143,7 +198,9 @@ ConnectionImplBoilerplate<TCtx, TList, TConn>::ConnectionImplBoilerplate(
     ConstructorToken /* unused */,
     std::shared_ptr<TCtx> context,
     std::string id)
-    : context_(std::move(context)), id_(std::move(id)) {}
+    : context_(std::move(context)),
+      id_(std::move(id)),
+      statsCounters_(&context_->getStatsCounters()) {}
 
 template <typename TCtx, typename TList, typename TConn>
 void ConnectionImplBoilerplate<TCtx, TList, TConn>::init() {
@@ -178,14 +235,29 @@ void ConnectionImplBoilerplate<TCtx, TList, TConn>::readFromLoop(
     read_callback_fn fn) {
   TP_DCHECK(context_->inLoop());
 
+  TP_TRACE_SCOPE("tp::Connection::read");
   uint64_t sequenceNumber = nextBufferBeingRead_++;
   TP_VLOG(7) << "Connection " << id_ << " received a read request (#"
              << sequenceNumber << ")";
+  const uint64_t traceFlowId = TP_TRACE_NEW_FLOW_ID();
+  TP_TRACE_FLOW_START("tp::Connection::read", traceFlowId);
+  TP_USDT(connection__read__start, id_.c_str(), sequenceNumber, 0);
 
-  fn = [this, sequenceNumber, fn{std::move(fn)}](
+  fn = [this, sequenceNumber, traceFlowId, fn{std::move(fn)}](
            const Error& error, const void* ptr, size_t length) {
     TP_VLOG(7) << "Connection " << id_ << " is calling a read callback (#"
                << sequenceNumber << ")";
+    TP_TRACE_SCOPE("tp::Connection::readCallback");
+    TP_TRACE_FLOW_END("tp::Connection::read", traceFlowId);
+    TP_USDT(
+        connection__read__done,
+        id_.c_str(),
+        sequenceNumber,
+        length,
+        error ? 1 : 0);
+    if (!error) {
+      statsCounters_.recordRead(length);
+    }
     fn(error, ptr, length);
     TP_VLOG(7) << "Connection " << id_ << " done calling a read callback (#"
                << sequenceNumber << ")";
@@ -215,14 +287,32 @@ void ConnectionImplBoilerplate<TCtx, TList, TConn>::readFromLoop(
     read_nop_callback_fn fn) {
   TP_DCHECK(context_->inLoop());
 
+  TP_TRACE_SCOPE("tp::Connection::read");
   uint64_t sequenceNumber = nextBufferBeingRead_++;
   TP_VLOG(7) << "Connection " << id_ << " received a nop object read request (#"
              << sequenceNumber << ")";
+  const uint64_t traceFlowId = TP_TRACE_NEW_FLOW_ID();
+  TP_TRACE_FLOW_START("tp::Connection::read", traceFlowId);
+  TP_USDT(connection__read__start, id_.c_str(), sequenceNumber, 0);
 
-  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+  fn = [this, sequenceNumber, traceFlowId, &object, fn{std::move(fn)}](
+           const Error& error) {
     TP_VLOG(7) << "Connection " << id_
                << " is calling a nop object read callback (#" << sequenceNumber
                << ")";
+    TP_TRACE_SCOPE("tp::Connection::readCallback");
+    TP_TRACE_FLOW_END("tp::Connection::read", traceFlowId);
+    size_t numBytes = 0;
+    if (!error) {
+      numBytes = object.getSize();
+      statsCounters_.recordRead(numBytes);
+    }
+    TP_USDT(
+        connection__read__done,
+        id_.c_str(),
+        sequenceNumber,
+        numBytes,
+        error ? 1 : 0);
     fn(error);
     TP_VLOG(7) << "Connection " << id_
                << " done calling a nop object read callback (#"
@@ -273,14 +363,29 @@ void ConnectionImplBoilerplate<TCtx, TList, TConn>::readFromLoop(
     read_callback_fn fn) {
   TP_DCHECK(context_->inLoop());
 
+  TP_TRACE_SCOPE("tp::Connection::read");
   uint64_t sequenceNumber = nextBufferBeingRead_++;
   TP_VLOG(7) << "Connection " << id_ << " received a read request (#"
              << sequenceNumber << ")";
+  const uint64_t traceFlowId = TP_TRACE_NEW_FLOW_ID();
+  TP_TRACE_FLOW_START("tp::Connection::read", traceFlowId);
+  TP_USDT(connection__read__start, id_.c_str(), sequenceNumber, length);
 
-  fn = [this, sequenceNumber, fn{std::move(fn)}](
+  fn = [this, sequenceNumber, traceFlowId, fn{std::move(fn)}](
            const Error& error, const void* ptr, size_t length) {
     TP_VLOG(7) << "Connection " << id_ << " is calling a read callback (#"
                << sequenceNumber << ")";
+    TP_TRACE_SCOPE("tp::Connection::readCallback");
+    TP_TRACE_FLOW_END("tp::Connection::read", traceFlowId);
+    TP_USDT(
+        connection__read__done,
+        id_.c_str(),
+        sequenceNumber,
+        length,
+        error ? 1 : 0);
+    if (!error) {
+      statsCounters_.recordRead(length);
+    }
     fn(error, ptr, length);
     TP_VLOG(7) << "Connection " << id_ << " done calling a read callback (#"
                << sequenceNumber << ")";
@@ -314,13 +419,25 @@ void ConnectionImplBoilerplate<TCtx, TList, TConn>::writeFromLoop(
     write_callback_fn fn) {
   TP_DCHECK(context_->inLoop());
 
+  TP_TRACE_SCOPE("tp::Connection::write");
   uint64_t sequenceNumber = nextBufferBeingWritten_++;
   TP_VLOG(7) << "Connection " << id_ << " received a write request (#"
              << sequenceNumber << ")";
+  const uint64_t traceFlowId = TP_TRACE_NEW_FLOW_ID();
+  TP_TRACE_FLOW_START("tp::Connection::write", traceFlowId);
+  TP_USDT(connection__write__start, id_.c_str(), sequenceNumber, length);
 
-  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+  fn = [this, sequenceNumber, traceFlowId, length, fn{std::move(fn)}](
+           const Error& error) {
     TP_VLOG(7) << "Connection " << id_ << " is calling a write callback (#"
                << sequenceNumber << ")";
+    TP_TRACE_SCOPE("tp::Connection::writeCallback");
+    TP_TRACE_FLOW_END("tp::Connection::write", traceFlowId);
+    TP_USDT(
+        connection__write__done, id_.c_str(), sequenceNumber, error ? 1 : 0);
+    if (!error) {
+      statsCounters_.recordWrite(length);
+    }
     fn(error);
     TP_VLOG(7) << "Connection " << id_ << " done calling a write callback (#"
                << sequenceNumber << ")";
@@ -331,6 +448,16 @@ void ConnectionImplBoilerplate<TCtx, TList, TConn>::writeFromLoop(
     return;
   }
 
+  if (isWriteShaped_) {
+    scheduleWriteFromLoop(
+        length,
+        std::move(fn),
+        [ptr, length](ConnectionImplBoilerplate& impl, write_callback_fn fn) {
+          impl.writeImplFromLoop(ptr, length, std::move(fn));
+        });
+    return;
+  }
+
   writeImplFromLoop(ptr, length, std::move(fn));
 }
 
@@ -350,15 +477,28 @@ void ConnectionImplBoilerplate<TCtx, TList, TConn>::writeFromLoop(
     write_callback_fn fn) {
   TP_DCHECK(context_->inLoop());
 
+  TP_TRACE_SCOPE("tp::Connection::write");
   uint64_t sequenceNumber = nextBufferBeingWritten_++;
   TP_VLOG(7) << "Connection " << id_
              << " received a nop object write request (#" << sequenceNumber
              << ")";
+  const uint64_t traceFlowId = TP_TRACE_NEW_FLOW_ID();
+  TP_TRACE_FLOW_START("tp::Connection::write", traceFlowId);
+  const size_t numBytes = object.getSize();
+  TP_USDT(connection__write__start, id_.c_str(), sequenceNumber, numBytes);
 
-  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+  fn = [this, sequenceNumber, traceFlowId, numBytes, fn{std::move(fn)}](
+           const Error& error) {
     TP_VLOG(7) << "Connection " << id_
                << " is calling a nop object write callback (#" << sequenceNumber
                << ")";
+    TP_TRACE_SCOPE("tp::Connection::writeCallback");
+    TP_TRACE_FLOW_END("tp::Connection::write", traceFlowId);
+    TP_USDT(
+        connection__write__done, id_.c_str(), sequenceNumber, error ? 1 : 0);
+    if (!error) {
+      statsCounters_.recordWrite(numBytes);
+    }
     fn(error);
     TP_VLOG(7) << "Connection " << id_
                << " done calling a nop object write callback (#"
@@ -370,6 +510,16 @@ void ConnectionImplBoilerplate<TCtx, TList, TConn>::writeFromLoop(
     return;
   }
 
+  if (isWriteShaped_) {
+    scheduleWriteFromLoop(
+        numBytes,
+        std::move(fn),
+        [&object](ConnectionImplBoilerplate& impl, write_callback_fn fn) {
+          impl.writeImplFromLoop(object, std::move(fn));
+        });
+    return;
+  }
+
   writeImplFromLoop(object, std::move(fn));
 }
 
@@ -406,6 +556,201 @@ void ConnectionImplBoilerplate<TCtx, TList, TConn>::writeImplFromLoop(
       });
 }
 
+template <typename TCtx, typename TList, typename TConn>
+void ConnectionImplBoilerplate<TCtx, TList, TConn>::write(
+    const AbstractNopHolder& object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  context_->deferToLoop([impl{this->shared_from_this()},
+                         &object,
+                         buffers{std::move(buffers)},
+                         fn{std::move(fn)}]() mutable {
+    impl->writeFromLoop(object, std::move(buffers), std::move(fn));
+  });
+}
+
+template <typename TCtx, typename TList, typename TConn>
+void ConnectionImplBoilerplate<TCtx, TList, TConn>::writeFromLoop(
+    const AbstractNopHolder& object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  TP_TRACE_SCOPE("tp::Connection::write");
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_
+             << " received a nop object and buffers write request (#"
+             << sequenceNumber << ", " << buffers.size() << " buffers)";
+  const uint64_t traceFlowId = TP_TRACE_NEW_FLOW_ID();
+  TP_TRACE_FLOW_START("tp::Connection::write", traceFlowId);
+  size_t numBytes = object.getSize();
+  for (const WriteBuffer& buffer : buffers) {
+    numBytes += buffer.length;
+  }
+  TP_USDT(connection__write__start, id_.c_str(), sequenceNumber, numBytes);
+
+  fn = [this, sequenceNumber, traceFlowId, numBytes, fn{std::move(fn)}](
+           const Error& error) {
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a nop object and buffers write callback (#"
+               << sequenceNumber << ")";
+    TP_TRACE_SCOPE("tp::Connection::writeCallback");
+    TP_TRACE_FLOW_END("tp::Connection::write", traceFlowId);
+    TP_USDT(
+        connection__write__done, id_.c_str(), sequenceNumber, error ? 1 : 0);
+    if (!error) {
+      statsCounters_.recordWrite(numBytes);
+    }
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a nop object and buffers write callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  if (isWriteShaped_) {
+    scheduleWriteFromLoop(
+        numBytes,
+        std::move(fn),
+        [&object, buffers{std::move(buffers)}](
+            ConnectionImplBoilerplate& impl, write_callback_fn fn) mutable {
+          impl.writeImplFromLoop(object, std::move(buffers), std::move(fn));
+        });
+    return;
+  }
+
+  writeImplFromLoop(object, std::move(buffers), std::move(fn));
+}
+
+template <typename TCtx, typename TList, typename TConn>
+void ConnectionImplBoilerplate<TCtx, TList, TConn>::writeImplFromLoop(
+    const AbstractNopHolder& object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  // Write callbacks are fired in order and, once an error occurs, all pending
+  // and subsequent ones get it too. Hence we only need to forward the last one.
+  if (buffers.empty()) {
+    writeImplFromLoop(object, std::move(fn));
+    return;
+  }
+  writeImplFromLoop(object, [](const Error& /* unused */) {});
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    // A previous write may have failed, in which case the connection has been
+    // shut down and must not be used anymore.
+    if (error_) {
+      fn(error_);
+      return;
+    }
+    const WriteBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx + 1 < buffers.size()) {
+      writeImplFromLoop(
+          buffer.ptr, buffer.length, [](const Error& /* unused */) {});
+    } else {
+      writeImplFromLoop(buffer.ptr, buffer.length, std::move(fn));
+    }
+  }
+}
+
+template <typename TCtx, typename TList, typename TConn>
+void ConnectionImplBoilerplate<TCtx, TList, TConn>::write(
+    std::vector<WriteSegment> segments,
+    write_callback_fn fn) {
+  context_->deferToLoop([impl{this->shared_from_this()},
+                         segments{std::move(segments)},
+                         fn{std::move(fn)}]() mutable {
+    impl->writeFromLoop(std::move(segments), std::move(fn));
+  });
+}
+
+template <typename TCtx, typename TList, typename TConn>
+void ConnectionImplBoilerplate<TCtx, TList, TConn>::writeFromLoop(
+    std::vector<WriteSegment> segments,
+    write_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(!segments.empty());
+
+  TP_TRACE_SCOPE("tp::Connection::write");
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_
+             << " received a batched write request (#" << sequenceNumber
+             << ", " << segments.size() << " nop objects)";
+  const uint64_t traceFlowId = TP_TRACE_NEW_FLOW_ID();
+  TP_TRACE_FLOW_START("tp::Connection::write", traceFlowId);
+  size_t numBytes = 0;
+  for (const WriteSegment& segment : segments) {
+    numBytes += segment.object->getSize();
+    for (const WriteBuffer& buffer : segment.buffers) {
+      numBytes += buffer.length;
+    }
+  }
+  TP_USDT(connection__write__start, id_.c_str(), sequenceNumber, numBytes);
+
+  fn = [this, sequenceNumber, traceFlowId, numBytes, fn{std::move(fn)}](
+           const Error& error) {
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a batched write callback (#" << sequenceNumber
+               << ")";
+    TP_TRACE_SCOPE("tp::Connection::writeCallback");
+    TP_TRACE_FLOW_END("tp::Connection::write", traceFlowId);
+    TP_USDT(
+        connection__write__done, id_.c_str(), sequenceNumber, error ? 1 : 0);
+    if (!error) {
+      statsCounters_.recordWrite(numBytes);
+    }
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a batched write callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  if (isWriteShaped_) {
+    scheduleWriteFromLoop(
+        numBytes,
+        std::move(fn),
+        [segments{std::move(segments)}](
+            ConnectionImplBoilerplate& impl, write_callback_fn fn) mutable {
+          impl.writeImplFromLoop(std::move(segments), std::move(fn));
+        });
+    return;
+  }
+
+  writeImplFromLoop(std::move(segments), std::move(fn));
+}
+
+template <typename TCtx, typename TList, typename TConn>
+void ConnectionImplBoilerplate<TCtx, TList, TConn>::writeImplFromLoop(
+    std::vector<WriteSegment> segments,
+    write_callback_fn fn) {
+  // As above, only the last callback needs to be forwarded.
+  for (size_t segmentIdx = 0; segmentIdx < segments.size(); segmentIdx++) {
+    // A previous write may have failed, in which case the connection has been
+    // shut down and must not be used anymore.
+    if (error_) {
+      fn(error_);
+      return;
+    }
+    WriteSegment& segment = segments[segmentIdx];
+    if (segmentIdx + 1 < segments.size()) {
+      writeImplFromLoop(
+          *segment.object,
+          std::move(segment.buffers),
+          [](const Error& /* unused */) {});
+    } else {
+      writeImplFromLoop(
+          *segment.object, std::move(segment.buffers), std::move(fn));
+    }
+  }
+}
+
 template <typename TCtx, typename TList, typename TConn>
 void ConnectionImplBoilerplate<TCtx, TList, TConn>::setId(std::string id) {
   context_->deferToLoop(
@@ -422,6 +767,73 @@ void ConnectionImplBoilerplate<TCtx, TList, TConn>::setIdFromLoop(
   id_ = std::move(id);
 }
 
+template <typename TCtx, typename TList, typename TConn>
+void ConnectionImplBoilerplate<TCtx, TList, TConn>::setWriteShaping(
+    uint32_t weight,
+    uint64_t maxBytesPerSecond) {
+  context_->deferToLoop(
+      [impl{this->shared_from_this()}, weight, maxBytesPerSecond]() {
+        impl->setWriteShapingFromLoop(weight, maxBytesPerSecond);
+      });
+}
+
+template <typename TCtx, typename TList, typename TConn>
+void ConnectionImplBoilerplate<TCtx, TList, TConn>::setWriteShapingFromLoop(
+    uint32_t weight,
+    uint64_t maxBytesPerSecond) {
+  TP_DCHECK(context_->inLoop());
+  if (error_) {
+    return;
+  }
+  TP_VLOG(7) << "Connection " << id_ << " has its writes shaped with weight "
+             << weight << " and a cap of " << maxBytesPerSecond
+             << " bytes per second";
+  if (weight == 0) {
+    if (isWriteShaped_) {
+      isWriteShaped_ = false;
+      context_->getWriteScheduler().removeFlow(this);
+    }
+    return;
+  }
+  isWriteShaped_ = true;
+  context_->getWriteScheduler().setFlow(this, weight, maxBytesPerSecond);
+}
+
+template <typename TCtx, typename TList, typename TConn>
+template <typename TStart>
+void ConnectionImplBoilerplate<TCtx, TList, TConn>::scheduleWriteFromLoop(
+    size_t numBytes,
+    write_callback_fn fn,
+    TStart start) {
+  context_->getWriteScheduler().enqueue(
+      this,
+      numBytes,
+      [impl{this->shared_from_this()},
+       numBytes,
+       fn{std::move(fn)},
+       start{std::move(start)}]() mutable {
+        ConnectionImplBoilerplate& self = *impl;
+        write_callback_fn doneFn = [context{self.context_.get()},
+                                    numBytes,
+                                    fn{std::move(fn)}](const Error& error) {
+          context->getWriteScheduler().onWriteDone(numBytes);
+          fn(error);
+        };
+        // The connection may have failed while the write was held back.
+        if (self.error_) {
+          doneFn(self.error_);
+          return;
+        }
+        start(self, std::move(doneFn));
+      });
+}
+
+template <typename TCtx, typename TList, typename TConn>
+TransportStats ConnectionImplBoilerplate<TCtx, TList, TConn>::
+    getTransportStats() const {
+  return statsCounters_.snapshot();
+}
+
 template <typename TCtx, typename TList, typename TConn>
 void ConnectionImplBoilerplate<TCtx, TList, TConn>::close() {
   context_->deferToLoop(
@@ -435,6 +847,15 @@ void ConnectionImplBoilerplate<TCtx, TList, TConn>::closeFromLoop() {
   setError(TP_CREATE_ERROR(ConnectionClosedError));
 }
 
+template <typename TCtx, typename TList, typename TConn>
+void ConnectionImplBoilerplate<TCtx, TList, TConn>::reclaimMemoryFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  if (error_) {
+    return;
+  }
+  reclaimMemoryImplFromLoop();
+}
+
 template <typename TCtx, typename TList, typename TConn>
 void ConnectionImplBoilerplate<TCtx, TList, TConn>::setError(Error error) {
   // Don't overwrite an error that's already set.
@@ -453,6 +874,12 @@ void ConnectionImplBoilerplate<TCtx, TList, TConn>::handleError() {
   TP_VLOG(8) << "Connection " << id_ << " is handling error " << error_.what();
 
   handleErrorImpl();
+
+  // The writes held back fail in turn, after those already underway.
+  if (isWriteShaped_) {
+    isWriteShaped_ = false;
+    context_->getWriteScheduler().removeFlow(this);
+  }
 }
 
 } // namespace transport
@@ -0,0 +1,392 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/connection_multiplexer.h>
+
+#include <atomic>
+#include <cstring>
+#include <utility>
+
+#include <nop/serializer.h>
+#include <nop/structure.h>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/nop.h>
+#include <tensorpipe/transport/error.h>
+
+namespace tensorpipe {
+namespace transport {
+
+namespace {
+
+// Precedes the data of each write on a stream, which follows as a separate
+// buffer unless it's empty.
+struct Frame {
+  uint64_t streamId;
+  uint64_t length;
+  NOP_STRUCTURE(Frame, streamId, length);
+};
+
+} // namespace
+
+// One of the streams of a multiplexer, exposed as a regular connection. All its
+// methods defer to the multiplexer's loop, hence they're thread-safe.
+class MultiplexedConnection final : public Connection {
+ public:
+  MultiplexedConnection(
+      std::shared_ptr<ConnectionMultiplexer> multiplexer,
+      uint64_t streamId)
+      : multiplexer_(std::move(multiplexer)), streamId_(streamId) {}
+
+  void read(read_callback_fn fn) override {
+    readFrame([fn{std::move(fn)}](
+                  const Error& error, const uint8_t* ptr, size_t length) {
+      fn(error, ptr, length);
+    });
+  }
+
+  void read(void* ptr, size_t length, read_callback_fn fn) override {
+    readFrame([ptr, length, fn{std::move(fn)}](
+                  const Error& error,
+                  const uint8_t* framePtr,
+                  size_t frameLength) {
+      if (error) {
+        fn(error, ptr, length);
+        return;
+      }
+      if (frameLength != length) {
+        fn(TP_CREATE_ERROR(ShortReadError, length, frameLength), ptr, length);
+        return;
+      }
+      std::memcpy(ptr, framePtr, length);
+      fn(Error::kSuccess, ptr, length);
+    });
+  }
+
+  void write(const void* ptr, size_t length, write_callback_fn fn) override {
+    multiplexer_->loop_.deferToLoop(
+        [multiplexer{multiplexer_},
+         streamId{streamId_},
+         ptr,
+         length,
+         fn{std::move(fn)}]() mutable {
+          multiplexer->writeFromLoop(streamId, ptr, length, std::move(fn));
+        });
+  }
+
+  void read(AbstractNopHolder& object, read_nop_callback_fn fn) override {
+    readFrame([&object, fn{std::move(fn)}](
+                  const Error& error, const uint8_t* ptr, size_t length) {
+      if (error) {
+        fn(error);
+        return;
+      }
+      NopReader reader(ptr, length);
+      nop::Status<void> status = object.read(reader);
+      TP_THROW_ASSERT_IF(status.has_error())
+          << "Error reading nop object: " << status.GetErrorMessage();
+      fn(Error::kSuccess);
+    });
+  }
+
+  void write(const AbstractNopHolder& object, write_callback_fn fn) override {
+    write(object, {}, std::move(fn));
+  }
+
+  void write(
+      const AbstractNopHolder& object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn) override {
+    // The object is serialized right away, so that the frame can be written
+    // like any other buffer.
+    auto data = std::make_shared<std::vector<uint8_t>>(object.getSize());
+    NopWriter writer(data->data(), data->size());
+    nop::Status<void> status = object.write(writer);
+    TP_THROW_ASSERT_IF(status.has_error())
+        << "Error writing nop object: " << status.GetErrorMessage();
+    multiplexer_->loop_.deferToLoop(
+        [multiplexer{multiplexer_},
+         streamId{streamId_},
+         data{std::move(data)},
+         buffers{std::move(buffers)},
+         fn{std::move(fn)}]() mutable {
+          // Write callbacks are fired in order and, once an error occurs, all
+          // the subsequent ones get it too. Hence only the last one matters.
+          multiplexer->writeFromLoop(
+              streamId,
+              data->data(),
+              data->size(),
+              buffers.empty()
+                  ? write_callback_fn(
+                        [data, fn{std::move(fn)}](const Error& error) {
+                          fn(error);
+                        })
+                  : write_callback_fn([data](const Error& /* unused */) {}));
+          for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+            const WriteBuffer& buffer = buffers[bufferIdx];
+            multiplexer->writeFromLoop(
+                streamId,
+                buffer.ptr,
+                buffer.length,
+                bufferIdx + 1 < buffers.size()
+                    ? write_callback_fn([](const Error& /* unused */) {})
+                    : std::move(fn));
+          }
+        });
+  }
+
+  void setId(std::string id) override {
+    TP_VLOG(7) << "Multiplexed connection " << id_ << " was renamed to " << id;
+    id_ = std::move(id);
+  }
+
+  void close() override {
+    if (closed_) {
+      return;
+    }
+    closed_ = true;
+    multiplexer_->loop_.deferToLoop(
+        [multiplexer{multiplexer_}, streamId{streamId_}]() {
+          multiplexer->closeStreamFromLoop(streamId);
+        });
+  }
+
+  ~MultiplexedConnection() override {
+    close();
+  }
+
+ private:
+  const std::shared_ptr<ConnectionMultiplexer> multiplexer_;
+  const uint64_t streamId_;
+  std::atomic<bool> closed_{false};
+  std::string id_{"N/A"};
+
+  void readFrame(ConnectionMultiplexer::TReadFn fn) {
+    multiplexer_->loop_.deferToLoop([multiplexer{multiplexer_},
+                                     streamId{streamId_},
+                                     fn{std::move(fn)}]() mutable {
+      multiplexer->readFromLoop(streamId, std::move(fn));
+    });
+  }
+};
+
+ConnectionMultiplexer::ConnectionMultiplexer(
+    std::shared_ptr<Connection> connection)
+    : connection_(std::move(connection)) {}
+
+void ConnectionMultiplexer::init() {
+  loop_.deferToLoop(
+      [multiplexer{shared_from_this()}]() { multiplexer->initFromLoop(); });
+}
+
+void ConnectionMultiplexer::initFromLoop() {
+  TP_DCHECK(loop_.inLoop());
+  readNextFrameFromLoop();
+}
+
+std::shared_ptr<Connection> ConnectionMultiplexer::openStream(
+    uint64_t streamId) {
+  loop_.runInLoop([&]() {
+    Stream& stream = streams_[streamId];
+    TP_DCHECK(!stream.opened);
+    stream.opened = true;
+    ++numOpenStreams_;
+  });
+  return std::make_shared<MultiplexedConnection>(shared_from_this(), streamId);
+}
+
+void ConnectionMultiplexer::setId(std::string id) {
+  loop_.deferToLoop(
+      [multiplexer{shared_from_this()}, id{std::move(id)}]() mutable {
+        TP_VLOG(7) << "Connection multiplexer " << multiplexer->id_
+                   << " was renamed to " << id;
+        multiplexer->id_ = std::move(id);
+      });
+}
+
+void ConnectionMultiplexer::close() {
+  loop_.deferToLoop([multiplexer{shared_from_this()}]() {
+    multiplexer->setErrorFromLoop(TP_CREATE_ERROR(ConnectionClosedError));
+  });
+}
+
+void ConnectionMultiplexer::readNextFrameFromLoop() {
+  TP_DCHECK(loop_.inLoop());
+  auto nopHolderIn = std::make_shared<NopHolder<Frame>>();
+  connection_->read(
+      *nopHolderIn,
+      [multiplexer{shared_from_this()}, nopHolderIn](const Error& error) {
+        multiplexer->loop_.deferToLoop([multiplexer, nopHolderIn, error]() {
+          if (error) {
+            multiplexer->setErrorFromLoop(error);
+            return;
+          }
+          const Frame& frame = nopHolderIn->getObject();
+          if (frame.length == 0) {
+            multiplexer->onReadOfFrameFromLoop(frame.streamId, {});
+          } else {
+            // The data is copied out in the callback, as the pointer it gets is
+            // only valid until it returns. The reads complete in order, hence
+            // the next frame can be asked for right away.
+            multiplexer->connection_->read(
+                [multiplexer, streamId{frame.streamId}](
+                    const Error& error, const void* ptr, size_t length) {
+                  std::vector<uint8_t> data;
+                  if (!error) {
+                    const uint8_t* bytes =
+                        reinterpret_cast<const uint8_t*>(ptr);
+                    data.assign(bytes, bytes + length);
+                  }
+                  multiplexer->loop_.deferToLoop(
+                      [multiplexer,
+                       streamId,
+                       error,
+                       data{std::move(data)}]() mutable {
+                        if (error) {
+                          multiplexer->setErrorFromLoop(error);
+                          return;
+                        }
+                        multiplexer->onReadOfFrameFromLoop(
+                            streamId, std::move(data));
+                      });
+                });
+          }
+          if (!multiplexer->error_) {
+            multiplexer->readNextFrameFromLoop();
+          }
+        });
+      });
+}
+
+void ConnectionMultiplexer::onReadOfFrameFromLoop(
+    uint64_t streamId,
+    std::vector<uint8_t> data) {
+  TP_DCHECK(loop_.inLoop());
+  if (error_) {
+    return;
+  }
+  Stream& stream = streams_[streamId];
+  if (stream.closed) {
+    return;
+  }
+  stream.frames.push_back(std::move(data));
+  deliverFramesFromLoop(stream);
+}
+
+void ConnectionMultiplexer::deliverFramesFromLoop(Stream& stream) {
+  TP_DCHECK(loop_.inLoop());
+  while (!stream.frames.empty() && !stream.readOperations.empty()) {
+    std::vector<uint8_t> data = std::move(stream.frames.front());
+    stream.frames.pop_front();
+    TReadFn fn = std::move(stream.readOperations.front());
+    stream.readOperations.pop_front();
+    fn(Error::kSuccess, data.data(), data.size());
+  }
+}
+
+void ConnectionMultiplexer::readFromLoop(uint64_t streamId, TReadFn fn) {
+  TP_DCHECK(loop_.inLoop());
+  Stream& stream = streams_[streamId];
+  TP_DCHECK(stream.opened);
+  if (error_) {
+    fn(error_, nullptr, 0);
+    return;
+  }
+  if (stream.closed) {
+    fn(TP_CREATE_ERROR(ConnectionClosedError), nullptr, 0);
+    return;
+  }
+  stream.readOperations.push_back(std::move(fn));
+  deliverFramesFromLoop(stream);
+}
+
+void ConnectionMultiplexer::writeFromLoop(
+    uint64_t streamId,
+    const void* ptr,
+    size_t length,
+    Connection::write_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+  const Stream& stream = streams_[streamId];
+  TP_DCHECK(stream.opened);
+  if (error_) {
+    fn(error_);
+    return;
+  }
+  if (stream.closed) {
+    fn(TP_CREATE_ERROR(ConnectionClosedError));
+    return;
+  }
+
+  auto nopHolderOut = std::make_shared<NopHolder<Frame>>();
+  Frame& frame = nopHolderOut->getObject();
+  frame.streamId = streamId;
+  frame.length = length;
+  std::vector<Connection::WriteBuffer> buffers;
+  if (length > 0) {
+    buffers.push_back({ptr, length});
+  }
+  connection_->write(
+      *nopHolderOut,
+      std::move(buffers),
+      [multiplexer{shared_from_this()}, nopHolderOut, fn{std::move(fn)}](
+          const Error& error) mutable {
+        multiplexer->loop_.deferToLoop(
+            [multiplexer, error, fn{std::move(fn)}]() mutable {
+              multiplexer->setErrorFromLoop(error);
+              fn(error);
+            });
+      });
+}
+
+void ConnectionMultiplexer::closeStreamFromLoop(uint64_t streamId) {
+  TP_DCHECK(loop_.inLoop());
+  Stream& stream = streams_[streamId];
+  TP_DCHECK(stream.opened);
+  if (stream.closed) {
+    return;
+  }
+  stream.closed = true;
+  stream.frames.clear();
+  while (!stream.readOperations.empty()) {
+    TReadFn fn = std::move(stream.readOperations.front());
+    stream.readOperations.pop_front();
+    fn(TP_CREATE_ERROR(ConnectionClosedError), nullptr, 0);
+  }
+  TP_DCHECK_GT(numOpenStreams_, 0);
+  if (--numOpenStreams_ == 0) {
+    TP_VLOG(7) << "Connection multiplexer " << id_
+               << " is closing as all its streams are closed";
+    setErrorFromLoop(TP_CREATE_ERROR(ConnectionClosedError));
+  }
+}
+
+void ConnectionMultiplexer::setErrorFromLoop(Error error) {
+  TP_DCHECK(loop_.inLoop());
+  // Don't overwrite an error that's already set.
+  if (error_ || !error) {
+    return;
+  }
+  error_ = std::move(error);
+  TP_VLOG(7) << "Connection multiplexer " << id_ << " is handling error "
+             << error_.what();
+
+  connection_->close();
+  for (auto& iter : streams_) {
+    Stream& stream = iter.second;
+    stream.frames.clear();
+    while (!stream.readOperations.empty()) {
+      TReadFn fn = std::move(stream.readOperations.front());
+      stream.readOperations.pop_front();
+      fn(error_, nullptr, 0);
+    }
+  }
+}
+
+} // namespace transport
+} // namespace tensorpipe
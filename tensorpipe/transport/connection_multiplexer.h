@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <tensorpipe/common/deferred_executor.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/transport/connection.h>
+
+namespace tensorpipe {
+namespace transport {
+
+class MultiplexedConnection;
+
+// Carries several connections (the "streams", each identified by a number that
+// both ends agree upon) over a single underlying connection, of any transport,
+// so that they only cost one socket, ringbuffer, etc. Each write on a stream is
+// sent as a frame, addressed to that stream, and the frames are read as soon
+// as they come in and kept aside until the stream's user reads them. This way
+// a stream whose user isn't reading doesn't hold the other ones back, at the
+// cost of a copy. Hence this is meant for connections that carry small control
+// messages, rather than bulk data.
+//
+// When all the streams have been closed, or when the underlying connection
+// fails, the underlying connection is closed and so are all the streams.
+class ConnectionMultiplexer final
+    : public std::enable_shared_from_this<ConnectionMultiplexer> {
+ public:
+  explicit ConnectionMultiplexer(std::shared_ptr<Connection> connection);
+
+  ConnectionMultiplexer(const ConnectionMultiplexer&) = delete;
+  ConnectionMultiplexer(ConnectionMultiplexer&&) = delete;
+  ConnectionMultiplexer& operator=(const ConnectionMultiplexer&) = delete;
+  ConnectionMultiplexer& operator=(ConnectionMultiplexer&&) = delete;
+
+  // Start reading the frames from the underlying connection. Must be called
+  // once, right after construction.
+  void init();
+
+  // Return the connection for the given stream, which must not have been opened
+  // yet. The data that the peer sends to the stream before it's opened is kept.
+  std::shared_ptr<Connection> openStream(uint64_t streamId);
+
+  // Tell the multiplexer what its identifier is. It will only be used for
+  // logging and debugging purposes.
+  void setId(std::string id);
+
+  void close();
+
+ private:
+  // Consume the data of a frame (in the form of a pointer and a length) or, if
+  // the error is set, fail because no data will ever come.
+  using TReadFn = MoveOnlyFunction<
+      void(const Error& error, const uint8_t* ptr, size_t length)>;
+
+  struct Stream {
+    bool opened{false};
+    bool closed{false};
+    std::deque<std::vector<uint8_t>> frames;
+    std::deque<TReadFn> readOperations;
+  };
+
+  OnDemandDeferredExecutor loop_;
+  const std::shared_ptr<Connection> connection_;
+  std::unordered_map<uint64_t, Stream> streams_;
+  size_t numOpenStreams_{0};
+  Error error_{Error::kSuccess};
+
+  // An identifier for the multiplexer, composed of the identifier of the pipe
+  // or channel that owns it. It will only be used for logging and debugging.
+  std::string id_{"N/A"};
+
+  void initFromLoop();
+  void readNextFrameFromLoop();
+  void onReadOfFrameFromLoop(uint64_t streamId, std::vector<uint8_t> data);
+  void deliverFramesFromLoop(Stream& stream);
+
+  void readFromLoop(uint64_t streamId, TReadFn fn);
+  void writeFromLoop(
+      uint64_t streamId,
+      const void* ptr,
+      size_t length,
+      Connection::write_callback_fn fn);
+  void closeStreamFromLoop(uint64_t streamId);
+
+  void setErrorFromLoop(Error error);
+
+  friend MultiplexedConnection;
+};
+
+} // namespace transport
+} // namespace tensorpipe
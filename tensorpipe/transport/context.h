@@ -8,8 +8,14 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
 #include <string>
+#include <utility>
+
+#include <tensorpipe/common/loop_stats.h>
+#include <tensorpipe/common/memory_footprint.h>
+#include <tensorpipe/transport/stats.h>
 
 namespace tensorpipe {
 namespace transport {
@@ -21,6 +27,16 @@ class Context {
  public:
   virtual std::shared_ptr<Connection> connect(std::string addr) = 0;
 
+  // Open a connection to be handled by the loop, or NIC, closest to the given
+  // NUMA node, for contexts that have several of them on different nodes, or
+  // by the one that connect would pick if the node is -1. The others ignore
+  // the node.
+  virtual std::shared_ptr<Connection> connectOnNumaNode(
+      std::string addr,
+      int /* unused */) {
+    return connect(std::move(addr));
+  }
+
   virtual std::shared_ptr<Listener> listen(std::string addr) = 0;
 
   // Return whether the context is able to operate correctly.
@@ -53,6 +69,33 @@ class Context {
   // channel contexts. It will only used for logging and debugging purposes.
   virtual void setId(std::string id) = 0;
 
+  // Start gathering the statistics of the event loops of the context, which
+  // the high-level context does when it collects statistics itself.
+  virtual void enableLoopStats() {}
+
+  // Return a snapshot of the statistics of each of the event loops of this
+  // context, by name. Contexts without loops of their own have none.
+  virtual std::map<std::string, LoopStats> getLoopStats() {
+    return {};
+  }
+
+  // Return a snapshot of the traffic of all the connections of this context,
+  // past and present.
+  virtual TransportStats getTransportStats() {
+    return TransportStats();
+  }
+
+  // Return a snapshot of the memory held by this context and its connections,
+  // by kind.
+  virtual MemoryFootprint getMemoryFootprint() {
+    return MemoryFootprint();
+  }
+
+  // Give back the memory that isn't in use right now (e.g., the inboxes of the
+  // connections that are idle), as the high-level context does when it goes
+  // over its soft limit. This is done asynchronously, in background.
+  virtual void reclaimMemory() {}
+
   virtual void close() = 0;
 
   virtual void join() = 0;
@@ -16,8 +16,11 @@
 #include <utility>
 
 #include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/memory_footprint.h>
 #include <tensorpipe/transport/connection_boilerplate.h>
 #include <tensorpipe/transport/listener_boilerplate.h>
+#include <tensorpipe/transport/stats.h>
+#include <tensorpipe/transport/write_scheduler.h>
 
 namespace tensorpipe {
 namespace transport {
@@ -57,6 +60,26 @@ class ContextImplBoilerplate : public virtual DeferredExecutor,
 
   void setId(std::string id);
 
+  // The counters of the traffic of all the connections of this context, which
+  // connections and transport-specific components record into.
+  TransportStatsCounters& getStatsCounters();
+
+  TransportStats getTransportStats() const;
+
+  // The memory held by this context and its connections, which they account
+  // for here as they allocate and release it.
+  MemoryFootprintCounters& getMemoryFootprintCounters();
+
+  MemoryFootprint getMemoryFootprint() const;
+
+  // The scheduler of the writes of the connections that are shaped (see
+  // Connection::setWriteShaping). To be used from within the loop.
+  WriteScheduler& getWriteScheduler();
+
+  // Have the connections, and then the context itself, give back the memory
+  // that they aren't using right now.
+  void reclaimMemory();
+
   void close();
 
   void join();
@@ -66,6 +89,7 @@ class ContextImplBoilerplate : public virtual DeferredExecutor,
  protected:
   virtual void closeImpl() = 0;
   virtual void joinImpl() = 0;
+  virtual void reclaimMemoryImpl() {}
 
   // An identifier for the context, composed of the identifier for the context,
   // combined with the transport's name. It will only be used for logging and
@@ -84,6 +108,12 @@ class ContextImplBoilerplate : public virtual DeferredExecutor,
   std::atomic<uint64_t> listenerCounter_{0};
   std::atomic<uint64_t> connectionCounter_{0};
 
+  TransportStatsCounters statsCounters_;
+
+  MemoryFootprintCounters memoryFootprintCounters_;
+
+  WriteScheduler writeScheduler_{*this};
+
   // Store shared_ptrs to dependent objects that have enrolled themselves to
   // keep them alive. We use a map, indexed by raw pointers, rather than a set
   // of shared_ptrs so that we can erase objects without them having to create
@@ -174,6 +204,52 @@ void ContextImplBoilerplate<TCtx, TList, TConn>::setId(std::string id) {
   id_ = std::move(id);
 }
 
+template <typename TCtx, typename TList, typename TConn>
+TransportStatsCounters& ContextImplBoilerplate<TCtx, TList, TConn>::
+    getStatsCounters() {
+  return statsCounters_;
+}
+
+template <typename TCtx, typename TList, typename TConn>
+TransportStats ContextImplBoilerplate<TCtx, TList, TConn>::getTransportStats()
+    const {
+  return statsCounters_.snapshot();
+}
+
+template <typename TCtx, typename TList, typename TConn>
+MemoryFootprintCounters& ContextImplBoilerplate<TCtx, TList, TConn>::
+    getMemoryFootprintCounters() {
+  return memoryFootprintCounters_;
+}
+
+template <typename TCtx, typename TList, typename TConn>
+MemoryFootprint ContextImplBoilerplate<TCtx, TList, TConn>::
+    getMemoryFootprint() const {
+  return memoryFootprintCounters_.snapshot();
+}
+
+template <typename TCtx, typename TList, typename TConn>
+WriteScheduler& ContextImplBoilerplate<TCtx, TList, TConn>::
+    getWriteScheduler() {
+  return writeScheduler_;
+}
+
+template <typename TCtx, typename TList, typename TConn>
+void ContextImplBoilerplate<TCtx, TList, TConn>::reclaimMemory() {
+  deferToLoop([this, impl{this->shared_from_this()}]() {
+    if (closed_) {
+      return;
+    }
+    TP_VLOG(7) << "Transport context " << id_ << " is reclaiming memory";
+    // Make a copy as they could unenroll themselves inline.
+    auto connectionsCopy = connections_;
+    for (auto& iter : connectionsCopy) {
+      iter.second->reclaimMemoryFromLoop();
+    }
+    reclaimMemoryImpl();
+  });
+}
+
 template <typename TCtx, typename TList, typename TConn>
 void ContextImplBoilerplate<TCtx, TList, TConn>::close() {
   // Defer this to the loop so that it won't race with other code accessing it
@@ -219,6 +295,9 @@ void ContextImplBoilerplate<TCtx, TList, TConn>::join() {
     deferToLoop([&]() { hasClosed.set_value(); });
     hasClosed.get_future().wait();
 
+    // Its timers defer to the loop, which must thus outlive them.
+    writeScheduler_.join();
+
     joinImpl();
 
     TP_VLOG(7) << "Transport context " << id_ << " done joining";
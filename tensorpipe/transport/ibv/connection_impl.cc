@@ -9,8 +9,14 @@
 #include <tensorpipe/transport/ibv/connection_impl.h>
 
 #include <string.h>
+#include <sys/mman.h>
 
+#include <algorithm>
+#include <array>
 #include <deque>
+#include <limits>
+#include <string>
+#include <tuple>
 #include <vector>
 
 #include <tensorpipe/common/callback.h>
@@ -21,7 +27,9 @@
 #include <tensorpipe/common/memory.h>
 #include <tensorpipe/common/ringbuffer_read_write_ops.h>
 #include <tensorpipe/common/socket.h>
+#include <tensorpipe/common/system.h>
 #include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/ibv/constants.h>
 #include <tensorpipe/transport/ibv/context_impl.h>
 #include <tensorpipe/transport/ibv/error.h>
 #include <tensorpipe/transport/ibv/reactor.h>
@@ -43,18 +51,118 @@ namespace {
 // assign a special ID to those types of requests, to match them later on.
 constexpr uint64_t kWriteRequestId = 1;
 constexpr uint64_t kAckRequestId = 2;
+constexpr uint64_t kRendezvousRequestId = 3;
+constexpr uint64_t kRendezvousDataId = 4;
+constexpr uint64_t kEagerRequestId = 5;
+
+// The immediate data of the RDMA writes into the inbox is their length, which
+// is bounded by the size of the ringbuffer. Hence we can use the upper bits to
+// flag the writes that are part of a rendezvous instead: either the receiver
+// writing into the sender's mailbox, or the sender writing the data into its
+// destination.
+constexpr uint32_t kRendezvousRequestImm = 1u << 31;
+constexpr uint32_t kRendezvousDataImm = 1u << 30;
+static_assert(
+    kMaxBufferSize < kRendezvousDataImm,
+    "The length of RDMA writes into the inbox must not collide with the flags");
+
+// The RDMA writes into the inbox may also acknowledge data that was read from
+// this side's inbox, sparing a send request, when both lengths fit together in
+// the immediate data: the two flags are then set, the acknowledged length goes
+// into the middle bits and the length of the write into the lowest ones.
+constexpr uint32_t kPiggybackedAckImm =
+    kRendezvousRequestImm | kRendezvousDataImm;
+constexpr int kPiggybackedLengthBits = 15;
+constexpr uint32_t kMaxPiggybackedLength = (1u << kPiggybackedLengthBits) - 1;
+static_assert(
+    (kMaxPiggybackedLength << kPiggybackedLengthBits | kMaxPiggybackedLength) <
+        kRendezvousDataImm,
+    "The piggybacked lengths must not collide with the flags");
+
+// Stands for an eager message among the lengths of the RDMA writes of a lane
+// that are waiting to be committed, which are bounded by the ringbuffer size.
+constexpr uint32_t kEagerMessageMarker = std::numeric_limits<uint32_t>::max();
+static_assert(
+    kMaxBufferSize < kEagerMessageMarker,
+    "The lengths of RDMA writes into the inbox must not collide with it");
+
+// If the ringbuffer is made of whole huge pages use them if any is available,
+// as that spares TLB misses to the reactor and entries of the translation table
+// to the device. If a NUMA node is given, place the memory on it, before it's
+// first touched (by its registration with the device).
+std::tuple<Error, MmappedPtr> allocateRingBufferMemory(
+    size_t size,
+    int numaNode) {
+  Error error;
+  MmappedPtr ptr;
+  std::tie(error, ptr) =
+      MmappedPtr::createOnHugePages(size, PROT_READ | PROT_WRITE);
+  if (error) {
+    TP_VLOG(6) << "Couldn't allocate a ringbuffer backed by huge pages, "
+               << "falling back to regular ones (" << error.what() << ")";
+  }
+  if (ptr.ptr() == nullptr) {
+    std::tie(error, ptr) = MmappedPtr::create(
+        size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1);
+    if (error) {
+      return std::make_tuple(std::move(error), MmappedPtr());
+    }
+  }
+  if (numaNode >= 0) {
+    error = bindMemoryToNumaNode(ptr.ptr(), size, numaNode);
+    TP_LOG_WARNING_IF(error) << "Couldn't place a ringbuffer on NUMA node "
+                             << numaNode << ": " << error.what();
+  }
+  return std::make_tuple(Error::kSuccess, std::move(ptr));
+}
+
+// The largest amount of data that a single RDMA write of a rendezvous carries.
+// The hardware usually caps this at 2GiB.
+constexpr size_t kMaxRendezvousWriteSize = 1 << 30;
 
 // The data that each queue pair endpoint needs to send to the other endpoint in
 // order to set up the queue pair itself. This data is transferred over a TCP
 // connection.
 struct Exchange {
-  IbvSetupInformation setupInfo;
+  uint32_t numLanes;
+  std::array<IbvSetupInformation, kMaxNumLanes> setupInfo;
   uint64_t memoryRegionPtr;
   uint32_t memoryRegionKey;
+  uint64_t memoryRegionSize;
+  uint64_t mailboxPtr;
+  uint32_t mailboxKey;
 };
 
+// The types of the messages through which the two ends of an established
+// connection agree to reclaim the memory of an idle inbox (see
+// handleIdleMessageFromLoop).
+constexpr uint32_t kParkRequest = 1;
+constexpr uint32_t kParkAccepted = 2;
+constexpr uint32_t kParkDeclined = 3;
+constexpr uint32_t kWakeRequest = 4;
+constexpr uint32_t kResume = 5;
+
+// Hand the memory of a deregistered ringbuffer back to the system. It's zeroed
+// out when it's touched again, by its next registration.
+void releaseRingBufferMemory(MmappedPtr& ptr, const std::string& id) {
+  int rv = ::madvise(ptr.ptr(), ptr.getLength(), MADV_DONTNEED);
+  if (rv < 0) {
+    // Huge pages only support this since Linux 5.18, otherwise the memory is
+    // still unpinned.
+    TP_VLOG(6) << "Connection " << id
+               << " couldn't release the memory of a ringbuffer: "
+               << TP_CREATE_ERROR(SystemError, "madvise", errno).what();
+  }
+}
+
 } // namespace
 
+struct ConnectionImpl::IdleMessage {
+  uint32_t type;
+  // For resume messages, the new key of the inbox.
+  uint32_t key;
+};
+
 ConnectionImpl::ConnectionImpl(
     ConstructorToken token,
     std::shared_ptr<ContextImpl> context,
@@ -79,6 +187,7 @@ ConnectionImpl::ConnectionImpl(
 
 void ConnectionImpl::initImplFromLoop() {
   context_->enroll(*this);
+  context_->onConnectionOpened();
 
   Error error;
   // The connection either got a socket or an address, but not both.
@@ -110,55 +219,72 @@ void ConnectionImpl::initImplFromLoop() {
   }
 
   // Create ringbuffer for inbox.
-  std::tie(error, inboxBuf_) = MmappedPtr::create(
-      kBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1);
+  inboxHeader_ = std::make_unique<util::ringbuffer::RingBufferHeader>(
+      context_->getBufferSize());
+  std::tie(error, inboxBuf_) = allocateRingBufferMemory(
+      inboxHeader_->kDataPoolByteSize, context_->getNumaNode());
   TP_THROW_ASSERT_IF(error)
       << "Couldn't allocate ringbuffer for connection inbox: " << error.what();
-  inboxRb_ = util::ringbuffer::RingBuffer(&inboxHeader_, inboxBuf_.ptr());
+  inboxRb_ = util::ringbuffer::RingBuffer(inboxHeader_.get(), inboxBuf_.ptr());
   inboxMr_ = createIbvMemoryRegion(
       context_->getReactor().getIbvLib(),
       context_->getReactor().getIbvPd(),
       inboxBuf_.ptr(),
-      kBufferSize,
+      inboxHeader_->kDataPoolByteSize,
       IbvLib::ACCESS_LOCAL_WRITE | IbvLib::ACCESS_REMOTE_WRITE);
+  inboxMemoryCharge_ = chargeRegisteredMemory(inboxHeader_->kDataPoolByteSize);
 
-  // Create ringbuffer for outbox.
-  std::tie(error, outboxBuf_) = MmappedPtr::create(
-      kBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1);
-  TP_THROW_ASSERT_IF(error)
-      << "Couldn't allocate ringbuffer for connection outbox: " << error.what();
-  outboxRb_ = util::ringbuffer::RingBuffer(&outboxHeader_, outboxBuf_.ptr());
-  outboxMr_ = createIbvMemoryRegion(
+  // The outbox is created once we know the size of the peer's inbox.
+
+  // Create the mailbox for rendezvous requests.
+  rendezvousBuf_ = std::make_unique<RendezvousRequest[]>(2);
+  rendezvousMr_ = createIbvMemoryRegion(
       context_->getReactor().getIbvLib(),
       context_->getReactor().getIbvPd(),
-      outboxBuf_.ptr(),
-      kBufferSize,
-      0);
+      rendezvousBuf_.get(),
+      2 * sizeof(RendezvousRequest),
+      IbvLib::ACCESS_LOCAL_WRITE | IbvLib::ACCESS_REMOTE_WRITE);
 
-  // Create and init queue pair.
-  {
+  // Create and init queue pairs.
+  lanes_.resize(context_->getReactor().getNumLanesForNewConnection(
+      context_->getNumLanes()));
+  for (Lane& lane : lanes_) {
     IbvLib::qp_init_attr initAttr;
     std::memset(&initAttr, 0, sizeof(initAttr));
     initAttr.qp_type = IbvLib::QPT_RC;
     initAttr.send_cq = context_->getReactor().getIbvCq().get();
     initAttr.recv_cq = context_->getReactor().getIbvCq().get();
-    initAttr.cap.max_send_wr = kNumPendingWriteReqs;
+    initAttr.cap.max_send_wr = context_->getReactor().getSendQueueCapacity();
     initAttr.cap.max_send_sge = 1;
+    initAttr.cap.max_inline_data = kMaxInlineDataSize;
     initAttr.srq = context_->getReactor().getIbvSrq().get();
-    initAttr.sq_sig_all = 1;
-    qp_ = createIbvQueuePair(
+    // The reactor decides which requests are signaled.
+    initAttr.sq_sig_all = 0;
+    // Devices reject the queue pair if they can't inline as much data as we
+    // ask for, hence halve it until they accept it, down to no inlining.
+    IbvLib& ibvLib = context_->getReactor().getIbvLib();
+    IbvLib::qp* qp;
+    while (true) {
+      qp = ibvLib.create_qp(context_->getReactor().getIbvPd().get(), &initAttr);
+      if (qp != nullptr || initAttr.cap.max_inline_data == 0) {
+        break;
+      }
+      initAttr.cap.max_inline_data /= 2;
+    }
+    TP_THROW_SYSTEM_IF(qp == nullptr, errno);
+    lane.qp = IbvQueuePair(qp, IbvQueuePairDeleter{&ibvLib});
+    transitionIbvQueuePairToInit(
         context_->getReactor().getIbvLib(),
-        context_->getReactor().getIbvPd(),
-        initAttr);
+        lane.qp,
+        context_->getReactor().getIbvAddress());
+
+    // Register methods to be called when our peer writes to our inbox and
+    // reads from our outbox. Creating the queue pair updated its capabilities
+    // with the values that the device actually granted.
+    lane.maxInlineData = initAttr.cap.max_inline_data;
+    context_->getReactor().registerQp(
+        lane.qp->qp_num, initAttr.cap.max_inline_data, shared_from_this());
   }
-  transitionIbvQueuePairToInit(
-      context_->getReactor().getIbvLib(),
-      qp_,
-      context_->getReactor().getIbvAddress());
-
-  // Register methods to be called when our peer writes to our inbox and reads
-  // from our outbox.
-  context_->getReactor().registerQp(qp_->qp_num, shared_from_this());
 
   // We're sending address first, so wait for writability.
   state_ = SEND_ADDR;
@@ -167,6 +293,8 @@ void ConnectionImpl::initImplFromLoop() {
 
 void ConnectionImpl::readImplFromLoop(read_callback_fn fn) {
   readOperations_.emplace_back(std::move(fn));
+  readOperations_.back().setBufferPool(&readBufferPool_);
+  readOperations_.back().setRendezvousThreshold(kRendezvousThreshold);
 
   // If the inbox already contains some data, we may be able to process this
   // operation right away.
@@ -193,6 +321,7 @@ void ConnectionImpl::readImplFromLoop(
     size_t length,
     read_callback_fn fn) {
   readOperations_.emplace_back(ptr, length, std::move(fn));
+  readOperations_.back().setRendezvousThreshold(kRendezvousThreshold);
 
   // If the inbox already contains some data, we may be able to process this
   // operation right away.
@@ -204,6 +333,7 @@ void ConnectionImpl::writeImplFromLoop(
     size_t length,
     write_callback_fn fn) {
   writeOperations_.emplace_back(ptr, length, std::move(fn));
+  writeOperations_.back().setRendezvousThreshold(kRendezvousThreshold);
 
   // If the outbox has some free space, we may be able to process this operation
   // right away.
@@ -220,6 +350,25 @@ void ConnectionImpl::writeImplFromLoop(
   processWriteOperationsFromLoop();
 }
 
+void ConnectionImpl::writeImplFromLoop(
+    const AbstractNopHolder& object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  // Use a single operation for all of them, which will write as much of them
+  // as possible in each ringbuffer transaction and thus notify the peer once.
+  std::vector<std::tuple<const void*, size_t>> ringbufferBuffers;
+  ringbufferBuffers.reserve(buffers.size());
+  for (const WriteBuffer& buffer : buffers) {
+    ringbufferBuffers.emplace_back(buffer.ptr, buffer.length);
+  }
+  writeOperations_.emplace_back(&object, ringbufferBuffers, std::move(fn));
+  writeOperations_.back().setRendezvousThreshold(kRendezvousThreshold);
+
+  // If the outbox has some free space, we may be able to process this operation
+  // right away.
+  processWriteOperationsFromLoop();
+}
+
 void ConnectionImpl::handleEventsFromLoop(int events) {
   TP_DCHECK(context_->inLoop());
   TP_VLOG(9) << "Connection " << id_ << " is handling an event on its socket ("
@@ -281,19 +430,67 @@ void ConnectionImpl::handleEventInFromLoop() {
       return;
     }
 
-    transitionIbvQueuePairToReadyToReceive(
+    if (ex.numLanes < 1 || ex.numLanes > kMaxNumLanes) {
+      setError(TP_CREATE_ERROR(
+          IbvError,
+          "peer requested an invalid number of lanes (" +
+              std::to_string(ex.numLanes) + ")"));
+      return;
+    }
+
+    if (!isPow2(ex.memoryRegionSize) || ex.memoryRegionSize < kMinBufferSize ||
+        ex.memoryRegionSize > kMaxBufferSize) {
+      setError(TP_CREATE_ERROR(
+          IbvError,
+          "peer has an inbox of invalid size (" +
+              std::to_string(ex.memoryRegionSize) + ")"));
+      return;
+    }
+
+    // Create ringbuffer for outbox, which mirrors the peer's inbox.
+    Error error;
+    std::tie(error, outboxBuf_) = allocateRingBufferMemory(
+        ex.memoryRegionSize, context_->getNumaNode());
+    TP_THROW_ASSERT_IF(error) << "Couldn't allocate ringbuffer for connection "
+                              << "outbox: " << error.what();
+    outboxHeader_ = std::make_unique<util::ringbuffer::RingBufferHeader>(
+        ex.memoryRegionSize);
+    outboxRb_ =
+        util::ringbuffer::RingBuffer(outboxHeader_.get(), outboxBuf_.ptr());
+    outboxMr_ = createIbvMemoryRegion(
         context_->getReactor().getIbvLib(),
-        qp_,
-        context_->getReactor().getIbvAddress(),
-        ex.setupInfo);
-    transitionIbvQueuePairToReadyToSend(
-        context_->getReactor().getIbvLib(), qp_);
+        context_->getReactor().getIbvPd(),
+        outboxBuf_.ptr(),
+        ex.memoryRegionSize,
+        0);
+    outboxMemoryCharge_ = chargeRegisteredMemory(ex.memoryRegionSize);
+
+    // Both sides stripe across the lowest number of lanes, hence we drop our
+    // extra queue pairs. They haven't been used yet so there's nothing to wait
+    // for before destroying them.
+    while (lanes_.size() > ex.numLanes) {
+      context_->getReactor().unregisterQp(lanes_.back().qp->qp_num);
+      lanes_.pop_back();
+    }
+
+    for (size_t laneIdx = 0; laneIdx < lanes_.size(); ++laneIdx) {
+      transitionIbvQueuePairToReadyToReceive(
+          context_->getReactor().getIbvLib(),
+          lanes_[laneIdx].qp,
+          context_->getReactor().getIbvAddress(),
+          ex.setupInfo[laneIdx]);
+      transitionIbvQueuePairToReadyToSend(
+          context_->getReactor().getIbvLib(), lanes_[laneIdx].qp);
+    }
 
     peerInboxKey_ = ex.memoryRegionKey;
     peerInboxPtr_ = ex.memoryRegionPtr;
+    peerMailboxKey_ = ex.mailboxKey;
+    peerMailboxPtr_ = ex.mailboxPtr;
 
     // The connection is usable now.
     state_ = ESTABLISHED;
+    scheduleIdleCheckFromLoop();
     processWriteOperationsFromLoop();
     // Trigger read operations in case a pair of local read() and remote
     // write() happened before connection is established. Otherwise read()
@@ -303,10 +500,24 @@ void ConnectionImpl::handleEventInFromLoop() {
   }
 
   if (state_ == ESTABLISHED) {
-    // We don't expect to read anything on this socket once the
-    // connection has been established. If we do, assume it's a
-    // zero-byte read indicating EOF.
-    setError(TP_CREATE_ERROR(EOFError));
+    // Once the connection has been established we only expect the messages
+    // about idle inboxes on this socket, or a zero-byte read indicating EOF.
+    IdleMessage message;
+    auto err = socket_.read(&message, sizeof(message));
+    if (err == 0) {
+      setError(TP_CREATE_ERROR(EOFError));
+      return;
+    }
+    if (err < 0) {
+      setError(TP_CREATE_ERROR(SystemError, "read", errno));
+      return;
+    }
+    // They're small enough to be read in a single chunk.
+    if (err != sizeof(message)) {
+      setError(TP_CREATE_ERROR(ShortReadError, sizeof(message), err));
+      return;
+    }
+    handleIdleMessageFromLoop(message);
     return;
   }
 
@@ -317,10 +528,17 @@ void ConnectionImpl::handleEventOutFromLoop() {
   TP_DCHECK(context_->inLoop());
   if (state_ == SEND_ADDR) {
     Exchange ex;
-    ex.setupInfo =
-        makeIbvSetupInformation(context_->getReactor().getIbvAddress(), qp_);
+    std::memset(&ex, 0, sizeof(ex));
+    ex.numLanes = lanes_.size();
+    for (size_t laneIdx = 0; laneIdx < lanes_.size(); ++laneIdx) {
+      ex.setupInfo[laneIdx] = makeIbvSetupInformation(
+          context_->getReactor().getIbvAddress(), lanes_[laneIdx].qp);
+    }
     ex.memoryRegionPtr = reinterpret_cast<uint64_t>(inboxBuf_.ptr());
     ex.memoryRegionKey = inboxMr_->rkey;
+    ex.memoryRegionSize = inboxHeader_->kDataPoolByteSize;
+    ex.mailboxPtr = reinterpret_cast<uint64_t>(&rendezvousBuf_[0]);
+    ex.mailboxKey = rendezvousMr_->rkey;
 
     auto err = socket_.write(reinterpret_cast<void*>(&ex), sizeof(ex));
     // Crossing our fingers that the exchange information is small enough that
@@ -339,6 +557,172 @@ void ConnectionImpl::handleEventOutFromLoop() {
   TP_THROW_ASSERT() << "EPOLLOUT event not handled in state " << state_;
 }
 
+void ConnectionImpl::handleIdleMessageFromLoop(const IdleMessage& message) {
+  TP_DCHECK(context_->inLoop());
+  switch (message.type) {
+    case kParkRequest:
+      // Our outbox can only be released once all that we wrote into the inbox
+      // has been read and acknowledged, and we don't want to be woken up right
+      // away.
+      if (!writeOperations_.empty() || numBytesInFlight_ > 0 ||
+          numWritesInFlight_ > 0) {
+        sendIdleMessageFromLoop(IdleMessage{kParkDeclined, 0});
+        return;
+      }
+      TP_VLOG(8) << "Connection " << id_ << " is parking its outbox";
+      outboxParked_ = true;
+      outboxMr_.reset();
+      outboxMemoryCharge_.reset();
+      releaseRingBufferMemory(outboxBuf_, id_);
+      sendIdleMessageFromLoop(IdleMessage{kParkAccepted, 0});
+      return;
+
+    case kParkAccepted:
+      TP_DCHECK_EQ(inboxState_, INBOX_PARKING);
+      // As the peer had all its data acknowledged, we read all of it.
+      TP_DCHECK_EQ(inboxHeader_->readHead(), inboxHeader_->readTail());
+      inboxMr_.reset();
+      inboxMemoryCharge_.reset();
+      releaseRingBufferMemory(inboxBuf_, id_);
+      TP_VLOG(8) << "Connection " << id_
+                 << " released the memory of its idle inbox";
+      statsCounters_.recordRingBufferReclaim();
+      inboxState_ = INBOX_RECLAIMED;
+      return;
+
+    case kParkDeclined:
+      TP_DCHECK_EQ(inboxState_, INBOX_PARKING);
+      inboxState_ = INBOX_ACTIVE;
+      return;
+
+    case kWakeRequest:
+      TP_DCHECK_EQ(inboxState_, INBOX_RECLAIMED);
+      inboxMr_ = createIbvMemoryRegion(
+          context_->getReactor().getIbvLib(),
+          context_->getReactor().getIbvPd(),
+          inboxBuf_.ptr(),
+          inboxHeader_->kDataPoolByteSize,
+          IbvLib::ACCESS_LOCAL_WRITE | IbvLib::ACCESS_REMOTE_WRITE);
+      inboxMemoryCharge_ =
+          chargeRegisteredMemory(inboxHeader_->kDataPoolByteSize);
+      TP_VLOG(8) << "Connection " << id_
+                 << " registered the memory of its inbox again";
+      inboxState_ = INBOX_ACTIVE;
+      numInboxBytesReadAtIdleCheck_ = numInboxBytesRead_;
+      sendIdleMessageFromLoop(IdleMessage{kResume, inboxMr_->rkey});
+      scheduleIdleCheckFromLoop();
+      return;
+
+    case kResume:
+      TP_DCHECK(outboxParked_);
+      TP_VLOG(8) << "Connection " << id_ << " is resuming its outbox";
+      outboxMr_ = createIbvMemoryRegion(
+          context_->getReactor().getIbvLib(),
+          context_->getReactor().getIbvPd(),
+          outboxBuf_.ptr(),
+          outboxHeader_->kDataPoolByteSize,
+          0);
+      outboxMemoryCharge_ =
+          chargeRegisteredMemory(outboxHeader_->kDataPoolByteSize);
+      peerInboxKey_ = message.key;
+      outboxParked_ = false;
+      wakeRequested_ = false;
+      processWriteOperationsFromLoop();
+      return;
+
+    default:
+      setError(TP_CREATE_ERROR(
+          IbvError,
+          "peer sent an invalid message (" + std::to_string(message.type) +
+              ")"));
+      return;
+  }
+}
+
+void ConnectionImpl::sendIdleMessageFromLoop(const IdleMessage& message) {
+  TP_DCHECK(context_->inLoop());
+  auto err = socket_.write(&message, sizeof(message));
+  if (err < 0) {
+    setError(TP_CREATE_ERROR(SystemError, "write", errno));
+    return;
+  }
+  if (err != sizeof(message)) {
+    setError(TP_CREATE_ERROR(ShortWriteError, sizeof(message), err));
+  }
+}
+
+void ConnectionImpl::checkIdleFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  idleTimer_.reset();
+  if (error_ || inboxState_ == INBOX_RECLAIMED) {
+    return;
+  }
+
+  // Nothing was read since the previous check, and nothing is left to be read
+  // or to be acknowledged (or else the peer would decline to park).
+  const bool lanesAreEmpty =
+      std::all_of(lanes_.begin(), lanes_.end(), [](const Lane& lane) {
+        return lane.pendingLengths.empty();
+      });
+  if (inboxState_ == INBOX_ACTIVE &&
+      numInboxBytesRead_ == numInboxBytesReadAtIdleCheck_ &&
+      inboxHeader_->readHead() == inboxHeader_->readTail() && lanesAreEmpty &&
+      numBytesToAck_ == 0) {
+    TP_VLOG(8) << "Connection " << id_
+               << " is asking its peer to park as its inbox is idle";
+    inboxState_ = INBOX_PARKING;
+    sendIdleMessageFromLoop(IdleMessage{kParkRequest, 0});
+  }
+  numInboxBytesReadAtIdleCheck_ = numInboxBytesRead_;
+  scheduleIdleCheckFromLoop();
+}
+
+void ConnectionImpl::scheduleIdleCheckFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  // The inbox may have been reclaimed on request of the context even if the
+  // idle connections aren't reclaimed on their own.
+  if (error_ || idleTimer_.has_value() ||
+      context_->getIdleTimeout().count() == 0) {
+    return;
+  }
+  // The timer doesn't keep the connection alive.
+  std::weak_ptr<ConnectionImpl> weakImpl = shared_from_this();
+  idleTimer_ = context_->getTimerWheel().schedule(
+      context_->getIdleTimeout(), [weakImpl]() {
+        std::shared_ptr<ConnectionImpl> impl = weakImpl.lock();
+        if (impl != nullptr) {
+          impl->context_->deferToLoop(
+              [impl]() { impl->checkIdleFromLoop(); });
+        }
+      });
+}
+
+void ConnectionImpl::reclaimMemoryImplFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  // Like an idle check, but without waiting for the inbox to have been empty
+  // for a while.
+  const bool lanesAreEmpty =
+      std::all_of(lanes_.begin(), lanes_.end(), [](const Lane& lane) {
+        return lane.pendingLengths.empty();
+      });
+  if (error_ || state_ != ESTABLISHED || inboxState_ != INBOX_ACTIVE ||
+      inboxHeader_->readHead() != inboxHeader_->readTail() || !lanesAreEmpty ||
+      numBytesToAck_ > 0) {
+    return;
+  }
+  TP_VLOG(8) << "Connection " << id_
+             << " is asking its peer to park as its inbox is to be reclaimed";
+  inboxState_ = INBOX_PARKING;
+  sendIdleMessageFromLoop(IdleMessage{kParkRequest, 0});
+}
+
+MemoryCharge ConnectionImpl::chargeRegisteredMemory(size_t numBytes) {
+  return MemoryCharge(
+      context_->getMemoryFootprintCounters(),
+      MemoryKind::kRegistered,
+      numBytes);
+}
+
 void ConnectionImpl::processReadOperationsFromLoop() {
   TP_DCHECK(context_->inLoop());
 
@@ -348,26 +732,35 @@ void ConnectionImpl::processReadOperationsFromLoop() {
     return;
   }
   // Serve read operations
-  util::ringbuffer::Consumer inboxConsumer(inboxRb_);
+  util::ringbuffer::SingleConsumer inboxConsumer(inboxRb_);
   while (!readOperations_.empty()) {
     RingbufferReadOperation& readOperation = readOperations_.front();
+    // The next message was sent eagerly, if all that was committed to the inbox
+    // before it has been read (but maybe not its last rendezvous, if any).
+    if (!eagerMessages_.empty() &&
+        eagerMessages_.front().position == numInboxBytesRead_ &&
+        readOperation.awaitingLength()) {
+      EagerMessage& message = eagerMessages_.front();
+      readOperation.handleEagerRead(message.buffer.get(), message.length);
+      eagerMessages_.pop_front();
+      readOperations_.pop_front();
+      continue;
+    }
     ssize_t len = readOperation.handleRead(inboxConsumer);
     if (len > 0) {
-      IbvLib::send_wr wr;
-      std::memset(&wr, 0, sizeof(wr));
-      wr.wr_id = kAckRequestId;
-      wr.opcode = IbvLib::WR_SEND_WITH_IMM;
-      wr.imm_data = len;
-
-      TP_VLOG(9) << "Connection " << id_
-                 << " is posting a send request (acknowledging " << wr.imm_data
-                 << " bytes) on QP " << qp_->qp_num;
-      context_->getReactor().postAck(qp_, wr);
-      numAcksInFlight_++;
+      numInboxBytesRead_ += len;
+      numBytesToAck_ += len;
+      if (!ackFlushRequested_) {
+        context_->getReactor().requestAckFlush(lanes_[0].qp->qp_num);
+        ackFlushRequested_ = true;
+      }
     }
     if (readOperation.completed()) {
       readOperations_.pop_front();
     } else {
+      if (readOperation.awaitingRendezvous() && rendezvousReadMr_ == nullptr) {
+        requestRendezvousFromLoop(readOperation);
+      }
       break;
     }
   }
@@ -380,13 +773,30 @@ void ConnectionImpl::processWriteOperationsFromLoop() {
     return;
   }
 
-  util::ringbuffer::Producer outboxProducer(outboxRb_);
+  util::ringbuffer::SingleProducer outboxProducer(outboxRb_);
   while (!writeOperations_.empty()) {
     RingbufferWriteOperation& writeOperation = writeOperations_.front();
+    // Small messages don't go through the ringbuffers, hence they don't need
+    // the peer's inbox to be registered.
+    if (postEagerSendFromLoop(writeOperation)) {
+      writeOperations_.pop_front();
+      continue;
+    }
+
+    // While the peer's inbox is reclaimed, have it registered before writing.
+    if (outboxParked_) {
+      if (!wakeRequested_) {
+        TP_VLOG(8) << "Connection " << id_ << " is asking its peer to resume";
+        wakeRequested_ = true;
+        sendIdleMessageFromLoop(IdleMessage{kWakeRequest, 0});
+      }
+      return;
+    }
+
     ssize_t len = writeOperation.handleWrite(outboxProducer);
     if (len > 0) {
       ssize_t ret;
-      util::ringbuffer::Consumer outboxConsumer(outboxRb_);
+      util::ringbuffer::SingleConsumer outboxConsumer(outboxRb_);
 
       // In order to get the pointers and lengths to the data that was just
       // written to the ringbuffer we pretend to start a consumer transaction so
@@ -397,7 +807,7 @@ void ConnectionImpl::processWriteOperationsFromLoop() {
       TP_THROW_SYSTEM_IF(ret < 0, -ret);
 
       ssize_t numBuffers;
-      std::array<util::ringbuffer::Consumer::Buffer, 2> buffers;
+      std::array<util::ringbuffer::SingleConsumer::Buffer, 2> buffers;
 
       // Skip over the data that was already sent but is still in flight.
       std::tie(numBuffers, buffers) =
@@ -409,29 +819,8 @@ void ConnectionImpl::processWriteOperationsFromLoop() {
       TP_THROW_SYSTEM_IF(numBuffers < 0, -numBuffers);
 
       for (int bufferIdx = 0; bufferIdx < numBuffers; bufferIdx++) {
-        IbvLib::sge list;
-        list.addr = reinterpret_cast<uint64_t>(buffers[bufferIdx].ptr);
-        list.length = buffers[bufferIdx].len;
-        list.lkey = outboxMr_->lkey;
-
-        uint64_t peerInboxOffset = peerInboxHead_ & (kBufferSize - 1);
-        peerInboxHead_ += buffers[bufferIdx].len;
-
-        IbvLib::send_wr wr;
-        std::memset(&wr, 0, sizeof(wr));
-        wr.wr_id = kWriteRequestId;
-        wr.sg_list = &list;
-        wr.num_sge = 1;
-        wr.opcode = IbvLib::WR_RDMA_WRITE_WITH_IMM;
-        wr.imm_data = buffers[bufferIdx].len;
-        wr.wr.rdma.remote_addr = peerInboxPtr_ + peerInboxOffset;
-        wr.wr.rdma.rkey = peerInboxKey_;
-
-        TP_VLOG(9) << "Connection " << id_
-                   << " is posting a RDMA write request (transmitting "
-                   << wr.imm_data << " bytes) on QP " << qp_->qp_num;
-        context_->getReactor().postWrite(qp_, wr);
-        numWritesInFlight_++;
+        postWritesForBufferFromLoop(
+            buffers[bufferIdx].ptr, buffers[bufferIdx].len);
       }
 
       ret = outboxConsumer.cancelTx();
@@ -442,72 +831,408 @@ void ConnectionImpl::processWriteOperationsFromLoop() {
     if (writeOperation.completed()) {
       writeOperations_.pop_front();
     } else {
+      if (writeOperation.awaitingRendezvous()) {
+        if (rendezvousRequestReceived_ && rendezvousWriteMr_ == nullptr) {
+          performRendezvousFromLoop(writeOperation);
+        }
+      } else {
+        statsCounters_.recordRingBufferStall();
+      }
       break;
     }
   }
 }
 
-void ConnectionImpl::onRemoteProducedData(uint32_t length) {
+void ConnectionImpl::requestRendezvousFromLoop(
+    RingbufferReadOperation& readOperation) {
+  TP_DCHECK(context_->inLoop());
+
+  rendezvousReadMr_ = context_->getReactor().getMemoryRegionCache().getRegion(
+      readOperation.rendezvousPtr(),
+      readOperation.rendezvousLength(),
+      IbvLib::ACCESS_LOCAL_WRITE | IbvLib::ACCESS_REMOTE_WRITE);
+
+  RendezvousRequest& request = rendezvousBuf_[1];
+  request.ptr = reinterpret_cast<uint64_t>(readOperation.rendezvousPtr());
+  request.key = rendezvousReadMr_->rkey;
+  request.length = readOperation.rendezvousLength();
+
+  IbvLib::sge list;
+  list.addr = reinterpret_cast<uint64_t>(&request);
+  list.length = sizeof(request);
+  list.lkey = rendezvousMr_->lkey;
+
+  IbvLib::send_wr wr;
+  std::memset(&wr, 0, sizeof(wr));
+  wr.wr_id = kRendezvousRequestId;
+  wr.sg_list = &list;
+  wr.num_sge = 1;
+  wr.opcode = IbvLib::WR_RDMA_WRITE_WITH_IMM;
+  wr.imm_data = kRendezvousRequestImm;
+  wr.wr.rdma.remote_addr = peerMailboxPtr_;
+  wr.wr.rdma.rkey = peerMailboxKey_;
+
+  TP_VLOG(9) << "Connection " << id_
+             << " is posting a RDMA write request (requesting a rendezvous for "
+             << request.length << " bytes) on QP " << lanes_[0].qp->qp_num;
+  context_->getReactor().postWrite(lanes_[0].qp, wr);
+  numWritesInFlight_++;
+}
+
+void ConnectionImpl::performRendezvousFromLoop(
+    RingbufferWriteOperation& writeOperation) {
+  TP_DCHECK(context_->inLoop());
+
+  const RendezvousRequest& request = rendezvousBuf_[0];
+  rendezvousRequestReceived_ = false;
+  if (request.length != writeOperation.rendezvousLength()) {
+    setError(TP_CREATE_ERROR(
+        IbvError,
+        "peer requested a rendezvous for " + std::to_string(request.length) +
+            " bytes but " + std::to_string(writeOperation.rendezvousLength()) +
+            " are being written"));
+    return;
+  }
+
+  const size_t length = writeOperation.rendezvousLength();
+  rendezvousWriteMr_ = context_->getReactor().getMemoryRegionCache().getRegion(
+      const_cast<void*>(writeOperation.rendezvousPtr()),
+      length,
+      0);
+
+  // Only the last write carries the immediate data, as it's delivered after
+  // all the previous ones on the same queue pair.
+  for (size_t offset = 0; offset < length; offset += kMaxRendezvousWriteSize) {
+    const size_t pieceLength =
+        std::min(length - offset, kMaxRendezvousWriteSize);
+    const bool isLast = offset + pieceLength == length;
+
+    IbvLib::sge list;
+    list.addr =
+        reinterpret_cast<uint64_t>(writeOperation.rendezvousPtr()) + offset;
+    list.length = pieceLength;
+    list.lkey = rendezvousWriteMr_->lkey;
+
+    IbvLib::send_wr wr;
+    std::memset(&wr, 0, sizeof(wr));
+    wr.wr_id = kRendezvousDataId;
+    wr.sg_list = &list;
+    wr.num_sge = 1;
+    wr.opcode =
+        isLast ? IbvLib::WR_RDMA_WRITE_WITH_IMM : IbvLib::WR_RDMA_WRITE;
+    wr.imm_data = isLast ? kRendezvousDataImm : 0;
+    wr.wr.rdma.remote_addr = request.ptr + offset;
+    wr.wr.rdma.rkey = request.key;
+
+    TP_VLOG(9) << "Connection " << id_
+               << " is posting a RDMA write request (transmitting "
+               << pieceLength << " bytes directly) on QP "
+               << lanes_[0].qp->qp_num;
+    context_->getReactor().postWrite(lanes_[0].qp, wr);
+    numWritesInFlight_++;
+    numRendezvousWritesInFlight_++;
+  }
+}
+
+void ConnectionImpl::postWritesForBufferFromLoop(
+    const void* ptr,
+    size_t length) {
+  TP_DCHECK(context_->inLoop());
+
+  const size_t numPieces = std::max<size_t>(
+      1, std::min<size_t>(lanes_.size(), length / kMinStripeSize));
+  size_t offset = 0;
+  for (size_t pieceIdx = 0; pieceIdx < numPieces; ++pieceIdx) {
+    // Spread the remainder over the first pieces.
+    const size_t pieceLength =
+        length / numPieces + (pieceIdx < length % numPieces ? 1 : 0);
+    Lane& lane = lanes_[nextLaneToWrite_];
+    nextLaneToWrite_ = (nextLaneToWrite_ + 1) % lanes_.size();
+
+    IbvLib::sge list;
+    list.addr = reinterpret_cast<uint64_t>(ptr) + offset;
+    list.length = pieceLength;
+    list.lkey = outboxMr_->lkey;
+
+    uint64_t peerInboxOffset = peerInboxHead_ & outboxHeader_->kDataModMask;
+    peerInboxHead_ += pieceLength;
+
+    IbvLib::send_wr wr;
+    std::memset(&wr, 0, sizeof(wr));
+    wr.wr_id = kWriteRequestId;
+    wr.sg_list = &list;
+    wr.num_sge = 1;
+    wr.opcode = IbvLib::WR_RDMA_WRITE_WITH_IMM;
+    wr.imm_data = pieceLength;
+    wr.wr.rdma.remote_addr = peerInboxPtr_ + peerInboxOffset;
+    wr.wr.rdma.rkey = peerInboxKey_;
+
+    uint32_t numBytesAcked = 0;
+    if (numBytesToAck_ > 0 && pieceLength <= kMaxPiggybackedLength) {
+      numBytesAcked = std::min(numBytesToAck_, kMaxPiggybackedLength);
+      numBytesToAck_ -= numBytesAcked;
+      wr.imm_data |=
+          kPiggybackedAckImm | (numBytesAcked << kPiggybackedLengthBits);
+    }
+
+    TP_VLOG(9) << "Connection " << id_
+               << " is posting a RDMA write request (transmitting "
+               << pieceLength << " bytes, acknowledging " << numBytesAcked
+               << " bytes) on QP " << lane.qp->qp_num;
+    context_->getReactor().postWrite(lane.qp, wr);
+    numWritesInFlight_++;
+
+    offset += pieceLength;
+  }
+  TP_DCHECK_EQ(offset, length);
+}
+
+bool ConnectionImpl::postEagerSendFromLoop(
+    RingbufferWriteOperation& writeOperation) {
+  TP_DCHECK(context_->inLoop());
+
+  // The reactor copies the data into its own request, and sends it inline.
+  Lane& lane = lanes_[nextLaneToWrite_];
+  std::array<uint8_t, kMaxEagerMessageSize> data;
+  const size_t length = writeOperation.handleEagerWrite(
+      data.data(),
+      std::min<size_t>(kMaxEagerMessageSize, lane.maxInlineData));
+  if (length == 0) {
+    return false;
+  }
+  nextLaneToWrite_ = (nextLaneToWrite_ + 1) % lanes_.size();
+
+  IbvLib::sge list;
+  list.addr = reinterpret_cast<uint64_t>(data.data());
+  list.length = length;
+  list.lkey = 0;
+
+  // Like the acknowledgements, whose immediate data it carries, except that
+  // it's not one as it has some data.
+  IbvLib::send_wr wr;
+  std::memset(&wr, 0, sizeof(wr));
+  wr.wr_id = kEagerRequestId;
+  wr.sg_list = &list;
+  wr.num_sge = 1;
+  wr.opcode = IbvLib::WR_SEND_WITH_IMM;
+  wr.imm_data = numBytesToAck_;
+  numBytesToAck_ = 0;
+
+  TP_VLOG(9) << "Connection " << id_
+             << " is posting a send request (transmitting " << length
+             << " bytes eagerly, acknowledging " << wr.imm_data
+             << " bytes) on QP " << lane.qp->qp_num;
+  context_->getReactor().postEagerSend(lane.qp, wr);
+  numWritesInFlight_++;
+  return true;
+}
+
+void ConnectionImpl::onRemoteProducedData(uint32_t qpNum, uint32_t length) {
   TP_DCHECK(context_->inLoop());
+  if ((length & kPiggybackedAckImm) == kPiggybackedAckImm) {
+    onRemoteConsumedData(
+        (length >> kPiggybackedLengthBits) & kMaxPiggybackedLength);
+    length &= kMaxPiggybackedLength;
+  }
+  if (length & kRendezvousRequestImm) {
+    TP_VLOG(9) << "Connection " << id_
+               << " was signalled that the peer requested a rendezvous";
+    TP_DCHECK(!rendezvousRequestReceived_);
+    rendezvousRequestReceived_ = true;
+    processWriteOperationsFromLoop();
+    return;
+  }
+  if (length & kRendezvousDataImm) {
+    TP_VLOG(9) << "Connection " << id_
+               << " was signalled that the peer completed a rendezvous";
+    // After an error the operations have already been flushed.
+    if (error_) {
+      return;
+    }
+    TP_DCHECK(!readOperations_.empty());
+    TP_DCHECK(readOperations_.front().awaitingRendezvous());
+    rendezvousReadMr_.reset();
+    readOperations_.front().completeRendezvous();
+    readOperations_.pop_front();
+    processReadOperationsFromLoop();
+    return;
+  }
+
   TP_VLOG(9) << "Connection " << id_ << " was signalled that " << length
-             << " bytes were written to its inbox on QP " << qp_->qp_num;
-  // We could start a transaction and use the proper methods for this, but as
-  // this method is the only producer for the inbox ringbuffer we can cut it
-  // short and directly increase the head.
-  inboxHeader_.incHead(length);
+             << " bytes were written to its inbox on QP " << qpNum;
+  auto iter = std::find_if(
+      lanes_.begin(), lanes_.end(), [qpNum](const Lane& lane) {
+        return lane.qp->qp_num == qpNum;
+      });
+  TP_THROW_ASSERT_IF(iter == lanes_.end())
+      << "Got data on QP " << qpNum << " which isn't one of the lanes";
+  iter->pendingLengths.push_back(length);
+  commitPendingDataFromLoop();
   processReadOperationsFromLoop();
 }
 
+void ConnectionImpl::onRemoteSentData(
+    uint32_t qpNum,
+    uint32_t ackedLength,
+    const void* ptr,
+    size_t length) {
+  TP_DCHECK(context_->inLoop());
+  if (ackedLength > 0) {
+    onRemoteConsumedData(ackedLength);
+  }
+  TP_VLOG(9) << "Connection " << id_ << " was sent " << length
+             << " bytes eagerly on QP " << qpNum;
+  // After an error the operations have already been flushed.
+  if (error_) {
+    return;
+  }
+  auto iter = std::find_if(
+      lanes_.begin(), lanes_.end(), [qpNum](const Lane& lane) {
+        return lane.qp->qp_num == qpNum;
+      });
+  TP_THROW_ASSERT_IF(iter == lanes_.end())
+      << "Got data on QP " << qpNum << " which isn't one of the lanes";
+
+  // If nothing precedes it, and a read operation is waiting for it, have it
+  // read straight from the buffer of the receive request. Otherwise it must be
+  // copied out, as the buffer goes back to the shared receive queue.
+  if (&*iter == &lanes_[nextLaneToCommit_] && iter->pendingLengths.empty() &&
+      eagerMessages_.empty() && numInboxBytesRead_ == numInboxBytesCommitted_ &&
+      !readOperations_.empty() && readOperations_.front().awaitingLength()) {
+    nextLaneToCommit_ = (nextLaneToCommit_ + 1) % lanes_.size();
+    readOperations_.front().handleEagerRead(ptr, length);
+    readOperations_.pop_front();
+  } else {
+    EagerMessage message;
+    message.buffer = ReadBufferPool::allocate(&readBufferPool_, length);
+    std::memcpy(message.buffer.get(), ptr, length);
+    message.length = length;
+    iter->pendingLengths.push_back(kEagerMessageMarker);
+    iter->pendingEagerMessages.push_back(std::move(message));
+  }
+  commitPendingDataFromLoop();
+  processReadOperationsFromLoop();
+}
+
+void ConnectionImpl::commitPendingDataFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  // Commit all the data that has now arrived without any gap, following the
+  // same round-robin order over the lanes that the sender used. We could start
+  // a transaction and use the proper methods for this, but as this method is
+  // the only producer for the inbox ringbuffer we can cut it short and directly
+  // increase the head. The eager messages are queued up instead, to be read
+  // once all the data before them has.
+  while (!lanes_[nextLaneToCommit_].pendingLengths.empty()) {
+    Lane& lane = lanes_[nextLaneToCommit_];
+    const uint32_t length = lane.pendingLengths.front();
+    lane.pendingLengths.pop_front();
+    if (length == kEagerMessageMarker) {
+      TP_DCHECK(!lane.pendingEagerMessages.empty());
+      lane.pendingEagerMessages.front().position = numInboxBytesCommitted_;
+      eagerMessages_.push_back(std::move(lane.pendingEagerMessages.front()));
+      lane.pendingEagerMessages.pop_front();
+    } else {
+      inboxHeader_->incHead(length);
+      numInboxBytesCommitted_ += length;
+    }
+    nextLaneToCommit_ = (nextLaneToCommit_ + 1) % lanes_.size();
+  }
+}
+
 void ConnectionImpl::onRemoteConsumedData(uint32_t length) {
   TP_DCHECK(context_->inLoop());
   TP_VLOG(9) << "Connection " << id_ << " was signalled that " << length
-             << " bytes were read from its outbox on QP " << qp_->qp_num;
+             << " bytes were read from its outbox on QP "
+             << lanes_[0].qp->qp_num;
   // We could start a transaction and use the proper methods for this, but as
   // this method is the only consumer for the outbox ringbuffer we can cut it
   // short and directly increase the tail.
-  outboxHeader_.incTail(length);
+  outboxHeader_->incTail(length);
   numBytesInFlight_ -= length;
   processWriteOperationsFromLoop();
 }
 
-void ConnectionImpl::onWriteCompleted() {
+void ConnectionImpl::onWriteCompleted(uint64_t wrId) {
   TP_DCHECK(context_->inLoop());
-  TP_VLOG(9) << "Connection " << id_
-             << " done posting a RDMA write request on QP " << qp_->qp_num;
+  TP_VLOG(9) << "Connection " << id_ << " done posting a RDMA write request";
   numWritesInFlight_--;
+  if (wrId == kRendezvousDataId) {
+    numRendezvousWritesInFlight_--;
+    if (numRendezvousWritesInFlight_ == 0 && !error_) {
+      rendezvousWriteMr_.reset();
+      writeOperations_.front().completeRendezvous();
+      processWriteOperationsFromLoop();
+    }
+  }
   tryCleanup();
 }
 
 void ConnectionImpl::onAckCompleted() {
   TP_DCHECK(context_->inLoop());
   TP_VLOG(9) << "Connection " << id_ << " done posting a send request on QP "
-             << qp_->qp_num;
+             << lanes_[0].qp->qp_num;
   numAcksInFlight_--;
   tryCleanup();
 }
 
+void ConnectionImpl::onFlushAcks() {
+  TP_DCHECK(context_->inLoop());
+  ackFlushRequested_ = false;
+  // After an error the peer doesn't care anymore.
+  if (error_ || numBytesToAck_ == 0) {
+    numBytesToAck_ = 0;
+    return;
+  }
+
+  IbvLib::send_wr wr;
+  std::memset(&wr, 0, sizeof(wr));
+  wr.wr_id = kAckRequestId;
+  wr.opcode = IbvLib::WR_SEND_WITH_IMM;
+  wr.imm_data = numBytesToAck_;
+  numBytesToAck_ = 0;
+
+  TP_VLOG(9) << "Connection " << id_
+             << " is posting a send request (acknowledging " << wr.imm_data
+             << " bytes) on QP " << lanes_[0].qp->qp_num;
+  context_->getReactor().postAck(lanes_[0].qp, wr);
+  numAcksInFlight_++;
+}
+
 void ConnectionImpl::onError(IbvLib::wc_status status, uint64_t wrId) {
   TP_DCHECK(context_->inLoop());
   setError(TP_CREATE_ERROR(
       IbvError, context_->getReactor().getIbvLib().wc_status_str(status)));
-  if (wrId == kWriteRequestId) {
-    onWriteCompleted();
+  if (wrId == kWriteRequestId || wrId == kRendezvousRequestId ||
+      wrId == kRendezvousDataId || wrId == kEagerRequestId) {
+    onWriteCompleted(wrId);
   } else if (wrId == kAckRequestId) {
     onAckCompleted();
   }
 }
 
 void ConnectionImpl::handleErrorImpl() {
+  if (idleTimer_.has_value()) {
+    context_->getTimerWheel().cancel(idleTimer_.value());
+    idleTimer_.reset();
+  }
+
+  // Revoke the peer's access to the destination of a rendezvous before handing
+  // the memory back to the user.
+  rendezvousReadMr_.reset();
+
   for (auto& readOperation : readOperations_) {
     readOperation.handleError(error_);
   }
   readOperations_.clear();
+  eagerMessages_.clear();
   for (auto& writeOperation : writeOperations_) {
     writeOperation.handleError(error_);
   }
   writeOperations_.clear();
 
-  transitionIbvQueuePairToError(context_->getReactor().getIbvLib(), qp_);
+  for (Lane& lane : lanes_) {
+    transitionIbvQueuePairToError(context_->getReactor().getIbvLib(), lane.qp);
+  }
 
   tryCleanup();
 
@@ -518,6 +1243,7 @@ void ConnectionImpl::handleErrorImpl() {
     socket_.reset();
   }
 
+  context_->onConnectionClosed();
   context_->unenroll(*this);
 }
 
@@ -541,8 +1267,7 @@ void ConnectionImpl::tryCleanup() {
       TP_VLOG(9) << "Connection " << id_
                  << " cannot proceed to cleanup because it has "
                  << numWritesInFlight_ << " pending RDMA write requests and "
-                 << numAcksInFlight_ << " pending send requests on QP "
-                 << qp_->qp_num;
+                 << numAcksInFlight_ << " pending send requests";
     }
   }
 }
@@ -551,13 +1276,20 @@ void ConnectionImpl::cleanup() {
   TP_DCHECK(context_->inLoop());
   TP_VLOG(8) << "Connection " << id_ << " is cleaning up";
 
-  context_->getReactor().unregisterQp(qp_->qp_num);
+  for (Lane& lane : lanes_) {
+    context_->getReactor().unregisterQp(lane.qp->qp_num);
+  }
 
-  qp_.reset();
+  lanes_.clear();
   inboxMr_.reset();
+  inboxMemoryCharge_.reset();
   inboxBuf_.reset();
   outboxMr_.reset();
+  outboxMemoryCharge_.reset();
   outboxBuf_.reset();
+  rendezvousWriteMr_.reset();
+  rendezvousMr_.reset();
+  rendezvousBuf_.reset();
 }
 
 } // namespace ibv
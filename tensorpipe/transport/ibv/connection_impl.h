@@ -13,13 +13,17 @@
 #include <deque>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <tensorpipe/common/epoll_loop.h>
 #include <tensorpipe/common/ibv.h>
 #include <tensorpipe/common/memory.h>
+#include <tensorpipe/common/memory_footprint.h>
 #include <tensorpipe/common/nop.h>
+#include <tensorpipe/common/read_buffer_pool.h>
 #include <tensorpipe/common/ringbuffer_read_write_ops.h>
 #include <tensorpipe/common/socket.h>
+#include <tensorpipe/common/timer_wheel.h>
 #include <tensorpipe/transport/connection_impl_boilerplate.h>
 #include <tensorpipe/transport/ibv/reactor.h>
 #include <tensorpipe/transport/ibv/sockaddr.h>
@@ -29,12 +33,6 @@ namespace tensorpipe {
 namespace transport {
 namespace ibv {
 
-namespace {
-
-constexpr auto kBufferSize = 2 * 1024 * 1024;
-
-} // namespace
-
 class ContextImpl;
 class ListenerImpl;
 
@@ -51,6 +49,15 @@ class ConnectionImpl final : public ConnectionImplBoilerplate<
     ESTABLISHED,
   };
 
+  // Where the inbox is in the reclamation of its memory once it's idle.
+  enum InboxState {
+    INBOX_ACTIVE = 1,
+    // We asked the peer to hold back its writes.
+    INBOX_PARKING,
+    // The memory is deregistered and gone, until the peer asks to write again.
+    INBOX_RECLAIMED,
+  };
+
  public:
   // Create a connection that is already connected (e.g. from a listener).
   ConnectionImpl(
@@ -70,10 +77,16 @@ class ConnectionImpl final : public ConnectionImplBoilerplate<
   void handleEventsFromLoop(int events) override;
 
   // Implementation of IbvEventHandler.
-  void onRemoteProducedData(uint32_t length) override;
+  void onRemoteProducedData(uint32_t qpNum, uint32_t length) override;
   void onRemoteConsumedData(uint32_t length) override;
-  void onWriteCompleted() override;
+  void onRemoteSentData(
+      uint32_t qpNum,
+      uint32_t ackedLength,
+      const void* ptr,
+      size_t length) override;
+  void onWriteCompleted(uint64_t wrId) override;
   void onAckCompleted() override;
+  void onFlushAcks() override;
   void onError(IbvLib::wc_status status, uint64_t wrId) override;
 
  protected:
@@ -87,7 +100,12 @@ class ConnectionImpl final : public ConnectionImplBoilerplate<
       override;
   void writeImplFromLoop(const AbstractNopHolder& object, write_callback_fn fn)
       override;
+  void writeImplFromLoop(
+      const AbstractNopHolder& object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn) override;
   void handleErrorImpl() override;
+  void reclaimMemoryImplFromLoop() override;
 
  private:
   // Handle events of type EPOLLIN on the UNIX domain socket.
@@ -102,33 +120,140 @@ class ConnectionImpl final : public ConnectionImplBoilerplate<
   // for this side's queue pair and inbox.
   void handleEventOutFromLoop();
 
+  // Once the connection is established, the socket only carries the messages
+  // through which the two sides agree to reclaim the memory of an idle inbox:
+  // its owner asks the peer to park its outbox (i.e., to hold back its writes),
+  // which the peer accepts if all it wrote has been acknowledged, and once they
+  // have both released their memory they wait for the peer to ask to write
+  // again, upon which the owner registers the inbox again and sends its new key
+  // to have the peer resume.
+  struct IdleMessage;
+  void handleIdleMessageFromLoop(const IdleMessage& message);
+  void sendIdleMessageFromLoop(const IdleMessage& message);
+
+  // Look at whether the inbox was idle since the previous check, to start the
+  // reclamation of its memory if so, and schedule the next check.
+  void checkIdleFromLoop();
+  void scheduleIdleCheckFromLoop();
+
+  // Account for the memory of the inbox or of the outbox as registered.
+  MemoryCharge chargeRegisteredMemory(size_t numBytes);
+
   State state_{INITIALIZING};
   Socket socket_;
   optional<Sockaddr> sockaddr_;
 
-  IbvQueuePair qp_;
+  // Recycles the buffers of the reads that weren't given a destination, and of
+  // the eager messages that couldn't be read right away. It must outlive the
+  // read operations and those messages, hence it's declared before them.
+  ReadBufferPool readBufferPool_;
+
+  // A message that the peer sent eagerly, copied out of the buffer of the
+  // shared receive queue, and the number of bytes that had been committed to
+  // the inbox before it (which must all have been read before it is), once
+  // it's committed too.
+  struct EagerMessage {
+    ReadBufferPool::Buffer buffer;
+    size_t length{0};
+    uint64_t position{0};
+  };
+
+  // The queue pairs that data is striped across. The first one is also used
+  // to send acknowledgements. The vector is sized once upon initialization (and
+  // possibly shrunk during the handshake), as the reactor holds references to
+  // the queue pairs, and it must thus never reallocate.
+  struct Lane {
+    IbvQueuePair qp;
+    // As granted by the device, which bounds the size of the eager messages.
+    uint32_t maxInlineData{0};
+    // The lengths of the RDMA writes that were received on this lane but that
+    // couldn't yet be committed to the inbox because some data that precedes
+    // them, which was sent on other lanes, hasn't arrived yet. The eager
+    // messages take their turn in the same way, with a marker in place of the
+    // length.
+    std::deque<uint32_t> pendingLengths;
+    std::deque<EagerMessage> pendingEagerMessages;
+  };
+  std::vector<Lane> lanes_;
+
+  // The sender posts each RDMA write (or eager send) on the lane that follows
+  // the one of the previous write, in round-robin order. The receiver commits
+  // them to the inbox in the same order, which allows to reassemble the data
+  // even though there is no ordering guarantee across queue pairs.
+  size_t nextLaneToWrite_{0};
+  size_t nextLaneToCommit_{0};
+
+  // The eager messages that were committed but not read yet, in order, and how
+  // many bytes were committed to the inbox in total, to tell where they go.
+  std::deque<EagerMessage> eagerMessages_;
+  uint64_t numInboxBytesCommitted_{0};
 
   // Inbox.
-  // Initialize header during construction because it isn't assignable.
-  util::ringbuffer::RingBufferHeader inboxHeader_{kBufferSize};
-  // Use mmapped memory so it's page-aligned (and, one day, to use huge pages).
+  // Its size comes from the context, hence the header is held by pointer, as it
+  // isn't assignable.
+  std::unique_ptr<util::ringbuffer::RingBufferHeader> inboxHeader_;
+  // Use mmapped memory so it's page-aligned and can use huge pages.
   MmappedPtr inboxBuf_;
   util::ringbuffer::RingBuffer inboxRb_;
   IbvMemoryRegion inboxMr_;
+  // Accounts for the memory of the inbox while it's registered.
+  MemoryCharge inboxMemoryCharge_;
 
   // Outbox.
-  // Initialize header during construction because it isn't assignable.
-  util::ringbuffer::RingBufferHeader outboxHeader_{kBufferSize};
-  // Use mmapped memory so it's page-aligned (and, one day, to use huge pages).
+  // It's as large as the peer's inbox, hence it's only created once we've
+  // learned that size.
+  std::unique_ptr<util::ringbuffer::RingBufferHeader> outboxHeader_;
+  // Use mmapped memory so it's page-aligned and can use huge pages.
   MmappedPtr outboxBuf_;
   util::ringbuffer::RingBuffer outboxRb_;
   IbvMemoryRegion outboxMr_;
+  MemoryCharge outboxMemoryCharge_;
 
   // Peer inbox key, pointer and head.
   uint32_t peerInboxKey_{0};
   uint64_t peerInboxPtr_{0};
   uint64_t peerInboxHead_{0};
 
+  // The reclamation of the memory of the inbox, and of the peer's one (on
+  // behalf of which we park our outbox).
+  InboxState inboxState_{INBOX_ACTIVE};
+  uint64_t numInboxBytesRead_{0};
+  uint64_t numInboxBytesReadAtIdleCheck_{0};
+  optional<TimerWheel::TTimerId> idleTimer_;
+  bool outboxParked_{false};
+  bool wakeRequested_{false};
+
+  // Large buffers are transferred with a rendezvous: once the receiver has got
+  // their length from the ringbuffer it registers their destination and writes
+  // its address into the sender's mailbox, upon which the sender writes the
+  // data there directly. As read and write operations are processed in order,
+  // there is at most one rendezvous in progress in each direction, hence the
+  // mailbox has a single slot. The first entry of this buffer is our mailbox,
+  // into which the peer writes, and second one is where we prepare the request
+  // that we write into the peer's mailbox.
+  struct RendezvousRequest {
+    uint64_t ptr;
+    uint32_t key;
+    uint32_t length;
+  };
+  std::unique_ptr<RendezvousRequest[]> rendezvousBuf_;
+  IbvMemoryRegion rendezvousMr_;
+  uint32_t peerMailboxKey_{0};
+  uint64_t peerMailboxPtr_{0};
+
+  // The state of the rendezvous of the read operation at the front of the
+  // queue, if any: the registration of the destination buffer, which exists
+  // for as long as we're waiting for the peer to write into it.
+  MemoryRegionCache::TRegion rendezvousReadMr_;
+
+  // The state of the rendezvous of the write operation at the front of the
+  // queue, if any: whether the peer has sent us the destination (which is then
+  // in our mailbox), and the registration of the source buffer, which exists
+  // while we're writing from it, and how many RDMA writes haven't completed.
+  bool rendezvousRequestReceived_{false};
+  MemoryRegionCache::TRegion rendezvousWriteMr_;
+  uint32_t numRendezvousWritesInFlight_{0};
+
   // The ringbuffer API is synchronous (it expects data to be consumed/produced
   // immediately "inline" when the buffer is accessed) but InfiniBand is
   // asynchronous, thus we need to abuse the ringbuffer API a bit. When new data
@@ -139,6 +264,14 @@ class ConnectionImpl final : public ConnectionImplBoilerplate<
   // track of how much data to skip with this field.
   uint32_t numBytesInFlight_{0};
 
+  // The number of bytes read from the inbox that haven't been acknowledged yet.
+  // They're held back until the reactor posts the requests of its iteration, so
+  // that they can ride along the RDMA writes that this side issues meanwhile;
+  // only what's left then is acknowledged with a send request, which is thus
+  // only needed when the traffic flows in one direction.
+  uint32_t numBytesToAck_{0};
+  bool ackFlushRequested_{false};
+
   // The connection performs two types of send requests: writing to the remote
   // inbox, or acknowledging a write into its own inbox. These send operations
   // could be delayed and stalled by the reactor as only a limited number of
@@ -176,6 +309,27 @@ class ConnectionImpl final : public ConnectionImplBoilerplate<
   // a new write operation is queued.
   void processWriteOperationsFromLoop();
 
+  // Post an RDMA write of the given buffer to the peer's inbox, splitting it
+  // across the lanes if it's large enough.
+  void postWritesForBufferFromLoop(const void* ptr, size_t length);
+
+  // Send the write operation at the front of the queue eagerly, with a single
+  // send request on the next lane, if it's small enough and it didn't start
+  // going through the ringbuffer. Returns whether it did (and completed it).
+  bool postEagerSendFromLoop(RingbufferWriteOperation& writeOperation);
+
+  // Commit the RDMA writes and the eager messages that have now arrived without
+  // any gap, in the order of the lanes.
+  void commitPendingDataFromLoop();
+
+  // Register the destination of the read operation at the front of the queue
+  // and send its address to the peer, to have it write the data there.
+  void requestRendezvousFromLoop(RingbufferReadOperation& readOperation);
+
+  // Write the source of the write operation at the front of the queue into the
+  // destination that the peer sent us.
+  void performRendezvousFromLoop(RingbufferWriteOperation& writeOperation);
+
   void tryCleanup();
   void cleanup();
 };
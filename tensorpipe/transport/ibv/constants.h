@@ -18,15 +18,15 @@ namespace {
 constexpr uint8_t kPortNum = 1;
 constexpr uint8_t kGlobalIdentifierIndex = 0;
 
-// FIXME Instead of hardcoding the next three values, we could use
-// ibv_query_device to obtain max_cqe, max_qp_wr and max_srq_wr and deduce from
-// them the maximum allowed values for these parameters.
+// The next three values are the defaults, which the user can override, and
+// which are lowered to the limits of the device (max_srq_wr, max_qp_wr and
+// max_cqe) if they exceed them.
 
 // How many simultaneous receive requests to keep queued on the shared receive
 // queue. Incoming RDMA writes and sends will consume one such request. The
-// reactor loop will fill the SRQ back up to this value once some requests
-// complete. So this number should just be large enough to accommodate all the
-// requests that could finish between two reactor loop iterations. And, even if
+// reactor loop will fill the SRQ back up to this value once enough requests
+// complete (see below). So this number should just be large enough to
+// accommodate all the requests that could finish in the meantime. And, even if
 // this number ends up being too low, the excess incoming requests will just
 // retry, causing a performance penalty but not a failure.
 constexpr uint32_t kNumPendingRecvReqs = 1024;
@@ -34,23 +34,71 @@ constexpr uint32_t kNumPendingRecvReqs = 1024;
 // How many RDMA write requests can be pending at the same time across all
 // connections. We need to put a limit on them because they all use the same
 // global completion queue which has a fixed capacity and if it overruns it will
-// enter an unrecoverable error state. This value is also set as the capacity of
-// the send queue of each queue pair.
+// enter an unrecoverable error state. The send queue of each queue pair has
+// room for these and for the next ones, which share it.
 constexpr uint32_t kNumPendingWriteReqs = 1024;
 
 // How many send requests (used by the receiver to acknowledge the RDMA writes
 // from the sender) can be pending at the same time across all connections.
 constexpr uint32_t kNumPendingAckReqs = 1024;
 
-// How many elements the completion queue should be able to hold. These elements
-// will be either the completed receive requests of the SRQ, or the completed
-// send requests from a connection's queue pair. We can bound the former value
-// but not the latter, so we try to add some margin.
-constexpr int kCompletionQueueSize =
-    kNumPendingRecvReqs + kNumPendingWriteReqs + kNumPendingAckReqs;
+// The completion queue is sized to hold the completions of all these requests,
+// i.e., either the completed receive requests of the SRQ, or the completed send
+// requests from a connection's queue pair.
+
+// The device is asked to signal when the SRQ holds fewer than this fraction of
+// its receive requests, which is when the reactor refills it. The reactor also
+// does so by itself once it counted that only this other fraction is left.
+constexpr uint32_t kSrqLimitDivisor = 2;
+constexpr uint32_t kSrqRefillDivisor = 4;
 
 // How many work completions to poll from the completion queue at each reactor
 // iteration.
 constexpr int kNumPolledWorkCompletions = 32;
 
+// Only one in this many send requests posted on a queue pair asks for a work
+// completion (as does the last one of each batch posted by the reactor), as the
+// completion of a request implies the one of all those posted before it on the
+// same queue pair. This reduces the traffic on the completion queue.
+constexpr uint32_t kSignalingInterval = 16;
+
+// How many bytes of data a work request can carry inline, i.e., copied into the
+// request itself at the time it's posted, rather than have the device fetch it
+// from registered memory with an additional DMA read. The device may grant more
+// than this, in which case we use what it granted, and if it supports less we
+// ask for less (possibly none).
+constexpr uint32_t kMaxInlineDataSize = 64;
+
+// Messages up to this large (and up to the amount of inline data that the
+// device granted) are sent eagerly, i.e., in full, with a send request, rather
+// than through the ringbuffers. They land into the buffers of the receive
+// requests of the shared receive queue, which are this large, and they're read
+// from there, without taking up space in the inbox nor being acknowledged. Both
+// ends of a connection must use the same value.
+constexpr uint32_t kMaxEagerMessageSize = 256;
+
+// The maximum number of queue pairs (or "lanes") that a connection can stripe
+// its data across. The two endpoints of a connection use the lowest of the
+// values they were configured with.
+constexpr size_t kMaxNumLanes = 8;
+
+// When a connection has multiple lanes, a contiguous chunk of data is split
+// into as many pieces as there are lanes, as long as each of them is at least
+// this large. Smaller chunks go on a single lane, since they wouldn't benefit
+// from being spread out but would cost more work requests.
+constexpr size_t kMinStripeSize = 64 * 1024;
+
+// Buffers at least this large aren't copied through the ringbuffers. Instead
+// the receiver registers their destination and sends its address to the
+// sender, which then writes them there directly from their source. This saves
+// two copies but costs a round trip and two memory registrations. Both ends of
+// a connection must use the same value.
+constexpr size_t kRendezvousThreshold = 256 * 1024;
+
+// The bounds on the size of the inboxes. The upper one leaves the top bits of
+// the immediate data of the RDMA writes into the inbox, which carries their
+// length, free to flag the rendezvous ones.
+constexpr size_t kMinBufferSize = 4096;
+constexpr size_t kMaxBufferSize = 1 << 29;
+
 } // namespace
@@ -8,12 +8,17 @@
 
 #include <tensorpipe/transport/ibv/context.h>
 
+#include <map>
 #include <memory>
 #include <string>
 #include <tuple>
 #include <utility>
+#include <vector>
 
+#include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/system.h>
 #include <tensorpipe/transport/ibv/connection_impl.h>
 #include <tensorpipe/transport/ibv/context_impl.h>
 #include <tensorpipe/transport/ibv/listener_impl.h>
@@ -22,38 +27,132 @@ namespace tensorpipe {
 namespace transport {
 namespace ibv {
 
-Context::Context() : impl_(std::make_shared<ContextImpl>()) {}
+namespace {
+
+std::vector<std::shared_ptr<ContextImpl>> createContextImpls(
+    const IbvOptions& ibvOptions,
+    const ThreadOptions& threadOptions) {
+  const size_t numReactors = ibvOptions.getNumReactors();
+  TP_THROW_ASSERT_IF(numReactors < 1)
+      << "The number of reactors must be at least one, got " << numReactors;
+  // No port stands for the default one.
+  const std::vector<NicPort>& nicPorts = ibvOptions.getNicPorts();
+  std::vector<optional<NicPort>> ports(nicPorts.begin(), nicPorts.end());
+  if (ports.empty()) {
+    ports.emplace_back(nullopt);
+  }
+  std::vector<std::shared_ptr<ContextImpl>> impls;
+  std::vector<std::weak_ptr<ContextImpl>> contextsForConnections;
+  for (const optional<NicPort>& port : ports) {
+    for (size_t idx = 0; idx < numReactors; idx++) {
+      impls.push_back(std::make_shared<ContextImpl>(
+          ibvOptions.getSpinDuration(),
+          ibvOptions.getNumLanes(),
+          ibvOptions.getRegistrationCacheCapacity(),
+          ibvOptions.getBufferSize(),
+          threadOptions,
+          ibvOptions.getQueueCapacities(),
+          ibvOptions.getIdleTimeout(),
+          port));
+      contextsForConnections.push_back(impls.back());
+    }
+  }
+  if (impls.size() > 1) {
+    impls[0]->setContextsForConnections(std::move(contextsForConnections));
+  }
+  return impls;
+}
+
+} // namespace
+
+Context::Context(IbvOptions ibvOptions, ThreadOptions threadOptions)
+    : impls_(createContextImpls(ibvOptions, threadOptions)) {}
 
 // Explicitly define all methods of the context, which just forward to the impl.
 // We cannot use an intermediate ContextBoilerplate class without forcing a
 // recursive include of private headers into the public ones.
 
 std::shared_ptr<Connection> Context::connect(std::string addr) {
-  return impl_->connect(std::move(addr));
+  return connectOnNumaNode(std::move(addr), -1);
+}
+
+std::shared_ptr<Connection> Context::connectOnNumaNode(
+    std::string addr,
+    int numaNode) {
+  return impls_[0]
+      ->getContextForNextConnection(
+          numaNode >= 0 ? numaNode : getNumaNodeOfCurrentCpu())
+      ->connect(std::move(addr));
 }
 
 std::shared_ptr<Listener> Context::listen(std::string addr) {
-  return impl_->listen(std::move(addr));
+  return impls_[0]->listen(std::move(addr));
 }
 
 bool Context::isViable() const {
-  return impl_->isViable();
+  return impls_[0]->isViable();
 }
 
 const std::string& Context::domainDescriptor() const {
-  return impl_->domainDescriptor();
+  return impls_[0]->domainDescriptor();
 }
 
 void Context::setId(std::string id) {
-  impl_->setId(std::move(id));
+  for (size_t idx = 1; idx < impls_.size(); idx++) {
+    impls_[idx]->setId(id + ".r" + std::to_string(idx));
+  }
+  impls_[0]->setId(std::move(id));
+}
+
+void Context::enableLoopStats() {
+  for (auto& impl : impls_) {
+    impl->enableLoopStats();
+  }
+}
+
+std::map<std::string, LoopStats> Context::getLoopStats() {
+  std::map<std::string, LoopStats> stats = impls_[0]->getLoopStats();
+  for (size_t idx = 1; idx < impls_.size(); idx++) {
+    for (auto& iter : impls_[idx]->getLoopStats()) {
+      stats.emplace(iter.first + std::to_string(idx), std::move(iter.second));
+    }
+  }
+  return stats;
+}
+
+TransportStats Context::getTransportStats() {
+  TransportStats stats;
+  for (auto& impl : impls_) {
+    stats.merge(impl->getTransportStats());
+  }
+  return stats;
+}
+
+MemoryFootprint Context::getMemoryFootprint() {
+  MemoryFootprint footprint;
+  for (auto& impl : impls_) {
+    footprint.merge(impl->getMemoryFootprint());
+  }
+  return footprint;
+}
+
+void Context::reclaimMemory() {
+  for (auto& impl : impls_) {
+    impl->reclaimMemory();
+  }
 }
 
 void Context::close() {
-  impl_->close();
+  for (auto& impl : impls_) {
+    impl->close();
+  }
 }
 
 void Context::join() {
-  impl_->join();
+  close();
+  for (auto& impl : impls_) {
+    impl->join();
+  }
 }
 
 Context::~Context() {
@@ -61,11 +160,17 @@ Context::~Context() {
 }
 
 std::tuple<Error, std::string> Context::lookupAddrForIface(std::string iface) {
-  return impl_->lookupAddrForIface(std::move(iface));
+  return impls_[0]->lookupAddrForIface(std::move(iface));
 }
 
 std::tuple<Error, std::string> Context::lookupAddrForHostname() {
-  return impl_->lookupAddrForHostname();
+  return impls_[0]->lookupAddrForHostname();
+}
+
+void Context::invalidateMemoryRegistrations(void* ptr, size_t length) {
+  for (auto& impl : impls_) {
+    impl->invalidateMemoryRegistrations(ptr, length);
+  }
 }
 
 } // namespace ibv
@@ -8,11 +8,17 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <map>
 #include <memory>
 #include <string>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/thread_options.h>
 #include <tensorpipe/transport/context.h>
 
 namespace tensorpipe {
@@ -21,9 +27,191 @@ namespace ibv {
 
 class ContextImpl;
 
+// The default time for which the reactor keeps polling after its last event.
+constexpr std::chrono::microseconds kDefaultSpinDuration{100};
+
+// The default size of the connections' inboxes, see below.
+constexpr size_t kDefaultBufferSize = 2 * 1024 * 1024;
+
+// How many work requests of each kind the reactor can have outstanding at once,
+// see below. Zero stands for the default value.
+struct QueueCapacities {
+  // The receive requests of the shared receive queue, one of which is consumed
+  // by each incoming RDMA write and send. Each has a registered buffer of 256
+  // bytes for the small messages that are sent eagerly.
+  size_t numRecvReqs{0};
+  // The RDMA writes (and the eager sends), across all connections.
+  size_t numWriteReqs{0};
+  // The sends acknowledging the data read from the inboxes, across all
+  // connections.
+  size_t numAckReqs{0};
+  // The queue pairs, across all connections, beyond which new connections get
+  // a single one, whatever the number of lanes. Zero stands for no limit.
+  size_t numQueuePairs{0};
+};
+
+// A port of an InfiniBand NIC, given by the name of the device (as listed by
+// ibv_devices), and the index of the GID of that port through which to reach
+// the peers.
+struct NicPort {
+  std::string deviceName;
+  uint8_t portNum{1};
+  uint8_t globalIdentifierIndex{0};
+};
+
+// How the context sets up its reactors and the connections they handle. The
+// defaults use a single reactor, on port 1 of the first device with GID 0, and
+// give each connection a single queue pair and an inbox of kDefaultBufferSize.
+class IbvOptions {
+ public:
+  // The reactor busy-polls the completion queue, which gives the lowest latency
+  // but costs a full core. Once it hasn't seen any event for this long it asks
+  // to be notified of the next work completion, through a completion channel,
+  // and goes to sleep until then, hence an idle context costs no CPU. Pass the
+  // maximum duration to have it never sleep.
+  IbvOptions&& spinDuration(std::chrono::microseconds duration) && {
+    spinDuration_ = duration;
+    return std::move(*this);
+  }
+
+  // Stripe the large writes of each connection across this many queue pairs
+  // (up to eight), which allows a single connection to make better use of fast
+  // links. The two ends of a connection agree on the lowest of their values.
+  // As the device caches the state of only so many queue pairs, and its message
+  // rate drops once they don't fit, processes with many peers should set a
+  // budget of queue pairs in the queue capacities, past which the new
+  // connections don't stripe. The number in use shows in the transport
+  // statistics.
+  IbvOptions&& numLanes(size_t numLanes) && {
+    numLanes_ = numLanes;
+    return std::move(*this);
+  }
+
+  // Large buffers are transferred directly from and to the user's memory, which
+  // needs to be registered with the device. Where the device supports on-demand
+  // paging, the memory that is sent from needs no registration at all, and the
+  // one that is received into is registered without being pinned, which is much
+  // cheaper. If this isn't zero, up to that many registrations are kept around
+  // to be reused by later transfers involving the same memory. In that case the
+  // user must call Context::invalidateMemoryRegistrations before deallocating
+  // any such memory.
+  IbvOptions&& registrationCacheCapacity(size_t capacity) && {
+    registrationCacheCapacity_ = capacity;
+    return std::move(*this);
+  }
+
+  // Each connection receives data through an inbox ringbuffer of this many
+  // bytes (a power of two, between a page and 512MiB), which the peer writes
+  // into with RDMA. The peer sizes its outbox to match, hence the two ends of a
+  // connection may use different values. Messages that fit in the inline data
+  // of a send request (up to 256 bytes) skip the ringbuffers: they're sent as
+  // they are, into the buffers of the shared receive queue, and are read from
+  // there.
+  IbvOptions&& bufferSize(size_t size) && {
+    bufferSize_ = size;
+    return std::move(*this);
+  }
+
+  // The queues of the device are sized after these, lowered to the limits that
+  // the device reports, such that the completion queue can hold the
+  // completions of all the requests.
+  IbvOptions&& queueCapacities(QueueCapacities capacities) && {
+    queueCapacities_ = capacities;
+    return std::move(*this);
+  }
+
+  // A single reactor can only handle so many messages per second. With more
+  // than one, each has its own thread, device context, completion queue and
+  // shared receive queue (and epoll loop), and the connections, whether opened
+  // or accepted, are assigned to them in turn. All of the other options apply
+  // to each reactor, including the thread options and the queue capacities.
+  IbvOptions&& numReactors(size_t numReactors) && {
+    numReactors_ = numReactors;
+    return std::move(*this);
+  }
+
+  // If this isn't zero, a connection whose inbox has stayed empty for that
+  // long, and up to twice as long, has the peer hold back its writes, and then
+  // they both deregister and give back the memory of the inbox and of the
+  // outbox that mirrors it. They register it again as soon as the peer has
+  // something to write, which costs a round trip over the TCP socket of the
+  // connection and the registration. This is for processes that keep many
+  // mostly idle connections, where those buffers would otherwise pin a lot of
+  // memory. The queue pairs are kept. The empty inboxes are reclaimed in the
+  // same way, whatever the timeout, when the context is asked to (see
+  // transport::Context::reclaimMemory).
+  IbvOptions&& idleTimeout(std::chrono::milliseconds timeout) && {
+    idleTimeout_ = timeout;
+    return std::move(*this);
+  }
+
+  // Use these ports, rather than the default one, each of which then gets its
+  // own reactors (as many as numReactors). The reactors of a port run on, and
+  // place the buffers of their connections on, the NUMA node of its NIC,
+  // unless the thread options say otherwise. Each new connection goes to the
+  // reactor handling the fewest connections, among those on the NUMA node of
+  // the thread that opens it, if there are any (the accepted connections don't
+  // have such a thread, and go by the load only). The two ends of a connection
+  // may use different NICs, as long as these can reach each other.
+  IbvOptions&& nicPorts(std::vector<NicPort> ports) && {
+    nicPorts_ = std::move(ports);
+    return std::move(*this);
+  }
+
+  std::chrono::microseconds getSpinDuration() const {
+    return spinDuration_;
+  }
+
+  size_t getNumLanes() const {
+    return numLanes_;
+  }
+
+  // Zero means disabled.
+  size_t getRegistrationCacheCapacity() const {
+    return registrationCacheCapacity_;
+  }
+
+  size_t getBufferSize() const {
+    return bufferSize_;
+  }
+
+  const QueueCapacities& getQueueCapacities() const {
+    return queueCapacities_;
+  }
+
+  size_t getNumReactors() const {
+    return numReactors_;
+  }
+
+  // Zero means disabled.
+  std::chrono::milliseconds getIdleTimeout() const {
+    return idleTimeout_;
+  }
+
+  // Empty means the default port.
+  const std::vector<NicPort>& getNicPorts() const {
+    return nicPorts_;
+  }
+
+ private:
+  std::chrono::microseconds spinDuration_{kDefaultSpinDuration};
+  size_t numLanes_{1};
+  size_t registrationCacheCapacity_{0};
+  size_t bufferSize_{kDefaultBufferSize};
+  QueueCapacities queueCapacities_;
+  size_t numReactors_{1};
+  std::chrono::milliseconds idleTimeout_{0};
+  std::vector<NicPort> nicPorts_;
+};
+
 class Context : public transport::Context {
  public:
-  Context();
+  // The reactors and their connections are set up according to ibvOptions, and
+  // the threads of the reactors and of their epoll loops according to
+  // threadOptions.
+  explicit Context(
+      IbvOptions ibvOptions = IbvOptions(),
+      ThreadOptions threadOptions = ThreadOptions());
 
   Context(const Context&) = delete;
   Context(Context&&) = delete;
@@ -32,6 +220,12 @@ class Context : public transport::Context {
 
   std::shared_ptr<Connection> connect(std::string addr) override;
 
+  // The connection goes to a reactor whose NIC is on the given NUMA node, if
+  // there are any, rather than on the one of the calling thread (see above).
+  std::shared_ptr<Connection> connectOnNumaNode(
+      std::string addr,
+      int numaNode) override;
+
   std::shared_ptr<Listener> listen(std::string addr) override;
 
   bool isViable() const override;
@@ -42,8 +236,23 @@ class Context : public transport::Context {
 
   std::tuple<Error, std::string> lookupAddrForHostname();
 
+  // Drop the cached registrations that overlap the given memory. Once this
+  // returns, the memory can be safely deallocated, as soon as all the
+  // operations that use it have completed.
+  void invalidateMemoryRegistrations(void* ptr, size_t length);
+
   void setId(std::string id) override;
 
+  void enableLoopStats() override;
+
+  std::map<std::string, LoopStats> getLoopStats() override;
+
+  TransportStats getTransportStats() override;
+
+  MemoryFootprint getMemoryFootprint() override;
+
+  void reclaimMemory() override;
+
   void close() override;
 
   void join() override;
@@ -51,11 +260,14 @@ class Context : public transport::Context {
   ~Context() override;
 
  private:
-  // The implementation is managed by a shared_ptr because each child object
-  // will also hold a shared_ptr to it (downcast as a shared_ptr to the private
-  // interface). However, its lifetime is tied to the one of this public object,
-  // since when the latter is destroyed the implementation is closed and joined.
-  const std::shared_ptr<ContextImpl> impl_;
+  // The implementations are managed by shared_ptrs because each child object
+  // will also hold a shared_ptr to its own (downcast as a shared_ptr to the
+  // private interface). However, their lifetime is tied to the one of this
+  // public object, since when the latter is destroyed they're closed and
+  // joined. There is one per reactor, and the first one is the one that the
+  // listeners belong to and that hands out the connections. The lookups of
+  // addresses and the domain descriptor are also the first one's.
+  const std::vector<std::shared_ptr<ContextImpl>> impls_;
 };
 
 } // namespace ibv
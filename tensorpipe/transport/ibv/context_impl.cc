@@ -23,6 +23,7 @@
 #include <tensorpipe/common/socket.h>
 #include <tensorpipe/common/system.h>
 #include <tensorpipe/transport/ibv/connection_impl.h>
+#include <tensorpipe/transport/ibv/constants.h>
 #include <tensorpipe/transport/ibv/error.h>
 #include <tensorpipe/transport/ibv/listener_impl.h>
 #include <tensorpipe/transport/ibv/reactor.h>
@@ -38,6 +39,32 @@ namespace {
 // disambiguate descriptors when debugging.
 const std::string kDomainDescriptorPrefix{"ibv:"};
 
+// Wakes up the reactor when the completion queue has new work completions.
+class CompletionChannelHandler final : public EpollLoop::EventHandler {
+ public:
+  explicit CompletionChannelHandler(Reactor& reactor) : reactor_(reactor) {}
+
+  void handleEventsFromLoop(int /* unused */) override {
+    reactor_.handleCompletionChannelEventsFromLoop();
+  }
+
+ private:
+  Reactor& reactor_;
+};
+
+// Hands the asynchronous events of the device over to the reactor.
+class AsyncEventHandler final : public EpollLoop::EventHandler {
+ public:
+  explicit AsyncEventHandler(Reactor& reactor) : reactor_(reactor) {}
+
+  void handleEventsFromLoop(int /* unused */) override {
+    reactor_.handleAsyncEventsFromLoop();
+  }
+
+ private:
+  Reactor& reactor_;
+};
+
 std::string generateDomainDescriptor() {
   // It would be very cool if we could somehow obtain an "identifier" for the
   // InfiniBand subnet that our device belongs to, but nothing of that sort
@@ -104,16 +131,63 @@ std::tuple<Error, AddressInfo> createAddressInfo(std::string host) {
 
 } // namespace
 
-ContextImpl::ContextImpl()
+ContextImpl::ContextImpl(
+    std::chrono::microseconds spinDuration,
+    size_t numLanes,
+    size_t registrationCacheCapacity,
+    size_t bufferSize,
+    ThreadOptions threadOptions,
+    QueueCapacities queueCapacities,
+    std::chrono::milliseconds idleTimeout,
+    optional<NicPort> nicPort)
     : ContextImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
-          generateDomainDescriptor()) {}
+          generateDomainDescriptor()),
+      reactor_(
+          spinDuration,
+          registrationCacheCapacity,
+          queueCapacities,
+          nicPort,
+          getStatsCounters(),
+          threadOptions),
+      loop_(reactor_, threadOptions),
+      numLanes_(numLanes),
+      bufferSize_(bufferSize),
+      numaNode_(reactor_.getThreadNumaNode()),
+      idleTimeout_(idleTimeout) {
+  TP_THROW_ASSERT_IF(numLanes_ < 1 || numLanes_ > kMaxNumLanes)
+      << "The number of lanes must be between 1 and " << kMaxNumLanes
+      << ", got " << numLanes_;
+  TP_THROW_ASSERT_IF(
+      !isPow2(bufferSize_) || bufferSize_ < kMinBufferSize ||
+      bufferSize_ > kMaxBufferSize)
+      << "The buffer size must be a power of two between " << kMinBufferSize
+      << " and " << kMaxBufferSize << " bytes, got " << bufferSize_;
+
+  if (reactor_.isViable()) {
+    reactor_.runInLoop([this]() {
+      loop_.registerDescriptor(
+          reactor_.getCompletionChannelFd(),
+          EPOLLIN,
+          std::make_shared<CompletionChannelHandler>(reactor_));
+      loop_.registerDescriptor(
+          reactor_.getAsyncEventFd(),
+          EPOLLIN,
+          std::make_shared<AsyncEventHandler>(reactor_));
+    });
+  }
+}
 
 void ContextImpl::closeImpl() {
+  if (reactor_.isViable()) {
+    loop_.unregisterDescriptor(reactor_.getCompletionChannelFd());
+    loop_.unregisterDescriptor(reactor_.getAsyncEventFd());
+  }
   loop_.close();
   reactor_.close();
 }
 
 void ContextImpl::joinImpl() {
+  timerWheel_.join();
   loop_.join();
   reactor_.join();
 }
@@ -209,10 +283,19 @@ bool ContextImpl::inLoop() {
   return reactor_.inLoop();
 };
 
-void ContextImpl::deferToLoop(std::function<void()> fn) {
+void ContextImpl::deferToLoop(TTask fn) {
   reactor_.deferToLoop(std::move(fn));
 };
 
+void ContextImpl::enableLoopStats() {
+  reactor_.enableStats();
+  loop_.enableStats();
+}
+
+std::map<std::string, LoopStats> ContextImpl::getLoopStats() {
+  return {{"reactor", reactor_.getStats()}, {"epoll", loop_.getStats()}};
+}
+
 void ContextImpl::registerDescriptor(
     int fd,
     int events,
@@ -228,6 +311,81 @@ Reactor& ContextImpl::getReactor() {
   return reactor_;
 }
 
+size_t ContextImpl::getNumLanes() const {
+  return numLanes_;
+}
+
+size_t ContextImpl::getBufferSize() const {
+  return bufferSize_;
+}
+
+int ContextImpl::getNumaNode() const {
+  return numaNode_;
+}
+
+std::chrono::milliseconds ContextImpl::getIdleTimeout() const {
+  return idleTimeout_;
+}
+
+TimerWheel& ContextImpl::getTimerWheel() {
+  return timerWheel_;
+}
+
+void ContextImpl::invalidateMemoryRegistrations(void* ptr, size_t length) {
+  reactor_.runInLoop([&]() {
+    reactor_.getMemoryRegionCache().invalidate(ptr, length);
+  });
+}
+
+void ContextImpl::setContextsForConnections(
+    std::vector<std::weak_ptr<ContextImpl>> contexts) {
+  contextsForConnections_ = std::move(contexts);
+}
+
+std::shared_ptr<ContextImpl> ContextImpl::getContextForNextConnection(
+    int numaNode) {
+  if (contextsForConnections_.empty()) {
+    return shared_from_this();
+  }
+  // The counts may be a bit behind, as the connections only start being
+  // counted once they're initialized in their loop, and thus bursts of new
+  // connections are still spread by starting each search at the next context.
+  const size_t firstIdx = nextContextForConnection_++;
+  std::shared_ptr<ContextImpl> bestContext;
+  std::tuple<bool, size_t> bestScore;
+  for (size_t offset = 0; offset < contextsForConnections_.size(); offset++) {
+    const size_t idx = (firstIdx + offset) % contextsForConnections_.size();
+    std::shared_ptr<ContextImpl> context = contextsForConnections_[idx].lock();
+    // The public context keeps all of them alive as long as it can be used.
+    TP_DCHECK(context != nullptr);
+    if (context == nullptr) {
+      continue;
+    }
+    // Scores are compared lexicographically: locality first, then load.
+    std::tuple<bool, size_t> score(
+        numaNode >= 0 && context->getReactor().getNicNumaNode() != numaNode,
+        context->getNumConnections());
+    if (bestContext == nullptr || score < bestScore) {
+      bestContext = std::move(context);
+      bestScore = score;
+    }
+  }
+  return bestContext != nullptr ? std::move(bestContext) : shared_from_this();
+}
+
+void ContextImpl::onConnectionOpened() {
+  numConnections_++;
+}
+
+void ContextImpl::onConnectionClosed() {
+  TP_DCHECK_GT(numConnections_.load(), 0);
+  numConnections_--;
+}
+
+size_t ContextImpl::getNumConnections() const {
+  return numConnections_.load();
+}
+
 } // namespace ibv
 } // namespace transport
 } // namespace tensorpipe
@@ -8,12 +8,18 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <map>
 #include <memory>
 #include <string>
 #include <tuple>
+#include <vector>
 
 #include <tensorpipe/common/epoll_loop.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/timer_wheel.h>
 #include <tensorpipe/transport/context_impl_boilerplate.h>
 #include <tensorpipe/transport/ibv/reactor.h>
 
@@ -27,7 +33,15 @@ class ListenerImpl;
 class ContextImpl final
     : public ContextImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl> {
  public:
-  ContextImpl();
+  ContextImpl(
+      std::chrono::microseconds spinDuration,
+      size_t numLanes,
+      size_t registrationCacheCapacity,
+      size_t bufferSize,
+      ThreadOptions threadOptions,
+      QueueCapacities queueCapacities,
+      std::chrono::milliseconds idleTimeout,
+      optional<NicPort> nicPort);
 
   bool isViable() const;
 
@@ -37,7 +51,11 @@ class ContextImpl final
 
   // Implement the DeferredExecutor interface.
   bool inLoop() override;
-  void deferToLoop(std::function<void()> fn) override;
+  void deferToLoop(TTask fn) override;
+
+  void enableLoopStats();
+
+  std::map<std::string, LoopStats> getLoopStats();
 
   void registerDescriptor(
       int fd,
@@ -48,6 +66,40 @@ class ContextImpl final
 
   Reactor& getReactor();
 
+  size_t getNumLanes() const;
+
+  size_t getBufferSize() const;
+
+  // The NUMA node on which to place the connections' buffers, or -1 if none.
+  int getNumaNode() const;
+
+  // How long an inbox must stay empty before its memory is reclaimed, or zero
+  // if it never is.
+  std::chrono::milliseconds getIdleTimeout() const;
+
+  // For the connections to check whether they're idle, once in a while.
+  TimerWheel& getTimerWheel();
+
+  void invalidateMemoryRegistrations(void* ptr, size_t length);
+
+  // The contexts (this one included) that share the connections opened or
+  // accepted through this one, which hands them out. It must be called before
+  // any connection is opened.
+  void setContextsForConnections(
+      std::vector<std::weak_ptr<ContextImpl>> contexts);
+
+  // The one handling the fewest connections, among those whose NIC is on the
+  // given NUMA node if there are any (or among all of them if it's -1), with
+  // the ties going to each of them in turn.
+  std::shared_ptr<ContextImpl> getContextForNextConnection(int numaNode);
+
+  // Called by the connections when they start and stop being handled by this
+  // context, to keep count of them.
+  void onConnectionOpened();
+  void onConnectionClosed();
+
+  size_t getNumConnections() const;
+
  protected:
   // Implement the entry points called by ContextImplBoilerplate.
   void closeImpl() override;
@@ -55,7 +107,21 @@ class ContextImpl final
 
  private:
   Reactor reactor_;
-  EpollLoop loop_{this->reactor_};
+  // Integrated with the reactor, which polls epoll and runs the handlers.
+  EpollLoop loop_;
+  const size_t numLanes_;
+  const size_t bufferSize_;
+  const int numaNode_;
+  const std::chrono::milliseconds idleTimeout_;
+
+  // Its thread is only started by the first timer, hence it costs nothing if
+  // idle connections aren't reclaimed.
+  TimerWheel timerWheel_{std::chrono::milliseconds(10), 512, "TP_IBV_timer"};
+
+  std::vector<std::weak_ptr<ContextImpl>> contextsForConnections_;
+  std::atomic<size_t> nextContextForConnection_{0};
+  // Read by the context that hands out the connections, from any thread.
+  std::atomic<size_t> numConnections_{0};
 };
 
 } // namespace ibv
@@ -146,7 +146,14 @@ void ListenerImpl::handleEventsFromLoop(int events) {
   if (fns_.empty()) {
     context_->unregisterDescriptor(socket_.fd());
   }
-  fn(Error::kSuccess, createAndInitConnection(std::move(socket)));
+  std::shared_ptr<ContextImpl> context =
+      context_->getContextForNextConnection(/*numaNode=*/-1);
+  if (context == context_) {
+    fn(Error::kSuccess, createAndInitConnection(std::move(socket)));
+  } else {
+    fn(Error::kSuccess,
+       createConnectionInContext(std::move(context), std::move(socket)));
+  }
 }
 
 } // namespace ibv
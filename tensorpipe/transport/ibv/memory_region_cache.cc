@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/ibv/memory_region_cache.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace ibv {
+
+namespace {
+
+// The implicit ODP registration gives no remote access, as its rkey would let
+// the peer write anywhere in the process.
+constexpr int kImplicitOdpAccessFlags = IbvLib::ACCESS_LOCAL_WRITE;
+
+} // namespace
+
+MemoryRegionCache::MemoryRegionCache(
+    IbvLib& ibvLib,
+    IbvProtectionDomain& pd,
+    size_t capacity)
+    : ibvLib_(ibvLib), pd_(pd), capacity_(capacity) {}
+
+MemoryRegionCache::TRegion MemoryRegionCache::getRegion(
+    void* ptr,
+    size_t length,
+    int accessFlags) {
+  TP_DCHECK_GT(length, 0);
+
+  probeOnDemandPaging();
+  if (implicitOdpMr_ != nullptr) {
+    if ((accessFlags & ~kImplicitOdpAccessFlags) == 0) {
+      // The cache owns the registration, and outlives the operations.
+      return TRegion(TRegion(), implicitOdpMr_.get());
+    }
+    accessFlags |= IbvLib::ACCESS_ON_DEMAND;
+  }
+
+  if (capacity_ == 0) {
+    auto entry = std::make_shared<Entry>();
+    entry->mr = createIbvMemoryRegion(ibvLib_, pd_, ptr, length, accessFlags);
+    return regionOf(entry);
+  }
+
+  const uintptr_t pageSize = ::getpagesize();
+  uintptr_t begin = reinterpret_cast<uintptr_t>(ptr) & ~(pageSize - 1);
+  uintptr_t end = (reinterpret_cast<uintptr_t>(ptr) + length + pageSize - 1) &
+      ~(pageSize - 1);
+
+  // As the intervals don't overlap, the only one that could contain the memory
+  // is the last one that begins before it.
+  auto iter = entries_.upper_bound(begin);
+  if (iter != entries_.begin()) {
+    const std::shared_ptr<Entry>& entry = std::prev(iter)->second;
+    if (entry->end >= end &&
+        (entry->accessFlags & accessFlags) == accessFlags) {
+      lru_.splice(lru_.begin(), lru_, entry->lruIter);
+      return regionOf(entry);
+    }
+  }
+
+  // Replace all the intervals that overlap the memory with a single one.
+  iter = entries_.lower_bound(begin);
+  if (iter != entries_.begin() && std::prev(iter)->second->end > begin) {
+    --iter;
+  }
+  while (iter != entries_.end() && iter->first < end) {
+    begin = std::min(begin, iter->second->begin);
+    end = std::max(end, iter->second->end);
+    accessFlags |= iter->second->accessFlags;
+    iter = eraseEntry(iter);
+  }
+
+  auto entry = std::make_shared<Entry>();
+  entry->begin = begin;
+  entry->end = end;
+  entry->accessFlags = accessFlags;
+  entry->mr = createIbvMemoryRegion(
+      ibvLib_, pd_, reinterpret_cast<void*>(begin), end - begin, accessFlags);
+  entry->lruIter = lru_.insert(lru_.begin(), begin);
+  entries_.emplace(begin, entry);
+
+  evictUnusedEntries();
+
+  return regionOf(entry);
+}
+
+void MemoryRegionCache::invalidate(void* ptr, size_t length) {
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(ptr);
+  const uintptr_t end = begin + length;
+
+  auto iter = entries_.lower_bound(begin);
+  if (iter != entries_.begin() && std::prev(iter)->second->end > begin) {
+    --iter;
+  }
+  while (iter != entries_.end() && iter->first < end) {
+    iter = eraseEntry(iter);
+  }
+}
+
+void MemoryRegionCache::probeOnDemandPaging() {
+  if (probedOnDemandPaging_) {
+    return;
+  }
+  probedOnDemandPaging_ = true;
+  implicitOdpMr_ = createIbvImplicitOnDemandMemoryRegion(
+      ibvLib_, pd_, kImplicitOdpAccessFlags);
+  TP_VLOG(5) << "InfiniBand device "
+             << (implicitOdpMr_ != nullptr ? "supports" : "doesn't support")
+             << " implicit on-demand paging";
+}
+
+MemoryRegionCache::TRegion MemoryRegionCache::regionOf(
+    const std::shared_ptr<Entry>& entry) {
+  // Share the ownership of the entry, so that it stays registered while in use
+  // even if it's evicted or invalidated in the meantime.
+  return TRegion(entry, entry->mr.get());
+}
+
+std::map<uintptr_t, std::shared_ptr<MemoryRegionCache::Entry>>::iterator
+MemoryRegionCache::eraseEntry(
+    std::map<uintptr_t, std::shared_ptr<Entry>>::iterator iter) {
+  lru_.erase(iter->second->lruIter);
+  return entries_.erase(iter);
+}
+
+void MemoryRegionCache::evictUnusedEntries() {
+  auto lruIter = lru_.end();
+  while (entries_.size() > capacity_ && lruIter != lru_.begin()) {
+    --lruIter;
+    auto iter = entries_.find(*lruIter);
+    TP_DCHECK(iter != entries_.end());
+    if (iter->second.use_count() > 1) {
+      continue;
+    }
+    // Erasing invalidates the iterator, hence move it past the entry first.
+    ++lruIter;
+    eraseEntry(iter);
+  }
+}
+
+} // namespace ibv
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+
+#include <tensorpipe/common/ibv.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace ibv {
+
+// Registers host memory with the InfiniBand device and, if given a non-zero
+// capacity, keeps the registrations around after they've been used, so that
+// transferring again from or to the same buffers doesn't have to pay for an
+// ibv_reg_mr each time.
+//
+// The registrations are kept as a set of disjoint page-aligned intervals, with
+// a new registration that overlaps existing ones replacing them all with one
+// that covers their union. When there are more of them than the capacity, the
+// least recently used ones that aren't in use are deregistered.
+//
+// The device keeps accessing the physical pages that were registered, even if
+// the virtual memory is unmapped and something else is mapped in its place.
+// Hence the user must invalidate the buffers before deallocating them, which is
+// why caching is opt-in. Regions that are in use when they're invalidated stay
+// registered until they're released.
+//
+// Where the device supports on-demand paging (ODP), it doesn't need the memory
+// to be registered beforehand, nor pinned: the memory that's only accessed
+// locally (i.e., sent from) goes through a single registration of the whole
+// address space, and the one that the peer accesses (i.e., written into) is
+// registered with ODP, which doesn't pin it and is thus much cheaper, and only
+// exposes that memory to the peer. As such registrations follow the mappings
+// of the virtual memory, they don't go stale either. Whether it's supported is
+// found out upon the first registration, falling back to regular ones if not.
+//
+// This class isn't thread-safe: it's meant to be used from the reactor thread.
+class MemoryRegionCache {
+ public:
+  // A registration covering (at least) the requested memory, which remains
+  // valid for as long as this pointer (or a copy of it) is held.
+  using TRegion = std::shared_ptr<IbvLib::mr>;
+
+  MemoryRegionCache(IbvLib& ibvLib, IbvProtectionDomain& pd, size_t capacity);
+
+  TRegion getRegion(void* ptr, size_t length, int accessFlags);
+
+  // Forget about the registrations that overlap the given memory.
+  void invalidate(void* ptr, size_t length);
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+  bool usesOnDemandPaging() const {
+    return implicitOdpMr_ != nullptr;
+  }
+
+ private:
+  struct Entry {
+    uintptr_t begin;
+    uintptr_t end;
+    int accessFlags;
+    IbvMemoryRegion mr;
+    std::list<uintptr_t>::iterator lruIter;
+  };
+
+  IbvLib& ibvLib_;
+  IbvProtectionDomain& pd_;
+  const size_t capacity_;
+
+  // The implicit ODP registration, if the device supports it. The protection
+  // domain may not exist yet when this is constructed, hence it's probed for on
+  // first use.
+  bool probedOnDemandPaging_{false};
+  IbvMemoryRegion implicitOdpMr_;
+
+  // Keyed by the beginning of the intervals, which don't overlap.
+  std::map<uintptr_t, std::shared_ptr<Entry>> entries_;
+  // The beginnings of the intervals, from the most to the least recently used.
+  std::list<uintptr_t> lru_;
+
+  void probeOnDemandPaging();
+
+  TRegion regionOf(const std::shared_ptr<Entry>& entry);
+
+  std::map<uintptr_t, std::shared_ptr<Entry>>::iterator eraseEntry(
+      std::map<uintptr_t, std::shared_ptr<Entry>>::iterator iter);
+
+  void evictUnusedEntries();
+};
+
+} // namespace ibv
+} // namespace transport
+} // namespace tensorpipe
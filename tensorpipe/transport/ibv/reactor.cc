@@ -8,6 +8,13 @@
 
 #include <tensorpipe/transport/ibv/reactor.h>
 
+#include <fcntl.h>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <string>
+
 #include <tensorpipe/common/system.h>
 #include <tensorpipe/transport/ibv/constants.h>
 
@@ -15,7 +22,59 @@ namespace tensorpipe {
 namespace transport {
 namespace ibv {
 
-Reactor::Reactor() {
+namespace {
+
+// Before going to sleep the reactor asks for the next work completion to be
+// notified on the completion channel, which wakes it up through the epoll loop
+// (see the context), hence it could sleep indefinitely. This is merely a safety
+// net.
+constexpr std::chrono::microseconds kSleepDuration = std::chrono::seconds(1);
+
+// The receive requests of the SRQ are told apart from the send requests, whose
+// IDs are counted up from one, by their top bit, the other ones being the slot
+// of their buffer. This matters for the failed work completions, which don't
+// have an opcode.
+constexpr uint64_t kRecvRequestIdFlag = 1ull << 63;
+
+// The events are consumed from the epoll loop, which mustn't block.
+void setNonBlocking(int fd) {
+  int rv = ::fcntl(fd, F_GETFL);
+  TP_THROW_SYSTEM_IF(rv < 0, errno);
+  rv = ::fcntl(fd, F_SETFL, rv | O_NONBLOCK);
+  TP_THROW_SYSTEM_IF(rv < 0, errno);
+}
+
+// Return the NUMA node to which the device is attached, or -1 if unknown (which
+// is also what the kernel reports on machines with a single node).
+int getNumaNodeOfIbvDevice(const std::string& deviceName) {
+  std::ifstream f("/sys/class/infiniband/" + deviceName + "/device/numa_node");
+  int numaNode = -1;
+  if (!(f >> numaNode)) {
+    return -1;
+  }
+  return numaNode;
+}
+
+uint32_t capacityOrDefault(size_t capacity, uint32_t defaultCapacity) {
+  if (capacity == 0) {
+    return defaultCapacity;
+  }
+  return std::min<size_t>(capacity, std::numeric_limits<uint32_t>::max());
+}
+
+} // namespace
+
+Reactor::Reactor(
+    std::chrono::microseconds spinDuration,
+    size_t registrationCacheCapacity,
+    QueueCapacities queueCapacities,
+    const optional<NicPort>& nicPort,
+    TransportStatsCounters& statsCounters,
+    ThreadOptions threadOptions)
+    : BusyPollingLoop(spinDuration, kSleepDuration),
+      threadNumaNode_(threadOptions.getNumaNode()),
+      memoryRegionCache_(ibvLib_, pd_, registrationCacheCapacity),
+      statsCounters_(statsCounters) {
   Error error;
   std::tie(error, ibvLib_) = IbvLib::create();
   // FIXME Instead of throwing away the error and setting a bool, we should have
@@ -43,47 +102,155 @@ Reactor::Reactor() {
                << " is not viable because it couldn't find any InfiniBand NICs";
     return;
   }
-  ctx_ = createIbvContext(getIbvLib(), deviceList[0]);
+  int deviceIdx = 0;
+  if (nicPort.has_value()) {
+    for (; deviceIdx < deviceList.size(); deviceIdx++) {
+      if (nicPort->deviceName ==
+          TP_CHECK_IBV_PTR(ibvLib_.get_device_name(&deviceList[deviceIdx]))) {
+        break;
+      }
+    }
+    TP_THROW_ASSERT_IF(deviceIdx == deviceList.size())
+        << "Couldn't find InfiniBand NIC " << nicPort->deviceName;
+    nicNumaNode_ = getNumaNodeOfIbvDevice(nicPort->deviceName);
+    TP_VLOG(9) << "Transport context " << id_ << " is using port "
+               << static_cast<int>(nicPort->portNum) << " of InfiniBand NIC "
+               << nicPort->deviceName << " on NUMA node " << nicNumaNode_;
+    if (threadNumaNode_ < 0 && nicNumaNode_ >= 0) {
+      threadOptions = std::move(threadOptions).numaNode(nicNumaNode_);
+      threadNumaNode_ = nicNumaNode_;
+    }
+  }
+  ctx_ = createIbvContext(getIbvLib(), deviceList[deviceIdx]);
   pd_ = createIbvProtectionDomain(getIbvLib(), ctx_);
+  compChannel_ = createIbvCompletionChannel(getIbvLib(), ctx_);
+  setNonBlocking(compChannel_->fd);
+  setNonBlocking(ctx_->async_fd);
+
+  // The writes and the acks share the send queues, hence if these must be
+  // shrunk they both are, in proportion.
+  const uint32_t numRecvReqs =
+      capacityOrDefault(queueCapacities.numRecvReqs, kNumPendingRecvReqs);
+  const uint32_t numWriteReqs =
+      capacityOrDefault(queueCapacities.numWriteReqs, kNumPendingWriteReqs);
+  const uint32_t numAckReqs =
+      capacityOrDefault(queueCapacities.numAckReqs, kNumPendingAckReqs);
+  const uint64_t numSendReqs = static_cast<uint64_t>(numWriteReqs) + numAckReqs;
+  IbvQueueCapacities capacities = fitIbvQueueCapacities(
+      getIbvLib(),
+      ctx_,
+      numRecvReqs,
+      std::min<uint64_t>(numSendReqs, std::numeric_limits<uint32_t>::max()),
+      /*useSharedReceiveQueue=*/true);
+  numRecvReqs_ = capacities.numRecvs;
+  numWriteReqs_ = std::max<uint64_t>(
+      capacities.numSends * static_cast<uint64_t>(numWriteReqs) / numSendReqs,
+      1);
+  numAckReqs_ = std::max<uint32_t>(capacities.numSends - numWriteReqs_, 1);
+  numAvailableWrites_ = numWriteReqs_;
+  numAvailableAcks_ = numAckReqs_;
+  maxNumQueuePairs_ = queueCapacities.numQueuePairs;
+  TP_VLOG(9) << "Transport context " << id_ << " allows " << numRecvReqs_
+             << " receive requests, " << numWriteReqs_ << " RDMA writes and "
+             << numAckReqs_ << " sends to be outstanding";
+
   cq_ = createIbvCompletionQueue(
       getIbvLib(),
       ctx_,
-      kCompletionQueueSize,
+      capacities.completionQueueSize,
       /*cq_context=*/nullptr,
-      /*channel=*/nullptr,
+      compChannel_.get(),
       /*comp_vector=*/0);
 
+  const size_t recvBuffersSize =
+      static_cast<size_t>(numRecvReqs_) * kMaxEagerMessageSize;
+  recvBuffers_ = std::make_unique<uint8_t[]>(recvBuffersSize);
+  recvBuffersMr_ = createIbvMemoryRegion(
+      getIbvLib(),
+      pd_,
+      recvBuffers_.get(),
+      recvBuffersSize,
+      IbvLib::ACCESS_LOCAL_WRITE);
+
   IbvLib::srq_init_attr srqInitAttr;
   std::memset(&srqInitAttr, 0, sizeof(srqInitAttr));
-  srqInitAttr.attr.max_wr = kNumPendingRecvReqs;
+  srqInitAttr.attr.max_wr = numRecvReqs_;
+  srqInitAttr.attr.max_sge = 1;
   srq_ = createIbvSharedReceiveQueue(getIbvLib(), pd_, srqInitAttr);
 
-  addr_ = makeIbvAddress(getIbvLib(), ctx_, kPortNum, kGlobalIdentifierIndex);
-
-  postRecvRequestsOnSRQ(kNumPendingRecvReqs);
+  addr_ = nicPort.has_value()
+      ? makeIbvAddress(
+            getIbvLib(),
+            ctx_,
+            nicPort->portNum,
+            nicPort->globalIdentifierIndex)
+      : makeIbvAddress(getIbvLib(), ctx_, kPortNum, kGlobalIdentifierIndex);
+
+  freeRecvSlots_.reserve(numRecvReqs_);
+  for (uint32_t slot = 0; slot < numRecvReqs_; slot++) {
+    freeRecvSlots_.push_back(numRecvReqs_ - 1 - slot);
+  }
+  postRecvRequestsOnSRQ();
+  // Not all devices support the limit, in which case the reactor relies on its
+  // own count of the completions.
+  srqLimitSupported_ = armSrqLimit() == 0;
+  srqLimitArmed_ = srqLimitSupported_;
 
-  startThread("TP_IBV_reactor");
+  startThread("TP_IBV_reactor", std::move(threadOptions));
 }
 
 bool Reactor::isViable() const {
   return foundIbvLib_ && const_cast<IbvContext&>(ctx_).get() != nullptr;
 }
 
-void Reactor::postRecvRequestsOnSRQ(int num) {
-  while (num > 0) {
+void Reactor::postRecvRequestsOnSRQ() {
+  while (!freeRecvSlots_.empty()) {
     IbvLib::recv_wr* badRecvWr = nullptr;
     std::array<IbvLib::recv_wr, kNumPolledWorkCompletions> wrs;
+    std::array<IbvLib::sge, kNumPolledWorkCompletions> lists;
     std::memset(wrs.data(), 0, sizeof(wrs));
-    for (int i = 0; i < std::min(num, kNumPolledWorkCompletions) - 1; i++) {
-      wrs[i].next = &wrs[i + 1];
+    const int num = std::min<size_t>(
+        freeRecvSlots_.size(), kNumPolledWorkCompletions);
+    for (int i = 0; i < num; i++) {
+      const uint32_t slot = freeRecvSlots_.back();
+      freeRecvSlots_.pop_back();
+      lists[i].addr = reinterpret_cast<uint64_t>(getRecvBuffer(slot));
+      lists[i].length = kMaxEagerMessageSize;
+      lists[i].lkey = recvBuffersMr_->lkey;
+      wrs[i].wr_id = kRecvRequestIdFlag | slot;
+      wrs[i].sg_list = &lists[i];
+      wrs[i].num_sge = 1;
+      wrs[i].next = i + 1 < num ? &wrs[i + 1] : nullptr;
     }
     int rv = getIbvLib().post_srq_recv(srq_.get(), wrs.data(), &badRecvWr);
     TP_THROW_SYSTEM_IF(rv != 0, errno);
     TP_THROW_ASSERT_IF(badRecvWr != nullptr);
-    num -= std::min(num, kNumPolledWorkCompletions);
   }
 }
 
+void Reactor::repostRecvRequestsOnSRQ() {
+  if (!freeRecvSlots_.empty()) {
+    TP_VLOG(9) << "Transport context " << id_ << " reposting "
+               << freeRecvSlots_.size() << " receive requests on the SRQ";
+    postRecvRequestsOnSRQ();
+  }
+  if (srqLimitSupported_ && !srqLimitArmed_) {
+    int rv = armSrqLimit();
+    TP_THROW_SYSTEM_IF(rv != 0, rv);
+    srqLimitArmed_ = true;
+  }
+}
+
+int Reactor::armSrqLimit() {
+  IbvLib::srq_attr srqAttr;
+  std::memset(&srqAttr, 0, sizeof(srqAttr));
+  srqAttr.srq_limit = numRecvReqs_ / kSrqLimitDivisor;
+  if (srqAttr.srq_limit == 0) {
+    return EINVAL;
+  }
+  return getIbvLib().modify_srq(srq_.get(), &srqAttr, IbvLib::SRQ_LIMIT);
+}
+
 void Reactor::setId(std::string id) {
   id_ = std::move(id);
 }
@@ -107,15 +274,19 @@ Reactor::~Reactor() {
 }
 
 bool Reactor::pollOnce() {
+  // Post the requests that were queued up since the previous iteration, e.g.,
+  // by deferred functions.
+  bool postedAny = postBatches();
+
   std::array<IbvLib::wc, kNumPolledWorkCompletions> wcs;
   auto rv = getIbvLib().poll_cq(cq_.get(), wcs.size(), wcs.data());
+  TP_THROW_SYSTEM_IF(rv < 0, errno);
+  statsCounters_.recordCompletionQueuePoll(rv);
 
   if (rv == 0) {
-    return false;
+    return postedAny;
   }
-  TP_THROW_SYSTEM_IF(rv < 0, errno);
 
-  int numRecvs = 0;
   int numWrites = 0;
   int numAcks = 0;
   for (int wcIdx = 0; wcIdx < rv; wcIdx++) {
@@ -129,102 +300,365 @@ bool Reactor::pollOnce() {
                << " (byte length: " << wc.byte_len
                << ", immediate data: " << wc.imm_data << ")";
 
-    auto iter = queuePairEventHandler_.find(wc.qp_num);
-    TP_THROW_ASSERT_IF(iter == queuePairEventHandler_.end())
+    auto iter = queuePairs_.find(wc.qp_num);
+    TP_THROW_ASSERT_IF(iter == queuePairs_.end())
         << "Got work completion for unknown queue pair " << wc.qp_num;
+    QueuePairState& state = iter->second;
 
     if (wc.status != IbvLib::WC_SUCCESS) {
-      iter->second->onError(wc.status, wc.wr_id);
+      // The opcode isn't set for failed work completions, but the receive
+      // requests of the SRQ are flagged in their ID.
+      if (!(wc.wr_id & kRecvRequestIdFlag)) {
+        reportSendCompletions(state, wc, numWrites, numAcks);
+      } else {
+        state.eventHandler->onError(wc.status, wc.wr_id);
+        // Its buffer can be used again.
+        freeRecvSlots_.push_back(wc.wr_id & ~kRecvRequestIdFlag);
+      }
       continue;
     }
 
     switch (wc.opcode) {
       case IbvLib::WC_RECV_RDMA_WITH_IMM:
         TP_THROW_ASSERT_IF(!(wc.wc_flags & IbvLib::WC_WITH_IMM));
-        iter->second->onRemoteProducedData(wc.imm_data);
-        numRecvs++;
+        state.eventHandler->onRemoteProducedData(wc.qp_num, wc.imm_data);
+        freeRecvSlots_.push_back(wc.wr_id & ~kRecvRequestIdFlag);
         break;
-      case IbvLib::WC_RECV:
+      case IbvLib::WC_RECV: {
         TP_THROW_ASSERT_IF(!(wc.wc_flags & IbvLib::WC_WITH_IMM));
-        iter->second->onRemoteConsumedData(wc.imm_data);
-        numRecvs++;
+        const uint32_t slot = wc.wr_id & ~kRecvRequestIdFlag;
+        // The acknowledgements are the only sends that carry no data.
+        if (wc.byte_len > 0) {
+          state.eventHandler->onRemoteSentData(
+              wc.qp_num, wc.imm_data, getRecvBuffer(slot), wc.byte_len);
+        } else {
+          state.eventHandler->onRemoteConsumedData(wc.imm_data);
+        }
+        freeRecvSlots_.push_back(slot);
         break;
+      }
       case IbvLib::WC_RDMA_WRITE:
-        iter->second->onWriteCompleted();
-        numWrites++;
-        break;
       case IbvLib::WC_SEND:
-        iter->second->onAckCompleted();
-        numAcks++;
+        reportSendCompletions(state, wc, numWrites, numAcks);
         break;
       default:
         TP_THROW_ASSERT() << "Unknown opcode: " << wc.opcode;
     }
   }
 
-  postRecvRequestsOnSRQ(numRecvs);
+  if (freeRecvSlots_.size() >=
+      numRecvReqs_ - numRecvReqs_ / kSrqRefillDivisor) {
+    repostRecvRequestsOnSRQ();
+  }
 
   numAvailableWrites_ += numWrites;
   while (!pendingQpWrites_.empty() && numAvailableWrites_ > 0) {
-    postWrite(
+    enqueueSendRequest(
         std::get<0>(pendingQpWrites_.front()),
-        std::get<1>(pendingQpWrites_.front()));
+        std::move(std::get<1>(pendingQpWrites_.front())));
     pendingQpWrites_.pop_front();
+    numAvailableWrites_--;
   }
 
   numAvailableAcks_ += numAcks;
   while (!pendingQpAcks_.empty() && numAvailableAcks_ > 0) {
-    postAck(
+    enqueueSendRequest(
         std::get<0>(pendingQpAcks_.front()),
-        std::get<1>(pendingQpAcks_.front()));
+        std::move(std::get<1>(pendingQpAcks_.front())));
     pendingQpAcks_.pop_front();
+    numAvailableAcks_--;
   }
 
+  // Post the requests that were queued up while handling the completions, so
+  // that those of a same queue pair share a single doorbell.
+  postBatches();
+
   return true;
 }
 
+void Reactor::reportSendCompletions(
+    QueuePairState& state,
+    const IbvLib::wc& wc,
+    int& numWrites,
+    int& numAcks) {
+  // Hold on to the event handler, as it may unregister its queue pairs (hence
+  // destroy their state) once it's told that its last request completed.
+  std::shared_ptr<IbvEventHandler> eventHandler = state.eventHandler;
+
+  // The requests that were posted before this one, and that were unsignaled,
+  // have also completed, successfully.
+  while (true) {
+    TP_THROW_ASSERT_IF(state.inFlight.empty())
+        << "Got work completion with unknown ID " << wc.wr_id << " for QP "
+        << wc.qp_num;
+    const SendRequestInFlight request = state.inFlight.front();
+    state.inFlight.pop_front();
+    const bool isLast = request.id == wc.wr_id;
+
+    if (request.isAck) {
+      numAcks++;
+    } else {
+      numWrites++;
+    }
+
+    if (isLast && wc.status != IbvLib::WC_SUCCESS) {
+      eventHandler->onError(wc.status, request.originalWrId);
+    } else if (request.isAck) {
+      eventHandler->onAckCompleted();
+    } else {
+      eventHandler->onWriteCompleted(request.originalWrId);
+    }
+
+    if (isLast) {
+      break;
+    }
+  }
+}
+
 bool Reactor::readyToClose() {
-  return queuePairEventHandler_.size() == 0;
+  return queuePairs_.size() == 0;
+}
+
+void Reactor::prepareToSleep() {
+  // Whatever comes in while the reactor sleeps finds a full SRQ.
+  repostRecvRequestsOnSRQ();
+  if (cqNotificationRequested_) {
+    return;
+  }
+  // The completions that came in before this are found by the last poll that
+  // the loop performs before sleeping, and the ones that come after wake it.
+  int rv = getIbvLib().req_notify_cq(cq_.get(), /*solicited_only=*/0);
+  TP_THROW_SYSTEM_IF(rv != 0, rv);
+  cqNotificationRequested_ = true;
+}
+
+int Reactor::getAsyncEventFd() const {
+  return ctx_->async_fd;
+}
+
+void Reactor::handleAsyncEventsFromLoop() {
+  TP_DCHECK(inLoop());
+  while (true) {
+    IbvLib::async_event event;
+    int rv = getIbvLib().get_async_event(ctx_.get(), &event);
+    if (rv != 0) {
+      TP_THROW_SYSTEM_IF(errno != EAGAIN, errno);
+      break;
+    }
+    const IbvLib::event_type eventType = event.event_type;
+    getIbvLib().ack_async_event(&event);
+
+    TP_VLOG(9) << "Transport context " << id_ << " got asynchronous event "
+               << getIbvLib().event_type_str(eventType);
+    if (eventType == IbvLib::EVENT_SRQ_LIMIT_REACHED) {
+      // The limit disarms itself once it fires.
+      srqLimitArmed_ = false;
+      repostRecvRequestsOnSRQ();
+    }
+  }
+}
+
+int Reactor::getCompletionChannelFd() const {
+  return compChannel_->fd;
+}
+
+void Reactor::handleCompletionChannelEventsFromLoop() {
+  TP_DCHECK(inLoop());
+  // The completions themselves are polled by the next iteration of the loop,
+  // as usual. Here, the notifications are merely consumed and acknowledged (all
+  // at once, as that takes a lock), and a new one will be requested when the
+  // loop is about to sleep again.
+  unsigned int numEvents = 0;
+  while (true) {
+    IbvLib::cq* cq;
+    void* cqContext;
+    int rv = getIbvLib().get_cq_event(compChannel_.get(), &cq, &cqContext);
+    if (rv != 0) {
+      TP_THROW_SYSTEM_IF(errno != EAGAIN, errno);
+      break;
+    }
+    TP_DCHECK_EQ(cq, cq_.get());
+    numEvents++;
+  }
+  if (numEvents > 0) {
+    getIbvLib().ack_cq_events(cq_.get(), numEvents);
+    cqNotificationRequested_ = false;
+  }
+}
+
+size_t Reactor::getNumLanesForNewConnection(size_t numLanes) const {
+  if (numLanes > 1 && maxNumQueuePairs_ > 0 &&
+      queuePairs_.size() + numLanes > maxNumQueuePairs_) {
+    TP_VLOG(8) << "Transport context " << id_ << " has " << queuePairs_.size()
+               << " queue pairs, hence a new connection gets a single lane";
+    return 1;
+  }
+  return numLanes;
 }
 
 void Reactor::registerQp(
     uint32_t qpn,
+    uint32_t maxInlineData,
     std::shared_ptr<IbvEventHandler> eventHandler) {
-  queuePairEventHandler_.emplace(qpn, std::move(eventHandler));
+  QueuePairState state;
+  state.eventHandler = std::move(eventHandler);
+  state.maxInlineData = maxInlineData;
+  queuePairs_.emplace(qpn, std::move(state));
+  statsCounters_.addQueuePairs(1);
 }
 
 void Reactor::unregisterQp(uint32_t qpn) {
-  queuePairEventHandler_.erase(qpn);
+  auto iter = queuePairs_.find(qpn);
+  TP_DCHECK(iter != queuePairs_.end());
+  TP_DCHECK(iter->second.batch.empty());
+  TP_DCHECK(iter->second.inFlight.empty());
+  queuePairs_.erase(iter);
+  statsCounters_.addQueuePairs(-1);
 }
 
 void Reactor::postWrite(IbvQueuePair& qp, IbvLib::send_wr& wr) {
+  SendRequest request;
+  request.wr = wr;
+  request.isAck = false;
+  TP_DCHECK_LE(wr.num_sge, 1);
+  if (wr.num_sge > 0) {
+    request.list = *wr.sg_list;
+  }
+  queueWriteRequest(qp, std::move(request));
+}
+
+void Reactor::postEagerSend(IbvQueuePair& qp, IbvLib::send_wr& wr) {
+  SendRequest request;
+  request.wr = wr;
+  request.isAck = false;
+  TP_DCHECK_EQ(wr.num_sge, 1);
+  TP_DCHECK_LE(wr.sg_list->length, kMaxEagerMessageSize);
+  request.list = *wr.sg_list;
+  request.ownsData = true;
+  std::memcpy(
+      request.data.data(),
+      reinterpret_cast<const void*>(wr.sg_list->addr),
+      wr.sg_list->length);
+  queueWriteRequest(qp, std::move(request));
+}
+
+void Reactor::queueWriteRequest(IbvQueuePair& qp, SendRequest request) {
   if (numAvailableWrites_ > 0) {
-    IbvLib::send_wr* badWr = nullptr;
-    TP_VLOG(9) << "Transport context " << id_ << " posting RDMA write for QP "
-               << qp->qp_num;
-    TP_CHECK_IBV_INT(getIbvLib().post_send(qp.get(), &wr, &badWr));
-    TP_THROW_ASSERT_IF(badWr != nullptr);
+    TP_VLOG(9) << "Transport context " << id_ << " queueing RDMA write for QP "
+               << qp->qp_num << " into batch";
+    enqueueSendRequest(qp, std::move(request));
     numAvailableWrites_--;
   } else {
     TP_VLOG(9) << "Transport context " << id_
                << " queueing up RDMA write for QP " << qp->qp_num;
-    pendingQpWrites_.emplace_back(qp, wr);
+    pendingQpWrites_.emplace_back(qp, std::move(request));
   }
 }
 
 void Reactor::postAck(IbvQueuePair& qp, IbvLib::send_wr& wr) {
+  SendRequest request;
+  request.wr = wr;
+  request.isAck = true;
+  TP_DCHECK_LE(wr.num_sge, 1);
+  if (wr.num_sge > 0) {
+    request.list = *wr.sg_list;
+  }
   if (numAvailableAcks_ > 0) {
-    IbvLib::send_wr* badWr = nullptr;
-    TP_VLOG(9) << "Transport context " << id_ << " posting send for QP "
-               << qp->qp_num;
-    TP_CHECK_IBV_INT(getIbvLib().post_send(qp.get(), &wr, &badWr));
-    TP_THROW_ASSERT_IF(badWr != nullptr);
+    TP_VLOG(9) << "Transport context " << id_ << " queueing send for QP "
+               << qp->qp_num << " into batch";
+    enqueueSendRequest(qp, std::move(request));
     numAvailableAcks_--;
   } else {
     TP_VLOG(9) << "Transport context " << id_ << " queueing send for QP "
                << qp->qp_num;
-    pendingQpAcks_.emplace_back(qp, wr);
+    pendingQpAcks_.emplace_back(qp, std::move(request));
+  }
+}
+
+void Reactor::requestAckFlush(uint32_t qpn) {
+  queuePairsWithAcksToFlush_.push_back(qpn);
+}
+
+void Reactor::enqueueSendRequest(IbvQueuePair& qp, SendRequest request) {
+  auto iter = queuePairs_.find(qp->qp_num);
+  TP_THROW_ASSERT_IF(iter == queuePairs_.end())
+      << "Posting send request for unknown queue pair " << qp->qp_num;
+  QueuePairState& state = iter->second;
+  state.qp = &qp;
+  if (state.batch.empty()) {
+    queuePairsWithBatches_.push_back(qp->qp_num);
+  }
+  state.batch.push_back(std::move(request));
+}
+
+bool Reactor::postBatches() {
+  if (!queuePairsWithAcksToFlush_.empty()) {
+    std::vector<uint32_t> qpns;
+    std::swap(qpns, queuePairsWithAcksToFlush_);
+    for (uint32_t qpn : qpns) {
+      // The queue pair may have been unregistered in the meantime.
+      auto iter = queuePairs_.find(qpn);
+      if (iter != queuePairs_.end()) {
+        std::shared_ptr<IbvEventHandler> eventHandler =
+            iter->second.eventHandler;
+        eventHandler->onFlushAcks();
+      }
+    }
   }
+
+  if (queuePairsWithBatches_.empty()) {
+    return false;
+  }
+
+  for (uint32_t qpn : queuePairsWithBatches_) {
+    auto iter = queuePairs_.find(qpn);
+    TP_DCHECK(iter != queuePairs_.end());
+    QueuePairState& state = iter->second;
+    std::vector<SendRequest>& batch = state.batch;
+    TP_DCHECK(!batch.empty());
+
+    for (size_t idx = 0; idx < batch.size(); idx++) {
+      IbvLib::send_wr& wr = batch[idx].wr;
+      const uint64_t originalWrId = wr.wr_id;
+      wr.wr_id = nextSendRequestId_++;
+      wr.next = idx + 1 < batch.size() ? &batch[idx + 1].wr : nullptr;
+      if (wr.num_sge > 0) {
+        wr.sg_list = &batch[idx].list;
+        if (batch[idx].ownsData) {
+          batch[idx].list.addr =
+              reinterpret_cast<uint64_t>(batch[idx].data.data());
+          TP_DCHECK_LE(batch[idx].list.length, state.maxInlineData);
+        }
+        // The data is copied into the request when it's posted, hence there's
+        // no need for the device to fetch it, nor for it to be registered.
+        if (batch[idx].list.length <= state.maxInlineData) {
+          wr.send_flags |= IbvLib::SEND_INLINE;
+        }
+      }
+      // The last request of the batch is always signaled, otherwise the ones
+      // before it may never be reported as completed.
+      state.numPostedSinceLastSignaled++;
+      if (state.numPostedSinceLastSignaled == kSignalingInterval ||
+          idx + 1 == batch.size()) {
+        wr.send_flags |= IbvLib::SEND_SIGNALED;
+        state.numPostedSinceLastSignaled = 0;
+      }
+      state.inFlight.push_back(
+          SendRequestInFlight{wr.wr_id, originalWrId, batch[idx].isAck});
+    }
+
+    IbvLib::send_wr* badWr = nullptr;
+    TP_VLOG(9) << "Transport context " << id_ << " posting " << batch.size()
+               << " send requests for QP " << qpn;
+    TP_CHECK_IBV_INT(
+        getIbvLib().post_send(state.qp->get(), &batch[0].wr, &badWr));
+    TP_THROW_ASSERT_IF(badWr != nullptr);
+    statsCounters_.recordWorkRequestsPosted(batch.size());
+    batch.clear();
+  }
+  queuePairsWithBatches_.clear();
+
+  return true;
 }
 
 } // namespace ibv
@@ -8,13 +8,19 @@
 
 #pragma once
 
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <functional>
 #include <future>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <set>
 #include <thread>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include <tensorpipe/common/busy_polling_loop.h>
@@ -22,7 +28,11 @@
 #include <tensorpipe/common/fd.h>
 #include <tensorpipe/common/ibv.h>
 #include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/thread_options.h>
 #include <tensorpipe/transport/ibv/constants.h>
+#include <tensorpipe/transport/ibv/context.h>
+#include <tensorpipe/transport/ibv/memory_region_cache.h>
+#include <tensorpipe/transport/stats.h>
 #include <tensorpipe/util/ringbuffer/consumer.h>
 #include <tensorpipe/util/ringbuffer/producer.h>
 
@@ -32,14 +42,30 @@ namespace ibv {
 
 class IbvEventHandler {
  public:
-  virtual void onRemoteProducedData(uint32_t length) = 0;
+  // The number of the queue pair is given as data may arrive on any of the
+  // queue pairs of a connection and must be reassembled in order.
+  virtual void onRemoteProducedData(uint32_t qpNum, uint32_t length) = 0;
 
   virtual void onRemoteConsumedData(uint32_t length) = 0;
 
-  virtual void onWriteCompleted() = 0;
+  // A message that was sent eagerly, which landed in a buffer of the shared
+  // receive queue that is only valid until this returns. Like for the writes
+  // into the inbox, it may acknowledge some data read by the peer as well.
+  virtual void onRemoteSentData(
+      uint32_t qpNum,
+      uint32_t ackedLength,
+      const void* ptr,
+      size_t length) = 0;
+
+  // The ID of the work request is given as it tells what the write was for.
+  virtual void onWriteCompleted(uint64_t wrId) = 0;
 
   virtual void onAckCompleted() = 0;
 
+  // Called right before the requests of an iteration are posted, if the handler
+  // asked for it, to post the acknowledgements that it held back.
+  virtual void onFlushAcks() = 0;
+
   virtual void onError(IbvLib::wc_status status, uint64_t wrId) = 0;
 
   virtual ~IbvEventHandler() = default;
@@ -55,7 +81,17 @@ class IbvEventHandler {
 //
 class Reactor final : public BusyPollingLoop {
  public:
-  Reactor();
+  // The work requests and the completion queue polls are recorded into the
+  // given counters, which must outlive the reactor. Without a NIC port, it uses
+  // the default one of the first device. With one, its thread goes to the NUMA
+  // node of the NIC, unless the options bind it to one already.
+  Reactor(
+      std::chrono::microseconds spinDuration,
+      size_t registrationCacheCapacity,
+      QueueCapacities queueCapacities,
+      const optional<NicPort>& nicPort,
+      TransportStatsCounters& statsCounters,
+      ThreadOptions threadOptions = ThreadOptions());
 
   IbvLib& getIbvLib() {
     return ibvLib_;
@@ -77,14 +113,60 @@ class Reactor final : public BusyPollingLoop {
     return addr_;
   }
 
-  void registerQp(uint32_t qpn, std::shared_ptr<IbvEventHandler> eventHandler);
+  // The NUMA node to which the NIC is attached, or -1 if unknown.
+  int getNicNumaNode() const {
+    return nicNumaNode_;
+  }
+
+  // The NUMA node that the thread of the reactor is bound to, or -1 if none.
+  int getThreadNumaNode() const {
+    return threadNumaNode_;
+  }
+
+  MemoryRegionCache& getMemoryRegionCache() {
+    return memoryRegionCache_;
+  }
+
+  // The capacity that the send queue of each queue pair must have, to hold all
+  // the RDMA writes and sends that the reactor lets be posted at once.
+  uint32_t getSendQueueCapacity() const {
+    return numWriteReqs_ + numAckReqs_;
+  }
+
+  // How many lanes a new connection may use, out of the given ones, for the
+  // queue pairs to stay within the budget set in the capacities, if any.
+  size_t getNumLanesForNewConnection(size_t numLanes) const;
+
+  // The maximum amount of inline data is the one that the device granted when
+  // the queue pair was created.
+  void registerQp(
+      uint32_t qpn,
+      uint32_t maxInlineData,
+      std::shared_ptr<IbvEventHandler> eventHandler);
 
   void unregisterQp(uint32_t qpn);
 
+  // The requests (which may have up to one scatter-gather element) are copied,
+  // and they're only actually posted at the end of the current iteration of the
+  // reactor, all the ones of a same queue pair at once. Their work request IDs
+  // are replaced by the reactor's own ones, and the original ones are given
+  // back to the event handler upon completion. The reactor decides which ones
+  // are signaled and which ones carry their data inline.
   void postWrite(IbvQueuePair& qp, IbvLib::send_wr& wr);
 
+  // A send request that counts among the writes, whose data (of up to the
+  // maximum eager message size, and up to the maximum amount of inline data of
+  // the queue pair) is copied into the reactor's own request, hence its memory
+  // doesn't need to be registered nor to stay valid after this returns.
+  void postEagerSend(IbvQueuePair& qp, IbvLib::send_wr& wr);
+
   void postAck(IbvQueuePair& qp, IbvLib::send_wr& wr);
 
+  // Have the event handler of the queue pair called back right before the
+  // requests of the current iteration are posted, so that it may hold back its
+  // acknowledgements until then, and piggyback them on its RDMA writes instead.
+  void requestAckFlush(uint32_t qpn);
+
   bool isViable() const;
 
   void setId(std::string id);
@@ -95,22 +177,78 @@ class Reactor final : public BusyPollingLoop {
 
   ~Reactor();
 
+  // The completion queue notifies this file descriptor of its work completions,
+  // once the reactor asked for it, which it does before going to sleep. It must
+  // be monitored by an epoll loop attached to the reactor, which calls the
+  // function below when it's readable.
+  int getCompletionChannelFd() const;
+
+  void handleCompletionChannelEventsFromLoop();
+
+  // The device reports its asynchronous events on this file descriptor, which
+  // must be monitored the same way, to call the function below.
+  int getAsyncEventFd() const;
+
+  void handleAsyncEventsFromLoop();
+
  protected:
   bool pollOnce() override;
 
   bool readyToClose() override;
 
+  void prepareToSleep() override;
+
  private:
   // InfiniBand stuff
   bool foundIbvLib_{false};
   IbvLib ibvLib_;
   IbvContext ctx_;
   IbvProtectionDomain pd_;
+  // The buffers of the receive requests of the SRQ, into which the eager
+  // messages land, made of one slot per request. Declared before the SRQ, as
+  // they must be destroyed after it.
+  std::unique_ptr<uint8_t[]> recvBuffers_;
+  IbvMemoryRegion recvBuffersMr_;
+  // Declared before the completion queue, as it must be destroyed after it.
+  IbvCompletionChannel compChannel_;
   IbvCompletionQueue cq_;
+  // Only accessed from the loop.
+  bool cqNotificationRequested_{false};
   IbvSharedReceiveQueue srq_;
   IbvAddress addr_;
+  int nicNumaNode_{-1};
+  int threadNumaNode_{-1};
+  // Declared after the protection domain, as it must be destroyed before it.
+  MemoryRegionCache memoryRegionCache_;
+
+  // The capacities of the queues, deduced from the ones requested by the user
+  // and from the limits of the device.
+  uint32_t numRecvReqs_{0};
+  uint32_t numWriteReqs_{0};
+  uint32_t numAckReqs_{0};
+  // Zero stands for no limit.
+  size_t maxNumQueuePairs_{0};
+
+  // The receive requests consumed from the shared receive queue aren't posted
+  // back after each poll but in bulk, once the device signals that the queue
+  // went below its limit (which must then be armed again), or before sleeping.
+  // As a fallback, in case the device doesn't support that, or if its event is
+  // late, it's done once the reactor counted enough completions itself. These
+  // are the slots of the buffers of the consumed requests.
+  std::vector<uint32_t> freeRecvSlots_;
+  bool srqLimitSupported_{false};
+  bool srqLimitArmed_{false};
+
+  uint8_t* getRecvBuffer(uint32_t slot) {
+    return recvBuffers_.get() +
+        static_cast<size_t>(slot) * kMaxEagerMessageSize;
+  }
+
+  void postRecvRequestsOnSRQ();
 
-  void postRecvRequestsOnSRQ(int num);
+  void repostRecvRequestsOnSRQ();
+
+  int armSrqLimit();
 
   std::atomic<bool> closed_{false};
   std::atomic<bool> joined_{false};
@@ -119,14 +257,65 @@ class Reactor final : public BusyPollingLoop {
   // debugging purposes.
   std::string id_{"N/A"};
 
-  // The registered event handlers for each queue pair.
-  std::unordered_map<uint32_t, std::shared_ptr<IbvEventHandler>>
-      queuePairEventHandler_;
-
-  uint32_t numAvailableWrites_{kNumPendingWriteReqs};
-  uint32_t numAvailableAcks_{kNumPendingAckReqs};
-  std::deque<std::tuple<IbvQueuePair&, IbvLib::send_wr>> pendingQpWrites_;
-  std::deque<std::tuple<IbvQueuePair&, IbvLib::send_wr>> pendingQpAcks_;
+  TransportStatsCounters& statsCounters_;
+
+  // A send request, with its scatter-gather element, which it will point to
+  // once it's posted, and which may in turn point to the request's own copy of
+  // the data for the eager sends.
+  struct SendRequest {
+    IbvLib::send_wr wr;
+    IbvLib::sge list;
+    bool isAck;
+    bool ownsData{false};
+    std::array<uint8_t, kMaxEagerMessageSize> data;
+  };
+
+  // A send request that has been posted but whose completion hasn't yet been
+  // reported to the event handler.
+  struct SendRequestInFlight {
+    uint64_t id;
+    uint64_t originalWrId;
+    bool isAck;
+  };
+
+  struct QueuePairState {
+    std::shared_ptr<IbvEventHandler> eventHandler;
+    uint32_t maxInlineData;
+    IbvQueuePair* qp{nullptr};
+    // The requests that will be posted at the end of this reactor iteration.
+    std::vector<SendRequest> batch;
+    // In the order in which they were posted, which is also the one in which
+    // they complete.
+    std::deque<SendRequestInFlight> inFlight;
+    uint32_t numPostedSinceLastSignaled{0};
+  };
+
+  // The state of each registered queue pair.
+  std::unordered_map<uint32_t, QueuePairState> queuePairs_;
+  // The queue pairs that have a non-empty batch.
+  std::vector<uint32_t> queuePairsWithBatches_;
+  // The queue pairs whose event handler must flush its acknowledgements.
+  std::vector<uint32_t> queuePairsWithAcksToFlush_;
+  // The IDs with the top bit set are reserved for the receive requests of the
+  // SRQ (see kRecvRequestIdFlag).
+  uint64_t nextSendRequestId_{1};
+
+  uint32_t numAvailableWrites_{0};
+  uint32_t numAvailableAcks_{0};
+  std::deque<std::tuple<IbvQueuePair&, SendRequest>> pendingQpWrites_;
+  std::deque<std::tuple<IbvQueuePair&, SendRequest>> pendingQpAcks_;
+
+  void enqueueSendRequest(IbvQueuePair& qp, SendRequest request);
+
+  void queueWriteRequest(IbvQueuePair& qp, SendRequest request);
+
+  bool postBatches();
+
+  void reportSendCompletions(
+      QueuePairState& state,
+      const IbvLib::wc& wc,
+      int& numWrites,
+      int& numAcks);
 };
 
 } // namespace ibv
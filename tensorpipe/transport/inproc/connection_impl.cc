@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/inproc/connection_impl.h>
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/inproc/context.h>
+#include <tensorpipe/transport/inproc/context_impl.h>
+#include <tensorpipe/transport/inproc/listener_impl.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace inproc {
+
+ConnectionImpl::ConnectionImpl(
+    ConstructorToken token,
+    std::shared_ptr<ContextImpl> context,
+    std::string id,
+    std::shared_ptr<ConnectionImpl> peer)
+    : ConnectionImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
+          token,
+          std::move(context),
+          std::move(id)),
+      peer_(std::move(peer)) {}
+
+ConnectionImpl::ConnectionImpl(
+    ConstructorToken token,
+    std::shared_ptr<ContextImpl> context,
+    std::string id,
+    std::string addr)
+    : ConnectionImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
+          token,
+          std::move(context),
+          std::move(id)),
+      addr_(std::move(addr)) {}
+
+void ConnectionImpl::initImplFromLoop() {
+  context_->enrollConnection(*this);
+
+  if (peer_ != nullptr) {
+    peer_->peerAccepted(shared_from_this());
+    return;
+  }
+
+  std::shared_ptr<ListenerImpl> listener = ListenerImpl::find(addr_.value());
+  if (listener == nullptr) {
+    // There's no one who could ever call us.
+    peerGone_ = true;
+    setError(TP_CREATE_ERROR(SystemError, "connect", ECONNREFUSED));
+    return;
+  }
+  listener->connectFromPeer(shared_from_this());
+}
+
+void ConnectionImpl::peerAccepted(std::shared_ptr<ConnectionImpl> peer) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, peer{std::move(peer)}]() mutable {
+        impl->peerAcceptedFromLoop(std::move(peer));
+      });
+}
+
+void ConnectionImpl::peerWrote(const void* ptr, size_t length) {
+  context_->deferToLoop([impl{shared_from_this()}, ptr, length]() {
+    impl->peerWroteFromLoop(ptr, length);
+  });
+}
+
+void ConnectionImpl::peerRead() {
+  context_->deferToLoop(
+      [impl{shared_from_this()}]() { impl->peerReadFromLoop(); });
+}
+
+void ConnectionImpl::peerFailed() {
+  context_->deferToLoop(
+      [impl{shared_from_this()}]() { impl->peerFailedFromLoop(); });
+}
+
+void ConnectionImpl::peerAcceptedFromLoop(
+    std::shared_ptr<ConnectionImpl> peer) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(peer_ == nullptr);
+  peer_ = std::move(peer);
+  if (error_) {
+    // We couldn't tell it when we failed, as we didn't know it yet.
+    peer_->peerFailed();
+    return;
+  }
+  sendWritesToPeerFromLoop();
+}
+
+void ConnectionImpl::peerWroteFromLoop(const void* ptr, size_t length) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(peer_ != nullptr);
+  if (error_) {
+    // The peer holds on to the buffer until it learns that we failed.
+    return;
+  }
+  incomingWrites_.push_back(IncomingWrite{ptr, length, nullptr, {}});
+  processReadOperationsFromLoop();
+}
+
+void ConnectionImpl::peerReadFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(!writeOperations_.empty());
+  TP_DCHECK_GT(numWritesSentToPeer_, 0);
+  WriteOperation writeOperation = std::move(writeOperations_.front());
+  writeOperations_.pop_front();
+  numWritesSentToPeer_--;
+  writeOperation.fn(error_);
+}
+
+void ConnectionImpl::peerFailedFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  peerGone_ = true;
+  if (!error_) {
+    if (peer_ == nullptr) {
+      // It was the listener that refused us.
+      setError(TP_CREATE_ERROR(SystemError, "connect", ECONNREFUSED));
+    } else {
+      setError(TP_CREATE_ERROR(EOFError));
+    }
+    return;
+  }
+  unenrollIfDoneFromLoop();
+}
+
+void ConnectionImpl::readImplFromLoop(read_callback_fn fn) {
+  readOperations_.push_back(ReadOperation{nullptr, 0, std::move(fn)});
+  processReadOperationsFromLoop();
+}
+
+void ConnectionImpl::readImplFromLoop(
+    void* ptr,
+    size_t length,
+    read_callback_fn fn) {
+  readOperations_.push_back(ReadOperation{ptr, length, std::move(fn)});
+  processReadOperationsFromLoop();
+}
+
+void ConnectionImpl::writeImplFromLoop(
+    const void* ptr,
+    size_t length,
+    write_callback_fn fn) {
+  writeOperations_.push_back(WriteOperation{ptr, length, std::move(fn)});
+  sendWritesToPeerFromLoop();
+}
+
+void ConnectionImpl::sendWritesToPeerFromLoop() {
+  if (peer_ == nullptr) {
+    return;
+  }
+  while (numWritesSentToPeer_ < writeOperations_.size()) {
+    const WriteOperation& writeOperation =
+        writeOperations_[numWritesSentToPeer_++];
+    peer_->peerWrote(writeOperation.ptr, writeOperation.length);
+  }
+}
+
+void ConnectionImpl::processReadOperationsFromLoop() {
+  while (!error_ && !readOperations_.empty() && !incomingWrites_.empty()) {
+    ReadOperation readOperation = std::move(readOperations_.front());
+    readOperations_.pop_front();
+    IncomingWrite incomingWrite = std::move(incomingWrites_.front());
+    incomingWrites_.pop_front();
+
+    // The peer was already told that it's done with the writes we copied.
+    const bool wasBuffered = incomingWrite.copy != nullptr;
+    const void* src =
+        wasBuffered ? incomingWrite.copy.get() : incomingWrite.ptr;
+    if (wasBuffered) {
+      numBytesBuffered_ -= incomingWrite.length;
+    }
+    if (readOperation.ptr != nullptr) {
+      TP_DCHECK_EQ(readOperation.length, incomingWrite.length);
+      if (incomingWrite.length > 0) {
+        std::memcpy(readOperation.ptr, src, incomingWrite.length);
+      }
+      if (!wasBuffered) {
+        peer_->peerRead();
+      }
+      readOperation.fn(
+          Error::kSuccess, readOperation.ptr, incomingWrite.length);
+    } else {
+      // The callback reads straight from the buffer of the peer, which must
+      // thus wait for it to return before it can be done with it.
+      readOperation.fn(Error::kSuccess, src, incomingWrite.length);
+      if (!wasBuffered && !error_) {
+        peer_->peerRead();
+      }
+    }
+  }
+
+  bufferIncomingWritesFromLoop();
+}
+
+void ConnectionImpl::bufferIncomingWritesFromLoop() {
+  // The buffered writes are always the leading ones, so that the peer is told
+  // that it's done with its writes in the order in which it made them.
+  for (IncomingWrite& incomingWrite : incomingWrites_) {
+    if (incomingWrite.copy != nullptr) {
+      continue;
+    }
+    if (numBytesBuffered_ + incomingWrite.length > kMaxBytesBuffered) {
+      break;
+    }
+    incomingWrite.copy = std::make_unique<uint8_t[]>(incomingWrite.length);
+    if (incomingWrite.length > 0) {
+      std::memcpy(
+          incomingWrite.copy.get(), incomingWrite.ptr, incomingWrite.length);
+    }
+    incomingWrite.copyMemoryCharge = MemoryCharge(
+        context_->getMemoryFootprintCounters(),
+        MemoryKind::kHost,
+        incomingWrite.length);
+    numBytesBuffered_ += incomingWrite.length;
+    peer_->peerRead();
+  }
+}
+
+void ConnectionImpl::handleErrorImpl() {
+  std::deque<ReadOperation> readOperations;
+  std::swap(readOperations, readOperations_);
+  for (auto& readOperation : readOperations) {
+    readOperation.fn(error_, readOperation.ptr, readOperation.length);
+  }
+  incomingWrites_.clear();
+  numBytesBuffered_ = 0;
+
+  if (peer_ != nullptr) {
+    peer_->peerFailed();
+  }
+
+  unenrollIfDoneFromLoop();
+}
+
+void ConnectionImpl::unenrollIfDoneFromLoop() {
+  if (!error_ || !peerGone_) {
+    return;
+  }
+
+  // The peer won't touch our buffers anymore, hence our writes can fail.
+  std::deque<WriteOperation> writeOperations;
+  std::swap(writeOperations, writeOperations_);
+  numWritesSentToPeer_ = 0;
+  for (auto& writeOperation : writeOperations) {
+    writeOperation.fn(error_);
+  }
+
+  peer_.reset();
+
+  context_->unenrollConnection(*this);
+}
+
+} // namespace inproc
+} // namespace transport
+} // namespace tensorpipe
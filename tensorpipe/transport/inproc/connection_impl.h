@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/common/memory_footprint.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/transport/connection_impl_boilerplate.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace inproc {
+
+class ContextImpl;
+class ListenerImpl;
+
+class ConnectionImpl final : public ConnectionImplBoilerplate<
+                                 ContextImpl,
+                                 ListenerImpl,
+                                 ConnectionImpl> {
+ public:
+  // Create a connection that is already connected (e.g. from a listener).
+  ConnectionImpl(
+      ConstructorToken token,
+      std::shared_ptr<ContextImpl> context,
+      std::string id,
+      std::shared_ptr<ConnectionImpl> peer);
+
+  // Create a connection that connects to the specified address.
+  ConnectionImpl(
+      ConstructorToken token,
+      std::shared_ptr<ContextImpl> context,
+      std::string id,
+      std::string addr);
+
+  // The entry points for the other end of the connection (or, before that is
+  // known, for the listener), which can be called from any thread. The peer
+  // tells us when it accepted us, when it's writing a buffer to us and when it
+  // read one of ours (which it then won't access anymore), and when it failed,
+  // after which it won't call us anymore.
+  void peerAccepted(std::shared_ptr<ConnectionImpl> peer);
+  void peerWrote(const void* ptr, size_t length);
+  void peerRead();
+  void peerFailed();
+
+ protected:
+  // Implement the entry points called by ConnectionImplBoilerplate.
+  void initImplFromLoop() override;
+  void readImplFromLoop(read_callback_fn fn) override;
+  void readImplFromLoop(void* ptr, size_t length, read_callback_fn fn) override;
+  void writeImplFromLoop(const void* ptr, size_t length, write_callback_fn fn)
+      override;
+  void handleErrorImpl() override;
+
+ private:
+  struct ReadOperation {
+    // Null if the read didn't come with a destination.
+    void* ptr;
+    size_t length;
+    read_callback_fn fn;
+  };
+
+  struct WriteOperation {
+    const void* ptr;
+    size_t length;
+    write_callback_fn fn;
+  };
+
+  // A write of the peer that no read has taken yet. It's copied, and the peer
+  // is told that it's done with it, if there's room for it in the buffer.
+  struct IncomingWrite {
+    const void* ptr;
+    size_t length;
+    std::unique_ptr<uint8_t[]> copy;
+    MemoryCharge copyMemoryCharge;
+  };
+
+  // The address of the listener, for the connections that connect to one.
+  optional<std::string> addr_;
+
+  // The other end, once it's known. It's kept until both ends failed, at which
+  // point neither of them can call the other anymore.
+  std::shared_ptr<ConnectionImpl> peer_;
+  // Whether the peer told us that it failed.
+  bool peerGone_{false};
+
+  std::deque<ReadOperation> readOperations_;
+
+  // The writes that the peer has been told about (or will be, once it's known)
+  // and that it didn't read yet, in order. They must be kept alive for as long
+  // as the peer may access them, hence even once we failed.
+  std::deque<WriteOperation> writeOperations_;
+  size_t numWritesSentToPeer_{0};
+
+  std::deque<IncomingWrite> incomingWrites_;
+  size_t numBytesBuffered_{0};
+
+  void peerAcceptedFromLoop(std::shared_ptr<ConnectionImpl> peer);
+  void peerWroteFromLoop(const void* ptr, size_t length);
+  void peerReadFromLoop();
+  void peerFailedFromLoop();
+
+  // Tell the peer about the writes it doesn't know of yet.
+  void sendWritesToPeerFromLoop();
+
+  // Copy the leading incoming writes that fit in the buffer, and let the peer
+  // be done with them.
+  void bufferIncomingWritesFromLoop();
+
+  void processReadOperationsFromLoop();
+
+  // Once both ends failed, let go of the peer and of the context.
+  void unenrollIfDoneFromLoop();
+};
+
+} // namespace inproc
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/common/thread_options.h>
+#include <tensorpipe/transport/context.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace inproc {
+
+class ContextImpl;
+
+// The default time for which the loop keeps polling after its last task.
+constexpr std::chrono::microseconds kDefaultSpinDuration{0};
+
+// The most bytes of the writes that a connection holds on to, in copies of its
+// own, while there's no read for them on its end, see below.
+constexpr size_t kMaxBytesBuffered = 1024 * 1024;
+
+class Context : public transport::Context {
+ public:
+  // The connections only work between contexts of the same process, where the
+  // listeners go by their address, which is just a name (or one made up for
+  // them, if it's empty). There are no sockets, shared memory or polling: the
+  // ends of a connection defer their operations to each other's loop, and the
+  // data of a write is copied by the reader, straight from the buffer of the
+  // writer into its own, after which the writer is told that it's done. The
+  // loop is a thread that sleeps until it's given something to do (or spins
+  // for the given duration before that, which shaves off its wakeups). Lest
+  // the writer be held back by a reader that isn't reading, up to
+  // kMaxBytesBuffered bytes of the writes are copied on arrival when there's no
+  // read for them, and the writer is done with them right away.
+  explicit Context(
+      std::chrono::microseconds spinDuration = kDefaultSpinDuration,
+      ThreadOptions threadOptions = ThreadOptions());
+
+  Context(const Context&) = delete;
+  Context(Context&&) = delete;
+  Context& operator=(const Context&) = delete;
+  Context& operator=(Context&&) = delete;
+
+  std::shared_ptr<Connection> connect(std::string addr) override;
+
+  std::shared_ptr<Listener> listen(std::string addr) override;
+
+  bool isViable() const override;
+
+  void enableLoopStats() override;
+
+  std::map<std::string, LoopStats> getLoopStats() override;
+
+  const std::string& domainDescriptor() const override;
+
+  void setId(std::string id) override;
+
+  TransportStats getTransportStats() override;
+
+  MemoryFootprint getMemoryFootprint() override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it (downcast as a shared_ptr to the private
+  // interface). However, its lifetime is tied to the one of this public object,
+  // since when the latter is destroyed the implementation is closed and joined.
+  const std::shared_ptr<ContextImpl> impl_;
+};
+
+} // namespace inproc
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/inproc/context_impl.h>
+
+#include <unistd.h>
+
+#include <sstream>
+#include <tuple>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/system.h>
+#include <tensorpipe/transport/inproc/connection_impl.h>
+#include <tensorpipe/transport/inproc/listener_impl.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace inproc {
+
+namespace {
+
+// Prepend descriptor with transport name so it's easy to
+// disambiguate descriptors when debugging.
+const std::string kDomainDescriptorPrefix{"inproc:"};
+
+std::tuple<bool, std::string> determineViabilityAndGenerateDomainDescriptor() {
+  std::ostringstream oss;
+  oss << kDomainDescriptorPrefix;
+
+  // This transport only works within a process, which we identify by its PID
+  // in its namespace, on a given boot of the machine.
+  auto bootID = getBootID();
+  if (!bootID.has_value()) {
+    TP_VLOG(8) << "Unable to read boot_id";
+    return std::make_tuple(false, std::string());
+  }
+  oss << bootID.value();
+
+  auto nsID = getLinuxNamespaceId(LinuxNamespace::kPid);
+  if (!nsID.has_value()) {
+    TP_VLOG(8) << "Unable to read pid namespace ID";
+    return std::make_tuple(false, std::string());
+  }
+  oss << '_' << nsID.value() << '_' << ::getpid();
+
+  std::string domainDescriptor = oss.str();
+  TP_VLOG(8) << "The domain descriptor for InProc is " << domainDescriptor;
+  return std::make_tuple(true, std::move(domainDescriptor));
+}
+
+} // namespace
+
+std::shared_ptr<ContextImpl> ContextImpl::create(
+    std::chrono::microseconds spinDuration,
+    ThreadOptions threadOptions) {
+  bool isViable;
+  std::string domainDescriptor;
+  std::tie(isViable, domainDescriptor) =
+      determineViabilityAndGenerateDomainDescriptor();
+  return std::make_shared<ContextImpl>(
+      isViable,
+      std::move(domainDescriptor),
+      spinDuration,
+      std::move(threadOptions));
+}
+
+ContextImpl::ContextImpl(
+    bool isViable,
+    std::string domainDescriptor,
+    std::chrono::microseconds spinDuration,
+    ThreadOptions threadOptions)
+    : ContextImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
+          std::move(domainDescriptor)),
+      isViable_(isViable),
+      loop_(spinDuration, std::move(threadOptions)) {}
+
+bool ContextImpl::isViable() const {
+  return isViable_;
+}
+
+bool ContextImpl::inLoop() {
+  return loop_.inLoop();
+}
+
+void ContextImpl::deferToLoop(TTask fn) {
+  loop_.deferToLoop(std::move(fn));
+}
+
+void ContextImpl::enableLoopStats() {
+  loop_.enableStats();
+}
+
+std::map<std::string, LoopStats> ContextImpl::getLoopStats() {
+  return {{"loop", loop_.getStats()}};
+}
+
+void ContextImpl::enrollConnection(ConnectionImpl& connection) {
+  enroll(connection);
+  std::unique_lock<std::mutex> lock(mutex_);
+  numConnections_++;
+}
+
+void ContextImpl::unenrollConnection(ConnectionImpl& connection) {
+  unenroll(connection);
+  std::unique_lock<std::mutex> lock(mutex_);
+  TP_DCHECK_GT(numConnections_, 0);
+  numConnections_--;
+  cv_.notify_all();
+}
+
+void ContextImpl::closeImpl() {
+  // The loop is needed until the connections are done, hence until joining.
+}
+
+void ContextImpl::joinImpl() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&]() { return numConnections_ == 0; });
+  }
+  loop_.join();
+}
+
+} // namespace inproc
+} // namespace transport
+} // namespace tensorpipe
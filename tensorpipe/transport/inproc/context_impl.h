@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <tensorpipe/common/thread_options.h>
+#include <tensorpipe/transport/context_impl_boilerplate.h>
+#include <tensorpipe/transport/inproc/loop.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace inproc {
+
+class ConnectionImpl;
+class ListenerImpl;
+
+class ContextImpl final
+    : public ContextImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl> {
+ public:
+  static std::shared_ptr<ContextImpl> create(
+      std::chrono::microseconds spinDuration,
+      ThreadOptions threadOptions);
+
+  ContextImpl(
+      bool isViable,
+      std::string domainDescriptor,
+      std::chrono::microseconds spinDuration,
+      ThreadOptions threadOptions);
+
+  bool isViable() const;
+
+  // Implement the DeferredExecutor interface.
+  bool inLoop() override;
+  void deferToLoop(TTask fn) override;
+
+  void enableLoopStats();
+
+  std::map<std::string, LoopStats> getLoopStats();
+
+  // The connections stay enrolled until their peer is done with them, which it
+  // tells them from its own loop, possibly on another context, hence the loop
+  // must keep running until they're all gone.
+  void enrollConnection(ConnectionImpl& connection);
+  void unenrollConnection(ConnectionImpl& connection);
+
+ protected:
+  // Implement the entry points called by ContextImplBoilerplate.
+  void closeImpl() override;
+  void joinImpl() override;
+
+ private:
+  const bool isViable_;
+
+  Loop loop_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  size_t numConnections_{0};
+};
+
+} // namespace inproc
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/inproc/listener_impl.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/inproc/connection_impl.h>
+#include <tensorpipe/transport/inproc/context_impl.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace inproc {
+
+namespace {
+
+// The listeners of all the contexts of this process, by their address, which
+// is how the connections find them.
+struct Registry {
+  std::mutex mutex;
+  std::unordered_map<std::string, std::weak_ptr<ListenerImpl>> listeners;
+  uint64_t nextAnonymousId{0};
+};
+
+Registry& getRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+} // namespace
+
+ListenerImpl::ListenerImpl(
+    ConstructorToken token,
+    std::shared_ptr<ContextImpl> context,
+    std::string id,
+    std::string addr)
+    : ListenerImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
+          token,
+          std::move(context),
+          std::move(id)),
+      addr_(std::move(addr)) {}
+
+std::shared_ptr<ListenerImpl> ListenerImpl::find(const std::string& addr) {
+  Registry& registry = getRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  auto iter = registry.listeners.find(addr);
+  if (iter == registry.listeners.end()) {
+    return nullptr;
+  }
+  return iter->second.lock();
+}
+
+void ListenerImpl::initImplFromLoop() {
+  context_->enroll(*this);
+
+  Registry& registry = getRegistry();
+  {
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    if (addr_.empty()) {
+      do {
+        addr_ = "anonymous" + std::to_string(registry.nextAnonymousId++);
+      } while (registry.listeners.count(addr_) > 0);
+    }
+    auto iter = registry.listeners.find(addr_);
+    if (iter == registry.listeners.end() || iter->second.expired()) {
+      registry.listeners[addr_] = shared_from_this();
+      isRegistered_ = true;
+    }
+  }
+  if (!isRegistered_) {
+    setError(TP_CREATE_ERROR(SystemError, "bind", EADDRINUSE));
+    return;
+  }
+}
+
+void ListenerImpl::handleErrorImpl() {
+  if (isRegistered_) {
+    Registry& registry = getRegistry();
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    registry.listeners.erase(addr_);
+    isRegistered_ = false;
+  }
+  for (auto& fn : fns_) {
+    fn(error_, std::shared_ptr<Connection>());
+  }
+  fns_.clear();
+  for (auto& peer : pendingPeers_) {
+    peer->peerFailed();
+  }
+  pendingPeers_.clear();
+
+  context_->unenroll(*this);
+}
+
+void ListenerImpl::acceptImplFromLoop(accept_callback_fn fn) {
+  fns_.push_back(std::move(fn));
+  acceptPendingPeersFromLoop();
+}
+
+std::string ListenerImpl::addrImplFromLoop() const {
+  TP_DCHECK(context_->inLoop());
+  return addr_;
+}
+
+void ListenerImpl::connectFromPeer(std::shared_ptr<ConnectionImpl> peer) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, peer{std::move(peer)}]() mutable {
+        impl->connectFromPeerFromLoop(std::move(peer));
+      });
+}
+
+void ListenerImpl::connectFromPeerFromLoop(
+    std::shared_ptr<ConnectionImpl> peer) {
+  TP_DCHECK(context_->inLoop());
+  if (error_) {
+    peer->peerFailed();
+    return;
+  }
+  pendingPeers_.push_back(std::move(peer));
+  acceptPendingPeersFromLoop();
+}
+
+void ListenerImpl::acceptPendingPeersFromLoop() {
+  while (!fns_.empty() && !pendingPeers_.empty()) {
+    auto fn = std::move(fns_.front());
+    fns_.pop_front();
+    std::shared_ptr<ConnectionImpl> peer = std::move(pendingPeers_.front());
+    pendingPeers_.pop_front();
+    fn(Error::kSuccess, createAndInitConnection(std::move(peer)));
+  }
+}
+
+} // namespace inproc
+} // namespace transport
+} // namespace tensorpipe
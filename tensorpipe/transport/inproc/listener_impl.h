@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/transport/listener_impl_boilerplate.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace inproc {
+
+class ConnectionImpl;
+class ContextImpl;
+
+class ListenerImpl final : public ListenerImplBoilerplate<
+                               ContextImpl,
+                               ListenerImpl,
+                               ConnectionImpl> {
+ public:
+  // Create a listener that listens on the specified address.
+  ListenerImpl(
+      ConstructorToken token,
+      std::shared_ptr<ContextImpl> context,
+      std::string id,
+      std::string addr);
+
+  // Find the listener, of any context of this process, that is listening on
+  // the given address, if any.
+  static std::shared_ptr<ListenerImpl> find(const std::string& addr);
+
+  // Hand a connection that is connecting to this listener over to it, for it to
+  // be paired with an accepted connection, or refused if the listener fails.
+  void connectFromPeer(std::shared_ptr<ConnectionImpl> peer);
+
+ protected:
+  // Implement the entry points called by ListenerImplBoilerplate.
+  void initImplFromLoop() override;
+  void acceptImplFromLoop(accept_callback_fn fn) override;
+  std::string addrImplFromLoop() const override;
+  void handleErrorImpl() override;
+
+ private:
+  std::string addr_;
+  bool isRegistered_{false};
+
+  std::deque<accept_callback_fn> fns_;
+  std::deque<std::shared_ptr<ConnectionImpl>> pendingPeers_;
+
+  void connectFromPeerFromLoop(std::shared_ptr<ConnectionImpl> peer);
+
+  void acceptPendingPeersFromLoop();
+};
+
+} // namespace inproc
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/inproc/loop.h>
+
+#include <utility>
+
+namespace tensorpipe {
+namespace transport {
+namespace inproc {
+
+namespace {
+
+// All deferred functions are notified, hence the loop could sleep
+// indefinitely. This is merely a safety net.
+constexpr std::chrono::microseconds kSleepDuration = std::chrono::seconds(1);
+
+} // namespace
+
+Loop::Loop(std::chrono::microseconds spinDuration, ThreadOptions threadOptions)
+    : BusyPollingLoop(spinDuration, kSleepDuration) {
+  startThread("TP_INPROC_loop", std::move(threadOptions));
+}
+
+void Loop::close() {
+  if (!closed_.exchange(true)) {
+    stopBusyPolling();
+  }
+}
+
+void Loop::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    joinThread();
+  }
+}
+
+Loop::~Loop() {
+  join();
+}
+
+bool Loop::pollOnce() {
+  return false;
+}
+
+bool Loop::readyToClose() {
+  // The context only closes the loop once its connections are all done.
+  return true;
+}
+
+} // namespace inproc
+} // namespace transport
+} // namespace tensorpipe
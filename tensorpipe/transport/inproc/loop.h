@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+#include <tensorpipe/common/busy_polling_loop.h>
+#include <tensorpipe/common/thread_options.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace inproc {
+
+// The thread on which a context runs its deferred functions, which is all it
+// has to do, as the peers hand everything over to it that way. It's needed for
+// the callbacks not to be called inline, from within the calls of the user,
+// which is what an on-demand loop running on their threads would do.
+class Loop final : public BusyPollingLoop {
+ public:
+  Loop(
+      std::chrono::microseconds spinDuration,
+      ThreadOptions threadOptions = ThreadOptions());
+
+  void close();
+
+  void join();
+
+  ~Loop();
+
+ protected:
+  bool pollOnce() override;
+
+  bool readyToClose() override;
+
+ private:
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+};
+
+} // namespace inproc
+} // namespace transport
+} // namespace tensorpipe
@@ -80,6 +80,13 @@ class ListenerImplBoilerplate : public std::enable_shared_from_this<TList> {
   template <typename... Args>
   std::shared_ptr<Connection> createAndInitConnection(Args&&... args);
 
+  // Same as above, but for a connection that belongs to another context, which
+  // thus initializes it later, from its own loop.
+  template <typename... Args>
+  std::shared_ptr<Connection> createConnectionInContext(
+      std::shared_ptr<TCtx> context,
+      Args&&... args);
+
   // An identifier for the listener, composed of the identifier for the context,
   // combined with an increasing sequence number. It will be used as a prefix
   // for the identifiers of connections. All of them will only be used for
@@ -218,6 +225,22 @@ std::shared_ptr<Connection> ListenerImplBoilerplate<TCtx, TList, TConn>::
       std::move(connection));
 }
 
+template <typename TCtx, typename TList, typename TConn>
+template <typename... Args>
+std::shared_ptr<Connection> ListenerImplBoilerplate<TCtx, TList, TConn>::
+    createConnectionInContext(std::shared_ptr<TCtx> context, Args&&... args) {
+  TP_DCHECK(context_->inLoop());
+  std::string connectionId = id_ + ".c" + std::to_string(connectionCounter_++);
+  TP_VLOG(7) << "Listener " << id_ << " is opening connection " << connectionId
+             << " in another context";
+  return std::make_shared<ConnectionBoilerplate<TCtx, TList, TConn>>(
+      typename ConnectionImplBoilerplate<TCtx, TList, TConn>::
+          ConstructorToken(),
+      std::move(context),
+      std::move(connectionId),
+      std::forward<Args>(args)...);
+}
+
 template <typename TCtx, typename TList, typename TConn>
 void ListenerImplBoilerplate<TCtx, TList, TConn>::setId(std::string id) {
   context_->deferToLoop(
@@ -9,8 +9,13 @@
 #include <tensorpipe/transport/shm/connection_impl.h>
 
 #include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <deque>
+#include <limits>
+#include <tuple>
 #include <vector>
 
 #include <tensorpipe/common/callback.h>
@@ -18,8 +23,11 @@
 #include <tensorpipe/common/epoll_loop.h>
 #include <tensorpipe/common/error_macros.h>
 #include <tensorpipe/common/ringbuffer_read_write_ops.h>
+#include <tensorpipe/common/system.h>
 #include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/shm/context.h>
 #include <tensorpipe/transport/shm/context_impl.h>
+#include <tensorpipe/transport/shm/multiplexer.h>
 #include <tensorpipe/transport/shm/reactor.h>
 #include <tensorpipe/transport/shm/sockaddr.h>
 #include <tensorpipe/util/ringbuffer/consumer.h>
@@ -30,6 +38,70 @@ namespace tensorpipe {
 namespace transport {
 namespace shm {
 
+namespace {
+
+// When the inboxes are shared, the two ends of a connection first tell each
+// other who they are, so that they can find (or set up) the multiplexer for the
+// other's context and address the frames of this connection.
+struct Hello {
+  uint64_t contextId;
+  uint64_t channelId;
+  uint64_t inboxSize;
+};
+
+// The messages through which the two ends of an established connection agree
+// to reclaim the memory of an idle inbox (see handleIdleMessageFromLoop).
+constexpr uint8_t kParkRequest = 1;
+constexpr uint8_t kParkAccepted = 2;
+constexpr uint8_t kParkDeclined = 3;
+constexpr uint8_t kWakeRequest = 4;
+constexpr uint8_t kResume = 5;
+
+// With their own inboxes, the two ends then tell each other where to find a
+// value that they picked in their memory, to check whether the other can read
+// it, and the token to trigger once a payload was pulled from their memory.
+struct RendezvousInfo {
+  int64_t pid;
+  uint64_t probeAddress;
+  uint64_t probeValue;
+  uint32_t reactorToken;
+};
+
+// The replies to the other end's RendezvousInfo.
+constexpr uint8_t kRendezvousSupported = 1;
+constexpr uint8_t kRendezvousUnsupported = 2;
+
+// Payloads smaller than this are cheaper to copy through the ringbuffer than to
+// pull from the peer's memory, which costs a syscall and a round trip.
+constexpr size_t kRendezvousThreshold = 256 * 1024;
+
+// Copy a payload straight from the memory of the given process.
+Error pullFromPeer(int64_t pid, uint64_t address, void* ptr, size_t length) {
+  size_t offset = 0;
+  while (offset < length) {
+    struct iovec local {
+      .iov_base = reinterpret_cast<uint8_t*>(ptr) + offset,
+      .iov_len = length - offset
+    };
+    struct iovec remote {
+      .iov_base = reinterpret_cast<void*>(address + offset),
+      .iov_len = length - offset
+    };
+    // The kernel may copy less than asked, e.g., for very large payloads.
+    ssize_t nread = ::process_vm_readv(pid, &local, 1, &remote, 1, 0);
+    if (nread < 0) {
+      return TP_CREATE_ERROR(SystemError, "process_vm_readv", errno);
+    }
+    if (nread == 0) {
+      return TP_CREATE_ERROR(ShortReadError, length, offset);
+    }
+    offset += nread;
+  }
+  return Error::kSuccess;
+}
+
+} // namespace
+
 ConnectionImpl::ConnectionImpl(
     ConstructorToken token,
     std::shared_ptr<ContextImpl> context,
@@ -78,11 +150,56 @@ void ConnectionImpl::initImplFromLoop() {
     return;
   }
 
-  // Create ringbuffer for inbox.
+  if (context_->sharesInboxes()) {
+    const size_t channelBufferSize =
+        std::min(context_->getBufferSize(), kSharedInboxChannelBufferSize);
+    channelId_ = context_->allocateChannelId();
+    channelInboxHeader_ =
+        std::make_unique<util::ringbuffer::RingBufferHeader>(channelBufferSize);
+    channelInboxData_ = std::make_unique<uint8_t[]>(channelBufferSize);
+    inboxRb_ = util::ringbuffer::RingBuffer(
+        channelInboxHeader_.get(), channelInboxData_.get());
+    channelOutboxHeader_ =
+        std::make_unique<util::ringbuffer::RingBufferHeader>(channelBufferSize);
+    channelOutboxData_ = std::make_unique<uint8_t[]>(channelBufferSize);
+    outboxRb_ = util::ringbuffer::RingBuffer(
+        channelOutboxHeader_.get(), channelOutboxData_.get());
+    channelBuffersMemoryCharge_ = MemoryCharge(
+        context_->getMemoryFootprintCounters(),
+        MemoryKind::kHost,
+        2 * channelBufferSize);
+
+    // We're introducing ourselves first, so wait for writability.
+    state_ = SEND_HELLO;
+    context_->registerDescriptor(socket_.fd(), EPOLLOUT, shared_from_this());
+    return;
+  }
+
+  // Create ringbuffer for inbox. Back it with huge pages if available (and if
+  // it's a multiple of their size), to spare TLB misses to the reactor and the
+  // peer. Map it twice in a row if possible, so that payloads and nop objects
+  // that wrap around its end can still be accessed in place.
   std::tie(error, inboxHeaderSegment_, inboxDataSegment_, inboxRb_) =
-      util::ringbuffer::shm::create(kBufferSize);
+      util::ringbuffer::shm::create(
+          context_->getBufferSize(),
+          util::shm::PageType::HugeTLB_2MB,
+          /*permWrite=*/true,
+          /*doubleMapped=*/true);
   TP_THROW_ASSERT_IF(error)
       << "Couldn't allocate ringbuffer for connection inbox: " << error.what();
+  inboxMemoryCharge_ = MemoryCharge(
+      context_->getMemoryFootprintCounters(),
+      MemoryKind::kShared,
+      context_->getBufferSize());
+  if (context_->getNumaNode() >= 0) {
+    error = bindMemoryToNumaNode(
+        inboxDataSegment_.getPtr(),
+        inboxDataSegment_.getSize(),
+        context_->getNumaNode());
+    TP_LOG_WARNING_IF(error)
+        << "Couldn't place the inbox of connection " << id_ << " on NUMA node "
+        << context_->getNumaNode() << ": " << error.what();
+  }
 
   // Register method to be called when our peer writes to our inbox.
   inboxReactorToken_ =
@@ -100,6 +217,15 @@ void ConnectionImpl::initImplFromLoop() {
         impl.processWriteOperationsFromLoop();
       }));
 
+  // Register method to be called when our peer pulled a payload from us.
+  rendezvousReactorToken_ =
+      context_->addReaction(runIfAlive(*this, [](ConnectionImpl& impl) {
+        TP_VLOG(9) << "Connection " << impl.id_
+                   << " is reacting to the peer pulling a payload";
+        impl.onRendezvousCompletedFromLoop();
+      }));
+  rendezvousProbe_ = context_->getUniqueId();
+
   // We're sending file descriptors first, so wait for writability.
   state_ = SEND_FDS;
   context_->registerDescriptor(socket_.fd(), EPOLLOUT, shared_from_this());
@@ -107,6 +233,7 @@ void ConnectionImpl::initImplFromLoop() {
 
 void ConnectionImpl::readImplFromLoop(read_callback_fn fn) {
   readOperations_.emplace_back(std::move(fn));
+  readOperations_.back().setBufferPool(&readBufferPool_);
 
   // If the inbox already contains some data, we may be able to process this
   // operation right away.
@@ -160,6 +287,24 @@ void ConnectionImpl::writeImplFromLoop(
   processWriteOperationsFromLoop();
 }
 
+void ConnectionImpl::writeImplFromLoop(
+    const AbstractNopHolder& object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  // Use a single operation for all of them, which will write as much of them
+  // as possible in each ringbuffer transaction and thus notify the peer once.
+  std::vector<std::tuple<const void*, size_t>> ringbufferBuffers;
+  ringbufferBuffers.reserve(buffers.size());
+  for (const WriteBuffer& buffer : buffers) {
+    ringbufferBuffers.emplace_back(buffer.ptr, buffer.length);
+  }
+  writeOperations_.emplace_back(&object, ringbufferBuffers, std::move(fn));
+
+  // If the outbox has some free space, we may be able to process this operation
+  // right away.
+  processWriteOperationsFromLoop();
+}
+
 void ConnectionImpl::handleEventsFromLoop(int events) {
   TP_DCHECK(context_->inLoop());
   TP_VLOG(9) << "Connection " << id_ << " is handling an event on its socket ("
@@ -210,6 +355,40 @@ void ConnectionImpl::handleEventsFromLoop(int events) {
 
 void ConnectionImpl::handleEventInFromLoop() {
   TP_DCHECK(context_->inLoop());
+  if (state_ == RECV_HELLO) {
+    Hello hello;
+    auto err = socket_.read(&hello);
+    if (err) {
+      setError(std::move(err));
+      return;
+    }
+    if (!isPow2(hello.inboxSize) ||
+        hello.inboxSize > std::numeric_limits<int32_t>::max()) {
+      setError(TP_CREATE_ERROR(
+          SystemError, "peer has an inbox of invalid size", EINVAL));
+      return;
+    }
+
+    multiplexer_ = context_->getMultiplexer(hello.contextId);
+    multiplexer_->addChannelFromLoop(
+        channelId_,
+        hello.channelId,
+        hello.inboxSize,
+        inboxRb_,
+        outboxRb_,
+        runIfAlive(
+            *this,
+            [](ConnectionImpl& impl) { impl.processReadOperationsFromLoop(); }),
+        runIfAlive(*this, [](ConnectionImpl& impl) {
+          impl.processWriteOperationsFromLoop();
+        }));
+
+    // Now we can send the file descriptors of the multiplexer.
+    state_ = SEND_FDS;
+    context_->registerDescriptor(socket_.fd(), EPOLLOUT, shared_from_this());
+    return;
+  }
+
   if (state_ == RECV_FDS) {
     Fd reactorHeaderFd;
     Fd reactorDataFd;
@@ -231,10 +410,32 @@ void ConnectionImpl::handleEventInFromLoop() {
       return;
     }
 
-    // Load ringbuffer for outbox.
+    if (multiplexer_ != nullptr) {
+      err = multiplexer_->setPeerInboxFromLoop(
+          peerInboxReactorToken,
+          peerOutboxReactorToken,
+          std::move(reactorHeaderFd),
+          std::move(reactorDataFd),
+          std::move(outboxHeaderFd),
+          std::move(outboxDataFd));
+      if (err) {
+        setError(std::move(err));
+        return;
+      }
+      state_ = ESTABLISHED;
+      processWriteOperationsFromLoop();
+      processReadOperationsFromLoop();
+      return;
+    }
+
+    // Load ringbuffer for outbox, mapping it twice in a row if possible.
     std::tie(err, outboxHeaderSegment_, outboxDataSegment_, outboxRb_) =
         util::ringbuffer::shm::load(
-            std::move(outboxHeaderFd), std::move(outboxDataFd));
+            std::move(outboxHeaderFd),
+            std::move(outboxDataFd),
+            /*dataPageType=*/nullopt,
+            /*permWrite=*/true,
+            /*doubleMapped=*/true);
     TP_THROW_ASSERT_IF(err)
         << "Couldn't access ringbuffer of connection outbox: " << err.what();
 
@@ -245,21 +446,69 @@ void ConnectionImpl::handleEventInFromLoop() {
     peerInboxReactorToken_ = peerInboxReactorToken;
     peerOutboxReactorToken_ = peerOutboxReactorToken;
 
-    // The connection is usable now.
-    state_ = ESTABLISHED;
-    processWriteOperationsFromLoop();
-    // Trigger read operations in case a pair of local read() and remote
-    // write() happened before connection is established. Otherwise read()
-    // callback would lose if it's the only read() request.
-    processReadOperationsFromLoop();
+    // Find out whether we can pull the large payloads from each other.
+    state_ = SEND_RENDEZVOUS_INFO;
+    context_->registerDescriptor(socket_.fd(), EPOLLOUT, shared_from_this());
+    return;
+  }
+
+  if (state_ == RECV_RENDEZVOUS_INFO) {
+    RendezvousInfo info;
+    auto err = socket_.read(&info);
+    if (err) {
+      setError(std::move(err));
+      return;
+    }
+    peerPid_ = info.pid;
+    peerRendezvousReactorToken_ = info.reactorToken;
+    const bool canPull = probePeerMemoryFromLoop(
+        info.pid, info.probeAddress, info.probeValue);
+    if (canPull) {
+      readRendezvousThreshold_ = kRendezvousThreshold;
+    }
+    const uint8_t reply =
+        canPull ? kRendezvousSupported : kRendezvousUnsupported;
+    err = socket_.write(reply);
+    if (err) {
+      setError(std::move(err));
+      return;
+    }
+    state_ = RECV_RENDEZVOUS_REPLY;
+    return;
+  }
+
+  if (state_ == RECV_RENDEZVOUS_REPLY) {
+    uint8_t reply;
+    auto err = socket_.read(&reply);
+    if (err) {
+      setError(std::move(err));
+      return;
+    }
+    if (reply == kRendezvousSupported) {
+      writeRendezvousThreshold_ = kRendezvousThreshold;
+    } else if (reply != kRendezvousUnsupported) {
+      setError(TP_CREATE_ERROR(
+          SystemError, "peer sent an invalid message", EINVAL));
+      return;
+    }
+    setEstablishedFromLoop();
     return;
   }
 
   if (state_ == ESTABLISHED) {
-    // We don't expect to read anything on this socket once the
-    // connection has been established. If we do, assume it's a
-    // zero-byte read indicating EOF.
-    setError(TP_CREATE_ERROR(EOFError));
+    // Once the connection has been established we only expect the messages
+    // about idle inboxes on this socket, or a zero-byte read indicating EOF.
+    uint8_t message;
+    ssize_t rv = socket_.read(&message, sizeof(message));
+    if (rv < 0) {
+      setError(TP_CREATE_ERROR(SystemError, "read", errno));
+      return;
+    }
+    if (rv == 0) {
+      setError(TP_CREATE_ERROR(EOFError));
+      return;
+    }
+    handleIdleMessageFromLoop(message);
     return;
   }
 
@@ -268,19 +517,44 @@ void ConnectionImpl::handleEventInFromLoop() {
 
 void ConnectionImpl::handleEventOutFromLoop() {
   TP_DCHECK(context_->inLoop());
+  if (state_ == SEND_HELLO) {
+    Hello hello;
+    hello.contextId = context_->getUniqueId();
+    hello.channelId = channelId_;
+    hello.inboxSize = inboxRb_.getHeader().kDataPoolByteSize;
+    auto err = socket_.write(hello);
+    if (err) {
+      setError(std::move(err));
+      return;
+    }
+
+    state_ = RECV_HELLO;
+    context_->registerDescriptor(socket_.fd(), EPOLLIN, shared_from_this());
+    return;
+  }
+
   if (state_ == SEND_FDS) {
     int reactorHeaderFd;
     int reactorDataFd;
     std::tie(reactorHeaderFd, reactorDataFd) = context_->reactorFds();
 
-    // Send our reactor token, reactor fds, and inbox fds.
-    auto err = socket_.sendPayloadAndFds(
-        inboxReactorToken_.value(),
-        outboxReactorToken_.value(),
-        reactorHeaderFd,
-        reactorDataFd,
-        inboxHeaderSegment_.getFd(),
-        inboxDataSegment_.getFd());
+    // Send our reactor token, reactor fds, and inbox fds. With shared inboxes,
+    // these are the multiplexer's ones rather than the connection's.
+    auto err = multiplexer_ != nullptr
+        ? socket_.sendPayloadAndFds(
+              multiplexer_->inboxReactorToken(),
+              multiplexer_->outboxReactorToken(),
+              reactorHeaderFd,
+              reactorDataFd,
+              multiplexer_->inboxHeaderFd(),
+              multiplexer_->inboxDataFd())
+        : socket_.sendPayloadAndFds(
+              inboxReactorToken_.value(),
+              outboxReactorToken_.value(),
+              reactorHeaderFd,
+              reactorDataFd,
+              inboxHeaderSegment_.getFd(),
+              inboxDataSegment_.getFd());
     if (err) {
       setError(std::move(err));
       return;
@@ -292,9 +566,241 @@ void ConnectionImpl::handleEventOutFromLoop() {
     return;
   }
 
+  if (state_ == SEND_RENDEZVOUS_INFO) {
+    RendezvousInfo info;
+    info.pid = ::getpid();
+    info.probeAddress = reinterpret_cast<uintptr_t>(&rendezvousProbe_);
+    info.probeValue = rendezvousProbe_;
+    info.reactorToken = rendezvousReactorToken_.value();
+    auto err = socket_.write(info);
+    if (err) {
+      setError(std::move(err));
+      return;
+    }
+
+    state_ = RECV_RENDEZVOUS_INFO;
+    context_->registerDescriptor(socket_.fd(), EPOLLIN, shared_from_this());
+    return;
+  }
+
   TP_THROW_ASSERT() << "EPOLLOUT event not handled in state " << state_;
 }
 
+bool ConnectionImpl::probePeerMemoryFromLoop(
+    int64_t peerPid,
+    uint64_t peerProbeAddress,
+    uint64_t peerProbeValue) {
+  TP_DCHECK(context_->inLoop());
+  // This fails if the peer is in another PID namespace (or the PID is someone
+  // else's, hence the check of the value), if we lack the ptrace permissions
+  // on it (e.g., with YAMA's restricted scope) or if seccomp blocks the call.
+  uint64_t value = 0;
+  struct iovec local {
+    .iov_base = &value, .iov_len = sizeof(value)
+  };
+  struct iovec remote {
+    .iov_base = reinterpret_cast<void*>(peerProbeAddress),
+    .iov_len = sizeof(value)
+  };
+  ssize_t nread = ::process_vm_readv(peerPid, &local, 1, &remote, 1, 0);
+  if (nread != sizeof(value) || value != peerProbeValue) {
+    TP_VLOG(6) << "Connection " << id_ << " can't read the memory of its peer"
+               << (nread < 0 ? ": " + std::string(::strerror(errno)) : "")
+               << ", hence it will receive all payloads through its inbox";
+    return false;
+  }
+  TP_VLOG(6) << "Connection " << id_
+             << " will pull the large payloads from the memory of its peer";
+  return true;
+}
+
+void ConnectionImpl::setEstablishedFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  // The connection is usable now.
+  state_ = ESTABLISHED;
+  scheduleIdleCheckFromLoop();
+  processWriteOperationsFromLoop();
+  // Trigger read operations in case a pair of local read() and remote
+  // write() happened before connection is established. Otherwise read()
+  // callback would lose if it's the only read() request.
+  processReadOperationsFromLoop();
+}
+
+void ConnectionImpl::onRendezvousCompletedFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  if (error_ || !rendezvousAdvertised_) {
+    return;
+  }
+  // The peer pulls the payloads one at a time, in order, and only those that
+  // we advertised, which belong to the front operation.
+  TP_DCHECK(!writeOperations_.empty());
+  TP_DCHECK(writeOperations_.front().awaitingRendezvous());
+  writeOperations_.front().completeRendezvous();
+  rendezvousAdvertised_ = false;
+  processWriteOperationsFromLoop();
+}
+
+void ConnectionImpl::handleIdleMessageFromLoop(uint8_t message) {
+  TP_DCHECK(context_->inLoop());
+  const util::ringbuffer::RingBufferHeader& inboxHeader = inboxRb_.getHeader();
+  Error error;
+  switch (message) {
+    case kParkRequest:
+      // If we have something to write we'd need to be woken up right away.
+      if (!writeOperations_.empty()) {
+        sendIdleMessageFromLoop(kParkDeclined);
+        return;
+      }
+      TP_VLOG(8) << "Connection " << id_ << " is parking its outbox";
+      outboxParked_ = true;
+      sendIdleMessageFromLoop(kParkAccepted);
+      return;
+
+    case kParkAccepted:
+      TP_DCHECK_EQ(inboxState_, INBOX_PARKING);
+      // The peer may have written something before it got our request.
+      if (inboxHeader.readHead() != inboxHeader.readTail()) {
+        inboxState_ = INBOX_ACTIVE;
+        sendIdleMessageFromLoop(kResume);
+        return;
+      }
+      error = inboxDataSegment_.releaseMemory();
+      if (error) {
+        TP_VLOG(6) << "Connection " << id_
+                   << " couldn't release the memory of its inbox: "
+                   << error.what();
+        inboxState_ = INBOX_ACTIVE;
+        sendIdleMessageFromLoop(kResume);
+        return;
+      }
+      TP_VLOG(8) << "Connection " << id_
+                 << " released the memory of its idle inbox";
+      statsCounters_.recordRingBufferReclaim();
+      inboxMemoryCharge_.reset();
+      inboxState_ = INBOX_RECLAIMED;
+      return;
+
+    case kParkDeclined:
+      TP_DCHECK_EQ(inboxState_, INBOX_PARKING);
+      inboxState_ = INBOX_ACTIVE;
+      return;
+
+    case kWakeRequest:
+      // The request may have been sent before the peer got a resume that we
+      // sent right away, when the inbox wasn't empty.
+      if (inboxState_ != INBOX_RECLAIMED) {
+        return;
+      }
+      error = inboxDataSegment_.reacquireMemory();
+      if (error) {
+        setError(std::move(error));
+        return;
+      }
+      TP_VLOG(8) << "Connection " << id_
+                 << " reacquired the memory of its inbox";
+      // Releasing the memory unmapped its pages, in both processes.
+      prefaultRingBufferFromLoop(inboxDataSegment_);
+      inboxMemoryCharge_ = MemoryCharge(
+          context_->getMemoryFootprintCounters(),
+          MemoryKind::kShared,
+          context_->getBufferSize());
+      inboxState_ = INBOX_ACTIVE;
+      numInboxBytesReadAtIdleCheck_ = numInboxBytesRead_;
+      sendIdleMessageFromLoop(kResume);
+      scheduleIdleCheckFromLoop();
+      return;
+
+    case kResume:
+      TP_DCHECK(outboxParked_);
+      TP_VLOG(8) << "Connection " << id_ << " is resuming its outbox";
+      outboxParked_ = false;
+      wakeRequested_ = false;
+      prefaultRingBufferFromLoop(outboxDataSegment_);
+      processWriteOperationsFromLoop();
+      return;
+
+    default:
+      setError(TP_CREATE_ERROR(
+          SystemError, "peer sent an invalid message", EINVAL));
+      return;
+  }
+}
+
+void ConnectionImpl::prefaultRingBufferFromLoop(
+    util::shm::Segment& dataSegment) {
+  TP_DCHECK(context_->inLoop());
+  Error error = dataSegment.prefault();
+  if (error) {
+    TP_VLOG(6) << "Connection " << id_
+               << " couldn't prefault a ringbuffer: " << error.what();
+  }
+}
+
+void ConnectionImpl::sendIdleMessageFromLoop(uint8_t message) {
+  TP_DCHECK(context_->inLoop());
+  auto err = socket_.write(message);
+  if (err) {
+    setError(std::move(err));
+  }
+}
+
+void ConnectionImpl::checkIdleFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  idleTimer_.reset();
+  if (error_ || inboxState_ == INBOX_RECLAIMED) {
+    return;
+  }
+
+  // Nothing was read since the previous check, and nothing is left to be read.
+  const util::ringbuffer::RingBufferHeader& inboxHeader = inboxRb_.getHeader();
+  if (inboxState_ == INBOX_ACTIVE &&
+      numInboxBytesRead_ == numInboxBytesReadAtIdleCheck_ &&
+      inboxHeader.readHead() == inboxHeader.readTail()) {
+    TP_VLOG(8) << "Connection " << id_
+               << " is asking its peer to park as its inbox is idle";
+    inboxState_ = INBOX_PARKING;
+    sendIdleMessageFromLoop(kParkRequest);
+  }
+  numInboxBytesReadAtIdleCheck_ = numInboxBytesRead_;
+  scheduleIdleCheckFromLoop();
+}
+
+void ConnectionImpl::scheduleIdleCheckFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  // The inbox may have been reclaimed on request of the context even if the
+  // idle connections aren't reclaimed on their own.
+  if (error_ || idleTimer_.has_value() ||
+      context_->getIdleTimeout().count() == 0) {
+    return;
+  }
+  // The timer doesn't keep the connection alive.
+  std::weak_ptr<ConnectionImpl> weakImpl = shared_from_this();
+  idleTimer_ = context_->getTimerWheel().schedule(
+      context_->getIdleTimeout(), [weakImpl]() {
+        std::shared_ptr<ConnectionImpl> impl = weakImpl.lock();
+        if (impl != nullptr) {
+          impl->context_->deferToLoop(
+              [impl]() { impl->checkIdleFromLoop(); });
+        }
+      });
+}
+
+void ConnectionImpl::reclaimMemoryImplFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  // Like an idle check, but without waiting for the inbox to have been empty
+  // for a while. Shared inboxes are never reclaimed.
+  const util::ringbuffer::RingBufferHeader& inboxHeader = inboxRb_.getHeader();
+  if (error_ || state_ != ESTABLISHED || context_->sharesInboxes() ||
+      inboxState_ != INBOX_ACTIVE ||
+      inboxHeader.readHead() != inboxHeader.readTail()) {
+    return;
+  }
+  TP_VLOG(8) << "Connection " << id_
+             << " is asking its peer to park as its inbox is to be reclaimed";
+  inboxState_ = INBOX_PARKING;
+  sendIdleMessageFromLoop(kParkRequest);
+}
+
 void ConnectionImpl::processReadOperationsFromLoop() {
   TP_DCHECK(context_->inLoop());
 
@@ -304,11 +810,40 @@ void ConnectionImpl::processReadOperationsFromLoop() {
     return;
   }
   // Serve read operations
-  util::ringbuffer::Consumer inboxConsumer(inboxRb_);
+  size_t bytesRead = 0;
+  util::ringbuffer::SingleConsumer inboxConsumer(inboxRb_);
   while (!readOperations_.empty()) {
     RingbufferReadOperation& readOperation = readOperations_.front();
-    if (readOperation.handleRead(inboxConsumer) > 0) {
-      peerReactorTrigger_->run(peerOutboxReactorToken_.value());
+    readOperation.setRendezvousThreshold(readRendezvousThreshold_);
+    bytesRead += readOperation.handleRead(inboxConsumer);
+    if (readOperation.awaitingRendezvous()) {
+      // The address of the payload follows its length, but the peer may not
+      // have had the room to write it yet.
+      uint64_t address;
+      ssize_t ret = inboxConsumer.startTx();
+      TP_THROW_SYSTEM_IF(ret < 0, -ret);
+      ret = inboxConsumer.readInTx</*AllowPartial=*/false>(
+          &address, sizeof(address));
+      if (ret == -ENODATA) {
+        ret = inboxConsumer.cancelTx();
+        TP_THROW_SYSTEM_IF(ret < 0, -ret);
+        break;
+      }
+      TP_THROW_SYSTEM_IF(ret < 0, -ret);
+      ret = inboxConsumer.commitTx();
+      TP_THROW_SYSTEM_IF(ret < 0, -ret);
+      bytesRead += sizeof(address);
+      Error error = pullFromPeer(
+          peerPid_,
+          address,
+          readOperation.rendezvousPtr(),
+          readOperation.rendezvousLength());
+      if (error) {
+        setError(std::move(error));
+        return;
+      }
+      readOperation.completeRendezvous();
+      peerReactorTrigger_->defer(peerRendezvousReactorToken_.value());
     }
     if (readOperation.completed()) {
       readOperations_.pop_front();
@@ -316,6 +851,20 @@ void ConnectionImpl::processReadOperationsFromLoop() {
       break;
     }
   }
+  // Notify the peer only once for all the operations that were served. With
+  // shared inboxes, do so by giving back the credits for what we consumed.
+  if (context_->sharesInboxes()) {
+    // A callback may have closed the connection in the meantime.
+    if (bytesRead > 0 && multiplexer_ != nullptr) {
+      multiplexer_->releaseCreditsFromLoop(channelId_, bytesRead);
+    }
+  } else {
+    if (bytesRead > 0) {
+      peerReactorTrigger_->defer(peerOutboxReactorToken_.value());
+    }
+    peerReactorTrigger_->flush();
+    numInboxBytesRead_ += bytesRead;
+  }
 }
 
 void ConnectionImpl::processWriteOperationsFromLoop() {
@@ -325,21 +874,86 @@ void ConnectionImpl::processWriteOperationsFromLoop() {
     return;
   }
 
-  util::ringbuffer::Producer outboxProducer(outboxRb_);
+  if (context_->sharesInboxes()) {
+    // Alternate between filling our private outbox and having the multiplexer
+    // drain it, for as long as it makes room in it (and a callback doesn't
+    // close the connection).
+    do {
+      util::ringbuffer::SingleProducer outboxProducer(outboxRb_);
+      while (!writeOperations_.empty()) {
+        RingbufferWriteOperation& writeOperation = writeOperations_.front();
+        writeOperation.handleWrite(outboxProducer);
+        if (writeOperation.completed()) {
+          writeOperations_.pop_front();
+        } else {
+          break;
+        }
+      }
+    } while (multiplexer_ != nullptr &&
+             multiplexer_->sendFromChannelFromLoop(channelId_) &&
+             !writeOperations_.empty());
+    if (!writeOperations_.empty()) {
+      statsCounters_.recordRingBufferStall();
+    }
+    return;
+  }
+
+  // While the peer's inbox is reclaimed, have it reacquired before writing.
+  if (outboxParked_) {
+    if (!writeOperations_.empty() && !wakeRequested_) {
+      TP_VLOG(8) << "Connection " << id_ << " is asking its peer to resume";
+      wakeRequested_ = true;
+      sendIdleMessageFromLoop(kWakeRequest);
+    }
+    return;
+  }
+
+  util::ringbuffer::SingleProducer outboxProducer(outboxRb_);
   while (!writeOperations_.empty()) {
     RingbufferWriteOperation& writeOperation = writeOperations_.front();
+    writeOperation.setRendezvousThreshold(writeRendezvousThreshold_);
     if (writeOperation.handleWrite(outboxProducer) > 0) {
-      peerReactorTrigger_->run(peerInboxReactorToken_.value());
+      peerReactorTrigger_->defer(peerInboxReactorToken_.value());
+    }
+    if (writeOperation.awaitingRendezvous()) {
+      // Have the peer pull the buffer, and wait for it to be done with it.
+      if (!rendezvousAdvertised_) {
+        uint64_t address =
+            reinterpret_cast<uintptr_t>(writeOperation.rendezvousPtr());
+        ssize_t ret = outboxProducer.startTx();
+        TP_THROW_SYSTEM_IF(ret < 0, -ret);
+        ret = outboxProducer.writeInTx</*AllowPartial=*/false>(
+            &address, sizeof(address));
+        if (ret == -ENOSPC) {
+          ret = outboxProducer.cancelTx();
+          TP_THROW_SYSTEM_IF(ret < 0, -ret);
+          statsCounters_.recordRingBufferStall();
+          break;
+        }
+        TP_THROW_SYSTEM_IF(ret < 0, -ret);
+        ret = outboxProducer.commitTx();
+        TP_THROW_SYSTEM_IF(ret < 0, -ret);
+        peerReactorTrigger_->defer(peerInboxReactorToken_.value());
+        rendezvousAdvertised_ = true;
+      }
+      break;
     }
     if (writeOperation.completed()) {
       writeOperations_.pop_front();
     } else {
+      statsCounters_.recordRingBufferStall();
       break;
     }
   }
+  // Notify the peer only once for all the operations that were served.
+  peerReactorTrigger_->flush();
 }
 
 void ConnectionImpl::handleErrorImpl() {
+  if (idleTimer_.has_value()) {
+    context_->getTimerWheel().cancel(idleTimer_.value());
+    idleTimer_.reset();
+  }
   for (auto& readOperation : readOperations_) {
     readOperation.handleError(error_);
   }
@@ -356,6 +970,14 @@ void ConnectionImpl::handleErrorImpl() {
     context_->removeReaction(outboxReactorToken_.value());
     outboxReactorToken_.reset();
   }
+  if (rendezvousReactorToken_.has_value()) {
+    context_->removeReaction(rendezvousReactorToken_.value());
+    rendezvousReactorToken_.reset();
+  }
+  if (multiplexer_ != nullptr) {
+    multiplexer_->removeChannelFromLoop(channelId_);
+    multiplexer_.reset();
+  }
   if (socket_.hasValue()) {
     if (state_ > INITIALIZING) {
       context_->unregisterDescriptor(socket_.fd());
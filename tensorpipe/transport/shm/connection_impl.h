@@ -8,15 +8,20 @@
 
 #pragma once
 
+#include <cstdint>
 #include <deque>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <tensorpipe/common/epoll_loop.h>
+#include <tensorpipe/common/memory_footprint.h>
 #include <tensorpipe/common/nop.h>
 #include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/read_buffer_pool.h>
 #include <tensorpipe/common/ringbuffer_read_write_ops.h>
 #include <tensorpipe/common/socket.h>
+#include <tensorpipe/common/timer_wheel.h>
 #include <tensorpipe/transport/connection_impl_boilerplate.h>
 #include <tensorpipe/transport/shm/reactor.h>
 #include <tensorpipe/transport/shm/sockaddr.h>
@@ -27,14 +32,9 @@ namespace tensorpipe {
 namespace transport {
 namespace shm {
 
-namespace {
-
-constexpr auto kBufferSize = 2 * 1024 * 1024;
-
-} // namespace
-
 class ContextImpl;
 class ListenerImpl;
+class Multiplexer;
 
 class ConnectionImpl final : public ConnectionImplBoilerplate<
                                  ContextImpl,
@@ -43,11 +43,25 @@ class ConnectionImpl final : public ConnectionImplBoilerplate<
                              public EpollLoop::EventHandler {
   enum State {
     INITIALIZING = 1,
+    SEND_HELLO,
+    RECV_HELLO,
     SEND_FDS,
     RECV_FDS,
+    SEND_RENDEZVOUS_INFO,
+    RECV_RENDEZVOUS_INFO,
+    RECV_RENDEZVOUS_REPLY,
     ESTABLISHED,
   };
 
+  // Where the inbox is in the reclamation of its memory once it's idle.
+  enum InboxState {
+    INBOX_ACTIVE = 1,
+    // We asked the peer to hold back its writes.
+    INBOX_PARKING,
+    // The memory is gone, until the peer asks to write again.
+    INBOX_RECLAIMED,
+  };
+
  public:
   // Create a connection that is already connected (e.g. from a listener).
   ConnectionImpl(
@@ -77,23 +91,64 @@ class ConnectionImpl final : public ConnectionImplBoilerplate<
       override;
   void writeImplFromLoop(const AbstractNopHolder& object, write_callback_fn fn)
       override;
+  void writeImplFromLoop(
+      const AbstractNopHolder& object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn) override;
   void handleErrorImpl() override;
+  void reclaimMemoryImplFromLoop() override;
 
  private:
   // Handle events of type EPOLLIN on the UNIX domain socket.
   //
   // The only data that is expected on that socket is the file descriptors for
   // the other side's inbox (which is this side's outbox) and its reactor, plus
-  // the reactor tokens to trigger the other side to read or write.
+  // the reactor tokens to trigger the other side to read or write. When the
+  // inboxes are shared, these are preceded by the ids of the other side's
+  // context and channel, and otherwise followed by the details of rendezvous.
   void handleEventInFromLoop();
 
   // Handle events of type EPOLLOUT on the UNIX domain socket.
   //
   // Once the socket is writable we send the file descriptors for this side's
   // inbox (which the other side's outbox) and our reactor, plus the reactor
-  // tokens to trigger this connection to read or write.
+  // tokens to trigger this connection to read or write. When the inboxes are
+  // shared, these are the ones of the multiplexer, and we first send the ids of
+  // our context and channel.
   void handleEventOutFromLoop();
 
+  // With their own inboxes, the two ends then find out whether each of them
+  // can read the memory of the other (with process_vm_readv, which needs ptrace
+  // permissions on the peer): each of them tells the other its PID and the
+  // address of a known value, which the other attempts to read, and replies
+  // whether it succeeded. In each direction in which it did, the large payloads
+  // don't go through the ringbuffer: the writer only puts their length and
+  // their address in it, the reader copies them straight from the writer's
+  // memory into their destination, and then triggers the writer's rendezvous
+  // token to have it release the buffer.
+  bool probePeerMemoryFromLoop(
+      int64_t peerPid,
+      uint64_t peerProbeAddress,
+      uint64_t peerProbeValue);
+  void setEstablishedFromLoop();
+  void onRendezvousCompletedFromLoop();
+
+  // Once the connection is established, the socket only carries the messages
+  // through which the two sides agree to reclaim the memory of an idle inbox:
+  // its owner asks the peer to park its outbox (i.e., to hold back its writes),
+  // which the peer accepts if it has nothing to write, and once the owner has
+  // released the memory they both wait for the peer to ask to write again, upon
+  // which the owner reacquires the memory and has the peer resume.
+  void handleIdleMessageFromLoop(uint8_t message);
+  void sendIdleMessageFromLoop(uint8_t message);
+  // Map the pages of a ringbuffer again after its memory came back.
+  void prefaultRingBufferFromLoop(util::shm::Segment& dataSegment);
+
+  // Look at whether the inbox was idle since the previous check, to start the
+  // reclamation of its memory if so, and schedule the next check.
+  void checkIdleFromLoop();
+  void scheduleIdleCheckFromLoop();
+
   State state_{INITIALIZING};
   Socket socket_;
   optional<Sockaddr> sockaddr_;
@@ -103,6 +158,8 @@ class ConnectionImpl final : public ConnectionImplBoilerplate<
   util::shm::Segment inboxDataSegment_;
   util::ringbuffer::RingBuffer inboxRb_;
   optional<Reactor::TToken> inboxReactorToken_;
+  // Accounts for the memory of the inbox while it's allocated.
+  MemoryCharge inboxMemoryCharge_;
 
   // Outbox.
   util::shm::Segment outboxHeaderSegment_;
@@ -110,10 +167,47 @@ class ConnectionImpl final : public ConnectionImplBoilerplate<
   util::ringbuffer::RingBuffer outboxRb_;
   optional<Reactor::TToken> outboxReactorToken_;
 
+  // Rendezvous (see probePeerMemoryFromLoop). The payloads at least as large as
+  // the threshold of their direction are pulled by the reader, which is the
+  // case of none of them unless the reader managed to read the other's probe.
+  uint64_t rendezvousProbe_{0};
+  optional<Reactor::TToken> rendezvousReactorToken_;
+  size_t readRendezvousThreshold_{SIZE_MAX};
+  size_t writeRendezvousThreshold_{SIZE_MAX};
+  int64_t peerPid_{0};
+  // Whether the address of the buffer of the front write operation that awaits
+  // rendezvous was written to the outbox, after its length.
+  bool rendezvousAdvertised_{false};
+
+  // The reclamation of the memory of the inbox, and of the peer's one (on
+  // behalf of which we park our outbox).
+  InboxState inboxState_{INBOX_ACTIVE};
+  uint64_t numInboxBytesRead_{0};
+  uint64_t numInboxBytesReadAtIdleCheck_{0};
+  optional<TimerWheel::TTimerId> idleTimer_;
+  bool outboxParked_{false};
+  bool wakeRequested_{false};
+
   // Peer trigger/tokens.
   optional<Reactor::Trigger> peerReactorTrigger_;
   optional<Reactor::TToken> peerInboxReactorToken_;
   optional<Reactor::TToken> peerOutboxReactorToken_;
+  optional<Reactor::TToken> peerRendezvousReactorToken_;
+
+  // When the inboxes are shared, the inbox and outbox above are private ones,
+  // allocated on the heap, and the multiplexer moves the data between them and
+  // the shared ones.
+  std::shared_ptr<Multiplexer> multiplexer_;
+  uint64_t channelId_{0};
+  std::unique_ptr<util::ringbuffer::RingBufferHeader> channelInboxHeader_;
+  std::unique_ptr<uint8_t[]> channelInboxData_;
+  std::unique_ptr<util::ringbuffer::RingBufferHeader> channelOutboxHeader_;
+  std::unique_ptr<uint8_t[]> channelOutboxData_;
+  MemoryCharge channelBuffersMemoryCharge_;
+
+  // Recycles the buffers of the reads that weren't given a destination. It must
+  // outlive the read operations, hence it's declared before them.
+  ReadBufferPool readBufferPool_;
 
   // Pending read operations.
   std::deque<RingbufferReadOperation> readOperations_;
@@ -8,6 +8,7 @@
 
 #include <tensorpipe/transport/shm/context.h>
 
+#include <map>
 #include <memory>
 #include <string>
 #include <utility>
@@ -20,7 +21,13 @@ namespace tensorpipe {
 namespace transport {
 namespace shm {
 
-Context::Context() : impl_(ContextImpl::create()) {}
+Context::Context(ShmOptions shmOptions, ThreadOptions threadOptions)
+    : impl_(ContextImpl::create(
+          shmOptions.getSpinDuration(),
+          shmOptions.getBufferSize(),
+          shmOptions.getShareInboxes(),
+          std::move(threadOptions),
+          shmOptions.getIdleTimeout())) {}
 
 // Explicitly define all methods of the context, which just forward to the impl.
 // We cannot use an intermediate ContextBoilerplate class without forcing a
@@ -46,6 +53,26 @@ void Context::setId(std::string id) {
   impl_->setId(std::move(id));
 }
 
+void Context::enableLoopStats() {
+  impl_->enableLoopStats();
+}
+
+std::map<std::string, LoopStats> Context::getLoopStats() {
+  return impl_->getLoopStats();
+}
+
+TransportStats Context::getTransportStats() {
+  return impl_->getTransportStats();
+}
+
+MemoryFootprint Context::getMemoryFootprint() {
+  return impl_->getMemoryFootprint();
+}
+
+void Context::reclaimMemory() {
+  impl_->reclaimMemory();
+}
+
 void Context::close() {
   impl_->close();
 }
@@ -8,9 +8,13 @@
 
 #pragma once
 
+#include <chrono>
+#include <map>
 #include <memory>
 #include <string>
+#include <utility>
 
+#include <tensorpipe/common/thread_options.h>
 #include <tensorpipe/transport/context.h>
 
 namespace tensorpipe {
@@ -19,9 +23,102 @@ namespace shm {
 
 class ContextImpl;
 
+// The default time for which the reactor keeps polling after its last event.
+constexpr std::chrono::microseconds kDefaultSpinDuration{100};
+
+// The default size of the connections' inboxes, see below.
+constexpr size_t kDefaultBufferSize = 2 * 1024 * 1024;
+
+// The size of the private buffers of the connections whose inboxes are shared
+// (unless the shared inbox is smaller). It caps how much data can be in flight
+// on each connection, independently of the size of the shared inbox.
+constexpr size_t kSharedInboxChannelBufferSize = 256 * 1024;
+
+// How the context sets up its reactor and the connections it handles. By
+// default each connection has its own inbox of kDefaultBufferSize bytes.
+class ShmOptions {
+ public:
+  // The reactor busy-polls for new events, which gives the lowest latency but
+  // costs a full core. Once it hasn't seen any event for this long it goes to
+  // sleep until it is woken up by the next event. Pass the maximum duration to
+  // have it never sleep.
+  ShmOptions&& spinDuration(std::chrono::microseconds duration) && {
+    spinDuration_ = duration;
+    return std::move(*this);
+  }
+
+  // Each connection receives data through an inbox ringbuffer of this many
+  // bytes (a power of two, of at least a page), which the peer writes into.
+  // Larger ones need fewer round trips to transfer large messages, smaller ones
+  // save memory when there are many connections. The two ends of a connection
+  // may use different sizes, as each of them only allocates its own inbox.
+  // Large payloads skip the inbox altogether, and are copied once, straight
+  // from the writer's memory into the reader's (with process_vm_readv), when
+  // the reader has the ptrace permissions that this requires on the writer;
+  // each end of a connection checks when it's established, and otherwise falls
+  // back to the inbox.
+  ShmOptions&& bufferSize(size_t size) && {
+    bufferSize_ = size;
+    return std::move(*this);
+  }
+
+  // Have all the connections with the same peer context share a single inbox,
+  // of bufferSize bytes, with each of them only keeping a small private buffer
+  // on the heap in each direction. This saves shared memory and file
+  // descriptors when there are many connections, at the cost of an extra copy
+  // on each side. Both ends must enable it, and the domain descriptor reflects
+  // it so that pipes only pick compatible contexts.
+  ShmOptions&& shareInboxes(bool shareInboxes) && {
+    shareInboxes_ = shareInboxes;
+    return std::move(*this);
+  }
+
+  // If this isn't zero, a connection (with its own inbox) whose inbox has
+  // stayed empty for that long, and up to twice as long, has the peer hold back
+  // its writes and gives the memory of the inbox back to the system. It
+  // allocates it again, and lets the peer resume, as soon as the peer has
+  // something to write. This is for processes that keep many mostly idle
+  // connections, where the inboxes would otherwise pin a lot of memory, at the
+  // cost of a round trip on the first write after a quiet period. The empty
+  // inboxes are reclaimed in the same way, whatever the timeout, when the
+  // context is asked to (see transport::Context::reclaimMemory).
+  ShmOptions&& idleTimeout(std::chrono::milliseconds timeout) && {
+    idleTimeout_ = timeout;
+    return std::move(*this);
+  }
+
+  std::chrono::microseconds getSpinDuration() const {
+    return spinDuration_;
+  }
+
+  size_t getBufferSize() const {
+    return bufferSize_;
+  }
+
+  bool getShareInboxes() const {
+    return shareInboxes_;
+  }
+
+  // Zero means disabled.
+  std::chrono::milliseconds getIdleTimeout() const {
+    return idleTimeout_;
+  }
+
+ private:
+  std::chrono::microseconds spinDuration_{kDefaultSpinDuration};
+  size_t bufferSize_{kDefaultBufferSize};
+  bool shareInboxes_{false};
+  std::chrono::milliseconds idleTimeout_{0};
+};
+
 class Context : public transport::Context {
  public:
-  Context();
+  // The reactor and the connections are set up according to shmOptions, and
+  // the threads of the reactor and of the epoll loop according to
+  // threadOptions.
+  explicit Context(
+      ShmOptions shmOptions = ShmOptions(),
+      ThreadOptions threadOptions = ThreadOptions());
 
   Context(const Context&) = delete;
   Context(Context&&) = delete;
@@ -38,6 +135,16 @@ class Context : public transport::Context {
 
   void setId(std::string id) override;
 
+  void enableLoopStats() override;
+
+  std::map<std::string, LoopStats> getLoopStats() override;
+
+  TransportStats getTransportStats() override;
+
+  MemoryFootprint getMemoryFootprint() override;
+
+  void reclaimMemory() override;
+
   void close() override;
 
   void join() override;
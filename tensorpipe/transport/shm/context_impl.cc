@@ -8,10 +8,13 @@
 
 #include <tensorpipe/transport/shm/context_impl.h>
 
+#include <random>
+
 #include <tensorpipe/common/epoll_loop.h>
 #include <tensorpipe/common/system.h>
 #include <tensorpipe/transport/shm/connection_impl.h>
 #include <tensorpipe/transport/shm/listener_impl.h>
+#include <tensorpipe/transport/shm/multiplexer.h>
 #include <tensorpipe/transport/shm/reactor.h>
 
 namespace tensorpipe {
@@ -20,11 +23,15 @@ namespace shm {
 
 namespace {
 
+// Smaller inboxes would mostly cost more notifications than they save memory.
+constexpr size_t kMinBufferSize = 4096;
+
 // Prepend descriptor with transport name so it's easy to
 // disambiguate descriptors when debugging.
 const std::string kDomainDescriptorPrefix{"shm:"};
 
-std::tuple<bool, std::string> determineViabilityAndGenerateDomainDescriptor() {
+std::tuple<bool, std::string> determineViabilityAndGenerateDomainDescriptor(
+    bool shareInboxes) {
   std::ostringstream oss;
   oss << kDomainDescriptorPrefix;
 
@@ -43,6 +50,12 @@ std::tuple<bool, std::string> determineViabilityAndGenerateDomainDescriptor() {
   TP_THROW_ASSERT_IF(!nsID.has_value()) << "Unable to read net namespace ID";
   oss << '_' << nsID.value();
 
+  // Connections with shared inboxes use a different protocol, hence they can't
+  // talk to regular ones.
+  if (shareInboxes) {
+    oss << "_shared";
+  }
+
   // Over that UNIX domain socket, the two endpoints exchange file descriptors
   // to regions of shared memory. Some restrictions may be in place that prevent
   // allocating such regions, hence let's allocate one here to see if it works.
@@ -64,31 +77,120 @@ std::tuple<bool, std::string> determineViabilityAndGenerateDomainDescriptor() {
   return std::make_tuple(true, std::move(domainDescriptor));
 }
 
+uint64_t generateUniqueId() {
+  std::random_device rd;
+  return (static_cast<uint64_t>(rd()) << 32) | rd();
+}
+
 } // namespace
 
-std::shared_ptr<ContextImpl> ContextImpl::create() {
+std::shared_ptr<ContextImpl> ContextImpl::create(
+    std::chrono::microseconds spinDuration,
+    size_t bufferSize,
+    bool shareInboxes,
+    ThreadOptions threadOptions,
+    std::chrono::milliseconds idleTimeout) {
   bool isViable;
   std::string domainDescriptor;
   std::tie(isViable, domainDescriptor) =
-      determineViabilityAndGenerateDomainDescriptor();
-  return std::make_shared<ContextImpl>(isViable, std::move(domainDescriptor));
+      determineViabilityAndGenerateDomainDescriptor(shareInboxes);
+  return std::make_shared<ContextImpl>(
+      isViable,
+      std::move(domainDescriptor),
+      spinDuration,
+      bufferSize,
+      shareInboxes,
+      std::move(threadOptions),
+      idleTimeout);
 }
 
-ContextImpl::ContextImpl(bool isViable, std::string domainDescriptor)
+ContextImpl::ContextImpl(
+    bool isViable,
+    std::string domainDescriptor,
+    std::chrono::microseconds spinDuration,
+    size_t bufferSize,
+    bool shareInboxes,
+    ThreadOptions threadOptions,
+    std::chrono::milliseconds idleTimeout)
     : ContextImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
           std::move(domainDescriptor)),
-      isViable_(isViable) {}
+      isViable_(isViable),
+      bufferSize_(bufferSize),
+      shareInboxes_(shareInboxes),
+      numaNode_(threadOptions.getNumaNode()),
+      uniqueId_(generateUniqueId()),
+      idleTimeout_(idleTimeout),
+      reactor_(spinDuration, threadOptions),
+      loop_(reactor_, threadOptions),
+      reactorMemoryCharge_(
+          getMemoryFootprintCounters(),
+          MemoryKind::kShared,
+          reactor_.getRingBufferSize()) {
+  TP_THROW_ASSERT_IF(!isPow2(bufferSize_) || bufferSize_ < kMinBufferSize)
+      << "The buffer size must be a power of two of at least "
+      << kMinBufferSize << " bytes, got " << bufferSize_;
+}
 
 bool ContextImpl::isViable() const {
   return isViable_;
 }
 
+size_t ContextImpl::getBufferSize() const {
+  return bufferSize_;
+}
+
+int ContextImpl::getNumaNode() const {
+  return numaNode_;
+}
+
+uint64_t ContextImpl::getUniqueId() const {
+  return uniqueId_;
+}
+
+bool ContextImpl::sharesInboxes() const {
+  return shareInboxes_;
+}
+
+std::chrono::milliseconds ContextImpl::getIdleTimeout() const {
+  return idleTimeout_;
+}
+
+TimerWheel& ContextImpl::getTimerWheel() {
+  return timerWheel_;
+}
+
+uint64_t ContextImpl::allocateChannelId() {
+  TP_DCHECK(inLoop());
+  // Never reuse the ids, as the peer could still send frames for closed ones.
+  return nextChannelId_++;
+}
+
+std::shared_ptr<Multiplexer> ContextImpl::getMultiplexer(
+    uint64_t peerContextId) {
+  TP_DCHECK(inLoop());
+  std::weak_ptr<Multiplexer>& weakMultiplexer = multiplexers_[peerContextId];
+  std::shared_ptr<Multiplexer> multiplexer = weakMultiplexer.lock();
+  if (multiplexer == nullptr) {
+    multiplexer =
+        std::make_shared<Multiplexer>(shared_from_this(), peerContextId);
+    multiplexer->initFromLoop();
+    weakMultiplexer = multiplexer;
+  }
+  return multiplexer;
+}
+
+void ContextImpl::forgetMultiplexer(uint64_t peerContextId) {
+  TP_DCHECK(inLoop());
+  multiplexers_.erase(peerContextId);
+}
+
 void ContextImpl::closeImpl() {
   loop_.close();
   reactor_.close();
 }
 
 void ContextImpl::joinImpl() {
+  timerWheel_.join();
   loop_.join();
   reactor_.join();
 }
@@ -97,10 +199,19 @@ bool ContextImpl::inLoop() {
   return reactor_.inLoop();
 };
 
-void ContextImpl::deferToLoop(std::function<void()> fn) {
+void ContextImpl::deferToLoop(TTask fn) {
   reactor_.deferToLoop(std::move(fn));
 };
 
+void ContextImpl::enableLoopStats() {
+  reactor_.enableStats();
+  loop_.enableStats();
+}
+
+std::map<std::string, LoopStats> ContextImpl::getLoopStats() {
+  return {{"reactor", reactor_.getStats()}, {"epoll", loop_.getStats()}};
+}
+
 void ContextImpl::registerDescriptor(
     int fd,
     int events,
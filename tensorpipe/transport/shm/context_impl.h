@@ -8,11 +8,18 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <map>
 #include <memory>
+#include <string>
 #include <tuple>
+#include <unordered_map>
 
 #include <tensorpipe/common/epoll_loop.h>
+#include <tensorpipe/common/memory_footprint.h>
+#include <tensorpipe/common/timer_wheel.h>
 #include <tensorpipe/transport/context_impl_boilerplate.h>
 #include <tensorpipe/transport/shm/reactor.h>
 
@@ -22,19 +29,36 @@ namespace shm {
 
 class ConnectionImpl;
 class ListenerImpl;
+class Multiplexer;
 
 class ContextImpl final
     : public ContextImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl> {
  public:
-  static std::shared_ptr<ContextImpl> create();
-
-  ContextImpl(bool isViable, std::string domainDescriptor);
+  static std::shared_ptr<ContextImpl> create(
+      std::chrono::microseconds spinDuration,
+      size_t bufferSize,
+      bool shareInboxes,
+      ThreadOptions threadOptions,
+      std::chrono::milliseconds idleTimeout);
+
+  ContextImpl(
+      bool isViable,
+      std::string domainDescriptor,
+      std::chrono::microseconds spinDuration,
+      size_t bufferSize,
+      bool shareInboxes,
+      ThreadOptions threadOptions,
+      std::chrono::milliseconds idleTimeout);
 
   bool isViable() const;
 
   // Implement the DeferredExecutor interface.
   bool inLoop() override;
-  void deferToLoop(std::function<void()> fn) override;
+  void deferToLoop(TTask fn) override;
+
+  void enableLoopStats();
+
+  std::map<std::string, LoopStats> getLoopStats();
 
   void registerDescriptor(
       int fd,
@@ -52,6 +76,33 @@ class ContextImpl final
 
   std::tuple<int, int> reactorFds();
 
+  size_t getBufferSize() const;
+
+  // The NUMA node on which to place the connections' buffers, or -1 if none.
+  int getNumaNode() const;
+
+  // Identifies this context to the peers, so they can tell which of their
+  // connections lead to the same context.
+  uint64_t getUniqueId() const;
+
+  bool sharesInboxes() const;
+
+  // How long an inbox must stay empty before its memory is reclaimed, or zero
+  // if it never is.
+  std::chrono::milliseconds getIdleTimeout() const;
+
+  // For the connections to check whether they're idle, once in a while.
+  TimerWheel& getTimerWheel();
+
+  uint64_t allocateChannelId();
+
+  // Return the multiplexer for the connections with the given peer context,
+  // creating it if there isn't one yet.
+  std::shared_ptr<Multiplexer> getMultiplexer(uint64_t peerContextId);
+
+  // Called by a multiplexer when its last connection has gone away.
+  void forgetMultiplexer(uint64_t peerContextId);
+
  protected:
   // Implement the entry points called by ContextImplBoilerplate.
   void closeImpl() override;
@@ -59,9 +110,24 @@ class ContextImpl final
 
  private:
   const bool isViable_;
+  const size_t bufferSize_;
+  const bool shareInboxes_;
+  const int numaNode_;
+  const uint64_t uniqueId_;
+  const std::chrono::milliseconds idleTimeout_;
+
+  // Its thread is only started by the first timer, hence it costs nothing if
+  // idle connections aren't reclaimed.
+  TimerWheel timerWheel_{std::chrono::milliseconds(10), 512, "TP_SHM_timer"};
 
   Reactor reactor_;
-  EpollLoop loop_{this->reactor_};
+  // Integrated with the reactor, which polls epoll and runs the handlers.
+  EpollLoop loop_;
+  // Accounts for the ringbuffer of the reactor, which the peers write into.
+  MemoryCharge reactorMemoryCharge_;
+
+  uint64_t nextChannelId_{0};
+  std::unordered_map<uint64_t, std::weak_ptr<Multiplexer>> multiplexers_;
 };
 
 } // namespace shm
@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/shm/multiplexer.h>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <array>
+#include <tuple>
+
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/system.h>
+#include <tensorpipe/transport/shm/context_impl.h>
+#include <tensorpipe/util/ringbuffer/consumer.h>
+#include <tensorpipe/util/ringbuffer/producer.h>
+#include <tensorpipe/util/ringbuffer/shm.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace shm {
+
+namespace {
+
+// Precedes the data of a channel in the shared ringbuffers. The frame is
+// addressed to the receiver's channel, and also returns the credits for the
+// data that the sender's end of that channel consumed. The header and the data
+// are committed together, hence a consumer never sees a partial frame.
+struct FrameHeader {
+  uint64_t channelId;
+  uint32_t length;
+  uint32_t credits;
+};
+
+bool isSameFile(int fd1, int fd2) {
+  struct stat stat1;
+  struct stat stat2;
+  if (::fstat(fd1, &stat1) != 0 || ::fstat(fd2, &stat2) != 0) {
+    return false;
+  }
+  return stat1.st_dev == stat2.st_dev && stat1.st_ino == stat2.st_ino;
+}
+
+} // namespace
+
+Multiplexer::Multiplexer(
+    std::shared_ptr<ContextImpl> context,
+    uint64_t peerContextId)
+    : context_(std::move(context)), peerContextId_(peerContextId) {}
+
+void Multiplexer::initFromLoop() {
+  TP_DCHECK(context_->inLoop());
+
+  Error error;
+  std::tie(error, inboxHeaderSegment_, inboxDataSegment_, inboxRb_) =
+      util::ringbuffer::shm::create(
+          context_->getBufferSize(), util::shm::PageType::HugeTLB_2MB);
+  TP_THROW_ASSERT_IF(error)
+      << "Couldn't allocate ringbuffer for shared inbox: " << error.what();
+  inboxMemoryCharge_ = MemoryCharge(
+      context_->getMemoryFootprintCounters(),
+      MemoryKind::kShared,
+      context_->getBufferSize());
+  if (context_->getNumaNode() >= 0) {
+    error = bindMemoryToNumaNode(
+        inboxDataSegment_.getPtr(),
+        inboxDataSegment_.getSize(),
+        context_->getNumaNode());
+    TP_LOG_WARNING_IF(error)
+        << "Couldn't place the shared inbox on NUMA node "
+        << context_->getNumaNode() << ": " << error.what();
+  }
+
+  inboxReactorToken_ =
+      context_->addReaction(runIfAlive(*this, [](Multiplexer& mux) {
+        TP_VLOG(9) << "Multiplexer for peer context " << mux.peerContextId_
+                   << " is reacting to the peer writing to the inbox";
+        mux.processInboxFromLoop();
+      }));
+
+  outboxReactorToken_ =
+      context_->addReaction(runIfAlive(*this, [](Multiplexer& mux) {
+        TP_VLOG(9) << "Multiplexer for peer context " << mux.peerContextId_
+                   << " is reacting to the peer reading from the outbox";
+        mux.processOutboxFromLoop();
+      }));
+}
+
+int Multiplexer::inboxHeaderFd() const {
+  return inboxHeaderSegment_.getFd();
+}
+
+int Multiplexer::inboxDataFd() const {
+  return inboxDataSegment_.getFd();
+}
+
+Multiplexer::TToken Multiplexer::inboxReactorToken() const {
+  return inboxReactorToken_.value();
+}
+
+Multiplexer::TToken Multiplexer::outboxReactorToken() const {
+  return outboxReactorToken_.value();
+}
+
+Error Multiplexer::setPeerInboxFromLoop(
+    TToken peerInboxReactorToken,
+    TToken peerOutboxReactorToken,
+    Fd reactorHeaderFd,
+    Fd reactorDataFd,
+    Fd outboxHeaderFd,
+    Fd outboxDataFd) {
+  TP_DCHECK(context_->inLoop());
+
+  if (peerReactorTrigger_.has_value() &&
+      isSameFile(outboxHeaderFd.fd(), outboxHeaderSegment_.getFd())) {
+    return Error::kSuccess;
+  }
+
+  Error error;
+  std::tie(error, outboxHeaderSegment_, outboxDataSegment_, outboxRb_) =
+      util::ringbuffer::shm::load(
+          std::move(outboxHeaderFd), std::move(outboxDataFd));
+  if (error) {
+    return error;
+  }
+
+  peerReactorTrigger_.emplace(
+      std::move(reactorHeaderFd), std::move(reactorDataFd));
+  peerInboxReactorToken_ = peerInboxReactorToken;
+  peerOutboxReactorToken_ = peerOutboxReactorToken;
+
+  // The peer may have filled our inbox before we could tell it that we read
+  // from it, and the channels may have data waiting to be sent.
+  peerReactorTrigger_->run(peerOutboxReactorToken_);
+  std::vector<uint64_t> drainedChannels;
+  writeFramesFromLoop(drainedChannels);
+  for (uint64_t channelId : drainedChannels) {
+    context_->deferToLoop(runIfAlive(*this, [channelId](Multiplexer& mux) {
+      mux.callOnWritableFromLoop(channelId);
+    }));
+  }
+
+  return Error::kSuccess;
+}
+
+void Multiplexer::addChannelFromLoop(
+    uint64_t channelId,
+    uint64_t peerChannelId,
+    size_t peerInboxSize,
+    util::ringbuffer::RingBuffer& inbox,
+    util::ringbuffer::RingBuffer& outbox,
+    TFunction onReadable,
+    TFunction onWritable) {
+  TP_DCHECK(context_->inLoop());
+  Channel channel;
+  channel.peerChannelId = peerChannelId;
+  channel.inbox = &inbox;
+  channel.outbox = &outbox;
+  channel.credits = peerInboxSize;
+  channel.onReadable = std::move(onReadable);
+  channel.onWritable = std::move(onWritable);
+  bool inserted;
+  std::tie(std::ignore, inserted) =
+      channels_.emplace(channelId, std::move(channel));
+  TP_DCHECK(inserted);
+}
+
+void Multiplexer::removeChannelFromLoop(uint64_t channelId) {
+  TP_DCHECK(context_->inLoop());
+  channels_.erase(channelId);
+}
+
+bool Multiplexer::sendFromChannelFromLoop(uint64_t channelId) {
+  TP_DCHECK(context_->inLoop());
+
+  std::vector<uint64_t> drainedChannels;
+  writeFramesFromLoop(drainedChannels);
+
+  // Don't call into the other channels inline, as they could in turn end up
+  // calling into the one that called us.
+  bool drained = false;
+  for (uint64_t otherChannelId : drainedChannels) {
+    if (otherChannelId == channelId) {
+      drained = true;
+      continue;
+    }
+    context_->deferToLoop(
+        runIfAlive(*this, [otherChannelId](Multiplexer& mux) {
+          mux.callOnWritableFromLoop(otherChannelId);
+        }));
+  }
+  return drained;
+}
+
+void Multiplexer::releaseCreditsFromLoop(uint64_t channelId, size_t length) {
+  TP_DCHECK(context_->inLoop());
+
+  auto iter = channels_.find(channelId);
+  TP_DCHECK(iter != channels_.end());
+  iter->second.creditsToRelease += length;
+
+  std::vector<uint64_t> drainedChannels;
+  writeFramesFromLoop(drainedChannels);
+  for (uint64_t otherChannelId : drainedChannels) {
+    context_->deferToLoop(
+        runIfAlive(*this, [otherChannelId](Multiplexer& mux) {
+          mux.callOnWritableFromLoop(otherChannelId);
+        }));
+  }
+}
+
+void Multiplexer::processInboxFromLoop() {
+  TP_DCHECK(context_->inLoop());
+
+  std::vector<uint64_t> readableChannels;
+  bool gotCredits = false;
+  size_t bytesConsumed = 0;
+
+  {
+    util::ringbuffer::Consumer inbox(inboxRb_);
+    ssize_t ret = inbox.startTx();
+    TP_THROW_SYSTEM_IF(ret < 0, -ret);
+    while (true) {
+      FrameHeader frame;
+      ret = inbox.readInTx</*AllowPartial=*/false>(&frame, sizeof(frame));
+      if (ret == -ENODATA) {
+        break;
+      }
+      TP_THROW_SYSTEM_IF(ret < 0, -ret);
+
+      ssize_t numBuffers;
+      std::array<util::ringbuffer::Consumer::Buffer, 2> buffers;
+      std::tie(numBuffers, buffers) =
+          inbox.accessContiguousInTx</*AllowPartial=*/false>(frame.length);
+      TP_THROW_SYSTEM_IF(numBuffers < 0, -numBuffers);
+      bytesConsumed += sizeof(frame) + frame.length;
+
+      auto iter = channels_.find(frame.channelId);
+      if (iter == channels_.end()) {
+        // The channel has been closed in the meantime: drop its data.
+        continue;
+      }
+      Channel& channel = iter->second;
+
+      if (frame.length > 0) {
+        util::ringbuffer::Producer channelInbox(*channel.inbox);
+        ret = channelInbox.startTx();
+        TP_THROW_SYSTEM_IF(ret < 0, -ret);
+        for (ssize_t bufferIdx = 0; bufferIdx < numBuffers; ++bufferIdx) {
+          // The credits guarantee that the channel's inbox has room for it.
+          ret = channelInbox.writeInTx</*AllowPartial=*/false>(
+              buffers[bufferIdx].ptr, buffers[bufferIdx].len);
+          TP_THROW_SYSTEM_IF(ret < 0, -ret);
+        }
+        ret = channelInbox.commitTx();
+        TP_THROW_SYSTEM_IF(ret < 0, -ret);
+        if (std::find(
+                readableChannels.begin(),
+                readableChannels.end(),
+                frame.channelId) == readableChannels.end()) {
+          readableChannels.push_back(frame.channelId);
+        }
+      }
+
+      if (frame.credits > 0) {
+        channel.credits += frame.credits;
+        gotCredits = true;
+      }
+    }
+    ret = inbox.commitTx();
+    TP_THROW_SYSTEM_IF(ret < 0, -ret);
+  }
+
+  // If we haven't learned how to reach the peer yet, we'll notify it once we
+  // do.
+  if (bytesConsumed > 0 && peerReactorTrigger_.has_value()) {
+    peerReactorTrigger_->run(peerOutboxReactorToken_);
+  }
+
+  std::vector<uint64_t> drainedChannels;
+  if (gotCredits) {
+    writeFramesFromLoop(drainedChannels);
+  }
+
+  for (uint64_t channelId : readableChannels) {
+    callOnReadableFromLoop(channelId);
+  }
+  for (uint64_t channelId : drainedChannels) {
+    callOnWritableFromLoop(channelId);
+  }
+}
+
+void Multiplexer::processOutboxFromLoop() {
+  TP_DCHECK(context_->inLoop());
+
+  std::vector<uint64_t> drainedChannels;
+  writeFramesFromLoop(drainedChannels);
+  for (uint64_t channelId : drainedChannels) {
+    callOnWritableFromLoop(channelId);
+  }
+}
+
+void Multiplexer::writeFramesFromLoop(std::vector<uint64_t>& drainedChannels) {
+  TP_DCHECK(context_->inLoop());
+
+  if (!peerReactorTrigger_.has_value() || channels_.empty()) {
+    return;
+  }
+
+  bool wroteFrames = false;
+  {
+    util::ringbuffer::Producer outbox(outboxRb_);
+    ssize_t ret = outbox.startTx();
+    TP_THROW_SYSTEM_IF(ret < 0, -ret);
+
+    const util::ringbuffer::RingBufferHeader& outboxHeader =
+        outboxRb_.getHeader();
+    size_t space = outboxHeader.kDataPoolByteSize -
+        (outboxHeader.readHead() - outboxHeader.readTail());
+
+    auto iter = channels_.upper_bound(lastSendingChannelId_);
+    for (size_t numVisited = 0; numVisited < channels_.size(); ++numVisited) {
+      if (iter == channels_.end()) {
+        iter = channels_.begin();
+      }
+      const uint64_t channelId = iter->first;
+      Channel& channel = iter->second;
+      ++iter;
+
+      if (space < sizeof(FrameHeader)) {
+        break;
+      }
+
+      util::ringbuffer::Consumer channelOutbox(*channel.outbox);
+      ret = channelOutbox.startTx();
+      TP_THROW_SYSTEM_IF(ret < 0, -ret);
+      const util::ringbuffer::RingBufferHeader& channelOutboxHeader =
+          channel.outbox->getHeader();
+      const size_t length = std::min(
+          {static_cast<size_t>(
+               channelOutboxHeader.readHead() - channelOutboxHeader.readTail()),
+           channel.credits,
+           space - sizeof(FrameHeader)});
+      if (length == 0 && channel.creditsToRelease == 0) {
+        ret = channelOutbox.cancelTx();
+        TP_THROW_SYSTEM_IF(ret < 0, -ret);
+        continue;
+      }
+
+      FrameHeader frame;
+      frame.channelId = channel.peerChannelId;
+      frame.length = length;
+      frame.credits = channel.creditsToRelease;
+      ret = outbox.writeInTx</*AllowPartial=*/false>(&frame, sizeof(frame));
+      TP_THROW_SYSTEM_IF(ret < 0, -ret);
+
+      ssize_t numBuffers;
+      std::array<util::ringbuffer::Consumer::Buffer, 2> buffers;
+      std::tie(numBuffers, buffers) =
+          channelOutbox.accessContiguousInTx</*AllowPartial=*/false>(length);
+      TP_THROW_SYSTEM_IF(numBuffers < 0, -numBuffers);
+      for (ssize_t bufferIdx = 0; bufferIdx < numBuffers; ++bufferIdx) {
+        ret = outbox.writeInTx</*AllowPartial=*/false>(
+            buffers[bufferIdx].ptr, buffers[bufferIdx].len);
+        TP_THROW_SYSTEM_IF(ret < 0, -ret);
+      }
+      ret = channelOutbox.commitTx();
+      TP_THROW_SYSTEM_IF(ret < 0, -ret);
+
+      space -= sizeof(frame) + length;
+      channel.credits -= length;
+      channel.creditsToRelease = 0;
+      wroteFrames = true;
+      if (length > 0) {
+        lastSendingChannelId_ = channelId;
+        drainedChannels.push_back(channelId);
+      }
+    }
+
+    ret = outbox.commitTx();
+    TP_THROW_SYSTEM_IF(ret < 0, -ret);
+  }
+
+  if (wroteFrames) {
+    peerReactorTrigger_->run(peerInboxReactorToken_);
+  }
+}
+
+void Multiplexer::callOnReadableFromLoop(uint64_t channelId) {
+  auto iter = channels_.find(channelId);
+  if (iter != channels_.end()) {
+    // The callback could remove the channel, and thus destroy itself.
+    TFunction fn = iter->second.onReadable;
+    fn();
+  }
+}
+
+void Multiplexer::callOnWritableFromLoop(uint64_t channelId) {
+  auto iter = channels_.find(channelId);
+  if (iter != channels_.end()) {
+    TFunction fn = iter->second.onWritable;
+    fn();
+  }
+}
+
+Multiplexer::~Multiplexer() {
+  if (inboxReactorToken_.has_value()) {
+    context_->removeReaction(inboxReactorToken_.value());
+  }
+  if (outboxReactorToken_.has_value()) {
+    context_->removeReaction(outboxReactorToken_.value());
+  }
+  context_->forgetMultiplexer(peerContextId_);
+}
+
+} // namespace shm
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/fd.h>
+#include <tensorpipe/common/memory_footprint.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/transport/shm/reactor.h>
+#include <tensorpipe/util/ringbuffer/ringbuffer.h>
+#include <tensorpipe/util/shm/segment.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace shm {
+
+class ContextImpl;
+
+// Carries all the connections between this context and one peer context over
+// a single pair of shared memory ringbuffers: an inbox, which the peer writes
+// into, and an outbox, which is the peer's inbox. This way the footprint and
+// the file descriptors of the shared memory don't grow with the number of
+// connections, and the reactor drains the data of all these connections in a
+// single pass.
+//
+// Each connection (a "channel") keeps a small private inbox and outbox, which
+// it reads from and writes into as usual. The multiplexer moves the data from
+// the channels' outboxes to the shared outbox in frames, prefixed by the id of
+// the destination channel, and from the shared inbox to the channels' inboxes.
+// A channel never sends more than what the peer channel's inbox can hold, and
+// the peer returns these credits as it consumes the data. Hence the frames in
+// the shared inbox can always be delivered, and a connection whose user isn't
+// reading doesn't block the other ones.
+//
+// This class isn't thread-safe: it's meant to be used from the reactor thread.
+class Multiplexer final : public std::enable_shared_from_this<Multiplexer> {
+ public:
+  using TToken = Reactor::TToken;
+  using TFunction = std::function<void()>;
+
+  Multiplexer(std::shared_ptr<ContextImpl> context, uint64_t peerContextId);
+
+  Multiplexer(const Multiplexer&) = delete;
+  Multiplexer(Multiplexer&&) = delete;
+  Multiplexer& operator=(const Multiplexer&) = delete;
+  Multiplexer& operator=(Multiplexer&&) = delete;
+
+  // Allocate the shared inbox and register the reactions to the peer writing to
+  // it and reading from the outbox. Must be called once, before anything else.
+  void initFromLoop();
+
+  // What the peer needs in order to write into the shared inbox.
+  int inboxHeaderFd() const;
+  int inboxDataFd() const;
+  TToken inboxReactorToken() const;
+  TToken outboxReactorToken() const;
+
+  // Map the peer's shared inbox as the outbox, and set up the triggers of the
+  // peer's reactions. All the connections with a peer send the same ones, hence
+  // this only does something the first time, or if the peer has replaced its
+  // shared inbox in the meantime (because all the connections had gone away).
+  Error setPeerInboxFromLoop(
+      TToken peerInboxReactorToken,
+      TToken peerOutboxReactorToken,
+      Fd reactorHeaderFd,
+      Fd reactorDataFd,
+      Fd outboxHeaderFd,
+      Fd outboxDataFd);
+
+  // Start routing the frames for the given channel to its inbox. The peer
+  // channel's inbox is peerInboxSize bytes large. The callbacks are called when
+  // some data was delivered to the inbox or drained from the outbox.
+  void addChannelFromLoop(
+      uint64_t channelId,
+      uint64_t peerChannelId,
+      size_t peerInboxSize,
+      util::ringbuffer::RingBuffer& inbox,
+      util::ringbuffer::RingBuffer& outbox,
+      TFunction onReadable,
+      TFunction onWritable);
+
+  void removeChannelFromLoop(uint64_t channelId);
+
+  // Send the data that the channel wrote into its outbox, as far as the credits
+  // and the space in the shared outbox allow. Return whether any of its data
+  // was sent, which means its outbox has room again. The other channels that
+  // get to send some data in the process are notified asynchronously.
+  bool sendFromChannelFromLoop(uint64_t channelId);
+
+  // Give back to the peer the credits for the data that a channel consumed
+  // from its inbox.
+  void releaseCreditsFromLoop(uint64_t channelId, size_t length);
+
+  ~Multiplexer();
+
+ private:
+  struct Channel {
+    uint64_t peerChannelId;
+    util::ringbuffer::RingBuffer* inbox;
+    util::ringbuffer::RingBuffer* outbox;
+    // How many more bytes the peer channel's inbox can accept.
+    size_t credits;
+    // How many bytes were consumed from the inbox but not yet reported.
+    size_t creditsToRelease{0};
+    TFunction onReadable;
+    TFunction onWritable;
+  };
+
+  const std::shared_ptr<ContextImpl> context_;
+  const uint64_t peerContextId_;
+
+  // Inbox.
+  util::shm::Segment inboxHeaderSegment_;
+  util::shm::Segment inboxDataSegment_;
+  util::ringbuffer::RingBuffer inboxRb_;
+  optional<TToken> inboxReactorToken_;
+  MemoryCharge inboxMemoryCharge_;
+
+  // Outbox.
+  util::shm::Segment outboxHeaderSegment_;
+  util::shm::Segment outboxDataSegment_;
+  util::ringbuffer::RingBuffer outboxRb_;
+  optional<TToken> outboxReactorToken_;
+
+  // Peer trigger/tokens.
+  optional<Reactor::Trigger> peerReactorTrigger_;
+  TToken peerInboxReactorToken_{0};
+  TToken peerOutboxReactorToken_{0};
+
+  std::map<uint64_t, Channel> channels_;
+  // The channels take turns to send, starting after the last one that did.
+  uint64_t lastSendingChannelId_{0};
+
+  // Deliver the frames found in the shared inbox to the channels' inboxes.
+  void processInboxFromLoop();
+
+  // Send the pending data and credits of all the channels.
+  void processOutboxFromLoop();
+
+  // Write as many frames as possible to the shared outbox, and append the ids
+  // of the channels whose data was (at least partly) sent to drainedChannels.
+  void writeFramesFromLoop(std::vector<uint64_t>& drainedChannels);
+
+  void callOnReadableFromLoop(uint64_t channelId);
+  void callOnWritableFromLoop(uint64_t channelId);
+};
+
+} // namespace shm
+} // namespace transport
+} // namespace tensorpipe
@@ -8,6 +8,9 @@
 
 #include <tensorpipe/transport/shm/reactor.h>
 
+#include <algorithm>
+#include <array>
+
 #include <tensorpipe/common/system.h>
 #include <tensorpipe/util/ringbuffer/shm.h>
 
@@ -17,9 +20,20 @@ namespace shm {
 
 namespace {
 
-void writeToken(util::ringbuffer::Producer& producer, Reactor::TToken token) {
+// The maximum number of tokens that are consumed at once from the ringbuffer.
+constexpr size_t kMaxTokensPerPoll = 256;
+
+// All events are notified (both triggers and deferred functions), hence the
+// reactor could sleep indefinitely. This is merely a safety net.
+constexpr std::chrono::microseconds kSleepDuration = std::chrono::seconds(1);
+
+void writeTokens(
+    util::ringbuffer::Producer& producer,
+    const Reactor::TToken* tokens,
+    size_t numTokens) {
+  const size_t numBytes = numTokens * sizeof(Reactor::TToken);
   for (;;) {
-    auto rv = producer.write(&token, sizeof(token));
+    auto rv = producer.write(tokens, numBytes);
     if (rv == -EAGAIN) {
       // There's contention on the spin-lock, wait for it by retrying.
       std::this_thread::yield();
@@ -35,21 +49,27 @@ void writeToken(util::ringbuffer::Producer& producer, Reactor::TToken token) {
       std::this_thread::yield();
       continue;
     }
-    TP_DCHECK_EQ(rv, sizeof(token));
+    TP_DCHECK_EQ(rv, numBytes);
     break;
   }
 }
 
 } // namespace
 
-Reactor::Reactor() {
+Reactor::Reactor(
+    std::chrono::microseconds spinDuration,
+    ThreadOptions threadOptions)
+    : BusyPollingLoop(spinDuration, kSleepDuration) {
+  // The peers write their triggers into it, and it's polled continuously, hence
+  // it's worth backing it with huge pages, if there are any.
   Error error;
   std::tie(error, headerSegment_, dataSegment_, rb_) =
-      util::ringbuffer::shm::create(kSize);
+      util::ringbuffer::shm::create(kSize, util::shm::PageType::HugeTLB_2MB);
   TP_THROW_ASSERT_IF(error)
       << "Couldn't allocate ringbuffer for reactor: " << error.what();
+  setEventCount(rb_.getHeader().getEventCount());
 
-  startThread("TP_SHM_reactor");
+  startThread("TP_SHM_reactor", std::move(threadOptions));
 }
 
 void Reactor::close() {
@@ -71,26 +91,36 @@ Reactor::~Reactor() {
 }
 
 Reactor::TToken Reactor::add(TFunction fn) {
-  std::unique_lock<std::mutex> lock(mutex_);
+  if (inLoop()) {
+    return addFromLoop(std::move(fn));
+  }
   TToken token;
+  runInLoop([&]() { token = addFromLoop(std::move(fn)); });
+  return token;
+}
 
-  // Either reuse a token or generate a new one.
-  auto it = reusableTokens_.begin();
-  if (it != reusableTokens_.end()) {
-    token = *it;
-    reusableTokens_.erase(it);
-  } else {
-    // If there are no reusable tokens, the next token is always equal
-    // to the number of tokens in use + 1.
-    token = functions_.size();
-  }
+Reactor::TToken Reactor::addFromLoop(TFunction fn) {
+  TP_DCHECK(inLoop());
+  TToken token;
 
-  // Ensure there is enough space in the functions vector.
-  if (functions_.size() <= token) {
-    functions_.resize(token + 1);
+  // Either reuse a token or take the next slot of the slab.
+  if (firstFree_ != kNoToken) {
+    token = firstFree_;
+    firstFree_ = slot(token).nextFree;
+    if (firstFree_ == kNoToken) {
+      lastFree_ = kNoToken;
+    }
+  } else {
+    TP_THROW_ASSERT_IF(numSlots_ == kMaxChunks * kSlotsPerChunk)
+        << "Too many functions registered with the reactor";
+    token = numSlots_++;
+    if (token % kSlotsPerChunk == 0) {
+      chunks_[token / kSlotsPerChunk] =
+          std::make_unique<Slot[]>(kSlotsPerChunk);
+    }
   }
 
-  functions_[token] = std::move(fn);
+  slot(token).fn = std::move(fn);
 
   functionCount_++;
 
@@ -98,10 +128,34 @@ Reactor::TToken Reactor::add(TFunction fn) {
 }
 
 void Reactor::remove(TToken token) {
-  std::unique_lock<std::mutex> lock(mutex_);
-  functions_[token] = nullptr;
-  reusableTokens_.insert(token);
+  if (inLoop()) {
+    removeFromLoop(token);
+    return;
+  }
+  runInLoop([&]() { removeFromLoop(token); });
+}
+
+void Reactor::removeFromLoop(TToken token) {
+  TP_DCHECK(inLoop());
+  TP_DCHECK_LT(token, numSlots_);
   functionCount_--;
+  if (token == runningToken_) {
+    runningTokenRemoved_ = true;
+    return;
+  }
+  freeSlotFromLoop(token);
+}
+
+void Reactor::freeSlotFromLoop(TToken token) {
+  Slot& s = slot(token);
+  s.fn = nullptr;
+  s.nextFree = kNoToken;
+  if (lastFree_ == kNoToken) {
+    firstFree_ = token;
+  } else {
+    slot(lastFree_).nextFree = token;
+  }
+  lastFree_ = token;
 }
 
 std::tuple<int, int> Reactor::fds() const {
@@ -109,26 +163,53 @@ std::tuple<int, int> Reactor::fds() const {
 }
 
 bool Reactor::pollOnce() {
+  // Drain as many tokens as possible in a single transaction. Producers always
+  // write whole tokens, hence the amount of data is a multiple of their size.
+  std::array<TToken, kMaxTokensPerPoll> tokens;
   util::ringbuffer::Consumer reactorConsumer(rb_);
-  uint32_t token;
-  auto ret = reactorConsumer.read(&token, sizeof(token));
-  if (ret == -ENODATA) {
+  auto ret = reactorConsumer.startTx();
+  TP_THROW_SYSTEM_IF(ret < 0, -ret);
+  ret = reactorConsumer.readInTx</*AllowPartial=*/true>(
+      tokens.data(), sizeof(tokens));
+  if (ret == -ENODATA || ret == 0) {
+    ret = reactorConsumer.cancelTx();
+    TP_THROW_SYSTEM_IF(ret < 0, -ret);
     return false;
   }
   TP_THROW_SYSTEM_IF(ret < 0, -ret);
+  TP_DCHECK_EQ(ret % sizeof(TToken), 0);
+  size_t numTokens = ret / sizeof(TToken);
+  ret = reactorConsumer.commitTx();
+  TP_THROW_SYSTEM_IF(ret < 0, -ret);
 
-  TFunction fn;
-
-  // Make copy of std::function so we don't need
-  // to hold the lock while executing it.
-  {
-    std::unique_lock<std::mutex> lock(mutex_);
-    TP_DCHECK_LT(token, functions_.size());
-    fn = functions_[token];
+  // A function processes all the data that is available when it runs, hence
+  // there is no point in running it multiple times for the same batch.
+  auto tokensEnd = tokens.begin();
+  for (size_t tokenIdx = 0; tokenIdx < numTokens; tokenIdx++) {
+    if (std::find(tokens.begin(), tokensEnd, tokens[tokenIdx]) == tokensEnd) {
+      *tokensEnd++ = tokens[tokenIdx];
+    }
   }
+  numTokens = tokensEnd - tokens.begin();
 
-  if (fn) {
+  // The functions are only modified from this thread, hence they're run in
+  // place. One that a previous one removed is skipped, whereas one that was
+  // added in its stead is run, which is harmless as functions must cope with
+  // spurious triggers anyways.
+  for (size_t tokenIdx = 0; tokenIdx < numTokens; tokenIdx++) {
+    const TToken token = tokens[tokenIdx];
+    TP_DCHECK_LT(token, numSlots_);
+    TFunction& fn = slot(token).fn;
+    if (!fn) {
+      continue;
+    }
+    runningToken_ = token;
     fn();
+    runningToken_ = kNoToken;
+    if (unlikely(runningTokenRemoved_)) {
+      runningTokenRemoved_ = false;
+      freeSlotFromLoop(token);
+    }
   }
 
   return true;
@@ -150,7 +231,25 @@ Reactor::Trigger::Trigger(Fd headerFd, Fd dataFd) {
 
 void Reactor::Trigger::run(TToken token) {
   util::ringbuffer::Producer producer(rb_);
-  writeToken(producer, token);
+  writeTokens(producer, &token, 1);
+  rb_.getHeader().getEventCount().notify();
+}
+
+void Reactor::Trigger::defer(TToken token) {
+  if (std::find(pendingTokens_.begin(), pendingTokens_.end(), token) ==
+      pendingTokens_.end()) {
+    pendingTokens_.push_back(token);
+  }
+}
+
+void Reactor::Trigger::flush() {
+  if (pendingTokens_.empty()) {
+    return;
+  }
+  util::ringbuffer::Producer producer(rb_);
+  writeTokens(producer, pendingTokens_.data(), pendingTokens_.size());
+  pendingTokens_.clear();
+  rb_.getHeader().getEventCount().notify();
 }
 
 } // namespace shm
@@ -8,12 +8,13 @@
 
 #pragma once
 
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
-#include <future>
-#include <list>
-#include <mutex>
-#include <set>
+#include <limits>
+#include <memory>
 #include <thread>
 #include <vector>
 
@@ -21,6 +22,7 @@
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/common/fd.h>
 #include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/thread_options.h>
 #include <tensorpipe/util/ringbuffer/consumer.h>
 #include <tensorpipe/util/ringbuffer/producer.h>
 #include <tensorpipe/util/shm/segment.h>
@@ -34,8 +36,13 @@ namespace shm {
 // Companion class to the event loop in `loop.h` that executes
 // functions on triggers. The triggers are posted to a shared memory
 // ring buffer, so this can be done by other processes on the same
-// machine. It uses extra data in the ring buffer header to store a
-// mutex and condition variable to avoid a busy loop.
+// machine. When idle for longer than the spin duration it sleeps on
+// the event count stored in the ring buffer header, which triggers
+// notify, to avoid a busy loop.
+//
+// The functions are only ever added, removed and run from the loop (callers
+// from other threads wait for it to do so for them) hence dispatching a
+// trigger takes no lock and makes no copy: it calls the function in place.
 //
 class Reactor final : public BusyPollingLoop {
   // This allows for buffering 1M triggers (at 4 bytes a piece).
@@ -45,18 +52,26 @@ class Reactor final : public BusyPollingLoop {
   using TFunction = std::function<void()>;
   using TToken = uint32_t;
 
-  Reactor();
+  Reactor(
+      std::chrono::microseconds spinDuration,
+      ThreadOptions threadOptions = ThreadOptions());
 
   // Add function to the reactor.
   // Returns token that can be used to trigger it.
   TToken add(TFunction fn);
 
-  // Removes function associated with token from reactor.
+  // Removes function associated with token from reactor. If it's the one
+  // that's running, it's only destroyed once it returns.
   void remove(TToken token);
 
   // Returns the file descriptors for the underlying ring buffer.
   std::tuple<int, int> fds() const;
 
+  // Returns the size of the data of the underlying ring buffer.
+  size_t getRingBufferSize() const {
+    return kSize;
+  }
+
   void close();
 
   void join();
@@ -73,23 +88,45 @@ class Reactor final : public BusyPollingLoop {
   util::shm::Segment dataSegment_;
   util::ringbuffer::RingBuffer rb_;
 
-  std::mutex mutex_;
   std::atomic<bool> closed_{false};
   std::atomic<bool> joined_{false};
 
-  // Tokens are placed in this set if they can be reused.
-  std::set<TToken> reusableTokens_;
+  static constexpr TToken kNoToken = std::numeric_limits<TToken>::max();
+  static constexpr size_t kSlotsPerChunk = 256;
+  static constexpr size_t kMaxChunks = 4096;
+
+  // A slot of the slab, which maps a token (its index) to its function. The
+  // free slots are kept in an intrusive list, in the order in which they were
+  // freed, so that tokens are reused first in, first out.
+  struct Slot {
+    TFunction fn;
+    TToken nextFree{kNoToken};
+  };
+
+  // The slab grows by whole chunks, which never move, hence a function keeps
+  // running from the same place even if it adds others that need a new chunk.
+  std::array<std::unique_ptr<Slot[]>, kMaxChunks> chunks_;
+  TToken numSlots_{0};
+  TToken firstFree_{kNoToken};
+  TToken lastFree_{kNoToken};
 
-  // Map reactor tokens to functions.
-  //
-  // The tokens are reused so we don't worry about unbounded growth
-  // and comfortably use a std::vector here.
-  //
-  std::vector<TFunction> functions_;
+  // The function being run, if any, and whether it removed itself meanwhile.
+  TToken runningToken_{kNoToken};
+  bool runningTokenRemoved_{false};
 
   // Count how many functions are registered.
   std::atomic<uint64_t> functionCount_{0};
 
+  Slot& slot(TToken token) {
+    return chunks_[token / kSlotsPerChunk][token % kSlotsPerChunk];
+  }
+
+  TToken addFromLoop(TFunction fn);
+
+  void removeFromLoop(TToken token);
+
+  void freeSlotFromLoop(TToken token);
+
  public:
   class Trigger {
    public:
@@ -97,10 +134,21 @@ class Reactor final : public BusyPollingLoop {
 
     void run(TToken token);
 
+    // Batched triggering: tokens passed to defer are only written to the
+    // remote reactor upon the next call to flush, all in the same ringbuffer
+    // transaction. Requests for a token that is already pending are coalesced,
+    // as a single wakeup of the remote function suffices for it to process all
+    // the data that is available.
+    void defer(TToken token);
+
+    void flush();
+
    private:
     util::shm::Segment headerSegment_;
     util::shm::Segment dataSegment_;
     util::ringbuffer::RingBuffer rb_;
+
+    std::vector<TToken> pendingTokens_;
   };
 };
 
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/sim/connection_impl.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/sim/context_impl.h>
+#include <tensorpipe/transport/sim/listener_impl.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace sim {
+
+namespace {
+
+std::chrono::nanoseconds transmissionTime(
+    size_t length,
+    uint64_t bytesPerSecond) {
+  if (bytesPerSecond == 0) {
+    return std::chrono::nanoseconds(0);
+  }
+  return std::chrono::nanoseconds(
+      static_cast<int64_t>(static_cast<double>(length) * 1e9 / bytesPerSecond));
+}
+
+} // namespace
+
+ConnectionImpl::ConnectionImpl(
+    ConstructorToken token,
+    std::shared_ptr<ContextImpl> context,
+    std::string id,
+    std::shared_ptr<Connection> inner)
+    : ConnectionImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
+          token,
+          std::move(context),
+          std::move(id)),
+      inner_(std::move(inner)) {}
+
+ConnectionImpl::ConnectionImpl(
+    ConstructorToken token,
+    std::shared_ptr<ContextImpl> context,
+    std::string id,
+    std::string addr)
+    : ConnectionImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
+          token,
+          std::move(context),
+          std::move(id)),
+      addr_(std::move(addr)) {}
+
+void ConnectionImpl::initImplFromLoop() {
+  context_->enroll(*this);
+
+  if (addr_.has_value()) {
+    inner_ = context_->getInnerContext().connect(addr_.value());
+  }
+  inner_->setId(id_ + ".inner");
+  generator_.seed(context_->nextConnectionSeed());
+}
+
+void ConnectionImpl::readImplFromLoop(read_callback_fn fn) {
+  readImplFromLoop(nullptr, 0, std::move(fn));
+}
+
+void ConnectionImpl::readImplFromLoop(
+    void* ptr,
+    size_t length,
+    read_callback_fn fn) {
+  readOperations_.push_back(
+      ReadOperation{ptr, length, std::move(fn), {}, nullptr, 0, {}});
+
+  // The data is only valid within the callbacks of the inner connection, which
+  // are called from its own loop, hence it's copied there.
+  inner_->read([impl{shared_from_this()}](
+                   const Error& error,
+                   const void* headerPtr,
+                   size_t headerLength) {
+    Error headerError = error;
+    int64_t arrivalTimeNs = 0;
+    if (!headerError && headerLength != sizeof(arrivalTimeNs)) {
+      headerError =
+          TP_CREATE_ERROR(ShortReadError, sizeof(arrivalTimeNs), headerLength);
+    }
+    if (!headerError) {
+      std::memcpy(&arrivalTimeNs, headerPtr, sizeof(arrivalTimeNs));
+    }
+    impl->context_->deferToLoop([impl, headerError, arrivalTimeNs]() {
+      impl->onReadHeaderFromLoop(
+          headerError,
+          TTimePoint(std::chrono::nanoseconds(arrivalTimeNs)));
+    });
+  });
+  inner_->read([impl{shared_from_this()}](
+                   const Error& error,
+                   const void* dataPtr,
+                   size_t dataLength) {
+    std::unique_ptr<uint8_t[]> data;
+    if (!error) {
+      data = std::make_unique<uint8_t[]>(dataLength);
+      if (dataLength > 0) {
+        std::memcpy(data.get(), dataPtr, dataLength);
+      }
+    }
+    impl->context_->deferToLoop(
+        [impl, error, data{std::move(data)}, dataLength]() mutable {
+          impl->onReadDataFromLoop(error, std::move(data), dataLength);
+        });
+  });
+}
+
+void ConnectionImpl::onReadHeaderFromLoop(
+    const Error& error,
+    TTimePoint arrivalTime) {
+  TP_DCHECK(context_->inLoop());
+  if (error_) {
+    // The reads were failed already.
+    return;
+  }
+  if (error) {
+    setErrorAfterReadsFromLoop(error);
+    return;
+  }
+  TP_DCHECK_LT(numReadHeadersReceived_, readOperations_.size());
+  readOperations_[numReadHeadersReceived_++].arrivalTime = arrivalTime;
+}
+
+void ConnectionImpl::onReadDataFromLoop(
+    const Error& error,
+    std::unique_ptr<uint8_t[]> data,
+    size_t length) {
+  TP_DCHECK(context_->inLoop());
+  if (error_) {
+    return;
+  }
+  if (error) {
+    setErrorAfterReadsFromLoop(error);
+    return;
+  }
+  TP_DCHECK_LT(numReadsReceived_, numReadHeadersReceived_);
+  ReadOperation& readOperation = readOperations_[numReadsReceived_++];
+  readOperation.data = std::move(data);
+  readOperation.dataLength = length;
+  readOperation.dataMemoryCharge = MemoryCharge(
+      context_->getMemoryFootprintCounters(), MemoryKind::kHost, length);
+
+  // The peer already keeps its writes in order, this is merely a safety net.
+  lastReadArrivalTime_ =
+      std::max(lastReadArrivalTime_, readOperation.arrivalTime);
+  context_->deferToLoopAt(lastReadArrivalTime_, [impl{shared_from_this()}]() {
+    impl->deliverReadFromLoop();
+  });
+}
+
+void ConnectionImpl::deliverReadFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  if (error_) {
+    return;
+  }
+  TP_DCHECK_GT(numReadsReceived_, 0);
+  ReadOperation readOperation = std::move(readOperations_.front());
+  readOperations_.pop_front();
+  numReadHeadersReceived_--;
+  numReadsReceived_--;
+
+  if (readOperation.ptr != nullptr) {
+    TP_DCHECK_EQ(readOperation.length, readOperation.dataLength);
+    if (readOperation.dataLength > 0) {
+      std::memcpy(
+          readOperation.ptr,
+          readOperation.data.get(),
+          readOperation.dataLength);
+    }
+    readOperation.fn(
+        Error::kSuccess, readOperation.ptr, readOperation.dataLength);
+  } else {
+    readOperation.fn(
+        Error::kSuccess, readOperation.data.get(), readOperation.dataLength);
+  }
+}
+
+void ConnectionImpl::setErrorAfterReadsFromLoop(const Error& error) {
+  const TTimePoint now = std::chrono::steady_clock::now();
+  if (lastReadArrivalTime_ <= now) {
+    setError(error);
+    return;
+  }
+  context_->deferToLoopAt(
+      lastReadArrivalTime_, [impl{shared_from_this()}, error]() {
+        impl->setError(error);
+      });
+}
+
+void ConnectionImpl::writeImplFromLoop(
+    const void* ptr,
+    size_t length,
+    write_callback_fn fn) {
+  const LinkOptions& linkOptions = context_->getLinkOptions();
+  const TTimePoint now = std::chrono::steady_clock::now();
+
+  linkFreeTime_ = std::max(linkFreeTime_, now) +
+      transmissionTime(length, linkOptions.bytesPerSecond);
+  TTimePoint arrivalTime = linkFreeTime_ + linkOptions.latency;
+  if (linkOptions.jitter.count() > 0) {
+    std::uniform_int_distribution<int64_t> jitterDistribution(
+        0, linkOptions.jitter.count());
+    arrivalTime += std::chrono::nanoseconds(jitterDistribution(generator_));
+  }
+  lastWriteArrivalTime_ = std::max(lastWriteArrivalTime_, arrivalTime);
+
+  writeOperations_.push_back(WriteOperation{
+      std::move(fn),
+      linkFreeTime_,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          lastWriteArrivalTime_.time_since_epoch())
+          .count()});
+  const WriteOperation& writeOperation = writeOperations_.back();
+
+  // The inner connection calls back in order, and once an error occurs all
+  // pending and subsequent callbacks get it too, hence only the one of the
+  // data is needed.
+  inner_->write(
+      &writeOperation.arrivalTimeNs,
+      sizeof(writeOperation.arrivalTimeNs),
+      [](const Error& /* unused */) {});
+  inner_->write(ptr, length, [impl{shared_from_this()}](const Error& error) {
+    impl->context_->deferToLoop(
+        [impl, error]() { impl->onWriteDoneByInnerFromLoop(error); });
+  });
+}
+
+void ConnectionImpl::onWriteDoneByInnerFromLoop(const Error& error) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK_LT(numWritesDoneByInner_, writeOperations_.size());
+  const TTimePoint departureTime =
+      writeOperations_[numWritesDoneByInner_++].departureTime;
+  if (error) {
+    setError(error);
+  }
+  if (!error_ && departureTime > std::chrono::steady_clock::now()) {
+    context_->deferToLoopAt(
+        departureTime,
+        [impl{shared_from_this()}]() { impl->completeWritesFromLoop(); });
+    return;
+  }
+  completeWritesFromLoop();
+}
+
+void ConnectionImpl::completeWritesFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  const TTimePoint now = std::chrono::steady_clock::now();
+  while (numWritesDoneByInner_ > 0 &&
+         (error_ || writeOperations_.front().departureTime <= now)) {
+    WriteOperation writeOperation = std::move(writeOperations_.front());
+    writeOperations_.pop_front();
+    numWritesDoneByInner_--;
+    writeOperation.fn(error_);
+  }
+}
+
+void ConnectionImpl::handleErrorImpl() {
+  std::deque<ReadOperation> readOperations;
+  std::swap(readOperations, readOperations_);
+  numReadHeadersReceived_ = 0;
+  numReadsReceived_ = 0;
+  for (auto& readOperation : readOperations) {
+    readOperation.fn(error_, readOperation.ptr, readOperation.length);
+  }
+
+  // This fails the writes that the inner connection isn't done with yet.
+  inner_->close();
+  completeWritesFromLoop();
+
+  context_->unenroll(*this);
+}
+
+} // namespace sim
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+
+#include <tensorpipe/common/memory_footprint.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/transport/connection.h>
+#include <tensorpipe/transport/connection_impl_boilerplate.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace sim {
+
+class ContextImpl;
+class ListenerImpl;
+
+class ConnectionImpl final : public ConnectionImplBoilerplate<
+                                 ContextImpl,
+                                 ListenerImpl,
+                                 ConnectionImpl> {
+ public:
+  // Create a connection that is already connected (e.g. from a listener).
+  ConnectionImpl(
+      ConstructorToken token,
+      std::shared_ptr<ContextImpl> context,
+      std::string id,
+      std::shared_ptr<Connection> inner);
+
+  // Create a connection that connects to the specified address.
+  ConnectionImpl(
+      ConstructorToken token,
+      std::shared_ptr<ContextImpl> context,
+      std::string id,
+      std::string addr);
+
+ protected:
+  // Implement the entry points called by ConnectionImplBoilerplate.
+  void initImplFromLoop() override;
+  void readImplFromLoop(read_callback_fn fn) override;
+  void readImplFromLoop(void* ptr, size_t length, read_callback_fn fn) override;
+  void writeImplFromLoop(const void* ptr, size_t length, write_callback_fn fn)
+      override;
+  void handleErrorImpl() override;
+
+ private:
+  using TTimePoint = std::chrono::steady_clock::time_point;
+
+  // Each write goes over the inner connection as the time at which it arrives
+  // (in nanoseconds of the monotonic clock), followed by its data, which the
+  // reader reads separately.
+  struct ReadOperation {
+    // Null if the read didn't come with a destination.
+    void* ptr;
+    size_t length;
+    read_callback_fn fn;
+    TTimePoint arrivalTime;
+    std::unique_ptr<uint8_t[]> data;
+    size_t dataLength;
+    MemoryCharge dataMemoryCharge;
+  };
+
+  struct WriteOperation {
+    write_callback_fn fn;
+    // When the write is all on the link, and thus done.
+    TTimePoint departureTime;
+    // The header of the write, which must stay alive until the inner
+    // connection is done with it.
+    int64_t arrivalTimeNs;
+  };
+
+  // The address of the listener, for the connections that connect to one.
+  optional<std::string> addr_;
+
+  std::shared_ptr<Connection> inner_;
+
+  // The jitter of our writes.
+  std::mt19937_64 generator_;
+
+  // When the link is done with the writes so far, and when the last of them
+  // arrives, which the next ones can't come before.
+  TTimePoint linkFreeTime_;
+  TTimePoint lastWriteArrivalTime_;
+  // The same, for the reads.
+  TTimePoint lastReadArrivalTime_;
+
+  // The reads that were handed to the inner connection, in order. The leading
+  // ones got the time at which they arrive, and the leading ones of those got
+  // their data too, and are waiting for that time.
+  std::deque<ReadOperation> readOperations_;
+  size_t numReadHeadersReceived_{0};
+  size_t numReadsReceived_{0};
+
+  // The writes that were handed to the inner connection, in order, the leading
+  // ones of which it's done with. They're kept until then, even once we failed,
+  // as it may still access their buffers and header.
+  std::deque<WriteOperation> writeOperations_;
+  size_t numWritesDoneByInner_{0};
+
+  void onReadHeaderFromLoop(const Error& error, TTimePoint arrivalTime);
+  void onReadDataFromLoop(
+      const Error& error,
+      std::unique_ptr<uint8_t[]> data,
+      size_t length);
+  void deliverReadFromLoop();
+
+  // Fail the connection once the reads that arrived before the error were
+  // delivered, as the inner connection fails as soon as the peer is gone, and
+  // this is when it would have been seen across the link.
+  void setErrorAfterReadsFromLoop(const Error& error);
+
+  void onWriteDoneByInnerFromLoop(const Error& error);
+
+  // Call the callbacks of the leading writes that the inner connection is done
+  // with and that are all on the link (or all of them, once we failed).
+  void completeWritesFromLoop();
+};
+
+} // namespace sim
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/common/thread_options.h>
+#include <tensorpipe/transport/context.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace sim {
+
+class ContextImpl;
+
+// The link that the writes of a connection go over, one write at a time.
+struct LinkOptions {
+  // The rate at which the bytes are put on the link, in bytes per second, or
+  // zero for a link without a limit.
+  uint64_t bytesPerSecond{0};
+  // The time it takes for a write to get across, once it's all on the link.
+  std::chrono::nanoseconds latency{0};
+  // The most extra time that a write may take to get across, on top of the
+  // latency, which is drawn uniformly for each write. The writes still arrive
+  // in order, hence they may be held back by the ones before them.
+  std::chrono::nanoseconds jitter{0};
+  // The jitter of the connections of a context is drawn from generators that
+  // are seeded with this, plus the number of connections that the context
+  // created before, hence a program that creates its connections in the same
+  // order gets the same delays on each run.
+  uint64_t seed{0};
+};
+
+class Context : public transport::Context {
+ public:
+  // The connections go over those of the inner context, and the listeners are
+  // its listeners, with the same addresses, but the data behaves as if it went
+  // over the given link: a write is done once it was put on the link (after
+  // the writes before it, at the given rate), and it's handed to the read on
+  // the other end once it got across (i.e., after the latency and the jitter),
+  // with no losses and no limit on how much can be in flight. The timing of a
+  // direction is set by the context of the writer, which tells the reader the
+  // time its writes arrive, hence both ends must be on the same machine (as
+  // they use its monotonic clock) and must both use this transport. Each write
+  // and each read is also a write and a read on the inner connection, which
+  // should thus be faster than the link for the results to match the model
+  // (e.g., inproc or shm). The data of the reads is copied into buffers of the
+  // connection until it's due to arrive.
+  explicit Context(
+      std::shared_ptr<transport::Context> innerContext,
+      LinkOptions linkOptions = LinkOptions(),
+      ThreadOptions threadOptions = ThreadOptions());
+
+  Context(const Context&) = delete;
+  Context(Context&&) = delete;
+  Context& operator=(const Context&) = delete;
+  Context& operator=(Context&&) = delete;
+
+  std::shared_ptr<Connection> connect(std::string addr) override;
+
+  std::shared_ptr<Listener> listen(std::string addr) override;
+
+  bool isViable() const override;
+
+  void enableLoopStats() override;
+
+  std::map<std::string, LoopStats> getLoopStats() override;
+
+  const std::string& domainDescriptor() const override;
+
+  void setId(std::string id) override;
+
+  TransportStats getTransportStats() override;
+
+  MemoryFootprint getMemoryFootprint() override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it (downcast as a shared_ptr to the private
+  // interface). However, its lifetime is tied to the one of this public object,
+  // since when the latter is destroyed the implementation is closed and joined.
+  const std::shared_ptr<ContextImpl> impl_;
+};
+
+} // namespace sim
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/sim/context_impl.h>
+
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/transport/sim/connection_impl.h>
+#include <tensorpipe/transport/sim/listener_impl.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace sim {
+
+namespace {
+
+// Prepend descriptor with transport name so it's easy to
+// disambiguate descriptors when debugging.
+const std::string kDomainDescriptorPrefix{"sim:"};
+
+} // namespace
+
+std::shared_ptr<ContextImpl> ContextImpl::create(
+    std::shared_ptr<transport::Context> innerContext,
+    LinkOptions linkOptions,
+    ThreadOptions threadOptions) {
+  TP_THROW_ASSERT_IF(innerContext == nullptr)
+      << "The simulated link needs an inner context";
+  return std::make_shared<ContextImpl>(
+      std::move(innerContext),
+      std::move(linkOptions),
+      std::move(threadOptions));
+}
+
+ContextImpl::ContextImpl(
+    std::shared_ptr<transport::Context> innerContext,
+    LinkOptions linkOptions,
+    ThreadOptions threadOptions)
+    : ContextImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
+          kDomainDescriptorPrefix + innerContext->domainDescriptor()),
+      innerContext_(std::move(innerContext)),
+      linkOptions_(std::move(linkOptions)),
+      loop_(std::move(threadOptions)) {}
+
+bool ContextImpl::isViable() const {
+  return innerContext_->isViable();
+}
+
+bool ContextImpl::inLoop() {
+  return loop_.inLoop();
+}
+
+void ContextImpl::deferToLoop(TTask fn) {
+  loop_.deferToLoop(std::move(fn));
+}
+
+void ContextImpl::deferToLoopAt(TTimePoint time, TTask fn) {
+  loop_.deferToLoopAt(time, std::move(fn));
+}
+
+void ContextImpl::enableLoopStats() {
+  loop_.enableStats();
+  innerContext_->enableLoopStats();
+}
+
+std::map<std::string, LoopStats> ContextImpl::getLoopStats() {
+  std::map<std::string, LoopStats> stats = {{"loop", loop_.getStats()}};
+  for (auto& iter : innerContext_->getLoopStats()) {
+    stats.emplace("inner_" + iter.first, std::move(iter.second));
+  }
+  return stats;
+}
+
+transport::Context& ContextImpl::getInnerContext() {
+  return *innerContext_;
+}
+
+const LinkOptions& ContextImpl::getLinkOptions() const {
+  return linkOptions_;
+}
+
+uint64_t ContextImpl::nextConnectionSeed() {
+  TP_DCHECK(inLoop());
+  return linkOptions_.seed + numConnectionsSeeded_++;
+}
+
+void ContextImpl::closeImpl() {
+  innerContext_->close();
+}
+
+void ContextImpl::joinImpl() {
+  // The inner connections call back into our loop until they're done, hence
+  // it must keep running until the inner context is joined.
+  innerContext_->join();
+  loop_.join();
+}
+
+} // namespace sim
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/common/thread_options.h>
+#include <tensorpipe/transport/context_impl_boilerplate.h>
+#include <tensorpipe/transport/sim/context.h>
+#include <tensorpipe/transport/sim/loop.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace sim {
+
+class ConnectionImpl;
+class ListenerImpl;
+
+class ContextImpl final
+    : public ContextImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl> {
+ public:
+  using TTimePoint = Loop::TTimePoint;
+
+  static std::shared_ptr<ContextImpl> create(
+      std::shared_ptr<transport::Context> innerContext,
+      LinkOptions linkOptions,
+      ThreadOptions threadOptions);
+
+  ContextImpl(
+      std::shared_ptr<transport::Context> innerContext,
+      LinkOptions linkOptions,
+      ThreadOptions threadOptions);
+
+  bool isViable() const;
+
+  // Implement the DeferredExecutor interface.
+  bool inLoop() override;
+  void deferToLoop(TTask fn) override;
+
+  // Run the function on the loop once the given time has come. Must be called
+  // from the loop.
+  void deferToLoopAt(TTimePoint time, TTask fn);
+
+  void enableLoopStats();
+
+  // The loops of the inner context are included, with a prefix.
+  std::map<std::string, LoopStats> getLoopStats();
+
+  transport::Context& getInnerContext();
+
+  const LinkOptions& getLinkOptions() const;
+
+  // The seed of the jitter of the next connection. Must be called from the
+  // loop, once per connection.
+  uint64_t nextConnectionSeed();
+
+ protected:
+  // Implement the entry points called by ContextImplBoilerplate.
+  void closeImpl() override;
+  void joinImpl() override;
+
+ private:
+  const std::shared_ptr<transport::Context> innerContext_;
+  const LinkOptions linkOptions_;
+
+  Loop loop_;
+
+  uint64_t numConnectionsSeeded_{0};
+};
+
+} // namespace sim
+} // namespace transport
+} // namespace tensorpipe
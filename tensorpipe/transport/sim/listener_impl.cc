@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/sim/listener_impl.h>
+
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/transport/sim/connection_impl.h>
+#include <tensorpipe/transport/sim/context_impl.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace sim {
+
+ListenerImpl::ListenerImpl(
+    ConstructorToken token,
+    std::shared_ptr<ContextImpl> context,
+    std::string id,
+    std::string addr)
+    : ListenerImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
+          token,
+          std::move(context),
+          std::move(id)),
+      addr_(std::move(addr)) {}
+
+void ListenerImpl::initImplFromLoop() {
+  context_->enroll(*this);
+  inner_ = context_->getInnerContext().listen(addr_);
+  inner_->setId(id_ + ".inner");
+}
+
+void ListenerImpl::acceptImplFromLoop(accept_callback_fn fn) {
+  // The inner listener calls back in order, and fails the pending accepts once
+  // it's closed, hence each callback is handed over to it.
+  inner_->accept([impl{shared_from_this()}, fn{std::move(fn)}](
+                     const Error& error,
+                     std::shared_ptr<Connection> innerConnection) mutable {
+    impl->context_->deferToLoop([impl,
+                                 error,
+                                 innerConnection{std::move(innerConnection)},
+                                 fn{std::move(fn)}]() mutable {
+      impl->onAcceptFromLoop(error, std::move(innerConnection), std::move(fn));
+    });
+  });
+}
+
+void ListenerImpl::onAcceptFromLoop(
+    const Error& error,
+    std::shared_ptr<Connection> innerConnection,
+    accept_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+  if (error) {
+    setError(error);
+  }
+  if (error_) {
+    if (innerConnection != nullptr) {
+      innerConnection->close();
+    }
+    fn(error_, std::shared_ptr<Connection>());
+    return;
+  }
+  fn(Error::kSuccess, createAndInitConnection(std::move(innerConnection)));
+}
+
+std::string ListenerImpl::addrImplFromLoop() const {
+  TP_DCHECK(context_->inLoop());
+  return inner_->addr();
+}
+
+void ListenerImpl::handleErrorImpl() {
+  inner_->close();
+
+  context_->unenroll(*this);
+}
+
+} // namespace sim
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <tensorpipe/transport/listener.h>
+#include <tensorpipe/transport/listener_impl_boilerplate.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace sim {
+
+class ConnectionImpl;
+class ContextImpl;
+
+class ListenerImpl final : public ListenerImplBoilerplate<
+                               ContextImpl,
+                               ListenerImpl,
+                               ConnectionImpl> {
+ public:
+  // Create a listener that listens on the specified address.
+  ListenerImpl(
+      ConstructorToken token,
+      std::shared_ptr<ContextImpl> context,
+      std::string id,
+      std::string addr);
+
+ protected:
+  // Implement the entry points called by ListenerImplBoilerplate.
+  void initImplFromLoop() override;
+  void acceptImplFromLoop(accept_callback_fn fn) override;
+  std::string addrImplFromLoop() const override;
+  void handleErrorImpl() override;
+
+ private:
+  const std::string addr_;
+
+  // The listener of the inner context, whose connections are wrapped as they
+  // are accepted.
+  std::shared_ptr<Listener> inner_;
+
+  void onAcceptFromLoop(
+      const Error& error,
+      std::shared_ptr<Connection> innerConnection,
+      accept_callback_fn fn);
+};
+
+} // namespace sim
+} // namespace transport
+} // namespace tensorpipe
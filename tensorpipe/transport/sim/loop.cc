@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/sim/loop.h>
+
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace sim {
+
+namespace {
+
+// The loop doesn't sleep while there are timed functions pending, and all
+// deferred functions are notified, hence it could sleep indefinitely otherwise.
+// This is merely a safety net.
+constexpr std::chrono::microseconds kSleepDuration = std::chrono::seconds(1);
+
+} // namespace
+
+Loop::Loop(ThreadOptions threadOptions)
+    : BusyPollingLoop(/*spinDuration=*/std::chrono::microseconds(0),
+                      kSleepDuration) {
+  startThread("TP_SIM_loop", std::move(threadOptions));
+}
+
+void Loop::deferToLoopAt(TTimePoint time, TTask fn) {
+  TP_DCHECK(inLoop());
+  timedTasks_.emplace(std::make_pair(time, nextTimedTaskId_++), std::move(fn));
+}
+
+void Loop::close() {
+  if (!closed_.exchange(true)) {
+    stopBusyPolling();
+  }
+}
+
+void Loop::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    joinThread();
+  }
+}
+
+Loop::~Loop() {
+  join();
+}
+
+bool Loop::pollOnce() {
+  const TTimePoint now = std::chrono::steady_clock::now();
+  bool ranTasks = false;
+  // The functions may schedule others, hence each is taken out before it runs.
+  while (!timedTasks_.empty() && timedTasks_.begin()->first.first <= now) {
+    TTask fn = std::move(timedTasks_.begin()->second);
+    timedTasks_.erase(timedTasks_.begin());
+    fn();
+    ranTasks = true;
+  }
+  // Claiming to have found something keeps the loop from going to sleep. This
+  // is only done on the last poll before sleeping, as it would otherwise keep
+  // the deferred functions from running.
+  if (isAboutToSleep_) {
+    isAboutToSleep_ = false;
+    return ranTasks || !timedTasks_.empty();
+  }
+  return ranTasks;
+}
+
+bool Loop::readyToClose() {
+  // The context only closes the loop once its inner context is joined, hence
+  // no more functions can be scheduled once the pending ones have run.
+  return timedTasks_.empty();
+}
+
+void Loop::prepareToSleep() {
+  isAboutToSleep_ = true;
+}
+
+} // namespace sim
+} // namespace transport
+} // namespace tensorpipe
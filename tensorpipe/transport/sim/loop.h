@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <utility>
+
+#include <tensorpipe/common/busy_polling_loop.h>
+#include <tensorpipe/common/thread_options.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace sim {
+
+// The thread on which a context runs its deferred functions and the ones it
+// scheduled for a later time, which is how the delays of the link are applied.
+// It keeps polling for as long as some of the latter are pending, so that they
+// run on time rather than after a sleep (or a wakeup), and sleeps otherwise.
+class Loop final : public BusyPollingLoop {
+ public:
+  using TTimePoint = std::chrono::steady_clock::time_point;
+
+  explicit Loop(ThreadOptions threadOptions = ThreadOptions());
+
+  // Run the function once the given time has come, after the ones scheduled
+  // earlier for the same time. Must be called from the loop.
+  void deferToLoopAt(TTimePoint time, TTask fn);
+
+  void close();
+
+  void join();
+
+  ~Loop();
+
+ protected:
+  bool pollOnce() override;
+
+  bool readyToClose() override;
+
+  void prepareToSleep() override;
+
+ private:
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+
+  // By time, and then by the order in which they were scheduled. Only accessed
+  // from the loop.
+  std::map<std::pair<TTimePoint, uint64_t>, TTask> timedTasks_;
+  uint64_t nextTimedTaskId_{0};
+  bool isAboutToSleep_{false};
+};
+
+} // namespace sim
+} // namespace transport
+} // namespace tensorpipe
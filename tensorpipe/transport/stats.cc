@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/stats.h>
+
+#include <algorithm>
+
+namespace tensorpipe {
+namespace transport {
+
+namespace {
+
+void increment(std::atomic<uint64_t>& counter, uint64_t value) {
+  counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t load(const std::atomic<uint64_t>& counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+
+} // namespace
+
+void TransportStats::merge(const TransportStats& other) {
+  numReads += other.numReads;
+  numBytesRead += other.numBytesRead;
+  numWrites += other.numWrites;
+  numBytesWritten += other.numBytesWritten;
+  numRingBufferStalls += other.numRingBufferStalls;
+  numRingBufferReclaims += other.numRingBufferReclaims;
+  numWorkRequestsPosted += other.numWorkRequestsPosted;
+  numCompletionQueuePolls += other.numCompletionQueuePolls;
+  numWorkCompletions += other.numWorkCompletions;
+  numQueuePairs += other.numQueuePairs;
+  writeQueueBytes += other.writeQueueBytes;
+  maxWriteQueueBytes = std::max(maxWriteQueueBytes, other.maxWriteQueueBytes);
+}
+
+void TransportStatsCounters::recordRead(size_t numBytes) {
+  increment(numReads_, 1);
+  increment(numBytesRead_, numBytes);
+  if (parent_ != nullptr) {
+    parent_->recordRead(numBytes);
+  }
+}
+
+void TransportStatsCounters::recordWrite(size_t numBytes) {
+  increment(numWrites_, 1);
+  increment(numBytesWritten_, numBytes);
+  if (parent_ != nullptr) {
+    parent_->recordWrite(numBytes);
+  }
+}
+
+void TransportStatsCounters::recordRingBufferStall() {
+  increment(numRingBufferStalls_, 1);
+  if (parent_ != nullptr) {
+    parent_->recordRingBufferStall();
+  }
+}
+
+void TransportStatsCounters::recordRingBufferReclaim() {
+  increment(numRingBufferReclaims_, 1);
+  if (parent_ != nullptr) {
+    parent_->recordRingBufferReclaim();
+  }
+}
+
+void TransportStatsCounters::recordWorkRequestsPosted(size_t numWorkRequests) {
+  increment(numWorkRequestsPosted_, numWorkRequests);
+  if (parent_ != nullptr) {
+    parent_->recordWorkRequestsPosted(numWorkRequests);
+  }
+}
+
+void TransportStatsCounters::recordCompletionQueuePoll(
+    size_t numWorkCompletions) {
+  increment(numCompletionQueuePolls_, 1);
+  increment(numWorkCompletions_, numWorkCompletions);
+  if (parent_ != nullptr) {
+    parent_->recordCompletionQueuePoll(numWorkCompletions);
+  }
+}
+
+void TransportStatsCounters::addWriteQueueBytes(int64_t delta) {
+  // Negative deltas wrap around, which unsigned addition handles correctly.
+  const uint64_t newValue =
+      writeQueueBytes_.fetch_add(
+          static_cast<uint64_t>(delta), std::memory_order_relaxed) +
+      static_cast<uint64_t>(delta);
+  uint64_t maxValue = load(maxWriteQueueBytes_);
+  while (newValue > maxValue &&
+         !maxWriteQueueBytes_.compare_exchange_weak(
+             maxValue, newValue, std::memory_order_relaxed)) {
+  }
+  if (parent_ != nullptr) {
+    parent_->addWriteQueueBytes(delta);
+  }
+}
+
+void TransportStatsCounters::addQueuePairs(int64_t delta) {
+  // Negative deltas wrap around, which unsigned addition handles correctly.
+  increment(numQueuePairs_, static_cast<uint64_t>(delta));
+  if (parent_ != nullptr) {
+    parent_->addQueuePairs(delta);
+  }
+}
+
+TransportStats TransportStatsCounters::snapshot() const {
+  TransportStats stats;
+  stats.numReads = load(numReads_);
+  stats.numBytesRead = load(numBytesRead_);
+  stats.numWrites = load(numWrites_);
+  stats.numBytesWritten = load(numBytesWritten_);
+  stats.numRingBufferStalls = load(numRingBufferStalls_);
+  stats.numRingBufferReclaims = load(numRingBufferReclaims_);
+  stats.numWorkRequestsPosted = load(numWorkRequestsPosted_);
+  stats.numCompletionQueuePolls = load(numCompletionQueuePolls_);
+  stats.numWorkCompletions = load(numWorkCompletions_);
+  stats.numQueuePairs = load(numQueuePairs_);
+  stats.writeQueueBytes = load(writeQueueBytes_);
+  stats.maxWriteQueueBytes = load(maxWriteQueueBytes_);
+  return stats;
+}
+
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace tensorpipe {
+namespace transport {
+
+// The traffic of a connection, or of all the connections of a context. Unlike
+// the statistics of the loops these are always gathered, as they amount to a
+// few relaxed atomic increments per operation. Each transport fills in the
+// fields that apply to it.
+struct TransportStats {
+  // The read and write operations that completed successfully, and the bytes
+  // they transferred (the serialized size, for nop objects).
+  uint64_t numReads{0};
+  uint64_t numBytesRead{0};
+  uint64_t numWrites{0};
+  uint64_t numBytesWritten{0};
+
+  // For transports built on a ring buffer (shm and ibv): how many times the
+  // pending writes found it full and had to wait for the peer to make room.
+  uint64_t numRingBufferStalls{0};
+
+  // For shm and ibv: how many times an idle connection gave back the memory of
+  // its inbox, until its peer would write into it again.
+  uint64_t numRingBufferReclaims{0};
+
+  // For ibv: the work requests that were posted to the send queues, how many
+  // times the completion queue was polled and the completions thus reaped.
+  // These are gathered by the reactor, hence only for the whole context.
+  uint64_t numWorkRequestsPosted{0};
+  uint64_t numCompletionQueuePolls{0};
+  uint64_t numWorkCompletions{0};
+
+  // For ibv: the queue pairs that the connections currently hold.
+  uint64_t numQueuePairs{0};
+
+  // For uv: the bytes that libuv still had to hand to the kernel when the
+  // snapshot was taken, and the most there ever were at once.
+  uint64_t writeQueueBytes{0};
+  uint64_t maxWriteQueueBytes{0};
+
+  // Add all the statistics of the other object to this one.
+  void merge(const TransportStats& other);
+};
+
+// The counters behind the above snapshot, which can be updated and read from
+// any thread. Those of a connection forward all updates to the ones of their
+// context (the parent), so that the latter don't need to be aggregated.
+class TransportStatsCounters {
+ public:
+  explicit TransportStatsCounters(TransportStatsCounters* parent = nullptr)
+      : parent_(parent) {}
+
+  TransportStatsCounters(const TransportStatsCounters&) = delete;
+  TransportStatsCounters& operator=(const TransportStatsCounters&) = delete;
+
+  void recordRead(size_t numBytes);
+  void recordWrite(size_t numBytes);
+  void recordRingBufferStall();
+  void recordRingBufferReclaim();
+  void recordWorkRequestsPosted(size_t numWorkRequests);
+  void recordCompletionQueuePoll(size_t numWorkCompletions);
+
+  // Account for a change in the number of bytes queued up for writing.
+  void addWriteQueueBytes(int64_t delta);
+
+  // Account for a change in the number of queue pairs.
+  void addQueuePairs(int64_t delta);
+
+  TransportStats snapshot() const;
+
+ private:
+  TransportStatsCounters* const parent_;
+
+  std::atomic<uint64_t> numReads_{0};
+  std::atomic<uint64_t> numBytesRead_{0};
+  std::atomic<uint64_t> numWrites_{0};
+  std::atomic<uint64_t> numBytesWritten_{0};
+  std::atomic<uint64_t> numRingBufferStalls_{0};
+  std::atomic<uint64_t> numRingBufferReclaims_{0};
+  std::atomic<uint64_t> numWorkRequestsPosted_{0};
+  std::atomic<uint64_t> numCompletionQueuePolls_{0};
+  std::atomic<uint64_t> numWorkCompletions_{0};
+  std::atomic<uint64_t> numQueuePairs_{0};
+  std::atomic<uint64_t> writeQueueBytes_{0};
+  std::atomic<uint64_t> maxWriteQueueBytes_{0};
+};
+
+} // namespace transport
+} // namespace tensorpipe
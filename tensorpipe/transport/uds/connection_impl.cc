@@ -0,0 +1,571 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uds/connection_impl.h>
+
+#include <linux/memfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/socket.h>
+#include <tensorpipe/common/stream_read_write_ops.h>
+#include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/uds/context_impl.h>
+#include <tensorpipe/transport/uds/sockaddr.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uds {
+
+namespace {
+
+// The size of the buffer that the lengths and the small payloads are received
+// into. It's the most that a single receive gets from the socket, unless it's
+// also receiving a payload straight into its destination.
+constexpr size_t kRecvBufferSize = 64 * 1024;
+
+// The kernel rejects the messages with more buffers than this (UIO_MAXIOV).
+constexpr size_t kMaxNumIovecsPerSend = 1024;
+
+// The kernel rejects the messages with more file descriptors than this
+// (SCM_MAX_FD is 253), and each receive must have room for all those that a
+// single send passes, hence we keep it much lower.
+constexpr size_t kMaxNumMemfdsPerSend = 16;
+
+using ControlBuffer =
+    std::array<char, CMSG_SPACE(sizeof(int) * kMaxNumMemfdsPerSend)>;
+
+// The first buffer of a write operation is always the one of the length.
+size_t getHeaderLength(StreamWriteOperation& writeOperation) {
+  return std::get<0>(writeOperation.getBufs())[0].len;
+}
+
+size_t getPayloadLength(StreamWriteOperation& writeOperation) {
+  StreamWriteOperation::Buf* bufs;
+  size_t numBufs;
+  std::tie(bufs, numBufs) = writeOperation.getBufs();
+  return numBufs > 1 ? bufs[1].len : 0;
+}
+
+} // namespace
+
+ConnectionImpl::ConnectionImpl(
+    ConstructorToken token,
+    std::shared_ptr<ContextImpl> context,
+    std::string id,
+    Socket socket)
+    : ConnectionImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
+          token,
+          std::move(context),
+          std::move(id)),
+      socket_(std::move(socket)) {}
+
+ConnectionImpl::ConnectionImpl(
+    ConstructorToken token,
+    std::shared_ptr<ContextImpl> context,
+    std::string id,
+    std::string addr)
+    : ConnectionImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
+          token,
+          std::move(context),
+          std::move(id)),
+      sockaddr_(Sockaddr::createAbstractUnixAddr(addr)) {}
+
+void ConnectionImpl::initImplFromLoop() {
+  context_->enroll(*this);
+
+  Error error;
+  // The connection either got a socket or an address, but not both.
+  TP_DCHECK(socket_.hasValue() ^ sockaddr_.has_value());
+  if (!socket_.hasValue()) {
+    std::tie(error, socket_) = Socket::createForFamily(AF_UNIX);
+    if (error) {
+      setError(std::move(error));
+      return;
+    }
+    error = socket_.connect(sockaddr_.value());
+    if (error) {
+      setError(std::move(error));
+      return;
+    }
+  }
+  // Ensure underlying socket is non-blocking such that it works well with
+  // event driven I/O.
+  error = socket_.block(false);
+  if (error) {
+    setError(std::move(error));
+    return;
+  }
+
+  recvBuffer_ = std::make_unique<char[]>(kRecvBufferSize);
+
+  // Start receiving right away, so that the data that comes before the first
+  // read, and the peer hanging up, are noticed.
+  updateRegisteredEventsFromLoop();
+}
+
+bool ConnectionImpl::usesMemfd(size_t length) const {
+  return length > 0 && length >= context_->getMemfdThreshold();
+}
+
+void ConnectionImpl::readImplFromLoop(read_callback_fn fn) {
+  readOperations_.emplace_back(std::move(fn));
+  readOperations_.back().setBufferPool(&readBufferPool_);
+  processReadOperationsFromLoop();
+}
+
+void ConnectionImpl::readImplFromLoop(
+    void* ptr,
+    size_t length,
+    read_callback_fn fn) {
+  readOperations_.emplace_back(ptr, length, std::move(fn));
+  processReadOperationsFromLoop();
+}
+
+void ConnectionImpl::writeImplFromLoop(
+    const void* ptr,
+    size_t length,
+    write_callback_fn fn) {
+  writeOperations_.emplace_back(ptr, length, std::move(fn));
+  processWriteOperationsFromLoop();
+}
+
+void ConnectionImpl::handleEventsFromLoop(int events) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(9) << "Connection " << id_ << " is handling an event on its socket ("
+             << EpollLoop::formatEpollEvents(events) << ")";
+
+  // Keep the error check first, as the socket could be both in an error state
+  // and readable or writable.
+  if (events & EPOLLERR) {
+    int error;
+    socklen_t errorlen = sizeof(error);
+    int rv = getsockopt(
+        socket_.fd(),
+        SOL_SOCKET,
+        SO_ERROR,
+        reinterpret_cast<void*>(&error),
+        &errorlen);
+    if (rv == -1) {
+      setError(TP_CREATE_ERROR(SystemError, "getsockopt", rv));
+    } else {
+      setError(TP_CREATE_ERROR(SystemError, "async error on socket", error));
+    }
+    return;
+  }
+  if (events & EPOLLOUT) {
+    waitingForWritable_ = false;
+    processWriteOperationsFromLoop();
+    if (error_) {
+      return;
+    }
+  }
+  if (events & EPOLLIN) {
+    processReadOperationsFromLoop();
+    if (error_) {
+      return;
+    }
+    // Get ahead of the next read while there's room in the buffer, as it's
+    // likely to come soon, and as the socket would otherwise stay readable.
+    if (readOperations_.empty() &&
+        recvBufferEnd_ - recvBufferBegin_ < kRecvBufferSize) {
+      recvFromLoop(nullptr, 0);
+      if (error_) {
+        return;
+      }
+    }
+  } else if (events & EPOLLHUP) {
+    // There could still be data to read when we get EPOLLHUP, in which case
+    // the socket is readable too, and we only fail once we've read all of it.
+    setError(TP_CREATE_ERROR(EOFError));
+    return;
+  }
+
+  updateRegisteredEventsFromLoop();
+}
+
+void ConnectionImpl::processReadOperationsFromLoop() {
+  while (!error_ && !readOperations_.empty()) {
+    StreamReadOperation& readOperation = readOperations_.front();
+    const optional<size_t> length = readOperation.lengthFromLoop();
+    if (readOperation.completeFromLoop()) {
+      // This happens for empty payloads, once their length has been read.
+    } else if (length.has_value() && usesMemfd(length.value())) {
+      readFromMemfdFromLoop(readOperation);
+      if (error_) {
+        return;
+      }
+    } else if (recvBufferBegin_ < recvBufferEnd_) {
+      const char* data = recvBuffer_.get() + recvBufferBegin_;
+      const size_t numBytesBuffered = recvBufferEnd_ - recvBufferBegin_;
+      if (readOperation.canReadInPlaceFromLoop(
+              /*streamIdx=*/0, numBytesBuffered)) {
+        // Nothing else touches the buffer until the callback returns, as the
+        // operations that it issues are deferred.
+        recvBufferBegin_ += length.value();
+        readOperation.readInPlaceFromLoop(/*streamIdx=*/0, data);
+      } else {
+        char* base;
+        size_t len;
+        readOperation.allocFromLoop(/*streamIdx=*/0, &base, &len);
+        const size_t numBytes = std::min(len, numBytesBuffered);
+        std::memcpy(base, data, numBytes);
+        readOperation.readFromLoop(/*streamIdx=*/0, numBytes);
+        recvBufferBegin_ += numBytes;
+      }
+    } else {
+      // Once the length is known the rest of the payload is received straight
+      // into its destination, together with what follows it into the buffer,
+      // unless it could be read in place from the latter.
+      char* base = nullptr;
+      size_t len = 0;
+      if (length.has_value() &&
+          !readOperation.canReadInPlaceFromLoop(
+              /*streamIdx=*/0, kRecvBufferSize)) {
+        readOperation.allocFromLoop(/*streamIdx=*/0, &base, &len);
+      }
+      const optional<size_t> numBytes = recvFromLoop(base, len);
+      if (error_ || !numBytes.has_value()) {
+        break;
+      }
+      if (numBytes.value() > 0) {
+        readOperation.readFromLoop(/*streamIdx=*/0, numBytes.value());
+      }
+    }
+
+    if (readOperation.completeFromLoop()) {
+      StreamReadOperation completedOperation = std::move(readOperation);
+      readOperations_.pop_front();
+      completedOperation.callbackFromLoop(Error::kSuccess);
+    }
+  }
+
+  if (!error_) {
+    updateRegisteredEventsFromLoop();
+  }
+}
+
+void ConnectionImpl::readFromMemfdFromLoop(
+    StreamReadOperation& readOperation) {
+  // The memfd comes with the first bytes of the send that carried the length,
+  // and thus it must have been received with them.
+  if (receivedMemfds_.empty()) {
+    setError(TP_CREATE_ERROR(
+        SystemError, "the peer didn't pass the memfd of a payload", EPROTO));
+    return;
+  }
+  Fd memfd = std::move(receivedMemfds_.front());
+  receivedMemfds_.pop_front();
+
+  char* base;
+  size_t len;
+  readOperation.allocFromLoop(/*streamIdx=*/0, &base, &len);
+  size_t offset = 0;
+  while (offset < len) {
+    auto rv = ::pread(memfd.fd(), base + offset, len - offset, offset);
+    if (rv == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      setError(TP_CREATE_ERROR(SystemError, "pread", errno));
+      return;
+    }
+    if (rv == 0) {
+      setError(TP_CREATE_ERROR(ShortReadError, len, offset));
+      return;
+    }
+    offset += rv;
+  }
+  readOperation.readFromLoop(/*streamIdx=*/0, len);
+}
+
+optional<size_t> ConnectionImpl::recvFromLoop(char* base, size_t len) {
+  // Make room at the end of the buffer.
+  if (recvBufferBegin_ == recvBufferEnd_) {
+    recvBufferBegin_ = 0;
+    recvBufferEnd_ = 0;
+  } else if (recvBufferEnd_ == kRecvBufferSize) {
+    std::memmove(
+        recvBuffer_.get(),
+        recvBuffer_.get() + recvBufferBegin_,
+        recvBufferEnd_ - recvBufferBegin_);
+    recvBufferEnd_ -= recvBufferBegin_;
+    recvBufferBegin_ = 0;
+  }
+
+  std::array<struct iovec, 2> iovecs;
+  size_t numIovecs = 0;
+  if (len > 0) {
+    iovecs[numIovecs++] = {base, len};
+  }
+  if (recvBufferEnd_ < kRecvBufferSize) {
+    iovecs[numIovecs++] = {
+        recvBuffer_.get() + recvBufferEnd_, kRecvBufferSize - recvBufferEnd_};
+  }
+  TP_DCHECK_GT(numIovecs, 0);
+
+  ControlBuffer control;
+  struct msghdr msg;
+  std::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iovecs.data();
+  msg.msg_iovlen = numIovecs;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+
+  ssize_t rv;
+  for (;;) {
+    rv = ::recvmsg(socket_.fd(), &msg, MSG_CMSG_CLOEXEC);
+    if (rv == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return nullopt;
+      }
+      setError(TP_CREATE_ERROR(SystemError, "recvmsg", errno));
+      return nullopt;
+    }
+    break;
+  }
+
+  // Take ownership of the memfds first, so that they're closed on error.
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    const size_t numFds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    const int* fds = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+    for (size_t fdIdx = 0; fdIdx < numFds; fdIdx++) {
+      receivedMemfds_.emplace_back(fds[fdIdx]);
+    }
+  }
+  if (msg.msg_flags & MSG_CTRUNC) {
+    setError(TP_CREATE_ERROR(
+        SystemError, "the peer passed too many memfds at once", EPROTO));
+    return nullopt;
+  }
+  if (rv == 0) {
+    setError(TP_CREATE_ERROR(EOFError));
+    return nullopt;
+  }
+
+  const size_t numBytesIntoBase = std::min(static_cast<size_t>(rv), len);
+  recvBufferEnd_ += rv - numBytesIntoBase;
+  return numBytesIntoBase;
+}
+
+void ConnectionImpl::processWriteOperationsFromLoop() {
+  while (!error_ && !waitingForWritable_ && !writeOperations_.empty()) {
+    // Gather the data of as many write operations as possible, so that the
+    // writes issued since the last send go out together. Only the lengths of
+    // the payloads that are handed over in memfds go through the socket.
+    sendIovecs_.clear();
+    size_t numBytesToSkip = numBytesSent_;
+    size_t numBytesToSend = 0;
+    for (size_t opIdx = 0; opIdx < writeOperations_.size(); opIdx++) {
+      StreamWriteOperation& writeOperation = writeOperations_[opIdx];
+      const bool memfd = usesMemfd(getPayloadLength(writeOperation));
+      StreamWriteOperation::Buf* bufs;
+      size_t numBufs;
+      std::tie(bufs, numBufs) = writeOperation.getBufs();
+      if (memfd) {
+        numBufs = 1;
+      }
+      if (sendIovecs_.size() + numBufs > kMaxNumIovecsPerSend) {
+        break;
+      }
+      if (opIdx == numWriteOperationsPrepared_) {
+        if (memfd) {
+          if (memfdsToSend_.size() == kMaxNumMemfdsPerSend) {
+            break;
+          }
+          copyToMemfdFromLoop(writeOperation);
+          if (error_) {
+            return;
+          }
+        }
+        numWriteOperationsPrepared_++;
+      }
+      for (size_t bufIdx = 0; bufIdx < numBufs; bufIdx++) {
+        const size_t skip = std::min(numBytesToSkip, bufs[bufIdx].len);
+        numBytesToSkip -= skip;
+        if (bufs[bufIdx].len > skip) {
+          sendIovecs_.push_back(
+              {bufs[bufIdx].base + skip, bufs[bufIdx].len - skip});
+          numBytesToSend += bufs[bufIdx].len - skip;
+        }
+      }
+    }
+    TP_DCHECK(!sendIovecs_.empty());
+
+    ControlBuffer control;
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = sendIovecs_.data();
+    msg.msg_iovlen = sendIovecs_.size();
+    if (!memfdsToSend_.empty()) {
+      msg.msg_control = control.data();
+      msg.msg_controllen = CMSG_SPACE(sizeof(int) * memfdsToSend_.size());
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int) * memfdsToSend_.size());
+      int* fds = reinterpret_cast<int*>(CMSG_DATA(cmsg));
+      for (size_t fdIdx = 0; fdIdx < memfdsToSend_.size(); fdIdx++) {
+        fds[fdIdx] = memfdsToSend_[fdIdx].fd();
+      }
+    }
+
+    ssize_t rv;
+    for (;;) {
+      rv = ::sendmsg(socket_.fd(), &msg, MSG_NOSIGNAL);
+      if (rv == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          break;
+        }
+        setError(TP_CREATE_ERROR(SystemError, "sendmsg", errno));
+        return;
+      }
+      break;
+    }
+    if (rv == -1) {
+      waitingForWritable_ = true;
+      break;
+    }
+
+    TP_VLOG(9) << "Connection " << id_ << " has sent " << rv << " bytes";
+
+    // The peer got its own copies of the memfds, along with the first byte.
+    memfdsToSend_.clear();
+    if (static_cast<size_t>(rv) < numBytesToSend) {
+      waitingForWritable_ = true;
+    }
+
+    // Settle the state before calling back, as the user may write again.
+    std::vector<StreamWriteOperation> completedOperations;
+    size_t numBytes = numBytesSent_ + rv;
+    while (!writeOperations_.empty()) {
+      StreamWriteOperation& writeOperation = writeOperations_.front();
+      const size_t payloadLength = getPayloadLength(writeOperation);
+      const size_t length = getHeaderLength(writeOperation) +
+          (usesMemfd(payloadLength) ? 0 : payloadLength);
+      if (numBytes < length) {
+        break;
+      }
+      numBytes -= length;
+      completedOperations.push_back(std::move(writeOperation));
+      writeOperations_.pop_front();
+      numWriteOperationsPrepared_--;
+    }
+    numBytesSent_ = numBytes;
+
+    for (StreamWriteOperation& writeOperation : completedOperations) {
+      writeOperation.callbackFromLoop(Error::kSuccess);
+    }
+  }
+
+  if (!error_) {
+    updateRegisteredEventsFromLoop();
+  }
+}
+
+void ConnectionImpl::copyToMemfdFromLoop(StreamWriteOperation& writeOperation) {
+  StreamWriteOperation::Buf* bufs;
+  size_t numBufs;
+  std::tie(bufs, numBufs) = writeOperation.getBufs();
+  TP_DCHECK_EQ(numBufs, 2);
+  const char* base = bufs[1].base;
+  const size_t len = bufs[1].len;
+
+  int fd = ::memfd_create("tensorpipe-uds", MFD_CLOEXEC);
+  if (fd < 0) {
+    setError(TP_CREATE_ERROR(SystemError, "memfd_create", errno));
+    return;
+  }
+  Fd memfd(fd);
+  size_t offset = 0;
+  while (offset < len) {
+    auto rv = ::pwrite(memfd.fd(), base + offset, len - offset, offset);
+    if (rv == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      setError(TP_CREATE_ERROR(SystemError, "pwrite", errno));
+      return;
+    }
+    offset += rv;
+  }
+  memfdsToSend_.push_back(std::move(memfd));
+}
+
+void ConnectionImpl::updateRegisteredEventsFromLoop() {
+  int events = 0;
+  // Unless the buffer is full, in which case only a read operation can make
+  // room in it.
+  if (!readOperations_.empty() ||
+      recvBufferEnd_ - recvBufferBegin_ < kRecvBufferSize) {
+    events |= EPOLLIN;
+  }
+  if (waitingForWritable_) {
+    events |= EPOLLOUT;
+  }
+  if (events == registeredEvents_) {
+    return;
+  }
+  if (events == 0) {
+    context_->unregisterDescriptor(socket_.fd());
+  } else {
+    context_->registerDescriptor(socket_.fd(), events, shared_from_this());
+  }
+  registeredEvents_ = events;
+}
+
+void ConnectionImpl::handleErrorImpl() {
+  if (registeredEvents_ != 0) {
+    context_->unregisterDescriptor(socket_.fd());
+    registeredEvents_ = 0;
+  }
+
+  std::deque<StreamReadOperation> readOperations;
+  std::swap(readOperations, readOperations_);
+  for (auto& readOperation : readOperations) {
+    readOperation.callbackFromLoop(error_);
+  }
+  std::deque<StreamWriteOperation> writeOperations;
+  std::swap(writeOperations, writeOperations_);
+  for (auto& writeOperation : writeOperations) {
+    writeOperation.callbackFromLoop(error_);
+  }
+
+  receivedMemfds_.clear();
+  memfdsToSend_.clear();
+  socket_.reset();
+
+  context_->unenroll(*this);
+}
+
+} // namespace uds
+} // namespace transport
+} // namespace tensorpipe
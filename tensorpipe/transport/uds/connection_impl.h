@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/common/epoll_loop.h>
+#include <tensorpipe/common/fd.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/socket.h>
+#include <tensorpipe/common/read_buffer_pool.h>
+#include <tensorpipe/common/stream_read_write_ops.h>
+#include <tensorpipe/transport/connection_impl_boilerplate.h>
+#include <tensorpipe/transport/uds/sockaddr.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uds {
+
+class ContextImpl;
+class ListenerImpl;
+
+class ConnectionImpl final : public ConnectionImplBoilerplate<
+                                 ContextImpl,
+                                 ListenerImpl,
+                                 ConnectionImpl>,
+                             public EpollLoop::EventHandler {
+ public:
+  // Create a connection that is already connected (e.g. from a listener).
+  ConnectionImpl(
+      ConstructorToken token,
+      std::shared_ptr<ContextImpl> context,
+      std::string id,
+      Socket socket);
+
+  // Create a connection that connects to the specified address.
+  ConnectionImpl(
+      ConstructorToken token,
+      std::shared_ptr<ContextImpl> context,
+      std::string id,
+      std::string addr);
+
+  // Implementation of EventHandler.
+  void handleEventsFromLoop(int events) override;
+
+ protected:
+  // Implement the entry points called by ConnectionImplBoilerplate.
+  void initImplFromLoop() override;
+  void readImplFromLoop(read_callback_fn fn) override;
+  void readImplFromLoop(void* ptr, size_t length, read_callback_fn fn) override;
+  void writeImplFromLoop(const void* ptr, size_t length, write_callback_fn fn)
+      override;
+  void handleErrorImpl() override;
+
+ private:
+  Socket socket_;
+  optional<Sockaddr> sockaddr_;
+
+  // The events for which the socket is currently registered with the loop (or
+  // zero if it isn't).
+  int registeredEvents_{0};
+
+  // Recycles the buffers of the reads that weren't given a destination. It must
+  // outlive the read operations, hence it's declared before them.
+  ReadBufferPool readBufferPool_;
+
+  // Pending read operations.
+  std::deque<StreamReadOperation> readOperations_;
+
+  // The data received from the socket that hasn't been consumed yet, which is
+  // the range [recvBufferBegin_, recvBufferEnd_) of this buffer. The lengths
+  // and the small payloads are received into it, many at once, and then copied
+  // to their destination, whereas the large payloads are received straight
+  // into their destination (along with what follows them, into here).
+  std::unique_ptr<char[]> recvBuffer_;
+  size_t recvBufferBegin_{0};
+  size_t recvBufferEnd_{0};
+
+  // The memfds received from the peer whose payloads haven't been read yet, in
+  // the order of the read operations they belong to.
+  std::deque<Fd> receivedMemfds_;
+
+  // Pending write operations. The data of as many of them as possible is
+  // handed to the kernel in a single sendmsg, which may be partial: its first
+  // numBytesSent_ bytes were sent already.
+  std::deque<StreamWriteOperation> writeOperations_;
+  size_t numBytesSent_{0};
+  // How many of the write operations at the front of the queue had their
+  // payloads copied into a memfd already, if they needed to.
+  size_t numWriteOperationsPrepared_{0};
+  // The memfds that were created for these operations but that weren't passed
+  // to the peer yet, which happens with the first bytes they're sent with.
+  std::deque<Fd> memfdsToSend_;
+  // Whether the last send didn't take all the data, and thus the connection is
+  // waiting for the socket to become writable again.
+  bool waitingForWritable_{false};
+
+  // Reused across the sends and receives, to avoid allocating.
+  std::vector<struct iovec> sendIovecs_;
+
+  // Whether a payload of the given length is handed over in a memfd.
+  bool usesMemfd(size_t length) const;
+
+  // Copy the data that was received into the buffer to the read operations,
+  // and receive more of it from the socket, until it runs out or there are no
+  // more read operations.
+  void processReadOperationsFromLoop();
+
+  // Called when the payload of the read operation at the front of the queue
+  // is in a memfd, to read it from there.
+  void readFromMemfdFromLoop(StreamReadOperation& readOperation);
+
+  // Receive from the socket into the buffer and, if given, into the chunk of a
+  // destination before it. Return how many bytes went into the latter, or
+  // nothing if no data was available.
+  optional<size_t> recvFromLoop(char* base, size_t len);
+
+  // Send the data of the pending write operations, until they run out or the
+  // socket stops accepting it.
+  void processWriteOperationsFromLoop();
+
+  // Copy the payload of the write operation into a new memfd, to send it along.
+  void copyToMemfdFromLoop(StreamWriteOperation& writeOperation);
+
+  // Register the socket for the events that the connection is waiting for.
+  void updateRegisteredEventsFromLoop();
+};
+
+} // namespace uds
+} // namespace transport
+} // namespace tensorpipe
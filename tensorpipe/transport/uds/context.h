@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/common/thread_options.h>
+#include <tensorpipe/transport/context.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uds {
+
+class ContextImpl;
+
+// The default time for which the reactor keeps polling after its last event.
+constexpr std::chrono::microseconds kDefaultSpinDuration{0};
+
+// The default size from which the payloads are handed over in a memfd, see
+// below.
+constexpr size_t kDefaultMemfdThreshold = 1024 * 1024;
+
+class Context : public transport::Context {
+ public:
+  // The connections go over UNIX domain sockets, hence they only work between
+  // processes of the same machine and network namespace. Their events are
+  // handled by a reactor, which goes to sleep as soon as it has been idle for
+  // spinDuration, until it's woken up by the next event. Unlike with the shm
+  // transport, this is the default, so that an idle context costs no CPU at
+  // all, whereas a longer spin duration saves the wakeups of the reactor when
+  // the events come in quick succession. The threads of the reactor and of the
+  // epoll loop are set up according to threadOptions.
+  //
+  // The payloads of at least memfdThreshold bytes don't go through the socket,
+  // which would need many round trips for them: they are copied into a memfd,
+  // which is passed to the peer along with their length, and from which the
+  // peer then reads them. Pass the maximum size to always send them inline.
+  // Both ends must use the same threshold, and the domain descriptor reflects
+  // it so that pipes only pick compatible contexts.
+  explicit Context(
+      std::chrono::microseconds spinDuration = kDefaultSpinDuration,
+      size_t memfdThreshold = kDefaultMemfdThreshold,
+      ThreadOptions threadOptions = ThreadOptions());
+
+  Context(const Context&) = delete;
+  Context(Context&&) = delete;
+  Context& operator=(const Context&) = delete;
+  Context& operator=(Context&&) = delete;
+
+  std::shared_ptr<Connection> connect(std::string addr) override;
+
+  std::shared_ptr<Listener> listen(std::string addr) override;
+
+  bool isViable() const override;
+
+  const std::string& domainDescriptor() const override;
+
+  void setId(std::string id) override;
+
+  void enableLoopStats() override;
+
+  std::map<std::string, LoopStats> getLoopStats() override;
+
+  TransportStats getTransportStats() override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it (downcast as a shared_ptr to the private
+  // interface). However, its lifetime is tied to the one of this public object,
+  // since when the latter is destroyed the implementation is closed and joined.
+  const std::shared_ptr<ContextImpl> impl_;
+};
+
+} // namespace uds
+} // namespace transport
+} // namespace tensorpipe
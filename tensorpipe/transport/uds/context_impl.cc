@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uds/context_impl.h>
+
+#include <linux/memfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <tuple>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/system.h>
+#include <tensorpipe/transport/uds/connection_impl.h>
+#include <tensorpipe/transport/uds/listener_impl.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uds {
+
+namespace {
+
+// Prepend descriptor with transport name so it's easy to
+// disambiguate descriptors when debugging.
+const std::string kDomainDescriptorPrefix{"uds:"};
+
+constexpr size_t kNoMemfdThreshold = std::numeric_limits<size_t>::max();
+
+// Some restrictions (e.g., seccomp filters, or old kernels) may prevent us from
+// creating memfds, hence let's create one here to see if it works, and else
+// send all the payloads inline.
+bool canCreateMemfds() {
+  int fd = ::memfd_create("tensorpipe-uds", MFD_CLOEXEC);
+  if (fd < 0) {
+    TP_VLOG(8) << "Couldn't create a memfd: " << strerror(errno);
+    return false;
+  }
+  ::close(fd);
+  return true;
+}
+
+std::tuple<bool, std::string> determineViabilityAndGenerateDomainDescriptor(
+    size_t memfdThreshold) {
+  std::ostringstream oss;
+  oss << kDomainDescriptorPrefix;
+
+  // This transport only works across processes on the same machine, and we
+  // detect that by computing the boot ID.
+  auto bootID = getBootID();
+  if (!bootID.has_value()) {
+    TP_VLOG(8) << "Unable to read boot_id";
+    return std::make_tuple(false, std::string());
+  }
+  oss << bootID.value();
+
+  // The listeners use "abstract" addresses (i.e., just identifiers, which are
+  // not materialized to filesystem paths), hence the two endpoints must be in
+  // the same Linux kernel network namespace (see network_namespaces(7)).
+  auto nsID = getLinuxNamespaceId(LinuxNamespace::kNet);
+  if (!nsID.has_value()) {
+    TP_VLOG(8) << "Unable to read net namespace ID";
+    return std::make_tuple(false, std::string());
+  }
+  oss << '_' << nsID.value();
+
+  // The receiver tells the payloads that come in a memfd by their length.
+  if (memfdThreshold != kNoMemfdThreshold) {
+    oss << "_memfd" << memfdThreshold;
+  }
+
+  std::string domainDescriptor = oss.str();
+  TP_VLOG(8) << "The domain descriptor for UDS is " << domainDescriptor;
+  return std::make_tuple(true, std::move(domainDescriptor));
+}
+
+} // namespace
+
+std::shared_ptr<ContextImpl> ContextImpl::create(
+    std::chrono::microseconds spinDuration,
+    size_t memfdThreshold,
+    ThreadOptions threadOptions) {
+  if (memfdThreshold != kNoMemfdThreshold && !canCreateMemfds()) {
+    memfdThreshold = kNoMemfdThreshold;
+  }
+  bool isViable;
+  std::string domainDescriptor;
+  std::tie(isViable, domainDescriptor) =
+      determineViabilityAndGenerateDomainDescriptor(memfdThreshold);
+  return std::make_shared<ContextImpl>(
+      isViable,
+      std::move(domainDescriptor),
+      spinDuration,
+      memfdThreshold,
+      std::move(threadOptions));
+}
+
+ContextImpl::ContextImpl(
+    bool isViable,
+    std::string domainDescriptor,
+    std::chrono::microseconds spinDuration,
+    size_t memfdThreshold,
+    ThreadOptions threadOptions)
+    : ContextImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
+          std::move(domainDescriptor)),
+      isViable_(isViable),
+      memfdThreshold_(memfdThreshold),
+      reactor_(spinDuration, threadOptions),
+      loop_(reactor_, threadOptions) {}
+
+bool ContextImpl::isViable() const {
+  return isViable_;
+}
+
+size_t ContextImpl::getMemfdThreshold() const {
+  return memfdThreshold_;
+}
+
+void ContextImpl::closeImpl() {
+  loop_.close();
+  reactor_.close();
+}
+
+void ContextImpl::joinImpl() {
+  loop_.join();
+  reactor_.join();
+}
+
+bool ContextImpl::inLoop() {
+  return reactor_.inLoop();
+};
+
+void ContextImpl::deferToLoop(TTask fn) {
+  reactor_.deferToLoop(std::move(fn));
+};
+
+void ContextImpl::enableLoopStats() {
+  reactor_.enableStats();
+  loop_.enableStats();
+}
+
+std::map<std::string, LoopStats> ContextImpl::getLoopStats() {
+  return {{"reactor", reactor_.getStats()}, {"epoll", loop_.getStats()}};
+}
+
+void ContextImpl::registerDescriptor(
+    int fd,
+    int events,
+    std::shared_ptr<EpollLoop::EventHandler> h) {
+  loop_.registerDescriptor(fd, events, std::move(h));
+}
+
+void ContextImpl::unregisterDescriptor(int fd) {
+  loop_.unregisterDescriptor(fd);
+}
+
+} // namespace uds
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/common/epoll_loop.h>
+#include <tensorpipe/transport/context_impl_boilerplate.h>
+#include <tensorpipe/transport/uds/reactor.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uds {
+
+class ConnectionImpl;
+class ListenerImpl;
+
+class ContextImpl final
+    : public ContextImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl> {
+ public:
+  static std::shared_ptr<ContextImpl> create(
+      std::chrono::microseconds spinDuration,
+      size_t memfdThreshold,
+      ThreadOptions threadOptions);
+
+  ContextImpl(
+      bool isViable,
+      std::string domainDescriptor,
+      std::chrono::microseconds spinDuration,
+      size_t memfdThreshold,
+      ThreadOptions threadOptions);
+
+  bool isViable() const;
+
+  // Implement the DeferredExecutor interface.
+  bool inLoop() override;
+  void deferToLoop(TTask fn) override;
+
+  void enableLoopStats();
+
+  std::map<std::string, LoopStats> getLoopStats();
+
+  void registerDescriptor(
+      int fd,
+      int events,
+      std::shared_ptr<EpollLoop::EventHandler> h);
+
+  void unregisterDescriptor(int fd);
+
+  // The size from which the payloads are handed over in a memfd.
+  size_t getMemfdThreshold() const;
+
+ protected:
+  // Implement the entry points called by ContextImplBoilerplate.
+  void closeImpl() override;
+  void joinImpl() override;
+
+ private:
+  const bool isViable_;
+  const size_t memfdThreshold_;
+
+  Reactor reactor_;
+  // Integrated with the reactor, which polls epoll and runs the handlers.
+  EpollLoop loop_;
+};
+
+} // namespace uds
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uds/reactor.h>
+
+#include <utility>
+
+namespace tensorpipe {
+namespace transport {
+namespace uds {
+
+namespace {
+
+// All events are notified (both the ones of epoll and deferred functions),
+// hence the reactor could sleep indefinitely. This is merely a safety net.
+constexpr std::chrono::microseconds kSleepDuration = std::chrono::seconds(1);
+
+} // namespace
+
+Reactor::Reactor(
+    std::chrono::microseconds spinDuration,
+    ThreadOptions threadOptions)
+    : BusyPollingLoop(spinDuration, kSleepDuration) {
+  startThread("TP_UDS_reactor", std::move(threadOptions));
+}
+
+void Reactor::close() {
+  if (!closed_.exchange(true)) {
+    stopBusyPolling();
+  }
+}
+
+void Reactor::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    joinThread();
+  }
+}
+
+Reactor::~Reactor() {
+  join();
+}
+
+bool Reactor::pollOnce() {
+  return false;
+}
+
+bool Reactor::readyToClose() {
+  // The epoll loop, which holds the handlers, stays attached until they're all
+  // gone, and the loop doesn't terminate before that.
+  return true;
+}
+
+} // namespace uds
+} // namespace transport
+} // namespace tensorpipe
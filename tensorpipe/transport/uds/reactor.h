@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+#include <tensorpipe/common/busy_polling_loop.h>
+#include <tensorpipe/common/thread_options.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uds {
+
+// Reactor loop.
+//
+// It has no events of its own: it only runs the deferred functions and, as it
+// polls it, the epoll loop that's integrated with it, which wake it up when it
+// sleeps. It sleeps once it has been idle for longer than the spin duration.
+class Reactor final : public BusyPollingLoop {
+ public:
+  Reactor(
+      std::chrono::microseconds spinDuration,
+      ThreadOptions threadOptions = ThreadOptions());
+
+  void close();
+
+  void join();
+
+  ~Reactor();
+
+ protected:
+  bool pollOnce() override;
+
+  bool readyToClose() override;
+
+ private:
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+};
+
+} // namespace uds
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,452 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uring/connection_impl.h>
+
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/socket.h>
+#include <tensorpipe/common/stream_read_write_ops.h>
+#include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/uring/context_impl.h>
+#include <tensorpipe/transport/uring/ring.h>
+#include <tensorpipe/transport/uring/sockaddr.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uring {
+
+namespace {
+
+// While no read operation is pending the connection keeps receiving into the
+// provided buffers, as the next read is likely to come soon, but it stops once
+// it holds this many of them, to leave the others to the other connections.
+constexpr size_t kMaxNumBufferedChunks = 16;
+
+// The kernel rejects the messages with more buffers than this (UIO_MAXIOV).
+constexpr size_t kMaxNumIovecsPerSend = 1024;
+
+// The length of a single receive, which the kernel holds in 32 bits.
+constexpr size_t kMaxDirectRecvLength = 1 << 30;
+
+size_t getTotalLength(StreamWriteOperation& writeOperation) {
+  StreamWriteOperation::Buf* bufs;
+  size_t numBufs;
+  std::tie(bufs, numBufs) = writeOperation.getBufs();
+  size_t length = 0;
+  for (size_t bufIdx = 0; bufIdx < numBufs; bufIdx++) {
+    length += bufs[bufIdx].len;
+  }
+  return length;
+}
+
+} // namespace
+
+ConnectionImpl::ConnectionImpl(
+    ConstructorToken token,
+    std::shared_ptr<ContextImpl> context,
+    std::string id,
+    Socket socket)
+    : ConnectionImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
+          token,
+          std::move(context),
+          std::move(id)),
+      socket_(std::move(socket)) {}
+
+ConnectionImpl::ConnectionImpl(
+    ConstructorToken token,
+    std::shared_ptr<ContextImpl> context,
+    std::string id,
+    std::string addr)
+    : ConnectionImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
+          token,
+          std::move(context),
+          std::move(id)),
+      sockaddr_(Sockaddr::createInetSockAddr(addr)) {}
+
+void ConnectionImpl::initImplFromLoop() {
+  context_->enroll(*this);
+
+  // The connection either got a socket or an address, but not both.
+  TP_DCHECK(socket_.hasValue() ^ sockaddr_.has_value());
+  if (socket_.hasValue()) {
+    onConnectedFromLoop();
+    return;
+  }
+
+  Error error;
+  std::tie(error, socket_) =
+      Socket::createForFamily(sockaddr_->addr()->sa_family);
+  if (error) {
+    setError(std::move(error));
+    return;
+  }
+
+  state_ = CONNECTING;
+  struct io_uring_sqe& sqe = context_->getRing().prepareFromLoop(
+      [impl{shared_from_this()}](int res, uint32_t /* unused */) {
+        impl->numOperationsInFlight_--;
+        if (impl->error_) {
+          impl->tryCleanupFromLoop();
+          return;
+        }
+        if (res < 0) {
+          impl->setError(TP_CREATE_ERROR(SystemError, "connect", -res));
+          return;
+        }
+        impl->onConnectedFromLoop();
+      });
+  sqe.opcode = IORING_OP_CONNECT;
+  sqe.fd = socket_.fd();
+  sqe.addr = reinterpret_cast<uint64_t>(sockaddr_->addr());
+  sqe.off = sockaddr_->addrlen();
+  numOperationsInFlight_++;
+}
+
+void ConnectionImpl::onConnectedFromLoop() {
+  TP_VLOG(9) << "Connection " << id_ << " is established";
+
+  // The messages usually come in several small writes, which must not wait.
+  int flag = 1;
+  auto rv = ::setsockopt(
+      socket_.fd(), IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  if (rv < 0) {
+    setError(TP_CREATE_ERROR(SystemError, "setsockopt", errno));
+    return;
+  }
+
+  state_ = ESTABLISHED;
+  processWriteOperationsFromLoop();
+  processReadOperationsFromLoop();
+}
+
+void ConnectionImpl::readImplFromLoop(read_callback_fn fn) {
+  readOperations_.emplace_back(std::move(fn));
+  readOperations_.back().setBufferPool(&readBufferPool_);
+  processReadOperationsFromLoop();
+}
+
+void ConnectionImpl::readImplFromLoop(
+    void* ptr,
+    size_t length,
+    read_callback_fn fn) {
+  readOperations_.emplace_back(ptr, length, std::move(fn));
+  processReadOperationsFromLoop();
+}
+
+void ConnectionImpl::writeImplFromLoop(
+    const void* ptr,
+    size_t length,
+    write_callback_fn fn) {
+  writeOperations_.emplace_back(ptr, length, std::move(fn));
+  processWriteOperationsFromLoop();
+}
+
+void ConnectionImpl::processReadOperationsFromLoop() {
+  Ring& ring = context_->getRing();
+  // The user callbacks may queue new read operations, and thus come back here,
+  // hence the state is updated before calling each of them.
+  while (!error_ && !readOperations_.empty() && !chunks_.empty()) {
+    TP_DCHECK_NE(recvState_, RECV_DIRECT);
+    StreamReadOperation& readOperation = readOperations_.front();
+    Chunk& chunk = chunks_.front();
+    char* base;
+    size_t len;
+    readOperation.allocFromLoop(/*streamIdx=*/0, &base, &len);
+    const size_t length = std::min(len, chunk.length);
+    std::memcpy(
+        base, ring.getBufferFromLoop(chunk.bufferId) + chunk.offset, length);
+    readOperation.readFromLoop(/*streamIdx=*/0, length);
+    chunk.offset += length;
+    chunk.length -= length;
+    if (chunk.length == 0) {
+      ring.recycleBufferFromLoop(chunk.bufferId);
+      chunks_.pop_front();
+    }
+    if (readOperation.completeFromLoop()) {
+      StreamReadOperation completedOperation = std::move(readOperation);
+      readOperations_.pop_front();
+      completedOperation.callbackFromLoop(Error::kSuccess);
+    }
+  }
+
+  updateRecvFromLoop();
+}
+
+void ConnectionImpl::updateRecvFromLoop() {
+  if (state_ != ESTABLISHED || error_ || recvState_ == RECV_CANCELLING ||
+      recvState_ == RECV_DIRECT) {
+    return;
+  }
+
+  Ring& ring = context_->getRing();
+  if (readOperations_.empty()) {
+    if (recvState_ == RECV_MULTISHOT &&
+        chunks_.size() >= kMaxNumBufferedChunks) {
+      ring.cancelFromLoop(multishotUserData_);
+      recvState_ = RECV_CANCELLING;
+    }
+    return;
+  }
+
+  // All the data that was received was consumed, else there would be no more
+  // read operations.
+  TP_DCHECK(chunks_.empty());
+  char* base;
+  size_t len;
+  readOperations_.front().allocFromLoop(/*streamIdx=*/0, &base, &len);
+  if (len >= ring.getBufferSize()) {
+    // Copying so much data through the provided buffers isn't worth it, but the
+    // multishot receive must first be stopped, as it could get some of it.
+    if (recvState_ == RECV_MULTISHOT) {
+      ring.cancelFromLoop(multishotUserData_);
+      recvState_ = RECV_CANCELLING;
+      return;
+    }
+    postDirectRecvFromLoop(base, len);
+  } else if (recvState_ == RECV_IDLE && !waitingForBuffers_) {
+    armMultishotRecvFromLoop();
+  }
+}
+
+void ConnectionImpl::armMultishotRecvFromLoop() {
+  TP_VLOG(9) << "Connection " << id_ << " is starting a multishot receive";
+  struct io_uring_sqe& sqe = context_->getRing().prepareFromLoop(
+      [impl{shared_from_this()}](int res, uint32_t flags) {
+        impl->onMultishotRecvFromLoop(res, flags);
+      });
+  sqe.opcode = IORING_OP_RECV;
+  sqe.fd = socket_.fd();
+  sqe.ioprio = IORING_RECV_MULTISHOT;
+  sqe.flags = IOSQE_BUFFER_SELECT;
+  sqe.buf_group = kBufferGroupId;
+  multishotUserData_ = sqe.user_data;
+  numOperationsInFlight_++;
+  recvState_ = RECV_MULTISHOT;
+}
+
+void ConnectionImpl::onMultishotRecvFromLoop(int res, uint32_t flags) {
+  Ring& ring = context_->getRing();
+  if (flags & IORING_CQE_F_BUFFER) {
+    const uint16_t bufferId = flags >> IORING_CQE_BUFFER_SHIFT;
+    if (res > 0 && !error_) {
+      chunks_.push_back(Chunk{bufferId, 0, static_cast<size_t>(res)});
+    } else {
+      ring.recycleBufferFromLoop(bufferId);
+    }
+  }
+  if (!(flags & IORING_CQE_F_MORE)) {
+    TP_VLOG(9) << "Connection " << id_ << " is done with a multishot receive";
+    numOperationsInFlight_--;
+    recvState_ = RECV_IDLE;
+  }
+
+  if (error_) {
+    tryCleanupFromLoop();
+    return;
+  }
+  if (res == 0) {
+    setError(TP_CREATE_ERROR(EOFError));
+    return;
+  }
+  if (res == -ENOBUFS) {
+    // All the buffers are in use, by this connection or by others.
+    TP_VLOG(9) << "Connection " << id_ << " is waiting for buffers";
+    waitingForBuffers_ = true;
+    ring.waitForBuffersFromLoop([impl{shared_from_this()}]() {
+      impl->waitingForBuffers_ = false;
+      impl->updateRecvFromLoop();
+    });
+  } else if (res < 0 && res != -ECANCELED) {
+    setError(TP_CREATE_ERROR(SystemError, "recv", -res));
+    return;
+  }
+
+  processReadOperationsFromLoop();
+}
+
+void ConnectionImpl::postDirectRecvFromLoop(char* base, size_t len) {
+  TP_VLOG(9) << "Connection " << id_ << " is receiving " << len
+             << " bytes directly";
+  struct io_uring_sqe& sqe = context_->getRing().prepareFromLoop(
+      [impl{shared_from_this()}](int res, uint32_t /* unused */) {
+        impl->onDirectRecvFromLoop(res);
+      });
+  sqe.opcode = IORING_OP_RECV;
+  sqe.fd = socket_.fd();
+  sqe.addr = reinterpret_cast<uint64_t>(base);
+  sqe.len = std::min(len, kMaxDirectRecvLength);
+  sqe.msg_flags = MSG_WAITALL;
+  numOperationsInFlight_++;
+  recvState_ = RECV_DIRECT;
+}
+
+void ConnectionImpl::onDirectRecvFromLoop(int res) {
+  numOperationsInFlight_--;
+  recvState_ = RECV_IDLE;
+
+  if (error_) {
+    tryCleanupFromLoop();
+    return;
+  }
+  if (res == 0) {
+    setError(TP_CREATE_ERROR(EOFError));
+    return;
+  }
+  if (res < 0) {
+    setError(TP_CREATE_ERROR(SystemError, "recv", -res));
+    return;
+  }
+
+  StreamReadOperation& readOperation = readOperations_.front();
+  readOperation.readFromLoop(/*streamIdx=*/0, res);
+  if (readOperation.completeFromLoop()) {
+    StreamReadOperation completedOperation = std::move(readOperation);
+    readOperations_.pop_front();
+    completedOperation.callbackFromLoop(Error::kSuccess);
+  }
+
+  processReadOperationsFromLoop();
+}
+
+void ConnectionImpl::processWriteOperationsFromLoop() {
+  if (state_ != ESTABLISHED || error_ || sendInFlight_ ||
+      writeOperations_.empty()) {
+    return;
+  }
+
+  // Gather the data of as many write operations as possible, so that the
+  // writes issued since the last send go out together.
+  sendIovecs_.clear();
+  size_t numBytesToSkip = numBytesSent_;
+  for (StreamWriteOperation& writeOperation : writeOperations_) {
+    StreamWriteOperation::Buf* bufs;
+    size_t numBufs;
+    std::tie(bufs, numBufs) = writeOperation.getBufs();
+    if (sendIovecs_.size() + numBufs > kMaxNumIovecsPerSend) {
+      break;
+    }
+    for (size_t bufIdx = 0; bufIdx < numBufs; bufIdx++) {
+      const size_t skip = std::min(numBytesToSkip, bufs[bufIdx].len);
+      numBytesToSkip -= skip;
+      if (bufs[bufIdx].len > skip) {
+        sendIovecs_.push_back(
+            {bufs[bufIdx].base + skip, bufs[bufIdx].len - skip});
+      }
+    }
+  }
+  TP_DCHECK(!sendIovecs_.empty());
+
+  std::memset(&sendMsg_, 0, sizeof(sendMsg_));
+  sendMsg_.msg_iov = sendIovecs_.data();
+  sendMsg_.msg_iovlen = sendIovecs_.size();
+
+  struct io_uring_sqe& sqe = context_->getRing().prepareFromLoop(
+      [impl{shared_from_this()}](int res, uint32_t /* unused */) {
+        impl->onSendFromLoop(res);
+      });
+  sqe.opcode = IORING_OP_SENDMSG;
+  sqe.fd = socket_.fd();
+  sqe.addr = reinterpret_cast<uint64_t>(&sendMsg_);
+  sqe.len = 1;
+  sqe.msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+  numOperationsInFlight_++;
+  sendInFlight_ = true;
+}
+
+void ConnectionImpl::onSendFromLoop(int res) {
+  numOperationsInFlight_--;
+  sendInFlight_ = false;
+
+  if (error_) {
+    tryCleanupFromLoop();
+    return;
+  }
+  if (res < 0) {
+    setError(TP_CREATE_ERROR(SystemError, "sendmsg", -res));
+    return;
+  }
+
+  TP_VLOG(9) << "Connection " << id_ << " has sent " << res << " bytes";
+
+  // Settle the state before calling back, as the user may write again, which
+  // could then start another send.
+  std::vector<StreamWriteOperation> completedOperations;
+  size_t numBytes = numBytesSent_ + res;
+  while (!writeOperations_.empty()) {
+    const size_t length = getTotalLength(writeOperations_.front());
+    if (numBytes < length) {
+      break;
+    }
+    numBytes -= length;
+    completedOperations.push_back(std::move(writeOperations_.front()));
+    writeOperations_.pop_front();
+  }
+  numBytesSent_ = numBytes;
+
+  for (StreamWriteOperation& writeOperation : completedOperations) {
+    writeOperation.callbackFromLoop(Error::kSuccess);
+  }
+
+  processWriteOperationsFromLoop();
+}
+
+void ConnectionImpl::handleErrorImpl() {
+  // The operations in flight may still access the user's buffers, hence their
+  // callbacks can only be fired once the kernel is done with all of them.
+  if (numOperationsInFlight_ > 0) {
+    context_->getRing().cancelFdFromLoop(socket_.fd());
+  }
+
+  tryCleanupFromLoop();
+}
+
+void ConnectionImpl::tryCleanupFromLoop() {
+  if (!error_ || cleanedUp_ || numOperationsInFlight_ > 0) {
+    return;
+  }
+  cleanedUp_ = true;
+  TP_VLOG(8) << "Connection " << id_ << " is cleaning up";
+
+  for (const Chunk& chunk : chunks_) {
+    context_->getRing().recycleBufferFromLoop(chunk.bufferId);
+  }
+  chunks_.clear();
+
+  std::deque<StreamReadOperation> readOperations;
+  std::swap(readOperations, readOperations_);
+  for (auto& readOperation : readOperations) {
+    readOperation.callbackFromLoop(error_);
+  }
+  std::deque<StreamWriteOperation> writeOperations;
+  std::swap(writeOperations, writeOperations_);
+  for (auto& writeOperation : writeOperations) {
+    writeOperation.callbackFromLoop(error_);
+  }
+
+  socket_.reset();
+
+  context_->unenroll(*this);
+}
+
+} // namespace uring
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/socket.h>
+#include <tensorpipe/common/read_buffer_pool.h>
+#include <tensorpipe/common/stream_read_write_ops.h>
+#include <tensorpipe/transport/connection_impl_boilerplate.h>
+#include <tensorpipe/transport/uring/sockaddr.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uring {
+
+class ContextImpl;
+class ListenerImpl;
+
+class ConnectionImpl final : public ConnectionImplBoilerplate<
+                                 ContextImpl,
+                                 ListenerImpl,
+                                 ConnectionImpl> {
+  enum State {
+    INITIALIZING = 1,
+    CONNECTING,
+    ESTABLISHED,
+  };
+
+  // How the socket is being read from.
+  enum RecvState {
+    // Not at all.
+    RECV_IDLE = 1,
+    // Through a multishot receive into the provided buffers.
+    RECV_MULTISHOT,
+    // Through a multishot receive that we've asked the kernel to cancel, and
+    // whose last completion hasn't come yet.
+    RECV_CANCELLING,
+    // Through a receive straight into the destination of a read operation.
+    RECV_DIRECT,
+  };
+
+ public:
+  // Create a connection that is already connected (e.g. from a listener).
+  ConnectionImpl(
+      ConstructorToken token,
+      std::shared_ptr<ContextImpl> context,
+      std::string id,
+      Socket socket);
+
+  // Create a connection that connects to the specified address.
+  ConnectionImpl(
+      ConstructorToken token,
+      std::shared_ptr<ContextImpl> context,
+      std::string id,
+      std::string addr);
+
+ protected:
+  // Implement the entry points called by ConnectionImplBoilerplate.
+  void initImplFromLoop() override;
+  void readImplFromLoop(read_callback_fn fn) override;
+  void readImplFromLoop(void* ptr, size_t length, read_callback_fn fn) override;
+  void writeImplFromLoop(const void* ptr, size_t length, write_callback_fn fn)
+      override;
+  void handleErrorImpl() override;
+
+ private:
+  State state_{INITIALIZING};
+  Socket socket_;
+  optional<Sockaddr> sockaddr_;
+
+  // The operations that were submitted to the ring and haven't had their last
+  // completion yet. Once the connection is in error it waits for all of them
+  // before handing the buffers back to the user and closing the socket.
+  size_t numOperationsInFlight_{0};
+
+  // Recycles the buffers of the reads that weren't given a destination. It must
+  // outlive the read operations, hence it's declared before them.
+  ReadBufferPool readBufferPool_;
+
+  // Pending read operations.
+  std::deque<StreamReadOperation> readOperations_;
+
+  // The data received into provided buffers that hasn't been consumed yet.
+  struct Chunk {
+    uint16_t bufferId;
+    size_t offset;
+    size_t length;
+  };
+  std::deque<Chunk> chunks_;
+
+  RecvState recvState_{RECV_IDLE};
+  // The user data of the multishot receive, to cancel it.
+  uint64_t multishotUserData_{0};
+  // Whether the multishot receive stopped because the ring ran out of buffers,
+  // and is waiting for some to be recycled to start again.
+  bool waitingForBuffers_{false};
+
+  // Pending write operations. The data of all of them is handed to the kernel
+  // in a single send, which may be partial: its first numBytesSent_ bytes were
+  // sent already.
+  std::deque<StreamWriteOperation> writeOperations_;
+  size_t numBytesSent_{0};
+  bool sendInFlight_{false};
+  // The message of the send in flight, which the kernel may access until it
+  // completes.
+  std::vector<struct iovec> sendIovecs_;
+  struct msghdr sendMsg_;
+
+  bool cleanedUp_{false};
+
+  // Start exchanging data, once the socket is connected.
+  void onConnectedFromLoop();
+
+  // Copy the data that was received into the provided buffers to the read
+  // operations, and complete them.
+  void processReadOperationsFromLoop();
+
+  // Decide how to read the next data from the socket: directly into the
+  // destination if there's a lot of it to read, else into provided buffers.
+  void updateRecvFromLoop();
+
+  void armMultishotRecvFromLoop();
+  void onMultishotRecvFromLoop(int res, uint32_t flags);
+  void postDirectRecvFromLoop(char* base, size_t len);
+  void onDirectRecvFromLoop(int res);
+
+  // Send the data of the pending write operations, if no send is in flight.
+  void processWriteOperationsFromLoop();
+  void onSendFromLoop(int res);
+
+  // Once in error and with no operation in flight, fire the callbacks of the
+  // pending read and write operations and release the resources.
+  void tryCleanupFromLoop();
+};
+
+} // namespace uring
+} // namespace transport
+} // namespace tensorpipe
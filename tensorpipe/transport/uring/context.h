@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/thread_options.h>
+#include <tensorpipe/transport/context.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uring {
+
+class ContextImpl;
+
+// The default number and size of the buffers that receive the data, see below.
+constexpr size_t kDefaultNumBuffers = 256;
+constexpr size_t kDefaultBufferSize = 32 * 1024;
+
+class Context : public transport::Context {
+ public:
+  // The connections and listeners go over TCP, and perform all their I/O
+  // through a single io_uring ring, whose thread is set up according to
+  // threadOptions. The operations of all of them are submitted together, once
+  // per iteration of its loop.
+  //
+  // The connections receive the lengths of the payloads, and the small ones,
+  // through multishot receives into a pool of numBuffers buffers (a power of
+  // two, at most 32768) of bufferSize bytes each, which is shared by all the
+  // connections and from which the data is then copied to its destination. The
+  // payloads that wouldn't fit in a buffer are received directly into their
+  // destination instead.
+  explicit Context(
+      size_t numBuffers = kDefaultNumBuffers,
+      size_t bufferSize = kDefaultBufferSize,
+      ThreadOptions threadOptions = ThreadOptions());
+
+  Context(const Context&) = delete;
+  Context(Context&&) = delete;
+  Context& operator=(const Context&) = delete;
+  Context& operator=(Context&&) = delete;
+
+  std::shared_ptr<Connection> connect(std::string addr) override;
+
+  std::shared_ptr<Listener> listen(std::string addr) override;
+
+  bool isViable() const override;
+
+  const std::string& domainDescriptor() const override;
+
+  std::tuple<Error, std::string> lookupAddrForIface(std::string iface);
+
+  std::tuple<Error, std::string> lookupAddrForHostname();
+
+  void setId(std::string id) override;
+
+  void enableLoopStats() override;
+
+  std::map<std::string, LoopStats> getLoopStats() override;
+
+  TransportStats getTransportStats() override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it (downcast as a shared_ptr to the private
+  // interface). However, its lifetime is tied to the one of this public object,
+  // since when the latter is destroyed the implementation is closed and joined.
+  const std::shared_ptr<ContextImpl> impl_;
+};
+
+} // namespace uring
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <tensorpipe/transport/context_impl_boilerplate.h>
+#include <tensorpipe/transport/uring/ring.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uring {
+
+class ConnectionImpl;
+class ListenerImpl;
+
+class ContextImpl final
+    : public ContextImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl> {
+ public:
+  ContextImpl(
+      size_t numBuffers,
+      size_t bufferSize,
+      ThreadOptions threadOptions);
+
+  bool isViable() const;
+
+  std::tuple<Error, std::string> lookupAddrForIface(std::string iface);
+
+  std::tuple<Error, std::string> lookupAddrForHostname();
+
+  // Implement the DeferredExecutor interface.
+  bool inLoop() override;
+  void deferToLoop(TTask fn) override;
+
+  void enableLoopStats();
+
+  std::map<std::string, LoopStats> getLoopStats();
+
+  Ring& getRing();
+
+ protected:
+  // Implement the entry points called by ContextImplBoilerplate.
+  void closeImpl() override;
+  void joinImpl() override;
+
+ private:
+  Ring ring_;
+};
+
+} // namespace uring
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uring/listener_impl.h>
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+#include <deque>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/socket.h>
+#include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/uring/connection_impl.h>
+#include <tensorpipe/transport/uring/context_impl.h>
+#include <tensorpipe/transport/uring/ring.h>
+#include <tensorpipe/transport/uring/sockaddr.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uring {
+
+ListenerImpl::ListenerImpl(
+    ConstructorToken token,
+    std::shared_ptr<ContextImpl> context,
+    std::string id,
+    std::string addr)
+    : ListenerImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
+          token,
+          std::move(context),
+          std::move(id)),
+      sockaddr_(Sockaddr::createInetSockAddr(addr)) {}
+
+void ListenerImpl::initImplFromLoop() {
+  context_->enroll(*this);
+
+  Error error;
+  TP_DCHECK(!socket_.hasValue());
+  std::tie(error, socket_) =
+      Socket::createForFamily(sockaddr_.addr()->sa_family);
+  if (error) {
+    setError(std::move(error));
+    return;
+  }
+  error = socket_.reuseAddr(true);
+  if (error) {
+    setError(std::move(error));
+    return;
+  }
+  error = socket_.bind(sockaddr_);
+  if (error) {
+    setError(std::move(error));
+    return;
+  }
+  error = socket_.listen(128);
+  if (error) {
+    setError(std::move(error));
+    return;
+  }
+}
+
+void ListenerImpl::handleErrorImpl() {
+  if (acceptInFlight_) {
+    context_->getRing().cancelFromLoop(acceptUserData_);
+  }
+  std::deque<accept_callback_fn> fns;
+  std::swap(fns, fns_);
+  for (auto& fn : fns) {
+    fn(error_, std::shared_ptr<Connection>());
+  }
+
+  tryCleanupFromLoop();
+}
+
+void ListenerImpl::tryCleanupFromLoop() {
+  if (!error_ || cleanedUp_ || acceptInFlight_) {
+    return;
+  }
+  cleanedUp_ = true;
+
+  socket_.reset();
+
+  context_->unenroll(*this);
+}
+
+void ListenerImpl::acceptImplFromLoop(accept_callback_fn fn) {
+  fns_.push_back(std::move(fn));
+
+  if (!acceptInFlight_) {
+    postAcceptFromLoop();
+  }
+}
+
+void ListenerImpl::postAcceptFromLoop() {
+  struct io_uring_sqe& sqe = context_->getRing().prepareFromLoop(
+      [impl{shared_from_this()}](int res, uint32_t /* unused */) {
+        impl->onAcceptFromLoop(res);
+      });
+  sqe.opcode = IORING_OP_ACCEPT;
+  sqe.fd = socket_.fd();
+  sqe.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  acceptUserData_ = sqe.user_data;
+  acceptInFlight_ = true;
+}
+
+void ListenerImpl::onAcceptFromLoop(int res) {
+  TP_DCHECK(context_->inLoop());
+  acceptInFlight_ = false;
+
+  if (error_) {
+    // The connection may have been accepted before the cancellation took
+    // effect, in which case it's closed right away.
+    if (res >= 0) {
+      Socket socket(res);
+    }
+    tryCleanupFromLoop();
+    return;
+  }
+  if (res < 0) {
+    setError(TP_CREATE_ERROR(SystemError, "accept", -res));
+    return;
+  }
+
+  TP_VLOG(9) << "Listener " << id_ << " has accepted a connection";
+
+  Socket socket(res);
+  TP_DCHECK(!fns_.empty())
+      << "the listener is supposed to only accept while it has callbacks";
+  auto fn = std::move(fns_.front());
+  fns_.pop_front();
+  if (!fns_.empty()) {
+    postAcceptFromLoop();
+  }
+  fn(Error::kSuccess, createAndInitConnection(std::move(socket)));
+}
+
+std::string ListenerImpl::addrImplFromLoop() const {
+  struct sockaddr_storage ss;
+  struct sockaddr* addr = reinterpret_cast<struct sockaddr*>(&ss);
+  socklen_t addrlen = sizeof(ss);
+  int rv = getsockname(socket_.fd(), addr, &addrlen);
+  TP_THROW_SYSTEM_IF(rv < 0, errno);
+  return Sockaddr(addr, addrlen).str();
+}
+
+} // namespace uring
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/common/socket.h>
+#include <tensorpipe/transport/listener_impl_boilerplate.h>
+#include <tensorpipe/transport/uring/sockaddr.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uring {
+
+class ConnectionImpl;
+class ContextImpl;
+
+class ListenerImpl final : public ListenerImplBoilerplate<
+                               ContextImpl,
+                               ListenerImpl,
+                               ConnectionImpl> {
+ public:
+  // Create a listener that listens on the specified address.
+  ListenerImpl(
+      ConstructorToken token,
+      std::shared_ptr<ContextImpl> context,
+      std::string id,
+      std::string addr);
+
+ protected:
+  // Implement the entry points called by ListenerImplBoilerplate.
+  void initImplFromLoop() override;
+  void acceptImplFromLoop(accept_callback_fn fn) override;
+  std::string addrImplFromLoop() const override;
+  void handleErrorImpl() override;
+
+ private:
+  Socket socket_;
+  Sockaddr sockaddr_;
+  std::deque<accept_callback_fn> fns_;
+
+  // The accept submitted to the ring, if any, which is only done while there
+  // are pending callbacks.
+  bool acceptInFlight_{false};
+  uint64_t acceptUserData_{0};
+
+  bool cleanedUp_{false};
+
+  void postAcceptFromLoop();
+  void onAcceptFromLoop(int res);
+
+  // Once in error and with no accept in flight, close the socket.
+  void tryCleanupFromLoop();
+};
+
+} // namespace uring
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uring/ring.h>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <tuple>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/system.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uring {
+
+namespace {
+
+// The user data of the multishot poll of the eventfd and of the cancellation
+// requests, whose completions don't have a callback. The other operations use
+// the address of their callback, which can't collide with these.
+constexpr uint64_t kWakeupUserData = 0;
+constexpr uint64_t kCancelUserData = 1;
+
+// The multishot operations produce many completions for a single submission,
+// hence the completion queue is made larger than the submission queue.
+constexpr uint32_t kCompletionQueueFactor = 4;
+
+// The kernel caps the size of the provided buffer rings.
+constexpr size_t kMaxNumBuffers = 32768;
+
+// The C library provides no wrappers for these system calls.
+
+int ioUringSetup(uint32_t numEntries, struct io_uring_params* params) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, numEntries, params));
+}
+
+int ioUringEnter(
+    int fd,
+    uint32_t toSubmit,
+    uint32_t minComplete,
+    uint32_t flags) {
+  return static_cast<int>(::syscall(
+      __NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+int ioUringRegister(int fd, uint32_t opcode, void* arg, uint32_t numArgs) {
+  return static_cast<int>(
+      ::syscall(__NR_io_uring_register, fd, opcode, arg, numArgs));
+}
+
+} // namespace
+
+Ring::Ring(
+    uint32_t numEntries,
+    size_t numBuffers,
+    size_t bufferSize,
+    ThreadOptions threadOptions)
+    : numBuffers_(numBuffers), bufferSize_(bufferSize) {
+  TP_THROW_ASSERT_IF(
+      !isPow2(numBuffers_) || numBuffers_ < 1 || numBuffers_ > kMaxNumBuffers)
+      << "The number of buffers must be a power of two between 1 and "
+      << kMaxNumBuffers << ", got " << numBuffers_;
+  TP_THROW_ASSERT_IF(bufferSize_ < 1 || bufferSize_ > UINT32_MAX)
+      << "The buffer size must be between 1 and " << UINT32_MAX
+      << " bytes, got " << bufferSize_;
+  {
+    auto rv = ::eventfd(0, EFD_NONBLOCK);
+    TP_THROW_SYSTEM_IF(rv == -1, errno);
+    eventFd_ = Fd(rv);
+  }
+
+  setUpRing(numEntries);
+  if (viable_) {
+    setUpProvidedBuffers();
+  }
+
+  startThread("TP_URING_loop", std::move(threadOptions));
+}
+
+void Ring::setUpRing(uint32_t numEntries) {
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  // Submitting all the entries even if some of them fail, and only running the
+  // completion work when we enter the ring, are optimizations that older
+  // kernels may not support.
+  params.flags =
+      IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+  params.cq_entries = numEntries * kCompletionQueueFactor;
+  int rv = ioUringSetup(numEntries, &params);
+  if (rv < 0 && errno == EINVAL) {
+    std::memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = numEntries * kCompletionQueueFactor;
+    rv = ioUringSetup(numEntries, &params);
+  }
+  if (rv < 0) {
+    TP_VLOG(9) << "The io_uring ring is not viable because it couldn't be set "
+               << "up: "
+               << TP_CREATE_ERROR(SystemError, "io_uring_setup", errno).what();
+    return;
+  }
+  ringFd_ = Fd(rv);
+  if (!(params.features & IORING_FEAT_NODROP)) {
+    // We can't afford to lose any completion.
+    TP_VLOG(9) << "The io_uring ring is not viable because the kernel may drop "
+               << "completions";
+    ringFd_.reset();
+    return;
+  }
+
+  size_t sqRingSize =
+      params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  size_t cqRingSize =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (singleMmap) {
+    sqRingSize = std::max(sqRingSize, cqRingSize);
+  }
+
+  Error error;
+  std::tie(error, sqRing_) = MmappedPtr::create(
+      sqRingSize,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      ringFd_.fd(),
+      IORING_OFF_SQ_RING);
+  TP_THROW_ASSERT_IF(error) << "Couldn't map the io_uring submission queue: "
+                            << error.what();
+  if (!singleMmap) {
+    std::tie(error, cqRing_) = MmappedPtr::create(
+        cqRingSize,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        ringFd_.fd(),
+        IORING_OFF_CQ_RING);
+    TP_THROW_ASSERT_IF(error) << "Couldn't map the io_uring completion queue: "
+                              << error.what();
+  }
+  std::tie(error, sqes_) = MmappedPtr::create(
+      params.sq_entries * sizeof(struct io_uring_sqe),
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      ringFd_.fd(),
+      IORING_OFF_SQES);
+  TP_THROW_ASSERT_IF(error) << "Couldn't map the io_uring submission entries: "
+                            << error.what();
+
+  uint8_t* sqPtr = sqRing_.ptr();
+  sqHead_ = reinterpret_cast<uint32_t*>(sqPtr + params.sq_off.head);
+  sqTail_ = reinterpret_cast<uint32_t*>(sqPtr + params.sq_off.tail);
+  sqMask_ = *reinterpret_cast<uint32_t*>(sqPtr + params.sq_off.ring_mask);
+  sqNumEntries_ = params.sq_entries;
+  sqLocalTail_ = *sqTail_;
+  // Each slot of the queue always holds the entry with the same index.
+  uint32_t* sqArray = reinterpret_cast<uint32_t*>(sqPtr + params.sq_off.array);
+  for (uint32_t idx = 0; idx < sqNumEntries_; idx++) {
+    sqArray[idx] = idx;
+  }
+
+  uint8_t* cqPtr = singleMmap ? sqRing_.ptr() : cqRing_.ptr();
+  cqHead_ = reinterpret_cast<uint32_t*>(cqPtr + params.cq_off.head);
+  cqTail_ = reinterpret_cast<uint32_t*>(cqPtr + params.cq_off.tail);
+  cqMask_ = *reinterpret_cast<uint32_t*>(cqPtr + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(cqPtr + params.cq_off.cqes);
+
+  viable_ = true;
+}
+
+void Ring::setUpProvidedBuffers() {
+  Error error;
+  std::tie(error, bufRing_) = MmappedPtr::create(
+      numBuffers_ * sizeof(struct io_uring_buf),
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS,
+      -1);
+  TP_THROW_ASSERT_IF(error) << "Couldn't allocate the provided buffer ring: "
+                            << error.what();
+  std::tie(error, bufs_) = MmappedPtr::create(
+      numBuffers_ * bufferSize_,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS,
+      -1);
+  TP_THROW_ASSERT_IF(error) << "Couldn't allocate the provided buffers: "
+                            << error.what();
+
+  struct io_uring_buf_reg reg;
+  std::memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(bufRing_.ptr());
+  reg.ring_entries = numBuffers_;
+  reg.bgid = kBufferGroupId;
+  auto rv = ioUringRegister(ringFd_.fd(), IORING_REGISTER_PBUF_RING, &reg, 1);
+  if (rv < 0) {
+    TP_VLOG(9) << "The io_uring ring is not viable because it couldn't "
+               << "register the provided buffers: "
+               << TP_CREATE_ERROR(SystemError, "io_uring_register", errno)
+                      .what();
+    viable_ = false;
+    return;
+  }
+
+  for (size_t bufferId = 0; bufferId < numBuffers_; bufferId++) {
+    recycleBufferFromLoop(bufferId);
+  }
+  bufsRecycled_ = false;
+}
+
+struct io_uring_sqe& Ring::getSqeFromLoop() {
+  if (sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) ==
+      sqNumEntries_) {
+    // The queue is full: hand what it has to the kernel right away.
+    enterFromLoop(/*wait=*/false);
+    TP_THROW_ASSERT_IF(
+        sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) ==
+        sqNumEntries_)
+        << "Couldn't make room in the io_uring submission queue";
+  }
+  struct io_uring_sqe& sqe =
+      reinterpret_cast<struct io_uring_sqe*>(sqes_.ptr())
+          [sqLocalTail_ & sqMask_];
+  std::memset(&sqe, 0, sizeof(sqe));
+  sqLocalTail_++;
+  return sqe;
+}
+
+struct io_uring_sqe& Ring::prepareFromLoop(TCompletionCallback fn) {
+  TP_DCHECK(inLoop());
+  TP_DCHECK(viable_);
+  struct io_uring_sqe& sqe = getSqeFromLoop();
+  sqe.user_data =
+      reinterpret_cast<uint64_t>(new TCompletionCallback(std::move(fn)));
+  numOperationsInFlight_++;
+  return sqe;
+}
+
+void Ring::cancelFromLoop(uint64_t userData) {
+  TP_DCHECK(inLoop());
+  struct io_uring_sqe& sqe = getSqeFromLoop();
+  sqe.opcode = IORING_OP_ASYNC_CANCEL;
+  sqe.fd = -1;
+  sqe.addr = userData;
+  sqe.user_data = kCancelUserData;
+}
+
+void Ring::cancelFdFromLoop(int fd) {
+  TP_DCHECK(inLoop());
+  struct io_uring_sqe& sqe = getSqeFromLoop();
+  sqe.opcode = IORING_OP_ASYNC_CANCEL;
+  sqe.fd = fd;
+  sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  sqe.user_data = kCancelUserData;
+}
+
+const uint8_t* Ring::getBufferFromLoop(uint16_t bufferId) const {
+  TP_DCHECK_LT(bufferId, numBuffers_);
+  return bufs_.ptr() + bufferId * bufferSize_;
+}
+
+void Ring::recycleBufferFromLoop(uint16_t bufferId) {
+  TP_DCHECK_LT(bufferId, numBuffers_);
+  struct io_uring_buf* entries =
+      reinterpret_cast<struct io_uring_buf*>(bufRing_.ptr());
+  struct io_uring_buf& entry =
+      entries[bufRingLocalTail_ & static_cast<uint16_t>(numBuffers_ - 1)];
+  entry.addr = reinterpret_cast<uint64_t>(bufs_.ptr() + bufferId * bufferSize_);
+  entry.len = bufferSize_;
+  entry.bid = bufferId;
+  bufRingLocalTail_++;
+  // The tail of the ring is stored in the reserved field of its first entry.
+  __atomic_store_n(&entries[0].resv, bufRingLocalTail_, __ATOMIC_RELEASE);
+  bufsRecycled_ = true;
+}
+
+void Ring::waitForBuffersFromLoop(std::function<void()> fn) {
+  TP_DCHECK(inLoop());
+  bufWaiters_.push_back(std::move(fn));
+}
+
+void Ring::enterFromLoop(bool wait) {
+  __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+  const uint32_t toSubmit =
+      sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+  if (toSubmit == 0 && !wait) {
+    return;
+  }
+  auto rv = ioUringEnter(
+      ringFd_.fd(),
+      toSubmit,
+      wait ? 1 : 0,
+      wait ? IORING_ENTER_GETEVENTS : 0);
+  if (rv < 0) {
+    // If the completion queue overflowed the pending entries will be submitted
+    // again once we have reaped some completions.
+    if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+      return;
+    }
+    TP_THROW_SYSTEM(errno);
+  }
+}
+
+void Ring::armWakeupFromLoop() {
+  struct io_uring_sqe& sqe = getSqeFromLoop();
+  sqe.opcode = IORING_OP_POLL_ADD;
+  sqe.fd = eventFd_.fd();
+  sqe.poll32_events = POLLIN;
+  sqe.len = IORING_POLL_ADD_MULTI;
+  sqe.user_data = kWakeupUserData;
+  wakeupArmed_ = true;
+}
+
+void Ring::handleWakeupFromLoop(uint32_t flags) {
+  if (!(flags & IORING_CQE_F_MORE)) {
+    wakeupArmed_ = false;
+  }
+  // Reset the eventfd before running the functions, so that the wakeups for the
+  // ones that are deferred from now on produce another completion. A single
+  // wakeup may produce several completions, hence it may already be reset.
+  uint64_t val;
+  auto rv = eventFd_.read(reinterpret_cast<void*>(&val), sizeof(val));
+  TP_DCHECK((rv == -1 && errno == EAGAIN) || (rv == sizeof(val) && val > 0));
+  runDeferredFunctionsFromEventLoop();
+}
+
+void Ring::reapCompletionsFromLoop() {
+  uint32_t head = *cqHead_;
+  uint32_t tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    for (; head != tail; head++) {
+      const struct io_uring_cqe cqe = cqes_[head & cqMask_];
+      // Give the slot back before running the callback, as we've copied it.
+      __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+
+      if (cqe.user_data == kWakeupUserData) {
+        handleWakeupFromLoop(cqe.flags);
+        continue;
+      }
+      if (cqe.user_data == kCancelUserData) {
+        continue;
+      }
+      auto fn = reinterpret_cast<TCompletionCallback*>(cqe.user_data);
+      if (cqe.flags & IORING_CQE_F_MORE) {
+        (*fn)(cqe.res, cqe.flags);
+      } else {
+        std::unique_ptr<TCompletionCallback> lastFn(fn);
+        numOperationsInFlight_--;
+        (*lastFn)(cqe.res, cqe.flags);
+      }
+    }
+    tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+  }
+}
+
+void Ring::eventLoop() {
+  if (!viable_) {
+    eventLoopWithoutRing();
+    return;
+  }
+
+  // Stop when another thread has asked the ring to close and all operations are
+  // done. The functions deferred from then on are run by the on-demand loop.
+  while (!closed_ || numOperationsInFlight_ > 0) {
+    if (!wakeupArmed_) {
+      armWakeupFromLoop();
+    }
+    enterFromLoop(/*wait=*/true);
+    reapCompletionsFromLoop();
+
+    if (bufsRecycled_) {
+      bufsRecycled_ = false;
+      std::vector<std::function<void()>> waiters;
+      std::swap(waiters, bufWaiters_);
+      for (auto& fn : waiters) {
+        fn();
+      }
+    }
+  }
+}
+
+void Ring::eventLoopWithoutRing() {
+  while (!closed_) {
+    struct pollfd pfd;
+    pfd.fd = eventFd_.fd();
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    auto rv = ::poll(&pfd, 1, -1);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      TP_THROW_SYSTEM(errno);
+    }
+    uint64_t val;
+    eventFd_.read(reinterpret_cast<void*>(&val), sizeof(val));
+    runDeferredFunctionsFromEventLoop();
+  }
+}
+
+void Ring::wakeupEventLoopToDeferFunction() {
+  eventFd_.writeOrThrow<uint64_t>(1);
+}
+
+void Ring::close() {
+  if (!closed_.exchange(true)) {
+    eventFd_.writeOrThrow<uint64_t>(1);
+  }
+}
+
+void Ring::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    joinThread();
+  }
+}
+
+Ring::~Ring() {
+  join();
+}
+
+} // namespace uring
+} // namespace transport
+} // namespace tensorpipe
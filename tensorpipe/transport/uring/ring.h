@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <linux/io_uring.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <tensorpipe/common/deferred_executor.h>
+#include <tensorpipe/common/fd.h>
+#include <tensorpipe/common/memory.h>
+#include <tensorpipe/common/thread_options.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uring {
+
+// The id of the group of the provided buffers, for the submission queue entries
+// that select one of them.
+constexpr uint16_t kBufferGroupId = 0;
+
+// An io_uring instance, driven by a thread of its own, through which the
+// connections and listeners of a context perform all their I/O.
+//
+// The operations aren't handed to the kernel one by one: their submission
+// queue entries accumulate during a whole iteration of the loop (i.e., while it
+// processes the completions and the deferred functions) and then they're all
+// submitted at once, by the same system call that waits for the next
+// completions. Thus, however many connections are busy, each iteration costs a
+// single system call.
+//
+// The ring also owns a pool of buffers that it registers with the kernel as a
+// provided buffer ring. The multishot receives of all the connections pick
+// their buffers from it as the data arrives, hence an idle connection doesn't
+// tie up any memory. The owner of each such buffer must give it back once it's
+// done with its data.
+//
+// If the kernel doesn't support io_uring (or the features above), the ring
+// isn't viable, but its thread still runs the deferred functions.
+class Ring final : public EventLoopDeferredExecutor {
+ public:
+  using TCompletionCallback = std::function<void(int res, uint32_t flags)>;
+
+  Ring(
+      uint32_t numEntries,
+      size_t numBuffers,
+      size_t bufferSize,
+      ThreadOptions threadOptions);
+
+  bool isViable() const {
+    return viable_;
+  }
+
+  // Return a submission queue entry for the caller to fill in, which will be
+  // submitted at the end of this iteration of the loop. The entry is zeroed,
+  // except for its user data, which the caller mustn't change and may keep to
+  // cancel the operation. The callback is called with the result and flags of
+  // each of the operation's completions, up to the first one that doesn't have
+  // the IORING_CQE_F_MORE flag (i.e., only once for most operations).
+  struct io_uring_sqe& prepareFromLoop(TCompletionCallback fn);
+
+  // Ask the kernel to cancel an operation, given its user data, or all the
+  // operations on a file descriptor. The operations still complete as usual,
+  // most likely with -ECANCELED, and may do so successfully if they were done
+  // already.
+  void cancelFromLoop(uint64_t userData);
+  void cancelFdFromLoop(int fd);
+
+  // The data of a provided buffer, given its id (as found in the flags of the
+  // completion of the operation that selected it).
+  const uint8_t* getBufferFromLoop(uint16_t bufferId) const;
+
+  size_t getBufferSize() const {
+    return bufferSize_;
+  }
+
+  // Give a provided buffer back to the kernel for it to use it again.
+  void recycleBufferFromLoop(uint16_t bufferId);
+
+  // Have the function called (once) at the end of the next iteration of the
+  // loop in which some provided buffers are recycled, for the operations that
+  // failed for lack of buffers (-ENOBUFS) to try again.
+  void waitForBuffersFromLoop(std::function<void()> fn);
+
+  void close();
+
+  void join();
+
+  ~Ring();
+
+ protected:
+  // Implement EventLoopDeferredExecutor.
+  void eventLoop() override;
+  void wakeupEventLoopToDeferFunction() override;
+
+ private:
+  const size_t numBuffers_;
+  const size_t bufferSize_;
+  bool viable_{false};
+
+  Fd ringFd_;
+  Fd eventFd_;
+
+  // Submission queue.
+  MmappedPtr sqRing_;
+  MmappedPtr sqes_;
+  uint32_t* sqHead_{nullptr};
+  uint32_t* sqTail_{nullptr};
+  uint32_t sqMask_{0};
+  uint32_t sqNumEntries_{0};
+  // The tail that we're filling in, which is only made visible to the kernel
+  // when we submit.
+  uint32_t sqLocalTail_{0};
+
+  // Completion queue. It may share the mapping of the submission queue.
+  MmappedPtr cqRing_;
+  uint32_t* cqHead_{nullptr};
+  uint32_t* cqTail_{nullptr};
+  uint32_t cqMask_{0};
+  struct io_uring_cqe* cqes_{nullptr};
+
+  // Provided buffer ring, and the memory of the buffers.
+  MmappedPtr bufRing_;
+  MmappedPtr bufs_;
+  uint16_t bufRingLocalTail_{0};
+  bool bufsRecycled_{false};
+  std::vector<std::function<void()>> bufWaiters_;
+
+  // The operations submitted through prepareFromLoop that haven't had their
+  // last completion yet. The multishot poll of the eventfd, which wakes up the
+  // loop for the deferred functions, doesn't count.
+  size_t numOperationsInFlight_{0};
+  bool wakeupArmed_{false};
+
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+
+  void setUpRing(uint32_t numEntries);
+
+  void setUpProvidedBuffers();
+
+  struct io_uring_sqe& getSqeFromLoop();
+
+  // Submit the pending entries and, if requested, wait for a completion.
+  void enterFromLoop(bool wait);
+
+  void armWakeupFromLoop();
+
+  void handleWakeupFromLoop(uint32_t flags);
+
+  void reapCompletionsFromLoop();
+
+  void eventLoopWithoutRing();
+};
+
+} // namespace uring
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uv/addr_cache.h>
+
+#include <utility>
+
+namespace tensorpipe {
+namespace transport {
+namespace uv {
+
+constexpr std::chrono::seconds AddrCache::kTtl;
+
+AddrCache& AddrCache::forHostnames() {
+  static AddrCache cache;
+  return cache;
+}
+
+AddrCache& AddrCache::forIfaces() {
+  static AddrCache cache;
+  return cache;
+}
+
+optional<std::vector<Sockaddr>> AddrCache::get(const std::string& name) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto iter = entries_.find(name);
+  if (iter == entries_.end()) {
+    return nullopt;
+  }
+  const Entry& entry = iter->second;
+  if (entry.expiry.has_value() &&
+      entry.expiry.value() <= std::chrono::steady_clock::now()) {
+    entries_.erase(iter);
+    return nullopt;
+  }
+  return entry.addrs;
+}
+
+void AddrCache::put(const std::string& name, std::vector<Sockaddr> addrs) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto iter = entries_.find(name);
+  if (iter != entries_.end() && !iter->second.expiry.has_value()) {
+    // The addresses supplied by the user take precedence.
+    return;
+  }
+  entries_.erase(name);
+  entries_.emplace(
+      name, Entry{std::move(addrs), std::chrono::steady_clock::now() + kTtl});
+}
+
+void AddrCache::pin(const std::string& name, std::vector<Sockaddr> addrs) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  entries_.erase(name);
+  entries_.emplace(name, Entry{std::move(addrs), nullopt});
+}
+
+} // namespace uv
+} // namespace transport
+} // namespace tensorpipe
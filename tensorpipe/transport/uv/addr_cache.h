@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/transport/uv/sockaddr.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uv {
+
+// The addresses (without port) that names resolve to, shared by all contexts
+// of the process, as resolving hostnames goes through DNS, which at times
+// takes seconds, and listing the interfaces isn't free either. The entries
+// expire after a while, to pick up the changes, except for the ones that were
+// supplied by the user (see setAddrForHostname). This is thread-safe.
+class AddrCache {
+ public:
+  // How long the addresses that were looked up are reused for.
+  static constexpr std::chrono::seconds kTtl{60};
+
+  // The addresses of hostnames, and the ones of network interfaces.
+  static AddrCache& forHostnames();
+  static AddrCache& forIfaces();
+
+  optional<std::vector<Sockaddr>> get(const std::string& name);
+
+  void put(const std::string& name, std::vector<Sockaddr> addrs);
+
+  // Like the above, except that the entry never expires.
+  void pin(const std::string& name, std::vector<Sockaddr> addrs);
+
+ private:
+  struct Entry {
+    std::vector<Sockaddr> addrs;
+    // Unset for pinned entries.
+    optional<std::chrono::steady_clock::time_point> expiry;
+  };
+
+  std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+};
+
+} // namespace uv
+} // namespace transport
+} // namespace tensorpipe
@@ -8,8 +8,15 @@
 
 #include <tensorpipe/transport/uv/connection_impl.h>
 
+#include <algorithm>
 #include <array>
+#include <cstring>
 #include <deque>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/common/defs.h>
@@ -26,16 +33,45 @@ namespace tensorpipe {
 namespace transport {
 namespace uv {
 
+namespace {
+
+// Payloads smaller than this aren't worth splitting among several streams, as
+// their transfer time is dominated by the latency. Both ends must agree on it.
+constexpr size_t kMinStripedLength = 256 * 1024;
+
+// How often to look for the kernel's reports about the zero-copy writes when
+// the loop isn't woken up by them.
+constexpr uint64_t kZeroCopyPollIntervalMs = 1;
+
+// The size of the slab of each stream. The data of an operation is read into
+// it unless the stream has at least this much left to read for the operation.
+constexpr size_t kRecvSlabSize = 64 * 1024;
+
+std::vector<std::unique_ptr<TCPHandle>> createHandles(
+    ContextImpl& context,
+    size_t numHandles) {
+  std::vector<std::unique_ptr<TCPHandle>> handles;
+  handles.reserve(numHandles);
+  for (size_t handleIdx = 0; handleIdx < numHandles; handleIdx++) {
+    handles.push_back(context.createHandle());
+  }
+  return handles;
+}
+
+} // namespace
+
 ConnectionImpl::ConnectionImpl(
     ConstructorToken token,
     std::shared_ptr<ContextImpl> context,
     std::string id,
-    std::unique_ptr<TCPHandle> handle)
+    std::vector<std::unique_ptr<TCPHandle>> handles)
     : ConnectionImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
           token,
           std::move(context),
           std::move(id)),
-      handle_(std::move(handle)) {}
+      handles_(std::move(handles)),
+      striping_{handles_.size(), kMinStripedLength},
+      reading_(handles_.size(), false) {}
 
 ConnectionImpl::ConnectionImpl(
     ConstructorToken token,
@@ -46,83 +82,467 @@ ConnectionImpl::ConnectionImpl(
           token,
           std::move(context),
           std::move(id)),
-      handle_(context_->createHandle()),
-      sockaddr_(Sockaddr::createInetSockAddr(addr)) {}
+      handles_(
+          createHandles(*context_, context_->getTCPOptions().getNumStreams())),
+      striping_{handles_.size(), kMinStripedLength},
+      reading_(handles_.size(), false) {
+  // Addresses that are numeric are used right away, the others are hostnames.
+  std::tie(hostname_, port_) = Sockaddr::splitHostAndPort(addr);
+  sockaddr_ = Sockaddr::createNumericInetSockAddr(hostname_, port_);
+  if (sockaddr_.has_value()) {
+    hostname_.clear();
+  } else if (hostname_.empty()) {
+    TP_THROW_EINVAL() << addr;
+  }
+}
 
 void ConnectionImpl::initImplFromLoop() {
   context_->enroll(*this);
 
   TP_VLOG(9) << "Connection " << id_ << " is initializing in loop";
 
-  if (sockaddr_.has_value()) {
-    handle_->initFromLoop();
-    handle_->connectFromLoop(sockaddr_.value(), [this](int status) {
+  if (!hostname_.empty()) {
+    resolving_ = true;
+    context_->resolveHostnameFromLoop(
+        hostname_,
+        [impl{shared_from_this()}](
+            const Error& error, std::vector<Sockaddr> addrs) {
+          impl->resolveCallbackFromLoop(error, std::move(addrs));
+        });
+    return;
+  }
+
+  initHandlesFromLoop();
+}
+
+void ConnectionImpl::resolveCallbackFromLoop(
+    const Error& error,
+    std::vector<Sockaddr> addrs) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(9) << "Connection " << id_ << " has resolved hostname " << hostname_
+             << " (" << (error ? error.what() : "success") << ")";
+  if (error_) {
+    // The connection was closed in the meantime.
+    return;
+  }
+  resolving_ = false;
+  if (error) {
+    setError(error);
+    return;
+  }
+
+  // All the streams connect to the first address, rather than falling back to
+  // the other ones in case of failure.
+  TP_DCHECK(!addrs.empty());
+  sockaddr_ = std::move(addrs.front());
+  sockaddr_.value().setPort(port_);
+  initHandlesFromLoop();
+  if (error_) {
+    return;
+  }
+
+  // Hand the operations that were queued up in the meantime to the streams.
+  if (!writeOperations_.empty()) {
+    issueWritesFromLoop(
+        nextWriteSequenceNumber_ - writeOperations_.size(),
+        nextWriteSequenceNumber_ - 1);
+  }
+  processReadOperationsFromLoop();
+}
+
+void ConnectionImpl::initHandlesFromLoop() {
+  // Outgoing connections create their sockets first, in order to set them up
+  // before connecting, whereas accepted ones already have them. All handles
+  // must be initialized before anything can fail, as an error closes them.
+  for (auto& handle : handles_) {
+    if (sockaddr_.has_value()) {
+      handle->initFromLoop(sockaddr_.value());
+    }
+    handle->armCloseCallbackFromLoop(
+        [this]() { this->closeCallbackFromLoop(); });
+  }
+  numHandles_ = handles_.size();
+
+  const size_t zeroCopyThreshold =
+      context_->getTCPOptions().getZeroCopyThreshold();
+  if (zeroCopyThreshold > 0) {
+    for (auto& handle : handles_) {
+      zeroCopyWriters_.push_back(
+          std::make_unique<ZeroCopyWriter>(*handle, zeroCopyThreshold));
+    }
+    zeroCopyCheck_ = context_->createCheckHandle();
+    zeroCopyCheck_->initFromLoop();
+    zeroCopyCheck_->armCloseCallbackFromLoop(
+        [this]() { this->closeCallbackFromLoop(); });
+    zeroCopyCheck_->armCheckCallbackFromLoop(
+        [this]() { this->pollZeroCopyFromLoop(); });
+    zeroCopyTimer_ = context_->createTimerHandle();
+    zeroCopyTimer_->initFromLoop();
+    zeroCopyTimer_->armCloseCallbackFromLoop(
+        [this]() { this->closeCallbackFromLoop(); });
+    zeroCopyTimer_->armTimerCallbackFromLoop(
+        [this]() { this->pollZeroCopyFromLoop(); });
+    numHandles_ += 2;
+  }
+
+  recvSlabs_.resize(handles_.size());
+  for (auto& slab : recvSlabs_) {
+    slab.data = std::make_unique<char[]>(kRecvSlabSize);
+  }
+
+  for (size_t streamIdx = 0; streamIdx < handles_.size(); streamIdx++) {
+    TCPHandle& handle = *handles_[streamIdx];
+    auto rv = handle.setOptionsFromLoop(context_->getTCPOptions());
+    if (rv < 0) {
+      setError(TP_CREATE_ERROR(UVError, rv));
+      return;
+    }
+    handle.armAllocCallbackFromLoop([this, streamIdx](uv_buf_t* buf) {
+      this->allocCallbackFromLoop(streamIdx, buf);
+    });
+    handle.armReadCallbackFromLoop(
+        [this, streamIdx](ssize_t nread, const uv_buf_t* buf) {
+          this->readCallbackFromLoop(streamIdx, nread, buf);
+        });
+  }
+
+  if (!sockaddr_.has_value()) {
+    return;
+  }
+
+  const uint64_t groupId = context_->generateStreamGroupIdFromLoop();
+  hellos_.reserve(handles_.size());
+  for (size_t streamIdx = 0; streamIdx < handles_.size(); streamIdx++) {
+    TCPHandle& handle = *handles_[streamIdx];
+    handle.connectFromLoop(sockaddr_.value(), [this](int status) {
+      if (status < 0) {
+        setError(TP_CREATE_ERROR(UVError, status));
+      }
+    });
+    if (handles_.size() == 1) {
+      continue;
+    }
+    // The write is carried out once the connection is established.
+    hellos_.push_back(StreamHello{
+        groupId,
+        static_cast<uint32_t>(streamIdx),
+        static_cast<uint32_t>(handles_.size())});
+    const uv_buf_t uvBuf = {
+        reinterpret_cast<char*>(&hellos_.back()), sizeof(StreamHello)};
+    writeToStreamFromLoop(streamIdx, &uvBuf, 1, [this](int status) {
       if (status < 0) {
         setError(TP_CREATE_ERROR(UVError, status));
       }
     });
   }
-  handle_->armCloseCallbackFromLoop(
-      [this]() { this->closeCallbackFromLoop(); });
-  handle_->armAllocCallbackFromLoop(
-      [this](uv_buf_t* buf) { this->allocCallbackFromLoop(buf); });
-  handle_->armReadCallbackFromLoop([this](ssize_t nread, const uv_buf_t* buf) {
-    this->readCallbackFromLoop(nread, buf);
-  });
 }
 
 void ConnectionImpl::readImplFromLoop(read_callback_fn fn) {
-  readOperations_.emplace_back(std::move(fn));
-
-  // Start reading if this is the first read operation.
-  if (readOperations_.size() == 1) {
-    handle_->readStartFromLoop();
-  }
+  readOperations_.emplace_back(std::move(fn), striping_);
+  readOperations_.back().setBufferPool(&readBufferPool_);
+  processReadOperationsFromLoop();
 }
 
 void ConnectionImpl::readImplFromLoop(
     void* ptr,
     size_t length,
     read_callback_fn fn) {
-  readOperations_.emplace_back(ptr, length, std::move(fn));
-
-  // Start reading if this is the first read operation.
-  if (readOperations_.size() == 1) {
-    handle_->readStartFromLoop();
-  }
+  readOperations_.emplace_back(ptr, length, std::move(fn), striping_);
+  processReadOperationsFromLoop();
 }
 
 void ConnectionImpl::writeImplFromLoop(
     const void* ptr,
     size_t length,
     write_callback_fn fn) {
-  writeOperations_.emplace_back(ptr, length, std::move(fn));
+  writeOperations_.emplace_back(ptr, length, std::move(fn), striping_);
+  const uint64_t sequenceNumber = nextWriteSequenceNumber_++;
+  issueWritesFromLoop(sequenceNumber, sequenceNumber);
+}
+
+void ConnectionImpl::writeImplFromLoop(
+    const AbstractNopHolder& object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  const uint64_t firstSequenceNumber = nextWriteSequenceNumber_;
+  appendWriteOperationsFromLoop(object, std::move(buffers), std::move(fn));
+  issueWritesFromLoop(firstSequenceNumber, nextWriteSequenceNumber_ - 1);
+}
+
+void ConnectionImpl::writeImplFromLoop(
+    std::vector<WriteSegment> segments,
+    write_callback_fn fn) {
+  // All the segments are handed to libuv at once, as a single write, and only
+  // the last one forwards the callback, as the operations complete in order.
+  const uint64_t firstSequenceNumber = nextWriteSequenceNumber_;
+  for (size_t segmentIdx = 0; segmentIdx < segments.size(); segmentIdx++) {
+    WriteSegment& segment = segments[segmentIdx];
+    appendWriteOperationsFromLoop(
+        *segment.object,
+        std::move(segment.buffers),
+        segmentIdx + 1 < segments.size()
+            ? write_callback_fn([](const Error& /* unused */) {})
+            : std::move(fn));
+  }
+  issueWritesFromLoop(firstSequenceNumber, nextWriteSequenceNumber_ - 1);
+}
+
+void ConnectionImpl::appendWriteOperationsFromLoop(
+    const AbstractNopHolder& object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  const size_t len = object.getSize();
+
+  // See the comment in ConnectionImplBoilerplate about why this isn't a
+  // unique_ptr (and not an array type).
+  auto buf = std::shared_ptr<uint8_t>(
+      new uint8_t[len], std::default_delete<uint8_t[]>());
+
+  NopWriter writer(buf.get(), len);
+  nop::Status<void> status = object.write(writer);
+  TP_THROW_ASSERT_IF(status.has_error())
+      << "Error writing nop object: " << status.GetErrorMessage();
+
+  // Each buffer gets its own write operation, in order for it to be framed in
+  // the same way as if it had been written on its own, but all of them are
+  // handed to libuv at once, resulting in a single write syscall and a single
+  // completion (per stream). Only the last operation forwards the callback (and
+  // only once all operations are done can the nop object buffer be released).
+  auto appendWriteOperation =
+      [&](const void* ptr, size_t length, write_callback_fn fn) {
+        writeOperations_.emplace_back(ptr, length, std::move(fn), striping_);
+        nextWriteSequenceNumber_++;
+      };
+
+  appendWriteOperation(
+      buf.get(),
+      len,
+      buffers.empty()
+          ? write_callback_fn([buf, fn{std::move(fn)}](const Error& error) {
+              fn(error);
+            })
+          : write_callback_fn([buf](const Error& /* unused */) {}));
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const WriteBuffer& buffer = buffers[bufferIdx];
+    appendWriteOperation(
+        buffer.ptr,
+        buffer.length,
+        bufferIdx + 1 < buffers.size()
+            ? write_callback_fn([](const Error& /* unused */) {})
+            : std::move(fn));
+  }
+}
+
+void ConnectionImpl::issueWritesFromLoop(
+    uint64_t firstSequenceNumber,
+    uint64_t lastSequenceNumber) {
+  if (resolving_) {
+    return;
+  }
+  std::vector<uv_buf_t> uvBufs;
+  for (size_t streamIdx = 0; streamIdx < handles_.size(); streamIdx++) {
+    uvBufs.clear();
+    for (uint64_t sequenceNumber = firstSequenceNumber;
+         sequenceNumber <= lastSequenceNumber;
+         sequenceNumber++) {
+      StreamWriteOperation& writeOperation = getWriteOperation(sequenceNumber);
+      if (!writeOperation.usesStream(streamIdx)) {
+        continue;
+      }
+      StreamWriteOperation::Buf* bufsPtr;
+      size_t bufsLen;
+      std::tie(bufsPtr, bufsLen) = writeOperation.getBufs(streamIdx);
+      for (size_t bufIdx = 0; bufIdx < bufsLen; bufIdx++) {
+        uvBufs.push_back(uv_buf_t{bufsPtr[bufIdx].base, bufsPtr[bufIdx].len});
+      }
+      writeOperation.writeIssuedFromLoop();
+    }
+    if (uvBufs.empty()) {
+      continue;
+    }
+    writeToStreamFromLoop(
+        streamIdx,
+        uvBufs.data(),
+        uvBufs.size(),
+        [this, streamIdx, firstSequenceNumber, lastSequenceNumber](int status) {
+          this->writeCallbackFromLoop(
+              status, streamIdx, firstSequenceNumber, lastSequenceNumber);
+        });
+  }
+  updateWriteQueueBytesFromLoop();
+}
+
+void ConnectionImpl::writeToStreamFromLoop(
+    size_t streamIdx,
+    const uv_buf_t bufs[],
+    unsigned int nbufs,
+    WriteRequest::TWriteCallback fn) {
+  if (zeroCopyWriters_.empty()) {
+    handles_[streamIdx]->writeFromLoop(bufs, nbufs, std::move(fn));
+    return;
+  }
+  zeroCopyWriters_[streamIdx]->writeFromLoop(bufs, nbufs, std::move(fn));
+  updateZeroCopyPollingFromLoop();
+}
+
+void ConnectionImpl::pollZeroCopyFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  for (auto& writer : zeroCopyWriters_) {
+    writer->pollFromLoop();
+  }
+  updateZeroCopyPollingFromLoop();
+}
+
+void ConnectionImpl::updateZeroCopyPollingFromLoop() {
+  if (error_) {
+    // The handles are closing.
+    return;
+  }
+  bool shouldPoll = false;
+  for (auto& writer : zeroCopyWriters_) {
+    shouldPoll = shouldPoll || writer->hasPendingCompletionsFromLoop();
+  }
+  if (shouldPoll && !pollingZeroCopy_) {
+    zeroCopyCheck_->startFromLoop();
+    zeroCopyTimer_->startFromLoop(
+        kZeroCopyPollIntervalMs, kZeroCopyPollIntervalMs);
+  } else if (!shouldPoll && pollingZeroCopy_) {
+    zeroCopyCheck_->stopFromLoop();
+    zeroCopyTimer_->stopFromLoop();
+  }
+  pollingZeroCopy_ = shouldPoll;
+}
+
+StreamWriteOperation& ConnectionImpl::getWriteOperation(
+    uint64_t sequenceNumber) {
+  const uint64_t frontSequenceNumber =
+      nextWriteSequenceNumber_ - writeOperations_.size();
+  TP_DCHECK_LE(frontSequenceNumber, sequenceNumber);
+  TP_DCHECK_LT(sequenceNumber, nextWriteSequenceNumber_);
+  return writeOperations_[sequenceNumber - frontSequenceNumber];
+}
+
+StreamReadOperation* ConnectionImpl::getReadOperationForStreamFromLoop(
+    size_t streamIdx) {
+  // Each stream is done with the operations in order, hence there are usually
+  // very few operations to skip before finding the one it's at.
+  for (auto& readOperation : readOperations_) {
+    if (!readOperation.doneFromLoop(streamIdx)) {
+      return &readOperation;
+    }
+  }
+  return nullptr;
+}
+
+void ConnectionImpl::processReadOperationsFromLoop() {
+  // The first stream may hold the lengths that the other streams are waiting
+  // for, and completing operations may let the first stream go on, hence this
+  // goes on for as long as something changes.
+  bool progress = true;
+  while (progress && !error_) {
+    progress = false;
+    for (size_t streamIdx = 0; streamIdx < handles_.size(); streamIdx++) {
+      progress = consumeRecvSlabFromLoop(streamIdx) || progress;
+    }
+
+    // The streams are done with the operations in order, hence so is the
+    // connection as a whole.
+    while (!readOperations_.empty() &&
+           readOperations_.front().completeFromLoop()) {
+      readOperations_.front().callbackFromLoop(Error::kSuccess);
+      readOperations_.pop_front();
+      progress = true;
+    }
+  }
+
+  // Stop reading from the streams that have nothing to read for now, so that
+  // this instance no longer receives allocation and read callbacks for them,
+  // and start reading from those that were waiting for the length to be known.
+  updateReadingFromLoop();
+}
+
+bool ConnectionImpl::consumeRecvSlabFromLoop(size_t streamIdx) {
+  RecvSlab& slab = recvSlabs_[streamIdx];
+  bool progress = false;
+  while (slab.begin < slab.end && !error_) {
+    StreamReadOperation* readOperation =
+        getReadOperationForStreamFromLoop(streamIdx);
+    if (readOperation == nullptr ||
+        !readOperation->canReadFromLoop(streamIdx)) {
+      break;
+    }
+    const size_t available = slab.end - slab.begin;
+    // The slab is overwritten by the next read, hence the payloads can only be
+    // delivered from it if their callback can be fired right away.
+    if (readOperation == &readOperations_.front() &&
+        readOperation->canReadInPlaceFromLoop(streamIdx, available)) {
+      const size_t length = readOperation->bytesLeftFromLoop(streamIdx);
+      readOperation->readInPlaceFromLoop(
+          streamIdx, slab.data.get() + slab.begin);
+      TP_DCHECK(readOperation->completeFromLoop());
+      readOperation->callbackFromLoop(Error::kSuccess);
+      readOperations_.pop_front();
+      slab.begin += length;
+    } else {
+      char* base;
+      size_t len;
+      readOperation->allocFromLoop(streamIdx, &base, &len);
+      const size_t length = std::min(len, available);
+      std::memcpy(base, slab.data.get() + slab.begin, length);
+      readOperation->readFromLoop(streamIdx, length);
+      slab.begin += length;
+    }
+    progress = true;
+  }
+  if (slab.begin == slab.end) {
+    slab.begin = 0;
+    slab.end = 0;
+  }
+  return progress;
+}
 
-  auto& writeOperation = writeOperations_.back();
-  StreamWriteOperation::Buf* bufsPtr;
-  unsigned int bufsLen;
-  std::tie(bufsPtr, bufsLen) = writeOperation.getBufs();
-  const std::array<uv_buf_t, 2> uvBufs = {
-      uv_buf_t{bufsPtr[0].base, bufsPtr[0].len},
-      uv_buf_t{bufsPtr[1].base, bufsPtr[1].len}};
-  handle_->writeFromLoop(uvBufs.data(), bufsLen, [this](int status) {
-    this->writeCallbackFromLoop(status);
-  });
+void ConnectionImpl::updateReadingFromLoop() {
+  if (resolving_) {
+    return;
+  }
+  for (size_t streamIdx = 0; streamIdx < handles_.size(); streamIdx++) {
+    StreamReadOperation* readOperation =
+        getReadOperationForStreamFromLoop(streamIdx);
+    const bool shouldRead =
+        readOperation != nullptr && readOperation->canReadFromLoop(streamIdx);
+    if (shouldRead && !reading_[streamIdx]) {
+      handles_[streamIdx]->readStartFromLoop();
+    } else if (!shouldRead && reading_[streamIdx]) {
+      handles_[streamIdx]->readStopFromLoop();
+    }
+    reading_[streamIdx] = shouldRead;
+  }
 }
 
-void ConnectionImpl::allocCallbackFromLoop(uv_buf_t* buf) {
+void ConnectionImpl::allocCallbackFromLoop(size_t streamIdx, uv_buf_t* buf) {
   TP_DCHECK(context_->inLoop());
-  TP_THROW_ASSERT_IF(readOperations_.empty());
-  TP_VLOG(9) << "Connection " << id_
-             << " has incoming data for which it needs to provide a buffer";
-  readOperations_.front().allocFromLoop(&buf->base, &buf->len);
+  TP_VLOG(9) << "Connection " << id_ << " has incoming data on stream "
+             << streamIdx << " for which it needs to provide a buffer";
+  StreamReadOperation* readOperation =
+      getReadOperationForStreamFromLoop(streamIdx);
+  TP_THROW_ASSERT_IF(readOperation == nullptr);
+  RecvSlab& slab = recvSlabs_[streamIdx];
+  TP_DCHECK_EQ(slab.begin, slab.end);
+  if (readOperation->bytesLeftFromLoop(streamIdx) >= kRecvSlabSize) {
+    readOperation->allocFromLoop(streamIdx, &buf->base, &buf->len);
+  } else {
+    buf->base = slab.data.get();
+    buf->len = kRecvSlabSize;
+  }
 }
 
 void ConnectionImpl::readCallbackFromLoop(
+    size_t streamIdx,
     ssize_t nread,
-    const uv_buf_t* /* unused */) {
+    const uv_buf_t* buf) {
   TP_DCHECK(context_->inLoop());
-  TP_VLOG(9) << "Connection " << id_ << " has completed reading some data ("
+  TP_VLOG(9) << "Connection " << id_ << " has completed reading some data on "
+             << "stream " << streamIdx << " ("
              << (nread >= 0 ? std::to_string(nread) + " bytes"
                             : formatUvError(nread))
              << ")";
@@ -132,25 +552,36 @@ void ConnectionImpl::readCallbackFromLoop(
     return;
   }
 
-  TP_THROW_ASSERT_IF(readOperations_.empty());
-  auto& readOperation = readOperations_.front();
-  readOperation.readFromLoop(nread);
-  if (readOperation.completeFromLoop()) {
-    readOperation.callbackFromLoop(Error::kSuccess);
-    // Remove the completed operation.
-    // If this was the final pending operation, this instance should
-    // no longer receive allocation and read callbacks.
-    readOperations_.pop_front();
-    if (readOperations_.empty()) {
-      handle_->readStopFromLoop();
+  if (context_->getTCPOptions().getQuickAck()) {
+    auto rv = handles_[streamIdx]->quickAckFromLoop();
+    if (rv < 0) {
+      setError(TP_CREATE_ERROR(UVError, rv));
+      return;
     }
   }
+
+  RecvSlab& slab = recvSlabs_[streamIdx];
+  if (buf->base == slab.data.get()) {
+    slab.end += nread;
+  } else {
+    StreamReadOperation* readOperation =
+        getReadOperationForStreamFromLoop(streamIdx);
+    TP_THROW_ASSERT_IF(readOperation == nullptr);
+    readOperation->readFromLoop(streamIdx, nread);
+  }
+
+  processReadOperationsFromLoop();
 }
 
-void ConnectionImpl::writeCallbackFromLoop(int status) {
+void ConnectionImpl::writeCallbackFromLoop(
+    int status,
+    size_t streamIdx,
+    uint64_t firstSequenceNumber,
+    uint64_t lastSequenceNumber) {
   TP_DCHECK(context_->inLoop());
-  TP_VLOG(9) << "Connection " << id_ << " has completed a write request ("
-             << formatUvError(status) << ")";
+  TP_VLOG(9) << "Connection " << id_ << " has completed a write request on "
+             << "stream " << streamIdx << " (" << formatUvError(status) << ", "
+             << lastSequenceNumber - firstSequenceNumber + 1 << " operations)";
 
   if (status < 0) {
     setError(TP_CREATE_ERROR(UVError, status));
@@ -162,15 +593,58 @@ void ConnectionImpl::writeCallbackFromLoop(int status) {
     // this method, both in case of success and of error.
   }
 
-  TP_THROW_ASSERT_IF(writeOperations_.empty());
-  auto& writeOperation = writeOperations_.front();
-  writeOperation.callbackFromLoop(error_);
-  writeOperations_.pop_front();
+  // The operations of the request that this stream doesn't carry may already
+  // be complete, and thus gone, but not the ones that it does carry.
+  const uint64_t frontSequenceNumber =
+      nextWriteSequenceNumber_ - writeOperations_.size();
+  for (uint64_t sequenceNumber =
+           std::max(firstSequenceNumber, frontSequenceNumber);
+       sequenceNumber <= lastSequenceNumber;
+       sequenceNumber++) {
+    StreamWriteOperation& writeOperation = getWriteOperation(sequenceNumber);
+    if (writeOperation.usesStream(streamIdx)) {
+      writeOperation.writeCompletedFromLoop();
+    }
+  }
+
+  updateWriteQueueBytesFromLoop();
+  completeWriteOperationsFromLoop();
+}
+
+void ConnectionImpl::completeWriteOperationsFromLoop() {
+  // The callbacks are fired in order, even if the writes of a later operation
+  // (e.g., one only carried by the first stream) completed earlier.
+  while (!writeOperations_.empty() &&
+         writeOperations_.front().completeFromLoop()) {
+    writeOperations_.front().callbackFromLoop(error_);
+    writeOperations_.pop_front();
+  }
+}
+
+void ConnectionImpl::updateWriteQueueBytesFromLoop() {
+  // Once the handles are closing their queues are being flushed, hence they
+  // are no longer accounted for.
+  size_t writeQueueBytes = 0;
+  if (!error_) {
+    for (auto& handle : handles_) {
+      writeQueueBytes += handle->writeQueueSizeFromLoop();
+    }
+  }
+  statsCounters_.addWriteQueueBytes(
+      static_cast<int64_t>(writeQueueBytes) -
+      static_cast<int64_t>(writeQueueBytes_));
+  writeQueueBytes_ = writeQueueBytes;
 }
 
 void ConnectionImpl::closeCallbackFromLoop() {
   TP_DCHECK(context_->inLoop());
-  TP_VLOG(9) << "Connection " << id_ << " has finished closing its handle";
+  numClosedHandles_++;
+  TP_VLOG(9) << "Connection " << id_ << " has finished closing "
+             << numClosedHandles_ << " of its " << numHandles_
+             << " handles";
+  if (numClosedHandles_ < numHandles_) {
+    return;
+  }
   TP_DCHECK(writeOperations_.empty());
   context_->unenroll(*this);
 }
@@ -180,12 +654,31 @@ void ConnectionImpl::handleErrorImpl() {
     readOperation.callbackFromLoop(error_);
   }
   readOperations_.clear();
+  if (resolving_) {
+    // The handles haven't been set up yet, and hence no write was issued.
+    for (auto& writeOperation : writeOperations_) {
+      writeOperation.callbackFromLoop(error_);
+    }
+    writeOperations_.clear();
+    context_->unenroll(*this);
+    return;
+  }
   // Do NOT fire the callbacks of the write operations, because we must wait for
   // their corresponding UV write requests to complete (or else the user may
   // deallocate the buffers while the loop is still processing them).
-  handle_->closeFromLoop();
-  // Do NOT unenroll here, as we must keep the UV handle alive until the close
-  // callback fires.
+  for (auto& writer : zeroCopyWriters_) {
+    writer->closeFromLoop();
+  }
+  for (auto& handle : handles_) {
+    handle->closeFromLoop();
+  }
+  if (zeroCopyCheck_ != nullptr) {
+    zeroCopyCheck_->closeFromLoop();
+    zeroCopyTimer_->closeFromLoop();
+  }
+  updateWriteQueueBytesFromLoop();
+  // Do NOT unenroll here, as we must keep the UV handles alive until the close
+  // callbacks fire.
 }
 
 } // namespace uv
@@ -9,15 +9,19 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <deque>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/read_buffer_pool.h>
 #include <tensorpipe/common/stream_read_write_ops.h>
 #include <tensorpipe/transport/connection_impl_boilerplate.h>
 #include <tensorpipe/transport/uv/sockaddr.h>
 #include <tensorpipe/transport/uv/uv.h>
+#include <tensorpipe/transport/uv/zero_copy_writer.h>
 
 namespace tensorpipe {
 namespace transport {
@@ -26,19 +30,29 @@ namespace uv {
 class ContextImpl;
 class ListenerImpl;
 
+// When a connection is made of several streams, each of them starts by telling
+// the listener which connection it belongs to, and at which position.
+struct StreamHello {
+  uint64_t groupId;
+  uint32_t streamIdx;
+  uint32_t numStreams;
+};
+
 class ConnectionImpl final : public ConnectionImplBoilerplate<
                                  ContextImpl,
                                  ListenerImpl,
                                  ConnectionImpl> {
  public:
-  // Create a connection that is already connected (e.g. from a listener).
+  // Create a connection that is already connected (e.g. from a listener),
+  // made of the given streams, in order.
   ConnectionImpl(
       ConstructorToken token,
       std::shared_ptr<ContextImpl> context,
       std::string id,
-      std::unique_ptr<TCPHandle> handle);
+      std::vector<std::unique_ptr<TCPHandle>> handles);
 
-  // Create a connection that connects to the specified address.
+  // Create a connection that connects to the specified address, whose host may
+  // be a hostname, which is then resolved once the connection is initialized.
   ConnectionImpl(
       ConstructorToken token,
       std::shared_ptr<ContextImpl> context,
@@ -52,26 +66,148 @@ class ConnectionImpl final : public ConnectionImplBoilerplate<
   void readImplFromLoop(void* ptr, size_t length, read_callback_fn fn) override;
   void writeImplFromLoop(const void* ptr, size_t length, write_callback_fn fn)
       override;
+  void writeImplFromLoop(
+      const AbstractNopHolder& object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn) override;
+  void writeImplFromLoop(
+      std::vector<WriteSegment> segments,
+      write_callback_fn fn) override;
   void handleErrorImpl() override;
 
  private:
-  // Called when libuv is about to read data from connection.
-  void allocCallbackFromLoop(uv_buf_t* buf);
+  // Create the sockets, set them up and, for outgoing connections, connect
+  // them, once the address to connect to is known.
+  void initHandlesFromLoop();
+
+  // Called once the hostname to connect to has been resolved.
+  void resolveCallbackFromLoop(const Error& error, std::vector<Sockaddr> addrs);
 
-  // Called when libuv has read data from connection.
-  void readCallbackFromLoop(ssize_t nread, const uv_buf_t* buf);
+  // Queue the write operations of a nop object and of the buffers that follow
+  // it, without handing them to libuv yet.
+  void appendWriteOperationsFromLoop(
+      const AbstractNopHolder& object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn);
 
-  // Called when libuv has written data to connection.
-  void writeCallbackFromLoop(int status);
+  // Called when libuv is about to read data from one of the streams.
+  void allocCallbackFromLoop(size_t streamIdx, uv_buf_t* buf);
 
-  // Called when libuv has closed the handle.
+  // Called when libuv has read data from one of the streams.
+  void readCallbackFromLoop(
+      size_t streamIdx,
+      ssize_t nread,
+      const uv_buf_t* buf);
+
+  // Called when libuv has written data to one of the streams. A single UV
+  // request may carry the data of several consecutive write operations, given
+  // by their sequence numbers, though not necessarily of all those in between.
+  void writeCallbackFromLoop(
+      int status,
+      size_t streamIdx,
+      uint64_t firstSequenceNumber,
+      uint64_t lastSequenceNumber);
+
+  // Called when libuv has closed one of the handles.
   void closeCallbackFromLoop();
 
-  const std::unique_ptr<TCPHandle> handle_;
+  // Write to the stream, through its zero-copy writer if there is one.
+  void writeToStreamFromLoop(
+      size_t streamIdx,
+      const uv_buf_t bufs[],
+      unsigned int nbufs,
+      WriteRequest::TWriteCallback fn);
+
+  // Process the kernel's reports of being done with the zero-copy data.
+  void pollZeroCopyFromLoop();
+
+  // Keep polling for the reports as long as some are expected.
+  void updateZeroCopyPollingFromLoop();
+
+  // Return the first read operation that the stream still has to read for.
+  StreamReadOperation* getReadOperationForStreamFromLoop(size_t streamIdx);
+
+  // Hand the data that's in the slabs to the read operations, fire the
+  // callbacks of those that are complete, and then update which streams read.
+  void processReadOperationsFromLoop();
+
+  // Hand as much of the data that's in the slab of the stream as possible to
+  // the read operations. Return whether it handed over any.
+  bool consumeRecvSlabFromLoop(size_t streamIdx);
+
+  // Start or stop reading from each stream depending on whether the pending
+  // read operations have something that it can read.
+  void updateReadingFromLoop();
+
+  // Hand the buffers of the write operations, with the given sequence numbers,
+  // to each stream that carries some of their data.
+  void issueWritesFromLoop(
+      uint64_t firstSequenceNumber,
+      uint64_t lastSequenceNumber);
+
+  // Fire the callbacks of the write operations at the front of the queue whose
+  // writes are complete.
+  void completeWriteOperationsFromLoop();
+
+  // Report how many bytes libuv still has to hand to the kernel, over all the
+  // streams, to the statistics.
+  void updateWriteQueueBytesFromLoop();
+
+  StreamWriteOperation& getWriteOperation(uint64_t sequenceNumber);
+
+  // One for each stream. The first one carries the lengths of the payloads.
+  const std::vector<std::unique_ptr<TCPHandle>> handles_;
+  const StreamStriping striping_;
   optional<Sockaddr> sockaddr_;
 
+  // An outgoing connection to a hostname doesn't create its sockets until the
+  // hostname is resolved, hence until then its operations merely queue up.
+  std::string hostname_;
+  uint16_t port_{0};
+  bool resolving_{false};
+
+  // When the large writes are zero-copy, all the writes to each stream go
+  // through its writer. The reports of the kernel wake up the loop only if the
+  // stream is reading, hence they're looked for after each iteration of the
+  // loop, and also periodically.
+  std::vector<std::unique_ptr<ZeroCopyWriter>> zeroCopyWriters_;
+  std::unique_ptr<CheckHandle> zeroCopyCheck_;
+  std::unique_ptr<TimerHandle> zeroCopyTimer_;
+  bool pollingZeroCopy_{false};
+
+  // Which streams are currently reading.
+  std::vector<bool> reading_;
+  size_t numHandles_{0};
+  size_t numClosedHandles_{0};
+
+  // The hellos sent on the streams of an outgoing connection, which must stay
+  // alive until they're written.
+  std::vector<StreamHello> hellos_;
+
+  // Each stream reads into a slab of its own, except when the data it has left
+  // to read for an operation is large, in which case it goes straight into its
+  // destination. A single read may thus get many small frames at once, which
+  // are parsed in place, and whose payloads are delivered from the slab itself
+  // when the user didn't provide a buffer. A stream only reads while some
+  // operation can take its data, hence once it's reading its slab is empty.
+  struct RecvSlab {
+    std::unique_ptr<char[]> data;
+    size_t begin{0};
+    size_t end{0};
+  };
+  std::vector<RecvSlab> recvSlabs_;
+
+  // Recycles the buffers of the reads that weren't given a destination. It must
+  // outlive the read operations, hence it's declared before them.
+  ReadBufferPool readBufferPool_;
+
   std::deque<StreamReadOperation> readOperations_;
   std::deque<StreamWriteOperation> writeOperations_;
+  // The sequence number of the next write operation, which lets requests refer
+  // to the operations whose data they carry.
+  uint64_t nextWriteSequenceNumber_{0};
+  // The size of the write queues as last reported to the statistics.
+  size_t writeQueueBytes_{0};
 };
 
 } // namespace uv
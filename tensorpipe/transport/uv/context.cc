@@ -8,48 +8,136 @@
 
 #include <tensorpipe/transport/uv/context.h>
 
+#include <map>
 #include <memory>
 #include <string>
 #include <tuple>
 #include <utility>
+#include <vector>
 
+#include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/stream_read_write_ops.h>
+#include <tensorpipe/transport/uv/addr_cache.h>
 #include <tensorpipe/transport/uv/connection_impl.h>
 #include <tensorpipe/transport/uv/context_impl.h>
 #include <tensorpipe/transport/uv/listener_impl.h>
+#include <tensorpipe/transport/uv/sharded_listener.h>
 
 namespace tensorpipe {
 namespace transport {
 namespace uv {
 
-Context::Context() : impl_(std::make_shared<ContextImpl>()) {}
+namespace {
+
+std::vector<std::shared_ptr<ContextImpl>> createImpls(
+    size_t numLoops,
+    const TCPOptions& tcpOptions,
+    const ThreadOptions& threadOptions) {
+  TP_THROW_ASSERT_IF(numLoops == 0) << "A context needs at least one loop";
+  TP_THROW_ASSERT_IF(
+      tcpOptions.getNumStreams() == 0 ||
+      tcpOptions.getNumStreams() > kMaxNumStreams)
+      << "The number of streams must be between 1 and "
+      << kMaxNumStreams;
+  // The listeners of a sharded context must be able to share their port.
+  const bool reusePort = numLoops > 1 && tcpOptions.getNumStreams() == 1;
+  std::vector<std::shared_ptr<ContextImpl>> impls;
+  impls.reserve(numLoops);
+  for (size_t loopIdx = 0; loopIdx < numLoops; loopIdx++) {
+    impls.push_back(
+        std::make_shared<ContextImpl>(reusePort, tcpOptions, threadOptions));
+  }
+  return impls;
+}
+
+} // namespace
+
+Context::Context(
+    size_t numLoops,
+    TCPOptions tcpOptions,
+    ThreadOptions threadOptions)
+    : impls_(createImpls(numLoops, tcpOptions, threadOptions)) {}
 
 // Explicitly define all methods of the context, which just forward to the impl.
 // We cannot use an intermediate ContextBoilerplate class without forcing a
 // recursive include of private headers into the public ones.
 
 std::shared_ptr<Connection> Context::connect(std::string addr) {
-  return impl_->connect(std::move(addr));
+  size_t implIdx = nextImplIdx_++ % impls_.size();
+  return impls_[implIdx]->connect(std::move(addr));
 }
 
 std::shared_ptr<Listener> Context::listen(std::string addr) {
-  return impl_->listen(std::move(addr));
+  if (impls_.size() == 1 || !impls_[0]->reusePort()) {
+    return impls_[0]->listen(std::move(addr));
+  }
+  // Have the first shard pick the port (if none was given), and the others
+  // then listen on that same port.
+  std::vector<std::shared_ptr<Listener>> listeners;
+  listeners.reserve(impls_.size());
+  listeners.push_back(impls_[0]->listen(std::move(addr)));
+  const std::string boundAddr = listeners[0]->addr();
+  for (size_t implIdx = 1; implIdx < impls_.size(); implIdx++) {
+    listeners.push_back(impls_[implIdx]->listen(boundAddr));
+  }
+  auto listener = std::make_shared<ShardedListener>(std::move(listeners));
+  listener->init();
+  return listener;
 }
 
 const std::string& Context::domainDescriptor() const {
-  return impl_->domainDescriptor();
+  // All shards have the same domain descriptor.
+  return impls_[0]->domainDescriptor();
 }
 
 void Context::setId(std::string id) {
-  impl_->setId(std::move(id));
+  if (impls_.size() == 1) {
+    impls_[0]->setId(std::move(id));
+    return;
+  }
+  for (size_t implIdx = 0; implIdx < impls_.size(); implIdx++) {
+    impls_[implIdx]->setId(id + "." + std::to_string(implIdx));
+  }
+}
+
+void Context::enableLoopStats() {
+  for (auto& impl : impls_) {
+    impl->enableLoopStats();
+  }
+}
+
+std::map<std::string, LoopStats> Context::getLoopStats() {
+  // The loops are told apart by their index, as the shards are by their id.
+  if (impls_.size() == 1) {
+    return {{"loop", impls_[0]->getLoopStats()}};
+  }
+  std::map<std::string, LoopStats> stats;
+  for (size_t implIdx = 0; implIdx < impls_.size(); implIdx++) {
+    stats.emplace(
+        "loop." + std::to_string(implIdx), impls_[implIdx]->getLoopStats());
+  }
+  return stats;
+}
+
+TransportStats Context::getTransportStats() {
+  TransportStats stats;
+  for (auto& impl : impls_) {
+    stats.merge(impl->getTransportStats());
+  }
+  return stats;
 }
 
 void Context::close() {
-  impl_->close();
+  for (auto& impl : impls_) {
+    impl->close();
+  }
 }
 
 void Context::join() {
-  impl_->join();
+  for (auto& impl : impls_) {
+    impl->join();
+  }
 }
 
 Context::~Context() {
@@ -57,11 +145,17 @@ Context::~Context() {
 }
 
 std::tuple<Error, std::string> Context::lookupAddrForIface(std::string iface) {
-  return impl_->lookupAddrForIface(std::move(iface));
+  return impls_[0]->lookupAddrForIface(std::move(iface));
 }
 
 std::tuple<Error, std::string> Context::lookupAddrForHostname() {
-  return impl_->lookupAddrForHostname();
+  return impls_[0]->lookupAddrForHostname();
+}
+
+void setAddrForHostname(std::string hostname, std::string addr) {
+  Sockaddr sockaddr = Sockaddr::createInetSockAddr(addr);
+  sockaddr.setPort(0);
+  AddrCache::forHostnames().pin(hostname, {std::move(sockaddr)});
 }
 
 } // namespace uv
@@ -8,11 +8,17 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <map>
 #include <memory>
 #include <string>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/thread_options.h>
 #include <tensorpipe/transport/context.h>
 
 namespace tensorpipe {
@@ -21,9 +27,169 @@ namespace uv {
 
 class ContextImpl;
 
+// How the context uses TCP for all its connections, both outgoing and accepted.
+// By default each connection is a single TCP connection, with Nagle's algorithm
+// disabled, as it combines badly with delayed acknowledgments in request and
+// response patterns, and everything else is left to the system's defaults.
+class TCPOptions {
+ public:
+  // Back each outgoing connection by this many TCP connections, and stripe the
+  // large payloads across all of them, as a single TCP stream can't fill a
+  // fast link. Small payloads still only go on the first one. The peer context
+  // must also use more than one stream (though not necessarily as many), as
+  // the accepting end needs to know that it must group the incoming ones.
+  TCPOptions&& numStreams(size_t numStreams) && {
+    numStreams_ = numStreams;
+    return std::move(*this);
+  }
+
+  // Whether to set TCP_NODELAY, to send small writes right away instead of
+  // waiting for the acknowledgment of the previous ones.
+  TCPOptions&& noDelay(bool noDelay) && {
+    noDelay_ = noDelay;
+    return std::move(*this);
+  }
+
+  // The sizes of the kernel's send and receive buffers (SO_SNDBUF, SO_RCVBUF)
+  // in bytes. Larger ones are needed to fill high bandwidth-delay links. They
+  // are set before connecting, so that the window scaling can account for them.
+  TCPOptions&& sendBufferSize(int size) && {
+    sendBufferSize_ = size;
+    return std::move(*this);
+  }
+
+  TCPOptions&& receiveBufferSize(int size) && {
+    receiveBufferSize_ = size;
+    return std::move(*this);
+  }
+
+  // Busy-poll the device queue for this many microseconds when waiting for
+  // data (SO_BUSY_POLL), trading CPU for latency. Linux-only, and raising it
+  // above the system's default (net.core.busy_read) requires CAP_NET_ADMIN.
+  TCPOptions&& busyPoll(int usecs) && {
+    busyPoll_ = usecs;
+    return std::move(*this);
+  }
+
+  // Enable TCP keepalive, probing the peer after this many seconds of idleness,
+  // so that connections to hosts that went away are eventually detected.
+  TCPOptions&& keepAlive(unsigned int delaySecs) && {
+    keepAliveDelay_ = delaySecs;
+    return std::move(*this);
+  }
+
+  // Acknowledge received data right away rather than delaying the ACKs. The
+  // kernel resets this flag over time, hence it is set again after each read.
+  // Linux-only.
+  TCPOptions&& quickAck(bool quickAck) && {
+    quickAck_ = quickAck;
+    return std::move(*this);
+  }
+
+  // Send the payloads of at least this many bytes with MSG_ZEROCOPY, to spare
+  // the kernel from copying them, which costs as much CPU as the rest of the
+  // network stack for large ones. Their write callbacks are then delayed until
+  // the kernel has released their pages. Below a few hundred kilobytes this
+  // doesn't pay for the bookkeeping. Linux-only.
+  TCPOptions&& zeroCopyThreshold(size_t threshold) && {
+    zeroCopyThreshold_ = threshold;
+    return std::move(*this);
+  }
+
+  // Keep the thread of each loop spinning, checking for events without ever
+  // blocking, until this many microseconds have gone by without any, before it
+  // goes to sleep. This spares the latency of waking it up when the data comes
+  // in, at the cost of keeping a core busy. (Combine with busyPoll to also have
+  // the kernel poll the device queue rather than waiting for its interrupts.)
+  TCPOptions&& pollWindow(unsigned int usecs) && {
+    pollWindow_ = usecs;
+    return std::move(*this);
+  }
+
+  // The length of the queue of the connections that the kernel has completed
+  // but that the listeners haven't accepted yet, past which it drops the new
+  // ones (and the clients retry after a second or more). Raise it for storms
+  // of connections, e.g., when a whole job connects to one process at once; a
+  // sharded context (see Context) has one such queue per loop. The kernel caps
+  // it at net.core.somaxconn.
+  TCPOptions&& listenBacklog(int backlog) && {
+    listenBacklog_ = backlog;
+    return std::move(*this);
+  }
+
+  size_t getNumStreams() const {
+    return numStreams_;
+  }
+
+  bool getNoDelay() const {
+    return noDelay_;
+  }
+
+  // Zero means the system's default.
+  int getSendBufferSize() const {
+    return sendBufferSize_;
+  }
+
+  // Zero means the system's default.
+  int getReceiveBufferSize() const {
+    return receiveBufferSize_;
+  }
+
+  // Zero means the system's default.
+  int getBusyPoll() const {
+    return busyPoll_;
+  }
+
+  // Zero means disabled.
+  unsigned int getKeepAliveDelay() const {
+    return keepAliveDelay_;
+  }
+
+  bool getQuickAck() const {
+    return quickAck_;
+  }
+
+  // Zero means disabled.
+  size_t getZeroCopyThreshold() const {
+    return zeroCopyThreshold_;
+  }
+
+  // Zero means disabled.
+  unsigned int getPollWindow() const {
+    return pollWindow_;
+  }
+
+  int getListenBacklog() const {
+    return listenBacklog_;
+  }
+
+ private:
+  size_t numStreams_{1};
+  bool noDelay_{true};
+  int sendBufferSize_{0};
+  int receiveBufferSize_{0};
+  int busyPoll_{0};
+  unsigned int keepAliveDelay_{0};
+  bool quickAck_{false};
+  size_t zeroCopyThreshold_{0};
+  unsigned int pollWindow_{0};
+  int listenBacklog_{128};
+};
+
 class Context : public transport::Context {
  public:
-  Context();
+  // The context runs numLoops event loops, each on its own thread. Outgoing
+  // connections are assigned to them in a round-robin fashion, and listeners
+  // listen on all of them at once, with the kernel balancing the incoming
+  // connections. Using more than one helps when the process has many pipes.
+  // (If the connections are made of several streams, only the first loop
+  // listens, as all the streams of a connection must end up on the same one.)
+  // The sockets of the connections are set up according to tcpOptions, and the
+  // threads of the loops according to threadOptions.
+  explicit Context(
+      size_t numLoops = 1,
+      TCPOptions tcpOptions = TCPOptions(),
+      ThreadOptions threadOptions = ThreadOptions());
 
   Context(const Context&) = delete;
   Context(Context&&) = delete;
@@ -36,12 +202,20 @@ class Context : public transport::Context {
 
   const std::string& domainDescriptor() const override;
 
+  // The addresses that these find are cached for the whole process for a
+  // while, as resolving a hostname may take seconds when DNS is slow.
   std::tuple<Error, std::string> lookupAddrForIface(std::string iface);
 
   std::tuple<Error, std::string> lookupAddrForHostname();
 
   void setId(std::string id) override;
 
+  void enableLoopStats() override;
+
+  std::map<std::string, LoopStats> getLoopStats() override;
+
+  TransportStats getTransportStats() override;
+
   void close() override;
 
   void join() override;
@@ -49,13 +223,23 @@ class Context : public transport::Context {
   ~Context() override;
 
  private:
-  // The implementation is managed by a shared_ptr because each child object
-  // will also hold a shared_ptr to it (downcast as a shared_ptr to the private
-  // interface). However, its lifetime is tied to the one of this public object,
-  // since when the latter is destroyed the implementation is closed and joined.
-  const std::shared_ptr<ContextImpl> impl_;
+  // The implementations are managed by shared_ptrs because each child object
+  // will also hold a shared_ptr to its own (downcast as a shared_ptr to the
+  // private interface). However, their lifetime is tied to the one of this
+  // public object, since when the latter is destroyed they're closed and
+  // joined. There's one of them per event loop.
+  const std::vector<std::shared_ptr<ContextImpl>> impls_;
+  std::atomic<size_t> nextImplIdx_{0};
 };
 
+// Have all the contexts of the process resolve the hostname to the given
+// numeric address (whose port, if any, is ignored) from now on, rather than
+// asking the resolver, both when connecting to the hostname (which, like any
+// other, may be given to connect as host:port) and, if it's the one of this
+// machine, in lookupAddrForHostname. This is for when the addresses are known
+// already, e.g., from the job's scheduler, and it spares the DNS lookups.
+void setAddrForHostname(std::string hostname, std::string addr);
+
 } // namespace uv
 } // namespace transport
 } // namespace tensorpipe
@@ -8,7 +8,10 @@
 
 #include <tensorpipe/transport/uv/context_impl.h>
 
+#include <utility>
+
 #include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/transport/uv/addr_cache.h>
 #include <tensorpipe/transport/uv/connection_impl.h>
 #include <tensorpipe/transport/uv/error.h>
 #include <tensorpipe/transport/uv/listener_impl.h>
@@ -26,15 +29,35 @@ namespace {
 // disambiguate descriptors when debugging.
 const std::string kDomainDescriptorPrefix{"uv:"};
 
-std::string generateDomainDescriptor() {
-  return kDomainDescriptorPrefix + "*";
+// Connections made of several streams aren't compatible with the others, as
+// the accepting end must know whether it has to group the incoming ones.
+std::string generateDomainDescriptor(bool striped) {
+  return kDomainDescriptorPrefix + "*" + (striped ? "_striped" : "");
+}
+
+std::vector<Sockaddr> getAddrsFromAddrinfo(const Addrinfo& info) {
+  std::vector<Sockaddr> addrs;
+  for (struct addrinfo* rp = info.get(); rp != nullptr; rp = rp->ai_next) {
+    TP_DCHECK(rp->ai_family == AF_INET || rp->ai_family == AF_INET6);
+    TP_DCHECK_EQ(rp->ai_socktype, SOCK_STREAM);
+    TP_DCHECK_EQ(rp->ai_protocol, IPPROTO_TCP);
+    addrs.emplace_back(rp->ai_addr, rp->ai_addrlen);
+  }
+  return addrs;
 }
 
 } // namespace
 
-ContextImpl::ContextImpl()
+ContextImpl::ContextImpl(
+    bool reusePort,
+    TCPOptions tcpOptions,
+    ThreadOptions threadOptions)
     : ContextImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl>(
-          generateDomainDescriptor()) {}
+          generateDomainDescriptor(tcpOptions.getNumStreams() > 1)),
+      loop_(std::move(threadOptions), tcpOptions.getPollWindow()),
+      reusePort_(reusePort),
+      tcpOptions_(std::move(tcpOptions)),
+      streamGroupIdGenerator_(std::random_device()()) {}
 
 void ContextImpl::closeImpl() {
   loop_.close();
@@ -46,6 +69,12 @@ void ContextImpl::joinImpl() {
 
 std::tuple<Error, std::string> ContextImpl::lookupAddrForIface(
     std::string iface) {
+  optional<std::vector<Sockaddr>> cachedAddrs =
+      AddrCache::forIfaces().get(iface);
+  if (cachedAddrs.has_value()) {
+    return std::make_tuple(Error::kSuccess, cachedAddrs.value().front().str());
+  }
+
   int rv;
   InterfaceAddresses addresses;
   int count;
@@ -64,14 +93,16 @@ std::tuple<Error, std::string> ContextImpl::lookupAddrForIface(
     const struct sockaddr* sockaddr =
         reinterpret_cast<const struct sockaddr*>(&address);
     switch (sockaddr->sa_family) {
-      case AF_INET:
-        return std::make_tuple(
-            Error::kSuccess,
-            Sockaddr(sockaddr, sizeof(address.address4)).str());
-      case AF_INET6:
-        return std::make_tuple(
-            Error::kSuccess,
-            Sockaddr(sockaddr, sizeof(address.address6)).str());
+      case AF_INET: {
+        Sockaddr addr(sockaddr, sizeof(address.address4));
+        AddrCache::forIfaces().put(iface, {addr});
+        return std::make_tuple(Error::kSuccess, addr.str());
+      }
+      case AF_INET6: {
+        Sockaddr addr(sockaddr, sizeof(address.address6));
+        AddrCache::forIfaces().put(iface, {addr});
+        return std::make_tuple(Error::kSuccess, addr.str());
+      }
     }
   }
 
@@ -95,20 +126,22 @@ std::tuple<Error, std::string> ContextImpl::lookupAddrForHostnameFromLoop() {
     return std::make_tuple(TP_CREATE_ERROR(UVError, rv), std::string());
   }
 
-  Addrinfo info;
-  std::tie(rv, info) = getAddrinfoFromLoop(loop_, std::move(hostname));
-  if (rv < 0) {
-    return std::make_tuple(TP_CREATE_ERROR(UVError, rv), std::string());
+  // The caller is waiting for the result anyway, hence on a miss the resolver
+  // is called synchronously.
+  optional<std::vector<Sockaddr>> addrs =
+      AddrCache::forHostnames().get(hostname);
+  if (!addrs.has_value()) {
+    Addrinfo info;
+    std::tie(rv, info) = getAddrinfoFromLoop(loop_, hostname);
+    if (rv < 0) {
+      return std::make_tuple(TP_CREATE_ERROR(UVError, rv), std::string());
+    }
+    addrs = getAddrsFromAddrinfo(info);
+    AddrCache::forHostnames().put(hostname, addrs.value());
   }
 
   Error error;
-  for (struct addrinfo* rp = info.get(); rp != nullptr; rp = rp->ai_next) {
-    TP_DCHECK(rp->ai_family == AF_INET || rp->ai_family == AF_INET6);
-    TP_DCHECK_EQ(rp->ai_socktype, SOCK_STREAM);
-    TP_DCHECK_EQ(rp->ai_protocol, IPPROTO_TCP);
-
-    Sockaddr addr = Sockaddr(rp->ai_addr, rp->ai_addrlen);
-
+  for (const Sockaddr& addr : addrs.value()) {
     // We allocate a shared_ptr, rather than a unique_ptr, because we then copy
     // this into the closure of the lambda we pass as close callback, to ensure
     // the handle remains alive until it's closed.
@@ -142,14 +175,77 @@ bool ContextImpl::inLoop() {
   return loop_.inLoop();
 };
 
-void ContextImpl::deferToLoop(std::function<void()> fn) {
+void ContextImpl::deferToLoop(TTask fn) {
   loop_.deferToLoop(std::move(fn));
 };
 
+void ContextImpl::enableLoopStats() {
+  loop_.enableStats();
+}
+
+LoopStats ContextImpl::getLoopStats() {
+  return loop_.getStats();
+}
+
 std::unique_ptr<TCPHandle> ContextImpl::createHandle() {
   return std::make_unique<TCPHandle>(loop_);
 };
 
+std::unique_ptr<TimerHandle> ContextImpl::createTimerHandle() {
+  return std::make_unique<TimerHandle>(loop_);
+}
+
+std::unique_ptr<CheckHandle> ContextImpl::createCheckHandle() {
+  return std::make_unique<CheckHandle>(loop_);
+}
+
+bool ContextImpl::reusePort() const {
+  return reusePort_;
+}
+
+const TCPOptions& ContextImpl::getTCPOptions() const {
+  return tcpOptions_;
+}
+
+uint64_t ContextImpl::generateStreamGroupIdFromLoop() {
+  TP_DCHECK(inLoop());
+  return streamGroupIdGenerator_();
+}
+
+void ContextImpl::resolveHostnameFromLoop(
+    std::string hostname,
+    resolve_callback_fn fn) {
+  TP_DCHECK(inLoop());
+  optional<std::vector<Sockaddr>> addrs =
+      AddrCache::forHostnames().get(hostname);
+  if (addrs.has_value()) {
+    fn(Error::kSuccess, std::move(addrs.value()));
+    return;
+  }
+
+  TP_VLOG(7) << "Transport context " << id_ << " is resolving hostname "
+             << hostname;
+  auto rv = GetAddrinfoRequest::perform(
+      loop_,
+      hostname,
+      [hostname, fn{std::move(fn)}](int status, Addrinfo info) {
+        if (status < 0) {
+          fn(TP_CREATE_ERROR(UVError, status), {});
+          return;
+        }
+        std::vector<Sockaddr> addrs = getAddrsFromAddrinfo(info);
+        if (addrs.empty()) {
+          fn(TP_CREATE_ERROR(NoAddrFoundError), {});
+          return;
+        }
+        AddrCache::forHostnames().put(hostname, addrs);
+        fn(Error::kSuccess, std::move(addrs));
+      });
+  if (rv < 0) {
+    fn(TP_CREATE_ERROR(UVError, rv), {});
+  }
+}
+
 } // namespace uv
 } // namespace transport
 } // namespace tensorpipe
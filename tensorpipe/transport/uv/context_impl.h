@@ -8,14 +8,19 @@
 
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <random>
 #include <string>
 #include <tuple>
+#include <vector>
 
 #include <tensorpipe/common/error.h>
 #include <tensorpipe/transport/context_impl_boilerplate.h>
+#include <tensorpipe/transport/uv/context.h>
 #include <tensorpipe/transport/uv/loop.h>
+#include <tensorpipe/transport/uv/sockaddr.h>
 #include <tensorpipe/transport/uv/uv.h>
 
 namespace tensorpipe {
@@ -28,7 +33,12 @@ class ListenerImpl;
 class ContextImpl final
     : public ContextImplBoilerplate<ContextImpl, ListenerImpl, ConnectionImpl> {
  public:
-  ContextImpl();
+  // When reusePort is set, listeners allow other sockets (e.g., those of the
+  // other shards of a sharded context) to bind to the same address and port.
+  explicit ContextImpl(
+      bool reusePort = false,
+      TCPOptions tcpOptions = TCPOptions(),
+      ThreadOptions threadOptions = ThreadOptions());
 
   std::tuple<Error, std::string> lookupAddrForIface(std::string iface);
 
@@ -36,10 +46,34 @@ class ContextImpl final
 
   // Implement the DeferredExecutor interface.
   bool inLoop() override;
-  void deferToLoop(std::function<void()> fn) override;
+  void deferToLoop(TTask fn) override;
+
+  void enableLoopStats();
+
+  LoopStats getLoopStats();
 
   std::unique_ptr<TCPHandle> createHandle();
 
+  std::unique_ptr<TimerHandle> createTimerHandle();
+
+  std::unique_ptr<CheckHandle> createCheckHandle();
+
+  bool reusePort() const;
+
+  const TCPOptions& getTCPOptions() const;
+
+  // The streams of an outgoing connection tell the listener which connection
+  // they belong to with this (random) identifier.
+  uint64_t generateStreamGroupIdFromLoop();
+
+  using resolve_callback_fn =
+      std::function<void(const Error& error, std::vector<Sockaddr> addrs)>;
+
+  // Look up the addresses (without port) that the hostname resolves to, in the
+  // cache or otherwise through the resolver, which then runs on libuv's thread
+  // pool rather than holding up the loop, and hand them to the callback.
+  void resolveHostnameFromLoop(std::string hostname, resolve_callback_fn fn);
+
  protected:
   // Implement the entry points called by ContextImplBoilerplate.
   void closeImpl() override;
@@ -48,6 +82,10 @@ class ContextImpl final
  private:
   Loop loop_;
 
+  const bool reusePort_;
+  const TCPOptions tcpOptions_;
+  std::mt19937_64 streamGroupIdGenerator_;
+
   std::tuple<Error, std::string> lookupAddrForHostnameFromLoop();
 };
 
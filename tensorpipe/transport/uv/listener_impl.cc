@@ -8,8 +8,14 @@
 
 #include <tensorpipe/transport/uv/listener_impl.h>
 
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/stream_read_write_ops.h>
 #include <tensorpipe/transport/uv/connection_impl.h>
 #include <tensorpipe/transport/uv/context_impl.h>
 #include <tensorpipe/transport/uv/error.h>
@@ -38,12 +44,17 @@ void ListenerImpl::initImplFromLoop() {
 
   TP_VLOG(9) << "Listener " << id_ << " is initializing in loop";
 
-  handle_->initFromLoop();
+  if (context_->reusePort()) {
+    handle_->initWithReusePortFromLoop(sockaddr_);
+  } else {
+    handle_->initFromLoop();
+  }
   auto rv = handle_->bindFromLoop(sockaddr_);
   TP_THROW_UV_IF(rv < 0, rv);
   handle_->armCloseCallbackFromLoop(
       [this]() { this->closeCallbackFromLoop(); });
   handle_->listenFromLoop(
+      context_->getTCPOptions().getListenBacklog(),
       [this](int status) { this->connectionCallbackFromLoop(status); });
 }
 
@@ -69,8 +80,118 @@ void ListenerImpl::connectionCallbackFromLoop(int status) {
   auto connection = context_->createHandle();
   connection->initFromLoop();
   handle_->acceptFromLoop(*connection);
+
+  if (context_->getTCPOptions().getNumStreams() == 1) {
+    std::vector<std::unique_ptr<TCPHandle>> handles;
+    handles.push_back(std::move(connection));
+    callback_.trigger(
+        Error::kSuccess, createAndInitConnection(std::move(handles)));
+    return;
+  }
+
+  const uint64_t streamId = nextPendingStreamId_++;
+  connection->armAllocCallbackFromLoop([this, streamId](uv_buf_t* buf) {
+    this->helloAllocCallbackFromLoop(streamId, buf);
+  });
+  connection->armReadCallbackFromLoop(
+      [this, streamId](ssize_t nread, const uv_buf_t* /* unused */) {
+        this->helloReadCallbackFromLoop(streamId, nread);
+      });
+  connection->readStartFromLoop();
+  pendingStreams_[streamId].handle = std::move(connection);
+}
+
+void ListenerImpl::helloAllocCallbackFromLoop(
+    uint64_t streamId,
+    uv_buf_t* buf) {
+  TP_DCHECK(context_->inLoop());
+  PendingStream& stream = pendingStreams_.at(streamId);
+  buf->base = reinterpret_cast<char*>(&stream.hello) + stream.bytesRead;
+  buf->len = sizeof(stream.hello) - stream.bytesRead;
+}
+
+void ListenerImpl::helloReadCallbackFromLoop(
+    uint64_t streamId,
+    ssize_t nread) {
+  TP_DCHECK(context_->inLoop());
+  auto iter = pendingStreams_.find(streamId);
+  TP_DCHECK(iter != pendingStreams_.end());
+  PendingStream& stream = iter->second;
+
+  if (nread < 0) {
+    TP_VLOG(9) << "Listener " << id_ << " lost an incoming stream ("
+               << formatUvError(nread) << ")";
+    discardHandleFromLoop(std::move(stream.handle));
+    pendingStreams_.erase(iter);
+    return;
+  }
+
+  stream.bytesRead += nread;
+  if (stream.bytesRead < sizeof(stream.hello)) {
+    return;
+  }
+
+  // Rearming the callbacks of the handle can't happen while they're running.
+  stream.handle->readStopFromLoop();
+  context_->deferToLoop(
+      runIfAlive(*this, [streamId](ListenerImpl& impl) {
+        impl.helloReceivedFromLoop(streamId);
+      }));
+}
+
+void ListenerImpl::helloReceivedFromLoop(uint64_t streamId) {
+  TP_DCHECK(context_->inLoop());
+  auto iter = pendingStreams_.find(streamId);
+  if (iter == pendingStreams_.end()) {
+    // The listener was closed in the meantime.
+    return;
+  }
+  std::unique_ptr<TCPHandle> handle = std::move(iter->second.handle);
+  const StreamHello hello = iter->second.hello;
+  pendingStreams_.erase(iter);
+  handle->disarmAllocAndReadCallbacksFromLoop();
+
+  TP_VLOG(9) << "Listener " << id_ << " got stream " << hello.streamIdx
+             << " of " << hello.numStreams << " of incoming connection "
+             << hello.groupId;
+
+  PendingGroup& group = pendingGroups_[hello.groupId];
+  if (group.handles.empty()) {
+    if (hello.numStreams < 2 || hello.numStreams > kMaxNumStreams) {
+      TP_LOG_WARNING() << "Listener " << id_ << " got an invalid number of "
+                       << "streams (" << hello.numStreams << ")";
+      pendingGroups_.erase(hello.groupId);
+      discardHandleFromLoop(std::move(handle));
+      return;
+    }
+    group.handles.resize(hello.numStreams);
+  }
+  if (hello.numStreams != group.handles.size() ||
+      hello.streamIdx >= group.handles.size() ||
+      group.handles[hello.streamIdx] != nullptr) {
+    TP_LOG_WARNING() << "Listener " << id_ << " got an inconsistent stream "
+                     << "for incoming connection " << hello.groupId;
+    discardHandleFromLoop(std::move(handle));
+    return;
+  }
+  group.handles[hello.streamIdx] = std::move(handle);
+  group.numArrived++;
+  if (group.numArrived < group.handles.size()) {
+    return;
+  }
+
+  std::vector<std::unique_ptr<TCPHandle>> handles = std::move(group.handles);
+  pendingGroups_.erase(hello.groupId);
   callback_.trigger(
-      Error::kSuccess, createAndInitConnection(std::move(connection)));
+      Error::kSuccess, createAndInitConnection(std::move(handles)));
+}
+
+void ListenerImpl::discardHandleFromLoop(std::unique_ptr<TCPHandle> handle) {
+  // The handle must stay alive until it's closed, hence it holds onto itself.
+  auto sharedHandle = std::shared_ptr<TCPHandle>(std::move(handle));
+  sharedHandle->armCloseCallbackFromLoop(
+      [sharedHandle]() mutable { sharedHandle.reset(); });
+  sharedHandle->closeFromLoop();
 }
 
 void ListenerImpl::closeCallbackFromLoop() {
@@ -82,6 +203,21 @@ void ListenerImpl::handleErrorImpl() {
   callback_.triggerAll([&]() {
     return std::make_tuple(std::cref(error_), std::shared_ptr<Connection>());
   });
+  // The streams that haven't formed a connection yet won't form one anymore.
+  // (Streams whose connection never completes, e.g. because some of its other
+  // streams failed to connect, also linger until then.)
+  for (auto& iter : pendingStreams_) {
+    discardHandleFromLoop(std::move(iter.second.handle));
+  }
+  pendingStreams_.clear();
+  for (auto& iter : pendingGroups_) {
+    for (auto& handle : iter.second.handles) {
+      if (handle != nullptr) {
+        discardHandleFromLoop(std::move(handle));
+      }
+    }
+  }
+  pendingGroups_.clear();
   handle_->closeFromLoop();
   // Do NOT unenroll here, as we must keep the UV handle alive until the close
   // callback fires.
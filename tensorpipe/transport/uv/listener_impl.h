@@ -8,11 +8,15 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/transport/listener_impl_boilerplate.h>
+#include <tensorpipe/transport/uv/connection_impl.h>
 #include <tensorpipe/transport/uv/sockaddr.h>
 #include <tensorpipe/transport/uv/uv.h>
 
@@ -51,9 +55,36 @@ class ListenerImpl final : public ListenerImplBoilerplate<
   // Called when libuv has closed the handle.
   void closeCallbackFromLoop();
 
+  // When the connections are made of several streams, each accepted stream
+  // first sends a hello, with which it's matched with the other streams of its
+  // connection. These are called while receiving it, and once it's complete.
+  void helloAllocCallbackFromLoop(uint64_t streamId, uv_buf_t* buf);
+  void helloReadCallbackFromLoop(uint64_t streamId, ssize_t nread);
+  void helloReceivedFromLoop(uint64_t streamId);
+
+  // Close a handle that won't make it into a connection.
+  void discardHandleFromLoop(std::unique_ptr<TCPHandle> handle);
+
   const std::unique_ptr<TCPHandle> handle_;
   Sockaddr sockaddr_;
 
+  // A stream whose hello hasn't been fully received yet.
+  struct PendingStream {
+    std::unique_ptr<TCPHandle> handle;
+    StreamHello hello;
+    size_t bytesRead{0};
+  };
+
+  // The streams of an incoming connection, at their positions, as they arrive.
+  struct PendingGroup {
+    std::vector<std::unique_ptr<TCPHandle>> handles;
+    size_t numArrived{0};
+  };
+
+  std::unordered_map<uint64_t, PendingStream> pendingStreams_;
+  uint64_t nextPendingStreamId_{0};
+  std::unordered_map<uint64_t, PendingGroup> pendingGroups_;
+
   // Once an accept callback fires, it becomes disarmed and must be rearmed.
   // Any firings that occur while the callback is disarmed are stashed and
   // triggered as soon as it's rearmed. With libuv we don't have the ability
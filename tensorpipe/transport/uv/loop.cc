@@ -8,6 +8,8 @@
 
 #include <tensorpipe/transport/uv/loop.h>
 
+#include <poll.h>
+
 #include <tensorpipe/common/system.h>
 #include <tensorpipe/transport/uv/uv.h>
 
@@ -15,7 +17,8 @@ namespace tensorpipe {
 namespace transport {
 namespace uv {
 
-Loop::Loop() {
+Loop::Loop(ThreadOptions threadOptions, unsigned int pollWindowUsecs)
+    : pollWindow_(pollWindowUsecs) {
   int rv;
   rv = uv_loop_init(&loop_);
   TP_THROW_UV_IF(rv < 0, rv);
@@ -23,7 +26,7 @@ Loop::Loop() {
   TP_THROW_UV_IF(rv < 0, rv);
   async_.data = this;
 
-  startThread("TP_UV_loop");
+  startThread("TP_UV_loop", std::move(threadOptions));
 }
 
 void Loop::close() {
@@ -55,11 +58,40 @@ void Loop::wakeupEventLoopToDeferFunction() {
 void Loop::eventLoop() {
   int rv;
 
+  // The polling loop needs to check the backend for events without running
+  // them, which it can't do on the platforms that don't have a descriptor.
+  if (pollWindow_.count() > 0 && uv_backend_fd(&loop_) >= 0) {
+    runPollingLoop();
+    return;
+  }
+
   rv = uv_run(&loop_, UV_RUN_DEFAULT);
   TP_THROW_ASSERT_IF(rv > 0)
       << ": uv_run returned with active handles or requests";
 }
 
+void Loop::runPollingLoop() {
+  // The backend (epoll, kqueue, ...) is itself readable when any of the
+  // descriptors it watches has an event, which can be checked without
+  // blocking. The rest (timers that expired, handles being closed, ...) shows
+  // in the timeout that the loop would use, once its time is up to date.
+  struct pollfd pfd;
+  pfd.fd = uv_backend_fd(&loop_);
+  pfd.events = POLLIN;
+  auto lastEvent = std::chrono::steady_clock::now();
+  while (uv_loop_alive(&loop_)) {
+    uv_update_time(&loop_);
+    pfd.revents = 0;
+    if (uv_backend_timeout(&loop_) == 0 || ::poll(&pfd, 1, 0) > 0) {
+      uv_run(&loop_, UV_RUN_NOWAIT);
+      lastEvent = std::chrono::steady_clock::now();
+    } else if (std::chrono::steady_clock::now() - lastEvent >= pollWindow_) {
+      uv_run(&loop_, UV_RUN_ONCE);
+      lastEvent = std::chrono::steady_clock::now();
+    }
+  }
+}
+
 void Loop::cleanUpLoop() {
   int rv;
 
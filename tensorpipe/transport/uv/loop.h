@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <future>
 #include <memory>
@@ -19,6 +20,7 @@
 
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/thread_options.h>
 
 namespace tensorpipe {
 namespace transport {
@@ -26,7 +28,11 @@ namespace uv {
 
 class Loop final : public EventLoopDeferredExecutor {
  public:
-  Loop();
+  // If pollWindowUsecs isn't zero, the thread doesn't block waiting for events
+  // until it has gone that long without finding any.
+  explicit Loop(
+      ThreadOptions threadOptions = ThreadOptions(),
+      unsigned int pollWindowUsecs = 0);
 
   uv_loop_t* ptr() {
     return &loop_;
@@ -55,9 +61,14 @@ class Loop final : public EventLoopDeferredExecutor {
  private:
   uv_loop_t loop_;
   uv_async_t async_;
+  const std::chrono::microseconds pollWindow_;
   std::atomic<bool> closed_{false};
   std::atomic<bool> joined_{false};
 
+  // Run the loop like UV_RUN_DEFAULT, except that it only blocks once it has
+  // spun for the poll window without finding any event.
+  void runPollingLoop();
+
   // This function is called by the event loop thread whenever
   // we have to run a number of deferred functions.
   static void uvAsyncCb(uv_async_t* handle);
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uv/sharded_listener.h>
+
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/transport/error.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uv {
+
+ShardedListener::ShardedListener(
+    std::vector<std::shared_ptr<Listener>> listeners)
+    : listeners_(std::move(listeners)) {
+  TP_DCHECK(!listeners_.empty());
+}
+
+void ShardedListener::init() {
+  loop_.deferToLoop([this]() {
+    for (size_t listenerIdx = 0; listenerIdx < listeners_.size();
+         listenerIdx++) {
+      armListenerFromLoop(listenerIdx);
+    }
+  });
+}
+
+void ShardedListener::armListenerFromLoop(size_t listenerIdx) {
+  TP_DCHECK(loop_.inLoop());
+  listeners_[listenerIdx]->accept(runIfAlive(
+      *this,
+      [listenerIdx](
+          ShardedListener& listener,
+          const Error& error,
+          std::shared_ptr<Connection> connection) {
+        // The callback is invoked from the shard's event loop, and the ones of
+        // the different shards may race, hence funnel them through our loop.
+        listener.loop_.deferToLoop([listenerIdx,
+                                    listener{listener.shared_from_this()},
+                                    error,
+                                    connection{std::move(connection)}]() {
+          listener->onAcceptFromLoop(
+              listenerIdx, error, std::move(connection));
+        });
+      }));
+}
+
+void ShardedListener::onAcceptFromLoop(
+    size_t listenerIdx,
+    const Error& error,
+    std::shared_ptr<Connection> connection) {
+  TP_DCHECK(loop_.inLoop());
+  if (error_) {
+    return;
+  }
+  if (error) {
+    // One shard failing (which includes it being closed) brings down the whole
+    // listener, as otherwise part of the incoming connections would be lost.
+    error_ = error;
+    for (auto& listener : listeners_) {
+      listener->close();
+    }
+    triggerAllFromLoop();
+    return;
+  }
+  callback_.trigger(Error::kSuccess, std::move(connection));
+  armListenerFromLoop(listenerIdx);
+}
+
+void ShardedListener::triggerAllFromLoop() {
+  TP_DCHECK(loop_.inLoop());
+  callback_.triggerAll([&]() {
+    return std::tuple<const Error&, std::shared_ptr<Connection>>(
+        error_, std::shared_ptr<Connection>());
+  });
+}
+
+void ShardedListener::accept(accept_callback_fn fn) {
+  loop_.deferToLoop([this, fn{std::move(fn)}]() mutable {
+    // Connections that were accepted before an error are still delivered.
+    callback_.arm(std::move(fn));
+    if (error_) {
+      triggerAllFromLoop();
+    }
+  });
+}
+
+std::string ShardedListener::addr() const {
+  return listeners_[0]->addr();
+}
+
+void ShardedListener::setId(std::string id) {
+  for (size_t listenerIdx = 0; listenerIdx < listeners_.size();
+       listenerIdx++) {
+    listeners_[listenerIdx]->setId(id + "." + std::to_string(listenerIdx));
+  }
+}
+
+void ShardedListener::close() {
+  loop_.deferToLoop([listener{shared_from_this()}]() {
+    listener->closeFromLoop();
+  });
+}
+
+void ShardedListener::closeFromLoop() {
+  TP_DCHECK(loop_.inLoop());
+  // The shards' own accept callbacks don't reach us once we're being
+  // destroyed, hence fail the pending accepts here rather than waiting for
+  // them, as the other listeners do.
+  if (!error_) {
+    error_ = TP_CREATE_ERROR(ListenerClosedError);
+    triggerAllFromLoop();
+  }
+  for (auto& listener : listeners_) {
+    listener->close();
+  }
+}
+
+ShardedListener::~ShardedListener() {
+  // This can't defer to the loop with a reference to this object, hence it
+  // waits for the loop instead.
+  loop_.runInLoop([this]() { closeFromLoop(); });
+}
+
+} // namespace uv
+} // namespace transport
+} // namespace tensorpipe
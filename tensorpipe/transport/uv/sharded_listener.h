@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/deferred_executor.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/transport/listener.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uv {
+
+// A listener that is made of one listener per shard of a sharded context, all
+// listening on the same address and port (thanks to SO_REUSEPORT), hence the
+// kernel spreads the incoming connections across the shards' event loops. It
+// forwards them, in the order they arrive, to the accept callbacks.
+class ShardedListener final
+    : public Listener,
+      public std::enable_shared_from_this<ShardedListener> {
+ public:
+  explicit ShardedListener(std::vector<std::shared_ptr<Listener>> listeners);
+
+  // Start accepting on all the shards. To be called right after construction,
+  // as it needs a shared_ptr to this object.
+  void init();
+
+  void accept(accept_callback_fn fn) override;
+
+  std::string addr() const override;
+
+  void setId(std::string id) override;
+
+  void close() override;
+
+  ~ShardedListener() override;
+
+ private:
+  OnDemandDeferredExecutor loop_;
+  const std::vector<std::shared_ptr<Listener>> listeners_;
+  Error error_{Error::kSuccess};
+
+  RearmableCallback<const Error&, std::shared_ptr<Connection>> callback_;
+
+  void armListenerFromLoop(size_t listenerIdx);
+  void onAcceptFromLoop(
+      size_t listenerIdx,
+      const Error& error,
+      std::shared_ptr<Connection> connection);
+  void triggerAllFromLoop();
+  void closeFromLoop();
+};
+
+} // namespace uv
+} // namespace transport
+} // namespace tensorpipe
@@ -23,6 +23,20 @@ namespace transport {
 namespace uv {
 
 Sockaddr Sockaddr::createInetSockAddr(const std::string& str) {
+  std::string host;
+  uint16_t port;
+  std::tie(host, port) = splitHostAndPort(str);
+
+  optional<Sockaddr> addr = createNumericInetSockAddr(host, port);
+  if (!addr.has_value()) {
+    // Invalid address.
+    TP_THROW_EINVAL() << str;
+  }
+  return std::move(addr.value());
+}
+
+std::tuple<std::string, uint16_t> Sockaddr::splitHostAndPort(
+    const std::string& str) {
   int port = 0;
   std::string addrStr;
   std::string portStr;
@@ -41,12 +55,12 @@ Sockaddr Sockaddr::createInetSockAddr(const std::string& str) {
     }
   }
 
-  // If the input string is an IPv4 address with port, we expect
-  // at least a single period and a single colon in the string.
+  // If the input string is an IPv4 address or a hostname with port, we expect
+  // a single colon in the string (IPv6 addresses have at least two).
   if (addrStr.empty()) {
-    auto period = str.find(".");
     auto colon = str.find(":");
-    if (period != std::string::npos && colon != std::string::npos) {
+    if (colon != std::string::npos &&
+        str.find(":", colon + 1) == std::string::npos) {
       addrStr = str.substr(0, colon);
       portStr = str.substr(colon + 1);
     }
@@ -65,10 +79,16 @@ Sockaddr Sockaddr::createInetSockAddr(const std::string& str) {
     }
   }
 
+  return std::make_tuple(std::move(addrStr), static_cast<uint16_t>(port));
+}
+
+optional<Sockaddr> Sockaddr::createNumericInetSockAddr(
+    const std::string& host,
+    uint16_t port) {
   // Try to convert an IPv4 address.
   {
     struct sockaddr_in addr;
-    auto rv = uv_ip4_addr(addrStr.c_str(), port, &addr);
+    auto rv = uv_ip4_addr(host.c_str(), port, &addr);
     if (rv == 0) {
       return Sockaddr(reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
     }
@@ -77,18 +97,23 @@ Sockaddr Sockaddr::createInetSockAddr(const std::string& str) {
   // Try to convert an IPv6 address.
   {
     struct sockaddr_in6 addr;
-    auto rv = uv_ip6_addr(addrStr.c_str(), port, &addr);
+    auto rv = uv_ip6_addr(host.c_str(), port, &addr);
     if (rv == 0) {
       return Sockaddr(reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
     }
   }
 
-  // Invalid address.
-  TP_THROW_EINVAL() << str;
+  return nullopt;
+}
 
-  // Return bogus to silence "return from non-void function" warning.
-  // Note: we don't reach this point per the throw above.
-  return Sockaddr(nullptr, 0);
+void Sockaddr::setPort(uint16_t port) {
+  if (addr_.ss_family == AF_INET) {
+    reinterpret_cast<struct sockaddr_in*>(&addr_)->sin_port = htons(port);
+  } else if (addr_.ss_family == AF_INET6) {
+    reinterpret_cast<struct sockaddr_in6*>(&addr_)->sin6_port = htons(port);
+  } else {
+    TP_THROW_EINVAL() << "invalid address family: " << addr_.ss_family;
+  }
 }
 
 std::string Sockaddr::str() const {
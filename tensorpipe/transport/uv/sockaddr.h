@@ -10,9 +10,12 @@
 
 #include <sys/socket.h>
 
+#include <cstdint>
 #include <cstring>
 #include <string>
+#include <tuple>
 
+#include <tensorpipe/common/optional.h>
 #include <tensorpipe/common/socket.h>
 
 namespace tensorpipe {
@@ -23,6 +26,18 @@ class Sockaddr final : public tensorpipe::Sockaddr {
  public:
   static Sockaddr createInetSockAddr(const std::string& str);
 
+  // Split an address given as host:port (or [host]:port for IPv6 ones, whose
+  // brackets may only be omitted when there's no port) into its host, which
+  // may be a hostname as well as a numeric one, and its port (zero if none is
+  // given).
+  static std::tuple<std::string, uint16_t> splitHostAndPort(
+      const std::string& str);
+
+  // Return the address if the host is a numeric IPv4 or IPv6 one.
+  static optional<Sockaddr> createNumericInetSockAddr(
+      const std::string& host,
+      uint16_t port);
+
   Sockaddr(const struct sockaddr* addr, socklen_t addrlen) {
     TP_ARG_CHECK(addr != nullptr);
     TP_ARG_CHECK_LE(addrlen, sizeof(addr_));
@@ -47,6 +62,8 @@ class Sockaddr final : public tensorpipe::Sockaddr {
 
   std::string str() const;
 
+  void setPort(uint16_t port);
+
  private:
   struct sockaddr_storage addr_;
   socklen_t addrlen_;
@@ -8,13 +8,25 @@
 
 #pragma once
 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
+
 #include <array>
+#include <cerrno>
+#include <cstring>
 #include <memory>
 
 #include <uv.h>
 
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/common/defs.h>
+#include <tensorpipe/transport/uv/context.h>
 #include <tensorpipe/transport/uv/loop.h>
 #include <tensorpipe/transport/uv/sockaddr.h>
 
@@ -126,6 +138,94 @@ class WriteRequest final : public BaseRequest<WriteRequest, uv_write_t> {
   TWriteCallback writeCallback_;
 };
 
+class TimerHandle final : public BaseHandle<TimerHandle, uv_timer_t> {
+  static void uvTimerCb(uv_timer_t* handle) {
+    TimerHandle& ref = *reinterpret_cast<TimerHandle*>(handle->data);
+    TP_DCHECK(ref.timerCallback_ != nullptr);
+    ref.timerCallback_();
+  }
+
+ public:
+  using TTimerCallback = std::function<void()>;
+
+  using BaseHandle<TimerHandle, uv_timer_t>::BaseHandle;
+
+  void initFromLoop() {
+    TP_DCHECK(this->loop_.inLoop());
+    TP_THROW_ASSERT_IF(loop_.closed());
+    auto rv = uv_timer_init(loop_.ptr(), this->ptr());
+    TP_THROW_UV_IF(rv < 0, rv);
+  }
+
+  void armTimerCallbackFromLoop(TTimerCallback fn) {
+    TP_DCHECK(this->loop_.inLoop());
+    TP_THROW_ASSERT_IF(timerCallback_ != nullptr);
+    timerCallback_ = std::move(fn);
+  }
+
+  // Fire the callback after timeoutMs milliseconds and then, if repeatMs isn't
+  // zero, every repeatMs milliseconds.
+  void startFromLoop(uint64_t timeoutMs, uint64_t repeatMs) {
+    TP_DCHECK(this->loop_.inLoop());
+    TP_THROW_ASSERT_IF(timerCallback_ == nullptr);
+    auto rv = uv_timer_start(this->ptr(), uvTimerCb, timeoutMs, repeatMs);
+    TP_THROW_UV_IF(rv < 0, rv);
+  }
+
+  void stopFromLoop() {
+    TP_DCHECK(this->loop_.inLoop());
+    auto rv = uv_timer_stop(this->ptr());
+    TP_THROW_UV_IF(rv < 0, rv);
+  }
+
+ private:
+  TTimerCallback timerCallback_;
+};
+
+// Fires its callback once per iteration of the loop, right after libuv has
+// processed the I/O events.
+class CheckHandle final : public BaseHandle<CheckHandle, uv_check_t> {
+  static void uvCheckCb(uv_check_t* handle) {
+    CheckHandle& ref = *reinterpret_cast<CheckHandle*>(handle->data);
+    TP_DCHECK(ref.checkCallback_ != nullptr);
+    ref.checkCallback_();
+  }
+
+ public:
+  using TCheckCallback = std::function<void()>;
+
+  using BaseHandle<CheckHandle, uv_check_t>::BaseHandle;
+
+  void initFromLoop() {
+    TP_DCHECK(this->loop_.inLoop());
+    TP_THROW_ASSERT_IF(loop_.closed());
+    auto rv = uv_check_init(loop_.ptr(), this->ptr());
+    TP_THROW_UV_IF(rv < 0, rv);
+  }
+
+  void armCheckCallbackFromLoop(TCheckCallback fn) {
+    TP_DCHECK(this->loop_.inLoop());
+    TP_THROW_ASSERT_IF(checkCallback_ != nullptr);
+    checkCallback_ = std::move(fn);
+  }
+
+  void startFromLoop() {
+    TP_DCHECK(this->loop_.inLoop());
+    TP_THROW_ASSERT_IF(checkCallback_ == nullptr);
+    auto rv = uv_check_start(this->ptr(), uvCheckCb);
+    TP_THROW_UV_IF(rv < 0, rv);
+  }
+
+  void stopFromLoop() {
+    TP_DCHECK(this->loop_.inLoop());
+    auto rv = uv_check_stop(this->ptr());
+    TP_THROW_UV_IF(rv < 0, rv);
+  }
+
+ private:
+  TCheckCallback checkCallback_;
+};
+
 template <typename T, typename U>
 class StreamHandle : public BaseHandle<T, U> {
   static void uvConnectionCb(uv_stream_t* server, int status) {
@@ -152,8 +252,6 @@ class StreamHandle : public BaseHandle<T, U> {
     ref.readCallback_(nread, buf);
   }
 
-  static constexpr int kBacklog = 128;
-
  public:
   using TConnectionCallback = std::function<void(int status)>;
   using TAcceptCallback = std::function<void(int status)>;
@@ -164,12 +262,12 @@ class StreamHandle : public BaseHandle<T, U> {
 
   // TODO Split this into a armConnectionCallback, a listenStart and a
   // listenStop method, to propagate the backpressure to the clients.
-  void listenFromLoop(TConnectionCallback connectionCallback) {
+  void listenFromLoop(int backlog, TConnectionCallback connectionCallback) {
     TP_DCHECK(this->loop_.inLoop());
     TP_THROW_ASSERT_IF(connectionCallback_ != nullptr);
     connectionCallback_ = std::move(connectionCallback);
     auto rv = uv_listen(
-        reinterpret_cast<uv_stream_t*>(this->ptr()), kBacklog, uvConnectionCb);
+        reinterpret_cast<uv_stream_t*>(this->ptr()), backlog, uvConnectionCb);
     TP_THROW_UV_IF(rv < 0, rv);
   }
 
@@ -194,6 +292,14 @@ class StreamHandle : public BaseHandle<T, U> {
     readCallback_ = std::move(fn);
   }
 
+  // Allow other callbacks to be armed, for example when the handle is passed
+  // on to a new owner. Reading must have been stopped.
+  void disarmAllocAndReadCallbacksFromLoop() {
+    TP_DCHECK(this->loop_.inLoop());
+    allocCallback_ = nullptr;
+    readCallback_ = nullptr;
+  }
+
   void readStartFromLoop() {
     TP_DCHECK(this->loop_.inLoop());
     TP_THROW_ASSERT_IF(allocCallback_ == nullptr);
@@ -222,6 +328,14 @@ class StreamHandle : public BaseHandle<T, U> {
     TP_THROW_UV_IF(rv < 0, rv);
   }
 
+  // How many bytes of the pending write requests libuv still has to hand to
+  // the kernel.
+  size_t writeQueueSizeFromLoop() {
+    TP_DCHECK(this->loop_.inLoop());
+    return uv_stream_get_write_queue_size(
+        reinterpret_cast<uv_stream_t*>(this->ptr()));
+  }
+
  protected:
   TConnectionCallback connectionCallback_;
   TAllocCallback allocCallback_;
@@ -262,13 +376,182 @@ class TCPHandle : public StreamHandle<TCPHandle, uv_tcp_t> {
   void initFromLoop() {
     TP_DCHECK(this->loop_.inLoop());
     TP_THROW_ASSERT_IF(loop_.closed());
-    int rv;
-    rv = uv_tcp_init(loop_.ptr(), this->ptr());
+    auto rv = uv_tcp_init(loop_.ptr(), this->ptr());
     TP_THROW_UV_IF(rv < 0, rv);
-    rv = uv_tcp_nodelay(this->ptr(), 1);
+  }
+
+  // Like the above, except that the socket is created right away, for the
+  // family of the given address, so that options can be set on it before it
+  // binds or connects.
+  void initFromLoop(const Sockaddr& addr) {
+    TP_DCHECK(this->loop_.inLoop());
+    TP_THROW_ASSERT_IF(loop_.closed());
+    auto rv = uv_tcp_init_ex(loop_.ptr(), this->ptr(), addr.addr()->sa_family);
     TP_THROW_UV_IF(rv < 0, rv);
   }
 
+  // Like the above, except that the socket is allowed to bind to the same
+  // address and port as other ones. The kernel then balances the incoming
+  // connections among all the sockets listening on it.
+  void initWithReusePortFromLoop(const Sockaddr& addr) {
+    initFromLoop(addr);
+    int on = 1;
+    auto rv = ::setsockopt(
+        filenoFromLoop(), SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    TP_THROW_SYSTEM_IF(rv < 0, errno);
+  }
+
+  // Apply the options to the socket, which must have been created already
+  // (i.e., the handle must have been initialized for an address, or accepted).
+  // Return zero or a negative error code, as libuv does.
+  [[nodiscard]] int setOptionsFromLoop(const TCPOptions& options) {
+    TP_DCHECK(this->loop_.inLoop());
+    int rv;
+    rv = uv_tcp_nodelay(this->ptr(), options.getNoDelay() ? 1 : 0);
+    if (rv < 0) {
+      return rv;
+    }
+    if (options.getKeepAliveDelay() > 0) {
+      rv = uv_tcp_keepalive(this->ptr(), 1, options.getKeepAliveDelay());
+      if (rv < 0) {
+        return rv;
+      }
+    }
+    if (options.getSendBufferSize() > 0) {
+      rv = setSockOptFromLoop(
+          SOL_SOCKET, SO_SNDBUF, options.getSendBufferSize());
+      if (rv < 0) {
+        return rv;
+      }
+    }
+    if (options.getReceiveBufferSize() > 0) {
+      rv = setSockOptFromLoop(
+          SOL_SOCKET, SO_RCVBUF, options.getReceiveBufferSize());
+      if (rv < 0) {
+        return rv;
+      }
+    }
+    if (options.getBusyPoll() > 0) {
+#ifdef SO_BUSY_POLL
+      rv = setSockOptFromLoop(SOL_SOCKET, SO_BUSY_POLL, options.getBusyPoll());
+      if (rv < 0) {
+        return rv;
+      }
+#else
+      return UV_ENOTSUP;
+#endif
+    }
+    if (options.getQuickAck()) {
+      rv = quickAckFromLoop();
+      if (rv < 0) {
+        return rv;
+      }
+    }
+    if (options.getZeroCopyThreshold() > 0) {
+#ifdef SO_ZEROCOPY
+      rv = setSockOptFromLoop(SOL_SOCKET, SO_ZEROCOPY, 1);
+      if (rv < 0) {
+        return rv;
+      }
+#else
+      return UV_ENOTSUP;
+#endif
+    }
+    return 0;
+  }
+
+  // Have the kernel acknowledge received data right away. The flag doesn't
+  // stick, hence this needs to be done again after receiving data.
+  [[nodiscard]] int quickAckFromLoop() {
+    TP_DCHECK(this->loop_.inLoop());
+#ifdef TCP_QUICKACK
+    return setSockOptFromLoop(IPPROTO_TCP, TCP_QUICKACK, 1);
+#else
+    return UV_ENOTSUP;
+#endif
+  }
+
+  // Hand the data to the kernel right away, bypassing libuv's queue (which thus
+  // must be empty), and without having it copied (MSG_ZEROCOPY): the pages are
+  // pinned and the data must be left untouched until the kernel reports having
+  // released them. The successful calls are numbered from zero, and the kernel
+  // refers to them by these numbers (modulo 2^32). Return how many bytes were
+  // sent, or a negative error code (UV_EAGAIN if the send buffer is full).
+  [[nodiscard]] ssize_t sendZeroCopyFromLoop(
+      const uv_buf_t bufs[],
+      unsigned int nbufs) {
+    TP_DCHECK(this->loop_.inLoop());
+#ifdef MSG_ZEROCOPY
+    // On Unix libuv's buffers have the same layout as iovecs.
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = reinterpret_cast<struct iovec*>(const_cast<uv_buf_t*>(bufs));
+    msg.msg_iovlen = nbufs;
+    ssize_t rv;
+    do {
+      rv = ::sendmsg(
+          filenoFromLoop(), &msg, MSG_ZEROCOPY | MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (rv < 0 && errno == EINTR);
+    return rv < 0 ? -errno : rv;
+#else
+    return UV_ENOTSUP;
+#endif
+  }
+
+  // Fetch one of the kernel's reports that it released the pages of the calls
+  // to sendZeroCopyFromLoop, from the first to the last one (inclusive). Return
+  // zero, UV_EAGAIN if there's no report yet, or a negative error code.
+  [[nodiscard]] int recvZeroCopyCompletionFromLoop(
+      uint32_t& first,
+      uint32_t& last) {
+    TP_DCHECK(this->loop_.inLoop());
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    std::array<char, CMSG_SPACE(sizeof(struct sock_extended_err)) + 64>
+        control;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    ssize_t rv;
+    do {
+      rv = ::recvmsg(filenoFromLoop(), &msg, MSG_ERRQUEUE);
+    } while (rv < 0 && errno == EINTR);
+    if (rv < 0) {
+      return -errno;
+    }
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+          !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+        continue;
+      }
+      const struct sock_extended_err* err =
+          reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cmsg));
+      if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0) {
+        continue;
+      }
+      first = err->ee_info;
+      last = err->ee_data;
+      return 0;
+    }
+    return UV_EPROTO;
+#else
+    return UV_ENOTSUP;
+#endif
+  }
+
+  // Have the closing of the socket reset the connection, discarding the data
+  // still in the send buffer, instead of having the kernel deliver it.
+  [[nodiscard]] int resetOnCloseFromLoop() {
+    TP_DCHECK(this->loop_.inLoop());
+    struct linger linger;
+    linger.l_onoff = 1;
+    linger.l_linger = 0;
+    auto rv = ::setsockopt(
+        filenoFromLoop(), SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    return rv < 0 ? -errno : 0;
+  }
+
   [[nodiscard]] int bindFromLoop(const Sockaddr& addr) {
     TP_DCHECK(this->loop_.inLoop());
     auto rv = uv_tcp_bind(ptr(), addr.addr(), 0);
@@ -294,6 +577,20 @@ class TCPHandle : public StreamHandle<TCPHandle, uv_tcp_t> {
     auto rv = ConnectRequest::perform(ptr(), addr.addr(), std::move(fn));
     TP_THROW_UV_IF(rv < 0, rv);
   }
+
+ private:
+  int filenoFromLoop() {
+    uv_os_fd_t fd;
+    auto rv = uv_fileno(reinterpret_cast<uv_handle_t*>(this->ptr()), &fd);
+    TP_THROW_UV_IF(rv < 0, rv);
+    return fd;
+  }
+
+  int setSockOptFromLoop(int level, int optname, int value) {
+    auto rv =
+        ::setsockopt(filenoFromLoop(), level, optname, &value, sizeof(value));
+    return rv < 0 ? -errno : 0;
+  }
 };
 
 struct AddrinfoDeleter {
@@ -304,14 +601,19 @@ struct AddrinfoDeleter {
 
 using Addrinfo = std::unique_ptr<struct addrinfo, AddrinfoDeleter>;
 
-inline std::tuple<int, Addrinfo> getAddrinfoFromLoop(
-    Loop& loop,
-    std::string hostname) {
+inline struct addrinfo getAddrinfoHints() {
   struct addrinfo hints;
   std::memset(&hints, 0, sizeof(hints));
   hints.ai_family = AF_UNSPEC;
   hints.ai_socktype = SOCK_STREAM;
   hints.ai_protocol = IPPROTO_TCP;
+  return hints;
+}
+
+inline std::tuple<int, Addrinfo> getAddrinfoFromLoop(
+    Loop& loop,
+    std::string hostname) {
+  const struct addrinfo hints = getAddrinfoHints();
 
   uv_getaddrinfo_t request;
   // Don't use a callback, and thus perform the call synchronously, because the
@@ -331,6 +633,51 @@ inline std::tuple<int, Addrinfo> getAddrinfoFromLoop(
   return std::make_tuple(0, Addrinfo(request.addrinfo, AddrinfoDeleter()));
 }
 
+// Like the above, except that the call is performed on libuv's thread pool,
+// which keeps the loop going while the resolver waits for DNS, and the result
+// is handed to the callback.
+class GetAddrinfoRequest final
+    : public BaseRequest<GetAddrinfoRequest, uv_getaddrinfo_t> {
+  static void uvGetAddrinfoCb(
+      uv_getaddrinfo_t* req,
+      int status,
+      struct addrinfo* res) {
+    std::unique_ptr<GetAddrinfoRequest> request(
+        reinterpret_cast<GetAddrinfoRequest*>(req->data));
+    request->getAddrinfoCallback_(status, Addrinfo(res, AddrinfoDeleter()));
+  }
+
+ public:
+  using TGetAddrinfoCallback = std::function<void(int status, Addrinfo info)>;
+
+  explicit GetAddrinfoRequest(TGetAddrinfoCallback fn)
+      : getAddrinfoCallback_(std::move(fn)) {}
+
+  static int perform(
+      Loop& loop,
+      const std::string& hostname,
+      TGetAddrinfoCallback fn) {
+    TP_DCHECK(loop.inLoop());
+    const struct addrinfo hints = getAddrinfoHints();
+    auto request = std::make_unique<GetAddrinfoRequest>(std::move(fn));
+    auto rv = uv_getaddrinfo(
+        loop.ptr(),
+        request->ptr(),
+        uvGetAddrinfoCb,
+        hostname.c_str(),
+        /*service=*/nullptr,
+        &hints);
+    if (rv == 0) {
+      // The callback now owns the request.
+      request.release();
+    }
+    return rv;
+  }
+
+ private:
+  TGetAddrinfoCallback getAddrinfoCallback_;
+};
+
 struct InterfaceAddressesDeleter {
   explicit InterfaceAddressesDeleter(int count) : count_(count) {}
 
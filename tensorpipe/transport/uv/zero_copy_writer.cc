@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uv/zero_copy_writer.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/transport/uv/uv.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uv {
+
+namespace {
+
+// The slices that libuv writes to find out when the socket is writable again
+// are copied by the kernel, therefore they're kept small.
+constexpr size_t kSliceLength = 4096;
+
+// The kernel rejects the sends with more buffers than this (UIO_MAXIOV).
+constexpr unsigned int kMaxNumBufsPerSend = 1024;
+
+// Skip the leading empty buffers, so that the request has data to send at
+// bufIdx, unless it has none left at all.
+void skipEmptyBufs(std::vector<uv_buf_t>& bufs, size_t& bufIdx) {
+  while (bufIdx < bufs.size() && bufs[bufIdx].len == 0) {
+    bufIdx++;
+  }
+}
+
+void advanceBufs(std::vector<uv_buf_t>& bufs, size_t& bufIdx, size_t length) {
+  while (length > 0) {
+    TP_DCHECK_LT(bufIdx, bufs.size());
+    uv_buf_t& buf = bufs[bufIdx];
+    const size_t chunkLength = std::min<size_t>(length, buf.len);
+    buf.base += chunkLength;
+    buf.len -= chunkLength;
+    length -= chunkLength;
+    skipEmptyBufs(bufs, bufIdx);
+  }
+}
+
+} // namespace
+
+ZeroCopyWriter::ZeroCopyWriter(TCPHandle& handle, size_t threshold)
+    : handle_(handle), threshold_(threshold) {}
+
+void ZeroCopyWriter::writeFromLoop(
+    const uv_buf_t bufs[],
+    unsigned int nbufs,
+    TWriteCallback fn) {
+  requests_.emplace_back();
+  Request& request = requests_.back();
+  request.bufs.assign(bufs, bufs + nbufs);
+  size_t length = 0;
+  for (const uv_buf_t& buf : request.bufs) {
+    length += buf.len;
+  }
+  skipEmptyBufs(request.bufs, request.bufIdx);
+  request.zeroCopy = length >= threshold_;
+  request.fn = std::move(fn);
+
+  issueFromLoop();
+}
+
+void ZeroCopyWriter::issueFromLoop() {
+  while (numIssuedRequests_ < requests_.size() && !sliceInFlight_) {
+    Request& request = requests_[numIssuedRequests_];
+
+    if (error_ != 0 || closed_) {
+      // The data of the earlier requests may not have been sent entirely, thus
+      // this one must not be sent at all.
+      if (request.status == 0) {
+        request.status = error_ != 0 ? error_ : UV_ECANCELED;
+      }
+      request.bufIdx = request.bufs.size();
+      numIssuedRequests_++;
+      continue;
+    }
+
+    if (!request.zeroCopy) {
+      if (request.bufIdx < request.bufs.size()) {
+        writeThroughUvFromLoop(request, /*onlySlice=*/false);
+      }
+      numIssuedRequests_++;
+      continue;
+    }
+
+    // The data that libuv has queued must go first. Writing a slice of this
+    // request through it tells when it's all gone.
+    if (request.bufIdx < request.bufs.size() &&
+        handle_.writeQueueSizeFromLoop() > 0) {
+      writeThroughUvFromLoop(request, /*onlySlice=*/true);
+      break;
+    }
+
+    if (request.firstSendNumber == request.endSendNumber) {
+      request.firstSendNumber = nextSendNumber_;
+      request.endSendNumber = nextSendNumber_;
+    }
+    while (request.bufIdx < request.bufs.size()) {
+      const unsigned int nbufs = std::min<size_t>(
+          request.bufs.size() - request.bufIdx, kMaxNumBufsPerSend);
+      const ssize_t rv =
+          handle_.sendZeroCopyFromLoop(&request.bufs[request.bufIdx], nbufs);
+      if (rv == UV_EAGAIN) {
+        writeThroughUvFromLoop(request, /*onlySlice=*/true);
+        break;
+      }
+      if (rv == UV_ENOBUFS) {
+        // The kernel ran out of memory to keep track of the pinned pages (see
+        // the net.core.optmem_max sysctl), hence we fall back to copying.
+        writeThroughUvFromLoop(request, /*onlySlice=*/false);
+        break;
+      }
+      if (rv < 0) {
+        error_ = rv;
+        request.status = rv;
+        request.bufIdx = request.bufs.size();
+        break;
+      }
+      nextSendNumber_++;
+      request.endSendNumber = nextSendNumber_;
+      advanceBufs(request.bufs, request.bufIdx, rv);
+    }
+    if (sliceInFlight_) {
+      break;
+    }
+    numIssuedRequests_++;
+  }
+
+  completeFromLoop();
+}
+
+void ZeroCopyWriter::writeThroughUvFromLoop(Request& request, bool onlySlice) {
+  TP_DCHECK_LT(request.bufIdx, request.bufs.size());
+  if (onlySlice) {
+    const uv_buf_t& buf = request.bufs[request.bufIdx];
+    const uv_buf_t slice = {buf.base, std::min<size_t>(buf.len, kSliceLength)};
+    handle_.writeFromLoop(&slice, 1, [this, &request](int status) {
+      onUvWriteFromLoop(request, /*isSlice=*/true, status);
+    });
+    advanceBufs(request.bufs, request.bufIdx, slice.len);
+    sliceInFlight_ = true;
+  } else {
+    // Libuv keeps its own copy of the array of buffers.
+    handle_.writeFromLoop(
+        &request.bufs[request.bufIdx],
+        request.bufs.size() - request.bufIdx,
+        [this, &request](int status) {
+          onUvWriteFromLoop(request, /*isSlice=*/false, status);
+        });
+    request.bufIdx = request.bufs.size();
+  }
+  request.numPendingUvWrites++;
+}
+
+void ZeroCopyWriter::onUvWriteFromLoop(
+    Request& request,
+    bool isSlice,
+    int status) {
+  request.numPendingUvWrites--;
+  if (status < 0) {
+    if (request.status == 0) {
+      request.status = status;
+    }
+    if (error_ == 0) {
+      error_ = status;
+    }
+  }
+  if (isSlice) {
+    sliceInFlight_ = false;
+    issueFromLoop();
+  } else {
+    completeFromLoop();
+  }
+}
+
+bool ZeroCopyWriter::hasPendingCompletionsFromLoop() const {
+  return numCompletedSends_ < nextSendNumber_;
+}
+
+void ZeroCopyWriter::pollFromLoop() {
+  while (!closed_ && hasPendingCompletionsFromLoop()) {
+    uint32_t first;
+    uint32_t last;
+    const int rv = handle_.recvZeroCopyCompletionFromLoop(first, last);
+    if (rv == UV_EAGAIN) {
+      break;
+    }
+    if (rv < 0) {
+      // Without the reports the requests can never complete, hence fail them,
+      // which will cause the connection to be closed.
+      if (error_ == 0) {
+        error_ = rv;
+      }
+      for (Request& request : requests_) {
+        if (request.numCompletedSends <
+            request.endSendNumber - request.firstSendNumber) {
+          request.numCompletedSends =
+              request.endSendNumber - request.firstSendNumber;
+          if (request.status == 0) {
+            request.status = rv;
+          }
+        }
+      }
+      numCompletedSends_ = nextSendNumber_;
+      break;
+    }
+
+    // The reports only carry the lower 32 bits of the numbers, and they can
+    // only be about sends that were made already.
+    const uint64_t firstNumber = nextSendNumber_ -
+        static_cast<uint32_t>(static_cast<uint32_t>(nextSendNumber_) - first);
+    const uint64_t endNumber =
+        firstNumber + static_cast<uint32_t>(last - first) + 1;
+    TP_DCHECK_LE(endNumber, nextSendNumber_);
+    for (Request& request : requests_) {
+      const uint64_t overlapStart =
+          std::max(firstNumber, request.firstSendNumber);
+      const uint64_t overlapEnd = std::min(endNumber, request.endSendNumber);
+      if (overlapStart < overlapEnd) {
+        request.numCompletedSends += overlapEnd - overlapStart;
+      }
+    }
+    numCompletedSends_ += endNumber - firstNumber;
+  }
+
+  completeFromLoop();
+}
+
+void ZeroCopyWriter::closeFromLoop() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+
+  if (hasPendingCompletionsFromLoop()) {
+    // The connection is going away because of an error anyways.
+    (void)handle_.resetOnCloseFromLoop();
+    for (Request& request : requests_) {
+      if (request.numCompletedSends <
+          request.endSendNumber - request.firstSendNumber) {
+        request.numCompletedSends =
+            request.endSendNumber - request.firstSendNumber;
+        if (request.status == 0) {
+          request.status = UV_ECANCELED;
+        }
+      }
+    }
+    numCompletedSends_ = nextSendNumber_;
+  }
+
+  // Fail the requests that weren't issued yet.
+  issueFromLoop();
+}
+
+void ZeroCopyWriter::completeFromLoop() {
+  while (numIssuedRequests_ > 0) {
+    Request& request = requests_.front();
+    if (request.numPendingUvWrites > 0 ||
+        request.numCompletedSends <
+            request.endSendNumber - request.firstSendNumber) {
+      break;
+    }
+    TWriteCallback fn = std::move(request.fn);
+    const int status = request.status;
+    requests_.pop_front();
+    numIssuedRequests_--;
+    fn(status);
+  }
+}
+
+} // namespace uv
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include <uv.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uv {
+
+class TCPHandle;
+
+// Writes to a TCP handle, having the kernel send the large requests without
+// copying them (MSG_ZEROCOPY), and the other ones through libuv as usual. All
+// the writes to the handle must go through it, for them to stay in order.
+//
+// The zero-copy sends bypass libuv, which can't be asked to use such a flag.
+// They can thus only be made while libuv has no data queued, and they stop once
+// the send buffer is full. Then a small slice of the request is handed to libuv
+// instead, which waits for the socket to be writable again: once it's written,
+// the zero-copy sends resume. The later requests wait for all the data of the
+// earlier ones to be handed to the kernel.
+//
+// A request is complete once all its data was sent and the kernel reported it
+// released the pages, which the owner must have it check for by calling
+// pollFromLoop as long as hasPendingCompletionsFromLoop returns true. The
+// kernel's reports make the socket readable on its error queue, which wakes up
+// the loop only if libuv is watching the socket (i.e., if it's reading).
+//
+// This class isn't thread-safe: it's meant to be used from the loop's thread.
+class ZeroCopyWriter {
+ public:
+  using TWriteCallback = std::function<void(int status)>;
+
+  ZeroCopyWriter(TCPHandle& handle, size_t threshold);
+
+  ZeroCopyWriter(const ZeroCopyWriter&) = delete;
+  ZeroCopyWriter(ZeroCopyWriter&&) = delete;
+  ZeroCopyWriter& operator=(const ZeroCopyWriter&) = delete;
+  ZeroCopyWriter& operator=(ZeroCopyWriter&&) = delete;
+
+  // Like TCPHandle::writeFromLoop, except that the requests of at least
+  // threshold bytes are zero-copy. The callbacks are fired in order.
+  void writeFromLoop(
+      const uv_buf_t bufs[],
+      unsigned int nbufs,
+      TWriteCallback fn);
+
+  // Whether the kernel still has to report releasing the pages of some data.
+  bool hasPendingCompletionsFromLoop() const;
+
+  // Process the reports the kernel has made so far.
+  void pollFromLoop();
+
+  // To be called before closing the handle, after which no report can be read
+  // anymore. The requests waiting for one fail, and if there are any the
+  // connection will be reset on close so that the peer can't receive data that
+  // the user may have modified in the meantime.
+  void closeFromLoop();
+
+ private:
+  struct Request {
+    // The data still to be handed to the kernel starts at bufIdx.
+    std::vector<uv_buf_t> bufs;
+    size_t bufIdx{0};
+    bool zeroCopy{false};
+    TWriteCallback fn;
+    int status{0};
+    // The libuv write requests carrying some of its data.
+    size_t numPendingUvWrites{0};
+    // The numbers of the zero-copy sends of its data, from first (inclusive) to
+    // end (exclusive), and how many of them the kernel reported completing.
+    uint64_t firstSendNumber{0};
+    uint64_t endSendNumber{0};
+    uint64_t numCompletedSends{0};
+  };
+
+  TCPHandle& handle_;
+  const size_t threshold_;
+
+  // The first numIssuedRequests_ ones have handed all their data to the kernel
+  // (or to libuv), the next one may be partway through.
+  std::deque<Request> requests_;
+  size_t numIssuedRequests_{0};
+  // Whether libuv is writing a slice of the request being issued.
+  bool sliceInFlight_{false};
+
+  uint64_t nextSendNumber_{0};
+  uint64_t numCompletedSends_{0};
+
+  int error_{0};
+  bool closed_{false};
+
+  // Hand as much data as possible to the kernel, in order.
+  void issueFromLoop();
+
+  // Hand the rest of the request (or just a slice of it) to libuv.
+  void writeThroughUvFromLoop(Request& request, bool onlySlice);
+
+  void onUvWriteFromLoop(Request& request, bool isSlice, int status);
+
+  // Fire the callbacks of the requests at the front that are done.
+  void completeFromLoop();
+};
+
+} // namespace uv
+} // namespace transport
+} // namespace tensorpipe
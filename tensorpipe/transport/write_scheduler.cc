@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/write_scheduler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace transport {
+
+namespace {
+
+// The granularity of the timers of the capped flows, which is thus the
+// resolution with which they are paced.
+constexpr std::chrono::milliseconds kTimerTickDuration{1};
+constexpr size_t kTimerNumSlots = 64;
+
+// The most tokens that the bucket of a flow with the given cap can hold.
+double burstBytes(uint64_t maxBytesPerSecond) {
+  return maxBytesPerSecond *
+      std::chrono::duration<double>(WriteScheduler::kBurstDuration).count();
+}
+
+} // namespace
+
+constexpr size_t WriteScheduler::kMaxBytesInFlight;
+constexpr std::chrono::milliseconds WriteScheduler::kBurstDuration;
+
+WriteScheduler::WriteScheduler(DeferredExecutor& loop)
+    : loop_(loop),
+      timerWheel_(kTimerTickDuration, kTimerNumSlots, "TP_write_sched") {}
+
+void WriteScheduler::setFlow(
+    TFlowId flowId,
+    uint32_t weight,
+    uint64_t maxBytesPerSecond) {
+  TP_DCHECK(loop_.inLoop());
+  TP_THROW_ASSERT_IF(weight == 0) << "The weight of a flow must be positive";
+  const auto now = std::chrono::steady_clock::now();
+  auto iter = flows_.find(flowId);
+  if (iter == flows_.end()) {
+    iter = flows_.emplace(flowId, Flow()).first;
+    iter->second.lastRefill = now;
+  } else {
+    refillTokens(iter->second, now);
+  }
+  Flow& flow = iter->second;
+  flow.weight = weight;
+  // A flow starts with a full bucket, and keeps what it had if the cap changes.
+  if (flow.maxBytesPerSecond == 0) {
+    flow.tokens = burstBytes(maxBytesPerSecond);
+  }
+  flow.maxBytesPerSecond = maxBytesPerSecond;
+  startWrites();
+}
+
+void WriteScheduler::removeFlow(TFlowId flowId) {
+  TP_DCHECK(loop_.inLoop());
+  auto iter = flows_.find(flowId);
+  if (iter == flows_.end()) {
+    return;
+  }
+  std::deque<PendingWrite> pendingWrites =
+      std::move(iter->second.pendingWrites);
+  flows_.erase(iter);
+  const bool wasStartingWrites = isStartingWrites_;
+  isStartingWrites_ = true;
+  for (PendingWrite& write : pendingWrites) {
+    startWrite(write);
+  }
+  isStartingWrites_ = wasStartingWrites;
+  startWrites();
+}
+
+void WriteScheduler::enqueue(
+    TFlowId flowId,
+    size_t numBytes,
+    MoveOnlyFunction<void()> start) {
+  TP_DCHECK(loop_.inLoop());
+  auto iter = flows_.find(flowId);
+  TP_DCHECK(iter != flows_.end());
+  Flow& flow = iter->second;
+  // A flow that was idle starts from the current virtual time, rather than
+  // from where it left, so that it can't monopolize the others to catch up.
+  const double startTag = std::max(virtualTime_, flow.lastFinishTag);
+  flow.lastFinishTag = startTag + static_cast<double>(numBytes) / flow.weight;
+  flow.pendingWrites.push_back(
+      PendingWrite{numBytes, startTag, std::move(start)});
+  startWrites();
+}
+
+void WriteScheduler::onWriteDone(size_t numBytes) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK_GE(numBytesInFlight_, numBytes);
+  numBytesInFlight_ -= numBytes;
+  startWrites();
+}
+
+void WriteScheduler::join() {
+  timerWheel_.join();
+}
+
+void WriteScheduler::refillTokens(
+    Flow& flow,
+    std::chrono::steady_clock::time_point now) {
+  if (flow.maxBytesPerSecond > 0) {
+    flow.tokens = std::min(
+        burstBytes(flow.maxBytesPerSecond),
+        flow.tokens +
+            flow.maxBytesPerSecond *
+                std::chrono::duration<double>(now - flow.lastRefill).count());
+  }
+  flow.lastRefill = now;
+}
+
+void WriteScheduler::startWrite(PendingWrite& write) {
+  numBytesInFlight_ += write.numBytes;
+  MoveOnlyFunction<void()> start = std::move(write.start);
+  start();
+}
+
+void WriteScheduler::startWrites() {
+  // The writes may complete inline (e.g., on error), and come back here through
+  // onWriteDone, in which case the outer call carries on with the next ones.
+  if (isStartingWrites_) {
+    return;
+  }
+  isStartingWrites_ = true;
+  const auto now = std::chrono::steady_clock::now();
+  while (numBytesInFlight_ < kMaxBytesInFlight || numBytesInFlight_ == 0) {
+    Flow* nextFlow = nullptr;
+    double minWaitSeconds = -1;
+    for (auto& iter : flows_) {
+      Flow& flow = iter.second;
+      if (flow.pendingWrites.empty()) {
+        continue;
+      }
+      refillTokens(flow, now);
+      if (flow.maxBytesPerSecond > 0 && flow.tokens < 0) {
+        const double waitSeconds = -flow.tokens / flow.maxBytesPerSecond;
+        if (minWaitSeconds < 0 || waitSeconds < minWaitSeconds) {
+          minWaitSeconds = waitSeconds;
+        }
+        continue;
+      }
+      if (nextFlow == nullptr ||
+          flow.pendingWrites.front().startTag <
+              nextFlow->pendingWrites.front().startTag) {
+        nextFlow = &flow;
+      }
+    }
+    if (nextFlow == nullptr) {
+      // Only the capped flows are left, if any, and the first of them to be
+      // allowed to go on again is woken up by a timer.
+      if (minWaitSeconds >= 0 && !isTimerPending_) {
+        isTimerPending_ = true;
+        const auto timeout = std::chrono::milliseconds(static_cast<int64_t>(
+            std::ceil(std::max(minWaitSeconds * 1000, 1.0))));
+        timerWheel_.schedule(timeout, [this]() {
+          loop_.deferToLoop([this]() {
+            isTimerPending_ = false;
+            startWrites();
+          });
+        });
+      }
+      break;
+    }
+    PendingWrite write = std::move(nextFlow->pendingWrites.front());
+    nextFlow->pendingWrites.pop_front();
+    virtualTime_ = write.startTag;
+    if (nextFlow->maxBytesPerSecond > 0) {
+      nextFlow->tokens -= write.numBytes;
+    }
+    // Connections may fail as a result, and their flows be erased, hence no
+    // pointer into them is held past this.
+    startWrite(write);
+  }
+  isStartingWrites_ = false;
+}
+
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+
+#include <tensorpipe/common/deferred_executor.h>
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/common/timer_wheel.h>
+
+namespace tensorpipe {
+namespace transport {
+
+// Decides which of the pending writes of the connections of a context go next,
+// for those connections that opted in (see Connection::setWriteShaping), so
+// that a bulk transfer on one of them can't hog the loop and the link at the
+// expense of the others. Each such connection is a flow, with a weight and an
+// optional cap on its rate. The writes of all flows are held back once those
+// started and not completed yet add up to kMaxBytesInFlight, and the next one
+// to start is picked by start-time fair queuing: a flow gets a share of the
+// bytes that is proportional to its weight among those with pending writes,
+// and a flow that was idle doesn't get to catch up. A flow over its rate cap
+// (measured by a token bucket, which allows bursts of kBurstDuration) waits,
+// without holding back the others, until a timer lets it go on. The writes of
+// each flow keep their order, but a write is never split, hence the sharing is
+// only as fine as the writes are. The connections that didn't opt in aren't
+// affected, nor do they count against the others.
+//
+// It's meant for the loop of a transport context, from which it must be used,
+// and on which the timers defer their work.
+class WriteScheduler {
+ public:
+  using TFlowId = const void*;
+
+  static constexpr size_t kMaxBytesInFlight = 4 * 1024 * 1024;
+  static constexpr std::chrono::milliseconds kBurstDuration{10};
+
+  explicit WriteScheduler(DeferredExecutor& loop);
+
+  WriteScheduler(const WriteScheduler&) = delete;
+  WriteScheduler(WriteScheduler&&) = delete;
+  WriteScheduler& operator=(const WriteScheduler&) = delete;
+  WriteScheduler& operator=(WriteScheduler&&) = delete;
+
+  // Create the flow, or change its weight (which must be positive) and its cap
+  // (in bytes per second, or zero for none). The weight applies to the writes
+  // enqueued after this, the cap right away.
+  void setFlow(TFlowId flowId, uint32_t weight, uint64_t maxBytesPerSecond);
+
+  // Start all the pending writes of the flow right away, and forget about it.
+  void removeFlow(TFlowId flowId);
+
+  // Hold a write of the given number of bytes back on the flow, and call the
+  // function to start it once its turn has come, possibly inline. The caller
+  // must then call onWriteDone when it completes.
+  void enqueue(TFlowId flowId, size_t numBytes, MoveOnlyFunction<void()> start);
+
+  void onWriteDone(size_t numBytes);
+
+  // The number of bytes of the writes that were started and aren't done yet.
+  size_t numBytesInFlight() const {
+    return numBytesInFlight_;
+  }
+
+  // Drop the pending timer, if any, and stop its thread. To be called before
+  // the loop it defers to is joined.
+  void join();
+
+ private:
+  struct PendingWrite {
+    size_t numBytes;
+    double startTag;
+    MoveOnlyFunction<void()> start;
+  };
+
+  struct Flow {
+    uint32_t weight{1};
+    uint64_t maxBytesPerSecond{0};
+    // The tokens of the bucket, in bytes, which may go below zero as a write
+    // can start as long as it's not, whatever its size.
+    double tokens{0};
+    std::chrono::steady_clock::time_point lastRefill;
+    double lastFinishTag{0};
+    std::deque<PendingWrite> pendingWrites;
+  };
+
+  DeferredExecutor& loop_;
+  std::unordered_map<TFlowId, Flow> flows_;
+  size_t numBytesInFlight_{0};
+  // The start tag of the last write that was started.
+  double virtualTime_{0};
+  bool isStartingWrites_{false};
+
+  TimerWheel timerWheel_;
+  bool isTimerPending_{false};
+
+  void refillTokens(Flow& flow, std::chrono::steady_clock::time_point now);
+
+  void startWrite(PendingWrite& write);
+
+  void startWrites();
+};
+
+} // namespace transport
+} // namespace tensorpipe
@@ -8,6 +8,9 @@
 
 #pragma once
 
+#include <array>
+#include <utility>
+
 #include <tensorpipe/util/ringbuffer/ringbuffer.h>
 
 namespace tensorpipe {
@@ -19,22 +22,31 @@ namespace ringbuffer {
 ///
 /// Provides methods to read data from a ringbuffer.
 ///
-class Consumer {
+/// If <SingleUser> is set, this must be the only consumer of the ringbuffer at
+/// any time (across all processes). It then skips the read transaction flag,
+/// advances the tail without an atomic read-modify-write and only re-reads the
+/// producer's head when the one it saw last doesn't cover enough data.
+///
+template <bool SingleUser>
+class BasicConsumer {
  public:
-  Consumer() = delete;
+  BasicConsumer() = delete;
 
-  explicit Consumer(RingBuffer& rb)
-      : header_{rb.getHeader()}, data_{rb.getData()} {
+  explicit BasicConsumer(RingBuffer& rb)
+      : header_{rb.getHeader()},
+        data_{rb.getData()},
+        dataIsDoubleMapped_{rb.isDataDoubleMapped()},
+        cachedHead_{rb.getCachedHead()} {
     TP_THROW_IF_NULLPTR(data_);
   }
 
-  Consumer(const Consumer&) = delete;
-  Consumer(Consumer&&) = delete;
+  BasicConsumer(const BasicConsumer&) = delete;
+  BasicConsumer(BasicConsumer&&) = delete;
 
-  Consumer& operator=(const Consumer&) = delete;
-  Consumer& operator=(Consumer&&) = delete;
+  BasicConsumer& operator=(const BasicConsumer&) = delete;
+  BasicConsumer& operator=(BasicConsumer&&) = delete;
 
-  ~Consumer() noexcept {
+  ~BasicConsumer() noexcept {
     TP_THROW_ASSERT_IF(inTx());
   }
 
@@ -42,6 +54,12 @@ class Consumer {
     return header_.kDataPoolByteSize;
   }
 
+  // Whether any data that fits in the ringbuffer can be read to and from a
+  // single contiguous buffer, as its end is followed by a mapping of its start.
+  bool isDataDoubleMapped() const {
+    return dataIsDoubleMapped_;
+  }
+
   //
   // Transaction based API.
   //
@@ -56,7 +74,7 @@ class Consumer {
     if (unlikely(inTx())) {
       return -EBUSY;
     }
-    if (header_.beginReadTransaction()) {
+    if (!SingleUser && header_.beginReadTransaction()) {
       return -EAGAIN;
     }
     inTx_ = true;
@@ -68,10 +86,16 @@ class Consumer {
     if (unlikely(!inTx())) {
       return -EINVAL;
     }
-    header_.incTail(txSize_);
+    if (SingleUser) {
+      header_.incTailExclusively(txSize_);
+    } else {
+      header_.incTail(txSize_);
+    }
     txSize_ = 0;
     inTx_ = false;
-    header_.endReadTransaction();
+    if (!SingleUser) {
+      header_.endReadTransaction();
+    }
     return 0;
   }
 
@@ -83,7 +107,9 @@ class Consumer {
     // <inReadTx_> flags that we are in a transaction,
     // so enforce no stores pass it.
     inTx_ = false;
-    header_.endReadTransaction();
+    if (!SingleUser) {
+      header_.endReadTransaction();
+    }
     return 0;
   }
 
@@ -93,7 +119,8 @@ class Consumer {
   };
 
   // The first item is negative in case of error, otherwise it contains how many
-  // elements of the array are valid (0, 1 or 2). The elements are ptr+len pairs
+  // elements of the array are valid (0, 1 or 2, though never 2 if the data is
+  // double mapped). The elements are ptr+len pairs
   // of contiguous areas of the ringbuffer that, chained together, represent a
   // slice of the requested size (or less if not enough data is available, and
   // AllowPartial is set to true).
@@ -110,8 +137,18 @@ class Consumer {
       return {0, result};
     }
 
-    const uint64_t head = header_.readHead();
     const uint64_t tail = header_.readTail();
+    uint64_t head;
+    if (SingleUser) {
+      // The head only ever grows, hence an old value underestimates the data.
+      head = cachedHead_;
+      if (head < tail + txSize_ + size) {
+        head = header_.readHead();
+        cachedHead_ = head;
+      }
+    } else {
+      head = header_.readHead();
+    }
     TP_DCHECK_LE(head - tail, header_.kDataPoolByteSize);
 
     const size_t avail = head - tail - txSize_;
@@ -133,7 +170,8 @@ class Consumer {
     txSize_ += size;
 
     // end == 0 is the same as end == bufferSize, in which case it doesn't wrap.
-    const bool wrap = (start >= end && end > 0);
+    // When the data is double mapped the range continues into the second copy.
+    const bool wrap = !dataIsDoubleMapped_ && (start >= end && end > 0);
     if (likely(!wrap)) {
       result[0] = {.ptr = data_ + start, .len = size};
       return {1, result};
@@ -206,10 +244,15 @@ class Consumer {
  private:
   RingBufferHeader& header_;
   const uint8_t* const data_;
+  const bool dataIsDoubleMapped_;
+  uint64_t& cachedHead_;
   unsigned txSize_ = 0;
   bool inTx_{false};
 };
 
+using Consumer = BasicConsumer</*SingleUser=*/false>;
+using SingleConsumer = BasicConsumer</*SingleUser=*/true>;
+
 } // namespace ringbuffer
 } // namespace util
 } // namespace tensorpipe
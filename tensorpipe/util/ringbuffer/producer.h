@@ -8,6 +8,9 @@
 
 #pragma once
 
+#include <array>
+#include <utility>
+
 #include <tensorpipe/util/ringbuffer/ringbuffer.h>
 
 namespace tensorpipe {
@@ -19,22 +22,31 @@ namespace ringbuffer {
 ///
 /// Provides methods to write data into a ringbuffer.
 ///
-class Producer {
+/// If <SingleUser> is set, this must be the only producer of the ringbuffer at
+/// any time (across all processes). It then skips the write transaction flag,
+/// advances the head without an atomic read-modify-write and only re-reads the
+/// consumer's tail when the one it saw last doesn't leave enough room.
+///
+template <bool SingleUser>
+class BasicProducer {
  public:
-  Producer() = delete;
+  BasicProducer() = delete;
 
-  explicit Producer(RingBuffer& rb)
-      : header_{rb.getHeader()}, data_{rb.getData()} {
+  explicit BasicProducer(RingBuffer& rb)
+      : header_{rb.getHeader()},
+        data_{rb.getData()},
+        dataIsDoubleMapped_{rb.isDataDoubleMapped()},
+        cachedTail_{rb.getCachedTail()} {
     TP_THROW_IF_NULLPTR(data_);
   }
 
-  Producer(const Producer&) = delete;
-  Producer(Producer&&) = delete;
+  BasicProducer(const BasicProducer&) = delete;
+  BasicProducer(BasicProducer&&) = delete;
 
-  Producer& operator=(const Producer&) = delete;
-  Producer& operator=(Producer&&) = delete;
+  BasicProducer& operator=(const BasicProducer&) = delete;
+  BasicProducer& operator=(BasicProducer&&) = delete;
 
-  ~Producer() noexcept {
+  ~BasicProducer() noexcept {
     TP_THROW_ASSERT_IF(inTx());
   }
 
@@ -42,6 +54,12 @@ class Producer {
     return header_.kDataPoolByteSize;
   }
 
+  // Whether any data that fits in the ringbuffer can be written to and from a
+  // single contiguous buffer, as its end is followed by a mapping of its start.
+  bool isDataDoubleMapped() const {
+    return dataIsDoubleMapped_;
+  }
+
   //
   // Transaction based API.
   //
@@ -56,7 +74,7 @@ class Producer {
     if (unlikely(inTx())) {
       return -EBUSY;
     }
-    if (header_.beginWriteTransaction()) {
+    if (!SingleUser && header_.beginWriteTransaction()) {
       return -EAGAIN;
     }
     inTx_ = true;
@@ -68,12 +86,18 @@ class Producer {
     if (unlikely(!inTx())) {
       return -EINVAL;
     }
-    header_.incHead(txSize_);
+    if (SingleUser) {
+      header_.incHeadExclusively(txSize_);
+    } else {
+      header_.incHead(txSize_);
+    }
     txSize_ = 0;
     // <inWriteTx_> flags that we are in a transaction,
     // so enforce no stores pass it.
     inTx_ = false;
-    header_.endWriteTransaction();
+    if (!SingleUser) {
+      header_.endWriteTransaction();
+    }
     return 0;
   }
 
@@ -85,7 +109,9 @@ class Producer {
     // <inWriteTx_> flags that we are in a transaction,
     // so enforce no stores pass it.
     inTx_ = false;
-    header_.endWriteTransaction();
+    if (!SingleUser) {
+      header_.endWriteTransaction();
+    }
     return 0;
   }
 
@@ -95,7 +121,8 @@ class Producer {
   };
 
   // The first item is negative in case of error, otherwise it contains how many
-  // elements of the array are valid (0, 1 or 2). The elements are ptr+len pairs
+  // elements of the array are valid (0, 1 or 2, though never 2 if the data is
+  // double mapped). The elements are ptr+len pairs
   // of contiguous areas of the ringbuffer that, chained together, represent a
   // slice of the requested size (or less if not enough data is available, and
   // AllowPartial is set to true).
@@ -113,7 +140,17 @@ class Producer {
     }
 
     const uint64_t head = header_.readHead();
-    const uint64_t tail = header_.readTail();
+    uint64_t tail;
+    if (SingleUser) {
+      // The tail only ever grows, hence an old value underestimates the room.
+      tail = cachedTail_;
+      if (head + txSize_ + size > tail + header_.kDataPoolByteSize) {
+        tail = header_.readTail();
+        cachedTail_ = tail;
+      }
+    } else {
+      tail = header_.readTail();
+    }
     TP_DCHECK_LE(head - tail, header_.kDataPoolByteSize);
 
     const size_t avail = header_.kDataPoolByteSize - (head - tail) - txSize_;
@@ -135,7 +172,8 @@ class Producer {
     txSize_ += size;
 
     // end == 0 is the same as end == bufferSize, in which case it doesn't wrap.
-    const bool wrap = (start >= end && end > 0);
+    // When the data is double mapped the range continues into the second copy.
+    const bool wrap = !dataIsDoubleMapped_ && (start >= end && end > 0);
     if (likely(!wrap)) {
       result[0] = {.ptr = data_ + start, .len = size};
       return {1, result};
@@ -210,10 +248,15 @@ class Producer {
  private:
   RingBufferHeader& header_;
   uint8_t* const data_;
+  const bool dataIsDoubleMapped_;
+  uint64_t& cachedTail_;
   unsigned txSize_ = 0;
   bool inTx_{false};
 };
 
+using Producer = BasicProducer</*SingleUser=*/false>;
+using SingleProducer = BasicProducer</*SingleUser=*/true>;
+
 } // namespace ringbuffer
 } // namespace util
 } // namespace tensorpipe
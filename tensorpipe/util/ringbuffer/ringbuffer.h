@@ -15,6 +15,7 @@
 #include <memory>
 #include <type_traits>
 
+#include <tensorpipe/common/event_count.h>
 #include <tensorpipe/common/system.h>
 
 ///
@@ -29,7 +30,8 @@
 ///
 /// Multiple ringbuffers can reference the same header + data.
 ///
-/// Multiple producers (or consumers) can reference the same ringbuffer.
+/// Multiple producers (or consumers) can reference the same ringbuffer, unless
+/// one of them is a single producer (or consumer), which must be the only one.
 ///
 /// Synchronization between all producers/consumers of all ringbuffers that
 /// reference the same header + pair pairs is done using atomic operations
@@ -54,6 +56,12 @@ namespace ringbuffer {
 ///
 class RingBufferHeader {
  public:
+  // The version of the layout of this class. As the header may be placed in
+  // shared memory, and accessed by other processes, it must be bumped whenever
+  // the layout changes, so that mismatching peers can be detected.
+  static constexpr uint64_t kCurrentVersion = 2;
+
+  const uint64_t kVersion{kCurrentVersion};
   const uint64_t kDataPoolByteSize;
   const uint64_t kDataModMask;
 
@@ -132,17 +140,57 @@ class RingBufferHeader {
     atomicTail_.fetch_add(inc, std::memory_order_release);
   }
 
+  // When the caller is the only producer (or consumer) then nobody else can be
+  // modifying the head (or tail) at the same time, hence there is no need for
+  // a read-modify-write, which is much more expensive than a plain store.
+
+  void incHeadExclusively(uint64_t inc) {
+    atomicHead_.store(
+        atomicHead_.load(std::memory_order_relaxed) + inc,
+        std::memory_order_release);
+  }
+
+  void incTailExclusively(uint64_t inc) {
+    atomicTail_.store(
+        atomicTail_.load(std::memory_order_relaxed) + inc,
+        std::memory_order_release);
+  }
+
+  // Allows a consumer to sleep until a producer writes new data. It isn't used
+  // by the ringbuffer itself: producers must notify it explicitly.
+  EventCount& getEventCount() {
+    return eventCount_;
+  }
+
  protected:
+  // What's written by producers, what's written by consumers and what's written
+  // by both are kept apart by this much, so that they never end up on the same
+  // cache line, nor on the same pair of cache lines (as some CPUs prefetch them
+  // in pairs), whatever the alignment of the header. Otherwise producers and
+  // consumers running on different cores would keep stealing the line from
+  // each other even when they don't access the same fields.
+  static constexpr size_t kFalseSharingRange = 128;
+
+  uint8_t paddingBeforeProducers_[kFalseSharingRange];
+
   // Acquired by producers.
   std::atomic_flag inWriteTx_ = ATOMIC_FLAG_INIT;
-  // Acquired by consumers.
-  std::atomic_flag inReadTx_ = ATOMIC_FLAG_INIT;
-
   // Written by producers.
   std::atomic<uint64_t> atomicHead_{0};
+
+  uint8_t paddingBeforeConsumers_[kFalseSharingRange];
+
+  // Acquired by consumers.
+  std::atomic_flag inReadTx_ = ATOMIC_FLAG_INIT;
   // Written by consumers.
   std::atomic<uint64_t> atomicTail_{0};
 
+  uint8_t paddingBeforeEventCount_[kFalseSharingRange];
+
+  EventCount eventCount_;
+
+  uint8_t paddingAfterEventCount_[kFalseSharingRange];
+
   // http://www.open-std.org/jtc1/sc22/wg21/docs/papers/2007/n2427.html#atomics.lockfree
   // static_assert(
   //     decltype(atomicHead_)::is_always_lock_free,
@@ -156,12 +204,20 @@ class RingBufferHeader {
 /// Process' view of a ring buffer.
 /// This cannot reside in shared memory since it has pointers.
 ///
+/// If <dataIsDoubleMapped>, the data is followed in memory by a second mapping
+/// of itself (see util::shm::Segment), thus any range of it, even one that
+/// wraps around its end, is contiguous. Each process may map the data either
+/// way, independently of the others.
+///
 class RingBuffer final {
  public:
   RingBuffer() = default;
 
-  RingBuffer(RingBufferHeader* header, uint8_t* data)
-      : header_(header), data_(data) {
+  RingBuffer(
+      RingBufferHeader* header,
+      uint8_t* data,
+      bool dataIsDoubleMapped = false)
+      : header_(header), data_(data), dataIsDoubleMapped_(dataIsDoubleMapped) {
     TP_THROW_IF_NULLPTR(header_) << "Header cannot be nullptr";
     TP_THROW_IF_NULLPTR(data_) << "Data cannot be nullptr";
   }
@@ -182,9 +238,28 @@ class RingBuffer final {
     return data_;
   }
 
+  bool isDataDoubleMapped() const {
+    return dataIsDoubleMapped_;
+  }
+
+  // The tail (or head) most recently seen by a single producer (or consumer)
+  // through this view, which it reuses until it appears to be out of room (or
+  // data). As the head and tail only ever grow, an outdated value is safe.
+
+  uint64_t& getCachedTail() {
+    return cachedTail_;
+  }
+
+  uint64_t& getCachedHead() {
+    return cachedHead_;
+  }
+
  protected:
   RingBufferHeader* header_ = nullptr;
   uint8_t* data_ = nullptr;
+  bool dataIsDoubleMapped_ = false;
+  uint64_t cachedTail_ = 0;
+  uint64_t cachedHead_ = 0;
 };
 
 } // namespace ringbuffer
@@ -13,10 +13,24 @@ namespace util {
 namespace ringbuffer {
 namespace shm {
 
+namespace {
+
+// This is only an optimization, hence it's fine if it fails.
+void prefaultDataSegment(util::shm::Segment& dataSegment) {
+  Error error = dataSegment.prefault();
+  if (error) {
+    TP_VLOG(6) << "Couldn't prefault the data of a ringbuffer ("
+               << error.what() << ")";
+  }
+}
+
+} // namespace
+
 std::tuple<Error, util::shm::Segment, util::shm::Segment, RingBuffer> create(
     size_t minRbByteSize,
     optional<util::shm::PageType> dataPageType,
-    bool permWrite) {
+    bool permWrite,
+    bool doubleMapped) {
   Error error;
   util::shm::Segment headerSegment;
   RingBufferHeader* header;
@@ -34,7 +48,7 @@ std::tuple<Error, util::shm::Segment, util::shm::Segment, RingBuffer> create(
   util::shm::Segment dataSegment;
   uint8_t* data;
   std::tie(error, dataSegment, data) = util::shm::Segment::create<uint8_t[]>(
-      header->kDataPoolByteSize, permWrite, dataPageType);
+      header->kDataPoolByteSize, permWrite, dataPageType, doubleMapped);
   if (error) {
     return std::make_tuple(
         std::move(error),
@@ -43,20 +57,26 @@ std::tuple<Error, util::shm::Segment, util::shm::Segment, RingBuffer> create(
         RingBuffer());
   }
 
+  // Constructing the data zeroed it out, but only through the first mapping.
+  prefaultDataSegment(dataSegment);
+
+  RingBuffer rb(header, data, dataSegment.isDoubleMapped());
+
   // Note: cannot use implicit construction from initializer list on GCC 5.5:
   // "converting to XYZ from initializer list would use explicit constructor".
   return std::make_tuple(
       Error::kSuccess,
       std::move(headerSegment),
       std::move(dataSegment),
-      RingBuffer(header, data));
+      std::move(rb));
 }
 
 std::tuple<Error, util::shm::Segment, util::shm::Segment, RingBuffer> load(
     Fd headerFd,
     Fd dataFd,
     optional<util::shm::PageType> dataPageType,
-    bool permWrite) {
+    bool permWrite,
+    bool doubleMapped) {
   Error error;
   util::shm::Segment headerSegment;
   RingBufferHeader* header;
@@ -74,11 +94,14 @@ std::tuple<Error, util::shm::Segment, util::shm::Segment, RingBuffer> load(
   if (unlikely(kHeaderSize != headerSegment.getSize())) {
     TP_THROW_SYSTEM(EPERM) << "Header segment of unexpected size";
   }
+  if (unlikely(header->kVersion != RingBufferHeader::kCurrentVersion)) {
+    TP_THROW_SYSTEM(EPROTO) << "Header segment of unexpected version";
+  }
 
   util::shm::Segment dataSegment;
   uint8_t* data;
   std::tie(error, dataSegment, data) = util::shm::Segment::load<uint8_t[]>(
-      std::move(dataFd), permWrite, dataPageType);
+      std::move(dataFd), permWrite, dataPageType, doubleMapped);
   if (error) {
     return std::make_tuple(
         std::move(error),
@@ -89,12 +112,15 @@ std::tuple<Error, util::shm::Segment, util::shm::Segment, RingBuffer> load(
   if (unlikely(header->kDataPoolByteSize != dataSegment.getSize())) {
     TP_THROW_SYSTEM(EPERM) << "Data segment of unexpected size";
   }
+  prefaultDataSegment(dataSegment);
+
+  RingBuffer rb(header, data, dataSegment.isDoubleMapped());
 
   return std::make_tuple(
       Error::kSuccess,
       std::move(headerSegment),
       std::move(dataSegment),
-      RingBuffer(header, data));
+      std::move(rb));
 }
 
 } // namespace shm
@@ -30,16 +30,26 @@ namespace shm {
 /// <min_rb_byte_size> is the minimum size of the data section
 /// of a RingBuffer (or each CPU's RingBuffer).
 ///
+/// If <doubleMapped>, try to map the data section twice in a row, so that the
+/// producers and consumers never have to split an access in two. Whether this
+/// succeeded can be told by RingBuffer::isDataDoubleMapped. The process that
+/// creates the ringbuffer and the ones that load it can choose independently.
+///
+/// Both this and load map all the pages of the data section into the process
+/// upfront, so that the first messages through it don't pay for page faults.
+///
 std::tuple<Error, util::shm::Segment, util::shm::Segment, RingBuffer> create(
     size_t minRbByteSize,
     optional<util::shm::PageType> dataPageType = nullopt,
-    bool permWrite = true);
+    bool permWrite = true,
+    bool doubleMapped = false);
 
 std::tuple<Error, util::shm::Segment, util::shm::Segment, RingBuffer> load(
     Fd headerFd,
     Fd dataFd,
     optional<util::shm::PageType> dataPageType = nullopt,
-    bool permWrite = true);
+    bool permWrite = true,
+    bool doubleMapped = false);
 
 } // namespace shm
 } // namespace ringbuffer
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/util/shm/arena.h>
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace util {
+namespace shm {
+
+constexpr size_t Arena::kAlignment;
+
+std::tuple<Error, std::unique_ptr<Arena>> Arena::create(size_t byteSize) {
+  Error error;
+  Segment segment;
+  std::tie(error, segment) =
+      Segment::alloc(byteSize, /*permWrite=*/true, /*pageType=*/nullopt);
+  if (error) {
+    return std::make_tuple(std::move(error), nullptr);
+  }
+  return std::make_tuple(
+      Error::kSuccess, std::make_unique<Arena>(std::move(segment)));
+}
+
+Arena::Arena(Segment segment)
+    : segment_(std::move(segment)),
+      base_(reinterpret_cast<uint8_t*>(segment_.getPtr())) {
+  const size_t usableSize = segment_.getSize() / kAlignment * kAlignment;
+  if (usableSize > 0) {
+    freeBlocks_.emplace(0, usableSize);
+  }
+}
+
+void* Arena::allocate(size_t length) {
+  // Even empty buffers take some room, so that they have an address of their
+  // own which can be freed.
+  const size_t blockLength =
+      std::max<size_t>(1, (length + kAlignment - 1) / kAlignment) * kAlignment;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (auto iter = freeBlocks_.begin(); iter != freeBlocks_.end(); ++iter) {
+    if (iter->second < blockLength) {
+      continue;
+    }
+    const size_t offset = iter->first;
+    const size_t remainingLength = iter->second - blockLength;
+    freeBlocks_.erase(iter);
+    if (remainingLength > 0) {
+      freeBlocks_.emplace(offset + blockLength, remainingLength);
+    }
+    allocatedBlocks_.emplace(offset, blockLength);
+    return base_ + offset;
+  }
+  return nullptr;
+}
+
+void Arena::deallocate(void* ptr) {
+  const size_t offset = offsetOf(ptr);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto allocatedIter = allocatedBlocks_.find(offset);
+  TP_THROW_ASSERT_IF(allocatedIter == allocatedBlocks_.end())
+      << "Freeing a buffer that wasn't allocated from this arena";
+  size_t blockOffset = offset;
+  size_t blockLength = allocatedIter->second;
+  allocatedBlocks_.erase(allocatedIter);
+
+  // Merge with the free blocks that come right after and right before.
+  auto nextIter = freeBlocks_.lower_bound(blockOffset);
+  if (nextIter != freeBlocks_.end() &&
+      nextIter->first == blockOffset + blockLength) {
+    blockLength += nextIter->second;
+    nextIter = freeBlocks_.erase(nextIter);
+  }
+  if (nextIter != freeBlocks_.begin()) {
+    auto prevIter = std::prev(nextIter);
+    if (prevIter->first + prevIter->second == blockOffset) {
+      blockOffset = prevIter->first;
+      blockLength += prevIter->second;
+      freeBlocks_.erase(prevIter);
+    }
+  }
+  freeBlocks_.emplace(blockOffset, blockLength);
+}
+
+bool Arena::contains(const void* ptr, size_t length) const {
+  const uint8_t* bytePtr = reinterpret_cast<const uint8_t*>(ptr);
+  const uint8_t* end = base_ + segment_.getSize();
+  return bytePtr >= base_ && bytePtr < end &&
+      length <= static_cast<size_t>(end - bytePtr);
+}
+
+size_t Arena::offsetOf(const void* ptr) const {
+  TP_DCHECK(contains(ptr, 0));
+  return reinterpret_cast<const uint8_t*>(ptr) - base_;
+}
+
+} // namespace shm
+} // namespace util
+} // namespace tensorpipe
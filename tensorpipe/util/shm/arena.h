@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/util/shm/segment.h>
+
+namespace tensorpipe {
+namespace util {
+namespace shm {
+
+/// Hands out buffers from a shared memory segment, which other processes can
+/// map (given its file descriptor) in order to access the buffers in place, by
+/// their offset in the segment. The buffers are aligned to cache lines, and
+/// are found with a first-fit search over the free blocks, which are merged
+/// with their neighbors when freed. All methods are thread-safe.
+class Arena {
+ public:
+  static constexpr size_t kAlignment = 64;
+
+  static std::tuple<Error, std::unique_ptr<Arena>> create(size_t byteSize);
+
+  explicit Arena(Segment segment);
+
+  Arena(const Arena&) = delete;
+  Arena(Arena&&) = delete;
+  Arena& operator=(const Arena&) = delete;
+  Arena& operator=(Arena&&) = delete;
+
+  /// Return a buffer of at least the given length, or null if there isn't a
+  /// free block large enough for it.
+  void* allocate(size_t length);
+
+  /// Free a buffer that was returned by allocate.
+  void deallocate(void* ptr);
+
+  /// Whether the given range lies within the segment.
+  bool contains(const void* ptr, size_t length) const;
+
+  /// The offset of the given pointer, which must lie within the segment.
+  size_t offsetOf(const void* ptr) const;
+
+  int getFd() const {
+    return segment_.getFd();
+  }
+
+  size_t getSize() const {
+    return segment_.getSize();
+  }
+
+ private:
+  Segment segment_;
+  uint8_t* const base_;
+
+  std::mutex mutex_;
+  // The free blocks, by offset, and the allocated ones, by offset too, with
+  // their lengths.
+  std::map<size_t, size_t> freeBlocks_;
+  std::unordered_map<size_t, size_t> allocatedBlocks_;
+};
+
+} // namespace shm
+} // namespace util
+} // namespace tensorpipe
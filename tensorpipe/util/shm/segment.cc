@@ -9,6 +9,7 @@
 #include <tensorpipe/util/shm/segment.h>
 
 #include <fcntl.h>
+#include <linux/memfd.h>
 #include <linux/mman.h>
 #include <sched.h>
 #include <sys/mman.h>
@@ -21,11 +22,17 @@
 #include <sstream>
 #include <thread>
 #include <tuple>
+#include <vector>
 
 namespace tensorpipe {
 namespace util {
 namespace shm {
 
+// Only defined by the headers of Linux 5.14 and later.
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+
 namespace {
 
 // Default base path for all segments created.
@@ -41,6 +48,29 @@ std::tuple<Error, Fd> createShmFd() {
   return std::make_tuple(Error::kSuccess, Fd(fd));
 }
 
+// Files in /dev/shm can't be backed by huge pages, hence for those we use an
+// anonymous file on the internal hugetlbfs mount, which can be shared with
+// other processes (and mapped by them) just like the other ones.
+std::tuple<Error, Fd> createHugeTlbShmFd(PageType pageType) {
+  unsigned int flags = MFD_CLOEXEC | MFD_HUGETLB;
+  flags |= pageType == PageType::HugeTLB_1GB ? MFD_HUGE_1GB : MFD_HUGE_2MB;
+  int fd = ::memfd_create("tensorpipe", flags);
+  if (fd < 0) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "memfd_create", errno), Fd());
+  }
+
+  return std::make_tuple(Error::kSuccess, Fd(fd));
+}
+
+size_t getHugePageSize(PageType pageType) {
+  TP_DCHECK(pageType != PageType::Default);
+  if (pageType == PageType::HugeTLB_1GB) {
+    return 1024ull * 1024ull * 1024ull;
+  }
+  return 2ull * 1024ull * 1024ull;
+}
+
 /// Choose a reasonable page size for a given size.
 /// This very opinionated choice of "reasonable" aims to
 /// keep wasted memory low.
@@ -66,7 +96,7 @@ std::tuple<Error, MmappedPtr> mmapShmFd(
     int fd,
     size_t byteSize,
     bool permWrite,
-    optional<PageType> pageType) {
+    bool twice = false) {
 #ifdef MAP_SHARED_VALIDATE
   int flags = MAP_SHARED | MAP_SHARED_VALIDATE;
 #else
@@ -85,62 +115,141 @@ update to obtain the latest correctness checks."
     prot |= PROT_WRITE;
   }
 
-  // FIXME mmap seems to fail with EINVAL if it cannot use hugepages when asked
-  // to do so. We could try with hugepages and, if it fails, try again without.
-  // But this adds complexity and I first want to know how much performance we
-  // gain through hugepages but so far I haven't been able to get them to work.
-  // switch (page_type.value_or(getDefaultPageType(byte_size))) {
-  //   case PageType::Default:
-  //     break;
-  //   case PageType::HugeTLB_2MB:
-  //     flags |= MAP_HUGETLB | MAP_HUGE_2MB;
-  //     break;
-  //   case PageType::HugeTLB_1GB:
-  //     flags |= MAP_HUGETLB | MAP_HUGE_1GB;
-  //     break;
-  // }
-
+  // The page size is determined by the file, hence there's no need to pass
+  // MAP_HUGETLB for the segments that are backed by huge pages.
+  if (twice) {
+    // Both copies must start on a page boundary. For files that are backed by
+    // huge pages the block size is the size of those.
+    struct stat sb;
+    int ret = ::fstat(fd, &sb);
+    if (ret < 0) {
+      return std::make_tuple(
+          TP_CREATE_ERROR(SystemError, "fstat", errno), MmappedPtr());
+    }
+    const size_t pageSize = static_cast<size_t>(sb.st_blksize);
+    if (byteSize % pageSize != 0) {
+      return std::make_tuple(
+          TP_CREATE_ERROR(SystemError, "mmap", EINVAL), MmappedPtr());
+    }
+    return MmappedPtr::createTwice(byteSize, pageSize, prot, flags, fd);
+  }
   return MmappedPtr::create(byteSize, prot, flags, fd);
 }
 
-} // namespace
-
-Segment::Segment(Fd fd, MmappedPtr ptr)
-    : fd_(std::move(fd)), ptr_(std::move(ptr)) {}
-
-std::tuple<Error, Segment> Segment::alloc(
+// Mapping the file twice is only a hint: if it can't be done (because the size
+// isn't a multiple of the page size, for example) map it once instead.
+std::tuple<Error, MmappedPtr, bool> mmapShmFdMaybeTwice(
+    int fd,
     size_t byteSize,
     bool permWrite,
-    optional<PageType> pageType) {
+    bool doubleMapped) {
   Error error;
-  Fd fd;
-  std::tie(error, fd) = createShmFd();
-  if (error) {
-    return std::make_tuple(std::move(error), Segment());
+  MmappedPtr ptr;
+  if (doubleMapped) {
+    std::tie(error, ptr) = mmapShmFd(fd, byteSize, permWrite, /*twice=*/true);
+    if (!error) {
+      return std::make_tuple(Error::kSuccess, std::move(ptr), true);
+    }
+    TP_VLOG(6) << "Couldn't map a shared memory segment twice, falling back "
+               << "to mapping it once (" << error.what() << ")";
   }
+  std::tie(error, ptr) = mmapShmFd(fd, byteSize, permWrite);
+  return std::make_tuple(std::move(error), std::move(ptr), false);
+}
 
+std::tuple<Error, Fd, MmappedPtr, bool> allocInternal(
+    Fd fd,
+    size_t byteSize,
+    bool permWrite,
+    bool doubleMapped) {
   // grow size to contain byte_size bytes.
   off_t len = static_cast<off_t>(byteSize);
   int ret = ::fallocate(fd.fd(), 0, 0, len);
   if (ret < 0) {
     return std::make_tuple(
-        TP_CREATE_ERROR(SystemError, "fallocate", errno), Segment());
+        TP_CREATE_ERROR(SystemError, "fallocate", errno),
+        Fd(),
+        MmappedPtr(),
+        false);
   }
 
+  Error error;
   MmappedPtr ptr;
-  std::tie(error, ptr) = mmapShmFd(fd.fd(), byteSize, permWrite, pageType);
+  std::tie(error, ptr, doubleMapped) =
+      mmapShmFdMaybeTwice(fd.fd(), byteSize, permWrite, doubleMapped);
+  if (error) {
+    return std::make_tuple(std::move(error), Fd(), MmappedPtr(), false);
+  }
+
+  return std::make_tuple(
+      Error::kSuccess, std::move(fd), std::move(ptr), doubleMapped);
+}
+
+} // namespace
+
+Segment::Segment(Fd fd, MmappedPtr ptr, bool doubleMapped)
+    : fd_(std::move(fd)), ptr_(std::move(ptr)), doubleMapped_(doubleMapped) {}
+
+std::tuple<Error, Segment> Segment::alloc(
+    size_t byteSize,
+    bool permWrite,
+    optional<PageType> pageType,
+    bool doubleMapped) {
+  Error error;
+  Fd fd;
+  MmappedPtr ptr;
+  bool isDoubleMapped;
+
+  // Huge pages are only a hint: they may all be in use (or none may have been
+  // reserved), in which case we fall back to smaller ones, down to regular
+  // ones.
+  std::vector<PageType> hugePageTypes;
+  if (pageType.has_value() && pageType.value() == PageType::HugeTLB_1GB) {
+    hugePageTypes.push_back(PageType::HugeTLB_1GB);
+  }
+  if (pageType.has_value() && pageType.value() != PageType::Default) {
+    hugePageTypes.push_back(PageType::HugeTLB_2MB);
+  }
+  for (PageType hugePageType : hugePageTypes) {
+    if (byteSize % getHugePageSize(hugePageType) != 0) {
+      continue;
+    }
+    std::tie(error, fd) = createHugeTlbShmFd(hugePageType);
+    if (!error) {
+      std::tie(error, fd, ptr, isDoubleMapped) =
+          allocInternal(std::move(fd), byteSize, permWrite, doubleMapped);
+    }
+    if (!error) {
+      return std::make_tuple(
+          Error::kSuccess,
+          Segment(std::move(fd), std::move(ptr), isDoubleMapped));
+    }
+    TP_VLOG(6) << "Couldn't allocate a shared memory segment backed by huge "
+               << "pages of " << getHugePageSize(hugePageType)
+               << " bytes, falling back to smaller ones (" << error.what()
+               << ")";
+  }
+
+  std::tie(error, fd) = createShmFd();
+  if (error) {
+    return std::make_tuple(std::move(error), Segment());
+  }
+
+  std::tie(error, fd, ptr, isDoubleMapped) =
+      allocInternal(std::move(fd), byteSize, permWrite, doubleMapped);
   if (error) {
     return std::make_tuple(std::move(error), Segment());
   }
 
   return std::make_tuple(
-      Error::kSuccess, Segment(std::move(fd), std::move(ptr)));
+      Error::kSuccess, Segment(std::move(fd), std::move(ptr), isDoubleMapped));
 }
 
 std::tuple<Error, Segment> Segment::access(
     Fd fd,
     bool permWrite,
-    optional<PageType> pageType) {
+    optional<PageType> pageType,
+    bool doubleMapped) {
   // Load whole file. Use fstat to obtain size.
   struct stat sb;
   int ret = ::fstat(fd.fd(), &sb);
@@ -152,13 +261,55 @@ std::tuple<Error, Segment> Segment::access(
 
   Error error;
   MmappedPtr ptr;
-  std::tie(error, ptr) = mmapShmFd(fd.fd(), byteSize, permWrite, pageType);
+  bool isDoubleMapped;
+  std::tie(error, ptr, isDoubleMapped) =
+      mmapShmFdMaybeTwice(fd.fd(), byteSize, permWrite, doubleMapped);
   if (error) {
     return std::make_tuple(std::move(error), Segment());
   }
 
   return std::make_tuple(
-      Error::kSuccess, Segment(std::move(fd), std::move(ptr)));
+      Error::kSuccess, Segment(std::move(fd), std::move(ptr), isDoubleMapped));
+}
+
+Error Segment::releaseMemory() {
+  int ret = ::fallocate(
+      fd_.fd(),
+      FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+      0,
+      static_cast<off_t>(getSize()));
+  if (ret < 0) {
+    return TP_CREATE_ERROR(SystemError, "fallocate", errno);
+  }
+  return Error::kSuccess;
+}
+
+Error Segment::reacquireMemory() {
+  int ret = ::fallocate(fd_.fd(), 0, 0, static_cast<off_t>(getSize()));
+  if (ret < 0) {
+    return TP_CREATE_ERROR(SystemError, "fallocate", errno);
+  }
+  return Error::kSuccess;
+}
+
+Error Segment::prefault() {
+  // A read fault on a shared mapping that is writable maps the page writable,
+  // hence there's no need to tell read-only and writable segments apart.
+  int ret = ::madvise(ptr_.ptr(), ptr_.getLength(), MADV_POPULATE_READ);
+  if (ret == 0) {
+    return Error::kSuccess;
+  }
+  if (errno != EINVAL) {
+    return TP_CREATE_ERROR(SystemError, "madvise", errno);
+  }
+  // Older kernels don't support it, in which case we touch each page instead.
+  const size_t pageSize = static_cast<size_t>(::getpagesize());
+  const volatile uint8_t* base =
+      static_cast<const volatile uint8_t*>(ptr_.ptr());
+  for (size_t offset = 0; offset < ptr_.getLength(); offset += pageSize) {
+    (void)base[offset];
+  }
+  return Error::kSuccess;
 }
 
 } // namespace shm
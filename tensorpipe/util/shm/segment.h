@@ -35,10 +35,16 @@ namespace shm {
 /// and availability of pages of requested size.
 /// HugeTLB pages often need to be reserved at boot time and
 /// may none left by the time Segment that request one is cerated.
+/// Segments that can't get 1GB pages try 2MB ones before default ones.
 enum class PageType { Default, HugeTLB_2MB, HugeTLB_1GB };
 
+/// If <doubleMapped> is requested, the memory is mapped twice in a row, so that
+/// accessing the bytes that follow the end of the segment wraps around to its
+/// start, which allows a circular buffer to always be accessed contiguously.
+/// Like the page type this is only a hint, since it only works if the size is
+/// a multiple of the page size, hence users must check isDoubleMapped().
 class Segment {
-  Segment(Fd fd, MmappedPtr ptr);
+  Segment(Fd fd, MmappedPtr ptr, bool doubleMapped);
 
  public:
   Segment() = default;
@@ -46,12 +52,14 @@ class Segment {
   static std::tuple<Error, Segment> alloc(
       size_t byteSize,
       bool permWrite,
-      optional<PageType> pageType);
+      optional<PageType> pageType,
+      bool doubleMapped = false);
 
   static std::tuple<Error, Segment> access(
       Fd fd,
       bool permWrite,
-      optional<PageType> pageType);
+      optional<PageType> pageType,
+      bool doubleMapped = false);
 
   /// Allocate shared memory to contain an object of type T and construct it.
   ///
@@ -98,7 +106,8 @@ class Segment {
   static std::tuple<Error, Segment, TScalar*> create(
       size_t numElements,
       bool permWrite,
-      optional<PageType> pageType) {
+      optional<PageType> pageType,
+      bool doubleMapped = false) {
     static_assert(
         std::is_same<TScalar[], T>::value,
         "Only one-dimensional unbounded arrays are supported");
@@ -110,7 +119,8 @@ class Segment {
     size_t byteSize = sizeof(TScalar) * numElements;
     Error error;
     Segment segment;
-    std::tie(error, segment) = Segment::alloc(byteSize, permWrite, pageType);
+    std::tie(error, segment) =
+        Segment::alloc(byteSize, permWrite, pageType, doubleMapped);
     if (error) {
       return std::make_tuple(std::move(error), Segment(), nullptr);
     }
@@ -166,7 +176,8 @@ class Segment {
   static std::tuple<Error, Segment, TScalar*> load(
       Fd fd,
       bool permWrite,
-      optional<PageType> pageType) {
+      optional<PageType> pageType,
+      bool doubleMapped = false) {
     static_assert(
         std::is_same<TScalar[], T>::value,
         "Only one-dimensional unbounded arrays are supported");
@@ -178,7 +189,7 @@ class Segment {
     Error error;
     Segment segment;
     std::tie(error, segment) =
-        Segment::access(std::move(fd), permWrite, pageType);
+        Segment::access(std::move(fd), permWrite, pageType, doubleMapped);
     if (error) {
       return std::make_tuple(std::move(error), Segment(), nullptr);
     }
@@ -199,16 +210,38 @@ class Segment {
     return ptr_.ptr();
   }
 
+  // The size of the segment, not counting its second mapping, if any.
   size_t getSize() const {
-    return ptr_.getLength();
+    return doubleMapped_ ? ptr_.getLength() / 2 : ptr_.getLength();
+  }
+
+  bool isDoubleMapped() const {
+    return doubleMapped_;
   }
 
+  // Give the memory of the segment back to the system, for all the processes
+  // that map it, while keeping it mapped: it then reads as zeros, and must not
+  // be written to until it has been reacquired, as for segments backed by huge
+  // pages that could fail (with a SIGBUS) if none is available anymore.
+  [[nodiscard]] Error releaseMemory();
+
+  // Allocate the memory of the segment again, after it was released.
+  [[nodiscard]] Error reacquireMemory();
+
+  // Set up this process's mappings of all the pages of the segment (both of
+  // them, if it's double-mapped) ahead of time, so that the first accesses to
+  // each page don't take a fault. The pages themselves are already allocated.
+  [[nodiscard]] Error prefault();
+
  private:
   // The file descriptor of the shared memory file.
   Fd fd_;
 
   // Base pointer of mmmap'ed shared memory segment.
   MmappedPtr ptr_;
+
+  // Whether the pointer covers two consecutive mappings of the file.
+  bool doubleMapped_{false};
 };
 
 } // namespace shm